@@ -42,7 +42,36 @@ android {
       isMinifyEnabled = false
       proguardFiles(getDefaultProguardFile("proguard-android-optimize.txt"), "proguard-rules.pro")
     }
+    // Release with ThinLTO and the checked in profile, see USB_VIDEO_PGO in CMakeLists.txt.
+    create("optimized") {
+      initWith(getByName("release"))
+      signingConfig = signingConfigs.getByName("debug")
+      matchingFallbacks += "release"
+      externalNativeBuild {
+        cmake { arguments += listOf("-DUSB_VIDEO_LTO=ON", "-DUSB_VIDEO_PGO=use") }
+      }
+    }
+    // Instrumented build that PgoTrainingTest trains the profile with.
+    create("pgoTraining") {
+      initWith(getByName("release"))
+      signingConfig = signingConfigs.getByName("debug")
+      matchingFallbacks += "release"
+      externalNativeBuild {
+        cmake { arguments += listOf("-DUSB_VIDEO_LTO=ON", "-DUSB_VIDEO_PGO=generate") }
+      }
+    }
+    // Debug build that logs allocations, locks and blocking calls on the audio
+    // path's real-time threads, see RealtimeCheck.h.
+    create("rtChecks") {
+      initWith(getByName("debug"))
+      matchingFallbacks += "debug"
+      externalNativeBuild {
+        cmake { arguments += listOf("-DUSB_VIDEO_RT_CHECKS=ON") }
+      }
+    }
   }
+  // -PusbVideoTestBuildType=pgoTraining runs the instrumented tests against the training build.
+  testBuildType = (project.findProperty("usbVideoTestBuildType") as String?) ?: "debug"
   compileOptions {
     sourceCompatibility = JavaVersion.VERSION_1_8
     targetCompatibility = JavaVersion.VERSION_1_8
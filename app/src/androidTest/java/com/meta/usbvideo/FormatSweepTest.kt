@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo
+
+import android.content.Context
+import android.graphics.PixelFormat
+import android.hardware.usb.UsbConstants
+import android.hardware.usb.UsbDevice
+import android.hardware.usb.UsbManager
+import android.media.ImageReader
+import android.os.Build
+import android.os.Handler
+import android.os.HandlerThread
+import android.os.SystemClock
+import android.system.Os
+import android.system.OsConstants
+import android.util.Log
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import androidx.test.platform.app.InstrumentationRegistry
+import com.meta.usbvideo.usb.VideoFormat
+import com.meta.usbvideo.usb.VideoStreamingConnection
+import java.io.File
+import org.json.JSONArray
+import org.json.JSONObject
+import org.junit.Assume.assumeTrue
+import org.junit.Test
+import org.junit.runner.RunWith
+
+private const val TAG = "FormatSweepTest"
+
+/**
+ * Streams every format the attached camera advertises for a few seconds each, through a camera
+ * session previewing into an ImageReader, and writes FPS, drops, per-stage latency, per-thread
+ * CPU time and RSS of each run to a JSON report in the app's external files directory.
+ *
+ * Skipped when no UVC camera is attached or the app has no permission for it. Runs in the app's
+ * process, so the camera must not be streaming in the app's UI at the same time. Arguments:
+ * `sweepSeconds` (default 5) measured per format after `sweepWarmupSeconds` (default 1), e.g.
+ * `adb shell am instrument -w -e class com.meta.usbvideo.FormatSweepTest -e sweepSeconds 10 ...`,
+ * then pull the logged report path.
+ */
+@RunWith(AndroidJUnit4::class)
+class FormatSweepTest {
+
+  @Test
+  fun sweepAdvertisedFormats() {
+    val arguments = InstrumentationRegistry.getArguments()
+    val seconds = arguments.getString("sweepSeconds")?.toLongOrNull() ?: 5L
+    val warmupSeconds = arguments.getString("sweepWarmupSeconds")?.toLongOrNull() ?: 1L
+    val context = InstrumentationRegistry.getInstrumentation().targetContext
+    val usbManager = context.getSystemService(Context.USB_SERVICE) as UsbManager
+    val usbDevice = usbManager.deviceList.values.firstOrNull { it.hasVideoInterface() }
+    assumeTrue("No UVC camera attached", usbDevice != null)
+    checkNotNull(usbDevice)
+    assumeTrue("No permission for ${usbDevice.productName}", usbManager.hasPermission(usbDevice))
+    val usbDeviceConnection = checkNotNull(usbManager.openDevice(usbDevice))
+
+    val runs = JSONArray()
+    try {
+      // Parses the descriptors only; closing it would also tear down the default stream.
+      val videoStreamingConnection = VideoStreamingConnection(usbDevice, usbDeviceConnection)
+      for (videoFormat in videoStreamingConnection.videoFormats) {
+        Log.i(TAG, "Streaming $videoFormat for $seconds s")
+        runs.put(
+            sweepFormat(usbDeviceConnection.fileDescriptor, videoFormat, warmupSeconds, seconds))
+      }
+    } finally {
+      usbDeviceConnection.close()
+    }
+
+    val report =
+        JSONObject()
+            .put("device", "${Build.MANUFACTURER} ${Build.MODEL}")
+            .put("sdk", Build.VERSION.SDK_INT)
+            .put(
+                "camera",
+                JSONObject()
+                    .put("name", usbDevice.productName ?: usbDevice.deviceName)
+                    .put("vendorId", usbDevice.vendorId)
+                    .put("productId", usbDevice.productId))
+            .put("secondsPerFormat", seconds)
+            .put("warmupSeconds", warmupSeconds)
+            .put("runs", runs)
+    val reportFile = File(context.getExternalFilesDir(null), "format_sweep.json")
+    reportFile.writeText(report.toString(2))
+    Log.i(TAG, "Wrote ${runs.length()} runs to ${reportFile.absolutePath}")
+  }
+
+  private fun sweepFormat(
+      deviceFD: Int,
+      videoFormat: VideoFormat,
+      warmupSeconds: Long,
+      seconds: Long,
+  ): JSONObject {
+    val run =
+        JSONObject()
+            .put("format", videoFormat.fourccFormat)
+            .put("width", videoFormat.width)
+            .put("height", videoFormat.height)
+            .put("fps", videoFormat.fps)
+    val libuvcFrameFormat =
+        try {
+          videoFormat.toLibuvcFrameFormat().ordinal
+        } catch (e: IllegalArgumentException) {
+          return run.put("error", e.message)
+        }
+
+    val drainThread = HandlerThread("format_sweep_drain").apply { start() }
+    val imageReader =
+        ImageReader.newInstance(videoFormat.width, videoFormat.height, PixelFormat.RGBA_8888, 4)
+    imageReader.setOnImageAvailableListener(
+        { reader -> reader.acquireLatestImage()?.close() }, Handler(drainThread.looper))
+    val handle =
+        UsbVideoNativeLibrary.openCameraSessionNative(
+            deviceFD,
+            videoFormat.width,
+            videoFormat.height,
+            videoFormat.fps,
+            libuvcFrameFormat,
+            imageReader.surface,
+        )
+    try {
+      if (handle < 0) {
+        return run.put("error", "Could not open a camera session")
+      }
+      if (!UsbVideoNativeLibrary.startCameraSessionNative(handle)) {
+        return run.put("error", "Could not start the camera session")
+      }
+      val stats = checkNotNull(StreamingStats.forSession(handle))
+      SystemClock.sleep(warmupSeconds * 1000)
+
+      val startCounters = SessionCounters(stats)
+      val startThreadCpu = threadCpuTimesMs()
+      val startNs = SystemClock.elapsedRealtimeNanos()
+      var peakRssKb = 0L
+      val endNs = startNs + seconds * 1_000_000_000L
+      while (SystemClock.elapsedRealtimeNanos() < endNs) {
+        SystemClock.sleep(250)
+        peakRssKb = maxOf(peakRssKb, rssKb())
+      }
+      val elapsedSeconds = (SystemClock.elapsedRealtimeNanos() - startNs) / 1e9
+      val endCounters = SessionCounters(stats)
+      val endThreadCpu = threadCpuTimesMs()
+      val percentiles = UsbVideoNativeLibrary.cameraSessionLatencyPercentilesNative(handle)
+
+      val captured = endCounters.captured - startCounters.captured
+      val rendered = endCounters.rendered - startCounters.rendered
+      run.put("seconds", elapsedSeconds)
+          .put("framesCaptured", captured)
+          .put("framesRendered", rendered)
+          .put("captureFps", captured / elapsedSeconds)
+          .put("renderFps", rendered / elapsedSeconds)
+          .put(
+              "drops",
+              JSONObject()
+                  .put("busy", endCounters.droppedBusy - startCounters.droppedBusy)
+                  .put(
+                      "windowLock",
+                      endCounters.droppedWindowLock - startCounters.droppedWindowLock)
+                  .put(
+                      "invalidSize",
+                      endCounters.droppedInvalidSize - startCounters.droppedInvalidSize))
+          .put("decodesSkipped", endCounters.decodesSkipped - startCounters.decodesSkipped)
+          .put("framesUnchanged", endCounters.framesUnchanged - startCounters.framesUnchanged)
+          .put("latencyUs", latencyJson(percentiles))
+          .put("threadCpuMs", threadCpuJson(startThreadCpu, endThreadCpu))
+          .put("threadRoles", threadRolesJson(startCounters, endCounters))
+          .put("nativeHeapBytes", stats.nativeHeapBytes)
+          .put("rssKb", rssKb())
+          .put("peakRssKb", peakRssKb)
+      Log.i(TAG, "$videoFormat: ${UsbVideoNativeLibrary.cameraSessionStatsSummaryNative(handle)}")
+      return run
+    } finally {
+      if (handle >= 0) {
+        UsbVideoNativeLibrary.stopCameraSessionNative(handle)
+        UsbVideoNativeLibrary.closeCameraSessionNative(handle)
+      }
+      imageReader.close()
+      drainThread.quitSafely()
+    }
+  }
+
+  /** Cumulative counters of a session, which keep counting across sessions sharing the block. */
+  private class SessionCounters(stats: StreamingStats) {
+    val captured = stats.videoFramesCaptured
+    val rendered = stats.videoFramesRendered
+    val droppedBusy = stats.videoFramesDroppedBusy
+    val droppedWindowLock = stats.videoFramesDroppedWindowLock
+    val droppedInvalidSize = stats.videoFramesDroppedInvalidSize
+    val decodesSkipped = stats.videoDecodesSkipped
+    val framesUnchanged = stats.videoFramesUnchanged
+    val roleCpuUs = ThreadRole.entries.map { stats.threadCpuTimeUs(it) }
+    val roleRunDelayUs = ThreadRole.entries.map { stats.threadRunDelayUs(it) }
+    val roleWakeups = ThreadRole.entries.map { stats.threadWakeups(it) }
+    val roleInvoluntarySwitches = ThreadRole.entries.map { stats.threadInvoluntarySwitches(it) }
+  }
+
+  /** CPU time, run delay, wakeups and preemptions of each thread role during the run. */
+  private fun threadRolesJson(start: SessionCounters, end: SessionCounters): JSONObject {
+    val json = JSONObject()
+    for (role in ThreadRole.entries) {
+      val i = role.ordinal
+      json.put(
+          role.name.lowercase(),
+          JSONObject()
+              .put("cpuUs", end.roleCpuUs[i] - start.roleCpuUs[i])
+              .put("runDelayUs", end.roleRunDelayUs[i] - start.roleRunDelayUs[i])
+              .put("wakeups", end.roleWakeups[i] - start.roleWakeups[i])
+              .put(
+                  "involuntarySwitches",
+                  end.roleInvoluntarySwitches[i] - start.roleInvoluntarySwitches[i]))
+    }
+    return json
+  }
+
+  /** Stage-major p50, p95 and p99, as [UsbVideoNativeLibrary.streamingLatencyPercentilesNative]. */
+  private fun latencyJson(percentiles: LongArray): JSONObject {
+    val json = JSONObject()
+    val percentileCount = LatencyPercentile.entries.size
+    if (percentiles.size < LatencyStage.entries.size * percentileCount) {
+      return json
+    }
+    for (stage in LatencyStage.entries) {
+      val stageJson = JSONObject()
+      for (percentile in LatencyPercentile.entries) {
+        stageJson.put(
+            percentile.name.lowercase(),
+            percentiles[stage.ordinal * percentileCount + percentile.ordinal])
+      }
+      json.put(stage.name.lowercase(), stageJson)
+    }
+    return json
+  }
+
+  /** CPU time each thread spent during the run, by name, for threads that ran at all. */
+  private fun threadCpuJson(start: Map<String, Long>, end: Map<String, Long>): JSONObject {
+    val byName = mutableMapOf<String, Long>()
+    for ((key, endMs) in end) {
+      val ms = endMs - (start[key] ?: 0L)
+      if (ms > 0) {
+        val name = key.substringAfter(':')
+        byName[name] = (byName[name] ?: 0L) + ms
+      }
+    }
+    val json = JSONObject()
+    byName.entries.sortedByDescending { it.value }.forEach { json.put(it.key, it.value) }
+    return json
+  }
+
+  /** User plus system time of each thread of this process, keyed by "tid:name". */
+  private fun threadCpuTimesMs(): Map<String, Long> {
+    val msPerTick = 1000.0 / Os.sysconf(OsConstants._SC_CLK_TCK)
+    val times = mutableMapOf<String, Long>()
+    File("/proc/self/task").listFiles()?.forEach { task ->
+      val stat = runCatching { File(task, "stat").readText() }.getOrNull() ?: return@forEach
+      // The name is in parentheses and may hold spaces; utime and stime are fields 14 and 15.
+      val name = stat.substringAfter('(').substringBeforeLast(')')
+      val fields = stat.substringAfterLast(") ").split(' ')
+      val ticks = (fields.getOrNull(11)?.toLongOrNull() ?: 0L) +
+          (fields.getOrNull(12)?.toLongOrNull() ?: 0L)
+      times["${task.name}:$name"] = (ticks * msPerTick).toLong()
+    }
+    return times
+  }
+
+  private fun rssKb(): Long =
+      File("/proc/self/status")
+          .readLines()
+          .firstOrNull { it.startsWith("VmRSS:") }
+          ?.split(Regex("\\s+"))
+          ?.getOrNull(1)
+          ?.toLongOrNull() ?: 0L
+
+  private fun UsbDevice.hasVideoInterface(): Boolean =
+      deviceClass == UsbConstants.USB_CLASS_VIDEO ||
+          (0 until interfaceCount).any {
+            getInterface(it).interfaceClass == UsbConstants.USB_CLASS_VIDEO
+          }
+}
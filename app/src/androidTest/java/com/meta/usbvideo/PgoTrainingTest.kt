@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo
+
+import android.graphics.PixelFormat
+import android.media.ImageReader
+import android.os.Handler
+import android.os.HandlerThread
+import android.os.ParcelFileDescriptor
+import android.os.SystemClock
+import android.util.Log
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import androidx.test.platform.app.InstrumentationRegistry
+import java.io.File
+import org.junit.Assert.assertTrue
+import org.junit.Assume.assumeTrue
+import org.junit.Test
+import org.junit.runner.RunWith
+
+private const val TAG = "PgoTrainingTest"
+
+/**
+ * Trains the profile of a USB_VIDEO_PGO=generate build: replays every frame log in the
+ * `pgoFrameLogs` directory (default `frame_logs` in the app's external files directory) as fast as
+ * the pipeline takes frames, for `pgoSeconds` (default 10) each, then writes the profile to
+ * `usbvideo.profraw` next to the logs. Record the logs with startFrameLogNative() over the standard
+ * formats, one per format, so the profile covers each decode and conversion path.
+ *
+ * Skipped in builds that are not instrumented or without frame logs. Then merge and check in the
+ * profile, see USB_VIDEO_PGO in CMakeLists.txt.
+ */
+@RunWith(AndroidJUnit4::class)
+class PgoTrainingTest {
+
+  @Test
+  fun replayFrameLogs() {
+    val arguments = InstrumentationRegistry.getArguments()
+    val seconds = arguments.getString("pgoSeconds")?.toLongOrNull() ?: 10L
+    val context = InstrumentationRegistry.getInstrumentation().targetContext
+    val logDir =
+        arguments.getString("pgoFrameLogs")?.let { File(it) }
+            ?: File(context.getExternalFilesDir(null), "frame_logs")
+    val logs = logDir.listFiles()?.filter { it.isFile && it.extension != "profraw" }.orEmpty()
+    assumeTrue("No frame logs in $logDir", logs.isNotEmpty())
+    val profile = File(logDir, "usbvideo.profraw")
+    // Writing a profile only succeeds in an instrumented build; check before replaying.
+    assumeTrue(
+        "Not a USB_VIDEO_PGO=generate build",
+        UsbVideoNativeLibrary.writeProfileNative(profile.absolutePath))
+
+    for (log in logs.sortedBy { it.name }) {
+      Log.i(TAG, "Replaying ${log.name} for $seconds s")
+      replay(log, seconds)
+    }
+    assertTrue(UsbVideoNativeLibrary.writeProfileNative(profile.absolutePath))
+    Log.i(TAG, "Wrote ${profile.absolutePath}")
+  }
+
+  private fun replay(log: File, seconds: Long) {
+    val drainThread = HandlerThread("pgo_training_drain").apply { start() }
+    // The replayed size is only known from the log; the preview scales into the reader.
+    val imageReader = ImageReader.newInstance(1280, 720, PixelFormat.RGBA_8888, 4)
+    imageReader.setOnImageAvailableListener(
+        { reader -> reader.acquireLatestImage()?.close() }, Handler(drainThread.looper))
+    val handle =
+        ParcelFileDescriptor.open(log, ParcelFileDescriptor.MODE_READ_ONLY).use { pfd ->
+          UsbVideoNativeLibrary.openReplaySessionNative(pfd.fd, false, 0, imageReader.surface)
+        }
+    try {
+      assertTrue("Could not open a replay session for ${log.name}", handle >= 0)
+      assertTrue(UsbVideoNativeLibrary.startCameraSessionNative(handle))
+      SystemClock.sleep(seconds * 1000)
+      Log.i(TAG, "${log.name}: ${UsbVideoNativeLibrary.cameraSessionStatsSummaryNative(handle)}")
+    } finally {
+      if (handle >= 0) {
+        UsbVideoNativeLibrary.stopCameraSessionNative(handle)
+        UsbVideoNativeLibrary.closeCameraSessionNative(handle)
+      }
+      imageReader.close()
+      drainThread.quitSafely()
+    }
+  }
+}
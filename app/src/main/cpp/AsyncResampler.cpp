@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AsyncResampler.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Per-channel dot product of the filter with kTaps frames at src.
+float dotProduct(const float* src, const float* taps) {
+#if defined(__ARM_NEON)
+  float32x4_t sum = vmulq_f32(vld1q_f32(src), vld1q_f32(taps));
+  for (uint32_t k = 4; k < AsyncResampler::kTaps; k += 4) {
+    sum = vmlaq_f32(sum, vld1q_f32(src + k), vld1q_f32(taps + k));
+  }
+#if defined(__aarch64__)
+  return vaddvq_f32(sum);
+#else
+  float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+  return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+#else
+  float sum = 0;
+  for (uint32_t k = 0; k < AsyncResampler::kTaps; k++) {
+    sum += src[k] * taps[k];
+  }
+  return sum;
+#endif
+}
+
+// Filter taps for a fractional position, between two phase rows.
+void interpolateTaps(const float* phase, const float* nextPhase, float fraction, float* taps) {
+#if defined(__ARM_NEON)
+  for (uint32_t k = 0; k < AsyncResampler::kTaps; k += 4) {
+    float32x4_t a = vld1q_f32(phase + k);
+    float32x4_t b = vld1q_f32(nextPhase + k);
+    vst1q_f32(taps + k, vmlaq_n_f32(a, vsubq_f32(b, a), fraction));
+  }
+#else
+  for (uint32_t k = 0; k < AsyncResampler::kTaps; k++) {
+    taps[k] = phase[k] + (nextPhase[k] - phase[k]) * fraction;
+  }
+#endif
+}
+
+} // namespace
+
+void AsyncResampler::init(
+    uint32_t channelCount,
+    uint32_t inputRate,
+    uint32_t outputRate,
+    size_t maxInputFrames) {
+  channelCount_ = channelCount;
+  outputRate_ = outputRate;
+  nominalRatio_ = outputRate > 0 ? (double)inputRate / outputRate : 1.0;
+  // Blackman windowed sinc, cut off a little below the lower of the two
+  // Nyquist frequencies.
+  const double kCutoff = 0.9 * std::min(1.0, 1.0 / nominalRatio_);
+  coefficients_.resize((kPhases + 1) * kTaps);
+  for (uint32_t p = 0; p <= kPhases; p++) {
+    double sum = 0;
+    for (uint32_t k = 0; k < kTaps; k++) {
+      // Distance from the output position, which lies between taps
+      // kTaps / 2 - 1 and kTaps / 2.
+      double x = (double)k - (kTaps / 2 - 1) - (double)p / kPhases;
+      double sinc = x == 0 ? 1.0 : std::sin(M_PI * kCutoff * x) / (M_PI * kCutoff * x);
+      double w = (x + kTaps / 2.0) / kTaps;
+      double window = 0.42 - 0.5 * std::cos(2 * M_PI * w) + 0.08 * std::cos(4 * M_PI * w);
+      coefficients_[p * kTaps + k] = sinc * window;
+      sum += sinc * window;
+    }
+    // Unity gain at DC for every phase.
+    for (uint32_t k = 0; k < kTaps; k++) {
+      coefficients_[p * kTaps + k] /= sum;
+    }
+  }
+  history_.assign(channelCount, std::vector<float>(kTaps + maxInputFrames + 1));
+  reset();
+}
+
+void AsyncResampler::reset() {
+  for (std::vector<float>& channel : history_) {
+    std::fill(channel.begin(), channel.end(), 0.0f);
+  }
+  historyFrames_ = kTaps - 1;
+  position_ = 0;
+  firstInputNs_ = -1;
+  inputFrames_ = 0;
+  firstOutputNs_ = -1;
+  fillAverage_ = -1;
+  sourceRate_ = 0;
+}
+
+void AsyncResampler::recordInput(size_t frames, int64_t nowNs) {
+  if (firstInputNs_ < 0) {
+    // Rate is counted from the end of the first transfer onwards.
+    firstInputNs_ = nowNs;
+    return;
+  }
+  inputFrames_ += frames;
+  lastInputNs_ = nowNs;
+}
+
+void AsyncResampler::recordOutputTimestamp(int64_t framePosition, int64_t timeNs) {
+  if (firstOutputNs_ < 0) {
+    firstOutputNs_ = timeNs;
+    firstOutputFrame_ = framePosition;
+  }
+  lastOutputNs_ = timeNs;
+  lastOutputFrame_ = framePosition;
+}
+
+void AsyncResampler::recordFill(size_t frames) {
+  // About half a second time constant at typical transfer rates.
+  constexpr double kSmoothing = 0.01;
+  fillAverage_ = fillAverage_ < 0 ? frames : fillAverage_ + (frames - fillAverage_) * kSmoothing;
+}
+
+double AsyncResampler::measuredRatio() const {
+  int64_t inputWindow = lastInputNs_ - firstInputNs_;
+  int64_t outputWindow = lastOutputNs_ - firstOutputNs_;
+  if (firstInputNs_ < 0 || firstOutputNs_ < 0 || inputWindow < kMinRateWindowNs ||
+      outputWindow < kMinRateWindowNs || lastOutputFrame_ <= firstOutputFrame_) {
+    return nominalRatio_;
+  }
+  double inputRate = sourceRate_ > 0 ? sourceRate_ : inputFrames_ / (inputWindow / 1e9);
+  double outputRate = (lastOutputFrame_ - firstOutputFrame_) / (outputWindow / 1e9);
+  return inputRate / outputRate;
+}
+
+double AsyncResampler::ratio() const {
+  double ratio = measuredRatio();
+  if (fillAverage_ >= 0 && outputRate_ > 0) {
+    // A fuller buffer consumes input faster, an emptier one slower.
+    ratio += nominalRatio_ * (fillAverage_ - (double)targetFill_) /
+        (outputRate_ * kFillCorrectionTime);
+  }
+  return std::clamp(
+      ratio, nominalRatio_ * (1.0 - kMaxDeviation), nominalRatio_ * (1.0 + kMaxDeviation));
+}
+
+size_t AsyncResampler::process(const float* input, size_t inputFrames, float* output) {
+  for (uint32_t c = 0; c < channelCount_; c++) {
+    float* channel = history_[c].data() + historyFrames_;
+    for (size_t i = 0; i < inputFrames; i++) {
+      channel[i] = input[i * channelCount_ + c];
+    }
+  }
+  historyFrames_ += inputFrames;
+
+  double step = ratio();
+  size_t outputFrames = 0;
+  float taps[kTaps];
+  while ((size_t)position_ + kTaps <= historyFrames_) {
+    size_t start = (size_t)position_;
+    double phase = (position_ - start) * kPhases;
+    uint32_t row = std::min<uint32_t>((uint32_t)phase, kPhases - 1);
+    interpolateTaps(
+        &coefficients_[row * kTaps],
+        &coefficients_[(row + 1) * kTaps],
+        (float)(phase - row),
+        taps);
+    for (uint32_t c = 0; c < channelCount_; c++) {
+      output[outputFrames * channelCount_ + c] = dotProduct(history_[c].data() + start, taps);
+    }
+    outputFrames++;
+    position_ += step;
+  }
+
+  // Keep the frames the next output still needs.
+  size_t consumed = std::min<size_t>((size_t)position_, historyFrames_);
+  for (std::vector<float>& channel : history_) {
+    std::copy(channel.begin() + consumed, channel.begin() + historyFrames_, channel.begin());
+  }
+  historyFrames_ -= consumed;
+  position_ -= consumed;
+  return outputFrames;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Asynchronous sample rate converter that absorbs the drift between the USB
+// device's audio clock and the Android output clock, and converts between
+// their nominal rates when the output runs at its native rate instead.
+//
+// The conversion ratio is estimated from two sources: the long-term rates of
+// USB input and AAudio output, measured against CLOCK_MONOTONIC, and the
+// ring buffer fill level, whose distance from the target is drained over
+// about kFillCorrectionTime. The buffer then stays at the target latency
+// instead of underrunning or overflowing with a click every few minutes.
+//
+// Resampling is a windowed sinc polyphase filter with coefficients linearly
+// interpolated between phases, computed on interleaved float frames. The
+// per-frame taps run as NEON multiply-accumulates where available.
+//
+// Not thread safe; everything runs on the USB event thread.
+class AsyncResampler final {
+ public:
+  static constexpr uint32_t kTaps = 16;
+  static constexpr uint32_t kPhases = 64;
+
+  void init(uint32_t channelCount, uint32_t inputRate, uint32_t outputRate, size_t maxInputFrames);
+  // Forgets the rate measurements and the filter history.
+  void reset();
+
+  void setTargetFill(size_t frames) {
+    targetFill_ = frames;
+  }
+
+  // Frames received from USB at nowNs.
+  void recordInput(size_t frames, int64_t nowNs);
+  // An AAudioStream_getTimestamp() result on CLOCK_MONOTONIC.
+  void recordOutputTimestamp(int64_t framePosition, int64_t timeNs);
+  // Ring buffer fill after a write, in frames.
+  void recordFill(size_t frames);
+  // The device's own rate, from an explicit feedback endpoint. Taken over
+  // the rate measured from the USB input once the output rate is known.
+  void recordSourceRate(double rate) {
+    sourceRate_ = rate;
+  }
+
+  // Input frames consumed per output frame.
+  double ratio() const;
+  double nominalRatio() const {
+    return nominalRatio_;
+  }
+  double fillAverage() const {
+    return fillAverage_;
+  }
+
+  // Upper bound on the frames process() produces from inputFrames.
+  size_t maxOutputFrames(size_t inputFrames) const {
+    double minRatio = nominalRatio_ * (1.0 - kMaxDeviation);
+    return (size_t)std::ceil(inputFrames / minRatio) + 2;
+  }
+  // Consumes every input frame; returns the number of frames written.
+  size_t process(const float* input, size_t inputFrames, float* output);
+
+ private:
+  // Largest correction, well above the drift of real crystals.
+  static constexpr double kMaxDeviation = 0.002;
+  static constexpr double kFillCorrectionTime = 10.0; // seconds
+  // Rates are trusted once measured over this long.
+  static constexpr int64_t kMinRateWindowNs = 2'000'000'000;
+
+  uint32_t channelCount_{};
+  uint32_t outputRate_{};
+  // Input over output sample rate, before drift.
+  double nominalRatio_{1.0};
+  size_t targetFill_{};
+  // kPhases + 1 rows of kTaps, so phase p + 1 always exists.
+  std::vector<float> coefficients_{};
+  // Planar, kTaps - 1 frames of history followed by new input.
+  std::vector<std::vector<float>> history_{};
+  size_t historyFrames_{};
+  double position_{};
+
+  double sourceRate_{};
+  int64_t firstInputNs_{-1};
+  int64_t lastInputNs_{};
+  uint64_t inputFrames_{};
+  int64_t firstOutputNs_{-1};
+  int64_t firstOutputFrame_{};
+  int64_t lastOutputNs_{};
+  int64_t lastOutputFrame_{};
+  double fillAverage_{-1};
+
+  double measuredRatio() const;
+};
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "AudioConcealer.h"
+
+#include <algorithm>
+#include <cstring>
+
+void AudioConcealer::init(PcmEncoding encoding, uint32_t channels, uint32_t sampleRate) {
+  toFloat_.init(encoding, PcmEncoding::FLOAT);
+  fromFloat_.init(PcmEncoding::FLOAT, encoding);
+  channels_ = std::max<uint32_t>(channels, 1);
+  bytesPerFrame_ = channels_ * PcmConverter::bytesPerSample(encoding);
+  historyCapacity_ = std::max<size_t>((size_t)sampleRate * kHistoryMs / 1000, 1);
+  fadeOutFrames_ = std::max<size_t>((size_t)sampleRate * kFadeOutMs / 1000, 1);
+  crossfadeFrames_ = std::max<size_t>((size_t)sampleRate * kCrossfadeMs / 1000, 1);
+  history_.assign(historyCapacity_ * channels_, 0.0f);
+  scratch_.assign(kChunkFrames * channels_, 0.0f);
+  reset();
+}
+
+void AudioConcealer::reset() {
+  historyFrames_ = 0;
+  concealing_ = false;
+  concealedFrames_ = 0;
+  crossfadeDone_ = crossfadeFrames_;
+}
+
+float AudioConcealer::concealedSample(size_t frame, uint32_t channel) const {
+  if (historyFrames_ == 0 || frame >= fadeOutFrames_) {
+    return 0.0f;
+  }
+  // Back and forth through the history, starting at its last frame.
+  size_t position = frame % (2 * historyFrames_);
+  size_t index = position < historyFrames_ ? historyFrames_ - 1 - position
+                                           : position - historyFrames_;
+  float gain = 1.0f - (float)frame / fadeOutFrames_;
+  return history_[index * channels_ + channel] * gain;
+}
+
+void AudioConcealer::played(uint8_t* data, size_t frames) {
+  if (concealing_) {
+    concealing_ = false;
+    crossfadeDone_ = 0;
+  }
+  size_t crossfaded = 0;
+  while (crossfadeDone_ < crossfadeFrames_ && crossfaded < frames) {
+    size_t chunk = std::min({kChunkFrames, frames - crossfaded, crossfadeFrames_ - crossfadeDone_});
+    uint8_t* chunkData = data + crossfaded * bytesPerFrame_;
+    float* samples = scratch_.data();
+    toFloat_.convert(chunkData, reinterpret_cast<uint8_t*>(samples), chunk * channels_);
+    for (size_t i = 0; i < chunk; i++) {
+      float gain = (float)(crossfadeDone_ + i + 1) / crossfadeFrames_;
+      for (uint32_t c = 0; c < channels_; c++) {
+        float concealed = concealedSample(concealedFrames_ + i, c);
+        float& sample = samples[i * channels_ + c];
+        sample = sample * gain + concealed * (1.0f - gain);
+      }
+    }
+    fromFloat_.convert(reinterpret_cast<const uint8_t*>(samples), chunkData, chunk * channels_);
+    crossfaded += chunk;
+    crossfadeDone_ += chunk;
+    concealedFrames_ += chunk;
+  }
+  // The concealment still fading in needs the history it started from.
+  if (crossfadeDone_ >= crossfadeFrames_) {
+    remember(data, frames);
+  }
+}
+
+void AudioConcealer::conceal(uint8_t* data, size_t frames) {
+  if (!concealing_) {
+    concealing_ = true;
+    concealedFrames_ = 0;
+    crossfadeDone_ = crossfadeFrames_;
+  }
+  size_t done = 0;
+  while (done < frames && concealedFrames_ < fadeOutFrames_ && historyFrames_ > 0) {
+    size_t chunk = std::min({kChunkFrames, frames - done, fadeOutFrames_ - concealedFrames_});
+    float* samples = scratch_.data();
+    for (size_t i = 0; i < chunk; i++) {
+      for (uint32_t c = 0; c < channels_; c++) {
+        samples[i * channels_ + c] = concealedSample(concealedFrames_ + i, c);
+      }
+    }
+    fromFloat_.convert(
+        reinterpret_cast<const uint8_t*>(samples), data + done * bytesPerFrame_, chunk * channels_);
+    done += chunk;
+    concealedFrames_ += chunk;
+  }
+  // Silence in every encoding.
+  memset(data + done * bytesPerFrame_, 0, (frames - done) * bytesPerFrame_);
+  concealedFrames_ += frames - done;
+}
+
+void AudioConcealer::remember(const uint8_t* data, size_t frames) {
+  size_t kept = std::min(frames, historyCapacity_);
+  size_t retained = std::min(historyFrames_, historyCapacity_ - kept);
+  if (retained > 0) {
+    memmove(
+        history_.data(),
+        history_.data() + (historyFrames_ - retained) * channels_,
+        retained * channels_ * sizeof(float));
+  }
+  toFloat_.convert(
+      data + (frames - kept) * bytesPerFrame_,
+      reinterpret_cast<uint8_t*>(history_.data() + retained * channels_),
+      kept * channels_);
+  historyFrames_ = retained + kept;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PcmConverter.h"
+
+// Fills gaps in a stream of interleaved frames. The frames before a gap play
+// again backwards, so the first concealed frame repeats the last real one,
+// while fading out to silence; the audio after the gap crossfades in from the
+// concealment. Frames of any PcmEncoding go through float for the mixing.
+// Not thread safe.
+class AudioConcealer final {
+ public:
+  static constexpr uint32_t kHistoryMs = 5;
+  static constexpr uint32_t kFadeOutMs = 10;
+  static constexpr uint32_t kCrossfadeMs = 2;
+
+  void init(PcmEncoding encoding, uint32_t channels, uint32_t sampleRate);
+  // Forgets the audio played so far.
+  void reset();
+
+  // After frames of real audio were written to data, which crossfades them
+  // in after a gap.
+  void played(uint8_t* data, size_t frames);
+  // Writes frames concealed frames to data.
+  void conceal(uint8_t* data, size_t frames);
+
+ private:
+  static constexpr size_t kChunkFrames = 256;
+
+  PcmConverter toFloat_{};
+  PcmConverter fromFloat_{};
+  uint32_t channels_{};
+  size_t bytesPerFrame_{};
+  size_t fadeOutFrames_{};
+  size_t crossfadeFrames_{};
+  // The latest frames played, oldest first.
+  std::vector<float> history_{};
+  size_t historyCapacity_{};
+  size_t historyFrames_{};
+  std::vector<float> scratch_{};
+  bool concealing_{false};
+  // Frames since the gap began, to continue the concealment into the crossfade.
+  size_t concealedFrames_{};
+  size_t crossfadeDone_{};
+
+  // Concealed sample of channel, frame frames into the gap.
+  float concealedSample(size_t frame, uint32_t channel) const;
+  void remember(const uint8_t* data, size_t frames);
+};
@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "AudioGainStage.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <cmath>
+
+namespace {
+
+constexpr size_t kLanes = 16;
+constexpr float kQ15Scale = 1.0f / 32768.0f;
+constexpr float kKneeRange = 1.0f - AudioGainStage::kSoftClipKnee;
+
+// Gains of one block by channel, and the meters they feed.
+struct Block {
+  uint32_t channels;
+  bool softClip;
+  const float* gain;
+  const float* step;
+  const float* low;
+  const float* high;
+  float* peak;
+  float* sumSquares;
+  uint64_t* overFullScale;
+};
+
+float loadSample(const float* sample) {
+  return *sample;
+}
+
+float loadSample(const int16_t* sample) {
+  return *sample * kQ15Scale;
+}
+
+void storeSample(float value, float* sample) {
+  *sample = value;
+}
+
+void storeSample(float value, int16_t* sample) {
+  *sample = (int16_t)std::clamp(value * 32768.0f, -32768.0f, 32767.0f);
+}
+
+float softClip(float value) {
+  float magnitude = std::fabs(value);
+  if (magnitude <= AudioGainStage::kSoftClipKnee) {
+    return value;
+  }
+  float over = (magnitude - AudioGainStage::kSoftClipKnee) / kKneeRange;
+  return std::copysign(
+      AudioGainStage::kSoftClipKnee + kKneeRange * over / (1.0f + over), value);
+}
+
+// Sample sampleIndex of the block is frame sampleIndex / channels, which
+// gets the channel's gain ramped that many frames and one more.
+template <typename Sample>
+void processScalar(Sample* data, size_t samples, size_t sampleIndex, const Block& block) {
+  uint32_t channel = sampleIndex % block.channels;
+  size_t frame = sampleIndex / block.channels;
+  for (size_t i = 0; i < samples; i++) {
+    float gain = std::clamp(
+        block.gain[channel] + block.step[channel] * (frame + 1),
+        block.low[channel],
+        block.high[channel]);
+    float value = loadSample(data + i) * gain;
+    *block.overFullScale += std::fabs(value) > 1.0f;
+    if (block.softClip) {
+      value = softClip(value);
+    }
+    block.peak[channel] = std::max(block.peak[channel], std::fabs(value));
+    block.sumSquares[channel] += value * value;
+    storeSample(value, data + i);
+    if (++channel == block.channels) {
+      channel = 0;
+      frame++;
+    }
+  }
+}
+
+#if defined(__ARM_NEON)
+
+void loadLanes(const float* src, float32x4_t* lanes) {
+  for (size_t k = 0; k < 4; k++) {
+    lanes[k] = vld1q_f32(src + 4 * k);
+  }
+}
+
+void loadLanes(const int16_t* src, float32x4_t* lanes) {
+  for (size_t k = 0; k < 4; k += 2) {
+    int16x8_t s = vld1q_s16(src + 4 * k);
+    lanes[k] = vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(s)), 15);
+    lanes[k + 1] = vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(s)), 15);
+  }
+}
+
+void storeLanes(const float32x4_t* lanes, float* dst) {
+  for (size_t k = 0; k < 4; k++) {
+    vst1q_f32(dst + 4 * k, lanes[k]);
+  }
+}
+
+void storeLanes(const float32x4_t* lanes, int16_t* dst) {
+  for (size_t k = 0; k < 4; k += 2) {
+    // Saturating, like PcmConverter's float to Q15.
+    int16x4_t low = vqmovn_s32(vcvtq_n_s32_f32(lanes[k], 15));
+    int16x4_t high = vqmovn_s32(vcvtq_n_s32_f32(lanes[k + 1], 15));
+    vst1q_s16(dst + 4 * k, vcombine_s16(low, high));
+  }
+}
+
+float32x4_t divide(float32x4_t numerator, float32x4_t denominator) {
+#if defined(__aarch64__)
+  return vdivq_f32(numerator, denominator);
+#else
+  float32x4_t reciprocal = vrecpeq_f32(denominator);
+  reciprocal = vmulq_f32(vrecpsq_f32(denominator, reciprocal), reciprocal);
+  reciprocal = vmulq_f32(vrecpsq_f32(denominator, reciprocal), reciprocal);
+  return vmulq_f32(numerator, reciprocal);
+#endif
+}
+
+float32x4_t softClip(float32x4_t value) {
+  float32x4_t knee = vdupq_n_f32(AudioGainStage::kSoftClipKnee);
+  float32x4_t magnitude = vabsq_f32(value);
+  // Zero below the knee, which leaves those samples as they are.
+  float32x4_t over =
+      vmulq_n_f32(vmaxq_f32(vsubq_f32(magnitude, knee), vdupq_n_f32(0.0f)), 1.0f / kKneeRange);
+  float32x4_t bent = vmlaq_n_f32(
+      vminq_f32(magnitude, knee), divide(over, vaddq_f32(over, vdupq_n_f32(1.0f))), kKneeRange);
+  // The magnitude with the sign bit of value.
+  return vbslq_f32(vdupq_n_u32(0x80000000u), value, bent);
+}
+
+// Whole iterations of kLanes samples, with channels dividing kLanes so
+// every lane keeps its channel. Returns the samples processed.
+template <typename Sample>
+size_t processNeon(Sample* data, size_t samples, size_t sampleIndex, const Block& block) {
+  if (kLanes % block.channels != 0 || samples < kLanes) {
+    return 0;
+  }
+  float gain[kLanes];
+  float step[kLanes];
+  float low[kLanes];
+  float high[kLanes];
+  uint32_t channelOf[kLanes];
+  size_t framesPerIteration = kLanes / block.channels;
+  for (size_t j = 0; j < kLanes; j++) {
+    uint32_t c = (sampleIndex + j) % block.channels;
+    size_t frame = (sampleIndex + j) / block.channels;
+    channelOf[j] = c;
+    gain[j] = block.gain[c] + block.step[c] * (frame + 1);
+    step[j] = block.step[c] * framesPerIteration;
+    low[j] = block.low[c];
+    high[j] = block.high[c];
+  }
+  float32x4_t gains[4], steps[4], lows[4], highs[4], peaks[4], sumSquares[4];
+  for (size_t k = 0; k < 4; k++) {
+    gains[k] = vld1q_f32(gain + 4 * k);
+    steps[k] = vld1q_f32(step + 4 * k);
+    lows[k] = vld1q_f32(low + 4 * k);
+    highs[k] = vld1q_f32(high + 4 * k);
+    peaks[k] = vdupq_n_f32(0.0f);
+    sumSquares[k] = vdupq_n_f32(0.0f);
+  }
+  float32x4_t fullScale = vdupq_n_f32(1.0f);
+  uint32x4_t overFullScale = vdupq_n_u32(0);
+  size_t i = 0;
+  for (; i + kLanes <= samples; i += kLanes) {
+    float32x4_t values[4];
+    loadLanes(data + i, values);
+    for (size_t k = 0; k < 4; k++) {
+      float32x4_t g = vminq_f32(vmaxq_f32(gains[k], lows[k]), highs[k]);
+      float32x4_t v = vmulq_f32(values[k], g);
+      // All ones where over, which subtracts one.
+      overFullScale = vsubq_u32(overFullScale, vcgtq_f32(vabsq_f32(v), fullScale));
+      if (block.softClip) {
+        v = softClip(v);
+      }
+      peaks[k] = vmaxq_f32(peaks[k], vabsq_f32(v));
+      sumSquares[k] = vmlaq_f32(sumSquares[k], v, v);
+      values[k] = v;
+      gains[k] = vaddq_f32(gains[k], steps[k]);
+    }
+    storeLanes(values, data + i);
+  }
+  float peak[kLanes];
+  float sumSquare[kLanes];
+  uint32_t over[4];
+  for (size_t k = 0; k < 4; k++) {
+    vst1q_f32(peak + 4 * k, peaks[k]);
+    vst1q_f32(sumSquare + 4 * k, sumSquares[k]);
+  }
+  vst1q_u32(over, overFullScale);
+  for (size_t j = 0; j < kLanes; j++) {
+    uint32_t c = channelOf[j];
+    block.peak[c] = std::max(block.peak[c], peak[j]);
+    block.sumSquares[c] += sumSquare[j];
+  }
+  *block.overFullScale += over[0] + over[1] + over[2] + over[3];
+  return i;
+}
+
+#endif
+
+} // namespace
+
+AudioGainStage::AudioGainStage() {
+  for (std::atomic<float>& gain : gains_) {
+    gain.store(1.0f, std::memory_order_relaxed);
+  }
+}
+
+void AudioGainStage::init(PcmEncoding encoding, uint32_t channels, uint32_t sampleRate) {
+  encoding_ = encoding;
+  supported_ = (encoding == PcmEncoding::I16 || encoding == PcmEncoding::FLOAT) &&
+      channels >= 1 && channels <= kMaxChannels && sampleRate > 0;
+  channels_ = std::clamp<uint32_t>(channels, 1, kMaxChannels);
+  sampleBytes_ = PcmConverter::bytesPerSample(encoding);
+  sampleRate = std::max<uint32_t>(sampleRate, 1);
+  rampFrames_ = std::max<uint32_t>(sampleRate * kRampMs / 1000, 1);
+  peakFallPerFrame_ = std::pow(10.0f, -kPeakFallDbPerSecond / 20.0f / sampleRate);
+  rmsFramesConstant_ = (float)sampleRate * kRmsWindowMs / 1000.0f;
+  gain_.fill(1.0f);
+  target_.fill(1.0f);
+  step_.fill(0.0f);
+  rampLow_.fill(1.0f);
+  rampHigh_.fill(1.0f);
+  rampFramesLeft_ = 0;
+  peak_.fill(0.0f);
+  meanSquare_.fill(0.0f);
+  overFullScale_ = 0;
+  active_ = false;
+  appliedEnabled_ = false;
+  appliedRevision_ = revision_.load(std::memory_order_acquire) - 1;
+}
+
+void AudioGainStage::setEnabled(bool enabled) {
+  enabled_.store(enabled, std::memory_order_relaxed);
+  revision_.fetch_add(1, std::memory_order_release);
+}
+
+void AudioGainStage::setGain(uint32_t channel, float gain) {
+  // Also NaN to zero.
+  gain = gain > 0.0f ? std::min(gain, kMaxGain) : 0.0f;
+  for (uint32_t c = 0; c < kMaxChannels; c++) {
+    if (channel == kAllChannels || channel == c) {
+      gains_[c].store(gain, std::memory_order_relaxed);
+    }
+  }
+  revision_.fetch_add(1, std::memory_order_release);
+}
+
+void AudioGainStage::setMuted(bool muted) {
+  muted_.store(muted, std::memory_order_relaxed);
+  revision_.fetch_add(1, std::memory_order_release);
+}
+
+void AudioGainStage::setSoftClip(bool softClip) {
+  softClip_.store(softClip, std::memory_order_relaxed);
+  revision_.fetch_add(1, std::memory_order_release);
+}
+
+float AudioGainStage::rms(uint32_t channel) const {
+  return channel < channels_ ? std::sqrt(meanSquare_[channel]) : 0.0f;
+}
+
+bool AudioGainStage::prepare() {
+  if (!supported_) {
+    return false;
+  }
+  uint32_t revision = revision_.load(std::memory_order_acquire);
+  if (revision != appliedRevision_) {
+    appliedRevision_ = revision;
+    appliedEnabled_ = enabled_.load(std::memory_order_relaxed);
+    bool muted = muted_.load(std::memory_order_relaxed);
+    applySoftClip_ = appliedEnabled_ && softClip_.load(std::memory_order_relaxed);
+    bool ramp = false;
+    for (uint32_t c = 0; c < channels_; c++) {
+      target_[c] = !appliedEnabled_ ? 1.0f
+          : muted                   ? 0.0f
+                                    : gains_[c].load(std::memory_order_relaxed);
+      ramp |= target_[c] != gain_[c];
+    }
+    // From wherever the previous ramp got to.
+    rampFramesLeft_ = ramp ? rampFrames_ : 0;
+    for (uint32_t c = 0; c < channels_; c++) {
+      step_[c] = (target_[c] - gain_[c]) / rampFrames_;
+      rampLow_[c] = std::min(gain_[c], target_[c]);
+      rampHigh_[c] = std::max(gain_[c], target_[c]);
+    }
+    active_ = appliedEnabled_ || rampFramesLeft_ > 0;
+    if (!active_) {
+      peak_.fill(0.0f);
+      meanSquare_.fill(0.0f);
+    }
+  }
+  if (!active_) {
+    return false;
+  }
+  blockPeak_.fill(0.0f);
+  blockSumSquares_.fill(0.0f);
+  return true;
+}
+
+void AudioGainStage::processSamples(uint8_t* data, size_t samples, size_t sampleIndex) {
+  Block block{
+      .channels = channels_,
+      .softClip = applySoftClip_,
+      .gain = gain_.data(),
+      .step = step_.data(),
+      .low = rampLow_.data(),
+      .high = rampHigh_.data(),
+      .peak = blockPeak_.data(),
+      .sumSquares = blockSumSquares_.data(),
+      .overFullScale = &overFullScale_,
+  };
+  size_t done = 0;
+  if (encoding_ == PcmEncoding::FLOAT) {
+    float* floats = reinterpret_cast<float*>(data);
+#if defined(__ARM_NEON)
+    done = processNeon(floats, samples, sampleIndex, block);
+#endif
+    processScalar(floats + done, samples - done, sampleIndex + done, block);
+  } else {
+    int16_t* shorts = reinterpret_cast<int16_t*>(data);
+#if defined(__ARM_NEON)
+    done = processNeon(shorts, samples, sampleIndex, block);
+#endif
+    processScalar(shorts + done, samples - done, sampleIndex + done, block);
+  }
+}
+
+void AudioGainStage::finish(size_t frames) {
+  if (rampFramesLeft_ > 0) {
+    uint32_t ramped = (uint32_t)std::min<size_t>(frames, rampFramesLeft_);
+    rampFramesLeft_ -= ramped;
+    for (uint32_t c = 0; c < channels_; c++) {
+      gain_[c] = rampFramesLeft_ == 0
+          ? target_[c]
+          : std::clamp(gain_[c] + step_[c] * ramped, rampLow_[c], rampHigh_[c]);
+      if (rampFramesLeft_ == 0) {
+        step_[c] = 0.0f;
+        rampLow_[c] = rampHigh_[c] = target_[c];
+      }
+    }
+  }
+  if (frames > 0) {
+    float fall = std::pow(peakFallPerFrame_, (float)frames);
+    float weight = 1.0f - std::exp(-(float)frames / rmsFramesConstant_);
+    for (uint32_t c = 0; c < channels_; c++) {
+      peak_[c] = std::max(blockPeak_[c], peak_[c] * fall);
+      meanSquare_[c] += (blockSumSquares_[c] / frames - meanSquare_[c]) * weight;
+    }
+  }
+  // Bypassed from the next block once a disable has ramped back to unity.
+  if (!appliedEnabled_ && rampFramesLeft_ == 0) {
+    active_ = false;
+    peak_.fill(0.0f);
+    meanSquare_.fill(0.0f);
+  }
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "PcmConverter.h"
+
+// Optional processing of the audio written into the playback ring, in place
+// and in the ring's encoding: a gain per channel, muting, soft clipping, and
+// peak and RMS metering of what comes out. Gain and mute changes ramp over
+// kRampMs so they do not click. I16 and FLOAT have NEON kernels for 1, 2, 4,
+// 8 and 16 channels, 16 samples per iteration; other encodings are left
+// alone.
+//
+// The setters may be called from any thread and take effect at the next
+// process(); process() and the meter readers belong to the thread writing the
+// ring.
+class AudioGainStage final {
+ public:
+  static constexpr uint32_t kMaxChannels = 32;
+  static constexpr uint32_t kAllChannels = UINT32_MAX;
+  static constexpr float kMaxGain = 16.0f; // +24 dB
+  static constexpr uint32_t kRampMs = 20;
+  // Soft clipping leaves samples below the knee alone and bends the rest
+  // towards full scale, which they approach but never reach.
+  static constexpr float kSoftClipKnee = 0.75f;
+  // Meter ballistics: the peak falls by this much a second and the RMS is
+  // exponentially weighted with this time constant.
+  static constexpr float kPeakFallDbPerSecond = 20.0f;
+  static constexpr uint32_t kRmsWindowMs = 300;
+
+  AudioGainStage();
+
+  // Keeps the settings, and restarts the meters.
+  void init(PcmEncoding encoding, uint32_t channels, uint32_t sampleRate);
+  bool supported() const {
+    return supported_;
+  }
+
+  // Bypassed, the default, the ring is not touched and the meters read zero.
+  // Disabling ramps back to unity gain first.
+  void setEnabled(bool enabled);
+  // Linear, clamped to kMaxGain; channel may be kAllChannels.
+  void setGain(uint32_t channel, float gain);
+  void setMuted(bool muted);
+  void setSoftClip(bool softClip);
+
+  // Processes the first bytes of a ring's spans, which start on a frame and
+  // split on sample boundaries.
+  template <typename Spans>
+  void process(const Spans& spans, size_t bytes) {
+    if (!prepare()) {
+      return;
+    }
+    size_t samples = bytes / sampleBytes_;
+    size_t first = std::min(samples, spans.firstSize / sampleBytes_);
+    processSamples(spans.first, first, 0);
+    if (first < samples) {
+      processSamples(spans.second, samples - first, first);
+    }
+    finish(samples / channels_);
+  }
+
+  // Of what process() wrote, linear with 1 at full scale.
+  float peak(uint32_t channel) const {
+    return channel < channels_ ? peak_[channel] : 0.0f;
+  }
+  float rms(uint32_t channel) const;
+  // Samples the gain took beyond full scale, before soft clipping or
+  // saturation, since init().
+  uint64_t samplesOverFullScale() const {
+    return overFullScale_;
+  }
+
+ private:
+  PcmEncoding encoding_{PcmEncoding::I16};
+  bool supported_{false};
+  uint32_t channels_{1};
+  size_t sampleBytes_{2};
+  uint32_t rampFrames_{1};
+  float peakFallPerFrame_{1.0f};
+  float rmsFramesConstant_{1.0f};
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<bool> muted_{false};
+  std::atomic<bool> softClip_{false};
+  std::array<std::atomic<float>, kMaxChannels> gains_{};
+  // Bumped by every setter, so process() reloads the settings only then.
+  std::atomic<uint32_t> revision_{0};
+  uint32_t appliedRevision_{UINT32_MAX};
+
+  bool active_{false};
+  bool appliedEnabled_{false};
+  bool applySoftClip_{false};
+  std::array<float, kMaxChannels> gain_{}; // at the start of the next block
+  std::array<float, kMaxChannels> target_{};
+  std::array<float, kMaxChannels> step_{}; // per frame, while ramping
+  // Between gain_ and target_, which bound the ramped gains.
+  std::array<float, kMaxChannels> rampLow_{};
+  std::array<float, kMaxChannels> rampHigh_{};
+  uint32_t rampFramesLeft_{};
+  // Of the block being processed, then the meters they feed.
+  std::array<float, kMaxChannels> blockPeak_{};
+  std::array<float, kMaxChannels> blockSumSquares_{};
+  std::array<float, kMaxChannels> peak_{};
+  std::array<float, kMaxChannels> meanSquare_{};
+  uint64_t overFullScale_{};
+
+  // Reloads changed settings; false when the stage is bypassed.
+  bool prepare();
+  // samples contiguous samples, sampleIndex into the block.
+  void processSamples(uint8_t* data, size_t samples, size_t sampleIndex);
+  // Advances the ramp and the meters past a block of frames.
+  void finish(size_t frames);
+};
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AudioLatencyTuner.h"
+
+#include <algorithm>
+
+void AudioLatencyTuner::init(
+    int32_t framesPerBurst,
+    int32_t bufferCapacityFrames,
+    uint32_t baseTransfers,
+    uint32_t maxTransfers,
+    size_t framesPerTransfer) {
+  framesPerBurst_ = std::max(framesPerBurst, 1);
+  bufferCapacityFrames_ = std::max(bufferCapacityFrames, framesPerBurst_);
+  baseTransfers_ = baseTransfers;
+  maxTransfers_ = std::max(maxTransfers, baseTransfers);
+  framesPerTransfer_ = framesPerTransfer;
+  level_ = kInitialLevel;
+  settings_ = settingsFor(level_);
+  calmPeriod_ = kInitialCalmPeriod;
+  lastChange_ = steady_clock::now();
+  lastLowered_ = {};
+}
+
+void AudioLatencyTuner::restart(uint64_t glitches, steady_clock::time_point now) {
+  glitches_ = glitches;
+  lastChange_ = now;
+}
+
+bool AudioLatencyTuner::update(uint64_t glitches, steady_clock::time_point now) {
+  bool glitched = glitches > glitches_;
+  glitches_ = glitches;
+  uint32_t level = level_;
+  if (glitched) {
+    if (now - lastLowered_ < kProbation) {
+      calmPeriod_ = std::min(calmPeriod_ * 2, kMaxCalmPeriod);
+    }
+    level = std::min(level_ + 1, kMaxLevel);
+    lastChange_ = now;
+  } else if (level_ > 0 && now - lastChange_ >= calmPeriod_) {
+    level = level_ - 1;
+    lastChange_ = now;
+    lastLowered_ = now;
+  }
+  if (level == level_) {
+    return false;
+  }
+  level_ = level;
+  settings_ = settingsFor(level);
+  return true;
+}
+
+AudioLatencyTuner::Settings AudioLatencyTuner::settingsFor(uint32_t level) const {
+  Settings settings;
+  settings.bufferSizeFrames = std::min<int32_t>(framesPerBurst_ * (level + 1), bufferCapacityFrames_);
+  settings.transfers =
+      std::clamp<uint32_t>(baseTransfers_ + level - kInitialLevel, 2, maxTransfers_);
+  settings.targetFillFrames = framesPerTransfer_ + (size_t)framesPerBurst_ * (level + 1);
+  return settings;
+}
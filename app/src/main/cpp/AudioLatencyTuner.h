@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std::chrono;
+
+// Searches for the least audio buffering that plays without glitches.
+//
+// Buffering is a single level that scales the AAudio buffer size, the number
+// of iso transfers kept in flight and the ring buffer fill the resampler
+// holds. Any glitch (underrun, overrun, XRun or USB packet error) raises the
+// level at once; a quiet calm period lowers it by one. A glitch shortly after
+// lowering doubles the calm period, so a device that needs more buffering
+// settles there instead of oscillating.
+class AudioLatencyTuner final {
+ public:
+  struct Settings {
+    int32_t bufferSizeFrames{};
+    uint32_t transfers{};
+    size_t targetFillFrames{};
+  };
+
+  // baseTransfers is what the stream starts with, maxTransfers what is allocated.
+  void init(
+      int32_t framesPerBurst,
+      int32_t bufferCapacityFrames,
+      uint32_t baseTransfers,
+      uint32_t maxTransfers,
+      size_t framesPerTransfer);
+
+  // Starts a new observation period from the current glitch total, keeping the
+  // level, so glitches while a stream starts up are not held against it.
+  void restart(uint64_t glitches, steady_clock::time_point now);
+
+  // Takes the running total of glitches. Returns true when the settings changed.
+  bool update(uint64_t glitches, steady_clock::time_point now);
+
+  const Settings& settings() const {
+    return settings_;
+  }
+  uint32_t level() const {
+    return level_;
+  }
+
+ private:
+  static constexpr uint32_t kInitialLevel = 1; // two bursts, AAudio's default
+  static constexpr uint32_t kMaxLevel = 7;
+  static constexpr seconds kInitialCalmPeriod{20};
+  static constexpr seconds kMaxCalmPeriod{300};
+  // A glitch this soon after lowering the level means it went too low.
+  static constexpr seconds kProbation{10};
+
+  int32_t framesPerBurst_{};
+  int32_t bufferCapacityFrames_{};
+  uint32_t baseTransfers_{};
+  uint32_t maxTransfers_{};
+  size_t framesPerTransfer_{};
+
+  uint32_t level_{kInitialLevel};
+  Settings settings_{};
+  uint64_t glitches_{};
+  seconds calmPeriod_{kInitialCalmPeriod};
+  steady_clock::time_point lastChange_{};
+  steady_clock::time_point lastLowered_{};
+
+  Settings settingsFor(uint32_t level) const;
+};
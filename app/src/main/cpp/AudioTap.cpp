@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "AudioTap.h"
+
+#include <algorithm>
+
+void AudioTap::attach(RingBufferPcm* ring, size_t bytesPerFrame, uint32_t sampleRate) {
+  std::unique_lock lk(mutex_);
+  ring_ = ring;
+  bytesPerFrame_ = std::max<size_t>(bytesPerFrame, 1);
+  sampleRate_ = sampleRate;
+  for (Reader& reader : readers_) {
+    if (reader.open) {
+      restart(reader);
+    }
+  }
+}
+
+void AudioTap::published(uint32_t ringPosition, int64_t timeNs) {
+  uint32_t sequence = anchorSequence_.load(std::memory_order_relaxed);
+  anchorSequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  anchorPosition_.store(ringPosition, std::memory_order_relaxed);
+  anchorTimeNs_.store(timeNs, std::memory_order_relaxed);
+  anchorSequence_.store(sequence + 2, std::memory_order_release);
+}
+
+int32_t AudioTap::open(Overflow overflow) {
+  std::unique_lock lk(mutex_);
+  for (int32_t i = 0; i < kMaxReaders; i++) {
+    Reader& reader = readers_[i];
+    if (!reader.open) {
+      reader.open = true;
+      reader.overflow = overflow;
+      reader.framePosition = 0;
+      restart(reader);
+      reader.cursor.lost = 0;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void AudioTap::close(int32_t reader) {
+  std::unique_lock lk(mutex_);
+  if (reader >= 0 && reader < kMaxReaders) {
+    readers_[reader].open = false;
+  }
+}
+
+size_t AudioTap::read(int32_t index, uint8_t* data, size_t capacity, Block& block) {
+  std::unique_lock lk(mutex_);
+  if (index < 0 || index >= kMaxReaders || !readers_[index].open || ring_ == nullptr) {
+    return 0;
+  }
+  Reader& reader = readers_[index];
+  uint64_t lostBefore = reader.cursor.lost;
+  size_t copied = ring_->readAt(reader.cursor, data, capacity, reader.overflow, bytesPerFrame_);
+  reader.framePosition += (reader.cursor.lost - lostBefore) / bytesPerFrame_;
+  uint32_t start = reader.cursor.position - copied;
+
+  uint32_t sequence;
+  uint32_t anchorPosition;
+  int64_t anchorTimeNs;
+  do {
+    sequence = anchorSequence_.load(std::memory_order_acquire);
+    anchorPosition = anchorPosition_.load(std::memory_order_relaxed);
+    anchorTimeNs = anchorTimeNs_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) != 0 || sequence != anchorSequence_.load(std::memory_order_relaxed));
+  int64_t framesBefore = (int32_t)(anchorPosition - start) / (int64_t)bytesPerFrame_;
+  block.timeNs =
+      sampleRate_ > 0 ? anchorTimeNs - framesBefore * 1'000'000'000 / sampleRate_ : anchorTimeNs;
+  block.framePosition = reader.framePosition;
+  block.lostFrames = reader.cursor.lost / bytesPerFrame_;
+  block.frames = copied / bytesPerFrame_;
+  reader.framePosition += block.frames;
+  return copied;
+}
+
+void AudioTap::restart(Reader& reader) {
+  if (ring_ != nullptr) {
+    ring_->seek(reader.cursor);
+  }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "RingBuffer.h"
+
+// Lets the app read the audio on its way to the AAudio stream, for recording
+// or level meters, straight from the playback ring: each reader copies out
+// at its own RingBuffer cursor on its own thread, so the USB completions
+// write the audio once and the playback callback never waits for a reader.
+//
+// Frames are in the AAudio stream's format, channel count and rate. A reader
+// that falls a ring behind loses frames, and resumes at the oldest or newest
+// ones as it asked when it opened.
+class AudioTap final {
+ public:
+  using Overflow = RingBufferPcm::Overflow;
+  static constexpr int32_t kMaxReaders = 4;
+
+  // Describes the frames of a read().
+  struct Block {
+    // CLOCK_MONOTONIC time the first frame came in from USB, estimated from
+    // the completion of its transfer.
+    int64_t timeNs{};
+    uint64_t framePosition{}; // frames since the reader opened, lost ones included
+    uint64_t lostFrames{}; // in total
+    uint32_t frames{};
+  };
+
+  // Ring to read from, for the readers open and to come, which start over at
+  // its latest write. Also called after replacing the ring.
+  void attach(RingBufferPcm* ring, size_t bytesPerFrame, uint32_t sampleRate);
+
+  // Producer only. After the frames up to ringPosition, the ring's
+  // writePosition(), came in from USB at timeNs.
+  void published(uint32_t ringPosition, int64_t timeNs);
+
+  // Returns the reader's index, or -1 when kMaxReaders are open.
+  int32_t open(Overflow overflow);
+  void close(int32_t reader);
+
+  // Copies the frames the reader has not read yet, those that fit in
+  // capacity bytes. Returns the bytes copied.
+  size_t read(int32_t reader, uint8_t* data, size_t capacity, Block& block);
+
+ private:
+  struct Reader {
+    bool open{false};
+    Overflow overflow{Overflow::NEWEST};
+    RingBufferPcm::Cursor cursor{};
+    uint64_t framePosition{};
+  };
+
+  // Held by readers and attach(), never by the producer.
+  std::mutex mutex_;
+  RingBufferPcm* ring_{};
+  size_t bytesPerFrame_{1};
+  uint32_t sampleRate_{};
+  std::array<Reader, kMaxReaders> readers_{};
+
+  // Ring position and time of the latest published() under a sequence
+  // lock, odd while they change.
+  std::atomic<uint32_t> anchorSequence_{0};
+  std::atomic<uint32_t> anchorPosition_{0};
+  std::atomic<int64_t> anchorTimeNs_{0};
+
+  void restart(Reader& reader);
+};
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AvSync.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+
+#include "StreamingStats.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "AvSync", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "AvSync", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "AvSync", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "AvSync", __VA_ARGS__)
+
+AvSync& AvSync::shared() {
+  static AvSync* sync = new AvSync();
+  return *sync;
+}
+
+void AvSync::setMaxSkew(nanoseconds maxSkew) {
+  std::lock_guard lk(mutex_);
+  maxSkew_ = std::max(maxSkew, 0ns);
+}
+
+void AvSync::setVideoDelayAvailable(bool available) {
+  std::lock_guard lk(mutex_);
+  videoDelayAvailable_ = available;
+  if (!available) {
+    videoDelay_ = 0ns;
+  }
+}
+
+void AvSync::recordAudioLatency(nanoseconds latency, steady_clock::time_point now) {
+  std::lock_guard lk(mutex_);
+  audioLatency_ = latency;
+  audioLatencyAt_ = now;
+  rebalance(now);
+}
+
+void AvSync::recordVideoLatency(nanoseconds latency, steady_clock::time_point now) {
+  std::lock_guard lk(mutex_);
+  double latencyNs = latency.count();
+  videoLatencyNs_ = videoLatencyNs_ < 0 || now - videoLatencyAt_ > kStaleAfter
+      ? latencyNs
+      : videoLatencyNs_ + (latencyNs - videoLatencyNs_) * kVideoSmoothing;
+  videoLatencyAt_ = now;
+  if (now - rebalancedAt_ >= kRebalanceInterval) {
+    rebalance(now);
+  }
+}
+
+nanoseconds AvSync::audioDelay() {
+  std::lock_guard lk(mutex_);
+  return audioDelay_;
+}
+
+nanoseconds AvSync::videoDelay() {
+  std::lock_guard lk(mutex_);
+  return videoDelay_;
+}
+
+void AvSync::rebalance(steady_clock::time_point now) {
+  rebalancedAt_ = now;
+  AvSyncCounters& stats = StreamingStats::shared().avSync;
+  if (now - audioLatencyAt_ > kStaleAfter || now - videoLatencyAt_ > kStaleAfter) {
+    // Nothing to be in step with.
+    audioDelay_ = 0ns;
+    videoDelay_ = 0ns;
+    stats.skewUs.set(0);
+    stats.audioDelayUs.set(0);
+    stats.videoDelayUs.set(0);
+    return;
+  }
+  // Positive when video is presented after the audio captured with it.
+  nanoseconds skew = nanoseconds((int64_t)videoLatencyNs_) - audioLatency_;
+  stats.skewUs.set((uint64_t)duration_cast<microseconds>(skew).count());
+  if (now < holdUntil_ || std::chrono::abs(skew) <= maxSkew_) {
+    return;
+  }
+  nanoseconds audioDelay = audioDelay_;
+  nanoseconds videoDelay = videoDelay_;
+  if (skew > 0ns) {
+    nanoseconds removed = std::min(videoDelay, skew);
+    videoDelay -= removed;
+    audioDelay += skew - removed;
+  } else {
+    nanoseconds removed = std::min(audioDelay, -skew);
+    audioDelay -= removed;
+    if (videoDelayAvailable_) {
+      videoDelay += -skew - removed;
+    }
+  }
+  audioDelay = std::min(audioDelay, kMaxDelay);
+  videoDelay = std::min(videoDelay, kMaxDelay);
+  if (audioDelay == audioDelay_ && videoDelay == videoDelay_) {
+    return;
+  }
+  holdUntil_ = now + (audioDelay != audioDelay_ ? kAudioSettleTime : kVideoSettleTime);
+  audioDelay_ = audioDelay;
+  videoDelay_ = videoDelay;
+  stats.audioDelayUs.set(duration_cast<microseconds>(audioDelay).count());
+  stats.videoDelayUs.set(duration_cast<microseconds>(videoDelay).count());
+  ULOGI(
+      "A/V skew %.1f ms, delaying audio by %.1f ms and video by %.1f ms",
+      skew.count() / 1e6,
+      audioDelay.count() / 1e6,
+      videoDelay.count() / 1e6);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+using namespace std::chrono;
+
+// Keeps audio and video presented in step.
+//
+// Each streamer reports how long its media takes from leaving the device to
+// being presented, on CLOCK_MONOTONIC: the audio streamer from USB transfer
+// completions and AAudio timestamps, the SurfaceControl presenter from UVC
+// PTS mapped onto the host clock and present fences. Their difference is the
+// A/V skew. Beyond the configured bound, the stream that is ahead is held
+// back: video through its desired present time, audio through extra ring
+// buffer fill. Delay already added to the stream that is behind is removed
+// first, so no more latency is added than needed.
+//
+// The streamers own separate libusb contexts and threads, so this is one
+// process-wide instance, like StreamingStats.
+class AvSync final {
+ public:
+  // Most delay added to either stream.
+  static constexpr nanoseconds kMaxDelay{250ms};
+
+  static AvSync& shared();
+
+  void setMaxSkew(nanoseconds maxSkew);
+  // Only the SurfaceControl presenter can hold video back.
+  void setVideoDelayAvailable(bool available);
+
+  // Smoothed latencies, from the audio event thread and the presenter.
+  void recordAudioLatency(nanoseconds latency, steady_clock::time_point now);
+  void recordVideoLatency(nanoseconds latency, steady_clock::time_point now);
+
+  nanoseconds audioDelay();
+  nanoseconds videoDelay();
+
+ private:
+  // Corrections show up in the measurements only after these: the resampler
+  // drains fill changes slowly, present times apply from the next frame.
+  static constexpr nanoseconds kAudioSettleTime{15s};
+  static constexpr nanoseconds kVideoSettleTime{2s};
+  // A stream that reported nothing for this long has stopped.
+  static constexpr nanoseconds kStaleAfter{5s};
+  static constexpr nanoseconds kRebalanceInterval{1s};
+  static constexpr double kVideoSmoothing = 0.05;
+
+  std::mutex mutex_;
+  nanoseconds maxSkew_{30ms};
+  bool videoDelayAvailable_{false};
+  nanoseconds audioLatency_{};
+  steady_clock::time_point audioLatencyAt_{};
+  double videoLatencyNs_{-1};
+  steady_clock::time_point videoLatencyAt_{};
+  nanoseconds audioDelay_{};
+  nanoseconds videoDelay_{};
+  steady_clock::time_point holdUntil_{};
+  steady_clock::time_point rebalancedAt_{};
+
+  void rebalance(steady_clock::time_point now);
+};
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "BitmapSnapshot.h"
+
+#include <android/bitmap.h>
+#include <android/log.h>
+
+#include <libyuv/planar_functions.h>
+
+#include <sys/prctl.h>
+#include <chrono>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "BitmapSnapshot", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "BitmapSnapshot", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "BitmapSnapshot", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "BitmapSnapshot", __VA_ARGS__)
+
+using namespace std::chrono;
+
+BitmapSnapshot::~BitmapSnapshot() {
+  stop();
+}
+
+void BitmapSnapshot::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  {
+    std::unique_lock lk(mutex_);
+    change_.notify_all();
+  }
+  snapshotThread_.join();
+  uvc_frame_t* frame = pending_.exchange(nullptr);
+  if (frame != nullptr) {
+    uvc_release_frame(frame);
+  }
+}
+
+bool BitmapSnapshot::request(
+    JNIEnv* env,
+    jobject bitmap,
+    uvc_frame_format frameFormat,
+    Callback done) {
+  AndroidBitmapInfo info;
+  if (AndroidBitmap_getInfo(env, bitmap, &info) != ANDROID_BITMAP_RESULT_SUCCESS ||
+      info.format != ANDROID_BITMAP_FORMAT_RGBA_8888) {
+    ULOGE("Snapshots need an RGBA_8888 bitmap");
+    return false;
+  }
+  if (!FrameConverter::isSupported(frameFormat, kBitmapFormat)) {
+    ULOGE("No RGBA conversion for format %d", frameFormat);
+    return false;
+  }
+  std::unique_lock lk(mutex_);
+  if (active_) {
+    return false;
+  }
+  if (!running_.exchange(true)) {
+    env->GetJavaVM(&javaVM_);
+    snapshotThread_ = std::thread(&BitmapSnapshot::snapshotLoop, this);
+  }
+  active_ = true;
+  bitmap_ = env->NewGlobalRef(bitmap);
+  done_ = std::move(done);
+  requested_.store(true, std::memory_order_release);
+  return true;
+}
+
+void BitmapSnapshot::offer(uvc_frame_t* frame) {
+  if (!requested_.load(std::memory_order_acquire) || !requested_.exchange(false)) {
+    return;
+  }
+  uvc_retain_frame(frame);
+  pending_.store(frame, std::memory_order_release);
+  std::unique_lock lk(mutex_);
+  change_.notify_all();
+}
+
+void BitmapSnapshot::snapshotLoop() {
+  prctl(PR_SET_NAME, "usb_video_snap");
+  JNIEnv* env = nullptr;
+  if (javaVM_->AttachCurrentThread(&env, nullptr) != JNI_OK) {
+    ULOGE("Snapshot thread could not attach to the VM");
+    running_ = false;
+    return;
+  }
+  while (running_) {
+    uvc_frame_t* frame = pending_.exchange(nullptr, std::memory_order_acquire);
+    if (frame == nullptr) {
+      std::unique_lock lk(mutex_);
+      change_.wait_for(lk, 100ms, [this] { return pending_ != nullptr || !running_; });
+      continue;
+    }
+    jobject bitmap;
+    {
+      std::unique_lock lk(mutex_);
+      bitmap = bitmap_;
+    }
+    bool ok = fill(env, bitmap, frame);
+    uvc_release_frame(frame);
+    complete(env, ok);
+  }
+  // A request that never got a frame.
+  requested_ = false;
+  complete(env, false);
+  javaVM_->DetachCurrentThread();
+}
+
+bool BitmapSnapshot::fill(JNIEnv* env, jobject bitmap, const uvc_frame_t* frame) {
+  TRACE_SCOPE("fillSnapshotBitmap");
+  steady_clock::time_point startedAt = steady_clock::now();
+  AndroidBitmapInfo info;
+  if (AndroidBitmap_getInfo(env, bitmap, &info) != ANDROID_BITMAP_RESULT_SUCCESS) {
+    ULOGE("Snapshot bitmap could not be read");
+    return false;
+  }
+  // The fanout only scales down, to even sizes.
+  FrameFanout::FramePtr derived;
+  if (FrameFanout::supportsFormat(frame->frame_format) && info.width <= frame->width &&
+      info.height <= frame->height && info.width % 2 == 0 && info.height % 2 == 0) {
+    derived = fanout_.derive(frame, FanoutFormat::RGBA, info.width, info.height);
+  }
+  if (derived == nullptr && converter_.frameFormat() != frame->frame_format &&
+      !converter_.configure(frame->frame_format, kBitmapFormat)) {
+    return false;
+  }
+  // The bitmap's size is the thumbnail's; ARGBScale makes up the difference.
+  converter_.setCpuScaling(true);
+  converter_.setColorimetry(fanout_.colorimetry());
+  void* pixels = nullptr;
+  if (AndroidBitmap_lockPixels(env, bitmap, &pixels) != ANDROID_BITMAP_RESULT_SUCCESS) {
+    ULOGE("Snapshot bitmap could not be locked");
+    return false;
+  }
+  ANativeWindow_Buffer buffer{
+      .width = (int32_t)info.width,
+      .height = (int32_t)info.height,
+      .stride = (int32_t)(info.stride / 4),
+      .format = kBitmapFormat,
+      .bits = pixels,
+  };
+  bool converted = derived != nullptr
+      ? libyuv::ARGBCopy(
+            derived->data.data(),
+            derived->stride,
+            static_cast<uint8_t*>(pixels),
+            info.stride,
+            info.width,
+            info.height) == 0
+      : converter_.convert(frame, buffer);
+  AndroidBitmap_unlockPixels(env, bitmap);
+  ULOGD(
+      "Snapshot of frame %u into %ux%u in %.1f ms",
+      frame->sequence,
+      info.width,
+      info.height,
+      duration<double, std::milli>(steady_clock::now() - startedAt).count());
+  return converted;
+}
+
+void BitmapSnapshot::complete(JNIEnv* env, bool ok) {
+  jobject bitmap;
+  Callback done;
+  {
+    std::unique_lock lk(mutex_);
+    if (!active_) {
+      return;
+    }
+    bitmap = bitmap_;
+    done = std::move(done_);
+    bitmap_ = nullptr;
+    done_ = nullptr;
+  }
+  if (done != nullptr) {
+    done(env, ok);
+  }
+  env->DeleteGlobalRef(bitmap);
+  // Only now can the next request take the bitmap slot.
+  std::unique_lock lk(mutex_);
+  active_ = false;
+}
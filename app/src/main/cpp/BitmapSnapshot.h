@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <android/hardware_buffer.h>
+#include <jni.h>
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "FrameConverter.h"
+#include "FrameFanout.h"
+
+// Fills a Java Bitmap from the next previewed frame, for thumbnails.
+//
+// The render thread hands the frame over after it was posted, taking only a
+// reference on libuvc's buffer; a snapshot thread attached to the VM locks
+// the bitmap's pixels with AndroidBitmap_lockPixels() and converts into them,
+// scaling with libyuv to the bitmap's size. Bitmaps no larger than the frame
+// copy the RGBA of a FrameFanout, shared with the frame tap when it asks for
+// the same size. The preview never waits for a
+// snapshot, and render threads only check an atomic flag while none is
+// requested.
+class BitmapSnapshot final {
+ public:
+  // Runs on the snapshot thread with its JNIEnv. ok is false when the frame
+  // could not be converted or the snapshot was dropped at shutdown.
+  using Callback = std::function<void(JNIEnv* env, bool ok)>;
+
+  // Android bitmaps in ANDROID_BITMAP_FORMAT_RGBA_8888, R first in memory.
+  static constexpr int32_t kBitmapFormat = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+
+  explicit BitmapSnapshot(FrameFanout& fanout) : fanout_(fanout) {}
+  BitmapSnapshot(const BitmapSnapshot&) = delete;
+  BitmapSnapshot& operator=(const BitmapSnapshot&) = delete;
+  ~BitmapSnapshot();
+
+  // bitmap must be RGBA_8888 and frameFormat convertible to it. Returns
+  // false, and does not call done, when a snapshot is already pending.
+  bool request(JNIEnv* env, jobject bitmap, uvc_frame_format frameFormat, Callback done);
+  // Render thread, once a frame was posted.
+  void offer(uvc_frame_t* frame);
+  // A request waits for a frame; any thread.
+  bool requested() const {
+    return requested_.load(std::memory_order_relaxed);
+  }
+  // Fails a pending request and gives back the frame it holds, before the
+  // stream's frame pool goes away.
+  void stop();
+
+ private:
+  FrameFanout& fanout_;
+  JavaVM* javaVM_{};
+  std::thread snapshotThread_{};
+  std::atomic<bool> running_{false};
+  std::mutex mutex_;
+  std::condition_variable change_;
+  // Set by request() until a frame was handed over.
+  std::atomic<bool> requested_{false};
+  std::atomic<uvc_frame_t*> pending_{nullptr};
+  // Guarded by mutex_; set from request() until done ran.
+  bool active_{false};
+  jobject bitmap_{};
+  Callback done_{};
+
+  // Snapshot thread only.
+  FrameConverter converter_{};
+
+  void snapshotLoop();
+  bool fill(JNIEnv* env, jobject bitmap, const uvc_frame_t* frame);
+  void complete(JNIEnv* env, bool ok);
+};
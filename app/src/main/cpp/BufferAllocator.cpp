@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "BufferAllocator.h"
+
+#include <libuvc/libuvc.h>
+#include <malloc.h>
+#include <atomic>
+#include <cstdlib>
+
+static std::atomic<size_t> liveBytes_{0};
+static std::atomic<const BufferAllocator::FrameSource*> frameSource_{nullptr};
+
+void* BufferAllocator::allocate(size_t bytes) {
+  void* buffer = aligned_alloc(kBufferAlignment, alignedStride(bytes > 0 ? bytes : 1));
+  if (buffer != nullptr) {
+    liveBytes_.fetch_add(malloc_usable_size(buffer), std::memory_order_relaxed);
+  }
+  return buffer;
+}
+
+void BufferAllocator::release(void* buffer) {
+  if (buffer != nullptr) {
+    liveBytes_.fetch_sub(malloc_usable_size(buffer), std::memory_order_relaxed);
+    free(buffer);
+  }
+}
+
+size_t BufferAllocator::liveBytes() {
+  return liveBytes_.load(std::memory_order_relaxed);
+}
+
+static void* allocateForLibuvc(size_t bytes, void* userPtr) {
+  return BufferAllocator::allocate(bytes);
+}
+
+static void* allocateFrameForLibuvc(size_t bytes, void* userPtr) {
+  const BufferAllocator::FrameSource* source = frameSource_.load(std::memory_order_acquire);
+  if (source != nullptr) {
+    size_t usable = 0;
+    void* buffer = source->allocate(bytes, &usable);
+    if (buffer != nullptr) {
+      liveBytes_.fetch_add(usable, std::memory_order_relaxed);
+      return buffer;
+    }
+  }
+  return BufferAllocator::allocate(bytes);
+}
+
+static void releaseForLibuvc(void* buffer, void* userPtr) {
+  const BufferAllocator::FrameSource* source = frameSource_.load(std::memory_order_acquire);
+  if (source != nullptr && buffer != nullptr) {
+    size_t usable = source->release(buffer);
+    if (usable > 0) {
+      liveBytes_.fetch_sub(usable, std::memory_order_relaxed);
+      return;
+    }
+  }
+  BufferAllocator::release(buffer);
+}
+
+void BufferAllocator::installForLibuvc() {
+  static const uvc_buffer_allocator_t allocator{
+      allocateForLibuvc,
+      releaseForLibuvc,
+      nullptr,
+      allocateFrameForLibuvc,
+  };
+  uvc_set_buffer_allocator(&allocator);
+}
+
+void BufferAllocator::setFrameSource(const FrameSource* source) {
+  frameSource_.store(source, std::memory_order_release);
+}
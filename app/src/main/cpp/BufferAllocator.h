@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Alignment of frame, transfer and conversion buffers: a cache line, which is
+// also a whole number of NEON and SSE vectors, so libyuv's row functions run
+// their aligned loads without splitting lines.
+static constexpr size_t kBufferAlignment = 64;
+
+// Row bytes rounded up so every row of a buffer starts aligned too.
+constexpr size_t alignedStride(size_t rowBytes) {
+  return (rowBytes + kBufferAlignment - 1) & ~(kBufferAlignment - 1);
+}
+
+// Allocator of the large buffers of the capture path.
+//
+// Sizes are rounded up to kBufferAlignment, so row functions reading a
+// vector past the last pixel stay inside the buffer. installForLibuvc() makes
+// libuvc take its frame pool, polling and heap transfer buffers from here.
+// Recycling is left to the pools that own the buffers: libuvc's frame pool,
+// spare transfers and frame buffer stash.
+class BufferAllocator final {
+ public:
+  // Other memory libuvc's frame pool slots come from, such as buffers the GPU
+  // imports frames from.
+  struct FrameSource {
+    // Null to take the slot from the heap; usable is set to the bytes the
+    // slot takes up.
+    void* (*allocate)(size_t bytes, size_t* usable);
+    // The usable bytes of buffer once released, 0 when it is not the
+    // source's.
+    size_t (*release)(void* buffer);
+  };
+
+  // Null when out of memory.
+  static void* allocate(size_t bytes);
+  static void release(void* buffer);
+
+  // Usable bytes of the buffers not yet released.
+  static size_t liveBytes();
+
+  // Before any stream opens, as buffers must be freed by the allocator that
+  // allocated them.
+  static void installForLibuvc();
+  // Kept for the rest of the process, as slots are freed through it until
+  // the last stream and stash let go of them.
+  static void setFrameSource(const FrameSource* source);
+};
+
+// std::allocator for vectors of trivial types backed by BufferAllocator.
+template <typename T>
+struct AlignedAllocator {
+  using value_type = T;
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) {}
+
+  T* allocate(size_t count) {
+    return static_cast<T*>(BufferAllocator::allocate(count * sizeof(T)));
+  }
+  void deallocate(T* buffer, size_t) {
+    BufferAllocator::release(buffer);
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U>&) const {
+    return true;
+  }
+};
+
+// Scratch frames and other byte buffers the row functions work on.
+using AlignedBytes = std::vector<uint8_t, AlignedAllocator<uint8_t>>;
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "BusBandwidthPlanner.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "BusBandwidthPlanner", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "BusBandwidthPlanner", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "BusBandwidthPlanner", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "BusBandwidthPlanner", __VA_ARGS__)
+
+BusBandwidthPlanner& BusBandwidthPlanner::shared() {
+  static BusBandwidthPlanner planner;
+  return planner;
+}
+
+uint64_t BusBandwidthPlanner::budgetFor(int speed) {
+  // Periodic transfers get 90% of full and SuperSpeed frames, 80% of high
+  // speed microframes.
+  switch (speed) {
+    case LIBUSB_SPEED_FULL:
+      return 1'350'000;
+    case LIBUSB_SPEED_HIGH:
+      return 48'000'000;
+    case LIBUSB_SPEED_SUPER:
+      return 450'000'000;
+    case LIBUSB_SPEED_SUPER_PLUS:
+      return 900'000'000;
+    default:
+      return 0;
+  }
+}
+
+BusBandwidthPlanner::Bus BusBandwidthPlanner::busOf(libusb_device_handle* handle) {
+  libusb_device* device = handle != nullptr ? libusb_get_device(handle) : nullptr;
+  if (device == nullptr) {
+    return {};
+  }
+  return {libusb_get_bus_number(device), budgetFor(libusb_get_device_speed(device))};
+}
+
+void BusBandwidthPlanner::reserve(
+    const void* owner,
+    const void* group,
+    Bus bus,
+    uint64_t bytesPerSecond) {
+  uint64_t total = 0;
+  {
+    std::lock_guard lk(mutex_);
+    std::erase_if(reservations_, [owner](const Reservation& r) { return r.owner == owner; });
+    reservations_.push_back({owner, group, bus, bytesPerSecond});
+    for (const Reservation& reservation : reservations_) {
+      if (reservation.bus == bus) {
+        total += reservation.bytesPerSecond;
+      }
+    }
+  }
+  ULOGI(
+      "Bus %u reserves %.1f of %.1f MB/s after %.1f MB/s more",
+      bus.number,
+      total / 1e6,
+      bus.budget / 1e6,
+      bytesPerSecond / 1e6);
+  if (bus.budget != 0 && total > bus.budget) {
+    ULOGW("Isochronous streams on bus %u exceed its periodic bandwidth", bus.number);
+  }
+}
+
+void BusBandwidthPlanner::release(const void* owner) {
+  std::lock_guard lk(mutex_);
+  std::erase_if(reservations_, [owner](const Reservation& r) { return r.owner == owner; });
+}
+
+uint64_t BusBandwidthPlanner::reserved(Bus bus) const {
+  std::lock_guard lk(mutex_);
+  uint64_t total = 0;
+  for (const Reservation& reservation : reservations_) {
+    if (reservation.bus == bus) {
+      total += reservation.bytesPerSecond;
+    }
+  }
+  return total;
+}
+
+uint64_t BusBandwidthPlanner::available(Bus bus, const std::vector<const void*>& groups) const {
+  std::lock_guard lk(mutex_);
+  uint64_t others = 0;
+  for (const Reservation& reservation : reservations_) {
+    if (reservation.bus == bus &&
+        std::find(groups.begin(), groups.end(), reservation.group) == groups.end()) {
+      others += reservation.bytesPerSecond;
+    }
+  }
+  return bus.budget > others ? bus.budget - others : 0;
+}
+
+uint32_t BusBandwidthPlanner::others(Bus bus, const void* owner) const {
+  std::lock_guard lk(mutex_);
+  return std::count_if(reservations_.begin(), reservations_.end(), [&](const Reservation& r) {
+    return r.bus == bus && r.owner != owner;
+  });
+}
+
+bool BusBandwidthPlanner::plan(
+    const std::vector<std::vector<Option>>& sessions,
+    uint64_t budget,
+    std::vector<size_t>& chosen) {
+  // The smallest option of each session, when nothing better fits.
+  chosen.assign(sessions.size(), 0);
+  uint64_t smallest = 0;
+  uint64_t largest = 0;
+  for (size_t s = 0; s < sessions.size(); s++) {
+    const std::vector<Option>& options = sessions[s];
+    uint64_t most = 0;
+    for (size_t o = 0; o < options.size(); o++) {
+      if (options[o].bytesPerSecond < options[chosen[s]].bytesPerSecond) {
+        chosen[s] = o;
+      }
+      most = std::max(most, options[o].bytesPerSecond);
+    }
+    smallest += options.empty() ? 0 : options[chosen[s]].bytesPerSecond;
+    largest += most;
+  }
+  if (smallest > budget) {
+    return false;
+  }
+  if (largest <= budget) {
+    // Everything fits, so every session takes its best.
+    for (size_t s = 0; s < sessions.size(); s++) {
+      const std::vector<Option>& options = sessions[s];
+      auto preferred = std::max_element(
+          options.begin(), options.end(), [](const Option& a, const Option& b) {
+            return a.preference < b.preference;
+          });
+      chosen[s] = preferred - options.begin();
+    }
+    return true;
+  }
+  // A multiple choice knapsack over the budget in kBudgetUnits steps, each
+  // option rounded up to whole steps so the plan never overshoots.
+  constexpr size_t kBudgetUnits = 1024;
+  uint64_t unit = std::max<uint64_t>((budget + kBudgetUnits - 1) / kBudgetUnits, 1);
+  size_t units = budget / unit;
+  constexpr double kNone = -1e300;
+  // best[u]: the highest total preference of the sessions so far within u
+  // steps; pick[s][u] the option session s takes for it.
+  std::vector<double> best(units + 1, 0.0);
+  std::vector<double> next(units + 1);
+  std::vector<std::vector<int32_t>> pick(sessions.size(), std::vector<int32_t>(units + 1, -1));
+  for (size_t s = 0; s < sessions.size(); s++) {
+    const std::vector<Option>& options = sessions[s];
+    if (options.empty()) {
+      continue;
+    }
+    std::fill(next.begin(), next.end(), kNone);
+    for (size_t o = 0; o < options.size(); o++) {
+      size_t cost = (options[o].bytesPerSecond + unit - 1) / unit;
+      for (size_t u = cost; u <= units; u++) {
+        if (best[u - cost] != kNone && best[u - cost] + options[o].preference > next[u]) {
+          next[u] = best[u - cost] + options[o].preference;
+          pick[s][u] = o;
+        }
+      }
+    }
+    best.swap(next);
+  }
+  size_t u = std::max_element(best.begin(), best.end()) - best.begin();
+  if (best[u] == kNone) {
+    // Only the rounding kept the smallest options out.
+    return true;
+  }
+  for (size_t s = sessions.size(); s-- > 0;) {
+    if (sessions[s].empty()) {
+      continue;
+    }
+    chosen[s] = pick[s][u];
+    u -= (sessions[s][chosen[s]].bytesPerSecond + unit - 1) / unit;
+  }
+  return true;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libusb/libusb.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// The isochronous streams of every camera and audio interface on a USB bus
+// share its periodic bandwidth, which each one's altsetting otherwise claims
+// without knowing about the others, so the second camera on a hub fails to
+// set its altsetting. Streamers reserve what their altsetting takes here
+// while it is set, from starting until the interface is released; a stream
+// that is not alone on its bus picks the smallest altsetting its format
+// fits, and plan() picks modes for several sessions that add up to what the
+// bus has left.
+//
+// A bus is its number together with its budget, so high and full speed
+// devices behind one root, or wrapped fds whose bus number is unknown, are
+// not mixed up.
+class BusBandwidthPlanner final {
+ public:
+  struct Bus {
+    uint8_t number;
+    // Bytes per second, zero for an unknown speed.
+    uint64_t budget;
+
+    bool operator==(const Bus& other) const = default;
+  };
+
+  // One way a session could stream, such as a camera mode.
+  struct Option {
+    uint64_t bytesPerSecond;
+    // Higher is better.
+    double preference;
+  };
+
+  static BusBandwidthPlanner& shared();
+
+  // Periodic bandwidth a bus of the libusb speed leaves isochronous
+  // endpoints, in bytes per second, zero for an unknown speed.
+  static uint64_t budgetFor(int speed);
+  static Bus busOf(libusb_device_handle* handle);
+
+  BusBandwidthPlanner(const BusBandwidthPlanner&) = delete;
+  BusBandwidthPlanner& operator=(const BusBandwidthPlanner&) = delete;
+
+  // Replaces what owner reserves. group ties the streams of one device
+  // together, for available().
+  // Held while a stream picks its altsetting and reserves it, so the next
+  // one sees the reservation.
+  std::mutex& startMutex() {
+    return startMutex_;
+  }
+
+  void reserve(const void* owner, const void* group, Bus bus, uint64_t bytesPerSecond);
+  void release(const void* owner);
+  // All reservations on the bus, in bytes per second.
+  uint64_t reserved(Bus bus) const;
+  // The budget less what other groups reserve, zero for an unknown budget.
+  uint64_t available(Bus bus, const void* group) const {
+    return available(bus, std::vector<const void*>{group});
+  }
+  uint64_t available(Bus bus, const std::vector<const void*>& groups) const;
+  // Streams reserving bandwidth on the bus, besides owner.
+  uint32_t others(Bus bus, const void* owner) const;
+
+  // One option per session, index into its list, that together carry at
+  // most budget with the highest total preference. False when even the
+  // smallest options do not fit, with those chosen.
+  static bool plan(
+      const std::vector<std::vector<Option>>& sessions,
+      uint64_t budget,
+      std::vector<size_t>& chosen);
+
+ private:
+  struct Reservation {
+    const void* owner;
+    const void* group;
+    Bus bus;
+    uint64_t bytesPerSecond;
+  };
+
+  std::mutex startMutex_;
+  mutable std::mutex mutex_;
+  std::vector<Reservation> reservations_{};
+
+  BusBandwidthPlanner() = default;
+};
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ChannelMixer.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+
+constexpr float kMinus3dB = 0.70710678f;
+constexpr float kMinus6dB = 0.5f;
+
+struct StereoGains {
+  float left;
+  float right;
+};
+
+// Downmix gains of a channel position, its bit in the cluster mask.
+StereoGains positionGains(uint32_t position) {
+  switch (position) {
+    case 0: // front left
+    case 6: // front left of center
+      return {1.0f, 0.0f};
+    case 1: // front right
+    case 7: // front right of center
+      return {0.0f, 1.0f};
+    case 2: // front center
+      return {kMinus3dB, kMinus3dB};
+    case 3: // low frequency effects
+      return {0.0f, 0.0f};
+    case 4: // back left
+    case 9: // side left
+    case 12: // top front left
+    case 15: // top back left
+      return {kMinus3dB, 0.0f};
+    case 5: // back right
+    case 10: // side right
+    case 14: // top front right
+    case 17: // top back right
+      return {0.0f, kMinus3dB};
+    default: // back, top and other centers
+      return {kMinus6dB, kMinus6dB};
+  }
+}
+
+#if defined(__ARM_NEON)
+float horizontalSum(float32x4_t v) {
+#if defined(__aarch64__)
+  return vaddvq_f32(v);
+#else
+  float32x2_t pair = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+}
+#endif
+
+} // namespace
+
+void ChannelMixer::init(uint32_t inputChannels, uint32_t inputMask, uint32_t outputChannels) {
+  inputChannels_ = std::clamp<uint32_t>(inputChannels, 1, kMaxChannels);
+  outputChannels_ = std::clamp<uint32_t>(outputChannels, 1, kMaxChannels);
+  matrix_.assign(outputChannels_ * inputChannels_, 0.0f);
+  // A mask that does not describe every channel, or is empty, is ignored.
+  if ((uint32_t)std::popcount(inputMask) != inputChannels_) {
+    inputMask = 0;
+  }
+  std::vector<StereoGains> gains(inputChannels_);
+  if (inputChannels_ == 1) {
+    gains[0] = {1.0f, 1.0f};
+  } else {
+    uint32_t mask = inputMask;
+    for (uint32_t c = 0; c < inputChannels_; c++) {
+      if (mask != 0) {
+        gains[c] = positionGains(std::countr_zero(mask));
+        mask &= mask - 1;
+      } else {
+        gains[c] = c % 2 == 0 ? StereoGains{1.0f, 0.0f} : StereoGains{0.0f, 1.0f};
+      }
+    }
+  }
+  // Scaled so a full scale signal on every channel cannot clip.
+  float leftSum = 0;
+  float rightSum = 0;
+  for (const StereoGains& gain : gains) {
+    leftSum += gain.left;
+    rightSum += gain.right;
+  }
+  float scale = 1.0f / std::max({leftSum, rightSum, 1.0f});
+  for (uint32_t c = 0; c < inputChannels_; c++) {
+    if (outputChannels_ == 1) {
+      matrix_[c] = (gains[c].left + gains[c].right) * scale / 2;
+      continue;
+    }
+    matrix_[c] = gains[c].left * scale;
+    matrix_[inputChannels_ + c] = gains[c].right * scale;
+  }
+  if (outputChannels_ == 1 && inputChannels_ == 1) {
+    matrix_[0] = 1.0f;
+  }
+  identity_ = inputChannels_ == outputChannels_;
+  for (uint32_t o = 0; o < outputChannels_ && identity_; o++) {
+    for (uint32_t c = 0; c < inputChannels_ && identity_; c++) {
+      identity_ = matrix_[o * inputChannels_ + c] == (o == c ? 1.0f : 0.0f);
+    }
+  }
+}
+
+void ChannelMixer::process(const float* input, size_t frames, float* output) const {
+  if (identity_) {
+    memcpy(output, input, frames * inputChannels_ * sizeof(float));
+    return;
+  }
+  if (outputChannels_ == 2) {
+    processStereo(input, frames, output);
+    return;
+  }
+  for (size_t i = 0; i < frames; i++) {
+    const float* frame = input + i * inputChannels_;
+    float* out = output + i * outputChannels_;
+    for (uint32_t o = 0; o < outputChannels_; o++) {
+      const float* row = matrix_.data() + o * inputChannels_;
+      float sum = 0;
+      for (uint32_t c = 0; c < inputChannels_; c++) {
+        sum += frame[c] * row[c];
+      }
+      out[o] = sum;
+    }
+  }
+}
+
+void ChannelMixer::processStereo(const float* input, size_t frames, float* output) const {
+  const float* left = matrix_.data();
+  const float* right = matrix_.data() + inputChannels_;
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  if (inputChannels_ == 1) {
+    float32x4_t leftGain = vdupq_n_f32(left[0]);
+    float32x4_t rightGain = vdupq_n_f32(right[0]);
+    for (; i + 4 <= frames; i += 4) {
+      float32x4_t mono = vld1q_f32(input + i);
+      float32x4x2_t stereo = {{vmulq_f32(mono, leftGain), vmulq_f32(mono, rightGain)}};
+      vst2q_f32(output + 2 * i, stereo);
+    }
+  } else {
+    uint32_t vectorChannels = inputChannels_ & ~3u;
+    for (; i < frames; i++) {
+      const float* frame = input + i * inputChannels_;
+      float32x4_t leftSum = vdupq_n_f32(0.0f);
+      float32x4_t rightSum = vdupq_n_f32(0.0f);
+      uint32_t c = 0;
+      for (; c < vectorChannels; c += 4) {
+        float32x4_t samples = vld1q_f32(frame + c);
+        leftSum = vmlaq_f32(leftSum, samples, vld1q_f32(left + c));
+        rightSum = vmlaq_f32(rightSum, samples, vld1q_f32(right + c));
+      }
+      float l = horizontalSum(leftSum);
+      float r = horizontalSum(rightSum);
+      for (; c < inputChannels_; c++) {
+        l += frame[c] * left[c];
+        r += frame[c] * right[c];
+      }
+      output[2 * i] = l;
+      output[2 * i + 1] = r;
+    }
+  }
+#endif
+  for (; i < frames; i++) {
+    const float* frame = input + i * inputChannels_;
+    float l = 0;
+    float r = 0;
+    for (uint32_t c = 0; c < inputChannels_; c++) {
+      l += frame[c] * left[c];
+      r += frame[c] * right[c];
+    }
+    output[2 * i] = l;
+    output[2 * i + 1] = r;
+  }
+}
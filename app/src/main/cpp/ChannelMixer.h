@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Maps interleaved float frames of the USB device's channel layout to the
+// AAudio stream's through a coefficient matrix: a downmix of positioned
+// channels to stereo or mono, a copy of mono to both sides, or an identity
+// that is skipped.
+//
+// Channel masks are UAC cluster bitmaps, whose first 18 positions have the
+// order of AAudio's channel masks: FL, FR, FC, LFE, BL, BR, FLC, FRC, BC, SL,
+// SR, TC and the top ones. Channels the mask does not place, as on mixers
+// that report no spatial positions, alternate between left and right.
+//
+// Stereo output from any number of channels, and mono to stereo, run as NEON
+// kernels where available.
+class ChannelMixer final {
+ public:
+  static constexpr uint32_t kMaxChannels = 32;
+
+  // Outputs beyond two are left silent.
+  void init(uint32_t inputChannels, uint32_t inputMask, uint32_t outputChannels);
+
+  uint32_t inputChannels() const {
+    return inputChannels_;
+  }
+  uint32_t outputChannels() const {
+    return outputChannels_;
+  }
+  bool isIdentity() const {
+    return identity_;
+  }
+
+  // Writes frames frames of outputChannels() samples each.
+  void process(const float* input, size_t frames, float* output) const;
+
+ private:
+  uint32_t inputChannels_{};
+  uint32_t outputChannels_{};
+  bool identity_{true};
+  // outputChannels_ rows of inputChannels_ coefficients.
+  std::vector<float> matrix_{};
+
+  void processStereo(const float* input, size_t frames, float* output) const;
+};
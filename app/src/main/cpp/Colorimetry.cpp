@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Colorimetry.h"
+
+#include <libyuv/convert_argb.h>
+
+namespace {
+
+// bMatrixCoefficients of the UVC color matching descriptor.
+constexpr uint8_t kMatrixUnspecified = 0;
+constexpr uint8_t kMatrixBt709 = 1;
+constexpr uint8_t kMatrixSmpte240M = 5;
+
+} // namespace
+
+Colorimetry Colorimetry::of(const uvc_format_desc_t* format, uvc_frame_format frameFormat) {
+  Colorimetry colorimetry{};
+  if (frameFormat == UVC_FRAME_FORMAT_MJPEG) {
+    // JFIF, whatever the descriptor says.
+    colorimetry.fullRange = true;
+    return colorimetry;
+  }
+  uint8_t coefficients = format != nullptr ? format->bMatrixCoefficients : kMatrixUnspecified;
+  if (coefficients == kMatrixUnspecified) {
+    colorimetry.matrix = frameFormat == UVC_FRAME_FORMAT_P010 ? Matrix::BT2020 : Matrix::BT601;
+  } else if (coefficients == kMatrixBt709 || coefficients == kMatrixSmpte240M) {
+    // SMPTE 240M differs from BT.709 by less than a code value.
+    colorimetry.matrix = Matrix::BT709;
+  }
+  // FCC, BT.470 BG and SMPTE 170M are all BT.601 within rounding.
+  return colorimetry;
+}
+
+const libyuv::YuvConstants* Colorimetry::yuv() const {
+  switch (matrix) {
+    case Matrix::BT709:
+      return fullRange ? &libyuv::kYuvF709Constants : &libyuv::kYuvH709Constants;
+    case Matrix::BT2020:
+      return fullRange ? &libyuv::kYuvV2020Constants : &libyuv::kYuv2020Constants;
+    case Matrix::BT601:
+      break;
+  }
+  return fullRange ? &libyuv::kYuvJPEGConstants : &libyuv::kYuvI601Constants;
+}
+
+const libyuv::YuvConstants* Colorimetry::yvu() const {
+  switch (matrix) {
+    case Matrix::BT709:
+      return fullRange ? &libyuv::kYvuF709Constants : &libyuv::kYvuH709Constants;
+    case Matrix::BT2020:
+      return fullRange ? &libyuv::kYvuV2020Constants : &libyuv::kYvu2020Constants;
+    case Matrix::BT601:
+      break;
+  }
+  return fullRange ? &libyuv::kYvuJPEGConstants : &libyuv::kYvuI601Constants;
+}
+
+Colorimetry::Coefficients Colorimetry::coefficients() const {
+  float kr = 0.299f;
+  float kb = 0.114f;
+  if (matrix == Matrix::BT709) {
+    kr = 0.2126f;
+    kb = 0.0722f;
+  } else if (matrix == Matrix::BT2020) {
+    kr = 0.2627f;
+    kb = 0.0593f;
+  }
+  float kg = 1.0f - kr - kb;
+  float chromaScale = fullRange ? 1.0f : 255.0f / 224.0f;
+  float crR = 2.0f * (1.0f - kr);
+  float cbB = 2.0f * (1.0f - kb);
+  return {
+      fullRange ? 0.0f : 16.0f / 255.0f,
+      fullRange ? 1.0f : 255.0f / 219.0f,
+      crR * chromaScale,
+      cbB * kb / kg * chromaScale,
+      crR * kr / kg * chromaScale,
+      cbB * chromaScale,
+  };
+}
+
+const char* Colorimetry::name() const {
+  switch (matrix) {
+    case Matrix::BT709:
+      return fullRange ? "BT.709 full range" : "BT.709";
+    case Matrix::BT2020:
+      return fullRange ? "BT.2020 full range" : "BT.2020";
+    case Matrix::BT601:
+      break;
+  }
+  return fullRange ? "BT.601 full range" : "BT.601";
+}
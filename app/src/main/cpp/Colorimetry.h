@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <cstdint>
+
+namespace libyuv {
+struct YuvConstants;
+}
+
+// How the YUV samples of a stream map to RGB, picked once when the stream is
+// set up from the color matching descriptor of its format.
+struct Colorimetry {
+  enum class Matrix : uint8_t {
+    BT601,
+    BT709,
+    BT2020,
+  };
+
+  Matrix matrix{Matrix::BT601};
+  // Luma over 0-255 rather than 16-235, as JPEG has it.
+  bool fullRange{false};
+
+  // The descriptor's matrix coefficients, or the frame format's defaults when
+  // it has none or is null: BT.601 per UVC, BT.2020 for P010, which has no
+  // UVC format of its own and carries HDR. UVC signals no range, and its
+  // uncompressed YUV formats are limited range.
+  static Colorimetry of(const uvc_format_desc_t* format, uvc_frame_format frameFormat);
+
+  // For libyuv conversions from U and V planes or pairs in that order; yvu()
+  // for those writing ABGR by swapping them, such as NV21ToARGBMatrix.
+  const libyuv::YuvConstants* yuv() const;
+  const libyuv::YuvConstants* yvu() const;
+
+  // Luma and chroma weights: R = Y + crR V, G = Y - cbG U - crG V, B = Y +
+  // cbB U, with Y scaled from its range and U, V centered and scaled.
+  struct Coefficients {
+    float yOffset;
+    float yScale;
+    float crR;
+    float cbG;
+    float crG;
+    float cbB;
+  };
+  Coefficients coefficients() const;
+
+  const char* name() const;
+
+  bool operator==(const Colorimetry&) const = default;
+};
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ControlExecutor.h"
+
+#include <sys/prctl.h>
+#include <cstdio>
+
+ControlExecutor& ControlExecutor::shared() {
+  static ControlExecutor executor(kThreads);
+  return executor;
+}
+
+ControlExecutor::ControlExecutor(uint32_t threads) {
+  threads_.reserve(threads);
+  for (uint32_t i = 0; i < threads; i++) {
+    threads_.emplace_back(&ControlExecutor::workLoop, this, i);
+  }
+}
+
+ControlExecutor::~ControlExecutor() {
+  {
+    std::lock_guard lk(mutex_);
+    stopping_ = true;
+  }
+  change_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ControlExecutor::post(std::function<void()> work) {
+  {
+    std::lock_guard lk(mutex_);
+    pending_.push_back(std::move(work));
+  }
+  change_.notify_one();
+}
+
+void ControlExecutor::workLoop(uint32_t index) {
+  char name[16];
+  snprintf(name, sizeof(name), "usb_control_%u", index);
+  prctl(PR_SET_NAME, name);
+  std::unique_lock lk(mutex_);
+  while (!stopping_ || !pending_.empty()) {
+    if (pending_.empty()) {
+      change_.wait(lk);
+      continue;
+    }
+    std::function<void()> work = std::move(pending_.front());
+    pending_.pop_front();
+    lk.unlock();
+    work();
+    work = nullptr;
+    lk.lock();
+  }
+}
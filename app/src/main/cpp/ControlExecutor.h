@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A few threads that run the control plane: the connect, negotiate, start
+// and stop steps of the streamers, written as coroutines (see ControlTask.h)
+// that hop onto the executor with co_await schedule().
+//
+// Steps still block in libuvc and AAudio, so there are more threads than
+// pipelines: two blocking pipelines leave room for the short continuations
+// that resume after a USB control completes.
+class ControlExecutor final {
+ public:
+  static constexpr uint32_t kThreads = 4;
+
+  static ControlExecutor& shared();
+
+  ControlExecutor(const ControlExecutor&) = delete;
+  ControlExecutor& operator=(const ControlExecutor&) = delete;
+  // Runs what is still queued, then joins the threads.
+  ~ControlExecutor();
+
+  void post(std::function<void()> work);
+
+  // co_await schedule() resumes the coroutine on one of the executor threads.
+  auto schedule() {
+    struct Awaiter {
+      ControlExecutor& executor;
+      bool await_ready() const noexcept {
+        return false;
+      }
+      void await_suspend(std::coroutine_handle<> handle) {
+        executor.post([handle] { handle.resume(); });
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{*this};
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable change_;
+  std::deque<std::function<void()>> pending_{};
+  bool stopping_{false};
+  std::vector<std::thread> threads_{};
+
+  explicit ControlExecutor(uint32_t threads);
+  void workLoop(uint32_t index);
+};
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ControlExecutor.h"
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// A lazy coroutine producing a T: nothing runs until the task is awaited,
+// or started with launch(). The awaiting coroutine resumes on the thread
+// that finished the task.
+template <typename T>
+class Task final {
+ public:
+  struct promise_type {
+    std::optional<T> value{};
+    std::coroutine_handle<> continuation{};
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() const noexcept {
+      return {};
+    }
+    auto final_suspend() const noexcept {
+      struct Awaiter {
+        bool await_ready() const noexcept {
+          return false;
+        }
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<promise_type> handle) const noexcept {
+          std::coroutine_handle<> continuation = handle.promise().continuation;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+      };
+      return Awaiter{};
+    }
+    void return_value(T result) {
+      value = std::move(result);
+    }
+    void unhandled_exception() const noexcept {
+      std::terminate();
+    }
+  };
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+    handle_.promise().continuation = continuation;
+    return handle_;
+  }
+  T await_resume() {
+    return std::move(*handle_.promise().value);
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+};
+
+// A coroutine nobody awaits; its frame is freed when it returns.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() const noexcept {
+      return {};
+    }
+    std::suspend_never initial_suspend() const noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() const noexcept {
+      return {};
+    }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept {
+      std::terminate();
+    }
+  };
+};
+
+// Runs task on executor and hands its result to done, on whichever thread
+// finished it.
+template <typename T>
+DetachedTask launch(ControlExecutor& executor, Task<T> task, std::function<void(T)> done) {
+  co_await executor.schedule();
+  done(co_await std::move(task));
+}
+
+// Runs first and second at the same time, each on its own executor thread,
+// and resumes once both are done.
+template <typename A, typename B>
+Task<std::pair<A, B>> whenAll(ControlExecutor& executor, Task<A> first, Task<B> second) {
+  struct State {
+    std::atomic<int> left{2};
+    std::optional<A> first{};
+    std::optional<B> second{};
+    std::coroutine_handle<> waiter{};
+
+    void finishOne() {
+      if (left.fetch_sub(1) == 1) {
+        waiter.resume();
+      }
+    }
+  };
+  // Awaiters only hold references: GCC 12 destroys the members of a
+  // co_await temporary twice.
+  struct Awaiter {
+    ControlExecutor& executor;
+    const std::shared_ptr<State>& state;
+    Task<A>& first;
+    Task<B>& second;
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+      state->waiter = handle;
+      launch<A>(executor, std::move(first), [state = state](A result) {
+        state->first = std::move(result);
+        state->finishOne();
+      });
+      launch<B>(executor, std::move(second), [state = state](B result) {
+        state->second = std::move(result);
+        state->finishOne();
+      });
+    }
+    void await_resume() const noexcept {}
+  };
+  auto state = std::make_shared<State>();
+  co_await Awaiter{executor, state, first, second};
+  co_return std::pair<A, B>(std::move(*state->first), std::move(*state->second));
+}
+
+// co_await awaitCallback<T>(executor, start) calls start with a callback and
+// resumes on executor with the value the callback was given, so a completion
+// arriving on the USB event thread never runs the rest of the coroutine there.
+// The callback must be called exactly once.
+template <typename T>
+Task<T> awaitCallback(
+    ControlExecutor& executor,
+    std::function<void(std::function<void(T)>)> start) {
+  struct Awaiter {
+    ControlExecutor& executor;
+    std::function<void(std::function<void(T)>)>& start;
+    std::optional<T>& value;
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+      start([&executor = executor, &value = value, handle](T result) {
+        value = std::move(result);
+        executor.post([handle] { handle.resume(); });
+      });
+    }
+    void await_resume() const noexcept {}
+  };
+  std::optional<T> value;
+  co_await Awaiter{executor, start, value};
+  co_return std::move(*value);
+}
+
+// Cooperative cancellation shared between a control operation and whoever
+// may abandon it. Steps check it between blocking calls; cancelling never
+// interrupts one.
+class CancelToken final {
+ public:
+  CancelToken() : cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+  void cancel() const {
+    cancelled_->store(true);
+  }
+  bool cancelled() const {
+    return cancelled_->load();
+  }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+};
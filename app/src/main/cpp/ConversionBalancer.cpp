@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ConversionBalancer.h"
+
+#include <algorithm>
+
+namespace {
+
+nanoseconds smooth(nanoseconds average, nanoseconds sample, uint32_t shift, bool first) {
+  return first ? sample : average + nanoseconds((sample - average).count() >> shift);
+}
+
+} // namespace
+
+void ConversionBalancer::reset() {
+  loads_ = {};
+  unavailable_ = {};
+  started_ = false;
+  overloadedSince_ = {};
+  dwell_ = kInitialDwell;
+  stale_ = kInitialStale;
+  moved_ = false;
+}
+
+ConversionBackend ConversionBalancer::record(
+    ConversionBackend backend,
+    nanoseconds queueDelay,
+    nanoseconds cost,
+    nanoseconds frameInterval,
+    steady_clock::time_point now) {
+  if (!started_) {
+    // Nothing is switched away from before a dwell time since the start.
+    started_ = true;
+    active_ = backend;
+    lastSwitch_ = now;
+  } else if (backend != active_) {
+    if (now - lastSwitch_ < dwell_ * 2) {
+      dwell_ = std::min(dwell_ * 2, kMaxDwell);
+    }
+    active_ = backend;
+    lastSwitch_ = now;
+    overloadedSince_ = {};
+    moved_ = true;
+    switches_++;
+  }
+  Load& load = loads_[(size_t)backend];
+  bool first = load.measuredAt.time_since_epoch().count() == 0;
+  load.cost = smooth(load.cost, cost, kSmoothingShift, first);
+  load.queueDelay = smooth(load.queueDelay, queueDelay, kSmoothingShift, first);
+  load.measuredAt = now;
+  nanoseconds busy = load.cost + load.queueDelay;
+  if (frameInterval.count() <= 0 || busy * 100 <= frameInterval * kOverloadPercent) {
+    overloadedSince_ = {};
+    if (now - lastSwitch_ >= kMaxDwell) {
+      // Settled for long enough that an old bounce says little.
+      dwell_ = kInitialDwell;
+      stale_ = kInitialStale;
+    }
+    return active_;
+  }
+  if (overloadedSince_.time_since_epoch().count() == 0) {
+    overloadedSince_ = now;
+    if (moved_ && now - lastSwitch_ < kSustain) {
+      // The switch did not help; the one left is not worth retrying soon.
+      stale_ = std::min(stale_ * 2, kMaxStale);
+    }
+  }
+  auto other = backend == ConversionBackend::CPU ? ConversionBackend::GPU : ConversionBackend::CPU;
+  if (unavailable_[(size_t)other] || now - overloadedSince_ < kSustain ||
+      now - lastSwitch_ < dwell_) {
+    return active_;
+  }
+  const Load& alternative = loads_[(size_t)other];
+  bool measured = alternative.measuredAt.time_since_epoch().count() != 0 &&
+      now - alternative.measuredAt < stale_;
+  if (measured && (alternative.cost + alternative.queueDelay) * 100 > busy * kMarginPercent) {
+    return active_;
+  }
+  return other;
+}
+
+void ConversionBalancer::switchFailed(ConversionBackend backend) {
+  unavailable_[(size_t)backend] = true;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+using namespace std::chrono;
+
+enum class ConversionBackend : uint8_t {
+  CPU, // FrameConverter into window or presenter buffers
+  GPU, // GlPreviewRenderer
+};
+
+// Routes a stream's preview conversion to whichever of the CPU and GPU
+// backends is less loaded, when what else runs on the phone makes one of
+// them the bottleneck.
+//
+// The load of a backend is its smoothed per frame cost, from taking a frame
+// off the render queue to posting it, plus how long frames waited in that
+// queue. Only the backend in use is measured; the other keeps what it was
+// last measured at. A backend using more than kOverloadPercent of the frame
+// interval for kSustain is left for the other one if that was last measured
+// at least kMarginPercent lighter, or so long ago it is worth another try.
+// A switch is never made within the dwell time of the previous one, and one
+// made within twice that doubles the dwell; a backend found overloaded
+// right after a switch to it doubles how long a measurement stays fresh.
+// Two backends that are both overloaded so settle instead of alternating.
+class ConversionBalancer final {
+ public:
+  struct Load {
+    nanoseconds cost{};
+    nanoseconds queueDelay{};
+    // Zero until the backend converted a frame since reset().
+    steady_clock::time_point measuredAt{};
+  };
+
+  // Forgets what both backends were measured at, for a new format or
+  // window.
+  void reset();
+
+  // Takes a frame that backend converted. Returns the backend the following
+  // frames should take; a different one asks for a switch, which the next
+  // frame converted by it confirms.
+  ConversionBackend record(
+      ConversionBackend backend,
+      nanoseconds queueDelay,
+      nanoseconds cost,
+      nanoseconds frameInterval,
+      steady_clock::time_point now);
+  // backend could not be set up and is not asked for again until reset().
+  void switchFailed(ConversionBackend backend);
+
+  const Load& load(ConversionBackend backend) const {
+    return loads_[(size_t)backend];
+  }
+  uint32_t switches() const {
+    return switches_;
+  }
+
+ private:
+  static constexpr int64_t kOverloadPercent = 80;
+  static constexpr int64_t kMarginPercent = 75;
+  static constexpr seconds kSustain{2};
+  static constexpr seconds kInitialDwell{5};
+  static constexpr seconds kMaxDwell{160};
+  // Loads older than this no longer tell how the other backend would do,
+  // until a retry finds it overloaded again.
+  static constexpr seconds kInitialStale{30};
+  static constexpr seconds kMaxStale{480};
+  // Weight of a new frame in the smoothed loads, as a shift.
+  static constexpr uint32_t kSmoothingShift = 4;
+
+  std::array<Load, 2> loads_{};
+  std::array<bool, 2> unavailable_{};
+  bool started_{false};
+  ConversionBackend active_{ConversionBackend::CPU};
+  steady_clock::time_point lastSwitch_{};
+  // Zero while the active backend keeps up.
+  steady_clock::time_point overloadedSince_{};
+  seconds dwell_{kInitialDwell};
+  seconds stale_{kInitialStale};
+  // A switch was made since reset().
+  bool moved_{false};
+  uint32_t switches_{};
+};
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "CpuFeatures.h"
+
+#include <android/log.h>
+#include <libyuv/cpu_id.h>
+#include <sys/auxv.h>
+
+#include <array>
+#include <utility>
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "CpuFeatures", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "CpuFeatures", __VA_ARGS__)
+
+#if defined(__aarch64__)
+// From the kernel's uapi asm/hwcap.h, for older NDK headers.
+static constexpr unsigned long kHwcapAsimd = 1UL << 1;
+static constexpr unsigned long kHwcapFphp = 1UL << 9;
+static constexpr unsigned long kHwcapAsimdhp = 1UL << 10;
+static constexpr unsigned long kHwcapAsimddp = 1UL << 20;
+static constexpr unsigned long kHwcapSve = 1UL << 22;
+static constexpr unsigned long kHwcap2Sve2 = 1UL << 1;
+static constexpr unsigned long kHwcap2I8mm = 1UL << 13;
+#endif
+
+static CpuFeatures detect() {
+  CpuFeatures features;
+#if defined(__aarch64__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  unsigned long hwcap2 = getauxval(AT_HWCAP2);
+  auto has = [](unsigned long caps, unsigned long bits) { return (caps & bits) == bits; };
+  features.flags |= has(hwcap, kHwcapAsimd) ? CpuFeatures::kNeon : 0;
+  features.flags |= has(hwcap, kHwcapFphp | kHwcapAsimdhp) ? CpuFeatures::kFp16 : 0;
+  features.flags |= has(hwcap, kHwcapAsimddp) ? CpuFeatures::kDotProd : 0;
+  features.flags |= has(hwcap2, kHwcap2I8mm) ? CpuFeatures::kI8mm : 0;
+  features.flags |= has(hwcap, kHwcapSve) ? CpuFeatures::kSve : 0;
+  features.flags |= has(hwcap2, kHwcap2Sve2) ? CpuFeatures::kSve2 : 0;
+#elif defined(__ARM_NEON)
+  features.flags |= CpuFeatures::kNeon;
+#elif defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  features.flags |= __builtin_cpu_supports("ssse3") ? CpuFeatures::kSsse3 : 0;
+  features.flags |= __builtin_cpu_supports("avx2") ? CpuFeatures::kAvx2 : 0;
+#endif
+  features.libyuvFlags = libyuv::TestCpuFlag(-1) & ~libyuv::kCpuInitialized;
+  return features;
+}
+
+const CpuFeatures& CpuFeatures::get() {
+  static const CpuFeatures features = [] {
+    CpuFeatures detected = detect();
+    ULOGI("CPU %s, libyuv flags 0x%x", detected.summary().c_str(), detected.libyuvFlags);
+    if (!detected.libyuvAgrees()) {
+      ULOGW("libyuv and the kernel disagree on NEON or AVX2");
+    }
+    return detected;
+  }();
+  return features;
+}
+
+CpuTier CpuFeatures::tier() const {
+  if ((flags & (kNeon | kFp16 | kDotProd)) != (kNeon | kFp16 | kDotProd)) {
+    return CpuTier::GENERIC;
+  }
+  return (flags & kSve2) != 0 ? CpuTier::ARMV9 : CpuTier::ARMV8_2;
+}
+
+bool CpuFeatures::libyuvAgrees() const {
+#if defined(__aarch64__) || defined(__arm__)
+  return ((flags & kNeon) != 0) == ((libyuvFlags & libyuv::kCpuHasNEON) != 0);
+#elif defined(__x86_64__) || defined(__i386__)
+  // A build with libyuv's x86 rows compiled out reports no AVX2.
+  return ((flags & kAvx2) != 0) == ((libyuvFlags & libyuv::kCpuHasAVX2) != 0);
+#else
+  return true;
+#endif
+}
+
+std::string CpuFeatures::summary() const {
+  static constexpr std::array<std::pair<uint32_t, const char*>, 8> kNames{{
+      {kNeon, "neon"},
+      {kFp16, "fp16"},
+      {kDotProd, "dotprod"},
+      {kI8mm, "i8mm"},
+      {kSve, "sve"},
+      {kSve2, "sve2"},
+      {kSsse3, "ssse3"},
+      {kAvx2, "avx2"},
+  }};
+  static constexpr std::array<const char*, 3> kTierNames{"generic", "armv8.2", "armv9"};
+  std::string text;
+  for (const auto& [flag, name] : kNames) {
+    if ((flags & flag) != 0) {
+      text += name;
+      text += ' ';
+    }
+  }
+  text += '(';
+  text += kTierNames[(int)tier()];
+  text += ')';
+  return text;
+}
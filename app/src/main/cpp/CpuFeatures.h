@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Instruction set extensions of the CPU, from the kernel's hardware
+// capabilities, against what the kernels we run were built to use.
+//
+// libyuv at this version has one Arm path, NEON, picked at run time from its
+// own cpu_id. Lens correction's remap has a dotprod variant, picked on
+// kDotProd; nothing has fp16 or SVE2 variants. The tier tells which of those
+// a build could dispatch to on this device, so stats and benchmark runs from
+// different phones can be told apart. On x86 libyuv picks SSSE3 or AVX2
+// rows, and PCM conversion and libuvc's payload copy have AVX2 variants
+// picked at run time too.
+enum class CpuTier : int {
+  GENERIC, // armv8-a with NEON, or not an Arm CPU
+  ARMV8_2, // dotprod and fp16 arithmetic
+  ARMV9, // SVE2 as well
+};
+
+struct CpuFeatures {
+  enum : uint32_t {
+    kNeon = 1 << 0,
+    kFp16 = 1 << 1, // half precision arithmetic, scalar and NEON
+    kDotProd = 1 << 2,
+    kI8mm = 1 << 3,
+    kSve = 1 << 4,
+    kSve2 = 1 << 5,
+    kSsse3 = 1 << 6,
+    kAvx2 = 1 << 7,
+  };
+
+  uint32_t flags{};
+  // libyuv::TestCpuFlag(-1) without the initialized bit: what libyuv
+  // dispatches on.
+  int32_t libyuvFlags{};
+
+  // Read once; any thread.
+  static const CpuFeatures& get();
+
+  CpuTier tier() const;
+  // Whether libyuv picked the NEON kernels on a CPU the kernel reports NEON
+  // for, and only then; on x86 the same for AVX2.
+  bool libyuvAgrees() const;
+  // "neon fp16 dotprod ... (armv8.2)".
+  std::string summary() const;
+};
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Deinterlacer.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <cstring>
+
+namespace deinterlace {
+namespace {
+
+// (above + below + 1) / 2.
+void interpolateRow(const uint8_t* above, const uint8_t* below, uint8_t* dst, size_t bytes) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= bytes; i += 16) {
+    vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(above + i), vld1q_u8(below + i)));
+  }
+#endif
+  for (; i < bytes; i++) {
+    dst[i] = (uint8_t)((above[i] + below[i] + 1) >> 1);
+  }
+}
+
+// About (above + 2 * row + below) / 4, as two halving adds so the NEON and
+// scalar kernels round alike.
+void blendRow(
+    const uint8_t* above,
+    const uint8_t* row,
+    const uint8_t* below,
+    uint8_t* dst,
+    size_t bytes) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= bytes; i += 16) {
+    uint8x16_t outer = vhaddq_u8(vld1q_u8(above + i), vld1q_u8(below + i));
+    vst1q_u8(dst + i, vrhaddq_u8(outer, vld1q_u8(row + i)));
+  }
+#endif
+  for (; i < bytes; i++) {
+    dst[i] = (uint8_t)((((above[i] + below[i]) >> 1) + row[i] + 1) >> 1);
+  }
+}
+
+// The row where it lies within kCombThreshold of the range of its
+// neighbours, their interpolation where it does not.
+void adaptiveRow(
+    const uint8_t* above,
+    const uint8_t* row,
+    const uint8_t* below,
+    uint8_t* dst,
+    size_t bytes) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  uint8x16_t threshold = vdupq_n_u8(kCombThreshold);
+  for (; i + 16 <= bytes; i += 16) {
+    uint8x16_t a = vld1q_u8(above + i);
+    uint8x16_t b = vld1q_u8(below + i);
+    uint8x16_t r = vld1q_u8(row + i);
+    uint8x16_t low = vqsubq_u8(vminq_u8(a, b), threshold);
+    uint8x16_t high = vqaddq_u8(vmaxq_u8(a, b), threshold);
+    uint8x16_t combed = vorrq_u8(vcltq_u8(r, low), vcgtq_u8(r, high));
+    vst1q_u8(dst + i, vbslq_u8(combed, vrhaddq_u8(a, b), r));
+  }
+#endif
+  for (; i < bytes; i++) {
+    int a = above[i];
+    int b = below[i];
+    int r = row[i];
+    bool combed = r + kCombThreshold < (a < b ? a : b) || r > (a > b ? a : b) + kCombThreshold;
+    dst[i] = combed ? (uint8_t)((a + b + 1) >> 1) : (uint8_t)r;
+  }
+}
+
+} // namespace
+
+void deinterlaceRows(
+    DeinterlaceMode mode,
+    bool topFieldFirst,
+    const uint8_t* src,
+    size_t step,
+    int32_t height,
+    size_t rowBytes,
+    int32_t row,
+    int32_t rows,
+    uint8_t* dst) {
+  // The later field's rows are kept as they are.
+  int32_t keptParity = topFieldFirst ? 1 : 0;
+  for (int32_t y = row; y < row + rows; y++, dst += step) {
+    const uint8_t* current = src + (size_t)y * step;
+    if (mode == DeinterlaceMode::OFF || height < 2 ||
+        (mode != DeinterlaceMode::BLEND && (y & 1) == keptParity)) {
+      memcpy(dst, current, rowBytes);
+      continue;
+    }
+    // Edge rows stand in for the missing neighbour with the one they have,
+    // which belongs to the other field as well.
+    const uint8_t* above = y > 0 ? current - step : current + step;
+    const uint8_t* below = y + 1 < height ? current + step : current - step;
+    switch (mode) {
+      case DeinterlaceMode::BOB:
+        interpolateRow(above, below, dst, rowBytes);
+        break;
+      case DeinterlaceMode::BLEND:
+        blendRow(above, current, below, dst, rowBytes);
+        break;
+      default:
+        adaptiveRow(above, current, below, dst, rowBytes);
+        break;
+    }
+  }
+}
+
+} // namespace deinterlace
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// How the two fields of an interlaced frame, woven into alternate rows by
+// capture cards and analog bridges, are combined into one progressive frame.
+enum class DeinterlaceMode : uint8_t {
+  OFF,
+  // Keeps the rows of the later field and interpolates the others from the
+  // rows above and below: no combing, at half the vertical resolution.
+  BOB,
+  // Filters every row with its neighbours, 1 2 1: no combing and no
+  // flicker, at the cost of softening still detail.
+  BLEND,
+  // Keeps the rows of the later field and weaves in the other field's rows
+  // where they agree with their neighbours, interpolating only where they
+  // stick out of them, as moving edges comb.
+  ADAPTIVE,
+};
+
+// Row kernels on packed bytes, NEON where available. The 4:2:2 formats keep
+// luma and chroma in the same rows, so each runs over YUYV and UYVY rows
+// alike without unpacking them.
+namespace deinterlace {
+
+// How far a row of the woven field may lie outside the range of the rows
+// above and below before ADAPTIVE takes it for motion, in 8 bit codes.
+constexpr uint8_t kCombThreshold = 12;
+
+// Writes the rows [row, row + rows) of a frame of height rows, rowBytes each
+// step bytes apart, to dst, whose rows are step bytes apart as well. Rows
+// outside the band are read as neighbours, so disjoint bands may be written
+// concurrently. topFieldFirst tells which field is the later one: the
+// bottom, odd rows when the top field is first.
+void deinterlaceRows(
+    DeinterlaceMode mode,
+    bool topFieldFirst,
+    const uint8_t* src,
+    size_t step,
+    int32_t height,
+    size_t rowBytes,
+    int32_t row,
+    int32_t rows,
+    uint8_t* dst);
+
+} // namespace deinterlace
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Demosaic.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libyuv/convert_argb.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace demosaic {
+namespace {
+
+// Columns of a row balanced at a time, into a buffer on the stack with
+// kMargin more on either side for their neighbors.
+constexpr int32_t kChunk = 256;
+constexpr int32_t kMargin = 2;
+constexpr int32_t kChunkBytes = kChunk + 2 * kMargin;
+
+// 8.8 fixed point, below 16.
+uint16_t fixedGain(float gain) {
+  return (uint16_t)std::lround(std::clamp(gain, 0.0f, 15.99f) * 256.0f);
+}
+
+// Reflects i about the first and last of size indexes, which keeps its
+// parity and with it the color of a mosaic's sample.
+int32_t mirror(int32_t i, int32_t size) {
+  if (i < 0) {
+    i = -i;
+  } else if (i >= size) {
+    i = 2 * (size - 1) - i;
+  }
+  return std::clamp(i, 0, size - 1);
+}
+
+// Gains of the even and odd columns of a row, and the shift that brings a
+// sample times its gain to 8 bits: the sample's bits, the gain's 8 included.
+struct RowGains {
+  uint16_t even;
+  uint16_t odd;
+  int32_t shift;
+};
+
+#if defined(__ARM_NEON)
+uint16x8_t loadSamples(const uint8_t* samples) {
+  return vmovl_u8(vld1_u8(samples));
+}
+
+uint16x8_t loadSamples(const uint16_t* samples) {
+  return vld1q_u16(samples);
+}
+
+// Balances the columns from x on, 8 at a time, into out indexed by column;
+// returns the first left.
+template <typename Sample>
+int32_t balanceNeon(
+    const Sample* samples,
+    int32_t x,
+    int32_t end,
+    const RowGains& gains,
+    uint8_t* out) {
+  uint16_t lanes[8];
+  for (int32_t i = 0; i < 8; i++) {
+    lanes[i] = ((x + i) & 1) != 0 ? gains.odd : gains.even;
+  }
+  uint16x8_t gain = vld1q_u16(lanes);
+  int32x4_t shift = vdupq_n_s32(-gains.shift);
+  for (; x + 8 <= end; x += 8) {
+    uint16x8_t v = loadSamples(samples + x);
+    uint32x4_t low = vshlq_u32(vmull_u16(vget_low_u16(v), vget_low_u16(gain)), shift);
+    uint32x4_t high = vshlq_u32(vmull_u16(vget_high_u16(v), vget_high_u16(gain)), shift);
+    vst1_u8(out + x, vqmovn_u16(vcombine_u16(vqmovn_u32(low), vqmovn_u32(high))));
+  }
+  return x;
+}
+#endif
+
+// Writes the white balanced 8 bit samples of the columns
+// [x0 - kMargin, x0 + count + kMargin) of row to out, mirrored past its
+// edges.
+template <typename Sample>
+void balanceRow(
+    const uint8_t* row,
+    int32_t width,
+    int32_t x0,
+    int32_t count,
+    const RowGains& gains,
+    uint8_t* out) {
+  const auto* samples = reinterpret_cast<const Sample*>(row);
+  auto balance = [&](int32_t x) {
+    uint32_t gain = (x & 1) != 0 ? gains.odd : gains.even;
+    return (uint8_t)std::min<uint32_t>(255, ((uint32_t)samples[x] * gain) >> gains.shift);
+  };
+  int32_t first = x0 - kMargin;
+  int32_t end = x0 + count + kMargin;
+  int32_t inner = std::max(first, 0);
+  int32_t innerEnd = std::min(end, width);
+  // Indexed by column.
+  out -= first;
+  for (int32_t x = first; x < inner; x++) {
+    out[x] = balance(mirror(x, width));
+  }
+  int32_t x = inner;
+  if (sizeof(Sample) == 1 && gains.even == 256 && gains.odd == 256) {
+    memcpy(out + x, row + x, innerEnd - x);
+    x = innerEnd;
+  }
+#if defined(__ARM_NEON)
+  x = balanceNeon(samples, x, innerEnd, gains, out);
+#endif
+  for (; x < innerEnd; x++) {
+    out[x] = balance(x);
+  }
+  for (x = innerEnd; x < end; x++) {
+    out[x] = balance(mirror(x, width));
+  }
+}
+
+// Balances the columns of a chunk by the format's sample size.
+void balanceChunk(
+    const BayerLayout& layout,
+    const uint8_t* row,
+    int32_t width,
+    int32_t x0,
+    int32_t count,
+    const RowGains& gains,
+    uint8_t* out) {
+  if (layout.bytesPerSample() == 2) {
+    balanceRow<uint16_t>(row, width, x0, count, gains, out);
+  } else {
+    balanceRow<uint8_t>(row, width, x0, count, gains, out);
+  }
+}
+
+// Pixel i of the balanced rows above, at and below it. own is the color of
+// the row's color sites, red or blue, and goes first in dst when ownFirst.
+void demosaicPixel(
+    const uint8_t* above,
+    const uint8_t* at,
+    const uint8_t* below,
+    int32_t i,
+    bool colorSite,
+    bool ownFirst,
+    uint8_t* dst) {
+  int32_t own;
+  int32_t green;
+  int32_t other;
+  if (colorSite) {
+    own = at[i];
+    green = (at[i - 1] + at[i + 1] + above[i] + below[i] + 2) >> 2;
+    other = (above[i - 1] + above[i + 1] + below[i - 1] + below[i + 1] + 2) >> 2;
+  } else {
+    own = (at[i - 1] + at[i + 1] + 1) >> 1;
+    green = at[i];
+    other = (above[i] + below[i] + 1) >> 1;
+  }
+  dst[0] = (uint8_t)(ownFirst ? own : other);
+  dst[1] = (uint8_t)green;
+  dst[2] = (uint8_t)(ownFirst ? other : own);
+  dst[3] = 255;
+}
+
+#if defined(__ARM_NEON)
+// (p + q + r + s + 2) / 4, as demosaicPixel() rounds.
+uint8x16_t average4(uint8x16_t p, uint8x16_t q, uint8x16_t r, uint8x16_t s) {
+  uint16x8_t low = vaddq_u16(
+      vaddl_u8(vget_low_u8(p), vget_low_u8(q)), vaddl_u8(vget_low_u8(r), vget_low_u8(s)));
+  uint16x8_t high = vaddq_u16(
+      vaddl_u8(vget_high_u8(p), vget_high_u8(q)), vaddl_u8(vget_high_u8(r), vget_high_u8(s)));
+  return vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2));
+}
+
+// 16 pairs of a color site and the green site after it at a time, from a
+// color site at i; returns the first pixel left. Loads split the pairs into
+// their two sites, and the neighbors across a pair's edges come from loads a
+// pair to the left or right.
+int32_t demosaicNeon(
+    const uint8_t* above,
+    const uint8_t* at,
+    const uint8_t* below,
+    int32_t i,
+    int32_t count,
+    bool ownFirst,
+    uint8_t* dst) {
+  uint8x16_t alpha = vdupq_n_u8(255);
+  for (; i + 32 <= count; i += 32) {
+    uint8x16x2_t row = vld2q_u8(at + i);
+    uint8x16_t left = vld2q_u8(at + i - 2).val[1];
+    uint8x16_t right = vld2q_u8(at + i + 2).val[0];
+    uint8x16x2_t up = vld2q_u8(above + i);
+    uint8x16_t upLeft = vld2q_u8(above + i - 2).val[1];
+    uint8x16x2_t down = vld2q_u8(below + i);
+    uint8x16_t downLeft = vld2q_u8(below + i - 2).val[1];
+
+    uint8x16_t colorOwn = row.val[0];
+    uint8x16_t colorGreen = average4(left, row.val[1], up.val[0], down.val[0]);
+    uint8x16_t colorOther = average4(upLeft, up.val[1], downLeft, down.val[1]);
+    uint8x16_t greenOwn = vrhaddq_u8(row.val[0], right);
+    uint8x16_t greenGreen = row.val[1];
+    uint8x16_t greenOther = vrhaddq_u8(up.val[1], down.val[1]);
+
+    uint8x16x2_t first = ownFirst ? vzipq_u8(colorOwn, greenOwn) : vzipq_u8(colorOther, greenOther);
+    uint8x16x2_t green = vzipq_u8(colorGreen, greenGreen);
+    uint8x16x2_t third = ownFirst ? vzipq_u8(colorOther, greenOther) : vzipq_u8(colorOwn, greenOwn);
+    uint8_t* out = dst + (size_t)i * 4;
+    vst4q_u8(out, (uint8x16x4_t{{first.val[0], green.val[0], third.val[0], alpha}}));
+    vst4q_u8(out + 64, (uint8x16x4_t{{first.val[1], green.val[1], third.val[1], alpha}}));
+  }
+  return i;
+}
+#endif
+
+// The count pixels of a chunk from its balanced rows, indexed from its
+// first column; the row's color sites are at the columns of colorParity.
+void demosaicChunk(
+    const uint8_t* above,
+    const uint8_t* at,
+    const uint8_t* below,
+    int32_t count,
+    int32_t colorParity,
+    bool ownFirst,
+    uint8_t* dst) {
+  int32_t i = 0;
+  if (colorParity == 1) {
+    demosaicPixel(above, at, below, 0, false, ownFirst, dst);
+    i = 1;
+  }
+#if defined(__ARM_NEON)
+  i = demosaicNeon(above, at, below, i, count, ownFirst, dst);
+#endif
+  for (; i < count; i++) {
+    demosaicPixel(above, at, below, i, (i & 1) == colorParity, ownFirst, dst + (size_t)i * 4);
+  }
+}
+
+} // namespace
+
+void bayerRows(
+    const BayerLayout& layout,
+    const WhiteBalance& balance,
+    const uint8_t* src,
+    size_t step,
+    int32_t width,
+    int32_t height,
+    int32_t row,
+    int32_t rows,
+    uint8_t* dst,
+    size_t stride,
+    bool rgba) {
+  uint16_t red = fixedGain(balance.red);
+  uint16_t green = fixedGain(balance.green);
+  uint16_t blue = fixedGain(balance.blue);
+  int32_t shift = layout.bits;
+  alignas(16) uint8_t above[kChunkBytes];
+  alignas(16) uint8_t at[kChunkBytes];
+  alignas(16) uint8_t below[kChunkBytes];
+  for (int32_t y = row; y < row + rows; y++) {
+    bool redRow = (y & 1) == layout.redY;
+    // The row's red or blue sites; the rows above and below have green
+    // there and the other color between.
+    int32_t colorParity = redRow ? layout.redX : 1 - layout.redX;
+    uint16_t own = redRow ? red : blue;
+    uint16_t other = redRow ? blue : red;
+    RowGains atGains =
+        colorParity == 0 ? RowGains{own, green, shift} : RowGains{green, own, shift};
+    RowGains besideGains =
+        colorParity == 0 ? RowGains{green, other, shift} : RowGains{other, green, shift};
+    const uint8_t* aboveRow = src + (size_t)mirror(y - 1, height) * step;
+    const uint8_t* atRow = src + (size_t)y * step;
+    const uint8_t* belowRow = src + (size_t)mirror(y + 1, height) * step;
+    uint8_t* out = dst + (size_t)(y - row) * stride;
+    // Red first in R, G, B, A and blue first in B, G, R, A.
+    bool ownFirst = rgba == redRow;
+    for (int32_t x0 = 0; x0 < width; x0 += kChunk) {
+      int32_t count = std::min(kChunk, width - x0);
+      balanceChunk(layout, aboveRow, width, x0, count, besideGains, above);
+      balanceChunk(layout, atRow, width, x0, count, atGains, at);
+      balanceChunk(layout, belowRow, width, x0, count, besideGains, below);
+      // Chunks start on even columns.
+      demosaicChunk(
+          above + kMargin,
+          at + kMargin,
+          below + kMargin,
+          count,
+          colorParity,
+          ownFirst,
+          out + (size_t)x0 * 4);
+    }
+  }
+}
+
+void gray16Rows(
+    const uint8_t* src,
+    size_t step,
+    int32_t width,
+    int32_t row,
+    int32_t rows,
+    uint8_t* dst,
+    size_t stride) {
+  alignas(16) uint8_t gray[kChunkBytes];
+  RowGains gains{256, 256, 16};
+  for (int32_t y = row; y < row + rows; y++) {
+    const uint8_t* samples = src + (size_t)y * step;
+    uint8_t* out = dst + (size_t)(y - row) * stride;
+    for (int32_t x0 = 0; x0 < width; x0 += kChunk) {
+      int32_t count = std::min(kChunk, width - x0);
+      balanceRow<uint16_t>(samples, width, x0, count, gains, gray);
+      libyuv::J400ToARGB(gray + kMargin, 0, out + (size_t)x0 * 4, 0, count, 1);
+    }
+  }
+}
+
+} // namespace demosaic
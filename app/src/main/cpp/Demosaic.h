@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Gains of the red, green and blue samples of raw sensor frames, applied
+// before they are demosaiced. Raw Bayer cameras leave white balance to the
+// host; the gains are usually found once for the scene's lighting.
+struct WhiteBalance {
+  float red{1.0f};
+  float green{1.0f};
+  float blue{1.0f};
+
+  bool operator==(const WhiteBalance&) const = default;
+};
+
+// Where the red sample of each 2x2 quad of a Bayer mosaic is, and how many
+// bits its samples have: a byte each for 8 bits, little endian 16 bit words
+// otherwise, 10 bit samples in their low bits. bits is 0 for other formats.
+struct BayerLayout {
+  int32_t redX{};
+  int32_t redY{};
+  int32_t bits{};
+
+  int32_t bytesPerSample() const {
+    return bits > 8 ? 2 : 1;
+  }
+};
+
+// Row kernels turning raw sensor samples into libyuv ARGB or R, G, B, A
+// rows, NEON where available.
+namespace demosaic {
+
+// BY8 and BA81 are BGGR, as Linux's uvcvideo takes them.
+constexpr BayerLayout bayerLayout(uvc_frame_format format) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_BY8:
+    case UVC_FRAME_FORMAT_BA81:
+    case UVC_FRAME_FORMAT_SBGGR8:
+      return {1, 1, 8};
+    case UVC_FRAME_FORMAT_SGRBG8:
+      return {1, 0, 8};
+    case UVC_FRAME_FORMAT_SGBRG8:
+      return {0, 1, 8};
+    case UVC_FRAME_FORMAT_SRGGB8:
+      return {0, 0, 8};
+    case UVC_FRAME_FORMAT_SBGGR10:
+      return {1, 1, 10};
+    case UVC_FRAME_FORMAT_SGRBG10:
+      return {1, 0, 10};
+    case UVC_FRAME_FORMAT_SGBRG10:
+      return {0, 1, 10};
+    case UVC_FRAME_FORMAT_SRGGB10:
+      return {0, 0, 10};
+    case UVC_FRAME_FORMAT_SBGGR16:
+      return {1, 1, 16};
+    case UVC_FRAME_FORMAT_SGRBG16:
+      return {1, 0, 16};
+    case UVC_FRAME_FORMAT_SGBRG16:
+      return {0, 1, 16};
+    case UVC_FRAME_FORMAT_SRGGB16:
+      return {0, 0, 16};
+    default:
+      return {};
+  }
+}
+
+constexpr bool isBayer(uvc_frame_format format) {
+  return bayerLayout(format).bits != 0;
+}
+
+// Writes the rows [row, row + rows) of a width x height mosaic, whose rows
+// are step bytes apart, to dst at stride bytes apart: each sample is white
+// balanced and brought to 8 bits, then the two colors it lacks are averaged
+// from its nearest neighbors, bilinear interpolation. Rows outside the band
+// are read as neighbors, so disjoint bands may be written concurrently.
+// Edges are mirrored, which keeps every neighbor of the right color. Pixels
+// are B, G, R, A in memory, libyuv's ARGB, or R, G, B, A when rgba.
+void bayerRows(
+    const BayerLayout& layout,
+    const WhiteBalance& balance,
+    const uint8_t* src,
+    size_t step,
+    int32_t width,
+    int32_t height,
+    int32_t row,
+    int32_t rows,
+    uint8_t* dst,
+    size_t stride,
+    bool rgba);
+
+// Writes the rows [row, row + rows) of little endian 16 bit grey samples,
+// such as Y16, to dst as ARGB rows of their high bytes.
+void gray16Rows(
+    const uint8_t* src,
+    size_t step,
+    int32_t width,
+    int32_t row,
+    int32_t rows,
+    uint8_t* dst,
+    size_t stride);
+
+} // namespace demosaic
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DepthColorizer.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Turbo's polynomial approximation from Google's reference, per channel the
+// coefficients of t^0 to t^5, for t in 0-1 from blue to red.
+constexpr float kTurbo[3][6] = {
+    {0.13572138f, 4.61539260f, -42.66032258f, 132.13108234f, -152.94239396f, 59.28637943f},
+    {0.09140261f, 2.19418839f, 4.84296658f, -14.18503333f, 4.27729857f, 2.82956604f},
+    {0.10667330f, 12.64194608f, -60.58204836f, 110.36276771f, -89.90310912f, 27.34824973f},
+};
+
+void turbo(float t, float rgb[3]) {
+  for (int32_t c = 0; c < 3; c++) {
+    float value = 0.0f;
+    for (int32_t i = 5; i >= 0; i--) {
+      value = value * t + kTurbo[c][i];
+    }
+    rgb[c] = value;
+  }
+}
+
+uint32_t pack(uint8_t b0, uint8_t b1, uint8_t b2) {
+  uint8_t bytes[4] = {b0, b1, b2, 255};
+  uint32_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+} // namespace
+
+DepthColorizer::DepthColorizer() {
+  build();
+}
+
+void DepthColorizer::configure(const DepthRange& range) {
+  if (range == range_ && !rgba_.empty()) {
+    return;
+  }
+  range_ = range;
+  build();
+}
+
+void DepthColorizer::build() {
+  int32_t nearClip = range_.nearClip;
+  int32_t farClip = std::max<int32_t>(range_.farClip, nearClip + 1);
+  // The last entry is black, for everything beyond the far clip.
+  shift_ = 0;
+  while ((farClip >> shift_) >= kTableSize - 1) {
+    shift_++;
+  }
+  rgba_.assign(kTableSize, pack(0, 0, 0));
+  argb_.assign(kTableSize, pack(0, 0, 0));
+  int32_t span = 1 << shift_;
+  // Entry 0 holds the samples without a depth. Entries the clips fall in
+  // are colored, by their depths within the range.
+  for (int32_t i = 1; i < kTableSize - 1; i++) {
+    int32_t first = i << shift_;
+    if (first + span - 1 < nearClip || first > farClip) {
+      continue;
+    }
+    int32_t depth = std::clamp(first + span / 2, nearClip, farClip);
+    float t = (float)(depth - nearClip) / (farClip - nearClip);
+    float rgb[3];
+    if (range_.palette == DepthPalette::GRAY) {
+      rgb[0] = rgb[1] = rgb[2] = 1.0f - t;
+    } else {
+      turbo(1.0f - t, rgb);
+    }
+    uint8_t bytes[3];
+    for (int32_t c = 0; c < 3; c++) {
+      bytes[c] = (uint8_t)std::lround(std::clamp(rgb[c], 0.0f, 1.0f) * 255.0f);
+    }
+    rgba_[i] = pack(bytes[0], bytes[1], bytes[2]);
+    argb_[i] = pack(bytes[2], bytes[1], bytes[0]);
+  }
+}
+
+void DepthColorizer::colorizeRow(
+    const uint16_t* src,
+    int32_t width,
+    uint8_t* dst,
+    bool rgba) const {
+  const uint32_t* table = rgba ? rgba_.data() : argb_.data();
+  int32_t x = 0;
+#if defined(__ARM_NEON)
+  // Indexes 8 at a time, and the colors gathered into lanes with one load
+  // each, as NEON has no gather; stored whole.
+  int16x8_t shift = vdupq_n_s16((int16_t)-shift_);
+  uint16x8_t last = vdupq_n_u16(kTableSize - 1);
+  for (; x + 8 <= width; x += 8) {
+    uint16x8_t index = vminq_u16(vshlq_u16(vld1q_u16(src + x), shift), last);
+    uint32x4_t low = vdupq_n_u32(0);
+    uint32x4_t high = vdupq_n_u32(0);
+    low = vld1q_lane_u32(table + vgetq_lane_u16(index, 0), low, 0);
+    low = vld1q_lane_u32(table + vgetq_lane_u16(index, 1), low, 1);
+    low = vld1q_lane_u32(table + vgetq_lane_u16(index, 2), low, 2);
+    low = vld1q_lane_u32(table + vgetq_lane_u16(index, 3), low, 3);
+    high = vld1q_lane_u32(table + vgetq_lane_u16(index, 4), high, 0);
+    high = vld1q_lane_u32(table + vgetq_lane_u16(index, 5), high, 1);
+    high = vld1q_lane_u32(table + vgetq_lane_u16(index, 6), high, 2);
+    high = vld1q_lane_u32(table + vgetq_lane_u16(index, 7), high, 3);
+    vst1q_u8(dst + (size_t)x * 4, vreinterpretq_u8_u32(low));
+    vst1q_u8(dst + (size_t)x * 4 + 16, vreinterpretq_u8_u32(high));
+  }
+#endif
+  for (; x < width; x++) {
+    uint32_t color = table[std::min<uint32_t>(src[x] >> shift_, kTableSize - 1)];
+    memcpy(dst + (size_t)x * 4, &color, sizeof(color));
+  }
+}
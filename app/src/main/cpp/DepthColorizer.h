@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Colors depth is shown in, from near to far.
+enum class DepthPalette : uint8_t {
+  // Google's Turbo, red near to blue far, in steps that look even.
+  TURBO,
+  // White near to black far.
+  GRAY,
+};
+
+// The depths of Z16 frames that are shown, in the camera's depth units,
+// usually millimeters. Depths outside [nearClip, farClip] and 0, which depth
+// cameras send where they measured nothing, are black.
+struct DepthRange {
+  uint16_t nearClip{100};
+  uint16_t farClip{4000};
+  DepthPalette palette{DepthPalette::TURBO};
+
+  bool operator==(const DepthRange&) const = default;
+};
+
+// Colors Z16 depth frames through a lookup table of kTableSize colors, 16
+// KB that stays in L1 while rows are colored. Depths are looked up at depth
+// >> shift, the smallest shift that fits the far clip in the table, so
+// ranges of up to 4094 units have a color per unit and longer ones one per
+// 2, 4 or more units, the clips as coarse. The table is built once per
+// range, never per frame.
+class DepthColorizer final {
+ public:
+  static constexpr int32_t kTableSize = 4096;
+
+  DepthColorizer();
+
+  // Rebuilds the tables for range; cheap when it did not change.
+  void configure(const DepthRange& range);
+
+  const DepthRange& range() const {
+    return range_;
+  }
+
+  // Writes the colors of width little endian depth samples to dst, R, G, B,
+  // A in memory when rgba and B, G, R, A, libyuv's ARGB, otherwise. dst is
+  // only written, so it may be a window buffer.
+  void colorizeRow(const uint16_t* src, int32_t width, uint8_t* dst, bool rgba) const;
+
+ private:
+  DepthRange range_{};
+  int32_t shift_{};
+  // The same colors in both byte orders, as 32 bit words in memory order.
+  std::vector<uint32_t> rgba_{};
+  std::vector<uint32_t> argb_{};
+
+  void build();
+};
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "DeviceClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Camera oscillators are good to a few tens of ppm; a fit further off than
+// this is fitting transport noise.
+constexpr double kMaxDriftPpm = 500;
+// Beyond this a 32 bit device clock may have wrapped unseen.
+constexpr int64_t kMaxSampleGapNs = 30'000'000'000;
+} // namespace
+
+void DeviceClock::reset(uint32_t clockFrequency) {
+  clockFrequency_ = clockFrequency;
+  count_ = 0;
+  next_ = 0;
+  started_ = false;
+  lastSof_ = -1;
+  nsPerTick_ = clockFrequency != 0 ? 1e9 / clockFrequency : 0;
+  offsetNs_ = 0;
+  jitterNs_ = 0;
+}
+
+void DeviceClock::addSample(uint32_t scr, int32_t sof, int64_t hostNs) {
+  if (clockFrequency_ == 0) {
+    return;
+  }
+  if (started_) {
+    // A camera repeating the SCR of the same bus frame adds no information.
+    if (scr == lastScr_ && sof >= 0 && sof == lastSof_) {
+      return;
+    }
+    int64_t lastHostNs = samples_[(next_ + kWindow - 1) % kWindow].hostNs + firstHostNs_;
+    if (hostNs - lastHostNs > kMaxSampleGapNs) {
+      reset(clockFrequency_);
+    }
+  }
+  if (!started_) {
+    started_ = true;
+    firstHostNs_ = hostNs;
+    lastTicks_ = 0;
+  } else {
+    // Signed, so an SCR slightly behind the previous one stays behind it.
+    lastTicks_ += (int32_t)(scr - lastScr_);
+  }
+  lastScr_ = scr;
+  lastSof_ = sof;
+  samples_[next_] = {lastTicks_, hostNs - firstHostNs_};
+  next_ = (next_ + 1) % kWindow;
+  count_ = std::min(count_ + 1, kWindow);
+  fit();
+}
+
+void DeviceClock::fit() {
+  double nominal = 1e9 / clockFrequency_;
+  double slope = nominal;
+  if (count_ >= kMinSamples) {
+    double meanTicks = 0;
+    double meanHost = 0;
+    for (size_t i = 0; i < count_; i++) {
+      meanTicks += (double)samples_[i].ticks;
+      meanHost += (double)samples_[i].hostNs;
+    }
+    meanTicks /= (double)count_;
+    meanHost /= (double)count_;
+    double covariance = 0;
+    double tickVariance = 0;
+    for (size_t i = 0; i < count_; i++) {
+      double dt = (double)samples_[i].ticks - meanTicks;
+      covariance += dt * ((double)samples_[i].hostNs - meanHost);
+      tickVariance += dt * dt;
+    }
+    if (tickVariance > 0) {
+      double limit = nominal * kMaxDriftPpm / 1e6;
+      slope = std::clamp(covariance / tickVariance, nominal - limit, nominal + limit);
+    }
+  }
+  auto residual = [&](const Sample& sample) {
+    return (double)sample.hostNs - slope * (double)sample.ticks;
+  };
+  double lowest = INFINITY;
+  double mean = 0;
+  for (size_t i = 0; i < count_; i++) {
+    lowest = std::min(lowest, residual(samples_[i]));
+    mean += residual(samples_[i]);
+  }
+  mean /= (double)count_;
+  double variance = 0;
+  for (size_t i = 0; i < count_; i++) {
+    double d = residual(samples_[i]) - mean;
+    variance += d * d;
+  }
+  nsPerTick_ = slope;
+  offsetNs_ = lowest;
+  jitterNs_ = std::sqrt(variance / (double)count_);
+}
+
+DeviceClock::Estimate DeviceClock::toHost(uint32_t deviceTicks) const {
+  if (count_ == 0) {
+    return {};
+  }
+  int64_t ticks = lastTicks_ + (int32_t)(deviceTicks - lastScr_);
+  return {
+      .hostNs = firstHostNs_ + std::llround(offsetNs_ + (double)ticks * nsPerTick_),
+      .jitterNs = std::llround(jitterNs_),
+      .confident = count_ >= kMinSamples && jitterNs_ <= (double)kMaxJitterNs,
+  };
+}
+
+double DeviceClock::driftPpm() const {
+  if (count_ < kMinSamples) {
+    return 0;
+  }
+  return (1e9 / (nsPerTick_ * clockFrequency_) - 1) * 1e6;
+}
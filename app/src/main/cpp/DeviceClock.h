@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Recovers the mapping from a camera's clock to CLOCK_MONOTONIC.
+//
+// Every frame with an SCR gives a sample: the device clock when its last
+// payload left the camera, and the host time libuvc saw that payload
+// complete. A least squares fit over the recent samples gives the device
+// clock's rate against the host; the offset is taken from the lower envelope
+// of the samples, the ones with the least transport delay, so the mapping is
+// not dragged late by frames that sat in a queue. The spread of the other
+// samples around it is the jitter reported with each estimate.
+//
+// Device times are 32 bit counters, unwrapped against the last sample. Not
+// thread safe; the render thread owns it.
+class DeviceClock final {
+ public:
+  struct Estimate {
+    // Host time of the device time, 0 without enough samples.
+    int64_t hostNs{};
+    // Standard deviation of the samples around the fit.
+    int64_t jitterNs{};
+    // Fewer than kMinSamples, or jitter above kMaxJitterNs.
+    bool confident{false};
+  };
+
+  static constexpr size_t kMinSamples = 8;
+  static constexpr int64_t kMaxJitterNs = 2'000'000;
+
+  // Drops all samples; clockFrequency is dwClockFrequency of the stream.
+  void reset(uint32_t clockFrequency);
+
+  // scr is the STC of the frame's last SCR, sof its USB SOF counter or -1,
+  // hostNs its USB completion time.
+  void addSample(uint32_t scr, int32_t sof, int64_t hostNs);
+
+  Estimate toHost(uint32_t deviceTicks) const;
+
+  // Device clock rate against the host in parts per million, positive when it
+  // runs fast.
+  double driftPpm() const;
+  size_t samples() const {
+    return count_;
+  }
+  int64_t jitterNs() const {
+    return (int64_t)jitterNs_;
+  }
+
+ private:
+  // About four seconds at 30 fps, short enough to follow thermal drift.
+  static constexpr size_t kWindow = 128;
+
+  struct Sample {
+    int64_t ticks; // unwrapped device ticks since the first sample
+    int64_t hostNs; // relative to firstHostNs_
+  };
+
+  uint32_t clockFrequency_{};
+  std::array<Sample, kWindow> samples_{};
+  size_t count_{};
+  size_t next_{};
+  bool started_{false};
+  uint32_t lastScr_{};
+  int32_t lastSof_{-1};
+  int64_t lastTicks_{};
+  int64_t firstHostNs_{};
+
+  // Fit of hostNs = offsetNs_ + ticks * nsPerTick_, refreshed per sample.
+  double nsPerTick_{};
+  double offsetNs_{};
+  double jitterNs_{};
+
+  void fit();
+};
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FastPaths.h"
+
+#include <android/log.h>
+
+#include <array>
+#include <atomic>
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FastPaths", __VA_ARGS__)
+
+namespace {
+
+constexpr std::array<const char*, FastPaths::kCount> kNames{
+    "gpu-conversion",
+    "surface-control",
+    "hardware-frame-buffers",
+    "inline-callback",
+    "slice-conversion",
+    "render-ahead",
+    "stripe-conversion",
+    "mjpeg-decode-pool",
+    "hardware-mjpeg",
+    "mjpeg-decode-skipping",
+    "gpu-mjpeg",
+    "vulkan-conversion",
+};
+
+// The cohort in the high half, so a streamer never reads the paths of one
+// selection with the cohort of another.
+std::atomic<uint64_t> selection_{FastPaths::kAll};
+
+} // namespace
+
+void FastPaths::set(uint32_t allowed, uint32_t cohort) {
+  allowed &= kAll;
+  uint64_t packed = (uint64_t)cohort << 32 | allowed;
+  if (selection_.exchange(packed, std::memory_order_relaxed) != packed) {
+    ULOGI("Cohort %u, fast paths allowed: %s", cohort, names(allowed).c_str());
+  }
+}
+
+FastPaths::Selection FastPaths::get() {
+  uint64_t packed = selection_.load(std::memory_order_relaxed);
+  return Selection{(uint32_t)packed, (uint32_t)(packed >> 32)};
+}
+
+std::string FastPaths::names(uint32_t paths) {
+  std::string names;
+  for (uint32_t i = 0; i < kCount; i++) {
+    if ((paths & (1u << i)) != 0) {
+      names += names.empty() ? "" : " ";
+      names += kNames[i];
+    }
+  }
+  return names.empty() ? "none" : names;
+}
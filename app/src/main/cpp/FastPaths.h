@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Hot path implementations a fleet rollout can turn off at run time, so a
+// new one reaches a share of devices first and is rolled back without a new
+// build.
+//
+// The app sets the allowed paths and the cohort that picked them once at
+// session start. Each streamer takes the set when its output is configured
+// and keeps it for the session: every choice below is also subject to the
+// streamer's own setting, and a path the registry clears falls back to the
+// one streams took before it landed. The paths a stream actually runs on,
+// with the cohort, are published in StreamingStats and TelemetryLog records,
+// so sessions of the cohorts can be compared.
+enum FastPath : uint32_t {
+  FAST_PATH_GPU_CONVERSION = 1 << 0, // GlPreviewRenderer converts raw frames
+  FAST_PATH_SURFACE_CONTROL = 1 << 1, // CPU conversion presents on its own layer
+  FAST_PATH_HARDWARE_FRAME_BUFFERS = 1 << 2, // frames reassembled where the GPU reads them
+  FAST_PATH_INLINE_CALLBACK = 1 << 3, // frame callback on the USB event thread
+  FAST_PATH_SLICE_CONVERSION = 1 << 4, // bands converted as the frame arrives
+  FAST_PATH_RENDER_AHEAD = 1 << 5,
+  FAST_PATH_STRIPE_CONVERSION = 1 << 6, // CPU conversion split across workers
+  FAST_PATH_MJPEG_DECODE_POOL = 1 << 7,
+  FAST_PATH_HARDWARE_MJPEG = 1 << 8, // MJPEG through MediaCodec
+  FAST_PATH_MJPEG_DECODE_SKIPPING = 1 << 9,
+  FAST_PATH_GPU_MJPEG = 1 << 10, // MJPEG through GlPreviewRenderer's compute shader
+  FAST_PATH_VULKAN_CONVERSION = 1 << 11, // Raw frames through VulkanConverter
+};
+
+class FastPaths final {
+ public:
+  static constexpr uint32_t kCount = 12;
+  static constexpr uint32_t kAll = (1u << kCount) - 1;
+
+  struct Selection {
+    uint32_t allowed{kAll};
+    // Chosen by the app, 0 when none was set.
+    uint32_t cohort{0};
+
+    bool allows(FastPath path) const {
+      return (allowed & path) != 0;
+    }
+  };
+
+  // Any thread; streamers configured afterwards take it. Bits of paths this
+  // build does not have are ignored.
+  static void set(uint32_t allowed, uint32_t cohort);
+  static Selection get();
+  // "gpu-conversion slice-conversion", "none" when empty.
+  static std::string names(uint32_t paths);
+};
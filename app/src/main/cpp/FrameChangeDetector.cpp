@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameChangeDetector.h"
+
+#include <libyuv/compare.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+// Byte offset and spacing of the luma, or for RGB the green, samples of a row.
+struct LumaLayout {
+  int32_t offset;
+  int32_t pixelBytes;
+};
+
+bool lumaLayout(uvc_frame_format format, LumaLayout& layout) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_YUYV:
+      layout = {0, 2};
+      return true;
+    case UVC_FRAME_FORMAT_UYVY:
+      layout = {1, 2};
+      return true;
+    case UVC_FRAME_FORMAT_NV12:
+    case UVC_FRAME_FORMAT_GRAY8:
+      layout = {0, 1};
+      return true;
+    case UVC_FRAME_FORMAT_P010:
+      // The high byte of each little endian sample.
+      layout = {1, 2};
+      return true;
+    case UVC_FRAME_FORMAT_RGB:
+    case UVC_FRAME_FORMAT_BGR:
+      layout = {1, 3};
+      return true;
+    default:
+      return false;
+  }
+}
+
+} // namespace
+
+bool FrameChangeDetector::supportsFormat(uvc_frame_format format) {
+  LumaLayout layout;
+  return lumaLayout(format, layout);
+}
+
+void FrameChangeDetector::setConfig(const Config& config) {
+  threshold_.store(config.threshold, std::memory_order_relaxed);
+  refreshIntervalNs_.store(config.refreshIntervalNs, std::memory_order_relaxed);
+  partialUpdates_.store(config.partialUpdates, std::memory_order_relaxed);
+  enabled_.store(config.enabled, std::memory_order_relaxed);
+  invalidate();
+}
+
+FrameChangeDetector::Config FrameChangeDetector::config() const {
+  return {
+      enabled_.load(std::memory_order_relaxed),
+      threshold_.load(std::memory_order_relaxed),
+      refreshIntervalNs_.load(std::memory_order_relaxed),
+      partialUpdates_.load(std::memory_order_relaxed),
+  };
+}
+
+bool FrameChangeDetector::shouldShow(const uvc_frame_t* frame, int64_t nowNs) {
+  Config config = this->config();
+  band_ = {};
+  if (!config.enabled || !sampleGrid(frame, current_, columns_, rows_)) {
+    return true;
+  }
+  bool whole = invalidated_.exchange(false, std::memory_order_relaxed) ||
+      current_.size() != shown_.size() || nowNs - shownWholeNs_ >= config.refreshIntervalNs;
+  bool show = whole || nowNs - shownNs_ >= config.refreshIntervalNs || differs(config.threshold);
+  if (show) {
+    if (whole || !config.partialUpdates) {
+      shownWholeNs_ = nowNs;
+    } else {
+      band_ = changedRows(frame->height);
+      bandSequence_ = frame->sequence;
+    }
+    shown_.swap(current_);
+    shownNs_ = nowNs;
+  }
+  return show;
+}
+
+bool FrameChangeDetector::dirtyRows(const uvc_frame_t* frame, RowBand& band) const {
+  if (band_.count <= 0 || frame->sequence != bandSequence_) {
+    return false;
+  }
+  band = band_;
+  return true;
+}
+
+FrameChangeDetector::RowBand FrameChangeDetector::changedRows(uint32_t height) const {
+  int32_t top = rows_;
+  int32_t bottom = -1;
+  for (int32_t row = 0; row < rows_; row++) {
+    const uint8_t* current = &current_[(size_t)row * columns_];
+    const uint8_t* shown = &shown_[(size_t)row * columns_];
+    for (int32_t column = 0; column < columns_; column++) {
+      if (std::abs(current[column] - shown[column]) > kDirtyCellChange) {
+        top = std::min(top, row);
+        bottom = row;
+        break;
+      }
+    }
+  }
+  if (bottom < 0) {
+    // Changed below kDirtyCellChange everywhere: the refresh catches it.
+    return {0, 0};
+  }
+  // Each cell stands for the rows around its center; a change between two
+  // centers shows in either.
+  top = std::max(top - 1, 0);
+  bottom = std::min(bottom + 2, rows_);
+  int32_t first = (int32_t)((int64_t)top * height / rows_) & ~1;
+  int32_t last = (int32_t)((int64_t)bottom * height / rows_);
+  return {first, last - first};
+}
+
+bool FrameChangeDetector::sampleGrid(
+    const uvc_frame_t* frame,
+    std::vector<uint8_t>& grid,
+    int32_t& columns,
+    int32_t& rows) {
+  LumaLayout layout;
+  if (!lumaLayout(frame->frame_format, layout) || frame->width < 2 || frame->height < 2) {
+    return false;
+  }
+  // Each cell averages the 2x2 pixels at its center, which halves the noise.
+  columns = std::min<int32_t>(kGridWidth, frame->width / 2);
+  rows = std::min<int32_t>(kGridHeight, frame->height / 2);
+  grid.resize((size_t)columns * rows);
+  const auto* data = static_cast<const uint8_t*>(frame->data);
+  size_t step = frame->step;
+  for (int32_t row = 0; row < rows; row++) {
+    int32_t y = (int32_t)(((int64_t)row * 2 + 1) * frame->height / (rows * 2)) & ~1;
+    const uint8_t* top = data + (size_t)y * step + layout.offset;
+    const uint8_t* bottom = top + step;
+    for (int32_t column = 0; column < columns; column++) {
+      int32_t x = (int32_t)(((int64_t)column * 2 + 1) * frame->width / (columns * 2)) & ~1;
+      size_t left = (size_t)x * layout.pixelBytes;
+      size_t right = left + layout.pixelBytes;
+      grid[(size_t)row * columns + column] =
+          (uint8_t)((top[left] + top[right] + bottom[left] + bottom[right] + 2) / 4);
+    }
+  }
+  return true;
+}
+
+bool FrameChangeDetector::differs(double threshold) const {
+  uint64_t squaredError =
+      libyuv::ComputeSumSquareError(shown_.data(), current_.data(), (int)current_.size());
+  if (squaredError > threshold * current_.size()) {
+    return true;
+  }
+  // A small object moving shifts only a few cells.
+  for (size_t i = 0; i < current_.size(); i++) {
+    if (std::abs(current_[i] - shown_[i]) > kCellChange) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Tells the render thread when a frame looks like the last one shown, so a
+// static scene is not converted and posted again at the full frame rate.
+//
+// Each frame is reduced to a grid of luma averages, a few thousand bytes
+// read from the frame. A frame is shown when the mean squared difference of
+// its grid to that of the last frame shown exceeds the threshold, when any
+// one cell moved by more than kCellChange, or when the refresh interval ran
+// out. Comparing with the last frame shown rather than the previous one
+// keeps a slow drift from going unnoticed. Compressed formats are always
+// shown.
+//
+// With partial updates, a frame shown also reports the band of rows whose
+// cells changed, so only those are converted and posted. A frame is still
+// shown whole at least once per refresh interval, so what the band missed,
+// such as drift below kDirtyCellChange, is repainted.
+class FrameChangeDetector final {
+ public:
+  struct Config {
+    bool enabled{false};
+    // Mean squared luma difference per cell, in 8 bit codes, that counts as
+    // a change. Sensor noise alone stays around 2.
+    double threshold{6.0};
+    // Longest time between frames shown, so the preview stays alive, and
+    // with partial updates between frames shown whole.
+    int64_t refreshIntervalNs{1'000'000'000};
+    bool partialUpdates{false};
+  };
+
+  // Rows [first, first + count) of a frame.
+  struct RowBand {
+    int32_t first{};
+    int32_t count{};
+  };
+
+  // One cell changing this much shows the frame, however small the change
+  // is over the whole grid.
+  static constexpr int32_t kCellChange = 48;
+  // A cell changing more than this is in the band a partial update redraws.
+  static constexpr int32_t kDirtyCellChange = 6;
+
+  FrameChangeDetector() = default;
+  FrameChangeDetector(const FrameChangeDetector&) = delete;
+  FrameChangeDetector& operator=(const FrameChangeDetector&) = delete;
+
+  static bool supportsFormat(uvc_frame_format format);
+  // Reduces frame to at most kGridWidth by kGridHeight luma averages, row
+  // by row in grid, as shouldShow() does; false for formats without luma.
+  // MotionDetector compares frames on the same grid.
+  static bool sampleGrid(
+      const uvc_frame_t* frame,
+      std::vector<uint8_t>& grid,
+      int32_t& columns,
+      int32_t& rows);
+
+  // Any thread; the next frame is shown.
+  void setConfig(const Config& config);
+  Config config() const;
+  // Any thread, when something besides the frame changes what is shown, such
+  // as the crop or the format.
+  void invalidate() {
+    invalidated_.store(true, std::memory_order_relaxed);
+  }
+
+  // Render thread. Whether frame is to be shown, which makes it the one
+  // later frames are compared with. Always true when disabled.
+  bool shouldShow(const uvc_frame_t* frame, int64_t nowNs);
+  // Render thread. The rows of frame that changed since the frame shown
+  // before it, if shouldShow() was the last to show frame and found a band
+  // to redraw rather than the whole frame.
+  bool dirtyRows(const uvc_frame_t* frame, RowBand& band) const;
+
+  static constexpr int32_t kGridWidth = 64;
+  static constexpr int32_t kGridHeight = 36;
+
+ private:
+  // Config, field by field so each stays lock-free.
+  std::atomic<bool> enabled_{false};
+  std::atomic<double> threshold_{Config{}.threshold};
+  std::atomic<int64_t> refreshIntervalNs_{Config{}.refreshIntervalNs};
+  std::atomic<bool> partialUpdates_{false};
+  std::atomic<bool> invalidated_{true};
+  // Render thread only.
+  std::vector<uint8_t> shown_{};
+  std::vector<uint8_t> current_{};
+  int64_t shownNs_{};
+  int64_t shownWholeNs_{};
+  // Of the last frame shown, with an empty band when it was shown whole.
+  uint32_t bandSequence_{};
+  RowBand band_{};
+  int32_t columns_{};
+  int32_t rows_{};
+
+  bool differs(double threshold) const;
+  // Rows of a frame of height covered by the cells that moved past
+  // kDirtyCellChange, one cell of margin around them.
+  RowBand changedRows(uint32_t height) const;
+};
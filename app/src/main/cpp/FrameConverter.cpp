@@ -0,0 +1,1417 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameConverter.h"
+
+#include <android/hardware_buffer.h>
+#include <android/log.h>
+
+#include <libyuv.h>
+#include <libyuv/convert_argb.h>
+#include <libyuv/convert_from_argb.h>
+#include <libyuv/planar_functions.h>
+#include <libyuv/scale_argb.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "FrameConverter", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FrameConverter", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "FrameConverter", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "FrameConverter", __VA_ARGS__)
+
+namespace {
+
+// libyuv names pixel formats by 32-bit word order, so its ARGB is B, G, R, A
+// in memory and its ABGR is the R, G, B, A layout of R8G8B8A8_UNORM.
+
+constexpr int32_t kRgba8888 = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+constexpr int32_t kRgbx8888 = AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+constexpr int32_t kRgb888 = AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM;
+constexpr int32_t kRgb565 = AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM;
+constexpr int32_t kRgba1010102 = AHARDWAREBUFFER_FORMAT_R10G10B10A2_UNORM;
+constexpr int32_t kYv12 = FrameConverter::kYv12WindowFormat;
+
+// Rows converted to ARGB before they are swapped into the window buffer;
+// even, so 4:2:0 chunks own whole chroma rows.
+constexpr int32_t kSwapRows = 16;
+
+// Ordered 4x4 dither of the bits RGB565 drops, libyuv's default matrix.
+constexpr uint8_t kDither565[16] = {0, 4, 1, 5, 6, 2, 7, 3, 1, 5, 0, 4, 7, 3, 6, 2};
+
+// First byte of a window buffer row with the given bytes per pixel.
+uint8_t* bufferRow(const ANativeWindow_Buffer& buffer, int32_t row, int32_t bytesPerPixel) {
+  return static_cast<uint8_t*>(buffer.bits) + (size_t)row * buffer.stride * bytesPerPixel;
+}
+
+const uint8_t* frameRow(const uvc_frame_t* frame, int32_t row) {
+  return static_cast<const uint8_t*>(frame->data) + (size_t)row * frame->step;
+}
+
+// Writes the buffer rows [row, row + rows) with write(target, row, rows),
+// those among [overlayTop, overlayBottom) into overlay, the scratch buffer
+// the label is blended in, and the others straight into buffer.
+template <typename Write>
+bool writeAroundOverlay(
+    const ANativeWindow_Buffer& buffer,
+    const ANativeWindow_Buffer& overlay,
+    int32_t overlayTop,
+    int32_t overlayBottom,
+    int32_t row,
+    int32_t rows,
+    Write&& write) {
+  int32_t end = row + rows;
+  int32_t top = std::clamp(overlayTop, row, end);
+  int32_t bottom = std::clamp(overlayBottom, top, end);
+  return (top == row || write(buffer, row, top - row)) &&
+      (bottom == top || write(overlay, top, bottom - top)) &&
+      (bottom == end || write(buffer, bottom, end - bottom));
+}
+
+// Swaps the 10 bit R and B of packed 2:10:10:10 pixels from src into dst.
+// libyuv's AR30ToAB30 has only a C row; this loop vectorizes.
+void swapRedBlue1010102(const uint8_t* src, uint8_t* dst, int32_t width) {
+  for (int32_t x = 0; x < width; x++) {
+    uint32_t pixel;
+    memcpy(&pixel, src + (size_t)x * 4, 4);
+    pixel = (pixel & 0xc00ffc00) | ((pixel >> 20) & 0x3ff) | ((pixel & 0x3ff) << 20);
+    memcpy(dst + (size_t)x * 4, &pixel, 4);
+  }
+}
+
+// Planes of a locked YV12 window buffer starting at an even row: Y, then Cr
+// and Cb with the stride of half a Y row aligned to 16 bytes.
+struct Yv12Rows {
+  int yStride;
+  int chromaStride;
+  uint8_t* y;
+  uint8_t* v;
+  uint8_t* u;
+
+  Yv12Rows(const ANativeWindow_Buffer& buffer, int32_t row)
+      : yStride(buffer.stride), chromaStride(((buffer.stride / 2) + 15) & ~15) {
+    auto* bits = static_cast<uint8_t*>(buffer.bits);
+    uint8_t* crPlane = bits + (size_t)yStride * buffer.height;
+    uint8_t* cbPlane = crPlane + (size_t)chromaStride * (buffer.height / 2);
+    y = bits + (size_t)row * yStride;
+    v = crPlane + (size_t)(row / 2) * chromaStride;
+    u = cbPlane + (size_t)(row / 2) * chromaStride;
+  }
+};
+
+// Per source format conversions of the output rows [row, row + rows), which
+// are also the source rows since frames are not scaled. toArgb() writes
+// libyuv ARGB; toRgba(), toRgb888() and toRgb565() are optional direct
+// conversions into the window buffer that skip the intermediate ARGB rows.
+// toYv12() and toRgba1010102() are the only writers of their formats. Raw
+// Bayer sources read the rows next to the band as well.
+// Formats that can only be converted as a whole set kWholeFrame.
+//
+// Window buffers are written, never read: their memory is often uncached or
+// write-combined, where a read-modify-write pass costs several times the
+// conversion. Passes that fix up pixels after libyuv work on rows of the
+// cached ARGB scratch and then stream the result out, as the label does in
+// the overlay scratch.
+template <uvc_frame_format Format>
+struct Source;
+
+template <>
+struct Source<UVC_FRAME_FORMAT_YUYV> {
+  static int toArgb(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    return libyuv::YUY2ToARGBMatrix(
+        frameRow(frame, row),
+        frame->step,
+        dst,
+        stride,
+        converter.colorimetry().yuv(),
+        width,
+        rows);
+  }
+  static bool toRgba(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    return libyuv::YUY2ToABGRMatrix(
+               frameRow(frame, row),
+               frame->step,
+               bufferRow(buffer, row, 4),
+               buffer.stride * 4,
+               converter.colorimetry().yuv(),
+               buffer.width,
+               rows) == 0;
+  }
+  static bool toYv12(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    Yv12Rows dst(buffer, row);
+    return libyuv::YUY2ToI420(
+               frameRow(frame, row),
+               frame->step,
+               dst.y,
+               dst.yStride,
+               dst.u,
+               dst.chromaStride,
+               dst.v,
+               dst.chromaStride,
+               buffer.width,
+               rows) == 0;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_UYVY> {
+  static int toArgb(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    return libyuv::UYVYToARGBMatrix(
+        frameRow(frame, row),
+        frame->step,
+        dst,
+        stride,
+        converter.colorimetry().yuv(),
+        width,
+        rows);
+  }
+  static bool toYv12(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    Yv12Rows dst(buffer, row);
+    return libyuv::UYVYToI420(
+               frameRow(frame, row),
+               frame->step,
+               dst.y,
+               dst.yStride,
+               dst.u,
+               dst.chromaStride,
+               dst.v,
+               dst.chromaStride,
+               buffer.width,
+               rows) == 0;
+  }
+};
+
+// Stripes of 4:2:0 formats start on even rows so they own whole chroma rows.
+template <>
+struct Source<UVC_FRAME_FORMAT_NV12> {
+  static const uint8_t* uvRow(
+      const FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row) {
+    return converter.chromaRow(frame, row);
+  }
+  static int toArgb(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    return libyuv::NV12ToARGBMatrix(
+        frameRow(frame, row),
+        frame->step,
+        uvRow(converter, frame, row),
+        frame->step,
+        dst,
+        stride,
+        converter.colorimetry().yuv(),
+        width,
+        rows);
+  }
+  // NV12 read as NV21 with the U and V weights swapped writes R and B
+  // swapped, as libyuv's NV12ToABGR does.
+  static bool toRgba(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    return libyuv::NV21ToARGBMatrix(
+               frameRow(frame, row),
+               frame->step,
+               uvRow(converter, frame, row),
+               frame->step,
+               bufferRow(buffer, row, 4),
+               buffer.stride * 4,
+               converter.colorimetry().yvu(),
+               buffer.width,
+               rows) == 0;
+  }
+  static bool toRgb888(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    return libyuv::NV21ToRGB24Matrix(
+               frameRow(frame, row),
+               frame->step,
+               uvRow(converter, frame, row),
+               frame->step,
+               bufferRow(buffer, row, 3),
+               buffer.stride * 3,
+               converter.colorimetry().yvu(),
+               buffer.width,
+               rows) == 0;
+  }
+  static bool toRgb565(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    return libyuv::NV12ToRGB565Matrix(
+               frameRow(frame, row),
+               frame->step,
+               uvRow(converter, frame, row),
+               frame->step,
+               bufferRow(buffer, row, 2),
+               buffer.stride * 2,
+               converter.colorimetry().yuv(),
+               buffer.width,
+               rows) == 0;
+  }
+  // Only the chroma planes are split; no color conversion.
+  static bool toYv12(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    Yv12Rows dst(buffer, row);
+    return libyuv::NV12ToI420(
+               frameRow(frame, row),
+               frame->step,
+               uvRow(converter, frame, row),
+               frame->step,
+               dst.y,
+               dst.yStride,
+               dst.u,
+               dst.chromaStride,
+               dst.v,
+               dst.chromaStride,
+               buffer.width,
+               rows) == 0;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_MJPEG> {
+  static constexpr bool kWholeFrame = true;
+  static bool toRgba(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t,
+      int32_t) {
+    return converter.mjpegDecoder().decode(frame, buffer);
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_GRAY8> {
+  // Full range luma, copied into R, G and B.
+  static int toArgb(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    return libyuv::J400ToARGB(frameRow(frame, row), frame->step, dst, stride, width, rows);
+  }
+  // R, G and B are equal, so ARGB has the bytes of RGBA.
+  static bool toRgba(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    return libyuv::J400ToARGB(
+               frameRow(frame, row),
+               frame->step,
+               bufferRow(buffer, row, 4),
+               buffer.stride * 4,
+               buffer.width,
+               rows) == 0;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_BGR> {
+  // UVC BGR is B, G, R in memory, which libyuv calls RGB24.
+  static int toArgb(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    return libyuv::RGB24ToARGB(frameRow(frame, row), frame->step, dst, stride, width, rows);
+  }
+  // RAWToARGB reverses the three bytes as it widens them, which turns B, G, R
+  // into R, G, B, A.
+  static bool toRgba(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    return libyuv::RAWToARGB(
+               frameRow(frame, row),
+               frame->step,
+               bufferRow(buffer, row, 4),
+               buffer.stride * 4,
+               buffer.width,
+               rows) == 0;
+  }
+  static bool toRgb888(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    // A red/blue swap; libyuv's RAWToRGB24 works in either direction.
+    return libyuv::RAWToRGB24(
+               frameRow(frame, row),
+               frame->step,
+               bufferRow(buffer, row, 3),
+               buffer.stride * 3,
+               buffer.width,
+               rows) == 0;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_P010> {
+  // 10 bit samples in the high bits of little endian 16 bit words.
+  static int toArgb(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    int stride16 = frame->step / 2;
+    return libyuv::P010ToARGBMatrix(
+        reinterpret_cast<const uint16_t*>(frameRow(frame, row)),
+        stride16,
+        reinterpret_cast<const uint16_t*>(converter.chromaRow(frame, row)),
+        stride16,
+        dst,
+        stride,
+        converter.colorimetry().yuv(),
+        width,
+        rows);
+  }
+  // All 10 bits into R10G10B10A2, as libyuv AR30 a few rows at a time in the
+  // scratch, then swapped to R in the low bits on the way to the buffer.
+  static bool toRgba1010102(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    int stride16 = frame->step / 2;
+    int stride = buffer.stride * 4;
+    int scratchStride = FrameConverter::argbScratchStride(buffer.width);
+    for (int32_t done = 0; done < rows; done += kSwapRows) {
+      int32_t chunk = std::min(kSwapRows, rows - done);
+      uint8_t* scratch = converter.argbScratchRow(row + done, buffer.width);
+      if (libyuv::P010ToAR30Matrix(
+              reinterpret_cast<const uint16_t*>(frameRow(frame, row + done)),
+              stride16,
+              reinterpret_cast<const uint16_t*>(converter.chromaRow(frame, row + done)),
+              stride16,
+              scratch,
+              scratchStride,
+              converter.colorimetry().yuv(),
+              buffer.width,
+              chunk) != 0) {
+        return false;
+      }
+      uint8_t* dst = bufferRow(buffer, row + done, 4);
+      for (int32_t r = 0; r < chunk; r++) {
+        swapRedBlue1010102(
+            scratch + (size_t)r * scratchStride, dst + (size_t)r * stride, buffer.width);
+      }
+    }
+    return true;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_GRAY16> {
+  // The high byte of each sample.
+  static int toArgb(
+      FrameConverter&,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    demosaic::gray16Rows(
+        static_cast<const uint8_t*>(frame->data), frame->step, width, row, rows, dst, stride);
+    return 0;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_Z16> {
+  // Depth through the colorizer's table, straight into 32 bit buffers.
+  static int toArgb(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    for (int32_t r = 0; r < rows; r++) {
+      converter.depthColorizer().colorizeRow(
+          reinterpret_cast<const uint16_t*>(frameRow(frame, row + r)),
+          width,
+          dst + (size_t)r * stride,
+          false);
+    }
+    return 0;
+  }
+  static bool toRgba(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    for (int32_t r = 0; r < rows; r++) {
+      converter.depthColorizer().colorizeRow(
+          reinterpret_cast<const uint16_t*>(frameRow(frame, row + r)),
+          buffer.width,
+          bufferRow(buffer, row + r, 4),
+          true);
+    }
+    return true;
+  }
+};
+
+// Mosaics white balanced and demosaiced in one pass per row, straight into
+// 32 bit buffers.
+template <uvc_frame_format Format>
+struct BayerSource {
+  static constexpr BayerLayout kLayout = demosaic::bayerLayout(Format);
+
+  static int toArgb(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width) {
+    demosaic::bayerRows(
+        kLayout,
+        converter.whiteBalance(),
+        static_cast<const uint8_t*>(frame->data),
+        frame->step,
+        width,
+        frame->height,
+        row,
+        rows,
+        dst,
+        stride,
+        false);
+    return 0;
+  }
+  static bool toRgba(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows) {
+    demosaic::bayerRows(
+        kLayout,
+        converter.whiteBalance(),
+        static_cast<const uint8_t*>(frame->data),
+        frame->step,
+        buffer.width,
+        frame->height,
+        row,
+        rows,
+        bufferRow(buffer, row, 4),
+        (size_t)buffer.stride * 4,
+        true);
+    return true;
+  }
+};
+
+template <>
+struct Source<UVC_FRAME_FORMAT_BY8> : BayerSource<UVC_FRAME_FORMAT_BY8> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_BA81> : BayerSource<UVC_FRAME_FORMAT_BA81> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SGRBG8> : BayerSource<UVC_FRAME_FORMAT_SGRBG8> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SGBRG8> : BayerSource<UVC_FRAME_FORMAT_SGBRG8> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SRGGB8> : BayerSource<UVC_FRAME_FORMAT_SRGGB8> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SBGGR8> : BayerSource<UVC_FRAME_FORMAT_SBGGR8> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SGRBG10> : BayerSource<UVC_FRAME_FORMAT_SGRBG10> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SGBRG10> : BayerSource<UVC_FRAME_FORMAT_SGBRG10> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SRGGB10> : BayerSource<UVC_FRAME_FORMAT_SRGGB10> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SBGGR10> : BayerSource<UVC_FRAME_FORMAT_SBGGR10> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SGRBG16> : BayerSource<UVC_FRAME_FORMAT_SGRBG16> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SGBRG16> : BayerSource<UVC_FRAME_FORMAT_SGBRG16> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SRGGB16> : BayerSource<UVC_FRAME_FORMAT_SRGGB16> {};
+template <>
+struct Source<UVC_FRAME_FORMAT_SBGGR16> : BayerSource<UVC_FRAME_FORMAT_SBGGR16> {};
+
+template <uvc_frame_format Format>
+concept HasArgb = requires { &Source<Format>::toArgb; };
+template <uvc_frame_format Format>
+concept HasRgba = requires { &Source<Format>::toRgba; };
+template <uvc_frame_format Format>
+concept HasRgb888 = requires { &Source<Format>::toRgb888; };
+template <uvc_frame_format Format>
+concept HasRgb565 = requires { &Source<Format>::toRgb565; };
+template <uvc_frame_format Format>
+concept HasRgba1010102 = requires { &Source<Format>::toRgba1010102; };
+template <uvc_frame_format Format>
+concept HasYv12 = requires { &Source<Format>::toYv12; };
+template <uvc_frame_format Format>
+concept IsWholeFrame = requires { Source<Format>::kWholeFrame; };
+
+template <uvc_frame_format Format, int32_t WindowFormat>
+constexpr bool kUsesArgbScratch = (WindowFormat == kRgb888 && !HasRgb888<Format>) ||
+    (WindowFormat == kRgb565 && !HasRgb565<Format>) ||
+    ((WindowFormat == kRgba8888 || WindowFormat == kRgbx8888) && !HasRgba<Format>) ||
+    WindowFormat == kRgba1010102;
+
+template <uvc_frame_format Format, int32_t WindowFormat>
+bool convertRows(
+    FrameConverter& converter,
+    const uvc_frame_t* frame,
+    const ANativeWindow_Buffer& buffer,
+    int32_t row,
+    int32_t rows) {
+  if constexpr (WindowFormat == kYv12) {
+    return Source<Format>::toYv12(converter, frame, buffer, row, rows);
+  } else if constexpr (WindowFormat == kRgba1010102) {
+    return Source<Format>::toRgba1010102(converter, frame, buffer, row, rows);
+  } else if constexpr (WindowFormat == kRgba8888 || WindowFormat == kRgbx8888) {
+    if constexpr (HasRgba<Format>) {
+      return Source<Format>::toRgba(converter, frame, buffer, row, rows);
+    } else {
+      // ARGB into the scratch a few rows at a time, then swapped to RGBA on
+      // the way to the buffer while the rows are still in cache.
+      int stride = buffer.stride * 4;
+      int argbStride = FrameConverter::argbScratchStride(buffer.width);
+      for (int32_t done = 0; done < rows; done += kSwapRows) {
+        int32_t chunk = std::min(kSwapRows, rows - done);
+        uint8_t* argb = converter.argbScratchRow(row + done, buffer.width);
+        if (Source<Format>::toArgb(
+                converter, frame, row + done, chunk, argb, argbStride, buffer.width) != 0 ||
+            libyuv::ARGBToABGR(
+                argb,
+                argbStride,
+                bufferRow(buffer, row + done, 4),
+                stride,
+                buffer.width,
+                chunk) != 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+  } else if constexpr (WindowFormat == kRgb888 && HasRgb888<Format>) {
+    return Source<Format>::toRgb888(converter, frame, buffer, row, rows);
+  } else if constexpr (WindowFormat == kRgb565 && HasRgb565<Format>) {
+    return Source<Format>::toRgb565(converter, frame, buffer, row, rows);
+  } else {
+    int argbStride = FrameConverter::argbScratchStride(buffer.width);
+    uint8_t* argb = converter.argbScratchRow(row, buffer.width);
+    if (Source<Format>::toArgb(
+            converter, frame, row, rows, argb, argbStride, buffer.width) != 0) {
+      return false;
+    }
+    if constexpr (WindowFormat == kRgb888) {
+      return libyuv::ARGBToRAW(
+                 argb,
+                 argbStride,
+                 bufferRow(buffer, row, 3),
+                 buffer.stride * 3,
+                 buffer.width,
+                 rows) == 0;
+    } else if (converter.dither()) {
+      // The matrix starts on the band's first row, so bands line up.
+      uint8_t dither[16];
+      for (int32_t i = 0; i < 16; i++) {
+        dither[i] = kDither565[((row + i / 4) % 4) * 4 + i % 4];
+      }
+      return libyuv::ARGBToRGB565Dither(
+                 argb,
+                 argbStride,
+                 bufferRow(buffer, row, 2),
+                 buffer.stride * 2,
+                 dither,
+                 buffer.width,
+                 rows) == 0;
+    } else {
+      return libyuv::ARGBToRGB565(
+                 argb,
+                 argbStride,
+                 bufferRow(buffer, row, 2),
+                 buffer.stride * 2,
+                 buffer.width,
+                 rows) == 0;
+    }
+  }
+}
+
+template <uvc_frame_format Format, int32_t WindowFormat>
+constexpr bool kIsSupported = WindowFormat == kYv12 ? HasYv12<Format>
+    : WindowFormat == kRgba1010102 ? HasRgba1010102<Format>
+    : (WindowFormat == kRgba8888 || WindowFormat == kRgbx8888)
+    ? (HasRgba<Format> || HasArgb<Format>)
+    : (WindowFormat == kRgb888 ? (HasRgb888<Format> || HasArgb<Format>)
+                               : (HasRgb565<Format> || HasArgb<Format>));
+
+struct ConverterEntry {
+  uvc_frame_format frameFormat;
+  int32_t windowFormat;
+  FrameConverter::ConvertFn convert;
+  FrameConverter::ArgbRowsFn toArgb;
+  bool wholeFrame;
+  bool usesArgbScratch;
+};
+
+template <uvc_frame_format Format, int32_t WindowFormat>
+constexpr ConverterEntry entry() {
+  if constexpr (kIsSupported<Format, WindowFormat>) {
+    FrameConverter::ArgbRowsFn toArgb = nullptr;
+    if constexpr (HasArgb<Format>) {
+      toArgb = &Source<Format>::toArgb;
+    }
+    return {
+        Format,
+        WindowFormat,
+        &convertRows<Format, WindowFormat>,
+        toArgb,
+        IsWholeFrame<Format>,
+        kUsesArgbScratch<Format, WindowFormat>};
+  } else {
+    return {Format, WindowFormat, nullptr, nullptr, false, false};
+  }
+}
+
+template <uvc_frame_format... Formats>
+constexpr auto makeConverterTable() {
+  return std::array<ConverterEntry, sizeof...(Formats) * 6>{
+      entry<Formats, kRgba8888>()...,
+      entry<Formats, kRgbx8888>()...,
+      entry<Formats, kRgb888>()...,
+      entry<Formats, kRgb565>()...,
+      entry<Formats, kYv12>()...,
+      entry<Formats, kRgba1010102>()...,
+  };
+}
+
+constexpr auto kConverters = makeConverterTable<
+    UVC_FRAME_FORMAT_YUYV,
+    UVC_FRAME_FORMAT_UYVY,
+    UVC_FRAME_FORMAT_NV12,
+    UVC_FRAME_FORMAT_MJPEG,
+    UVC_FRAME_FORMAT_GRAY8,
+    UVC_FRAME_FORMAT_BGR,
+    UVC_FRAME_FORMAT_P010,
+    UVC_FRAME_FORMAT_GRAY16,
+    UVC_FRAME_FORMAT_BY8,
+    UVC_FRAME_FORMAT_BA81,
+    UVC_FRAME_FORMAT_SGRBG8,
+    UVC_FRAME_FORMAT_SGBRG8,
+    UVC_FRAME_FORMAT_SRGGB8,
+    UVC_FRAME_FORMAT_SBGGR8,
+    UVC_FRAME_FORMAT_SGRBG10,
+    UVC_FRAME_FORMAT_SGBRG10,
+    UVC_FRAME_FORMAT_SRGGB10,
+    UVC_FRAME_FORMAT_SBGGR10,
+    UVC_FRAME_FORMAT_SGRBG16,
+    UVC_FRAME_FORMAT_SGBRG16,
+    UVC_FRAME_FORMAT_SRGGB16,
+    UVC_FRAME_FORMAT_SBGGR16,
+    UVC_FRAME_FORMAT_Z16>();
+
+const ConverterEntry* findConverter(uvc_frame_format frameFormat, int32_t windowFormat) {
+  for (const auto& converter : kConverters) {
+    if (converter.frameFormat == frameFormat && converter.windowFormat == windowFormat) {
+      return converter.convert != nullptr ? &converter : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+struct StripeJob {
+  FrameConverter* converter;
+  FrameConverter::ConvertFn convert;
+  const uvc_frame_t* frame;
+  const ANativeWindow_Buffer* buffer;
+  int32_t height;
+  int32_t stripeRows;
+  std::atomic<bool> succeeded{true};
+};
+
+void convertStripe(void* context, uint32_t stripe) {
+  auto* job = static_cast<StripeJob*>(context);
+  int32_t row = stripe * job->stripeRows;
+  int32_t rows = std::min(job->stripeRows, job->height - row);
+  if (!job->convert(*job->converter, job->frame, *job->buffer, row, rows)) {
+    job->succeeded = false;
+  }
+}
+
+struct ScaleJob {
+  FrameConverter* converter;
+  FrameConverter::ArgbRowsFn toArgb;
+  const RowScaler* scaler;
+  RowScaler::Scratch* scratch;
+  const uvc_frame_t* frame;
+  const ANativeWindow_Buffer* buffer;
+  int32_t stripeRows;
+  // Where the label's rows go, see writeAroundOverlay().
+  ANativeWindow_Buffer overlay;
+  int32_t overlayTop;
+  int32_t overlayBottom;
+  std::atomic<bool> succeeded{true};
+};
+
+bool fetchArgbRows(void* context, int32_t row, int32_t rows, uint8_t* dst, size_t stride) {
+  auto* job = static_cast<ScaleJob*>(context);
+  return job->toArgb(
+             *job->converter, job->frame, row, rows, dst, (int)stride, job->frame->width) == 0;
+}
+
+void scaleStripe(void* context, uint32_t stripe) {
+  auto* job = static_cast<ScaleJob*>(context);
+  int32_t row = stripe * job->stripeRows;
+  int32_t rows = std::min(job->stripeRows, job->buffer->height - row);
+  // Rows are scaled as libyuv ARGB, the B, G, R, A the window's R, G, B, A
+  // is swapped from on the way out.
+  if (!writeAroundOverlay(
+          *job->buffer,
+          job->overlay,
+          job->overlayTop,
+          job->overlayBottom,
+          row,
+          rows,
+          [&](const ANativeWindow_Buffer& target, int32_t first, int32_t count) {
+            return job->scaler->scaleRows(
+                job->scratch[stripe],
+                first,
+                count,
+                &fetchArgbRows,
+                job,
+                bufferRow(target, first, 4),
+                (size_t)target.stride * 4,
+                true);
+          })) {
+    job->succeeded = false;
+  }
+}
+
+struct RemapJob {
+  const DewarpMap* map;
+  const uint8_t* source;
+  size_t sourceStride;
+  const ANativeWindow_Buffer* buffer;
+  int32_t stripeRows;
+  ANativeWindow_Buffer overlay;
+  int32_t overlayTop;
+  int32_t overlayBottom;
+};
+
+void remapStripe(void* context, uint32_t stripe) {
+  auto* job = static_cast<RemapJob*>(context);
+  int32_t row = stripe * job->stripeRows;
+  writeAroundOverlay(
+      *job->buffer,
+      job->overlay,
+      job->overlayTop,
+      job->overlayBottom,
+      row,
+      std::min(job->stripeRows, job->map->height() - row),
+      [&](const ANativeWindow_Buffer& target, int32_t first, int32_t count) {
+        job->map->remapRows(
+            job->source,
+            job->sourceStride,
+            static_cast<uint8_t*>(target.bits),
+            (size_t)target.stride * 4,
+            first,
+            count);
+        return true;
+      });
+}
+
+} // namespace
+
+bool FrameConverter::isSupported(uvc_frame_format frameFormat, int32_t windowFormat) {
+  return findConverter(frameFormat, windowFormat) != nullptr;
+}
+
+bool FrameConverter::configure(uvc_frame_format frameFormat, int32_t windowFormat) {
+  frameFormat_ = frameFormat;
+  windowFormat_ = windowFormat;
+  const ConverterEntry* converter = findConverter(frameFormat, windowFormat);
+  convert_ = converter != nullptr ? converter->convert : nullptr;
+  toArgb_ = converter != nullptr ? converter->toArgb : nullptr;
+  convertsStripes_ = converter != nullptr && !converter->wholeFrame;
+  usesArgbScratch_ = converter != nullptr && converter->usesArgbScratch;
+  if (convert_ == nullptr) {
+    ULOGE("No converter from frame format %d to window format %d", frameFormat, windowFormat);
+    return false;
+  }
+  ULOGI(
+      "Converting frame format %d to window format %d stripes: %d",
+      frameFormat,
+      windowFormat,
+      convertsStripes_);
+  return true;
+}
+
+void FrameConverter::setWorkerPool(StripeWorkerPool* workerPool, int32_t minParallelHeight) {
+  workerPool_ = workerPool;
+  minParallelHeight_ = minParallelHeight;
+}
+
+bool FrameConverter::convert(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer) {
+  TRACE_SCOPE("convertFrame");
+  if (convert_ == nullptr) {
+    return false;
+  }
+  overlayWidth_ = buffer.width;
+  overlayHeight_ = buffer.height;
+  if (correctsLens()) {
+    FrameCrop crop = crop_.within(frame->width, frame->height, 2);
+    int32_t width = crop.empty() ? frame->width : crop.width;
+    int32_t height = crop.empty() ? frame->height : crop.height;
+    if (dewarpMap_.build(lens_, width, height, buffer.width, buffer.height)) {
+      placeOverlay(buffer, false);
+      if (!convertCorrected(frame, buffer)) {
+        return false;
+      }
+      flushOverlay(buffer, 0, buffer.height);
+      return true;
+    }
+  }
+  placeOverlay(buffer, !convertsStripes_);
+  if (!convertsStripes_) {
+    // Whole frame decoders write the buffer at its own size, into the
+    // overlay scratch when there is a label to blend.
+    if (!convert_(*this, frame, overlayBottom_ > 0 ? overlayTarget(buffer) : buffer, 0,
+                  buffer.height)) {
+      return false;
+    }
+    flushOverlay(buffer, 0, buffer.height);
+    return true;
+  }
+  uvc_frame_t view = cropView(frame);
+  bool cropped = view.width != frame->width || view.height != frame->height;
+  frame = &view;
+  bool sameSize =
+      frame->width == (uint32_t)buffer.width && frame->height == (uint32_t)buffer.height;
+  bool is32Bit = windowFormat_ == kRgba8888 || windowFormat_ == kRgbx8888;
+  if (sameSize || !(cpuScaling_ || cropped) || !is32Bit) {
+    // The buffer height is kept since planar buffers derive plane offsets
+    // from it.
+    ANativeWindow_Buffer common = buffer;
+    common.width = std::min<int32_t>(buffer.width, frame->width);
+    return convertUnscaled(
+        frame, common, std::min<int32_t>(buffer.height, frame->height), true);
+  }
+  if (toArgb_ != nullptr && !deinterlaces() && !measures(frame)) {
+    if (!convertScaled(frame, buffer)) {
+      return false;
+    }
+    flushOverlay(buffer, 0, buffer.height);
+    return true;
+  }
+  size_t scaledStride = alignedStride((size_t)frame->width * 4);
+  scaleScratch_.resize(scaledStride * frame->height);
+  ANativeWindow_Buffer scaled = buffer;
+  scaled.bits = scaleScratch_.data();
+  scaled.width = frame->width;
+  scaled.height = frame->height;
+  scaled.stride = scaledStride / 4;
+  if (!convertUnscaled(frame, scaled, scaled.height, false)) {
+    return false;
+  }
+  // ARGBScale works on any 4 byte pixel layout; the clipped scale writes
+  // the same pixels as the whole one.
+  if (!writeAroundOverlay(
+          buffer,
+          overlayTarget(buffer),
+          overlayTop_,
+          overlayBottom_,
+          0,
+          buffer.height,
+          [&](const ANativeWindow_Buffer& target, int32_t row, int32_t rows) {
+            return libyuv::ARGBScaleClip(
+                       scaleScratch_.data(),
+                       scaled.stride * 4,
+                       scaled.width,
+                       scaled.height,
+                       static_cast<uint8_t*>(target.bits),
+                       target.stride * 4,
+                       buffer.width,
+                       buffer.height,
+                       0,
+                       row,
+                       buffer.width,
+                       rows,
+                       libyuv::kFilterBilinear) == 0;
+          })) {
+    return false;
+  }
+  flushOverlay(buffer, 0, buffer.height);
+  return true;
+}
+
+bool FrameConverter::convertScaled(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer) {
+  TRACE_SCOPE("convertScaled");
+  if (!rowScaler_.configure(frame->width, frame->height, buffer.width, buffer.height)) {
+    return false;
+  }
+  uint32_t stripeCount = 1;
+  if (workerPool_ != nullptr && (int32_t)frame->height >= minParallelHeight_) {
+    stripeCount = std::min<uint32_t>(
+        {workerPool_->threadCount(), frame->height / kMinStripeRows, (uint32_t)buffer.height});
+    stripeCount = std::max<uint32_t>(stripeCount, 1);
+  }
+  if (scalerScratch_.size() < stripeCount) {
+    scalerScratch_.resize(stripeCount);
+  }
+  int32_t stripeRows = (buffer.height + stripeCount - 1) / stripeCount;
+  ScaleJob job{
+      this,
+      toArgb_,
+      &rowScaler_,
+      scalerScratch_.data(),
+      frame,
+      &buffer,
+      stripeRows,
+      overlayTarget(buffer),
+      overlayTop_,
+      overlayBottom_};
+  stripeCount = (buffer.height + stripeRows - 1) / stripeRows;
+  if (stripeCount <= 1) {
+    scaleStripe(&job, 0);
+  } else {
+    workerPool_->run(stripeCount, &scaleStripe, &job);
+  }
+  return job.succeeded;
+}
+
+bool FrameConverter::convertsRows(
+    const uvc_frame_t* frame,
+    const ANativeWindow_Buffer& buffer) const {
+  if (convert_ == nullptr || !convertsStripes_ || frame->frame_format != frameFormat_ ||
+      deinterlaces() || correctsLens() || !crop_.within(frame->width, frame->height, 2).empty()) {
+    return false;
+  }
+  bool sameSize =
+      frame->width == (uint32_t)buffer.width && frame->height == (uint32_t)buffer.height;
+  bool is32Bit = windowFormat_ == kRgba8888 || windowFormat_ == kRgbx8888;
+  return sameSize || !cpuScaling_ || !is32Bit;
+}
+
+bool FrameConverter::convertRows(
+    const uvc_frame_t* frame,
+    const ANativeWindow_Buffer& buffer,
+    int32_t row,
+    int32_t rows) {
+  TRACE_SCOPE("convertRows");
+  uvc_frame_t view = cropView(frame);
+  frame = &view;
+  int32_t height = std::min<int32_t>(buffer.height, frame->height);
+  rows = std::min(rows, height - row);
+  if (rows <= 0) {
+    return true;
+  }
+  ANativeWindow_Buffer common = buffer;
+  common.width = std::min<int32_t>(buffer.width, frame->width);
+  if (usesArgbScratch_) {
+    argbScratch_.resize((size_t)argbScratchStride(common.width) * height);
+  }
+  overlayWidth_ = buffer.width;
+  overlayHeight_ = buffer.height;
+  placeOverlay(common, false);
+  bandStages_ = CONVERT | (overlayBottom_ > overlayTop_ ? OVERLAY : 0);
+  if (measures(frame)) {
+    // Bands of one frame add up; a frame started anywhere but its first row
+    // never completes, and one with a band converted twice overcounts.
+    if (row == 0 || lumaStats_.sequence() != frame->sequence) {
+      lumaStats_.reset(frame->sequence, height);
+    }
+    bandStages_ |= MEASURE;
+  }
+  if (bandStages_ != CONVERT) {
+    return convertStaged(*this, frame, common, row, rows);
+  }
+  return convert_(*this, frame, common, row, rows);
+}
+
+uvc_frame_t FrameConverter::cropView(const uvc_frame_t* frame) {
+  uvc_frame_t view = *frame;
+  const auto* data = static_cast<const uint8_t*>(frame->data);
+  chroma_ = data + (size_t)frame->height * frame->step;
+  // Even, so views of 4:2:x frames start on whole chroma samples.
+  FrameCrop crop = crop_.within(frame->width, frame->height, 2);
+  if (crop.empty()) {
+    return view;
+  }
+  size_t offset = (size_t)crop.x * (frame->step / frame->width);
+  view.data = const_cast<uint8_t*>(data + (size_t)crop.y * frame->step + offset);
+  view.width = crop.width;
+  view.height = crop.height;
+  chroma_ += (size_t)(crop.y / 2) * frame->step + offset;
+  return view;
+}
+
+int32_t FrameConverter::completedRows(const uvc_frame_t* frame, size_t bytes) {
+  if (frame->step == 0 || frame->height == 0) {
+    return 0;
+  }
+  size_t height = frame->height;
+  size_t rows;
+  switch (frame->frame_format) {
+    case UVC_FRAME_FORMAT_NV12:
+    case UVC_FRAME_FORMAT_P010: {
+      // One interleaved chroma row covers two luma rows.
+      size_t lumaBytes = frame->step * height;
+      rows = bytes < lumaBytes ? 0 : (bytes - lumaBytes) / frame->step * 2;
+      break;
+    }
+    default:
+      rows = bytes / frame->step;
+      if (demosaic::isBayer(frame->frame_format) && rows > 0 && rows < height) {
+        rows--;
+      }
+      break;
+  }
+  if (rows >= height) {
+    return (int32_t)height;
+  }
+  return (int32_t)(rows & ~(size_t)1);
+}
+
+bool FrameConverter::convertUnscaled(
+    const uvc_frame_t* frame,
+    const ANativeWindow_Buffer& buffer,
+    int32_t height,
+    bool blend) {
+  if (usesArgbScratch_) {
+    argbScratch_.resize((size_t)argbScratchStride(buffer.width) * height);
+  }
+  bandStages_ = CONVERT;
+  if (measures(frame)) {
+    lumaStats_.reset(frame->sequence, height);
+    bandStages_ |= MEASURE;
+  }
+  if (deinterlaces()) {
+    deinterlaceScratch_.resize((size_t)frame->step * frame->height);
+    bandStages_ |= DEINTERLACE;
+  }
+  if (blend) {
+    placeOverlay(buffer, false);
+    if (overlayBottom_ > overlayTop_) {
+      bandStages_ |= OVERLAY;
+    }
+  }
+  ConvertFn convert = bandStages_ == CONVERT ? convert_ : &convertStaged;
+  uint32_t stripeCount = 1;
+  if (workerPool_ != nullptr && convertsStripes_ && height >= minParallelHeight_) {
+    stripeCount = std::min<uint32_t>(workerPool_->threadCount(), height / kMinStripeRows);
+  }
+  if (stripeCount <= 1) {
+    return convert(*this, frame, buffer, 0, height);
+  }
+  // Even stripe heights keep 4:2:0 chroma rows within one stripe.
+  int32_t stripeRows = ((height + stripeCount - 1) / stripeCount + 1) & ~1;
+  StripeJob job{this, convert, frame, &buffer, height, stripeRows};
+  workerPool_->run((height + stripeRows - 1) / stripeRows, &convertStripe, &job);
+  return job.succeeded;
+}
+
+bool FrameConverter::deinterlaces() const {
+  return deinterlace_ != DeinterlaceMode::OFF && convertsStripes_ &&
+      (frameFormat_ == UVC_FRAME_FORMAT_YUYV || frameFormat_ == UVC_FRAME_FORMAT_UYVY);
+}
+
+bool FrameConverter::measures(const uvc_frame_t* frame) const {
+  return lumaStatsEnabled_.load(std::memory_order_relaxed) && convertsStripes_ &&
+      LumaAccumulator::supportsFormat(frame->frame_format);
+}
+
+// What the stages of one convertStaged() call share; concurrent stripes have
+// one each.
+struct FrameConverter::Bands {
+  FrameConverter& converter;
+  const uvc_frame_t* frame;
+  const ANativeWindow_Buffer& buffer;
+  // The frame with the rows DEINTERLACE wrote, which CONVERT reads then.
+  uvc_frame_t deinterlaced;
+  const uvc_frame_t* source;
+  uint32_t bins[LumaStats::kBins]{};
+};
+
+struct FrameConverter::MeasureStage {
+  static bool run(Bands& bands, int32_t row, int32_t rows) {
+    LumaAccumulator::countRows(bands.frame, row, rows, bands.bins);
+    return true;
+  }
+  static void finish(Bands& bands, int32_t rows) {
+    bands.converter.lumaStats_.merge(bands.bins, rows);
+  }
+};
+
+struct FrameConverter::DeinterlaceStage {
+  static bool run(Bands& bands, int32_t row, int32_t rows) {
+    const uvc_frame_t* frame = bands.frame;
+    deinterlace::deinterlaceRows(
+        bands.converter.deinterlace_,
+        bands.converter.topFieldFirst_,
+        static_cast<const uint8_t*>(frame->data),
+        frame->step,
+        (int32_t)frame->height,
+        (size_t)frame->width * 2,
+        row,
+        rows,
+        bands.converter.deinterlaceScratch_.data() + (size_t)row * frame->step);
+    return true;
+  }
+};
+
+struct FrameConverter::ConvertStage {
+  static bool run(Bands& bands, int32_t row, int32_t rows) {
+    FrameConverter& converter = bands.converter;
+    if (!(converter.bandStages_ & OVERLAY)) {
+      return converter.convert_(converter, bands.source, bands.buffer, row, rows);
+    }
+    // The label's rows into the overlay scratch, for OverlayStage.
+    return writeAroundOverlay(
+        bands.buffer,
+        converter.overlayTarget(bands.buffer),
+        converter.overlayTop_,
+        converter.overlayBottom_,
+        row,
+        rows,
+        [&](const ANativeWindow_Buffer& target, int32_t first, int32_t count) {
+          return converter.convert_(converter, bands.source, target, first, count);
+        });
+  }
+};
+
+struct FrameConverter::OverlayStage {
+  static bool run(Bands& bands, int32_t row, int32_t rows) {
+    bands.converter.flushOverlay(bands.buffer, row, rows);
+    return true;
+  }
+};
+
+bool FrameConverter::convertStaged(
+    FrameConverter& converter,
+    const uvc_frame_t* frame,
+    const ANativeWindow_Buffer& buffer,
+    int32_t row,
+    int32_t rows) {
+  Bands bands{converter, frame, buffer, *frame, frame};
+  if (converter.bandStages_ & DEINTERLACE) {
+    bands.deinterlaced.data = converter.deinterlaceScratch_.data();
+    bands.source = &bands.deinterlaced;
+  }
+  return BandPipeline::pick(converter.bandStages_)(bands, row, rows);
+}
+
+bool FrameConverter::blends() const {
+  return overlay_ != nullptr && overlay_->enabled() &&
+      (windowFormat_ == kRgba8888 || windowFormat_ == kRgbx8888);
+}
+
+void FrameConverter::placeOverlay(const ANativeWindow_Buffer& buffer, bool wholeFrame) {
+  overlayTop_ = 0;
+  overlayBottom_ = 0;
+  if (!blends() || overlay_->height() == 0) {
+    return;
+  }
+  if (wholeFrame) {
+    overlayBottom_ = buffer.height;
+  } else {
+    int32_t x = 0;
+    int32_t y = 0;
+    overlay_->place(overlayWidth_, overlayHeight_, x, y);
+    overlayTop_ = std::clamp(y, 0, buffer.height) & ~1;
+    overlayBottom_ = std::min((std::max(y + overlay_->height(), 0) + 1) & ~1, buffer.height);
+  }
+  overlayScratch_.resize((size_t)buffer.stride * 4 * overlayBottom_);
+}
+
+ANativeWindow_Buffer FrameConverter::overlayTarget(const ANativeWindow_Buffer& buffer) {
+  ANativeWindow_Buffer target = buffer;
+  target.bits = overlayScratch_.data();
+  return target;
+}
+
+void FrameConverter::flushOverlay(
+    const ANativeWindow_Buffer& buffer,
+    int32_t row,
+    int32_t rows) {
+  int32_t top = std::max(overlayTop_, row);
+  int32_t bottom = std::min(overlayBottom_, row + rows);
+  if (top >= bottom) {
+    return;
+  }
+  TRACE_SCOPE("blendOverlay");
+  int32_t stride = buffer.stride * 4;
+  uint8_t* scratch = overlayScratch_.data();
+  overlay_->blendRows(scratch, stride, overlayWidth_, overlayHeight_, top, bottom - top);
+  libyuv::ARGBCopy(
+      scratch + (size_t)top * stride,
+      stride,
+      bufferRow(buffer, top, 4),
+      stride,
+      buffer.width,
+      bottom - top);
+}
+
+void FrameConverter::copyRgba(
+    const uint8_t* rgba,
+    int32_t stride,
+    int32_t width,
+    int32_t height,
+    const ANativeWindow_Buffer& buffer) {
+  overlayWidth_ = buffer.width;
+  overlayHeight_ = buffer.height;
+  ANativeWindow_Buffer common = buffer;
+  common.width = std::min(width, buffer.width);
+  height = std::min(height, buffer.height);
+  placeOverlay(common, false);
+  writeAroundOverlay(
+      common,
+      overlayTarget(common),
+      overlayTop_,
+      overlayBottom_,
+      0,
+      height,
+      [&](const ANativeWindow_Buffer& target, int32_t row, int32_t rows) {
+        libyuv::ARGBCopy(
+            rgba + (size_t)row * stride,
+            stride,
+            bufferRow(target, row, 4),
+            target.stride * 4,
+            target.width,
+            rows);
+        return true;
+      });
+  flushOverlay(common, 0, height);
+}
+
+bool FrameConverter::correctsLens() const {
+  return lens_.enabled() && (windowFormat_ == kRgba8888 || windowFormat_ == kRgbx8888);
+}
+
+bool FrameConverter::convertCorrected(
+    const uvc_frame_t* frame,
+    const ANativeWindow_Buffer& buffer) {
+  // convert() built dewarpMap_ for the source image: the crop at its own
+  // size, which MJPEG is decoded at too.
+  int32_t width = frame->width;
+  int32_t height = frame->height;
+  FrameCrop crop = crop_.within(width, height, 2);
+  if (!crop.empty()) {
+    width = crop.width;
+    height = crop.height;
+  }
+  size_t sourceStride = alignedStride((size_t)width * 4);
+  scaleScratch_.resize(sourceStride * height);
+  ANativeWindow_Buffer source = buffer;
+  source.bits = scaleScratch_.data();
+  source.width = width;
+  source.height = height;
+  source.stride = sourceStride / 4;
+  if (convertsStripes_) {
+    uvc_frame_t view = cropView(frame);
+    if (!convertUnscaled(&view, source, height, false)) {
+      return false;
+    }
+  } else if (!convert_(*this, frame, source, 0, height)) {
+    return false;
+  }
+  TRACE_SCOPE("remapLens");
+  uint32_t stripeCount = 1;
+  if (workerPool_ != nullptr && buffer.height >= minParallelHeight_) {
+    stripeCount = std::min<uint32_t>(workerPool_->threadCount(), buffer.height / kMinStripeRows);
+  }
+  stripeCount = std::max<uint32_t>(stripeCount, 1);
+  int32_t stripeRows = (buffer.height + stripeCount - 1) / stripeCount;
+  RemapJob job{
+      &dewarpMap_,
+      scaleScratch_.data(),
+      sourceStride,
+      &buffer,
+      stripeRows,
+      overlayTarget(buffer),
+      overlayTop_,
+      overlayBottom_};
+  if (stripeCount == 1) {
+    remapStripe(&job, 0);
+  } else {
+    workerPool_->run((buffer.height + stripeRows - 1) / stripeRows, &remapStripe, &job);
+  }
+  return true;
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "BufferAllocator.h"
+#include "Colorimetry.h"
+#include "Deinterlacer.h"
+#include "Demosaic.h"
+#include "DepthColorizer.h"
+#include "FrameCrop.h"
+#include "LensCorrection.h"
+#include "LumaStats.h"
+#include "MjpegDecoder.h"
+#include "RowPipeline.h"
+#include "RowScaler.h"
+#include "StripeWorkerPool.h"
+#include "TextOverlay.h"
+
+using namespace std::chrono;
+
+// CPU conversion of camera frames into a locked window buffer.
+//
+// Every supported (uvc_frame_format, window format) pair has a converter
+// generated at compile time. configure() looks the pair up once when the
+// stream is set up, so a combination without a converter is rejected there
+// instead of failing on every frame.
+class FrameConverter final {
+ public:
+  // Converts the rows [row, row + rows) of a frame into the same rows of the
+  // buffer. Calls for disjoint rows may run concurrently.
+  using ConvertFn = bool (*)(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows);
+  // Converts the rows [row, row + rows) of a frame into libyuv ARGB rows at
+  // dst, stride bytes apart, returning 0 like libyuv.
+  using ArgbRowsFn = int (*)(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      int32_t row,
+      int32_t rows,
+      uint8_t* dst,
+      int stride,
+      int width);
+
+  // HAL_PIXEL_FORMAT_YV12, the planar 4:2:0 layout ANativeWindow_lock()
+  // documents for YUV window buffers. The compositor does the color
+  // conversion.
+  static constexpr int32_t kYv12WindowFormat = 0x32315659;
+
+  FrameConverter() = default;
+  FrameConverter(const FrameConverter&) = delete;
+  FrameConverter& operator=(const FrameConverter&) = delete;
+
+  static bool isSupported(uvc_frame_format frameFormat, int32_t windowFormat);
+
+  // Selects the converter for the pair. Returns false, and converts nothing
+  // until configured again, if the pair is not supported.
+  bool configure(uvc_frame_format frameFormat, int32_t windowFormat);
+
+  // Frames at least minParallelHeight rows high are split into horizontal
+  // stripes converted on the pool. A null pool converts on the calling thread.
+  void setWorkerPool(StripeWorkerPool* workerPool, int32_t minParallelHeight);
+
+  // Scales to the buffer when the frame and buffer sizes differ, with a
+  // RowScaler that converts only the rows each output row needs, just
+  // before scaling them, in stripes on the pool. Deinterlaced or measured
+  // frames are converted at the frame size into a scratch frame scaled with
+  // libyuv instead. MJPEG is decoded at the buffer size and 24 and 16 bit
+  // buffers are not scaled. Without CPU scaling only the area the frame and
+  // buffer have in common is converted.
+  void setCpuScaling(bool cpuScaling) {
+    cpuScaling_ = cpuScaling;
+  }
+
+  // Dithers RGB565 output that goes through ARGB rows, hiding the banding of
+  // 5 and 6 bit channels in gradients. NV12 converts straight to RGB565 and
+  // is not dithered.
+  void setDither(bool dither) {
+    dither_ = dither;
+  }
+
+  bool dither() const {
+    return dither_;
+  }
+
+  // The matrix and range YUV sources are converted to RGB with, BT.601
+  // limited range unless set. MJPEG is decoded as JFIF regardless.
+  void setColorimetry(const Colorimetry& colorimetry) {
+    colorimetry_ = colorimetry;
+  }
+
+  const Colorimetry& colorimetry() const {
+    return colorimetry_;
+  }
+
+  // Gains raw Bayer frames are white balanced with as they are demosaiced,
+  // unity unless set.
+  void setWhiteBalance(const WhiteBalance& whiteBalance) {
+    whiteBalance_ = whiteBalance;
+  }
+
+  const WhiteBalance& whiteBalance() const {
+    return whiteBalance_;
+  }
+
+  // The depths of Z16 frames shown and their palette. Rebuilds the color
+  // table only when the range changed.
+  void setDepthRange(const DepthRange& range) {
+    depthColorizer_.configure(range);
+  }
+
+  const DepthColorizer& depthColorizer() const {
+    return depthColorizer_;
+  }
+
+  // Converts only the crop of each frame: uncompressed rows start at its
+  // origin and MJPEG is decoded with it. A crop the buffer size differs from
+  // is scaled to the buffer like with CPU scaling.
+  void setCrop(const FrameCrop& crop) {
+    crop_ = crop;
+    mjpegDecoder_.setCrop(crop);
+  }
+
+  // Combines the fields of interlaced YUYV and UYVY frames before converting
+  // them, band by band just ahead of the conversion reading the band, so the
+  // deinterlaced rows are still in cache. Other formats are not deinterlaced.
+  void setDeinterlace(DeinterlaceMode mode, bool topFieldFirst) {
+    deinterlace_ = mode;
+    topFieldFirst_ = topFieldFirst;
+  }
+
+  DeinterlaceMode deinterlace() const {
+    return deinterlace_;
+  }
+
+  // Gathers a luma histogram of YUYV, UYVY and NV12 frames from the rows
+  // being converted, band by band just before converting them, for
+  // lumaStats(). Any thread; takes effect from the next frame.
+  void setLumaStats(bool enabled) {
+    lumaStatsEnabled_.store(enabled, std::memory_order_relaxed);
+  }
+
+  // The histogram of the last frame converted, when every row of it was.
+  // Not for frames converted in part, as convertRows() does for changed
+  // rows only.
+  bool lumaStats(LumaStats& stats) const {
+    return lumaStats_.collect(colorimetry_.fullRange, stats);
+  }
+
+  // Blends overlay's label into the 32 bit buffers frames are converted
+  // into; null stops. The buffer is only written: the rows the label covers
+  // are converted into a cached scratch, blended there and copied out,
+  // unscaled frames band by band, others once the whole frame is. Frames of
+  // whole frame decoders go through the scratch whole. The overlay is
+  // updated before convert() and outlives the converter's use of it.
+  void setOverlay(const TextOverlay* overlay) {
+    overlay_ = overlay;
+  }
+
+  // Undistorts frames converted into 32 bit buffers: the frame, or its crop,
+  // is converted at its own size and remapped from there into the buffer,
+  // which scales it as well. Other buffers are not corrected.
+  void setLensCorrection(const LensCalibration& lens) {
+    lens_ = lens;
+  }
+
+  bool convert(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer);
+
+  // Whether convertRows() can convert the frame into the buffer band by
+  // band, as its rows arrive: a row converter and no CPU scaling for it.
+  // Never with a crop, lens correction or while deinterlacing, which reads
+  // the next row.
+  bool convertsRows(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer) const;
+
+  // Converts the rows [row, row + rows) of the area the frame and buffer have
+  // in common, on the calling thread. Bands after the first start on even
+  // rows, as completedRows() returns them.
+  bool convertRows(
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows);
+
+  // Rows of an uncompressed frame that can be converted once its first bytes
+  // arrived, even until the last one. NV12 and P010 chroma follow the whole
+  // luma plane, so their rows only complete after it. Bayer rows need the
+  // row below them, so the last one arrived completes only with the frame.
+  static int32_t completedRows(const uvc_frame_t* frame, size_t bytes);
+
+  uvc_frame_format frameFormat() const {
+    return frameFormat_;
+  }
+
+  int32_t windowFormat() const {
+    return windowFormat_;
+  }
+
+  MjpegDecoder& mjpegDecoder() {
+    return mjpegDecoder_;
+  }
+
+  // Copies width x height RGBA pixels, stride bytes a row, such as a frame
+  // decoded elsewhere, into the buffer with the label blended in the way
+  // convert() blends it.
+  void copyRgba(
+      const uint8_t* rgba,
+      int32_t stride,
+      int32_t width,
+      int32_t height,
+      const ANativeWindow_Buffer& buffer);
+
+  // Intermediate frames kept between conversions, the decoder's included.
+  size_t scratchBytes() const {
+    size_t bytes = argbScratch_.capacity() + scaleScratch_.capacity() +
+        deinterlaceScratch_.capacity() + overlayScratch_.capacity() + dewarpMap_.bytes() +
+        mjpegDecoder_.scratchBytes();
+    for (const RowScaler::Scratch& scratch : scalerScratch_) {
+      bytes += scratch.bytes();
+    }
+    return bytes;
+  }
+
+  // Frees them; the next convert() allocates what it needs again.
+  void releaseScratch() {
+    AlignedBytes().swap(argbScratch_);
+    AlignedBytes().swap(scaleScratch_);
+    AlignedBytes().swap(deinterlaceScratch_);
+    AlignedBytes().swap(overlayScratch_);
+    std::vector<RowScaler::Scratch>().swap(scalerScratch_);
+    dewarpMap_.clear();
+    mjpegDecoder_.releaseScratch();
+  }
+
+  // Row of the intermediate ARGB frame used by pairs without a direct libyuv
+  // conversion. convert() sizes it before any rows are converted.
+  uint8_t* argbScratchRow(int32_t row, int32_t width) {
+    return argbScratch_.data() + (size_t)row * argbScratchStride(width);
+  }
+
+  static int32_t argbScratchStride(int32_t width) {
+    return (int32_t)alignedStride((size_t)width * 4);
+  }
+
+  // Interleaved chroma of a 4:2:0 frame row, which follows the luma plane of
+  // the whole frame. convert() locates it before any rows are converted.
+  const uint8_t* chromaRow(const uvc_frame_t* frame, int32_t row) const {
+    return chroma_ + (size_t)(row / 2) * frame->step;
+  }
+
+ private:
+  // Stripes shorter than this cost more to hand out than they save.
+  static constexpr int32_t kMinStripeRows = 128;
+  // Rows deinterlaced or measured ahead of converting them, a few dozen KB
+  // at 1080p.
+  static constexpr int32_t kStageBandRows = 16;
+
+  // The stages of the band loop, bits of the BandPipeline mask in the order
+  // they run on each band.
+  enum BandStage : uint32_t {
+    MEASURE = 1 << 0,
+    DEINTERLACE = 1 << 1,
+    CONVERT = 1 << 2,
+    OVERLAY = 1 << 3,
+  };
+  struct Bands;
+  struct MeasureStage;
+  struct DeinterlaceStage;
+  struct ConvertStage;
+  struct OverlayStage;
+  using BandPipeline = RowPipeline<
+      Bands,
+      kStageBandRows,
+      MeasureStage,
+      DeinterlaceStage,
+      ConvertStage,
+      OverlayStage>;
+
+  uvc_frame_format frameFormat_{UVC_FRAME_FORMAT_UNKNOWN};
+  int32_t windowFormat_{};
+  ConvertFn convert_{};
+  // Null for formats that only convert into the buffer's layout directly.
+  ArgbRowsFn toArgb_{};
+  bool convertsStripes_{false};
+  bool usesArgbScratch_{false};
+  StripeWorkerPool* workerPool_{};
+  int32_t minParallelHeight_{};
+  bool cpuScaling_{false};
+  bool dither_{false};
+  Colorimetry colorimetry_{};
+  WhiteBalance whiteBalance_{};
+  DepthColorizer depthColorizer_{};
+  MjpegDecoder mjpegDecoder_{};
+  AlignedBytes argbScratch_{};
+  // Frame size conversion output when scaling on the CPU without the row
+  // scaler, or correcting the lens.
+  AlignedBytes scaleScratch_{};
+  RowScaler rowScaler_{};
+  // One per stripe.
+  std::vector<RowScaler::Scratch> scalerScratch_{};
+  FrameCrop crop_{};
+  const uint8_t* chroma_{};
+  DeinterlaceMode deinterlace_{DeinterlaceMode::OFF};
+  bool topFieldFirst_{true};
+  // The deinterlaced frame, at the frame's step.
+  AlignedBytes deinterlaceScratch_{};
+
+  LensCalibration lens_{};
+  DewarpMap dewarpMap_{};
+
+  std::atomic<bool> lumaStatsEnabled_{false};
+  LumaAccumulator lumaStats_{};
+
+  const TextOverlay* overlay_{};
+  // The buffer size the label is placed in, the whole buffer's even when
+  // only part of it is converted.
+  int32_t overlayWidth_{};
+  int32_t overlayHeight_{};
+  // The buffer rows [overlayTop_, overlayBottom_) at the buffer's stride,
+  // the label's rows, rounded out to whole 4:2:0 chroma rows. The rows
+  // above them are allocated but unused, so rows keep their offsets.
+  AlignedBytes overlayScratch_{};
+  int32_t overlayTop_{};
+  int32_t overlayBottom_{};
+
+  // BandStage bits of the frame being converted.
+  uint32_t bandStages_{CONVERT};
+
+  bool deinterlaces() const;
+  bool measures(const uvc_frame_t* frame) const;
+  bool correctsLens() const;
+  bool blends() const;
+  // Sizes overlayScratch_ for the rows of buffer the label covers, or all of
+  // them for whole frame decoders; none when no label is blended. Called
+  // before any of the frame's rows are written.
+  void placeOverlay(const ANativeWindow_Buffer& buffer, bool wholeFrame);
+  // The buffer with overlayScratch_ in place of its memory.
+  ANativeWindow_Buffer overlayTarget(const ANativeWindow_Buffer& buffer);
+  // Blends the label over the overlay rows among [row, row + rows) in
+  // overlayScratch_ and copies them to the buffer. Calls for disjoint rows
+  // may run concurrently.
+  void flushOverlay(const ANativeWindow_Buffer& buffer, int32_t row, int32_t rows);
+  bool convertCorrected(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer);
+
+  // A ConvertFn running the bandStages_ of the BandPipeline: each band is
+  // measured into lumaStats_, deinterlaced into deinterlaceScratch_,
+  // converted and blended with the label, as enabled.
+  static bool convertStaged(
+      FrameConverter& converter,
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t row,
+      int32_t rows);
+
+  // The frame's crop as a frame of its own, rows keeping the frame's step.
+  uvc_frame_t cropView(const uvc_frame_t* frame);
+
+  bool convertScaled(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer);
+  // OVERLAY is among the stages when blend, for buffers that are the window's.
+  bool convertUnscaled(
+      const uvc_frame_t* frame,
+      const ANativeWindow_Buffer& buffer,
+      int32_t height,
+      bool blend);
+};
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Region of interest of a camera frame, in frame pixels. The preview shows
+// only this part of the frame, scaled to the window, and only its pixels are
+// converted or decoded. An empty crop shows the whole frame.
+struct FrameCrop {
+  int32_t x{};
+  int32_t y{};
+  int32_t width{};
+  int32_t height{};
+
+  bool empty() const {
+    return width <= 0 || height <= 0;
+  }
+
+  // The part within a frameWidth x frameHeight frame, with its origin and
+  // size rounded down to multiples of align, which 4:2:x chroma needs to be
+  // 2. Empty when it leaves less than that.
+  FrameCrop within(int32_t frameWidth, int32_t frameHeight, int32_t align) const {
+    if (empty()) {
+      return {};
+    }
+    int32_t left = std::clamp(x, 0, frameWidth) / align * align;
+    int32_t top = std::clamp(y, 0, frameHeight) / align * align;
+    int32_t right = std::clamp(x + width, left, frameWidth);
+    int32_t bottom = std::clamp(y + height, top, frameHeight);
+    FrameCrop crop{
+        left, top, (right - left) / align * align, (bottom - top) / align * align};
+    return crop.empty() ? FrameCrop{} : crop;
+  }
+
+  bool operator==(const FrameCrop&) const = default;
+};
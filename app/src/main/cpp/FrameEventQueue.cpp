@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameEventQueue.h"
+
+#include <algorithm>
+#include <iterator>
+
+FrameEventQueue::FrameEventQueue() : slots_(std::make_unique<std::array<Slot, kCapacity>>()) {
+  for (uint32_t i = 0; i < kCapacity; i++) {
+    (*slots_)[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+FrameEventQueue& FrameEventQueue::forSession(uint32_t slot) {
+  static FrameEventQueue* queues = new FrameEventQueue[StreamingStats::kMaxSessions];
+  return queues[slot];
+}
+
+FrameEventQueue* FrameEventQueue::forStats(const StreamingStats& stats) {
+  for (uint32_t slot = 0; slot < StreamingStats::kMaxSessions; slot++) {
+    if (&stats == &StreamingStats::forSession(slot)) {
+      return &forSession(slot);
+    }
+  }
+  return nullptr;
+}
+
+bool FrameEventQueue::open() {
+  std::lock_guard lk(mutex_);
+  if (open_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  FrameEvent discarded[32];
+  while (take(discarded, std::size(discarded)) > 0) {
+  }
+  lost_.store(0, std::memory_order_relaxed);
+  open_.store(true, std::memory_order_release);
+  return true;
+}
+
+void FrameEventQueue::close() {
+  std::lock_guard lk(mutex_);
+  open_.store(false, std::memory_order_release);
+  wakeup_.notify_all();
+}
+
+void FrameEventQueue::push(const FrameEvent& event) {
+  if (!open_.load(std::memory_order_acquire)) {
+    return;
+  }
+  uint32_t position = tail_.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &(*slots_)[position % kCapacity];
+    int32_t lag = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+    if (lag == 0) {
+      if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_seq_cst)) {
+        break;
+      }
+    } else if (lag < 0) {
+      // The reader has not taken the event a ring ago yet.
+      lost_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->event = event;
+  slot->sequence.store(position + 1, std::memory_order_release);
+
+  uint32_t waitingFor = waitingFor_.load(std::memory_order_seq_cst);
+  if (waitingFor != 0 && queued() >= waitingFor) {
+    std::lock_guard lk(mutex_);
+    wakeup_.notify_one();
+  }
+}
+
+uint32_t FrameEventQueue::queued() const {
+  return tail_.load(std::memory_order_seq_cst) - head_.load(std::memory_order_relaxed);
+}
+
+size_t FrameEventQueue::take(FrameEvent* out, size_t capacity) {
+  uint32_t head = head_.load(std::memory_order_relaxed);
+  size_t count = 0;
+  while (count < capacity) {
+    Slot& slot = (*slots_)[head % kCapacity];
+    // A claimed slot is still being written; it is taken with the next batch.
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+      break;
+    }
+    out[count++] = slot.event;
+    slot.sequence.store(head + kCapacity, std::memory_order_release);
+    head++;
+  }
+  head_.store(head, std::memory_order_relaxed);
+  return count;
+}
+
+size_t FrameEventQueue::read(
+    FrameEvent* out,
+    size_t capacity,
+    size_t minCount,
+    nanoseconds maxWait) {
+  uint32_t wanted = (uint32_t)std::clamp<size_t>(minCount, 1, kCapacity);
+  if (queued() < wanted && maxWait > 0ns) {
+    std::unique_lock lk(mutex_);
+    waitingFor_.store(wanted, std::memory_order_seq_cst);
+    wakeup_.wait_for(lk, maxWait, [&] {
+      return queued() >= wanted || !open_.load(std::memory_order_acquire);
+    });
+    waitingFor_.store(0, std::memory_order_relaxed);
+  }
+  return take(out, capacity);
+}
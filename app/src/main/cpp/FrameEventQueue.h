@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "StreamingStats.h"
+
+using namespace std::chrono;
+
+// What happened to a frame.
+enum class FrameEventKind : uint8_t {
+  CAPTURED, // complete frame from libuvc, before it is validated
+  RENDERED, // posted to the preview or handed to the video decoder
+  DROPPED, // never reached the screen, for the FrameDropCause in cause
+};
+
+// One record per frame event, laid out as Kotlin reads it from the buffer
+// readFrameEventsNative fills. Times are CLOCK_MONOTONIC nanoseconds.
+struct FrameEvent {
+  static constexpr uint16_t kNoLuma = 0xffff;
+
+  int64_t timeNs{}; // when it happened
+  int64_t captureTimeNs{}; // end of the frame's USB transfer
+  uint32_t sequence{}; // libuvc frame sequence
+  uint32_t bytes{}; // payload size
+  uint32_t latencyUs{}; // RENDERED: USB completion to post
+  FrameEventKind kind{};
+  uint8_t cause{};
+  // RENDERED while gathering luma stats: the mean luma in 1/256 codes, and
+  // the shares of samples clipped dark and bright in 1/65535. kNoLuma when
+  // the frame was not measured.
+  uint16_t lumaMean{kNoLuma};
+  uint16_t lumaDark{};
+  uint16_t lumaBright{};
+  uint32_t reserved{};
+};
+static_assert(sizeof(FrameEvent) == 40);
+
+// Carries per-frame events from the capture and render threads to one reader,
+// which takes them in batches so the app sees every frame without a JNI call
+// per frame.
+//
+// Producers claim a slot in a bounded lock-free ring and never wait: when the
+// reader falls a ring behind, new events are dropped and counted in lost().
+// The reader waits for a batch or a timeout; producers only take the mutex to
+// wake it once enough events are queued. Events are only queued while a
+// reader is open. Queues are never freed, so a reader blocked in read() may
+// outlive the streamer that fed it.
+class FrameEventQueue final {
+ public:
+  static constexpr uint32_t kCapacity = 512;
+
+  FrameEventQueue();
+  FrameEventQueue(const FrameEventQueue&) = delete;
+  FrameEventQueue& operator=(const FrameEventQueue&) = delete;
+
+  // slot must be below StreamingStats::kMaxSessions.
+  static FrameEventQueue& forSession(uint32_t slot);
+  // The queue of a StreamingStats block, null for one that is not a session's.
+  static FrameEventQueue* forStats(const StreamingStats& stats);
+
+  // Discards what an earlier reader left. Returns false if a reader is open.
+  bool open();
+  // Wakes a reader blocked in read().
+  void close();
+  bool isOpen() const {
+    return open_.load(std::memory_order_relaxed);
+  }
+
+  // Any thread.
+  void push(const FrameEvent& event);
+
+  // Reader only. Waits until minCount events are queued, maxWait passed or
+  // close(), then moves up to capacity of them into out. Returns the count.
+  size_t read(FrameEvent* out, size_t capacity, size_t minCount, nanoseconds maxWait);
+
+  // Events dropped since open() because the reader fell behind.
+  uint64_t lost() const {
+    return lost_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    // Position a producer may claim the slot at, plus one once it is written.
+    std::atomic<uint32_t> sequence{};
+    FrameEvent event{};
+  };
+
+  uint32_t queued() const;
+  size_t take(FrameEvent* out, size_t capacity);
+
+  std::unique_ptr<std::array<Slot, kCapacity>> slots_;
+  alignas(kCacheLineSize) std::atomic<uint32_t> tail_{0};
+  alignas(kCacheLineSize) std::atomic<uint32_t> head_{0};
+  std::atomic<uint64_t> lost_{0};
+  std::atomic<bool> open_{false};
+  // Events the blocked reader waits for, zero when it is not waiting.
+  std::atomic<uint32_t> waitingFor_{0};
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+};
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameFanout.h"
+
+#include <android/hardware_buffer.h>
+#include <android/log.h>
+
+#include <libyuv/convert_argb.h>
+#include <libyuv/convert_from_argb.h>
+#include <libyuv/planar_functions.h>
+#include <libyuv/scale.h>
+#include <libyuv/scale_argb.h>
+
+#include <algorithm>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "FrameFanout", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FrameFanout", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "FrameFanout", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "FrameFanout", __VA_ARGS__)
+
+bool FrameFanout::supportsFormat(uvc_frame_format format) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_NV12:
+    case UVC_FRAME_FORMAT_YUYV:
+    case UVC_FRAME_FORMAT_UYVY:
+    case UVC_FRAME_FORMAT_MJPEG:
+      return true;
+    default:
+      return false;
+  }
+}
+
+FrameFanout::FramePtr FrameFanout::derive(
+    const uvc_frame_t* frame,
+    FanoutFormat format,
+    int32_t width,
+    int32_t height) {
+  if (!supportsFormat(frame->frame_format) || frame->width < 2 || frame->height < 2) {
+    return nullptr;
+  }
+  int32_t captureWidth = (int32_t)frame->width;
+  int32_t captureHeight = (int32_t)frame->height;
+  width = width > 0 ? std::min(width, captureWidth) : captureWidth;
+  height = height > 0 ? std::min(height, captureHeight) : captureHeight;
+  // NV12 chroma is subsampled in both directions.
+  width = std::max(2, width & ~1);
+  height = std::max(2, height & ~1);
+
+  std::lock_guard lk(mutex_);
+  if (frame->sequence != sourceSequence_ || frame->data != sourceData_) {
+    current_.clear();
+    sourceSequence_ = frame->sequence;
+    sourceData_ = frame->data;
+  }
+  return deriveLocked(frame, format, width, height);
+}
+
+bool FrameFanout::findLocked(FanoutFormat format, int32_t width, int32_t height) const {
+  return std::any_of(current_.begin(), current_.end(), [&](const std::shared_ptr<Frame>& output) {
+    return output->format == format && output->width == width && output->height == height;
+  });
+}
+
+std::shared_ptr<FrameFanout::Frame> FrameFanout::deriveLocked(
+    const uvc_frame_t* frame,
+    FanoutFormat format,
+    int32_t width,
+    int32_t height) {
+  for (const std::shared_ptr<Frame>& output : current_) {
+    if (output->format == format && output->width == width && output->height == height) {
+      shared_++;
+      return output;
+    }
+  }
+  int32_t captureWidth = (int32_t)frame->width & ~1;
+  int32_t captureHeight = (int32_t)frame->height & ~1;
+  bool mjpeg = frame->frame_format == UVC_FRAME_FORMAT_MJPEG;
+  bool scaled = width != captureWidth || height != captureHeight;
+
+  // MJPEG goes through NV12 like the other formats once a consumer asked
+  // for NV12, decoded without leaving YCbCr; RGBA alone is decoded straight
+  // at the requested size.
+  bool nv12Mjpeg = mjpeg && MjpegDecoder::decodesNv12() &&
+      (format == FanoutFormat::NV12 || findLocked(FanoutFormat::NV12, captureWidth, captureHeight));
+  bool viaNv12 = !mjpeg || nv12Mjpeg;
+  // Straight from the frame: MJPEG decoded at the requested size, or the
+  // capture size NV12 everything else is derived from.
+  bool root = viaNv12 ? format == FanoutFormat::NV12 && !scaled : format == FanoutFormat::RGBA;
+  std::shared_ptr<Frame> source;
+  if (!root) {
+    // Scale in NV12, which has 3/8 of the bytes of RGBA to filter.
+    bool fromCaptureSize = viaNv12 && format == FanoutFormat::NV12;
+    source = deriveLocked(
+        frame,
+        viaNv12 ? FanoutFormat::NV12 : FanoutFormat::RGBA,
+        fromCaptureSize ? captureWidth : width,
+        fromCaptureSize ? captureHeight : height);
+    if (source == nullptr) {
+      return nullptr;
+    }
+  }
+
+  TRACE_SCOPE("fanoutFrame");
+  std::shared_ptr<Frame> out = allocate(format, width, height);
+  if (out == nullptr) {
+    return nullptr;
+  }
+  out->sequence = frame->sequence;
+  uint8_t* dst = out->data.data();
+  size_t uvOffset = (size_t)out->stride * height;
+  bool ok;
+  if (root && mjpeg && format == FanoutFormat::NV12) {
+    ok = mjpegDecoder_.decodeNv12(
+        frame, dst, out->stride, dst + uvOffset, out->stride, width, height);
+  } else if (root && mjpeg) {
+    ok = decodeMjpeg(frame, *out);
+  } else if (root) {
+    ok = convertToNv12(frame, *out);
+  } else if (format == FanoutFormat::NV12 && source->format == FanoutFormat::NV12) {
+    const uint8_t* y = source->data.data();
+    ok = libyuv::NV12Scale(
+             y,
+             source->stride,
+             y + (size_t)source->stride * source->height,
+             source->stride,
+             source->width,
+             source->height,
+             dst,
+             out->stride,
+             dst + uvOffset,
+             out->stride,
+             width,
+             height,
+             libyuv::kFilterBilinear) == 0;
+  } else if (format == FanoutFormat::RGBA) {
+    const uint8_t* y = source->data.data();
+    ok = libyuv::NV21ToARGBMatrix(
+             y,
+             source->stride,
+             y + (size_t)source->stride * source->height,
+             source->stride,
+             dst,
+             out->stride,
+             colorimetry_.yvu(),
+             width,
+             height) == 0;
+  } else {
+    ok = libyuv::ABGRToNV12(
+             source->data.data(),
+             source->stride,
+             dst,
+             out->stride,
+             dst + uvOffset,
+             out->stride,
+             width,
+             height) == 0;
+  }
+  if (!ok) {
+    return nullptr;
+  }
+  derived_++;
+  current_.push_back(out);
+  return out;
+}
+
+std::shared_ptr<FrameFanout::Frame> FrameFanout::allocate(
+    FanoutFormat format,
+    int32_t width,
+    int32_t height) {
+  int32_t stride = format == FanoutFormat::NV12 ? width : width * 4;
+  size_t bytes = format == FanoutFormat::NV12 ? (size_t)stride * height * 3 / 2
+                                              : (size_t)stride * height;
+  // Only the pool holds a buffer nobody uses, and only this thread, under
+  // mutex_, hands out new references to it.
+  std::shared_ptr<Frame> out;
+  for (const std::shared_ptr<Frame>& pooled : pool_) {
+    if (pooled.use_count() == 1 && pooled->data.capacity() >= bytes) {
+      out = pooled;
+      break;
+    }
+  }
+  if (out == nullptr) {
+    out = std::make_shared<Frame>();
+    if (pool_.size() < kMaxPooled) {
+      pool_.push_back(out);
+    }
+  }
+  out->format = format;
+  out->width = width;
+  out->height = height;
+  out->stride = stride;
+  out->data.resize(bytes);
+  return out;
+}
+
+bool FrameFanout::convertToNv12(const uvc_frame_t* frame, Frame& out) {
+  const uint8_t* src = static_cast<const uint8_t*>(frame->data);
+  int32_t width = out.width;
+  int32_t height = out.height;
+  uint8_t* y = out.data.data();
+  uint8_t* uv = y + (size_t)out.stride * height;
+  switch (frame->frame_format) {
+    case UVC_FRAME_FORMAT_NV12: {
+      size_t step = frame->step > 0 ? frame->step : frame->width;
+      if (frame->data_bytes < step * frame->height * 3 / 2) {
+        return false;
+      }
+      return libyuv::NV12Copy(
+                 src,
+                 step,
+                 src + step * frame->height,
+                 step,
+                 y,
+                 out.stride,
+                 uv,
+                 out.stride,
+                 width,
+                 height) == 0;
+    }
+    case UVC_FRAME_FORMAT_YUYV:
+      return libyuv::YUY2ToNV12(src, frame->step, y, out.stride, uv, out.stride, width, height) ==
+          0;
+    case UVC_FRAME_FORMAT_UYVY:
+      return libyuv::UYVYToNV12(src, frame->step, y, out.stride, uv, out.stride, width, height) ==
+          0;
+    default:
+      return false;
+  }
+}
+
+bool FrameFanout::decodeMjpeg(const uvc_frame_t* frame, Frame& out) {
+  ANativeWindow_Buffer buffer{};
+  buffer.width = out.width;
+  buffer.height = out.height;
+  buffer.stride = out.stride / 4;
+  buffer.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+  buffer.bits = out.data.data();
+  return mjpegDecoder_.decode(frame, buffer);
+}
+
+void FrameFanout::reset() {
+  std::lock_guard lk(mutex_);
+  if (derived_ > 0) {
+    ULOGI(
+        "Derived %llu outputs, %llu more requests shared them",
+        (unsigned long long)derived_,
+        (unsigned long long)shared_);
+  }
+  current_.clear();
+  pool_.clear();
+  sourceData_ = nullptr;
+  derived_ = 0;
+  shared_ = 0;
+}
+
+void FrameFanout::setColorimetry(const Colorimetry& colorimetry) {
+  std::lock_guard lk(mutex_);
+  if (colorimetry_ != colorimetry) {
+    colorimetry_ = colorimetry;
+    current_.clear();
+    sourceData_ = nullptr;
+  }
+}
+
+Colorimetry FrameFanout::colorimetry() {
+  std::lock_guard lk(mutex_);
+  return colorimetry_;
+}
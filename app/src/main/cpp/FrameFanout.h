@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "BufferAllocator.h"
+#include "Colorimetry.h"
+#include "MjpegDecoder.h"
+
+// Layouts FrameFanout derives.
+enum class FanoutFormat : int {
+  NV12,
+  RGBA, // 8 bits per channel, R first in memory
+};
+
+// Shared conversions of the latest frame for the consumers besides the
+// preview, such as the frame tap and bitmap snapshots.
+//
+// A frame is decoded or converted once into a canonical layout, capture size
+// NV12 for uncompressed formats and RGBA for MJPEG, and each requested
+// format and size is derived from the cheapest output already made for the
+// frame: scaling in NV12 before converting to RGBA, decoding MJPEG straight
+// at the requested size. With libjpeg-turbo, MJPEG asked for in NV12 is
+// decoded to NV12 without a round trip through RGB, and later RGBA requests
+// of the frame convert from that. Outputs are refcounted and kept for the frame, so
+// consumers asking for the same format and size share one buffer, and a new
+// consumer only costs the steps nobody needed yet. Nothing is derived until a
+// consumer asks, which each does only when it is ready for a frame.
+//
+// The preview converts straight into its window buffers and does not go
+// through here.
+class FrameFanout final {
+ public:
+  struct Frame {
+    FanoutFormat format{};
+    int32_t width{};
+    int32_t height{};
+    int32_t stride{}; // bytes per row, of the Y plane for NV12
+    uint32_t sequence{};
+    AlignedBytes data{};
+
+    size_t size() const {
+      return format == FanoutFormat::NV12 ? (size_t)stride * height * 3 / 2
+                                          : (size_t)stride * height;
+    }
+  };
+  using FramePtr = std::shared_ptr<const Frame>;
+
+  FrameFanout() = default;
+  FrameFanout(const FrameFanout&) = delete;
+  FrameFanout& operator=(const FrameFanout&) = delete;
+
+  static bool supportsFormat(uvc_frame_format format);
+
+  // Any thread, with a reference held on frame. Zero sizes keep the capture
+  // size, larger ones are clamped to it and both are rounded down to even.
+  // Null when the frame could not be converted.
+  FramePtr derive(const uvc_frame_t* frame, FanoutFormat format, int32_t width, int32_t height);
+
+  // Drops the outputs and buffers not held by consumers, once the stream
+  // stopped.
+  void reset();
+
+  // The stream's matrix and range for RGBA from uncompressed frames, as the
+  // preview converts them.
+  void setColorimetry(const Colorimetry& colorimetry);
+  Colorimetry colorimetry();
+
+ private:
+  // Buffers beyond these are freed once their consumers let go.
+  static constexpr size_t kMaxPooled = 6;
+
+  std::mutex mutex_;
+  // The frame the outputs in current_ were derived from.
+  uint32_t sourceSequence_{};
+  const void* sourceData_{};
+  std::vector<std::shared_ptr<Frame>> current_{};
+  std::vector<std::shared_ptr<Frame>> pool_{};
+  MjpegDecoder mjpegDecoder_{};
+  Colorimetry colorimetry_{};
+  uint64_t derived_{};
+  uint64_t shared_{};
+
+  std::shared_ptr<Frame> deriveLocked(
+      const uvc_frame_t* frame,
+      FanoutFormat format,
+      int32_t width,
+      int32_t height);
+  // An output of the current frame in that format at that size exists.
+  bool findLocked(FanoutFormat format, int32_t width, int32_t height) const;
+  std::shared_ptr<Frame> allocate(FanoutFormat format, int32_t width, int32_t height);
+  bool convertToNv12(const uvc_frame_t* frame, Frame& out);
+  bool decodeMjpeg(const uvc_frame_t* frame, Frame& out);
+};
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameLatencyStats.h"
+
+#include <format>
+
+FrameTimeline FrameTimeline::forFrame(const uvc_frame_t* frame, int64_t callbackNs) {
+  FrameTimeline timeline;
+  timeline.pts = frame->pts;
+  timeline.scr = frame->last_scr;
+  // Some UVC 1.5 cameras only copy the clocks into the metadata's UsbVideoHeader.
+  if (frame->meta.flags & UVC_FRAME_META_USB_VIDEO_HEADER) {
+    if (timeline.pts == 0) {
+      timeline.pts = frame->meta.header_pts;
+    }
+    if (timeline.scr == 0) {
+      timeline.scr = frame->meta.header_scr;
+    }
+  }
+  timeline.usbCompleteNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+      frame->capture_time_finished.tv_nsec;
+  timeline.callbackNs = callbackNs;
+  return timeline;
+}
+
+void FrameLatencyStats::setClockFrequency(uint32_t clockFrequency) {
+  clockFrequency_ = clockFrequency;
+}
+
+void FrameLatencyStats::record(const FrameTimeline& timeline) {
+  auto histogram = [this](LatencyStage stage) -> LatencyHistogram& {
+    return histograms_[(size_t)stage];
+  };
+  nanoseconds device{0ns};
+  if (clockFrequency_ != 0 && timeline.pts != 0 && timeline.scr != 0) {
+    // Both are 32 bit counters of the same clock, so the difference survives a wrap.
+    uint64_t ticks = (uint32_t)(timeline.scr - timeline.pts);
+    device = nanoseconds((int64_t)(ticks * 1'000'000'000 / clockFrequency_));
+    histogram(LatencyStage::DEVICE).record(device);
+  }
+  histogram(LatencyStage::USB_TO_CALLBACK)
+      .record(nanoseconds(timeline.callbackNs - timeline.usbCompleteNs));
+  histogram(LatencyStage::QUEUE).record(nanoseconds(timeline.renderStartNs - timeline.callbackNs));
+  histogram(LatencyStage::CONVERT)
+      .record(nanoseconds(timeline.convertedNs - timeline.renderStartNs));
+  histogram(LatencyStage::POST).record(nanoseconds(timeline.postedNs - timeline.convertedNs));
+  histogram(LatencyStage::TOTAL)
+      .record(device + nanoseconds(timeline.postedNs - timeline.usbCompleteNs));
+  if (timeline.windowLockNs >= 0) {
+    histogram(LatencyStage::WINDOW_LOCK).record(nanoseconds(timeline.windowLockNs));
+  }
+}
+
+void FrameLatencyStats::publish() {
+  auto& published = streamingStats_.videoRender.latencyPercentilesUs;
+  size_t i = 0;
+  for (const LatencyHistogram& histogram : histograms_) {
+    for (double fraction : kPercentiles) {
+      published[i++].set(histogram.percentile(fraction).count());
+    }
+  }
+}
+
+std::vector<int64_t> FrameLatencyStats::percentiles() {
+  std::vector<int64_t> result;
+  result.reserve(histograms_.size() * kPercentiles.size());
+  for (const LatencyHistogram& histogram : histograms_) {
+    for (double fraction : kPercentiles) {
+      result.push_back(histogram.percentile(fraction).count());
+    }
+  }
+  return result;
+}
+
+std::string FrameLatencyStats::summary() {
+  std::string result;
+  for (size_t i = 0; i < histograms_.size(); i++) {
+    const LatencyHistogram& histogram = histograms_[i];
+    if (histogram.count() == 0) {
+      continue;
+    }
+    result += std::format(
+        " {} {:.2f}/{:.2f}/{:.2f}",
+        stageName((LatencyStage)i),
+        histogram.percentile(kPercentiles[0]).count() / 1000.0,
+        histogram.percentile(kPercentiles[1]).count() / 1000.0,
+        histogram.percentile(kPercentiles[2]).count() / 1000.0);
+  }
+  return result;
+}
+
+void FrameLatencyStats::reset() {
+  for (LatencyHistogram& histogram : histograms_) {
+    histogram.reset();
+  }
+}
+
+const char* FrameLatencyStats::stageName(LatencyStage stage) {
+  switch (stage) {
+    case LatencyStage::DEVICE:
+      return "device";
+    case LatencyStage::USB_TO_CALLBACK:
+      return "usb";
+    case LatencyStage::QUEUE:
+      return "queue";
+    case LatencyStage::CONVERT:
+      return "convert";
+    case LatencyStage::POST:
+      return "post";
+    case LatencyStage::TOTAL:
+      return "total";
+    case LatencyStage::WINDOW_LOCK:
+      return "lock";
+    default:
+      return "?";
+  }
+}
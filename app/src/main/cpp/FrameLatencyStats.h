@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "LatencyHistogram.h"
+#include "StreamingStats.h"
+
+using namespace std::chrono;
+
+// Points in a frame's life, all CLOCK_MONOTONIC nanoseconds except the
+// device clock values.
+struct FrameTimeline {
+  // Device clock ticks from the payload headers, 0 when the camera omits them.
+  uint32_t pts{};
+  uint32_t scr{};
+  int64_t usbCompleteNs{}; // libuvc saw the end of frame
+  int64_t callbackNs{}; // frame callback entered
+  int64_t renderStartNs{}; // render thread took the frame
+  int64_t convertedNs{}; // frame written to the output buffer
+  int64_t postedNs{}; // buffer handed to the compositor
+  // Waited for a window or presenter buffer, part of CONVERT; -1 when the
+  // frame took none. With render ahead, the wait of the lock thread.
+  int64_t windowLockNs{-1};
+  // Sensor capture (PTS) through the recovered device clock, 0 until
+  // DeviceClock is confident, and the mapping's jitter.
+  int64_t captureNs{};
+  int64_t captureJitterNs{};
+
+  static FrameTimeline forFrame(const uvc_frame_t* frame, int64_t callbackNs);
+};
+
+// Stages a frame's latency is split into. DEVICE is the time from sensor
+// sampling (PTS) to the last payload leaving the camera (SCR); the others
+// are measured on the host.
+enum class LatencyStage : uint8_t {
+  DEVICE,
+  USB_TO_CALLBACK,
+  QUEUE,
+  CONVERT,
+  POST,
+  TOTAL, // DEVICE plus USB completion to post
+  WINDOW_LOCK, // within CONVERT, see FrameTimeline::windowLockNs
+  COUNT,
+};
+static_assert((size_t)LatencyStage::COUNT == kVideoLatencyStages);
+
+// Percentile histograms of each stage over the whole stream, kept in the
+// session's StreamingStats. Recorded on the render thread, read from any
+// thread.
+class FrameLatencyStats final {
+ public:
+  static constexpr std::array<double, kPublishedPercentiles> kPercentiles{0.50, 0.95, 0.99};
+
+  explicit FrameLatencyStats(StreamingStats& streamingStats)
+      : streamingStats_(streamingStats), histograms_(streamingStats.videoLatency) {}
+
+  // Both only while no frames are being recorded.
+  void setClockFrequency(uint32_t clockFrequency);
+  void reset();
+
+  void record(const FrameTimeline& timeline);
+  // Copies the current percentiles into StreamingStats' render counters.
+  void publish();
+
+  // p50, p95 and p99 of every stage in microseconds, stage-major.
+  std::vector<int64_t> percentiles();
+  // Stage percentiles on one line for logging.
+  std::string summary();
+
+  static const char* stageName(LatencyStage stage);
+
+ private:
+  uint32_t clockFrequency_{};
+  StreamingStats& streamingStats_;
+  std::array<LatencyHistogram, kVideoLatencyStages>& histograms_;
+};
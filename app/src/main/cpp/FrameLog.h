@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Layout of frame log files: the camera's uvc_frame_t payloads as they left
+// libuvc, with their timing, written by FrameLogRecorder and read in place
+// through mmap by FrameLogPlayer.
+//
+// A FrameLogHeader is followed by records, each a FrameLogRecord and its
+// payload padded to kFrameLogAlignment. Records are only ever appended, so a
+// log cut short keeps every complete record before the cut.
+static constexpr char kFrameLogMagic[8] = {'U', 'V', 'C', 'F', 'L', 'O', 'G', '1'};
+static constexpr uint32_t kFrameLogVersion = 1;
+static constexpr size_t kFrameLogAlignment = 8;
+
+struct FrameLogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize; // offset of the first record
+  uint32_t frameFormat; // uvc_frame_format
+  uint32_t width;
+  uint32_t height;
+  uint32_t frameInterval; // 100 ns units
+  uint32_t clockFrequency; // PTS clock in Hz
+  uint32_t maxFrameSize; // largest payload the stream could send
+  uint32_t reserved[6];
+};
+static_assert(sizeof(FrameLogHeader) == 64);
+
+struct FrameLogRecord {
+  uint32_t size; // payload bytes following the record
+  uint32_t sequence;
+  int64_t captureTimeNs; // CLOCK_MONOTONIC, end of the USB transfer
+  uint32_t pts;
+  uint32_t flags; // zero
+};
+static_assert(sizeof(FrameLogRecord) % kFrameLogAlignment == 0);
+
+// Bytes a record with size bytes of payload takes in the file.
+constexpr size_t frameLogRecordSpan(uint32_t size) {
+  return sizeof(FrameLogRecord) + ((size + kFrameLogAlignment - 1) & ~(kFrameLogAlignment - 1));
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameLogPlayer.h"
+
+#include <android/log.h>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "FrameLogPlayer", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FrameLogPlayer", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "FrameLogPlayer", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "FrameLogPlayer", __VA_ARGS__)
+
+using namespace std::chrono;
+
+FrameLogPlayer::~FrameLogPlayer() {
+  stop();
+  if (streamHandle_ != nullptr) {
+    uvc_stream_close(streamHandle_);
+  }
+  if (map_ != nullptr) {
+    munmap(const_cast<uint8_t*>(map_), mapSize_);
+  }
+}
+
+bool FrameLogPlayer::open(int fd, uint32_t poolSize) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FrameLogHeader)) {
+    ULOGE("Frame log fd %d is too short", fd);
+    return false;
+  }
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    ULOGE("Frame log mmap failed: %s", strerror(errno));
+    return false;
+  }
+  map_ = static_cast<const uint8_t*>(map);
+  mapSize_ = st.st_size;
+  header_ = reinterpret_cast<const FrameLogHeader*>(map_);
+  if (memcmp(header_->magic, kFrameLogMagic, sizeof(kFrameLogMagic)) != 0 ||
+      header_->version != kFrameLogVersion || header_->headerSize < sizeof(FrameLogHeader) ||
+      header_->headerSize % kFrameLogAlignment != 0) {
+    ULOGE("Not a version %u frame log", kFrameLogVersion);
+    return false;
+  }
+  if (!index()) {
+    return false;
+  }
+  uvc_error_t res = uvc_stream_open_playback(
+      &streamHandle_,
+      static_cast<uvc_frame_format>(header_->frameFormat),
+      header_->width,
+      header_->height,
+      header_->maxFrameSize,
+      poolSize);
+  if (res != UVC_SUCCESS) {
+    ULOGE("Playback stream failed: %s", uvc_strerror(res));
+    streamHandle_ = nullptr;
+    return false;
+  }
+  ULOGI(
+      "Frame log of %zu format %u %ux%u frames, %.1f MB",
+      records_.size(),
+      header_->frameFormat,
+      header_->width,
+      header_->height,
+      mapSize_ / 1e6);
+  return true;
+}
+
+bool FrameLogPlayer::index() {
+  size_t offset = header_->headerSize;
+  while (offset + sizeof(FrameLogRecord) <= mapSize_) {
+    const FrameLogRecord* record = reinterpret_cast<const FrameLogRecord*>(map_ + offset);
+    size_t span = frameLogRecordSpan(record->size);
+    if (record->size > header_->maxFrameSize || offset + span > mapSize_) {
+      // A record cut short by the end of the recording.
+      ULOGW("Frame log ends in a partial record at %zu", offset);
+      break;
+    }
+    records_.push_back(record);
+    offset += span;
+  }
+  if (records_.empty()) {
+    ULOGE("Frame log has no frames");
+    return false;
+  }
+  return true;
+}
+
+bool FrameLogPlayer::start(uvc_frame_callback_t* callback, void* userData, const Options& options) {
+  if (streamHandle_ == nullptr || playing_) {
+    return false;
+  }
+  // A previous playback that ran to its end.
+  stop();
+  callback_ = callback;
+  userData_ = userData;
+  options_ = options;
+  playing_ = true;
+  playbackThread_ = std::thread(&FrameLogPlayer::playbackLoop, this);
+  return true;
+}
+
+void FrameLogPlayer::requestStop() {
+  playing_ = false;
+}
+
+bool FrameLogPlayer::stop() {
+  playing_ = false;
+  if (playbackThread_.joinable()) {
+    playbackThread_.join();
+  }
+  return true;
+}
+
+uvc_frame_t* FrameLogPlayer::lend(const FrameLogRecord* record, uint64_t& bufferWaits) {
+  timespec captureTime;
+  while (playing_) {
+    clock_gettime(CLOCK_MONOTONIC, &captureTime);
+    uvc_frame_t* frame;
+    uvc_error_t res = uvc_stream_playback_frame(
+        streamHandle_, record + 1, record->size, record->pts, &captureTime, &frame);
+    if (res == UVC_SUCCESS) {
+      return frame;
+    }
+    if (res != UVC_ERROR_BUSY) {
+      ULOGE("Frame %u could not be played: %s", record->sequence, uvc_strerror(res));
+      return nullptr;
+    }
+    // The pipeline holds every buffer, as it would hold up libuvc's pool.
+    bufferWaits++;
+    std::this_thread::sleep_for(1ms);
+  }
+  return nullptr;
+}
+
+void FrameLogPlayer::playbackLoop() {
+  prctl(PR_SET_NAME, "usb_video_replay");
+  steady_clock::time_point startedAt = steady_clock::now();
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t bufferWaits = 0;
+  for (uint32_t loop = 0; playing_ && (options_.loops == 0 || loop < options_.loops); loop++) {
+    steady_clock::time_point loopStart = steady_clock::now();
+    int64_t firstCaptureTimeNs = records_.front()->captureTimeNs;
+    for (const FrameLogRecord* record : records_) {
+      if (!playing_) {
+        break;
+      }
+      if (options_.realtime) {
+        std::this_thread::sleep_until(
+            loopStart + nanoseconds(record->captureTimeNs - firstCaptureTimeNs));
+      }
+      uvc_frame_t* frame = lend(record, bufferWaits);
+      if (frame == nullptr) {
+        playing_ = false;
+        break;
+      }
+      TRACE_SCOPE("replayFrame");
+      // The callback takes over the frame's reference.
+      callback_(frame, userData_);
+      frames++;
+      bytes += record->size;
+    }
+  }
+  double seconds = duration<double>(steady_clock::now() - startedAt).count();
+  ULOGI(
+      "Replayed %llu frames in %.2f s: %.1f fps, %.1f MB/s, %llu waits for a buffer",
+      (unsigned long long)frames,
+      seconds,
+      seconds > 0 ? frames / seconds : 0,
+      seconds > 0 ? bytes / seconds / 1e6 : 0,
+      (unsigned long long)bufferWaits);
+  playing_ = false;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "FrameLog.h"
+
+// Replays a frame log through a frame callback, normally
+// UsbVideoStreamer::captureFrameCallback(), so the decode, conversion and
+// preview stages can be measured on any device without a camera.
+//
+// The log is mapped read only. Each record is copied into a buffer of a
+// libuvc playback stream, uvc_stream_open_playback(), and handed to the
+// callback as a borrowed frame, so it is retained and released like a live
+// one. Frames go out at the recorded pace or as fast as the pipeline gives
+// buffers back; their capture time is the time they were handed over.
+class FrameLogPlayer final {
+ public:
+  struct Options {
+    // Keep the recorded frame timing, or play as fast as buffers come back.
+    bool realtime{true};
+    // Times the log is played, zero to loop until stopped.
+    uint32_t loops{1};
+  };
+
+  FrameLogPlayer() = default;
+  FrameLogPlayer(const FrameLogPlayer&) = delete;
+  FrameLogPlayer& operator=(const FrameLogPlayer&) = delete;
+  ~FrameLogPlayer();
+
+  // Maps and indexes the log at fd, which the caller may close afterwards.
+  // poolSize is the playback stream's frame buffer count.
+  bool open(int fd, uint32_t poolSize);
+  const FrameLogHeader& header() const {
+    return *header_;
+  }
+  // Owned by the player; closed with it.
+  uvc_stream_handle_t* streamHandle() const {
+    return streamHandle_;
+  }
+
+  bool start(uvc_frame_callback_t* callback, void* userData, const Options& options);
+  // Ends playback after the frame being handed over, without waiting.
+  void requestStop();
+  // Joins the playback thread.
+  bool stop();
+
+ private:
+  const uint8_t* map_{};
+  size_t mapSize_{};
+  const FrameLogHeader* header_{};
+  std::vector<const FrameLogRecord*> records_{};
+  uvc_stream_handle_t* streamHandle_{};
+
+  uvc_frame_callback_t* callback_{};
+  void* userData_{};
+  Options options_{};
+  std::thread playbackThread_{};
+  std::atomic<bool> playing_{false};
+
+  bool index();
+  void playbackLoop();
+  // Waits for a free buffer. Returns null once stopped.
+  uvc_frame_t* lend(const FrameLogRecord* record, uint64_t& bufferWaits);
+};
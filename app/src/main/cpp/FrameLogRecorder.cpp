@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameLogRecorder.h"
+
+#include <android/log.h>
+
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "FrameLogRecorder", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FrameLogRecorder", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "FrameLogRecorder", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "FrameLogRecorder", __VA_ARGS__)
+
+using namespace std::chrono;
+
+FrameLogRecorder::~FrameLogRecorder() {
+  stop();
+}
+
+bool FrameLogRecorder::start(int fd, FrameLogHeader header) {
+  if (running_) {
+    return false;
+  }
+  memcpy(header.magic, kFrameLogMagic, sizeof(header.magic));
+  header.version = kFrameLogVersion;
+  header.headerSize = sizeof(FrameLogHeader);
+  if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      lseek(fd, sizeof(header), SEEK_SET) != (off_t)sizeof(header)) {
+    ULOGE("Header write to fd %d failed: %s", fd, strerror(errno));
+    return false;
+  }
+  fd_ = fd;
+  frames_ = 0;
+  bytes_ = sizeof(header);
+  writeFailed_ = false;
+  skipped_ = 0;
+  running_ = true;
+  writerThread_ = std::thread(&FrameLogRecorder::writerLoop, this);
+  ULOGI(
+      "Logging format %u %ux%u frames, up to %u bytes each",
+      header.frameFormat,
+      header.width,
+      header.height,
+      header.maxFrameSize);
+  return true;
+}
+
+void FrameLogRecorder::addFrame(uvc_frame_t* frame) {
+  if (!running_) {
+    return;
+  }
+  uvc_retain_frame(frame);
+  if (!pending_.tryPush(frame, steady_clock::now().time_since_epoch().count())) {
+    uvc_release_frame(frame);
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  std::unique_lock lk(pendingMutex_);
+  pendingChange_.notify_all();
+}
+
+bool FrameLogRecorder::stop() {
+  if (!running_.exchange(false)) {
+    return false;
+  }
+  {
+    std::unique_lock lk(pendingMutex_);
+    pendingChange_.notify_all();
+  }
+  writerThread_.join();
+  ULOGI(
+      "Frame log stopped after %llu frames, %.1f MB, %u skipped by the writer%s",
+      (unsigned long long)frames_,
+      bytes_ / 1e6,
+      skipped_.load(),
+      writeFailed_ ? ", log is incomplete" : "");
+  return !writeFailed_;
+}
+
+void FrameLogRecorder::writerLoop() {
+  prctl(PR_SET_NAME, "usb_video_flog");
+  // Whatever is still queued at stop() is written too.
+  while (running_ || !pending_.empty()) {
+    uvc_frame_t* frame;
+    int64_t enqueueTime;
+    if (!pending_.tryPop(frame, enqueueTime)) {
+      std::unique_lock lk(pendingMutex_);
+      pendingChange_.wait_for(lk, 10ms, [this] { return !pending_.empty() || !running_; });
+      continue;
+    }
+    if (!writeFailed_) {
+      writeFrame(frame);
+    }
+    uvc_release_frame(frame);
+  }
+}
+
+void FrameLogRecorder::writeFrame(const uvc_frame_t* frame) {
+  TRACE_SCOPE("writeFrameLogRecord");
+  FrameLogRecord record{
+      .size = (uint32_t)frame->data_bytes,
+      .sequence = frame->sequence,
+      .captureTimeNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+          frame->capture_time_finished.tv_nsec,
+      .pts = frame->pts,
+      .flags = 0,
+  };
+  static const uint8_t kPad[kFrameLogAlignment] = {};
+  size_t span = frameLogRecordSpan(record.size);
+  iovec parts[] = {
+      {&record, sizeof(record)},
+      {frame->data, frame->data_bytes},
+      {const_cast<uint8_t*>(kPad), span - sizeof(record) - frame->data_bytes},
+  };
+  if (writev(fd_, parts, 3) != (ssize_t)span) {
+    ULOGE("Frame log write failed: %s", strerror(errno));
+    writeFailed_ = true;
+    return;
+  }
+  frames_++;
+  bytes_ += span;
+}
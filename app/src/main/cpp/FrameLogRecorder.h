@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "FrameLog.h"
+#include "SpscQueue.h"
+
+// Appends every captured frame, as libuvc delivered it, to a frame log that
+// FrameLogPlayer can replay through the pipeline without a camera.
+//
+// Like MjpegRecorder, the capture thread only takes a reference on the
+// borrowed frame and a writer thread writes it out with one writev(), so
+// logging costs no copy. Frames the writer cannot keep up with are skipped
+// and counted.
+class FrameLogRecorder final {
+ public:
+  FrameLogRecorder() = default;
+  FrameLogRecorder(const FrameLogRecorder&) = delete;
+  FrameLogRecorder& operator=(const FrameLogRecorder&) = delete;
+  ~FrameLogRecorder();
+
+  // fd must be open for writing at offset 0; the caller keeps ownership.
+  // header.magic, version and headerSize are filled in here.
+  bool start(int fd, FrameLogHeader header);
+  // Capture thread only.
+  void addFrame(uvc_frame_t* frame);
+  // Returns false when a frame could not be written.
+  bool stop();
+
+ private:
+  static constexpr uint32_t kPendingFrames = 4;
+
+  int fd_{-1};
+  SpscQueue<uvc_frame_t*> pending_{kPendingFrames};
+  std::thread writerThread_{};
+  std::atomic<bool> running_{false};
+  std::mutex pendingMutex_;
+  std::condition_variable pendingChange_;
+  std::atomic<uint32_t> skipped_{0};
+
+  // Writer thread only.
+  uint64_t frames_{};
+  uint64_t bytes_{};
+  bool writeFailed_{false};
+
+  void writerLoop();
+  void writeFrame(const uvc_frame_t* frame);
+};
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FramePairer.h"
+
+void FramePairer::offer(uint32_t stream, const uvc_frame_t* frame) {
+  Pending current{
+      .valid = true,
+      .pts = frame->pts,
+      .captureNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+          frame->capture_time_finished.tv_nsec,
+      .sequence = frame->sequence,
+  };
+  std::lock_guard lk(mutex_);
+  Pending& other = pending_[stream ^ 1];
+  if (other.valid) {
+    nanoseconds otherToCurrent = skew(other, current);
+    if (abs(otherToCurrent) <= tolerance_) {
+      stats_.pairs++;
+      stats_.lastSkewUs =
+          duration_cast<microseconds>(stream == 1 ? otherToCurrent : -otherToCurrent).count();
+      stats_.lastSequences[stream] = current.sequence;
+      stats_.lastSequences[stream ^ 1] = other.sequence;
+      other.valid = false;
+      return;
+    }
+    // This stream is past the waiting frame, which can no longer be matched.
+    if (otherToCurrent > tolerance_) {
+      stats_.unpaired++;
+      other.valid = false;
+    }
+  }
+  Pending& own = pending_[stream];
+  if (own.valid) {
+    stats_.unpaired++;
+  }
+  own = current;
+}
+
+FramePairer::Stats FramePairer::stats() {
+  std::lock_guard lk(mutex_);
+  return stats_;
+}
+
+nanoseconds FramePairer::skew(const Pending& a, const Pending& b) const {
+  if (clockFrequency_ != 0 && a.pts != 0 && b.pts != 0) {
+    // 32 bit counters, so the signed difference survives a wrap.
+    int64_t ticks = (int32_t)(b.pts - a.pts);
+    return nanoseconds(ticks * 1'000'000'000 / clockFrequency_);
+  }
+  return nanoseconds(b.captureNs - a.captureNs);
+}
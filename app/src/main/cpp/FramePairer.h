@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+using namespace std::chrono;
+
+// Matches the frames two streams of one camera captured together, such as
+// depth and color, so consumers can use them as a pair.
+//
+// Streams of a device stamp their PTS from the same clock, so frames are
+// paired by PTS, or by USB completion time when either frame has none. Each
+// stream's newest unmatched frame waits for its partner; it is counted as
+// unpaired once a newer one replaces it or the other stream moves past it.
+class FramePairer final {
+ public:
+  struct Stats {
+    uint64_t pairs{};
+    uint64_t unpaired{};
+    // Of the last pair: stream 1 minus stream 0 capture time, and the libuvc
+    // sequence numbers, which FrameTap reports too.
+    int64_t lastSkewUs{};
+    std::array<uint32_t, 2> lastSequences{};
+  };
+
+  // clockFrequency is the device's PTS clock in Hz, tolerance the largest
+  // capture time difference within a pair.
+  FramePairer(uint32_t clockFrequency, nanoseconds tolerance)
+      : clockFrequency_(clockFrequency), tolerance_(tolerance) {}
+
+  // Called from each stream's capture thread; stream is 0 or 1.
+  void offer(uint32_t stream, const uvc_frame_t* frame);
+  Stats stats();
+
+ private:
+  struct Pending {
+    bool valid{false};
+    uint32_t pts{};
+    int64_t captureNs{};
+    uint32_t sequence{};
+  };
+
+  const uint32_t clockFrequency_;
+  const nanoseconds tolerance_;
+  std::mutex mutex_;
+  std::array<Pending, 2> pending_{};
+  Stats stats_{};
+
+  // How much later b was captured than a.
+  nanoseconds skew(const Pending& a, const Pending& b) const;
+};
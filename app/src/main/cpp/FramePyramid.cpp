@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FramePyramid.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Byte offset 0 takes the Y of YUYV, 1 that of UYVY.
+void extractLuma(const uint8_t* src, size_t offset, uint8_t* dst, int32_t width) {
+  int32_t x = 0;
+#if defined(__ARM_NEON)
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t pixels = vld2q_u8(src + x * 2);
+    vst1q_u8(dst + x, offset == 0 ? pixels.val[0] : pixels.val[1]);
+  }
+#endif
+  for (; x < width; x++) {
+    dst[x] = src[x * 2 + offset];
+  }
+}
+
+} // namespace
+
+bool FramePyramid::supportsLumaFormat(uvc_frame_format format) {
+  return format == UVC_FRAME_FORMAT_YUYV || format == UVC_FRAME_FORMAT_UYVY ||
+      format == UVC_FRAME_FORMAT_NV12;
+}
+
+bool FramePyramid::configure(
+    int32_t sourceWidth,
+    int32_t sourceHeight,
+    uint32_t channels,
+    const std::vector<Level>& sizes) {
+  levels_.clear();
+  accumulators_.clear();
+  bytes_ = 0;
+  if ((channels != 1 && channels != 4) || sizes.empty() || sizes.size() > kMaxLevels) {
+    return false;
+  }
+  sourceWidth_ = sourceWidth;
+  sourceHeight_ = sourceHeight;
+  channels_ = channels;
+  for (const Level& size : sizes) {
+    if (size.width <= 0 || size.height <= 0 || size.width > sourceWidth ||
+        size.height > sourceHeight) {
+      levels_.clear();
+      accumulators_.clear();
+      bytes_ = 0;
+      return false;
+    }
+    Level& level = levels_.emplace_back(size);
+    level.stride = (int32_t)alignedStride((size_t)size.width * channels);
+    level.offset = bytes_;
+    bytes_ += (size_t)level.stride * size.height;
+    Accumulator& accumulator = accumulators_.emplace_back();
+    accumulator.identity = size.width == sourceWidth && size.height == sourceHeight;
+    if (accumulator.identity) {
+      continue;
+    }
+    accumulator.columnStart.resize(size.width + 1);
+    accumulator.columnWeight.resize(size.width);
+    for (int32_t x = 0; x <= size.width; x++) {
+      accumulator.columnStart[x] = (int32_t)((int64_t)x * sourceWidth / size.width);
+    }
+    for (int32_t x = 0; x < size.width; x++) {
+      accumulator.columnWeight[x] =
+          1.0f / (accumulator.columnStart[x + 1] - accumulator.columnStart[x]);
+    }
+    accumulator.sums.resize((size_t)size.width * channels);
+  }
+  prefix_.resize(((size_t)sourceWidth + 1) * channels);
+  if (channels == 1) {
+    lumaRow_.resize(sourceWidth);
+  }
+  return true;
+}
+
+bool FramePyramid::buildFromLuma(const uvc_frame_t* frame, uint8_t* dst) {
+  if (channels_ != 1 || levels_.empty() || frame->width != (uint32_t)sourceWidth_ ||
+      frame->height != (uint32_t)sourceHeight_ || !supportsLumaFormat(frame->frame_format) ||
+      frame->data_bytes < frame->step * frame->height) {
+    return false;
+  }
+  begin();
+  const auto* data = static_cast<const uint8_t*>(frame->data);
+  size_t offset = frame->frame_format == UVC_FRAME_FORMAT_UYVY ? 1 : 0;
+  for (int32_t y = 0; y < sourceHeight_; y++) {
+    const uint8_t* row = data + (size_t)y * frame->step;
+    if (frame->frame_format != UVC_FRAME_FORMAT_NV12) {
+      extractLuma(row, offset, lumaRow_.data(), sourceWidth_);
+      row = lumaRow_.data();
+    }
+    addRow(row, y, dst);
+  }
+  return true;
+}
+
+void FramePyramid::buildFromPixels(const uint8_t* src, size_t stride, uint8_t* dst) {
+  if (channels_ != 4 || levels_.empty()) {
+    return;
+  }
+  begin();
+  for (int32_t y = 0; y < sourceHeight_; y++) {
+    addRow(src + y * stride, y, dst);
+  }
+}
+
+int32_t FramePyramid::rowEnd(size_t level, int32_t row) const {
+  return (int32_t)((int64_t)(row + 1) * sourceHeight_ / levels_[level].height);
+}
+
+void FramePyramid::begin() {
+  for (size_t i = 0; i < levels_.size(); i++) {
+    Accumulator& accumulator = accumulators_[i];
+    accumulator.row = 0;
+    accumulator.rowEnd = rowEnd(i, 0);
+    std::fill(accumulator.sums.begin(), accumulator.sums.end(), 0);
+  }
+}
+
+void FramePyramid::addRow(const uint8_t* row, int32_t y, uint8_t* dst) {
+  size_t channels = channels_;
+  size_t rowBytes = (size_t)sourceWidth_ * channels;
+  bool summed = false;
+  for (size_t i = 0; i < levels_.size(); i++) {
+    const Level& level = levels_[i];
+    Accumulator& accumulator = accumulators_[i];
+    if (accumulator.identity) {
+      memcpy(dst + level.offset + (size_t)y * level.stride, row, rowBytes);
+      continue;
+    }
+    if (!summed) {
+      // Shared by every level: the sum of any run of columns is a difference.
+      uint32_t* prefix = prefix_.data();
+      for (size_t c = 0; c < channels; c++) {
+        prefix[c] = 0;
+      }
+      for (size_t b = 0; b < rowBytes; b++) {
+        prefix[b + channels] = prefix[b] + row[b];
+      }
+      summed = true;
+    }
+    const uint32_t* prefix = prefix_.data();
+    const int32_t* columnStart = accumulator.columnStart.data();
+    uint32_t* sums = accumulator.sums.data();
+    for (int32_t x = 0; x < level.width; x++) {
+      const uint32_t* begin = prefix + columnStart[x] * channels;
+      const uint32_t* end = prefix + columnStart[x + 1] * channels;
+      for (size_t c = 0; c < channels; c++) {
+        sums[x * channels + c] += end[c] - begin[c];
+      }
+    }
+    if (y + 1 < accumulator.rowEnd) {
+      continue;
+    }
+    int32_t rowStart = accumulator.row > 0 ? rowEnd(i, accumulator.row - 1) : 0;
+    float rowWeight = 1.0f / (accumulator.rowEnd - rowStart);
+    uint8_t* out = dst + level.offset + (size_t)accumulator.row * level.stride;
+    for (int32_t x = 0; x < level.width; x++) {
+      float weight = accumulator.columnWeight[x] * rowWeight;
+      for (size_t c = 0; c < channels; c++) {
+        out[x * channels + c] = (uint8_t)(sums[x * channels + c] * weight + 0.5f);
+        sums[x * channels + c] = 0;
+      }
+    }
+    accumulator.row++;
+    accumulator.rowEnd = rowEnd(i, accumulator.row);
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "BufferAllocator.h"
+
+// Builds downscaled copies of an image at several sizes, such as 320x240,
+// 640x480 and the full frame for detectors, in one pass over the source:
+// each source row is read once, while in cache, and added to the rows of
+// every level it covers. Levels are area averages of the source, of any
+// size up to the source's.
+//
+// The source is either the luma of a YUYV, UYVY or NV12 frame, extracted
+// straight from the frame like libuvc's uvc_yuyv2y() but with NEON where
+// available, or 4 byte pixels such as RGBA.
+//
+// Levels are laid out one after another in one buffer, rows 64 byte aligned.
+class FramePyramid final {
+ public:
+  static constexpr size_t kMaxLevels = 4;
+
+  struct Level {
+    int32_t width{};
+    int32_t height{};
+    int32_t stride{};
+    size_t offset{};
+  };
+
+  // channels is 1 for luma and 4 for 4 byte pixels. False when a size is
+  // empty or larger than the source, or there are more than kMaxLevels.
+  bool configure(
+      int32_t sourceWidth,
+      int32_t sourceHeight,
+      uint32_t channels,
+      const std::vector<Level>& sizes);
+
+  const std::vector<Level>& levels() const {
+    return levels_;
+  }
+
+  // Of the whole buffer build() fills.
+  size_t bytes() const {
+    return bytes_;
+  }
+
+  static bool supportsLumaFormat(uvc_frame_format format);
+
+  // Builds every level from the luma of frame, which must have the source
+  // size, into dst. False for other formats.
+  bool buildFromLuma(const uvc_frame_t* frame, uint8_t* dst);
+
+  // Builds every level from 4 byte pixels into dst.
+  void buildFromPixels(const uint8_t* src, size_t stride, uint8_t* dst);
+
+ private:
+  // Per level: the source columns and rows each destination pixel averages,
+  // and the sums of the destination row being accumulated.
+  struct Accumulator {
+    std::vector<int32_t> columnStart{};
+    std::vector<float> columnWeight{};
+    std::vector<uint32_t> sums{};
+    int32_t row{};
+    int32_t rowEnd{};
+    bool identity{};
+  };
+
+  int32_t sourceWidth_{};
+  int32_t sourceHeight_{};
+  uint32_t channels_{};
+  size_t bytes_{};
+  std::vector<Level> levels_{};
+  std::vector<Accumulator> accumulators_{};
+  // Running sums of the current source row, per channel, with a leading 0.
+  std::vector<uint32_t> prefix_{};
+  AlignedBytes lumaRow_{};
+
+  int32_t rowEnd(size_t level, int32_t row) const;
+  void begin();
+  void addRow(const uint8_t* row, int32_t y, uint8_t* dst);
+};
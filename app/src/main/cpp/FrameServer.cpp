@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameServer.h"
+
+#include <android/log.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "Trace.h"
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FrameServer", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "FrameServer", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "FrameServer", __VA_ARGS__)
+
+static constexpr uint64_t kBufferUsage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN |
+    AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+
+FrameServer::~FrameServer() {
+  stop();
+}
+
+bool FrameServer::start(
+    const Config& config,
+    const char* name,
+    int32_t captureWidth,
+    int32_t captureHeight,
+    uvc_frame_format captureFormat) {
+  if (running_) {
+    return false;
+  }
+  if (config.bufferCount == 0 || config.bufferCount > kMaxBuffers) {
+    ULOGE("Buffer count %u is not in 1..%u", config.bufferCount, kMaxBuffers);
+    return false;
+  }
+  if (!FrameFanout::supportsFormat(captureFormat)) {
+    ULOGE("Cannot share frame format %d", captureFormat);
+    return false;
+  }
+  size_t nameLength = strlen(name);
+  sockaddr_un address{};
+  if (nameLength == 0 || nameLength + 1 > sizeof(address.sun_path)) {
+    ULOGE("Bad socket name '%s'", name);
+    return false;
+  }
+  config_ = config;
+  if (config_.width <= 0 || config_.height <= 0) {
+    config_.width = captureWidth;
+    config_.height = captureHeight;
+  }
+  // FrameFanout clamps and rounds the same way.
+  config_.width = std::max(2, std::min(config_.width, captureWidth) & ~1);
+  config_.height = std::max(2, std::min(config_.height, captureHeight) & ~1);
+  if (!allocateBuffers()) {
+    release();
+    return false;
+  }
+
+  // An abstract name: the leading NUL keeps it out of the file system.
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path + 1, name, nameLength);
+  socklen_t addressLength = offsetof(sockaddr_un, sun_path) + 1 + nameLength;
+  listenFd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listenFd_ < 0 || bind(listenFd_, (sockaddr*)&address, addressLength) != 0 ||
+      listen(listenFd_, kMaxClients) != 0) {
+    ULOGE("Listening on @%s failed: %s", name, strerror(errno));
+    release();
+    return false;
+  }
+  wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeFd_ < 0) {
+    ULOGE("eventfd failed: %s", strerror(errno));
+    release();
+    return false;
+  }
+  published_ = 0;
+  skipped_ = 0;
+  running_ = true;
+  serverThread_ = std::thread(&FrameServer::serverLoop, this);
+  ULOGI(
+      "Serving %s %dx%d frames in %u buffers on @%s",
+      config_.format == FanoutFormat::NV12 ? "NV12" : "RGBA",
+      config_.width,
+      config_.height,
+      config_.bufferCount,
+      name);
+  return true;
+}
+
+bool FrameServer::allocateBuffers() {
+  bufferFormat_ = config_.format == FanoutFormat::NV12 ? AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420
+                                                       : AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+  AHardwareBuffer_Desc desc{};
+  desc.width = config_.width;
+  desc.height = config_.height;
+  desc.layers = 1;
+  desc.format = bufferFormat_;
+  desc.usage = kBufferUsage;
+  // Not every gralloc lets the GPU sample YUV buffers the CPU writes.
+  if (!AHardwareBuffer_isSupported(&desc)) {
+    desc.usage &= ~AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+  }
+  slots_ = std::vector<Slot>(config_.bufferCount);
+  for (Slot& slot : slots_) {
+    if (AHardwareBuffer_allocate(&desc, &slot.buffer) != 0) {
+      ULOGE(
+          "AHardwareBuffer_allocate %dx%d format %u failed",
+          config_.width,
+          config_.height,
+          bufferFormat_);
+      return false;
+    }
+  }
+  return true;
+}
+
+void FrameServer::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  eventfd_write(wakeFd_, 1);
+  serverThread_.join();
+  uvc_frame_t* frame = pending_.exchange(nullptr);
+  if (frame != nullptr) {
+    uvc_release_frame(frame);
+  }
+  busy_ = false;
+  accepting_ = false;
+  release();
+  ULOGI(
+      "Frame server stopped after %llu frames, %u skipped",
+      (unsigned long long)published_,
+      skipped_.load());
+}
+
+void FrameServer::release() {
+  for (size_t i = 0; i < clients_.size(); i++) {
+    if (clients_[i].fd >= 0) {
+      dropClient(i);
+    }
+  }
+  for (Slot& slot : slots_) {
+    if (slot.buffer != nullptr) {
+      AHardwareBuffer_release(slot.buffer);
+    }
+  }
+  slots_.clear();
+  for (int* fd : {&listenFd_, &wakeFd_}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void FrameServer::offer(uvc_frame_t* frame) {
+  if (!accepting_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // Never queue behind a frame still being written.
+  if (busy_.load(std::memory_order_acquire)) {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  busy_.store(true, std::memory_order_relaxed);
+  uvc_retain_frame(frame);
+  pending_.store(frame, std::memory_order_release);
+  eventfd_write(wakeFd_, 1);
+}
+
+void FrameServer::serverLoop() {
+  prctl(PR_SET_NAME, "usb_video_fsrv");
+  while (running_) {
+    pollfd fds[2 + kMaxClients];
+    size_t count = 0;
+    fds[count++] = {wakeFd_, POLLIN, 0};
+    fds[count++] = {listenFd_, POLLIN, 0};
+    for (const Client& client : clients_) {
+      fds[count++] = {client.fd, POLLIN, 0};
+    }
+    if (poll(fds, count, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ULOGE("poll failed: %s", strerror(errno));
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      eventfd_t ignored;
+      eventfd_read(wakeFd_, &ignored);
+      uvc_frame_t* frame = pending_.exchange(nullptr, std::memory_order_acquire);
+      if (frame != nullptr) {
+        publish(frame);
+        uvc_release_frame(frame);
+        busy_.store(false, std::memory_order_release);
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      acceptClient();
+    }
+    for (size_t i = 0; i < kMaxClients; i++) {
+      short events = fds[2 + i].revents;
+      if (clients_[i].fd < 0 || events == 0) {
+        continue;
+      }
+      if (events & POLLIN) {
+        readReleases(i);
+      } else {
+        dropClient(i);
+      }
+    }
+    updateAccepting();
+  }
+}
+
+void FrameServer::acceptClient() {
+  int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  ucred peer{};
+  socklen_t peerLength = sizeof(peer);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0) {
+    close(fd);
+    return;
+  }
+  bool allowed = peer.uid == getuid() ||
+      std::find(config_.allowedUids.begin(), config_.allowedUids.end(), peer.uid) !=
+          config_.allowedUids.end();
+  auto free = std::find_if(
+      clients_.begin(), clients_.end(), [](const Client& client) { return client.fd < 0; });
+  if (!allowed || free == clients_.end()) {
+    ULOGW("Refused client pid %d uid %d: %s", peer.pid, peer.uid, allowed ? "full" : "uid");
+    close(fd);
+    return;
+  }
+  if (!welcome(fd)) {
+    ULOGW("Handshake with pid %d failed: %s", peer.pid, strerror(errno));
+    close(fd);
+    return;
+  }
+  *free = {fd, peer.uid};
+  ULOGI("Client pid %d uid %d connected", peer.pid, peer.uid);
+}
+
+bool FrameServer::welcome(int fd) {
+  Hello hello;
+  hello.bufferCount = slots_.size();
+  hello.format = bufferFormat_;
+  hello.width = config_.width;
+  hello.height = config_.height;
+  if (send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+    return false;
+  }
+  for (const Slot& slot : slots_) {
+    if (AHardwareBuffer_sendHandleToUnixSocket(slot.buffer, fd) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FrameServer::readReleases(size_t client) {
+  ReleaseMessage message;
+  ssize_t received;
+  while ((received = recv(clients_[client].fd, &message, sizeof(message), MSG_DONTWAIT)) ==
+         sizeof(message)) {
+    if (message.buffer < slots_.size() && slots_[message.buffer].sequence == message.sequence) {
+      slots_[message.buffer].holders &= ~(1u << client);
+    }
+  }
+  if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    dropClient(client);
+  }
+}
+
+void FrameServer::dropClient(size_t client) {
+  close(clients_[client].fd);
+  clients_[client] = Client{};
+  for (Slot& slot : slots_) {
+    slot.holders &= ~(1u << client);
+  }
+  ULOGI("Client %zu disconnected", client);
+}
+
+void FrameServer::updateAccepting() {
+  bool hasClient = std::any_of(
+      clients_.begin(), clients_.end(), [](const Client& client) { return client.fd >= 0; });
+  bool hasFreeSlot =
+      std::any_of(slots_.begin(), slots_.end(), [](const Slot& slot) { return slot.holders == 0; });
+  accepting_.store(hasClient && hasFreeSlot, std::memory_order_relaxed);
+}
+
+void FrameServer::publish(uvc_frame_t* frame) {
+  TRACE_SCOPE("serveFrame");
+  // The free buffer written longest ago, so clients that hold on to the latest
+  // frame a little longer do not see it overwritten.
+  Slot* slot = nullptr;
+  for (Slot& candidate : slots_) {
+    if (candidate.holders != 0) {
+      continue;
+    }
+    if (slot == nullptr || candidate.publishOrder < slot->publishOrder) {
+      slot = &candidate;
+    }
+  }
+  if (slot == nullptr) {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  FrameFanout::FramePtr derived =
+      fanout_.derive(frame, config_.format, config_.width, config_.height);
+  int32_t fence = -1;
+  if (derived == nullptr || derived->width != config_.width ||
+      derived->height != config_.height || !writeBuffer(slot->buffer, *derived, fence)) {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  slot->sequence = frame->sequence;
+  slot->publishOrder = ++published_;
+
+  FrameMessage message;
+  message.buffer = slot - slots_.data();
+  message.sequence = frame->sequence;
+  message.captureTimeNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+      frame->capture_time_finished.tv_nsec;
+  message.hasFence = fence >= 0;
+  iovec part{&message, sizeof(message)};
+  alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(int))]{};
+  msghdr header{};
+  header.msg_iov = &part;
+  header.msg_iovlen = 1;
+  if (fence >= 0) {
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    cmsghdr* rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(rights), &fence, sizeof(int));
+  }
+  for (size_t i = 0; i < kMaxClients; i++) {
+    // A client that does not keep up misses the frame rather than stalling us.
+    if (clients_[i].fd >= 0 && sendmsg(clients_[i].fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL) > 0) {
+      slot->holders |= 1u << i;
+    }
+  }
+  if (fence >= 0) {
+    close(fence);
+  }
+}
+
+bool FrameServer::writeBuffer(
+    AHardwareBuffer* buffer,
+    const FrameFanout::Frame& frame,
+    int32_t& fence) {
+  const uint8_t* src = frame.data.data();
+  if (frame.format == FanoutFormat::RGBA) {
+    AHardwareBuffer_Desc desc;
+    AHardwareBuffer_describe(buffer, &desc);
+    void* bits = nullptr;
+    if (AHardwareBuffer_lock(buffer, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, nullptr, &bits) !=
+        0) {
+      ULOGE("AHardwareBuffer_lock failed");
+      return false;
+    }
+    for (int32_t row = 0; row < frame.height; row++) {
+      memcpy((uint8_t*)bits + row * desc.stride * 4, src + row * frame.stride, frame.width * 4);
+    }
+    return AHardwareBuffer_unlock(buffer, &fence) == 0;
+  }
+
+  AHardwareBuffer_Planes planes;
+  if (AHardwareBuffer_lockPlanes(
+          buffer, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, nullptr, &planes) != 0 ||
+      planes.planeCount < 3) {
+    ULOGE("AHardwareBuffer_lockPlanes failed");
+    return false;
+  }
+  const AHardwareBuffer_Plane& yPlane = planes.planes[0];
+  const AHardwareBuffer_Plane& cbPlane = planes.planes[1];
+  const AHardwareBuffer_Plane& crPlane = planes.planes[2];
+  for (int32_t row = 0; row < frame.height; row++) {
+    memcpy((uint8_t*)yPlane.data + row * yPlane.rowStride, src + row * frame.stride, frame.width);
+  }
+  // Whole chroma rows when gralloc uses NV12's interleaved CbCr too.
+  const uint8_t* srcUv = src + frame.stride * frame.height;
+  bool isNv12Layout = cbPlane.pixelStride == 2 && crPlane.pixelStride == 2 &&
+      (uint8_t*)crPlane.data == (uint8_t*)cbPlane.data + 1;
+  for (int32_t row = 0; row < frame.height / 2; row++) {
+    const uint8_t* srcRow = srcUv + row * frame.stride;
+    uint8_t* cbRow = (uint8_t*)cbPlane.data + row * cbPlane.rowStride;
+    if (isNv12Layout) {
+      memcpy(cbRow, srcRow, frame.width);
+      continue;
+    }
+    uint8_t* crRow = (uint8_t*)crPlane.data + row * crPlane.rowStride;
+    for (int32_t col = 0; col < frame.width / 2; col++) {
+      cbRow[col * cbPlane.pixelStride] = srcRow[col * 2];
+      crRow[col * crPlane.pixelStride] = srcRow[col * 2 + 1];
+    }
+  }
+  return AHardwareBuffer_unlock(buffer, &fence) == 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <android/hardware_buffer.h>
+#include <libuvc/libuvc.h>
+#include <sys/types.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "FrameFanout.h"
+
+// Shares the stream with other processes through a ring of AHardwareBuffers.
+//
+// Clients connect to an abstract SOCK_SEQPACKET Unix socket and get a Hello,
+// then every buffer once through AHardwareBuffer_sendHandleToUnixSocket().
+// From then on each frame is one FrameMessage naming its buffer, with the
+// fence of the write attached as SCM_RIGHTS when there is one. Clients read
+// the buffers in place and send a ReleaseMessage back when done. A buffer is
+// written again only once no client holds it: frames arriving while every
+// buffer is held are skipped, and so are clients whose socket is full.
+//
+// Frames are converted through the FrameFanout shared with the other
+// consumers on the server's own thread, which also accepts clients and reads
+// their releases; the capture thread only hands over a frame reference.
+// Clients of other uids must be allowed in the Config.
+class FrameServer final {
+ public:
+  struct Config {
+    FanoutFormat format{FanoutFormat::RGBA};
+    // Zero keeps the capture size.
+    int32_t width{};
+    int32_t height{};
+    uint32_t bufferCount{4};
+    std::vector<uid_t> allowedUids{};
+  };
+
+  // Socket messages, native endian.
+  static constexpr uint32_t kMagic = 0x53465655; // "UVFS"
+  static constexpr uint32_t kVersion = 1;
+  struct Hello {
+    uint32_t magic{kMagic};
+    uint32_t version{kVersion};
+    uint32_t bufferCount{};
+    uint32_t format{}; // AHardwareBuffer format
+    int32_t width{};
+    int32_t height{};
+  };
+  struct FrameMessage {
+    uint32_t buffer{};
+    uint32_t sequence{};
+    int64_t captureTimeNs{}; // CLOCK_MONOTONIC, end of the USB transfer
+    uint32_t hasFence{};
+    uint32_t reserved{};
+  };
+  struct ReleaseMessage {
+    uint32_t buffer{};
+    uint32_t sequence{};
+  };
+
+  static constexpr uint32_t kMaxBuffers = 8;
+  static constexpr size_t kMaxClients = 4;
+
+  explicit FrameServer(FrameFanout& fanout) : fanout_(fanout) {}
+  FrameServer(const FrameServer&) = delete;
+  FrameServer& operator=(const FrameServer&) = delete;
+  ~FrameServer();
+
+  // name is the abstract socket name, without the leading NUL.
+  bool start(
+      const Config& config,
+      const char* name,
+      int32_t captureWidth,
+      int32_t captureHeight,
+      uvc_frame_format captureFormat);
+  // Disconnects the clients; the buffers live on in processes that mapped them.
+  void stop();
+
+  // Capture thread only. Takes a reference on frame when it is accepted.
+  void offer(uvc_frame_t* frame);
+
+ private:
+  struct Slot {
+    AHardwareBuffer* buffer{};
+    // Bit i is set while client i holds the buffer.
+    uint32_t holders{};
+    uint32_t sequence{};
+    uint64_t publishOrder{};
+  };
+  struct Client {
+    int fd{-1};
+    uid_t uid{};
+  };
+
+  FrameFanout& fanout_;
+  Config config_{};
+  uint32_t bufferFormat_{};
+  std::vector<Slot> slots_{};
+  std::array<Client, kMaxClients> clients_{};
+
+  int listenFd_{-1};
+  int wakeFd_{-1};
+  std::thread serverThread_{};
+  std::atomic<bool> running_{false};
+  // Frame handed over by the capture thread, null while the server is idle.
+  std::atomic<uvc_frame_t*> pending_{nullptr};
+  std::atomic<bool> busy_{false};
+  // Set by the server thread while a client is connected and a buffer is free.
+  std::atomic<bool> accepting_{false};
+  std::atomic<uint32_t> skipped_{0};
+
+  // Server thread only.
+  uint64_t published_{};
+
+  bool allocateBuffers();
+  void serverLoop();
+  void acceptClient();
+  bool welcome(int fd);
+  void readReleases(size_t client);
+  void dropClient(size_t client);
+  void publish(uvc_frame_t* frame);
+  bool writeBuffer(AHardwareBuffer* buffer, const FrameFanout::Frame& frame, int32_t& fence);
+  void updateAccepting();
+  void release();
+};
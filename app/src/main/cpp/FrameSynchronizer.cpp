@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "FrameSynchronizer.h"
+
+#include <algorithm>
+
+FrameSynchronizer::FrameSynchronizer(
+    uint32_t streams,
+    nanoseconds tolerance,
+    nanoseconds maxWait)
+    : streams_(std::clamp<uint32_t>(streams, 1, kMaxStreams)),
+      toleranceNs_(tolerance.count()),
+      maxWaitNs_(maxWait.count()) {}
+
+FrameSynchronizer::~FrameSynchronizer() {
+  for (std::deque<Queued>& queue : queues_) {
+    for (Queued& queued : queue) {
+      uvc_release_frame(queued.frame);
+    }
+  }
+  if (hasReady_) {
+    releaseSet(ready_);
+  }
+  if (hasAcquired_) {
+    releaseSet(acquired_);
+  }
+}
+
+void FrameSynchronizer::offer(uint32_t stream, uvc_frame_t* frame, int64_t captureNs) {
+  if (stream >= streams_) {
+    return;
+  }
+  int64_t nowNs = steady_clock::now().time_since_epoch().count();
+  uvc_retain_frame(frame);
+  std::lock_guard lk(mutex_);
+  std::deque<Queued>& queue = queues_[stream];
+  if (queue.size() >= kMaxQueued) {
+    // Its partners are later still; the other streams are behind.
+    uvc_release_frame(queue.front().frame);
+    queue.pop_front();
+    stats_.stale++;
+  }
+  queue.push_back({frame, captureNs, nowNs});
+  matchLocked(nowNs);
+}
+
+void FrameSynchronizer::matchLocked(int64_t nowNs) {
+  while (true) {
+    // Frames that waited too long for a partner go, oldest first.
+    bool complete = true;
+    for (uint32_t s = 0; s < streams_; s++) {
+      std::deque<Queued>& queue = queues_[s];
+      while (!queue.empty() && nowNs - queue.front().arrivedNs > maxWaitNs_) {
+        uvc_release_frame(queue.front().frame);
+        queue.pop_front();
+        stats_.timedOut++;
+      }
+      complete = complete && !queue.empty();
+    }
+    if (!complete) {
+      return;
+    }
+    int64_t latest = INT64_MIN;
+    for (uint32_t s = 0; s < streams_; s++) {
+      latest = std::max(latest, queues_[s].front().captureNs);
+    }
+    // Older frames cannot match latest, nor anything after it.
+    bool dropped = false;
+    for (uint32_t s = 0; s < streams_; s++) {
+      std::deque<Queued>& queue = queues_[s];
+      while (!queue.empty() && queue.front().captureNs < latest - toleranceNs_) {
+        uvc_release_frame(queue.front().frame);
+        queue.pop_front();
+        stats_.stale++;
+        dropped = true;
+      }
+    }
+    if (dropped) {
+      continue;
+    }
+    if (hasReady_) {
+      releaseSet(ready_);
+      stats_.superseded++;
+    }
+    ready_.number = nextNumber_++;
+    ready_.streams = streams_;
+    int64_t earliest = latest;
+    for (uint32_t s = 0; s < streams_; s++) {
+      Queued queued = queues_[s].front();
+      queues_[s].pop_front();
+      ready_.frames[s] = queued.frame;
+      ready_.captureNs[s] = queued.captureNs;
+      earliest = std::min(earliest, queued.captureNs);
+    }
+    ready_.spreadNs = latest - earliest;
+    hasReady_ = true;
+    stats_.sets++;
+    stats_.lastSpreadUs = ready_.spreadNs / 1000;
+    changed_.notify_all();
+  }
+}
+
+bool FrameSynchronizer::acquire(Set& set, nanoseconds timeout) {
+  std::unique_lock lk(mutex_);
+  if (hasAcquired_) {
+    return false;
+  }
+  if (!changed_.wait_for(lk, timeout, [this] { return hasReady_; })) {
+    return false;
+  }
+  acquired_ = ready_;
+  hasAcquired_ = true;
+  hasReady_ = false;
+  set = acquired_;
+  return true;
+}
+
+void FrameSynchronizer::release() {
+  std::lock_guard lk(mutex_);
+  if (hasAcquired_) {
+    releaseSet(acquired_);
+    hasAcquired_ = false;
+    changed_.notify_all();
+  }
+}
+
+void FrameSynchronizer::flush(uint32_t stream) {
+  if (stream >= streams_) {
+    return;
+  }
+  std::unique_lock lk(mutex_);
+  for (Queued& queued : queues_[stream]) {
+    uvc_release_frame(queued.frame);
+  }
+  queues_[stream].clear();
+  if (hasReady_) {
+    releaseSet(ready_);
+    hasReady_ = false;
+  }
+  if (hasAcquired_ && !changed_.wait_for(lk, kReleaseTimeout, [this] { return !hasAcquired_; })) {
+    // The consumer may read a reused buffer now, which beats libuvc
+    // touching the stream it freed on the late release.
+    releaseSet(acquired_);
+    hasAcquired_ = false;
+  }
+}
+
+FrameSynchronizer::Stats FrameSynchronizer::stats() {
+  std::lock_guard lk(mutex_);
+  return stats_;
+}
+
+void FrameSynchronizer::releaseSet(Set& set) {
+  for (uint32_t s = 0; s < set.streams; s++) {
+    uvc_release_frame(set.frames[s]);
+  }
+  set = {};
+}
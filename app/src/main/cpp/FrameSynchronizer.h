@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+using namespace std::chrono;
+
+// Matches the frames several cameras captured at about the same time into
+// sets, for stereo and multi-view consumers, where FramePairer only matches
+// two streams of one camera.
+//
+// Devices share no clock, so frames are matched on their host capture time:
+// the PTS mapped onto CLOCK_MONOTONIC by each stream's DeviceClock, or the
+// USB completion time until it is confident. A set takes the oldest waiting
+// frame of every stream once they all lie within the tolerance of the latest
+// of them; frames older than that can no longer be matched and are dropped
+// right away. A frame whose partners do not arrive within the maximum wait
+// is dropped too, so a stalled camera does not hold the others' buffers.
+//
+// Frames are not copied: the synchronizer holds references on libuvc's pool
+// buffers, at most kMaxQueued per stream, the newest matched set and the set
+// the consumer acquired. Matched sets the consumer did not get to are
+// replaced by newer ones.
+class FrameSynchronizer final {
+ public:
+  static constexpr uint32_t kMaxStreams = 8;
+  static constexpr size_t kMaxQueued = 3;
+  // How long flush() waits for the consumer to give back an acquired set
+  // holding the stream's frames, before it takes them back anyway.
+  static constexpr milliseconds kReleaseTimeout = 500ms;
+
+  struct Set {
+    uint64_t number{};
+    uint32_t streams{};
+    std::array<uvc_frame_t*, kMaxStreams> frames{};
+    std::array<int64_t, kMaxStreams> captureNs{};
+    // Latest capture time of the set minus the earliest.
+    int64_t spreadNs{};
+  };
+
+  struct Stats {
+    uint64_t sets{};
+    // Of the frames offered: too old to match by the time the other streams
+    // caught up, or with no partners within the maximum wait.
+    uint64_t stale{};
+    uint64_t timedOut{};
+    // Matched sets replaced by a newer one before they were acquired.
+    uint64_t superseded{};
+    int64_t lastSpreadUs{};
+  };
+
+  FrameSynchronizer(uint32_t streams, nanoseconds tolerance, nanoseconds maxWait);
+  FrameSynchronizer(const FrameSynchronizer&) = delete;
+  FrameSynchronizer& operator=(const FrameSynchronizer&) = delete;
+  // Releases every frame, an acquired set's included.
+  ~FrameSynchronizer();
+
+  uint32_t streams() const {
+    return streams_;
+  }
+
+  // Each stream's render thread; stream is below streams(). Takes a
+  // reference on frame while it waits for its partners.
+  void offer(uint32_t stream, uvc_frame_t* frame, int64_t captureNs);
+
+  // The newest set matched since the last one acquired, waiting up to
+  // timeout for one. Its frames stay valid until release(). False when
+  // there is none, or a set is still acquired.
+  bool acquire(Set& set, nanoseconds timeout = 0ns);
+  void release();
+
+  // Drops the frames of stream, which is stopping, waiting up to
+  // kReleaseTimeout for an acquired set holding one: libuvc frees its pool
+  // with the stream.
+  void flush(uint32_t stream);
+
+  Stats stats();
+
+ private:
+  struct Queued {
+    uvc_frame_t* frame;
+    int64_t captureNs;
+    int64_t arrivedNs;
+  };
+
+  const uint32_t streams_;
+  const int64_t toleranceNs_;
+  const int64_t maxWaitNs_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::array<std::deque<Queued>, kMaxStreams> queues_{};
+  Set ready_{};
+  bool hasReady_{false};
+  Set acquired_{};
+  bool hasAcquired_{false};
+  uint64_t nextNumber_{1};
+  Stats stats_{};
+
+  // Forms every set the queues allow.
+  void matchLocked(int64_t nowNs);
+  void releaseSet(Set& set);
+};
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameTap.h"
+
+#include <android/log.h>
+
+#include <sys/prctl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "FrameTap", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "FrameTap", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "FrameTap", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "FrameTap", __VA_ARGS__)
+
+using namespace std::chrono;
+
+static const char* formatName(FrameTapFormat format) {
+  switch (format) {
+    case FrameTapFormat::RAW:
+      return "raw";
+    case FrameTapFormat::NV12:
+      return "NV12";
+    case FrameTapFormat::RGBA:
+      return "RGBA";
+    case FrameTapFormat::LUMA:
+      return "luma";
+    case FrameTapFormat::TENSOR:
+      return "tensor";
+  }
+  return "?";
+}
+
+FrameTap::~FrameTap() {
+  stop();
+}
+
+bool FrameTap::start(
+    const Config& config,
+    int32_t captureWidth,
+    int32_t captureHeight,
+    uvc_frame_format captureFormat,
+    uint32_t maxFrameSize) {
+  if (running_) {
+    return false;
+  }
+  if (config.bufferCount == 0 || config.bufferCount > kMaxBuffers) {
+    ULOGE("Buffer count %u is not in 1..%u", config.bufferCount, kMaxBuffers);
+    return false;
+  }
+  config_ = config;
+  bool luma = config_.format == FrameTapFormat::LUMA;
+  if (config_.levels.size() >= kMaxLevels ||
+      (!config_.levels.empty() && !luma && config_.format != FrameTapFormat::RGBA)) {
+    ULOGE("No %zu pyramid levels for %s frames", config_.levels.size(), formatName(config.format));
+    return false;
+  }
+  if (config_.format == FrameTapFormat::RAW) {
+    config_.width = captureWidth;
+    config_.height = captureHeight;
+    slotCapacity_ = maxFrameSize;
+  } else if (config_.format == FrameTapFormat::TENSOR) {
+    // MJPEG goes through the fanout's capture size NV12 decode, which is
+    // full range as JPEG is, like the stream's colorimetry says.
+    uvc_frame_format source =
+        captureFormat == UVC_FRAME_FORMAT_MJPEG ? UVC_FRAME_FORMAT_NV12 : captureFormat;
+    if (!tensor_.configure(
+            config_.tensor, captureWidth, captureHeight, source, fanout_.colorimetry())) {
+      ULOGE(
+          "Cannot convert %dx%d frames of format %d to a %dx%d tensor",
+          captureWidth,
+          captureHeight,
+          captureFormat,
+          config_.tensor.width,
+          config_.tensor.height);
+      return false;
+    }
+    config_.width = config_.tensor.width;
+    config_.height = config_.tensor.height;
+    slotCapacity_ = tensor_.bytes();
+  } else {
+    if (luma ? !FramePyramid::supportsLumaFormat(captureFormat)
+             : !FrameFanout::supportsFormat(captureFormat)) {
+      ULOGE("Cannot convert frame format %d to %s", captureFormat, formatName(config.format));
+      return false;
+    }
+    if (config_.width <= 0 || config_.height <= 0) {
+      config_.width = captureWidth;
+      config_.height = captureHeight;
+    }
+    if (config_.width > captureWidth || config_.height > captureHeight) {
+      ULOGE(
+          "Tap size %dx%d exceeds capture size %dx%d",
+          config_.width,
+          config_.height,
+          captureWidth,
+          captureHeight);
+      return false;
+    }
+    // NV12 chroma is subsampled in both directions.
+    config_.width = std::max(2, config_.width & ~1);
+    config_.height = std::max(2, config_.height & ~1);
+    size_t pixels = (size_t)config_.width * config_.height;
+    slotCapacity_ = config_.format == FrameTapFormat::NV12 ? pixels * 3 / 2 : pixels * 4;
+    if (luma || !config_.levels.empty()) {
+      // Luma is taken from the capture, RGBA levels from the fanout's
+      // conversion at the first level's size.
+      std::vector<FramePyramid::Level> sizes{{config_.width, config_.height}};
+      for (const Size& level : config_.levels) {
+        sizes.push_back({level.width, level.height});
+      }
+      if (!pyramid_.configure(
+              luma ? captureWidth : config_.width,
+              luma ? captureHeight : config_.height,
+              luma ? 1 : 4,
+              sizes)) {
+        ULOGE("Pyramid levels must be within %dx%d", config_.width, config_.height);
+        return false;
+      }
+      slotCapacity_ = pyramid_.bytes();
+    }
+  }
+  if (slotCapacity_ == 0) {
+    ULOGE("No buffer size for %s frames", formatName(config_.format));
+    return false;
+  }
+
+  if (!allocateSlots()) {
+    slots_.clear();
+    return false;
+  }
+  published_ = 0;
+  skipped_ = 0;
+  running_ = true;
+  tapThread_ = std::thread(&FrameTap::tapLoop, this);
+  ULOGI(
+      "Tapping %s %dx%d frames into %u %sbuffers of %zu bytes",
+      formatName(config_.format),
+      config_.width,
+      config_.height,
+      config_.bufferCount,
+      config_.hardwareBuffers ? "hardware " : "",
+      slotCapacity_);
+  return true;
+}
+
+bool FrameTap::allocateSlots() {
+  size_t allocation = (slotCapacity_ + kBufferAlignment - 1) & ~(kBufferAlignment - 1);
+  slots_ = std::vector<Slot>(config_.bufferCount);
+  if (!config_.hardwareBuffers) {
+    for (Slot& slot : slots_) {
+      slot.data.reset(static_cast<uint8_t*>(aligned_alloc(kBufferAlignment, allocation)));
+      if (slot.data == nullptr) {
+        ULOGE("Could not allocate %zu bytes for %u buffers", allocation, config_.bufferCount);
+        return false;
+      }
+    }
+    return true;
+  }
+  // Written by the CPU, read as shader storage or NN API memory.
+  AHardwareBuffer_Desc desc{};
+  desc.width = allocation;
+  desc.height = 1;
+  desc.layers = 1;
+  desc.format = AHARDWAREBUFFER_FORMAT_BLOB;
+  desc.usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_GPU_DATA_BUFFER;
+  if (!AHardwareBuffer_isSupported(&desc)) {
+    ULOGE("Hardware buffers of %zu bytes are not supported", allocation);
+    return false;
+  }
+  for (Slot& slot : slots_) {
+    AHardwareBuffer* buffer = nullptr;
+    if (AHardwareBuffer_allocate(&desc, &buffer) != 0) {
+      ULOGE("AHardwareBuffer_allocate of %zu bytes failed", allocation);
+      return false;
+    }
+    slot.hardwareBuffer.reset(buffer);
+  }
+  return true;
+}
+
+void FrameTap::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  {
+    std::unique_lock lk(pendingMutex_);
+    pendingChange_.notify_all();
+  }
+  tapThread_.join();
+  uvc_frame_t* frame = pending_.exchange(nullptr);
+  if (frame != nullptr) {
+    uvc_release_frame(frame);
+  }
+  busy_ = false;
+  ULOGI(
+      "Frame tap stopped after %llu frames, %u skipped",
+      (unsigned long long)published_,
+      skipped_.load());
+}
+
+void FrameTap::offer(uvc_frame_t* frame) {
+  if (!running_) {
+    return;
+  }
+  // Never queue behind a frame still being converted, and never take a pool
+  // buffer from libuvc when every tap buffer is held by consumers.
+  if (busy_.load(std::memory_order_acquire) || !hasWritableSlot()) {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  busy_.store(true, std::memory_order_relaxed);
+  uvc_retain_frame(frame);
+  pending_.store(frame, std::memory_order_release);
+  std::unique_lock lk(pendingMutex_);
+  pendingChange_.notify_all();
+}
+
+bool FrameTap::hasWritableSlot() const {
+  for (const Slot& slot : slots_) {
+    uint32_t state = slot.state.load(std::memory_order_relaxed);
+    if (state == FREE || state == READY) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int32_t FrameTap::claimSlot() {
+  for (size_t i = 0; i < slots_.size(); i++) {
+    uint32_t expected = FREE;
+    if (slots_[i].state.compare_exchange_strong(expected, WRITING, std::memory_order_acquire)) {
+      return i;
+    }
+  }
+  // Overwrite the oldest frame nobody acquired. A consumer may acquire it
+  // first, so look again when the exchange fails.
+  for (size_t attempt = 0; attempt < slots_.size(); attempt++) {
+    int32_t oldest = -1;
+    uint64_t oldestOrder = UINT64_MAX;
+    for (size_t i = 0; i < slots_.size(); i++) {
+      uint64_t order = slots_[i].publishOrder.load(std::memory_order_relaxed);
+      if (slots_[i].state.load(std::memory_order_relaxed) == READY && order < oldestOrder) {
+        oldest = i;
+        oldestOrder = order;
+      }
+    }
+    if (oldest < 0) {
+      return -1;
+    }
+    uint32_t expected = READY;
+    if (slots_[oldest].state.compare_exchange_strong(
+            expected, WRITING, std::memory_order_acquire)) {
+      return oldest;
+    }
+  }
+  return -1;
+}
+
+int32_t FrameTap::acquire(FrameInfo& info) {
+  while (true) {
+    int32_t newest = -1;
+    uint64_t newestOrder = 0;
+    for (size_t i = 0; i < slots_.size(); i++) {
+      if (slots_[i].state.load(std::memory_order_acquire) != READY) {
+        continue;
+      }
+      uint64_t order = slots_[i].publishOrder.load(std::memory_order_relaxed);
+      if (newest < 0 || order > newestOrder) {
+        newest = i;
+        newestOrder = order;
+      }
+    }
+    if (newest < 0) {
+      return -1;
+    }
+    uint32_t expected = READY;
+    if (!slots_[newest].state.compare_exchange_strong(
+            expected, ACQUIRED, std::memory_order_acq_rel)) {
+      continue; // overwritten meanwhile
+    }
+    Slot& slot = slots_[newest];
+    info = slot.info;
+    // Frames older than this one would arrive out of order; recycle them.
+    uint64_t acquiredOrder = slot.publishOrder.load(std::memory_order_relaxed);
+    for (Slot& other : slots_) {
+      if (other.publishOrder.load(std::memory_order_relaxed) < acquiredOrder) {
+        uint32_t ready = READY;
+        other.state.compare_exchange_strong(ready, FREE, std::memory_order_relaxed);
+      }
+    }
+    return newest;
+  }
+}
+
+void FrameTap::release(int32_t index) {
+  if (index < 0 || (size_t)index >= slots_.size()) {
+    return;
+  }
+  uint32_t expected = ACQUIRED;
+  if (!slots_[index].state.compare_exchange_strong(expected, FREE, std::memory_order_release)) {
+    ULOGW("Buffer %d released without being acquired", index);
+  }
+}
+
+void FrameTap::tapLoop() {
+  prctl(PR_SET_NAME, "usb_video_tap");
+  while (running_) {
+    uvc_frame_t* frame = pending_.exchange(nullptr, std::memory_order_acquire);
+    if (frame == nullptr) {
+      std::unique_lock lk(pendingMutex_);
+      pendingChange_.wait_for(lk, 10ms, [this] { return pending_ != nullptr || !running_; });
+      continue;
+    }
+    int32_t index = claimSlot();
+    if (index < 0) {
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      Slot& slot = slots_[index];
+      if (write(frame, slot)) {
+        slot.publishOrder.store(++published_, std::memory_order_relaxed);
+        slot.state.store(READY, std::memory_order_release);
+      } else {
+        slot.state.store(FREE, std::memory_order_release);
+      }
+    }
+    uvc_release_frame(frame);
+    busy_.store(false, std::memory_order_release);
+  }
+}
+
+bool FrameTap::write(const uvc_frame_t* frame, Slot& slot) {
+  if (slot.hardwareBuffer == nullptr) {
+    return convert(frame, slot.data.get(), slot.info);
+  }
+  void* bits = nullptr;
+  if (AHardwareBuffer_lock(
+          slot.hardwareBuffer.get(), AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, nullptr, &bits) !=
+      0) {
+    ULOGE("AHardwareBuffer_lock failed");
+    return false;
+  }
+  bool written = convert(frame, static_cast<uint8_t*>(bits), slot.info);
+  // Without a fence, returns once the writes are visible to the buffer's
+  // other users.
+  AHardwareBuffer_unlock(slot.hardwareBuffer.get(), nullptr);
+  return written;
+}
+
+bool FrameTap::convert(const uvc_frame_t* frame, uint8_t* dst, FrameInfo& info) {
+  TRACE_SCOPE("tapFrame");
+  info.captureTimeNs =
+      frame->capture_time_finished.tv_sec * 1'000'000'000LL + frame->capture_time_finished.tv_nsec;
+  info.sequence = frame->sequence;
+  info.levelCount = 1;
+  if (config_.format == FrameTapFormat::LUMA) {
+    if (!pyramid_.buildFromLuma(frame, dst)) {
+      return false;
+    }
+    setLevels(info);
+    return true;
+  }
+  if (config_.format == FrameTapFormat::TENSOR) {
+    return convertTensor(frame, dst, info);
+  }
+  if (config_.format == FrameTapFormat::RAW) {
+    if (frame->data_bytes > slotCapacity_) {
+      ULOGE("Frame of %zu bytes exceeds the %zu byte buffers", frame->data_bytes, slotCapacity_);
+      return false;
+    }
+    memcpy(dst, frame->data, frame->data_bytes);
+    info.width = frame->width;
+    info.height = frame->height;
+    info.stride = frame->step;
+    info.size = frame->data_bytes;
+    info.levels[0] = {info.width, info.height, info.stride, 0};
+    return true;
+  }
+
+  // Shared with the other consumers asking for this frame in the same layout.
+  FrameFanout::FramePtr derived = fanout_.derive(
+      frame,
+      config_.format == FrameTapFormat::NV12 ? FanoutFormat::NV12 : FanoutFormat::RGBA,
+      config_.width,
+      config_.height);
+  if (derived == nullptr || derived->size() > slotCapacity_) {
+    return false;
+  }
+  if (!config_.levels.empty()) {
+    pyramid_.buildFromPixels(derived->data.data(), derived->stride, dst);
+    setLevels(info);
+    return true;
+  }
+  memcpy(dst, derived->data.data(), derived->size());
+  info.width = derived->width;
+  info.height = derived->height;
+  info.stride = derived->stride;
+  info.size = derived->size();
+  info.levels[0] = {info.width, info.height, info.stride, 0};
+  return true;
+}
+
+bool FrameTap::convertTensor(const uvc_frame_t* frame, uint8_t* dst, FrameInfo& info) {
+  bool converted;
+  if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+    FrameFanout::FramePtr decoded = fanout_.derive(frame, FanoutFormat::NV12, 0, 0);
+    if (decoded == nullptr) {
+      return false;
+    }
+    uvc_frame_t nv12{};
+    nv12.data = const_cast<uint8_t*>(decoded->data.data());
+    nv12.data_bytes = decoded->size();
+    nv12.width = decoded->width;
+    nv12.height = decoded->height;
+    nv12.step = decoded->stride;
+    nv12.frame_format = UVC_FRAME_FORMAT_NV12;
+    converted = tensor_.convert(&nv12, dst);
+  } else {
+    converted = tensor_.convert(frame, dst);
+  }
+  if (!converted) {
+    return false;
+  }
+  const TensorSpec& spec = tensor_.spec();
+  size_t valueBytes = spec.type == TensorType::FLOAT32 ? sizeof(float) : 1;
+  info.width = spec.width;
+  info.height = spec.height;
+  info.stride = (int32_t)(valueBytes * spec.width * (spec.layout == TensorLayout::NHWC ? 3 : 1));
+  info.size = tensor_.bytes();
+  info.levels[0] = {info.width, info.height, info.stride, 0};
+  return true;
+}
+
+void FrameTap::setLevels(FrameInfo& info) const {
+  const std::vector<FramePyramid::Level>& levels = pyramid_.levels();
+  std::copy(levels.begin(), levels.end(), info.levels.begin());
+  info.levelCount = levels.size();
+  info.width = levels[0].width;
+  info.height = levels[0].height;
+  info.stride = levels[0].stride;
+  info.size = pyramid_.bytes();
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/hardware_buffer.h>
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameFanout.h"
+#include "FramePyramid.h"
+#include "TensorConverter.h"
+
+// Layout of the frames published by FrameTap.
+enum class FrameTapFormat : int {
+  RAW, // the camera's payload as is, at capture size
+  NV12,
+  RGBA, // 8 bits per channel, R first in memory
+  LUMA, // the Y plane of YUYV, UYVY and NV12 frames, 8 bits
+  TENSOR, // a model's input, see TensorConverter
+};
+
+// Publishes copies of captured frames, optionally downscaled and converted
+// through a FrameFanout shared with the other consumers, into a small pool of
+// buffers that another thread reads in place, such as
+// an ML model through direct ByteBuffers.
+//
+// Consumers poll with acquire(), which hands out the newest published buffer,
+// and give it back with release(). Nothing is ever waited on: the capture
+// thread only offers a frame when the tap is idle and a buffer can be
+// written, so the tap holds at most one of libuvc's pool buffers and never
+// delays the preview. Published buffers nobody acquired are overwritten by
+// newer frames.
+//
+// LUMA and RGBA buffers can hold a pyramid of the frame at further, smaller
+// sizes too, built by FramePyramid in the same pass that copies it.
+//
+// TENSOR buffers are written by TensorConverter straight from YUYV, UYVY and
+// NV12 frames, and from the fanout's NV12 decode of MJPEG ones.
+//
+// Buffers can be AHardwareBuffer BLOBs instead of plain memory, for GPU
+// delegates to import tensors without a copy. Each is locked for writing
+// only while a frame is converted into it, so consumers read it between
+// acquire() and release() like any other buffer.
+class FrameTap final {
+ public:
+  static constexpr size_t kMaxLevels = FramePyramid::kMaxLevels;
+
+  struct Size {
+    int32_t width{};
+    int32_t height{};
+  };
+
+  struct Config {
+    FrameTapFormat format{FrameTapFormat::RGBA};
+    // Zero keeps the capture size. RAW frames are never scaled.
+    int32_t width{};
+    int32_t height{};
+    uint32_t bufferCount{3};
+    // Sizes of further levels, no larger than width x height, up to
+    // kMaxLevels - 1. LUMA and RGBA only.
+    std::vector<Size> levels{};
+    // TENSOR only, which ignores width and height.
+    TensorSpec tensor{};
+    bool hardwareBuffers{false};
+  };
+
+  // Describes the frame in an acquired buffer.
+  struct FrameInfo {
+    int64_t captureTimeNs{}; // CLOCK_MONOTONIC, end of the USB transfer
+    uint32_t sequence{};
+    int32_t width{};
+    int32_t height{};
+    int32_t stride{}; // bytes per row, of the Y plane for NV12 and a plane for NCHW
+    uint32_t size{}; // bytes used in the buffer
+    // The frame at width x height first, then the further levels.
+    uint32_t levelCount{1};
+    std::array<FramePyramid::Level, kMaxLevels> levels{};
+  };
+
+  explicit FrameTap(FrameFanout& fanout) : fanout_(fanout) {}
+  FrameTap(const FrameTap&) = delete;
+  FrameTap& operator=(const FrameTap&) = delete;
+  ~FrameTap();
+
+  // maxFrameSize bounds RAW payloads, typically dwMaxVideoFrameSize.
+  bool start(
+      const Config& config,
+      int32_t captureWidth,
+      int32_t captureHeight,
+      uvc_frame_format captureFormat,
+      uint32_t maxFrameSize);
+  // Releases any frame still held. Buffers must no longer be read afterwards.
+  void stop();
+
+  // Capture thread only. Takes a reference on frame when it is accepted.
+  void offer(uvc_frame_t* frame);
+
+  size_t bufferCount() const {
+    return slots_.size();
+  }
+  // Null for hardware buffers.
+  uint8_t* bufferData(size_t index) const {
+    return slots_[index].data.get();
+  }
+  // Null unless Config::hardwareBuffers.
+  AHardwareBuffer* hardwareBuffer(size_t index) const {
+    return slots_[index].hardwareBuffer.get();
+  }
+  size_t bufferCapacity() const {
+    return slotCapacity_;
+  }
+
+  // Returns the index of the newest published buffer, or -1 if there is none.
+  // It is not overwritten until release(index).
+  int32_t acquire(FrameInfo& info);
+  void release(int32_t index);
+
+ private:
+  enum SlotState : uint32_t {
+    FREE,
+    WRITING,
+    READY,
+    ACQUIRED,
+  };
+
+  struct Slot {
+    std::unique_ptr<uint8_t, decltype(&free)> data{nullptr, &free};
+    std::unique_ptr<AHardwareBuffer, decltype(&AHardwareBuffer_release)> hardwareBuffer{
+        nullptr, &AHardwareBuffer_release};
+    std::atomic<uint32_t> state{FREE};
+    // Order of publication, to find the newest and oldest ready buffers.
+    std::atomic<uint64_t> publishOrder{0};
+    FrameInfo info{};
+  };
+
+  static constexpr uint32_t kMaxBuffers = 8;
+  static constexpr size_t kBufferAlignment = 64;
+
+  FrameFanout& fanout_;
+  Config config_{};
+  std::vector<Slot> slots_{};
+  size_t slotCapacity_{};
+  // LUMA frames, and RGBA ones with further levels. Tap thread only after
+  // start().
+  FramePyramid pyramid_{};
+  // TENSOR frames. Tap thread only after start().
+  TensorConverter tensor_{};
+
+  std::thread tapThread_{};
+  std::atomic<bool> running_{false};
+  std::mutex pendingMutex_;
+  std::condition_variable pendingChange_;
+  // Frame handed over by the capture thread, null while the tap is idle.
+  std::atomic<uvc_frame_t*> pending_{nullptr};
+  // Set by offer() until the tap thread is done with the frame.
+  std::atomic<bool> busy_{false};
+  std::atomic<uint32_t> skipped_{0};
+
+  // Tap thread only.
+  uint64_t published_{};
+
+  bool hasWritableSlot() const;
+  int32_t claimSlot();
+  bool allocateSlots();
+  void tapLoop();
+  bool write(const uvc_frame_t* frame, Slot& slot);
+  bool convert(const uvc_frame_t* frame, uint8_t* dst, FrameInfo& info);
+  bool convertTensor(const uvc_frame_t* frame, uint8_t* dst, FrameInfo& info);
+  void setLevels(FrameInfo& info) const;
+};
@@ -0,0 +1,1189 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "GlPreviewRenderer.h"
+
+#include <GLES3/gl31.h>
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+#include "HardwareFrameBuffers.h"
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "GlPreviewRenderer", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "GlPreviewRenderer", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "GlPreviewRenderer", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "GlPreviewRenderer", __VA_ARGS__)
+
+static const char* kVertexShader = R"(#version 300 es
+in vec2 aPosition;
+in vec2 aTexCoord;
+out vec2 vTexCoord;
+void main() {
+  vTexCoord = aTexCoord;
+  gl_Position = vec4(aPosition, 0.0, 1.0);
+}
+)";
+
+// Declares vTexCoord and sourceCoord(), the source texture coordinate of the
+// fragment, false outside the source. With DEWARP defined it comes from the
+// DewarpMap in uRemap, whose 12.4 fixed point entries are source pixel
+// positions with pixel centers on integers.
+static const char* kSourceCoordFunction = R"(
+in highp vec2 vTexCoord;
+#ifdef DEWARP
+uniform highp usampler2D uRemap;
+bool sourceCoord(out highp vec2 coord) {
+  highp vec2 size = vec2(textureSize(uRemap, 0));
+  highp uvec2 source = texelFetch(uRemap, ivec2(vTexCoord * size), 0).rg;
+  coord = (vec2(source) / 16.0 + 0.5) / size;
+  return source.x != 65535u;
+}
+#else
+bool sourceCoord(out highp vec2 coord) {
+  coord = vTexCoord;
+  return true;
+}
+#endif
+)";
+
+// The driver converts the YUV external image to RGB while sampling. With
+// DECODED defined the texture is the MJPEG compute stage's RGB output.
+static const char* kExternalFragmentShader = R"(
+precision mediump float;
+#ifdef DECODED
+uniform sampler2D uTexture;
+#else
+uniform samplerExternalOES uTexture;
+#endif
+out vec4 fragColor;
+void main() {
+  highp vec2 coord;
+  if (!sourceCoord(coord)) {
+    fragColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+  fragColor = texture(uTexture, coord);
+}
+)";
+
+// Each RGBA texel holds Y0 U Y1 V for two horizontally adjacent pixels.
+// uLuma is the offset and scale of Y, uChroma the crR, cbG, crG and cbB
+// weights of the stream's Colorimetry.
+static const char* kYuyvFragmentShader = R"(
+precision highp float;
+uniform sampler2D uTexture;
+uniform vec2 uLuma;
+uniform vec4 uChroma;
+out vec4 fragColor;
+void main() {
+  vec2 coord;
+  if (!sourceCoord(coord)) {
+    fragColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+  ivec2 size = textureSize(uTexture, 0);
+  int x = int(coord.x * float(size.x * 2));
+  int y = int(coord.y * float(size.y));
+  vec4 yuyv = texelFetch(uTexture, ivec2(x / 2, y), 0);
+  float luma = uLuma.y * (((x & 1) == 0 ? yuyv.r : yuyv.b) - uLuma.x);
+  float u = yuyv.g - 0.5;
+  float v = yuyv.a - 0.5;
+  fragColor = vec4(
+      luma + uChroma.x * v, luma - uChroma.y * u - uChroma.z * v, luma + uChroma.w * u, 1.0);
+}
+)";
+
+// Bytes of a frame in its HardwareFrameBuffers slot, fetched from a GL_R8
+// texture buffer of the slot. uFrame is the width, height and row step in
+// bytes. YUYV rows hold Y0 U Y1 V for two pixels, with YUYV defined; NV12
+// rows of interleaved CbCr follow the Y plane. uLuma and uChroma are as for
+// YUYV textures.
+static const char* kSlotFragmentShader = R"(
+precision highp float;
+uniform highp samplerBuffer uTexture;
+uniform ivec3 uFrame;
+uniform vec2 uLuma;
+uniform vec4 uChroma;
+out vec4 fragColor;
+void main() {
+  vec2 coord;
+  if (!sourceCoord(coord)) {
+    fragColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+  int x = clamp(int(coord.x * float(uFrame.x)), 0, uFrame.x - 1);
+  int y = clamp(int(coord.y * float(uFrame.y)), 0, uFrame.y - 1);
+#ifdef YUYV
+  int pair = y * uFrame.z + (x & ~1) * 2;
+  float luma = texelFetch(uTexture, pair + (x & 1) * 2).r;
+  float u = texelFetch(uTexture, pair + 1).r - 0.5;
+  float v = texelFetch(uTexture, pair + 3).r - 0.5;
+#else
+  float luma = texelFetch(uTexture, y * uFrame.z + x).r;
+  int chroma = (uFrame.y + y / 2) * uFrame.z + (x & ~1);
+  float u = texelFetch(uTexture, chroma).r - 0.5;
+  float v = texelFetch(uTexture, chroma + 1).r - 0.5;
+#endif
+  luma = uLuma.y * (luma - uLuma.x);
+  fragColor = vec4(
+      luma + uChroma.x * v, luma - uChroma.y * u - uChroma.z * v, luma + uChroma.w * u, 1.0);
+}
+)";
+
+// Raw Bayer frames, demosaiced with the 5x5 kernels of Malvar, He and Cutler,
+// which correct bilinear interpolation with the gradient of the sample's
+// own color. Samples are fetched byte by byte, from the slot's texture
+// buffer with SLOT defined or from RGBA texels of four bytes otherwise; with
+// WIDE defined they are little endian 16 bit words, scaled by uScale to
+// 0-1. uFrame is as for slots, uRedSite the red sample of each 2x2 quad and
+// uGains the white balance applied to each sample before the kernels.
+static const char* kBayerFragmentShader = R"(
+precision highp float;
+#ifdef SLOT
+uniform highp samplerBuffer uTexture;
+#else
+uniform highp sampler2D uTexture;
+#endif
+uniform ivec3 uFrame;
+uniform ivec2 uRedSite;
+uniform vec3 uGains;
+uniform float uScale;
+out vec4 fragColor;
+float byteAt(int x, int y) {
+#ifdef SLOT
+  return texelFetch(uTexture, y * uFrame.z + x).r;
+#else
+  return texelFetch(uTexture, ivec2(x >> 2, y), 0)[x & 3];
+#endif
+}
+// Edges are mirrored, which keeps the color of every sample.
+float raw(int x, int y) {
+  x = x < 0 ? -x : (x >= uFrame.x ? 2 * (uFrame.x - 1) - x : x);
+  y = y < 0 ? -y : (y >= uFrame.y ? 2 * (uFrame.y - 1) - y : y);
+#ifdef WIDE
+  float value = (byteAt(x * 2, y) + byteAt(x * 2 + 1, y) * 256.0) * uScale;
+#else
+  float value = byteAt(x, y);
+#endif
+  bool redRow = (y & 1) == uRedSite.y;
+  bool redColumn = (x & 1) == uRedSite.x;
+  return value * (redRow != redColumn ? uGains.g : (redRow ? uGains.r : uGains.b));
+}
+void main() {
+  vec2 coord;
+  if (!sourceCoord(coord)) {
+    fragColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+  int x = clamp(int(coord.x * float(uFrame.x)), 0, uFrame.x - 1);
+  int y = clamp(int(coord.y * float(uFrame.y)), 0, uFrame.y - 1);
+  float c = raw(x, y);
+  float west = raw(x - 1, y) + raw(x + 1, y);
+  float north = raw(x, y - 1) + raw(x, y + 1);
+  float west2 = raw(x - 2, y) + raw(x + 2, y);
+  float north2 = raw(x, y - 2) + raw(x, y + 2);
+  float diagonal = raw(x - 1, y - 1) + raw(x + 1, y - 1) + raw(x - 1, y + 1) + raw(x + 1, y + 1);
+  bool redRow = (y & 1) == uRedSite.y;
+  bool redColumn = (x & 1) == uRedSite.x;
+  vec3 rgb;
+  if (redRow == redColumn) {
+    float green = (4.0 * c + 2.0 * (west + north) - (west2 + north2)) / 8.0;
+    float other = (6.0 * c + 2.0 * diagonal - 1.5 * (west2 + north2)) / 8.0;
+    rgb = redRow ? vec3(c, green, other) : vec3(other, green, c);
+  } else {
+    // The color of the row's other samples, then the column's.
+    float across = (5.0 * c + 4.0 * west - west2 - diagonal + 0.5 * north2) / 8.0;
+    float down = (5.0 * c + 4.0 * north - north2 - diagonal + 0.5 * west2) / 8.0;
+    rgb = redRow ? vec3(across, c, down) : vec3(down, c, across);
+  }
+  fragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);
+}
+)";
+
+// One MCU of a JpegEntropyDecoder frame per work group of 8x8 invocations.
+// Each invocation dequantizes a coefficient of every block, then transforms
+// rows and columns of them with the basis c(u) / 2 * cos((2x + 1)u pi / 16)
+// of T.81 A.3.3. Each then converts the pixels covered by its chroma sample,
+// uLumaBlocks of them, with JFIF's full range BT.601 matrix.
+static const char* kJpegComputeShader = R"(#version 310 es
+precision highp float;
+precision highp int;
+layout(local_size_x = 8, local_size_y = 8) in;
+// Two coefficients to a word, the first in the low half.
+layout(std430, binding = 0) readonly buffer Coefficients {
+  uint coefficients[];
+};
+// 64 entries for each component.
+layout(std430, binding = 1) readonly buffer Quant {
+  uint quant[];
+};
+layout(rgba8, binding = 0) writeonly uniform highp image2D uOutput;
+uniform ivec2 uSize;
+uniform ivec2 uLumaBlocks;
+uniform int uComponents;
+shared float basis[64];
+shared float samples[6 * 64];
+void main() {
+  ivec2 n = ivec2(gl_LocalInvocationID.xy);
+  int i = n.y * 8 + n.x;
+  basis[i] = (n.y == 0 ? 0.35355339 : 0.5) * cos(float((2 * n.x + 1) * n.y) * 0.19634954);
+  int lumaBlocks = uLumaBlocks.x * uLumaBlocks.y;
+  int blocks = lumaBlocks + uComponents - 1;
+  int mcu = int(gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x);
+  for (int b = 0; b < blocks; b++) {
+    int index = (mcu * blocks + b) * 64 + i;
+    int coefficient = bitfieldExtract(int(coefficients[index >> 1]), (index & 1) * 16, 16);
+    int component = max(b - lumaBlocks + 1, 0);
+    samples[b * 64 + i] = float(coefficient) * float(quant[component * 64 + i]);
+  }
+  barrier();
+  float transformed[6];
+  for (int b = 0; b < blocks; b++) {
+    float sum = 0.0;
+    for (int u = 0; u < 8; u++) {
+      sum += basis[u * 8 + n.x] * samples[b * 64 + n.y * 8 + u];
+    }
+    transformed[b] = sum;
+  }
+  barrier();
+  for (int b = 0; b < blocks; b++) {
+    samples[b * 64 + i] = transformed[b];
+  }
+  barrier();
+  for (int b = 0; b < blocks; b++) {
+    float sum = 0.0;
+    for (int v = 0; v < 8; v++) {
+      sum += basis[v * 8 + n.y] * samples[b * 64 + v * 8 + n.x];
+    }
+    transformed[b] = sum + 128.0;
+  }
+  barrier();
+  for (int b = 0; b < blocks; b++) {
+    samples[b * 64 + i] = transformed[b];
+  }
+  barrier();
+  float cb = uComponents == 3 ? samples[lumaBlocks * 64 + i] - 128.0 : 0.0;
+  float cr = uComponents == 3 ? samples[(lumaBlocks + 1) * 64 + i] - 128.0 : 0.0;
+  vec3 chroma = vec3(1.402 * cr, -0.344136 * cb - 0.714136 * cr, 1.772 * cb);
+  ivec2 origin = ivec2(gl_WorkGroupID.xy) * uLumaBlocks * 8;
+  for (int dy = 0; dy < uLumaBlocks.y; dy++) {
+    for (int dx = 0; dx < uLumaBlocks.x; dx++) {
+      ivec2 luma = n * uLumaBlocks + ivec2(dx, dy);
+      ivec2 pixel = origin + luma;
+      if (pixel.x >= uSize.x || pixel.y >= uSize.y) {
+        continue;
+      }
+      int block = (luma.y >> 3) * uLumaBlocks.x + (luma.x >> 3);
+      float y = samples[block * 64 + (luma.y & 7) * 8 + (luma.x & 7)];
+      imageStore(uOutput, pixel, vec4(clamp((y + chroma) / 255.0, 0.0, 1.0), 1.0));
+    }
+  }
+}
+)";
+
+// The TextOverlay label, premultiplied, drawn into a viewport of its size.
+static const char* kOverlayFragmentShader = R"(#version 300 es
+precision mediump float;
+in vec2 vTexCoord;
+uniform sampler2D uTexture;
+out vec4 fragColor;
+void main() {
+  fragColor = texture(uTexture, vTexCoord);
+}
+)";
+
+// Full screen triangle strip: x, y, u, v. Texture row 0 is the top of the image.
+static const GLfloat kQuadVertices[] = {
+    -1.0f, -1.0f, 0.0f, 1.0f, //
+    1.0f, -1.0f, 1.0f, 1.0f, //
+    -1.0f, 1.0f, 0.0f, 0.0f, //
+    1.0f, 1.0f, 1.0f, 0.0f, //
+};
+
+static GLuint compileShader(GLenum type, const char* source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (compiled != GL_TRUE) {
+    char log[512]{};
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    ULOGE("Shader compilation failed: %s", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+static GLuint linkComputeProgram(const char* source) {
+  GLuint shader = compileShader(GL_COMPUTE_SHADER, source);
+  if (shader == 0) {
+    return 0;
+  }
+  GLuint program = glCreateProgram();
+  glAttachShader(program, shader);
+  glLinkProgram(program);
+  glDeleteShader(shader);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE) {
+    char log[512]{};
+    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    ULOGE("Compute program link failed: %s", log);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+static GLuint linkProgram(const char* vertexSource, const char* fragmentSource) {
+  GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+  GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+  if (vertexShader == 0 || fragmentShader == 0) {
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return 0;
+  }
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertexShader);
+  glAttachShader(program, fragmentShader);
+  glLinkProgram(program);
+  glDeleteShader(vertexShader);
+  glDeleteShader(fragmentShader);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE) {
+    char log[512]{};
+    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    ULOGE("Program link failed: %s", log);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+bool GlPreviewRenderer::supportsFormat(uvc_frame_format format) {
+  return format == UVC_FRAME_FORMAT_NV12 || format == UVC_FRAME_FORMAT_YUYV ||
+      format == UVC_FRAME_FORMAT_MJPEG || demosaic::isBayer(format);
+}
+
+GlPreviewRenderer::~GlPreviewRenderer() {
+  destroy();
+}
+
+bool GlPreviewRenderer::init(
+    ANativeWindow* window,
+    int32_t width,
+    int32_t height,
+    uvc_frame_format format,
+    const Colorimetry& colorimetry,
+    const LensCalibration& lens) {
+  if (window == nullptr || !supportsFormat(format)) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  format_ = format;
+  colorimetry_ = colorimetry;
+  bayer_ = demosaic::bayerLayout(format);
+  if (bayer_.bits != 0 && sourceRowBytes() % 4 != 0) {
+    // Rows are copied into whole RGBA texels.
+    ULOGW("No GL preview for %d pixel rows of format %d", width, format);
+    return false;
+  }
+  // Left empty without correction. Looked up per window pixel, so a table
+  // at the frame size is enough.
+  dewarpMap_.build(lens, width, height, width, height);
+  textureTarget_ = format == UVC_FRAME_FORMAT_NV12 ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+
+  bool mjpeg = format == UVC_FRAME_FORMAT_MJPEG;
+  bool ready =
+      initEgl(window) && initProgram() && (mjpeg ? initJpegStage() : initSourceBuffers());
+  if (!ready) {
+    destroy();
+    return false;
+  }
+  if (!mjpeg) {
+    // MJPEG frames are entropy decoded from wherever they are.
+    initSlotProgram();
+  }
+  releaseCurrent();
+  ULOGI(
+      "GL preview ready for format %d %dx%d, %s frame slots",
+      format_,
+      width_,
+      height_,
+      slotProgram_.id != 0 ? "importing" : "copying");
+  return true;
+}
+
+bool GlPreviewRenderer::initEgl(ANativeWindow* window) {
+  display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display_ == EGL_NO_DISPLAY || !eglInitialize(display_, nullptr, nullptr)) {
+    ULOGE("eglInitialize failed 0x%x", eglGetError());
+    display_ = EGL_NO_DISPLAY;
+    return false;
+  }
+
+  EGLint configAttribs[] = {
+      EGL_RENDERABLE_TYPE,
+      EGL_OPENGL_ES3_BIT_KHR,
+      EGL_SURFACE_TYPE,
+      EGL_WINDOW_BIT,
+      EGL_RED_SIZE,
+      8,
+      EGL_GREEN_SIZE,
+      8,
+      EGL_BLUE_SIZE,
+      8,
+      // Lets the same context draw into a video encoder's input surface.
+      EGL_RECORDABLE_ANDROID,
+      EGL_TRUE,
+      EGL_NONE,
+  };
+  EGLint numConfigs = 0;
+  if (!eglChooseConfig(display_, configAttribs, &config_, 1, &numConfigs) || numConfigs < 1) {
+    ULOGW("No recordable EGL config, preview only");
+    configAttribs[std::size(configAttribs) - 3] = EGL_NONE;
+    if (!eglChooseConfig(display_, configAttribs, &config_, 1, &numConfigs) || numConfigs < 1) {
+      ULOGE("eglChooseConfig failed 0x%x", eglGetError());
+      return false;
+    }
+  }
+
+  const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
+  context_ = eglCreateContext(display_, config_, EGL_NO_CONTEXT, contextAttribs);
+  if (context_ == EGL_NO_CONTEXT) {
+    ULOGE("eglCreateContext failed 0x%x", eglGetError());
+    return false;
+  }
+
+  surface_ = eglCreateWindowSurface(display_, config_, window, nullptr);
+  if (surface_ == EGL_NO_SURFACE) {
+    ULOGE("eglCreateWindowSurface failed 0x%x", eglGetError());
+    return false;
+  }
+  return makeCurrent();
+}
+
+bool GlPreviewRenderer::initProgram() {
+  bool external = format_ == UVC_FRAME_FORMAT_NV12;
+  bool decoded = format_ == UVC_FRAME_FORMAT_MJPEG;
+  std::string fragmentSource = "#version 300 es\n";
+  if (external) {
+    fragmentSource += "#extension GL_OES_EGL_image_external_essl3 : require\n";
+  }
+  if (decoded) {
+    fragmentSource += "#define DECODED\n";
+  }
+  if (!dewarpMap_.empty()) {
+    fragmentSource += "#define DEWARP\n";
+  }
+  if (bayer_.bits > 8) {
+    fragmentSource += "#define WIDE\n";
+  }
+  fragmentSource += kSourceCoordFunction;
+  if (external || decoded) {
+    fragmentSource += kExternalFragmentShader;
+  } else {
+    fragmentSource += bayer_.bits != 0 ? kBayerFragmentShader : kYuyvFragmentShader;
+  }
+  if (!linkSourceProgram(fragmentSource, program_)) {
+    return false;
+  }
+
+  if (!dewarpMap_.empty()) {
+    // Integer textures are never filtered; the table is fetched texel by
+    // texel.
+    glGenTextures(1, &remapTexture_);
+    glBindTexture(GL_TEXTURE_2D, remapTexture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RG16UI,
+        dewarpMap_.width(),
+        dewarpMap_.height(),
+        0,
+        GL_RG_INTEGER,
+        GL_UNSIGNED_SHORT,
+        dewarpMap_.row(0));
+    // The GPU keeps its copy.
+    dewarpMap_.clear();
+  }
+
+  glGenBuffers(1, &vertexBuffer_);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer_);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(kQuadVertices), kQuadVertices, GL_STATIC_DRAW);
+  return glGetError() == GL_NO_ERROR;
+}
+
+bool GlPreviewRenderer::linkSourceProgram(const std::string& fragmentSource, Program& program) {
+  program.id = linkProgram(kVertexShader, fragmentSource.c_str());
+  if (program.id == 0) {
+    return false;
+  }
+  program.positionAttrib = glGetAttribLocation(program.id, "aPosition");
+  program.texCoordAttrib = glGetAttribLocation(program.id, "aTexCoord");
+  program.textureUniform = glGetUniformLocation(program.id, "uTexture");
+  glUseProgram(program.id);
+  // Absent from the external image shader.
+  GLint luma = glGetUniformLocation(program.id, "uLuma");
+  if (luma != -1) {
+    Colorimetry::Coefficients weights = colorimetry_.coefficients();
+    glUniform2f(luma, weights.yOffset, weights.yScale);
+    glUniform4f(
+        glGetUniformLocation(program.id, "uChroma"),
+        weights.crR,
+        weights.cbG,
+        weights.crG,
+        weights.cbB);
+  }
+  GLint remap = glGetUniformLocation(program.id, "uRemap");
+  if (remap != -1) {
+    glUniform1i(remap, 1);
+  }
+  program.gainsUniform = glGetUniformLocation(program.id, "uGains");
+  if (program.gainsUniform != -1) {
+    // Copied frames keep these; slots set uFrame per frame.
+    glUniform3i(glGetUniformLocation(program.id, "uFrame"), width_, height_, sourceRowBytes());
+    glUniform2i(glGetUniformLocation(program.id, "uRedSite"), bayer_.redX, bayer_.redY);
+    glUniform1f(glGetUniformLocation(program.id, "uScale"), 255.0f / ((1 << bayer_.bits) - 1));
+  }
+  return true;
+}
+
+void GlPreviewRenderer::initSlotProgram() {
+  const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+  if (extensions == nullptr || strstr(extensions, "GL_EXT_external_buffer") == nullptr ||
+      strstr(extensions, "GL_EXT_texture_buffer") == nullptr) {
+    return;
+  }
+  bufferStorageExternal_ = (PFNGLBUFFERSTORAGEEXTERNALEXTPROC)eglGetProcAddress(
+      "glBufferStorageExternalEXT");
+  texBuffer_ = (PFNGLTEXBUFFEREXTPROC)eglGetProcAddress("glTexBufferEXT");
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE_EXT, &maxTextureBufferBytes_);
+  if (bufferStorageExternal_ == nullptr || texBuffer_ == nullptr || maxTextureBufferBytes_ <= 0) {
+    return;
+  }
+  std::string fragmentSource = "#version 310 es\n#extension GL_EXT_texture_buffer : require\n";
+  // The DewarpMap is uploaded by now.
+  if (remapTexture_ != 0) {
+    fragmentSource += "#define DEWARP\n";
+  }
+  if (format_ == UVC_FRAME_FORMAT_YUYV) {
+    fragmentSource += "#define YUYV\n";
+  }
+  if (bayer_.bits > 8) {
+    fragmentSource += "#define WIDE\n";
+  }
+  fragmentSource += kSourceCoordFunction;
+  if (bayer_.bits != 0) {
+    fragmentSource += "#define SLOT\n";
+    fragmentSource += kBayerFragmentShader;
+  } else {
+    fragmentSource += kSlotFragmentShader;
+  }
+  if (!linkSourceProgram(fragmentSource, slotProgram_)) {
+    ULOGW("Frame slots cannot be sampled, copying frames");
+    slotProgram_ = Program{};
+    return;
+  }
+  frameUniform_ = glGetUniformLocation(slotProgram_.id, "uFrame");
+}
+
+bool GlPreviewRenderer::initSourceBuffers() {
+  AHardwareBuffer_Desc desc{};
+  if (format_ == UVC_FRAME_FORMAT_NV12) {
+    desc.width = width_;
+    desc.format = AHARDWAREBUFFER_FORMAT_Y8Cb8Cr8_420;
+  } else {
+    desc.width = sourceRowBytes() / 4;
+    desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+  }
+  desc.height = height_;
+  desc.layers = 1;
+  desc.usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_CPU_READ_NEVER |
+      AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+  if (!AHardwareBuffer_isSupported(&desc)) {
+    ULOGW("AHardwareBuffer format %u %ux%u not supported", desc.format, desc.width, desc.height);
+    return false;
+  }
+
+  const EGLint imageAttribs[] = {EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE};
+  for (SourceBuffer& source : sourceBuffers_) {
+    if (AHardwareBuffer_allocate(&desc, &source.buffer) != 0) {
+      ULOGE("AHardwareBuffer_allocate failed");
+      source.buffer = nullptr;
+      return false;
+    }
+    source.image = eglCreateImageKHR(
+        display_,
+        EGL_NO_CONTEXT,
+        EGL_NATIVE_BUFFER_ANDROID,
+        eglGetNativeClientBufferANDROID(source.buffer),
+        imageAttribs);
+    if (source.image == EGL_NO_IMAGE_KHR) {
+      ULOGE("eglCreateImageKHR failed 0x%x", eglGetError());
+      return false;
+    }
+    glGenTextures(1, &source.texture);
+    glBindTexture(textureTarget_, source.texture);
+    glTexParameteri(textureTarget_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(textureTarget_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(textureTarget_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(textureTarget_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glEGLImageTargetTexture2DOES(textureTarget_, (GLeglImageOES)source.image);
+  }
+  return glGetError() == GL_NO_ERROR;
+}
+
+bool GlPreviewRenderer::initJpegStage() {
+  GLint major = 0;
+  GLint minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major * 10 + minor < 31) {
+    ULOGW("GLES %d.%d has no compute shaders for MJPEG", major, minor);
+    return false;
+  }
+  jpeg_.program = linkComputeProgram(kJpegComputeShader);
+  if (jpeg_.program == 0) {
+    return false;
+  }
+  jpeg_.sizeUniform = glGetUniformLocation(jpeg_.program, "uSize");
+  jpeg_.lumaBlocksUniform = glGetUniformLocation(jpeg_.program, "uLumaBlocks");
+  jpeg_.componentsUniform = glGetUniformLocation(jpeg_.program, "uComponents");
+  glGenBuffers(1, &jpeg_.coefficientBuffer);
+  glGenBuffers(1, &jpeg_.quantBuffer);
+  // Immutable, as images must be.
+  glGenTextures(1, &jpeg_.output);
+  glBindTexture(GL_TEXTURE_2D, jpeg_.output);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width_, height_);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return glGetError() == GL_NO_ERROR;
+}
+
+bool GlPreviewRenderer::decodeJpeg(const uvc_frame_t* frame) {
+  JpegEntropyDecoder& decoder = jpeg_.decoder;
+  if (!decoder.decode((const uint8_t*)frame->data, frame->data_bytes, width_, height_)) {
+    ULOGD("Frame %u is not a baseline JPEG of %dx%d", frame->sequence, width_, height_);
+    return false;
+  }
+  TRACE_SCOPE("jpegCompute");
+  // Respecified every frame, so the GPU may still read the last frame's
+  // copy.
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, jpeg_.coefficientBuffer);
+  glBufferData(
+      GL_SHADER_STORAGE_BUFFER,
+      decoder.coefficientCount() * sizeof(int16_t),
+      decoder.coefficients(),
+      GL_STREAM_DRAW);
+  uint32_t quant[JpegEntropyDecoder::kMaxComponents * 64];
+  std::copy_n(decoder.quantTables(), decoder.componentCount() * 64, quant);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, jpeg_.quantBuffer);
+  glBufferData(
+      GL_SHADER_STORAGE_BUFFER,
+      decoder.componentCount() * 64 * sizeof(uint32_t),
+      quant,
+      GL_STREAM_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glUseProgram(jpeg_.program);
+  glUniform2i(jpeg_.sizeUniform, width_, height_);
+  glUniform2i(jpeg_.lumaBlocksUniform, decoder.lumaBlocksWide(), decoder.lumaBlocksHigh());
+  glUniform1i(jpeg_.componentsUniform, decoder.componentCount());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, jpeg_.coefficientBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, jpeg_.quantBuffer);
+  glBindImageTexture(0, jpeg_.output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  glDispatchCompute(decoder.mcusWide(), decoder.mcusHigh(), 1);
+  // The draws sample what the dispatch wrote.
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  return glGetError() == GL_NO_ERROR;
+}
+
+bool GlPreviewRenderer::makeCurrent() {
+  if (!eglMakeCurrent(display_, surface_, surface_, context_)) {
+    ULOGE("eglMakeCurrent failed 0x%x", eglGetError());
+    return false;
+  }
+  return true;
+}
+
+bool GlPreviewRenderer::setWindow(ANativeWindow* window) {
+  bool current = context_ != EGL_NO_CONTEXT && eglGetCurrentContext() == context_;
+  if (current) {
+    // Surfaceless, so the old surface can go before the new one is made.
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_);
+  }
+  if (surface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(display_, surface_);
+    surface_ = EGL_NO_SURFACE;
+  }
+  bool created = true;
+  if (window != nullptr) {
+    surface_ = eglCreateWindowSurface(display_, config_, window, nullptr);
+    if (surface_ == EGL_NO_SURFACE) {
+      ULOGE("eglCreateWindowSurface failed 0x%x", eglGetError());
+      created = false;
+    }
+  }
+  return (!current || makeCurrent()) && created;
+}
+
+void GlPreviewRenderer::releaseCurrent() {
+  if (display_ != EGL_NO_DISPLAY) {
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+}
+
+bool GlPreviewRenderer::copyFrameToBuffer(const uvc_frame_t* frame, AHardwareBuffer* buffer)
+    const {
+  const uint8_t* src = (const uint8_t*)frame->data;
+  if (format_ != UVC_FRAME_FORMAT_NV12) {
+    AHardwareBuffer_Desc desc;
+    AHardwareBuffer_describe(buffer, &desc);
+    void* bits = nullptr;
+    if (AHardwareBuffer_lock(buffer, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, nullptr, &bits) !=
+        0) {
+      ULOGE("AHardwareBuffer_lock failed");
+      return false;
+    }
+    uint8_t* dst = (uint8_t*)bits;
+    size_t rowBytes = sourceRowBytes();
+    for (int32_t row = 0; row < height_; row++) {
+      memcpy(dst + row * desc.stride * 4, src + row * frame->step, rowBytes);
+    }
+    return AHardwareBuffer_unlock(buffer, nullptr) == 0;
+  }
+
+  AHardwareBuffer_Planes planes;
+  if (AHardwareBuffer_lockPlanes(
+          buffer, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, nullptr, &planes) != 0 ||
+      planes.planeCount < 3) {
+    ULOGE("AHardwareBuffer_lockPlanes failed");
+    return false;
+  }
+  const AHardwareBuffer_Plane& yPlane = planes.planes[0];
+  const AHardwareBuffer_Plane& cbPlane = planes.planes[1];
+  const AHardwareBuffer_Plane& crPlane = planes.planes[2];
+  for (int32_t row = 0; row < height_; row++) {
+    memcpy((uint8_t*)yPlane.data + row * yPlane.rowStride, src + row * frame->step, width_);
+  }
+
+  // NV12 chroma is interleaved CbCr. Most gralloc YUV buffers use the same
+  // layout, in which case whole rows can be copied.
+  const uint8_t* srcUv = src + frame->step * height_;
+  bool isNv12Layout = cbPlane.pixelStride == 2 && crPlane.pixelStride == 2 &&
+      (uint8_t*)crPlane.data == (uint8_t*)cbPlane.data + 1;
+  for (int32_t row = 0; row < height_ / 2; row++) {
+    const uint8_t* srcRow = srcUv + row * frame->step;
+    uint8_t* cbRow = (uint8_t*)cbPlane.data + row * cbPlane.rowStride;
+    if (isNv12Layout) {
+      memcpy(cbRow, srcRow, width_);
+      continue;
+    }
+    uint8_t* crRow = (uint8_t*)crPlane.data + row * crPlane.rowStride;
+    for (int32_t col = 0; col < width_ / 2; col++) {
+      cbRow[col * cbPlane.pixelStride] = srcRow[col * 2];
+      crRow[col * crPlane.pixelStride] = srcRow[col * 2 + 1];
+    }
+  }
+  return AHardwareBuffer_unlock(buffer, nullptr) == 0;
+}
+
+GLuint GlPreviewRenderer::slotTexture(const uvc_frame_t* frame) {
+  HardwareFrameBuffers::Slot found;
+  if (slotProgram_.id == 0 || !HardwareFrameBuffers::find(frame->data, found)) {
+    return 0;
+  }
+  size_t rows = format_ == UVC_FRAME_FORMAT_NV12 ? height_ + height_ / 2 : height_;
+  if (frame->step * rows > found.bytes || found.bytes > (size_t)maxTextureBufferBytes_) {
+    return 0;
+  }
+  drawCount_++;
+  ImportedSlot* oldest = &importedSlots_[0];
+  for (ImportedSlot& slot : importedSlots_) {
+    if (slot.id == found.id) {
+      slot.drawnAt = drawCount_;
+      return slot.texture;
+    }
+    if (slot.drawnAt < oldest->drawnAt) {
+      oldest = &slot;
+    }
+  }
+  // The least recently drawn import is no longer read by the GPU: the frames
+  // it held were released behind fences or it belongs to a freed slot.
+  releaseImportedSlot(*oldest);
+  ImportedSlot& slot = *oldest;
+  glGenBuffers(1, &slot.dataBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER_EXT, slot.dataBuffer);
+  bufferStorageExternal_(
+      GL_TEXTURE_BUFFER_EXT,
+      0,
+      (GLsizeiptr)found.bytes,
+      (GLeglClientBufferEXT)eglGetNativeClientBufferANDROID(found.buffer),
+      0);
+  glGenTextures(1, &slot.texture);
+  glBindTexture(GL_TEXTURE_BUFFER_EXT, slot.texture);
+  texBuffer_(GL_TEXTURE_BUFFER_EXT, GL_R8, slot.dataBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER_EXT, 0);
+  if (glGetError() != GL_NO_ERROR) {
+    ULOGW("Frame slot import failed, copying frames");
+    releaseImportedSlot(slot);
+    glDeleteProgram(slotProgram_.id);
+    slotProgram_ = Program{};
+    return 0;
+  }
+  AHardwareBuffer_acquire(found.buffer);
+  slot.id = found.id;
+  slot.buffer = found.buffer;
+  slot.drawnAt = drawCount_;
+  return slot.texture;
+}
+
+void GlPreviewRenderer::releaseImportedSlot(ImportedSlot& slot) {
+  if (slot.texture != 0) {
+    glDeleteTextures(1, &slot.texture);
+  }
+  if (slot.dataBuffer != 0) {
+    glDeleteBuffers(1, &slot.dataBuffer);
+  }
+  if (slot.buffer != nullptr) {
+    AHardwareBuffer_release(slot.buffer);
+  }
+  slot = ImportedSlot{};
+}
+
+void GlPreviewRenderer::holdFrame(uvc_frame_t* frame) {
+  HeldFrame& held = heldFrames_[nextHeldFrame_];
+  nextHeldFrame_ = (nextHeldFrame_ + 1) % kHeldFrameCount;
+  if (held.fence != EGL_NO_SYNC_KHR) {
+    // Usually signaled long ago, kHeldFrameCount frames back.
+    eglClientWaitSyncKHR(
+        display_, held.fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+    eglDestroySyncKHR(display_, held.fence);
+    held.fence = EGL_NO_SYNC_KHR;
+  }
+  if (held.frame != nullptr) {
+    uvc_release_frame(held.frame);
+  }
+  uvc_retain_frame(frame);
+  held.frame = frame;
+  held.fence = eglCreateSyncKHR(display_, EGL_SYNC_FENCE_KHR, nullptr);
+  if (held.fence == EGL_NO_SYNC_KHR) {
+    // Without a fence the slot cannot be given back early.
+    glFinish();
+  }
+}
+
+void GlPreviewRenderer::releaseHeldFrames() {
+  for (HeldFrame& held : heldFrames_) {
+    if (held.fence != EGL_NO_SYNC_KHR) {
+      eglClientWaitSyncKHR(
+          display_, held.fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+      eglDestroySyncKHR(display_, held.fence);
+    }
+    if (held.frame != nullptr) {
+      uvc_release_frame(held.frame);
+    }
+    held = HeldFrame{};
+  }
+}
+
+bool GlPreviewRenderer::renderFrame(uvc_frame_t* frame) {
+  if (frame->width != (uint32_t)width_ || frame->height != (uint32_t)height_) {
+    ULOGE(
+        "Frame %dx%d does not match GL preview %dx%d",
+        frame->width,
+        frame->height,
+        width_,
+        height_);
+    return false;
+  }
+  if (overlay_ != nullptr && overlay_->revision() != overlayRevision_) {
+    uploadOverlay();
+  }
+  GLuint texture = slotTexture(frame);
+  bool fromSlot = texture != 0;
+  const Program& program = fromSlot ? slotProgram_ : program_;
+  GLenum target = fromSlot ? GL_TEXTURE_BUFFER_EXT : textureTarget_;
+  if (program.gainsUniform != -1) {
+    glUseProgram(program.id);
+    glUniform3f(program.gainsUniform, whiteBalance_.red, whiteBalance_.green, whiteBalance_.blue);
+  }
+  if (fromSlot) {
+    glUseProgram(slotProgram_.id);
+    glUniform3i(frameUniform_, width_, height_, (GLint)frame->step);
+  } else if (format_ == UVC_FRAME_FORMAT_MJPEG) {
+    if (!decodeJpeg(frame)) {
+      return false;
+    }
+    texture = jpeg_.output;
+  } else {
+    SourceBuffer& source = sourceBuffers_[nextSourceBuffer_];
+    nextSourceBuffer_ = (nextSourceBuffer_ + 1) % kSourceBufferCount;
+    if (!copyFrameToBuffer(frame, source.buffer)) {
+      return false;
+    }
+    texture = source.texture;
+  }
+
+  bool swapped = true;
+  if (surface_ != EGL_NO_SURFACE) {
+    draw(surface_, program, target, texture);
+    if (!eglSwapBuffers(display_, surface_)) {
+      ULOGE("eglSwapBuffers failed 0x%x", eglGetError());
+      swapped = false;
+    }
+  }
+  if (swapped && recordingSurface_ != EGL_NO_SURFACE) {
+    renderToRecording(frame, program, target, texture);
+  }
+  if (fromSlot) {
+    // Drawn or not, the commands may still read the slot.
+    holdFrame(frame);
+  }
+  return swapped;
+}
+
+void GlPreviewRenderer::setRecordingWindow(ANativeWindow* window) {
+  if (window == recordingWindow_) {
+    return;
+  }
+  if (recordingSurface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(display_, recordingSurface_);
+    recordingSurface_ = EGL_NO_SURFACE;
+  }
+  if (recordingWindow_ != nullptr) {
+    ANativeWindow_release(recordingWindow_);
+  }
+  recordingWindow_ = window;
+  if (window == nullptr) {
+    return;
+  }
+  ANativeWindow_acquire(window);
+  recordingSurface_ = eglCreateWindowSurface(display_, config_, window, nullptr);
+  if (recordingSurface_ == EGL_NO_SURFACE) {
+    ULOGE("eglCreateWindowSurface for recording failed 0x%x", eglGetError());
+  }
+}
+
+void GlPreviewRenderer::renderToRecording(
+    const uvc_frame_t* frame,
+    const Program& program,
+    GLenum target,
+    GLuint texture) {
+  if (!eglMakeCurrent(display_, recordingSurface_, recordingSurface_, context_)) {
+    ULOGE("eglMakeCurrent for recording failed 0x%x", eglGetError());
+    return;
+  }
+  EGLnsecsANDROID captureTimeNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+      frame->capture_time_finished.tv_nsec;
+  eglPresentationTimeANDROID(display_, recordingSurface_, captureTimeNs);
+  draw(recordingSurface_, program, target, texture);
+  if (!eglSwapBuffers(display_, recordingSurface_)) {
+    ULOGE("eglSwapBuffers for recording failed 0x%x", eglGetError());
+  }
+  makeCurrent();
+}
+
+void GlPreviewRenderer::draw(
+    EGLSurface surface,
+    const Program& program,
+    GLenum target,
+    GLuint texture) {
+  EGLint surfaceWidth = 0;
+  EGLint surfaceHeight = 0;
+  eglQuerySurface(display_, surface, EGL_WIDTH, &surfaceWidth);
+  eglQuerySurface(display_, surface, EGL_HEIGHT, &surfaceHeight);
+  glViewport(0, 0, surfaceWidth, surfaceHeight);
+
+  glUseProgram(program.id);
+  if (remapTexture_ != 0) {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, remapTexture_);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(target, texture);
+  glUniform1i(program.textureUniform, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer_);
+  glEnableVertexAttribArray(program.positionAttrib);
+  glVertexAttribPointer(
+      program.positionAttrib, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), nullptr);
+  glEnableVertexAttribArray(program.texCoordAttrib);
+  glVertexAttribPointer(
+      program.texCoordAttrib,
+      2,
+      GL_FLOAT,
+      GL_FALSE,
+      4 * sizeof(GLfloat),
+      (const void*)(2 * sizeof(GLfloat)));
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  if (overlay_ != nullptr && overlayTexture_ != 0 && overlay_->width() > 0) {
+    drawOverlay(surfaceWidth, surfaceHeight);
+  }
+}
+
+void GlPreviewRenderer::setWhiteBalance(const WhiteBalance& whiteBalance) {
+  whiteBalance_ = whiteBalance;
+}
+
+void GlPreviewRenderer::setOverlay(const TextOverlay* overlay) {
+  overlay_ = overlay;
+  // Uploaded by the next renderFrame().
+  overlayRevision_ = overlay != nullptr ? overlay->revision() - 1 : 0;
+}
+
+void GlPreviewRenderer::uploadOverlay() {
+  overlayRevision_ = overlay_->revision();
+  if (overlayProgram_ == 0) {
+    overlayProgram_ = linkProgram(kVertexShader, kOverlayFragmentShader);
+    if (overlayProgram_ == 0) {
+      overlay_ = nullptr;
+      return;
+    }
+    glUseProgram(overlayProgram_);
+    glUniform1i(glGetUniformLocation(overlayProgram_, "uTexture"), 0);
+    overlayPositionAttrib_ = glGetAttribLocation(overlayProgram_, "aPosition");
+    overlayTexCoordAttrib_ = glGetAttribLocation(overlayProgram_, "aTexCoord");
+  }
+  if (overlayTexture_ == 0) {
+    glGenTextures(1, &overlayTexture_);
+    glBindTexture(GL_TEXTURE_2D, overlayTexture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  if (overlay_->width() == 0) {
+    return;
+  }
+  // Only the label's texels go up, when its text changes.
+  glBindTexture(GL_TEXTURE_2D, overlayTexture_);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexImage2D(
+      GL_TEXTURE_2D,
+      0,
+      GL_RGBA8,
+      overlay_->width(),
+      overlay_->height(),
+      0,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      overlay_->pixels());
+}
+
+void GlPreviewRenderer::drawOverlay(EGLint surfaceWidth, EGLint surfaceHeight) {
+  int32_t x = 0;
+  int32_t y = 0;
+  overlay_->place(surfaceWidth, surfaceHeight, x, y);
+  // The viewport's origin is the bottom left corner.
+  glViewport(x, surfaceHeight - y - overlay_->height(), overlay_->width(), overlay_->height());
+  glUseProgram(overlayProgram_);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, overlayTexture_);
+  glEnableVertexAttribArray(overlayPositionAttrib_);
+  glVertexAttribPointer(
+      overlayPositionAttrib_, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), nullptr);
+  glEnableVertexAttribArray(overlayTexCoordAttrib_);
+  glVertexAttribPointer(
+      overlayTexCoordAttrib_,
+      2,
+      GL_FLOAT,
+      GL_FALSE,
+      4 * sizeof(GLfloat),
+      (const void*)(2 * sizeof(GLfloat)));
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glDisable(GL_BLEND);
+}
+
+void GlPreviewRenderer::destroy() {
+  if (display_ == EGL_NO_DISPLAY) {
+    return;
+  }
+  bool isCurrent = context_ != EGL_NO_CONTEXT && makeCurrent();
+  releaseHeldFrames();
+  for (ImportedSlot& slot : importedSlots_) {
+    if (!isCurrent) {
+      // Gone with the context.
+      slot.texture = 0;
+      slot.dataBuffer = 0;
+    }
+    releaseImportedSlot(slot);
+  }
+  for (SourceBuffer& source : sourceBuffers_) {
+    if (isCurrent && source.texture != 0) {
+      glDeleteTextures(1, &source.texture);
+    }
+    if (source.image != EGL_NO_IMAGE_KHR) {
+      eglDestroyImageKHR(display_, source.image);
+    }
+    if (source.buffer != nullptr) {
+      AHardwareBuffer_release(source.buffer);
+    }
+    source = SourceBuffer{};
+  }
+  if (isCurrent) {
+    glDeleteBuffers(1, &vertexBuffer_);
+    glDeleteTextures(1, &remapTexture_);
+    glDeleteTextures(1, &overlayTexture_);
+    glDeleteProgram(program_.id);
+    glDeleteProgram(slotProgram_.id);
+    glDeleteProgram(overlayProgram_);
+    glDeleteProgram(jpeg_.program);
+    glDeleteBuffers(1, &jpeg_.coefficientBuffer);
+    glDeleteBuffers(1, &jpeg_.quantBuffer);
+    glDeleteTextures(1, &jpeg_.output);
+  }
+  vertexBuffer_ = 0;
+  remapTexture_ = 0;
+  overlayTexture_ = 0;
+  program_ = Program{};
+  slotProgram_ = Program{};
+  overlayProgram_ = 0;
+  jpeg_.program = 0;
+  jpeg_.coefficientBuffer = 0;
+  jpeg_.quantBuffer = 0;
+  jpeg_.output = 0;
+  releaseCurrent();
+  setRecordingWindow(nullptr);
+  if (surface_ != EGL_NO_SURFACE) {
+    eglDestroySurface(display_, surface_);
+    surface_ = EGL_NO_SURFACE;
+  }
+  if (context_ != EGL_NO_CONTEXT) {
+    eglDestroyContext(display_, context_);
+    context_ = EGL_NO_CONTEXT;
+  }
+  // The default display is shared with the UI toolkit, so it is not terminated.
+  display_ = EGL_NO_DISPLAY;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+#include <android/hardware_buffer.h>
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "Colorimetry.h"
+#include "Demosaic.h"
+#include "JpegEntropyDecoder.h"
+#include "LensCorrection.h"
+#include "TextOverlay.h"
+
+// Draws raw NV12, YUYV or Bayer camera frames to the preview window with
+// GLES.
+//
+// Each frame is copied plane by plane into an AHardwareBuffer that is bound
+// to a texture through an EGLImage. NV12 is sampled as a YUV external image so
+// the GPU does the color conversion; YUYV has no common YUV hardware buffer
+// format, so it is uploaded as RGBA texels holding two pixels each and
+// unpacked in the fragment shader. Bayer mosaics are uploaded the same way,
+// four bytes to a texel, and demosaiced in the fragment shader.
+//
+// Frames whose data is a HardwareFrameBuffers slot are not copied: the slot
+// is imported as a texture buffer of bytes, through GL_EXT_external_buffer
+// and GL_EXT_texture_buffer, and a fragment shader fetches and converts the
+// pixel's bytes with colorimetry, without filtering. Each such frame is
+// referenced until a fence shows the GPU is done reading it, and a few
+// imports are kept for the slots coming back.
+//
+// MJPEG frames are entropy decoded on the CPU by JpegEntropyDecoder and
+// their coefficients uploaded to a shader storage buffer. A GLES 3.1 compute
+// shader then dequantizes and inverse transforms each MCU's blocks, repeats
+// its chroma samples over the pixels they cover and converts to RGB for JFIF,
+// into an RGBA texture drawn like the others. Without a 3.1 context init()
+// fails for MJPEG.
+//
+// With lens correction each fragment looks up the source position it samples
+// in a DewarpMap texture.
+//
+// A recording window, such as an encoder's input surface, gets the same
+// texture drawn a second time, timestamped with the frame's capture time.
+//
+// A TextOverlay label is blended over both, from a texture uploaded only
+// when the label changes.
+//
+// init() may run on any thread and leaves no context current. makeCurrent(),
+// setRecordingWindow() and renderFrame() must then be called from the render
+// thread, which calls releaseCurrent() before the renderer is destroyed.
+class GlPreviewRenderer final {
+ public:
+  // Frames renderFrame() may keep referenced until drawn by the GPU, which
+  // the frame pool must have besides the ones in flight.
+  static constexpr size_t kHeldFrameCount = 3;
+
+  GlPreviewRenderer() = default;
+  GlPreviewRenderer(const GlPreviewRenderer&) = delete;
+  GlPreviewRenderer& operator=(const GlPreviewRenderer&) = delete;
+  ~GlPreviewRenderer();
+
+  // NV12, YUYV, Bayer formats and MJPEG, the last only where init() finds a
+  // GLES 3.1 context.
+  static bool supportsFormat(uvc_frame_format format);
+
+  // YUYV is converted with colorimetry; the driver picks the matrix of NV12
+  // external images, but not of NV12 drawn from its slot. Frames are
+  // undistorted when lens is enabled.
+  bool init(
+      ANativeWindow* window,
+      int32_t width,
+      int32_t height,
+      uvc_frame_format format,
+      const Colorimetry& colorimetry,
+      const LensCalibration& lens);
+  bool makeCurrent();
+  void releaseCurrent();
+  // Draws the following frames into window instead, or only into the
+  // recording window when null, keeping the context and its textures. On
+  // the render thread the context stays current, without a surface while
+  // there is no window.
+  bool setWindow(ANativeWindow* window);
+  // Draws every following frame into window too; null stops. The window is
+  // referenced until it is replaced.
+  void setRecordingWindow(ANativeWindow* window);
+  // Gains Bayer frames are white balanced with from the next frame on.
+  void setWhiteBalance(const WhiteBalance& whiteBalance);
+  // Burns overlay's label into every following frame, previewed and recorded
+  // alike; null stops. renderFrame() uploads the label when it changed, so
+  // the overlay is updated before it and outlives the renderer's use of it.
+  void setOverlay(const TextOverlay* overlay);
+  // Retains frame when it is drawn from its slot.
+  bool renderFrame(uvc_frame_t* frame);
+  // Gives back the frames drawn from their slots once the GPU is done with
+  // them, before the stream stops.
+  void releaseHeldFrames();
+
+ private:
+  struct SourceBuffer {
+    AHardwareBuffer* buffer{};
+    EGLImageKHR image{EGL_NO_IMAGE_KHR};
+    GLuint texture{};
+  };
+  static constexpr size_t kSourceBufferCount = 3;
+  // Slots kept imported, the least recently drawn going first; a pool has
+  // fewer.
+  static constexpr size_t kImportedSlotCount = 16;
+
+  struct Program {
+    GLuint id{};
+    GLint positionAttrib{-1};
+    GLint texCoordAttrib{-1};
+    GLint textureUniform{-1};
+    // Bayer programs only.
+    GLint gainsUniform{-1};
+  };
+  // A HardwareFrameBuffers slot imported as a GL_R8 texture buffer.
+  struct ImportedSlot {
+    uint64_t id{};
+    // Referenced, as the slot may be freed while imported.
+    AHardwareBuffer* buffer{};
+    GLuint dataBuffer{};
+    GLuint texture{};
+    uint64_t drawnAt{};
+  };
+  struct HeldFrame {
+    uvc_frame_t* frame{};
+    EGLSyncKHR fence{EGL_NO_SYNC_KHR};
+  };
+  // The MJPEG compute stage.
+  struct JpegStage {
+    JpegEntropyDecoder decoder{};
+    GLuint program{};
+    GLint sizeUniform{-1};
+    GLint lumaBlocksUniform{-1};
+    GLint componentsUniform{-1};
+    GLuint coefficientBuffer{};
+    GLuint quantBuffer{};
+    // RGBA8, the size of the frames; its texels are drawn like a source
+    // buffer's.
+    GLuint output{};
+  };
+
+  EGLDisplay display_{EGL_NO_DISPLAY};
+  EGLContext context_{EGL_NO_CONTEXT};
+  EGLConfig config_{};
+  EGLSurface surface_{EGL_NO_SURFACE};
+  ANativeWindow* recordingWindow_{};
+  EGLSurface recordingSurface_{EGL_NO_SURFACE};
+  Program program_{};
+  GLuint vertexBuffer_{};
+  // The DewarpMap, when correcting the lens; the CPU copy is freed once
+  // uploaded.
+  GLuint remapTexture_{};
+  DewarpMap dewarpMap_{};
+  const TextOverlay* overlay_{};
+  uint32_t overlayRevision_{};
+  GLuint overlayProgram_{};
+  GLuint overlayTexture_{};
+  GLint overlayPositionAttrib_{-1};
+  GLint overlayTexCoordAttrib_{-1};
+  GLenum textureTarget_{GL_TEXTURE_EXTERNAL_OES};
+  std::array<SourceBuffer, kSourceBufferCount> sourceBuffers_{};
+  size_t nextSourceBuffer_{};
+  // Zero when the context cannot import slots.
+  Program slotProgram_{};
+  GLint frameUniform_{-1};
+  GLint maxTextureBufferBytes_{};
+  PFNGLBUFFERSTORAGEEXTERNALEXTPROC bufferStorageExternal_{};
+  PFNGLTEXBUFFEREXTPROC texBuffer_{};
+  std::array<ImportedSlot, kImportedSlotCount> importedSlots_{};
+  uint64_t drawCount_{};
+  std::array<HeldFrame, kHeldFrameCount> heldFrames_{};
+  size_t nextHeldFrame_{};
+  int32_t width_{};
+  int32_t height_{};
+  uvc_frame_format format_{};
+  Colorimetry colorimetry_{};
+  // bits is 0 but for Bayer formats.
+  BayerLayout bayer_{};
+  WhiteBalance whiteBalance_{};
+  JpegStage jpeg_{};
+
+  // Bytes of a frame row copied into RGBA texels, for all but NV12.
+  int32_t sourceRowBytes() const {
+    return width_ * (bayer_.bits != 0 ? bayer_.bytesPerSample() : 2);
+  }
+  bool initEgl(ANativeWindow* window);
+  bool initProgram();
+  bool linkSourceProgram(const std::string& fragmentSource, Program& program);
+  // Leaves slotProgram_ zero without the extensions.
+  void initSlotProgram();
+  bool initSourceBuffers();
+  bool initJpegStage();
+  // Decodes an MJPEG frame into jpeg_.output; false for frames that are not
+  // baseline JPEGs of the stream's size.
+  bool decodeJpeg(const uvc_frame_t* frame);
+  bool copyFrameToBuffer(const uvc_frame_t* frame, AHardwareBuffer* buffer) const;
+  // The texture buffer of frame's slot, 0 to copy the frame instead.
+  GLuint slotTexture(const uvc_frame_t* frame);
+  void releaseImportedSlot(ImportedSlot& slot);
+  // Keeps frame until the commands drawing it so far have completed.
+  void holdFrame(uvc_frame_t* frame);
+  void draw(EGLSurface surface, const Program& program, GLenum target, GLuint texture);
+  void uploadOverlay();
+  void drawOverlay(EGLint surfaceWidth, EGLint surfaceHeight);
+  void renderToRecording(
+      const uvc_frame_t* frame,
+      const Program& program,
+      GLenum target,
+      GLuint texture);
+  void destroy();
+};
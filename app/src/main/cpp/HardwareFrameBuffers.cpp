@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HardwareFrameBuffers.h"
+
+#include <android/log.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "BufferAllocator.h"
+#include "FastPaths.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "HardwareFrameBuffers", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "HardwareFrameBuffers", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "HardwareFrameBuffers", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "HardwareFrameBuffers", __VA_ARGS__)
+
+namespace {
+
+constexpr uint64_t kCpuUsage =
+    AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN | AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN;
+
+std::atomic<bool> enabled_{false};
+std::mutex mutex_;
+// Guarded by mutex_, keyed by the locked address.
+std::unordered_map<const void*, HardwareFrameBuffers::Slot> slots_;
+uint64_t nextId_{1};
+
+AHardwareBuffer_Desc slotDesc(size_t bytes) {
+  AHardwareBuffer_Desc desc{};
+  desc.width = (uint32_t)alignedStride(bytes > 0 ? bytes : 1);
+  desc.height = 1;
+  desc.layers = 1;
+  desc.format = AHARDWAREBUFFER_FORMAT_BLOB;
+  desc.usage = kCpuUsage | AHARDWAREBUFFER_USAGE_GPU_DATA_BUFFER;
+  return desc;
+}
+
+void* allocateSlot(size_t bytes, size_t* usable) {
+  if (!HardwareFrameBuffers::enabled() || bytes > UINT32_MAX - kBufferAlignment) {
+    return nullptr;
+  }
+  AHardwareBuffer_Desc desc = slotDesc(bytes);
+  AHardwareBuffer* buffer = nullptr;
+  if (AHardwareBuffer_allocate(&desc, &buffer) != 0) {
+    ULOGW("AHardwareBuffer_allocate of %u bytes failed, slot on the heap", desc.width);
+    return nullptr;
+  }
+  // Locked once; libuvc writes the slot many frames over.
+  void* data = nullptr;
+  if (AHardwareBuffer_lock(buffer, kCpuUsage, -1, nullptr, &data) != 0 || data == nullptr) {
+    ULOGW("AHardwareBuffer_lock failed, slot on the heap");
+    AHardwareBuffer_release(buffer);
+    return nullptr;
+  }
+  if ((uintptr_t)data % kBufferAlignment != 0) {
+    ULOGW("Hardware buffer mapped at %p is not aligned, slot on the heap", data);
+    AHardwareBuffer_unlock(buffer, nullptr);
+    AHardwareBuffer_release(buffer);
+    return nullptr;
+  }
+  std::unique_lock lk(mutex_);
+  slots_[data] = {buffer, nextId_++, desc.width};
+  *usable = desc.width;
+  return data;
+}
+
+size_t releaseSlot(void* data) {
+  HardwareFrameBuffers::Slot slot;
+  {
+    std::unique_lock lk(mutex_);
+    auto it = slots_.find(data);
+    if (it == slots_.end()) {
+      return 0;
+    }
+    slot = it->second;
+    slots_.erase(it);
+  }
+  AHardwareBuffer_unlock(slot.buffer, nullptr);
+  // Renderers that imported the slot hold their own reference.
+  AHardwareBuffer_release(slot.buffer);
+  return slot.bytes;
+}
+
+const BufferAllocator::FrameSource kFrameSource{allocateSlot, releaseSlot};
+
+} // namespace
+
+bool HardwareFrameBuffers::setEnabled(bool enabled) {
+  if (enabled) {
+    // Checked at a typical 1080p YUYV frame size.
+    AHardwareBuffer_Desc desc = slotDesc(1920 * 1080 * 2);
+    if (!AHardwareBuffer_isSupported(&desc)) {
+      ULOGW("No CPU and GPU data hardware buffers, frame pool slots stay on the heap");
+      return false;
+    }
+    BufferAllocator::setFrameSource(&kFrameSource);
+  }
+  if (enabled_.exchange(enabled) != enabled) {
+    ULOGI("Frame pool slots in hardware buffers %s", enabled ? "enabled" : "disabled");
+  }
+  return true;
+}
+
+bool HardwareFrameBuffers::enabled() {
+  return enabled_.load(std::memory_order_relaxed) &&
+      FastPaths::get().allows(FAST_PATH_HARDWARE_FRAME_BUFFERS);
+}
+
+bool HardwareFrameBuffers::find(const void* data, Slot& slot) {
+  std::unique_lock lk(mutex_);
+  auto it = slots_.find(data);
+  if (it == slots_.end()) {
+    return false;
+  }
+  slot = it->second;
+  return true;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <android/hardware_buffer.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// libuvc's frame pool slots as AHardwareBuffers, so the GPU reads raw NV12
+// and YUYV frames where the USB payloads were reassembled instead of from a
+// copy.
+//
+// While enabled, new slots are BLOB hardware buffers the CPU writes and the
+// GPU reads as data buffers, locked for CPU access for their whole life;
+// copying the payloads out of the USB transfers is then the only copy a
+// frame takes. GlPreviewRenderer finds the slot of a frame here and imports
+// it as a texture buffer. The slots are not YUV hardware buffers: gralloc
+// picks their strides and plane offsets, while payloads are written back to
+// back.
+class HardwareFrameBuffers final {
+ public:
+  struct Slot {
+    AHardwareBuffer* buffer{};
+    // Unique for the process, unlike the addresses of slots, which come back.
+    uint64_t id{};
+    size_t bytes{};
+  };
+
+  // Slots allocated while disabled, or before, stay heap memory until the
+  // pool replaces them. False when the device has no such buffers.
+  static bool setEnabled(bool enabled);
+  // Also false while FastPaths does not allow FAST_PATH_HARDWARE_FRAME_BUFFERS.
+  static bool enabled();
+  // False when data is not the start of a slot.
+  static bool find(const void* data, Slot& slot);
+};
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "HotLog.h"
+
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+
+using namespace std::chrono;
+
+namespace {
+// Below the default, so draining never competes with the streaming threads.
+constexpr int kDrainNice = 10;
+constexpr size_t kLineBytes = 1024;
+} // namespace
+
+HotLog& HotLog::shared() {
+  static HotLog log;
+  return log;
+}
+
+HotLog::HotLog() {
+  for (size_t i = 0; i < kCapacity; i++) {
+    ring_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  thread_ = std::thread(&HotLog::drainLoop, this);
+}
+
+HotLog::~HotLog() {
+  {
+    std::lock_guard lk(stopMutex_);
+    stopping_ = true;
+  }
+  stopChange_.notify_all();
+  thread_.join();
+}
+
+int64_t HotLog::nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+bool HotLog::admit(Site& site) {
+  if (site.interval.count() <= 0) {
+    return true;
+  }
+  int64_t now = nowNs();
+  int64_t next = site.nextNs.load(std::memory_order_relaxed);
+  // Of threads racing for the same slot, one wins and the others count.
+  if (now < next ||
+      !site.nextNs.compare_exchange_strong(
+          next, now + site.interval.count(), std::memory_order_relaxed)) {
+    site.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+HotLog::Record* HotLog::claim() {
+  // A bounded ring whose slots carry their sequence: a slot is free for
+  // position pos when its sequence is pos, and readable at pos + 1.
+  uint64_t pos = enqueuePos_.load(std::memory_order_relaxed);
+  while (true) {
+    Record& record = ring_[pos % kCapacity];
+    uint64_t sequence = record.sequence.load(std::memory_order_acquire);
+    int64_t diff = (int64_t)(sequence - pos);
+    if (diff == 0) {
+      if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        return &record;
+      }
+    } else if (diff < 0) {
+      return nullptr;
+    } else {
+      pos = enqueuePos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void HotLog::flush() {
+  drain();
+}
+
+void HotLog::drainLoop() {
+  prctl(PR_SET_NAME, "usb_log");
+  setpriority(PRIO_PROCESS, gettid(), kDrainNice);
+  std::unique_lock lk(stopMutex_);
+  while (!stopping_) {
+    stopChange_.wait_for(lk, kDrainInterval);
+    lk.unlock();
+    drain();
+    lk.lock();
+  }
+}
+
+void HotLog::drain() {
+  std::lock_guard lk(drainMutex_);
+  while (true) {
+    Record& record = ring_[dequeuePos_ % kCapacity];
+    if (record.sequence.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+      break;
+    }
+    write(record);
+    record.sequence.store(dequeuePos_ + kCapacity, std::memory_order_release);
+    dequeuePos_++;
+  }
+  uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    __android_log_print(
+        ANDROID_LOG_WARN, "HotLog", "Dropped %u messages, the ring was full", dropped);
+  }
+}
+
+void HotLog::write(const Record& record) {
+  const Site& site = *record.site;
+  char line[kLineBytes];
+  size_t length = 0;
+  size_t arg = 0;
+  auto append = [&](const char* spec, auto value) {
+    if (length < sizeof(line)) {
+      int n = snprintf(line + length, sizeof(line) - length, spec, value);
+      length += n > 0 ? (size_t)n : 0;
+    }
+  };
+  for (const char* p = site.format; *p != '\0' && length < sizeof(line) - 1;) {
+    if (*p != '%') {
+      line[length++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      line[length++] = '%';
+      p += 2;
+      continue;
+    }
+    // Flags, width and precision are kept; the length modifier is replaced
+    // by the one of the stored value.
+    char spec[32];
+    size_t specLength = 0;
+    const char* q = p;
+    spec[specLength++] = *q++;
+    while (*q != '\0' && strchr("-+ #0123456789.", *q) != nullptr && specLength < 24) {
+      spec[specLength++] = *q++;
+    }
+    while (*q != '\0' && strchr("hlLjzt", *q) != nullptr) {
+      q++;
+    }
+    char conversion = *q;
+    if (conversion == '\0' || arg >= record.argCount) {
+      break;
+    }
+    p = q + 1;
+    Kind kind = record.kinds[arg];
+    uint64_t raw = record.args[arg++];
+    double d = 0;
+    if (kind == Kind::DOUBLE) {
+      std::memcpy(&d, &raw, sizeof(d));
+    }
+    if (strchr("diouxXc", conversion) != nullptr) {
+      if (conversion != 'c') {
+        spec[specLength++] = 'l';
+        spec[specLength++] = 'l';
+      }
+      spec[specLength++] = conversion;
+      spec[specLength] = '\0';
+      long long value = kind == Kind::DOUBLE ? (long long)d : (long long)raw;
+      if (conversion == 'c') {
+        append(spec, (int)value);
+      } else {
+        append(spec, value);
+      }
+    } else if (strchr("fFeEgGaA", conversion) != nullptr) {
+      spec[specLength++] = conversion;
+      spec[specLength] = '\0';
+      double value = kind == Kind::DOUBLE ? d
+          : kind == Kind::INT               ? (double)(int64_t)raw
+                                            : (double)raw;
+      append(spec, value);
+    } else if (conversion == 's') {
+      spec[specLength++] = 's';
+      spec[specLength] = '\0';
+      append(spec, kind == Kind::STRING ? record.strings + raw : "?");
+    } else if (conversion == 'p') {
+      spec[specLength++] = 'p';
+      spec[specLength] = '\0';
+      append(spec, (void*)(uintptr_t)raw);
+    } else {
+      break;
+    }
+  }
+  length = std::min(length, sizeof(line) - 1);
+  line[length] = '\0';
+  if (record.suppressed > 0) {
+    __android_log_print(
+        site.priority, site.tag, "%s (%u more suppressed)", line, record.suppressed);
+  } else {
+    __android_log_write(site.priority, site.tag, line);
+  }
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// Logging for the capture, USB event and render threads, which must not
+// block in or pay for __android_log_print.
+//
+// HOT_LOG() copies its arguments unformatted into a fixed-size record of a
+// lock-free ring; a low priority thread formats the records and writes them
+// to logcat every kDrainInterval. A full ring drops the record and counts
+// it, so a hot thread never waits. Each call site has its own static Site,
+// which both identifies the format string and rate limits the site:
+// messages within its interval of the last one are counted and the count is
+// appended to the next one that is written.
+//
+// Arguments are integers, enums, floating point values, pointers or C
+// strings; strings are copied, up to kStringBytes per record. The format is
+// checked at compile time like printf's; '*' widths are not supported.
+class HotLog final {
+ public:
+  struct Site {
+    int priority;
+    const char* tag;
+    const char* format;
+    // Messages closer together than this are counted instead, 0 for none.
+    std::chrono::nanoseconds interval;
+    std::atomic<int64_t> nextNs{0};
+    std::atomic<uint32_t> suppressed{0};
+  };
+
+  static constexpr size_t kCapacity = 256;
+  static constexpr size_t kMaxArgs = 20;
+  static constexpr size_t kStringBytes = 256;
+  static constexpr std::chrono::milliseconds kDrainInterval{50};
+
+  static HotLog& shared();
+
+  HotLog(const HotLog&) = delete;
+  HotLog& operator=(const HotLog&) = delete;
+  ~HotLog();
+
+  template <typename... Args>
+  void log(Site& site, const Args&... args);
+
+  // Writes out what is queued, from any thread. For tests and crash paths.
+  void flush();
+
+  // Never called, it only lets the compiler check HOT_LOG's arguments.
+  static void checkFormat(const char*, ...) __attribute__((format(printf, 1, 2))) {}
+
+ private:
+  enum class Kind : uint8_t { INT, UINT, DOUBLE, POINTER, STRING };
+  struct Record {
+    std::atomic<uint64_t> sequence;
+    const Site* site;
+    uint32_t suppressed;
+    uint8_t argCount;
+    std::array<Kind, kMaxArgs> kinds;
+    // The value, or for STRING its offset in strings.
+    std::array<uint64_t, kMaxArgs> args;
+    char strings[kStringBytes];
+  };
+
+  std::array<Record, kCapacity> ring_;
+  std::atomic<uint64_t> enqueuePos_{0};
+  std::atomic<uint32_t> dropped_{0};
+
+  // The drain thread's, under drainMutex_.
+  std::mutex drainMutex_;
+  uint64_t dequeuePos_{0};
+
+  std::mutex stopMutex_;
+  std::condition_variable stopChange_;
+  bool stopping_{false};
+  std::thread thread_{};
+
+  HotLog();
+  static int64_t nowNs();
+  bool admit(Site& site);
+  Record* claim();
+  void drainLoop();
+  void drain();
+  void write(const Record& record);
+
+  template <typename T>
+  static void put(Record& record, size_t& stringBytes, const T& value);
+};
+
+template <typename... Args>
+void HotLog::log(Site& site, const Args&... args) {
+  static_assert(sizeof...(Args) <= kMaxArgs, "too many HOT_LOG arguments");
+  if (!admit(site)) {
+    return;
+  }
+  Record* record = claim();
+  if (record == nullptr) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  record->site = &site;
+  record->suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+  record->argCount = 0;
+  [[maybe_unused]] size_t stringBytes = 0;
+  (put(*record, stringBytes, args), ...);
+  record->sequence.store(
+      record->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template <typename T>
+void HotLog::put(Record& record, size_t& stringBytes, const T& value) {
+  size_t i = record.argCount++;
+  if constexpr (std::is_same_v<T, bool> || std::is_enum_v<T> ||
+                (std::is_integral_v<T> && std::is_signed_v<T>)) {
+    record.kinds[i] = Kind::INT;
+    record.args[i] = (uint64_t)(int64_t)value;
+  } else if constexpr (std::is_integral_v<T>) {
+    record.kinds[i] = Kind::UINT;
+    record.args[i] = (uint64_t)value;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    double d = value;
+    record.kinds[i] = Kind::DOUBLE;
+    std::memcpy(&record.args[i], &d, sizeof(d));
+  } else if constexpr (std::is_convertible_v<T, const char*>) {
+    const char* s = value != nullptr ? (const char*)value : "(null)";
+    // Strings past the space left come out truncated or empty.
+    size_t offset = std::min(stringBytes, kStringBytes - 1);
+    size_t length = std::min(strlen(s), kStringBytes - 1 - offset);
+    record.kinds[i] = Kind::STRING;
+    record.args[i] = offset;
+    std::memcpy(record.strings + offset, s, length);
+    record.strings[offset + length] = '\0';
+    stringBytes = offset + length + 1;
+  } else if constexpr (std::is_pointer_v<T>) {
+    record.kinds[i] = Kind::POINTER;
+    record.args[i] = (uint64_t)(uintptr_t)value;
+  } else {
+    static_assert(sizeof(T) == 0, "HOT_LOG takes scalars and C strings");
+  }
+}
+
+// Logs through HotLog::shared() at most once per interval from this call site.
+#define HOT_LOG_EVERY(priority, tag, interval, format, ...)                          \
+  do {                                                                                \
+    static HotLog::Site hotLogSite_{priority, tag, format, interval};                 \
+    if (false) {                                                                      \
+      HotLog::checkFormat(format, ##__VA_ARGS__);                                     \
+    }                                                                                 \
+    HotLog::shared().log(hotLogSite_, ##__VA_ARGS__);                                 \
+  } while (0)
+
+#define HOT_LOG(priority, tag, format, ...) \
+  HOT_LOG_EVERY(priority, tag, std::chrono::nanoseconds{0}, format, ##__VA_ARGS__)
@@ -0,0 +1,550 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "InstantReplay.h"
+
+#include <android/log.h>
+
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "BufferAllocator.h"
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "InstantReplay", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "InstantReplay", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "InstantReplay", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "InstantReplay", __VA_ARGS__)
+
+namespace {
+
+struct AccessUnitInfo {
+  bool keyframe{};
+  bool hasParameterSets{};
+};
+
+// Looks at the NAL units of an Annex B access unit up to its first slice,
+// appending the parameter sets, with start codes, to parameterSets.
+AccessUnitInfo scanAccessUnit(
+    const uint8_t* data,
+    size_t size,
+    bool hevc,
+    std::vector<uint8_t>& parameterSets) {
+  static constexpr uint8_t kStartCode[] = {0, 0, 0, 1};
+  AccessUnitInfo info;
+  const uint8_t* end = data + size;
+  const uint8_t* p = data;
+  while (end - p >= 4) {
+    if (p[0] != 0 || p[1] != 0 || p[2] != 1) {
+      p++;
+      continue;
+    }
+    const uint8_t* nal = p + 3;
+    bool parameterSet;
+    bool slice;
+    if (hevc) {
+      uint8_t type = (nal[0] >> 1) & 0x3F;
+      parameterSet = type >= 32 && type <= 34;
+      slice = type < 32;
+      // IRAP pictures: BLA, IDR and CRA.
+      info.keyframe = type >= 16 && type <= 21;
+    } else {
+      uint8_t type = nal[0] & 0x1F;
+      parameterSet = type == 7 || type == 8;
+      slice = type >= 1 && type <= 5;
+      info.keyframe = type == 5;
+    }
+    if (slice) {
+      return info;
+    }
+    p = nal;
+    if (parameterSet) {
+      while (end - p >= 3 && !(p[0] == 0 && p[1] == 0 && (p[2] == 1 || p[2] == 0))) {
+        p++;
+      }
+      const uint8_t* nalEnd = end - p >= 3 ? p : end;
+      parameterSets.insert(parameterSets.end(), kStartCode, kStartCode + sizeof(kStartCode));
+      parameterSets.insert(parameterSets.end(), nal, nalEnd);
+      info.hasParameterSets = true;
+    }
+  }
+  return info;
+}
+
+} // namespace
+
+InstantReplay::~InstantReplay() {
+  if (saveThread_.joinable()) {
+    saveThread_.join();
+  }
+  for (Slab& slab : slabs_) {
+    BufferAllocator::release(slab.data);
+  }
+}
+
+bool InstantReplay::start(const Config& config) {
+  if (maxSlabs_ != 0) {
+    return false;
+  }
+  if (config.format != UVC_FRAME_FORMAT_MJPEG && config.format != UVC_FRAME_FORMAT_H264 &&
+      config.format != UVC_FRAME_FORMAT_H265) {
+    ULOGE("Instant replay keeps MJPEG, H.264 or H.265 frames, not format %d", config.format);
+    return false;
+  }
+  // One slab is always being filled.
+  if (config.memoryBudget < 2 * kSlabBytes || config.window <= 0ms) {
+    ULOGE(
+        "Memory budget of %zu bytes or window of %lld ms too small",
+        config.memoryBudget,
+        (long long)config.window.count());
+    return false;
+  }
+  config_ = config;
+  maxSlabs_ = config.memoryBudget / kSlabBytes;
+  slabs_.reserve(maxSlabs_);
+  freeSlabs_.reserve(maxSlabs_);
+  ULOGI(
+      "Keeping %lld s of format %d %ux%u frames in up to %.1f MB",
+      (long long)duration_cast<seconds>(config.window).count(),
+      config.format,
+      config.width,
+      config.height,
+      maxSlabs_ * kSlabBytes / 1e6);
+  return true;
+}
+
+void InstantReplay::addFrame(const uvc_frame_t* frame) {
+  // The stream switched formats.
+  if (frame->frame_format != config_.format) {
+    return;
+  }
+  add((const uint8_t*)frame->data,
+      frame->data_bytes,
+      frame->capture_time_finished.tv_sec * 1'000'000'000LL + frame->capture_time_finished.tv_nsec,
+      frame->pts,
+      frame->sequence);
+}
+
+void InstantReplay::add(
+    const uint8_t* data,
+    size_t size,
+    int64_t captureTimeNs,
+    uint32_t pts,
+    uint32_t sequence) {
+  if (maxSlabs_ == 0 || data == nullptr || size == 0 || size > UINT32_MAX) {
+    return;
+  }
+  TRACE_SCOPE("instantReplayAdd");
+  AccessUnitInfo info{.keyframe = true, .hasParameterSets = true};
+  std::vector<uint8_t> parameterSets;
+  if (config_.format != UVC_FRAME_FORMAT_MJPEG) {
+    info = scanAccessUnit(data, size, config_.format == UVC_FRAME_FORMAT_H265, parameterSets);
+  }
+
+  std::lock_guard lk(mutex_);
+  evictExpired(captureTimeNs);
+  if (!reserve(size)) {
+    if (skipped_++ % 100 == 0) {
+      ULOGW("No room for a %zu byte frame, %llu skipped", size, (unsigned long long)skipped_);
+    }
+    return;
+  }
+  if (info.keyframe && info.hasParameterSets && config_.format != UVC_FRAME_FORMAT_MJPEG) {
+    // For keyframes further on that come without them.
+    codecConfig_.swap(parameterSets);
+  }
+  if (fillSlab_ == kNoSlab || fillOffset_ == kSlabBytes) {
+    uint32_t slab = takeSlab();
+    if (fillSlab_ != kNoSlab) {
+      unref(fillSlab_);
+    }
+    fillSlab_ = slab;
+    fillOffset_ = 0;
+    slabs_[slab].refs = 1;
+  }
+  Entry entry{
+      .record =
+          {
+              .size = (uint32_t)size,
+              .sequence = sequence,
+              .captureTimeNs = captureTimeNs,
+              .pts = pts,
+              .flags = 0,
+          },
+      .firstSlab = fillSlab_,
+      .offset = fillOffset_,
+      .keyframe = info.keyframe,
+      .hasParameterSets = info.hasParameterSets,
+  };
+  slabs_[fillSlab_].refs++;
+  size_t copied = 0;
+  while (true) {
+    size_t bytes = std::min(size - copied, kSlabBytes - fillOffset_);
+    memcpy(slabs_[fillSlab_].data + fillOffset_, data + copied, bytes);
+    copied += bytes;
+    fillOffset_ += bytes;
+    if (copied == size) {
+      break;
+    }
+    uint32_t next = takeSlab();
+    slabs_[fillSlab_].next = next;
+    unref(fillSlab_);
+    fillSlab_ = next;
+    fillOffset_ = 0;
+    // The fill cursor and this frame.
+    slabs_[next].refs = 2;
+  }
+  if (entry.keyframe) {
+    keyframes_.push_back(evicted_ + entries_.size());
+  }
+  entries_.push_back(entry);
+  maxFrameSize_ = std::max(maxFrameSize_, (uint32_t)size);
+  if (followNext_ != kNotFollowing) {
+    added_.notify_all();
+  }
+}
+
+void InstantReplay::setCodecConfig(const uint8_t* data, size_t size) {
+  std::lock_guard lk(mutex_);
+  codecConfig_.assign(data, data + size);
+}
+
+bool InstantReplay::reserve(size_t bytes) {
+  size_t room = fillSlab_ == kNoSlab ? 0 : kSlabBytes - fillOffset_;
+  size_t needed = bytes > room ? (bytes - room + kSlabBytes - 1) / kSlabBytes : 0;
+  while (freeSlabs_.size() < needed && slabs_.size() < maxSlabs_) {
+    void* data = BufferAllocator::allocate(kSlabBytes);
+    if (data == nullptr) {
+      ULOGW("Out of memory at %zu slabs", slabs_.size());
+      maxSlabs_ = slabs_.size();
+      break;
+    }
+    freeSlabs_.push_back(slabs_.size());
+    slabs_.push_back({.data = static_cast<uint8_t*>(data)});
+  }
+  while (freeSlabs_.size() < needed && !entries_.empty()) {
+    evictFront();
+  }
+  return freeSlabs_.size() >= needed;
+}
+
+uint32_t InstantReplay::takeSlab() {
+  uint32_t slab = freeSlabs_.back();
+  freeSlabs_.pop_back();
+  return slab;
+}
+
+void InstantReplay::unref(uint32_t slab) {
+  if (--slabs_[slab].refs == 0) {
+    slabs_[slab].next = kNoSlab;
+    freeSlabs_.push_back(slab);
+  }
+}
+
+void InstantReplay::retainEntry(const Entry& entry) {
+  uint32_t slab = entry.firstSlab;
+  size_t offset = entry.offset;
+  size_t remaining = entry.record.size;
+  while (true) {
+    slabs_[slab].refs++;
+    size_t bytes = std::min(remaining, kSlabBytes - offset);
+    remaining -= bytes;
+    if (remaining == 0) {
+      return;
+    }
+    slab = slabs_[slab].next;
+    offset = 0;
+  }
+}
+
+void InstantReplay::unrefEntry(const Entry& entry) {
+  uint32_t slab = entry.firstSlab;
+  size_t offset = entry.offset;
+  size_t remaining = entry.record.size;
+  while (true) {
+    uint32_t next = slabs_[slab].next;
+    unref(slab);
+    size_t bytes = std::min(remaining, kSlabBytes - offset);
+    remaining -= bytes;
+    if (remaining == 0) {
+      return;
+    }
+    slab = next;
+    offset = 0;
+  }
+}
+
+void InstantReplay::evictFront() {
+  unrefEntry(entries_.front());
+  entries_.pop_front();
+  if (!keyframes_.empty() && keyframes_.front() == evicted_) {
+    keyframes_.pop_front();
+  }
+  if (followNext_ != kNotFollowing && followNext_ <= evicted_) {
+    followNext_ = evicted_ + 1;
+    followLost_++;
+    followResync_ = true;
+  }
+  evicted_++;
+}
+
+void InstantReplay::evictExpired(int64_t nowNs) {
+  int64_t cutoff = nowNs - duration_cast<nanoseconds>(config_.window).count();
+  // The follower has yet to read the rest.
+  while (!entries_.empty() && (followNext_ == kNotFollowing || evicted_ < followNext_)) {
+    const Entry& front = entries_.front();
+    // Without the keyframe it follows, nothing saves it.
+    if (!front.keyframe) {
+      evictFront();
+      continue;
+    }
+    // The window starts at the last keyframe before the cutoff.
+    if (front.record.captureTimeNs >= cutoff || keyframes_.size() < 2 ||
+        entries_[keyframes_[1] - evicted_].record.captureTimeNs > cutoff) {
+      return;
+    }
+    evictFront();
+  }
+}
+
+void InstantReplay::copyPayload(const Entry& entry, uint8_t* out) const {
+  uint32_t slab = entry.firstSlab;
+  size_t offset = entry.offset;
+  size_t remaining = entry.record.size;
+  while (true) {
+    size_t bytes = std::min(remaining, kSlabBytes - offset);
+    memcpy(out, slabs_[slab].data + offset, bytes);
+    out += bytes;
+    remaining -= bytes;
+    if (remaining == 0) {
+      return;
+    }
+    slab = slabs_[slab].next;
+    offset = 0;
+  }
+}
+
+bool InstantReplay::follow(nanoseconds preRoll) {
+  std::lock_guard lk(mutex_);
+  if (maxSlabs_ == 0 || followNext_ != kNotFollowing) {
+    return false;
+  }
+  followNext_ = evicted_ + entries_.size();
+  followResync_ = true;
+  followLost_ = 0;
+  if (!keyframes_.empty()) {
+    int64_t since = entries_.back().record.captureTimeNs - preRoll.count();
+    followNext_ = keyframes_.front();
+    for (uint64_t keyframe : keyframes_) {
+      if (entries_[keyframe - evicted_].record.captureTimeNs > since) {
+        break;
+      }
+      followNext_ = keyframe;
+    }
+  }
+  uint64_t frames = evicted_ + entries_.size() - followNext_;
+  ULOGI(
+      "Following from %.1f s back, %llu frames",
+      frames > 0
+          ? (entries_.back().record.captureTimeNs -
+             entries_[followNext_ - evicted_].record.captureTimeNs) / 1e9
+          : 0.0,
+      (unsigned long long)frames);
+  return true;
+}
+
+void InstantReplay::unfollow() {
+  std::lock_guard lk(mutex_);
+  followNext_ = kNotFollowing;
+  added_.notify_all();
+}
+
+bool InstantReplay::readFollowed(FollowedFrame& frame, milliseconds timeout) {
+  std::unique_lock lk(mutex_);
+  Entry entry;
+  while (true) {
+    if (!added_.wait_for(lk, timeout, [this] {
+          return followNext_ == kNotFollowing || followNext_ < evicted_ + entries_.size();
+        })) {
+      return false;
+    }
+    if (followNext_ == kNotFollowing) {
+      return false;
+    }
+    entry = entries_[followNext_ - evicted_];
+    followNext_++;
+    if (!followResync_ || entry.keyframe) {
+      break;
+    }
+    followLost_++;
+  }
+  size_t configBytes = 0;
+  if (followResync_) {
+    followResync_ = false;
+    if (!entry.hasParameterSets) {
+      configBytes = codecConfig_.size();
+    }
+  }
+  frame.record = entry.record;
+  frame.record.size += configBytes;
+  frame.keyframe = entry.keyframe;
+  frame.payload.resize(frame.record.size);
+  memcpy(frame.payload.data(), codecConfig_.data(), configBytes);
+  // Copied unlocked; the links of a listed frame's slabs do not change.
+  retainEntry(entry);
+  lk.unlock();
+  copyPayload(entry, frame.payload.data() + configBytes);
+  lk.lock();
+  unrefEntry(entry);
+  return true;
+}
+
+uint64_t InstantReplay::followLost() {
+  std::lock_guard lk(mutex_);
+  return followLost_;
+}
+
+std::vector<uint8_t> InstantReplay::codecConfig() {
+  std::lock_guard lk(mutex_);
+  return codecConfig_;
+}
+
+bool InstantReplay::save(int fd) {
+  if (saveThread_.joinable()) {
+    if (savedFrames_.load(std::memory_order_acquire) < 0) {
+      ULOGW("A save is still being written");
+      return false;
+    }
+    saveThread_.join();
+  }
+  std::vector<Entry> entries;
+  std::vector<uint8_t> codecConfig;
+  {
+    std::lock_guard lk(mutex_);
+    if (keyframes_.empty()) {
+      ULOGW("Nothing to save yet");
+      return false;
+    }
+    entries.reserve(entries_.size());
+    for (size_t i = keyframes_.front() - evicted_; i < entries_.size(); i++) {
+      retainEntry(entries_[i]);
+      entries.push_back(entries_[i]);
+    }
+    if (!entries.front().hasParameterSets) {
+      codecConfig = codecConfig_;
+    }
+  }
+  int saveFd = dup(fd);
+  if (saveFd < 0) {
+    ULOGE("dup of fd %d failed: %s", fd, strerror(errno));
+    std::lock_guard lk(mutex_);
+    for (const Entry& entry : entries) {
+      unrefEntry(entry);
+    }
+    return false;
+  }
+  savedFrames_.store(-1, std::memory_order_release);
+  saveThread_ = std::thread(
+      &InstantReplay::writeSave, this, saveFd, std::move(entries), std::move(codecConfig));
+  return true;
+}
+
+void InstantReplay::writeSave(
+    int fd,
+    std::vector<Entry> entries,
+    std::vector<uint8_t> codecConfig) {
+  prctl(PR_SET_NAME, "usb_video_replay");
+  TRACE_SCOPE("writeInstantReplay");
+  steady_clock::time_point startedAt = steady_clock::now();
+  uint32_t maxFrameSize = 0;
+  for (const Entry& entry : entries) {
+    maxFrameSize = std::max(maxFrameSize, entry.record.size);
+  }
+  FrameLogHeader header{
+      .version = kFrameLogVersion,
+      .headerSize = sizeof(FrameLogHeader),
+      .frameFormat = (uint32_t)config_.format,
+      .width = config_.width,
+      .height = config_.height,
+      .frameInterval = config_.frameInterval,
+      .clockFrequency = config_.clockFrequency,
+      .maxFrameSize = maxFrameSize + (uint32_t)codecConfig.size(),
+  };
+  memcpy(header.magic, kFrameLogMagic, sizeof(header.magic));
+  bool failed = write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header);
+
+  static const uint8_t kPad[kFrameLogAlignment] = {};
+  std::vector<iovec> parts;
+  uint64_t bytes = sizeof(header);
+  size_t written = 0;
+  size_t next = 0;
+  while (next < entries.size() && !failed) {
+    const Entry& entry = entries[next++];
+    FrameLogRecord record = entry.record;
+    parts.clear();
+    parts.push_back({&record, sizeof(record)});
+    if (written == 0 && !codecConfig.empty()) {
+      record.size += codecConfig.size();
+      parts.push_back({codecConfig.data(), codecConfig.size()});
+    }
+    // The links of a frame's slabs were set before it was listed for saving.
+    uint32_t slab = entry.firstSlab;
+    size_t offset = entry.offset;
+    size_t remaining = entry.record.size;
+    while (true) {
+      size_t partBytes = std::min(remaining, kSlabBytes - offset);
+      parts.push_back({slabs_[slab].data + offset, partBytes});
+      remaining -= partBytes;
+      if (remaining == 0) {
+        break;
+      }
+      slab = slabs_[slab].next;
+      offset = 0;
+    }
+    size_t span = frameLogRecordSpan(record.size);
+    parts.push_back({const_cast<uint8_t*>(kPad), span - sizeof(record) - record.size});
+    if (writev(fd, parts.data(), parts.size()) != (ssize_t)span) {
+      failed = true;
+    } else {
+      written++;
+      bytes += span;
+    }
+    std::lock_guard lk(mutex_);
+    unrefEntry(entry);
+  }
+  if (failed) {
+    ULOGE("Instant replay write failed after %zu frames: %s", written, strerror(errno));
+    std::lock_guard lk(mutex_);
+    for (size_t i = next; i < entries.size(); i++) {
+      unrefEntry(entries[i]);
+    }
+  }
+  close(fd);
+  int64_t span = entries.back().record.captureTimeNs - entries.front().record.captureTimeNs;
+  ULOGI(
+      "Saved %zu frames, %.1f s and %.1f MB, in %lld ms%s",
+      written,
+      span / 1e9,
+      bytes / 1e6,
+      (long long)duration_cast<milliseconds>(steady_clock::now() - startedAt).count(),
+      failed ? ", replay is incomplete" : "");
+  savedFrames_.store(failed ? 0 : (int64_t)written, std::memory_order_release);
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameLog.h"
+
+using namespace std::chrono;
+
+// Keeps the last stretch of the stream in memory, compressed, so an operator
+// can save it after the fact instead of recording to flash all the time.
+//
+// Frames are kept as they were encoded: the camera's MJPEG, H.264 or H.265
+// payloads, or StreamRecorder's encoder output for uncompressed cameras. Each
+// is copied into a chain of fixed-size slabs, packed back to back so small
+// inter frames share one. Slabs come from BufferAllocator, up to the memory
+// budget, and are reused from a free list once no frame or save holds them.
+// The oldest frames go when they fall out of the window or when a new frame
+// needs their memory; a window begins at a keyframe, so inter frames before
+// its start are kept until the next keyframe takes over.
+//
+// save() writes the window from its first keyframe as a frame log, which
+// FrameLogPlayer replays, on a thread of its own. The frames being saved hold
+// their slabs until they are written, and capture goes on meanwhile.
+//
+// A recording can also start in the past by following the ring, see
+// follow(): it reads the frames from a keyframe some time back, then the live
+// ones as they come. Frames it has not read yet stay past the window.
+class InstantReplay final {
+ public:
+  struct Config {
+    // UVC_FRAME_FORMAT_MJPEG, _H264 or _H265.
+    uvc_frame_format format{UVC_FRAME_FORMAT_MJPEG};
+    uint32_t width{};
+    uint32_t height{};
+    uint32_t frameInterval{}; // 100 ns units
+    uint32_t clockFrequency{}; // PTS clock in Hz, zero without PTS
+    milliseconds window{30s};
+    size_t memoryBudget{kDefaultMemoryBudget};
+  };
+
+  struct FollowedFrame {
+    FrameLogRecord record{};
+    bool keyframe{};
+    // The parameter sets come first when the keyframe starting a follow or
+    // a resync has none of its own.
+    std::vector<uint8_t> payload{};
+  };
+
+  static constexpr size_t kSlabBytes = 32 * 1024;
+  static constexpr size_t kDefaultMemoryBudget = 96 * 1024 * 1024;
+
+  InstantReplay() = default;
+  InstantReplay(const InstantReplay&) = delete;
+  InstantReplay& operator=(const InstantReplay&) = delete;
+  // Waits for a save in progress.
+  ~InstantReplay();
+
+  bool start(const Config& config);
+
+  // One thread at a time: the capture thread, or the recorder's drain thread.
+  // captureTimeNs is CLOCK_MONOTONIC.
+  void add(
+      const uint8_t* data,
+      size_t size,
+      int64_t captureTimeNs,
+      uint32_t pts,
+      uint32_t sequence);
+  // Frames of another format than the configured one are left out.
+  void addFrame(const uvc_frame_t* frame);
+  // Parameter sets an encoder sends ahead of its frames; they are written
+  // ahead of the first keyframe of a save that has none of its own.
+  void setCodecConfig(const uint8_t* data, size_t size);
+
+  // Writes the window to fd, which is duplicated, in the background. False
+  // when a save is still running or there is nothing to save yet.
+  bool save(int fd);
+  // Frames the last save wrote, -1 while one runs.
+  int64_t savedFrames() const {
+    return savedFrames_.load(std::memory_order_acquire);
+  }
+
+  // Follows the stream from the last keyframe at least preRoll old, or the
+  // oldest one kept. Frames from there on are kept until readFollowed()
+  // returns them, unless newer ones need their memory; the follower then
+  // loses frames up to the next keyframe. One follower at a time.
+  bool follow(nanoseconds preRoll);
+  void unfollow();
+  // Copies the next followed frame to frame, waiting up to timeout for one.
+  bool readFollowed(FollowedFrame& frame, milliseconds timeout);
+  // Frames the follower lost to newer ones.
+  uint64_t followLost();
+  // Parameter sets last seen, Annex B.
+  std::vector<uint8_t> codecConfig();
+
+  const Config& config() const {
+    return config_;
+  }
+
+ private:
+  static constexpr uint32_t kNoSlab = UINT32_MAX;
+  static constexpr uint64_t kNotFollowing = UINT64_MAX;
+
+  struct Slab {
+    uint8_t* data{};
+    uint32_t next{kNoSlab};
+    // Frames with bytes in it, saves holding those, and the fill cursor.
+    uint32_t refs{};
+  };
+
+  struct Entry {
+    FrameLogRecord record{};
+    uint32_t firstSlab{};
+    uint32_t offset{}; // in firstSlab
+    bool keyframe{};
+    bool hasParameterSets{};
+  };
+
+  Config config_{};
+  size_t maxSlabs_{};
+
+  std::mutex mutex_;
+  std::vector<Slab> slabs_{};
+  std::vector<uint32_t> freeSlabs_{};
+  std::deque<Entry> entries_{};
+  // Index in entries_ of each keyframe, offset by evicted_.
+  std::deque<uint64_t> keyframes_{};
+  uint64_t evicted_{};
+  uint32_t fillSlab_{kNoSlab};
+  uint32_t fillOffset_{};
+  uint32_t maxFrameSize_{};
+  std::vector<uint8_t> codecConfig_{};
+  uint64_t skipped_{};
+  // Index of the next frame for the follower, offset by evicted_.
+  uint64_t followNext_{kNotFollowing};
+  bool followResync_{};
+  uint64_t followLost_{};
+  std::condition_variable added_;
+
+  std::thread saveThread_{};
+  std::atomic<int64_t> savedFrames_{0};
+
+  bool reserve(size_t bytes);
+  uint32_t takeSlab();
+  void unref(uint32_t slab);
+  void unrefEntry(const Entry& entry);
+  void retainEntry(const Entry& entry);
+  void evictFront();
+  void evictExpired(int64_t nowNs);
+  void copyPayload(const Entry& entry, uint8_t* out) const;
+  void writeSave(int fd, std::vector<Entry> entries, std::vector<uint8_t> codecConfig);
+};
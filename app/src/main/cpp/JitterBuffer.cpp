@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "JitterBuffer.h"
+
+#include <algorithm>
+
+namespace {
+
+// Without a negotiated interval.
+constexpr int64_t kDefaultFrameIntervalNs = 1'000'000'000 / 30;
+// A cadence further behind the arrivals than this many intervals restarts.
+constexpr int64_t kCadenceGapIntervals = 4;
+// Weight of a new arrival interval in the cadence's.
+constexpr int64_t kCadenceSmoothing = 32;
+
+} // namespace
+
+void JitterBuffer::reset(int64_t frameIntervalNs) {
+  *this = JitterBuffer();
+  frameIntervalNs_ = frameIntervalNs > 0 ? frameIntervalNs : kDefaultFrameIntervalNs;
+  cadenceIntervalNs_ = frameIntervalNs_;
+}
+
+int64_t JitterBuffer::sourceTime(int64_t enqueueNs, int64_t deviceNs) {
+  bool deviceTimed = deviceNs != 0;
+  if (deviceTimed != deviceTimed_) {
+    // The two kinds of source time are offset from the arrivals differently.
+    deviceTimed_ = deviceTimed;
+    latenessCount_ = 0;
+    delaySet_ = false;
+    lastSourceNs_ = 0;
+  }
+  if (lastEnqueueNs_ != 0) {
+    int64_t arrivalIntervalNs =
+        std::clamp(enqueueNs - lastEnqueueNs_, frameIntervalNs_ / 2, frameIntervalNs_ * 2);
+    cadenceIntervalNs_ += (arrivalIntervalNs - cadenceIntervalNs_) / kCadenceSmoothing;
+  }
+  lastEnqueueNs_ = enqueueNs;
+  if (deviceTimed) {
+    return deviceNs;
+  }
+  int64_t predictedNs = lastSourceNs_ + cadenceIntervalNs_;
+  if (lastSourceNs_ == 0 || enqueueNs < predictedNs ||
+      enqueueNs - predictedNs > kCadenceGapIntervals * frameIntervalNs_) {
+    return enqueueNs;
+  }
+  return predictedNs;
+}
+
+void JitterBuffer::adapt(int64_t latenessNs) {
+  lateness_[latenessCount_++ % kWindow] = latenessNs;
+  size_t samples = std::min(latenessCount_, kWindow);
+  std::array<int64_t, kWindow> sorted;
+  std::copy_n(lateness_.begin(), samples, sorted.begin());
+  auto p95 = sorted.begin() + samples * 95 / 100;
+  std::nth_element(sorted.begin(), p95, sorted.begin() + samples);
+  int64_t minNs = *std::min_element(sorted.begin(), sorted.begin() + samples);
+
+  int64_t spreadNs = *p95 - minNs;
+  uint32_t depth = std::clamp<uint32_t>(
+      (uint32_t)((spreadNs + frameIntervalNs_ - 1) / frameIntervalNs_), kMinDepth, kMaxDepth);
+  if (depth > targetDepth_) {
+    targetDepth_ = depth;
+    shrinkCount_ = 0;
+  } else if (depth < targetDepth_ && ++shrinkCount_ >= kShrinkFrames) {
+    targetDepth_--;
+    shrinkCount_ = 0;
+  } else if (depth == targetDepth_) {
+    shrinkCount_ = 0;
+  }
+
+  int64_t targetNs = minNs + targetDepth_ * frameIntervalNs_;
+  if (!delaySet_) {
+    delayNs_ = targetNs;
+    delaySet_ = true;
+    return;
+  }
+  delayNs_ += std::clamp(
+      targetNs - delayNs_, -frameIntervalNs_ / kShrinkDivisor, frameIntervalNs_ / kGrowDivisor);
+}
+
+uvc_frame_t* JitterBuffer::push(uvc_frame_t* frame, int64_t enqueueNs, int64_t deviceNs) {
+  int64_t sourceNs = sourceTime(enqueueNs, deviceNs);
+  lastSourceNs_ = sourceNs;
+  adapt(enqueueNs - sourceNs);
+  int64_t dueNs = sourceNs + delayNs_;
+  // In order, and apart enough that a bunch of late frames is paced out
+  // again instead of shown in one vsync.
+  if (lastDueNs_ != 0) {
+    dueNs = std::max(dueNs, lastDueNs_ + frameIntervalNs_ / 2);
+  }
+  lastDueNs_ = dueNs;
+
+  uvc_frame_t* evicted = nullptr;
+  Entry oldest;
+  if (count_ == kCapacity && popEntry(oldest)) {
+    evicted = oldest.frame;
+    report_.overflows++;
+  }
+  entries_[(head_ + count_) % kCapacity] = {frame, enqueueNs, sourceNs, dueNs};
+  count_++;
+  return evicted;
+}
+
+bool JitterBuffer::popEntry(Entry& entry) {
+  if (count_ == 0) {
+    return false;
+  }
+  entry = entries_[head_];
+  head_ = (head_ + 1) % kCapacity;
+  count_--;
+  return true;
+}
+
+bool JitterBuffer::pop(int64_t nowNs, uvc_frame_t*& frame, int64_t& enqueueNs) {
+  if (count_ == 0 || entries_[head_].dueNs > nowNs) {
+    return false;
+  }
+  Entry entry;
+  popEntry(entry);
+  int64_t addedNs = nowNs - entry.enqueueNs;
+  report_.frames++;
+  report_.maxAddedNs = std::max(report_.maxAddedNs, addedNs);
+  addedTotalNs_ += addedNs;
+  if (entry.enqueueNs > entry.dueNs) {
+    report_.late++;
+  }
+  released_[releasedNext_++ % kReleased] = {entry.frame->sequence, entry.sourceNs};
+  frame = entry.frame;
+  enqueueNs = entry.enqueueNs;
+  return true;
+}
+
+bool JitterBuffer::take(uvc_frame_t*& frame, int64_t& enqueueNs) {
+  Entry entry;
+  if (!popEntry(entry)) {
+    return false;
+  }
+  frame = entry.frame;
+  enqueueNs = entry.enqueueNs;
+  return true;
+}
+
+void JitterBuffer::presented(uint32_t sequence, int64_t postedNs) {
+  auto released = std::find_if(released_.begin(), released_.end(), [sequence](const Released& r) {
+    return r.sequence == sequence && r.sourceNs != 0;
+  });
+  if (released == released_.end()) {
+    return;
+  }
+  int64_t sourceNs = released->sourceNs;
+  released->sourceNs = 0;
+  int64_t sourceIntervalNs = sourceNs - lastPostedSourceNs_;
+  // Across a skipped frame or a switch of source times there is no cadence
+  // to compare with.
+  if (lastPostedNs_ != 0 && sourceIntervalNs > 0 &&
+      sourceIntervalNs <= kCadenceGapIntervals * frameIntervalNs_) {
+    int64_t deviationNs = (postedNs - lastPostedNs_) - sourceIntervalNs;
+    jitterSamples_[jitterCount_++ % kJitterSamples] = deviationNs < 0 ? -deviationNs : deviationNs;
+  }
+  lastPostedNs_ = postedNs;
+  lastPostedSourceNs_ = sourceNs;
+}
+
+JitterBuffer::Report JitterBuffer::takeReport() {
+  Report report = report_;
+  report.targetDepth = targetDepth_;
+  report.delayNs = delayNs_;
+  report.meanAddedNs = report.frames > 0 ? addedTotalNs_ / report.frames : 0;
+  size_t samples = std::min(jitterCount_, kJitterSamples);
+  if (samples > 0) {
+    auto p95 = jitterSamples_.begin() + samples * 95 / 100;
+    std::nth_element(jitterSamples_.begin(), p95, jitterSamples_.begin() + samples);
+    report.presentJitterP95Ns = *p95;
+  }
+  report_ = Report{};
+  addedTotalNs_ = 0;
+  jitterCount_ = 0;
+  return report;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Presentation jitter buffer of the smooth playback mode: the render thread
+// holds arrived frames back and takes each at an even cadence instead of as
+// soon as it arrives, trading a frame or a few of latency for the bursts of
+// isochronous completions and MJPEG decodes.
+//
+// Each frame is due at its source time plus a delay common to all frames.
+// The source time is the sensor capture time through the recovered device
+// clock, or without one a cadence that starts at the negotiated frame
+// interval, follows the average arrival interval and re-anchors on the
+// earliest arrivals. The delay is the smallest lateness, arrival
+// minus source time, of the last kWindow frames plus the target depth in
+// frame intervals; the depth covers the spread of the lateness, from
+// kMinDepth to kMaxDepth frames. It grows as soon as frames come later and
+// shrinks after kShrinkFrames of less jitter. Per frame the delay grows by
+// at most 1/kGrowDivisor of an interval and shrinks by 1/kShrinkDivisor,
+// so a change shows as one short hitch rather than a stutter. A late frame
+// is handed out at once and counted.
+//
+// Used from the render thread only. Frames are lent like the frame queue's:
+// push() takes the caller's reference and pop() hands it back.
+class JitterBuffer final {
+ public:
+  static constexpr uint32_t kMinDepth = 1;
+  static constexpr uint32_t kMaxDepth = 3;
+  // Frames held at most; the one past them pushes the oldest out.
+  static constexpr size_t kCapacity = kMaxDepth + 2;
+  static constexpr size_t kWindow = 64;
+  static constexpr uint32_t kShrinkFrames = 120;
+  static constexpr int64_t kGrowDivisor = 2;
+  static constexpr int64_t kShrinkDivisor = 8;
+
+  // What the buffer did since the last takeReport().
+  struct Report {
+    uint32_t targetDepth{};
+    int64_t delayNs{};
+    uint32_t frames{};
+    // Frames presented that arrived after they were due, and frames the
+    // buffer overflowed with.
+    uint32_t late{};
+    uint32_t overflows{};
+    // Time frames were held, and the 95th percentile of how far the
+    // intervals between presented frames were from those between their
+    // source times.
+    int64_t meanAddedNs{};
+    int64_t maxAddedNs{};
+    int64_t presentJitterP95Ns{};
+  };
+
+  // Drops nothing: the caller drains it with take() first.
+  void reset(int64_t frameIntervalNs);
+
+  // Takes the frame that arrived at enqueueNs, captured at deviceNs on the
+  // host's clock or 0 without a confident device clock. Returns the frame
+  // pushed out when the buffer was full, for the caller to drop, or null.
+  uvc_frame_t* push(uvc_frame_t* frame, int64_t enqueueNs, int64_t deviceNs);
+
+  // The oldest frame and its arrival time once it is due at nowNs.
+  bool pop(int64_t nowNs, uvc_frame_t*& frame, int64_t& enqueueNs);
+  // The oldest frame regardless, to drain the buffer.
+  bool take(uvc_frame_t*& frame, int64_t& enqueueNs);
+
+  bool empty() const {
+    return count_ == 0;
+  }
+  // When the oldest frame is due, with one held.
+  int64_t nextDueNs() const {
+    return entries_[head_].dueNs;
+  }
+
+  // The frame of this sequence number, popped before, reached the screen
+  // at postedNs.
+  void presented(uint32_t sequence, int64_t postedNs);
+
+  Report takeReport();
+
+ private:
+  struct Entry {
+    uvc_frame_t* frame;
+    int64_t enqueueNs;
+    int64_t sourceNs;
+    int64_t dueNs;
+  };
+  // Popped frames waiting for presented(), by sequence number.
+  struct Released {
+    uint32_t sequence;
+    int64_t sourceNs;
+  };
+  static constexpr size_t kReleased = 8;
+  static constexpr size_t kJitterSamples = 256;
+
+  int64_t frameIntervalNs_{};
+  std::array<Entry, kCapacity> entries_{};
+  size_t head_{};
+  size_t count_{};
+
+  // Source times from the device clock, or from the cadence, whose interval
+  // follows the arrivals from the negotiated one on.
+  bool deviceTimed_{false};
+  int64_t cadenceIntervalNs_{};
+  int64_t lastSourceNs_{};
+  int64_t lastEnqueueNs_{};
+  int64_t lastDueNs_{};
+  std::array<int64_t, kWindow> lateness_{};
+  size_t latenessCount_{};
+  uint32_t targetDepth_{kMinDepth};
+  uint32_t shrinkCount_{};
+  int64_t delayNs_{};
+  bool delaySet_{false};
+
+  std::array<Released, kReleased> released_{};
+  size_t releasedNext_{};
+  int64_t lastPostedNs_{};
+  int64_t lastPostedSourceNs_{};
+
+  Report report_{};
+  int64_t addedTotalNs_{};
+  std::array<int64_t, kJitterSamples> jitterSamples_{};
+  size_t jitterCount_{};
+
+  int64_t sourceTime(int64_t enqueueNs, int64_t deviceNs);
+  void adapt(int64_t latenessNs);
+  bool popEntry(Entry& entry);
+};
@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JpegEntropyDecoder.h"
+
+#include <android/log.h>
+
+#include <cstring>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "JpegEntropyDecoder", __VA_ARGS__)
+
+const uint8_t kJpegDefaultHuffmanTables[420] = {
+    0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
+    0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x00, 0x02,
+    0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00,
+    0x01, 0x7d, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31,
+    0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91,
+    0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33,
+    0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43,
+    0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
+    0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73,
+    0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2,
+    0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+    0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05,
+    0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04,
+    0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22,
+    0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33,
+    0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+    0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36,
+    0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a,
+    0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66,
+    0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+    0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+    0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+    0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+    0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+namespace {
+
+// The natural order index of each zigzag position.
+constexpr uint8_t kZigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  //
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28, //
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, //
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63, //
+};
+
+uint16_t readU16(const uint8_t* p) {
+  return p[0] << 8 | p[1];
+}
+
+// The difference sizes of T.81 F.1.2.1, read as sign extended magnitudes.
+int32_t receiveExtend(uint64_t& bits, int32_t& count, int32_t size) {
+  int32_t value = (int32_t)(bits >> (64 - size));
+  bits <<= size;
+  count -= size;
+  return value < 1 << (size - 1) ? value - (1 << size) + 1 : value;
+}
+
+} // namespace
+
+void JpegEntropyDecoder::BitReader::fill() {
+  // Whole bytes at once while none of them is 0xFF.
+  uint64_t word;
+  if (pos + 8 <= size && count <= 56) {
+    memcpy(&word, data + pos, sizeof(word));
+    uint64_t inverted = ~word;
+    if (((inverted - 0x0101010101010101ULL) & ~inverted & 0x8080808080808080ULL) == 0) {
+      int32_t bytes = (64 - count) >> 3;
+      uint64_t next = __builtin_bswap64(word);
+      next = bytes == 8 ? next : next >> (64 - bytes * 8) << (64 - bytes * 8);
+      bits |= next >> count;
+      count += bytes * 8;
+      pos += bytes;
+      return;
+    }
+  }
+  while (count <= 56) {
+    uint8_t byte = 0;
+    if (pos < size && data[pos] != 0xFF) {
+      byte = data[pos++];
+    } else if (pos + 1 < size && data[pos + 1] == 0x00) {
+      // A stuffed 0xFF data byte.
+      byte = 0xFF;
+      pos += 2;
+    } else {
+      // A marker or the end: left in place.
+      paddedBytes++;
+    }
+    bits |= (uint64_t)byte << (56 - count);
+    count += 8;
+  }
+}
+
+bool JpegEntropyDecoder::decode(
+    const uint8_t* data, size_t size, int32_t width, int32_t height) {
+  TRACE_SCOPE("jpegEntropyDecode");
+  expectedWidth_ = width;
+  expectedHeight_ = height;
+  // A DRI segment only holds for the frame it is in.
+  restartInterval_ = 0;
+  if (!defaultTables_) {
+    for (int32_t i = 0; i < 4; i++) {
+      dcTables_[i].defined = false;
+      acTables_[i].defined = false;
+    }
+    readHuffmanTables(kJpegDefaultHuffmanTables + 4, sizeof(kJpegDefaultHuffmanTables) - 4);
+    defaultTables_ = true;
+  }
+  size_t scanOffset = 0;
+  if (!parseHeaders(data, size, scanOffset)) {
+    return false;
+  }
+  return decodeScan(data + scanOffset, size - scanOffset);
+}
+
+bool JpegEntropyDecoder::parseHeaders(const uint8_t* data, size_t size, size_t& scanOffset) {
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    ULOGD("Not a JPEG: no SOI");
+    return false;
+  }
+  bool frameHeader = false;
+  size_t offset = 2;
+  while (offset + 4 <= size) {
+    if (data[offset] != 0xFF) {
+      ULOGD("No marker at %zu", offset);
+      return false;
+    }
+    uint8_t marker = data[offset + 1];
+    if (marker == 0xFF) {
+      // Fill byte.
+      offset++;
+      continue;
+    }
+    size_t length = readU16(data + offset + 2);
+    if (length < 2 || offset + 2 + length > size) {
+      ULOGD("Marker 0x%02x segment of %zu bytes overruns the frame", marker, length);
+      return false;
+    }
+    const uint8_t* segment = data + offset + 4;
+    length -= 2;
+    bool valid = true;
+    switch (marker) {
+      case 0xC0: // baseline
+      case 0xC1: // extended sequential, Huffman coded
+        valid = readFrameHeader(segment, length);
+        frameHeader = valid;
+        break;
+      case 0xC4:
+        valid = readHuffmanTables(segment, length);
+        defaultTables_ = false;
+        break;
+      case 0xDB:
+        valid = readQuantTables(segment, length);
+        break;
+      case 0xDD:
+        valid = length >= 2;
+        restartInterval_ = valid ? readU16(segment) : 0;
+        break;
+      case 0xDA:
+        if (!frameHeader || !readScanHeader(segment, length)) {
+          return false;
+        }
+        scanOffset = offset + 4 + length;
+        return true;
+      case 0xD9:
+        ULOGD("EOI before the scan");
+        return false;
+      default:
+        if ((marker & 0xF0) == 0xC0 && marker != 0xC8 && marker != 0xCC) {
+          ULOGD("Unsupported frame type SOF%d", marker & 0x0F);
+          return false;
+        }
+        // APPn, COM and the like.
+        break;
+    }
+    if (!valid) {
+      ULOGD("Malformed marker 0x%02x segment", marker);
+      return false;
+    }
+    offset += 4 + length;
+  }
+  ULOGD("No scan");
+  return false;
+}
+
+bool JpegEntropyDecoder::readQuantTables(const uint8_t* segment, size_t length) {
+  size_t offset = 0;
+  while (offset < length) {
+    int32_t precision = segment[offset] >> 4;
+    int32_t index = segment[offset] & 0x0F;
+    size_t bytes = precision == 0 ? 64 : 128;
+    if (precision > 1 || index > 3 || offset + 1 + bytes > length) {
+      return false;
+    }
+    const uint8_t* values = segment + offset + 1;
+    for (int32_t k = 0; k < 64; k++) {
+      quantTables_[index][kZigzag[k]] = precision == 0 ? values[k] : readU16(values + k * 2);
+    }
+    offset += 1 + bytes;
+  }
+  return true;
+}
+
+bool JpegEntropyDecoder::readFrameHeader(const uint8_t* segment, size_t length) {
+  if (length < 6) {
+    return false;
+  }
+  int32_t count = segment[5];
+  if (segment[0] != 8 || (count != 1 && count != kMaxComponents) ||
+      length < 6 + 3 * (size_t)count) {
+    ULOGD("Unsupported %d bit frame of %d components", segment[0], count);
+    return false;
+  }
+  height_ = readU16(segment + 1);
+  width_ = readU16(segment + 3);
+  if (width_ == 0 || height_ == 0) {
+    // A height left to a DNL marker.
+    return false;
+  }
+  if (width_ != expectedWidth_ || height_ != expectedHeight_) {
+    ULOGD("Frame of %dx%d, expected %dx%d", width_, height_, expectedWidth_, expectedHeight_);
+    return false;
+  }
+  componentCount_ = count;
+  int32_t lumaSampling = segment[7];
+  for (int32_t i = 0; i < count; i++) {
+    const uint8_t* spec = segment + 6 + 3 * i;
+    components_[i].id = spec[0];
+    components_[i].quantTable = spec[2] & 0x03;
+    // Chroma sampled once per MCU, which the compute shader upsamples.
+    if (i > 0 && spec[1] != 0x11) {
+      ULOGD("Unsupported chroma sampling 0x%02x", spec[1]);
+      return false;
+    }
+  }
+  if (count == 1) {
+    // A lone component's scan is not interleaved: its MCUs are blocks.
+    lumaBlocksWide_ = 1;
+    lumaBlocksHigh_ = 1;
+  } else {
+    lumaBlocksWide_ = lumaSampling >> 4;
+    lumaBlocksHigh_ = lumaSampling & 0x0F;
+    if (lumaBlocksWide_ < 1 || lumaBlocksWide_ > 2 || lumaBlocksHigh_ < 1 ||
+        lumaBlocksHigh_ > 2) {
+      ULOGD("Unsupported luma sampling 0x%02x", lumaSampling);
+      return false;
+    }
+  }
+  mcusWide_ = (width_ + 8 * lumaBlocksWide_ - 1) / (8 * lumaBlocksWide_);
+  mcusHigh_ = (height_ + 8 * lumaBlocksHigh_ - 1) / (8 * lumaBlocksHigh_);
+  return true;
+}
+
+bool JpegEntropyDecoder::readHuffmanTables(const uint8_t* segment, size_t length) {
+  size_t offset = 0;
+  while (offset + 17 <= length) {
+    int32_t tableClass = segment[offset] >> 4;
+    int32_t index = segment[offset] & 0x0F;
+    if (tableClass > 1 || index > 3) {
+      return false;
+    }
+    const uint8_t* counts = segment + offset + 1;
+    size_t total = 0;
+    for (int32_t i = 0; i < 16; i++) {
+      total += counts[i];
+    }
+    if (total > 256 || offset + 17 + total > length) {
+      return false;
+    }
+    HuffmanTable& table = tableClass == 0 ? dcTables_[index] : acTables_[index];
+    memcpy(table.symbols, segment + offset + 17, total);
+    memset(table.fastLength, 0, sizeof(table.fastLength));
+    // Canonical codes: each length's run counts up from the previous one's
+    // last code, shifted left by a bit.
+    int32_t code = 0;
+    int32_t k = 0;
+    for (int32_t bitLength = 1; bitLength <= 16; bitLength++) {
+      table.valueOffset[bitLength] = k - code;
+      for (int32_t i = 0; i < counts[bitLength - 1]; i++, code++, k++) {
+        if (code >= 1 << bitLength) {
+          // More codes than the length has.
+          return false;
+        }
+        if (bitLength <= kFastBits) {
+          int32_t first = code << (kFastBits - bitLength);
+          for (int32_t j = 0; j < 1 << (kFastBits - bitLength); j++) {
+            table.fastSymbol[first + j] = table.symbols[k];
+            table.fastLength[first + j] = bitLength;
+          }
+        }
+      }
+      table.maxCode[bitLength] = counts[bitLength - 1] > 0 ? code - 1 : -1;
+      code <<= 1;
+    }
+    table.maxCode[17] = INT32_MAX;
+    memset(table.fastAc, 0, sizeof(table.fastAc));
+    for (int32_t i = 0; tableClass == 1 && i < 1 << kFastBits; i++) {
+      int32_t codeLength = table.fastLength[i];
+      int32_t run = table.fastSymbol[i] >> 4;
+      int32_t magnitude = table.fastSymbol[i] & 0x0F;
+      if (codeLength == 0 || magnitude == 0 || codeLength + magnitude > kFastBits) {
+        continue;
+      }
+      int32_t bits = (i << codeLength & ((1 << kFastBits) - 1)) >> (kFastBits - magnitude);
+      int32_t value = bits < 1 << (magnitude - 1) ? bits - (1 << magnitude) + 1 : bits;
+      if (value >= -128 && value <= 127) {
+        table.fastAc[i] = (int16_t)(value * 256 + run * 16 + codeLength + magnitude);
+      }
+    }
+    table.defined = true;
+    offset += 17 + total;
+  }
+  return offset == length;
+}
+
+bool JpegEntropyDecoder::readScanHeader(const uint8_t* segment, size_t length) {
+  if (length < 1) {
+    return false;
+  }
+  int32_t count = segment[0];
+  if (count != componentCount_ || length < 4 + 2 * (size_t)count) {
+    ULOGD("Unsupported scan of %d of %d components", count, componentCount_);
+    return false;
+  }
+  for (int32_t i = 0; i < count; i++) {
+    const uint8_t* spec = segment + 1 + 2 * i;
+    // Scans list the components in frame order.
+    if (spec[0] != components_[i].id) {
+      return false;
+    }
+    components_[i].dcTable = spec[1] >> 4;
+    components_[i].acTable = spec[1] & 0x0F;
+    if (components_[i].dcTable > 3 || components_[i].acTable > 3 ||
+        !dcTables_[components_[i].dcTable].defined ||
+        !acTables_[components_[i].acTable].defined) {
+      ULOGD("Scan uses an undefined Huffman table");
+      return false;
+    }
+    memcpy(componentQuant_[i], quantTables_[components_[i].quantTable], sizeof(componentQuant_[i]));
+  }
+  const uint8_t* spectral = segment + 1 + 2 * count;
+  // Ss 0, Se 63, Ah and Al 0: all of every block in this one scan.
+  return spectral[0] == 0 && spectral[1] == 63 && spectral[2] == 0;
+}
+
+int32_t JpegEntropyDecoder::decodeSymbol(BitReader& reader, const HuffmanTable& table) {
+  if (reader.count < 16) {
+    reader.fill();
+  }
+  uint32_t peek = (uint32_t)(reader.bits >> (64 - kFastBits));
+  int32_t bitLength = table.fastLength[peek];
+  if (bitLength != 0) {
+    reader.bits <<= bitLength;
+    reader.count -= bitLength;
+    return table.fastSymbol[peek];
+  }
+  int32_t code = (int32_t)(reader.bits >> 48);
+  for (bitLength = kFastBits + 1; bitLength <= 16; bitLength++) {
+    int32_t prefix = code >> (16 - bitLength);
+    if (prefix <= table.maxCode[bitLength]) {
+      reader.bits <<= bitLength;
+      reader.count -= bitLength;
+      return table.symbols[prefix + table.valueOffset[bitLength]];
+    }
+  }
+  return -1;
+}
+
+bool JpegEntropyDecoder::decodeBlock(
+    BitReader& reader,
+    const Component& component,
+    int32_t& dc,
+    int16_t* block) {
+  memset(block, 0, 64 * sizeof(int16_t));
+  int32_t size = decodeSymbol(reader, dcTables_[component.dcTable]);
+  if (size < 0 || size > 11) {
+    return false;
+  }
+  if (size > 0) {
+    if (reader.count < size) {
+      reader.fill();
+    }
+    dc += receiveExtend(reader.bits, reader.count, size);
+  }
+  block[0] = (int16_t)dc;
+  const HuffmanTable& ac = acTables_[component.acTable];
+  for (int32_t k = 1; k < 64; k++) {
+    if (reader.count < 32) {
+      reader.fill();
+    }
+    int32_t fast = ac.fastAc[reader.bits >> (64 - kFastBits)];
+    if (fast != 0) {
+      k += (fast >> 4) & 0x0F;
+      if (k > 63) {
+        return false;
+      }
+      reader.bits <<= fast & 0x0F;
+      reader.count -= fast & 0x0F;
+      block[kZigzag[k]] = (int16_t)(fast >> 8);
+      continue;
+    }
+    int32_t symbol = decodeSymbol(reader, ac);
+    if (symbol < 0) {
+      return false;
+    }
+    int32_t run = symbol >> 4;
+    size = symbol & 0x0F;
+    if (size == 0) {
+      if (run != 15) {
+        break; // end of block
+      }
+      k += 15; // sixteen zeros
+      continue;
+    }
+    k += run;
+    if (k > 63 || size > 10) {
+      return false;
+    }
+    if (reader.count < size) {
+      reader.fill();
+    }
+    block[kZigzag[k]] = (int16_t)receiveExtend(reader.bits, reader.count, size);
+  }
+  return true;
+}
+
+bool JpegEntropyDecoder::decodeScan(const uint8_t* data, size_t size) {
+  size_t mcuCount = (size_t)mcusWide_ * mcusHigh_;
+  if (coefficients_.size() < coefficientCount()) {
+    coefficients_.resize(coefficientCount());
+  }
+  int32_t lumaBlocks = lumaBlocksWide_ * lumaBlocksHigh_;
+  BitReader reader{data, size};
+  int32_t dc[kMaxComponents]{};
+  uint32_t untilRestart = restartInterval_;
+  int16_t* block = coefficients_.data();
+  for (size_t mcu = 0; mcu < mcuCount; mcu++) {
+    if (restartInterval_ != 0 && untilRestart == 0) {
+      // The segment's last byte is padded with ones up to the RSTn marker,
+      // where the reader stopped.
+      if (reader.overran() || reader.pos + 1 >= size || data[reader.pos] != 0xFF ||
+          (data[reader.pos + 1] & 0xF8) != 0xD0) {
+        ULOGD("No restart marker before MCU %zu", mcu);
+        return false;
+      }
+      reader = BitReader{data, size, reader.pos + 2};
+      memset(dc, 0, sizeof(dc));
+      untilRestart = restartInterval_;
+    }
+    untilRestart--;
+    for (int32_t i = 0; i < lumaBlocks; i++, block += 64) {
+      if (!decodeBlock(reader, components_[0], dc[0], block)) {
+        ULOGD("Corrupt Y block in MCU %zu", mcu);
+        return false;
+      }
+    }
+    for (int32_t c = 1; c < componentCount_; c++, block += 64) {
+      if (!decodeBlock(reader, components_[c], dc[c], block)) {
+        ULOGD("Corrupt chroma block in MCU %zu", mcu);
+        return false;
+      }
+    }
+  }
+  if (reader.overran()) {
+    ULOGD("Scan truncated");
+    return false;
+  }
+  return true;
+}
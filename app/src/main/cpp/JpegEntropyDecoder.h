@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The Huffman tables of ITU T.81 Annex K as one DHT segment, marker
+// included. UVC cameras often leave them out of MJPEG frames, which libjpeg
+// tolerates and most hardware decoders do not.
+extern const uint8_t kJpegDefaultHuffmanTables[420];
+
+// Entropy decodes baseline JPEG frames into the quantized DCT coefficients of
+// their blocks, leaving dequantization, the inverse DCT, chroma upsampling
+// and color conversion to GlPreviewRenderer's compute shader.
+//
+// Takes the frames UVC cameras send: 8 bit baseline, one scan holding every
+// component, either grayscale or YCbCr with the chroma sampled once per MCU,
+// so 4:4:4, 4:2:2, 4:4:0 and 4:2:0. The Annex K tables stand in for missing
+// DHT segments. Progressive, arithmetic coded and 12 bit frames are refused.
+//
+// The buffers are kept across frames; not thread safe.
+class JpegEntropyDecoder final {
+ public:
+  static constexpr int32_t kMaxComponents = 3;
+  // Four Y blocks and one each of Cb and Cr, for 4:2:0.
+  static constexpr int32_t kMaxBlocksPerMcu = 6;
+
+  // False on anything but a whole width x height frame of the kind above; the
+  // coefficients are then partly written. The size is checked before any
+  // buffer is grown, so a corrupt frame header cannot allocate past it.
+  bool decode(const uint8_t* data, size_t size, int32_t width, int32_t height);
+
+  int32_t width() const {
+    return width_;
+  }
+  int32_t height() const {
+    return height_;
+  }
+  int32_t componentCount() const {
+    return componentCount_;
+  }
+  // Y blocks across and down an MCU; 1 for grayscale, whose MCUs are single
+  // blocks.
+  int32_t lumaBlocksWide() const {
+    return lumaBlocksWide_;
+  }
+  int32_t lumaBlocksHigh() const {
+    return lumaBlocksHigh_;
+  }
+  int32_t mcusWide() const {
+    return mcusWide_;
+  }
+  int32_t mcusHigh() const {
+    return mcusHigh_;
+  }
+  int32_t blocksPerMcu() const {
+    return lumaBlocksWide_ * lumaBlocksHigh_ + componentCount_ - 1;
+  }
+  // 64 to a block in natural order, row by row, MCU after MCU in scan
+  // order, each MCU's Y blocks row by row and then its Cb and Cr blocks.
+  const int16_t* coefficients() const {
+    return coefficients_.data();
+  }
+  size_t coefficientCount() const {
+    return (size_t)mcusWide_ * mcusHigh_ * blocksPerMcu() * 64;
+  }
+  // The quantization table of each component, 64 entries apiece in natural
+  // order.
+  const uint16_t* quantTables() const {
+    return componentQuant_[0];
+  }
+
+ private:
+  struct HuffmanTable {
+    bool defined{};
+    // Codes of up to kFastBits bits, looked up by the next kFastBits bits;
+    // a length of 0 sends longer codes to maxCode.
+    uint8_t fastSymbol[512]{};
+    uint8_t fastLength[512]{};
+    // AC tables only: whole coefficients whose code and magnitude fit in
+    // kFastBits, as value << 8 | zero run << 4 | bits taken, else 0.
+    int16_t fastAc[512]{};
+    // The largest code of each length, -1 when there is none, and what
+    // turns a code of the length into its index in symbols.
+    int32_t maxCode[18]{};
+    int32_t valueOffset[18]{};
+    uint8_t symbols[256]{};
+  };
+  struct Component {
+    uint8_t id{};
+    int32_t quantTable{};
+    int32_t dcTable{};
+    int32_t acTable{};
+  };
+  // Fills from the entropy coded data, stopping at the first marker and
+  // feeding zero bits past it.
+  struct BitReader {
+    const uint8_t* data{};
+    size_t size{};
+    size_t pos{};
+    uint64_t bits{};
+    int32_t count{};
+    int32_t paddedBytes{};
+
+    void fill();
+    // Whether more bits were taken than the data had.
+    bool overran() const {
+      return paddedBytes * 8 > count;
+    }
+  };
+  static constexpr int32_t kFastBits = 9;
+
+  bool parseHeaders(const uint8_t* data, size_t size, size_t& scanOffset);
+  bool readQuantTables(const uint8_t* segment, size_t length);
+  bool readFrameHeader(const uint8_t* segment, size_t length);
+  bool readHuffmanTables(const uint8_t* segment, size_t length);
+  bool readScanHeader(const uint8_t* segment, size_t length);
+  bool decodeScan(const uint8_t* data, size_t size);
+  bool decodeBlock(BitReader& reader, const Component& component, int32_t& dc, int16_t* block);
+  static int32_t decodeSymbol(BitReader& reader, const HuffmanTable& table);
+
+  int32_t expectedWidth_{};
+  int32_t expectedHeight_{};
+  int32_t width_{};
+  int32_t height_{};
+  int32_t componentCount_{};
+  int32_t lumaBlocksWide_{1};
+  int32_t lumaBlocksHigh_{1};
+  int32_t mcusWide_{};
+  int32_t mcusHigh_{};
+  uint32_t restartInterval_{};
+  // Whether the Huffman tables are the Annex K ones, no DHT segment having
+  // replaced any since they were loaded.
+  bool defaultTables_{};
+  Component components_[kMaxComponents]{};
+  uint16_t quantTables_[4][64]{};
+  uint16_t componentQuant_[kMaxComponents][64]{};
+  HuffmanTable dcTables_[4]{};
+  HuffmanTable acTables_[4]{};
+  std::vector<int16_t> coefficients_{};
+};
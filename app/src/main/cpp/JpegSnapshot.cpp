@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JpegSnapshot.h"
+
+#include <android/bitmap.h>
+#include <android/data_space.h>
+#include <android/log.h>
+
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "JpegSnapshot", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "JpegSnapshot", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "JpegSnapshot", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "JpegSnapshot", __VA_ARGS__)
+
+using namespace std::chrono;
+
+JpegSnapshot::~JpegSnapshot() {
+  stop();
+}
+
+void JpegSnapshot::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  {
+    std::unique_lock lk(mutex_);
+    change_.notify_all();
+  }
+  snapshotThread_.join();
+  uvc_frame_t* frame = pending_.exchange(nullptr);
+  if (frame != nullptr) {
+    uvc_release_frame(frame);
+  }
+}
+
+bool JpegSnapshot::request(
+    uvc_frame_format frameFormat,
+    int32_t width,
+    int32_t height,
+    int32_t quality,
+    Callback done) {
+  if (!FrameFanout::supportsFormat(frameFormat)) {
+    ULOGE("No RGBA conversion for format %d", frameFormat);
+    return false;
+  }
+  std::unique_lock lk(mutex_);
+  if (active_) {
+    return false;
+  }
+  if (!running_.exchange(true)) {
+    snapshotThread_ = std::thread(&JpegSnapshot::snapshotLoop, this);
+  }
+  active_ = true;
+  width_ = std::max(width, 0);
+  height_ = std::max(height, 0);
+  quality_ = std::clamp(quality, 0, 100);
+  done_ = std::move(done);
+  requested_.store(true, std::memory_order_release);
+  return true;
+}
+
+void JpegSnapshot::offer(uvc_frame_t* frame) {
+  if (!requested_.load(std::memory_order_acquire) || !requested_.exchange(false)) {
+    return;
+  }
+  uvc_retain_frame(frame);
+  pending_.store(frame, std::memory_order_release);
+  std::unique_lock lk(mutex_);
+  change_.notify_all();
+}
+
+void JpegSnapshot::snapshotLoop() {
+  prctl(PR_SET_NAME, "usb_video_jpeg");
+  setpriority(PRIO_PROCESS, gettid(), kSnapshotNice);
+  while (running_) {
+    uvc_frame_t* frame = pending_.exchange(nullptr, std::memory_order_acquire);
+    if (frame == nullptr) {
+      std::unique_lock lk(mutex_);
+      change_.wait_for(lk, 100ms, [this] { return pending_ != nullptr || !running_; });
+      continue;
+    }
+    std::vector<uint8_t> jpeg;
+    int32_t width = 0;
+    int32_t height = 0;
+    bool ok = encode(frame, jpeg, width, height);
+    complete(ok, width, height, std::move(jpeg));
+  }
+  // A request that never got a frame.
+  requested_ = false;
+  complete(false, 0, 0, {});
+}
+
+bool JpegSnapshot::encode(
+    uvc_frame_t* frame,
+    std::vector<uint8_t>& jpeg,
+    int32_t& width,
+    int32_t& height) {
+  TRACE_SCOPE("encodeJpegSnapshot");
+  steady_clock::time_point startedAt = steady_clock::now();
+  int32_t quality;
+  {
+    std::unique_lock lk(mutex_);
+    width = width_;
+    height = height_;
+    quality = quality_;
+  }
+  uint32_t sequence = frame->sequence;
+  FrameFanout::FramePtr rgba = fanout_.derive(frame, FanoutFormat::RGBA, width, height);
+  // Only the RGBA is needed from here on; the pool gets its buffer back
+  // before the slow part.
+  uvc_release_frame(frame);
+  if (rgba == nullptr) {
+    ULOGE("Frame %u could not be converted for a snapshot", sequence);
+    return false;
+  }
+  steady_clock::time_point convertedAt = steady_clock::now();
+  AndroidBitmapInfo info{
+      .width = (uint32_t)rgba->width,
+      .height = (uint32_t)rgba->height,
+      .stride = (uint32_t)rgba->stride,
+      .format = ANDROID_BITMAP_FORMAT_RGBA_8888,
+      .flags = ANDROID_BITMAP_FLAGS_ALPHA_OPAQUE,
+  };
+  // About a bit per pixel at usual qualities.
+  jpeg.reserve((size_t)rgba->width * rgba->height / 8);
+  auto write = [](void* context, const void* data, size_t size) {
+    auto* out = static_cast<std::vector<uint8_t>*>(context);
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    out->insert(out->end(), bytes, bytes + size);
+    return true;
+  };
+  int result = AndroidBitmap_compress(
+      &info,
+      ADATASPACE_SRGB,
+      rgba->data.data(),
+      ANDROID_BITMAP_COMPRESS_FORMAT_JPEG,
+      quality,
+      &jpeg,
+      write);
+  if (result != ANDROID_BITMAP_RESULT_SUCCESS) {
+    ULOGE("AndroidBitmap_compress failed: %d", result);
+    jpeg.clear();
+    return false;
+  }
+  width = rgba->width;
+  height = rgba->height;
+  ULOGD(
+      "JPEG snapshot of frame %u, %dx%d at quality %d: %zu bytes, converted in %.1f ms, "
+      "encoded in %.1f ms",
+      sequence,
+      width,
+      height,
+      quality,
+      jpeg.size(),
+      duration<double, std::milli>(convertedAt - startedAt).count(),
+      duration<double, std::milli>(steady_clock::now() - convertedAt).count());
+  return true;
+}
+
+void JpegSnapshot::complete(bool ok, int32_t width, int32_t height, std::vector<uint8_t> jpeg) {
+  Callback done;
+  {
+    std::unique_lock lk(mutex_);
+    if (!active_) {
+      return;
+    }
+    done = std::move(done_);
+    done_ = nullptr;
+  }
+  if (done != nullptr) {
+    done(ok, width, height, std::move(jpeg));
+  }
+  // Only now can the next request be made.
+  std::unique_lock lk(mutex_);
+  active_ = false;
+}
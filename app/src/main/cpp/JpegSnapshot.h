@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameFanout.h"
+
+// Encodes the next captured frame to JPEG, for saving snapshots without a
+// Bitmap and Bitmap.compress() on the app's side.
+//
+// The capture thread hands the frame over taking only a reference on
+// libuvc's buffer, and only when a snapshot is requested; no frame is
+// copied or waits for the encoder. A snapshot thread below the streaming
+// threads' priority converts it to RGBA through the FrameFanout, shared
+// with the frame tap, gives the buffer back and compresses the RGBA with
+// AndroidBitmap_compress(), which takes no YUV.
+class JpegSnapshot final {
+ public:
+  // Runs on the snapshot thread. jpeg is empty when ok is false, also for a
+  // snapshot dropped at shutdown.
+  using Callback =
+      std::function<void(bool ok, int32_t width, int32_t height, std::vector<uint8_t> jpeg)>;
+
+  explicit JpegSnapshot(FrameFanout& fanout) : fanout_(fanout) {}
+  JpegSnapshot(const JpegSnapshot&) = delete;
+  JpegSnapshot& operator=(const JpegSnapshot&) = delete;
+  ~JpegSnapshot();
+
+  // Zero sizes keep the capture size, larger ones are clamped to it. quality
+  // is 0-100. Returns false, and does not call done, when the format cannot
+  // be converted or a snapshot is already pending.
+  bool request(
+      uvc_frame_format frameFormat,
+      int32_t width,
+      int32_t height,
+      int32_t quality,
+      Callback done);
+  // Capture thread.
+  void offer(uvc_frame_t* frame);
+  // Fails a pending request and gives back the frame it holds.
+  void stop();
+
+ private:
+  // Below the streaming threads, like TelemetryLog's sampling.
+  static constexpr int32_t kSnapshotNice = 10;
+
+  FrameFanout& fanout_;
+  std::thread snapshotThread_{};
+  std::atomic<bool> running_{false};
+  std::mutex mutex_;
+  std::condition_variable change_;
+  // Set by request() until a frame was handed over.
+  std::atomic<bool> requested_{false};
+  std::atomic<uvc_frame_t*> pending_{nullptr};
+  // Guarded by mutex_; set from request() until done ran.
+  bool active_{false};
+  int32_t width_{};
+  int32_t height_{};
+  int32_t quality_{};
+  Callback done_{};
+
+  void snapshotLoop();
+  // Releases frame once converted.
+  bool encode(uvc_frame_t* frame, std::vector<uint8_t>& jpeg, int32_t& width, int32_t& height);
+  void complete(bool ok, int32_t width, int32_t height, std::vector<uint8_t> jpeg);
+};
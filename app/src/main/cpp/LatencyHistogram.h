@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+
+using namespace std::chrono;
+
+// Histogram of durations in microseconds with log-linear buckets: exact up to
+// 32 us, then 16 buckets per power of two, about 6% wide, up to a minute.
+//
+// There must be one writer, but any thread may read while it records: the
+// counters are atomics updated without read-modify-write instructions. The
+// layout is standard, so a histogram can be shared with Kotlin as raw memory:
+// a 64 bit sample count followed by kBucketCount 32 bit bucket counts.
+class LatencyHistogram {
+ public:
+  static constexpr uint32_t kSubBucketBits = 4;
+  static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr uint32_t kMaxShift = 22;
+  static constexpr uint32_t kBucketCount = (kMaxShift + 2) * kSubBuckets;
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  // Writer only.
+  void record(nanoseconds duration) {
+    int64_t us = duration_cast<microseconds>(duration).count();
+    std::atomic<uint32_t>& bucket = buckets_[bucketOf(us > 0 ? (uint64_t)us : 0)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket holding the given fraction of samples, 0 if empty.
+  microseconds percentile(double fraction) const {
+    // Sum the buckets rather than trusting count_, which a concurrent record()
+    // may have updated separately.
+    std::array<uint32_t, kBucketCount> buckets;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < kBucketCount; i++) {
+      buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+      total += buckets[i];
+    }
+    if (total == 0) {
+      return 0us;
+    }
+    uint64_t rank = (uint64_t)(fraction * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kBucketCount; i++) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        return microseconds(bucketUpperBound(i));
+      }
+    }
+    return microseconds(bucketUpperBound(kBucketCount - 1));
+  }
+
+  // Only while the writer is idle.
+  void reset() {
+    for (std::atomic<uint32_t>& bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+  }
+
+  static int64_t bucketUpperBound(uint32_t bucket) {
+    if (bucket < 2 * kSubBuckets) {
+      return bucket + 1;
+    }
+    uint32_t shift = bucket / kSubBuckets - 1;
+    int64_t mantissa = bucket % kSubBuckets + kSubBuckets;
+    return (mantissa + 1) << shift;
+  }
+
+ private:
+  std::atomic<uint64_t> count_{0};
+  std::array<std::atomic<uint32_t>, kBucketCount> buckets_{};
+
+  static uint32_t bucketOf(uint64_t us) {
+    if (us < 2 * kSubBuckets) {
+      return (uint32_t)us;
+    }
+    uint32_t shift = std::bit_width(us) - 1 - kSubBucketBits;
+    if (shift > kMaxShift) {
+      return kBucketCount - 1;
+    }
+    return (shift + 1) * kSubBuckets + (uint32_t)(us >> shift) - kSubBuckets;
+  }
+};
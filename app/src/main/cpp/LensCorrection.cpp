@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "LensCorrection.h"
+
+#include <android/log.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "CpuFeatures.h"
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "LensCorrection", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "LensCorrection", __VA_ARGS__)
+
+namespace {
+
+#if defined(__aarch64__)
+const bool kHasDotProd = (CpuFeatures::get().flags & CpuFeatures::kDotProd) != 0;
+#else
+constexpr bool kHasDotProd = false;
+#endif
+
+} // namespace
+
+bool DewarpMap::hasDotProd() {
+  return kHasDotProd;
+}
+
+bool DewarpMap::build(
+    const LensCalibration& lens,
+    int32_t sourceWidth,
+    int32_t sourceHeight,
+    int32_t width,
+    int32_t height) {
+  if (!entries_.empty() && lens == lens_ && sourceWidth == sourceWidth_ &&
+      sourceHeight == sourceHeight_ && width == width_ && height == height_) {
+    return true;
+  }
+  clear();
+  if (!lens.enabled() || sourceWidth < 2 || sourceHeight < 2 || width <= 0 || height <= 0) {
+    return false;
+  }
+  if (sourceWidth > kMaxSourceSize || sourceHeight > kMaxSourceSize) {
+    ULOGW("No lens correction for %dx%d sources", sourceWidth, sourceHeight);
+    return false;
+  }
+  entries_.resize((size_t)width * height * 2);
+  lens_ = lens;
+  sourceWidth_ = sourceWidth;
+  sourceHeight_ = sourceHeight;
+  width_ = width;
+  height_ = height;
+
+  // Source pixel coordinates have pixel centers on integers.
+  double focal = (double)lens.focal * sourceWidth;
+  double outputFocal = focal * lens.scale;
+  double centerX = (double)lens.centerX * sourceWidth - 0.5;
+  double centerY = (double)lens.centerY * sourceHeight - 0.5;
+  double scaleX = (double)sourceWidth / width;
+  double scaleY = (double)sourceHeight / height;
+  const std::array<float, 4>& k = lens.k;
+  double one = 1 << kFractionBits;
+  uint16_t* entry = entries_.data();
+  for (int32_t y = 0; y < height; y++) {
+    double py = ((y + 0.5) * scaleY - 0.5 - centerY) / outputFocal;
+    for (int32_t x = 0; x < width; x++, entry += 2) {
+      double px = ((x + 0.5) * scaleX - 0.5 - centerX) / outputFocal;
+      double r2 = px * px + py * py;
+      double distortion;
+      if (lens.model == LensCalibration::Model::FISHEYE) {
+        double r = std::sqrt(r2);
+        double theta = std::atan(r);
+        double t2 = theta * theta;
+        double thetaD = theta * (1 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3]))));
+        distortion = r > 1e-9 ? thetaD / r : 1.0;
+      } else {
+        distortion = 1 + r2 * (k[0] + r2 * (k[1] + r2 * (k[2] + r2 * k[3])));
+      }
+      double sx = px * distortion * focal + centerX;
+      double sy = py * distortion * focal + centerY;
+      if (!(sx > -0.5 && sy > -0.5 && sx < sourceWidth - 0.5 && sy < sourceHeight - 0.5)) {
+        entry[0] = kOutside;
+        entry[1] = 0;
+        continue;
+      }
+      entry[0] = (uint16_t)std::lround(std::clamp(sx, 0.0, sourceWidth - 1.0) * one);
+      entry[1] = (uint16_t)std::lround(std::clamp(sy, 0.0, sourceHeight - 1.0) * one);
+    }
+  }
+  ULOGI(
+      "Lens correction model %d %dx%d to %dx%d",
+      (int)lens.model,
+      sourceWidth,
+      sourceHeight,
+      width,
+      height);
+  return true;
+}
+
+void DewarpMap::remapRows(
+    const uint8_t* src,
+    size_t srcStride,
+    uint8_t* dst,
+    size_t dstStride,
+    int32_t row,
+    int32_t rows,
+    bool dotProd) const {
+  if (dotProd && kHasDotProd && remapRowsDotProd(src, srcStride, dst, dstStride, row, rows)) {
+    return;
+  }
+  constexpr uint32_t one = 1 << kFractionBits;
+  // Opaque black, in any 4 byte layout with alpha or padding last.
+  constexpr uint8_t kBlack[4] = {0, 0, 0, 0xff};
+  int32_t lastX = sourceWidth_ - 2;
+  int32_t lastY = sourceHeight_ - 2;
+  for (int32_t y = row; y < row + rows; y++) {
+    const uint16_t* entry = this->row(y);
+    uint8_t* out = dst + (size_t)y * dstStride;
+    for (int32_t x = 0; x < width_; x++, entry += 2, out += 4) {
+      if (entry[0] == kOutside) {
+        memcpy(out, kBlack, 4);
+        continue;
+      }
+      // The last column and row interpolate from the ones before, all the
+      // way to them.
+      int32_t x0 = std::min<int32_t>(entry[0] >> kFractionBits, lastX);
+      int32_t y0 = std::min<int32_t>(entry[1] >> kFractionBits, lastY);
+      uint32_t fx = entry[0] - x0 * one;
+      uint32_t fy = entry[1] - y0 * one;
+      const uint8_t* top = src + (size_t)y0 * srcStride + (size_t)x0 * 4;
+      const uint8_t* bottom = top + srcStride;
+#if defined(__ARM_NEON)
+      // Both pixels of each row in one vector, blended vertically as 8 bit
+      // by 8 bit products, then the halves horizontally.
+      uint16x8_t vertical = vmull_u8(vld1_u8(top), vdup_n_u8((uint8_t)(one - fy)));
+      vertical = vmlal_u8(vertical, vld1_u8(bottom), vdup_n_u8((uint8_t)fy));
+      uint32x4_t sum = vmull_n_u16(vget_low_u16(vertical), (uint16_t)(one - fx));
+      sum = vmlal_n_u16(sum, vget_high_u16(vertical), (uint16_t)fx);
+      uint16x4_t pixel = vrshrn_n_u32(sum, 2 * kFractionBits);
+      uint8x8_t packed = vmovn_u16(vcombine_u16(pixel, pixel));
+      vst1_lane_u32(reinterpret_cast<uint32_t*>(out), vreinterpret_u32_u8(packed), 0);
+#else
+      for (int32_t c = 0; c < 4; c++) {
+        uint32_t left = top[c] * (one - fy) + bottom[c] * fy;
+        uint32_t right = top[c + 4] * (one - fy) + bottom[c + 4] * fy;
+        uint32_t sum = left * (one - fx) + right * fx;
+        out[c] = (uint8_t)((sum + (1 << (2 * kFractionBits - 1))) >> (2 * kFractionBits));
+      }
+#endif
+    }
+  }
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lens distortion of a camera, from an OpenCV style calibration. Lengths are
+// relative to the image width, so one calibration applies at every
+// resolution of the same sensor area.
+struct LensCalibration {
+  enum class Model : uint8_t {
+    NONE,
+    // Brown-Conrady radial distortion, r * (1 + k1 r^2 + k2 r^4 + ...).
+    RADIAL,
+    // Kannala-Brandt, OpenCV's fisheye model: the angle of incidence theta
+    // imaged at theta * (1 + k1 theta^2 + k2 theta^4 + ...).
+    FISHEYE,
+  };
+
+  Model model{Model::NONE};
+  // Focal length and optical center, as fractions of the image width and
+  // height.
+  float focal{1.0f};
+  float centerX{0.5f};
+  float centerY{0.5f};
+  std::array<float, 4> k{};
+  // Focal length of the corrected image relative to the calibration's;
+  // below 1 keeps more of a wide field of view, leaving black corners.
+  float scale{1.0f};
+
+  bool enabled() const {
+    return model != Model::NONE && focal > 0 && scale > 0;
+  }
+
+  bool operator==(const LensCalibration&) const = default;
+};
+
+// Remap table undistorting a source image into an image of another size: for
+// each destination pixel the source position it samples, as 12.4 fixed point
+// x and y. Built once per calibration and pair of sizes, 4 bytes a pixel;
+// the CPU path gathers through it with remapRows() and the GL preview
+// uploads it as an RG16UI texture.
+class DewarpMap final {
+ public:
+  static constexpr int32_t kFractionBits = 4;
+  // Source sizes the 12 integer bits cover.
+  static constexpr int32_t kMaxSourceSize = 4095;
+  // X of destination pixels that sample outside the source, drawn black.
+  static constexpr uint16_t kOutside = 0xffff;
+
+  // Rebuilds the table unless it is already the one asked for. False, and
+  // empty, when the calibration is disabled or a size is out of range.
+  bool build(
+      const LensCalibration& lens,
+      int32_t sourceWidth,
+      int32_t sourceHeight,
+      int32_t width,
+      int32_t height);
+
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  int32_t width() const {
+    return width_;
+  }
+
+  int32_t height() const {
+    return height_;
+  }
+
+  // x, y pairs of the width destination pixels of row.
+  const uint16_t* row(int32_t row) const {
+    return entries_.data() + (size_t)row * width_ * 2;
+  }
+
+  size_t bytes() const {
+    return entries_.capacity() * sizeof(uint16_t);
+  }
+
+  void clear() {
+    std::vector<uint16_t>().swap(entries_);
+    width_ = height_ = 0;
+  }
+
+  // Writes the rows [row, row + rows) of dst, bilinearly interpolated from
+  // the 4 byte pixels of the source image the table was built for, with NEON
+  // where available, and its dotprod variant on CPUs that have it unless
+  // dotProd is false. The two write the same bytes. Disjoint rows may be
+  // written concurrently.
+  void remapRows(
+      const uint8_t* src,
+      size_t srcStride,
+      uint8_t* dst,
+      size_t dstStride,
+      int32_t row,
+      int32_t rows,
+      bool dotProd = true) const;
+
+  // Whether remapRows() runs the dotprod variant here.
+  static bool hasDotProd();
+
+ private:
+  // In LensCorrectionDotProd.cpp; false, doing nothing, in builds without it.
+  bool remapRowsDotProd(
+      const uint8_t* src,
+      size_t srcStride,
+      uint8_t* dst,
+      size_t dstStride,
+      int32_t row,
+      int32_t rows) const;
+
+  std::vector<uint16_t> entries_{};
+  LensCalibration lens_{};
+  int32_t sourceWidth_{};
+  int32_t sourceHeight_{};
+  int32_t width_{};
+  int32_t height_{};
+};
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LensCorrection.h"
+
+// Built with -march=armv8.2-a+dotprod on arm64, see CMakeLists.txt, and only
+// called on CPUs CpuFeatures reports dotprod for.
+#if defined(__ARM_FEATURE_DOTPROD)
+#include <arm_neon.h>
+
+#include <algorithm>
+
+namespace {
+
+constexpr int32_t kFractionBits = DewarpMap::kFractionBits;
+constexpr uint32_t kOne = 1 << kFractionBits;
+
+// The top left, top right, bottom left and bottom right taps of each channel
+// gathered into one 32 bit lane, in the order of the packed weights.
+constexpr uint8_t kTapsByChannel[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+
+// The four channels of a destination pixel, scaled by kOne * kOne.
+inline uint32x4_t sample(
+    const uint8_t* src,
+    size_t srcStride,
+    const uint16_t* entry,
+    int32_t lastX,
+    int32_t lastY,
+    uint8x16_t taps) {
+  if (entry[0] == DewarpMap::kOutside) {
+    // Opaque black, in any 4 byte layout with alpha or padding last.
+    return uint32x4_t{0, 0, 0, 0xffu << (2 * kFractionBits)};
+  }
+  int32_t x0 = std::min<int32_t>(entry[0] >> kFractionBits, lastX);
+  int32_t y0 = std::min<int32_t>(entry[1] >> kFractionBits, lastY);
+  uint32_t fx = entry[0] - x0 * kOne;
+  uint32_t fy = entry[1] - y0 * kOne;
+  const uint8_t* top = src + (size_t)y0 * srcStride + (size_t)x0 * 4;
+  if (fx % kOne == 0 && fy % kOne == 0) {
+    // On a source pixel its weight, kOne * kOne, does not fit a byte.
+    const uint8_t* pixel = top + (fy ? srcStride : 0) + (fx ? 4 : 0);
+    return vshll_n_u16(vget_low_u16(vmovl_u8(vld1_u8(pixel))), 2 * kFractionBits);
+  }
+  uint32_t weights = ((kOne - fx) * (kOne - fy)) | ((fx * (kOne - fy)) << 8) |
+      (((kOne - fx) * fy) << 16) | ((fx * fy) << 24);
+  uint8x16_t pixels = vqtbl1q_u8(vcombine_u8(vld1_u8(top), vld1_u8(top + srcStride)), taps);
+  return vdotq_u32(vdupq_n_u32(0), pixels, vreinterpretq_u8_u32(vdupq_n_u32(weights)));
+}
+
+} // namespace
+
+// The same sums as the NEON loop, a dot product of the four taps with their
+// weights per channel, so the output is bit exact with it.
+bool DewarpMap::remapRowsDotProd(
+    const uint8_t* src,
+    size_t srcStride,
+    uint8_t* dst,
+    size_t dstStride,
+    int32_t row,
+    int32_t rows) const {
+  const uint8x16_t taps = vld1q_u8(kTapsByChannel);
+  int32_t lastX = sourceWidth_ - 2;
+  int32_t lastY = sourceHeight_ - 2;
+  for (int32_t y = row; y < row + rows; y++) {
+    const uint16_t* entry = this->row(y);
+    uint8_t* out = dst + (size_t)y * dstStride;
+    int32_t x = 0;
+    // Four pixels narrowed and stored together.
+    for (; x + 4 <= width_; x += 4, entry += 8, out += 16) {
+      uint32x4_t p0 = sample(src, srcStride, entry, lastX, lastY, taps);
+      uint32x4_t p1 = sample(src, srcStride, entry + 2, lastX, lastY, taps);
+      uint32x4_t p2 = sample(src, srcStride, entry + 4, lastX, lastY, taps);
+      uint32x4_t p3 = sample(src, srcStride, entry + 6, lastX, lastY, taps);
+      uint16x8_t low = vcombine_u16(
+          vrshrn_n_u32(p0, 2 * kFractionBits), vrshrn_n_u32(p1, 2 * kFractionBits));
+      uint16x8_t high = vcombine_u16(
+          vrshrn_n_u32(p2, 2 * kFractionBits), vrshrn_n_u32(p3, 2 * kFractionBits));
+      vst1q_u8(out, vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+    }
+    for (; x < width_; x++, entry += 2, out += 4) {
+      uint16x4_t pixel =
+          vrshrn_n_u32(sample(src, srcStride, entry, lastX, lastY, taps), 2 * kFractionBits);
+      uint8x8_t packed = vmovn_u16(vcombine_u16(pixel, pixel));
+      vst1_lane_u32(reinterpret_cast<uint32_t*>(out), vreinterpret_u32_u8(packed), 0);
+    }
+  }
+  return true;
+}
+
+#else
+
+bool DewarpMap::remapRowsDotProd(
+    const uint8_t* /* src */,
+    size_t /* srcStride */,
+    uint8_t* /* dst */,
+    size_t /* dstStride */,
+    int32_t /* row */,
+    int32_t /* rows */) const {
+  return false;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "LibraryLoad.h"
+
+#include <android/log.h>
+#include <dlfcn.h>
+#include <link.h>
+
+#include <atomic>
+#include <cstring>
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "LibraryLoad", __VA_ARGS__)
+
+namespace {
+
+std::atomic<int64_t> loadUs_{0};
+std::atomic<int64_t> onLoadUs_{0};
+std::atomic<uint64_t> mappedBytes_{0};
+
+// Sums the PT_LOAD segments of the library holding this function.
+uint64_t segmentBytes() {
+  Dl_info self{};
+  if (dladdr(reinterpret_cast<void*>(&segmentBytes), &self) == 0 || self.dli_fname == nullptr) {
+    return 0;
+  }
+  struct Search {
+    const char* name;
+    uint64_t bytes;
+  } search{self.dli_fname, 0};
+  dl_iterate_phdr(
+      [](dl_phdr_info* info, size_t, void* data) {
+        auto* search = static_cast<Search*>(data);
+        if (info->dlpi_name == nullptr || strcmp(info->dlpi_name, search->name) != 0) {
+          return 0;
+        }
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+          if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            search->bytes += info->dlpi_phdr[i].p_memsz;
+          }
+        }
+        return 1;
+      },
+      &search);
+  return search.bytes;
+}
+
+} // namespace
+
+void LibraryLoad::recordOnLoad(steady_clock::time_point begin) {
+  mappedBytes_ = segmentBytes();
+  onLoadUs_ = duration_cast<microseconds>(steady_clock::now() - begin).count();
+}
+
+void LibraryLoad::recordLoad(int64_t loadUs) {
+  loadUs_ = loadUs;
+  ULOGI(
+      "Loaded in %.2f ms, JNI_OnLoad %.2f ms, %llu KB mapped",
+      loadUs / 1000.0,
+      onLoadUs_ / 1000.0,
+      (unsigned long long)mappedBytes_ / 1024);
+}
+
+LibraryLoad LibraryLoad::get() {
+  return {loadUs_, onLoadUs_, mappedBytes_};
+}
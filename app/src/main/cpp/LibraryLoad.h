@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+using namespace std::chrono;
+
+// Startup cost of libusbvideo.so, published with the process wide counters
+// of StreamingStats and logged once the app reports its part.
+struct LibraryLoad {
+  // System.loadLibrary() as the app timed it, 0 until it reported it.
+  int64_t loadUs{};
+  // The part of it JNI_OnLoad took.
+  int64_t onLoadUs{};
+  // What the library's loadable segments map: code, data and relocations.
+  uint64_t mappedBytes{};
+
+  // From JNI_OnLoad, which began at begin.
+  static void recordOnLoad(steady_clock::time_point begin);
+  // From the app, once System.loadLibrary() returned.
+  static void recordLoad(int64_t loadUs);
+  // Any thread.
+  static LibraryLoad get();
+};
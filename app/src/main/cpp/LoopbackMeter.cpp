@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "LoopbackMeter.h"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr double kNsPerSecond = 1e9;
+
+LoopbackMeter::LoopbackMeter() {
+  // x^11 + x^9 + 1 is primitive, so the register runs through every nonzero
+  // state once per period.
+  uint32_t state = 1;
+  for (int8_t& chip : sequence_) {
+    uint32_t bit = ((state >> 10) ^ (state >> 8)) & 1;
+    state = ((state << 1) | bit) & kSequenceLength;
+    chip = (state & 1) != 0 ? 1 : -1;
+  }
+}
+
+bool LoopbackMeter::start(
+    uint32_t bursts,
+    uint32_t outputRate,
+    uint32_t outputChannels,
+    uint32_t inputRate,
+    uint32_t inputChannels) {
+  if (bursts == 0 || bursts > kMaxBursts || outputRate == 0 || outputChannels == 0 ||
+      inputRate == 0 || inputChannels == 0) {
+    return false;
+  }
+  std::lock_guard control(controlMutex_);
+  std::lock_guard lock(mutex_);
+  outputRate_ = outputRate;
+  outputChannels_ = outputChannels;
+  inputRate_ = inputRate;
+  inputChannels_ = inputChannels;
+  chipRate_ = std::min(outputRate, inputRate);
+  probeFrames_ = ((uint64_t)kSequenceLength * outputRate + chipRate_ - 1) / chipRate_;
+  windowSamples_ = (size_t)inputRate * kWindowMs / 1000;
+  // Allocated here, so the audio threads only fill them.
+  bursts_.assign(bursts, Burst{});
+  for (Burst& burst : bursts_) {
+    burst.window.resize(windowSamples_);
+    burst.transfers.reserve(kMaxWindowTransfers);
+  }
+  nextBurst_ = 0;
+  probePosition_ = -1;
+  silentFrames_ = 0;
+  capturing_ = 0;
+  emitted_.store(0, std::memory_order_relaxed);
+  captured_.store(0, std::memory_order_relaxed);
+  active_.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+void LoopbackMeter::cancel() {
+  std::lock_guard control(controlMutex_);
+  std::lock_guard lock(mutex_);
+  active_.store(false, std::memory_order_relaxed);
+}
+
+bool LoopbackMeter::render(
+    float* out,
+    size_t frames,
+    int64_t streamFrame,
+    int64_t writeNs,
+    int64_t bufferedNs) {
+  std::unique_lock lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock() || !active_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  int64_t gapFrames = (int64_t)outputRate_ * kGapMs / 1000;
+  for (size_t i = 0; i < frames; i++) {
+    // The next burst waits for the previous one's window, so each window
+    // only holds its own.
+    if (probePosition_ < 0 && nextBurst_ < bursts_.size() && silentFrames_ >= gapFrames &&
+        captured_.load(std::memory_order_acquire) >= nextBurst_) {
+      Burst& burst = bursts_[nextBurst_];
+      burst.streamFrame = streamFrame + (int64_t)i;
+      // As though the stream were handed over frame by frame.
+      burst.writeNs = writeNs + (int64_t)(i * kNsPerSecond / outputRate_);
+      burst.bufferedNs = bufferedNs;
+      probePosition_ = 0;
+      emitted_.store(++nextBurst_, std::memory_order_release);
+    }
+    float value = 0.0f;
+    if (probePosition_ >= 0) {
+      value = kLevel * sequence_[(uint64_t)probePosition_ * chipRate_ / outputRate_];
+      if (++probePosition_ == (int64_t)probeFrames_) {
+        probePosition_ = -1;
+        silentFrames_ = 0;
+      }
+    } else {
+      silentFrames_++;
+    }
+    std::fill(out, out + outputChannels_, value);
+    out += outputChannels_;
+  }
+  return true;
+}
+
+void LoopbackMeter::capture(const float* in, size_t frames, int64_t completionNs) {
+  std::unique_lock lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock() || !active_.load(std::memory_order_relaxed) ||
+      capturing_ >= bursts_.size() || emitted_.load(std::memory_order_acquire) <= capturing_) {
+    return;
+  }
+  Burst& burst = bursts_[capturing_];
+  // Nothing in a transfer that completed before the burst was played.
+  if (burst.samples == 0 && completionNs < burst.writeNs) {
+    return;
+  }
+  size_t taken = std::min(frames, windowSamples_ - burst.samples);
+  float* window = burst.window.data() + burst.samples;
+  for (size_t i = 0; i < taken; i++) {
+    float sum = 0.0f;
+    for (uint32_t c = 0; c < inputChannels_; c++) {
+      sum += in[i * inputChannels_ + c];
+    }
+    window[i] = sum;
+  }
+  burst.transfers.emplace_back(burst.samples + frames, completionNs);
+  burst.samples += taken;
+  if (burst.samples < windowSamples_ && burst.transfers.size() < kMaxWindowTransfers) {
+    return;
+  }
+  burst.timestampFrame = timestampFrame_;
+  burst.timestampNs = timestampNs_;
+  captured_.store(++capturing_, std::memory_order_release);
+  if (capturing_ == bursts_.size()) {
+    active_.store(false, std::memory_order_relaxed);
+  }
+}
+
+void LoopbackMeter::recordOutputTimestamp(int64_t framePosition, int64_t timeNs) {
+  timestampFrame_ = framePosition;
+  timestampNs_ = timeNs;
+}
+
+void LoopbackMeter::analyze(Burst& burst) const {
+  burst.analyzed = true;
+  // The sequence as the input samples it.
+  size_t referenceSamples = ((uint64_t)kSequenceLength * inputRate_ + chipRate_ - 1) / chipRate_;
+  if (burst.samples < referenceSamples + 2) {
+    return;
+  }
+  std::vector<float> reference(referenceSamples);
+  for (size_t i = 0; i < referenceSamples; i++) {
+    reference[i] = sequence_[(uint64_t)i * chipRate_ / inputRate_];
+  }
+  size_t lags = burst.samples - referenceSamples + 1;
+  std::vector<float> correlation(lags);
+  double sumSquares = 0;
+  size_t peak = 0;
+  for (size_t lag = 0; lag < lags; lag++) {
+    const float* window = burst.window.data() + lag;
+    float sum = 0.0f;
+    for (size_t i = 0; i < referenceSamples; i++) {
+      sum += reference[i] * window[i];
+    }
+    // Either polarity: speakers and microphones may invert.
+    correlation[lag] = std::abs(sum);
+    sumSquares += (double)sum * sum;
+    if (correlation[lag] > correlation[peak]) {
+      peak = lag;
+    }
+  }
+  double rms = std::sqrt(sumSquares / lags);
+  burst.peakRatio = rms > 0 ? correlation[peak] / rms : 0;
+  if (burst.peakRatio < kMinPeakRatio) {
+    return;
+  }
+  // Vertex of the parabola through the peak and its neighbours.
+  double onset = (double)peak;
+  if (peak > 0 && peak + 1 < lags) {
+    double before = correlation[peak - 1];
+    double at = correlation[peak];
+    double after = correlation[peak + 1];
+    double curvature = before - 2 * at + after;
+    if (curvature < 0) {
+      onset += 0.5 * (before - after) / curvature;
+    }
+  }
+  // A sample reached the host about the audio after it in its transfer
+  // before the transfer completed.
+  auto transfer = std::find_if(
+      burst.transfers.begin(),
+      burst.transfers.end(),
+      [onset](const std::pair<size_t, int64_t>& entry) { return (double)entry.first > onset; });
+  if (transfer == burst.transfers.end()) {
+    return;
+  }
+  double arrivedNs =
+      transfer->second - ((double)transfer->first - onset) * kNsPerSecond / inputRate_;
+  burst.detected = true;
+  burst.roundTripNs = arrivedNs - burst.writeNs;
+  if (burst.timestampNs >= 0) {
+    double presentedNs = burst.timestampNs +
+        (double)(burst.streamFrame - burst.timestampFrame) * kNsPerSecond / outputRate_;
+    burst.outputNs = presentedNs - burst.writeNs;
+  }
+}
+
+bool LoopbackMeter::report(Report& report) {
+  std::lock_guard control(controlMutex_);
+  size_t captured = captured_.load(std::memory_order_acquire);
+  report = Report{};
+  report.bursts = (uint32_t)bursts_.size();
+  report.captured = (uint32_t)captured;
+  if (captured == 0) {
+    return false;
+  }
+  double sum = 0;
+  double sumSquares = 0;
+  double outputSum = 0;
+  uint32_t timestamped = 0;
+  double bufferedSum = 0;
+  double peakSum = 0;
+  for (size_t i = 0; i < captured; i++) {
+    Burst& burst = bursts_[i];
+    if (!burst.analyzed) {
+      analyze(burst);
+    }
+    if (!burst.detected) {
+      continue;
+    }
+    double ms = burst.roundTripNs / 1e6;
+    report.roundTripMinMs = report.detected == 0 ? ms : std::min(report.roundTripMinMs, ms);
+    report.roundTripMaxMs = report.detected == 0 ? ms : std::max(report.roundTripMaxMs, ms);
+    report.detected++;
+    sum += ms;
+    sumSquares += ms * ms;
+    bufferedSum += burst.bufferedNs / 1e6;
+    peakSum += burst.peakRatio;
+    if (burst.timestampNs >= 0) {
+      outputSum += burst.outputNs / 1e6;
+      timestamped++;
+    }
+  }
+  if (report.detected > 0) {
+    uint32_t n = report.detected;
+    report.roundTripMs = sum / n;
+    double variance = sumSquares / n - report.roundTripMs * report.roundTripMs;
+    report.jitterMs = std::sqrt(std::max(0.0, variance));
+    report.passThroughMs = report.roundTripMs + bufferedSum / n;
+    report.peakRatio = peakSum / n;
+  }
+  if (timestamped > 0) {
+    report.outputMs = outputSum / timestamped;
+    report.inputMs = report.roundTripMs - report.outputMs;
+  }
+  return true;
+}
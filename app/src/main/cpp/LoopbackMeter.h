@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Measures the acoustic round trip from the phone's speaker to the USB
+// microphone and back into the app, for hard latency numbers per phone.
+//
+// Each burst plays a maximum length sequence through the AAudio stream in
+// place of the microphone's audio, then records what the microphone picks up
+// for kWindowMs. Cross-correlating that against the sequence finds when it
+// arrived, to a fraction of an input sample. The playback callback notes when
+// it handed each burst to AAudio and how long microphone audio was buffered
+// at the time; the USB completions and AAudio's latest timestamp place the
+// input and the output on the same steady clock.
+//
+// render() runs on the playback callback and capture() and
+// recordOutputTimestamp() on the USB event thread; neither blocks, they skip
+// a call when start() or cancel() holds the meter. report() correlates on the
+// calling thread.
+class LoopbackMeter final {
+ public:
+  static constexpr uint32_t kSequenceOrder = 11;
+  static constexpr size_t kSequenceLength = (1u << kSequenceOrder) - 1;
+  static constexpr float kLevel = 0.25f;
+  // Longest round trip measured.
+  static constexpr uint32_t kWindowMs = 500;
+  // Silence before each burst, for the room to quiet down.
+  static constexpr uint32_t kGapMs = 200;
+  // How far the correlation peak must stand above its RMS to count.
+  static constexpr float kMinPeakRatio = 8.0f;
+  static constexpr uint32_t kMaxBursts = 100;
+  // Transfers recorded per window, at least one a millisecond.
+  static constexpr size_t kMaxWindowTransfers = 2 * kWindowMs;
+
+  // Times in milliseconds over the bursts detected.
+  struct Report {
+    uint32_t bursts{};
+    uint32_t captured{};
+    uint32_t detected{};
+    // Handed to AAudio until back from USB.
+    double roundTripMs{};
+    double roundTripMinMs{};
+    double roundTripMaxMs{};
+    // Standard deviation of the round trip.
+    double jitterMs{};
+    // Handed to AAudio until presented, from AAudio's timestamps, and the
+    // rest of the round trip, from the speaker through the microphone and
+    // USB. Zero output without a timestamp.
+    double outputMs{};
+    double inputMs{};
+    // Microphone to speaker as the app plays it: the round trip plus the
+    // microphone audio buffered ahead of AAudio.
+    double passThroughMs{};
+    // Mean of the detected correlation peaks over their RMS.
+    double peakRatio{};
+  };
+
+  LoopbackMeter();
+  LoopbackMeter(const LoopbackMeter&) = delete;
+  LoopbackMeter& operator=(const LoopbackMeter&) = delete;
+
+  // Starts over with bursts bursts, up to kMaxBursts, between a stream of
+  // outputChannels at outputRate and a USB input of inputChannels at
+  // inputRate.
+  bool start(
+      uint32_t bursts,
+      uint32_t outputRate,
+      uint32_t outputChannels,
+      uint32_t inputRate,
+      uint32_t inputChannels);
+  void cancel();
+  // Until every burst was captured.
+  bool active() const {
+    return active_.load(std::memory_order_relaxed);
+  }
+
+  // Fills frames interleaved output frames with the sequence while a burst
+  // plays and silence otherwise. streamFrame is the stream position of the
+  // first, writeNs when AAudio gets them and bufferedNs how long microphone
+  // audio waits to play. Returns false when the meter is not active, leaving
+  // out alone.
+  bool render(float* out, size_t frames, int64_t streamFrame, int64_t writeNs, int64_t bufferedNs);
+  // Interleaved input frames of a transfer that completed at completionNs.
+  void capture(const float* in, size_t frames, int64_t completionNs);
+  void recordOutputTimestamp(int64_t framePosition, int64_t timeNs);
+
+  // Of the bursts captured so far; false when none was.
+  bool report(Report& report);
+
+ private:
+  struct Burst {
+    // Written by render() before emitted_ counts it.
+    int64_t streamFrame{};
+    int64_t writeNs{};
+    int64_t bufferedNs{};
+    // Written by capture() before captured_ counts it.
+    std::vector<float> window{};
+    size_t samples{};
+    // Input samples up to the end of each transfer, and when it completed.
+    std::vector<std::pair<size_t, int64_t>> transfers{};
+    int64_t timestampFrame{};
+    int64_t timestampNs{-1};
+    // Filled by report().
+    bool analyzed{false};
+    bool detected{false};
+    double roundTripNs{};
+    double outputNs{};
+    double peakRatio{};
+  };
+
+  // +1 and -1 chips.
+  std::array<int8_t, kSequenceLength> sequence_{};
+  // Held by start() and cancel(); the audio threads only try it.
+  std::mutex mutex_;
+  // Serializes start(), cancel() and report().
+  std::mutex controlMutex_;
+  std::atomic<bool> active_{false};
+  std::vector<Burst> bursts_{};
+  uint32_t outputRate_{};
+  uint32_t outputChannels_{};
+  uint32_t inputRate_{};
+  uint32_t inputChannels_{};
+  // Chips per second, the slower of the two rates.
+  uint32_t chipRate_{};
+  size_t probeFrames_{};
+  size_t windowSamples_{};
+  // Playback callback only.
+  size_t nextBurst_{};
+  int64_t probePosition_{-1};
+  int64_t silentFrames_{};
+  // Event thread only.
+  size_t capturing_{};
+  int64_t timestampFrame_{};
+  int64_t timestampNs_{-1};
+  std::atomic<size_t> emitted_{};
+  std::atomic<size_t> captured_{};
+
+  void analyze(Burst& burst) const;
+};
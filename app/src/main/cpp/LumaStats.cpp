@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "LumaStats.h"
+
+float LumaStats::mean() const {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < kBins; i++) {
+    sum += (uint64_t)histogram[i] * i;
+  }
+  return samples > 0 ? (float)sum / samples : 0.0f;
+}
+
+float LumaStats::darkClipped() const {
+  uint32_t clipped = 0;
+  for (size_t i = 0; i <= black; i++) {
+    clipped += histogram[i];
+  }
+  return samples > 0 ? (float)clipped / samples : 0.0f;
+}
+
+float LumaStats::brightClipped() const {
+  uint32_t clipped = 0;
+  for (size_t i = white; i < kBins; i++) {
+    clipped += histogram[i];
+  }
+  return samples > 0 ? (float)clipped / samples : 0.0f;
+}
+
+void LumaStats::fold(uint32_t* out, size_t bins) const {
+  size_t width = kBins / bins;
+  for (size_t i = 0; i < bins; i++) {
+    uint32_t sum = 0;
+    for (size_t j = 0; j < width; j++) {
+      sum += histogram[i * width + j];
+    }
+    out[i] = sum;
+  }
+}
+
+bool LumaAccumulator::supportsFormat(uvc_frame_format format) {
+  return format == UVC_FRAME_FORMAT_YUYV || format == UVC_FRAME_FORMAT_UYVY ||
+      format == UVC_FRAME_FORMAT_NV12;
+}
+
+void LumaAccumulator::reset(uint32_t sequence, int32_t height) {
+  for (std::atomic<uint32_t>& bin : bins_) {
+    bin.store(0, std::memory_order_relaxed);
+  }
+  rows_.store(0, std::memory_order_relaxed);
+  height_ = height;
+  sequence_ = sequence;
+}
+
+void LumaAccumulator::countRows(
+    const uvc_frame_t* frame,
+    int32_t row,
+    int32_t rows,
+    uint32_t* bins) {
+  // Every other pixel: the first Y of each YUYV or UYVY pair, every other
+  // byte of the NV12 luma plane.
+  size_t offset = frame->frame_format == UVC_FRAME_FORMAT_UYVY ? 1 : 0;
+  size_t pixelBytes = frame->frame_format == UVC_FRAME_FORMAT_NV12 ? 2 : 4;
+  size_t rowBytes = (size_t)frame->width / 2 * pixelBytes;
+  const auto* data = static_cast<const uint8_t*>(frame->data);
+  for (int32_t y = (row + 1) & ~1; y < row + rows; y += 2) {
+    const uint8_t* luma = data + (size_t)y * frame->step + offset;
+    for (size_t x = 0; x < rowBytes; x += pixelBytes) {
+      bins[luma[x]]++;
+    }
+  }
+}
+
+void LumaAccumulator::merge(const uint32_t* bins, int32_t rows) {
+  for (size_t i = 0; i < LumaStats::kBins; i++) {
+    if (bins[i] != 0) {
+      bins_[i].fetch_add(bins[i], std::memory_order_relaxed);
+    }
+  }
+  rows_.fetch_add(rows, std::memory_order_release);
+}
+
+bool LumaAccumulator::collect(bool fullRange, LumaStats& stats) const {
+  if (height_ <= 0 || rows_.load(std::memory_order_acquire) != height_) {
+    return false;
+  }
+  stats.sequence = sequence_;
+  stats.samples = 0;
+  for (size_t i = 0; i < LumaStats::kBins; i++) {
+    stats.histogram[i] = bins_[i].load(std::memory_order_relaxed);
+    stats.samples += stats.histogram[i];
+  }
+  stats.black = fullRange ? 0 : 16;
+  stats.white = fullRange ? 255 : 235;
+  return true;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Luma histogram of a frame, for exposure hints and brightness alarms.
+struct LumaStats {
+  static constexpr size_t kBins = 256;
+
+  uint32_t sequence{};
+  std::array<uint32_t, kBins> histogram{};
+  uint32_t samples{};
+  // Codes at or beyond which luma counts as clipped: 16 and 235 for limited
+  // range streams, 0 and 255 for full range ones.
+  uint8_t black{16};
+  uint8_t white{235};
+
+  // In 8 bit codes.
+  float mean() const;
+  // Shares of the samples at or below black and at or above white.
+  float darkClipped() const;
+  float brightClipped() const;
+  // Sums kBins / bins neighbouring bins into each of bins, a divisor of kBins.
+  void fold(uint32_t* out, size_t bins) const;
+};
+
+// Gathers LumaStats from the rows of a frame while FrameConverter converts
+// them, so the luma is read once, from cache, by both. Samples every other
+// pixel of every other row of YUYV, UYVY and NV12 frames.
+//
+// Each conversion stripe counts its rows into a table of its own and merges
+// it once, so stripes converted concurrently do not contend.
+class LumaAccumulator final {
+ public:
+  static bool supportsFormat(uvc_frame_format format);
+
+  // Starts a frame of height rows.
+  void reset(uint32_t sequence, int32_t height);
+
+  // Counts the samples of rows [row, row + rows) into bins, of kBins.
+  static void countRows(const uvc_frame_t* frame, int32_t row, int32_t rows, uint32_t* bins);
+
+  // Adds what countRows() counted for rows rows. Any thread.
+  void merge(const uint32_t* bins, int32_t rows);
+
+  uint32_t sequence() const {
+    return sequence_;
+  }
+
+  // Whether every row of the frame was counted exactly once, and its stats
+  // when so.
+  bool collect(bool fullRange, LumaStats& stats) const;
+
+ private:
+  std::array<std::atomic<uint32_t>, LumaStats::kBins> bins_{};
+  std::atomic<int32_t> rows_{};
+  int32_t height_{};
+  uint32_t sequence_{};
+};
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MediaCodecDecoder.h"
+
+#include <android/log.h>
+#include <media/NdkMediaFormat.h>
+
+#include <cstring>
+
+#include "JpegEntropyDecoder.h"
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "MediaCodecDecoder", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "MediaCodecDecoder", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "MediaCodecDecoder", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "MediaCodecDecoder", __VA_ARGS__)
+
+static const char* mimeTypeFor(uvc_frame_format format) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_H264:
+      return "video/avc";
+    case UVC_FRAME_FORMAT_H265:
+      return "video/hevc";
+    case UVC_FRAME_FORMAT_VP8:
+      return "video/x-vnd.on2.vp8";
+    case UVC_FRAME_FORMAT_VP9:
+      return "video/x-vnd.on2.vp9";
+    case UVC_FRAME_FORMAT_MJPEG:
+      return "video/mjpeg"; // vendor decoders only, AOSP has none
+    default:
+      return nullptr;
+  }
+}
+
+static bool startsWithSoi(const uint8_t* data, size_t size) {
+  return size >= 2 && data[0] == 0xFF && data[1] == 0xD8;
+}
+
+// Offset of the SOS marker, or 0 when the frame is not a JPEG, has no scan or
+// already carries a DHT segment and needs none inserted.
+static size_t missingHuffmanTablesOffset(const uint8_t* data, size_t size) {
+  if (!startsWithSoi(data, size)) {
+    return 0;
+  }
+  size_t offset = 2;
+  while (offset + 4 <= size && data[offset] == 0xFF) {
+    uint8_t marker = data[offset + 1];
+    if (marker == 0xC4) {
+      return 0;
+    }
+    if (marker == 0xDA) {
+      return offset;
+    }
+    offset += 2 + (data[offset + 2] << 8 | data[offset + 3]);
+  }
+  return 0;
+}
+
+bool MediaCodecDecoder::supportsFormat(uvc_frame_format format) {
+  return mimeTypeFor(format) != nullptr;
+}
+
+MediaCodecDecoder::~MediaCodecDecoder() {
+  if (codec_ == nullptr) {
+    return;
+  }
+  if (started_) {
+    AMediaCodec_stop(codec_);
+  }
+  AMediaCodec_delete(codec_);
+}
+
+bool MediaCodecDecoder::init(
+    ANativeWindow* window,
+    int32_t width,
+    int32_t height,
+    uvc_frame_format format,
+    uint32_t maxFrameSize) {
+  const char* mimeType = mimeTypeFor(format);
+  if (mimeType == nullptr) {
+    ULOGE("Unsupported frame format %d", format);
+    return false;
+  }
+  codec_ = AMediaCodec_createDecoderByType(mimeType);
+  if (codec_ == nullptr) {
+    ULOGE("No %s decoder", mimeType);
+    return false;
+  }
+
+  // The codec sizes and formats the window buffers itself.
+  ANativeWindow_setBuffersGeometry(window, 0, 0, 0);
+  AMediaFormat* mediaFormat = AMediaFormat_new();
+  AMediaFormat_setString(mediaFormat, AMEDIAFORMAT_KEY_MIME, mimeType);
+  AMediaFormat_setInt32(mediaFormat, AMEDIAFORMAT_KEY_WIDTH, width);
+  AMediaFormat_setInt32(mediaFormat, AMEDIAFORMAT_KEY_HEIGHT, height);
+  if (maxFrameSize > 0) {
+    if (format == UVC_FRAME_FORMAT_MJPEG) {
+      maxFrameSize += sizeof(kJpegDefaultHuffmanTables);
+    }
+    AMediaFormat_setInt32(mediaFormat, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, (int32_t)maxFrameSize);
+  }
+  // Output each frame as soon as it is decoded instead of filling the
+  // codec's reorder queue; camera streams carry no B frames.
+  AMediaFormat_setInt32(mediaFormat, AMEDIAFORMAT_KEY_LOW_LATENCY, 1);
+  AMediaFormat_setInt32(mediaFormat, AMEDIAFORMAT_KEY_PRIORITY, 0); // realtime
+  media_status_t status = AMediaCodec_configure(codec_, mediaFormat, window, nullptr, 0);
+  AMediaFormat_delete(mediaFormat);
+  if (status != AMEDIA_OK) {
+    ULOGE("AMediaCodec_configure %s %dx%d error %d", mimeType, width, height, status);
+    return false;
+  }
+  status = AMediaCodec_start(codec_);
+  if (status != AMEDIA_OK) {
+    ULOGE("AMediaCodec_start error %d", status);
+    return false;
+  }
+  started_ = true;
+  ULOGI("Decoding %s %dx%d to the preview window", mimeType, width, height);
+  return true;
+}
+
+bool MediaCodecDecoder::setWindow(ANativeWindow* window) {
+  if (window == nullptr) {
+    return true;
+  }
+  ANativeWindow_setBuffersGeometry(window, 0, 0, 0);
+  media_status_t status = AMediaCodec_setOutputSurface(codec_, window);
+  if (status != AMEDIA_OK) {
+    ULOGE("AMediaCodec_setOutputSurface error %d", status);
+    return false;
+  }
+  return true;
+}
+
+bool MediaCodecDecoder::queueFrame(const uvc_frame_t* frame) {
+  TRACE_SCOPE("queueCodecInput");
+  const uint8_t* data = (const uint8_t*)frame->data;
+  bool mjpeg = frame->frame_format == UVC_FRAME_FORMAT_MJPEG;
+  if (mjpeg && !startsWithSoi(data, frame->data_bytes)) {
+    // An error frame or a stray payload, nothing a decoder can use.
+    ULOGW("Frame %u of %zu bytes is not a JPEG", frame->sequence, frame->data_bytes);
+    return false;
+  }
+  // Free up output buffers first so the codec has room to take more input.
+  renderDecodedFrames();
+  ssize_t index = AMediaCodec_dequeueInputBuffer(codec_, kInputTimeoutUs);
+  if (index < 0) {
+    renderDecodedFrames();
+    index = AMediaCodec_dequeueInputBuffer(codec_, 0);
+  }
+  if (index < 0) {
+    return false;
+  }
+  size_t capacity;
+  uint8_t* input = AMediaCodec_getInputBuffer(codec_, index, &capacity);
+  size_t tablesOffset = mjpeg ? missingHuffmanTablesOffset(data, frame->data_bytes) : 0;
+  size_t size = frame->data_bytes + (tablesOffset > 0 ? sizeof(kJpegDefaultHuffmanTables) : 0);
+  if (input == nullptr || size > capacity) {
+    ULOGE(
+        "Frame %u of %zu bytes does not fit codec input %zu",
+        frame->sequence,
+        size,
+        input == nullptr ? 0 : capacity);
+    AMediaCodec_queueInputBuffer(codec_, index, 0, 0, 0, 0);
+    return false;
+  }
+  // The tables go in with the copy the codec input needs anyway.
+  if (tablesOffset > 0) {
+    memcpy(input, data, tablesOffset);
+    memcpy(input + tablesOffset, kJpegDefaultHuffmanTables, sizeof(kJpegDefaultHuffmanTables));
+    memcpy(
+        input + tablesOffset + sizeof(kJpegDefaultHuffmanTables),
+        data + tablesOffset,
+        frame->data_bytes - tablesOffset);
+  } else {
+    memcpy(input, data, frame->data_bytes);
+  }
+  uint64_t ptsUs = frame->capture_time_finished.tv_sec * 1'000'000ULL +
+      frame->capture_time_finished.tv_nsec / 1'000;
+  media_status_t status =
+      AMediaCodec_queueInputBuffer(codec_, index, 0, size, ptsUs, 0);
+  if (status != AMEDIA_OK) {
+    ULOGE("AMediaCodec_queueInputBuffer error %d", status);
+    return false;
+  }
+  renderDecodedFrames();
+  return true;
+}
+
+void MediaCodecDecoder::renderDecodedFrames() {
+  AMediaCodecBufferInfo info;
+  while (true) {
+    ssize_t index = AMediaCodec_dequeueOutputBuffer(codec_, &info, 0);
+    if (index >= 0) {
+      TRACE_SCOPE("releaseCodecOutput");
+      AMediaCodec_releaseOutputBuffer(codec_, index, info.size > 0);
+    } else if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+      AMediaFormat* format = AMediaCodec_getOutputFormat(codec_);
+      ULOGI("Decoder output format %s", AMediaFormat_toString(format));
+      AMediaFormat_delete(format);
+    } else if (index != AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
+      return;
+    }
+  }
+}
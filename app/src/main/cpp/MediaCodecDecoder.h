@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+#include <media/NdkMediaCodec.h>
+
+#include <cstdint>
+
+// Decodes H.264, H.265, VP8 or VP9 frame based payloads with AMediaCodec
+// straight into the preview window, so decoded pixels never reach the CPU.
+//
+// Each payload is copied once, from libuvc's borrowed frame into a codec input
+// buffer: the codec owns its input memory, so it cannot wrap libuvc's.
+// Decoded buffers are released to the window as soon as they are ready.
+//
+// init() may run on any thread; queueFrame() must then be called from the
+// render thread.
+class MediaCodecDecoder final {
+ public:
+  MediaCodecDecoder() = default;
+  MediaCodecDecoder(const MediaCodecDecoder&) = delete;
+  MediaCodecDecoder& operator=(const MediaCodecDecoder&) = delete;
+  ~MediaCodecDecoder();
+
+  static bool supportsFormat(uvc_frame_format format);
+
+  bool init(
+      ANativeWindow* window,
+      int32_t width,
+      int32_t height,
+      uvc_frame_format format,
+      uint32_t maxFrameSize);
+  // Queues one access unit for decoding and renders any decoded frames.
+  // Returns false when the frame was dropped: no input buffer freed up in
+  // time, it did not fit one, or an MJPEG payload did not start with SOI.
+  bool queueFrame(const uvc_frame_t* frame);
+  // Renders the following frames into window. The codec cannot run without
+  // an output surface, so while there is no window the caller stops
+  // queueing frames and the first ones after it decode against missing
+  // references until the next key frame.
+  bool setWindow(ANativeWindow* window);
+
+ private:
+  // Long enough to ride out a decoder hiccup, short enough that the render
+  // queue does not back up behind it.
+  static constexpr int64_t kInputTimeoutUs = 5'000;
+
+  AMediaCodec* codec_{};
+  bool started_{false};
+
+  void renderDecodedFrames();
+};
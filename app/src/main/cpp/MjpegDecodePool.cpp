@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "MjpegDecodePool.h"
+
+#include <android/hardware_buffer.h>
+#include <android/log.h>
+#include <android/native_window.h>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "MjpegDecodePool", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "MjpegDecodePool", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "MjpegDecodePool", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "MjpegDecodePool", __VA_ARGS__)
+
+MjpegDecodePool::MjpegDecodePool(uint32_t workers, std::function<void()> decoded)
+    : decoded_(std::move(decoded)), scheduler_(TaskScheduler::shared()) {
+  slots_.reserve(workers);
+  for (uint32_t i = 0; i < workers; i++) {
+    slots_.push_back(std::make_unique<Slot>());
+  }
+  ULOGI("Decoding MJPEG on %u slots", workers);
+}
+
+MjpegDecodePool::~MjpegDecodePool() {
+  drain();
+  std::unique_lock lk(mutex_);
+  done_.wait(lk, [this] { return jobs_ == 0; });
+}
+
+void MjpegDecodePool::decode(uint32_t index) {
+  // The slot is the job's own until it is marked DECODED.
+  Slot& slot = *slots_[index];
+  auto start = steady_clock::now();
+  slot.decodeStartNs = start.time_since_epoch().count();
+  size_t stride = alignedStride((size_t)slot.width * 4);
+  slot.rgba.resize(stride * slot.height);
+  ANativeWindow_Buffer buffer{};
+  buffer.width = slot.width;
+  buffer.height = slot.height;
+  buffer.stride = stride / 4;
+  buffer.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+  buffer.bits = slot.rgba.data();
+  bool ok;
+  {
+    TRACE_SCOPE("decodeJpeg");
+    slot.decoder.setCrop(slot.crop);
+    ok = slot.decoder.decode(slot.frame, buffer);
+  }
+  nanoseconds busy = steady_clock::now() - start;
+  {
+    std::lock_guard lk(mutex_);
+    slot.ok = ok;
+    slot.busy += busy;
+    slot.bytes = slot.rgba.capacity() + slot.decoder.scratchBytes();
+    slot.state = SlotState::DECODED;
+  }
+  done_.notify_all();
+  // Without mutex_, which the render thread may check while holding its own.
+  decoded_();
+  std::lock_guard lk(mutex_);
+  jobs_--;
+  // Under mutex_, as the destructor may return as soon as jobs_ is 0.
+  done_.notify_all();
+}
+
+bool MjpegDecodePool::full() {
+  std::lock_guard lk(mutex_);
+  return order_.size() == slots_.size();
+}
+
+bool MjpegDecodePool::submit(
+    uvc_frame_t* frame,
+    int64_t enqueueNs,
+    int32_t width,
+    int32_t height,
+    const FrameCrop& crop) {
+  std::unique_lock lk(mutex_);
+  for (uint32_t i = 0; i < slots_.size(); i++) {
+    Slot& slot = *slots_[i];
+    if (slot.state != SlotState::IDLE) {
+      continue;
+    }
+    slot.state = SlotState::DECODING;
+    slot.frame = frame;
+    slot.enqueueNs = enqueueNs;
+    slot.width = width;
+    slot.height = height;
+    slot.crop = crop;
+    // Keep sequence order even if frames arrive out of it.
+    auto position = order_.end();
+    while (position != order_.begin() &&
+           (int32_t)(slots_[*(position - 1)]->frame->sequence - frame->sequence) > 0) {
+      --position;
+    }
+    order_.insert(position, i);
+    jobs_++;
+    lk.unlock();
+    scheduler_->submit(TaskPriority::PREVIEW, [this, i] { decode(i); });
+    return true;
+  }
+  return false;
+}
+
+bool MjpegDecodePool::isNextReady() const {
+  return !order_.empty() && slots_[order_.front()]->state == SlotState::DECODED;
+}
+
+bool MjpegDecodePool::hasNext() {
+  std::lock_guard lk(mutex_);
+  return isNextReady();
+}
+
+bool MjpegDecodePool::takeNext(Decoded& decoded, bool wait) {
+  std::unique_lock lk(mutex_);
+  // A taken frame stays at the front until recycled.
+  if (!order_.empty() && slots_[order_.front()]->state == SlotState::TAKEN) {
+    return false;
+  }
+  if (wait) {
+    done_.wait(lk, [this] { return order_.empty() || isNextReady(); });
+  }
+  if (!isNextReady()) {
+    return false;
+  }
+  uint32_t index = order_.front();
+  Slot& slot = *slots_[index];
+  slot.state = SlotState::TAKEN;
+  decoded.frame = slot.frame;
+  decoded.enqueueNs = slot.enqueueNs;
+  decoded.decodeStartNs = slot.decodeStartNs;
+  decoded.ok = slot.ok;
+  decoded.rgba = slot.rgba.data();
+  decoded.width = slot.width;
+  decoded.height = slot.height;
+  decoded.stride = alignedStride((size_t)slot.width * 4);
+  decoded.slot = index;
+  return true;
+}
+
+void MjpegDecodePool::recycle(const Decoded& decoded) {
+  std::lock_guard lk(mutex_);
+  Slot& slot = *slots_[decoded.slot];
+  if (slot.state != SlotState::TAKEN) {
+    return;
+  }
+  slot.state = SlotState::IDLE;
+  slot.frame = nullptr;
+  if (!order_.empty() && order_.front() == decoded.slot) {
+    order_.pop_front();
+  }
+}
+
+void MjpegDecodePool::drain() {
+  std::unique_lock lk(mutex_);
+  done_.wait(lk, [this] {
+    for (const auto& slot : slots_) {
+      if (slot->state == SlotState::DECODING) {
+        return false;
+      }
+    }
+    return true;
+  });
+  for (auto& slot : slots_) {
+    if (slot->frame != nullptr) {
+      uvc_release_frame(slot->frame);
+      slot->frame = nullptr;
+    }
+    slot->state = SlotState::IDLE;
+  }
+  order_.clear();
+}
+
+std::vector<nanoseconds> MjpegDecodePool::takeBusyTimes() {
+  std::lock_guard lk(mutex_);
+  std::vector<nanoseconds> busyTimes;
+  busyTimes.reserve(slots_.size());
+  for (auto& slot : slots_) {
+    busyTimes.push_back(slot->busy);
+    slot->busy = 0ns;
+  }
+  return busyTimes;
+}
+
+size_t MjpegDecodePool::bufferBytes() {
+  std::lock_guard lk(mutex_);
+  size_t bytes = 0;
+  for (auto& slot : slots_) {
+    bytes += slot->bytes;
+  }
+  return bytes;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "BufferAllocator.h"
+#include "FrameCrop.h"
+#include "MjpegDecoder.h"
+#include "TaskScheduler.h"
+
+using namespace std::chrono;
+
+// Decodes consecutive MJPEG frames of one stream on several threads at once.
+//
+// Each worker slot keeps its own MjpegDecoder and RGBA output buffer, so
+// frames are decoded whole and independently, as preview jobs on the
+// TaskScheduler. Decoded frames are handed back in uvc_frame_t::sequence
+// order, a frame only once every earlier one was taken, so the caller
+// presents them as captured.
+//
+// One thread, the render thread, calls everything but the constructor's
+// callback.
+class MjpegDecodePool final {
+ public:
+  struct Decoded {
+    // Still borrowed from libuvc; the caller releases it after recycle().
+    uvc_frame_t* frame{};
+    int64_t enqueueNs{};
+    int64_t decodeStartNs{};
+    bool ok{false};
+    // RGBA, valid until recycle().
+    const uint8_t* rgba{};
+    int32_t width{};
+    int32_t height{};
+    size_t stride{};
+    uint32_t slot{};
+  };
+
+  // decoded runs on a scheduler worker after each frame, to wake the render
+  // thread.
+  MjpegDecodePool(uint32_t workers, std::function<void()> decoded);
+  MjpegDecodePool(const MjpegDecodePool&) = delete;
+  MjpegDecodePool& operator=(const MjpegDecodePool&) = delete;
+  // Releases the frames still held, after waiting for their decode jobs.
+  ~MjpegDecodePool();
+
+  uint32_t workerCount() const {
+    return slots_.size();
+  }
+
+  // Every worker holds a frame, decoding or decoded but not yet recycled.
+  bool full();
+  // Hands frame to an idle worker, to decode its crop into width x height
+  // RGBA. Returns false, keeping frame with the caller, when full().
+  bool submit(
+      uvc_frame_t* frame,
+      int64_t enqueueNs,
+      int32_t width,
+      int32_t height,
+      const FrameCrop& crop);
+  // Takes the next frame in sequence once it is decoded. With wait, blocks
+  // while it is being decoded; returns false when nothing is in flight.
+  bool takeNext(Decoded& decoded, bool wait);
+  // Whether takeNext() would return a frame without waiting.
+  bool hasNext();
+  // Gives the worker of a taken frame its next one.
+  void recycle(const Decoded& decoded);
+  // Waits for the workers and releases every frame they hold.
+  void drain();
+
+  // Decoding time of each worker since the last call.
+  std::vector<nanoseconds> takeBusyTimes();
+
+  // RGBA and decoder scratch of the workers, as of their last decode.
+  size_t bufferBytes();
+
+ private:
+  enum class SlotState : uint8_t {
+    IDLE,
+    DECODING,
+    DECODED,
+    TAKEN,
+  };
+
+  struct Slot {
+    SlotState state{SlotState::IDLE};
+    uvc_frame_t* frame{};
+    int64_t enqueueNs{};
+    int64_t decodeStartNs{};
+    bool ok{false};
+    int32_t width{};
+    int32_t height{};
+    FrameCrop crop{};
+    AlignedBytes rgba{};
+    MjpegDecoder decoder{};
+    // rgba and decoder scratch, updated under mutex_ after each decode.
+    size_t bytes{};
+    nanoseconds busy{0ns};
+  };
+
+  std::function<void()> decoded_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::shared_ptr<TaskScheduler> scheduler_;
+  std::mutex mutex_;
+  std::condition_variable done_;
+  // Decode jobs submitted and not yet returned, which still use the pool.
+  uint32_t jobs_{};
+  // Slots holding a frame, in sequence order.
+  std::deque<uint32_t> order_;
+
+  void decode(uint32_t index);
+  bool isNextReady() const;
+};
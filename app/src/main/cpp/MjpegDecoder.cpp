@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MjpegDecoder.h"
+
+#include <android/hardware_buffer.h>
+#if __ANDROID_MIN_SDK_VERSION__ >= 30
+#include <android/imagedecoder.h>
+#endif
+#include <android/log.h>
+
+#include <libyuv.h>
+#include <libyuv/convert_argb.h>
+#include <libyuv/scale_argb.h>
+
+#include <algorithm>
+
+#if __ANDROID_MIN_SDK_VERSION__ < 30 && defined(HAVE_JPEG)
+namespace {
+
+struct RgbaRows {
+  uint8_t* rgba;
+  int stride;
+  int width;
+};
+
+// libyuv names formats by word order: ABGR is R, G, B, A in memory. JPEG is
+// full range BT.601, which libyuv's J formats are.
+void jpegI420ToRgba(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+  auto* dst = static_cast<RgbaRows*>(opaque);
+  libyuv::J420ToABGR(
+      data[0], strides[0], data[1], strides[1], data[2], strides[2], dst->rgba, dst->stride,
+      dst->width, rows);
+  dst->rgba += rows * dst->stride;
+}
+
+void jpegI422ToRgba(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+  auto* dst = static_cast<RgbaRows*>(opaque);
+  libyuv::J422ToABGR(
+      data[0], strides[0], data[1], strides[1], data[2], strides[2], dst->rgba, dst->stride,
+      dst->width, rows);
+  dst->rgba += rows * dst->stride;
+}
+
+void jpegI444ToRgba(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+  auto* dst = static_cast<RgbaRows*>(opaque);
+  libyuv::J444ToABGR(
+      data[0], strides[0], data[1], strides[1], data[2], strides[2], dst->rgba, dst->stride,
+      dst->width, rows);
+  dst->rgba += rows * dst->stride;
+}
+
+// Gray pixels are the same in either channel order.
+void jpegI400ToRgba(void* opaque, const uint8_t* const* data, const int* strides, int rows) {
+  auto* dst = static_cast<RgbaRows*>(opaque);
+  libyuv::J400ToARGB(data[0], strides[0], dst->rgba, dst->stride, dst->width, rows);
+  dst->rgba += rows * dst->stride;
+}
+
+bool hasSampling(libyuv::MJpegDecoder& decoder, int lumaHoriz, int lumaVert) {
+  return decoder.GetColorSpace() == libyuv::MJpegDecoder::kColorSpaceYCbCr &&
+      decoder.GetNumComponents() == 3 && decoder.GetHorizSampFactor(0) == lumaHoriz &&
+      decoder.GetVertSampFactor(0) == lumaVert && decoder.GetHorizSampFactor(1) == 1 &&
+      decoder.GetVertSampFactor(1) == 1 && decoder.GetHorizSampFactor(2) == 1 &&
+      decoder.GetVertSampFactor(2) == 1;
+}
+
+} // namespace
+#endif
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "MjpegDecoder", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "MjpegDecoder", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "MjpegDecoder", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "MjpegDecoder", __VA_ARGS__)
+
+MjpegDecoder::~MjpegDecoder() {
+  reset();
+}
+
+void MjpegDecoder::reset() {
+  if (rgbFrame_ != nullptr) {
+    uvc_free_frame(rgbFrame_);
+    rgbFrame_ = nullptr;
+  }
+#if __ANDROID_MIN_SDK_VERSION__ < 30 && defined(HAVE_JPEG)
+  yuvDecoder_.reset();
+#endif
+  width_ = 0;
+  height_ = 0;
+  outputWidth_ = 0;
+  outputHeight_ = 0;
+}
+
+size_t MjpegDecoder::scratchBytes() const {
+  return argbScratch_.capacity() + (rgbFrame_ != nullptr ? rgbFrame_->data_bytes : 0);
+}
+
+void MjpegDecoder::releaseScratch() {
+  reset();
+  AlignedBytes().swap(argbScratch_);
+}
+
+bool MjpegDecoder::configure(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer) {
+  reset();
+  width_ = frame->width;
+  height_ = frame->height;
+  outputWidth_ = buffer.width;
+  outputHeight_ = buffer.height;
+  outputStride_ = buffer.stride * 4;
+  outputSize_ = buffer.height * outputStride_;
+  isScaled_ = decodeAtOutputSize_ &&
+      (width_ != (uint32_t)outputWidth_ || height_ != (uint32_t)outputHeight_);
+  scaleDenom_ = 1;
+#if __ANDROID_MIN_SDK_VERSION__ >= 30
+  frameCrop_ = crop_.within(width_, height_, 1);
+  if (!frameCrop_.empty()) {
+    isScaled_ = decodeAtOutputSize_ &&
+        (frameCrop_.width != outputWidth_ || frameCrop_.height != outputHeight_);
+  }
+#else
+  // Largest IDCT scale that still covers the output; the rest is done by ARGBScale.
+  while (isScaled_ && scaleDenom_ < 8 &&
+         (width_ + scaleDenom_ * 2 - 1) / (scaleDenom_ * 2) >= (uint32_t)outputWidth_ &&
+         (height_ + scaleDenom_ * 2 - 1) / (scaleDenom_ * 2) >= (uint32_t)outputHeight_) {
+    scaleDenom_ *= 2;
+  }
+#if defined(HAVE_JPEG)
+  if (width_ == (uint32_t)outputWidth_ && height_ == (uint32_t)outputHeight_) {
+    argbScratch_.clear();
+    yuvDecoder_ = std::make_unique<libyuv::MJpegDecoder>();
+    ULOGI("MJPEG decoder configured for %dx%d into stride %zu", width_, height_, outputStride_);
+    return true;
+  }
+#endif
+  uint32_t scaledWidth = (width_ + scaleDenom_ - 1) / scaleDenom_;
+  uint32_t scaledHeight = (height_ + scaleDenom_ - 1) / scaleDenom_;
+  rgbFrame_ = uvc_allocate_frame(scaledWidth * scaledHeight * 3);
+  if (rgbFrame_ == nullptr) {
+    ULOGE("Failed to allocate RGB scratch frame for %dx%d", scaledWidth, scaledHeight);
+    reset();
+    return false;
+  }
+  if (isScaled_ &&
+      (scaledWidth != (uint32_t)outputWidth_ || scaledHeight != (uint32_t)outputHeight_)) {
+    argbScratch_.resize(alignedStride(scaledWidth * 4) * scaledHeight);
+  } else {
+    argbScratch_.clear();
+  }
+#endif
+  ULOGI(
+      "MJPEG decoder configured for %dx%d into %dx%d stride %zu scaled: %d 1/%d",
+      width_,
+      height_,
+      outputWidth_,
+      outputHeight_,
+      outputStride_,
+      isScaled_,
+      scaleDenom_);
+  return true;
+}
+
+bool MjpegDecoder::decode(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer) {
+  if (frame->width != width_ || frame->height != height_ || buffer.width != outputWidth_ ||
+      buffer.height != outputHeight_ || (size_t)buffer.stride * 4 != outputStride_) {
+    if (!configure(frame, buffer)) {
+      return false;
+    }
+  }
+
+#if __ANDROID_MIN_SDK_VERSION__ >= 30
+  auto setupStart = steady_clock::now();
+  AImageDecoder* decoder;
+  int result = AImageDecoder_createFromBuffer(frame->data, frame->data_bytes, &decoder);
+  if (result != ANDROID_IMAGE_DECODER_SUCCESS) {
+    ULOGE(
+        "MJPG AImageDecoder_createFromBuffer error %d frame size %zu %dx%d, step %zu",
+        result,
+        frame->data_bytes,
+        frame->width,
+        frame->height,
+        frame->step);
+    return false;
+  }
+  std::unique_ptr<AImageDecoder, decltype(&AImageDecoder_delete)> decoderPtr(
+      decoder, &AImageDecoder_delete);
+  // The crop is scaled with the frame, so the frame's target size maps the
+  // crop onto the output.
+  int32_t targetWidth = width_;
+  int32_t targetHeight = height_;
+  if (isScaled_) {
+    if (!frameCrop_.empty()) {
+      targetWidth = (int64_t)width_ * outputWidth_ / frameCrop_.width;
+      targetHeight = (int64_t)height_ * outputHeight_ / frameCrop_.height;
+    } else {
+      targetWidth = outputWidth_;
+      targetHeight = outputHeight_;
+    }
+    result = AImageDecoder_setTargetSize(decoder, targetWidth, targetHeight);
+    if (result != ANDROID_IMAGE_DECODER_SUCCESS) {
+      ULOGW("AImageDecoder_setTargetSize %dx%d error %d", targetWidth, targetHeight, result);
+      isScaled_ = false;
+      targetWidth = width_;
+      targetHeight = height_;
+    }
+  }
+  if (!frameCrop_.empty()) {
+    ARect crop;
+    crop.left = (int64_t)frameCrop_.x * targetWidth / width_;
+    crop.top = (int64_t)frameCrop_.y * targetHeight / height_;
+    crop.right = std::min(
+        crop.left + (isScaled_ ? outputWidth_ : std::min(frameCrop_.width, outputWidth_)),
+        targetWidth);
+    crop.bottom = std::min(
+        crop.top + (isScaled_ ? outputHeight_ : std::min(frameCrop_.height, outputHeight_)),
+        targetHeight);
+    result = AImageDecoder_setCrop(decoder, crop);
+    if (result != ANDROID_IMAGE_DECODER_SUCCESS) {
+      ULOGW(
+          "AImageDecoder_setCrop %d,%d %dx%d error %d",
+          crop.left,
+          crop.top,
+          crop.right - crop.left,
+          crop.bottom - crop.top,
+          result);
+    }
+  }
+  lastSetupTime_ = steady_clock::now() - setupStart;
+
+  result = AImageDecoder_decodeImage(decoder, buffer.bits, outputStride_, outputSize_);
+  if (result != ANDROID_IMAGE_DECODER_SUCCESS) {
+    const AImageDecoderHeaderInfo* info = AImageDecoder_getHeaderInfo(decoder);
+    ULOGE(
+        "MJPG decoding error %d frame size %zu %dx%d, step %zu, decoded image header: %d X %d stride %zu mime-type %s",
+        result,
+        frame->data_bytes,
+        frame->width,
+        frame->height,
+        frame->step,
+        AImageDecoderHeaderInfo_getWidth(info),
+        AImageDecoderHeaderInfo_getHeight(info),
+        outputStride_,
+        AImageDecoderHeaderInfo_getMimeType(info));
+    return false;
+  }
+  return true;
+#else
+  lastSetupTime_ = 0ns;
+  if (buffer.format != AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM &&
+      buffer.format != AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM) {
+    ULOGE("Unsupported hardware_buffer_format  %d for MJPEG frame", buffer.format);
+    return false;
+  }
+#if !defined(HAVE_JPEG)
+  ULOGE("MJPEG decoding below API 30 requires building with libjpeg-turbo");
+  return false;
+#else
+  if (yuvDecoder_ != nullptr) {
+    return decodeUnscaled(frame, buffer);
+  }
+  if (uvc_mjpeg2rgb_scaled(const_cast<uvc_frame_t*>(frame), rgbFrame_, scaleDenom_) !=
+      UVC_SUCCESS) {
+    return false;
+  }
+  if (argbScratch_.empty()) {
+    libyuv::RGB24ToARGB(
+        (uint8_t*)rgbFrame_->data,
+        rgbFrame_->step,
+        (uint8_t*)buffer.bits,
+        outputStride_,
+        buffer.width,
+        buffer.height);
+    return true;
+  }
+  int32_t argbStride = alignedStride(rgbFrame_->width * 4);
+  libyuv::RGB24ToARGB(
+      (uint8_t*)rgbFrame_->data,
+      rgbFrame_->step,
+      argbScratch_.data(),
+      argbStride,
+      rgbFrame_->width,
+      rgbFrame_->height);
+  libyuv::ARGBScale(
+      argbScratch_.data(),
+      argbStride,
+      rgbFrame_->width,
+      rgbFrame_->height,
+      (uint8_t*)buffer.bits,
+      outputStride_,
+      buffer.width,
+      buffer.height,
+      libyuv::kFilterBilinear);
+  return true;
+#endif // HAVE_JPEG
+#endif
+}
+
+bool MjpegDecoder::decodeNv12(
+    const uvc_frame_t* frame,
+    uint8_t* y,
+    int32_t yStride,
+    uint8_t* uv,
+    int32_t uvStride,
+    int32_t width,
+    int32_t height) {
+#if defined(HAVE_JPEG)
+  // libjpeg's raw output: the planes come out as coded, and libyuv only
+  // interleaves or subsamples the chroma rows.
+  int result = libyuv::MJPGToNV12(
+      static_cast<const uint8_t*>(frame->data),
+      frame->data_bytes,
+      y,
+      yStride,
+      uv,
+      uvStride,
+      (int)frame->width,
+      (int)frame->height,
+      width,
+      height);
+  if (result != 0) {
+    ULOGE(
+        "MJPGToNV12 error %d frame size %zu %dx%d",
+        result,
+        frame->data_bytes,
+        frame->width,
+        frame->height);
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+#if __ANDROID_MIN_SDK_VERSION__ < 30 && defined(HAVE_JPEG)
+bool MjpegDecoder::decodeUnscaled(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer) {
+  libyuv::MJpegDecoder& decoder = *yuvDecoder_;
+  if (!decoder.LoadFrame(static_cast<const uint8_t*>(frame->data), frame->data_bytes)) {
+    ULOGE("MJPG LoadFrame error frame size %zu %dx%d", frame->data_bytes, width_, height_);
+    return false;
+  }
+  if (decoder.GetWidth() != (int)width_ || decoder.GetHeight() != (int)height_) {
+    ULOGE(
+        "MJPG frame header %dx%d does not match %dx%d",
+        decoder.GetWidth(),
+        decoder.GetHeight(),
+        width_,
+        height_);
+    decoder.UnloadFrame();
+    return false;
+  }
+  // Only configured when the window buffer matches the frame size.
+  RgbaRows rows{static_cast<uint8_t*>(buffer.bits), (int)outputStride_, (int)width_};
+  libyuv::MJpegDecoder::CallbackFunction callback = nullptr;
+  if (hasSampling(decoder, 2, 2)) {
+    callback = &jpegI420ToRgba;
+  } else if (hasSampling(decoder, 2, 1)) {
+    callback = &jpegI422ToRgba;
+  } else if (hasSampling(decoder, 1, 1)) {
+    callback = &jpegI444ToRgba;
+  } else if (
+      decoder.GetColorSpace() == libyuv::MJpegDecoder::kColorSpaceGrayscale &&
+      decoder.GetNumComponents() == 1) {
+    callback = &jpegI400ToRgba;
+  } else {
+    ULOGE("Unsupported MJPG color space %d", decoder.GetColorSpace());
+    decoder.UnloadFrame();
+    return false;
+  }
+  if (!decoder.DecodeToCallback(callback, &rows, width_, height_)) {
+    ULOGE("MJPG decoding error frame size %zu %dx%d", frame->data_bytes, width_, height_);
+    return false;
+  }
+  return true;
+}
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+#if __ANDROID_MIN_SDK_VERSION__ < 30 && defined(HAVE_JPEG)
+#include <libyuv/mjpeg_decoder.h>
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "BufferAllocator.h"
+#include "FrameCrop.h"
+
+using namespace std::chrono;
+
+// Decoding session for a stream of MJPEG frames of one resolution.
+//
+// Everything that only depends on the frame dimensions and the output
+// geometry is computed once and kept until a frame of a different size
+// arrives. AImageDecoder cannot be pointed at a new buffer, so on API 30+ the
+// decoder object itself is still created per frame; the time spent on that
+// setup is reported through lastSetupTime().
+//
+// When decoding at output size, frames larger than the window buffer are
+// decoded straight at the buffer size: AImageDecoder_setTargetSize on API 30+,
+// libjpeg IDCT scaling by 1/2, 1/4 or 1/8 on older releases.
+//
+// With a crop, AImageDecoder_setCrop limits the decode to the rows and MCUs
+// it covers, scaled to the buffer like a whole frame is. Older releases
+// decode whole frames.
+//
+// Before API 30 decoding needs libjpeg-turbo (HAVE_JPEG). Unscaled frames go
+// through a libyuv MJpegDecoder kept for the session whose row callbacks
+// write RGBA straight into the window buffer, with no RGB24 intermediate.
+class MjpegDecoder final {
+ public:
+  MjpegDecoder() = default;
+  MjpegDecoder(const MjpegDecoder&) = delete;
+  MjpegDecoder& operator=(const MjpegDecoder&) = delete;
+  ~MjpegDecoder();
+
+  // Decodes into a locked RGBA window buffer. On a decode error the buffer
+  // may be partly written; callers show another frame instead.
+  bool decode(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer);
+
+  // Whether decodeNv12() is available. It needs libjpeg-turbo's raw YCbCr
+  // output, which AImageDecoder does not have.
+  static constexpr bool decodesNv12() {
+#if defined(HAVE_JPEG)
+    return true;
+#else
+    return false;
+#endif
+  }
+  // Decodes the top left width x height of a frame into NV12 planes, keeping
+  // the JPEG's own YCbCr: no conversion to RGB, and no chroma upsampling for
+  // 4:2:0 frames. Decodes whole frames, with no crop or scaling. False when
+  // unavailable or on a decode error.
+  bool decodeNv12(
+      const uvc_frame_t* frame,
+      uint8_t* y,
+      int32_t yStride,
+      uint8_t* uv,
+      int32_t uvStride,
+      int32_t width,
+      int32_t height);
+
+  nanoseconds lastSetupTime() const {
+    return lastSetupTime_;
+  }
+
+  void setDecodeAtOutputSize(bool decodeAtOutputSize) {
+    decodeAtOutputSize_ = decodeAtOutputSize;
+    width_ = 0; // reconfigure on the next frame
+  }
+
+  void setCrop(const FrameCrop& crop) {
+    if (crop != crop_) {
+      crop_ = crop;
+      width_ = 0;
+    }
+  }
+
+  // Scratch frames the decoder keeps between frames.
+  size_t scratchBytes() const;
+  // Frees them; the next frame sets the decoder up again.
+  void releaseScratch();
+
+ private:
+  uint32_t width_{};
+  uint32_t height_{};
+  int32_t outputWidth_{};
+  int32_t outputHeight_{};
+  size_t outputStride_{};
+  size_t outputSize_{};
+  nanoseconds lastSetupTime_{0ns};
+  bool decodeAtOutputSize_{true};
+  bool isScaled_{false};
+  FrameCrop crop_{};
+  // crop_ within the frame, empty for none. API 30+.
+  FrameCrop frameCrop_{};
+  // IDCT scale denominator for the pre-API 30 decode.
+  uint8_t scaleDenom_{1};
+  // RGB24 scratch for the pre-API 30 IDCT scaled decode, reused across frames.
+  uvc_frame_t* rgbFrame_{};
+#if __ANDROID_MIN_SDK_VERSION__ < 30 && defined(HAVE_JPEG)
+  std::unique_ptr<libyuv::MJpegDecoder> yuvDecoder_{};
+
+  bool decodeUnscaled(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer);
+#endif
+  // ARGB scratch when the IDCT scaled size still differs from the output.
+  AlignedBytes argbScratch_{};
+
+  bool configure(const uvc_frame_t* frame, const ANativeWindow_Buffer& buffer);
+  void reset();
+};
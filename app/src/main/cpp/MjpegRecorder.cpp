@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MjpegRecorder.h"
+
+#include <android/log.h>
+
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "MjpegRecorder", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "MjpegRecorder", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "MjpegRecorder", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "MjpegRecorder", __VA_ARGS__)
+
+using namespace std::chrono;
+
+// RIFF 'AVI ', LIST 'hdrl' holding 'avih' and LIST 'strl' with 'strh' and
+// 'strf', then the LIST 'movi' header.
+static constexpr size_t kHeaderSize = 12 + 12 + 64 + 12 + 64 + 48 + 12;
+static constexpr uint32_t kHdrlSize = 4 + 64 + 12 + 64 + 48;
+static constexpr uint32_t kStrlSize = 4 + 64 + 48;
+static constexpr uint32_t kAvifHasIndex = 0x10;
+static constexpr uint32_t kAviifKeyframe = 0x10;
+
+namespace {
+
+class RiffWriter {
+ public:
+  explicit RiffWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+  void fourcc(const char* code) {
+    out_.insert(out_.end(), code, code + 4);
+  }
+
+  void u32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      out_.push_back((uint8_t)(value >> (8 * i)));
+    }
+  }
+
+  void u16(uint16_t value) {
+    out_.push_back((uint8_t)value);
+    out_.push_back((uint8_t)(value >> 8));
+  }
+
+ private:
+  std::vector<uint8_t>& out_;
+};
+
+} // namespace
+
+MjpegRecorder::~MjpegRecorder() {
+  stop();
+}
+
+bool MjpegRecorder::start(
+    int fd,
+    int32_t width,
+    int32_t height,
+    uint32_t frameInterval,
+    uint32_t clockFrequency) {
+  if (running_ || frameInterval == 0) {
+    return false;
+  }
+  fd_ = fd;
+  width_ = width;
+  height_ = height;
+  frameInterval_ = frameInterval;
+  clockFrequency_ = clockFrequency;
+  // Placeholder with zero counts, rewritten by stop(). Frames follow it.
+  if (!writeHeader() || lseek(fd, kHeaderSize, SEEK_SET) != (off_t)kHeaderSize) {
+    ULOGE("Header write to fd %d failed: %s", fd, strerror(errno));
+    return false;
+  }
+  running_ = true;
+  writerThread_ = std::thread(&MjpegRecorder::writerLoop, this);
+  ULOGI("Recording MJPEG %dx%d, frame interval %.3f ms", width, height, frameInterval / 1e4);
+  return true;
+}
+
+bool MjpegRecorder::startFromReplay(
+    int fd,
+    std::shared_ptr<InstantReplay> replay,
+    nanoseconds preRoll) {
+  const InstantReplay::Config& config = replay->config();
+  if (running_ || config.format != UVC_FRAME_FORMAT_MJPEG || config.frameInterval == 0 ||
+      !replay->follow(preRoll)) {
+    return false;
+  }
+  fd_ = fd;
+  width_ = config.width;
+  height_ = config.height;
+  frameInterval_ = config.frameInterval;
+  clockFrequency_ = config.clockFrequency;
+  if (!writeHeader() || lseek(fd, kHeaderSize, SEEK_SET) != (off_t)kHeaderSize) {
+    ULOGE("Header write to fd %d failed: %s", fd, strerror(errno));
+    replay->unfollow();
+    return false;
+  }
+  replay_ = std::move(replay);
+  stopTimeNs_ = INT64_MAX;
+  running_ = true;
+  writerThread_ = std::thread(&MjpegRecorder::replayLoop, this);
+  ULOGI(
+      "Recording MJPEG %dx%d from %.1f s back",
+      width_,
+      height_,
+      duration_cast<milliseconds>(preRoll).count() / 1e3);
+  return true;
+}
+
+void MjpegRecorder::addFrame(uvc_frame_t* frame) {
+  if (!running_) {
+    return;
+  }
+  uvc_retain_frame(frame);
+  if (!pending_.tryPush(frame, steady_clock::now().time_since_epoch().count())) {
+    uvc_release_frame(frame);
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  std::unique_lock lk(pendingMutex_);
+  pendingChange_.notify_all();
+}
+
+bool MjpegRecorder::stop() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  stopTimeNs_ = now.tv_sec * 1'000'000'000LL + now.tv_nsec;
+  if (!running_.exchange(false)) {
+    return false;
+  }
+  {
+    std::unique_lock lk(pendingMutex_);
+    pendingChange_.notify_all();
+  }
+  writerThread_.join();
+  if (replay_ != nullptr) {
+    replay_->unfollow();
+    skipped_ += replay_->followLost();
+    replay_ = nullptr;
+  }
+  bool finalized = !writeFailed_ && writeIndex() && writeHeader();
+  ULOGI(
+      "Recording stopped after %u frames, %.1f MB, %u skipped by the writer%s",
+      frames_,
+      moviBytes_ / 1e6,
+      skipped_.load(),
+      finalized ? "" : ", file is incomplete");
+  return finalized;
+}
+
+void MjpegRecorder::writerLoop() {
+  prctl(PR_SET_NAME, "usb_video_mjpeg");
+  // Whatever is still queued at stop() is written too.
+  while (running_ || !pending_.empty()) {
+    uvc_frame_t* frame;
+    int64_t enqueueTime;
+    if (!pending_.tryPop(frame, enqueueTime)) {
+      std::unique_lock lk(pendingMutex_);
+      pendingChange_.wait_for(lk, 10ms, [this] { return !pending_.empty() || !running_; });
+      continue;
+    }
+    if (!full_ && !writeFailed_) {
+      writeFrame(frame);
+    }
+    uvc_release_frame(frame);
+  }
+}
+
+void MjpegRecorder::replayLoop() {
+  prctl(PR_SET_NAME, "usb_video_mjpeg");
+  InstantReplay::FollowedFrame followed;
+  // The backlog up to stop() is written too.
+  while (true) {
+    if (!replay_->readFollowed(followed, running_ ? 10ms : 0ms)) {
+      if (!running_) {
+        return;
+      }
+      continue;
+    }
+    if (followed.record.captureTimeNs > stopTimeNs_) {
+      return;
+    }
+    if (full_ || writeFailed_) {
+      continue;
+    }
+    uvc_frame_t frame{};
+    frame.data = followed.payload.data();
+    frame.data_bytes = followed.payload.size();
+    frame.pts = followed.record.pts;
+    frame.capture_time_finished.tv_sec = followed.record.captureTimeNs / 1'000'000'000;
+    frame.capture_time_finished.tv_nsec = followed.record.captureTimeNs % 1'000'000'000;
+    writeFrame(&frame);
+  }
+}
+
+void MjpegRecorder::writeFrame(const uvc_frame_t* frame) {
+  TRACE_SCOPE("writeMjpegFrame");
+  int64_t captureTimeUs = frame->capture_time_finished.tv_sec * 1'000'000LL +
+      frame->capture_time_finished.tv_nsec / 1000;
+  if (!started_) {
+    started_ = true;
+    usePts_ = clockFrequency_ != 0 && frame->pts != 0;
+    lastPts_ = frame->pts;
+    firstCaptureTimeUs_ = captureTimeUs;
+  }
+  // Position of the frame on the file's timeline, in 100 ns units.
+  uint64_t elapsed;
+  if (usePts_) {
+    // A 32 bit counter that wraps in about a minute at typical clock rates.
+    elapsedTicks_ += (uint32_t)(frame->pts - lastPts_);
+    lastPts_ = frame->pts;
+    elapsed = elapsedTicks_ * 10'000'000 / clockFrequency_;
+  } else {
+    elapsed = (uint64_t)std::max<int64_t>(0, captureTimeUs - firstCaptureTimeUs_) * 10;
+  }
+  uint64_t slot = (elapsed + frameInterval_ / 2) / frameInterval_ - slotOffset_;
+  // A jump of over a second is a clock glitch rather than dropped frames.
+  uint64_t maxGap = 10'000'000 / frameInterval_;
+  if (slot > frames_ + maxGap) {
+    ULOGW("Timestamp jumped by %llu frames, resyncing", (unsigned long long)(slot - frames_));
+    slotOffset_ += slot - frames_;
+    slot = frames_;
+  }
+  while (frames_ < slot) {
+    if (!appendChunk(nullptr, 0)) {
+      return;
+    }
+  }
+  appendChunk(frame->data, frame->data_bytes);
+}
+
+bool MjpegRecorder::appendChunk(const void* data, uint32_t size) {
+  uint32_t padding = size & 1;
+  if (moviBytes_ + 8 + size + padding > kMaxMoviBytes) {
+    ULOGW("Recording reached the AVI size limit, no more frames are written");
+    full_ = true;
+    return false;
+  }
+  uint32_t chunkHeader[2];
+  memcpy(&chunkHeader[0], "00dc", 4);
+  chunkHeader[1] = size;
+  static const uint8_t kPad = 0;
+  iovec parts[] = {
+      {chunkHeader, sizeof(chunkHeader)},
+      {const_cast<void*>(data), size},
+      {const_cast<uint8_t*>(&kPad), padding},
+  };
+  ssize_t expected = sizeof(chunkHeader) + size + padding;
+  if (writev(fd_, parts, 3) != expected) {
+    ULOGE("Frame write failed: %s", strerror(errno));
+    writeFailed_ = true;
+    return false;
+  }
+  index_.push_back({(uint32_t)(4 + moviBytes_), size});
+  moviBytes_ += expected;
+  maxChunkSize_ = std::max(maxChunkSize_, size);
+  frames_++;
+  return true;
+}
+
+bool MjpegRecorder::writeIndex() {
+  std::vector<uint8_t> bytes;
+  bytes.reserve(8 + 16 * index_.size());
+  RiffWriter riff(bytes);
+  riff.fourcc("idx1");
+  riff.u32(16 * index_.size());
+  for (const IndexEntry& entry : index_) {
+    riff.fourcc("00dc");
+    riff.u32(entry.size > 0 ? kAviifKeyframe : 0);
+    riff.u32(entry.offset);
+    riff.u32(entry.size);
+  }
+  if (write(fd_, bytes.data(), bytes.size()) != (ssize_t)bytes.size()) {
+    ULOGE("Index write failed: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool MjpegRecorder::writeHeader() {
+  std::vector<uint8_t> bytes;
+  bytes.reserve(kHeaderSize);
+  RiffWriter riff(bytes);
+  uint32_t indexBytes = 8 + 16 * frames_;
+  uint32_t bytesPerSecond = (uint64_t)maxChunkSize_ * 10'000'000 / frameInterval_;
+
+  riff.fourcc("RIFF");
+  riff.u32(kHeaderSize - 8 + moviBytes_ + indexBytes);
+  riff.fourcc("AVI ");
+
+  riff.fourcc("LIST");
+  riff.u32(kHdrlSize);
+  riff.fourcc("hdrl");
+  riff.fourcc("avih");
+  riff.u32(56);
+  riff.u32(frameInterval_ / 10); // dwMicroSecPerFrame
+  riff.u32(bytesPerSecond); // dwMaxBytesPerSec
+  riff.u32(0); // dwPaddingGranularity
+  riff.u32(kAvifHasIndex); // dwFlags
+  riff.u32(frames_); // dwTotalFrames
+  riff.u32(0); // dwInitialFrames
+  riff.u32(1); // dwStreams
+  riff.u32(maxChunkSize_ + 8); // dwSuggestedBufferSize
+  riff.u32(width_);
+  riff.u32(height_);
+  for (int i = 0; i < 4; i++) {
+    riff.u32(0); // dwReserved
+  }
+
+  riff.fourcc("LIST");
+  riff.u32(kStrlSize);
+  riff.fourcc("strl");
+  riff.fourcc("strh");
+  riff.u32(56);
+  riff.fourcc("vids");
+  riff.fourcc("MJPG");
+  riff.u32(0); // dwFlags
+  riff.u16(0); // wPriority
+  riff.u16(0); // wLanguage
+  riff.u32(0); // dwInitialFrames
+  riff.u32(frameInterval_); // dwScale
+  riff.u32(10'000'000); // dwRate, so dwRate / dwScale is frames per second
+  riff.u32(0); // dwStart
+  riff.u32(frames_); // dwLength
+  riff.u32(maxChunkSize_ + 8); // dwSuggestedBufferSize
+  riff.u32(UINT32_MAX); // dwQuality, default
+  riff.u32(0); // dwSampleSize, varies
+  riff.u16(0); // rcFrame
+  riff.u16(0);
+  riff.u16(width_);
+  riff.u16(height_);
+  riff.fourcc("strf");
+  riff.u32(40);
+  riff.u32(40); // BITMAPINFOHEADER biSize
+  riff.u32(width_);
+  riff.u32(height_);
+  riff.u16(1); // biPlanes
+  riff.u16(24); // biBitCount
+  riff.fourcc("MJPG");
+  riff.u32(width_ * height_ * 3); // biSizeImage
+  riff.u32(0); // biXPelsPerMeter
+  riff.u32(0); // biYPelsPerMeter
+  riff.u32(0); // biClrUsed
+  riff.u32(0); // biClrImportant
+
+  riff.fourcc("LIST");
+  riff.u32(4 + moviBytes_);
+  riff.fourcc("movi");
+
+  return pwrite(fd_, bytes.data(), bytes.size(), 0) == (ssize_t)bytes.size();
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "InstantReplay.h"
+#include "SpscQueue.h"
+
+// Writes the camera's MJPEG frames unchanged into an AVI file.
+//
+// The capture thread only takes a reference on each borrowed libuvc frame;
+// a writer thread appends the payload straight from libuvc's buffer with one
+// writev() per frame, so recording costs no decode, encode or copy. If the
+// writer falls behind, frames are skipped rather than stalling capture.
+//
+// AVI has a fixed frame rate, so frames are placed on the negotiated frame
+// interval by their UVC PTS, or their USB completion time if the camera sends
+// none. Gaps left by dropped frames are filled with empty chunks, which
+// players show as a repeat of the previous frame.
+//
+// startFromReplay() records from an instant replay instead, beginning some
+// time in the past: the writer follows the replay, copying the kept frames
+// out of it, and catches up with the live ones.
+class MjpegRecorder final {
+ public:
+  MjpegRecorder() = default;
+  MjpegRecorder(const MjpegRecorder&) = delete;
+  MjpegRecorder& operator=(const MjpegRecorder&) = delete;
+  ~MjpegRecorder();
+
+  // fd must be open for writing at offset 0; the caller keeps ownership.
+  // frameInterval is in 100 ns units, clockFrequency is the PTS clock in Hz.
+  bool start(
+      int fd,
+      int32_t width,
+      int32_t height,
+      uint32_t frameInterval,
+      uint32_t clockFrequency);
+  // Records what replay keeps from preRoll back, then what it keeps from
+  // then on, until stop(). replay must be of an MJPEG stream.
+  bool startFromReplay(int fd, std::shared_ptr<InstantReplay> replay, nanoseconds preRoll);
+  // Capture thread only.
+  void addFrame(uvc_frame_t* frame);
+  // Writes the index and final header. Returns true when the file is playable.
+  bool stop();
+
+ private:
+  // Frames waiting for the writer. Each holds a libuvc pool buffer, of which
+  // there are only a few.
+  static constexpr uint32_t kPendingFrames = 2;
+  // AVI 1.0 sizes are 32 bit; leave room for the index.
+  static constexpr uint64_t kMaxMoviBytes = 2'000'000'000;
+
+  struct IndexEntry {
+    uint32_t offset; // from the 'movi' list type
+    uint32_t size;
+  };
+
+  int fd_{-1};
+  int32_t width_{};
+  int32_t height_{};
+  uint32_t frameInterval_{};
+  uint32_t clockFrequency_{};
+
+  SpscQueue<uvc_frame_t*> pending_{kPendingFrames};
+  std::thread writerThread_{};
+  std::atomic<bool> running_{false};
+  std::mutex pendingMutex_;
+  std::condition_variable pendingChange_;
+  std::atomic<uint32_t> skipped_{0};
+  std::shared_ptr<InstantReplay> replay_{};
+  // Replayed frames captured after stop() are left out.
+  std::atomic<int64_t> stopTimeNs_{INT64_MAX};
+
+  // Writer thread only.
+  bool usePts_{false};
+  bool started_{false};
+  uint32_t lastPts_{};
+  uint64_t elapsedTicks_{};
+  int64_t firstCaptureTimeUs_{};
+  uint64_t slotOffset_{};
+  uint64_t moviBytes_{};
+  uint32_t maxChunkSize_{};
+  uint32_t frames_{};
+  bool full_{false};
+  bool writeFailed_{false};
+  std::vector<IndexEntry> index_{};
+
+  void writerLoop();
+  void replayLoop();
+  void writeFrame(const uvc_frame_t* frame);
+  bool appendChunk(const void* data, uint32_t size);
+  bool writeIndex();
+  bool writeHeader();
+};
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ModeSelector.h"
+
+#include <android/log.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include "CpuFeatures.h"
+#include "ThroughputProbe.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "ModeSelector", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "ModeSelector", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "ModeSelector", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "ModeSelector", __VA_ARGS__)
+
+namespace {
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+// CPU us per megapixel on an armv8.2 core: a libyuv conversion of the
+// uncompressed formats, a software decode and conversion of MJPEG.
+constexpr double kPriorUsPerMegapixel[] = {1500.0, 1000.0, 9000.0};
+// Weight of a new measurement against what the model had.
+constexpr double kMeasurementWeight = 0.3;
+
+double tierScale(CpuTier tier) {
+  switch (tier) {
+    case CpuTier::ARMV9:
+      return 0.7;
+    case CpuTier::ARMV8_2:
+      return 1.0;
+    case CpuTier::GENERIC:
+    default:
+      return 1.6;
+  }
+}
+
+// How well width x height fills the surface: 1 for the same size and shape,
+// less for smaller modes and, slowly, for larger ones that only get scaled
+// down.
+double displayFit(int32_t width, int32_t height, int32_t surfaceWidth, int32_t surfaceHeight) {
+  double ratio = (double)width * height / ((double)surfaceWidth * surfaceHeight);
+  double fit = ratio <= 1.0 ? ratio : 1.0 / (1.0 + 0.25 * std::log2(ratio));
+  double aspect = (double)width / height;
+  double surfaceAspect = (double)surfaceWidth / surfaceHeight;
+  return fit * (1.0 - std::min(1.0, std::abs(aspect - surfaceAspect) / surfaceAspect));
+}
+
+bool pipelineFormat(const uvc_format_desc_t* format, uvc_frame_format& frameFormat) {
+  if (format->bDescriptorSubtype == UVC_VS_FORMAT_MJPEG) {
+    frameFormat = UVC_FRAME_FORMAT_MJPEG;
+    return true;
+  }
+  if (format->bDescriptorSubtype != UVC_VS_FORMAT_UNCOMPRESSED) {
+    return false;
+  }
+  if (memcmp(format->fourccFormat, "YUY2", 4) == 0) {
+    frameFormat = UVC_FRAME_FORMAT_YUYV;
+    return true;
+  }
+  if (memcmp(format->fourccFormat, "NV12", 4) == 0) {
+    frameFormat = UVC_FRAME_FORMAT_NV12;
+    return true;
+  }
+  return false;
+}
+
+// Rates of the frame as the connect path passes them, 10^7 / interval.
+std::vector<int32_t> frameRates(const uvc_frame_desc_t* frame) {
+  std::vector<uint32_t> intervals;
+  if (frame->bFrameIntervalType == 0) {
+    intervals = {frame->dwMinFrameInterval, frame->dwDefaultFrameInterval};
+  } else {
+    for (const uint32_t* interval = frame->intervals; interval != nullptr && *interval != 0;
+         interval++) {
+      intervals.push_back(*interval);
+    }
+  }
+  std::vector<int32_t> rates;
+  for (uint32_t interval : intervals) {
+    int32_t fps = interval > 0 ? (int32_t)(10'000'000 / interval) : 0;
+    if (fps > 0 && std::find(rates.begin(), rates.end(), fps) == rates.end()) {
+      rates.push_back(fps);
+    }
+  }
+  return rates;
+}
+
+} // namespace
+
+ModeCostModel& ModeCostModel::shared() {
+  static ModeCostModel* model = new ModeCostModel();
+  return *model;
+}
+
+void ModeCostModel::setDirectory(const std::string& directory) {
+  std::lock_guard lk(mutex_);
+  directory_ = directory;
+  loaded_ = false;
+}
+
+bool ModeCostModel::slotOf(uvc_frame_format format, Slot& slot) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_YUYV:
+      slot = YUYV;
+      return true;
+    case UVC_FRAME_FORMAT_NV12:
+      slot = NV12;
+      return true;
+    case UVC_FRAME_FORMAT_MJPEG:
+      slot = MJPEG;
+      return true;
+    default:
+      return false;
+  }
+}
+
+double ModeCostModel::cpuUsPerMegapixel(uvc_frame_format format) {
+  Slot slot;
+  if (!slotOf(format, slot)) {
+    return 0;
+  }
+  std::lock_guard lk(mutex_);
+  loadLocked();
+  return entries_[slot].usPerMegapixel;
+}
+
+void ModeCostModel::record(
+    uvc_frame_format format,
+    int32_t width,
+    int32_t height,
+    double cpuUsPerFrame) {
+  Slot slot;
+  if (!slotOf(format, slot) || width <= 0 || height <= 0 || cpuUsPerFrame <= 0) {
+    return;
+  }
+  double usPerMegapixel = cpuUsPerFrame * 1e6 / ((double)width * height);
+  std::lock_guard lk(mutex_);
+  loadLocked();
+  Entry& entry = entries_[slot];
+  // The first measurement replaces the prior outright.
+  entry.usPerMegapixel = entry.samples == 0
+      ? usPerMegapixel
+      : entry.usPerMegapixel * (1.0 - kMeasurementWeight) + usPerMegapixel * kMeasurementWeight;
+  entry.samples++;
+  saveLocked();
+}
+
+void ModeCostModel::loadLocked() {
+  if (loaded_) {
+    return;
+  }
+  loaded_ = true;
+  double scale = tierScale(CpuFeatures::get().tier());
+  for (size_t slot = 0; slot < COUNT; slot++) {
+    entries_[slot] = {kPriorUsPerMegapixel[slot] * scale, 0, 0};
+  }
+  if (directory_.empty()) {
+    return;
+  }
+  int fd = open((directory_ + "/uvc_mode_costs.bin").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  FileHeader header{};
+  std::array<Entry, COUNT> entries{};
+  if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == kMagic &&
+      header.version == kVersion && header.count == COUNT &&
+      read(fd, entries.data(), sizeof(entries)) == sizeof(entries)) {
+    for (size_t slot = 0; slot < COUNT; slot++) {
+      if (entries[slot].samples > 0 && entries[slot].usPerMegapixel > 0) {
+        entries_[slot] = entries[slot];
+      }
+    }
+  }
+  close(fd);
+}
+
+void ModeCostModel::saveLocked() {
+  if (directory_.empty()) {
+    return;
+  }
+  // Written aside and renamed, like the negotiation cache.
+  std::string target = directory_ + "/uvc_mode_costs.bin";
+  std::string temporary = target + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ULOGE("Cannot write %s: %s", temporary.c_str(), strerror(errno));
+    return;
+  }
+  FileHeader header{kMagic, kVersion, COUNT, 0};
+  bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+      write(fd, entries_.data(), sizeof(entries_)) == sizeof(entries_);
+  close(fd);
+  if (!written || rename(temporary.c_str(), target.c_str()) != 0) {
+    ULOGE("Cannot write %s: %s", target.c_str(), strerror(errno));
+    unlink(temporary.c_str());
+  }
+}
+
+std::vector<ModeSelector::Candidate> ModeSelector::rank(
+    UvcDevice& device,
+    int32_t surfaceWidth,
+    int32_t surfaceHeight) {
+  std::vector<Candidate> candidates;
+  // What the other cameras and audio interfaces on the bus leave this one,
+  // and no more than a probe found the camera's path sustains.
+  BusBandwidthPlanner::Bus bus = device.bus();
+  uint64_t busBudget =
+      bus.budget != 0 ? BusBandwidthPlanner::shared().available(bus, &device) : UINT64_MAX;
+  ThroughputProbe::Result probed;
+  if (ThroughputProbe::shared().find(device, probed) && probed.ceiling() != 0) {
+    busBudget = std::min(busBudget, probed.ceiling());
+  }
+  uint8_t interfaceNumber;
+  uint8_t stillCaptureMethod;
+  const uvc_format_desc_t* formats;
+  for (int index = 0;
+       uvc_get_stream_interface(
+           device.handle(), index, &interfaceNumber, &stillCaptureMethod, &formats) ==
+       UVC_SUCCESS;
+       index++) {
+    for (const uvc_format_desc_t* format = formats; format != nullptr; format = format->next) {
+      uvc_frame_format frameFormat;
+      if (!pipelineFormat(format, frameFormat)) {
+        continue;
+      }
+      double usPerMegapixel = ModeCostModel::shared().cpuUsPerMegapixel(frameFormat);
+      double bytesPerPixel = frameFormat == UVC_FRAME_FORMAT_MJPEG
+          ? kMjpegBytesPerPixel
+          : (format->bBitsPerPixel > 0 ? format->bBitsPerPixel : 16) / 8.0;
+      for (const uvc_frame_desc_t* frame = format->frame_descs; frame != nullptr;
+           frame = frame->next) {
+        double megapixels = (double)frame->wWidth * frame->wHeight / 1e6;
+        for (int32_t fps : frameRates(frame)) {
+          Candidate candidate{};
+          candidate.interfaceNumber = interfaceNumber;
+          candidate.format = frameFormat;
+          candidate.width = frame->wWidth;
+          candidate.height = frame->wHeight;
+          candidate.fps = fps;
+          candidate.bytesPerSecond =
+              (uint64_t)((double)frame->wWidth * frame->wHeight * bytesPerPixel * fps);
+          candidate.cpuLoad = usPerMegapixel * megapixels * fps / 1e6;
+          candidate.fitsBus = candidate.bytesPerSecond <= busBudget;
+          candidate.fitsCpu = candidate.cpuLoad <= kMaxCpuLoad;
+          candidates.push_back(candidate);
+        }
+      }
+    }
+  }
+  if (candidates.empty()) {
+    return candidates;
+  }
+
+  if (surfaceWidth <= 0 || surfaceHeight <= 0) {
+    // No preference: measure against the largest mode.
+    auto largest = std::max_element(
+        candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+          return a.width * a.height < b.width * b.height;
+        });
+    surfaceWidth = largest->width;
+    surfaceHeight = largest->height;
+  }
+  for (Candidate& candidate : candidates) {
+    if (candidate.fitsBus && candidate.fitsCpu) {
+      double rate = std::min(candidate.fps, 60) / 60.0;
+      double fit = displayFit(candidate.width, candidate.height, surfaceWidth, surfaceHeight);
+      // Ahead of every mode that does not fit; a little headroom breaks ties.
+      candidate.score = 2.0 + 0.6 * fit + 0.35 * rate +
+          0.05 * (1.0 - candidate.cpuLoad / kMaxCpuLoad);
+    } else {
+      double busOverload = busBudget != UINT64_MAX
+          ? (double)candidate.bytesPerSecond / std::max<uint64_t>(busBudget, 1)
+          : 0;
+      double cpuOverload = candidate.cpuLoad / kMaxCpuLoad;
+      candidate.score = 1.0 / (1.0 + std::max(busOverload, cpuOverload));
+    }
+  }
+  std::stable_sort(
+      candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.score > b.score;
+      });
+  const Candidate& best = candidates.front();
+  ULOGI(
+      "Best of %zu modes for %dx%d: format %d %dx%d@%d, %.1f MB/s of %.1f, %.2f cores",
+      candidates.size(),
+      surfaceWidth,
+      surfaceHeight,
+      best.format,
+      best.width,
+      best.height,
+      best.fps,
+      best.bytesPerSecond / 1e6,
+      busBudget != UINT64_MAX ? busBudget / 1e6 : 0.0,
+      best.cpuLoad);
+  return candidates;
+}
+
+bool ModeSelector::cheapest(
+    UvcDevice& device,
+    int32_t interfaceNumber,
+    int32_t fps,
+    Candidate& mode) {
+  bool found = false;
+  for (const Candidate& candidate : rank(device, 0, 0)) {
+    if (candidate.format == UVC_FRAME_FORMAT_MJPEG ||
+        (interfaceNumber >= 0 && candidate.interfaceNumber != interfaceNumber)) {
+      continue;
+    }
+    int64_t pixels = (int64_t)candidate.width * candidate.height;
+    int64_t modePixels = (int64_t)mode.width * mode.height;
+    if (!found || pixels < modePixels ||
+        (pixels == modePixels && std::abs(candidate.fps - fps) < std::abs(mode.fps - fps))) {
+      mode = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool ModeSelector::plan(
+    const std::vector<UvcDevice*>& devices,
+    int32_t surfaceWidth,
+    int32_t surfaceHeight,
+    std::vector<Candidate>& modes) {
+  modes.assign(devices.size(), Candidate{});
+  std::vector<std::vector<Candidate>> rankings;
+  for (UvcDevice* device : devices) {
+    rankings.push_back(rank(*device, surfaceWidth, surfaceHeight));
+  }
+  bool fits = true;
+  std::vector<bool> planned(devices.size(), false);
+  for (size_t first = 0; first < devices.size(); first++) {
+    if (planned[first]) {
+      continue;
+    }
+    // The cameras on the bus of the first one not planned yet share what
+    // everything else on it leaves them.
+    BusBandwidthPlanner::Bus bus = devices[first]->bus();
+    std::vector<size_t> members;
+    std::vector<const void*> groups;
+    for (size_t d = first; d < devices.size(); d++) {
+      if (!planned[d] && devices[d]->bus() == bus) {
+        planned[d] = true;
+        members.push_back(d);
+        groups.push_back(devices[d]);
+      }
+    }
+    std::vector<std::vector<BusBandwidthPlanner::Option>> options;
+    for (size_t d : members) {
+      std::vector<BusBandwidthPlanner::Option>& list = options.emplace_back();
+      for (const Candidate& candidate : rankings[d]) {
+        list.push_back({candidate.bytesPerSecond, candidate.score});
+      }
+    }
+    uint64_t budget = bus.budget != 0 ? BusBandwidthPlanner::shared().available(bus, groups)
+                                      : UINT64_MAX;
+    std::vector<size_t> chosen;
+    bool busFits = BusBandwidthPlanner::plan(options, budget, chosen);
+    uint64_t total = 0;
+    for (size_t m = 0; m < members.size(); m++) {
+      size_t d = members[m];
+      if (rankings[d].empty()) {
+        fits = false;
+        continue;
+      }
+      modes[d] = rankings[d][chosen[m]];
+      modes[d].fitsBus = busFits;
+      total += modes[d].bytesPerSecond;
+    }
+    fits = fits && busFits;
+    ULOGI(
+        "%zu cameras on bus %u take %.1f of the %.1f MB/s it leaves them%s",
+        members.size(),
+        bus.number,
+        total / 1e6,
+        bus.budget != 0 ? budget / 1e6 : 0.0,
+        busFits ? "" : ", more than fits");
+  }
+  return fits;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "UvcDevice.h"
+
+// What getting a frame of each format on screen costs this device in CPU
+// time, per megapixel: conversion, MJPEG decoding and posting. Starts from
+// priors scaled by the CPU tier and follows what streams measure, kept in a
+// small file next to the negotiation cache so the next run starts from the
+// measurements.
+class ModeCostModel final {
+ public:
+  static ModeCostModel& shared();
+
+  // Where the file lives, typically the app's cache directory.
+  void setDirectory(const std::string& directory);
+
+  // Zero for formats the pipeline does not display.
+  double cpuUsPerMegapixel(uvc_frame_format format);
+  // A stream of the format spent cpuUsPerFrame on each width x height frame.
+  void record(uvc_frame_format format, int32_t width, int32_t height, double cpuUsPerFrame);
+
+ private:
+  enum Slot : size_t { YUYV, NV12, MJPEG, COUNT };
+  struct Entry {
+    double usPerMegapixel;
+    uint32_t samples;
+    uint32_t reserved;
+  };
+  static constexpr uint32_t kMagic = 0x4d435655; // "UVCM"
+  static constexpr uint32_t kVersion = 1;
+
+  std::mutex mutex_;
+  std::string directory_{};
+  bool loaded_{false};
+  std::array<Entry, COUNT> entries_{};
+
+  static bool slotOf(uvc_frame_format format, Slot& slot);
+  void loadLocked();
+  void saveLocked();
+};
+
+// Ranks a camera's modes for a preview surface. A mode must fit the
+// isochronous budget the other streams on its bus leave it,
+// BusBandwidthPlanner, and the CPU time this device needs for its format,
+// ModeCostModel; among those that do, the ones that fill the surface best at
+// the highest rate up to 60 fps come first. Modes that fit neither follow,
+// least overloaded first, so weak phones pick NV12 or YUYV at a lower size
+// over MJPEG they cannot decode in time.
+class ModeSelector final {
+ public:
+  struct Candidate {
+    int32_t interfaceNumber;
+    uvc_frame_format format;
+    int32_t width;
+    int32_t height;
+    int32_t fps;
+    uint64_t bytesPerSecond; // estimated for MJPEG
+    double cpuLoad; // cores busy getting the frames on screen
+    bool fitsBus;
+    bool fitsCpu;
+    double score; // higher is better
+  };
+
+  // Cores the preview of one camera may keep busy.
+  static constexpr double kMaxCpuLoad = 1.5;
+  // MJPEG is assumed to compress to about 4 bits per pixel.
+  static constexpr double kMjpegBytesPerPixel = 0.5;
+
+  // Best first. surfaceWidth and surfaceHeight may be zero for no
+  // preference.
+  static std::vector<Candidate> rank(
+      UvcDevice& device,
+      int32_t surfaceWidth,
+      int32_t surfaceHeight);
+  // The mode that gets a first frame on screen soonest: the fewest pixels of
+  // YUYV or NV12 on interfaceNumber, -1 for any, at the rate closest to fps.
+  // False when the camera streams neither.
+  static bool cheapest(UvcDevice& device, int32_t interfaceNumber, int32_t fps, Candidate& mode);
+  // One mode per camera, for cameras started together: each one's best
+  // ranked mode, stepped down where the cameras sharing a bus would not fit
+  // what its other streams leave them. A mode's fitsBus tells whether its
+  // bus's modes fit together. False when a camera has no mode, or a bus does
+  // not fit even with the cheapest modes.
+  static bool plan(
+      const std::vector<UvcDevice*>& devices,
+      int32_t surfaceWidth,
+      int32_t surfaceHeight,
+      std::vector<Candidate>& modes);
+};
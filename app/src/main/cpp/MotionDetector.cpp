@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "MotionDetector.h"
+
+#include <cstdlib>
+
+#include "FrameChangeDetector.h"
+
+bool MotionDetector::update(const uvc_frame_t* frame, int64_t nowNs) {
+  int32_t columns;
+  int32_t rows;
+  if (!FrameChangeDetector::sampleGrid(frame, grid_, columns, rows)) {
+    return false;
+  }
+  if (resetPending_.exchange(false, std::memory_order_relaxed) || columns != columns_ ||
+      rows != rows_) {
+    columns_ = columns;
+    rows_ = rows;
+    learntFrames_ = 0;
+    movingFrames_ = 0;
+  }
+  if (learntFrames_ < kWarmupFrames) {
+    learn();
+    return false;
+  }
+  bool moving = changedCells() > config_.minChangedCells * grid_.size();
+  // What moves is learnt as well, so an object that stops becomes background.
+  learn();
+  movingFrames_ = moving ? movingFrames_ + 1 : 0;
+  if (movingFrames_ < kConfirmFrames) {
+    return false;
+  }
+  lastMotionNs_.store(nowNs, std::memory_order_relaxed);
+  return true;
+}
+
+size_t MotionDetector::changedCells() const {
+  int64_t difference = 0;
+  for (size_t i = 0; i < grid_.size(); i++) {
+    difference += ((int32_t)grid_[i] << kBackgroundShift) - background_[i];
+  }
+  int32_t offset = (int32_t)(difference / (int64_t)grid_.size());
+  int32_t threshold = config_.cellChange << kBackgroundShift;
+  size_t changed = 0;
+  for (size_t i = 0; i < grid_.size(); i++) {
+    int32_t cell = ((int32_t)grid_[i] << kBackgroundShift) - background_[i] - offset;
+    changed += std::abs(cell) > threshold;
+  }
+  return changed;
+}
+
+void MotionDetector::learn() {
+  if (learntFrames_ == 0) {
+    background_.resize(grid_.size());
+    for (size_t i = 0; i < grid_.size(); i++) {
+      background_[i] = (uint16_t)(grid_[i] << kBackgroundShift);
+    }
+  } else {
+    for (size_t i = 0; i < grid_.size(); i++) {
+      int32_t target = (int32_t)grid_[i] << kBackgroundShift;
+      background_[i] = (uint16_t)(background_[i] + ((target - background_[i]) >> kBackgroundShift));
+    }
+  }
+  if (learntFrames_ < kWarmupFrames) {
+    learntFrames_++;
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Tells when something moves in front of the camera, for MotionStandby, on
+// the grid of luma averages FrameChangeDetector reduces frames to.
+//
+// Each grid is compared with a background, an exponentially weighted average
+// of the grids before it, after taking out the mean difference between the
+// two, so neither sensor noise nor the exposure settling counts. A frame
+// moves when more than minChangedCells of its cells stand out from the
+// background by cellChange, and kConfirmFrames such frames in a row are
+// motion, which a single flicker is not. The background is learnt again from
+// kWarmupFrames frames after reset() and whenever the grid changes size, as
+// it does after a mode switch. Compressed formats have no grid.
+class MotionDetector final {
+ public:
+  struct Config {
+    // Luma difference of a cell from the background, in 8 bit codes.
+    int32_t cellChange{24};
+    // Share of the cells that must change for the frame to move.
+    double minChangedCells{0.01};
+  };
+
+  static constexpr uint32_t kConfirmFrames = 2;
+  static constexpr uint32_t kWarmupFrames = 4;
+  // Each frame moves the background 1 / 2^kBackgroundShift of the way.
+  static constexpr int32_t kBackgroundShift = 4;
+
+  explicit MotionDetector(const Config& config) : config_(config) {}
+  MotionDetector(const MotionDetector&) = delete;
+  MotionDetector& operator=(const MotionDetector&) = delete;
+
+  // Render thread. Whether frame is the latest of a motion, which makes
+  // nowNs the lastMotionNs(). False for formats without a grid.
+  bool update(const uvc_frame_t* frame, int64_t nowNs);
+  // Any thread. steady_clock time of the latest frame of a motion, 0 before
+  // the first.
+  int64_t lastMotionNs() const {
+    return lastMotionNs_.load(std::memory_order_relaxed);
+  }
+  // Any thread. The background is learnt again from the next frame on.
+  void reset() {
+    resetPending_.store(true, std::memory_order_relaxed);
+  }
+
+ private:
+  const Config config_;
+  std::atomic<int64_t> lastMotionNs_{0};
+  std::atomic<bool> resetPending_{false};
+  // Render thread only. The background holds kBackgroundShift fraction bits.
+  std::vector<uint8_t> grid_{};
+  std::vector<uint16_t> background_{};
+  int32_t columns_{};
+  int32_t rows_{};
+  uint32_t learntFrames_{};
+  uint32_t movingFrames_{};
+
+  // Cells of grid_ standing out from the background, exposure taken out.
+  size_t changedCells() const;
+  void learn();
+};
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "MotionStandby.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+
+#include "StreamWatchdog.h"
+#include "StreamerController.h"
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "MotionStandby", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "MotionStandby", __VA_ARGS__)
+
+MotionStandby::MotionStandby(
+    std::shared_ptr<MotionDetector> detector,
+    nanoseconds quietPeriod,
+    Actions actions,
+    Listener listener)
+    : detector_(std::move(detector)),
+      quietPeriod_(quietPeriod),
+      actions_(std::move(actions)),
+      listener_(std::move(listener)) {}
+
+void MotionStandby::start() {
+  {
+    std::lock_guard lk(mutex_);
+    if (phase_ != Phase::kStopped) {
+      return;
+    }
+    phase_ = Phase::kSwitching;
+    switchingFrom_ = Phase::kStopped;
+    phaseSince_ = steady_clock::now();
+  }
+  post(false);
+  StreamWatchdog::shared().watch(this, [this](steady_clock::time_point now) { check(now); });
+}
+
+void MotionStandby::stop() {
+  StreamWatchdog::shared().unwatch(this);
+  std::lock_guard lk(mutex_);
+  if (phase_ == Phase::kStopped) {
+    return;
+  }
+  phase_ = Phase::kStopped;
+  ULOGI(
+      "Stopped after %u events, %.0f s in standby and %.0f s recording",
+      events_,
+      duration<double>(standbyTime_).count(),
+      duration<double>(eventTime_).count());
+}
+
+bool MotionStandby::inEvent() const {
+  std::lock_guard lk(mutex_);
+  return phase_ == Phase::kEvent;
+}
+
+void MotionStandby::check(steady_clock::time_point now) {
+  std::unique_lock lk(mutex_);
+  int64_t motionNs = detector_->lastMotionNs();
+  if (phase_ == Phase::kStandby && motionNs > armedNs_) {
+    switchingFrom_ = phase_;
+    phase_ = Phase::kSwitching;
+    lk.unlock();
+    post(true);
+  } else if (phase_ == Phase::kEvent) {
+    // Frames the detector cannot read leave the start as the last motion.
+    steady_clock::time_point lastMotion =
+        std::max(steady_clock::time_point(nanoseconds(motionNs)), phaseSince_);
+    if (now - lastMotion >= quietPeriod_) {
+      switchingFrom_ = phase_;
+      phase_ = Phase::kSwitching;
+      lk.unlock();
+      post(false);
+    }
+  }
+}
+
+void MotionStandby::post(bool beginEvent) {
+  std::shared_ptr<MotionStandby> self = shared_from_this();
+  StreamerController::shared().post(
+      {StreamerController::kVideoLane,
+       StreamerController::Priority::kNormal,
+       StreamerController::kNoCoalescing,
+       [self, beginEvent]() -> StreamerController::Result {
+         {
+           std::lock_guard lk(self->mutex_);
+           if (self->phase_ == Phase::kStopped) {
+             return false;
+           }
+         }
+         bool succeeded = beginEvent ? self->actions_.beginEvent() : self->actions_.enterStandby();
+         self->switched(beginEvent, succeeded);
+         return succeeded;
+       }},
+      nullptr);
+}
+
+void MotionStandby::switched(bool beginEvent, bool succeeded) {
+  steady_clock::time_point now = steady_clock::now();
+  {
+    std::lock_guard lk(mutex_);
+    if (phase_ != Phase::kSwitching) {
+      return;
+    }
+    nanoseconds previous = now - phaseSince_;
+    phaseSince_ = now;
+    // The switch's own frames, and all motion before, are not the next
+    // event's.
+    armedNs_ = now.time_since_epoch().count();
+    detector_->reset();
+    if (switchingFrom_ == Phase::kStandby) {
+      standbyTime_ += previous;
+    } else if (switchingFrom_ == Phase::kEvent) {
+      eventTime_ += previous;
+    }
+    if (beginEvent && succeeded) {
+      phase_ = Phase::kEvent;
+      events_++;
+      ULOGI(
+          "Motion: event %u after %.1f s in standby",
+          events_,
+          duration<double>(previous).count());
+    } else if (beginEvent) {
+      phase_ = Phase::kStandby;
+      ULOGW("Motion, but the full mode could not start");
+    } else {
+      phase_ = Phase::kStandby;
+      nanoseconds total = standbyTime_ + eventTime_;
+      ULOGI(
+          "Standby%s after %.1f s, %.0f%% of the time so far in standby",
+          succeeded ? "" : " mode could not start",
+          duration<double>(previous).count(),
+          total.count() > 0 ? 100.0 * standbyTime_.count() / total.count() : 100.0);
+    }
+  }
+  if (listener_ && (succeeded || !beginEvent)) {
+    listener_(beginEvent && succeeded);
+  }
+}
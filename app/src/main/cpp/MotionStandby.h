@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "MotionDetector.h"
+
+using namespace std::chrono;
+
+// Keeps a camera that idles most of the time in its cheapest mode until
+// something moves in front of it, then records in full quality.
+//
+// In standby the stream runs the fewest pixels the camera has uncompressed,
+// at its slowest rate, and a MotionDetector looks at every frame on the
+// render thread. Motion switches the stream to the full mode and starts an
+// event, its recording; once the detector saw nothing for the quiet period
+// the event ends and the stream goes back to standby. Full modes without a
+// grid, such as MJPEG, keep an event for the quiet period after the motion
+// that started it, and standby picks up motion that carries on.
+//
+// The checks run on StreamWatchdog's thread, and the switches, the Actions,
+// on StreamerController's video lane, one at a time, so neither waits on the
+// render thread or a USB callback.
+class MotionStandby final : public std::enable_shared_from_this<MotionStandby> {
+ public:
+  struct Actions {
+    // Ends the event's recording, if any, and switches to standby.
+    std::function<bool()> enterStandby;
+    // Switches to the full mode and starts the event's recording.
+    std::function<bool()> beginEvent;
+  };
+  // On the video lane after each switch: true when an event began, false
+  // once the stream is back in standby.
+  using Listener = std::function<void(bool event)>;
+
+  // Slowest standby rate, which still sees motion within a few frames.
+  static constexpr int32_t kStandbyMinFps = 5;
+
+  MotionStandby(
+      std::shared_ptr<MotionDetector> detector,
+      nanoseconds quietPeriod,
+      Actions actions,
+      Listener listener);
+  MotionStandby(const MotionStandby&) = delete;
+  MotionStandby& operator=(const MotionStandby&) = delete;
+
+  // Posts the switch to standby, then watches for motion.
+  void start();
+  // Stops watching and drops the switches still to run. Returns once no
+  // check runs; a switch running on the video lane completes.
+  void stop();
+  bool inEvent() const;
+
+ private:
+  enum class Phase {
+    kStopped,
+    kSwitching,
+    kStandby,
+    kEvent,
+  };
+
+  const std::shared_ptr<MotionDetector> detector_;
+  const nanoseconds quietPeriod_;
+  const Actions actions_;
+  const Listener listener_;
+  mutable std::mutex mutex_;
+  Phase phase_{Phase::kStopped};
+  // What a kSwitching phase_ leaves, for the time spent in it.
+  Phase switchingFrom_{Phase::kStopped};
+  // Motion before this does not start an event.
+  int64_t armedNs_{};
+  steady_clock::time_point phaseSince_{};
+  uint32_t events_{};
+  nanoseconds standbyTime_{};
+  nanoseconds eventTime_{};
+
+  void check(steady_clock::time_point now);
+  // Runs action on the video lane, then moves to the phase it leads to.
+  void post(bool beginEvent);
+  void switched(bool beginEvent, bool succeeded);
+};
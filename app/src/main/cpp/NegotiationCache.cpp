@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NegotiationCache.h"
+
+#include <android/log.h>
+#include <libusb/libusb.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <format>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "NegotiationCache", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "NegotiationCache", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "NegotiationCache", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "NegotiationCache", __VA_ARGS__)
+
+namespace {
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  // Entries are stored as is, so a libuvc with another layout starts over.
+  uint32_t entrySize;
+  uint32_t count;
+};
+
+// FNV-1a, to fit serial numbers of any length into a file name.
+uint64_t hashString(const std::string& value) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : value) {
+    hash = (hash ^ c) * 0x100000001b3;
+  }
+  return hash;
+}
+
+} // namespace
+
+NegotiationCache& NegotiationCache::shared() {
+  static NegotiationCache* cache = new NegotiationCache();
+  return *cache;
+}
+
+void NegotiationCache::setDirectory(const std::string& directory) {
+  std::lock_guard lk(mutex_);
+  directory_ = directory;
+  devices_.clear();
+}
+
+std::string NegotiationCache::deviceKey(uvc_device_handle_t* deviceHandle) {
+  libusb_device_handle* usbHandle = uvc_get_libusb_handle(deviceHandle);
+  libusb_device_descriptor descriptor;
+  if (libusb_get_device_descriptor(libusb_get_device(usbHandle), &descriptor) != 0) {
+    return "";
+  }
+  char serial[256] = "";
+  if (descriptor.iSerialNumber != 0 &&
+      libusb_get_string_descriptor_ascii(
+          usbHandle, descriptor.iSerialNumber, (unsigned char*)serial, sizeof(serial)) < 0) {
+    serial[0] = '\0';
+  }
+  return std::format(
+      "{:04x}_{:04x}_{:04x}_{:016x}",
+      descriptor.idVendor,
+      descriptor.idProduct,
+      descriptor.bcdDevice,
+      hashString(serial));
+}
+
+bool NegotiationCache::find(
+    const std::string& deviceKey,
+    const Mode& mode,
+    uvc_stream_ctrl_t& ctrl) {
+  std::lock_guard lk(mutex_);
+  if (directory_.empty() || deviceKey.empty()) {
+    return false;
+  }
+  for (const Entry& entry : load(deviceKey)) {
+    if (entry.mode == mode) {
+      ctrl = entry.ctrl;
+      return true;
+    }
+  }
+  return false;
+}
+
+void NegotiationCache::store(
+    const std::string& deviceKey,
+    const Mode& mode,
+    const uvc_stream_ctrl_t& ctrl) {
+  std::lock_guard lk(mutex_);
+  if (directory_.empty() || deviceKey.empty()) {
+    return;
+  }
+  std::vector<Entry>& entries = load(deviceKey);
+  std::erase_if(entries, [&mode](const Entry& entry) { return entry.mode == mode; });
+  // Newest last; the oldest mode goes first when the file is full.
+  if (entries.size() >= kMaxEntries) {
+    entries.erase(entries.begin());
+  }
+  entries.push_back({mode, ctrl});
+  save(deviceKey, entries);
+}
+
+void NegotiationCache::evict(const std::string& deviceKey, const Mode& mode) {
+  std::lock_guard lk(mutex_);
+  if (directory_.empty() || deviceKey.empty()) {
+    return;
+  }
+  std::vector<Entry>& entries = load(deviceKey);
+  if (std::erase_if(entries, [&mode](const Entry& entry) { return entry.mode == mode; }) > 0) {
+    ULOGI(
+        "Evicted %dx%d@%dfps format %d of %s",
+        mode.width,
+        mode.height,
+        mode.fps,
+        mode.format,
+        deviceKey.c_str());
+    save(deviceKey, entries);
+  }
+}
+
+std::vector<NegotiationCache::Entry>& NegotiationCache::load(const std::string& deviceKey) {
+  auto it = devices_.find(deviceKey);
+  if (it != devices_.end()) {
+    return it->second;
+  }
+  std::vector<Entry>& entries = devices_[deviceKey];
+  int fd = open(path(deviceKey).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return entries;
+  }
+  FileHeader header{};
+  if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == kMagic &&
+      header.version == kVersion && header.entrySize == sizeof(Entry) &&
+      header.count <= kMaxEntries) {
+    entries.resize(header.count);
+    ssize_t bytes = header.count * sizeof(Entry);
+    if (read(fd, entries.data(), bytes) != bytes) {
+      ULOGW("Truncated cache file for %s", deviceKey.c_str());
+      entries.clear();
+    }
+  }
+  close(fd);
+  return entries;
+}
+
+void NegotiationCache::save(const std::string& deviceKey, const std::vector<Entry>& entries) {
+  // Written aside and renamed, so a crash never leaves half a file behind.
+  std::string target = path(deviceKey);
+  std::string temporary = target + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ULOGE("Cannot write %s: %s", temporary.c_str(), strerror(errno));
+    return;
+  }
+  FileHeader header{kMagic, kVersion, sizeof(Entry), (uint32_t)entries.size()};
+  ssize_t bytes = entries.size() * sizeof(Entry);
+  bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+      write(fd, entries.data(), bytes) == bytes;
+  close(fd);
+  if (!written || rename(temporary.c_str(), target.c_str()) != 0) {
+    ULOGE("Cannot write %s: %s", target.c_str(), strerror(errno));
+    unlink(temporary.c_str());
+  }
+}
+
+std::string NegotiationCache::path(const std::string& deviceKey) const {
+  return directory_ + "/uvc_negotiation_" + deviceKey + ".bin";
+}
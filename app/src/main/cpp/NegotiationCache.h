@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Stream control blocks cameras committed before, kept in one small file per
+// camera so the next connect can skip the PROBE round and COMMIT right away.
+//
+// Cameras are told apart by VID, PID, bcdDevice and serial number, so a
+// firmware update starts over. Entries are only a shortcut: the streamer
+// negotiates from scratch and evicts the entry when its COMMIT fails or the
+// stream it starts delivers no frame.
+class NegotiationCache final {
+ public:
+  struct Mode {
+    int32_t interfaceNumber; // -1 for the first interface with the format
+    int32_t format; // uvc_frame_format
+    int32_t width;
+    int32_t height;
+    int32_t fps;
+
+    bool operator==(const Mode& other) const = default;
+  };
+
+  static NegotiationCache& shared();
+
+  // Where the files live, typically the app's cache directory. Nothing is
+  // cached until it is set.
+  void setDirectory(const std::string& directory);
+
+  // Empty when the device descriptor cannot be read.
+  static std::string deviceKey(uvc_device_handle_t* deviceHandle);
+
+  bool find(const std::string& deviceKey, const Mode& mode, uvc_stream_ctrl_t& ctrl);
+  void store(const std::string& deviceKey, const Mode& mode, const uvc_stream_ctrl_t& ctrl);
+  void evict(const std::string& deviceKey, const Mode& mode);
+
+ private:
+  struct Entry {
+    Mode mode;
+    uvc_stream_ctrl_t ctrl;
+  };
+  static constexpr uint32_t kMagic = 0x4e435655; // "UVCN"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kMaxEntries = 32;
+
+  std::mutex mutex_;
+  std::string directory_{};
+  // Entries of every camera seen since the directory was set, loaded on first use.
+  std::map<std::string, std::vector<Entry>> devices_{};
+
+  std::vector<Entry>& load(const std::string& deviceKey);
+  void save(const std::string& deviceKey, const std::vector<Entry>& entries);
+  std::string path(const std::string& deviceKey) const;
+};
@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PcmConverter.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_AVX2 1
+#endif
+
+#include <cstring>
+
+namespace {
+
+constexpr float kQ15Scale = 1.0f / 32768.0f;
+constexpr float kQ31Scale = 1.0f / 2147483648.0f;
+
+#if defined(PCM_AVX2)
+// Android's x86 ABIs only guarantee SSSE3, so the AVX2 loops are built for
+// it alone and picked at run time. Each returns how many samples it did.
+const bool kHasAvx2 = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}();
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// Three byte samples of both 128 bit lanes, four per lane, into the top
+// bytes of 32 bit words.
+AVX2_TARGET __m256i loadI24x8(const uint8_t* src) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+      -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  __m256i bytes = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)src)),
+      _mm_loadu_si128((const __m128i*)(src + 12)),
+      1);
+  return _mm256_shuffle_epi8(bytes, shuffle);
+}
+
+// The 16 bytes loadI24x8() reads from src + 12 run 4 past the 8 samples.
+AVX2_TARGET size_t i24ToI32Avx2(const uint8_t* src, int32_t* dst, size_t samples) {
+  size_t i = 0;
+  for (; i + 10 <= samples; i += 8) {
+    _mm256_storeu_si256((__m256i*)(dst + i), loadI24x8(src + i * 3));
+  }
+  return i;
+}
+
+AVX2_TARGET size_t i24ToFloatAvx2(const uint8_t* src, float* dst, size_t samples) {
+  const __m256 scale = _mm256_set1_ps(kQ31Scale);
+  size_t i = 0;
+  for (; i + 10 <= samples; i += 8) {
+    __m256 value = _mm256_cvtepi32_ps(loadI24x8(src + i * 3));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(value, scale));
+  }
+  return i;
+}
+
+AVX2_TARGET size_t i24ToI16Avx2(const uint8_t* src, int16_t* dst, size_t samples) {
+  size_t i = 0;
+  for (; i + 10 <= samples; i += 8) {
+    __m256i words = _mm256_srai_epi32(loadI24x8(src + i * 3), 16);
+    __m128i packed = _mm_packs_epi32(
+        _mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128((__m128i*)(dst + i), packed);
+  }
+  return i;
+}
+
+AVX2_TARGET size_t i32ToFloatAvx2(const int32_t* src, float* dst, size_t samples) {
+  const __m256 scale = _mm256_set1_ps(kQ31Scale);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256 value = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(value, scale));
+  }
+  return i;
+}
+
+AVX2_TARGET size_t i16ToFloatAvx2(const int16_t* src, float* dst, size_t samples) {
+  const __m256 scale = _mm256_set1_ps(kQ15Scale);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256i value = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(value), scale));
+  }
+  return i;
+}
+
+AVX2_TARGET size_t i16ToI32Avx2(const int16_t* src, int32_t* dst, size_t samples) {
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256i value = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi32(value, 16));
+  }
+  return i;
+}
+
+AVX2_TARGET size_t i32ToI16Avx2(const int32_t* src, int16_t* dst, size_t samples) {
+  size_t i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m256i low = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(src + i)), 16);
+    __m256i high = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(src + i + 8)), 16);
+    // The pack interleaves the lanes of its operands.
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+    _mm256_storeu_si256((__m256i*)(dst + i), packed);
+  }
+  return i;
+}
+
+// Clamped first: an out of range conversion is INT32_MIN whatever the sign.
+AVX2_TARGET size_t floatToI16Avx2(const float* src, int16_t* dst, size_t samples) {
+  const __m256 scale = _mm256_set1_ps(32768.0f);
+  const __m256 low = _mm256_set1_ps(-32768.0f);
+  const __m256 high = _mm256_set1_ps(32767.0f);
+  size_t i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+    __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+    __m256i a32 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(a, low), high));
+    __m256i b32 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(b, low), high));
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a32, b32), 0xd8);
+    _mm256_storeu_si256((__m256i*)(dst + i), packed);
+  }
+  return i;
+}
+
+AVX2_TARGET size_t floatToI32Avx2(const float* src, int32_t* dst, size_t samples) {
+  const __m256 scale = _mm256_set1_ps(2147483648.0f);
+  const __m256 low = _mm256_set1_ps(-2147483648.0f);
+  const __m256 high = _mm256_set1_ps(2147483520.0f);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256 value = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+    value = _mm256_min_ps(_mm256_max_ps(value, low), high);
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvttps_epi32(value));
+  }
+  return i;
+}
+#endif
+
+int32_t loadI24(const uint8_t* src) {
+  // Left aligned, so 24 bit samples span the full 32 bit range.
+  return (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 24);
+}
+
+void i24ToI32(const uint8_t* src, int32_t* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  uint8x16_t zero = vdupq_n_u8(0);
+  for (; i + 16 <= samples; i += 16) {
+    uint8x16x3_t bytes = vld3q_u8(src + i * 3);
+    uint8x16x4_t words = {{zero, bytes.val[0], bytes.val[1], bytes.val[2]}};
+    vst4q_u8(reinterpret_cast<uint8_t*>(dst + i), words);
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i24ToI32Avx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = loadI24(src + i * 3);
+  }
+}
+
+void i24ToFloat(const uint8_t* src, float* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  int32_t widened[16];
+  for (; i + 16 <= samples; i += 16) {
+    i24ToI32(src + i * 3, widened, 16);
+    for (size_t j = 0; j < 16; j += 4) {
+      vst1q_f32(dst + i + j, vcvtq_n_f32_s32(vld1q_s32(widened + j), 31));
+    }
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i24ToFloatAvx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = loadI24(src + i * 3) * kQ31Scale;
+  }
+}
+
+void i32ToFloat(const int32_t* src, float* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= samples; i += 16) {
+    for (size_t j = 0; j < 16; j += 4) {
+      vst1q_f32(dst + i + j, vcvtq_n_f32_s32(vld1q_s32(src + i + j), 31));
+    }
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i32ToFloatAvx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = src[i] * kQ31Scale;
+  }
+}
+
+void i16ToFloat(const int16_t* src, float* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= samples; i += 16) {
+    for (size_t j = 0; j < 16; j += 8) {
+      int16x8_t s = vld1q_s16(src + i + j);
+      vst1q_f32(dst + i + j, vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(s)), 15));
+      vst1q_f32(dst + i + j + 4, vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(s)), 15));
+    }
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i16ToFloatAvx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = src[i] * kQ15Scale;
+  }
+}
+
+void i16ToI32(const int16_t* src, int32_t* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 8 <= samples; i += 8) {
+    int16x8_t s = vld1q_s16(src + i);
+    vst1q_s32(dst + i, vshll_n_s16(vget_low_s16(s), 16));
+    vst1q_s32(dst + i + 4, vshll_n_s16(vget_high_s16(s), 16));
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i16ToI32Avx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = (int32_t)((uint32_t)(uint16_t)src[i] << 16);
+  }
+}
+
+void i32ToI16(const int32_t* src, int16_t* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 8 <= samples; i += 8) {
+    int16x4_t low = vshrn_n_s32(vld1q_s32(src + i), 16);
+    int16x4_t high = vshrn_n_s32(vld1q_s32(src + i + 4), 16);
+    vst1q_s16(dst + i, vcombine_s16(low, high));
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i32ToI16Avx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = (int16_t)(src[i] >> 16);
+  }
+}
+
+void i24ToI16(const uint8_t* src, int16_t* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= samples; i += 16) {
+    uint8x16x3_t bytes = vld3q_u8(src + i * 3);
+    uint8x16x2_t halves = {{bytes.val[1], bytes.val[2]}};
+    vst2q_u8(reinterpret_cast<uint8_t*>(dst + i), halves);
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = i24ToI16Avx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = (int16_t)(src[i * 3 + 1] | src[i * 3 + 2] << 8);
+  }
+}
+
+void floatToI16(const float* src, int16_t* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 8 <= samples; i += 8) {
+    // Saturating Q15 conversion clips out of range samples.
+    int32x4_t low = vcvtq_n_s32_f32(vld1q_f32(src + i), 15);
+    int32x4_t high = vcvtq_n_s32_f32(vld1q_f32(src + i + 4), 15);
+    vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = floatToI16Avx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = (int16_t)std::clamp(src[i] * 32768.0f, -32768.0f, 32767.0f);
+  }
+}
+
+void floatToI32(const float* src, int32_t* dst, size_t samples) {
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 4 <= samples; i += 4) {
+    vst1q_s32(dst + i, vcvtq_n_s32_f32(vld1q_f32(src + i), 31));
+  }
+#elif defined(PCM_AVX2)
+  if (kHasAvx2) {
+    i = floatToI32Avx2(src, dst, samples);
+  }
+#endif
+  for (; i < samples; i++) {
+    dst[i] = (int32_t)std::clamp(src[i] * 2147483648.0f, -2147483648.0f, 2147483520.0f);
+  }
+}
+
+} // namespace
+
+bool PcmConverter::encodingForSubframe(bool isFloat, uint8_t subFrameSize, PcmEncoding& encoding) {
+  if (isFloat) {
+    encoding = PcmEncoding::FLOAT;
+    return subFrameSize == 4;
+  }
+  switch (subFrameSize) {
+    case 2:
+      encoding = PcmEncoding::I16;
+      return true;
+    case 3:
+      encoding = PcmEncoding::I24_PACKED;
+      return true;
+    case 4:
+      encoding = PcmEncoding::I32;
+      return true;
+    default:
+      return false;
+  }
+}
+
+size_t PcmConverter::bytesPerSample(PcmEncoding encoding) {
+  switch (encoding) {
+    case PcmEncoding::I16:
+      return 2;
+    case PcmEncoding::I24_PACKED:
+      return 3;
+    case PcmEncoding::I32:
+    case PcmEncoding::FLOAT:
+      return 4;
+  }
+  return 2;
+}
+
+aaudio_format_t PcmConverter::aaudioFormat(PcmEncoding encoding) {
+  switch (encoding) {
+    case PcmEncoding::I16:
+      return AAUDIO_FORMAT_PCM_I16;
+    case PcmEncoding::I24_PACKED:
+      return AAUDIO_FORMAT_PCM_I24_PACKED;
+    case PcmEncoding::I32:
+      return AAUDIO_FORMAT_PCM_I32;
+    case PcmEncoding::FLOAT:
+      return AAUDIO_FORMAT_PCM_FLOAT;
+  }
+  return AAUDIO_FORMAT_PCM_I16;
+}
+
+bool PcmConverter::encodingForAAudioFormat(aaudio_format_t format, PcmEncoding& encoding) {
+  switch (format) {
+    case AAUDIO_FORMAT_PCM_I16:
+      encoding = PcmEncoding::I16;
+      return true;
+    case AAUDIO_FORMAT_PCM_I32:
+      encoding = PcmEncoding::I32;
+      return true;
+    case AAUDIO_FORMAT_PCM_FLOAT:
+      encoding = PcmEncoding::FLOAT;
+      return true;
+    default:
+      // Packed 24 bit output would split samples across ring spans.
+      return false;
+  }
+}
+
+const char* PcmConverter::name(PcmEncoding encoding) {
+  switch (encoding) {
+    case PcmEncoding::I16:
+      return "PCM16";
+    case PcmEncoding::I24_PACKED:
+      return "PCM24";
+    case PcmEncoding::I32:
+      return "PCM32";
+    case PcmEncoding::FLOAT:
+      return "PCM Float";
+  }
+  return "";
+}
+
+void PcmConverter::convert(const uint8_t* src, uint8_t* dst, size_t samples) const {
+  if (input_ == output_) {
+    memcpy(dst, src, samples * inputBytes_);
+    return;
+  }
+  auto* i16Src = reinterpret_cast<const int16_t*>(src);
+  auto* i32Src = reinterpret_cast<const int32_t*>(src);
+  auto* floatSrc = reinterpret_cast<const float*>(src);
+  auto* i16Dst = reinterpret_cast<int16_t*>(dst);
+  auto* i32Dst = reinterpret_cast<int32_t*>(dst);
+  auto* floatDst = reinterpret_cast<float*>(dst);
+  switch (input_) {
+    case PcmEncoding::I16:
+      if (output_ == PcmEncoding::I32) {
+        i16ToI32(i16Src, i32Dst, samples);
+      } else if (output_ == PcmEncoding::FLOAT) {
+        i16ToFloat(i16Src, floatDst, samples);
+      }
+      break;
+    case PcmEncoding::I24_PACKED:
+      if (output_ == PcmEncoding::I32) {
+        i24ToI32(src, i32Dst, samples);
+      } else if (output_ == PcmEncoding::FLOAT) {
+        i24ToFloat(src, floatDst, samples);
+      } else if (output_ == PcmEncoding::I16) {
+        i24ToI16(src, i16Dst, samples);
+      }
+      break;
+    case PcmEncoding::I32:
+      if (output_ == PcmEncoding::FLOAT) {
+        i32ToFloat(i32Src, floatDst, samples);
+      } else if (output_ == PcmEncoding::I16) {
+        i32ToI16(i32Src, i16Dst, samples);
+      }
+      break;
+    case PcmEncoding::FLOAT:
+      if (output_ == PcmEncoding::I16) {
+        floatToI16(floatSrc, i16Dst, samples);
+      } else if (output_ == PcmEncoding::I32) {
+        floatToI32(floatSrc, i32Dst, samples);
+      }
+      break;
+  }
+}
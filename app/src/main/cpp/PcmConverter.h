@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <aaudio/AAudio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Sample encodings on either side of the audio ring buffer.
+enum class PcmEncoding : uint8_t {
+  I16,
+  I24_PACKED, // 3 bytes per sample, little endian
+  I32,
+  FLOAT,
+};
+
+// Converts USB audio subframes to the AAudio stream's sample format as they
+// are written into the ring buffer, so the playback callback only copies.
+// The conversions used by the supported devices have NEON kernels that
+// handle 16 samples per iteration, with a scalar loop for the remainder.
+class PcmConverter final {
+ public:
+  // Returns false for a USB subframe layout that cannot be played.
+  static bool encodingForSubframe(bool isFloat, uint8_t subFrameSize, PcmEncoding& encoding);
+  static size_t bytesPerSample(PcmEncoding encoding);
+  static aaudio_format_t aaudioFormat(PcmEncoding encoding);
+  static bool encodingForAAudioFormat(aaudio_format_t format, PcmEncoding& encoding);
+  static const char* name(PcmEncoding encoding);
+
+  void init(PcmEncoding input, PcmEncoding output) {
+    input_ = input;
+    output_ = output;
+    inputBytes_ = bytesPerSample(input);
+    outputBytes_ = bytesPerSample(output);
+  }
+
+  PcmEncoding input() const {
+    return input_;
+  }
+  PcmEncoding output() const {
+    return output_;
+  }
+  size_t inputBytesPerSample() const {
+    return inputBytes_;
+  }
+  size_t outputBytesPerSample() const {
+    return outputBytes_;
+  }
+
+  void convert(const uint8_t* src, uint8_t* dst, size_t samples) const;
+
+  // Converts up to samples input samples into a ring's byte spans, starting
+  // offset bytes in. Spans must split on output sample boundaries, which a
+  // power-of-two ring written in whole samples does. Returns the bytes
+  // written.
+  template <typename Spans>
+  size_t convertInto(const Spans& spans, size_t offset, const uint8_t* src, size_t samples) const {
+    size_t room = spans.size() - std::min(offset, spans.size());
+    samples = std::min(samples, room / outputBytes_);
+    size_t converted = 0;
+    if (offset < spans.firstSize) {
+      converted = std::min(samples, (spans.firstSize - offset) / outputBytes_);
+      convert(src, spans.first + offset, converted);
+    }
+    if (converted < samples) {
+      size_t secondOffset = offset + converted * outputBytes_ - spans.firstSize;
+      convert(src + converted * inputBytes_, spans.second + secondOffset, samples - converted);
+    }
+    return samples * outputBytes_;
+  }
+
+ private:
+  PcmEncoding input_{PcmEncoding::I16};
+  PcmEncoding output_{PcmEncoding::I16};
+  size_t inputBytes_{2};
+  size_t outputBytes_{2};
+};
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PreRollRecorder.h"
+
+#include <android/log.h>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaFormat.h>
+
+#include <sys/prctl.h>
+#include <ctime>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "PreRollRecorder", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "PreRollRecorder", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "PreRollRecorder", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "PreRollRecorder", __VA_ARGS__)
+
+namespace {
+
+// Parameter sets at the start of an Annex B access unit, with start codes:
+// SPS to sps and PPS to pps for H.264, VPS, SPS and PPS all to sps for H.265.
+void splitParameterSets(
+    const std::vector<uint8_t>& accessUnit,
+    bool hevc,
+    std::vector<uint8_t>& sps,
+    std::vector<uint8_t>& pps) {
+  static constexpr uint8_t kStartCode[] = {0, 0, 0, 1};
+  const uint8_t* end = accessUnit.data() + accessUnit.size();
+  const uint8_t* p = accessUnit.data();
+  while (end - p >= 4) {
+    if (p[0] != 0 || p[1] != 0 || p[2] != 1) {
+      p++;
+      continue;
+    }
+    const uint8_t* nal = p + 3;
+    p = nal;
+    while (end - p >= 3 && !(p[0] == 0 && p[1] == 0 && (p[2] == 1 || p[2] == 0))) {
+      p++;
+    }
+    const uint8_t* nalEnd = end - p >= 3 ? p : end;
+    std::vector<uint8_t>* out = nullptr;
+    if (hevc) {
+      uint8_t type = (nal[0] >> 1) & 0x3F;
+      if (type < 32) {
+        return;
+      }
+      out = type <= 34 ? &sps : nullptr;
+    } else {
+      uint8_t type = nal[0] & 0x1F;
+      if (type >= 1 && type <= 5) {
+        return;
+      }
+      out = type == 7 ? &sps : type == 8 ? &pps : nullptr;
+    }
+    if (out != nullptr) {
+      out->insert(out->end(), kStartCode, kStartCode + sizeof(kStartCode));
+      out->insert(out->end(), nal, nalEnd);
+    }
+  }
+}
+
+} // namespace
+
+PreRollRecorder::~PreRollRecorder() {
+  stop();
+}
+
+bool PreRollRecorder::start(
+    int fd,
+    std::shared_ptr<InstantReplay> replay,
+    nanoseconds preRoll) {
+  const InstantReplay::Config& config = replay->config();
+  if (running_ ||
+      (config.format != UVC_FRAME_FORMAT_H264 && config.format != UVC_FRAME_FORMAT_H265)) {
+    return false;
+  }
+  muxer_ = AMediaMuxer_new(fd, AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+  if (muxer_ == nullptr) {
+    ULOGE("AMediaMuxer_new failed for fd %d", fd);
+    return false;
+  }
+  if (!replay->follow(preRoll)) {
+    AMediaMuxer_delete(muxer_);
+    muxer_ = nullptr;
+    return false;
+  }
+  replay_ = std::move(replay);
+  stopTimeNs_ = INT64_MAX;
+  running_ = true;
+  writerThread_ = std::thread(&PreRollRecorder::writerLoop, this);
+  ULOGI(
+      "Recording %s %ux%u from %.1f s back",
+      config.format == UVC_FRAME_FORMAT_H265 ? "HEVC" : "H.264",
+      config.width,
+      config.height,
+      duration_cast<milliseconds>(preRoll).count() / 1e3);
+  return true;
+}
+
+bool PreRollRecorder::stop() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  stopTimeNs_ = now.tv_sec * 1'000'000'000LL + now.tv_nsec;
+  if (!running_.exchange(false)) {
+    return false;
+  }
+  writerThread_.join();
+  replay_->unfollow();
+  uint64_t lost = replay_->followLost();
+  replay_ = nullptr;
+  bool finalized = muxerStarted_ && !writeFailed_ && AMediaMuxer_stop(muxer_) == AMEDIA_OK;
+  AMediaMuxer_delete(muxer_);
+  muxer_ = nullptr;
+  ULOGI(
+      "Recording stopped after %llu frames, %.1f MB, %llu lost to the replay%s",
+      (unsigned long long)frames_,
+      bytes_ / 1e6,
+      (unsigned long long)lost,
+      finalized ? "" : ", file is incomplete");
+  return finalized;
+}
+
+void PreRollRecorder::writerLoop() {
+  prctl(PR_SET_NAME, "usb_video_preroll");
+  InstantReplay::FollowedFrame frame;
+  // The backlog up to stop() is written too.
+  while (true) {
+    if (!replay_->readFollowed(frame, running_ ? 10ms : 0ms)) {
+      if (!running_) {
+        return;
+      }
+      continue;
+    }
+    if (frame.record.captureTimeNs > stopTimeNs_) {
+      return;
+    }
+    if (writeFailed_) {
+      continue;
+    }
+    if (!muxerStarted_ && (!frame.keyframe || !startMuxer(frame.payload))) {
+      continue;
+    }
+    writeFrame(frame);
+  }
+}
+
+bool PreRollRecorder::startMuxer(const std::vector<uint8_t>& keyframe) {
+  const InstantReplay::Config& config = replay_->config();
+  bool hevc = config.format == UVC_FRAME_FORMAT_H265;
+  std::vector<uint8_t> sps;
+  std::vector<uint8_t> pps;
+  splitParameterSets(keyframe, hevc, sps, pps);
+  if (sps.empty() || (!hevc && pps.empty())) {
+    ULOGW("Keyframe without parameter sets, waiting for the next one");
+    return false;
+  }
+  AMediaFormat* format = AMediaFormat_new();
+  AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, hevc ? "video/hevc" : "video/avc");
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, config.width);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, config.height);
+  AMediaFormat_setBuffer(format, AMEDIAFORMAT_KEY_CSD_0, sps.data(), sps.size());
+  if (!hevc) {
+    AMediaFormat_setBuffer(format, AMEDIAFORMAT_KEY_CSD_1, pps.data(), pps.size());
+  }
+  track_ = AMediaMuxer_addTrack(muxer_, format);
+  AMediaFormat_delete(format);
+  media_status_t status = track_ >= 0 ? AMediaMuxer_start(muxer_) : AMEDIA_ERROR_UNKNOWN;
+  if (status != AMEDIA_OK) {
+    ULOGE("Muxer start error %d, track %zd", status, track_);
+    writeFailed_ = true;
+    return false;
+  }
+  muxerStarted_ = true;
+  return true;
+}
+
+void PreRollRecorder::writeFrame(const InstantReplay::FollowedFrame& frame) {
+  TRACE_SCOPE("writePreRollSample");
+  if (frames_ == 0) {
+    firstCaptureTimeNs_ = frame.record.captureTimeNs;
+  }
+  AMediaCodecBufferInfo info{
+      .offset = 0,
+      .size = (int32_t)frame.payload.size(),
+      .presentationTimeUs = (frame.record.captureTimeNs - firstCaptureTimeNs_) / 1000,
+      .flags = frame.keyframe ? kBufferFlagKeyFrame : 0,
+  };
+  media_status_t status =
+      AMediaMuxer_writeSampleData(muxer_, track_, frame.payload.data(), &info);
+  if (status != AMEDIA_OK) {
+    ULOGE("Sample write error %d", status);
+    writeFailed_ = true;
+    return;
+  }
+  frames_++;
+  bytes_ += frame.payload.size();
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <media/NdkMediaMuxer.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "InstantReplay.h"
+
+using namespace std::chrono;
+
+// Records an instant replay of an H.264 or H.265 stream to an MP4 file,
+// beginning some time in the past.
+//
+// The replay is followed from the last keyframe at least the pre-roll back,
+// so the file starts on a keyframe, and its frames are muxed as they are
+// with AMediaMuxer, without decoding or re-encoding them. The writer then
+// catches up with the live frames as the camera, or StreamRecorder's encoder
+// for uncompressed cameras, adds them. The track takes its parameter sets
+// from the first keyframe. The replay keeps no audio, so neither does the
+// file.
+class PreRollRecorder final {
+ public:
+  PreRollRecorder() = default;
+  PreRollRecorder(const PreRollRecorder&) = delete;
+  PreRollRecorder& operator=(const PreRollRecorder&) = delete;
+  ~PreRollRecorder();
+
+  // fd must be open for reading and writing; the caller keeps ownership.
+  // replay must be of an H.264 or H.265 stream.
+  bool start(int fd, std::shared_ptr<InstantReplay> replay, nanoseconds preRoll);
+  // Writes the frames captured up to now. Returns true when a playable file
+  // was finalized.
+  bool stop();
+
+ private:
+  // AMEDIACODEC_BUFFER_FLAG_KEY_FRAME, declared from API 34 on.
+  static constexpr uint32_t kBufferFlagKeyFrame = 1;
+
+  std::shared_ptr<InstantReplay> replay_{};
+  AMediaMuxer* muxer_{};
+  std::thread writerThread_{};
+  std::atomic<bool> running_{false};
+  // Frames captured after stop() are left out.
+  std::atomic<int64_t> stopTimeNs_{INT64_MAX};
+
+  // Writer thread only.
+  ssize_t track_{-1};
+  bool muxerStarted_{false};
+  int64_t firstCaptureTimeNs_{};
+  uint64_t frames_{};
+  uint64_t bytes_{};
+  bool writeFailed_{false};
+
+  void writerLoop();
+  bool startMuxer(const std::vector<uint8_t>& keyframe);
+  void writeFrame(const InstantReplay::FollowedFrame& frame);
+};
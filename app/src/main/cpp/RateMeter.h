@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+using namespace std::chrono;
+
+// Event rate of a stream: a 64 bit total, the rate over a sliding window of
+// kWindow and an exponentially weighted rate with the given time constant.
+//
+// Callers pass the time of the event, so a completion costs the one clock
+// read it already makes. The window advances in kBucket steps; rates are
+// republished as each bucket closes, so they hold the values of the last
+// event until the next one. There must be one writer, but any thread may
+// take a snapshot while it adds.
+class RateMeter {
+ public:
+  static constexpr nanoseconds kBucket{100ms};
+  static constexpr size_t kBuckets = 10;
+  static constexpr nanoseconds kWindow{kBucket * kBuckets};
+
+  struct Snapshot {
+    uint64_t total{};
+    // Events per second.
+    double windowRate{};
+    double smoothedRate{};
+  };
+
+  explicit RateMeter(nanoseconds timeConstant = 2s)
+      : alpha_(1 - std::exp(-duration<double>(kBucket) / duration<double>(timeConstant))) {}
+
+  // Returns true once per kWindow, for callers that publish at that pace.
+  bool add(uint64_t count, steady_clock::time_point now) {
+    int64_t bucket = now.time_since_epoch() / kBucket;
+    if (!started_) {
+      started_ = true;
+      bucket_ = bucket;
+      reportedBucket_ = bucket;
+    }
+    if (bucket > bucket_) {
+      advance(bucket);
+    }
+    slots_[(size_t)(bucket_ % kSlots)] += count;
+    total_.store(total_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    if (bucket - reportedBucket_ >= (int64_t)kBuckets) {
+      reportedBucket_ = bucket;
+      return true;
+    }
+    return false;
+  }
+
+  Snapshot snapshot() const {
+    return {
+        .total = total_.load(std::memory_order_relaxed),
+        .windowRate = windowRate_.load(std::memory_order_relaxed),
+        .smoothedRate = smoothedRate_.load(std::memory_order_relaxed),
+    };
+  }
+
+  // Starts the rates over; the total keeps counting.
+  void reset() {
+    started_ = false;
+    slots_ = {};
+    windowSum_ = 0;
+    smoothed_ = -1;
+    windowRate_.store(0, std::memory_order_relaxed);
+    smoothedRate_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  // The bucket being filled and the kBuckets closed ones of the window.
+  static constexpr size_t kSlots = kBuckets + 1;
+
+  double alpha_;
+  bool started_{false};
+  int64_t bucket_{};
+  int64_t reportedBucket_{};
+  std::array<uint64_t, kSlots> slots_{};
+  uint64_t windowSum_{};
+  double smoothed_{-1};
+  std::atomic<uint64_t> total_{0};
+  std::atomic<double> windowRate_{0};
+  std::atomic<double> smoothedRate_{0};
+
+  void advance(int64_t bucket) {
+    double perSecond = 1 / duration<double>(kBucket).count();
+    int64_t gap = bucket - bucket_;
+    // Buckets that closed empty decay the smoothed rate as well.
+    for (int64_t i = 0; i < std::min<int64_t>(gap, kSlots); i++) {
+      uint64_t closed = slots_[(size_t)(bucket_ % kSlots)];
+      double rate = closed * perSecond;
+      smoothed_ = smoothed_ < 0 ? rate : smoothed_ + alpha_ * (rate - smoothed_);
+      windowSum_ += closed;
+      bucket_++;
+      // The slot the new bucket reuses held the one leaving the window.
+      uint64_t& leaving = slots_[(size_t)(bucket_ % kSlots)];
+      windowSum_ -= leaving;
+      leaving = 0;
+    }
+    if (gap > (int64_t)kSlots) {
+      smoothed_ *= std::pow(1 - alpha_, (double)(gap - kSlots));
+      slots_ = {};
+      windowSum_ = 0;
+    }
+    bucket_ = bucket;
+    windowRate_.store(windowSum_ / duration<double>(kWindow).count(), std::memory_order_relaxed);
+    smoothedRate_.store(smoothed_, std::memory_order_relaxed);
+  }
+};
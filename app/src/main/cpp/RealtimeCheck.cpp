@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "RealtimeCheck.h"
+
+#include <android/log.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <unwind.h>
+#include <atomic>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdlib>
+#include <ctime>
+
+// The link passes --wrap for each of the calls below, which points every
+// reference to e.g. malloc from the objects and static libraries linked into
+// libusbvideo.so at __wrap_malloc, and __real_malloc at libc's malloc.
+// Allocations and locks inside libaaudio or libc itself are not seen.
+//
+// The stack is logged the way a tombstone lists it, so ndk-stack or
+// llvm-symbolizer with the unstripped library turn it into file and line:
+//   adb logcat -s RealtimeCheck | ndk-stack -sym app/build/intermediates/...
+
+#define ULOGW(...) __real___android_log_print(ANDROID_LOG_WARN, "RealtimeCheck", __VA_ARGS__)
+
+extern "C" {
+void* __real_malloc(size_t bytes);
+void* __real_calloc(size_t count, size_t bytes);
+void* __real_realloc(void* ptr, size_t bytes);
+void __real_free(void* ptr);
+void* __real_aligned_alloc(size_t alignment, size_t bytes);
+int __real_posix_memalign(void** ptr, size_t alignment, size_t bytes);
+void* __real_memalign(size_t alignment, size_t bytes);
+int __real_pthread_mutex_lock(pthread_mutex_t* mutex);
+int __real_pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex);
+int __real_pthread_cond_timedwait(
+    pthread_cond_t* cond,
+    pthread_mutex_t* mutex,
+    const struct timespec* abstime);
+int __real_pthread_rwlock_rdlock(pthread_rwlock_t* rwlock);
+int __real_pthread_rwlock_wrlock(pthread_rwlock_t* rwlock);
+int __real_pthread_join(pthread_t thread, void** result);
+int __real___android_log_print(int priority, const char* tag, const char* format, ...);
+int __real___android_log_vprint(int priority, const char* tag, const char* format, va_list args);
+int __real___android_log_write(int priority, const char* tag, const char* text);
+int __real_usleep(useconds_t us);
+int __real_nanosleep(const struct timespec* duration, struct timespec* remaining);
+int __real_clock_nanosleep(
+    clockid_t clock,
+    int flags,
+    const struct timespec* duration,
+    struct timespec* remaining);
+int __real_poll(struct pollfd* fds, nfds_t count, int timeoutMs);
+int __real_epoll_wait(int epfd, struct epoll_event* events, int count, int timeoutMs);
+int __real_select(int count, fd_set* read, fd_set* write, fd_set* except, struct timeval* timeout);
+ssize_t __real_read(int fd, void* buf, size_t bytes);
+ssize_t __real_write(int fd, const void* buf, size_t bytes);
+int __real_ioctl(int fd, int request, ...);
+int __real_fsync(int fd);
+// What FORTIFY turns read(), write() and poll() into when it knows the size
+// of the buffer.
+ssize_t __real___read_chk(int fd, void* buf, size_t bytes, size_t bufBytes);
+ssize_t __real___write_chk(int fd, const void* buf, size_t bytes, size_t bufBytes);
+int __real___poll_chk(struct pollfd* fds, nfds_t count, int timeoutMs, size_t fdsBytes);
+}
+
+namespace {
+
+constexpr size_t kMaxFrames = 32;
+// Stacks already logged; new ones past this many are only counted.
+constexpr size_t kLoggedStacks = 256;
+
+// Innermost section of the thread, null outside of any.
+thread_local const char* tSection = nullptr;
+// While logging, whose own allocations, locks and writes are not the
+// section's.
+thread_local bool tReporting = false;
+
+std::atomic<uint64_t> gLoggedStacks[kLoggedStacks]{};
+std::atomic<uint64_t> gViolations{0};
+
+struct Backtrace {
+  uintptr_t pcs[kMaxFrames];
+  size_t frames{};
+};
+
+_Unwind_Reason_Code unwindFrame(_Unwind_Context* context, void* arg) {
+  Backtrace* backtrace = static_cast<Backtrace*>(arg);
+  uintptr_t pc = _Unwind_GetIP(context);
+  if (pc != 0) {
+    backtrace->pcs[backtrace->frames++] = pc;
+  }
+  return backtrace->frames == kMaxFrames ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+// Whether the stack is new, recording it if so.
+bool firstSeen(const Backtrace& backtrace) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < backtrace.frames; i++) {
+    hash = (hash ^ backtrace.pcs[i]) * 0x100000001b3ull;
+  }
+  hash |= 1; // 0 marks a free entry
+  for (size_t probe = 0; probe < kLoggedStacks; probe++) {
+    std::atomic<uint64_t>& entry = gLoggedStacks[(hash + probe) % kLoggedStacks];
+    uint64_t expected = 0;
+    if (entry.compare_exchange_strong(expected, hash, std::memory_order_relaxed)) {
+      return true;
+    }
+    if (expected == hash) {
+      return false;
+    }
+  }
+  return false;
+}
+
+__attribute__((noinline)) void report(const char* call) {
+  tReporting = true;
+  uint64_t violation = gViolations.fetch_add(1, std::memory_order_relaxed) + 1;
+  Backtrace backtrace{};
+  _Unwind_Backtrace(unwindFrame, &backtrace);
+  if (firstSeen(backtrace)) {
+    ULOGW("%s in real-time section %s, violation %" PRIu64, call, tSection, violation);
+    // Frame 0 is report() itself.
+    for (size_t i = 1; i < backtrace.frames; i++) {
+      uintptr_t pc = backtrace.pcs[i];
+      Dl_info info{};
+      if (dladdr(reinterpret_cast<void*>(pc), &info) == 0 || info.dli_fname == nullptr) {
+        ULOGW("    #%02zu pc %016" PRIxPTR "  <unknown>", i - 1, pc);
+        continue;
+      }
+      uintptr_t relative = pc - reinterpret_cast<uintptr_t>(info.dli_fbase);
+      if (info.dli_sname != nullptr) {
+        ULOGW(
+            "    #%02zu pc %016" PRIxPTR "  %s (%s+%" PRIuPTR ")",
+            i - 1,
+            relative,
+            info.dli_fname,
+            info.dli_sname,
+            pc - reinterpret_cast<uintptr_t>(info.dli_saddr));
+      } else {
+        ULOGW("    #%02zu pc %016" PRIxPTR "  %s", i - 1, relative, info.dli_fname);
+      }
+    }
+  }
+  tReporting = false;
+}
+
+inline void check(const char* call) {
+  if (tSection != nullptr && !tReporting) [[unlikely]] {
+    report(call);
+  }
+}
+
+} // namespace
+
+RealtimeScope::RealtimeScope(const char* name) : outer_(tSection) {
+  tSection = name;
+}
+
+RealtimeScope::~RealtimeScope() {
+  tSection = outer_;
+}
+
+uint64_t RealtimeScope::violations() {
+  return gViolations.load(std::memory_order_relaxed);
+}
+
+extern "C" {
+
+void* __wrap_malloc(size_t bytes) {
+  check("malloc");
+  return __real_malloc(bytes);
+}
+
+void* __wrap_calloc(size_t count, size_t bytes) {
+  check("calloc");
+  return __real_calloc(count, bytes);
+}
+
+void* __wrap_realloc(void* ptr, size_t bytes) {
+  check("realloc");
+  return __real_realloc(ptr, bytes);
+}
+
+void __wrap_free(void* ptr) {
+  if (ptr != nullptr) {
+    check("free");
+  }
+  __real_free(ptr);
+}
+
+void* __wrap_aligned_alloc(size_t alignment, size_t bytes) {
+  check("aligned_alloc");
+  return __real_aligned_alloc(alignment, bytes);
+}
+
+int __wrap_posix_memalign(void** ptr, size_t alignment, size_t bytes) {
+  check("posix_memalign");
+  return __real_posix_memalign(ptr, alignment, bytes);
+}
+
+void* __wrap_memalign(size_t alignment, size_t bytes) {
+  check("memalign");
+  return __real_memalign(alignment, bytes);
+}
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t* mutex) {
+  check("pthread_mutex_lock");
+  return __real_pthread_mutex_lock(mutex);
+}
+
+int __wrap_pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+  check("pthread_cond_wait");
+  return __real_pthread_cond_wait(cond, mutex);
+}
+
+int __wrap_pthread_cond_timedwait(
+    pthread_cond_t* cond,
+    pthread_mutex_t* mutex,
+    const struct timespec* abstime) {
+  check("pthread_cond_timedwait");
+  return __real_pthread_cond_timedwait(cond, mutex, abstime);
+}
+
+int __wrap_pthread_rwlock_rdlock(pthread_rwlock_t* rwlock) {
+  check("pthread_rwlock_rdlock");
+  return __real_pthread_rwlock_rdlock(rwlock);
+}
+
+int __wrap_pthread_rwlock_wrlock(pthread_rwlock_t* rwlock) {
+  check("pthread_rwlock_wrlock");
+  return __real_pthread_rwlock_wrlock(rwlock);
+}
+
+int __wrap_pthread_join(pthread_t thread, void** result) {
+  check("pthread_join");
+  return __real_pthread_join(thread, result);
+}
+
+int __wrap___android_log_print(int priority, const char* tag, const char* format, ...) {
+  check("__android_log_print");
+  va_list args;
+  va_start(args, format);
+  int result = __real___android_log_vprint(priority, tag, format, args);
+  va_end(args);
+  return result;
+}
+
+int __wrap___android_log_vprint(int priority, const char* tag, const char* format, va_list args) {
+  check("__android_log_vprint");
+  return __real___android_log_vprint(priority, tag, format, args);
+}
+
+int __wrap___android_log_write(int priority, const char* tag, const char* text) {
+  check("__android_log_write");
+  return __real___android_log_write(priority, tag, text);
+}
+
+int __wrap_usleep(useconds_t us) {
+  check("usleep");
+  return __real_usleep(us);
+}
+
+int __wrap_nanosleep(const struct timespec* duration, struct timespec* remaining) {
+  check("nanosleep");
+  return __real_nanosleep(duration, remaining);
+}
+
+int __wrap_clock_nanosleep(
+    clockid_t clock,
+    int flags,
+    const struct timespec* duration,
+    struct timespec* remaining) {
+  check("clock_nanosleep");
+  return __real_clock_nanosleep(clock, flags, duration, remaining);
+}
+
+int __wrap_poll(struct pollfd* fds, nfds_t count, int timeoutMs) {
+  check("poll");
+  return __real_poll(fds, count, timeoutMs);
+}
+
+int __wrap___poll_chk(struct pollfd* fds, nfds_t count, int timeoutMs, size_t fdsBytes) {
+  check("poll");
+  return __real___poll_chk(fds, count, timeoutMs, fdsBytes);
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event* events, int count, int timeoutMs) {
+  check("epoll_wait");
+  return __real_epoll_wait(epfd, events, count, timeoutMs);
+}
+
+int __wrap_select(int count, fd_set* read, fd_set* write, fd_set* except, struct timeval* timeout) {
+  check("select");
+  return __real_select(count, read, write, except, timeout);
+}
+
+ssize_t __wrap_read(int fd, void* buf, size_t bytes) {
+  check("read");
+  return __real_read(fd, buf, bytes);
+}
+
+ssize_t __wrap___read_chk(int fd, void* buf, size_t bytes, size_t bufBytes) {
+  check("read");
+  return __real___read_chk(fd, buf, bytes, bufBytes);
+}
+
+ssize_t __wrap_write(int fd, const void* buf, size_t bytes) {
+  check("write");
+  return __real_write(fd, buf, bytes);
+}
+
+ssize_t __wrap___write_chk(int fd, const void* buf, size_t bytes, size_t bufBytes) {
+  check("write");
+  return __real___write_chk(fd, buf, bytes, bufBytes);
+}
+
+// URB submission and reaping in libusb. The third argument is a pointer or
+// an integer, which travel the same way.
+int __wrap_ioctl(int fd, int request, ...) {
+  check("ioctl");
+  va_list args;
+  va_start(args, request);
+  void* arg = va_arg(args, void*);
+  va_end(args);
+  return __real_ioctl(fd, request, arg);
+}
+
+int __wrap_fsync(int fd) {
+  check("fsync");
+  return __real_fsync(fd);
+}
+
+} // extern "C"
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// Real-time sections: the AAudio callback, the USB audio completions and the
+// PCM ring, which must not allocate, lock, log or block. Built with
+// USB_VIDEO_RT_CHECKS, see CMakeLists.txt, the link routes malloc and free,
+// mutex and condition waits, __android_log_print and the blocking syscalls
+// of libusbvideo.so and the libraries linked into it through
+// RealtimeCheck.cpp, which logs each call made inside a section with its
+// stack, once per stack. Otherwise the sections compile to nothing. Names
+// must be string literals.
+
+#ifdef USB_VIDEO_RT_CHECKS
+
+#include <cstdint>
+
+class RealtimeScope final {
+ public:
+  explicit RealtimeScope(const char* name);
+  RealtimeScope(const RealtimeScope&) = delete;
+  RealtimeScope& operator=(const RealtimeScope&) = delete;
+  ~RealtimeScope();
+
+  // Calls reported so far, including those of stacks logged before.
+  static uint64_t violations();
+
+ private:
+  const char* outer_;
+};
+
+#define REALTIME_CONCAT_INNER(a, b) a##b
+#define REALTIME_CONCAT(a, b) REALTIME_CONCAT_INNER(a, b)
+#define REALTIME_SCOPE(name) RealtimeScope REALTIME_CONCAT(realtimeScope, __LINE__)(name)
+
+#else
+
+#define REALTIME_SCOPE(name)
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ReconnectManager.h"
+
+#include <android/log.h>
+
+#include <sys/prctl.h>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "ReconnectManager", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "ReconnectManager", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "ReconnectManager", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "ReconnectManager", __VA_ARGS__)
+
+ReconnectManager::ReconnectManager() : thread_(&ReconnectManager::notifyLoop, this) {}
+
+ReconnectManager::~ReconnectManager() {
+  {
+    std::lock_guard lk(mutex_);
+    stopping_ = true;
+  }
+  change_.notify_all();
+  thread_.join();
+}
+
+void ReconnectManager::setListener(Listener listener) {
+  std::lock_guard lk(mutex_);
+  listener_ = std::move(listener);
+}
+
+void ReconnectManager::reportLoss(const char* pipeline) {
+  {
+    std::lock_guard lk(mutex_);
+    if (lost_) {
+      return;
+    }
+    lost_ = true;
+    lostAt_ = steady_clock::now();
+    notifyPending_ = true;
+  }
+  ULOGW("Device of the %s streamer lost, waiting for it to come back", pipeline);
+  change_.notify_all();
+}
+
+bool ReconnectManager::hold() {
+  std::lock_guard lk(mutex_);
+  steady_clock::time_point now = steady_clock::now();
+  if (!lost_) {
+    lost_ = true;
+    lostAt_ = now;
+    ULOGW("Device detached, waiting for it to come back");
+  }
+  return isPendingLocked(now);
+}
+
+bool ReconnectManager::isPending() const {
+  std::lock_guard lk(mutex_);
+  return isPendingLocked(steady_clock::now());
+}
+
+bool ReconnectManager::isPendingLocked(steady_clock::time_point now) const {
+  return lost_ && now - lostAt_ < kGracePeriod;
+}
+
+void ReconnectManager::finish(bool reattached) {
+  std::lock_guard lk(mutex_);
+  if (!lost_) {
+    return;
+  }
+  double outageMs = duration<double, std::milli>(steady_clock::now() - lostAt_).count();
+  if (reattached) {
+    ULOGI("Streaming resumed %.1f ms after the device was lost", outageMs);
+  } else {
+    ULOGI("Gave up on the device %.1f ms after it was lost", outageMs);
+  }
+  lost_ = false;
+  notifyPending_ = false;
+}
+
+void ReconnectManager::notifyLoop() {
+  prctl(PR_SET_NAME, "usb_reconnect");
+  std::unique_lock lk(mutex_);
+  while (!stopping_) {
+    if (!notifyPending_) {
+      change_.wait(lk);
+      continue;
+    }
+    notifyPending_ = false;
+    Listener listener = listener_;
+    lk.unlock();
+    if (listener) {
+      listener();
+    }
+    lk.lock();
+  }
+}
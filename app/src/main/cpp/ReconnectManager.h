@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace std::chrono;
+
+// Keeps the default streamers through a short loss of their device, such as
+// a cable glitch, so they resume on the fds of the device attached again
+// instead of the whole connect sequence running another time.
+//
+// The transfer completions of either streamer report the loss on the USB
+// event thread; the app is told on the manager's own thread. Until the
+// streamers reattach, or kGracePeriod after the loss, the AAudio stream, the
+// video backends with their preview window and the committed stream control
+// stay up.
+class ReconnectManager final {
+ public:
+  using Listener = std::function<void()>;
+
+  // Longest a lost device is waited for.
+  static constexpr seconds kGracePeriod{10};
+
+  ReconnectManager();
+  ReconnectManager(const ReconnectManager&) = delete;
+  ReconnectManager& operator=(const ReconnectManager&) = delete;
+  ~ReconnectManager();
+
+  // Called once per loss, on the manager's thread. Null removes it.
+  void setListener(Listener listener);
+  // From the USB event thread; returns right away.
+  void reportLoss(const char* pipeline);
+  // Waits for the device from now on when no transfer reported its loss
+  // yet, as when the app sees it detached first. False once the grace
+  // period of the loss is over.
+  bool hold();
+  bool isPending() const;
+  // Ends the wait, once the streamers reattached or were torn down.
+  void finish(bool reattached);
+
+ private:
+  mutable std::mutex mutex_;
+  std::condition_variable change_;
+  bool lost_{false};
+  steady_clock::time_point lostAt_{};
+  bool notifyPending_{false};
+  bool stopping_{false};
+  Listener listener_{};
+  std::thread thread_{};
+
+  bool isPendingLocked(steady_clock::time_point now) const;
+  void notifyLoop();
+};
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "RenderAheadWindow.h"
+
+#include <android/hardware_buffer.h>
+#include <android/log.h>
+#include <sys/prctl.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "FrameConverter.h"
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "RenderAheadWindow", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "RenderAheadWindow", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "RenderAheadWindow", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "RenderAheadWindow", __VA_ARGS__)
+
+using namespace std::chrono;
+
+static int64_t nowNs() {
+  return steady_clock::now().time_since_epoch().count();
+}
+
+RenderAheadWindow::RenderAheadWindow(ANativeWindow* window) : window_(window) {
+  ANativeWindow_acquire(window_);
+  thread_ = std::thread(&RenderAheadWindow::lockLoop, this);
+}
+
+RenderAheadWindow::~RenderAheadWindow() {
+  {
+    std::lock_guard lk(mutex_);
+    stopping_ = true;
+  }
+  change_.notify_all();
+  thread_.join();
+  ANativeWindow_release(window_);
+}
+
+size_t RenderAheadWindow::bufferBytes(const ANativeWindow_Buffer& buffer) {
+  size_t stride = buffer.stride > 0 ? (size_t)buffer.stride : 0;
+  size_t height = buffer.height > 0 ? (size_t)buffer.height : 0;
+  switch (buffer.format) {
+    case AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM:
+    case AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM:
+      return stride * height * 4;
+    case AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM:
+      return stride * height * 2;
+    case FrameConverter::kYv12WindowFormat: {
+      // Chroma rows are half the luma stride, rounded up to 16 bytes.
+      size_t chromaStride = ((stride / 2) + 15) & ~(size_t)15;
+      return stride * height + 2 * chromaStride * (height / 2);
+    }
+    default:
+      return 0;
+  }
+}
+
+RenderAheadWindow::Target RenderAheadWindow::acquire(
+    ANativeWindow_Buffer* buffer,
+    int64_t& lockWaitNs,
+    bool& lockFailed) {
+  std::lock_guard lk(mutex_);
+  lockFailed = failed_;
+  if (ready_) {
+    ready_ = false;
+    lent_ = true;
+    *buffer = windowBuffer_;
+    lockWaitNs = lockWaitNs_;
+    return Target::WINDOW;
+  }
+  lockWaitNs = failed_ ? 0 : nowNs() - lockStartNs_;
+  size_t bytes = bufferBytes(shape_);
+  if (failed_ || bytes == 0) {
+    return Target::NONE;
+  }
+  spare_.resize(bytes);
+  *buffer = shape_;
+  buffer->bits = spare_.data();
+  writingSpare_ = true;
+  return Target::PRIVATE;
+}
+
+bool RenderAheadWindow::post() {
+  std::unique_lock lk(mutex_);
+  if (lent_) {
+    lent_ = false;
+    lk.unlock();
+    {
+      TRACE_SCOPE("postBuffer");
+      ANativeWindow_unlockAndPost(window_);
+    }
+    change_.notify_all();
+    return false;
+  }
+  if (!writingSpare_) {
+    return false;
+  }
+  writingSpare_ = false;
+  bool replaced = hasPending_;
+  pending_.swap(spare_);
+  pendingShape_ = shape_;
+  hasPending_ = true;
+  lk.unlock();
+  change_.notify_all();
+  return replaced;
+}
+
+void RenderAheadWindow::discard() {
+  std::lock_guard lk(mutex_);
+  writingSpare_ = false;
+}
+
+void RenderAheadWindow::retry() {
+  {
+    std::lock_guard lk(mutex_);
+    failed_ = false;
+  }
+  change_.notify_all();
+}
+
+void RenderAheadWindow::lockLoop() {
+  prctl(PR_SET_NAME, "usb_video_lock");
+  std::unique_lock lk(mutex_);
+  while (!stopping_) {
+    if (ready_ || lent_ || failed_) {
+      change_.wait(lk);
+      continue;
+    }
+    lockStartNs_ = nowNs();
+    lk.unlock();
+    ANativeWindow_Buffer buffer;
+    int32_t status;
+    {
+      TRACE_SCOPE("lockBuffer");
+      status = ANativeWindow_lock(window_, &buffer, nullptr);
+    }
+    int64_t lockedNs = nowNs();
+    lk.lock();
+    if (status != 0) {
+      ULOGE("ANativeWindow_lock failed with error %d", status);
+      failed_ = true;
+      continue;
+    }
+    lockWaitNs_ = lockedNs - lockStartNs_;
+    shape_ = buffer;
+    shape_.bits = nullptr;
+    if (!hasPending_) {
+      windowBuffer_ = buffer;
+      ready_ = true;
+      continue;
+    }
+    // The frame rendered while this thread waited goes out first.
+    hasPending_ = false;
+    bool fits = pendingShape_.format == buffer.format && pendingShape_.width == buffer.width &&
+        pendingShape_.height == buffer.height && pendingShape_.stride == buffer.stride;
+    if (!fits) {
+      // The window changed geometry meanwhile; the render thread gets this one.
+      windowBuffer_ = buffer;
+      ready_ = true;
+      continue;
+    }
+    // pending_ is only swapped under the mutex while hasPending_, unset above.
+    AlignedBytes copied;
+    copied.swap(pending_);
+    lk.unlock();
+    {
+      TRACE_SCOPE("copyRenderedAhead");
+      memcpy(buffer.bits, copied.data(), copied.size());
+    }
+    ANativeWindow_unlockAndPost(window_);
+    lk.lock();
+    if (pending_.empty()) {
+      // Kept for the next private frame.
+      pending_.swap(copied);
+    }
+  }
+  if (ready_) {
+    // A window buffer cannot be unlocked without posting it.
+    ANativeWindow_unlockAndPost(window_);
+    ready_ = false;
+  }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <android/native_window.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "BufferAllocator.h"
+
+// Locks the preview window's next buffer ahead of the render thread, on a
+// thread of its own, so the render thread never waits in ANativeWindow_lock()
+// while the compositor holds every buffer.
+//
+// When no window buffer is ready the frame is converted into a private
+// buffer shaped like the last window buffer instead, and copied into the
+// window once it hands out the next one. A newer frame replaces one still
+// waiting there, so the backlog never exceeds a frame.
+//
+// acquire(), post() and discard() are called from the render thread.
+class RenderAheadWindow final {
+ public:
+  enum class Target : uint8_t {
+    NONE, // no buffer: drop the frame
+    WINDOW, // a window buffer, posted as is
+    PRIVATE, // a private buffer, copied into the next window buffer
+  };
+
+  // Holds a reference to window until destroyed.
+  explicit RenderAheadWindow(ANativeWindow* window);
+  RenderAheadWindow(const RenderAheadWindow&) = delete;
+  RenderAheadWindow& operator=(const RenderAheadWindow&) = delete;
+  // Posts a window buffer still locked, which holds an earlier frame.
+  ~RenderAheadWindow();
+
+  // Never blocks. lockWaitNs is how long the lock of the buffer took, or
+  // how long the pending one has waited so far for PRIVATE and NONE. lockFailed
+  // is set when ANativeWindow_lock() failed; call retry() to lock again.
+  Target acquire(ANativeWindow_Buffer* buffer, int64_t& lockWaitNs, bool& lockFailed);
+  // Posts the WINDOW buffer, or leaves the PRIVATE one for the next window
+  // buffer. True when that replaced a private frame still waiting, which is
+  // then dropped.
+  bool post();
+  // Gives up a PRIVATE buffer. A WINDOW buffer cannot be unlocked without
+  // posting, so post() it with the last good frame instead.
+  void discard();
+  // Locks again after a failure, once the window's geometry was fixed.
+  void retry();
+
+ private:
+  // Bytes of a buffer with this format, stride and height; 0 for formats not
+  // copied.
+  static size_t bufferBytes(const ANativeWindow_Buffer& buffer);
+
+  ANativeWindow* window_;
+  std::mutex mutex_;
+  std::condition_variable change_;
+  // A buffer locked by the lock thread, not yet taken by the render thread.
+  bool ready_{false};
+  // Taken by the render thread, until post().
+  bool lent_{false};
+  bool failed_{false};
+  bool stopping_{false};
+  ANativeWindow_Buffer windowBuffer_{};
+  int64_t lockStartNs_{0};
+  int64_t lockWaitNs_{0};
+  // The last window buffer's layout, which the private buffers take.
+  ANativeWindow_Buffer shape_{};
+  // Written by the render thread between acquire() and post().
+  AlignedBytes spare_{};
+  // Waits for a window buffer, owned by the lock thread once copying.
+  AlignedBytes pending_{};
+  ANativeWindow_Buffer pendingShape_{};
+  bool hasPending_{false};
+  bool writingSpare_{false};
+  std::thread thread_{};
+
+  void lockLoop();
+};
@@ -16,88 +16,231 @@
 
 #pragma once
 
-#include <assert.h>
-#include <limits.h>
 #include <stdint.h>
+#include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <memory>
-
+#include <new>
+#include <type_traits>
+
+#include "RealtimeCheck.h"
+
+// Wait-free ring of samples with a single producer and a single consumer.
+//
+// Positions are free-running counters masked into a power-of-two buffer, so
+// the whole capacity is usable and full and empty are told apart without a
+// spare slot. Each side only stores its own position, with release
+// semantics, so a write never moves the read position: samples that do not
+// fit are dropped by the producer instead.
+//
+// peekWrite()/peekRead() expose the free or filled part of the ring as at
+// most two contiguous spans, so data can be produced or consumed in place;
+// commitWrite()/commitRead() then publish how much was used.
+//
+// Any number of other readers can follow the producer through their own
+// Cursor with readAt(). The producer never waits for them: a reader a whole
+// capacity behind is lapped, and resumes where its Overflow policy says.
 template <typename T>
 class RingBuffer {
+  static_assert(std::is_trivially_copyable_v<T>, "RingBuffer samples must be trivially copyable");
+
  public:
+  // Up to two contiguous runs of samples, in ring order.
+  struct Spans {
+    T* first{};
+    size_t firstSize{};
+    T* second{};
+    size_t secondSize{};
+
+    size_t size() const {
+      return firstSize + secondSize;
+    }
+
+    // Copies up to len samples in, starting offset samples into the spans.
+    // Returns the number copied.
+    size_t copyFrom(size_t offset, const T* data, size_t len) const {
+      len = std::min(len, size() - std::min(offset, size()));
+      size_t copied = 0;
+      if (offset < firstSize) {
+        copied = std::min(len, firstSize - offset);
+        memcpy(first + offset, data, copied * sizeof(T));
+      }
+      if (copied < len) {
+        memcpy(second + (offset + copied - firstSize), data + copied, (len - copied) * sizeof(T));
+      }
+      return len;
+    }
+
+    // Copies up to len samples out, starting offset samples into the spans.
+    // Returns the number copied.
+    size_t copyTo(size_t offset, T* data, size_t len) const {
+      len = std::min(len, size() - std::min(offset, size()));
+      size_t copied = 0;
+      if (offset < firstSize) {
+        copied = std::min(len, firstSize - offset);
+        memcpy(data, first + offset, copied * sizeof(T));
+      }
+      if (copied < len) {
+        memcpy(data + copied, second + (offset + copied - firstSize), (len - copied) * sizeof(T));
+      }
+      return len;
+    }
+  };
+
+  // Where a lapped Cursor resumes.
+  enum class Overflow {
+    OLDEST, // at the oldest samples still in the ring
+    NEWEST, // at the latest write
+  };
+
+  // A reader besides the consumer, used from one thread at a time.
+  struct Cursor {
+    uint32_t position{};
+    uint64_t lost{}; // samples skipped over after laps
+  };
+
   RingBuffer(const RingBuffer&) = delete;
   RingBuffer& operator=(const RingBuffer&) = delete;
-  RingBuffer(int capacity) : capacity_(capacity), readPos_(0), writePos_(0) {
-    buffer_ = std::unique_ptr<T[]>(new T[capacity_]);
-    memset(buffer_.get(), 0, sizeof(T) * capacity_);
-  }
+  // Capacity is rounded up to a power of two.
+  RingBuffer(int capacity)
+      : capacity_(std::bit_ceil((uint32_t)std::max(capacity, 1))),
+        mask_(capacity_ - 1),
+        buffer_(std::make_unique<T[]>(capacity_)) {}
 
   int32_t capacity() const {
     return capacity_;
   }
 
-  size_t size() {
-    return (writePos_ + capacity_ - readPos_) % capacity_;
+  // Exact from either side; a snapshot from any other thread.
+  size_t size() const {
+    return writePos_.load(std::memory_order_acquire) - readPos_.load(std::memory_order_acquire);
   }
 
-  int write(T* data, int len) {
-    if (data == nullptr || len <= 0) {
-      return 0;
-    }
+  // Samples ever written, wrapping around.
+  uint32_t writePosition() const {
+    return writePos_.load(std::memory_order_acquire);
+  }
 
-    // If we are adding data larger than the capacity
-    // then just take the last capacity_ from the input data.
-    if (len > capacity_) {
-      data = &data[len - capacity_];
-      len = capacity_;
-    }
+  // Producer only. Free space, up to maxLen samples. Cursor readers treat all
+  // of it as being written over until the next peekWrite(), so ask for no
+  // more than will be written.
+  Spans peekWrite(size_t maxLen) {
+    REALTIME_SCOPE("RingBuffer");
+    uint32_t writePos = writePos_.load(std::memory_order_relaxed);
+    uint32_t free = capacity_ - (writePos - readPos_.load(std::memory_order_acquire));
+    Spans spans = spansAt(writePos, std::min<size_t>(maxLen, free));
+    writeEnd_.store(writePos + spans.size(), std::memory_order_relaxed);
+    // Ahead of the writes into the spans, for readAt() to see a lap.
+    std::atomic_thread_fence(std::memory_order_release);
+    return spans;
+  }
 
-    int size = (writePos_ + capacity_ - readPos_) % capacity_;
-    int start = writePos_;
-    int end = (writePos_ + len) % capacity_;
-    if (start < end) {
-      memcpy(&buffer_[start], data, len * sizeof(T));
-    } else {
-      int first_slice = capacity_ - start;
-      memcpy(&buffer_[start], data, first_slice * sizeof(T));
-      memcpy(&buffer_[0], &data[first_slice], (len - first_slice) * sizeof(T));
-    }
+  // Producer only. Publishes len samples written into the last peekWrite().
+  void commitWrite(size_t len) {
+    REALTIME_SCOPE("RingBuffer");
+    writePos_.store(writePos_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+  }
+
+  // Consumer only. Filled samples, up to maxLen.
+  Spans peekRead(size_t maxLen) {
+    REALTIME_SCOPE("RingBuffer");
+    uint32_t readPos = readPos_.load(std::memory_order_relaxed);
+    uint32_t filled = writePos_.load(std::memory_order_acquire) - readPos;
+    return spansAt(readPos, std::min<size_t>(maxLen, filled));
+  }
 
-    writePos_ = end;
-    if (size + len > capacity_) {
-      readPos_ = (readPos_ + size + len) % capacity_;
+  // Consumer only. Frees len samples of the last peekRead().
+  void commitRead(size_t len) {
+    REALTIME_SCOPE("RingBuffer");
+    readPos_.store(readPos_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+  }
+
+  // Producer only. Returns the number of samples written, less than len when
+  // the ring is full.
+  int write(const T* data, int len) {
+    if (data == nullptr || len <= 0) {
+      return 0;
     }
-    return len;
+    size_t written = peekWrite(len).copyFrom(0, data, len);
+    commitWrite(written);
+    return written;
   }
 
+  // Consumer only. Returns the number of samples read.
   int read(T* data, int len) {
-    int available = (writePos_ + capacity_ - readPos_) % capacity_;
-    if (available == 0 || data == nullptr || len <= 0) {
+    if (data == nullptr || len <= 0) {
       return 0;
     }
+    size_t copied = peekRead(len).copyTo(0, data, len);
+    commitRead(copied);
+    return copied;
+  }
 
-    int to_copy = std::min(len, available);
-
-    int start = readPos_;
-    int end = (readPos_ + to_copy) % capacity_;
+  // Moves cursor to the latest write.
+  void seek(Cursor& cursor) const {
+    cursor.position = writePos_.load(std::memory_order_acquire);
+  }
 
-    if (start < end) {
-      memcpy(data, &buffer_[start], to_copy * sizeof(T));
-    } else {
-      int first_slice = capacity_ - start;
-      memcpy(data, &buffer_[start], first_slice * sizeof(T));
-      memcpy(&data[first_slice], &buffer_[0], (to_copy - first_slice) * sizeof(T));
+  // Any thread but the producer's. Copies up to len samples at cursor, in
+  // multiples of align, which positions are kept to. Returns the number
+  // copied, zero when the producer lapped the copy.
+  size_t readAt(Cursor& cursor, T* data, size_t len, Overflow overflow, size_t align = 1) {
+    uint32_t writePos = writePos_.load(std::memory_order_acquire);
+    if (lapped(cursor)) {
+      resume(cursor, writePos, overflow, align);
     }
-
-    readPos_ = (readPos_ + to_copy) % capacity_;
-    return to_copy;
+    len = std::min<size_t>(len, writePos - cursor.position);
+    len -= len % align;
+    spansAt(cursor.position, len).copyTo(0, data, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (lapped(cursor)) {
+      resume(cursor, writePos_.load(std::memory_order_acquire), overflow, align);
+      return 0;
+    }
+    cursor.position += len;
+    return len;
   }
 
  private:
-  int capacity_;
-  uint32_t readPos_;
-  uint32_t writePos_;
+  // Keeps each position on its own cache line, away from the other side's.
+  static constexpr size_t kCacheLineSize = 64;
+
+  const uint32_t capacity_;
+  const uint32_t mask_;
   std::unique_ptr<T[]> buffer_;
+  alignas(kCacheLineSize) std::atomic<uint32_t> readPos_{0};
+  alignas(kCacheLineSize) std::atomic<uint32_t> writePos_{0};
+  // End of the span the producer may be writing, positions a capacity before
+  // it on are overwritten.
+  std::atomic<uint32_t> writeEnd_{0};
+
+  bool lapped(const Cursor& cursor) const {
+    uint32_t oldest = writeEnd_.load(std::memory_order_relaxed) - capacity_;
+    return (int32_t)(cursor.position - oldest) < 0;
+  }
+
+  void resume(Cursor& cursor, uint32_t writePos, Overflow overflow, size_t align) {
+    uint32_t position = writePos;
+    if (overflow == Overflow::OLDEST) {
+      uint32_t oldest = writeEnd_.load(std::memory_order_relaxed) - capacity_;
+      uint32_t behind = oldest - cursor.position;
+      position = cursor.position + (behind + align - 1) / align * align;
+      if ((int32_t)(writePos - position) < 0) {
+        position = writePos;
+      }
+    }
+    cursor.lost += position - cursor.position;
+    cursor.position = position;
+  }
+
+  Spans spansAt(uint32_t position, size_t len) {
+    uint32_t start = position & mask_;
+    size_t firstSize = std::min<size_t>(len, capacity_ - start);
+    return {&buffer_[start], firstSize, &buffer_[0], len - firstSize};
+  }
 };
 
-typedef RingBuffer<uint16_t> RingBufferPcm;
+// Interleaved audio in the output stream's sample format, counted in bytes.
+typedef RingBuffer<uint8_t> RingBufferPcm;
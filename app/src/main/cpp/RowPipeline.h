@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Runs row stages over a frame band by band: each band of rows goes through
+// every enabled stage before the next band starts, so the later stages find
+// it still in cache and any number of cheap stages costs a single pass over
+// the frame's memory.
+//
+// A stage is a type with
+//   static bool run(State& state, int32_t row, int32_t rows);
+// and optionally
+//   static void finish(State& state, int32_t rows);
+// called once all bands of the call ran. Stages run in the order they are
+// listed. Every combination of them is instantiated at compile time as its
+// own loop, the disabled stages compiled out, and pick() selects one by a
+// mask with bit i for the i-th stage, so enabling a stage adds no branch to
+// the others.
+template <typename State, int32_t BandRows, typename... Stages>
+class RowPipeline final {
+ public:
+  using RunFn = bool (*)(State& state, int32_t row, int32_t rows);
+
+  static constexpr uint32_t kStageCount = sizeof...(Stages);
+  static_assert(kStageCount > 0 && kStageCount <= 6, "2^stages loops are instantiated");
+  static_assert(BandRows > 0 && BandRows % 2 == 0, "bands keep 4:2:0 chroma rows whole");
+
+  // Runs the rows [row, row + rows) through the stages of mask.
+  static RunFn pick(uint32_t mask) {
+    return kLoops[mask & ((1u << kStageCount) - 1)];
+  }
+
+ private:
+  template <typename Stage>
+  static constexpr bool kHasFinish =
+      requires(State& state) { Stage::finish(state, int32_t{}); };
+
+  template <bool Enabled, typename Stage>
+  static bool runStage(State& state, int32_t row, int32_t rows) {
+    if constexpr (Enabled) {
+      return Stage::run(state, row, rows);
+    } else {
+      return true;
+    }
+  }
+
+  template <bool Enabled, typename Stage>
+  static void finishStage(State& state, int32_t rows) {
+    if constexpr (Enabled && kHasFinish<Stage>) {
+      Stage::finish(state, rows);
+    }
+  }
+
+  template <uint32_t Mask, size_t... I>
+  static bool runBands(State& state, int32_t row, int32_t rows, std::index_sequence<I...>) {
+    for (int32_t band = row; band < row + rows; band += BandRows) {
+      int32_t bandRows = std::min(BandRows, row + rows - band);
+      if (!(runStage<((Mask >> I) & 1) != 0, Stages>(state, band, bandRows) && ...)) {
+        return false;
+      }
+    }
+    (finishStage<((Mask >> I) & 1) != 0, Stages>(state, rows), ...);
+    return true;
+  }
+
+  template <uint32_t Mask>
+  static bool loop(State& state, int32_t row, int32_t rows) {
+    return runBands<Mask>(state, row, rows, std::index_sequence_for<Stages...>());
+  }
+
+  template <size_t... Mask>
+  static constexpr std::array<RunFn, sizeof...(Mask)> loops(std::index_sequence<Mask...>) {
+    return {&loop<(uint32_t)Mask>...};
+  }
+
+  static constexpr std::array<RunFn, (1u << kStageCount)> kLoops =
+      loops(std::make_index_sequence<(1u << kStageCount)>());
+};
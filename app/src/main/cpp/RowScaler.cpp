@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RowScaler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Byte of a source pixel each output byte takes.
+template <bool SwapRedBlue>
+constexpr size_t channel(size_t c) {
+  return SwapRedBlue && c != 1 && c != 3 ? 2 - c : c;
+}
+
+template <bool SwapRedBlue>
+void pickRow(const uint8_t* src, const int32_t* first, int32_t width, uint8_t* dst) {
+  for (int32_t x = 0; x < width; x++) {
+    const uint8_t* pixel = src + (size_t)first[x] * 4;
+    for (size_t c = 0; c < 4; c++) {
+      dst[x * 4 + c] = pixel[channel<SwapRedBlue>(c)];
+    }
+  }
+}
+
+template <bool SwapRedBlue>
+void interpolateRow(
+    const uint8_t* src,
+    const int32_t* first,
+    const int32_t* weight,
+    int32_t width,
+    uint8_t* dst) {
+  for (int32_t x = 0; x < width; x++) {
+    const uint8_t* left = src + (size_t)first[x] * 4;
+    int32_t right = weight[x];
+    for (size_t c = 0; c < 4; c++) {
+      int32_t a = left[channel<SwapRedBlue>(c)];
+      int32_t b = left[4 + channel<SwapRedBlue>(c)];
+      dst[x * 4 + c] = (uint8_t)(a + (((b - a) * right + 128) >> 8));
+    }
+  }
+}
+
+template <bool SwapRedBlue>
+void averageRow(
+    const uint8_t* src,
+    const int32_t* first,
+    const int32_t* end,
+    const int32_t* reciprocal,
+    int32_t width,
+    uint8_t* dst) {
+  for (int32_t x = 0; x < width; x++) {
+    uint32_t sums[4]{};
+    for (int32_t i = first[x]; i < end[x]; i++) {
+      for (size_t c = 0; c < 4; c++) {
+        sums[c] += src[(size_t)i * 4 + c];
+      }
+    }
+    for (size_t c = 0; c < 4; c++) {
+      dst[x * 4 + c] = (uint8_t)((sums[channel<SwapRedBlue>(c)] * reciprocal[x] + 32768) >> 16);
+    }
+  }
+}
+
+} // namespace
+
+RowScaler::Filter RowScaler::filterFor(int32_t source, int32_t destination) {
+  if (destination >= source) {
+    return destination % source == 0 ? Filter::NONE : Filter::BILINEAR;
+  }
+  return source >= 2 * destination ? Filter::BOX : Filter::BILINEAR;
+}
+
+bool RowScaler::configure(
+    int32_t sourceWidth,
+    int32_t sourceHeight,
+    int32_t width,
+    int32_t height) {
+  if (sourceWidth <= 0 || sourceHeight <= 0 || width <= 0 || height <= 0) {
+    return false;
+  }
+  if (sourceWidth == sourceWidth_ && sourceHeight == sourceHeight_ && width == width_ &&
+      height == height_) {
+    return true;
+  }
+  sourceWidth_ = sourceWidth;
+  sourceHeight_ = sourceHeight;
+  width_ = width;
+  height_ = height;
+  horizontal_ = filterFor(sourceWidth, width);
+  vertical_ = filterFor(sourceHeight, height);
+  fillAxis(columns_, horizontal_, sourceWidth, width);
+  fillAxis(rows_, vertical_, sourceHeight, height);
+  int32_t span = 0;
+  for (int32_t y = 0; y < height; y++) {
+    int32_t first;
+    int32_t end;
+    sourceRows(y, first, end);
+    span = std::max(span, end - (first & ~1));
+  }
+  // Rows are fetched in pairs, so one more may come in.
+  ringRows_ = (span + 2) & ~1;
+  ringStride_ = alignedStride((size_t)sourceWidth * 4);
+  return true;
+}
+
+void RowScaler::fillAxis(Axis& axis, Filter filter, int32_t source, int32_t destination) {
+  axis.first.resize(destination);
+  axis.weight.assign(destination, 0);
+  axis.end.assign(destination, 0);
+  for (int32_t i = 0; i < destination; i++) {
+    switch (filter) {
+      case Filter::NONE:
+        axis.first[i] = (int32_t)(((int64_t)i * 2 + 1) * source / (destination * 2));
+        break;
+      case Filter::BILINEAR: {
+        // Pixel centers line up; source is at least 2 when not upscaled by
+        // an integer ratio.
+        float position = std::clamp(
+            (i + 0.5f) * source / destination - 0.5f, 0.0f, (float)(source - 1));
+        int32_t left = std::min((int32_t)position, source - 2);
+        axis.first[i] = left;
+        axis.weight[i] = (int32_t)std::lround((position - left) * 256);
+        break;
+      }
+      case Filter::BOX: {
+        axis.first[i] = (int32_t)((int64_t)i * source / destination);
+        axis.end[i] = (int32_t)((int64_t)(i + 1) * source / destination);
+        axis.weight[i] = (int32_t)std::lround(65536.0 / (axis.end[i] - axis.first[i]));
+        break;
+      }
+    }
+  }
+}
+
+void RowScaler::sourceRows(int32_t row, int32_t& first, int32_t& end) const {
+  first = rows_.first[row];
+  if (vertical_ == Filter::BOX) {
+    end = rows_.end[row];
+  } else {
+    end = first + (vertical_ == Filter::BILINEAR ? 2 : 1);
+  }
+}
+
+bool RowScaler::scaleRows(
+    Scratch& scratch,
+    int32_t row,
+    int32_t rows,
+    FetchFn fetch,
+    void* context,
+    uint8_t* dst,
+    size_t stride,
+    bool swapRedBlue) const {
+  if (width_ == 0 || row < 0 || row + rows > height_) {
+    return false;
+  }
+  scratch.ring.resize(ringStride_ * ringRows_);
+  scratch.first = 0;
+  scratch.end = 0;
+  if (vertical_ != Filter::NONE) {
+    scratch.vertical.resize(ringStride_);
+  }
+  if (vertical_ == Filter::BOX) {
+    scratch.sums.resize((size_t)sourceWidth_ * 4);
+  }
+  for (int32_t y = row; y < row + rows; y++) {
+    int32_t first;
+    int32_t end;
+    sourceRows(y, first, end);
+    // Rows above the ones this row needs are done with; a gap is skipped.
+    scratch.first = std::max(scratch.first, first & ~1);
+    if (scratch.end < scratch.first) {
+      scratch.end = scratch.first;
+    }
+    if (!fetchRows(scratch, end, fetch, context)) {
+      return false;
+    }
+    scaleRow(combineRows(scratch, y), dst + (size_t)(y - row) * stride, swapRedBlue);
+  }
+  return true;
+}
+
+bool RowScaler::fetchRows(Scratch& scratch, int32_t end, FetchFn fetch, void* context) const {
+  while (scratch.end < end) {
+    int32_t pair = std::min(2, sourceHeight_ - scratch.end);
+    uint8_t* slot = scratch.ring.data() + (size_t)(scratch.end % ringRows_) * ringStride_;
+    if (!fetch(context, scratch.end, pair, slot, ringStride_)) {
+      return false;
+    }
+    scratch.end += pair;
+  }
+  return true;
+}
+
+const uint8_t* RowScaler::combineRows(Scratch& scratch, int32_t row) const {
+  int32_t first = rows_.first[row];
+  size_t bytes = (size_t)sourceWidth_ * 4;
+  uint8_t* out = scratch.vertical.data();
+  switch (vertical_) {
+    case Filter::NONE:
+      return ringRow(scratch, first);
+    case Filter::BILINEAR: {
+      int32_t below = rows_.weight[row];
+      const uint8_t* upper = ringRow(scratch, first);
+      if (below == 0) {
+        return upper;
+      }
+      const uint8_t* lower = ringRow(scratch, first + 1);
+      for (size_t i = 0; i < bytes; i++) {
+        int32_t a = upper[i];
+        out[i] = (uint8_t)(a + (((lower[i] - a) * below + 128) >> 8));
+      }
+      return out;
+    }
+    case Filter::BOX: {
+      uint32_t* sums = scratch.sums.data();
+      const uint8_t* top = ringRow(scratch, first);
+      for (size_t i = 0; i < bytes; i++) {
+        sums[i] = top[i];
+      }
+      for (int32_t y = first + 1; y < rows_.end[row]; y++) {
+        const uint8_t* src = ringRow(scratch, y);
+        for (size_t i = 0; i < bytes; i++) {
+          sums[i] += src[i];
+        }
+      }
+      uint32_t reciprocal = rows_.weight[row];
+      for (size_t i = 0; i < bytes; i++) {
+        out[i] = (uint8_t)((sums[i] * reciprocal + 32768) >> 16);
+      }
+      return out;
+    }
+  }
+  return nullptr;
+}
+
+void RowScaler::scaleRow(const uint8_t* src, uint8_t* dst, bool swapRedBlue) const {
+  const int32_t* first = columns_.first.data();
+  switch (horizontal_) {
+    case Filter::NONE:
+      if (!swapRedBlue && width_ == sourceWidth_) {
+        memcpy(dst, src, (size_t)width_ * 4);
+      } else if (swapRedBlue) {
+        pickRow<true>(src, first, width_, dst);
+      } else {
+        pickRow<false>(src, first, width_, dst);
+      }
+      break;
+    case Filter::BILINEAR:
+      if (swapRedBlue) {
+        interpolateRow<true>(src, first, columns_.weight.data(), width_, dst);
+      } else {
+        interpolateRow<false>(src, first, columns_.weight.data(), width_, dst);
+      }
+      break;
+    case Filter::BOX:
+      if (swapRedBlue) {
+        averageRow<true>(
+            src, first, columns_.end.data(), columns_.weight.data(), width_, dst);
+      } else {
+        averageRow<false>(
+            src, first, columns_.end.data(), columns_.weight.data(), width_, dst);
+      }
+      break;
+  }
+}
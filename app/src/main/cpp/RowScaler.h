@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "BufferAllocator.h"
+
+// Scales 4 byte pixels whose source rows are produced on demand, such as
+// rows of a YUV frame converted to ARGB just before they are scaled, so no
+// frame size intermediate is ever written.
+//
+// Each output row asks for the few source rows it covers, which are
+// converted a pair at a time into a small ring that keeps them for the next
+// output rows; the rows are combined vertically, then horizontally into the
+// output. Each axis has its own filter, by its ratio: none for unscaled and
+// integer upscaled axes, which replicate pixels, a box average when
+// shrinking twofold or more, bilinear otherwise. Integer downscales are
+// boxes too, which are then exact averages rather than skipped pixels.
+class RowScaler final {
+ public:
+  enum class Filter : uint8_t {
+    NONE,
+    BILINEAR,
+    BOX,
+  };
+
+  // Writes the source rows [row, row + rows), always an even row and a pair
+  // of rows but at the bottom of an odd height, at stride bytes apart.
+  using FetchFn = bool (*)(void* context, int32_t row, int32_t rows, uint8_t* dst, size_t stride);
+
+  // Rows and sums of one caller; scaleRows() on disjoint output rows can run
+  // concurrently with a Scratch each.
+  struct Scratch {
+    AlignedBytes ring{};
+    // Source rows held, the oldest first; slots are row % ringRows.
+    int32_t first{};
+    int32_t end{};
+    AlignedBytes vertical{};
+    std::vector<uint32_t> sums{};
+
+    size_t bytes() const {
+      return ring.capacity() + vertical.capacity() + sums.capacity() * sizeof(uint32_t);
+    }
+  };
+
+  static Filter filterFor(int32_t source, int32_t destination);
+
+  // False for empty sizes. Cheap when they did not change.
+  bool configure(int32_t sourceWidth, int32_t sourceHeight, int32_t width, int32_t height);
+
+  Filter horizontalFilter() const {
+    return horizontal_;
+  }
+
+  Filter verticalFilter() const {
+    return vertical_;
+  }
+
+  // Writes the output rows [row, row + rows) at stride bytes apart, with the
+  // first and third bytes of each pixel swapped when swapRedBlue.
+  bool scaleRows(
+      Scratch& scratch,
+      int32_t row,
+      int32_t rows,
+      FetchFn fetch,
+      void* context,
+      uint8_t* dst,
+      size_t stride,
+      bool swapRedBlue) const;
+
+ private:
+  // Source indexes and weights of one axis: per output pixel the first
+  // source pixel, and for BILINEAR the 0-256 weight of the next one or for
+  // BOX the end of the run and 65536 over its length.
+  struct Axis {
+    std::vector<int32_t> first{};
+    std::vector<int32_t> weight{};
+    std::vector<int32_t> end{};
+  };
+
+  int32_t sourceWidth_{};
+  int32_t sourceHeight_{};
+  int32_t width_{};
+  int32_t height_{};
+  Filter horizontal_{Filter::NONE};
+  Filter vertical_{Filter::NONE};
+  Axis columns_{};
+  Axis rows_{};
+  // Source rows the ring of a Scratch holds, even.
+  int32_t ringRows_{};
+  size_t ringStride_{};
+
+  static void fillAxis(Axis& axis, Filter filter, int32_t source, int32_t destination);
+  // Source rows [first, end) output row needs.
+  void sourceRows(int32_t row, int32_t& first, int32_t& end) const;
+  bool fetchRows(Scratch& scratch, int32_t end, FetchFn fetch, void* context) const;
+  const uint8_t* ringRow(const Scratch& scratch, int32_t row) const {
+    return scratch.ring.data() + (size_t)(row % ringRows_) * ringStride_;
+  }
+  const uint8_t* combineRows(Scratch& scratch, int32_t row) const;
+  void scaleRow(const uint8_t* src, uint8_t* dst, bool swapRedBlue) const;
+};
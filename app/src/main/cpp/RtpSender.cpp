@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "RtpSender.h"
+
+#include <android/log.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <random>
+#include <thread>
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "RtpSender", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "RtpSender", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "RtpSender", __VA_ARGS__)
+
+static constexpr size_t kRtpHeaderSize = 12;
+// RTCP packet types and the payload-specific feedback formats asking for a
+// keyframe (RFC 4585, RFC 5104).
+static constexpr uint8_t kRtcpSenderReport = 200;
+static constexpr uint8_t kRtcpPayloadFeedback = 206;
+static constexpr uint8_t kFeedbackPli = 1;
+static constexpr uint8_t kFeedbackFir = 4;
+// Seconds from 1900, where NTP time starts, to 1970.
+static constexpr uint64_t kNtpUnixOffset = 2'208'988'800ULL;
+
+static int64_t nowNs() {
+  return steady_clock::now().time_since_epoch().count();
+}
+
+static void putBe16(uint8_t* out, uint16_t value) {
+  out[0] = value >> 8;
+  out[1] = value;
+}
+
+static void putBe32(uint8_t* out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+RtpSender::~RtpSender() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool RtpSender::open(const char* host, uint16_t port, const Config& config) {
+  if (config.mtu <= kRtpHeaderSize + 3) {
+    ULOGE("MTU %u too small", config.mtu);
+    return false;
+  }
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo* addresses = nullptr;
+  std::string service = std::to_string(port);
+  int error = getaddrinfo(host, service.c_str(), &hints, &addresses);
+  if (error != 0) {
+    ULOGE("Resolving %s failed: %s", host, gai_strerror(error));
+    return false;
+  }
+  for (addrinfo* address = addresses; address != nullptr && fd_ < 0; address = address->ai_next) {
+    int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+      ::close(fd);
+      continue;
+    }
+    fd_ = fd;
+  }
+  freeaddrinfo(addresses);
+  if (fd_ < 0) {
+    ULOGE("No UDP socket for %s:%u: %s", host, port, strerror(errno));
+    return false;
+  }
+  config_ = config;
+  std::random_device random;
+  ssrc_ = random();
+  timestampBase_ = random();
+  sequence_ = random();
+  bytesPerSecond_ = config.bitRate / 8.0 * kPacingFactor;
+  ULOGI(
+      "Sending %s RTP to %s:%u, MTU %u, paced at %.0f kB/s",
+      config.hevc ? "H.265" : "H.264",
+      host,
+      port,
+      config.mtu,
+      bytesPerSecond_ / 1000);
+  return true;
+}
+
+void RtpSender::splitNals(const uint8_t* data, size_t size) {
+  nals_.clear();
+  const uint8_t* end = data + size;
+  const uint8_t* start = nullptr;
+  const uint8_t* p = data;
+  while (end - p >= 3) {
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+      if (start != nullptr) {
+        // A four byte start code leaves a zero behind the previous unit.
+        const uint8_t* nalEnd = p > start && p[-1] == 0 ? p - 1 : p;
+        nals_.push_back({start, (size_t)(nalEnd - start)});
+      }
+      p += 3;
+      start = p;
+    } else {
+      p++;
+    }
+  }
+  if (start != nullptr && start < end) {
+    nals_.push_back({start, (size_t)(end - start)});
+  }
+}
+
+int32_t RtpSender::parameterSetIndex(const Nal& nal) const {
+  if (nal.size == 0) {
+    return -1;
+  }
+  if (config_.hevc) {
+    uint8_t type = (nal.data[0] >> 1) & 0x3F;
+    return type >= 32 && type <= 34 ? type - 32 : -1;
+  }
+  uint8_t type = nal.data[0] & 0x1F;
+  return type == 7 || type == 8 ? type - 6 : -1;
+}
+
+bool RtpSender::isKeyframe(const Nal& nal) const {
+  if (nal.size == 0) {
+    return false;
+  }
+  if (config_.hevc) {
+    // IRAP pictures: BLA, IDR and CRA.
+    uint8_t type = (nal.data[0] >> 1) & 0x3F;
+    return type >= 16 && type <= 21;
+  }
+  return (nal.data[0] & 0x1F) == 5;
+}
+
+void RtpSender::setParameterSets(const uint8_t* data, size_t size) {
+  splitNals(data, size);
+  for (const Nal& nal : nals_) {
+    int32_t index = parameterSetIndex(nal);
+    if (index >= 0) {
+      parameterSets_[index].assign(nal.data, nal.data + nal.size);
+    }
+  }
+}
+
+void RtpSender::sendAccessUnit(const uint8_t* data, size_t size, int64_t captureTimeNs) {
+  if (fd_ < 0) {
+    return;
+  }
+  splitNals(data, size);
+  if (nals_.empty()) {
+    return;
+  }
+  bool keyframe = false;
+  bool hasParameterSets = false;
+  for (const Nal& nal : nals_) {
+    int32_t index = parameterSetIndex(nal);
+    if (index >= 0) {
+      parameterSets_[index].assign(nal.data, nal.data + nal.size);
+      hasParameterSets = true;
+    }
+    keyframe |= isKeyframe(nal);
+  }
+  uint32_t timestamp = rtpTimestamp(captureTimeNs);
+  if (keyframe && !hasParameterSets) {
+    for (const std::vector<uint8_t>& parameterSet : parameterSets_) {
+      if (!parameterSet.empty()) {
+        sendNal({parameterSet.data(), parameterSet.size()}, timestamp, false);
+      }
+    }
+  }
+  for (size_t i = 0; i < nals_.size(); i++) {
+    sendNal(nals_[i], timestamp, i + 1 == nals_.size());
+  }
+  int64_t now = nowNs();
+  frames_.add();
+  latency_.record(nanoseconds(now - captureTimeNs));
+  if (now - lastReportNs_ >= kSenderReportInterval.count()) {
+    sendSenderReport(now);
+  }
+  readFeedback();
+}
+
+void RtpSender::sendNal(const Nal& nal, uint32_t timestamp, bool marker) {
+  size_t maxPayload = config_.mtu - kRtpHeaderSize;
+  if (nal.size <= maxPayload) {
+    sendPacket(timestamp, marker, nullptr, 0, nal.data, nal.size);
+    return;
+  }
+  // Fragmentation units carry the NAL header in their own headers.
+  uint8_t prefix[3];
+  size_t prefixSize;
+  size_t headerSize;
+  if (config_.hevc) {
+    prefix[0] = (nal.data[0] & 0x81) | (49 << 1);
+    prefix[1] = nal.data[1];
+    prefix[2] = (nal.data[0] >> 1) & 0x3F;
+    prefixSize = 3;
+    headerSize = 2;
+  } else {
+    prefix[0] = (nal.data[0] & 0xE0) | 28;
+    prefix[1] = nal.data[0] & 0x1F;
+    prefixSize = 2;
+    headerSize = 1;
+  }
+  uint8_t& fuHeader = prefix[prefixSize - 1];
+  uint8_t type = fuHeader;
+  size_t fragmentSize = maxPayload - prefixSize;
+  for (size_t offset = headerSize; offset < nal.size; offset += fragmentSize) {
+    size_t size = std::min(fragmentSize, nal.size - offset);
+    bool last = offset + size == nal.size;
+    fuHeader = type | (offset == headerSize ? 0x80 : 0) | (last ? 0x40 : 0);
+    sendPacket(timestamp, marker && last, prefix, prefixSize, nal.data + offset, size);
+  }
+}
+
+void RtpSender::sendPacket(
+    uint32_t timestamp,
+    bool marker,
+    const uint8_t* prefix,
+    size_t prefixSize,
+    const uint8_t* payload,
+    size_t payloadSize) {
+  uint8_t header[kRtpHeaderSize];
+  header[0] = 0x80; // version 2
+  header[1] = (marker ? 0x80 : 0) | (config_.payloadType & 0x7F);
+  putBe16(header + 2, sequence_++);
+  putBe32(header + 4, timestamp);
+  putBe32(header + 8, ssrc_);
+  iovec parts[3] = {
+      {header, sizeof(header)},
+      {const_cast<uint8_t*>(prefix), prefixSize},
+      {const_cast<uint8_t*>(payload), payloadSize},
+  };
+  msghdr message{};
+  message.msg_iov = parts;
+  message.msg_iovlen = 3;
+  size_t bytes = sizeof(header) + prefixSize + payloadSize;
+  pace(bytes);
+  if (sendmsg(fd_, &message, MSG_NOSIGNAL) < 0) {
+    // The receiver not listening yet shows up as ECONNREFUSED.
+    if (sendErrors_.load() == 0) {
+      ULOGW("sendmsg failed: %s", strerror(errno));
+    }
+    sendErrors_.add();
+    return;
+  }
+  packets_.add();
+  bytes_.add(bytes);
+}
+
+void RtpSender::pace(size_t bytes) {
+  if (bytesPerSecond_ <= 0) {
+    return;
+  }
+  int64_t now = nowNs();
+  nextSendNs_ = std::clamp(nextSendNs_, now, now + (int64_t)kMaxPacingDelay.count());
+  if (nextSendNs_ > now) {
+    std::this_thread::sleep_for(nanoseconds(nextSendNs_ - now));
+  }
+  nextSendNs_ += (int64_t)(bytes * 1e9 / bytesPerSecond_);
+}
+
+uint32_t RtpSender::rtpTimestamp(int64_t monotonicNs) const {
+  return timestampBase_ + (uint32_t)(monotonicNs / 1000 * kClockRate / 1'000'000);
+}
+
+void RtpSender::sendSenderReport(int64_t now) {
+  lastReportNs_ = now;
+  timespec wallClock{};
+  clock_gettime(CLOCK_REALTIME, &wallClock);
+  uint8_t report[28];
+  report[0] = 0x80; // version 2, no report blocks
+  report[1] = kRtcpSenderReport;
+  putBe16(report + 2, sizeof(report) / 4 - 1);
+  putBe32(report + 4, ssrc_);
+  putBe32(report + 8, wallClock.tv_sec + kNtpUnixOffset);
+  putBe32(report + 12, (uint32_t)(((uint64_t)wallClock.tv_nsec << 32) / 1'000'000'000));
+  putBe32(report + 16, rtpTimestamp(now));
+  putBe32(report + 20, packets_.load());
+  putBe32(report + 24, bytes_.load());
+  send(fd_, report, sizeof(report), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+void RtpSender::readFeedback() {
+  uint8_t packet[1500];
+  ssize_t received;
+  while ((received = recv(fd_, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+    // A compound RTCP packet: walk every packet in it.
+    size_t offset = 0;
+    while (offset + 4 <= (size_t)received) {
+      const uint8_t* rtcp = packet + offset;
+      size_t length = ((rtcp[2] << 8 | rtcp[3]) + 1) * 4;
+      uint8_t format = rtcp[0] & 0x1F;
+      if (rtcp[1] == kRtcpPayloadFeedback && (format == kFeedbackPli || format == kFeedbackFir)) {
+        requestKeyframe();
+      }
+      offset += length;
+    }
+  }
+}
+
+void RtpSender::requestKeyframe() {
+  keyframeRequests_.addShared();
+  keyframeRequested_.store(true, std::memory_order_relaxed);
+}
+
+bool RtpSender::takeKeyframeRequest() {
+  return keyframeRequested_.exchange(false, std::memory_order_relaxed);
+}
+
+std::string RtpSender::summary() const {
+  return std::format(
+      "RTP {}: {} frames {} packets {:.1f} MB, {} send errors, {} keyframe requests, "
+      "latency {:.2f}/{:.2f}/{:.2f} ms",
+      config_.hevc ? "H.265" : "H.264",
+      frames_.load(),
+      packets_.load(),
+      bytes_.load() / 1e6,
+      sendErrors_.load(),
+      keyframeRequests_.load(),
+      latency_.percentile(0.50).count() / 1000.0,
+      latency_.percentile(0.95).count() / 1000.0,
+      latency_.percentile(0.99).count() / 1000.0);
+}
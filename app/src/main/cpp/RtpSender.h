@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "LatencyHistogram.h"
+#include "StreamingStats.h"
+
+using namespace std::chrono;
+
+// Sends an H.264 (RFC 6184) or H.265 (RFC 7798) stream as RTP over a
+// connected UDP socket, with RTCP on the same port as WebRTC muxes it.
+//
+// Access units are Annex B byte streams. NAL units that fit a packet go out
+// as they are, larger ones as fragmentation units, and every packet is
+// gathered by sendmsg() straight from the caller's buffer, so encoder output
+// buffers and libuvc frames are never copied. Parameter sets are kept and
+// sent again ahead of keyframes that come without them, so a receiver can
+// join at any keyframe.
+//
+// Packets are paced to kPacingFactor times the configured bit rate so a
+// keyframe does not leave in one burst. A PLI or FIR from the receiver sets
+// a keyframe request the encoder polls with takeKeyframeRequest().
+class RtpSender final {
+ public:
+  struct Config {
+    bool hevc{false};
+    // Largest datagram, RTP header included.
+    uint32_t mtu{kDefaultMtu};
+    // Zero sends every packet at once.
+    int32_t bitRate{};
+    uint8_t payloadType{96};
+  };
+
+  static constexpr uint32_t kDefaultMtu = 1200;
+  static constexpr uint32_t kClockRate = 90'000;
+  static constexpr double kPacingFactor = 2.5;
+  // Pacing never holds a packet back longer than this.
+  static constexpr nanoseconds kMaxPacingDelay = 30ms;
+  static constexpr nanoseconds kSenderReportInterval = 1s;
+
+  RtpSender() = default;
+  RtpSender(const RtpSender&) = delete;
+  RtpSender& operator=(const RtpSender&) = delete;
+  ~RtpSender();
+
+  // host is a name or an IPv4 or IPv6 address.
+  bool open(const char* host, uint16_t port, const Config& config);
+
+  bool hevc() const {
+    return config_.hevc;
+  }
+
+  // One thread at a time. captureTimeNs is the CLOCK_MONOTONIC end of the
+  // frame's USB transfer: it gives the RTP timestamp, and the send latency
+  // once the last packet is out.
+  void sendAccessUnit(const uint8_t* data, size_t size, int64_t captureTimeNs);
+  // Codec config of an encoder, parameter sets only. Nothing is sent.
+  void setParameterSets(const uint8_t* data, size_t size);
+
+  // Any thread.
+  void requestKeyframe();
+  // True once per request, from requestKeyframe() or the receiver.
+  bool takeKeyframeRequest();
+
+  // Frames, packets, bytes, keyframe requests and send latency on one line.
+  std::string summary() const;
+
+ private:
+  struct Nal {
+    const uint8_t* data;
+    size_t size;
+  };
+
+  void splitNals(const uint8_t* data, size_t size);
+  // VPS, SPS and PPS go to 0, 1 and 2, other NAL units to -1.
+  int32_t parameterSetIndex(const Nal& nal) const;
+  bool isKeyframe(const Nal& nal) const;
+  void sendNal(const Nal& nal, uint32_t timestamp, bool marker);
+  void sendPacket(
+      uint32_t timestamp,
+      bool marker,
+      const uint8_t* prefix,
+      size_t prefixSize,
+      const uint8_t* payload,
+      size_t payloadSize);
+  void pace(size_t bytes);
+  uint32_t rtpTimestamp(int64_t monotonicNs) const;
+  void sendSenderReport(int64_t nowNs);
+  void readFeedback();
+
+  Config config_{};
+  int fd_{-1};
+  uint32_t ssrc_{};
+  uint32_t timestampBase_{};
+  uint16_t sequence_{};
+  double bytesPerSecond_{};
+  int64_t nextSendNs_{};
+  int64_t lastReportNs_{};
+  std::vector<Nal> nals_{};
+  std::array<std::vector<uint8_t>, 3> parameterSets_{};
+  std::atomic<bool> keyframeRequested_{false};
+
+  StatCounter frames_{};
+  StatCounter packets_{};
+  StatCounter bytes_{};
+  StatCounter sendErrors_{};
+  StatCounter keyframeRequests_{};
+  LatencyHistogram latency_{};
+};
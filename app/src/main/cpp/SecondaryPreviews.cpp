@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SecondaryPreviews.h"
+
+#include <android/hardware_buffer.h>
+#include <android/log.h>
+
+#include <libyuv/planar_functions.h>
+#include <libyuv/scale_argb.h>
+
+#include <algorithm>
+
+#include "FrameFanout.h"
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "SecondaryPreviews", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "SecondaryPreviews", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "SecondaryPreviews", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "SecondaryPreviews", __VA_ARGS__)
+
+SecondaryPreviews::~SecondaryPreviews() {
+  clear();
+}
+
+bool SecondaryPreviews::add(ANativeWindow* window, int32_t maxFps) {
+  if (window == nullptr || maxFps < 0) {
+    return false;
+  }
+  std::lock_guard lk(mutex_);
+  for (const Output& output : outputs_) {
+    if (output.window == window) {
+      return false;
+    }
+  }
+  ANativeWindow_acquire(window);
+  Output output{};
+  output.window = window;
+  output.intervalNs = maxFps > 0 ? 1'000'000'000LL / maxFps : 0;
+  outputs_.push_back(output);
+  count_ = outputs_.size();
+  ULOGI("Added a secondary preview at up to %d fps, %zu in all", maxFps, outputs_.size());
+  return true;
+}
+
+bool SecondaryPreviews::remove(ANativeWindow* window) {
+  std::lock_guard lk(mutex_);
+  auto it = std::find_if(
+      outputs_.begin(), outputs_.end(), [&](const Output& o) { return o.window == window; });
+  if (it == outputs_.end()) {
+    return false;
+  }
+  ANativeWindow_release(it->window);
+  outputs_.erase(it);
+  count_ = outputs_.size();
+  return true;
+}
+
+void SecondaryPreviews::clear() {
+  std::lock_guard lk(mutex_);
+  for (const Output& output : outputs_) {
+    ANativeWindow_release(output.window);
+  }
+  outputs_.clear();
+  count_ = 0;
+}
+
+bool SecondaryPreviews::due(const Output& output, int64_t nowNs) {
+  // A little early is on time, so capture jitter does not halve the rate.
+  return output.lastPresentNs == 0 ||
+      nowNs - output.lastPresentNs >= output.intervalNs - output.intervalNs / 8;
+}
+
+bool SecondaryPreviews::lock(Output& output, ANativeWindow_Buffer& buffer) {
+  if (!output.configured) {
+    // Buffers at the surface's own size, which the thumbnail's view sets.
+    ANativeWindow_setBuffersGeometry(output.window, 0, 0, AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM);
+    output.configured = true;
+  }
+  int32_t result = ANativeWindow_lock(output.window, &buffer, nullptr);
+  if (result != 0) {
+    ULOGW("Secondary preview could not be locked: %d", result);
+    return false;
+  }
+  return true;
+}
+
+void SecondaryPreviews::present(
+    const ANativeWindow_Buffer& rgba,
+    uint32_t sequence,
+    int64_t nowNs) {
+  if (count_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::lock_guard lk(mutex_);
+  for (Output& output : outputs_) {
+    if (!due(output, nowNs)) {
+      continue;
+    }
+    TRACE_SCOPE("secondaryPreview");
+    ANativeWindow_Buffer buffer;
+    if (!lock(output, buffer)) {
+      continue;
+    }
+    libyuv::ARGBScale(
+        static_cast<const uint8_t*>(rgba.bits),
+        rgba.stride * 4,
+        rgba.width,
+        rgba.height,
+        static_cast<uint8_t*>(buffer.bits),
+        buffer.stride * 4,
+        buffer.width,
+        buffer.height,
+        libyuv::kFilterBilinear);
+    ANativeWindow_unlockAndPost(output.window);
+    output.lastPresentNs = nowNs;
+    output.lastSequence = sequence;
+  }
+}
+
+void SecondaryPreviews::offer(const uvc_frame_t* frame, FrameFanout& fanout, int64_t nowNs) {
+  if (count_.load(std::memory_order_relaxed) == 0 ||
+      !FrameFanout::supportsFormat(frame->frame_format)) {
+    return;
+  }
+  std::lock_guard lk(mutex_);
+  for (Output& output : outputs_) {
+    if (output.lastSequence == frame->sequence || !due(output, nowNs)) {
+      continue;
+    }
+    TRACE_SCOPE("secondaryPreview");
+    ANativeWindow_Buffer buffer;
+    if (!lock(output, buffer)) {
+      continue;
+    }
+    // Windows of the same size share one conversion.
+    FrameFanout::FramePtr derived =
+        fanout.derive(frame, FanoutFormat::RGBA, buffer.width, buffer.height);
+    if (derived != nullptr) {
+      libyuv::ARGBScale(
+          derived->data.data(),
+          derived->stride,
+          derived->width,
+          derived->height,
+          static_cast<uint8_t*>(buffer.bits),
+          buffer.stride * 4,
+          buffer.width,
+          buffer.height,
+          libyuv::kFilterBilinear);
+    }
+    ANativeWindow_unlockAndPost(output.window);
+    output.lastPresentNs = nowNs;
+    output.lastSequence = frame->sequence;
+  }
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class FrameFanout;
+
+// Windows showing a stream besides its preview, such as a thumbnail strip or
+// a picture in picture, each at its own size and at most its own frame rate.
+//
+// They are filled by scaling the preview's RGBA window buffer once it was
+// converted, before it is posted, so no frame is converted twice. Preview
+// paths without a CPU RGBA buffer, the GL preview, YV12 windows and MJPEG
+// decoded straight to YUV, fill them from the FrameFanout's RGBA at each
+// window's size instead; compressed H.264 and H.265 frames cannot fill them.
+// A window is only touched on frames its frame rate cap lets through.
+//
+// add() and remove() are called from any thread, the rest from the render
+// thread.
+class SecondaryPreviews final {
+ public:
+  SecondaryPreviews() = default;
+  SecondaryPreviews(const SecondaryPreviews&) = delete;
+  SecondaryPreviews& operator=(const SecondaryPreviews&) = delete;
+  ~SecondaryPreviews();
+
+  // Takes a reference on window. maxFps 0 shows every frame. Returns false
+  // when the window was already added.
+  bool add(ANativeWindow* window, int32_t maxFps);
+  bool remove(ANativeWindow* window);
+  void clear();
+  bool empty() const {
+    return count_.load(std::memory_order_relaxed) == 0;
+  }
+
+  // Scales the converted RGBA preview buffer of frame sequence into the
+  // windows that are due a frame at nowNs.
+  void present(const ANativeWindow_Buffer& rgba, uint32_t sequence, int64_t nowNs);
+  // Fills the windows still due a frame at nowNs, which present() did not
+  // serve, from fanout.
+  void offer(const uvc_frame_t* frame, FrameFanout& fanout, int64_t nowNs);
+
+ private:
+  struct Output {
+    ANativeWindow* window{};
+    int64_t intervalNs{};
+    int64_t lastPresentNs{};
+    // Frame last shown, so offer() skips the ones present() served.
+    uint32_t lastSequence{UINT32_MAX};
+    bool configured{false};
+  };
+
+  std::mutex mutex_;
+  std::vector<Output> outputs_{};
+  // Size of outputs_, so frames skip mutex_ while there are none.
+  std::atomic<size_t> count_{0};
+
+  static bool due(const Output& output, int64_t nowNs);
+  static bool lock(Output& output, ANativeWindow_Buffer& buffer);
+};
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SlowFrameRecorder.h"
+
+#include <android/log.h>
+
+#include <time.h>
+
+#include "HotLog.h"
+
+#define HLOGW(...) HOT_LOG(ANDROID_LOG_WARN, "SlowFrameRecorder", __VA_ARGS__)
+#define HLOGI(...) HOT_LOG(ANDROID_LOG_INFO, "SlowFrameRecorder", __VA_ARGS__)
+
+namespace {
+
+double toMs(int64_t ns) {
+  return ns / 1e6;
+}
+
+// Milliseconds from one stage to the next, -1 when either is missing.
+double stageMs(int64_t fromNs, int64_t toNs) {
+  return fromNs > 0 && toNs > 0 ? toMs(toNs - fromNs) : -1;
+}
+
+} // namespace
+
+void SlowFrameRecorder::record(const Record& record, int64_t frameIntervalNs) {
+  float multiple = budgetMultiple_.load(std::memory_order_relaxed);
+  if (multiple <= 0 || frameIntervalNs <= 0) {
+    return;
+  }
+  ring_[written_++ % kCapacity] = record;
+  const FrameTimeline& timeline = record.timeline;
+  int64_t budgetNs = (int64_t)(multiple * frameIntervalNs);
+  if (timeline.postedNs - timeline.usbCompleteNs <= budgetNs) {
+    return;
+  }
+  if (lastDumpNs_ != 0 && timeline.postedNs - lastDumpNs_ < kDumpInterval) {
+    return;
+  }
+  lastDumpNs_ = timeline.postedNs;
+  dump(record, budgetNs);
+}
+
+void SlowFrameRecorder::reset() {
+  written_ = 0;
+  lastDumpNs_ = 0;
+}
+
+int64_t SlowFrameRecorder::threadCpuNs() {
+  timespec now{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1'000'000'000LL + now.tv_nsec;
+}
+
+void SlowFrameRecorder::dump(const Record& slow, int64_t budgetNs) {
+  size_t count = written_ < kCapacity ? (size_t)written_ : kCapacity;
+  HLOGW(
+      "Frame %u took %.2f ms, over its %.2f ms budget; stages of the last %zu frames in ms:",
+      slow.sequence,
+      toMs(slow.timeline.postedNs - slow.timeline.usbCompleteNs),
+      toMs(budgetNs),
+      count);
+  for (uint64_t i = written_ - count; i < written_; i++) {
+    const Record& record = ring_[i % kCapacity];
+    const FrameTimeline& timeline = record.timeline;
+    // The gap since the previous post shows the stutter itself.
+    double gapMs = -1;
+    if (i > written_ - count) {
+      gapMs = stageMs(ring_[(i - 1) % kCapacity].timeline.postedNs, timeline.postedNs);
+    }
+    HLOGI(
+        "  #%u callback %.2f queue %.2f lock %.2f convert %.2f post %.2f total %.2f"
+        " cpu %.2f depth %u gap %.2f",
+        record.sequence,
+        stageMs(timeline.usbCompleteNs, timeline.callbackNs),
+        stageMs(timeline.callbackNs, timeline.renderStartNs),
+        timeline.windowLockNs >= 0 ? toMs(timeline.windowLockNs) : -1,
+        stageMs(timeline.renderStartNs, timeline.convertedNs),
+        stageMs(timeline.convertedNs, timeline.postedNs),
+        stageMs(timeline.usbCompleteNs, timeline.postedNs),
+        toMs(record.renderCpuNs),
+        record.queueDepth,
+        gapMs);
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "FrameLatencyStats.h"
+
+// A flight recorder of the render thread's last kCapacity frames: their
+// stage timestamps, the render thread CPU each took and the frames queued
+// behind them. When a frame's host latency, USB completion to post, exceeds
+// a multiple of the frame interval the ring is dumped through HotLog, so the
+// frames leading up to a stutter can be read from logcat without the render
+// thread formatting anything. The periodic summaries only show averages.
+//
+// libuvc stamps USB completion when it swaps the assembled frame out, so that
+// stage includes the swap. Dumps are at least kDumpInterval apart, as a long
+// stall makes every frame behind it late.
+//
+// record() is called from the render thread only.
+class SlowFrameRecorder final {
+ public:
+  static constexpr size_t kCapacity = 32;
+  static constexpr int64_t kDumpInterval = 1'000'000'000;
+
+  struct Record {
+    uint32_t sequence;
+    // Frames waiting in the render queue when this one was taken.
+    uint32_t queueDepth;
+    FrameTimeline timeline;
+    // CLOCK_THREAD_CPUTIME_ID of the render thread from taking the frame to
+    // posting it.
+    int64_t renderCpuNs;
+  };
+
+  // 0 turns the recorder off. From any thread, applies from the next frame.
+  void setBudgetMultiple(float multiple) {
+    budgetMultiple_.store(multiple, std::memory_order_relaxed);
+  }
+  bool enabled() const {
+    return budgetMultiple_.load(std::memory_order_relaxed) > 0;
+  }
+
+  // Keeps the record and dumps the ring when the frame missed its budget of
+  // the multiple times frameIntervalNs.
+  void record(const Record& record, int64_t frameIntervalNs);
+  // Forgets the frames, for a new stream.
+  void reset();
+
+  // CPU time of the calling thread, for renderCpuNs.
+  static int64_t threadCpuNs();
+
+ private:
+  std::atomic<float> budgetMultiple_{0};
+  std::array<Record, kCapacity> ring_{};
+  uint64_t written_{0};
+  int64_t lastDumpNs_{0};
+
+  void dump(const Record& slow, int64_t budgetNs);
+};
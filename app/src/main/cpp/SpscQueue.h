@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+
+// Bounded lock-free queue with a single producer and a single consumer.
+// Alongside each item it carries the time it was pushed so the consumer can
+// measure queueing delay.
+//
+// tryPop() may also be called by the producer to evict the oldest item when
+// the queue is full. Both sides advance head_ with a CAS, so whoever wins owns
+// the item and the other side retries.
+template <typename T>
+class SpscQueue {
+  static_assert(std::is_trivially_copyable_v<T>, "SpscQueue items must be trivially copyable");
+
+ public:
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+  SpscQueue(uint32_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1),
+        items_(std::make_unique<std::atomic<T>[]>(capacity_)),
+        enqueueTimes_(std::make_unique<std::atomic<int64_t>[]>(capacity_)) {}
+
+  uint32_t capacity() const {
+    return capacity_;
+  }
+
+  uint32_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  bool full() const {
+    return size() >= capacity_;
+  }
+
+  // Producer only. Returns false without blocking if the queue is full.
+  bool tryPush(T item, int64_t enqueueTimeNs) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+      return false;
+    }
+    items_[tail % capacity_].store(item, std::memory_order_relaxed);
+    enqueueTimes_[tail % capacity_].store(enqueueTimeNs, std::memory_order_relaxed);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer, or producer evicting the oldest item. Returns false if empty.
+  bool tryPop(T& item, int64_t& enqueueTimeNs) {
+    uint32_t head = head_.load(std::memory_order_acquire);
+    while (head != tail_.load(std::memory_order_acquire)) {
+      T candidate = items_[head % capacity_].load(std::memory_order_relaxed);
+      int64_t enqueueTime = enqueueTimes_[head % capacity_].load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(
+              head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        item = candidate;
+        enqueueTimeNs = enqueueTime;
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const uint32_t capacity_;
+  std::unique_ptr<std::atomic<T>[]> items_;
+  std::unique_ptr<std::atomic<int64_t>[]> enqueueTimes_;
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+};
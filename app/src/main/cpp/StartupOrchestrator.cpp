@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "StartupOrchestrator.h"
+
+#include <android/log.h>
+
+#include <cstdio>
+#include <tuple>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "StartupOrchestrator", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "StartupOrchestrator", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "StartupOrchestrator", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "StartupOrchestrator", __VA_ARGS__)
+
+void StartupOrchestrator::PhaseLog::mark(const char* phase) {
+  steady_clock::time_point now = steady_clock::now();
+  phases_.emplace_back(phase, duration<double, std::milli>(now - last_).count());
+  last_ = now;
+}
+
+// Set on the thread running a completion, which must not wait for itself.
+static thread_local bool inCompletion_ = false;
+
+StartupOrchestrator::~StartupOrchestrator() {
+  wait();
+}
+
+bool StartupOrchestrator::run(Pipeline audio, Pipeline video, Completion completion) {
+  {
+    std::lock_guard lk(mutex_);
+    if (running_) {
+      ULOGW("Startup already in progress");
+      return false;
+    }
+    running_ = true;
+    audioCancel_ = CancelToken();
+    videoCancel_ = CancelToken();
+  }
+  auto run = std::make_shared<Run>();
+  run->audio = std::move(audio);
+  run->video = std::move(video);
+  run->completion = std::move(completion);
+  run->begin = steady_clock::now();
+  run->audioLog.last_ = run->videoLog.last_ = run->begin;
+  run->audioLog.cancel_ = audioCancel_;
+  run->videoLog.cancel_ = videoCancel_;
+  launch<Result>(ControlExecutor::shared(), startup(run), [this, run](Result result) {
+    if (run->completion) {
+      inCompletion_ = true;
+      run->completion(result);
+      inCompletion_ = false;
+    }
+    {
+      std::lock_guard lk(mutex_);
+      running_ = false;
+    }
+    done_.notify_all();
+  });
+  return true;
+}
+
+void StartupOrchestrator::cancelAudio() {
+  std::lock_guard lk(mutex_);
+  if (running_) {
+    audioCancel_.cancel();
+  }
+}
+
+void StartupOrchestrator::cancelVideo() {
+  std::lock_guard lk(mutex_);
+  if (running_) {
+    videoCancel_.cancel();
+  }
+}
+
+void StartupOrchestrator::wait() {
+  if (inCompletion_) {
+    return;
+  }
+  std::unique_lock lk(mutex_);
+  done_.wait(lk, [this] { return !running_; });
+}
+
+Task<StartupOrchestrator::Result> StartupOrchestrator::startup(std::shared_ptr<Run> run) {
+  Result result;
+  std::tie(result.audio, result.video) = co_await whenAll(
+      ControlExecutor::shared(),
+      runPipeline(run->audio, run->audioLog),
+      runPipeline(run->video, run->videoLog));
+  result.totalMs = duration<double, std::milli>(steady_clock::now() - run->begin).count();
+  append(result.breakdown, "audio", run->audioLog);
+  append(result.breakdown, "video", run->videoLog);
+  ULOGI(
+      "Startup took %.1f ms, audio %s%s, video %s%s: %s",
+      result.totalMs,
+      result.audio ? "up" : "down",
+      run->audioLog.cancelled() ? " (cancelled)" : "",
+      result.video ? "up" : "down",
+      run->videoLog.cancelled() ? " (cancelled)" : "",
+      result.breakdown.c_str());
+  co_return result;
+}
+
+Task<bool> StartupOrchestrator::runPipeline(const Pipeline& pipeline, PhaseLog& log) {
+  co_return pipeline && !log.cancelled() && pipeline(log);
+}
+
+void StartupOrchestrator::append(std::string& out, const char* pipeline, const PhaseLog& log) {
+  if (log.phases_.empty()) {
+    return;
+  }
+  if (!out.empty()) {
+    out += "; ";
+  }
+  out += pipeline;
+  out += ":";
+  char phase[64];
+  for (size_t i = 0; i < log.phases_.size(); i++) {
+    snprintf(
+        phase,
+        sizeof(phase),
+        "%s %s %.1f ms",
+        i == 0 ? "" : ",",
+        log.phases_[i].first,
+        log.phases_[i].second);
+    out += phase;
+  }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "ControlTask.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono;
+
+// Runs the blocking connect and start steps of the audio and video streamers
+// at the same time, as coroutine tasks on the ControlExecutor, and reports how
+// long every phase took.
+//
+// The pipelines only meet in UsbSession::shared(), which serializes the
+// libusb setup, so the AAudio open and its state change wait overlap the UVC
+// probe, stream open and transfer setup, and startup costs the longer of the
+// two pipelines rather than their sum.
+//
+// A run is cancelled cooperatively: the pipelines check PhaseLog::cancelled()
+// between their blocking steps and skip the rest, so a disconnect during
+// startup does not wait for a fast start upgrade nobody will see.
+class StartupOrchestrator final {
+ public:
+  // Phases of one pipeline, each timed from the previous mark.
+  class PhaseLog {
+   public:
+    void mark(const char* phase);
+    // Whether the pipeline was cancelled since the run began.
+    bool cancelled() const {
+      return cancel_.cancelled();
+    }
+
+   private:
+    friend class StartupOrchestrator;
+    CancelToken cancel_{};
+    steady_clock::time_point last_{};
+    std::vector<std::pair<const char*, double>> phases_{};
+  };
+
+  // Returns whether the streamer is up. Empty pipelines are skipped.
+  using Pipeline = std::function<bool(PhaseLog&)>;
+
+  struct Result {
+    bool audio{false};
+    bool video{false};
+    double totalMs{};
+    // Like "audio: open 480.2 ms, start 2.1 ms; video: negotiate 35.0 ms, ...".
+    std::string breakdown{};
+  };
+
+  using Completion = std::function<void(const Result&)>;
+
+  StartupOrchestrator() = default;
+  StartupOrchestrator(const StartupOrchestrator&) = delete;
+  StartupOrchestrator& operator=(const StartupOrchestrator&) = delete;
+  ~StartupOrchestrator();
+
+  // Returns false while a previous run is in progress. completion runs on an
+  // executor thread once both pipelines are done.
+  bool run(Pipeline audio, Pipeline video, Completion completion);
+  // Ask a pipeline of the current run to stop after the step in progress.
+  void cancelAudio();
+  void cancelVideo();
+  // Blocks until the current run, including its completion, is over. Does
+  // nothing when called from the completion.
+  void wait();
+
+ private:
+  struct Run {
+    Pipeline audio{};
+    Pipeline video{};
+    Completion completion{};
+    steady_clock::time_point begin{};
+    PhaseLog audioLog{};
+    PhaseLog videoLog{};
+  };
+
+  std::mutex mutex_;
+  std::condition_variable done_;
+  bool running_{false};
+  CancelToken audioCancel_{};
+  CancelToken videoCancel_{};
+
+  static Task<Result> startup(std::shared_ptr<Run> run);
+  static Task<bool> runPipeline(const Pipeline& pipeline, PhaseLog& log);
+  static void append(std::string& out, const char* pipeline, const PhaseLog& log);
+};
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "StillCapture.h"
+
+#include <android/log.h>
+
+#include <cstring>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "StillCapture", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "StillCapture", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "StillCapture", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "StillCapture", __VA_ARGS__)
+
+StillCapture::StillCapture(std::shared_ptr<UvcDevice> device, uvc_stream_handle_t* streamHandle)
+    : device_(std::move(device)), streamHandle_(streamHandle) {}
+
+StillCapture::~StillCapture() {
+  std::unique_lock lk(mutex_);
+  closing_ = true;
+  if (bulkInFlight_) {
+    libusb_cancel_transfer(transfer_);
+  }
+  idle_.wait(lk, [this] { return !triggerInFlight_ && !bulkInFlight_; });
+  finish(lk, false, {});
+  if (method_ == 2) {
+    // Only possible while stopped; the buffers stay large until then.
+    uvc_stream_set_still(streamHandle_, nullptr);
+  }
+  if (transfer_ != nullptr) {
+    libusb_free_transfer(transfer_);
+  }
+}
+
+bool StillCapture::needsStoppedStream(uvc_device_handle_t* deviceHandle, uint8_t interfaceNumber) {
+  return uvc_get_still_capture_method(deviceHandle, interfaceNumber) == 2;
+}
+
+bool StillCapture::configure(uvc_stream_ctrl_t& streamCtrl, int32_t width, int32_t height) {
+  uvc_device_handle_t* deviceHandle = device_->handle();
+  method_ = uvc_get_still_capture_method(deviceHandle, streamCtrl.bInterfaceNumber);
+  if (method_ != 2 && method_ != 3) {
+    ULOGE("Interface %u has no still method 2 or 3, but %d", streamCtrl.bInterfaceNumber, method_);
+    return false;
+  }
+  // Probes and commits the still.
+  uvc_error_t res =
+      uvc_get_still_ctrl_format_size(deviceHandle, &streamCtrl, &stillCtrl_, width, height);
+  if (res != UVC_SUCCESS) {
+    ULOGE("No %dx%d still for the stream's format: %s", width, height, uvc_strerror(res));
+    return false;
+  }
+  if (method_ == 2) {
+    res = uvc_stream_set_still(streamHandle_, &stillCtrl_);
+    if (res != UVC_SUCCESS) {
+      ULOGE("Cannot size the stream for the still: %s", uvc_strerror(res));
+      return false;
+    }
+  } else {
+    endpoint_ = uvc_get_still_endpoint(deviceHandle, &stillCtrl_);
+    if ((endpoint_ & LIBUSB_ENDPOINT_IN) == 0) {
+      ULOGE("Method 3 still without a bulk IN endpoint");
+      return false;
+    }
+    uint32_t transferSize = stillCtrl_.dwMaxPayloadTransferSize != 0
+        ? stillCtrl_.dwMaxPayloadTransferSize
+        : kDefaultBulkTransferSize;
+    transferBuffer_.resize(transferSize);
+    transfer_ = libusb_alloc_transfer(0);
+    if (transfer_ == nullptr) {
+      return false;
+    }
+  }
+  width_ = width;
+  height_ = height;
+  ULOGI(
+      "Still method %d at %dx%d, up to %u bytes",
+      method_,
+      width,
+      height,
+      stillCtrl_.dwMaxVideoFrameSize);
+  return true;
+}
+
+bool StillCapture::capture(Callback done) {
+  {
+    std::unique_lock lk(mutex_);
+    if (pending_ != nullptr && steady_clock::now() >= deadline_ && !bulkInFlight_) {
+      ULOGW("Still did not arrive in time");
+      finish(lk, false, {});
+      lk.lock();
+    }
+    if (closing_ || pending_ != nullptr || triggerInFlight_ || bulkInFlight_) {
+      return false;
+    }
+    pending_ = std::move(done);
+    deadline_ = steady_clock::now() + kTimeout;
+    image_.clear();
+    triggerInFlight_ = true;
+  }
+  uint8_t trigger = method_ == 3 ? kTriggerBulk : kTriggerInStream;
+  device_->controls().setStreaming(
+      stillCtrl_.bInterfaceNumber,
+      kStillImageTriggerControl,
+      &trigger,
+      sizeof(trigger),
+      [this](uvc_error_t result, const uint8_t*, uint16_t) { onTriggered(result); });
+  return true;
+}
+
+void StillCapture::onTriggered(uvc_error_t result) {
+  std::unique_lock lk(mutex_);
+  triggerInFlight_ = false;
+  if (result != UVC_SUCCESS) {
+    ULOGE("Still trigger failed: %s", uvc_strerror(result));
+    finish(lk, false, {});
+    lk.lock();
+  } else if (method_ == 3 && !closing_ && !submitBulkLocked()) {
+    finish(lk, false, {});
+    lk.lock();
+  }
+  idle_.notify_all();
+}
+
+bool StillCapture::offer(const uvc_frame_t* frame) {
+  if (!frame->still) {
+    // Frames keep coming while a method 2 still is pending, so the deadline
+    // is checked here.
+    std::unique_lock lk(mutex_, std::try_to_lock);
+    if (lk.owns_lock() && method_ == 2 && pending_ != nullptr && !triggerInFlight_ &&
+        steady_clock::now() >= deadline_) {
+      ULOGW("Still did not arrive in time");
+      finish(lk, false, {});
+    }
+    return false;
+  }
+  const uint8_t* data = static_cast<const uint8_t*>(frame->data);
+  std::unique_lock lk(mutex_);
+  if (pending_ == nullptr) {
+    ULOGW("Still frame without a capture, dropped");
+    return true;
+  }
+  finish(lk, frame->data_bytes > 0, std::vector<uint8_t>(data, data + frame->data_bytes));
+  return true;
+}
+
+bool StillCapture::submitBulkLocked() {
+  libusb_fill_bulk_transfer(
+      transfer_,
+      uvc_get_libusb_handle(device_->handle()),
+      endpoint_,
+      transferBuffer_.data(),
+      (int)transferBuffer_.size(),
+      &StillCapture::onBulkTransferComplete,
+      this,
+      duration_cast<milliseconds>(kTimeout).count());
+  int status = libusb_submit_transfer(transfer_);
+  if (status != LIBUSB_SUCCESS) {
+    ULOGE("Still transfer on endpoint %#x failed: %s", endpoint_, libusb_error_name(status));
+    return false;
+  }
+  bulkInFlight_ = true;
+  return true;
+}
+
+void LIBUSB_CALL StillCapture::onBulkTransferComplete(libusb_transfer* transfer) {
+  StillCapture* self = static_cast<StillCapture*>(transfer->user_data);
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    self->onBulkPayload(transfer->buffer, transfer->actual_length);
+    return;
+  }
+  std::unique_lock lk(self->mutex_);
+  self->bulkInFlight_ = false;
+  if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+    ULOGE("Still transfer failed: %s", libusb_error_name(transfer->status));
+  }
+  self->finish(lk, false, {});
+  lk.lock();
+  self->idle_.notify_all();
+}
+
+void StillCapture::onBulkPayload(const uint8_t* payload, int length) {
+  std::unique_lock lk(mutex_);
+  bulkInFlight_ = false;
+  // Each payload starts with the UVC payload header.
+  int headerLength = length >= 2 ? payload[0] : 0;
+  if (headerLength >= 2 && headerLength <= length) {
+    uint8_t info = payload[1];
+    if ((info & 0x40) != 0) {
+      ULOGE("Still payload with the error bit set");
+      finish(lk, false, {});
+      lk.lock();
+      idle_.notify_all();
+      return;
+    }
+    image_.insert(image_.end(), payload + headerLength, payload + length);
+    bool endOfFrame = (info & 0x02) != 0 || image_.size() >= stillCtrl_.dwMaxVideoFrameSize;
+    if (endOfFrame) {
+      finish(lk, !image_.empty(), std::move(image_));
+      lk.lock();
+      image_.clear();
+      idle_.notify_all();
+      return;
+    }
+  }
+  if (closing_ || !submitBulkLocked()) {
+    finish(lk, false, {});
+    lk.lock();
+    idle_.notify_all();
+  }
+}
+
+void StillCapture::finish(std::unique_lock<std::mutex>& lk, bool ok, std::vector<uint8_t> data) {
+  Callback done = std::move(pending_);
+  pending_ = nullptr;
+  lk.unlock();
+  if (done == nullptr) {
+    return;
+  }
+  if (ok) {
+    ULOGI("Still of %zu bytes", data.size());
+    done(true, width_, height_, std::move(data));
+  } else {
+    done(false, 0, 0, {});
+  }
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libusb/libusb.h>
+#include <libuvc/libuvc.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "UvcDevice.h"
+
+using namespace std::chrono;
+
+// Captures UVC still images at a size of their own while the video stream
+// keeps its format, for a full resolution snapshot of a low resolution
+// preview.
+//
+// Method 2 cameras send the still in the video stream, as a frame carrying
+// the still image bit; libuvc sizes its buffers for it and the capture
+// thread hands it to offer() instead of the preview. Method 3 cameras send
+// it on a bulk endpoint of its own, read here with async transfers on the
+// shared USB session. Either way the trigger is an async control transfer
+// and the still is delivered as the camera encoded it: JPEG for MJPEG
+// streams, the raw payload otherwise. Method 1 stills are plain video
+// frames and are not supported.
+class StillCapture final {
+ public:
+  // Runs on the capture thread, the USB event thread or the caller's for
+  // errors. data is empty when ok is false.
+  using Callback =
+      std::function<void(bool ok, int32_t width, int32_t height, std::vector<uint8_t> data)>;
+
+  // A still that has not arrived this long after capture() fails.
+  static constexpr milliseconds kTimeout = 3s;
+
+  StillCapture(std::shared_ptr<UvcDevice> device, uvc_stream_handle_t* streamHandle);
+  StillCapture(const StillCapture&) = delete;
+  StillCapture& operator=(const StillCapture&) = delete;
+  // Fails a pending capture and waits for the trigger and bulk transfer in
+  // flight.
+  ~StillCapture();
+
+  // Probes and commits a still of width x height in the stream's format.
+  // Method 2 resizes the stream's frame buffers, so the stream must be
+  // stopped; needsStoppedStream() tells before calling.
+  bool configure(uvc_stream_ctrl_t& streamCtrl, int32_t width, int32_t height);
+  static bool needsStoppedStream(uvc_device_handle_t* deviceHandle, uint8_t interfaceNumber);
+  // One capture at a time, with the stream running.
+  bool capture(Callback done);
+  // Capture thread only. Returns true when frame is a method 2 still, which
+  // then must not be previewed.
+  bool offer(const uvc_frame_t* frame);
+
+ private:
+  static constexpr uint8_t kStillImageTriggerControl = 0x05;
+  // bTrigger values of the trigger control.
+  static constexpr uint8_t kTriggerInStream = 1;
+  static constexpr uint8_t kTriggerBulk = 2;
+  static constexpr uint32_t kDefaultBulkTransferSize = 16 * 1024;
+
+  std::shared_ptr<UvcDevice> device_{};
+  uvc_stream_handle_t* streamHandle_{};
+  uvc_still_ctrl_t stillCtrl_{};
+  int method_{};
+  uint8_t endpoint_{};
+  int32_t width_{};
+  int32_t height_{};
+  libusb_transfer* transfer_{};
+  std::vector<uint8_t> transferBuffer_{};
+
+  std::mutex mutex_;
+  Callback pending_{};
+  steady_clock::time_point deadline_{};
+  // The trigger and the bulk transfer complete on the USB event thread.
+  bool triggerInFlight_{false};
+  bool bulkInFlight_{false};
+  bool closing_{false};
+  std::condition_variable idle_;
+  // Method 3 payloads gathered so far.
+  std::vector<uint8_t> image_{};
+
+  static void LIBUSB_CALL onBulkTransferComplete(libusb_transfer* transfer);
+
+  void onTriggered(uvc_error_t result);
+  // Called with mutex_ held.
+  bool submitBulkLocked();
+  void onBulkPayload(const uint8_t* payload, int length);
+  // Takes the pending callback and runs it without mutex_.
+  void finish(std::unique_lock<std::mutex>& lk, bool ok, std::vector<uint8_t> data);
+};
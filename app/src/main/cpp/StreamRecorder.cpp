@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamRecorder.h"
+
+#include <android/log.h>
+#include <media/NdkMediaFormat.h>
+
+#include <sys/prctl.h>
+#include <algorithm>
+#include <cstring>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "StreamRecorder", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "StreamRecorder", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "StreamRecorder", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "StreamRecorder", __VA_ARGS__)
+
+// MediaCodecInfo.CodecCapabilities.COLOR_FormatSurface
+static constexpr int32_t kColorFormatSurface = 0x7F000789;
+// MediaCodecInfo.CodecProfileLevel.AACObjectLC
+static constexpr int32_t kAacProfileLc = 2;
+// MediaCodec.PARAMETER_KEY_REQUEST_SYNC_FRAME
+static constexpr const char* kRequestSyncFrame = "request-sync";
+
+StreamRecorder::~StreamRecorder() {
+  stop();
+  release();
+}
+
+bool StreamRecorder::start(int fd, const VideoConfig& video, const AudioConfig& audio) {
+  if (fd >= 0) {
+    muxer_ = AMediaMuxer_new(fd, AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+    if (muxer_ == nullptr) {
+      ULOGE("AMediaMuxer_new failed for fd %d", fd);
+      return false;
+    }
+  }
+  hevc_ = video.hevc;
+  if (!startVideoEncoder(video)) {
+    release();
+    return false;
+  }
+  if (muxer_ != nullptr && audio.sampleRate > 0 && !startAudioEncoder(audio)) {
+    ULOGW("Recording without audio");
+  }
+  drainThread_ = std::thread(&StreamRecorder::drainLoop, this);
+  ULOGI(
+      "Recording %s%s %dx%d@%d %d bps, audio %d Hz x %d",
+      muxer_ != nullptr ? "" : "for the network only, ",
+      video.hevc ? "HEVC" : "H.264",
+      video.width,
+      video.height,
+      video.fps,
+      video.bitRate,
+      audio_.codec != nullptr ? audio.sampleRate : 0,
+      audio_.codec != nullptr ? audio.channelCount : 0);
+  return true;
+}
+
+bool StreamRecorder::startVideoEncoder(const VideoConfig& video) {
+  const char* mimeType = video.hevc ? "video/hevc" : "video/avc";
+  video_.codec = AMediaCodec_createEncoderByType(mimeType);
+  if (video_.codec == nullptr) {
+    ULOGE("No %s encoder", mimeType);
+    return false;
+  }
+  AMediaFormat* format = AMediaFormat_new();
+  AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, mimeType);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, video.width);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, video.height);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, kColorFormatSurface);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, video.bitRate);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_FRAME_RATE, video.fps);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_I_FRAME_INTERVAL, 1);
+  media_status_t status = AMediaCodec_configure(
+      video_.codec, format, nullptr, nullptr, AMEDIACODEC_CONFIGURE_FLAG_ENCODE);
+  AMediaFormat_delete(format);
+  if (status != AMEDIA_OK) {
+    ULOGE("Video encoder configure %dx%d error %d", video.width, video.height, status);
+    return false;
+  }
+  status = AMediaCodec_createInputSurface(video_.codec, &inputWindow_);
+  if (status != AMEDIA_OK) {
+    ULOGE("AMediaCodec_createInputSurface error %d", status);
+    return false;
+  }
+  status = AMediaCodec_start(video_.codec);
+  if (status != AMEDIA_OK) {
+    ULOGE("Video encoder start error %d", status);
+    return false;
+  }
+  return true;
+}
+
+bool StreamRecorder::startAudioEncoder(const AudioConfig& audio) {
+  AMediaCodec* codec = AMediaCodec_createEncoderByType("audio/mp4a-latm");
+  if (codec == nullptr) {
+    ULOGE("No AAC encoder");
+    return false;
+  }
+  sampleRate_ = audio.sampleRate;
+  bytesPerAudioFrame_ = audio.channelCount * sizeof(int16_t);
+  AMediaFormat* format = AMediaFormat_new();
+  AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, "audio/mp4a-latm");
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_SAMPLE_RATE, audio.sampleRate);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_CHANNEL_COUNT, audio.channelCount);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, kAudioBitRate);
+  AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_AAC_PROFILE, kAacProfileLc);
+  AMediaFormat_setInt32(
+      format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, kAudioFramesPerInput * bytesPerAudioFrame_);
+  media_status_t status =
+      AMediaCodec_configure(codec, format, nullptr, nullptr, AMEDIACODEC_CONFIGURE_FLAG_ENCODE);
+  AMediaFormat_delete(format);
+  if (status == AMEDIA_OK) {
+    status = AMediaCodec_start(codec);
+  }
+  if (status != AMEDIA_OK) {
+    ULOGE("Audio encoder %d Hz x %d error %d", audio.sampleRate, audio.channelCount, status);
+    AMediaCodec_delete(codec);
+    return false;
+  }
+  audio_.codec = codec;
+  return true;
+}
+
+void StreamRecorder::writeAudio(const uint8_t* pcm, size_t bytes) {
+  if (audio_.codec == nullptr || audioAbandoned_ || stopping_) {
+    return;
+  }
+  if (audioStartUs_ < 0) {
+    audioStartUs_ = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+  }
+  while (bytes > 0) {
+    if (audioInputIndex_ < 0) {
+      audioInputIndex_ = AMediaCodec_dequeueInputBuffer(audio_.codec, 0);
+      if (audioInputIndex_ < 0) {
+        // The encoder is behind: skip this audio but keep the timeline.
+        audioFrames_ += bytes / bytesPerAudioFrame_;
+        return;
+      }
+      size_t capacity = 0;
+      audioInput_ = AMediaCodec_getInputBuffer(audio_.codec, audioInputIndex_, &capacity);
+      audioInputLimit_ = std::min(capacity, kAudioFramesPerInput * bytesPerAudioFrame_);
+      audioInputLimit_ -= audioInputLimit_ % bytesPerAudioFrame_;
+      audioInputSize_ = 0;
+      audioInputPtsUs_ = audioStartUs_ + audioFrames_ * 1'000'000 / sampleRate_;
+    }
+    size_t count = std::min(bytes, audioInputLimit_ - audioInputSize_);
+    memcpy(audioInput_ + audioInputSize_, pcm, count);
+    audioInputSize_ += count;
+    audioFrames_ += count / bytesPerAudioFrame_;
+    pcm += count;
+    bytes -= count;
+    if (audioInputSize_ == audioInputLimit_) {
+      queueAudioInput(0);
+    }
+  }
+}
+
+void StreamRecorder::queueAudioInput(uint32_t flags) {
+  AMediaCodec_queueInputBuffer(
+      audio_.codec, audioInputIndex_, 0, audioInputSize_, audioInputPtsUs_, flags);
+  audioInputIndex_ = -1;
+  audioInput_ = nullptr;
+}
+
+bool StreamRecorder::stop() {
+  if (!drainThread_.joinable()) {
+    return false;
+  }
+  AMediaCodec_signalEndOfInputStream(video_.codec);
+  if (audio_.codec != nullptr && !audioAbandoned_) {
+    if (audioInputIndex_ < 0) {
+      audioInputIndex_ = AMediaCodec_dequeueInputBuffer(audio_.codec, kDrainTimeoutUs);
+      audioInputSize_ = 0;
+    }
+    if (audioInputIndex_ >= 0) {
+      queueAudioInput(AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+    } else {
+      // No end of stream can reach the muxer, stop waiting for it.
+      audioAbandoned_ = true;
+    }
+  }
+  stopping_ = true;
+  drainThread_.join();
+  bool finalized = muxerStarted_ && AMediaMuxer_stop(muxer_) == AMEDIA_OK;
+  if (muxer_ != nullptr) {
+    ULOGI("Recording stopped, %s", finalized ? "file finalized" : "nothing written");
+  } else {
+    ULOGI("Encoding for the network stopped");
+  }
+  release();
+  return finalized;
+}
+
+void StreamRecorder::drainLoop() {
+  prctl(PR_SET_NAME, "usb_video_record");
+  steady_clock::time_point deadline = steady_clock::time_point::max();
+  while (!video_.ended || (audio_.codec != nullptr && !audio_.ended && !audioAbandoned_)) {
+    if (stopping_ && deadline == steady_clock::time_point::max()) {
+      deadline = steady_clock::now() + kStopTimeout;
+    }
+    if (steady_clock::now() > deadline) {
+      ULOGW("Encoders did not reach end of stream in time");
+      break;
+    }
+    requestKeyframeIfAsked();
+    if (isDrainable(video_)) {
+      drain(video_, kDrainTimeoutUs);
+    } else {
+      std::this_thread::sleep_for(microseconds(kDrainTimeoutUs));
+    }
+    if (isDrainable(audio_)) {
+      drain(audio_, 0);
+    }
+    startMuxerWhenReady();
+  }
+}
+
+bool StreamRecorder::isDrainable(const Track& track) const {
+  // Once a track has its format, its samples wait in the codec for the muxer.
+  if (&track == &audio_ && audioAbandoned_) {
+    return false;
+  }
+  return track.codec != nullptr && !track.ended && (muxerStarted_ || track.muxerTrack < 0);
+}
+
+void StreamRecorder::drain(Track& track, int64_t timeoutUs) {
+  AMediaCodecBufferInfo info;
+  while (true) {
+    ssize_t index = AMediaCodec_dequeueOutputBuffer(track.codec, &info, timeoutUs);
+    timeoutUs = 0;
+    if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+      AMediaFormat* format = AMediaCodec_getOutputFormat(track.codec);
+      ULOGI("Encoder output format %s", AMediaFormat_toString(format));
+      if (muxer_ != nullptr) {
+        track.muxerTrack = AMediaMuxer_addTrack(muxer_, format);
+      }
+      AMediaFormat_delete(format);
+      if (&track == &video_) {
+        videoFormatTime_ = steady_clock::now();
+      }
+      return;
+    }
+    if (index == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
+      continue;
+    }
+    if (index < 0) {
+      return;
+    }
+    TRACE_SCOPE("writeSample");
+    size_t capacity;
+    uint8_t* data = AMediaCodec_getOutputBuffer(track.codec, index, &capacity);
+    // Codec config is already part of the track format.
+    if (info.size > 0 && (info.flags & AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG) == 0 &&
+        muxerStarted_) {
+      AMediaMuxer_writeSampleData(muxer_, track.muxerTrack, data, &info);
+    }
+    if (&track == &video_ && info.size > 0 && data != nullptr) {
+      sendToNetwork(data, info);
+      addToInstantReplay(data, info);
+    }
+    if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
+      track.ended = true;
+    }
+    AMediaCodec_releaseOutputBuffer(track.codec, index, false);
+    if (track.ended) {
+      return;
+    }
+  }
+}
+
+void StreamRecorder::setNetworkSink(std::shared_ptr<RtpSender> sink) {
+  std::lock_guard lk(networkSinkMutex_);
+  networkSink_ = std::move(sink);
+  if (networkSink_ != nullptr) {
+    // A receiver joining mid-stream needs a keyframe to start from.
+    networkSink_->requestKeyframe();
+  }
+}
+
+void StreamRecorder::sendToNetwork(const uint8_t* data, const AMediaCodecBufferInfo& info) {
+  std::lock_guard lk(networkSinkMutex_);
+  if (networkSink_ == nullptr) {
+    return;
+  }
+  if (info.flags & AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG) {
+    networkSink_->setParameterSets(data + info.offset, info.size);
+  } else {
+    // Presentation times are the frames' capture times, see GlPreviewRenderer.
+    networkSink_->sendAccessUnit(data + info.offset, info.size, info.presentationTimeUs * 1000);
+  }
+}
+
+void StreamRecorder::setInstantReplay(std::shared_ptr<InstantReplay> replay) {
+  std::lock_guard lk(instantReplayMutex_);
+  instantReplay_ = std::move(replay);
+  if (instantReplay_ != nullptr && !videoCodecConfig_.empty()) {
+    instantReplay_->setCodecConfig(videoCodecConfig_.data(), videoCodecConfig_.size());
+  }
+}
+
+void StreamRecorder::addToInstantReplay(const uint8_t* data, const AMediaCodecBufferInfo& info) {
+  std::lock_guard lk(instantReplayMutex_);
+  if (info.flags & AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG) {
+    videoCodecConfig_.assign(data + info.offset, data + info.offset + info.size);
+    if (instantReplay_ != nullptr) {
+      instantReplay_->setCodecConfig(data + info.offset, info.size);
+    }
+  } else if (instantReplay_ != nullptr) {
+    instantReplay_->add(
+        data + info.offset, info.size, info.presentationTimeUs * 1000, 0, replaySequence_++);
+  }
+}
+
+void StreamRecorder::requestKeyframeIfAsked() {
+  {
+    std::lock_guard lk(networkSinkMutex_);
+    if (networkSink_ == nullptr || !networkSink_->takeKeyframeRequest()) {
+      return;
+    }
+  }
+  AMediaFormat* params = AMediaFormat_new();
+  AMediaFormat_setInt32(params, kRequestSyncFrame, 0);
+  media_status_t status = AMediaCodec_setParameters(video_.codec, params);
+  AMediaFormat_delete(params);
+  if (status != AMEDIA_OK) {
+    ULOGW("Keyframe request error %d", status);
+  }
+}
+
+void StreamRecorder::startMuxerWhenReady() {
+  if (muxerStarted_ || video_.muxerTrack < 0) {
+    return;
+  }
+  if (audio_.codec != nullptr && audio_.muxerTrack < 0 && !audioAbandoned_) {
+    if (steady_clock::now() - videoFormatTime_ < kAudioFormatTimeout) {
+      return;
+    }
+    ULOGW(
+        "No audio format after %lld ms, recording video only",
+        (long long)kAudioFormatTimeout.count());
+    audioAbandoned_ = true;
+  }
+  media_status_t status = AMediaMuxer_start(muxer_);
+  if (status != AMEDIA_OK) {
+    ULOGE("AMediaMuxer_start error %d", status);
+    video_.ended = true;
+    audio_.ended = true;
+    return;
+  }
+  muxerStarted_ = true;
+}
+
+void StreamRecorder::release() {
+  if (drainThread_.joinable()) {
+    stopping_ = true;
+    drainThread_.join();
+  }
+  for (Track* track : {&video_, &audio_}) {
+    if (track->codec != nullptr) {
+      AMediaCodec_stop(track->codec);
+      AMediaCodec_delete(track->codec);
+    }
+    *track = Track{};
+  }
+  if (inputWindow_ != nullptr) {
+    ANativeWindow_release(inputWindow_);
+    inputWindow_ = nullptr;
+  }
+  if (muxer_ != nullptr) {
+    AMediaMuxer_delete(muxer_);
+    muxer_ = nullptr;
+  }
+  muxerStarted_ = false;
+}
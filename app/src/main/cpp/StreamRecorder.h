@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/native_window.h>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaMuxer.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "InstantReplay.h"
+#include "RtpSender.h"
+
+using namespace std::chrono;
+
+// Encodes the live stream to an MP4 file with AMediaCodec and AMediaMuxer.
+//
+// Video is drawn by the preview renderer into the encoder's input window, so
+// the recording reuses the frame already uploaded for preview instead of
+// converting it again. Audio is 16 bit PCM handed over by the audio streamer
+// and encoded to AAC, written straight into the codec's input buffers.
+//
+// A drain thread moves encoded samples into the muxer. The muxer starts once
+// every track has its format; if audio produces none shortly after video,
+// the file is written without audio.
+//
+// The encoded video can also be sent over the network, see setNetworkSink(),
+// and kept for an instant replay, see setInstantReplay(); without a file the
+// recorder only encodes for those.
+//
+// writeAudio() is called from the audio thread and must not race with stop():
+// detach the recorder from both streamers first.
+class StreamRecorder final {
+ public:
+  struct VideoConfig {
+    int32_t width{};
+    int32_t height{};
+    int32_t fps{};
+    int32_t bitRate{};
+    bool hevc{false};
+  };
+  // A zero sample rate records video only.
+  struct AudioConfig {
+    int32_t sampleRate{};
+    int32_t channelCount{};
+  };
+
+  StreamRecorder() = default;
+  StreamRecorder(const StreamRecorder&) = delete;
+  StreamRecorder& operator=(const StreamRecorder&) = delete;
+  ~StreamRecorder();
+
+  // fd must be open for reading and writing; the caller keeps ownership. A
+  // negative fd writes no file and records no audio.
+  bool start(int fd, const VideoConfig& video, const AudioConfig& audio);
+  // Returns true when a playable file was finalized.
+  bool stop();
+
+  // Window the preview renderer draws recorded frames into.
+  ANativeWindow* inputWindow() const {
+    return inputWindow_;
+  }
+
+  void writeAudio(const uint8_t* pcm, size_t bytes);
+
+  // Hands every encoded video frame to sink, from the drain thread, and asks
+  // the encoder for a keyframe when the sink wants one. Null detaches it.
+  void setNetworkSink(std::shared_ptr<RtpSender> sink);
+  // Keeps every encoded video frame in replay, from the drain thread. Null
+  // detaches it.
+  void setInstantReplay(std::shared_ptr<InstantReplay> replay);
+
+  bool hevc() const {
+    return hevc_;
+  }
+
+ private:
+  struct Track {
+    AMediaCodec* codec{};
+    ssize_t muxerTrack{-1};
+    bool ended{false};
+  };
+
+  static constexpr int64_t kDrainTimeoutUs = 10'000;
+  static constexpr int32_t kAudioBitRate = 128'000;
+  // AAC encodes 1024 frames at a time; queue input in matching chunks.
+  static constexpr size_t kAudioFramesPerInput = 1024;
+  // How long video waits for the audio format before recording without audio.
+  // Video output is held back meanwhile, so this also bounds how long the
+  // encoder can stall the preview.
+  static constexpr milliseconds kAudioFormatTimeout{500};
+  static constexpr seconds kStopTimeout{2};
+
+  AMediaMuxer* muxer_{};
+  ANativeWindow* inputWindow_{};
+  Track video_{};
+  Track audio_{};
+  std::thread drainThread_{};
+  std::atomic<bool> stopping_{false};
+  bool muxerStarted_{false};
+  steady_clock::time_point videoFormatTime_{};
+  std::atomic<bool> audioAbandoned_{false};
+  bool hevc_{false};
+  // Held by the drain thread while it sends a frame to networkSink_.
+  std::mutex networkSinkMutex_;
+  std::shared_ptr<RtpSender> networkSink_{};
+  // Held by the drain thread while it hands a frame to instantReplay_.
+  std::mutex instantReplayMutex_;
+  std::shared_ptr<InstantReplay> instantReplay_{};
+  // The encoder sends it once, for a replay attached later.
+  std::vector<uint8_t> videoCodecConfig_{};
+  uint32_t replaySequence_{};
+
+  // Audio input being filled, audio thread only.
+  int32_t sampleRate_{};
+  size_t bytesPerAudioFrame_{};
+  ssize_t audioInputIndex_{-1};
+  uint8_t* audioInput_{};
+  size_t audioInputLimit_{};
+  size_t audioInputSize_{};
+  uint64_t audioInputPtsUs_{};
+  int64_t audioStartUs_{-1};
+  uint64_t audioFrames_{};
+
+  bool startVideoEncoder(const VideoConfig& video);
+  bool startAudioEncoder(const AudioConfig& audio);
+  void queueAudioInput(uint32_t flags);
+  void sendToNetwork(const uint8_t* data, const AMediaCodecBufferInfo& info);
+  void addToInstantReplay(const uint8_t* data, const AMediaCodecBufferInfo& info);
+  void requestKeyframeIfAsked();
+  void drainLoop();
+  void drain(Track& track, int64_t timeoutUs);
+  bool isDrainable(const Track& track) const;
+  void startMuxerWhenReady();
+  void release();
+};
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "StreamWatchdog.h"
+
+#include <sys/prctl.h>
+#include <algorithm>
+
+using namespace std::chrono;
+
+StreamWatchdog& StreamWatchdog::shared() {
+  static StreamWatchdog watchdog;
+  return watchdog;
+}
+
+StreamWatchdog::StreamWatchdog() : thread_(&StreamWatchdog::watchLoop, this) {}
+
+StreamWatchdog::~StreamWatchdog() {
+  {
+    std::lock_guard lk(mutex_);
+    stopping_ = true;
+  }
+  change_.notify_all();
+  thread_.join();
+}
+
+void StreamWatchdog::watch(const void* owner, Check check) {
+  std::lock_guard lk(mutex_);
+  entries_.push_back({owner, std::move(check)});
+}
+
+void StreamWatchdog::unwatch(const void* owner) {
+  std::unique_lock lk(mutex_);
+  std::erase_if(entries_, [owner](const Entry& entry) { return entry.owner == owner; });
+  if (std::this_thread::get_id() == thread_.get_id()) {
+    return;
+  }
+  change_.wait(lk, [this, owner] { return checking_ != owner; });
+  // The check may have restarted its stream, and watched it again.
+  std::erase_if(entries_, [owner](const Entry& entry) { return entry.owner == owner; });
+}
+
+void StreamWatchdog::watchLoop() {
+  prctl(PR_SET_NAME, "usb_watchdog");
+  std::unique_lock lk(mutex_);
+  while (!stopping_) {
+    change_.wait_for(lk, kInterval, [this] { return stopping_; });
+    if (stopping_) {
+      break;
+    }
+    std::vector<const void*> owners;
+    owners.reserve(entries_.size());
+    for (const Entry& entry : entries_) {
+      owners.push_back(entry.owner);
+    }
+    steady_clock::time_point now = steady_clock::now();
+    for (const void* owner : owners) {
+      // Checks unwatched by an earlier one of this round are skipped.
+      auto it = std::find_if(entries_.begin(), entries_.end(), [owner](const Entry& entry) {
+        return entry.owner == owner;
+      });
+      if (it == entries_.end()) {
+        continue;
+      }
+      Check check = it->check;
+      checking_ = owner;
+      lk.unlock();
+      check(now);
+      check = nullptr;
+      lk.lock();
+      checking_ = nullptr;
+      change_.notify_all();
+    }
+  }
+}
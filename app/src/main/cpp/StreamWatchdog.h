@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the stall checks of the running streams every kInterval on a
+// background thread, so a stream whose transfers stopped completing is
+// noticed even though none of its callbacks run any more.
+//
+// A check may stop and start its own stream. unwatch() returns once the
+// owner's checks are removed and none of them is running, except on the
+// watchdog thread itself, where it only removes them.
+class StreamWatchdog final {
+ public:
+  using Check = std::function<void(std::chrono::steady_clock::time_point now)>;
+
+  static constexpr std::chrono::milliseconds kInterval{100};
+
+  static StreamWatchdog& shared();
+
+  StreamWatchdog(const StreamWatchdog&) = delete;
+  StreamWatchdog& operator=(const StreamWatchdog&) = delete;
+  ~StreamWatchdog();
+
+  void watch(const void* owner, Check check);
+  void unwatch(const void* owner);
+
+ private:
+  struct Entry {
+    const void* owner;
+    Check check;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable change_;
+  std::vector<Entry> entries_{};
+  const void* checking_{nullptr};
+  bool stopping_{false};
+  std::thread thread_{};
+
+  StreamWatchdog();
+  void watchLoop();
+};
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "StreamerController.h"
+
+#include <android/log.h>
+#include <sys/prctl.h>
+#include <algorithm>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "StreamerController", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "StreamerController", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "StreamerController", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "StreamerController", __VA_ARGS__)
+
+StreamerController& StreamerController::shared() {
+  static StreamerController controller;
+  return controller;
+}
+
+StreamerController::StreamerController()
+    : audioThread_(&StreamerController::workLoop, this, "usb_ctl_audio"),
+      videoThread_(&StreamerController::workLoop, this, "usb_ctl_video") {}
+
+StreamerController::~StreamerController() {
+  std::vector<Entry> dropped;
+  {
+    std::lock_guard lk(mutex_);
+    stopping_ = true;
+    dropped.swap(queue_);
+  }
+  change_.notify_all();
+  audioThread_.join();
+  videoThread_.join();
+  for (Entry& entry : dropped) {
+    for (Callback& done : entry.done) {
+      done(kCancelled);
+    }
+  }
+}
+
+uint64_t StreamerController::post(Command command, Callback done) {
+  std::unique_lock lk(mutex_);
+  if (stopping_) {
+    lk.unlock();
+    ULOGW("Command posted after shutdown");
+    if (done) {
+      done(kCancelled);
+    }
+    return 0;
+  }
+  if (command.coalescingKey != kNoCoalescing) {
+    // Only the last command queued on the lanes may absorb this one, so the
+    // commands in between keep their order relative to it.
+    for (auto it = queue_.rbegin(); it != queue_.rend(); ++it) {
+      if ((it->command.lane & command.lane) == 0) {
+        continue;
+      }
+      if (it->command.coalescingKey == command.coalescingKey &&
+          it->command.lane == command.lane) {
+        ULOGD("Command %llu absorbs the next one", (unsigned long long)it->id);
+        it->command.work = std::move(command.work);
+        it->command.priority = std::max(it->command.priority, command.priority);
+        if (done) {
+          it->done.push_back(std::move(done));
+        }
+        return it->id;
+      }
+      break;
+    }
+  }
+  uint64_t id = nextId_++;
+  Entry entry{id, nextSequence_++, std::move(command), {}};
+  if (done) {
+    entry.done.push_back(std::move(done));
+  }
+  queue_.push_back(std::move(entry));
+  lk.unlock();
+  change_.notify_all();
+  return id;
+}
+
+void StreamerController::cancel(Lane lanes) {
+  std::vector<Entry> dropped;
+  {
+    std::lock_guard lk(mutex_);
+    auto kept = queue_.begin();
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+      if ((it->command.lane & lanes) != 0) {
+        dropped.push_back(std::move(*it));
+      } else {
+        *kept++ = std::move(*it);
+      }
+    }
+    queue_.erase(kept, queue_.end());
+  }
+  for (Entry& entry : dropped) {
+    for (Callback& done : entry.done) {
+      done(kCancelled);
+    }
+  }
+}
+
+size_t StreamerController::pending() const {
+  std::lock_guard lk(mutex_);
+  return queue_.size() + running_;
+}
+
+size_t StreamerController::nextRunnableLocked() const {
+  // Highest priority first, then oldest. A command waiting for a busy lane
+  // blocks what is ordered after it on that lane, so each lane keeps its order.
+  for (Priority priority : {Priority::kHigh, Priority::kNormal, Priority::kLow}) {
+    uint8_t blocked = busyLanes_;
+    for (size_t i = 0; i < queue_.size(); i++) {
+      const Command& command = queue_[i].command;
+      if (command.priority < priority) {
+        continue;
+      }
+      if (command.priority == priority && (command.lane & blocked) == 0) {
+        return i;
+      }
+      blocked |= command.lane;
+    }
+  }
+  return queue_.size();
+}
+
+void StreamerController::workLoop(const char* name) {
+  prctl(PR_SET_NAME, name);
+  std::unique_lock lk(mutex_);
+  while (!stopping_) {
+    size_t next = nextRunnableLocked();
+    if (next == queue_.size()) {
+      change_.wait(lk);
+      continue;
+    }
+    Entry entry = std::move(queue_[next]);
+    queue_.erase(queue_.begin() + next);
+    Lane lane = entry.command.lane;
+    busyLanes_ |= lane;
+    running_++;
+    lk.unlock();
+    Result result = entry.command.work ? entry.command.work() : 0;
+    for (Callback& done : entry.done) {
+      done(result);
+    }
+    entry = {};
+    lk.lock();
+    busyLanes_ &= ~lane;
+    running_--;
+    // The other lane thread may wait for a lane this one freed.
+    change_.notify_all();
+  }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the commands that start, stop and reconfigure the streamers, posted
+// from Kotlin, which gets a completion callback instead of waiting.
+//
+// Commands run on one of two lane threads, so a slow audio stop does not hold
+// up a video format switch. A command ordered on both lanes, a connect or a
+// disconnect, waits for both and runs alone. Within a lane, commands run by
+// priority, and in posting order for the same priority. A command posted
+// behind a pending one with the same coalescing key, with nothing else queued
+// between them on their lanes, replaces it: repeated restarts or format
+// switches run once, with the arguments of the last, and every caller gets
+// that one's result.
+class StreamerController final {
+ public:
+  enum Lane : uint8_t {
+    kAudioLane = 1 << 0,
+    kVideoLane = 1 << 1,
+    kBothLanes = kAudioLane | kVideoLane,
+  };
+
+  enum class Priority : uint8_t {
+    kLow,
+    kNormal,
+    kHigh,
+  };
+
+  using Result = int64_t;
+  using Work = std::function<Result()>;
+  using Callback = std::function<void(Result)>;
+
+  static constexpr uint64_t kNoCoalescing = 0;
+  // Passed to the callbacks of the commands dropped by cancel() or shutdown.
+  static constexpr Result kCancelled = std::numeric_limits<Result>::min();
+
+  struct Command {
+    Lane lane{kBothLanes};
+    Priority priority{Priority::kNormal};
+    uint64_t coalescingKey{kNoCoalescing};
+    Work work{};
+  };
+
+  static StreamerController& shared();
+
+  StreamerController(const StreamerController&) = delete;
+  StreamerController& operator=(const StreamerController&) = delete;
+  // Cancels what is still queued, then joins the threads.
+  ~StreamerController();
+
+  // Queues command and returns its id, that of the pending command it
+  // replaced when coalesced. done, when set, runs on the lane thread once the
+  // command ran, or on the caller's with kCancelled after shutdown.
+  uint64_t post(Command command, Callback done);
+  // Drops the pending commands ordered on any of lanes. The running ones
+  // complete normally.
+  void cancel(Lane lanes);
+  // Commands queued, including those running.
+  size_t pending() const;
+
+ private:
+  struct Entry {
+    uint64_t id;
+    uint64_t sequence;
+    Command command;
+    std::vector<Callback> done;
+  };
+
+  mutable std::mutex mutex_;
+  std::condition_variable change_;
+  // In posting order, running commands taken out.
+  std::vector<Entry> queue_{};
+  uint8_t busyLanes_{0};
+  size_t running_{0};
+  uint64_t nextId_{1};
+  uint64_t nextSequence_{0};
+  bool stopping_{false};
+  std::thread audioThread_{};
+  std::thread videoThread_{};
+
+  StreamerController();
+  // Index in queue_ of the command to run next, or queue_.size().
+  size_t nextRunnableLocked() const;
+  void workLoop(const char* name);
+};
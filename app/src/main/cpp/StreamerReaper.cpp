@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "StreamerReaper.h"
+
+#include <android/log.h>
+
+#include <sys/prctl.h>
+#include <chrono>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "StreamerReaper", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "StreamerReaper", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "StreamerReaper", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "StreamerReaper", __VA_ARGS__)
+
+using namespace std::chrono;
+
+StreamerReaper& StreamerReaper::shared() {
+  static StreamerReaper reaper;
+  return reaper;
+}
+
+StreamerReaper::StreamerReaper() : thread_(&StreamerReaper::reapLoop, this) {}
+
+StreamerReaper::~StreamerReaper() {
+  {
+    std::lock_guard lk(mutex_);
+    stopping_ = true;
+  }
+  change_.notify_all();
+  thread_.join();
+}
+
+void StreamerReaper::retire(std::function<void()> teardown) {
+  {
+    std::lock_guard lk(mutex_);
+    pending_.push_back(std::move(teardown));
+  }
+  change_.notify_all();
+}
+
+void StreamerReaper::drain() {
+  std::unique_lock lk(mutex_);
+  change_.wait(lk, [this] { return pending_.empty() && !busy_; });
+}
+
+void StreamerReaper::reapLoop() {
+  prctl(PR_SET_NAME, "usb_reaper");
+  std::unique_lock lk(mutex_);
+  // What is still pending at exit is torn down too.
+  while (!stopping_ || !pending_.empty()) {
+    if (pending_.empty()) {
+      change_.wait(lk);
+      continue;
+    }
+    std::function<void()> teardown = std::move(pending_.front());
+    pending_.pop_front();
+    busy_ = true;
+    lk.unlock();
+    steady_clock::time_point begin = steady_clock::now();
+    teardown();
+    // Whatever the teardown captured is released before drain() returns.
+    teardown = nullptr;
+    ULOGD(
+        "Teardown took %.1f ms",
+        duration<double, std::milli>(steady_clock::now() - begin).count());
+    lk.lock();
+    busy_ = false;
+    change_.notify_all();
+  }
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Tears down disconnected streamers on a background thread, so waiting for
+// cancelled transfers, joining their threads and closing AAudio streams and
+// device handles never blocks the caller.
+//
+// Teardowns run in the order they were retired. A streamer about to be opened
+// on a device calls drain() first, since a streamer still being torn down may
+// hold the device's interfaces.
+class StreamerReaper final {
+ public:
+  static StreamerReaper& shared();
+
+  StreamerReaper(const StreamerReaper&) = delete;
+  StreamerReaper& operator=(const StreamerReaper&) = delete;
+  ~StreamerReaper();
+
+  void retire(std::function<void()> teardown);
+  // Returns once every teardown retired so far has run.
+  void drain();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable change_;
+  std::deque<std::function<void()>> pending_{};
+  bool busy_{false};
+  bool stopping_{false};
+  std::thread thread_{};
+
+  StreamerReaper();
+  void reapLoop();
+};
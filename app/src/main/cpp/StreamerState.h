@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// Lifecycle of the audio and video streamers.
+//
+// stop() is split in two: requestStop() cancels the transfers and returns,
+// moving to STOPPING; the streamer settles into READY_TO_START once its last
+// transfer completes and whatever else it waits on is done. start() finishes
+// a pending stop first, so a restart never races the cancellation.
+enum class StreamerState : int {
+  INITIAL,
+  READY_TO_START,
+  STARTING,
+  STARTED,
+  STOPPING,
+  STOPPED,
+  DESTROYING,
+  DESTROYED,
+  ERROR,
+};
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StreamingStats.h"
+
+#include <libuvc/libuvc.h>
+#include <malloc.h>
+
+#include <cstddef>
+
+#include "BufferAllocator.h"
+#include "CpuFeatures.h"
+#include "LibraryLoad.h"
+#include "ThreadPolicy.h"
+
+// Offsets StreamingStats.kt reads directly.
+static_assert(offsetof(StreamingStats::Header, version) == 0);
+static_assert(offsetof(StreamingStats::Header, videoCaptureOffset) == 8);
+static_assert(offsetof(StreamingStats::Header, histogramBucketCount) == 36);
+static_assert(offsetof(StreamingStats::Header, avSyncOffset) == 40);
+static_assert(offsetof(VideoRenderCounters, latencyPercentilesUs) == 16);
+static_assert(offsetof(AudioCounters, latencyPercentilesUs) == 48);
+static_assert(offsetof(AudioCounters, overruns) == 72);
+static_assert(offsetof(StreamingStats::Header, memoryOffset) == 48);
+static_assert(sizeof(ThreadUsageCounters) == 48);
+static_assert(offsetof(StreamingStats::Header, transportOffset) == 52);
+static_assert(sizeof(UsbTransportCounters) == 112);
+static_assert(offsetof(StreamingStats::Header, watchdogOffset) == 56);
+static_assert(sizeof(WatchdogCounters) == 48);
+static_assert(kStatsThreadRoles == kThreadRoles);
+
+StreamingStats::StreamingStats() {
+  auto offset = [this](const void* field) {
+    return (uint32_t)(static_cast<const char*>(field) - reinterpret_cast<const char*>(this));
+  };
+  header.size = sizeof(StreamingStats);
+  header.videoCaptureOffset = offset(&videoCapture);
+  header.videoDropsOffset = offset(&videoDrops);
+  header.videoRenderOffset = offset(&videoRender);
+  header.audioOffset = offset(&audio);
+  header.videoLatencyOffset = offset(&videoLatency);
+  header.audioLatencyOffset = offset(&audioLatency);
+  header.histogramStride = sizeof(LatencyHistogram);
+  header.avSyncOffset = offset(&avSync);
+  header.threadsOffset = offset(&threads);
+  header.memoryOffset = offset(&memory);
+  header.transportOffset = offset(&transport);
+  header.watchdogOffset = offset(&watchdog);
+}
+
+void StreamingStats::publishProcessUsage() {
+  for (size_t i = 0; i < kThreadRoles; i++) {
+    ThreadUsage usage = ThreadPolicies::usage((ThreadRole)i);
+    ThreadUsageCounters& counters = threads.roles[i];
+    counters.cpuTimeUs.set(usage.cpuTimeNs / 1000);
+    counters.runDelayUs.set(usage.runDelayNs / 1000);
+    counters.wakeups.set(usage.wakeups);
+    counters.voluntarySwitches.set(usage.voluntarySwitches);
+    counters.involuntarySwitches.set(usage.involuntarySwitches);
+    counters.threads.set(usage.threads);
+  }
+  const CpuFeatures& cpu = CpuFeatures::get();
+  threads.cpuFeatures.set(cpu.flags);
+  threads.cpuTier.set((uint64_t)cpu.tier());
+  threads.libyuvCpuFlags.set((uint32_t)cpu.libyuvFlags);
+  LibraryLoad load = LibraryLoad::get();
+  threads.libraryLoadUs.set(load.loadUs);
+  threads.jniOnLoadUs.set(load.onLoadUs);
+  threads.libraryMappedBytes.set(load.mappedBytes);
+  memory.frameBufferStashBytes.set(uvc_frame_buffer_stash_bytes());
+  memory.alignedBufferBytes.set(BufferAllocator::liveBytes());
+  memory.nativeHeapBytes.set(mallinfo().uordblks);
+}
+
+StreamingStats& StreamingStats::shared() {
+  return forSession(0);
+}
+
+StreamingStats& StreamingStats::forSession(uint32_t slot) {
+  static StreamingStats* stats = new StreamingStats[kMaxSessions];
+  return stats[slot];
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+#include "LatencyHistogram.h"
+
+static constexpr size_t kCacheLineSize = 64;
+
+// A 64 bit counter other threads can read at any time. add() is for counters
+// with a single writer and avoids an atomic read-modify-write; addShared() is
+// for the few written from more than one thread.
+struct StatCounter {
+  std::atomic<uint64_t> value{0};
+
+  void add(uint64_t delta = 1) {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
+  void addShared(uint64_t delta = 1) {
+    value.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  void set(uint64_t newValue) {
+    value.store(newValue, std::memory_order_relaxed);
+  }
+
+  uint64_t load() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+// Sizes of FrameDropCause, LatencyStage and ThreadRole, and percentiles
+// published per stage.
+static constexpr size_t kVideoDropCauses = 3;
+static constexpr size_t kVideoLatencyStages = 7;
+static constexpr size_t kPublishedPercentiles = 3; // p50, p95, p99
+static constexpr size_t kStatsThreadRoles = 4;
+// Output channels AudioGainStage's meters are published for.
+static constexpr size_t kMeteredAudioChannels = 8;
+
+// Written by the capture thread.
+struct alignas(kCacheLineSize) VideoCaptureCounters {
+  StatCounter frames;
+  StatCounter bytes;
+  // Isochronous bandwidth in bytes per second: reserved by the selected
+  // altsetting and needed by the negotiated format. Zero for bulk streams.
+  StatCounter isoReservedBytesPerSecond;
+  StatCounter isoNeededBytesPerSecond;
+  StatCounter isoPacketErrors;
+};
+
+// Written by the capture and render threads, rarely: indexed by FrameDropCause.
+struct alignas(kCacheLineSize) VideoDropCounters {
+  std::array<StatCounter, kVideoDropCauses> drops;
+};
+
+// Written by the render thread. Percentiles are republished once a second,
+// in microseconds.
+struct alignas(kCacheLineSize) VideoRenderCounters {
+  StatCounter frames;
+  StatCounter fps;
+  std::array<StatCounter, kVideoLatencyStages * kPublishedPercentiles> latencyPercentilesUs;
+  // MJPEG frames passed over for a newer one without being decoded, also
+  // counted as drops.
+  StatCounter decodesSkipped;
+  // Frames FrameChangeDetector found unchanged, neither converted nor posted.
+  StatCounter framesUnchanged;
+  // Frames that failed to convert, with the last good frame left or put back
+  // on screen instead.
+  StatCounter framesConcealed;
+  // fps is over the last second; this one is exponentially weighted, in
+  // thousandths of a frame per second.
+  StatCounter fpsSmoothedMilli;
+  // Since the streamer was created, to its first frame shown and to the first
+  // one in the requested mode; they differ when a fast start showed a cheaper
+  // mode first.
+  StatCounter firstFrameUs;
+  StatCounter fullQualityUs;
+  // Stripe and decode jobs run on the TaskScheduler for this stream, those
+  // that finished after the next frame was due, and frames skipped when the
+  // scheduler was oversubscribed. Shed frames are also counted as drops.
+  StatCounter deadlineJobs;
+  StatCounter deadlineMisses;
+  StatCounter framesShed;
+  // Frames of which only the rows that changed were converted and posted.
+  StatCounter framesPartial;
+  // Smooth playback, republished once a second: the jitter buffer's target
+  // depth in frames and its delay past the source time, the 95th percentile
+  // of how far presentation intervals strayed from the source's, the mean
+  // time frames were held, and frames presented after they were due.
+  StatCounter jitterBufferDepth;
+  StatCounter jitterBufferDelayUs;
+  StatCounter presentJitterUs;
+  StatCounter addedLatencyUs;
+  StatCounter jitterBufferLateFrames;
+  // ConversionBalancer: the backend converting, a ConversionBackend, how
+  // often it moved, and each backend's smoothed cost per frame and queue
+  // delay, as last measured while it converted.
+  StatCounter conversionBackend;
+  StatCounter conversionSwitches;
+  StatCounter cpuConversionCostUs;
+  StatCounter cpuConversionQueueDelayUs;
+  StatCounter gpuConversionCostUs;
+  StatCounter gpuConversionQueueDelayUs;
+  // FastPaths the stream runs on, as FastPath bits, and the cohort that
+  // allowed them.
+  StatCounter fastPaths;
+  StatCounter fastPathCohort;
+};
+
+// Written by the AAudio callback and the USB event thread, one writer per counter.
+struct alignas(kCacheLineSize) AudioCounters {
+  StatCounter usbTransfers;
+  StatCounter playerCallbacks;
+  StatCounter bytes;
+  StatCounter underruns; // player callbacks that ran out of audio
+  StatCounter packetErrors;
+  StatCounter samplingFrequency;
+  // Audio buffered ahead of the player, in microseconds.
+  std::array<StatCounter, kPublishedPercentiles> latencyPercentilesUs;
+  StatCounter overruns; // transfers that did not fit in the ring buffer
+  StatCounter xruns; // AAudioStream_getXRunCount
+  // Buffering picked by AudioLatencyTuner.
+  StatCounter bufferSizeFrames;
+  StatCounter inFlightTransfers;
+  StatCounter targetFillFrames;
+  StatCounter ringFillFrames; // after the latest USB transfer
+  // Estimated time from a sample reaching the device's USB endpoint to AAudio
+  // presenting it, for the latest transfer.
+  StatCounter deliveryLatencyUs;
+  // Frames AudioConcealer made up, for underruns and for errored packets.
+  StatCounter framesConcealed;
+  StatCounter packetFramesConcealed;
+  // samplingFrequency exponentially weighted, in thousandths of a Hz.
+  StatCounter samplingFrequencySmoothedMilli;
+  // AudioGainStage's meters by output channel, in millionths of full scale,
+  // after every USB transfer; zero while it is bypassed.
+  std::array<StatCounter, kMeteredAudioChannels> levelPeakMicro;
+  std::array<StatCounter, kMeteredAudioChannels> levelRmsMicro;
+  StatCounter samplesOverFullScale; // gained beyond full scale
+  // From start() to the estimated presentation of the first USB sample,
+  // once the ring had filled to its target.
+  StatCounter startToAudibleUs;
+};
+
+// Written by AvSync. Values are signed microseconds.
+struct alignas(kCacheLineSize) AvSyncCounters {
+  StatCounter skewUs; // positive when video is presented after its audio
+  StatCounter audioDelayUs;
+  StatCounter videoDelayUs;
+};
+
+// ThreadUsage of one ThreadRole.
+struct ThreadUsageCounters {
+  StatCounter cpuTimeUs;
+  StatCounter runDelayUs;
+  StatCounter wakeups;
+  StatCounter voluntarySwitches;
+  StatCounter involuntarySwitches;
+  StatCounter threads;
+};
+
+// Process wide, the same in every block. Republished once a second by the
+// video render thread and every couple of seconds from audio completions.
+struct alignas(kCacheLineSize) ThreadCounters {
+  std::array<ThreadUsageCounters, kStatsThreadRoles> roles;
+  // CpuFeatures of the device, set once.
+  StatCounter cpuFeatures;
+  StatCounter cpuTier;
+  StatCounter libyuvCpuFlags;
+  // LibraryLoad: System.loadLibrary() as the app timed it, the part of it
+  // JNI_OnLoad took, and the bytes libusbvideo.so maps.
+  StatCounter libraryLoadUs;
+  StatCounter jniOnLoadUs;
+  StatCounter libraryMappedBytes;
+};
+
+// Native memory in bytes by what holds it. The video fields are the
+// session's, republished with the thread counters, the audio one is set when
+// the audio stream starts, and the rest is process wide.
+struct alignas(kCacheLineSize) MemoryCounters {
+  StatCounter videoTransferBytes; // in flight and spare, usbfs included
+  StatCounter videoUsbfsBytes;
+  StatCounter videoFramePoolBytes;
+  StatCounter videoPollingBytes; // polling and metadata buffers
+  StatCounter renderScratchBytes;
+  StatCounter decodeWorkerBytes;
+  StatCounter audioBufferBytes; // transfers, ring buffer and resampler
+  StatCounter frameBufferStashBytes;
+  StatCounter alignedBufferBytes; // BufferAllocator's, most video buffers above included
+  StatCounter nativeHeapBytes; // malloc in use
+};
+
+// Isochronous packets, or bulk payloads, of one streaming endpoint. Bytes
+// against the reserved ones of as many packets give the share of the
+// altsetting's bandwidth in use.
+struct UsbTransportCounters {
+  StatCounter packets;
+  StatCounter packetErrors;
+  StatCounter shortPackets; // with less data than a full packet
+  StatCounter emptyPackets; // without data, or a payload header only
+  StatCounter bytes;
+  StatCounter reservedBytesPerPacket;
+  StatCounter maxPacketBytes; // of the running stream
+  StatCounter packetIntervalUs; // zero for bulk
+  // UVC only, zero for audio.
+  StatCounter headerErrors; // payloads dropped for the error bit or their header
+  StatCounter incompleteFrames; // published with a packet or payload missing
+  StatCounter framesWithoutEof;
+  StatCounter sequenceGaps; // frames missing between uvc_frame_t::sequence numbers
+  StatCounter oversizeFrames; // beyond dwMaxVideoFrameSize, in a grown buffer
+  StatCounter truncatedFrames; // out of buffer, published without their end
+};
+
+// Video written by the capture thread, audio by the USB event thread.
+struct alignas(kCacheLineSize) TransportCounters {
+  UsbTransportCounters video;
+  UsbTransportCounters audio;
+  // usbfs ioctls of the whole process, every device and endpoint, written
+  // with the video counters.
+  StatCounter urbSubmits;
+  StatCounter urbReaps;
+  StatCounter emptyReaps; // found nothing, about one per event wakeup
+};
+
+// StreamWatchdog's view of one streaming endpoint.
+struct WatchdogCounters {
+  StatCounter transfersInFlight;
+  StatCounter transfersRearmed; // failed transfers submitted again
+  StatCounter stalls; // no frame, or audio transfer, for the stall timeout
+  StatCounter restarts; // streams stopped and started for a stall
+  StatCounter failedRestarts;
+  StatCounter longestStallUs;
+};
+
+// Written by the watchdog thread, and audio re-arms by the USB event thread.
+struct alignas(kCacheLineSize) StallCounters {
+  WatchdogCounters video;
+  WatchdogCounters audio;
+};
+
+// Streaming statistics of one camera session, shared with Kotlin as a direct
+// ByteBuffer so a dashboard can poll them without JNI calls or allocation.
+//
+// Values are native endian and naturally aligned. The header holds the
+// offset of every section so readers only hard code offsets within a section;
+// bump kVersion whenever a section's layout changes. Blocks are never freed,
+// so the ByteBuffer stays valid across streamer lifetimes.
+struct StreamingStats {
+  static constexpr uint32_t kVersion = 26;
+  // Slot 0 is shared(), the others belong to additional camera sessions.
+  static constexpr uint32_t kMaxSessions = 8;
+
+  struct alignas(kCacheLineSize) Header {
+    uint32_t version{kVersion};
+    uint32_t size{};
+    uint32_t videoCaptureOffset{};
+    uint32_t videoDropsOffset{};
+    uint32_t videoRenderOffset{};
+    uint32_t audioOffset{};
+    uint32_t videoLatencyOffset{}; // kVideoLatencyStages histograms
+    uint32_t audioLatencyOffset{};
+    uint32_t histogramStride{};
+    uint32_t histogramBucketCount{LatencyHistogram::kBucketCount};
+    uint32_t avSyncOffset{};
+    uint32_t threadsOffset{};
+    uint32_t memoryOffset{};
+    uint32_t transportOffset{};
+    uint32_t watchdogOffset{};
+  } header;
+
+  VideoCaptureCounters videoCapture;
+  VideoDropCounters videoDrops;
+  VideoRenderCounters videoRender;
+  AudioCounters audio;
+  AvSyncCounters avSync;
+  ThreadCounters threads;
+  MemoryCounters memory;
+  TransportCounters transport;
+  StallCounters watchdog;
+  alignas(kCacheLineSize) std::array<LatencyHistogram, kVideoLatencyStages> videoLatency;
+  alignas(kCacheLineSize) LatencyHistogram audioLatency;
+
+  StreamingStats();
+
+  // Reads ThreadPolicies::usage() of every role into threads and the process
+  // wide memory into memory.
+  void publishProcessUsage();
+
+  static StreamingStats& shared();
+  // slot must be below kMaxSessions.
+  static StreamingStats& forSession(uint32_t slot);
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(sizeof(StatCounter) == sizeof(uint64_t));
+static_assert(std::is_standard_layout_v<LatencyHistogram>);
+static_assert(sizeof(LatencyHistogram) == 8 + 4 * LatencyHistogram::kBucketCount);
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StripeWorkerPool.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "StripeWorkerPool", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "StripeWorkerPool", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "StripeWorkerPool", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "StripeWorkerPool", __VA_ARGS__)
+
+std::shared_ptr<StripeWorkerPool> StripeWorkerPool::shared() {
+  static std::mutex mutex;
+  static std::weak_ptr<StripeWorkerPool> current;
+  std::lock_guard lk(mutex);
+  std::shared_ptr<StripeWorkerPool> pool = current.lock();
+  if (pool == nullptr) {
+    pool = std::make_shared<StripeWorkerPool>();
+    current = pool;
+  }
+  return pool;
+}
+
+StripeWorkerPool::StripeWorkerPool()
+    : scheduler_(TaskScheduler::shared()),
+      busyNs_(std::make_shared<BusyTimes>(scheduler_->workerCount() + 1)) {}
+
+void StripeWorkerPool::runStripes(Job& job, BusyTimes& busyNs) {
+  auto start = steady_clock::now();
+  uint32_t stripe;
+  while ((stripe = job.nextStripe.fetch_add(1, std::memory_order_acq_rel)) < job.stripeCount) {
+    {
+      TRACE_SCOPE("convertStripe");
+      job.fn(job.context, stripe);
+    }
+    if (job.pendingStripes.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard lk(job.mutex);
+      job.done.notify_all();
+    }
+  }
+  int32_t worker = TaskScheduler::currentWorker();
+  size_t index = worker >= 0 ? worker : busyNs.size() - 1;
+  busyNs[index] += duration_cast<nanoseconds>(steady_clock::now() - start).count();
+}
+
+void StripeWorkerPool::run(uint32_t stripeCount, StripeFn fn, void* context) {
+  if (stripeCount == 0) {
+    return;
+  }
+  auto job = std::make_shared<Job>();
+  job->fn = fn;
+  job->context = context;
+  job->stripeCount = stripeCount;
+  job->pendingStripes.store(stripeCount, std::memory_order_relaxed);
+  uint32_t helpers = std::min(stripeCount, threadCount()) - 1;
+  for (uint32_t i = 0; i < helpers; i++) {
+    // A helper that starts late finds every stripe taken and returns.
+    scheduler_->submit(TaskPriority::PREVIEW, [job, busyNs = busyNs_] {
+      runStripes(*job, *busyNs);
+    });
+  }
+  runStripes(*job, *busyNs_);
+  std::unique_lock lk(job->mutex);
+  job->done.wait(lk, [&] { return job->pendingStripes.load(std::memory_order_acquire) == 0; });
+}
+
+std::vector<nanoseconds> StripeWorkerPool::takeBusyTimes() {
+  std::vector<nanoseconds> busyTimes(busyNs_->size());
+  for (size_t i = 0; i < busyTimes.size(); i++) {
+    busyTimes[i] = nanoseconds((*busyNs_)[i].exchange(0));
+  }
+  return busyTimes;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "TaskScheduler.h"
+
+using namespace std::chrono;
+
+// Splits one job into stripes, run on the TaskScheduler's workers as
+// preview jobs.
+//
+// run() hands stripes out to the workers and to the calling thread, which
+// works on them too, and returns once every stripe is done. Concurrent run()
+// calls, from the render threads of several cameras, share the workers, so
+// the stripes of one camera are picked up by cores another leaves idle.
+class StripeWorkerPool final {
+ public:
+  using StripeFn = void (*)(void* context, uint32_t stripe);
+
+  StripeWorkerPool();
+  StripeWorkerPool(const StripeWorkerPool&) = delete;
+  StripeWorkerPool& operator=(const StripeWorkerPool&) = delete;
+
+  // The process's pool, created on first use and shut down with its last user.
+  static std::shared_ptr<StripeWorkerPool> shared();
+
+  // Number of threads run() spreads stripes over, including the caller: one
+  // per performance core.
+  uint32_t threadCount() const {
+    return scheduler_->performanceWorkers();
+  }
+
+  void run(uint32_t stripeCount, StripeFn fn, void* context);
+
+  // Time each scheduler worker spent on stripes since the last call, with the
+  // calling threads last.
+  std::vector<nanoseconds> takeBusyTimes();
+
+ private:
+  struct Job {
+    StripeFn fn{};
+    void* context{};
+    uint32_t stripeCount{};
+    std::atomic<uint32_t> nextStripe{0};
+    std::atomic<uint32_t> pendingStripes{0};
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  using BusyTimes = std::vector<std::atomic<int64_t>>;
+
+  std::shared_ptr<TaskScheduler> scheduler_;
+  // Outlives the pool in the helpers that start after their job is done.
+  std::shared_ptr<BusyTimes> busyNs_;
+
+  static void runStripes(Job& job, BusyTimes& busyNs);
+};
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SurfaceControlPresenter.h"
+
+#include <android/log.h>
+#include <android/sync.h>
+
+#include <unistd.h>
+#include <algorithm>
+
+#include "AvSync.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "SurfaceControlPresenter", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "SurfaceControlPresenter", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "SurfaceControlPresenter", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "SurfaceControlPresenter", __VA_ARGS__)
+
+// Frames arriving this much later than their PTS predicts re-anchor the
+// mapping, e.g. after a stall or a clock drifting away from the host's.
+static constexpr int64_t kMaxLatenessNs = 100'000'000;
+// Re-anchor well before the 32 bit PTS wraps.
+static constexpr uint64_t kMaxAnchorAgeSeconds = 10;
+
+static void closeFence(int& fence) {
+  if (fence >= 0) {
+    close(fence);
+    fence = -1;
+  }
+}
+
+SurfaceControlPresenter::~SurfaceControlPresenter() {
+  destroy();
+}
+
+bool SurfaceControlPresenter::init(
+    ANativeWindow* window,
+    int32_t width,
+    int32_t height,
+    int32_t format,
+    uint32_t clockFrequency) {
+  surfaceControl_ = ASurfaceControl_createFromWindow(window, "usb_video_preview");
+  if (surfaceControl_ == nullptr) {
+    ULOGE("ASurfaceControl_createFromWindow failed");
+    return false;
+  }
+  AHardwareBuffer_Desc desc{};
+  desc.width = width;
+  desc.height = height;
+  desc.layers = 1;
+  desc.format = format;
+  desc.usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_CPU_READ_NEVER |
+      AHARDWAREBUFFER_USAGE_COMPOSER_OVERLAY | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+  for (Slot& slot : slots_) {
+    slot.presenter = this;
+    if (AHardwareBuffer_allocate(&desc, &slot.buffer) != 0) {
+      ULOGE("AHardwareBuffer_allocate %dx%d format %d failed", width, height, format);
+      destroy();
+      return false;
+    }
+  }
+  source_ = {0, 0, width, height};
+  destination_ = {0, 0, ANativeWindow_getWidth(window), ANativeWindow_getHeight(window)};
+  geometrySet_ = false;
+  clockFrequency_ = clockFrequency;
+  anchored_ = false;
+  ULOGI(
+      "Presenting %dx%d format %d into %dx%d, clock %u Hz",
+      width,
+      height,
+      format,
+      destination_.right,
+      destination_.bottom,
+      clockFrequency);
+  return true;
+}
+
+void SurfaceControlPresenter::destroy() {
+  if (surfaceControl_ != nullptr) {
+    // Detach the layer, then wait for callbacks that still reference slots_.
+    ASurfaceTransaction* transaction = ASurfaceTransaction_create();
+    ASurfaceTransaction_setVisibility(
+        transaction, surfaceControl_, ASURFACE_TRANSACTION_VISIBILITY_HIDE);
+    ASurfaceTransaction_apply(transaction);
+    ASurfaceTransaction_delete(transaction);
+    std::unique_lock lk(mutex_);
+    completed_.wait_for(lk, 500ms, [this] {
+      return std::none_of(slots_.begin(), slots_.end(), [](const Slot& slot) {
+        return slot.state == SlotState::QUEUED;
+      });
+    });
+  }
+  for (Slot& slot : slots_) {
+    if (slot.buffer != nullptr) {
+      AHardwareBuffer_release(slot.buffer);
+      slot.buffer = nullptr;
+    }
+    closeFence(slot.releaseFence);
+    slot.state = SlotState::FREE;
+  }
+  for (PendingFence& pending : pendingFences_) {
+    closeFence(pending.fd);
+  }
+  pendingFences_.clear();
+  lockedSlot_ = kSlotCount;
+  onScreenSlot_ = kSlotCount;
+  if (surfaceControl_ != nullptr) {
+    ASurfaceControl_release(surfaceControl_);
+    surfaceControl_ = nullptr;
+  }
+}
+
+bool SurfaceControlPresenter::takeFreeSlot(int& releaseFence) {
+  std::lock_guard lk(mutex_);
+  for (size_t i = 0; i < kSlotCount; i++) {
+    if (slots_[i].state == SlotState::FREE) {
+      lockedSlot_ = i;
+      break;
+    }
+  }
+  if (lockedSlot_ == kSlotCount || slots_[lockedSlot_].state != SlotState::FREE) {
+    lockedSlot_ = kSlotCount;
+    return false;
+  }
+  slots_[lockedSlot_].state = SlotState::LOCKED;
+  std::swap(releaseFence, slots_[lockedSlot_].releaseFence);
+  return true;
+}
+
+bool SurfaceControlPresenter::lock(ANativeWindow_Buffer* buffer) {
+  int fence = -1;
+  if (!takeFreeSlot(fence)) {
+    return false;
+  }
+  cpuLocked_ = true;
+  Slot& slot = slots_[lockedSlot_];
+  void* bits = nullptr;
+  // The lock waits on the release fence and takes ownership of it.
+  int result = AHardwareBuffer_lock(
+      slot.buffer, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, fence, nullptr, &bits);
+  if (result != 0) {
+    ULOGE("AHardwareBuffer_lock error %d", result);
+    std::lock_guard lk(mutex_);
+    slot.state = SlotState::FREE;
+    lockedSlot_ = kSlotCount;
+    return false;
+  }
+  AHardwareBuffer_Desc desc;
+  AHardwareBuffer_describe(slot.buffer, &desc);
+  buffer->width = desc.width;
+  buffer->height = desc.height;
+  buffer->stride = desc.stride;
+  buffer->format = desc.format;
+  buffer->bits = bits;
+  return true;
+}
+
+bool SurfaceControlPresenter::acquire(AHardwareBuffer** buffer, int* releaseFence) {
+  *releaseFence = -1;
+  if (!takeFreeSlot(*releaseFence)) {
+    return false;
+  }
+  cpuLocked_ = false;
+  *buffer = slots_[lockedSlot_].buffer;
+  return true;
+}
+
+void SurfaceControlPresenter::setTransform(int32_t transform) {
+  if (transform != transform_) {
+    transform_ = transform;
+    geometrySet_ = false;
+  }
+}
+
+void SurfaceControlPresenter::setFrameRate(float fps) {
+  if (fps != frameRate_) {
+    frameRate_ = fps;
+    frameRateSet_ = false;
+  }
+}
+
+void SurfaceControlPresenter::unlock() {
+  if (lockedSlot_ == kSlotCount) {
+    return;
+  }
+  Slot& slot = slots_[lockedSlot_];
+  lockedSlot_ = kSlotCount;
+  int fence = -1;
+  int result = cpuLocked_ ? AHardwareBuffer_unlock(slot.buffer, &fence) : 0;
+  if (result != 0) {
+    ULOGE("AHardwareBuffer_unlock error %d", result);
+  }
+  std::lock_guard lk(mutex_);
+  // The next writer waits for the CPU writes, same as for a release. An
+  // acquired buffer's writer handed no fence back, so nothing is pending.
+  slot.releaseFence = fence;
+  slot.state = SlotState::FREE;
+}
+
+bool SurfaceControlPresenter::present(
+    const uvc_frame_t* frame,
+    int64_t sourceNs,
+    int acquireFence) {
+  if (lockedSlot_ == kSlotCount) {
+    closeFence(acquireFence);
+    return false;
+  }
+  Slot& slot = slots_[lockedSlot_];
+  lockedSlot_ = kSlotCount;
+  if (cpuLocked_) {
+    closeFence(acquireFence);
+    int result = AHardwareBuffer_unlock(slot.buffer, &acquireFence);
+    if (result != 0) {
+      ULOGE("AHardwareBuffer_unlock error %d", result);
+    }
+  }
+  int64_t captureNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+      frame->capture_time_finished.tv_nsec;
+  {
+    std::lock_guard lk(mutex_);
+    slot.captureNs = captureNs;
+    slot.sourceNs = captureNs;
+    slot.state = SlotState::QUEUED;
+  }
+
+  ASurfaceTransaction* transaction = ASurfaceTransaction_create();
+  ASurfaceTransaction_setBuffer(transaction, surfaceControl_, slot.buffer, acquireFence);
+  if (!geometrySet_) {
+    ASurfaceTransaction_setGeometry(
+        transaction, surfaceControl_, source_, destination_, transform_);
+    ASurfaceTransaction_setBufferTransparency(
+        transaction, surfaceControl_, ASURFACE_TRANSACTION_TRANSPARENCY_OPAQUE);
+    ASurfaceTransaction_setVisibility(
+        transaction, surfaceControl_, ASURFACE_TRANSACTION_VISIBILITY_SHOW);
+    geometrySet_ = true;
+  }
+  if (!frameRateSet_) {
+    ASurfaceTransaction_setFrameRate(
+        transaction,
+        surfaceControl_,
+        frameRate_,
+        ANATIVEWINDOW_FRAME_RATE_COMPATIBILITY_FIXED_SOURCE);
+    frameRateSet_ = true;
+  }
+  int64_t presentAt = desiredPresentTime(frame, captureNs, sourceNs, slot.sourceNs);
+  nanoseconds syncDelay = avSync_ != nullptr ? avSync_->videoDelay() : 0ns;
+  if (syncDelay > 0ns) {
+    presentAt = (presentAt > 0 ? presentAt : captureNs) + syncDelay.count();
+  }
+  if (presentAt > 0) {
+    ASurfaceTransaction_setDesiredPresentTime(transaction, presentAt);
+  }
+  ASurfaceTransaction_setOnComplete(transaction, &slot, &onTransactionComplete);
+  ASurfaceTransaction_apply(transaction);
+  ASurfaceTransaction_delete(transaction);
+  return true;
+}
+
+int64_t SurfaceControlPresenter::desiredPresentTime(
+    const uvc_frame_t* frame,
+    int64_t captureNs,
+    int64_t recoveredNs,
+    int64_t& sourceNs) {
+  if (clockFrequency_ == 0 || frame->pts == 0) {
+    return 0;
+  }
+  if (anchored_) {
+    frameIntervalNs_ = (int64_t)((uint64_t)(uint32_t)(frame->pts - lastPts_) * 1'000'000'000 /
+                                 clockFrequency_);
+  }
+  lastPts_ = frame->pts;
+  int64_t headroomNs = std::clamp<int64_t>(frameIntervalNs_, 0, kMaxLatenessNs);
+  // The recovered clock already accounts for drift and transport jitter.
+  if (recoveredNs > 0) {
+    anchored_ = true;
+    anchorPts_ = frame->pts;
+    anchorHostNs_ = recoveredNs;
+    sourceNs = recoveredNs;
+    return recoveredNs + headroomNs;
+  }
+  uint64_t ticks = (uint32_t)(frame->pts - anchorPts_);
+  int64_t expectedNs = anchorHostNs_ + (int64_t)(ticks * 1'000'000'000 / clockFrequency_);
+  // The anchor is the frame with the least transport delay seen so far: a
+  // frame arriving before its predicted time moves it.
+  if (!anchored_ || captureNs < expectedNs || captureNs - expectedNs > kMaxLatenessNs ||
+      ticks > kMaxAnchorAgeSeconds * clockFrequency_) {
+    anchored_ = true;
+    anchorPts_ = frame->pts;
+    anchorHostNs_ = captureNs;
+    expectedNs = captureNs;
+  }
+  sourceNs = expectedNs;
+  // One frame interval of headroom for conversion and composition.
+  return expectedNs + headroomNs;
+}
+
+void SurfaceControlPresenter::onTransactionComplete(
+    void* context,
+    ASurfaceTransactionStats* stats) {
+  auto* slot = static_cast<Slot*>(context);
+  slot->presenter->complete(*slot, stats);
+}
+
+void SurfaceControlPresenter::complete(Slot& slot, ASurfaceTransactionStats* stats) {
+  int releaseFence = ASurfaceTransactionStats_getPreviousReleaseFenceFd(stats, surfaceControl_);
+  int presentFence = ASurfaceTransactionStats_getPresentFenceFd(stats);
+  std::lock_guard lk(mutex_);
+  size_t index = &slot - slots_.data();
+  if (onScreenSlot_ < kSlotCount && onScreenSlot_ != index) {
+    Slot& previous = slots_[onScreenSlot_];
+    closeFence(previous.releaseFence);
+    previous.releaseFence = releaseFence;
+    previous.state = SlotState::FREE;
+  } else {
+    closeFence(releaseFence);
+  }
+  slot.state = SlotState::ON_SCREEN;
+  onScreenSlot_ = index;
+  if (presentFence >= 0) {
+    pendingFences_.push_back({presentFence, slot.captureNs, slot.sourceNs});
+    if (pendingFences_.size() > kMaxPendingFences) {
+      closeFence(pendingFences_.front().fd);
+      pendingFences_.pop_front();
+    }
+  }
+  collectSignaledFences();
+  completed_.notify_all();
+}
+
+void SurfaceControlPresenter::collectSignaledFences() {
+  while (!pendingFences_.empty()) {
+    PendingFence& pending = pendingFences_.front();
+    struct sync_file_info* info = sync_file_info(pending.fd);
+    if (info == nullptr) {
+      closeFence(pending.fd);
+      pendingFences_.pop_front();
+      continue;
+    }
+    // Fences signal in order, so stop at the first one still pending.
+    if (info->status != 1) {
+      sync_file_info_free(info);
+      return;
+    }
+    uint64_t presentNs = 0;
+    struct sync_fence_info* fences = sync_get_fence_info(info);
+    for (uint32_t i = 0; i < info->num_fences; i++) {
+      presentNs = std::max(presentNs, fences[i].timestamp_ns);
+    }
+    sync_file_info_free(info);
+    nanoseconds latency((int64_t)presentNs - pending.captureNs);
+    if (avSync_ != nullptr) {
+      avSync_->recordVideoLatency(
+          nanoseconds((int64_t)presentNs - pending.sourceNs), steady_clock::now());
+    }
+    latencyStats_.frames++;
+    latencyStats_.total += latency;
+    latencyStats_.max = std::max(latencyStats_.max, latency);
+    closeFence(pending.fd);
+    pendingFences_.pop_front();
+  }
+}
+
+SurfaceControlPresenter::LatencyStats SurfaceControlPresenter::takeLatencyStats() {
+  std::lock_guard lk(mutex_);
+  collectSignaledFences();
+  LatencyStats stats = latencyStats_;
+  latencyStats_ = {};
+  return stats;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android/hardware_buffer.h>
+#include <android/native_window.h>
+#include <android/surface_control.h>
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+using namespace std::chrono;
+
+class AvSync;
+
+// Presents converted frames as AHardwareBuffers on a child ASurfaceControl of
+// the preview window instead of going through the window's BufferQueue.
+//
+// Each frame gets a desired present time mapped from its UVC PTS onto the
+// host clock, so frames are latched at the device's cadence rather than
+// whenever they happen to be posted. Present fences of completed
+// transactions are read back to measure capture to present latency.
+//
+// lock() and present() are called from the render thread. Transaction
+// callbacks arrive on a binder thread and only touch state under mutex_.
+class SurfaceControlPresenter final {
+ public:
+  // avSync, when set, delays presentation for lip sync and is fed the
+  // measured present latency.
+  explicit SurfaceControlPresenter(AvSync* avSync = nullptr) : avSync_(avSync) {}
+  SurfaceControlPresenter(const SurfaceControlPresenter&) = delete;
+  SurfaceControlPresenter& operator=(const SurfaceControlPresenter&) = delete;
+  ~SurfaceControlPresenter();
+
+  // clockFrequency is the stream's dwClockFrequency, used to convert PTS.
+  bool init(
+      ANativeWindow* window,
+      int32_t width,
+      int32_t height,
+      int32_t format,
+      uint32_t clockFrequency);
+
+  // Locks a free buffer for CPU writes. Returns false when all buffers are
+  // still queued or on screen; the frame should then be dropped.
+  bool lock(ANativeWindow_Buffer* buffer);
+
+  // Takes a free buffer for the GPU to write, like lock() but without a CPU
+  // mapping. releaseFence, owned by the caller, is -1 or signals once the
+  // buffer may be written.
+  bool acquire(AHardwareBuffer** buffer, int* releaseFence);
+
+  // Unlocks the buffer from lock() or acquire() and submits it for the
+  // frame. sourceNs is its capture time from DeviceClock, or 0 to map its
+  // PTS here. acquireFence, owned, is the GPU's fence for an acquired
+  // buffer's writes.
+  bool present(const uvc_frame_t* frame, int64_t sourceNs = 0, int acquireFence = -1);
+
+  // Unlocks the buffer from lock() or acquire() without submitting it.
+  void unlock();
+
+  // ANativeWindowTransform of the frames from the next present().
+  void setTransform(int32_t transform);
+
+  // Frame rate of the layer from the next present(), for the display to
+  // match, as a fixed source's.
+  void setFrameRate(float fps);
+
+  // Capture to present latency of frames whose present fence signaled since
+  // the last call.
+  struct LatencyStats {
+    uint32_t frames{};
+    nanoseconds total{0ns};
+    nanoseconds max{0ns};
+  };
+  LatencyStats takeLatencyStats();
+
+ private:
+  enum class SlotState { FREE, LOCKED, QUEUED, ON_SCREEN };
+  struct Slot {
+    SurfaceControlPresenter* presenter{};
+    AHardwareBuffer* buffer{};
+    SlotState state{SlotState::FREE};
+    // Fence to wait on before writing, handed back with the release.
+    int releaseFence{-1};
+    int64_t captureNs{};
+    // PTS mapped onto the host clock, what A/V sync measures from.
+    int64_t sourceNs{};
+  };
+  static constexpr size_t kSlotCount = 3;
+  // Present fences kept while they are pending.
+  static constexpr size_t kMaxPendingFences = 4;
+
+  AvSync* avSync_{};
+  ASurfaceControl* surfaceControl_{};
+  std::array<Slot, kSlotCount> slots_{};
+  size_t lockedSlot_{kSlotCount};
+  // Whether lockedSlot_ is mapped by lock(), or from acquire().
+  bool cpuLocked_{false};
+  size_t onScreenSlot_{kSlotCount};
+  bool geometrySet_{false};
+  int32_t transform_{ANATIVEWINDOW_TRANSFORM_IDENTITY};
+  float frameRate_{};
+  bool frameRateSet_{true};
+  ARect source_{};
+  ARect destination_{};
+
+  // PTS to host clock mapping, anchored on the earliest arriving frame.
+  uint32_t clockFrequency_{};
+  bool anchored_{false};
+  uint32_t anchorPts_{};
+  int64_t anchorHostNs_{};
+  int64_t frameIntervalNs_{};
+  uint32_t lastPts_{};
+
+  std::mutex mutex_;
+  // Signaled when a transaction completes, so destroy() can wait for them.
+  std::condition_variable completed_;
+  struct PendingFence {
+    int fd;
+    int64_t captureNs;
+    int64_t sourceNs;
+  };
+  std::deque<PendingFence> pendingFences_{};
+  LatencyStats latencyStats_{};
+
+  // Marks the first free slot locked, swapping out its release fence.
+  bool takeFreeSlot(int& releaseFence);
+  int64_t desiredPresentTime(
+      const uvc_frame_t* frame,
+      int64_t captureNs,
+      int64_t recoveredNs,
+      int64_t& sourceNs);
+  static void onTransactionComplete(void* context, ASurfaceTransactionStats* stats);
+  void complete(Slot& slot, ASurfaceTransactionStats* stats);
+  void collectSignaledFences();
+  void destroy();
+};
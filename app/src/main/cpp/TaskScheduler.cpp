@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TaskScheduler.h"
+
+#include <android/log.h>
+
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+
+#include "ThreadPolicy.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "TaskScheduler", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "TaskScheduler", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "TaskScheduler", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "TaskScheduler", __VA_ARGS__)
+
+static thread_local int32_t currentWorker_ = -1;
+// Set by DeadlineScope, and while a worker runs a session's job.
+static thread_local std::shared_ptr<TaskScheduler::Session> currentSession_;
+static thread_local int64_t currentDeadlineNs_ = INT64_MAX;
+
+bool TaskScheduler::Session::takeShedRequest() {
+  if (!shedRequested_.exchange(false, std::memory_order_relaxed)) {
+    return false;
+  }
+  shed_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+TaskScheduler::Session::Stats TaskScheduler::Session::stats() const {
+  return Stats{
+      jobs_.load(std::memory_order_relaxed),
+      missed_.load(std::memory_order_relaxed),
+      shed_.load(std::memory_order_relaxed)};
+}
+
+TaskScheduler::DeadlineScope::DeadlineScope(std::shared_ptr<Session> session, int64_t deadlineNs)
+    : previousSession_(std::move(currentSession_)), previousDeadlineNs_(currentDeadlineNs_) {
+  currentSession_ = std::move(session);
+  currentDeadlineNs_ = deadlineNs;
+}
+
+TaskScheduler::DeadlineScope::~DeadlineScope() {
+  currentSession_ = std::move(previousSession_);
+  currentDeadlineNs_ = previousDeadlineNs_;
+}
+
+std::shared_ptr<TaskScheduler> TaskScheduler::shared() {
+  static std::mutex mutex;
+  static std::weak_ptr<TaskScheduler> current;
+  std::lock_guard lk(mutex);
+  std::shared_ptr<TaskScheduler> scheduler = current.lock();
+  if (scheduler == nullptr) {
+    scheduler = std::make_shared<TaskScheduler>();
+    current = scheduler;
+  }
+  return scheduler;
+}
+
+TaskScheduler::TaskScheduler() {
+  const std::vector<int>& performance = ThreadPolicies::performanceCores();
+  int cpuCount = (int)sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu = 0; cpu < cpuCount; cpu++) {
+    if (std::find(performance.begin(), performance.end(), cpu) == performance.end()) {
+      efficiencyCores_.push_back(cpu);
+    }
+  }
+  performanceWorkers_ = std::max<uint32_t>(performance.size(), 1);
+  uint32_t efficiencyWorkers =
+      std::min<uint32_t>(efficiencyCores_.size(), kMaxEfficiencyWorkers);
+  uint32_t workerCount = performanceWorkers_ + efficiencyWorkers;
+  workers_.reserve(workerCount);
+  for (uint32_t i = 0; i < workerCount; i++) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (uint32_t i = 0; i < workerCount; i++) {
+    workers_[i]->thread = std::thread(&TaskScheduler::workerLoop, this, i);
+  }
+  ULOGI(
+      "Started %u performance and %u efficiency workers",
+      performanceWorkers_,
+      efficiencyWorkers);
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard lk(mutex_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+std::shared_ptr<TaskScheduler::Session> TaskScheduler::openSession(nanoseconds period) {
+  auto session = std::make_shared<Session>(period);
+  std::lock_guard lk(mutex_);
+  std::erase_if(sessions_, [](const std::weak_ptr<Session>& weak) { return weak.expired(); });
+  sessions_.push_back(session);
+  return session;
+}
+
+int32_t TaskScheduler::currentWorker() {
+  return currentWorker_;
+}
+
+void TaskScheduler::submit(TaskPriority priority, Job job) {
+  int32_t self = currentWorker_;
+  uint32_t index;
+  if (self >= 0) {
+    index = self;
+  } else {
+    uint32_t next = nextWorker_.fetch_add(1, std::memory_order_relaxed);
+    uint32_t efficiencyWorkers = workers_.size() - performanceWorkers_;
+    index = priority == TaskPriority::RECORDING && efficiencyWorkers > 0
+        ? performanceWorkers_ + next % efficiencyWorkers
+        : next % performanceWorkers_;
+  }
+  Entry entry;
+  entry.deadlineNs = currentSession_ != nullptr ? currentDeadlineNs_ : INT64_MAX;
+  entry.sequence = nextSequence_.fetch_add(1, std::memory_order_relaxed);
+  entry.job = std::move(job);
+  entry.session = currentSession_;
+  {
+    std::lock_guard lk(workers_[index]->mutex);
+    std::vector<Entry>& jobs = workers_[index]->jobs[(size_t)priority];
+    jobs.push_back(std::move(entry));
+    std::push_heap(jobs.begin(), jobs.end());
+  }
+  {
+    std::lock_guard lk(mutex_);
+    queued_++;
+  }
+  wake_.notify_one();
+}
+
+bool TaskScheduler::takeJob(uint32_t index, Entry& entry) {
+  for (size_t priority = 0; priority < kTaskPriorities; priority++) {
+    // The queues are peeked one at a time, so the job found may be gone
+    // by the time its worker's queue is locked again; look again then.
+    while (true) {
+      int64_t bestDeadline = INT64_MAX;
+      int32_t best = -1;
+      for (uint32_t i = 0; i < workers_.size(); i++) {
+        uint32_t candidate = (index + i) % workers_.size();
+        Worker& worker = *workers_[candidate];
+        std::lock_guard lk(worker.mutex);
+        const std::vector<Entry>& jobs = worker.jobs[priority];
+        if (!jobs.empty() && (best < 0 || jobs.front().deadlineNs < bestDeadline)) {
+          best = candidate;
+          bestDeadline = jobs.front().deadlineNs;
+        }
+      }
+      if (best < 0) {
+        break;
+      }
+      Worker& worker = *workers_[best];
+      std::lock_guard lk(worker.mutex);
+      std::vector<Entry>& jobs = worker.jobs[priority];
+      if (jobs.empty()) {
+        continue;
+      }
+      std::pop_heap(jobs.begin(), jobs.end());
+      entry = std::move(jobs.back());
+      jobs.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::shedSlackest() {
+  std::lock_guard lk(mutex_);
+  Session* slackest = nullptr;
+  std::shared_ptr<Session> locked;
+  for (const std::weak_ptr<Session>& weak : sessions_) {
+    std::shared_ptr<Session> session = weak.lock();
+    if (session == nullptr) {
+      continue;
+    }
+    // One request at a time: the first shed frame may be enough.
+    if (session->shedRequested_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    if (slackest == nullptr ||
+        session->periodNs_.load(std::memory_order_relaxed) >
+            slackest->periodNs_.load(std::memory_order_relaxed)) {
+      slackest = session.get();
+      locked = std::move(session);
+    }
+  }
+  if (slackest != nullptr) {
+    slackest->shedRequested_.store(true, std::memory_order_relaxed);
+  }
+}
+
+void TaskScheduler::workerLoop(uint32_t index) {
+  char name[16];
+  snprintf(name, sizeof(name), "usb_video_wk%u", index);
+  ThreadPolicies::apply(ThreadRole::CONVERT, name);
+  if (index >= performanceWorkers_) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int core : efficiencyCores_) {
+      CPU_SET(core, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      ULOGW("Could not move %s to the efficiency cores", name);
+    }
+  }
+  currentWorker_ = index;
+
+  Entry entry;
+  while (true) {
+    if (takeJob(index, entry)) {
+      {
+        std::lock_guard lk(mutex_);
+        queued_--;
+      }
+      Session* session = entry.session.get();
+      if (session != nullptr &&
+          steady_clock::now().time_since_epoch().count() > entry.deadlineNs) {
+        shedSlackest();
+      }
+      {
+        DeadlineScope scope(std::move(entry.session), entry.deadlineNs);
+        entry.job();
+        if (session != nullptr) {
+          session->jobs_.fetch_add(1, std::memory_order_relaxed);
+          if (steady_clock::now().time_since_epoch().count() > entry.deadlineNs) {
+            session->missed_.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+      }
+      entry.job = nullptr;
+      continue;
+    }
+    std::unique_lock lk(mutex_);
+    // What is still queued at exit runs too.
+    if (!running_ && queued_ == 0) {
+      return;
+    }
+    wake_.wait(lk, [this] { return !running_ || queued_ > 0; });
+  }
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+// What a job is for, most urgent first. A worker always takes the most
+// urgent job it can find, its own or stolen, so preview work beats analysis
+// and analysis beats recording.
+enum class TaskPriority : uint8_t {
+  PREVIEW,
+  ANALYSIS,
+  RECORDING,
+};
+
+static constexpr size_t kTaskPriorities = 3;
+
+// The process's compute threads, shared by the stripe conversion, the
+// parallel MJPEG decode and every streaming session, so the number of
+// threads stays bounded however many cameras and consumers there are.
+//
+// Each worker has its own queue per priority. Within a priority, jobs run
+// earliest deadline first: jobs submitted within a DeadlineScope are due with
+// their session's frame, the others run after them in submission order. A
+// worker takes the earliest job of its own queue or steals that of a busy
+// worker, whichever is due first. There is one performance worker per
+// performance core and, on big.LITTLE parts, up to kMaxEfficiencyWorkers on
+// the little cores. Preview and analysis jobs are placed on the performance
+// workers, recording jobs on the efficiency ones, though any worker steals
+// any job.
+//
+// A job of a session that starts past its deadline means the workers are
+// oversubscribed: the session with the longest frame interval, which has the
+// most slack, is asked to shed its next frame.
+//
+// Workers follow the CONVERT thread policy; the efficiency workers are then
+// moved onto the little cores.
+class TaskScheduler final {
+ public:
+  using Job = std::function<void()>;
+
+  // A stream of periodic work, such as one camera's frames.
+  class Session final {
+   public:
+    struct Stats {
+      uint64_t jobs{};
+      // Jobs that finished past their deadline.
+      uint64_t missed{};
+      // Frames skipped on the scheduler's request.
+      uint64_t shed{};
+    };
+
+    explicit Session(nanoseconds period) : periodNs_(period.count()) {}
+
+    void setPeriod(nanoseconds period) {
+      periodNs_.store(period.count(), std::memory_order_relaxed);
+    }
+    // Whether the scheduler asked to skip the next frame; counts it as shed.
+    bool takeShedRequest();
+    Stats stats() const;
+
+   private:
+    friend class TaskScheduler;
+    std::atomic<int64_t> periodNs_;
+    std::atomic<bool> shedRequested_{false};
+    std::atomic<uint64_t> jobs_{0};
+    std::atomic<uint64_t> missed_{0};
+    std::atomic<uint64_t> shed_{0};
+  };
+
+  // Jobs submitted from the calling thread while the scope lives, and from
+  // the jobs themselves, belong to session and are due at deadlineNs on the
+  // steady clock.
+  class DeadlineScope final {
+   public:
+    DeadlineScope(std::shared_ptr<Session> session, int64_t deadlineNs);
+    DeadlineScope(const DeadlineScope&) = delete;
+    DeadlineScope& operator=(const DeadlineScope&) = delete;
+    ~DeadlineScope();
+
+   private:
+    std::shared_ptr<Session> previousSession_;
+    int64_t previousDeadlineNs_;
+  };
+
+  static constexpr uint32_t kMaxEfficiencyWorkers = 2;
+
+  TaskScheduler();
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+  // Runs the jobs still queued, then joins the workers.
+  ~TaskScheduler();
+
+  // The process's scheduler, created on first use and shut down with its
+  // last user.
+  static std::shared_ptr<TaskScheduler> shared();
+
+  uint32_t workerCount() const {
+    return workers_.size();
+  }
+  uint32_t performanceWorkers() const {
+    return performanceWorkers_;
+  }
+  // Index of the worker running the calling thread, or -1 off the scheduler.
+  static int32_t currentWorker();
+
+  // Sessions are only held by their users; the scheduler forgets the ones
+  // they dropped.
+  std::shared_ptr<Session> openSession(nanoseconds period);
+
+  void submit(TaskPriority priority, Job job);
+
+ private:
+  struct Entry {
+    int64_t deadlineNs{};
+    uint64_t sequence{};
+    Job job{};
+    std::shared_ptr<Session> session{};
+
+    // Orders a max-heap so its front is the earliest deadline.
+    bool operator<(const Entry& other) const {
+      return deadlineNs != other.deadlineNs ? deadlineNs > other.deadlineNs
+                                            : sequence > other.sequence;
+    }
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    // Heaps ordered by Entry::operator<.
+    std::vector<Entry> jobs[kTaskPriorities];
+    std::thread thread{};
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  uint32_t performanceWorkers_{};
+  std::vector<int> efficiencyCores_;
+  std::atomic<uint32_t> nextWorker_{0};
+  std::atomic<uint64_t> nextSequence_{0};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  // Jobs in the queues, changed under mutex_ so a worker never misses one.
+  uint32_t queued_{};
+  bool running_{true};
+  std::vector<std::weak_ptr<Session>> sessions_{};
+
+  void workerLoop(uint32_t index);
+  // Pops the job of the highest priority due first, the calling worker's on
+  // a tie.
+  bool takeJob(uint32_t index, Entry& entry);
+  void shedSlackest();
+};
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "TelemetryLog.h"
+
+#include <android/log.h>
+#include <android/thermal.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include "FrameLatencyStats.h"
+#include "StreamingStats.h"
+
+#define ULOG_TAG "TelemetryLog"
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, ULOG_TAG, __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, ULOG_TAG, __VA_ARGS__)
+
+using namespace std::chrono;
+
+static_assert(std::tuple_size_v<decltype(TelemetryRecord::cpuPermille)> == kStatsThreadRoles);
+static_assert(std::tuple_size_v<decltype(TelemetryRecord::totalLatencyUs)> ==
+              kPublishedPercentiles);
+
+namespace {
+
+// Cumulative counters as of the previous record. A counter that went down
+// was reset by a new stream, and all of it is new.
+struct Totals {
+  uint64_t renderedFrames{0};
+  uint64_t audioTransfers{0};
+  uint64_t videoDrops{0};
+  uint64_t videoPacketErrors{0};
+  uint64_t audioPacketErrors{0};
+  uint64_t audioXruns{0};
+  uint64_t audioUnderruns{0};
+  std::array<uint64_t, kStatsThreadRoles> cpuTimeUs{};
+};
+
+uint64_t advance(uint64_t now, uint64_t& last) {
+  uint64_t delta = now >= last ? now - last : now;
+  last = now;
+  return delta;
+}
+
+uint32_t clamp32(uint64_t value) {
+  return (uint32_t)std::min<uint64_t>(value, UINT32_MAX);
+}
+
+uint64_t wallTimeMs() {
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+TelemetryRecord sample(
+    const StreamingStats& stats,
+    Totals& totals,
+    int64_t elapsedUs,
+    AThermalManager* thermal) {
+  TelemetryRecord record{};
+  record.wallTimeMs = wallTimeMs();
+
+  uint64_t drops = 0;
+  for (const StatCounter& counter : stats.videoDrops.drops) {
+    drops += counter.load();
+  }
+  record.videoDrops = clamp32(advance(drops, totals.videoDrops));
+  record.videoPacketErrors =
+      clamp32(advance(stats.transport.video.packetErrors.load(), totals.videoPacketErrors));
+  record.audioPacketErrors =
+      clamp32(advance(stats.transport.audio.packetErrors.load(), totals.audioPacketErrors));
+  record.audioXruns = clamp32(advance(stats.audio.xruns.load(), totals.audioXruns));
+  record.audioUnderruns = clamp32(advance(stats.audio.underruns.load(), totals.audioUnderruns));
+
+  if (advance(stats.videoRender.frames.load(), totals.renderedFrames) > 0) {
+    record.flags |= TELEMETRY_VIDEO_RUNNING;
+    record.fastPaths = clamp32(stats.videoRender.fastPaths.load());
+    record.fastPathCohort = clamp32(stats.videoRender.fastPathCohort.load());
+    record.videoFpsDeci = (uint16_t)std::min<uint64_t>(
+        stats.videoRender.fpsSmoothedMilli.load() / 100, UINT16_MAX);
+    size_t total = (size_t)LatencyStage::TOTAL * kPublishedPercentiles;
+    for (size_t i = 0; i < kPublishedPercentiles; i++) {
+      record.totalLatencyUs[i] = clamp32(stats.videoRender.latencyPercentilesUs[total + i].load());
+    }
+  }
+  if (advance(stats.audio.usbTransfers.load(), totals.audioTransfers) > 0) {
+    record.flags |= TELEMETRY_AUDIO_RUNNING;
+    record.audioSamplingFrequency = clamp32(stats.audio.samplingFrequency.load());
+  }
+  if ((record.flags & TELEMETRY_VIDEO_RUNNING) && (record.flags & TELEMETRY_AUDIO_RUNNING)) {
+    int64_t skewUs = (int64_t)stats.avSync.skewUs.load();
+    record.avSkewUs = (int32_t)std::clamp<int64_t>(skewUs, INT32_MIN, INT32_MAX);
+  }
+
+  // The streamers publish the CPU time about once a second, so a role
+  // updated late shows up in the next record instead.
+  for (size_t i = 0; i < kStatsThreadRoles; i++) {
+    uint64_t cpuUs = advance(stats.threads.roles[i].cpuTimeUs.load(), totals.cpuTimeUs[i]);
+    if (elapsedUs > 0) {
+      record.cpuPermille[i] = (uint16_t)std::min<uint64_t>(cpuUs * 1000 / elapsedUs, UINT16_MAX);
+    }
+  }
+  record.nativeHeapKiB = clamp32(stats.memory.nativeHeapBytes.load() / 1024);
+  record.thermalStatus = thermal != nullptr ? (int8_t)AThermal_getCurrentThermalStatus(thermal)
+                                            : (int8_t)ATHERMAL_STATUS_ERROR;
+  return record;
+}
+
+} // namespace
+
+TelemetryLog& TelemetryLog::shared() {
+  static TelemetryLog log;
+  return log;
+}
+
+TelemetryLog::~TelemetryLog() {
+  stop();
+}
+
+bool TelemetryLog::start(const std::string& path, uint32_t capacity) {
+  stop();
+  if (capacity == 0) {
+    return false;
+  }
+  size_t bytes = sizeof(TelemetryFileHeader) + (size_t)capacity * sizeof(TelemetryRecord);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ULOGE("Failed to open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st {};
+  bool sized = fstat(fd, &st) == 0 && (size_t)st.st_size == bytes;
+  if (!sized && ftruncate(fd, 0) != 0) {
+    ULOGE("Failed to truncate %s: %s", path.c_str(), strerror(errno));
+    close(fd);
+    return false;
+  }
+  // Reserves the blocks now, so a full disk fails here and not as a SIGBUS
+  // on a store into the mapping.
+  int error = sized ? 0 : posix_fallocate(fd, 0, bytes);
+  if (error != 0) {
+    ULOGE("Failed to allocate %zu bytes for %s: %s", bytes, path.c_str(), strerror(error));
+    close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    ULOGE("Failed to map %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  auto* header = (TelemetryFileHeader*)mapping;
+  if (header->magic != kTelemetryMagic || header->version != kTelemetryVersion ||
+      header->recordSize != sizeof(TelemetryRecord) || header->capacity != capacity) {
+    memset(mapping, 0, bytes);
+    header->magic = kTelemetryMagic;
+    header->version = kTelemetryVersion;
+    header->recordSize = sizeof(TelemetryRecord);
+    header->capacity = capacity;
+    header->createdWallMs = wallTimeMs();
+    header->written.store(0, std::memory_order_relaxed);
+  }
+  ULOGI("Logging to %s, %llu records so far",
+        path.c_str(),
+        (unsigned long long)header->written.load(std::memory_order_relaxed));
+
+  std::lock_guard lk(mutex_);
+  header_ = header;
+  records_ = (TelemetryRecord*)(header + 1);
+  mappedBytes_ = bytes;
+  stopping_ = false;
+  thread_ = std::thread(&TelemetryLog::sampleLoop, this);
+  return true;
+}
+
+void TelemetryLog::stop() {
+  {
+    std::lock_guard lk(mutex_);
+    if (!thread_.joinable()) {
+      return;
+    }
+    stopping_ = true;
+  }
+  change_.notify_all();
+  thread_.join();
+  unmap();
+}
+
+void TelemetryLog::unmap() {
+  // The records already are in the page cache; MS_ASYNC only starts the
+  // write back of the last ones.
+  msync(header_, mappedBytes_, MS_ASYNC);
+  munmap(header_, mappedBytes_);
+  header_ = nullptr;
+  records_ = nullptr;
+  mappedBytes_ = 0;
+}
+
+void TelemetryLog::sampleLoop() {
+  prctl(PR_SET_NAME, "usb_telemetry");
+  // Below the streaming threads, like HotLog's drain.
+  setpriority(PRIO_PROCESS, gettid(), 10);
+  AThermalManager* thermal = AThermal_acquireManager();
+  const StreamingStats& stats = StreamingStats::shared();
+  Totals totals;
+  // Only the counts of the first second are recorded, not all so far.
+  sample(stats, totals, 0, nullptr);
+  steady_clock::time_point last = steady_clock::now();
+
+  std::unique_lock lk(mutex_);
+  while (!stopping_) {
+    change_.wait_until(lk, last + 1s, [this] { return stopping_; });
+    if (stopping_) {
+      break;
+    }
+    steady_clock::time_point now = steady_clock::now();
+    int64_t elapsedUs = duration_cast<microseconds>(now - last).count();
+    last = now;
+    TelemetryRecord record = sample(stats, totals, elapsedUs, thermal);
+    uint64_t written = header_->written.load(std::memory_order_relaxed);
+    records_[written % header_->capacity] = record;
+    header_->written.store(written + 1, std::memory_order_release);
+  }
+  if (thermal != nullptr) {
+    AThermal_releaseManager(thermal);
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Session telemetry kept across runs in a memory-mapped file in app storage,
+// one fixed size record per second, so a problem a user reports days later
+// can still be looked at: frame rate, latency, drops, USB errors, audio
+// XRuns, CPU and the thermal status, tagged with the FastPaths the stream
+// ran on so rollout cohorts can be compared.
+//
+// The file is a TelemetryFileHeader followed by capacity records used as a
+// ring. A record is written in place through the mapping and only then
+// counted in written, so a process killed mid-record leaves the ones before
+// it intact and the page cache writes them back. host/TelemetryDump.cpp
+// prints a copied file.
+
+static constexpr uint32_t kTelemetryMagic = 0x4c545655; // "UVTL"
+static constexpr uint32_t kTelemetryVersion = 2;
+
+struct TelemetryFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t capacity; // records
+  // Records ever written; the latest is at (written - 1) % capacity.
+  std::atomic<uint64_t> written;
+  uint64_t createdWallMs;
+  uint8_t reserved[32];
+};
+static_assert(sizeof(TelemetryFileHeader) == 64);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+enum TelemetryFlags : uint8_t {
+  TELEMETRY_VIDEO_RUNNING = 1 << 0, // frames were rendered this second
+  TELEMETRY_AUDIO_RUNNING = 1 << 1, // audio transfers completed this second
+};
+
+// Counts are over the second the record covers, levels are its last value.
+struct TelemetryRecord {
+  uint64_t wallTimeMs; // CLOCK_REALTIME, to line up with logcat and bug reports
+  uint32_t audioSamplingFrequency;
+  std::array<uint32_t, 3> totalLatencyUs; // p50, p95, p99 of the stream so far
+  uint32_t videoDrops; // every FrameDropCause
+  uint32_t videoPacketErrors;
+  uint32_t audioPacketErrors;
+  uint32_t audioXruns;
+  uint32_t audioUnderruns;
+  int32_t avSkewUs;
+  uint32_t nativeHeapKiB;
+  uint16_t videoFpsDeci; // smoothed, in tenths
+  std::array<uint16_t, 4> cpuPermille; // of one core, per ThreadRole
+  int8_t thermalStatus; // AThermalStatus, -1 when unavailable
+  uint8_t flags; // TelemetryFlags
+  uint32_t fastPaths; // FastPath bits of the video stream
+  uint32_t fastPathCohort;
+};
+static_assert(sizeof(TelemetryRecord) == 72);
+
+// Appends a TelemetryRecord of StreamingStats::shared() to the file every
+// second on its own thread; the streaming paths are not involved, they only
+// update the counters it reads.
+class TelemetryLog final {
+ public:
+  static constexpr uint32_t kDefaultCapacity = 7 * 24 * 60 * 60; // a week, 42 MiB
+
+  static TelemetryLog& shared();
+
+  TelemetryLog(const TelemetryLog&) = delete;
+  TelemetryLog& operator=(const TelemetryLog&) = delete;
+  ~TelemetryLog();
+
+  // Maps path, keeping its records when it was written with the same
+  // version and capacity and starting it over otherwise, and starts
+  // sampling. A running log is closed first.
+  bool start(const std::string& path, uint32_t capacity = kDefaultCapacity);
+  void stop();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable change_;
+  bool stopping_{false};
+  std::thread thread_{};
+  TelemetryFileHeader* header_{nullptr};
+  TelemetryRecord* records_{nullptr};
+  size_t mappedBytes_{0};
+
+  TelemetryLog() = default;
+  void sampleLoop();
+  void unmap();
+};
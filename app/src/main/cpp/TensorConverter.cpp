@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TensorConverter.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Bilinear taps of count outputs spread over length source luma samples
+// from start, on a line of limit samples subsampled by subsampling. Chroma
+// is cosited with the first of its luma samples, or centered between them.
+void fillTaps(
+    std::vector<int32_t>& offsets,
+    std::vector<float>& weights,
+    int32_t count,
+    int32_t start,
+    int32_t length,
+    int32_t limit,
+    int32_t subsampling,
+    bool centered,
+    int32_t bytesPerSample,
+    int32_t base) {
+  offsets.resize(count);
+  weights.resize(count);
+  for (int32_t i = 0; i < count; i++) {
+    float position = start + (i + 0.5f) * length / count - 0.5f;
+    position = centered ? (position + 0.5f) / subsampling - 0.5f : position / subsampling;
+    int32_t first = std::clamp((int32_t)std::floor(position), 0, limit - 2);
+    offsets[i] = first * bytesPerSample + base;
+    weights[i] = std::clamp(position - first, 0.0f, 1.0f);
+  }
+}
+
+bool packed(uvc_frame_format format) {
+  return format == UVC_FRAME_FORMAT_YUYV || format == UVC_FRAME_FORMAT_UYVY;
+}
+
+#if defined(__ARM_NEON)
+int32x4_t roundToInt(float32x4_t value) {
+#if defined(__aarch64__)
+  return vcvtnq_s32_f32(value);
+#else
+  // Halves away from zero rather than to even, which only moves ties.
+  uint32x4_t negative = vcltq_f32(value, vdupq_n_f32(0.0f));
+  return vcvtq_s32_f32(
+      vaddq_f32(value, vbslq_f32(negative, vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f))));
+#endif
+}
+
+int16x8_t roundToShort(float32x4_t low, float32x4_t high) {
+  return vcombine_s16(vqmovn_s32(roundToInt(low)), vqmovn_s32(roundToInt(high)));
+}
+#endif
+
+} // namespace
+
+bool TensorConverter::supportsFormat(uvc_frame_format format) {
+  return packed(format) || format == UVC_FRAME_FORMAT_NV12;
+}
+
+bool TensorConverter::configure(
+    const TensorSpec& spec,
+    int32_t captureWidth,
+    int32_t captureHeight,
+    uvc_frame_format format,
+    const Colorimetry& colorimetry) {
+  format_ = UVC_FRAME_FORMAT_UNKNOWN;
+  // The chroma of a 4 pixel wide or high frame is the least that has two
+  // samples to interpolate between.
+  if (!supportsFormat(format) || spec.width <= 0 || spec.height <= 0 || captureWidth < 4 ||
+      captureHeight < 4 || (spec.type != TensorType::FLOAT32 && !(spec.scale > 0.0f))) {
+    return false;
+  }
+  for (float deviation : spec.std) {
+    if (deviation == 0.0f) {
+      return false;
+    }
+  }
+  FrameCrop crop = spec.crop.empty() ? FrameCrop{0, 0, captureWidth, captureHeight}
+                                     : spec.crop.within(captureWidth, captureHeight, 2);
+  if (crop.empty()) {
+    return false;
+  }
+  spec_ = spec;
+  spec_.crop = crop;
+  captureWidth_ = captureWidth;
+  captureHeight_ = captureHeight;
+
+  bool nv12 = format == UVC_FRAME_FORMAT_NV12;
+  lumaStep_ = nv12 ? 1 : 2;
+  chromaStep_ = nv12 ? 2 : 4;
+  vOffset_ = nv12 ? 1 : 2;
+  int32_t lumaBase = format == UVC_FRAME_FORMAT_UYVY ? 1 : 0;
+  int32_t uBase = format == UVC_FRAME_FORMAT_YUYV ? 1 : 0;
+  fillTaps(
+      luma_.offset,
+      luma_.weight,
+      spec_.width,
+      crop.x,
+      crop.width,
+      captureWidth,
+      1,
+      false,
+      lumaStep_,
+      lumaBase);
+  fillTaps(
+      chroma_.offset,
+      chroma_.weight,
+      spec_.width,
+      crop.x,
+      crop.width,
+      captureWidth / 2,
+      2,
+      false,
+      chromaStep_,
+      uBase);
+  fillTaps(
+      lumaRows_.offset,
+      lumaRows_.weight,
+      spec_.height,
+      crop.y,
+      crop.height,
+      captureHeight,
+      1,
+      false,
+      1,
+      0);
+  if (nv12) {
+    fillTaps(
+        chromaRows_.offset,
+        chromaRows_.weight,
+        spec_.height,
+        crop.y,
+        crop.height,
+        captureHeight / 2,
+        2,
+        true,
+        1,
+        0);
+  } else {
+    chromaRows_ = lumaRows_;
+  }
+
+  Colorimetry::Coefficients weights = colorimetry.coefficients();
+  yWeight_ = weights.yScale;
+  crR_ = weights.crR;
+  cbG_ = weights.cbG;
+  crG_ = weights.crG;
+  cbB_ = weights.cbB;
+  float lumaOffset = -weights.yScale * weights.yOffset * 255.0f;
+  offset_ = {
+      lumaOffset - 128.0f * crR_,
+      lumaOffset + 128.0f * (cbG_ + crG_),
+      lumaOffset - 128.0f * cbB_,
+  };
+  bool quantized = spec_.type != TensorType::FLOAT32;
+  for (size_t c = 0; c < 3; c++) {
+    gain_[c] = 1.0f / spec_.std[c];
+    bias_[c] = -spec_.mean[c] / spec_.std[c];
+    if (quantized) {
+      gain_[c] /= spec_.scale;
+      bias_[c] = bias_[c] / spec_.scale + spec_.zeroPoint;
+    }
+  }
+  y_.resize(spec_.width);
+  u_.resize(spec_.width);
+  v_.resize(spec_.width);
+  format_ = format;
+  return true;
+}
+
+size_t TensorConverter::bytes() const {
+  size_t values = (size_t)spec_.width * spec_.height * 3;
+  return spec_.type == TensorType::FLOAT32 ? values * sizeof(float) : values;
+}
+
+bool TensorConverter::convert(const uvc_frame_t* frame, uint8_t* dst) {
+  if (format_ == UVC_FRAME_FORMAT_UNKNOWN || frame->frame_format != format_ ||
+      frame->width != (uint32_t)captureWidth_ || frame->height != (uint32_t)captureHeight_) {
+    return false;
+  }
+  size_t step = frame->step > 0 ? frame->step : (size_t)frame->width * lumaStep_;
+  size_t size = step * frame->height;
+  if (frame->data_bytes < (packed(format_) ? size : size * 3 / 2)) {
+    return false;
+  }
+  for (int32_t row = 0; row < spec_.height; row++) {
+    sampleRow(frame, row);
+    storeRow(row, dst);
+  }
+  return true;
+}
+
+void TensorConverter::sampleRow(const uvc_frame_t* frame, int32_t row) {
+  const auto* data = static_cast<const uint8_t*>(frame->data);
+  size_t step = frame->step > 0 ? frame->step : (size_t)frame->width * lumaStep_;
+  const uint8_t* luma0 = data + (size_t)lumaRows_.offset[row] * step;
+  const uint8_t* luma1 = luma0 + step;
+  float lumaBelow = lumaRows_.weight[row];
+  // NV12 chroma rows follow the luma plane, half as many and as wide.
+  const uint8_t* chroma0 = packed(format_)
+      ? luma0
+      : data + step * frame->height + (size_t)chromaRows_.offset[row] * step;
+  const uint8_t* chroma1 = chroma0 + step;
+  float chromaBelow = chromaRows_.weight[row];
+
+  auto sample = [](const uint8_t* upper,
+                   const uint8_t* lower,
+                   int32_t at,
+                   int32_t next,
+                   float right,
+                   float below) {
+    float top = upper[at] + right * (upper[at + next] - upper[at]);
+    float bottom = lower[at] + right * (lower[at + next] - lower[at]);
+    return top + below * (bottom - top);
+  };
+  for (int32_t x = 0; x < spec_.width; x++) {
+    y_[x] = sample(luma0, luma1, luma_.offset[x], lumaStep_, luma_.weight[x], lumaBelow);
+    int32_t u = chroma_.offset[x];
+    float right = chroma_.weight[x];
+    u_[x] = sample(chroma0, chroma1, u, chromaStep_, right, chromaBelow);
+    v_[x] = sample(chroma0, chroma1, u + vOffset_, chromaStep_, right, chromaBelow);
+  }
+}
+
+void TensorConverter::storeRow(int32_t row, uint8_t* dst) const {
+  int32_t width = spec_.width;
+  bool planar = spec_.layout == TensorLayout::NCHW;
+  size_t plane = (size_t)width * spec_.height;
+  // Index of the row's first value, and the distances from one channel and
+  // one pixel to the next.
+  size_t first = planar ? (size_t)row * width : (size_t)row * width * 3;
+  size_t channelStride = planar ? plane : 1;
+  size_t pixelStride = planar ? 1 : 3;
+  auto* floats = reinterpret_cast<float*>(dst) + first;
+  auto* bytes = dst + first;
+
+  int32_t x = 0;
+#if defined(__ARM_NEON)
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  float32x4_t white = vdupq_n_f32(255.0f);
+  for (; x + 8 <= width; x += 8) {
+    // Tensor values of 8 pixels per channel, in two halves.
+    float32x4_t values[3][2];
+    for (int32_t half = 0; half < 2; half++) {
+      int32_t at = x + half * 4;
+      float32x4_t luma = vmulq_n_f32(vld1q_f32(y_.data() + at), yWeight_);
+      float32x4_t u = vld1q_f32(u_.data() + at);
+      float32x4_t v = vld1q_f32(v_.data() + at);
+      float32x4_t rgb[3] = {
+          vmlaq_n_f32(vaddq_f32(luma, vdupq_n_f32(offset_[0])), v, crR_),
+          vmlsq_n_f32(vmlsq_n_f32(vaddq_f32(luma, vdupq_n_f32(offset_[1])), u, cbG_), v, crG_),
+          vmlaq_n_f32(vaddq_f32(luma, vdupq_n_f32(offset_[2])), u, cbB_),
+      };
+      for (size_t c = 0; c < 3; c++) {
+        values[c][half] = vmlaq_n_f32(
+            vdupq_n_f32(bias_[c]), vminq_f32(vmaxq_f32(rgb[c], zero), white), gain_[c]);
+      }
+    }
+    if (spec_.type == TensorType::FLOAT32) {
+      for (int32_t half = 0; half < 2; half++) {
+        int32_t at = x + half * 4;
+        if (planar) {
+          for (size_t c = 0; c < 3; c++) {
+            vst1q_f32(floats + c * plane + at, values[c][half]);
+          }
+        } else {
+          float32x4x3_t pixels = {{values[0][half], values[1][half], values[2][half]}};
+          vst3q_f32(floats + at * 3, pixels);
+        }
+      }
+      continue;
+    }
+    int16x8_t shorts[3];
+    for (size_t c = 0; c < 3; c++) {
+      shorts[c] = roundToShort(values[c][0], values[c][1]);
+    }
+    if (spec_.type == TensorType::INT8) {
+      int8x8x3_t pixels = {{vqmovn_s16(shorts[0]), vqmovn_s16(shorts[1]), vqmovn_s16(shorts[2])}};
+      auto* out = reinterpret_cast<int8_t*>(bytes);
+      if (planar) {
+        for (size_t c = 0; c < 3; c++) {
+          vst1_s8(out + c * plane + x, pixels.val[c]);
+        }
+      } else {
+        vst3_s8(out + x * 3, pixels);
+      }
+    } else {
+      uint8x8x3_t pixels = {
+          {vqmovun_s16(shorts[0]), vqmovun_s16(shorts[1]), vqmovun_s16(shorts[2])}};
+      if (planar) {
+        for (size_t c = 0; c < 3; c++) {
+          vst1_u8(bytes + c * plane + x, pixels.val[c]);
+        }
+      } else {
+        vst3_u8(bytes + x * 3, pixels);
+      }
+    }
+  }
+#endif
+  for (; x < width; x++) {
+    float luma = yWeight_ * y_[x];
+    float u = u_[x];
+    float v = v_[x];
+    float rgb[3] = {
+        luma + crR_ * v + offset_[0],
+        luma - cbG_ * u - crG_ * v + offset_[1],
+        luma + cbB_ * u + offset_[2],
+    };
+    for (size_t c = 0; c < 3; c++) {
+      float value = std::clamp(rgb[c], 0.0f, 255.0f) * gain_[c] + bias_[c];
+      size_t index = c * channelStride + x * pixelStride;
+      if (spec_.type == TensorType::FLOAT32) {
+        floats[index] = value;
+      } else if (spec_.type == TensorType::INT8) {
+        bytes[index] = (uint8_t)(int8_t)std::clamp(std::lrintf(value), -128L, 127L);
+      } else {
+        bytes[index] = (uint8_t)std::clamp(std::lrintf(value), 0L, 255L);
+      }
+    }
+  }
+}
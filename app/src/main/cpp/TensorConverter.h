@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Colorimetry.h"
+#include "FrameCrop.h"
+
+enum class TensorLayout : int {
+  NHWC, // R, G and B of each pixel together
+  NCHW, // a plane of R, then G, then B
+};
+
+enum class TensorType : int {
+  FLOAT32,
+  INT8,
+  UINT8,
+};
+
+// Shape and normalization of the input tensor of a model.
+struct TensorSpec {
+  TensorLayout layout{TensorLayout::NHWC};
+  TensorType type{TensorType::FLOAT32};
+  int32_t width{};
+  int32_t height{};
+  // Part of the capture resized to width x height, the whole of it when
+  // empty. Stretched when the aspect ratios differ.
+  FrameCrop crop{};
+  // Per channel, R first, of 0-255 values: (value - mean) / std.
+  std::array<float, 3> mean{0.0f, 0.0f, 0.0f};
+  std::array<float, 3> std{1.0f, 1.0f, 1.0f};
+  // INT8 and UINT8 tensors hold round(normalized / scale) + zeroPoint,
+  // saturated, as TFLite quantizes its inputs.
+  float scale{1.0f};
+  int32_t zeroPoint{0};
+};
+
+// Writes model ready tensors straight from YUYV, UYVY and NV12 frames: the
+// crop is resized bilinearly, converted to RGB with the stream's
+// Colorimetry, normalized and quantized in one pass over the source, with
+// no RGBA frame in between. Each output row samples two source rows into
+// Y, U and V rows, which one NEON loop, where available, turns into the
+// tensor's values.
+//
+// Resizing does not filter: it matches the bilinear resize models are
+// commonly trained with, and aliases when shrinking more than twofold.
+class TensorConverter final {
+ public:
+  static bool supportsFormat(uvc_frame_format format);
+
+  // False when the spec or the crop is empty or the format unsupported.
+  bool configure(
+      const TensorSpec& spec,
+      int32_t captureWidth,
+      int32_t captureHeight,
+      uvc_frame_format format,
+      const Colorimetry& colorimetry);
+
+  const TensorSpec& spec() const {
+    return spec_;
+  }
+
+  // Of the tensor convert() writes.
+  size_t bytes() const;
+
+  // False when frame does not have the configured size and format.
+  bool convert(const uvc_frame_t* frame, uint8_t* dst);
+
+ private:
+  // Per output column, the byte offset in a source row of the left sample
+  // and its weight against the next one; per output row, the upper source
+  // row and the weight of the one below.
+  struct Taps {
+    std::vector<int32_t> offset{};
+    std::vector<float> weight{};
+  };
+
+  TensorSpec spec_{};
+  int32_t captureWidth_{};
+  int32_t captureHeight_{};
+  uvc_frame_format format_{UVC_FRAME_FORMAT_UNKNOWN};
+  Taps luma_{};
+  Taps chroma_{}; // offset of U
+  Taps lumaRows_{};
+  Taps chromaRows_{};
+  // Byte distance to the next sample, and from U to V.
+  int32_t lumaStep_{};
+  int32_t chromaStep_{};
+  int32_t vOffset_{};
+  // R = y Y + crR V + r, G = y Y - cbG U - crG V + g, B = y Y + cbB U + b on
+  // 0-255 samples, then clamped to 0-255 and mapped to the tensor's value
+  // with gain and bias per channel.
+  float yWeight_{};
+  float crR_{};
+  float cbG_{};
+  float crG_{};
+  float cbB_{};
+  std::array<float, 3> offset_{};
+  std::array<float, 3> gain_{};
+  std::array<float, 3> bias_{};
+  std::vector<float> y_{};
+  std::vector<float> u_{};
+  std::vector<float> v_{};
+
+  void sampleRow(const uvc_frame_t* frame, int32_t row);
+  void storeRow(int32_t row, uint8_t* dst) const;
+};
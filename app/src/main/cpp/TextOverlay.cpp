@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "TextOverlay.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+using namespace std::chrono;
+
+// ASCII 0x20 to 0x5f, seven rows of five pixels each, the leftmost in bit 4.
+static constexpr char kFirstGlyph = 0x20;
+static constexpr size_t kGlyphCount = 0x40;
+static constexpr uint8_t kFont[kGlyphCount][TextOverlay::kGlyphHeight] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // space
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // !
+    {0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00}, // "
+    {0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a}, // #
+    {0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04}, // $
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+    {0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d}, // &
+    {0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00}, // '
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+    {0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00}, // *
+    {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00}, // +
+    {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}, // ,
+    {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, // -
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, // .
+    {0x01, 0x01, 0x02, 0x04, 0x08, 0x10, 0x10}, // /
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+    {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+    {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+    {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+    {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+    {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+    {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, // :
+    {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08}, // ;
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+    {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00}, // =
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // ?
+    {0x0e, 0x11, 0x17, 0x15, 0x17, 0x10, 0x0f}, // @
+    {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // A
+    {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, // B
+    {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}, // C
+    {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, // D
+    {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, // E
+    {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, // F
+    {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}, // G
+    {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // H
+    {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, // I
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, // J
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, // L
+    {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+    {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // O
+    {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, // P
+    {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, // Q
+    {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, // R
+    {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}, // S
+    {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // U
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, // V
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}, // W
+    {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, // X
+    {0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04}, // Y
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, // Z
+    {0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e}, // [
+    {0x10, 0x10, 0x08, 0x04, 0x02, 0x01, 0x01}, // backslash
+    {0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e}, // ]
+    {0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00}, // ^
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f}, // _
+};
+
+static size_t glyphIndex(char c) {
+  if (c >= 'a' && c <= 'z') {
+    c = (char)(c - 'a' + 'A');
+  }
+  if (c < kFirstGlyph || (size_t)(c - kFirstGlyph) >= kGlyphCount) {
+    c = '?';
+  }
+  return (size_t)(c - kFirstGlyph);
+}
+
+// Rounded x / 255 for x up to 255 * 255.
+static inline uint8_t div255(uint32_t x) {
+  return (uint8_t)((x + ((x + 128) >> 8) + 128) >> 8);
+}
+
+void TextOverlay::configure(const OverlayConfig& config) {
+  config_ = config;
+  config_.scale = std::clamp(config.scale, 1, kMaxScale);
+  config_.text.resize(std::min(config_.text.size(), kMaxTextLength));
+  text_.clear();
+  second_ = -1;
+  label_.clear();
+  width_ = 0;
+  height_ = 0;
+  revision_++;
+  if (!config_.enabled()) {
+    atlas_.clear();
+    return;
+  }
+
+  int32_t scale = config_.scale;
+  uint32_t alpha = config_.color >> 24;
+  // Premultiplied, over the background.
+  uint8_t foreground[4] = {
+      div255(((config_.color >> 16) & 0xff) * alpha),
+      div255(((config_.color >> 8) & 0xff) * alpha),
+      div255((config_.color & 0xff) * alpha),
+      (uint8_t)(alpha + div255(kBackgroundAlpha * (255 - alpha))),
+  };
+  uint8_t background[4] = {0, 0, 0, kBackgroundAlpha};
+  // A glyph, a column of spacing after it, and a row of margin above and below.
+  cellWidth_ = (kGlyphWidth + 1) * scale;
+  cellHeight_ = (kGlyphHeight + 2) * scale;
+  size_t atlasStride = (size_t)cellWidth_ * kGlyphCount * 4;
+  atlas_.resize(atlasStride * cellHeight_);
+  for (int32_t y = 0; y < cellHeight_; y++) {
+    int32_t fontRow = y / scale - 1;
+    uint8_t* out = atlas_.data() + y * atlasStride;
+    for (size_t glyph = 0; glyph < kGlyphCount; glyph++) {
+      uint8_t bits = fontRow >= 0 && fontRow < kGlyphHeight ? kFont[glyph][fontRow] : 0;
+      for (int32_t x = 0; x < cellWidth_; x++, out += 4) {
+        int32_t fontColumn = x / scale;
+        bool set = fontColumn < kGlyphWidth && (bits >> (kGlyphWidth - 1 - fontColumn)) & 1;
+        memcpy(out, set ? foreground : background, 4);
+      }
+    }
+  }
+}
+
+void TextOverlay::update(int64_t captureNs) {
+  if (!config_.enabled()) {
+    return;
+  }
+  if (!config_.timestamp) {
+    if (label_.empty()) {
+      compose(config_.text);
+    }
+    return;
+  }
+  // The steady clock the capture time is on does not track wall time; the
+  // frame's age carries over.
+  int64_t age = steady_clock::now().time_since_epoch().count() - captureNs;
+  int64_t wallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+  int64_t second = (wallNs - std::max<int64_t>(age, 0)) / 1'000'000'000;
+  if (second == second_) {
+    return;
+  }
+  second_ = second;
+  time_t time = (time_t)second;
+  tm local{};
+  localtime_r(&time, &local);
+  char stamp[32];
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+  compose(config_.text.empty() ? std::string(stamp) : std::string(stamp) + "  " + config_.text);
+}
+
+void TextOverlay::compose(const std::string& text) {
+  if (text == text_ && !label_.empty()) {
+    return;
+  }
+  text_ = text;
+  int32_t scale = config_.scale;
+  // The background starts one font pixel before the first glyph; the last
+  // glyph's spacing closes it.
+  width_ = scale + (int32_t)text.size() * cellWidth_;
+  height_ = cellHeight_;
+  label_.resize((size_t)width_ * height_ * 4);
+  size_t atlasStride = (size_t)cellWidth_ * kGlyphCount * 4;
+  size_t cellBytes = (size_t)cellWidth_ * 4;
+  for (int32_t y = 0; y < height_; y++) {
+    uint8_t* out = label_.data() + (size_t)y * width_ * 4;
+    const uint8_t* atlasRow = atlas_.data() + y * atlasStride;
+    // The background of the space glyph.
+    memcpy(out, atlasRow, (size_t)scale * 4);
+    out += scale * 4;
+    for (char c : text) {
+      memcpy(out, atlasRow + glyphIndex(c) * cellBytes, cellBytes);
+      out += cellBytes;
+    }
+  }
+  revision_++;
+}
+
+void TextOverlay::place(int32_t width, int32_t height, int32_t& x, int32_t& y) const {
+  int32_t margin = 2 * config_.scale;
+  bool right = config_.corner == OverlayConfig::Corner::TOP_RIGHT ||
+      config_.corner == OverlayConfig::Corner::BOTTOM_RIGHT;
+  bool bottom = config_.corner == OverlayConfig::Corner::BOTTOM_LEFT ||
+      config_.corner == OverlayConfig::Corner::BOTTOM_RIGHT;
+  x = std::max(right ? width - margin - width_ : margin, 0);
+  y = std::max(bottom ? height - margin - height_ : margin, 0);
+}
+
+void TextOverlay::blendRows(
+    uint8_t* rgba,
+    int32_t stride,
+    int32_t width,
+    int32_t height,
+    int32_t row,
+    int32_t rows) const {
+  if (label_.empty()) {
+    return;
+  }
+  int32_t x = 0;
+  int32_t y = 0;
+  place(width, height, x, y);
+  int32_t first = std::max(y, row);
+  int32_t last = std::min({y + height_, row + rows, height});
+  int32_t columns = std::min(width_, width - x);
+  for (int32_t r = first; r < last; r++) {
+    const uint8_t* src = label_.data() + (size_t)(r - y) * width_ * 4;
+    uint8_t* dst = rgba + (size_t)r * stride + (size_t)x * 4;
+    int32_t i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 8 <= columns; i += 8) {
+      uint8x8x4_t s = vld4_u8(src + i * 4);
+      uint8x8x4_t d = vld4_u8(dst + i * 4);
+      uint8x8_t inverse = vmvn_u8(s.val[3]);
+      for (int c = 0; c < 4; c++) {
+        uint16x8_t product = vmull_u8(d.val[c], inverse);
+        d.val[c] = vqadd_u8(s.val[c], vraddhn_u16(product, vrshrq_n_u16(product, 8)));
+      }
+      vst4_u8(dst + i * 4, d);
+    }
+#endif
+    for (; i < columns; i++) {
+      uint32_t inverse = 255 - src[i * 4 + 3];
+      for (int c = 0; c < 4; c++) {
+        uint8_t* channel = dst + i * 4 + c;
+        *channel = (uint8_t)std::min<uint32_t>(src[i * 4 + c] + div255(*channel * inverse), 255);
+      }
+    }
+  }
+}
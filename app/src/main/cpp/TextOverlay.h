@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What TextOverlay burns into frames.
+struct OverlayConfig {
+  enum class Corner : uint8_t { TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT };
+
+  // The wall clock time the frame was captured, to the second.
+  bool timestamp{false};
+  // Drawn after the timestamp. Lower case is drawn upper case, characters
+  // beyond ASCII as '?'.
+  std::string text{};
+  Corner corner{Corner::BOTTOM_LEFT};
+  // Output pixels per font pixel, 1 to kMaxScale.
+  int32_t scale{2};
+  // ARGB, as Android colors.
+  uint32_t color{0xffffffff};
+
+  bool enabled() const {
+    return timestamp || !text.empty();
+  }
+};
+
+// A line of text, such as a capture timestamp or a watermark, burned into
+// RGBA frames as they are written.
+//
+// The glyphs of a 5x7 font are rendered once, at the configured scale and
+// color, into an atlas of premultiplied RGBA cells over a translucent
+// background. The label is composed from those cells only when its text
+// changes, once a second with a timestamp, and each frame only blends the
+// label's rectangle. The cost per frame is proportional to the label's area,
+// whatever the frame rate.
+//
+// configure() must not race with the other calls; update() and blendRows()
+// are called from the render thread.
+class TextOverlay final {
+ public:
+  static constexpr int32_t kGlyphWidth = 5;
+  static constexpr int32_t kGlyphHeight = 7;
+  static constexpr int32_t kMaxScale = 16;
+  static constexpr size_t kMaxTextLength = 128;
+  static constexpr uint8_t kBackgroundAlpha = 0x60;
+
+  void configure(const OverlayConfig& config);
+
+  bool enabled() const {
+    return config_.enabled();
+  }
+
+  // Lays the label out for a frame captured at captureNs, on the steady
+  // clock. Cheap unless the text changed.
+  void update(int64_t captureNs);
+
+  // Changes whenever the label does.
+  uint32_t revision() const {
+    return revision_;
+  }
+  int32_t width() const {
+    return width_;
+  }
+  int32_t height() const {
+    return height_;
+  }
+  // Premultiplied RGBA, width() * 4 bytes a row.
+  const uint8_t* pixels() const {
+    return label_.data();
+  }
+
+  // Top left corner of the label in a width x height image. Labels wider
+  // than the image lie partly outside it.
+  void place(int32_t width, int32_t height, int32_t& x, int32_t& y) const;
+
+  // Blends the label over rows [row, row + rows) of a width x height RGBA or
+  // RGBX image, stride bytes a row.
+  void blendRows(
+      uint8_t* rgba,
+      int32_t stride,
+      int32_t width,
+      int32_t height,
+      int32_t row,
+      int32_t rows) const;
+
+ private:
+  OverlayConfig config_{};
+  // One cell per glyph of the font, side by side.
+  std::vector<uint8_t> atlas_{};
+  int32_t cellWidth_{};
+  int32_t cellHeight_{};
+  std::vector<uint8_t> label_{};
+  int32_t width_{};
+  int32_t height_{};
+  std::string text_{};
+  int64_t second_{-1};
+  uint32_t revision_{};
+
+  void compose(const std::string& text);
+};
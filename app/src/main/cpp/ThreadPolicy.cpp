@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThreadPolicy.h"
+
+#include <android/log.h>
+#if defined(__ANDROID__)
+#include <android/api-level.h>
+#endif
+
+#include <dlfcn.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "ThreadPolicy", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "ThreadPolicy", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "ThreadPolicy", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "ThreadPolicy", __VA_ARGS__)
+
+static constexpr std::array<const char*, kThreadRoles> kRoleNames{
+    "USB events",
+    "capture",
+    "render",
+    "convert",
+};
+
+// Nice values are the platform's: ANDROID_PRIORITY_URGENT_AUDIO for the USB
+// completions feeding AAudio, ANDROID_PRIORITY_AUDIO for frame callbacks and
+// ANDROID_PRIORITY_URGENT_DISPLAY for the threads that produce the preview.
+static std::mutex policiesMutex;
+static std::array<ThreadPolicy, kThreadRoles> policies{{
+    {-19, 0, true, 0},
+    {-16, 0, true, 0},
+    {-8, 0, true, 0},
+    {-8, 0, true, 0},
+}};
+static std::array<EffectiveThreadPolicy, kThreadRoles> effectivePolicies{};
+
+struct TrackedThread {
+  pid_t tid;
+  // In clock ticks after boot, which tells the thread apart from a later one
+  // reusing its tid.
+  uint64_t startTime;
+  ThreadUsage usage;
+};
+// Guarded by policiesMutex.
+static std::array<std::vector<TrackedThread>, kThreadRoles> trackedThreads{};
+static std::array<ThreadUsage, kThreadRoles> exitedUsage{};
+
+static void addUsage(ThreadUsage& total, const ThreadUsage& usage) {
+  total.cpuTimeNs += usage.cpuTimeNs;
+  total.runDelayNs += usage.runDelayNs;
+  total.wakeups += usage.wakeups;
+  total.voluntarySwitches += usage.voluntarySwitches;
+  total.involuntarySwitches += usage.involuntarySwitches;
+}
+
+static FILE* openTaskFile(pid_t tid, const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/%s", tid, name);
+  return fopen(path, "re");
+}
+
+static bool readStartTime(pid_t tid, uint64_t& startTime) {
+  FILE* file = openTaskFile(tid, "stat");
+  if (file == nullptr) {
+    return false;
+  }
+  char stat[1024];
+  size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+  fclose(file);
+  stat[length] = '\0';
+  // The name is in parentheses and may hold spaces; start time is field 22.
+  const char* fields = strrchr(stat, ')');
+  if (fields == nullptr) {
+    return false;
+  }
+  unsigned long long value = 0;
+  int parsed = sscanf(
+      fields + 1,
+      " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+      &value);
+  startTime = value;
+  return parsed == 1;
+}
+
+static bool readCpuTime(clockid_t clock, ThreadUsage& usage) {
+  timespec cpuTime{};
+  if (clock_gettime(clock, &cpuTime) != 0) {
+    return false;
+  }
+  usage.cpuTimeNs = (uint64_t)cpuTime.tv_sec * 1'000'000'000 + cpuTime.tv_nsec;
+  return true;
+}
+
+// Time on a CPU, time waiting for one and times put on one.
+static void readSchedStat(pid_t tid, ThreadUsage& usage) {
+  if (FILE* file = openTaskFile(tid, "schedstat")) {
+    unsigned long long onCpuNs = 0;
+    unsigned long long delayNs = 0;
+    unsigned long long runs = 0;
+    if (fscanf(file, "%llu %llu %llu", &onCpuNs, &delayNs, &runs) == 3) {
+      usage.runDelayNs = delayNs;
+      usage.wakeups = runs;
+    }
+    fclose(file);
+  }
+}
+
+// Of another thread of the process. False once it exited.
+static bool readUsage(const TrackedThread& thread, ThreadUsage& usage) {
+  uint64_t startTime = 0;
+  if (!readStartTime(thread.tid, startTime) || startTime != thread.startTime) {
+    return false;
+  }
+  // Its CPU clock as pthread_getcpuclockid() makes it, which is
+  // CLOCK_THREAD_CPUTIME_ID seen from another thread.
+  if (!readCpuTime((clockid_t)((~(uint32_t)thread.tid << 3) | 6), usage)) {
+    return false;
+  }
+  readSchedStat(thread.tid, usage);
+  if (FILE* file = openTaskFile(thread.tid, "status")) {
+    char line[128];
+    unsigned long long value = 0;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1) {
+        usage.voluntarySwitches = value;
+      } else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1) {
+        usage.involuntarySwitches = value;
+      }
+    }
+    fclose(file);
+  }
+  return true;
+}
+
+// Counts the usage of a tracked thread that is about to exit.
+static void retireThread() {
+  pid_t tid = gettid();
+  ThreadUsage usage{};
+  readCpuTime(CLOCK_THREAD_CPUTIME_ID, usage);
+  readSchedStat(tid, usage);
+  rusage resources{};
+  if (getrusage(RUSAGE_THREAD, &resources) == 0) {
+    usage.voluntarySwitches = resources.ru_nvcsw;
+    usage.involuntarySwitches = resources.ru_nivcsw;
+  }
+  std::lock_guard lk(policiesMutex);
+  for (size_t i = 0; i < kThreadRoles; i++) {
+    std::vector<TrackedThread>& threads = trackedThreads[i];
+    auto it = std::find_if(threads.begin(), threads.end(), [tid](const TrackedThread& thread) {
+      return thread.tid == tid;
+    });
+    if (it != threads.end()) {
+      addUsage(exitedUsage[i], usage);
+      threads.erase(it);
+      return;
+    }
+  }
+}
+
+// Retires the thread when its thread_local objects are destroyed on exit.
+struct ThreadRetirer {
+  ~ThreadRetirer() {
+    retireThread();
+  }
+};
+
+// A thread applying a role again, or another one, moves to it.
+static void trackThread(ThreadRole role, pid_t tid) {
+  uint64_t startTime = 0;
+  if (!readStartTime(tid, startTime)) {
+    return;
+  }
+  for (size_t i = 0; i < kThreadRoles; i++) {
+    std::vector<TrackedThread>& threads = trackedThreads[i];
+    for (auto it = threads.begin(); it != threads.end();) {
+      if (it->tid == tid) {
+        addUsage(exitedUsage[i], it->usage);
+        it = threads.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  trackedThreads[(size_t)role].push_back({tid, startTime, {}});
+}
+
+static int64_t cpuMaxFrequency(int cpu) {
+  char path[96];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    return -1;
+  }
+  long long frequency = -1;
+  if (fscanf(file, "%lld", &frequency) != 1) {
+    frequency = -1;
+  }
+  fclose(file);
+  return frequency;
+}
+
+static std::vector<int> findPerformanceCores() {
+  int cpuCount = (int)sysconf(_SC_NPROCESSORS_CONF);
+  std::vector<int64_t> frequencies(cpuCount > 0 ? cpuCount : 0);
+  int64_t lowest = INT64_MAX;
+  int64_t highest = -1;
+  for (int cpu = 0; cpu < cpuCount; cpu++) {
+    frequencies[cpu] = cpuMaxFrequency(cpu);
+    if (frequencies[cpu] > 0) {
+      lowest = std::min(lowest, frequencies[cpu]);
+      highest = std::max(highest, frequencies[cpu]);
+    }
+  }
+  std::vector<int> cores;
+  for (int cpu = 0; cpu < cpuCount; cpu++) {
+    // Keep everything above the little cluster: big and prime cores.
+    if (highest < 0 || lowest == highest || frequencies[cpu] > lowest) {
+      cores.push_back(cpu);
+    }
+  }
+  return cores;
+}
+
+const std::vector<int>& ThreadPolicies::performanceCores() {
+  static const std::vector<int> cores = findPerformanceCores();
+  return cores;
+}
+
+void ThreadPolicies::set(ThreadRole role, const ThreadPolicy& policy) {
+  std::lock_guard lk(policiesMutex);
+  policies[(size_t)role] = policy;
+}
+
+ThreadPolicy ThreadPolicies::get(ThreadRole role) {
+  std::lock_guard lk(policiesMutex);
+  return policies[(size_t)role];
+}
+
+void ThreadPolicies::apply(ThreadRole role, const char* name) {
+  prctl(PR_SET_NAME, name);
+  ThreadPolicy policy = get(role);
+  pid_t tid = gettid();
+  bool fifo = false;
+  if (policy.fifoPriority > 0) {
+    sched_param param{};
+    param.sched_priority = policy.fifoPriority;
+    fifo = sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+    if (!fifo) {
+      ULOGW("No SCHED_FIFO for %s, using nice %d: %s", name, policy.nice, strerror(errno));
+    }
+  }
+  if (!fifo && setpriority(PRIO_PROCESS, tid, policy.nice) != 0) {
+    ULOGW("Could not set the priority of %s to %d: %s", name, policy.nice, strerror(errno));
+  }
+  if (policy.performanceCores) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int core : performanceCores()) {
+      CPU_SET(core, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      ULOGW("Could not pin %s to performance cores: %s", name, strerror(errno));
+    }
+  }
+
+  EffectiveThreadPolicy effective{};
+  effective.tid = tid;
+  effective.schedPolicy = sched_getscheduler(0);
+  if (effective.schedPolicy == SCHED_FIFO) {
+    sched_param param{};
+    sched_getparam(0, &param);
+    effective.priority = param.sched_priority;
+  } else {
+    effective.priority = getpriority(PRIO_PROCESS, tid);
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    for (int cpu = 0; cpu < 64; cpu++) {
+      if (CPU_ISSET(cpu, &cpus)) {
+        effective.cpuMask |= 1ull << cpu;
+      }
+    }
+  }
+  {
+    std::lock_guard lk(policiesMutex);
+    EffectiveThreadPolicy& recorded = effectivePolicies[(size_t)role];
+    effective.hintSessions = recorded.hintSessions;
+    effective.threads = recorded.threads + 1;
+    recorded = effective;
+    trackThread(role, tid);
+  }
+  static thread_local ThreadRetirer retirer;
+  ULOGD(
+      "%s: %s %d, cpus 0x%llx",
+      name,
+      effective.schedPolicy == SCHED_FIFO ? "fifo" : "nice",
+      effective.priority,
+      (unsigned long long)effective.cpuMask);
+}
+
+EffectiveThreadPolicy ThreadPolicies::effective(ThreadRole role) {
+  std::lock_guard lk(policiesMutex);
+  return effectivePolicies[(size_t)role];
+}
+
+ThreadUsage ThreadPolicies::usage(ThreadRole role) {
+  std::lock_guard lk(policiesMutex);
+  std::vector<TrackedThread>& threads = trackedThreads[(size_t)role];
+  ThreadUsage& exited = exitedUsage[(size_t)role];
+  ThreadUsage total = exited;
+  for (auto it = threads.begin(); it != threads.end();) {
+    if (readUsage(*it, it->usage)) {
+      addUsage(total, it->usage);
+      total.threads++;
+      ++it;
+    } else {
+      // Counted up to the last read before it exited.
+      addUsage(exited, it->usage);
+      addUsage(total, it->usage);
+      it = threads.erase(it);
+    }
+  }
+  return total;
+}
+
+void ThreadPolicies::recordHintSession(ThreadRole role, int32_t delta) {
+  std::lock_guard lk(policiesMutex);
+  effectivePolicies[(size_t)role].hintSessions += delta;
+}
+
+std::string ThreadPolicies::summary() {
+  std::string result;
+  for (size_t i = 0; i < kThreadRoles; i++) {
+    EffectiveThreadPolicy policy = effective((ThreadRole)i);
+    if (policy.threads == 0) {
+      continue;
+    }
+    ThreadUsage usage = ThreadPolicies::usage((ThreadRole)i);
+    char line[256];
+    snprintf(
+        line,
+        sizeof(line),
+        "%s thread %d: %s %d cpus 0x%llx hint sessions %u, cpu %.2f s, run delay %.2f s, "
+        "%llu wakeups, %llu voluntary and %llu involuntary switches\n",
+        kRoleNames[i],
+        policy.tid,
+        policy.schedPolicy == SCHED_FIFO ? "fifo" : "nice",
+        policy.priority,
+        (unsigned long long)policy.cpuMask,
+        policy.hintSessions,
+        usage.cpuTimeNs / 1e9,
+        usage.runDelayNs / 1e9,
+        (unsigned long long)usage.wakeups,
+        (unsigned long long)usage.voluntarySwitches,
+        (unsigned long long)usage.involuntarySwitches);
+    result += line;
+  }
+  return result;
+}
+
+namespace {
+
+// The APerformanceHint calls, looked up at run time since they are newer
+// than our minSdk.
+struct HintApi {
+  void* (*getManager)(){};
+  void* (*createSession)(void*, const int32_t*, size_t, int64_t){};
+  int (*reportActualWorkDuration)(void*, int64_t){};
+  void (*closeSession)(void*){};
+  void* manager{};
+};
+
+const HintApi* hintApi() {
+  static const HintApi api = [] {
+    HintApi api{};
+#if defined(__ANDROID__)
+    if (android_get_device_api_level() < 33) {
+      return api;
+    }
+    void* library = dlopen("libandroid.so", RTLD_NOW);
+    if (library == nullptr) {
+      return api;
+    }
+    api.getManager = (void* (*)())dlsym(library, "APerformanceHint_getManager");
+    api.createSession = (void* (*)(void*, const int32_t*, size_t, int64_t))dlsym(
+        library, "APerformanceHint_createSession");
+    api.reportActualWorkDuration =
+        (int (*)(void*, int64_t))dlsym(library, "APerformanceHint_reportActualWorkDuration");
+    api.closeSession = (void (*)(void*))dlsym(library, "APerformanceHint_closeSession");
+    if (api.getManager != nullptr) {
+      api.manager = api.getManager();
+    }
+#endif
+    return api;
+  }();
+  bool available = api.manager != nullptr && api.createSession != nullptr &&
+      api.reportActualWorkDuration != nullptr && api.closeSession != nullptr;
+  return available ? &api : nullptr;
+}
+
+} // namespace
+
+PerformanceHint::~PerformanceHint() {
+  close();
+}
+
+void PerformanceHint::open(ThreadRole role, int64_t targetWorkNs) {
+  close();
+  int64_t policyTargetNs = ThreadPolicies::get(role).targetWorkNs;
+  if (policyTargetNs != 0) {
+    targetWorkNs = policyTargetNs;
+  }
+  const HintApi* api = hintApi();
+  if (targetWorkNs <= 0 || api == nullptr) {
+    return;
+  }
+  int32_t tid = gettid();
+  session_ = api->createSession(api->manager, &tid, 1, targetWorkNs);
+  if (session_ == nullptr) {
+    ULOGW("No performance hint session for the %s thread", kRoleNames[(size_t)role]);
+    return;
+  }
+  role_ = role;
+  ThreadPolicies::recordHintSession(role, 1);
+  ULOGI(
+      "Performance hint session for the %s thread, target %.2f ms",
+      kRoleNames[(size_t)role],
+      targetWorkNs / 1e6);
+}
+
+void PerformanceHint::close() {
+  if (session_ == nullptr) {
+    return;
+  }
+  hintApi()->closeSession(session_);
+  session_ = nullptr;
+  ThreadPolicies::recordHintSession(role_, -1);
+}
+
+void PerformanceHint::reportWork(int64_t durationNs) {
+  if (session_ != nullptr && durationNs > 0) {
+    hintApi()->reportActualWorkDuration(session_, durationNs);
+  }
+}
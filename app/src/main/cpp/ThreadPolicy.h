@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The native threads we own, in the order of ThreadRole in UsbVideoNativeLibrary.kt.
+enum class ThreadRole : int {
+  USB_EVENTS, // UsbSession's event thread
+  CAPTURE, // libuvc's callback thread, when frame callbacks are not inline
+  RENDER,
+  CONVERT, // TaskScheduler workers
+};
+
+static constexpr size_t kThreadRoles = 4;
+
+// How a thread of some role is scheduled.
+struct ThreadPolicy {
+  // Used when fifoPriority is 0, or when SCHED_FIFO is not permitted.
+  int32_t nice{};
+  // SCHED_FIFO priority, 1 to 99. Apps usually lack the permission for it.
+  int32_t fifoPriority{};
+  // Keeps the thread off the little cores.
+  bool performanceCores{};
+  // Target duration of one unit of work for the role's ADPF hint sessions
+  // (API 33), replacing the frame or transfer period the streamers pick.
+  // Zero keeps theirs, negative opens none.
+  int64_t targetWorkNs{};
+};
+
+// What a thread of the role actually got, from the kernel after applying.
+struct EffectiveThreadPolicy {
+  int32_t tid{};
+  int32_t schedPolicy{}; // SCHED_OTHER or SCHED_FIFO
+  int32_t priority{}; // nice for SCHED_OTHER, the realtime priority otherwise
+  uint64_t cpuMask{}; // first 64 CPUs
+  uint32_t hintSessions{}; // open ADPF sessions, one per streamer
+  uint32_t threads{}; // applied so far, several for CONVERT
+};
+
+// How much a role's threads ran so far, from the kernel's accounting of each
+// thread. Threads that exited keep being counted.
+struct ThreadUsage {
+  uint64_t cpuTimeNs{};
+  // Runnable but waiting for a CPU.
+  uint64_t runDelayNs{};
+  // Times put on a CPU: wakeups, and resumptions after being preempted.
+  uint64_t wakeups{};
+  uint64_t voluntarySwitches{}; // blocked, such as waiting for the next frame
+  uint64_t involuntarySwitches{}; // preempted
+  uint32_t threads{}; // still running
+};
+
+// Process wide scheduling policies of our native threads.
+//
+// Each thread calls apply() for its role when it starts, which names it and
+// sets its priority and CPU affinity. New policies take effect on threads
+// started afterwards, so set them before streaming. What each role got is
+// kept for stats, as some settings need permissions the app may not have.
+class ThreadPolicies final {
+ public:
+  static void set(ThreadRole role, const ThreadPolicy& policy);
+  static ThreadPolicy get(ThreadRole role);
+
+  // Names the calling thread and applies the role's policy. Failures are
+  // logged and leave the thread as it was.
+  static void apply(ThreadRole role, const char* name);
+
+  static EffectiveThreadPolicy effective(ThreadRole role);
+  // Reads the accounting of every thread that applied the role from /proc,
+  // on the order of 10 us per thread.
+  static ThreadUsage usage(ThreadRole role);
+  // One line per role that was applied, for the stats summary.
+  static std::string summary();
+
+  // CPUs above the lowest maximum frequency, or all CPUs if they are equal.
+  static const std::vector<int>& performanceCores();
+
+ private:
+  static void recordHintSession(ThreadRole role, int32_t delta);
+  friend class PerformanceHint;
+};
+
+// ADPF hint session of the calling thread, fed with the duration of each unit
+// of work so the governor clocks the CPU just high enough to finish it in
+// time, rather than ramping down between frames. Does nothing before API 33.
+class PerformanceHint final {
+ public:
+  // Reports the time until it goes out of scope as one unit of work.
+  class Work final {
+   public:
+    explicit Work(PerformanceHint& hint)
+        : hint_(hint),
+          start_(hint.isOpen() ? std::chrono::steady_clock::now()
+                               : std::chrono::steady_clock::time_point{}) {}
+    Work(const Work&) = delete;
+    Work& operator=(const Work&) = delete;
+    ~Work() {
+      if (hint_.isOpen()) {
+        hint_.reportWork((std::chrono::steady_clock::now() - start_).count());
+      }
+    }
+
+   private:
+    PerformanceHint& hint_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  PerformanceHint() = default;
+  PerformanceHint(const PerformanceHint&) = delete;
+  PerformanceHint& operator=(const PerformanceHint&) = delete;
+  ~PerformanceHint();
+
+  // On the thread doing the work. targetWorkNs is the work's deadline, such
+  // as the frame period, unless the role's policy sets one.
+  void open(ThreadRole role, int64_t targetWorkNs);
+  // From any thread, once the work stopped.
+  void close();
+  void reportWork(int64_t durationNs);
+
+  bool isOpen() const {
+    return session_ != nullptr;
+  }
+
+ private:
+  void* session_{};
+  ThreadRole role_{};
+};
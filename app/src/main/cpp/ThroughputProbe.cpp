@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ThroughputProbe.h"
+
+#include <android/log.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include "BusBandwidthPlanner.h"
+#include "ModeSelector.h"
+#include "NegotiationCache.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "ThroughputProbe", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "ThroughputProbe", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "ThroughputProbe", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "ThroughputProbe", __VA_ARGS__)
+
+using namespace std::chrono;
+
+namespace {
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+int deviceSpeed(UvcDevice& device) {
+  libusb_device* usbDevice = libusb_get_device(uvc_get_libusb_handle(device.handle()));
+  return usbDevice != nullptr ? libusb_get_device_speed(usbDevice) : LIBUSB_SPEED_UNKNOWN;
+}
+
+int64_t completedNs(const uvc_frame_t* frame) {
+  return frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+      frame->capture_time_finished.tv_nsec;
+}
+
+// The mode that sends the most: the largest uncompressed one, whose rate is
+// known, or else the largest MJPEG one.
+bool highestBandwidthMode(UvcDevice& device, ModeSelector::Candidate& mode) {
+  bool found = false;
+  for (const ModeSelector::Candidate& candidate : ModeSelector::rank(device, 0, 0)) {
+    bool compressed = candidate.format == UVC_FRAME_FORMAT_MJPEG;
+    bool modeCompressed = mode.format == UVC_FRAME_FORMAT_MJPEG;
+    if (!found || (modeCompressed && !compressed) ||
+        (compressed == modeCompressed && candidate.bytesPerSecond > mode.bytesPerSecond)) {
+      mode = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
+
+} // namespace
+
+ThroughputProbe& ThroughputProbe::shared() {
+  static ThroughputProbe* probe = new ThroughputProbe();
+  return *probe;
+}
+
+void ThroughputProbe::setDirectory(const std::string& directory) {
+  std::lock_guard lk(mutex_);
+  directory_ = directory;
+  results_.clear();
+}
+
+bool ThroughputProbe::find(UvcDevice& device, Result& result) {
+  std::string key = NegotiationCache::deviceKey(device.handle());
+  if (key.empty()) {
+    return false;
+  }
+  int speed = deviceSpeed(device);
+  std::lock_guard lk(mutex_);
+  auto it = results_.find(key);
+  if (it == results_.end() && !directory_.empty()) {
+    int fd = open(path(key).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      FileHeader header{};
+      Result stored{};
+      if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == kMagic &&
+          header.version == kVersion && read(fd, &stored, sizeof(stored)) == sizeof(stored)) {
+        it = results_.emplace(key, stored).first;
+      }
+      close(fd);
+    }
+  }
+  if (it == results_.end() || it->second.speed != speed) {
+    return false;
+  }
+  result = it->second;
+  return true;
+}
+
+bool ThroughputProbe::probe(UvcDevice& device, milliseconds duration, Result& result) {
+  ModeSelector::Candidate mode{};
+  if (!highestBandwidthMode(device, mode)) {
+    ULOGW("No mode to probe");
+    return false;
+  }
+  uvc_stream_ctrl_t ctrl;
+  uvc_error_t ret = uvc_get_stream_ctrl_format_size_on_interface(
+      device.handle(),
+      &ctrl,
+      mode.interfaceNumber,
+      mode.format,
+      mode.width,
+      mode.height,
+      mode.fps);
+  uvc_stream_handle_t* stream = nullptr;
+  if (ret == UVC_SUCCESS) {
+    ret = uvc_stream_open_ctrl(device.handle(), &stream, &ctrl);
+  }
+  if (ret != UVC_SUCCESS) {
+    ULOGE(
+        "Cannot open %dx%d@%d to probe: %s",
+        mode.width,
+        mode.height,
+        mode.fps,
+        uvc_strerror(ret));
+    return false;
+  }
+  device.addStream();
+  BusBandwidthPlanner& planner = BusBandwidthPlanner::shared();
+  {
+    // The first altsetting holding the mode's payloads, which is what the
+    // camera asks for without a planner.
+    std::lock_guard busLock(planner.startMutex());
+    std::lock_guard lk(device.startMutex());
+    uvc_stream_options_t options{};
+    ret = uvc_stream_start_with_options(
+        stream, nullptr, nullptr, UVC_STREAM_FLAG_POLLED_FRAMES, &options);
+    uvc_stream_bandwidth_t bandwidth{};
+    if (ret == UVC_SUCCESS) {
+      uvc_stream_get_bandwidth(stream, &bandwidth);
+    }
+    if (bandwidth.interval_us != 0) {
+      planner.reserve(
+          stream,
+          &device,
+          device.bus(),
+          (uint64_t)bandwidth.reserved_bytes * 1'000'000 / bandwidth.interval_us);
+    }
+  }
+  bool measured = false;
+  if (ret != UVC_SUCCESS) {
+    ULOGE(
+        "Cannot start %dx%d@%d to probe: %s",
+        mode.width,
+        mode.height,
+        mode.fps,
+        uvc_strerror(ret));
+  } else {
+    // Counted from the first frame, once the camera is up.
+    uvc_stream_transport_t first{};
+    uvc_stream_transport_t last{};
+    int64_t firstNs = 0;
+    int64_t lastNs = 0;
+    uint64_t frames = 0;
+    double meanUs = 0;
+    double m2 = 0;
+    steady_clock::time_point deadline = steady_clock::now() + kFirstFrameTimeout;
+    while (steady_clock::now() < deadline) {
+      uvc_frame_t* frame = nullptr;
+      if (uvc_stream_acquire_frame(stream, &frame, 100'000) != UVC_SUCCESS || frame == nullptr) {
+        continue;
+      }
+      int64_t ns = completedNs(frame);
+      uvc_release_frame(frame);
+      if (firstNs == 0) {
+        uvc_stream_get_transport(stream, &first);
+        firstNs = ns;
+        deadline = steady_clock::now() + duration;
+      } else {
+        uvc_stream_get_transport(stream, &last);
+        // Welford's running variance of the completion intervals.
+        double intervalUs = (ns - lastNs) / 1e3;
+        frames++;
+        double delta = intervalUs - meanUs;
+        meanUs += delta / frames;
+        m2 += delta * (intervalUs - meanUs);
+      }
+      lastNs = ns;
+    }
+    uvc_stream_stop(stream);
+    if (frames > 0) {
+      double seconds = (lastNs - firstNs) / 1e9;
+      uint64_t packets = last.packets - first.packets;
+      result = {
+          .interfaceNumber = mode.interfaceNumber,
+          .format = mode.format,
+          .width = mode.width,
+          .height = mode.height,
+          .fps = mode.fps,
+          .speed = deviceSpeed(device),
+          .modeBytesPerSecond = mode.bytesPerSecond,
+          .bytesPerSecond = (uint64_t)((last.bytes - first.bytes) / seconds),
+          .packetErrorRate =
+              packets > 0 ? (double)(last.packet_errors - first.packet_errors) / packets : 0,
+          .framesPerSecond = frames / seconds,
+          .frameJitterUs = std::sqrt(m2 / frames),
+      };
+      measured = true;
+    } else {
+      ULOGW("No frames of %dx%d@%d while probing", mode.width, mode.height, mode.fps);
+    }
+  }
+  uvc_stream_close(stream);
+  planner.release(stream);
+  device.removeStream();
+  if (!measured) {
+    return false;
+  }
+  ULOGI(
+      "Format %d %dx%d@%d: %.1f of %.1f MB/s, %.2f fps, %.3f%% packet errors, %.0f us jitter%s",
+      result.format,
+      result.width,
+      result.height,
+      result.fps,
+      result.bytesPerSecond / 1e6,
+      result.modeBytesPerSecond / 1e6,
+      result.framesPerSecond,
+      result.packetErrorRate * 100,
+      result.frameJitterUs,
+      result.keptUp() ? "" : ", fell short");
+
+  std::string key = NegotiationCache::deviceKey(device.handle());
+  if (key.empty()) {
+    return true;
+  }
+  std::lock_guard lk(mutex_);
+  results_[key] = result;
+  if (directory_.empty()) {
+    return true;
+  }
+  // Written aside and renamed, like the negotiation cache.
+  std::string target = path(key);
+  std::string temporary = target + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ULOGE("Cannot write %s: %s", temporary.c_str(), strerror(errno));
+    return true;
+  }
+  FileHeader header{kMagic, kVersion};
+  bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+      write(fd, &result, sizeof(result)) == sizeof(result);
+  close(fd);
+  if (!written || rename(temporary.c_str(), target.c_str()) != 0) {
+    ULOGE("Cannot write %s: %s", target.c_str(), strerror(errno));
+    unlink(temporary.c_str());
+  }
+  return true;
+}
+
+std::string ThroughputProbe::path(const std::string& deviceKey) const {
+  return directory_ + "/uvc_throughput_" + deviceKey + ".bin";
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "UvcDevice.h"
+
+// What a camera's USB path sustains, the phone's controller, the cable and
+// any hub included, which the bus speed it advertises says little about.
+// probe() streams the camera's highest bandwidth mode for a few seconds
+// without converting a frame and measures the bytes that completed, the
+// packet error rate and how evenly frames completed. Results are kept in one
+// small file per camera next to the negotiation cache, so a camera is probed
+// once per bus speed, and ModeSelector ranks modes above a path's ceiling as
+// not fitting the bus.
+class ThroughputProbe final {
+ public:
+  struct Result {
+    int32_t interfaceNumber;
+    int32_t format; // uvc_frame_format
+    int32_t width;
+    int32_t height;
+    int32_t fps;
+    // libusb speed of the bus while probing.
+    int32_t speed;
+    // What the mode sends, estimated for MJPEG.
+    uint64_t modeBytesPerSecond;
+    // Completed, payload headers included.
+    uint64_t bytesPerSecond;
+    double packetErrorRate;
+    double framesPerSecond;
+    // Standard deviation of the intervals between frame completions.
+    double frameJitterUs;
+
+    // The mode streamed at its rate without notable packet errors.
+    bool keptUp() const {
+      return framesPerSecond >= fps * kMinFrameRateRatio && packetErrorRate <= kMaxPacketErrorRate;
+    }
+    // Bytes per second modes must stay under, zero for no ceiling below the
+    // bus's when the path kept up.
+    uint64_t ceiling() const {
+      return keptUp() ? 0 : bytesPerSecond;
+    }
+  };
+
+  static constexpr std::chrono::milliseconds kDefaultDuration{3000};
+  // Kept up at this share of the mode's frame rate, and this packet error rate.
+  static constexpr double kMinFrameRateRatio = 0.9;
+  static constexpr double kMaxPacketErrorRate = 0.01;
+  // For the first frame, which cameras take a while to send.
+  static constexpr std::chrono::milliseconds kFirstFrameTimeout{2000};
+
+  static ThroughputProbe& shared();
+
+  // Where the files live, typically the app's cache directory. Nothing is
+  // kept until it is set.
+  void setDirectory(const std::string& directory);
+
+  // The result of an earlier probe of the camera at its current bus speed.
+  bool find(UvcDevice& device, Result& result);
+  // Streams for duration, blocking, and keeps the result. None of the
+  // camera's streams may be running. False when no mode could be streamed.
+  bool probe(UvcDevice& device, std::chrono::milliseconds duration, Result& result);
+
+ private:
+  static constexpr uint32_t kMagic = 0x54505655; // "UVPT"
+  static constexpr uint32_t kVersion = 1;
+
+  std::mutex mutex_;
+  std::string directory_{};
+  // Results read or measured since the directory was set, by device key.
+  std::map<std::string, Result> results_{};
+
+  ThroughputProbe() = default;
+  std::string path(const std::string& deviceKey) const;
+};
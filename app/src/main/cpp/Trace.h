@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// ATrace sections and counters for system traces. Built with
+// USB_VIDEO_TRACING, see CMakeLists.txt; otherwise they compile to nothing.
+// Names must be string literals.
+
+#ifdef USB_VIDEO_TRACING
+
+#include <android/trace.h>
+
+class ScopedTrace final {
+ public:
+  explicit ScopedTrace(const char* name) {
+    ATrace_beginSection(name);
+  }
+  ScopedTrace(const ScopedTrace&) = delete;
+  ScopedTrace& operator=(const ScopedTrace&) = delete;
+  ~ScopedTrace() {
+    ATrace_endSection();
+  }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) ScopedTrace TRACE_CONCAT(scopedTrace, __LINE__)(name)
+#define TRACE_COUNTER(name, value) ATrace_setCounter(name, (int64_t)(value))
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+
+#endif
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "UacDescriptors.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr uint8_t kSubclassAudioControl = 0x01;
+constexpr uint8_t kSubclassAudioStreaming = 0x02;
+// bInterfaceProtocol of UAC 2.0 interfaces.
+constexpr uint8_t kProtocolUac2 = 0x20;
+constexpr uint8_t kCsInterface = 0x24;
+constexpr uint8_t kCsEndpoint = 0x25;
+
+// Audio control subtypes.
+constexpr uint8_t kAcHeader = 0x01;
+constexpr uint8_t kAcInputTerminal = 0x02;
+constexpr uint8_t kAcOutputTerminal = 0x03;
+constexpr uint8_t kAcSelectorUnit = 0x05;
+constexpr uint8_t kAcFeatureUnit = 0x06;
+constexpr uint8_t kAcClockSelector = 0x0b;
+
+// Audio streaming subtypes.
+constexpr uint8_t kAsGeneral = 0x01;
+constexpr uint8_t kAsFormatType = 0x02;
+constexpr uint8_t kFormatTypeI = 0x01;
+constexpr uint8_t kEpGeneral = 0x01;
+
+// UAC 2.0 bmFormats of Type I.
+constexpr uint32_t kUac2Pcm = 1 << 0;
+constexpr uint32_t kUac2IeeeFloat = 1 << 2;
+
+uint32_t le16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+uint32_t le24(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+uint32_t le32(const uint8_t* p) {
+  return le24(p) | ((uint32_t)p[3] << 24);
+}
+
+// Calls visit(descriptor, length) for every descriptor in extra.
+template <typename Visit>
+void forEachDescriptor(const unsigned char* extra, int length, Visit visit) {
+  int offset = 0;
+  while (extra != nullptr && offset + 2 <= length) {
+    uint8_t descriptorLength = extra[offset];
+    if (descriptorLength < 2 || offset + descriptorLength > length) {
+      return;
+    }
+    visit(extra + offset, descriptorLength);
+    offset += descriptorLength;
+  }
+}
+
+} // namespace
+
+bool UacStreamingAltsetting::supportsRate(uint32_t rate) const {
+  if (sampleRates.empty()) {
+    // UAC 2.0, or a descriptor without rates: the clock source decides.
+    return true;
+  }
+  if (continuousRates) {
+    return sampleRates.size() >= 2 && rate >= sampleRates[0] && rate <= sampleRates[1];
+  }
+  return std::find(sampleRates.begin(), sampleRates.end(), rate) != sampleRates.end();
+}
+
+UacDescriptors UacDescriptors::parse(const libusb_config_descriptor* config) {
+  UacDescriptors descriptors;
+  if (config == nullptr) {
+    return descriptors;
+  }
+  for (int i = 0; i < config->bNumInterfaces; i++) {
+    const libusb_interface& interface = config->interface[i];
+    for (int j = 0; j < interface.num_altsetting; j++) {
+      const libusb_interface_descriptor& altsetting = interface.altsetting[j];
+      if (altsetting.bInterfaceClass != LIBUSB_CLASS_AUDIO) {
+        continue;
+      }
+      if (altsetting.bInterfaceSubClass == kSubclassAudioControl && descriptors.version == 0) {
+        descriptors.parseControl(altsetting);
+        continue;
+      }
+      UacStreamingAltsetting streaming;
+      if (altsetting.bInterfaceSubClass == kSubclassAudioStreaming &&
+          parseStreaming(altsetting, altsetting.bInterfaceProtocol == kProtocolUac2, streaming)) {
+        descriptors.altsettings.push_back(std::move(streaming));
+      }
+    }
+  }
+  for (UacStreamingAltsetting& altsetting : descriptors.altsettings) {
+    if (altsetting.channelConfig == 0) {
+      altsetting.channelConfig = descriptors.channelConfig(altsetting.terminalLink);
+    }
+  }
+  return descriptors;
+}
+
+uint8_t UacDescriptors::clockSource(uint8_t terminalLink) const {
+  for (const TerminalClock& terminal : terminalClocks_) {
+    if (terminal.terminal != terminalLink) {
+      continue;
+    }
+    for (const TerminalClock& selector : selectorInputs_) {
+      if (selector.terminal == terminal.clock) {
+        return selector.clock;
+      }
+    }
+    return terminal.clock;
+  }
+  return 0;
+}
+
+uint32_t UacDescriptors::channelConfig(uint8_t terminalLink) const {
+  uint8_t entity = terminalLink;
+  // Bounded by the entity count, in case the descriptors loop.
+  for (size_t hops = 0; entity != 0 && hops <= clusterSources_.size(); hops++) {
+    auto it = std::find_if(
+        clusterSources_.begin(), clusterSources_.end(), [entity](const ClusterSource& source) {
+          return source.entity == entity;
+        });
+    if (it == clusterSources_.end()) {
+      return 0;
+    }
+    if (it->source == 0) {
+      return it->channelConfig;
+    }
+    entity = it->source;
+  }
+  return 0;
+}
+
+void UacDescriptors::parseControl(const libusb_interface_descriptor& interface) {
+  controlInterface = interface.bInterfaceNumber;
+  bool uac2 = interface.bInterfaceProtocol == kProtocolUac2;
+  version = uac2 ? 0x0200 : 0x0100;
+  forEachDescriptor(interface.extra, interface.extra_length, [&](const uint8_t* d, uint8_t length) {
+    if (d[1] != kCsInterface || length < 4) {
+      return;
+    }
+    switch (d[2]) {
+      case kAcHeader:
+        if (length >= 5) {
+          version = le16(d + 3);
+        }
+        break;
+      case kAcInputTerminal:
+        if (uac2 && length >= 13) {
+          terminalClocks_.push_back({d[3], d[7]});
+          clusterSources_.push_back({d[3], 0, le32(d + 9)});
+        } else if (!uac2 && length >= 10) {
+          clusterSources_.push_back({d[3], 0, le16(d + 8)});
+        }
+        break;
+      case kAcOutputTerminal:
+        if (uac2 && length >= 9) {
+          terminalClocks_.push_back({d[3], d[8]});
+        }
+        if (length >= 8) {
+          clusterSources_.push_back({d[3], d[7], 0});
+        }
+        break;
+      case kAcFeatureUnit:
+        if (length >= 5) {
+          clusterSources_.push_back({d[3], d[4], 0});
+        }
+        break;
+      case kAcSelectorUnit:
+        // Every input of a selector carries the same cluster.
+        if (length >= 6 && d[4] > 0) {
+          clusterSources_.push_back({d[3], d[5], 0});
+        }
+        break;
+      case kAcClockSelector:
+        if (uac2 && length >= 6 && d[4] > 0) {
+          selectorInputs_.push_back({d[3], d[5]});
+        }
+        break;
+    }
+  });
+}
+
+bool UacDescriptors::parseStreaming(
+    const libusb_interface_descriptor& interface,
+    bool uac2,
+    UacStreamingAltsetting& altsetting) {
+  const libusb_endpoint_descriptor* data = nullptr;
+  for (int k = 0; k < interface.bNumEndpoints; k++) {
+    const libusb_endpoint_descriptor& endpoint = interface.endpoint[k];
+    bool isochronous =
+        (endpoint.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    // Usage type, bits 4..5: data, feedback or implicit feedback data.
+    uint8_t usage = (endpoint.bmAttributes >> 4) & 0x3;
+    if (isochronous && (endpoint.bEndpointAddress & LIBUSB_ENDPOINT_IN) != 0 && usage != 1 &&
+        data == nullptr) {
+      data = &endpoint;
+    }
+  }
+  if (data == nullptr) {
+    return false;
+  }
+  altsetting.interfaceNumber = interface.bInterfaceNumber;
+  altsetting.altsetting = interface.bAlternateSetting;
+  altsetting.endpointAddress = data->bEndpointAddress;
+  altsetting.maxPacketBytes =
+      (data->wMaxPacketSize & 0x7ff) * (1 + ((data->wMaxPacketSize >> 11) & 0x3));
+  altsetting.interval = data->bInterval;
+  altsetting.syncType = static_cast<UacSyncType>((data->bmAttributes >> 2) & 0x3);
+
+  for (int k = 0; k < interface.bNumEndpoints; k++) {
+    const libusb_endpoint_descriptor& endpoint = interface.endpoint[k];
+    // UAC 1.0 names it in bSynchAddress, UAC 2.0 by its usage type.
+    bool feedback = uac2
+        ? ((endpoint.bmAttributes >> 4) & 0x3) == 1
+        : data->bSynchAddress != 0 && endpoint.bEndpointAddress == data->bSynchAddress;
+    if (feedback && &endpoint != data && (endpoint.bEndpointAddress & LIBUSB_ENDPOINT_IN) != 0) {
+      altsetting.feedbackAddress = endpoint.bEndpointAddress;
+      altsetting.feedbackPacketBytes = endpoint.wMaxPacketSize & 0x7ff;
+    }
+  }
+
+  forEachDescriptor(data->extra, data->extra_length, [&](const uint8_t* d, uint8_t length) {
+    if (d[1] == kCsEndpoint && d[2] == kEpGeneral && length >= 4 && !uac2) {
+      altsetting.hasSampleRateControl = (d[3] & 0x1) != 0;
+    }
+  });
+
+  bool hasFormat = false;
+  forEachDescriptor(interface.extra, interface.extra_length, [&](const uint8_t* d, uint8_t length) {
+    if (d[1] != kCsInterface || length < 4) {
+      return;
+    }
+    if (d[2] == kAsGeneral && uac2 && length >= 16) {
+      altsetting.terminalLink = d[3];
+      uint32_t formats = le32(d + 6);
+      if ((formats & kUac2Pcm) != 0) {
+        altsetting.formatTag = kFormatPcm;
+      } else if ((formats & kUac2IeeeFloat) != 0) {
+        altsetting.formatTag = kFormatIeeeFloat;
+      }
+      altsetting.channelCount = d[10];
+      altsetting.channelConfig = le32(d + 11);
+    } else if (d[2] == kAsGeneral && !uac2 && length >= 7) {
+      altsetting.terminalLink = d[3];
+      altsetting.formatTag = le16(d + 5);
+    } else if (d[2] == kAsFormatType && d[3] == kFormatTypeI && uac2 && length >= 6) {
+      altsetting.subframeSize = d[4];
+      altsetting.bitResolution = d[5];
+      hasFormat = true;
+    } else if (d[2] == kAsFormatType && d[3] == kFormatTypeI && !uac2 && length >= 8) {
+      altsetting.channelCount = d[4];
+      altsetting.subframeSize = d[5];
+      altsetting.bitResolution = d[6];
+      uint8_t rateCount = d[7];
+      altsetting.continuousRates = rateCount == 0;
+      size_t rates = altsetting.continuousRates ? 2 : rateCount;
+      for (size_t r = 0; r < rates && 8 + 3 * (r + 1) <= length; r++) {
+        altsetting.sampleRates.push_back(le24(d + 8 + 3 * r));
+      }
+      hasFormat = true;
+    }
+  });
+  return hasFormat;
+}
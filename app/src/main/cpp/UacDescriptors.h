@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libusb/libusb.h>
+#include <cstdint>
+#include <vector>
+
+// Synchronization type of an isochronous endpoint, bmAttributes bits 2..3.
+enum class UacSyncType : uint8_t {
+  NONE = 0,
+  ASYNC = 1,
+  ADAPTIVE = 2,
+  SYNC = 3,
+};
+
+// One altsetting of an audio streaming interface with an isochronous IN
+// endpoint, as its UAC 1.0 or 2.0 class specific descriptors describe it.
+struct UacStreamingAltsetting {
+  uint8_t interfaceNumber{};
+  uint8_t altsetting{};
+  uint8_t terminalLink{};
+  // wFormatTag of UAC 1.0; UAC 2.0's bmFormats maps to the same values.
+  uint16_t formatTag{};
+  uint8_t channelCount{};
+  // Spatial positions of the channels, the cluster's bmChannelConfig; zero
+  // when the device does not report them.
+  uint32_t channelConfig{};
+  uint8_t subframeSize{};
+  uint8_t bitResolution{};
+  // UAC 1.0 only; UAC 2.0 rates belong to the clock source.
+  std::vector<uint32_t> sampleRates{};
+  bool continuousRates{false}; // sampleRates holds the lower and upper bound
+  bool hasSampleRateControl{false};
+
+  uint8_t endpointAddress{};
+  // Bytes per service interval, high bandwidth transactions included.
+  uint32_t maxPacketBytes{};
+  uint8_t interval{}; // bInterval
+  UacSyncType syncType{UacSyncType::NONE};
+  // Explicit feedback endpoint, zero without one.
+  uint8_t feedbackAddress{};
+  uint16_t feedbackPacketBytes{};
+
+  bool supportsRate(uint32_t rate) const;
+};
+
+// Audio control and streaming descriptors of a configuration.
+struct UacDescriptors {
+  static constexpr uint16_t kFormatPcm = 0x0001;
+  static constexpr uint16_t kFormatIeeeFloat = 0x0003;
+
+  // 0x0100 or 0x0200, zero without an audio control interface.
+  uint16_t version{};
+  uint8_t controlInterface{};
+  std::vector<UacStreamingAltsetting> altsettings{};
+
+  static UacDescriptors parse(const libusb_config_descriptor* config);
+
+  // UAC 2.0 clock source of the streaming terminal, zero when unknown.
+  uint8_t clockSource(uint8_t terminalLink) const;
+
+  // Channel positions of the cluster reaching the streaming terminal, as the
+  // input terminal it comes from describes it. Zero when unknown.
+  uint32_t channelConfig(uint8_t terminalLink) const;
+
+ private:
+  struct TerminalClock {
+    uint8_t terminal;
+    uint8_t clock;
+  };
+  std::vector<TerminalClock> terminalClocks_{};
+  // Clock selectors, resolved to their first input.
+  std::vector<TerminalClock> selectorInputs_{};
+  // Terminals and units with the entity they take their cluster from, or the
+  // channel positions for input terminals.
+  struct ClusterSource {
+    uint8_t entity;
+    uint8_t source;
+    uint32_t channelConfig;
+  };
+  std::vector<ClusterSource> clusterSources_{};
+
+  void parseControl(const libusb_interface_descriptor& interface);
+  static bool parseStreaming(
+      const libusb_interface_descriptor& interface,
+      bool uac2,
+      UacStreamingAltsetting& altsetting);
+};
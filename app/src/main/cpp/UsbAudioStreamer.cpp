@@ -17,12 +17,24 @@
 #include "UsbAudioStreamer.h"
 
 #include <aaudio/AAudio.h>
+#include <android/api-level.h>
 #include <android/log.h>
 #include <libusb/libusb.h>
 
+#include <unistd.h>
+#include <cerrno>
+#include <array>
+#include <cmath>
+#include <cstring>
 #include <format>
 #include <memory>
+#include "AvSync.h"
+#include "BusBandwidthPlanner.h"
+#include "HotLog.h"
+#include "RealtimeCheck.h"
 #include "RingBuffer.h"
+#include "StreamWatchdog.h"
+#include "Trace.h"
 #include "aaudio_type_conversion.h"
 
 #define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "UsbAudioStreamer", __VA_ARGS__)
@@ -33,16 +45,66 @@
 
 #define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "UsbAudioStreamer", __VA_ARGS__)
 
+// For the USB event thread, see HotLog.
+#define HLOGD(...) HOT_LOG(ANDROID_LOG_DEBUG, "UsbAudioStreamer", __VA_ARGS__)
+#define HLOGI(...) HOT_LOG(ANDROID_LOG_INFO, "UsbAudioStreamer", __VA_ARGS__)
+#define HLOGE(...) HOT_LOG(ANDROID_LOG_ERROR, "UsbAudioStreamer", __VA_ARGS__)
+#define HLOGE_EVERY(interval, ...) \
+  HOT_LOG_EVERY(ANDROID_LOG_ERROR, "UsbAudioStreamer", interval, __VA_ARGS__)
+
 UsbAudioStreamer::~UsbAudioStreamer() {
+  StreamWatchdog::shared().unwatch(this);
+  state_ = StreamerState::DESTROYING;
+  // The session's event thread outlives this streamer, so no completion may
+  // still be pending once the transfers are freed.
+  cancelTransfers();
+  if (!waitForTransfers()) {
+    ULOGE("Transfers still active after cancellation");
+  }
   if (audioStream_ != nullptr) {
     AAudioStream_close(audioStream_);
     audioStream_ = nullptr;
   }
 
-  state_ = StreamerState::DESTROYING;
+  // Buffers in usbfs memory are unmapped through the device handle.
+  transfers_.clear();
+  feedback_ = nullptr;
+  closeDevice();
+
+  audioTap_.attach(nullptr, 0, 0);
+  ringBuffer_ = nullptr;
+
+  ULOGI("UsbAudioStreamer destroyed");
+  state_ = StreamerState::DESTROYED;
+}
+
+bool UsbAudioStreamer::openDevice(intptr_t deviceFD) {
+  // A duplicate, so teardown can outlive the app's UsbDeviceConnection.
+  deviceFD_ = dup((int)deviceFD);
+  if (deviceFD_ < 0) {
+    ULOGE("dup of fd %d failed: %s", (int)deviceFD, strerror(errno));
+    return false;
+  }
+  int errcode = libusb_wrap_sys_device(context_, deviceFD_, &deviceHandle_);
+  if (errcode != LIBUSB_SUCCESS) {
+    ULOGE("libusb_wrap_sys_device failed %s", libusb_error_name(errcode));
+    return false;
+  }
+
+  libusb_device* device = libusb_get_device(deviceHandle_);
+  ULOGD("Got device %p with usb speed %d", device, libusb_get_device_speed(device));
+  errcode = libusb_get_active_config_descriptor(device, &config_);
+  if (errcode != LIBUSB_SUCCESS) {
+    ULOGE("libusb_get_active_config_descriptor failed %s", libusb_error_name(errcode));
+    return false;
+  }
+  return true;
+}
 
+void UsbAudioStreamer::closeDevice() {
   if (deviceHandle_ && claimedInterface_ != -1) {
     auto status = libusb_release_interface(deviceHandle_, claimedInterface_);
+    BusBandwidthPlanner::shared().release(this);
     if (status == LIBUSB_SUCCESS) {
       ULOGI("Released claimed audio interface");
     } else {
@@ -64,102 +126,302 @@ UsbAudioStreamer::~UsbAudioStreamer() {
     libusb_close(deviceHandle_);
     deviceHandle_ = nullptr;
   }
-
-  // this will call libusb_free_transfer in destructor
-  transfers_.clear();
+  if (deviceFD_ >= 0) {
+    close(deviceFD_);
+  }
 
   if (config_ != nullptr) {
     ULOGI("Free config");
     libusb_free_config_descriptor(config_);
   }
+  claimedInterface_ = -1;
+  detachedInterface_ = -1;
+  deviceFD_ = -1;
+  config_ = nullptr;
+}
 
-  if (context_ != nullptr) {
-    ULOGI("Exit context");
-    libusb_exit(context_);
+bool UsbAudioStreamer::resolveAudioInterface() {
+  if (config_ == nullptr) {
+    return false;
+  }
+  UacDescriptors descriptors = UacDescriptors::parse(config_);
+  if (descriptors.altsettings.empty()) {
+    ULOGE("No audio streaming altsetting with an isochronous IN endpoint");
+    return false;
+  }
+  // AudioFormat.ENCODING_PCM_FLOAT for IEEE float streams.
+  uint16_t formatTag =
+      jAudioFormat_ == 4 ? UacDescriptors::kFormatIeeeFloat : UacDescriptors::kFormatPcm;
+  for (const UacStreamingAltsetting& altsetting : descriptors.altsettings) {
+    ULOGI(
+        "UAC %x interface %u altsetting %u: format %u, %u channels of %u bytes, %zu rates, "
+        "%u bytes per %u us, sync type %u, feedback endpoint %02x",
+        descriptors.version,
+        altsetting.interfaceNumber,
+        altsetting.altsetting,
+        altsetting.formatTag,
+        altsetting.channelCount,
+        altsetting.subframeSize,
+        altsetting.sampleRates.size(),
+        altsetting.maxPacketBytes,
+        packetIntervalUs(altsetting.interval),
+        static_cast<uint32_t>(altsetting.syncType),
+        altsetting.feedbackAddress);
+  }
+  // The output's native rate spares the resampler its rate conversion, which
+  // leaves only the drift to correct. Once AAudio plays, as on a reattach,
+  // the rate stays.
+  std::array<uint32_t, 3> rates = {nativeSampleRate_, samplingFrequency_, kPreferredSampleRate};
+  if (audioStream_ != nullptr) {
+    rates = {samplingFrequency_, 0, 0};
+  }
+  const UacStreamingAltsetting* chosen = nullptr;
+  for (uint32_t rate : rates) {
+    if (rate == 0 || (chosen = pickAltsetting(descriptors, formatTag, rate)) == nullptr) {
+      continue;
+    }
+    // UAC 2.0 altsettings list no rates; applySampleRate() asks the clock.
+    if (!chosen->sampleRates.empty()) {
+      samplingFrequency_ = rate;
+    }
+    break;
+  }
+  if (chosen == nullptr) {
+    ULOGW("No altsetting matches the format, taking the first one");
+    chosen = &descriptors.altsettings.front();
   }
 
-  ringBuffer_ = nullptr;
+  const UacStreamingAltsetting& altsetting = *chosen;
+  uint8_t interfaceNumber = altsetting.interfaceNumber;
+  endpointAddress_ = altsetting.endpointAddress;
+  maxPacketSize_ = altsetting.maxPacketBytes;
+  endpointInterval_ = altsetting.interval;
+  syncType_ = altsetting.syncType;
+  feedbackAddress_ = altsetting.feedbackAddress;
+  feedbackPacketBytes_ = altsetting.feedbackPacketBytes;
+  channelMask_ = altsetting.channelConfig;
+  static constexpr const char* kSyncTypes[] = {"no", "asynchronous", "adaptive", "synchronous"};
+  ULOGI(
+      "Streaming from endpoint %02x of interface %u altsetting %u, %u bytes per packet, %s sync, "
+      "channels %08x",
+      endpointAddress_,
+      interfaceNumber,
+      altsetting.altsetting,
+      maxPacketSize_,
+      kSyncTypes[static_cast<uint8_t>(syncType_)],
+      channelMask_);
+  // if a kernel driver is active, must detach before claiming interfaces
+  if (libusb_kernel_driver_active(deviceHandle_, interfaceNumber) == 1) {
+    auto detach_call_status = libusb_detach_kernel_driver(deviceHandle_, interfaceNumber);
+    if (detach_call_status != LIBUSB_SUCCESS) {
+      ULOGE(
+              "libusb_detach_kernel_driver error for interface %d: %s.",
+              interfaceNumber,
+              libusb_error_name(detach_call_status));
+      return false;
+    }
+    detachedInterface_ = interfaceNumber;
+  }
+  auto claim_interface_status = libusb_claim_interface(deviceHandle_, interfaceNumber);
+  if (claim_interface_status != LIBUSB_SUCCESS) {
+    ULOGE(
+            "libusb_claim_interface error for interface %d: %s.",
+            interfaceNumber,
+            libusb_error_name(claim_interface_status));
+    return false;
+  }
+  claimedInterface_ = interfaceNumber;
+  {
+    // Cameras on the bus pick their altsettings knowing what this one takes.
+    BusBandwidthPlanner& planner = BusBandwidthPlanner::shared();
+    std::lock_guard lk(planner.startMutex());
+    auto set_alt_setting_status =
+        libusb_set_interface_alt_setting(deviceHandle_, interfaceNumber, altsetting.altsetting);
+    if (set_alt_setting_status != LIBUSB_SUCCESS) {
+      ULOGE(
+              "libusb_set_interface_alt_setting error for interface %d: %s.",
+              interfaceNumber,
+              libusb_error_name(set_alt_setting_status));
+      return false;
+    }
+    planner.reserve(
+        this,
+        this,
+        BusBandwidthPlanner::busOf(deviceHandle_),
+        (uint64_t)maxPacketSize_ * 1'000'000 / packetIntervalUs(endpointInterval_));
+  }
+  ULOGI("libusb_claim_interface claimed interface %d success", interfaceNumber);
+  applySampleRate(descriptors, altsetting);
+  if (samplingFrequency_ == 0) {
+    ULOGE("The device reported no sampling frequency");
+    return false;
+  }
+  return true;
+}
 
-  ULOGI("UsbAudioStreamer destroyed");
-  state_ = StreamerState::DESTROYED;
+const UacStreamingAltsetting* UsbAudioStreamer::pickAltsetting(
+    const UacDescriptors& descriptors,
+    uint16_t formatTag,
+    uint32_t rate) const {
+  uint32_t frameBytes = subFrameSize_ * channelCount_;
+  // The altsetting that reserves the least bandwidth and still carries the
+  // format, or else the one that reserves the most.
+  const UacStreamingAltsetting* chosen = nullptr;
+  uint32_t chosenNeeded = 0;
+  for (const UacStreamingAltsetting& altsetting : descriptors.altsettings) {
+    if (altsetting.formatTag != formatTag || altsetting.channelCount != channelCount_ ||
+        altsetting.subframeSize != subFrameSize_ || !altsetting.supportsRate(rate)) {
+      continue;
+    }
+    uint64_t frames = ((uint64_t)rate * packetIntervalUs(altsetting.interval) + 999'999) /
+        1'000'000;
+    uint32_t needed = (frames + 1) * frameBytes;
+    bool fits = altsetting.maxPacketBytes >= needed;
+    bool chosenFits = chosen != nullptr && chosen->maxPacketBytes >= chosenNeeded;
+    bool smaller = chosen != nullptr && altsetting.maxPacketBytes < chosen->maxPacketBytes;
+    if (chosen == nullptr || (fits && (!chosenFits || smaller)) ||
+        (!fits && !chosenFits && !smaller)) {
+      chosen = &altsetting;
+      chosenNeeded = needed;
+    }
+  }
+  return chosen;
 }
 
-bool UsbAudioStreamer::resolveAudioInterface() {
-  if (config_ == nullptr) {
-    return false;
+void UsbAudioStreamer::applySampleRate(
+    const UacDescriptors& descriptors,
+    const UacStreamingAltsetting& altsetting) {
+  // Class requests to the endpoint, and to the audio control interface.
+  constexpr uint8_t kToEndpoint = 0x22;
+  constexpr uint8_t kToInterface = 0x21;
+  constexpr uint8_t kFromInterface = 0xa1;
+  constexpr uint8_t kSetCur = 0x01;
+  // UAC 2.0 CUR and RANGE requests.
+  constexpr uint8_t kCur = 0x01;
+  constexpr uint8_t kRange = 0x02;
+  constexpr uint16_t kSamplingFreqControl = 0x01 << 8;
+  constexpr unsigned int kTimeoutMs = 1000;
+  if (descriptors.version < 0x0200) {
+    if (samplingFrequency_ == 0 && !altsetting.sampleRates.empty()) {
+      samplingFrequency_ = altsetting.sampleRates.front();
+    }
+    // A single rate needs no request, which some devices stall.
+    if (altsetting.sampleRates.size() < 2 && !altsetting.hasSampleRateControl) {
+      return;
+    }
+    uint8_t data[3] = {
+        (uint8_t)samplingFrequency_,
+        (uint8_t)(samplingFrequency_ >> 8),
+        (uint8_t)(samplingFrequency_ >> 16)};
+    int status = libusb_control_transfer(
+        deviceHandle_,
+        kToEndpoint,
+        kSetCur,
+        kSamplingFreqControl,
+        endpointAddress_,
+        data,
+        sizeof(data),
+        kTimeoutMs);
+    if (status < 0) {
+      ULOGW(
+          "Setting the endpoint to %u Hz failed: %s",
+          samplingFrequency_,
+          libusb_error_name(status));
+    }
+    return;
+  }
+
+  uint8_t clock = descriptors.clockSource(altsetting.terminalLink);
+  if (clock == 0) {
+    ULOGW("No clock source for terminal %u", altsetting.terminalLink);
+    return;
+  }
+  uint16_t index = (clock << 8) | descriptors.controlInterface;
+  // wNumSubRanges, then min, max and resolution of 4 bytes each.
+  uint8_t ranges[2 + 12 * 16] = {};
+  int length = libusb_control_transfer(
+      deviceHandle_,
+      kFromInterface,
+      kRange,
+      kSamplingFreqControl,
+      index,
+      ranges,
+      sizeof(ranges),
+      kTimeoutMs);
+  // Native rate first, then the requested one, as in resolveAudioInterface().
+  std::array<uint32_t, 3> candidates = {
+      nativeSampleRate_, samplingFrequency_, kPreferredSampleRate};
+  if (audioStream_ != nullptr) {
+    candidates = {samplingFrequency_, 0, 0};
+  }
+  std::array<bool, 3> supported = {};
+  uint32_t highest = 0;
+  for (int offset = 2; length > 0 && offset + 12 <= length; offset += 12) {
+    uint32_t min = ranges[offset] | (ranges[offset + 1] << 8) | (ranges[offset + 2] << 16) |
+        ((uint32_t)ranges[offset + 3] << 24);
+    uint32_t max = ranges[offset + 4] | (ranges[offset + 5] << 8) | (ranges[offset + 6] << 16) |
+        ((uint32_t)ranges[offset + 7] << 24);
+    ULOGI("Clock %u supports %u to %u Hz", clock, min, max);
+    for (size_t c = 0; c < candidates.size(); c++) {
+      supported[c] = supported[c] || (candidates[c] >= min && candidates[c] <= max);
+    }
+    highest = std::max(highest, max);
+  }
+  if (length < 0) {
+    ULOGW("Reading the rates of clock %u failed: %s", clock, libusb_error_name(length));
+  }
+  if (highest != 0 && audioStream_ == nullptr) {
+    size_t c = std::find(supported.begin(), supported.end(), true) - supported.begin();
+    samplingFrequency_ = c < candidates.size() ? candidates[c] : highest;
   }
 
-  // Find the audio interface
-  for (auto i = 0; i < config_->bNumInterfaces; ++i) {
-    const auto interface = &config_->interface[i];
-    for (auto j = 0; j < interface->num_altsetting; ++j) {
-      const auto interfaceDescriptor = &interface->altsetting[j];
-      ULOGI(
-              "interfaceDescriptor input endpoint at %d %u %u.",
-              j,
-              interfaceDescriptor->bInterfaceClass,
-              interfaceDescriptor->bInterfaceSubClass);
-      if (interfaceDescriptor->bInterfaceClass == LIBUSB_CLASS_AUDIO &&
-          interfaceDescriptor->bInterfaceSubClass == kInterfaceSubClassStreaming &&
-          interfaceDescriptor->bNumEndpoints > 0) {
-        for (auto k = 0; k < interfaceDescriptor->bNumEndpoints; k++) {
-          ULOGI(
-                  "found a streaming sub class interface %u at %u wtih endpoints count %d",
-                  interfaceDescriptor->bInterfaceNumber,
-                  i,
-                  interfaceDescriptor->bNumEndpoints);
-          auto const endpoint = &interfaceDescriptor->endpoint[k];
-          if ((endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN) != 0) {
-            auto interface_number = interfaceDescriptor->bInterfaceNumber;
-            endpointAddress_ = endpoint->bEndpointAddress;
-            maxPacketSize_ = endpoint->wMaxPacketSize;
-            ULOGI(
-                    "Found input endpoint at %u packet size %d. maxPacketSize_: %d",
-                    endpoint->bEndpointAddress,
-                    endpoint->wMaxPacketSize,
-                    maxPacketSize_);
-            // if a kernel driver is active, must detach before claiming interfaces
-            if (libusb_kernel_driver_active(deviceHandle_, interface_number) == 1) {
-              auto detach_call_status =
-                      libusb_detach_kernel_driver(deviceHandle_, interfaceDescriptor->bInterfaceNumber);
-              if (detach_call_status != LIBUSB_SUCCESS) {
-                ULOGE(
-                        "libusb_detach_kernel_driver error for interface %d: %s.",
-                        interface_number,
-                        libusb_error_name(detach_call_status));
-                return false;
-              }
-              detachedInterface_ = interface_number;
-            }
-            auto claim_interface_status = libusb_claim_interface(deviceHandle_, interface_number);
-            if (claim_interface_status != LIBUSB_SUCCESS) {
-              ULOGE(
-                      "libusb_claim_interface error for interface %d: %s.",
-                      interface_number,
-                      libusb_error_name(claim_interface_status));
-              return false;
-            }
-            claimedInterface_ = i;
-            auto set_alt_setting_status = libusb_set_interface_alt_setting(
-                    deviceHandle_,
-                    interfaceDescriptor->bInterfaceNumber,
-                    interfaceDescriptor->bAlternateSetting);
-            if (set_alt_setting_status != LIBUSB_SUCCESS) {
-              ULOGE(
-                      "libusb_set_interface_alt_setting error for interface %d: %s.",
-                      interface_number,
-                      libusb_error_name(claim_interface_status));
-              return false;
-            } else {
-              ULOGI("libusb_claim_interface claimed interface %d success", interface_number);
-              return true;
-            }
-          }
-        }
-      }
-    }
-  }
-  return false;
+  uint8_t current[4] = {};
+  int status = libusb_control_transfer(
+      deviceHandle_,
+      kFromInterface,
+      kCur,
+      kSamplingFreqControl,
+      index,
+      current,
+      sizeof(current),
+      kTimeoutMs);
+  uint32_t currentRate = current[0] | (current[1] << 8) | (current[2] << 16) |
+      ((uint32_t)current[3] << 24);
+  if (status == sizeof(current) && samplingFrequency_ == 0) {
+    samplingFrequency_ = currentRate;
+  }
+  if (samplingFrequency_ == 0 || (status == sizeof(current) && currentRate == samplingFrequency_)) {
+    return;
+  }
+  uint8_t data[4] = {
+      (uint8_t)samplingFrequency_,
+      (uint8_t)(samplingFrequency_ >> 8),
+      (uint8_t)(samplingFrequency_ >> 16),
+      (uint8_t)(samplingFrequency_ >> 24)};
+  status = libusb_control_transfer(
+      deviceHandle_,
+      kToInterface,
+      kCur,
+      kSamplingFreqControl,
+      index,
+      data,
+      sizeof(data),
+      kTimeoutMs);
+  if (status < 0) {
+    ULOGW(
+        "Setting clock %u to %u Hz failed: %s",
+        clock,
+        samplingFrequency_,
+        libusb_error_name(status));
+  } else {
+    ULOGI("Clock %u set to %u Hz", clock, samplingFrequency_);
+  }
+}
+
+uint32_t UsbAudioStreamer::packetIntervalUs(uint8_t interval) const {
+  // bInterval is an exponent, of frames at full speed and of microframes faster.
+  bool highSpeed = getUsbDeviceSpeed() >= LIBUSB_SPEED_HIGH;
+  return (highSpeed ? 125 : 1000) << (std::clamp<int>(interval, 1, 16) - 1);
 }
 
 UsbAudioStreamer::UsbAudioStreamer(
@@ -169,47 +431,50 @@ UsbAudioStreamer::UsbAudioStreamer(
         uint8_t subFrameSize,
         uint8_t channelCount,
         uint32_t jAudioPerfMode,
-        uint32_t framesPerBurst)
+        uint32_t framesPerBurst,
+        bool exclusive,
+        uint32_t nativeSampleRate,
+        StreamingStats& streamingStats)
         : jAudioFormat_(jAudioFormat),
           samplingFrequency_(samplingFrequency),
+          nativeSampleRate_(nativeSampleRate),
           subFrameSize_(subFrameSize),
           channelCount_(channelCount),
-          framesPerBurst_(framesPerBurst) {
+          framesPerBurst_(framesPerBurst),
+          streamingStats_(streamingStats),
+          avSync_(&streamingStats == &StreamingStats::shared() ? &AvSync::shared() : nullptr) {
+  streamerStats_.streamingStats = &streamingStats_;
   ULOGI(
           "UsbAudioStreamer::init samplingFrequency_: %d channelCount_: %d framesPerBurst_ %d",
           samplingFrequency_,
           channelCount_,
           framesPerBurst_);
-  int errcode = libusb_set_option(nullptr, LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
-  if (errcode != LIBUSB_SUCCESS) {
-    ULOGE("libusb setting no discovery option failed %s", libusb_error_name(errcode));
-  }
-
-  ULOGI("Initializing UsbContext");
-  errcode = libusb_init(&context_);
-  if (errcode != LIBUSB_SUCCESS) {
-    ULOGE("libusb_init failed %s", libusb_error_name(errcode));
-  } else {
-    ULOGD("libusb initialized");
+  session_ = UsbSession::shared();
+  if (session_ == nullptr) {
+    state_ = StreamerState::ERROR;
+    return;
   }
+  context_ = session_->context();
 
-  errcode = libusb_set_option(context_, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_ERROR);
-  if (errcode != LIBUSB_SUCCESS) {
-    ULOGE("libusb setting loglevel option failed %s", libusb_error_name(errcode));
+  if (!openDevice(deviceFD)) {
+    state_ = StreamerState::ERROR;
     return;
   }
 
-  errcode = libusb_wrap_sys_device(context_, deviceFD, &deviceHandle_);
-  if (errcode != LIBUSB_SUCCESS) {
-    ULOGE("libusb_wrap_sys_device failed %s", libusb_error_name(errcode));
+  PcmEncoding inputEncoding;
+  PcmEncoding outputEncoding;
+  if (!resolvePcmEncodings(inputEncoding, outputEncoding)) {
+    ULOGE("Unsupported audio format %u with %u byte subframes", jAudioFormat_, subFrameSize_);
+    state_ = StreamerState::ERROR;
     return;
   }
 
-  libusb_device* device = libusb_get_device(deviceHandle_);
-  ULOGD("Got device %p with usb speed %d", device, libusb_get_device_speed(device));
-  errcode = libusb_get_active_config_descriptor(device, &config_);
-  if (errcode != LIBUSB_SUCCESS) {
-    ULOGE("libusb_get_active_config_descriptor failed %s", libusb_error_name(errcode));
+  // Before the AAudio stream, since a UAC 2.0 device may pick the rate.
+  if (resolveAudioInterface()) {
+    ULOGI("Resolved audio interface, %u Hz", samplingFrequency_);
+  } else {
+    state_ = StreamerState::ERROR;
+    ULOGE("Could not resolve audio interface");
     return;
   }
 
@@ -217,13 +482,48 @@ UsbAudioStreamer::UsbAudioStreamer(
   ULOGD("AAudio_createStreamBuilder result %d.", result);
   if (result == AAUDIO_OK && audioStreamBuilder_ != nullptr) {
     AAudioStreamBuilder_setDirection(audioStreamBuilder_, AAUDIO_DIRECTION_OUTPUT);
-    AAudioStreamBuilder_setFormat(audioStreamBuilder_, convertFormat(jAudioFormat_));
-    AAudioStreamBuilder_setSampleRate(audioStreamBuilder_, samplingFrequency);
-    AAudioStreamBuilder_setChannelCount(audioStreamBuilder_, channelCount);
+    AAudioStreamBuilder_setFormat(audioStreamBuilder_, PcmConverter::aaudioFormat(outputEncoding));
+    if (exclusive) {
+      // The MMAP path only runs at the mixer's rate; any other rate falls
+      // back to the legacy path with its extra buffering.
+      AAudioStreamBuilder_setSharingMode(audioStreamBuilder_, AAUDIO_SHARING_MODE_EXCLUSIVE);
+      AAudioStreamBuilder_setSampleRate(
+          audioStreamBuilder_, nativeSampleRate > 0 ? nativeSampleRate : AAUDIO_UNSPECIFIED);
+    } else {
+      AAudioStreamBuilder_setSampleRate(audioStreamBuilder_, samplingFrequency_);
+    }
+    // Outputs are stereo at most; more channels would only be mixed down
+    // behind the stream, so the mixer does that here.
+    AAudioStreamBuilder_setChannelCount(audioStreamBuilder_, std::min<int32_t>(channelCount, 2));
     AAudioStreamBuilder_setPerformanceMode(audioStreamBuilder_, convertPerfMode(jAudioPerfMode));
     AAudioStreamBuilder_setDataCallback(audioStreamBuilder_, audioPlaybackCallback, this);
     result = AAudioStreamBuilder_openStream(audioStreamBuilder_, &audioStream_);
     ULOGD("AAudioStreamBuilder_openStream result %d.", result);
+    if (result != AAUDIO_OK ||
+        !PcmConverter::encodingForAAudioFormat(
+            AAudioStream_getFormat(audioStream_), outputEncoding)) {
+      ULOGE("AAudio stream open error %d", result);
+      state_ = StreamerState::ERROR;
+      return;
+    }
+    inputConverter_.init(inputEncoding, PcmEncoding::FLOAT);
+    outputConverter_.init(PcmEncoding::FLOAT, outputEncoding);
+    outputSampleRate_ = AAudioStream_getSampleRate(audioStream_);
+    outputChannelCount_ = std::max<int32_t>(AAudioStream_getChannelCount(audioStream_), 1);
+    mixer_.init(channelCount_, channelMask_, outputChannelCount_);
+    packetConcealer_.init(PcmEncoding::FLOAT, channelCount_, samplingFrequency_);
+    playbackConcealer_.init(outputEncoding, outputChannelCount_, outputSampleRate_);
+    gainStage_.init(outputEncoding, outputChannelCount_, outputSampleRate_);
+    loopbackOutput_.resize(kLoopbackChunkFrames * outputChannelCount_);
+    ULOGI(
+        "Playing %u channel %s USB audio at %u Hz as %u channel %s at %u Hz, %s sharing",
+        channelCount_,
+        PcmConverter::name(inputEncoding),
+        samplingFrequency_,
+        outputChannelCount_,
+        PcmConverter::name(outputEncoding),
+        outputSampleRate_,
+        sharingModeName(AAudioStream_getSharingMode(audioStream_)));
     framesPerBurst_ = AAudioStream_getFramesPerBurst(audioStream_);
     bufferCapacityInFrames_ = AAudioStream_getBufferCapacityInFrames(audioStream_);
     ULOGD(
@@ -236,13 +536,6 @@ UsbAudioStreamer::UsbAudioStreamer(
     return;
   }
 
-  if (resolveAudioInterface()) {
-    ULOGE("Resolved audio interface");
-  } else {
-    state_ = StreamerState::ERROR;
-    ULOGE("Could not resolve audio interface");
-    return;
-  }
   allocateTransferRequests();
 
   state_ = StreamerState::READY_TO_START;
@@ -250,6 +543,8 @@ UsbAudioStreamer::UsbAudioStreamer(
 
 bool UsbAudioStreamer::start() {
   ULOGI("UsbAudioStreamer start called");
+  // A restart right after requestStop() waits for the cancellations here.
+  finishStop();
   if (state_ != StreamerState::READY_TO_START) {
     ULOGE("Streamer state must by ready to start");
     return false;
@@ -259,9 +554,21 @@ bool UsbAudioStreamer::start() {
   streamerStats_.total_bytes = 0;
   streamerStats_.player_cb_counter = 0;
   streamerStats_.usb_cb_counter = 0;
-  streamerStats_.event_loops = 0;
-  stopUsbAudioCapture_ = 0;
+  streamerStats_.eventLoopsAtStart = session_->eventLoops();
+  resampler_.reset();
+  packetConcealer_.reset();
+  playbackConcealer_.reset();
+  outputTimestampAt_ = {};
+  outputTimestampNs_ = -1;
+  latencyTunerStarted_ = false;
+  latencyTunedAt_ = steady_clock::now();
+  startedAt_ = latencyTunedAt_;
+  startNs_ = startedAt_.time_since_epoch().count();
+  firstAudibleNs_ = 0;
+  firstAudibleLogged_ = false;
+  prefilled_ = false;
 
+  // The transfers fill the ring while AAudio starts.
   if(!submitTransferRequests()) {
     ULOGE("Submit transfer requests failed");
     return false;
@@ -272,21 +579,123 @@ bool UsbAudioStreamer::start() {
     ULOGE("start audio player error");
     return false;
   }
-  aaudio_stream_state_t inputState = AAUDIO_STREAM_STATE_STARTING;
-  aaudio_stream_state_t nextState = AAUDIO_STREAM_STATE_UNINITIALIZED;
-  int64_t timeoutNanos = 500LL * 1000000LL;
-  auto result = AAudioStream_waitForStateChange(audioStream_, inputState, &nextState, timeoutNanos);
-  ULOGD(
-          "AAudioStream start: result %d nextState %d started(ref) = %d",
-          result,
-          nextState,
-          AAUDIO_STREAM_STATE_STARTED);
-  if (result != AAUDIO_OK) {
+  state_ = StreamerState::STARTED;
+  StreamWatchdog::shared().watch(this, [this](steady_clock::time_point now) { checkStall(now); });
+  return true;
+}
+
+void UsbAudioStreamer::checkStall(steady_clock::time_point now) {
+  if (state_ != StreamerState::STARTED || deviceLost_) {
+    return;
+  }
+  WatchdogCounters& counters = streamingStats_.watchdog.audio;
+  uint32_t inFlight = submittedTransferCount();
+  counters.transfersInFlight.set(inFlight);
+  steady_clock::time_point lastTransfer{
+      nanoseconds(lastTransferNs_.load(std::memory_order_relaxed))};
+  nanoseconds stalled = now - std::max(startedAt_, lastTransfer);
+  if (lastTransfer > startedAt_) {
+    stallRestarts_ = 0;
+  }
+  if (stalled < kStallTimeout) {
+    return;
+  }
+  uint64_t stalledUs = duration_cast<microseconds>(stalled).count();
+  if (stalledUs > counters.longestStallUs.load()) {
+    counters.longestStallUs.set(stalledUs);
+  }
+  if (inFlight == 0) {
+    // Without a transfer in flight no callback runs, so the parked ones are
+    // this thread's to submit.
+    uint32_t rearmed = submitParkedTransfers();
+    if (rearmed > 0) {
+      ULOGW("No audio transfer in flight, submitted %u again", rearmed);
+      counters.stalls.add();
+      counters.transfersRearmed.addShared(rearmed);
+      // Counted from here again before a restart.
+      startedAt_ = now;
+      return;
+    }
+  }
+  if (stalled < kStallTimeout + kStallRestartTimeout || stallRestarts_ >= kMaxStallRestarts) {
+    return;
+  }
+  counters.stalls.add();
+  stallRestarts_++;
+  ULOGW(
+      "No audio transfer for %.1f ms, restarting the stream (%u of %u)",
+      duration<double, std::milli>(stalled).count(),
+      stallRestarts_,
+      kMaxStallRestarts);
+  // requestStop() drops this check, and start() adds it back.
+  counters.restarts.add();
+  if (!stop() || !start()) {
+    ULOGE("Restarting the stalled audio stream failed");
+    counters.failedRestarts.add();
+  }
+}
+
+void UsbAudioStreamer::setDeviceLostListener(std::function<void()> listener) {
+  deviceLostListener_ = std::move(listener);
+}
+
+void UsbAudioStreamer::reportDeviceLost() {
+  if (deviceLost_.exchange(true)) {
+    return;
+  }
+  ULOGW("Audio device lost");
+  if (deviceLostListener_) {
+    deviceLostListener_();
+  }
+}
+
+bool UsbAudioStreamer::reattach(intptr_t deviceFD) {
+  StreamWatchdog::shared().unwatch(this);
+  StreamerState state = state_;
+  if (deviceHandle_ == nullptr || audioStream_ == nullptr || state == StreamerState::ERROR) {
+    return false;
+  }
+  steady_clock::time_point startedAt = steady_clock::now();
+  bool wasStarted = state == StreamerState::STARTED || state == StreamerState::STARTING;
+  // Keeps the callbacks of what is still in flight from resubmitting, while
+  // AAudio plays on.
+  state_ = StreamerState::STOPPING;
+  cancelTransfers();
+  if (!waitForTransfers()) {
+    ULOGE("Transfers still active on the lost device");
     state_ = StreamerState::ERROR;
-    ULOGE("start audio player error");
+    return false;
+  }
+  transfers_.clear();
+  feedback_ = nullptr;
+  closeDevice();
+  // Set again for the transfers of the new handle.
+  usbHint_.close();
+  usbHintOpened_ = false;
+
+  if (!openDevice(deviceFD) || !resolveAudioInterface()) {
+    ULOGE("Cannot reattach to the audio device");
+    state_ = StreamerState::ERROR;
+    return false;
+  }
+  allocateTransferRequests();
+  deviceLost_ = false;
+  if (!wasStarted) {
+    state_ = StreamerState::READY_TO_START;
+    return true;
+  }
+  state_ = StreamerState::STARTING;
+  resampler_.reset();
+  packetConcealer_.reset();
+  if (!submitTransferRequests()) {
     return false;
   }
   state_ = StreamerState::STARTED;
+  startedAt_ = steady_clock::now();
+  StreamWatchdog::shared().watch(this, [this](steady_clock::time_point now) { checkStall(now); });
+  ULOGI(
+      "Reattached to the audio device in %.1f ms",
+      duration<double, std::milli>(steady_clock::now() - startedAt).count());
   return true;
 }
 
@@ -300,6 +709,9 @@ bool UsbAudioStreamer::ensureTransferRequests() {
 
 bool UsbAudioStreamer::submitTransferRequests() {
   for (const auto& transferData: transfers_) {
+    if (submittedTransferCount() >= activeTransfers_) {
+      break;
+    }
     auto submit_transfer_status = libusb_submit_transfer(transferData->transfer);
     transferData->isSubmitted = submit_transfer_status == LIBUSB_SUCCESS;
   }
@@ -311,6 +723,13 @@ bool UsbAudioStreamer::submitTransferRequests() {
         return transferUserData->isSubmitted;
       });
   ULOGE("submitTransferRequests2 %d", submittedTransfers);
+  if (feedback_ != nullptr && !feedback_->isSubmitted) {
+    int status = libusb_submit_transfer(feedback_->transfer);
+    feedback_->isSubmitted = status == LIBUSB_SUCCESS;
+    if (status != LIBUSB_SUCCESS) {
+      ULOGW("Feedback endpoint transfer failed: %s", libusb_error_name(status));
+    }
+  }
   if (submittedTransfers == 0) {
     state_ = StreamerState::ERROR;
     return false;
@@ -328,15 +747,49 @@ void UsbAudioStreamer::allocateTransferRequests() {
           AAudioStream_getBufferSizeInFrames(audioStream_),
           bufferCapacityInFrames_);
   auto bytes_per_burst = framesPerBurst_ * subFrameSize_ * channelCount_;
-  auto computed_num_packets = (bytes_per_burst + maxPacketSize_ - 1) / maxPacketSize_;
+  if (AAudioStream_getPerformanceMode(audioStream_) == AAUDIO_PERFORMANCE_MODE_POWER_SAVING) {
+    // Fewer, longer transfers: one completion per kPowerSavingTransferMs at least.
+    int32_t bytes_per_ms = samplingFrequency_ * subFrameSize_ * channelCount_ / 1000;
+    bytes_per_burst = std::max(bytes_per_burst, bytes_per_ms * kPowerSavingTransferMs);
+  }
+  uint32_t packetIntervalUs = this->packetIntervalUs(endpointInterval_);
+  uint32_t frameBytes = subFrameSize_ * channelCount_;
+  uint64_t nominalFrames = (uint64_t)samplingFrequency_ * packetIntervalUs / 1'000'000;
+  nominalPacketBytes_ = nominalFrames * frameBytes;
+  uint64_t packetFrames =
+      ((uint64_t)samplingFrequency_ * packetIntervalUs + 999'999) / 1'000'000 + 1;
+  packetBytes_ = std::min<uint64_t>(maxPacketSize_, packetFrames * frameBytes);
+  if (packetBytes_ < frameBytes) {
+    packetBytes_ = maxPacketSize_;
+  }
+  // Packets are counted at the nominal rate, so a transfer covers the burst
+  // in time and not just in buffer space.
+  int32_t nominalBytes = std::max<int32_t>(nominalPacketBytes_, packetBytes_ / 2);
+  auto computed_num_packets = (bytes_per_burst + nominalBytes - 1) / nominalBytes;
   auto num_packets = std::max(2, computed_num_packets);
-  auto buffer_size = maxPacketSize_ * num_packets;
+  auto buffer_size = packetBytes_ * num_packets;
   auto computed_num_transfers = (bufferCapacityInFrames_ + framesPerBurst_ - 1) / framesPerBurst_;
   int32_t num_transfers = std::max(2, computed_num_transfers);
-  size_t ring_buffer_capacity = buffer_size * num_transfers / subFrameSize_;
+  // Sized for the most buffering the tuner may pick.
+  int32_t allocated_transfers = num_transfers + kSpareTransfers;
+  size_t framesPerTransfer = buffer_size / frameBytes;
+  transferPeriodNs_ = (int64_t)num_packets * packetIntervalUs * 1000;
+  uint32_t resampledChannels = std::min<uint32_t>(channelCount_, outputChannelCount_);
+  resampler_.init(resampledChannels, samplingFrequency_, outputSampleRate_, framesPerTransfer);
+  size_t outputFramesPerTransfer = resampler_.maxOutputFrames(framesPerTransfer);
+  size_t syncDelayFrames = duration_cast<microseconds>(AvSync::kMaxDelay).count() *
+      outputSampleRate_ / 1'000'000;
+  size_t ring_buffer_capacity = (outputFramesPerTransfer * allocated_transfers + syncDelayFrames) *
+      outputChannelCount_ * outputConverter_.outputBytesPerSample();
+  UsbTransportCounters& transport = streamingStats_.transport.audio;
+  transport.reservedBytesPerPacket.set(maxPacketSize_);
+  transport.packetIntervalUs.set(packetIntervalUs);
+  transport.maxPacketBytes.set(0);
   ULOGI(
-          "ISO transfer params. maxPacketSize: %d num packets: %d buffer size: %d num transfers: %d",
+          "ISO transfer params. maxPacketSize: %d packet length %u num packets: %d "
+          "buffer size: %d num transfers: %d",
           maxPacketSize_,
+          packetBytes_,
           num_packets,
           buffer_size,
           num_transfers);
@@ -346,11 +799,32 @@ void UsbAudioStreamer::allocateTransferRequests() {
           bufferCapacityInFrames_,
           ring_buffer_capacity);
 
-  if (ringBuffer_->capacity() != ring_buffer_capacity) {
+  if ((size_t)ringBuffer_->capacity() < ring_buffer_capacity) {
     ringBuffer_ = std::make_unique<RingBufferPcm>(ring_buffer_capacity);
   }
+  audioTap_.attach(
+      ringBuffer_.get(),
+      outputChannelCount_ * outputConverter_.outputBytesPerSample(),
+      outputSampleRate_);
+  resamplerInput_.resize(framesPerTransfer * channelCount_);
+  resamplerOutput_.resize(outputFramesPerTransfer * outputChannelCount_);
+  if (mixer_.isIdentity()) {
+    mixBuffer_.clear();
+  } else if (channelCount_ >= outputChannelCount_) {
+    mixBuffer_.resize(framesPerTransfer * resampledChannels);
+  } else {
+    mixBuffer_.resize(outputFramesPerTransfer * resampledChannels);
+  }
+  latencyTuner_.init(
+      framesPerBurst_,
+      bufferCapacityInFrames_,
+      num_transfers,
+      allocated_transfers,
+      outputFramesPerTransfer);
+  applyLatencySettings();
 
-  for (auto i = 0; i < num_transfers; i++) {
+  uint32_t deviceMemoryTransfers = 0;
+  for (auto i = 0; i < allocated_transfers; i++) {
     libusb_transfer* transfer = libusb_alloc_transfer(num_packets);
     if (transfer == nullptr) {
       ULOGD("libusb_alloc_transfer index %d failed.", i);
@@ -363,38 +837,125 @@ void UsbAudioStreamer::allocateTransferRequests() {
             maxPacketSize_);
     transfers_.emplace_back(std::make_unique<TransferUserData>(transfer, this, false));
     TransferUserData* transferUserData = transfers_.back().get();
+    // usbfs memory spares the kernel a copy of every URB; heap memory when the
+    // kernel has no mmap support or its usbfs_memory_mb is used up.
+    unsigned char* buffer = libusb_dev_mem_alloc(deviceHandle_, buffer_size);
+    transferUserData->deviceMemory = buffer != nullptr;
+    if (buffer == nullptr) {
+      buffer = (unsigned char*)BufferAllocator::allocate(buffer_size);
+    }
+    deviceMemoryTransfers += transferUserData->deviceMemory;
     libusb_fill_iso_transfer(
             transfer,
             deviceHandle_,
             (unsigned char)endpointAddress_,
-            (unsigned char*)malloc(buffer_size),
+            buffer,
             buffer_size,
             num_packets,
             transferCallback,
             transferUserData,
             kIsochronousTransferTimeoutMillis);
-    transfer->flags = LIBUSB_TRANSFER_SHORT_NOT_OK | LIBUSB_TRANSFER_FREE_BUFFER;
-    libusb_set_iso_packet_lengths(transfer, maxPacketSize_);
+    transfer->flags = LIBUSB_TRANSFER_SHORT_NOT_OK;
+    libusb_set_iso_packet_lengths(transfer, packetBytes_);
+  }
+  ULOGI("%u of %zu transfer buffers in usbfs memory", deviceMemoryTransfers, transfers_.size());
+
+  feedback_ = nullptr;
+  feedbackRateHz_ = 0;
+  if (feedbackAddress_ != 0 && feedbackPacketBytes_ >= 3) {
+    libusb_transfer* transfer = libusb_alloc_transfer(1);
+    if (transfer != nullptr) {
+      feedback_ = std::make_unique<TransferUserData>(transfer, this, false);
+      unsigned char* buffer = (unsigned char*)BufferAllocator::allocate(feedbackPacketBytes_);
+      libusb_fill_iso_transfer(
+          transfer,
+          deviceHandle_,
+          feedbackAddress_,
+          buffer,
+          feedbackPacketBytes_,
+          1,
+          feedbackCallback,
+          feedback_.get(),
+          kIsochronousTransferTimeoutMillis);
+      libusb_set_iso_packet_lengths(transfer, feedbackPacketBytes_);
+      ULOGI("Reading the device's rate from feedback endpoint %02x", feedbackAddress_);
+    }
   }
+  streamingStats_.memory.audioBufferBytes.set(
+      transfers_.size() * buffer_size + ringBuffer_->capacity() +
+      (resamplerInput_.capacity() + resamplerOutput_.capacity() + mixBuffer_.capacity()) *
+          sizeof(float));
 }
 
-bool UsbAudioStreamer::stop() {
-  ULOGI("UsbAudioStreamer stop called");
+bool UsbAudioStreamer::requestStop() {
+  // Waits for a stall check in progress, unless this is one.
+  StreamWatchdog::shared().unwatch(this);
+  StreamerState state = state_;
+  if (state != StreamerState::STARTED && state != StreamerState::STARTING) {
+    return false;
+  }
+  ULOGI("UsbAudioStreamer stop requested");
   state_ = StreamerState::STOPPING;
-  uint8_t tries{0};
-  while (hasActiveTransfers() && tries++ < 5) {
-    std::unique_lock lk(mutex_);
-    stateChange_.wait_for(lk, 100ms);
+  // Cancelled transfers complete right away instead of after their packets.
+  cancelTransfers();
+  if (AAudioStream_requestStop(audioStream_) != AAUDIO_OK) {
+    ULOGE("AAudioStream_requestStop failed");
   }
-  stopUsbAudioCapture_ = 1;
-  if (hasActiveTransfers() || !stopAudioPlayer()) {
+  return true;
+}
+
+void UsbAudioStreamer::cancelTransfers() {
+  for (const auto& transferData : transfers_) {
+    if (transferData->isSubmitted) {
+      libusb_cancel_transfer(transferData->transfer);
+    }
+  }
+  if (feedback_ != nullptr && feedback_->isSubmitted) {
+    libusb_cancel_transfer(feedback_->transfer);
+  }
+}
+
+bool UsbAudioStreamer::waitForTransfers() {
+  std::unique_lock lk(mutex_);
+  return stateChange_.wait_for(lk, kStopTimeout, [this] { return !hasActiveTransfers(); });
+}
+
+bool UsbAudioStreamer::finishStop() {
+  if (state_ != StreamerState::STOPPING && state_ != StreamerState::STOPPED) {
+    return state_ == StreamerState::READY_TO_START;
+  }
+  if (!waitForTransfers() || !waitForAudioPlayerStop()) {
     ULOGE("UsbAudioStreamer stop failed. Active Transfers %d", hasActiveTransfers());
     state_ = StreamerState::ERROR;
     return false;
-  } else {
-    state_ = StreamerState::READY_TO_START;
-    return true;
   }
+  usbHint_.close();
+  usbHintOpened_ = false;
+  state_ = StreamerState::READY_TO_START;
+  return true;
+}
+
+bool UsbAudioStreamer::stop() {
+  ULOGI("UsbAudioStreamer stop called");
+  requestStop();
+  return finishStop();
+}
+
+StreamerState UsbAudioStreamer::state() const {
+  return state_;
+}
+
+bool UsbAudioStreamer::resolvePcmEncodings(PcmEncoding& input, PcmEncoding& output) const {
+  // AudioFormat.ENCODING_PCM_FLOAT for IEEE float streams.
+  if (!PcmConverter::encodingForSubframe(jAudioFormat_ == 4, subFrameSize_, input)) {
+    return false;
+  }
+  output = input;
+  if (input == PcmEncoding::I24_PACKED || input == PcmEncoding::I32) {
+    // AAudio takes 32 bit integers from API 31; float keeps 24 bits exactly.
+    output = android_get_device_api_level() >= 31 ? PcmEncoding::I32 : PcmEncoding::FLOAT;
+  }
+  return true;
 }
 
 uint32_t UsbAudioStreamer::samplesFromByteCount(uint32_t byteCount) const {
@@ -402,17 +963,24 @@ uint32_t UsbAudioStreamer::samplesFromByteCount(uint32_t byteCount) const {
 }
 
 std::string UsbAudioStreamer::statsSummaryString() const {
-  std::string audioFormatStr = "";
-  if (jAudioFormat_ == 2) { // AudioFormat.ENCODING_PCM_16BIT
-    audioFormatStr = "PCM16";
-  } else if (jAudioFormat_ == 3) {
-    audioFormatStr = "PCM8";
-  } else if (jAudioFormat_ == 4) {
-    audioFormatStr = "PCM Float";
+  std::string audioFormatStr = PcmConverter::name(inputConverter_.input());
+  if (audioStream_ == nullptr) {
+    return std::format(
+        "{} {}Ch. {}",
+        audioFormatStr,
+        channelCount_,
+        streamingStats_.audio.samplingFrequency.load());
   }
   return std::format(
-          "{} {}Ch. {}", audioFormatStr, channelCount_, streamerStats_.samplingFrequency);
-  ;
+      "{} {}Ch. {} -> {}Ch. {} Hz {} {} burst {}",
+      audioFormatStr,
+      channelCount_,
+      streamingStats_.audio.samplingFrequency.load(),
+      outputChannelCount_,
+      outputSampleRate_,
+      sharingModeName(AAudioStream_getSharingMode(audioStream_)),
+      perfModeName(AAudioStream_getPerformanceMode(audioStream_)),
+      framesPerBurst_);
 }
 
 aaudio_data_callback_result_t UsbAudioStreamer::audioPlaybackCallback(
@@ -420,167 +988,544 @@ aaudio_data_callback_result_t UsbAudioStreamer::audioPlaybackCallback(
         void* userData,
         void* audioData,
         int32_t numFrames) {
+  TRACE_SCOPE("audioPlaybackCallback");
+  REALTIME_SCOPE("audioPlaybackCallback");
   UsbAudioStreamer* streamer = reinterpret_cast<UsbAudioStreamer*>(userData);
-  auto sizeToRead = streamer->channelCount_ * numFrames;
-  auto bytesToRead = streamer->bytesInAudioFrames(numFrames);
-
-  streamer->streamerStats_.event_loops++;
-  libusb_handle_events_timeout_completed(
-          streamer->context(),
-          &streamer->libusbEventsTimeout_,
-          const_cast<int*>(&streamer->stopUsbAudioCapture_));
+  size_t bytesPerFrame =
+      streamer->outputChannelCount_ * streamer->outputConverter_.outputBytesPerSample();
+  size_t bytesToRead = bytesPerFrame * numFrames;
+
   streamer->streamerStats_.player_cb_counter++;
 
-  auto available = streamer->ringBuffer_->size();
+  // Everything buffered so far, copied out in place below.
+  RingBufferPcm& ringBuffer = *streamer->ringBuffer_;
+  RingBufferPcm::Spans buffered = ringBuffer.peekRead(ringBuffer.capacity());
+  size_t available = buffered.size();
+  TRACE_COUNTER("audioRingBufferFill", available);
+  StreamingStats& sharedStats = streamer->streamingStats_;
+  sharedStats.audio.playerCallbacks.add();
+  if (streamer->outputSampleRate_ > 0 && bytesPerFrame > 0) {
+    int64_t bufferedFrames = available / bytesPerFrame;
+    sharedStats.audioLatency.record(
+        microseconds(bufferedFrames * 1'000'000 / streamer->outputSampleRate_));
+  }
 
-  if (available < sizeToRead) {
-    memset(audioData, 0, bytesToRead);
-  } else {
-    auto movedData = streamer->ringBuffer_->read((uint16_t*)audioData, sizeToRead);
-    if (movedData != sizeToRead && streamer->state_ == StreamerState::STARTED) {
-      ULOGD(
-              "ringBuffer read error %zu sizeToRead %d read data = %d",
-              available,
-              sizeToRead,
-              movedData);
+  // Stream position of the next ring frame, before this callback's frames.
+  int64_t framesWritten = AAudioStream_getFramesWritten(stream);
+  streamer->ringToStreamOffset_.store(
+      framesWritten - streamer->ringFramesRead_, std::memory_order_relaxed);
+  uint8_t* output = reinterpret_cast<uint8_t*>(audioData);
+  if (!streamer->prefilled_.load(std::memory_order_relaxed)) {
+    // Silence rather than concealment until the ring has filled up once.
+    if (bytesPerFrame == 0 || streamer->outputSampleRate_ == 0 ||
+        available / bytesPerFrame < streamer->prefillFrames_.load(std::memory_order_relaxed)) {
+      memset(output, 0, bytesToRead);
+      return AAUDIO_CALLBACK_RESULT_CONTINUE;
     }
+    streamer->prefilled_.store(true, std::memory_order_relaxed);
+    // This callback's first frame plays after what AAudio holds already.
+    int64_t queuedFrames = framesWritten - AAudioStream_getFramesRead(stream);
+    streamer->firstAudibleNs_.store(
+        steady_clock::now().time_since_epoch().count() +
+            std::max<int64_t>(queuedFrames, 0) * 1'000'000'000 / streamer->outputSampleRate_,
+        std::memory_order_relaxed);
+  }
+  // What is there plays, and the concealment covers the rest.
+  size_t framesRead =
+      bytesPerFrame > 0 ? std::min<size_t>(available / bytesPerFrame, numFrames) : 0;
+  size_t bytesRead = framesRead * bytesPerFrame;
+  ringBuffer.commitRead(buffered.copyTo(0, output, bytesRead));
+  streamer->ringFramesRead_ += framesRead;
+  streamer->playbackConcealer_.played(output, framesRead);
+  if (bytesRead < bytesToRead) {
+    sharedStats.audio.underruns.add();
+    sharedStats.audio.framesConcealed.add(numFrames - framesRead);
+    streamer->playbackConcealer_.conceal(output + bytesRead, numFrames - framesRead);
+  }
+  // The ring is drained all the same, so the microphone's audio keeps its
+  // usual delay through it.
+  if (streamer->loopback_.active() && bytesPerFrame > 0) {
+    streamer->renderLoopback(output, numFrames, framesWritten, available / bytesPerFrame);
   }
   return AAUDIO_CALLBACK_RESULT_CONTINUE;
 }
 
-bool UsbAudioStreamer::startAudioPlayer() {
-  if (AAudioStream_requestStart(audioStream_) != AAUDIO_OK) {
+bool UsbAudioStreamer::startLoopbackMeasurement(uint32_t bursts) {
+  if (outputSampleRate_ == 0 || samplingFrequency_ == 0 || loopbackOutput_.empty()) {
     return false;
   }
-  aaudio_stream_state_t inputState = AAUDIO_STREAM_STATE_STARTING;
-  aaudio_stream_state_t nextState = AAUDIO_STREAM_STATE_UNINITIALIZED;
-  int64_t timeoutNanos = 500LL * 1000000LL;
-  AAudioStream_waitForStateChange(audioStream_, inputState, &nextState, timeoutNanos);
-  return nextState == AAUDIO_STREAM_STATE_STARTED;
+  ULOGI("Measuring the loopback latency with %u bursts", bursts);
+  return loopback_.start(
+      bursts, outputSampleRate_, outputChannelCount_, samplingFrequency_, channelCount_);
 }
 
-bool UsbAudioStreamer::stopAudioPlayer() {
-  if (AAudioStream_requestStop(audioStream_) != AAUDIO_OK) {
+void UsbAudioStreamer::renderLoopback(
+    uint8_t* output,
+    int32_t numFrames,
+    int64_t streamFrame,
+    size_t bufferedFrames) {
+  TRACE_SCOPE("renderLoopback");
+  int64_t nowNs = steady_clock::now().time_since_epoch().count();
+  // Microphone audio captured now plays after what the ring holds and half
+  // the resampler's filter.
+  int64_t bufferedNs = (int64_t)(bufferedFrames * 1e9 / outputSampleRate_ +
+                                 AsyncResampler::kTaps / 2 * 1e9 / samplingFrequency_);
+  size_t bytesPerFrame = outputChannelCount_ * outputConverter_.outputBytesPerSample();
+  for (int32_t done = 0; done < numFrames;) {
+    size_t frames = std::min<size_t>(numFrames - done, kLoopbackChunkFrames);
+    if (!loopback_.render(loopbackOutput_.data(), frames, streamFrame + done, nowNs, bufferedNs)) {
+      return;
+    }
+    outputConverter_.convert(
+        reinterpret_cast<const uint8_t*>(loopbackOutput_.data()),
+        output + done * bytesPerFrame,
+        frames * outputChannelCount_);
+    done += frames;
+  }
+}
+
+bool UsbAudioStreamer::startAudioPlayer() {
+  aaudio_result_t result = AAudioStream_requestStart(audioStream_);
+  if (result != AAUDIO_OK) {
+    ULOGE("AAudioStream_requestStart: %s", AAudio_convertResultToText(result));
     return false;
   }
-  aaudio_stream_state_t inputState = AAUDIO_STREAM_STATE_STOPPING;
-  aaudio_stream_state_t nextState = AAUDIO_STREAM_STATE_UNINITIALIZED;
-  AAudioStream_waitForStateChange(audioStream_, inputState, &nextState, 500000000);
-  return nextState == AAUDIO_STREAM_STATE_STOPPED;
+  // Mostly the stream is STARTING here; one wait covers any state it is in.
+  aaudio_stream_state_t state = AAudioStream_getState(audioStream_);
+  if (state != AAUDIO_STREAM_STATE_STARTED) {
+    result = AAudioStream_waitForStateChange(
+        audioStream_, state, &state, duration_cast<nanoseconds>(kStartTimeout).count());
+  }
+  ULOGD(
+      "AAudioStream start: result %d state %d after %.1f ms",
+      result,
+      state,
+      duration<double, std::milli>(steady_clock::now() - startedAt_).count());
+  return result == AAUDIO_OK && state == AAUDIO_STREAM_STATE_STARTED;
+}
+
+bool UsbAudioStreamer::waitForAudioPlayerStop() {
+  aaudio_stream_state_t state = AAudioStream_getState(audioStream_);
+  if (state == AAUDIO_STREAM_STATE_STOPPING) {
+    AAudioStream_waitForStateChange(
+        audioStream_,
+        state,
+        &state,
+        duration_cast<nanoseconds>(kStopTimeout).count());
+  }
+  return state == AAUDIO_STREAM_STATE_STOPPED;
 }
 
 void UsbAudioStreamer::transferCallback(libusb_transfer* transfer) {
+  TRACE_SCOPE("transferCallback");
+  REALTIME_SCOPE("transferCallback");
   if (transfer == nullptr) {
-    ULOGE("transferCallback transfer is null.");
+    HLOGE("transferCallback transfer is null.");
     return;
   }
   TransferUserData* transferUserData = reinterpret_cast<TransferUserData*>(transfer->user_data);
 
   if (transferUserData == nullptr) {
-    ULOGE("transferUserData is null.");
+    HLOGE("transferUserData is null.");
     return;
   }
   transferUserData->isSubmitted = false;
   if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
-    ULOGI("LIBUSB_TRANSFER_NO_DEVICE");
+    HLOGI("LIBUSB_TRANSFER_NO_DEVICE");
+    UsbAudioStreamer* streamer = transferUserData->streamer;
+    if (streamer->state_ == StreamerState::STARTED) {
+      streamer->reportDeviceLost();
+    }
+    // A stop or teardown waiting for the transfers need not time out.
+    std::unique_lock lk(streamer->mutex_);
+    streamer->stateChange_.notify_all();
     return;
   }
 
   UsbAudioStreamer* streamer = transferUserData->streamer;
   const StreamerState state = streamer->state_;
   if (state == StreamerState::STOPPING) {
-    if (streamer->hasActiveTransfers()) {
-      ULOGE("Streamer has active transfers");
-    } else {
-      ULOGE("Streamer has no active transfers");
+    if (!streamer->hasActiveTransfers()) {
+      HLOGD("Last transfer of the stopping streamer completed");
       std::unique_lock lk(streamer->mutex_);
-      streamer->stateChange_.notify_one();
+      StreamerState stopping = StreamerState::STOPPING;
+      streamer->state_.compare_exchange_strong(stopping, StreamerState::STOPPED);
+      streamer->stateChange_.notify_all();
     }
     return;
   }
   if (state == StreamerState::DESTROYING || state == StreamerState::DESTROYED) {
-    ULOGE("Streamer is shutting down");
+    if (!streamer->hasActiveTransfers()) {
+      std::unique_lock lk(streamer->mutex_);
+      streamer->stateChange_.notify_one();
+    }
     return;
   }
 
+  if (!streamer->usbHintOpened_) {
+    streamer->usbHint_.open(ThreadRole::USB_EVENTS, streamer->transferPeriodNs_);
+    streamer->usbHintOpened_ = true;
+  }
+  PerformanceHint::Work work(streamer->usbHint_);
+
   int len = 0;
+  // Packets are gathered as float for the resampler, which writes the whole
+  // transfer into the ring at once.
+  const PcmConverter& converter = streamer->inputConverter_;
+  float* resamplerInput = streamer->resamplerInput_.data();
+  size_t inputSamples = 0;
+  UsbTransportCounters& transport = streamer->streamingStats_.transport.audio;
+  transport.packets.add(transfer->num_iso_packets);
+  std::unique_lock recorderLock(streamer->recorderMutex_);
+  size_t frameSamples = streamer->channelCount_;
   for (auto i = 0; i < transfer->num_iso_packets; i++) {
     struct libusb_iso_packet_descriptor* pack = &transfer->iso_packet_desc[i];
     if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
-      const time_point<steady_clock> now = steady_clock::now();
-      if (now - streamer->callbackErrorLoggedAt_ > 60s) {
-        ULOGE("Error (status %d: %s)", pack->status, libusb_error_name(pack->status));
-        streamer->callbackErrorLoggedAt_ = now;
-      }
+      streamer->streamingStats_.audio.packetErrors.add();
+      transport.packetErrors.add();
+      HLOGE_EVERY(60s, "Error (status %d: %s)", pack->status, libusb_error_name(pack->status));
+      // The packet's nominal frames keep the stream's timing.
+      size_t frames = std::min(
+          streamer->nominalPacketBytes_ / converter.inputBytesPerSample() / frameSamples,
+          (streamer->resamplerInput_.size() - inputSamples) / frameSamples);
+      streamer->packetConcealer_.conceal(
+          reinterpret_cast<uint8_t*>(resamplerInput + inputSamples), frames);
+      streamer->streamingStats_.audio.packetFramesConcealed.add(frames);
+      inputSamples += frames * frameSamples;
       continue;
     }
+    if (pack->actual_length == 0) {
+      transport.emptyPackets.add();
+    } else if (pack->actual_length < streamer->nominalPacketBytes_) {
+      transport.shortPackets.add();
+    }
+    if (pack->actual_length > transport.maxPacketBytes.load()) {
+      transport.maxPacketBytes.set(pack->actual_length);
+    }
     const uint8_t* data = libusb_get_iso_packet_buffer_simple(transfer, i);
 
-    auto dataSize = pack->actual_length / 2;
-    auto result = streamer->ringBuffer_->write((uint16_t*)data, dataSize);
-    if (result != dataSize) {
-      ULOGE("Write error result = %d to write = %d", result, pack->actual_length);
+    size_t samples = std::min(
+        pack->actual_length / converter.inputBytesPerSample(),
+        streamer->resamplerInput_.size() - inputSamples);
+    samples -= samples % frameSamples;
+    converter.convert(data, reinterpret_cast<uint8_t*>(resamplerInput + inputSamples), samples);
+    streamer->packetConcealer_.played(
+        reinterpret_cast<uint8_t*>(resamplerInput + inputSamples), samples / frameSamples);
+    inputSamples += samples;
+    if (streamer->recorder_ != nullptr) {
+      streamer->recorder_->writeAudio(data, pack->actual_length);
     }
 
     len += pack->actual_length;
   }
+  recorderLock.unlock();
+  transport.bytes.add(len);
+  if (streamer->loopback_.active()) {
+    streamer->loopback_.capture(
+        resamplerInput,
+        inputSamples / streamer->channelCount_,
+        steady_clock::now().time_since_epoch().count());
+  }
+  streamer->writeResampled(inputSamples / streamer->channelCount_);
 
   /* update stats */
   UsbAudioStreamerStats& stats = streamer->streamerStats_;
 
+  const time_point<steady_clock> now = steady_clock::now();
   if (len > 0) {
-    stats.recordSamples(streamer->samplesFromByteCount(len));
+    stats.recordSamples(streamer->samplesFromByteCount(len), now);
   }
-
-  const time_point<steady_clock> now = steady_clock::now();
   if (stats.t0_10_s.time_since_epoch().count() == 0) {
     stats.t0_10_s = now;
     stats.total_bytes = 0;
     stats.player_cb_counter = 0;
     stats.usb_cb_counter = 0;
+    stats.eventLoopsAtStart = streamer->session_->eventLoops();
   }
   stats.total_bytes += len;
   stats.usb_cb_counter++;
+  streamer->streamingStats_.audio.usbTransfers.add();
+  streamer->streamingStats_.audio.bytes.add(len);
+  streamer->tuneLatency(now);
 
   duration<float> diff = duration_cast<seconds>(now - stats.t0_10_s);
   if (diff >= 10.0s) {
-    ULOGI(
-            "Audio callbacks %hu usb callbacks %hu in %hu event loops. Transferred  %d in %.1f secs, speed %.1f bps",
-            stats.player_cb_counter,
-            stats.usb_cb_counter,
-            stats.event_loops,
-            stats.total_bytes,
+    HLOGI(
+            "Audio callbacks %llu usb callbacks %llu in %llu shared event loops. Transferred  %llu in %.1f secs, speed %.1f bps",
+            (unsigned long long)stats.player_cb_counter.load(),
+            (unsigned long long)stats.usb_cb_counter,
+            (unsigned long long)(streamer->session_->eventLoops() - stats.eventLoopsAtStart),
+            (unsigned long long)stats.total_bytes,
             diff.count(),
             stats.total_bytes / diff.count());
+    HLOGI(
+        "Clock drift correction %+.0f ppm, ring buffer fill %.0f frames, USB to speaker %.1f ms",
+        (streamer->resampler_.ratio() / streamer->resampler_.nominalRatio() - 1) * 1e6,
+        streamer->resampler_.fillAverage(),
+        streamer->deliveryLatencyAverageUs_ / 1e3);
+    if (streamer->feedbackRateHz_ > 0) {
+      HLOGI("Device reports %.3f Hz through its feedback endpoint", streamer->feedbackRateHz_);
+    }
     stats.t0_10_s = now;
     stats.total_bytes = 0;
     stats.player_cb_counter = 0;
     stats.usb_cb_counter = 0;
-    stats.event_loops = 0;
+    stats.eventLoopsAtStart = streamer->session_->eventLoops();
   }
 
-  int maxExpectedLen = streamer->maxPacketSize_ * transfer->num_iso_packets;
+  int maxExpectedLen = streamer->packetBytes_ * transfer->num_iso_packets;
 
   if (len > maxExpectedLen) {
-    ULOGE("Error: incoming transfer data is more than maxPacketSize * num_iso_packets.");
-    ULOGE(
-            "Error: incoming transfer data %d is more than maxPacketSize * num_iso_packets. %dx%d=%d",
+    HLOGE("Error: incoming transfer data is more than packet length * num_iso_packets.");
+    HLOGE(
+            "Error: incoming transfer data %d is more than packet length * num_iso_packets. "
+            "%dx%d=%d",
             len,
-            streamer->maxPacketSize_,
+            streamer->packetBytes_,
             transfer->num_iso_packets,
             maxExpectedLen);
-    ULOGE("streamer %p", streamer);
-    return;
+    HLOGE("streamer %p", streamer);
+    // Dropping the transfer would starve the stream; it goes back all the same.
   }
+  streamer->lastTransferNs_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
 
+  // Parks the transfer when the tuner lowered the number in flight.
+  if (streamer->submittedTransferCount() >= streamer->activeTransfers_) {
+    return;
+  }
   auto status = libusb_submit_transfer(transfer);
   if (status == LIBUSB_SUCCESS) {
     transferUserData->isSubmitted = true;
+    // Transfers whose resubmission failed earlier are re-armed behind this one.
+    uint32_t rearmed = streamer->submitParkedTransfers();
+    if (rearmed > 0) {
+      streamer->streamingStats_.watchdog.audio.transfersRearmed.addShared(rearmed);
+    }
   } else if (status == LIBUSB_ERROR_NO_DEVICE) {
-    ULOGE("LOST DEVICE libusb_submit_transfer: %s.", libusb_error_name(status));
+    HLOGE("LOST DEVICE libusb_submit_transfer: %s.", libusb_error_name(status));
+    streamer->reportDeviceLost();
+    std::unique_lock lk(streamer->mutex_);
+    streamer->stateChange_.notify_all();
+  } else {
+    HLOGE("libusb_submit_transfer: %s.", libusb_error_name(status));
+  }
+}
+
+void UsbAudioStreamer::feedbackCallback(libusb_transfer* transfer) {
+  REALTIME_SCOPE("feedbackCallback");
+  TransferUserData* transferUserData = reinterpret_cast<TransferUserData*>(transfer->user_data);
+  transferUserData->isSubmitted = false;
+  UsbAudioStreamer* streamer = transferUserData->streamer;
+  StreamerState state = streamer->state_;
+  if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE ||
+      (state != StreamerState::STARTED && state != StreamerState::STARTING)) {
+    std::unique_lock lk(streamer->mutex_);
+    streamer->stateChange_.notify_all();
+    return;
+  }
+  const libusb_iso_packet_descriptor& packet = transfer->iso_packet_desc[0];
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+      packet.status == LIBUSB_TRANSFER_COMPLETED && packet.actual_length >= 3) {
+    const uint8_t* data = libusb_get_iso_packet_buffer_simple(transfer, 0);
+    uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+    // Frames per frame as 10.14 at full speed, per microframe as 16.16
+    // faster; some full speed devices send 16.16 in four bytes as well.
+    double frames = value / 16384.0;
+    if (packet.actual_length >= 4) {
+      value |= (uint32_t)data[3] << 24;
+      frames = value / 65536.0;
+    }
+    bool highSpeed = streamer->getUsbDeviceSpeed() >= LIBUSB_SPEED_HIGH;
+    double rate = frames * (highSpeed ? 8000 : 1000);
+    // Anything far from the nominal rate is a misread format.
+    if (std::abs(rate - streamer->samplingFrequency_) < streamer->samplingFrequency_ * 0.01) {
+      streamer->feedbackRateHz_ = rate;
+      streamer->resampler_.recordSourceRate(rate);
+    }
+  }
+  if (libusb_submit_transfer(transfer) == LIBUSB_SUCCESS) {
+    transferUserData->isSubmitted = true;
+  }
+}
+
+void UsbAudioStreamer::writeResampled(size_t inputFrames) {
+  TRACE_SCOPE("resampleAudio");
+  steady_clock::time_point now = steady_clock::now();
+  resampler_.recordInput(inputFrames, now.time_since_epoch().count());
+  if (now - outputTimestampAt_ >= 1s) {
+    int64_t framePosition;
+    int64_t timeNs;
+    if (AAudioStream_getTimestamp(audioStream_, CLOCK_MONOTONIC, &framePosition, &timeNs) ==
+        AAUDIO_OK) {
+      resampler_.recordOutputTimestamp(framePosition, timeNs);
+      outputTimestampAt_ = now;
+      outputTimestampFrame_ = framePosition;
+      outputTimestampNs_ = timeNs;
+      loopback_.recordOutputTimestamp(framePosition, timeNs);
+    }
+  }
+
+  size_t outputFrames;
+  if (mixer_.isIdentity()) {
+    outputFrames = resampler_.process(resamplerInput_.data(), inputFrames, resamplerOutput_.data());
+  } else if (channelCount_ >= outputChannelCount_) {
+    mixer_.process(resamplerInput_.data(), inputFrames, mixBuffer_.data());
+    outputFrames = resampler_.process(mixBuffer_.data(), inputFrames, resamplerOutput_.data());
   } else {
-    ULOGE("libusb_submit_transfer: %s.", libusb_error_name(status));
+    outputFrames = resampler_.process(resamplerInput_.data(), inputFrames, mixBuffer_.data());
+    mixer_.process(mixBuffer_.data(), outputFrames, resamplerOutput_.data());
+  }
+  size_t outputSamples = outputFrames * outputChannelCount_;
+  // Only what is written, which AudioTap readers must not read meanwhile.
+  RingBufferPcm::Spans freeSpace =
+      ringBuffer_->peekWrite(outputSamples * outputConverter_.outputBytesPerSample());
+  size_t written = outputConverter_.convertInto(
+      freeSpace, 0, reinterpret_cast<const uint8_t*>(resamplerOutput_.data()), outputSamples);
+  gainStage_.process(freeSpace, written);
+  publishLevels();
+  ringBuffer_->commitWrite(written);
+  audioTap_.published(ringBuffer_->writePosition(), now.time_since_epoch().count());
+  size_t bytesPerFrame = outputChannelCount_ * outputConverter_.outputBytesPerSample();
+  recordDeliveryLatency(ringFramesWritten_, inputFrames, now.time_since_epoch().count());
+  ringFramesWritten_ += written / bytesPerFrame;
+  if (written != outputSamples * outputConverter_.outputBytesPerSample()) {
+    streamingStats_.audio.overruns.add();
+    ULOGE("Write error result = %zu to write = %zu", written, outputSamples);
+  }
+  size_t fill = ringBuffer_->size();
+  TRACE_COUNTER("audioRingBufferFill", fill);
+  resampler_.recordFill(fill / bytesPerFrame);
+  streamingStats_.audio.ringFillFrames.set(fill / bytesPerFrame);
+}
+
+void UsbAudioStreamer::publishLevels() {
+  AudioCounters& audio = streamingStats_.audio;
+  for (uint32_t c = 0; c < kMeteredAudioChannels; c++) {
+    audio.levelPeakMicro[c].set(std::llround(gainStage_.peak(c) * 1e6));
+    audio.levelRmsMicro[c].set(std::llround(gainStage_.rms(c) * 1e6));
+  }
+  audio.samplesOverFullScale.set(gainStage_.samplesOverFullScale());
+}
+
+void UsbAudioStreamer::recordDeliveryLatency(
+    int64_t ringFrame,
+    size_t inputFrames,
+    int64_t nowNs) {
+  int64_t offset = ringToStreamOffset_.load(std::memory_order_relaxed);
+  if (offset == kNoStreamOffset || outputTimestampNs_ < 0 || inputFrames == 0 ||
+      outputSampleRate_ == 0 || samplingFrequency_ == 0) {
+    return;
+  }
+  // The transfer's first frame reached the device about its own length before
+  // the completion, and the resampler holds it back by half its filter more.
+  double capturedNs =
+      nowNs - (inputFrames + AsyncResampler::kTaps / 2) * 1e9 / samplingFrequency_;
+  // When AAudio presents it, extrapolated from the latest timestamp. Future
+  // underruns would delay it further.
+  double presentedNs = outputTimestampNs_ +
+      (ringFrame + offset - outputTimestampFrame_) * 1e9 / outputSampleRate_;
+  double latencyUs = (presentedNs - capturedNs) / 1e3;
+  // About a second time constant at typical transfer rates, for the log.
+  constexpr double kSmoothing = 0.005;
+  deliveryLatencyAverageUs_ = deliveryLatencyAverageUs_ < 0
+      ? latencyUs
+      : deliveryLatencyAverageUs_ + (latencyUs - deliveryLatencyAverageUs_) * kSmoothing;
+  streamingStats_.audio.deliveryLatencyUs.set(std::max(0.0, latencyUs));
+}
+
+void UsbAudioStreamer::tuneLatency(steady_clock::time_point now) {
+  if (now - latencyTunedAt_ < kLatencyTuningInterval) {
+    return;
+  }
+  latencyTunedAt_ = now;
+  streamingStats_.publishProcessUsage();
+  if (avSync_ != nullptr) {
+    if (deliveryLatencyAverageUs_ >= 0) {
+      avSync_->recordAudioLatency(microseconds((int64_t)deliveryLatencyAverageUs_), now);
+    }
+    if (avSync_->audioDelay() != syncDelay_) {
+      syncDelay_ = avSync_->audioDelay();
+      applyLatencySettings();
+    }
+  }
+  AudioCounters& audio = streamingStats_.audio;
+  int32_t xruns = AAudioStream_getXRunCount(audioStream_);
+  if (xruns >= 0) {
+    audio.xruns.set(xruns);
   }
+  uint64_t glitches = audio.underruns.load() + audio.overruns.load() + audio.xruns.load() +
+      audio.packetErrors.load();
+  int64_t firstAudibleNs = firstAudibleNs_.load(std::memory_order_relaxed);
+  if (!firstAudibleLogged_ && firstAudibleNs != 0) {
+    firstAudibleLogged_ = true;
+    int64_t startToAudibleUs = (firstAudibleNs - startNs_) / 1000;
+    audio.startToAudibleUs.set(startToAudibleUs);
+    ULOGI(
+        "First USB audio sample audible %.1f ms after start, %zu frames prefilled",
+        startToAudibleUs / 1e3,
+        prefillFrames_.load(std::memory_order_relaxed));
+  }
+  // The first period after start() covers the ring buffer filling up.
+  if (!latencyTunerStarted_) {
+    latencyTunerStarted_ = true;
+    latencyTuner_.restart(glitches, now);
+    return;
+  }
+  if (latencyTuner_.update(glitches, now)) {
+    applyLatencySettings();
+    submitParkedTransfers();
+  }
+}
+
+void UsbAudioStreamer::applyLatencySettings() {
+  const AudioLatencyTuner::Settings& settings = latencyTuner_.settings();
+  // AAudio rounds the size to its own granularity and returns the result.
+  aaudio_result_t bufferSize =
+      AAudioStream_setBufferSizeInFrames(audioStream_, settings.bufferSizeFrames);
+  if (bufferSize < 0) {
+    ULOGW("Could not set the audio buffer size: %s", AAudio_convertResultToText(bufferSize));
+    bufferSize = AAudioStream_getBufferSizeInFrames(audioStream_);
+  }
+  size_t targetFill = settings.targetFillFrames +
+      duration_cast<microseconds>(syncDelay_).count() * outputSampleRate_ / 1'000'000;
+  resampler_.setTargetFill(targetFill);
+  prefillFrames_.store(targetFill, std::memory_order_relaxed);
+  activeTransfers_ = settings.transfers;
+  AudioCounters& audio = streamingStats_.audio;
+  audio.bufferSizeFrames.set(bufferSize);
+  audio.inFlightTransfers.set(activeTransfers_);
+  audio.targetFillFrames.set(targetFill);
+  ULOGI(
+      "Audio buffering level %u: buffer size %d frames, %u transfers, ring buffer fill %zu frames",
+      latencyTuner_.level(),
+      bufferSize,
+      activeTransfers_,
+      targetFill);
+}
+
+uint32_t UsbAudioStreamer::submitParkedTransfers() {
+  uint32_t submitted = 0;
+  for (const auto& transferData : transfers_) {
+    if (submittedTransferCount() >= activeTransfers_) {
+      break;
+    }
+    if (transferData->isSubmitted) {
+      continue;
+    }
+    auto status = libusb_submit_transfer(transferData->transfer);
+    if (status != LIBUSB_SUCCESS) {
+      ULOGE("libusb_submit_transfer: %s.", libusb_error_name(status));
+      break;
+    }
+    transferData->isSubmitted = true;
+    submitted++;
+  }
+  return submitted;
+}
+
+void UsbAudioStreamer::setRecorder(StreamRecorder* recorder) {
+  std::unique_lock lk(recorderMutex_);
+  recorder_ = recorder;
 }
 
 bool UsbAudioStreamer::isPlaying() const {
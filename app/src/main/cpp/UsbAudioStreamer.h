@@ -21,6 +21,7 @@
 #include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -28,44 +29,63 @@
 #include <condition_variable>
 #include <iterator>
 #include <mutex>
+#include <thread>
 
+#include "AsyncResampler.h"
+#include "AudioConcealer.h"
+#include "AudioGainStage.h"
+#include "AudioLatencyTuner.h"
+#include "AudioTap.h"
+#include "BufferAllocator.h"
+#include "ChannelMixer.h"
+#include "LoopbackMeter.h"
+#include "PcmConverter.h"
+#include "RateMeter.h"
 #include "RingBuffer.h"
+#include "StreamRecorder.h"
+#include "StreamerState.h"
+#include "StreamingStats.h"
+#include "ThreadPolicy.h"
+#include "UacDescriptors.h"
+#include "UsbSession.h"
 
 using namespace std::chrono;
 
-enum class StreamerState : int {
-  INITIAL,
-  READY_TO_START,
-  STARTING,
-  STARTED,
-  STOPPING,
-  STOPPED,
-  DESTROYING,
-  DESTROYED,
-  ERROR,
-};
-
 struct UsbAudioStreamerStats {
-  uint32_t total_bytes{0};
-  uint16_t usb_cb_counter{0};
-  uint16_t player_cb_counter{0};
-  uint16_t event_loops{0};
+  // Counts of the 10 second log window.
+  uint64_t total_bytes{0};
+  uint64_t usb_cb_counter{0};
+  std::atomic<uint64_t> player_cb_counter{0};
+  // UsbSession event loops when the 10 second window started.
+  uint64_t eventLoopsAtStart{0};
   steady_clock::time_point t0_10_s{milliseconds{0}};
 
   uint32_t samplingFrequency = 0;
-  uint32_t currentSamplingFrequency = 0;
-  steady_clock::time_point t0_1_s{high_resolution_clock::now()};
-
-  void recordSamples(uint32_t samples) {
-    currentSamplingFrequency += samples;
-    if (duration_cast<seconds>(high_resolution_clock::now() - t0_1_s) >= 1s) {
-      t0_1_s = high_resolution_clock::now();
-      samplingFrequency = currentSamplingFrequency;
-      currentSamplingFrequency = 0;
+  RateMeter sampleRate{};
+
+  // now is the completion's time, read once by the caller.
+  void recordSamples(uint32_t samples, steady_clock::time_point now) {
+    if (sampleRate.add(samples, now)) {
+      samplingFrequency = (uint32_t)std::llround(sampleRate.snapshot().windowRate);
+      publish();
     }
   }
+
+  StreamingStats* streamingStats{&StreamingStats::shared()};
+
+  // Once a second: sampling rate and buffered audio percentiles.
+  void publish() {
+    StreamingStats& stats = *streamingStats;
+    stats.audio.samplingFrequency.set(samplingFrequency);
+    stats.audio.samplingFrequencySmoothedMilli.set(
+        std::llround(sampleRate.snapshot().smoothedRate * 1000));
+    stats.audio.latencyPercentilesUs[0].set(stats.audioLatency.percentile(0.50).count());
+    stats.audio.latencyPercentilesUs[1].set(stats.audioLatency.percentile(0.95).count());
+    stats.audio.latencyPercentilesUs[2].set(stats.audioLatency.percentile(0.99).count());
+  }
 };
 
+class AvSync;
 class UsbAudioStreamer;
 
 struct TransferUserData {
@@ -78,9 +98,16 @@ struct TransferUserData {
   libusb_transfer* transfer;
   UsbAudioStreamer* streamer;
   bool isSubmitted;
+  // The buffer is usbfs memory from libusb_dev_mem_alloc rather than the heap.
+  bool deviceMemory{false};
 
+  // The device handle must still be open.
   ~TransferUserData() {
-
+    if (deviceMemory) {
+      libusb_dev_mem_free(transfer->dev_handle, transfer->buffer, transfer->length);
+    } else {
+      BufferAllocator::release(transfer->buffer);
+    }
     libusb_free_transfer(transfer);
     streamer = nullptr;
   }
@@ -97,7 +124,14 @@ class UsbAudioStreamer final {
       uint8_t subFrameSize, // number of bytes per audio sample
       uint8_t channelCount,
       uint32_t jAudioPerfMode,
-      uint32_t framesPerBurst);
+      uint32_t framesPerBurst,
+      // Asks for an MMAP exclusive stream at nativeSampleRate, zero if unknown,
+      // resampling the device's audio to it. The device is set to
+      // nativeSampleRate instead of samplingFrequency when it supports it.
+      bool exclusive,
+      uint32_t nativeSampleRate,
+      // Counters of this session; A/V sync only runs on the shared block.
+      StreamingStats& streamingStats = StreamingStats::shared());
   ~UsbAudioStreamer();
 
   UsbAudioStreamer& operator=(const UsbAudioStreamer&) = delete;
@@ -128,60 +162,272 @@ class UsbAudioStreamer final {
   }
 
   bool hasActiveTransfers() const {
+    return submittedTransferCount() > 0 || (feedback_ != nullptr && feedback_->isSubmitted);
+  }
+
+  uint32_t submittedTransferCount() const {
     return std::count_if(
-               transfers_.begin(),
-               transfers_.end(),
-               [](const std::unique_ptr<TransferUserData>& transfer) {
-                 return transfer->isSubmitted;
-               }) > 0;
+        transfers_.begin(),
+        transfers_.end(),
+        [](const std::unique_ptr<TransferUserData>& transfer) { return transfer->isSubmitted; });
+  }
+
+  uint32_t samplingFrequency() const {
+    return samplingFrequency_;
+  }
+
+  uint8_t channelCount() const {
+    return channelCount_;
+  }
+
+  uint8_t subFrameSize() const {
+    return subFrameSize_;
   }
 
+  // Readers of the audio on its way to AAudio, in the stream's encoding,
+  // channels and rate below.
+  AudioTap& audioTap() {
+    return audioTap_;
+  }
+  PcmEncoding outputEncoding() const {
+    return outputConverter_.output();
+  }
+  uint32_t outputChannelCount() const {
+    return outputChannelCount_;
+  }
+  uint32_t outputSampleRate() const {
+    return outputSampleRate_;
+  }
+
+  // Measures the round trip from the speaker to the USB microphone with
+  // bursts LoopbackMeter bursts, which play in place of the microphone's
+  // audio until the last is captured. Returns false when the stream is not
+  // set up or bursts is out of range.
+  bool startLoopbackMeasurement(uint32_t bursts);
+  void cancelLoopbackMeasurement() {
+    loopback_.cancel();
+  }
+  // Of the bursts captured so far, correlated on the calling thread.
+  bool loopbackReport(LoopbackMeter::Report& report) {
+    return loopback_.report(report);
+  }
+
+  // Gain, mute, soft clipping and metering of the audio on its way into the
+  // ring, and so to AAudio and the taps. They keep their settings across
+  // stops and reattaches.
+  AudioGainStage& gainStage() {
+    return gainStage_;
+  }
+
+  // Hands captured PCM to recorder as well, null stops. Returns once no
+  // transfer is being written to the previous recorder.
+  void setRecorder(StreamRecorder* recorder);
+
+  // Called at most once per loss, on the USB event thread, when a transfer
+  // finds the device gone. It must return right away. Before start().
+  void setDeviceLostListener(std::function<void()> listener);
+  bool isDeviceLost() const {
+    return deviceLost_;
+  }
+  // Moves the streamer to deviceFD, the same device opened again after it
+  // was lost: frees the old handle's transfers, claims the audio interface
+  // on the new one and resumes the transfers if it was started. The AAudio
+  // stream keeps playing throughout, silence while the device was gone.
+  bool reattach(intptr_t deviceFD);
+
+  // Finishes a stop still pending from requestStop() first.
   bool start();
   bool isPlaying() const;
+  // Cancels the transfers and asks AAudio to stop without waiting for
+  // either; the streamer is STOPPING until finishStop(). Returns false when
+  // it was not started.
+  bool requestStop();
+  // Waits for what requestStop() cancelled and moves to READY_TO_START.
+  bool finishStop();
   bool stop();
+  StreamerState state() const;
   uint32_t samplesFromByteCount(uint32_t bytes) const;
   std::string statsSummaryString() const;
   bool ensureTransferRequests();
 
  private:
-  libusb_context* context_;
+  std::shared_ptr<UsbSession> session_{};
+  libusb_context* context_{};
+  int deviceFD_{-1};
   libusb_device_handle* deviceHandle_{};
   libusb_config_descriptor* config_{};
   std::vector<std::unique_ptr<TransferUserData>> transfers_{};
   uint8_t endpointAddress_{};
   uint16_t maxPacketSize_{};
+  uint8_t endpointInterval_{}; // bInterval
+  UacSyncType syncType_{UacSyncType::NONE};
+  // Whole frames of one packet interval at the nominal rate, fewer make a
+  // short packet.
+  uint32_t nominalPacketBytes_{};
+  // Length of each packet: a frame more than the nominal rate rounded up,
+  // which a source of a fractional rate or its own clock may send.
+  uint32_t packetBytes_{};
+  // Explicit feedback endpoint of the altsetting, zero without one. Its
+  // transfer reports the device's rate to the resampler.
+  uint8_t feedbackAddress_{};
+  uint16_t feedbackPacketBytes_{};
+  std::unique_ptr<TransferUserData> feedback_{};
+  double feedbackRateHz_{};
   int detachedInterface_{-1};
   int claimedInterface_{-1};
   uint32_t jAudioFormat_{};
   uint32_t samplingFrequency_{};
+  // AAudio's, preferred over samplingFrequency_ when the device has it.
+  uint32_t nativeSampleRate_{};
   uint8_t subFrameSize_{};
   uint8_t channelCount_{};
+  // Channel positions of the USB stream, zero when the device reports none.
+  uint32_t channelMask_{};
+  // Channels of the AAudio stream, which the mixer maps the USB ones to.
+  uint32_t outputChannelCount_{};
   int32_t framesPerBurst_{};
+  StreamingStats& streamingStats_;
+  AvSync* avSync_{};
   int32_t bufferCapacityInFrames_{};
-  const struct libusb_init_option libusbOptions = {.option = LIBUSB_OPTION_NO_DEVICE_DISCOVERY};
-  timeval libusbEventsTimeout_{0, 100}; // 100 microseconds
-  std::unique_ptr<RingBufferPcm> ringBuffer_{std::make_unique<RingBufferPcm>(3072)};
+  // Rate of the AAudio stream, which differs from the USB rate in exclusive mode.
+  uint32_t outputSampleRate_{};
+  // USB subframes go through float and the drift compensating resampler on
+  // their way into the ring, which holds the AAudio stream's format.
+  PcmConverter inputConverter_{};
+  PcmConverter outputConverter_{};
+  AsyncResampler resampler_{};
+  std::vector<float> resamplerInput_{};
+  std::vector<float> resamplerOutput_{};
+  // Downmixes ahead of the resampler and upmixes after it, so it runs on the
+  // fewer channels, through mixBuffer_.
+  ChannelMixer mixer_{};
+  std::vector<float> mixBuffer_{};
+  // Fill in for errored packets, on the USB side, and for underruns in the
+  // playback callback.
+  AudioConcealer packetConcealer_{};
+  AudioConcealer playbackConcealer_{};
+  AudioGainStage gainStage_{};
+  LoopbackMeter loopback_{};
+  // Float output the meter renders into, kLoopbackChunkFrames at a time.
+  std::vector<float> loopbackOutput_{};
+  steady_clock::time_point outputTimestampAt_{};
+  // Latest AAudioStream_getTimestamp(), on CLOCK_MONOTONIC.
+  int64_t outputTimestampFrame_{};
+  int64_t outputTimestampNs_{-1};
+  // Frames that ever went through the ring, so a frame's place in the ring
+  // maps to its position in the AAudio stream. The callback publishes the
+  // difference, which grows with every underrun filled with silence.
+  int64_t ringFramesWritten_{};
+  int64_t ringFramesRead_{};
+  std::atomic<int64_t> ringToStreamOffset_{kNoStreamOffset};
+  // Until the ring first holds prefillFrames_ the callback plays silence,
+  // so playback starts on a full buffer instead of on underruns. The frames
+  // are the target fill of applyLatencySettings().
+  std::atomic<bool> prefilled_{false};
+  std::atomic<size_t> prefillFrames_{};
+  // steady_clock time of start(), and of the estimated presentation of the
+  // first USB sample after it, once the callback has played one.
+  int64_t startNs_{};
+  std::atomic<int64_t> firstAudibleNs_{0};
+  bool firstAudibleLogged_{false};
+  double deliveryLatencyAverageUs_{-1};
+  // Transfers beyond activeTransfers_ are allocated but parked, so the tuner
+  // can add some without allocating on the event thread.
+  AudioLatencyTuner latencyTuner_{};
+  uint32_t activeTransfers_{};
+  bool latencyTunerStarted_{false};
+  // Extra ring buffer fill AvSync asked for.
+  nanoseconds syncDelay_{};
+  steady_clock::time_point latencyTunedAt_{};
+  std::unique_ptr<RingBufferPcm> ringBuffer_{std::make_unique<RingBufferPcm>(6144)};
+  AudioTap audioTap_{};
   std::atomic<StreamerState> state_{StreamerState::INITIAL};
   std::mutex mutex_;
+  // Held by the event thread while it writes a transfer to recorder_.
+  std::mutex recorderMutex_;
+  StreamRecorder* recorder_{};
   std::condition_variable stateChange_;
+  // ADPF session of the USB event thread, opened by the first transfer of a
+  // start and aiming to handle each transfer within the audio it carries.
+  PerformanceHint usbHint_{};
+  bool usbHintOpened_{false};
+  int64_t transferPeriodNs_{};
+
+  std::atomic<bool> deviceLost_{false};
+  std::function<void()> deviceLostListener_{};
+  // For checkStall(): steady_clock time of the last completed transfer.
+  steady_clock::time_point startedAt_{};
+  std::atomic<int64_t> lastTransferNs_{0};
+  uint32_t stallRestarts_{0};
 
+  // Wraps a duplicate of deviceFD and reads its active configuration.
+  bool openDevice(intptr_t deviceFD);
+  // Gives the interface back and closes the handle; no transfer may be left.
+  void closeDevice();
+  void reportDeviceLost();
+  // Claims the streaming altsetting that matches the format and the rate,
+  // picking the rate when none was given, and sets it on the device.
   bool resolveAudioInterface();
+  // Best effort: UAC 1.0 endpoint or UAC 2.0 clock source sampling frequency.
+  void applySampleRate(const UacDescriptors& descriptors, const UacStreamingAltsetting& altsetting);
+  // Null when no altsetting carries the format at rate.
+  const UacStreamingAltsetting* pickAltsetting(
+      const UacDescriptors& descriptors,
+      uint16_t formatTag,
+      uint32_t rate) const;
+  uint32_t packetIntervalUs(uint8_t interval) const;
+  void cancelTransfers();
+  bool resolvePcmEncodings(PcmEncoding& input, PcmEncoding& output) const;
+  // Requests AAudio's start and waits for it once, while the transfers
+  // submitted before fill the ring.
   bool startAudioPlayer();
-  bool stopAudioPlayer();
+  // Longest wait for cancelled transfers and for AAudio to stop.
+  static constexpr milliseconds kStopTimeout = 500ms;
+  // Longest wait for AAudio to start.
+  static constexpr milliseconds kStartTimeout = 500ms;
+  // Without a completed transfer this long StreamWatchdog submits parked
+  // transfers again when none is in flight, and this much longer restarts
+  // the stream, at most kMaxStallRestarts times without progress in between.
+  static constexpr milliseconds kStallTimeout = 200ms;
+  static constexpr milliseconds kStallRestartTimeout = 1s;
+  static constexpr uint32_t kMaxStallRestarts = 3;
+
+  bool waitForTransfers();
+  bool waitForAudioPlayerStop();
   void allocateTransferRequests();
   bool submitTransferRequests();
   static aaudio_data_callback_result_t
   audioPlaybackCallback(AAudioStream* stream, void* userData, void* audioData, int32_t numFrames);
 
   static void transferCallback(libusb_transfer* transfer);
-
-  volatile int stopUsbAudioCapture_{0};
+  static void feedbackCallback(libusb_transfer* transfer);
+  // Playback callback, over what it wrote while the loopback meter is active.
+  void renderLoopback(
+      uint8_t* output,
+      int32_t numFrames,
+      int64_t streamFrame,
+      size_t bufferedFrames);
+  void writeResampled(size_t inputFrames);
+  void publishLevels();
+  void recordDeliveryLatency(int64_t ringFrame, size_t inputFrames, int64_t nowNs);
+  void tuneLatency(steady_clock::time_point now);
+  void applyLatencySettings();
+  // Up to activeTransfers_, returns how many were submitted.
+  uint32_t submitParkedTransfers();
+  // Watchdog thread, while started.
+  void checkStall(steady_clock::time_point now);
 
   AAudioStreamBuilder* audioStreamBuilder_{};
   AAudioStream* audioStream_{};
   UsbAudioStreamerStats streamerStats_{};
-  steady_clock::time_point callbackErrorLoggedAt_{seconds{0}};
 
   static constexpr uint32_t kIsochronousTransferTimeoutMillis = 500;
-  static constexpr uint8_t kInterfaceSubClassStreaming = 0x02;
+  // Picked when the device's UAC 2.0 clock offers it and no rate was given.
+  static constexpr uint32_t kPreferredSampleRate = 48'000;
+  static constexpr uint32_t kSpareTransfers = 4;
+  // Least audio one transfer carries with AAUDIO_PERFORMANCE_MODE_POWER_SAVING.
+  static constexpr int32_t kPowerSavingTransferMs = 16;
+  static constexpr int64_t kNoStreamOffset = INT64_MIN;
+  static constexpr size_t kLoopbackChunkFrames = 256;
+  static constexpr seconds kLatencyTuningInterval{2};
 };
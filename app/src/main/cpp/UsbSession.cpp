@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UsbSession.h"
+
+#include <android/log.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "ThreadPolicy.h"
+#include "Trace.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "UsbSession", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "UsbSession", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "UsbSession", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "UsbSession", __VA_ARGS__)
+
+std::atomic<bool> UsbSession::useLooper_{true};
+
+void UsbSession::setUseLooper(bool useLooper) {
+  useLooper_ = useLooper;
+}
+
+std::shared_ptr<UsbSession> UsbSession::shared() {
+  static std::mutex mutex;
+  static std::weak_ptr<UsbSession> current;
+  std::lock_guard lk(mutex);
+  std::shared_ptr<UsbSession> session = current.lock();
+  if (session == nullptr) {
+    session.reset(new UsbSession());
+    if (!session->start()) {
+      return nullptr;
+    }
+    current = session;
+  }
+  return session;
+}
+
+bool UsbSession::start() {
+  // Android hands out device fds; there is no bus to enumerate.
+  int status = libusb_set_option(nullptr, LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
+  if (status != LIBUSB_SUCCESS) {
+    ULOGE("libusb setting no discovery option failed %s", libusb_error_name(status));
+  }
+  status = libusb_init(&context_);
+  if (status != LIBUSB_SUCCESS) {
+    ULOGE("libusb_init failed %s", libusb_error_name(status));
+    context_ = nullptr;
+    return false;
+  }
+  status = libusb_set_option(context_, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_ERROR);
+  if (status != LIBUSB_SUCCESS) {
+    ULOGW("libusb setting loglevel option failed %s", libusb_error_name(status));
+  }
+#if defined(__ANDROID__)
+  if (useLooper_ && libusb_pollfds_handle_timeouts(context_)) {
+    eventThread_ = std::thread(&UsbSession::looperLoop, this);
+    // Notifiers can only be set once the looper exists.
+    std::unique_lock lk(looperMutex_);
+    looperReady_.wait(lk, [this] { return looperStarted_; });
+    ULOGI("USB session started, on a looper");
+    return true;
+  }
+#endif
+  eventThread_ = std::thread(&UsbSession::eventLoop, this);
+  ULOGI("USB session started, polling in libusb");
+  return true;
+}
+
+UsbSession::~UsbSession() {
+  if (eventThread_.joinable()) {
+    __atomic_store_n(&stop_, 1, __ATOMIC_RELEASE);
+#if defined(__ANDROID__)
+    if (looper_ != nullptr) {
+      ALooper_wake(looper_);
+    } else {
+      libusb_interrupt_event_handler(context_);
+    }
+#else
+    libusb_interrupt_event_handler(context_);
+#endif
+    eventThread_.join();
+  }
+  if (context_ != nullptr) {
+    libusb_exit(context_);
+  }
+  ULOGI("USB session ended after %llu event loops", (unsigned long long)eventLoops());
+}
+
+void UsbSession::eventLoop() {
+  ThreadPolicies::apply(ThreadRole::USB_EVENTS, "usb_events");
+  while (!__atomic_load_n(&stop_, __ATOMIC_ACQUIRE)) {
+    TRACE_SCOPE("handleUsbEvents");
+    eventLoops_.fetch_add(1, std::memory_order_relaxed);
+    // Blocks in poll until a transfer completes or the destructor interrupts it.
+    libusb_handle_events_completed(context_, &stop_);
+  }
+}
+
+#if defined(__ANDROID__)
+void UsbSession::looperLoop() {
+  ThreadPolicies::apply(ThreadRole::USB_EVENTS, "usb_events");
+  ALooper* looper = ALooper_prepare(0);
+  ALooper_acquire(looper);
+  looper_ = looper;
+  // An fd added between these two calls is registered twice, which
+  // ALooper_addFd treats as an update.
+  libusb_set_pollfd_notifiers(context_, &onPollfdAdded, &onPollfdRemoved, this);
+  const libusb_pollfd** pollfds = libusb_get_pollfds(context_);
+  for (const libusb_pollfd** pollfd = pollfds; pollfd != nullptr && *pollfd != nullptr; pollfd++) {
+    onPollfdAdded((*pollfd)->fd, (*pollfd)->events, this);
+  }
+  libusb_free_pollfds(pollfds);
+  {
+    std::lock_guard lk(looperMutex_);
+    looperStarted_ = true;
+  }
+  looperReady_.notify_all();
+
+  while (!__atomic_load_n(&stop_, __ATOMIC_ACQUIRE)) {
+    ALooper_pollOnce(-1, nullptr, nullptr, nullptr);
+  }
+  libusb_set_pollfd_notifiers(context_, nullptr, nullptr, nullptr);
+  ALooper_release(looper);
+}
+
+int UsbSession::onPollfdReady(int fd, int events, void* data) {
+  TRACE_SCOPE("handleUsbEvents");
+  auto* session = static_cast<UsbSession*>(data);
+  session->eventLoops_.fetch_add(1, std::memory_order_relaxed);
+  // The fd is ready, so this handles what is pending without blocking.
+  timeval zero{0, 0};
+  libusb_handle_events_timeout_completed(session->context_, &zero, nullptr);
+  return 1;
+}
+
+void UsbSession::onPollfdAdded(int fd, short events, void* userData) {
+  auto* session = static_cast<UsbSession*>(userData);
+  int looperEvents = ((events & POLLIN) ? ALOOPER_EVENT_INPUT : 0) |
+      ((events & POLLOUT) ? ALOOPER_EVENT_OUTPUT : 0);
+  if (ALooper_addFd(
+          session->looper_, fd, ALOOPER_POLL_CALLBACK, looperEvents, &onPollfdReady, session) !=
+      1) {
+    ULOGE("Could not watch libusb fd %d", fd);
+  }
+}
+
+void UsbSession::onPollfdRemoved(int fd, void* userData) {
+  auto* session = static_cast<UsbSession*>(userData);
+  ALooper_removeFd(session->looper_, fd);
+}
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#if defined(__ANDROID__)
+#include <android/looper.h>
+#endif
+#include <libusb/libusb.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// One libusb context and event thread for every streamer of the process.
+//
+// The audio streamer wraps its device fd into the context directly and
+// libuvc gets it as an external context, so it starts no handler thread of
+// its own. Completions of both streamers' transfers then run on a single
+// thread that only wakes for USB events. Its USB_EVENTS thread policy runs
+// it at audio priority by default since audio completions feed the AAudio
+// callback; the video completions it also runs only copy payloads into
+// libuvc's frames.
+//
+// By default that thread is an ALooper watching libusb's pollfds, kept in
+// sync through libusb's fd notifiers, and each ready fd handles events
+// without blocking. Otherwise it blocks in libusb's own poll. The looper
+// needs libusb to keep its timeouts on a pollfd, which Linux's timerfd does.
+// Host builds have no looper and always poll in libusb.
+//
+// Streamers hold the session through shared(); it is torn down when the last
+// one lets go, after their device handles and transfers are gone.
+class UsbSession final {
+ public:
+  UsbSession(const UsbSession&) = delete;
+  UsbSession& operator=(const UsbSession&) = delete;
+  ~UsbSession();
+
+  // The running session, started on first use. Null if libusb failed.
+  static std::shared_ptr<UsbSession> shared();
+  // Takes effect for the next session.
+  static void setUseLooper(bool useLooper);
+
+  libusb_context* context() const {
+    return context_;
+  }
+
+  // Passes of the event loop so far, for stats.
+  uint64_t eventLoops() const {
+    return eventLoops_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static std::atomic<bool> useLooper_;
+
+  libusb_context* context_{};
+  std::thread eventThread_{};
+  int stop_{0};
+  std::atomic<uint64_t> eventLoops_{0};
+#if defined(__ANDROID__)
+  // Set up by the looper thread before start() returns.
+  ALooper* looper_{};
+  std::mutex looperMutex_;
+  std::condition_variable looperReady_;
+  bool looperStarted_{false};
+#endif
+
+  UsbSession() = default;
+  bool start();
+  void eventLoop();
+#if defined(__ANDROID__)
+  void looperLoop();
+  static int onPollfdReady(int fd, int events, void* data);
+  static void onPollfdAdded(int fd, short events, void* userData);
+  static void onPollfdRemoved(int fd, void* userData);
+#endif
+};
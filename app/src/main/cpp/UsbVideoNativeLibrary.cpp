@@ -14,33 +14,507 @@
  * limitations under the License.
  */
 
+#include <android/hardware_buffer_jni.h>
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
+#include <android/thermal.h>
 #include <jni.h>
+#include <malloc.h>
 #include <memory.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <format>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "AvSync.h"
+#include "BufferAllocator.h"
+#include "FastPaths.h"
+#include "FrameEventQueue.h"
+#include "HardwareFrameBuffers.h"
+#include "InstantReplay.h"
+#include "LibraryLoad.h"
+#include "ModeSelector.h"
+#include "MjpegRecorder.h"
+#include "MotionStandby.h"
+#include "NegotiationCache.h"
+#include "PreRollRecorder.h"
+#include "ReconnectManager.h"
+#include "RtpSender.h"
+#include "StartupOrchestrator.h"
+#include "StreamRecorder.h"
+#include "StreamerController.h"
+#include "StreamerReaper.h"
+#include "StreamingStats.h"
+#include "TelemetryLog.h"
+#include "ThreadPolicy.h"
+#include "ThroughputProbe.h"
 #include "UsbAudioStreamer.h"
+#include "UsbSession.h"
 #include "UsbVideoStreamer.h"
+#include "UvcFormatTable.h"
 #include "clog.h"
 
+#if defined(USB_VIDEO_PGO_GENERATE)
+// The profile runtime linked in by -fprofile-generate.
+extern "C" void __llvm_profile_set_filename(const char* name);
+extern "C" int __llvm_profile_write_file(void);
+#endif
+
 static JavaVM* javaVM_ = nullptr;
 
 static std::unique_ptr<UsbAudioStreamer> streamer_{};
 static std::unique_ptr<UsbVideoStreamer> uvcStreamer_{};
+static std::unique_ptr<StreamRecorder> recorder_{};
+// Builds streamer_ and uvcStreamer_ off the calling thread; the disconnect
+// entry points wait for it before touching them.
+static StartupOrchestrator startup_{};
+
+// Keeps streamer_ and uvcStreamer_ up through a loss of their device. Made
+// on first use, so loading the library starts no thread.
+static ReconnectManager& reconnect() {
+  static ReconnectManager manager;
+  return manager;
+}
+
+// Fast start for the video streamers connected from now on, see
+// UsbVideoStreamer::setFastStart().
+static std::atomic<bool> videoFastStart_{false};
 
 using ANativeWindowOwner = std::unique_ptr<ANativeWindow, decltype(&ANativeWindow_release)>;
 static ANativeWindowOwner previewWindow_ = ANativeWindowOwner(nullptr, &ANativeWindow_release);
 
+// The last summary handed to Java, returned again while the text is unchanged.
+static std::mutex summaryMutex_;
+static std::string lastSummary_;
+static jstring lastSummaryString_ = nullptr;
+
+// Additional cameras, opened through the handle based entry points next to the
+// default streamers above. Every session has its own streamers, preview window
+// and stats block; the USB event thread and the stripe workers are shared.
+struct CameraSession {
+  std::unique_ptr<UsbVideoStreamer> video{};
+  std::unique_ptr<UsbAudioStreamer> audio{};
+  ANativeWindowOwner previewWindow{nullptr, &ANativeWindow_release};
+  uint32_t statsSlot{};
+};
+
+// Held across calls into a session's streamers, which may block in stop().
+static std::mutex sessionsMutex_;
+static std::map<jint, CameraSession> sessions_{};
+static jint nextSessionHandle_ = 1;
+// Matches frames across the sessions of synchronizedHandles_, by stream index.
+static std::shared_ptr<FrameSynchronizer> frameSynchronizer_{};
+static std::vector<jint> synchronizedHandles_{};
+
+// Lowest stats block no open session uses, zero when all are taken. Block 0
+// belongs to the default streamers.
+static uint32_t freeStatsSlot() {
+  for (uint32_t slot = 1; slot < StreamingStats::kMaxSessions; slot++) {
+    if (std::none_of(sessions_.begin(), sessions_.end(), [slot](const auto& entry) {
+          return entry.second.statsSlot == slot;
+        })) {
+      return slot;
+    }
+  }
+  return 0;
+}
+
+static CameraSession* findSession(jint handle) {
+  auto it = sessions_.find(handle);
+  return it != sessions_.end() ? &it->second : nullptr;
+}
+
+// Handle 0 is the default video streamer.
+static UsbVideoStreamer* findVideoStreamer(jint handle) {
+  if (handle == 0) {
+    return uvcStreamer_.get();
+  }
+  CameraSession* session = findSession(handle);
+  return session != nullptr ? session->video.get() : nullptr;
+}
+
+// Camera of a video streamer. Callers may use it without sessionsMutex_, so
+// cached control answers can call back into Java.
+static std::shared_ptr<UvcDevice> findDevice(jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* streamer = findVideoStreamer(handle);
+  return streamer != nullptr ? streamer->device() : nullptr;
+}
+
+// Runs fn with a JNIEnv for the calling native thread, attaching the thread
+// for the call when the VM does not know it yet.
+template <typename Fn>
+static void withJniEnv(Fn&& fn) {
+  if (javaVM_ == nullptr) {
+    return;
+  }
+  JNIEnv* env = nullptr;
+  bool attached = false;
+  if (javaVM_->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_4) == JNI_EDETACHED) {
+    if (javaVM_->AttachCurrentThread(&env, nullptr) != JNI_OK) {
+      CLOGE("Attaching a native thread failed");
+      return;
+    }
+    attached = true;
+  }
+  fn(env);
+  if (attached) {
+    javaVM_->DetachCurrentThread();
+  }
+}
+
+// The default streamers report their device's loss to reconnect().
+static void watchDeviceLoss(UsbVideoStreamer& video) {
+  video.setDeviceLostListener([] { reconnect().reportLoss("video"); });
+}
+
+static void watchDeviceLoss(UsbAudioStreamer& audio) {
+  audio.setDeviceLostListener([] { reconnect().reportLoss("audio"); });
+}
+
+// Calls listener.onUvcControlComplete once with the result, then drops the
+// global reference. A null listener ignores the result.
+static UvcControlQueue::Callback controlCallback(JNIEnv* env, jobject jListener) {
+  if (jListener == nullptr) {
+    return nullptr;
+  }
+  jmethodID onComplete =
+      env->GetMethodID(env->GetObjectClass(jListener), "onUvcControlComplete", "(I[B)V");
+  if (onComplete == nullptr) {
+    return nullptr;
+  }
+  jobject listener = env->NewGlobalRef(jListener);
+  return [listener, onComplete](uvc_error_t result, const uint8_t* data, uint16_t length) {
+    withJniEnv([&](JNIEnv* threadEnv) {
+      jbyteArray answer = nullptr;
+      if (result == UVC_SUCCESS && data != nullptr) {
+        answer = threadEnv->NewByteArray(length);
+        if (answer != nullptr) {
+          threadEnv->SetByteArrayRegion(answer, 0, length, reinterpret_cast<const jbyte*>(data));
+        }
+      }
+      threadEnv->CallVoidMethod(listener, onComplete, (jint)result, answer);
+      if (answer != nullptr) {
+        threadEnv->DeleteLocalRef(answer);
+      }
+      threadEnv->DeleteGlobalRef(listener);
+    });
+  };
+}
+
+static jint addCameraSession(
+    JNIEnv* env,
+    std::shared_ptr<UvcDevice> device,
+    jint interfaceNumber,
+    jint width,
+    jint height,
+    jint fps,
+    jint libuvcFrameFormat,
+    jobject jSurface) {
+  uint32_t statsSlot = freeStatsSlot();
+  if (statsSlot == 0) {
+    CLOGE("No stats block left for another camera session");
+    return -1;
+  }
+  CameraSession session;
+  session.statsSlot = statsSlot;
+  session.video = std::make_unique<UsbVideoStreamer>(
+      std::move(device),
+      interfaceNumber,
+      width,
+      height,
+      fps,
+      static_cast<uvc_frame_format>(libuvcFrameFormat),
+      2,
+      FrameDropPolicy::DROP_OLDEST,
+      StreamingStats::forSession(statsSlot));
+  session.previewWindow.reset(ANativeWindow_fromSurface(env, jSurface));
+  if (!session.video->configureOutput(session.previewWindow.get())) {
+    return -1;
+  }
+  jint handle = nextSessionHandle_++;
+  sessions_.emplace(handle, std::move(session));
+  CLOGI(
+      "Opened camera session %d, interface %d, stats block %u",
+      handle,
+      interfaceNumber,
+      statsSlot);
+  return handle;
+}
+
+// Asks the streamers to stop and hands them to the reaper, which tears them
+// down, then releases the window they drew into, off the calling thread.
+static void retireStreamers(
+    std::unique_ptr<UsbVideoStreamer> video,
+    std::unique_ptr<UsbAudioStreamer> audio,
+    ANativeWindowOwner window) {
+  if (video == nullptr && audio == nullptr && window == nullptr) {
+    return;
+  }
+  if (video != nullptr) {
+    video->requestStop();
+  }
+  if (audio != nullptr) {
+    audio->requestStop();
+  }
+  // std::function needs a copyable teardown. The references are moved all
+  // the way into the reaper's queue, so the last one is dropped there.
+  StreamerReaper::shared().retire(
+      [retiredVideo = std::shared_ptr<UsbVideoStreamer>(std::move(video)),
+       retiredAudio = std::shared_ptr<UsbAudioStreamer>(std::move(audio)),
+       retiredWindow = std::shared_ptr<ANativeWindow>(std::move(window))]() mutable {
+        retiredAudio = nullptr;
+        retiredVideo = nullptr;
+        retiredWindow = nullptr;
+      });
+}
+
+// The RTP stream of the default video streamer, fed by the camera itself for
+// H.264 and H.265 streams and by recorder_'s encoder otherwise.
+static std::shared_ptr<RtpSender> networkSink_{};
+static bool networkFromRecorder_ = false;
+// recorder_ was started for networkSink_ alone, without a file.
+static bool networkOwnsRecorder_ = false;
+
+// The instant replay of the default video streamer, fed like networkSink_.
+static std::shared_ptr<InstantReplay> instantReplay_{};
+static bool replayFromRecorder_ = false;
+// recorder_ was started for instantReplay_ alone, without a file.
+static bool replayOwnsRecorder_ = false;
+// A recording that began in the past, following instantReplay_.
+static std::unique_ptr<MjpegRecorder> preRollMjpegRecorder_{};
+static std::unique_ptr<PreRollRecorder> preRollRecorder_{};
+
+// Motion standby of the default video streamer. An event records to the fds
+// armed last, which the app keeps open until told the event ended, and
+// writes the pre-roll from the standby stream's instant replay first.
+static std::shared_ptr<MotionStandby> motionStandby_{};
+static NegotiationCache::Mode motionFullMode_{};
+static std::mutex motionFdsMutex_;
+static int motionRecordingFd_ = -1;
+static int motionPreRollFd_ = -1;
+// How the running event records, on the video lane.
+enum class MotionRecording {
+  kNone,
+  kEncoded, // recorder_
+  kMjpeg, // UsbVideoStreamer::startMjpegRecording()
+  kPassthrough, // preRollRecorder_ following instantReplay_
+};
+static MotionRecording motionRecording_ = MotionRecording::kNone;
+// instantReplay_ is the standby stream's, started for the pre-roll.
+static bool motionOwnsReplay_ = false;
+
+// Leaves the recording and the replay to whoever stops them next.
+static void releaseMotionStandby() {
+  if (motionStandby_ == nullptr) {
+    return;
+  }
+  motionStandby_->stop();
+  motionStandby_ = nullptr;
+  motionRecording_ = MotionRecording::kNone;
+  motionOwnsReplay_ = false;
+  std::lock_guard lk(motionFdsMutex_);
+  motionRecordingFd_ = -1;
+  motionPreRollFd_ = -1;
+}
+
+static bool stopPreRollRecording() {
+  bool finalized = false;
+  if (preRollMjpegRecorder_ != nullptr) {
+    finalized = preRollMjpegRecorder_->stop();
+    preRollMjpegRecorder_ = nullptr;
+  }
+  if (preRollRecorder_ != nullptr) {
+    finalized = preRollRecorder_->stop();
+    preRollRecorder_ = nullptr;
+  }
+  return finalized;
+}
+
+static void releaseNetworkSink() {
+  CLOGI("%s", networkSink_->summary().c_str());
+  networkSink_ = nullptr;
+  networkFromRecorder_ = false;
+  networkOwnsRecorder_ = false;
+}
+
+static void releaseInstantReplay() {
+  stopPreRollRecording();
+  instantReplay_ = nullptr;
+  replayFromRecorder_ = false;
+  replayOwnsRecorder_ = false;
+}
+
+// Also ends a network stream and an instant replay encoded by the recorder.
+static bool stopRecording() {
+  if (recorder_ == nullptr) {
+    return false;
+  }
+  if (streamer_ != nullptr) {
+    streamer_->setRecorder(nullptr);
+  }
+  if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->detachRecorder();
+  }
+  if (networkFromRecorder_) {
+    recorder_->setNetworkSink(nullptr);
+    releaseNetworkSink();
+  }
+  if (replayFromRecorder_) {
+    recorder_->setInstantReplay(nullptr);
+    releaseInstantReplay();
+  }
+  bool finalized = recorder_->stop();
+  recorder_ = nullptr;
+  return finalized;
+}
+
+static void stopNetworkStream() {
+  if (networkSink_ == nullptr) {
+    return;
+  }
+  if (networkOwnsRecorder_ && !replayFromRecorder_) {
+    stopRecording();
+    return;
+  }
+  if (networkFromRecorder_) {
+    recorder_->setNetworkSink(nullptr);
+    // The replay still encodes with it.
+    replayOwnsRecorder_ |= networkOwnsRecorder_;
+  } else if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->setNetworkSink(nullptr);
+  }
+  releaseNetworkSink();
+}
+
+static void stopInstantReplay() {
+  if (instantReplay_ == nullptr) {
+    return;
+  }
+  if (replayOwnsRecorder_ && !networkFromRecorder_) {
+    stopRecording();
+    return;
+  }
+  if (replayFromRecorder_) {
+    recorder_->setInstantReplay(nullptr);
+    networkOwnsRecorder_ |= replayOwnsRecorder_;
+  } else if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->setInstantReplay(nullptr);
+  }
+  releaseInstantReplay();
+}
+
+// Stats handles are addresses of StreamingStats blocks, which are never freed.
+// Anything else reads as an empty block.
+static const StreamingStats* statsFromHandle(jlong handle) {
+  for (uint32_t slot = 0; slot < StreamingStats::kMaxSessions; slot++) {
+    const StreamingStats& stats = StreamingStats::forSession(slot);
+    if (handle == reinterpret_cast<jlong>(&stats)) {
+      return &stats;
+    }
+  }
+  return nullptr;
+}
+
+static FrameEventQueue* frameEventsFromHandle(jlong handle) {
+  const StreamingStats* stats = statsFromHandle(handle);
+  return stats != nullptr ? FrameEventQueue::forStats(*stats) : nullptr;
+}
+
+// @CriticalNative getters, bound by RegisterNatives in JNI_OnLoad. They take
+// neither JNIEnv nor jclass, and must not block or call back into Java.
+static jint JNICALL usbDeviceSpeedCritical() {
+  if (streamer_ != nullptr) {
+    return streamer_->getUsbDeviceSpeed();
+  }
+  return 0; /* LIBUSB_SPEED_UNKNOWN */
+}
+
+static jlong JNICALL statsHandleCritical() {
+  return reinterpret_cast<jlong>(&StreamingStats::shared());
+}
+
+static jlong JNICALL videoFpsCritical(jlong handle) {
+  const StreamingStats* stats = statsFromHandle(handle);
+  return stats != nullptr ? stats->videoRender.fps.load() : 0;
+}
+
+static jlong JNICALL videoLatencyUsCritical(jlong handle, jint stage, jint percentile) {
+  const StreamingStats* stats = statsFromHandle(handle);
+  if (stats == nullptr || stage < 0 || stage >= (jint)kVideoLatencyStages || percentile < 0 ||
+      percentile >= (jint)kPublishedPercentiles) {
+    return 0;
+  }
+  return stats->videoRender.latencyPercentilesUs[stage * kPublishedPercentiles + percentile].load();
+}
+
+static jlong JNICALL audioLatencyUsCritical(jlong handle, jint percentile) {
+  const StreamingStats* stats = statsFromHandle(handle);
+  if (stats == nullptr || percentile < 0 || percentile >= (jint)kPublishedPercentiles) {
+    return 0;
+  }
+  return stats->audio.latencyPercentilesUs[percentile].load();
+}
+
+static jlong JNICALL audioRingFillFramesCritical(jlong handle) {
+  const StreamingStats* stats = statsFromHandle(handle);
+  return stats != nullptr ? stats->audio.ringFillFrames.load() : 0;
+}
+
+static jlong JNICALL frameEventsLostCritical(jlong handle) {
+  FrameEventQueue* events = frameEventsFromHandle(handle);
+  return events != nullptr ? events->lost() : 0;
+}
+
+static const JNINativeMethod kCriticalNatives[] = {
+    {"usbDeviceSpeedNative", "()I", reinterpret_cast<void*>(usbDeviceSpeedCritical)},
+    {"statsHandleNative", "()J", reinterpret_cast<void*>(statsHandleCritical)},
+    {"videoFpsNative", "(J)J", reinterpret_cast<void*>(videoFpsCritical)},
+    {"videoLatencyUsNative", "(JII)J", reinterpret_cast<void*>(videoLatencyUsCritical)},
+    {"audioLatencyUsNative", "(JI)J", reinterpret_cast<void*>(audioLatencyUsCritical)},
+    {"audioRingFillFramesNative", "(J)J", reinterpret_cast<void*>(audioRingFillFramesCritical)},
+    {"frameEventsLostNative", "(J)J", reinterpret_cast<void*>(frameEventsLostCritical)},
+};
+
+// @CriticalNative methods cannot be found by name before API 31.
+static bool registerCriticalNatives(JNIEnv* env) {
+  jclass library = env->FindClass("com/meta/usbvideo/UsbVideoNativeLibrary");
+  if (library == nullptr) {
+    env->ExceptionClear();
+    return false;
+  }
+  jint result = env->RegisterNatives(
+      library, kCriticalNatives, sizeof(kCriticalNatives) / sizeof(kCriticalNatives[0]));
+  env->DeleteLocalRef(library);
+  if (result != JNI_OK) {
+    env->ExceptionClear();
+    return false;
+  }
+  return true;
+}
+
 extern "C" {
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* jvm, void* reserved) {
+  steady_clock::time_point begin = steady_clock::now();
   javaVM_ = jvm;
+  BufferAllocator::installForLibuvc();
   JNIEnv* env;
   if (JNI_OK != jvm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_4)) {
     CLOGE("Get JNIEnv failed");
     return JNI_ERR;
   }
+  if (!registerCriticalNatives(env)) {
+    CLOGE("Registering critical natives failed");
+  }
+  LibraryLoad::recordOnLoad(begin);
   CLOGI("JNI_OnLoad success!");
   return JNI_VERSION_1_4;
 }
@@ -53,12 +527,54 @@ JNIEXPORT void JNICALL JNI_OnUnload(JavaVM* jvm, void* reserved) {
   CLOGI("JNI_OnUnload success!");
 }
 
-JNIEXPORT jint JNICALL
-Java_com_meta_usbvideo_UsbVideoNativeLibrary_getUsbDeviceSpeed(JNIEnv* env, jobject self) {
-  if (streamer_ != nullptr) {
-    return streamer_->getUsbDeviceSpeed();
-  }
-  return 0; /* LIBUSB_SPEED_UNKNOWN */
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setNegotiationCacheDirNative(
+    JNIEnv* env,
+    jobject self,
+    jstring jDir) {
+  const char* dir = env->GetStringUTFChars(jDir, nullptr);
+  NegotiationCache::shared().setDirectory(dir);
+  ModeCostModel::shared().setDirectory(dir);
+  ThroughputProbe::shared().setDirectory(dir);
+  env->ReleaseStringUTFChars(jDir, dir);
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_recordLibraryLoadNative(
+    JNIEnv* env,
+    jobject self,
+    jlong loadUs) {
+  LibraryLoad::recordLoad(loadUs);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setHardwareFrameBuffersNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  return HardwareFrameBuffers::setEnabled(enabled);
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setFastPathsNative(
+    JNIEnv* env,
+    jobject self,
+    jint allowed,
+    jint cohort) {
+  FastPaths::set((uint32_t)allowed, (uint32_t)cohort);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startTelemetryLogNative(
+    JNIEnv* env,
+    jobject self,
+    jstring jPath,
+    jint capacity) {
+  const char* path = env->GetStringUTFChars(jPath, nullptr);
+  bool started = TelemetryLog::shared().start(
+      path, capacity > 0 ? (uint32_t)capacity : TelemetryLog::kDefaultCapacity);
+  env->ReleaseStringUTFChars(jPath, path);
+  return started;
+}
+
+JNIEXPORT void JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopTelemetryLogNative(JNIEnv* env, jobject self) {
+  TelemetryLog::shared().stop();
 }
 
 JNIEXPORT jboolean JNICALL
@@ -75,9 +591,13 @@ Java_com_meta_usbvideo_UsbVideoNativeLibrary_connectUsbVideoStreamingNative(
       " Java_com_meta_usbvideo_UsbVideoNativeLibrary__connectUsbVideoStreamingNative called with deviceFd %d",
       deviceFd);
   if (uvcStreamer_ == nullptr) {
+    // A previous streamer may still hold the camera's interfaces.
+    StreamerReaper::shared().drain();
     uvcStreamer_ = std::make_unique<UsbVideoStreamer>(
         (intptr_t)deviceFd, width, height, fps, static_cast<uvc_frame_format>(libuvcFrameFormat));
-    previewWindow_.reset(ANativeWindow_fromSurface(env, jSurface));
+    watchDeviceLoss(*uvcStreamer_);
+    // No surface streams headless.
+    previewWindow_.reset(jSurface != nullptr ? ANativeWindow_fromSurface(env, jSurface) : nullptr);
     return uvcStreamer_->configureOutput(previewWindow_.get());
   }
   return false;
@@ -98,79 +618,2615 @@ JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopUsbVideo
     JNIEnv* env,
     jobject self) {
   if (uvcStreamer_ != nullptr) {
-    uvcStreamer_->stop();
+    uvcStreamer_->requestStop();
+  }
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_pauseUsbVideoStreamingNative(
+    JNIEnv* env,
+    jobject self) {
+  return uvcStreamer_ != nullptr && uvcStreamer_->pause();
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_resumeUsbVideoStreamingNative(
+    JNIEnv* env,
+    jobject self) {
+  return uvcStreamer_ != nullptr && uvcStreamer_->resume();
+}
+
+static bool reconfigureVideo(jint width, jint height, jint fps, jint libuvcFrameFormat) {
+  // A fast start may still be switching modes.
+  startup_.wait();
+  if (uvcStreamer_ == nullptr) {
+    return false;
   }
+  return uvcStreamer_->reconfigure(
+      width, height, fps, static_cast<uvc_frame_format>(libuvcFrameFormat));
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_reconfigureUsbVideoStreamingNative(
+    JNIEnv* env,
+    jobject self,
+    jint width,
+    jint height,
+    jint fps,
+    jint libuvcFrameFormat) {
+  return reconfigureVideo(width, height, fps, libuvcFrameFormat);
+}
+
+static void disconnectVideo() {
+  // Whatever the startup has not done yet is no longer wanted.
+  startup_.cancelVideo();
+  startup_.wait();
+  reconnect().finish(false);
+  releaseMotionStandby();
+  stopNetworkStream();
+  stopInstantReplay();
+  stopRecording();
+  retireStreamers(std::move(uvcStreamer_), nullptr, std::move(previewWindow_));
+  UvcDevice::releaseKept();
 }
 
 JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_disconnectUsbVideoStreamingNative(
         JNIEnv* env,
         jobject self) {
-  uvcStreamer_ = nullptr;
-  previewWindow_.reset(nullptr);
+  disconnectVideo();
 }
 
-JNIEXPORT jstring JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_streamingStatsSummaryString(
+JNIEXPORT jintArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_rankVideoModesNative(
     JNIEnv* env,
-    jobject self) {
-  std::string result = "";
-  if (streamer_ != nullptr) {
-    result += streamer_->statsSummaryString();
-    result += "\n";
+    jobject self,
+    jint deviceFd,
+    jint surfaceWidth,
+    jint surfaceHeight) {
+  std::shared_ptr<UvcDevice> device = UvcDevice::openKept((intptr_t)deviceFd);
+  if (device == nullptr) {
+    return nullptr;
   }
-  if (uvcStreamer_ != nullptr) {
-    result += uvcStreamer_->statsSummaryString();
+  std::vector<jint> modes;
+  for (const ModeSelector::Candidate& candidate :
+       ModeSelector::rank(*device, surfaceWidth, surfaceHeight)) {
+    modes.insert(
+        modes.end(),
+        {candidate.format,
+         candidate.width,
+         candidate.height,
+         candidate.fps,
+         candidate.interfaceNumber,
+         (candidate.fitsBus ? 1 : 0) | (candidate.fitsCpu ? 2 : 0)});
   }
-  return env->NewStringUTF(result.c_str());
+  jintArray result = env->NewIntArray(modes.size());
+  if (result != nullptr) {
+    env->SetIntArrayRegion(result, 0, modes.size(), modes.data());
+  }
+  return result;
 }
 
-JNIEXPORT jboolean JNICALL
-Java_com_meta_usbvideo_UsbVideoNativeLibrary_connectUsbAudioStreamingNative(
+JNIEXPORT jlongArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_probeUsbThroughputNative(
     JNIEnv* env,
-    jobject tis,
+    jobject self,
     jint deviceFd,
-    jint jAudioFormat,
-    jint samplingFrequency,
-    jint subFrameSize,
-    jint channelCount,
-    jint jAudioPerfMode,
-    jint outputFramesPerBuffer) {
-  if (streamer_ != nullptr) {
-    //CLOGE("startUsbAudioStreamingNative called before stopUsbAudioStreamingNative was called");
-    return true;
+    jint durationMs,
+    jboolean reprobe) {
+  std::shared_ptr<UvcDevice> device = UvcDevice::openKept((intptr_t)deviceFd);
+  if (device == nullptr) {
+    return nullptr;
   }
-  streamer_ = std::make_unique<UsbAudioStreamer>(
-      (intptr_t)deviceFd,
-      jAudioFormat,
-      samplingFrequency,
-      subFrameSize,
-      channelCount,
-      jAudioPerfMode,
-      outputFramesPerBuffer);
-  return streamer_ != nullptr;
+  ThroughputProbe& probe = ThroughputProbe::shared();
+  ThroughputProbe::Result result;
+  milliseconds duration =
+      durationMs > 0 ? milliseconds(durationMs) : ThroughputProbe::kDefaultDuration;
+  if ((reprobe || !probe.find(*device, result)) && !probe.probe(*device, duration, result)) {
+    return nullptr;
+  }
+  jlong values[] = {
+      result.interfaceNumber,
+      result.format,
+      result.width,
+      result.height,
+      result.fps,
+      result.speed,
+      (jlong)result.modeBytesPerSecond,
+      (jlong)result.bytesPerSecond,
+      std::lround(result.packetErrorRate * 1e6),
+      std::lround(result.framesPerSecond * 1000),
+      std::lround(result.frameJitterUs),
+      (jlong)result.ceiling(),
+  };
+  jlongArray array = env->NewLongArray(std::size(values));
+  if (array != nullptr) {
+    env->SetLongArrayRegion(array, 0, std::size(values), values);
+  }
+  return array;
 }
 
+JNIEXPORT jintArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_planVideoModesNative(
+    JNIEnv* env,
+    jobject self,
+    jintArray jDeviceFds,
+    jint surfaceWidth,
+    jint surfaceHeight) {
+  jsize count = env->GetArrayLength(jDeviceFds);
+  std::vector<jint> deviceFds(count);
+  env->GetIntArrayRegion(jDeviceFds, 0, count, deviceFds.data());
+  std::vector<std::shared_ptr<UvcDevice>> devices;
+  std::vector<UvcDevice*> planned;
+  for (jint deviceFd : deviceFds) {
+    std::shared_ptr<UvcDevice> device = UvcDevice::open((intptr_t)deviceFd);
+    if (device == nullptr) {
+      return nullptr;
+    }
+    planned.push_back(device.get());
+    devices.push_back(std::move(device));
+  }
+  std::vector<ModeSelector::Candidate> modes;
+  ModeSelector::plan(planned, surfaceWidth, surfaceHeight, modes);
+  std::vector<jint> values;
+  for (const ModeSelector::Candidate& mode : modes) {
+    values.insert(
+        values.end(),
+        {mode.format,
+         mode.width,
+         mode.height,
+         mode.fps,
+         mode.interfaceNumber,
+         (mode.fitsBus ? 1 : 0) | (mode.fitsCpu ? 2 : 0)});
+  }
+  jintArray result = env->NewIntArray(values.size());
+  if (result != nullptr) {
+    env->SetIntArrayRegion(result, 0, values.size(), values.data());
+  }
+  return result;
+}
 
-JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_disconnectUsbAudioStreamingNative(
-        JNIEnv* env,
-        jobject self) {
-  if (streamer_ != nullptr) {
-    streamer_ = nullptr;
+JNIEXPORT jbyteArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_videoFormatTableNative(
+    JNIEnv* env,
+    jobject self,
+    jint deviceFd) {
+  std::shared_ptr<UvcDevice> device = UvcDevice::openKept((intptr_t)deviceFd);
+  if (device == nullptr) {
+    return nullptr;
   }
+  std::vector<uint8_t> table = encodeUvcFormatTable(device->handle());
+  if (table.empty()) {
+    return nullptr;
+  }
+  jbyteArray result = env->NewByteArray(table.size());
+  if (result != nullptr) {
+    env->SetByteArrayRegion(
+        result, 0, table.size(), reinterpret_cast<const jbyte*>(table.data()));
+  }
+  return result;
 }
-JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startUsbAudioStreamingNative(
-        JNIEnv* env,
-        jobject self) {
-  if (streamer_ != nullptr) {
-    streamer_->start();
+
+static bool startRecording(int fd, bool hevc, int32_t bitRate) {
+  if (uvcStreamer_ == nullptr || recorder_ != nullptr) {
+    return false;
   }
+  StreamRecorder::VideoConfig video{
+      .width = uvcStreamer_->captureWidth(),
+      .height = uvcStreamer_->captureHeight(),
+      .fps = uvcStreamer_->captureFps(),
+      .bitRate = bitRate,
+      .hevc = hevc,
+  };
+  StreamRecorder::AudioConfig audio{};
+  // The audio path only carries 16 bit PCM.
+  if (streamer_ != nullptr && streamer_->isPlaying() && streamer_->subFrameSize() == 2) {
+    audio.sampleRate = streamer_->samplingFrequency();
+    audio.channelCount = streamer_->channelCount();
+  }
+  auto recorder = std::make_unique<StreamRecorder>();
+  if (!recorder->start(fd, video, audio) || !uvcStreamer_->attachRecorder(recorder.get())) {
+    return false;
+  }
+  if (audio.sampleRate > 0) {
+    streamer_->setRecorder(recorder.get());
+  }
+  recorder_ = std::move(recorder);
+  return true;
 }
 
-JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopUsbAudioStreamingNative(
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startRecordingNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd,
+    jboolean hevc,
+    jint bitRate) {
+  return startRecording(fd, hevc, bitRate);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopRecordingNative(
     JNIEnv* env,
     jobject self) {
-  if (streamer_ != nullptr) {
-    streamer_->stop();
+  return stopRecording();
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startNetworkStreamNative(
+    JNIEnv* env,
+    jobject self,
+    jstring jHost,
+    jint port,
+    jboolean hevc,
+    jint bitRate,
+    jint mtu) {
+  if (uvcStreamer_ == nullptr || networkSink_ != nullptr || port <= 0 || port > 0xFFFF) {
+    return false;
+  }
+  uvc_frame_format format = uvcStreamer_->captureFrameFormat();
+  bool passthrough = format == UVC_FRAME_FORMAT_H264 || format == UVC_FRAME_FORMAT_H265;
+  RtpSender::Config config{
+      .hevc = passthrough ? format == UVC_FRAME_FORMAT_H265 : (bool)hevc,
+      .mtu = mtu > 0 ? (uint32_t)mtu : RtpSender::kDefaultMtu,
+      .bitRate = bitRate,
+  };
+  // A running recording decides the codec.
+  if (!passthrough && recorder_ != nullptr) {
+    config.hevc = recorder_->hevc();
+  }
+  auto sink = std::make_shared<RtpSender>();
+  const char* host = env->GetStringUTFChars(jHost, nullptr);
+  bool opened = sink->open(host, port, config);
+  env->ReleaseStringUTFChars(jHost, host);
+  if (!opened) {
+    return false;
+  }
+  if (passthrough) {
+    if (!uvcStreamer_->setNetworkSink(sink)) {
+      return false;
+    }
+  } else {
+    bool ownsRecorder = recorder_ == nullptr;
+    if (ownsRecorder) {
+      StreamRecorder::VideoConfig video{
+          .width = uvcStreamer_->captureWidth(),
+          .height = uvcStreamer_->captureHeight(),
+          .fps = uvcStreamer_->captureFps(),
+          .bitRate = bitRate,
+          .hevc = config.hevc,
+      };
+      auto recorder = std::make_unique<StreamRecorder>();
+      if (!recorder->start(-1, video, {}) || !uvcStreamer_->attachRecorder(recorder.get())) {
+        return false;
+      }
+      recorder_ = std::move(recorder);
+    }
+    recorder_->setNetworkSink(sink);
+    networkFromRecorder_ = true;
+    networkOwnsRecorder_ = ownsRecorder;
+  }
+  networkSink_ = std::move(sink);
+  return true;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopNetworkStreamNative(
+    JNIEnv* env,
+    jobject self) {
+  stopNetworkStream();
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_requestNetworkKeyframeNative(
+    JNIEnv* env,
+    jobject self) {
+  if (networkSink_ != nullptr) {
+    networkSink_->requestKeyframe();
+  }
+}
+
+static bool startInstantReplay(
+    int32_t windowMs,
+    int64_t memoryBudget,
+    bool hevc,
+    int32_t bitRate) {
+  if (uvcStreamer_ == nullptr || instantReplay_ != nullptr || windowMs <= 0 ||
+      memoryBudget <= 0) {
+    return false;
+  }
+  uvc_frame_format format = uvcStreamer_->captureFrameFormat();
+  bool passthrough = format == UVC_FRAME_FORMAT_MJPEG || format == UVC_FRAME_FORMAT_H264 ||
+      format == UVC_FRAME_FORMAT_H265;
+  int32_t fps = uvcStreamer_->captureFps();
+  InstantReplay::Config config{
+      .format = format,
+      .width = (uint32_t)uvcStreamer_->captureWidth(),
+      .height = (uint32_t)uvcStreamer_->captureHeight(),
+      .frameInterval = fps > 0 ? 10'000'000u / fps : 0,
+      .clockFrequency = uvcStreamer_->clockFrequency(),
+      .window = milliseconds(windowMs),
+      .memoryBudget = (size_t)memoryBudget,
+  };
+  if (!passthrough) {
+    // A running recording decides the codec; its frames carry no PTS.
+    bool recorderHevc = recorder_ != nullptr ? recorder_->hevc() : hevc;
+    config.format = recorderHevc ? UVC_FRAME_FORMAT_H265 : UVC_FRAME_FORMAT_H264;
+    config.clockFrequency = 0;
+  }
+  auto replay = std::make_shared<InstantReplay>();
+  if (!replay->start(config)) {
+    return false;
+  }
+  if (passthrough) {
+    if (!uvcStreamer_->setInstantReplay(replay)) {
+      return false;
+    }
+  } else {
+    bool ownsRecorder = recorder_ == nullptr;
+    if (ownsRecorder) {
+      StreamRecorder::VideoConfig video{
+          .width = uvcStreamer_->captureWidth(),
+          .height = uvcStreamer_->captureHeight(),
+          .fps = fps,
+          .bitRate = bitRate,
+          .hevc = config.format == UVC_FRAME_FORMAT_H265,
+      };
+      auto recorder = std::make_unique<StreamRecorder>();
+      if (!recorder->start(-1, video, {}) || !uvcStreamer_->attachRecorder(recorder.get())) {
+        return false;
+      }
+      recorder_ = std::move(recorder);
+    }
+    recorder_->setInstantReplay(replay);
+    replayFromRecorder_ = true;
+    replayOwnsRecorder_ = ownsRecorder;
+  }
+  instantReplay_ = std::move(replay);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startInstantReplayNative(
+    JNIEnv* env,
+    jobject self,
+    jint windowMs,
+    jlong memoryBudget,
+    jboolean hevc,
+    jint bitRate) {
+  return startInstantReplay(windowMs, memoryBudget, hevc, bitRate);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_saveInstantReplayNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd) {
+  return instantReplay_ != nullptr && instantReplay_->save(fd);
+}
+
+JNIEXPORT jlong JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_instantReplaySavedFramesNative(
+    JNIEnv* env,
+    jobject self) {
+  return instantReplay_ != nullptr ? instantReplay_->savedFrames() : 0;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopInstantReplayNative(
+    JNIEnv* env,
+    jobject self) {
+  stopInstantReplay();
+}
+
+static bool startPreRollRecording(int fd, int32_t preRollMs) {
+  if (instantReplay_ == nullptr || preRollMjpegRecorder_ != nullptr ||
+      preRollRecorder_ != nullptr || preRollMs < 0) {
+    return false;
   }
+  if (instantReplay_->config().format == UVC_FRAME_FORMAT_MJPEG) {
+    auto recorder = std::make_unique<MjpegRecorder>();
+    if (!recorder->startFromReplay(fd, instantReplay_, milliseconds(preRollMs))) {
+      return false;
+    }
+    preRollMjpegRecorder_ = std::move(recorder);
+  } else {
+    auto recorder = std::make_unique<PreRollRecorder>();
+    if (!recorder->start(fd, instantReplay_, milliseconds(preRollMs))) {
+      return false;
+    }
+    preRollRecorder_ = std::move(recorder);
+  }
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startPreRollRecordingNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd,
+    jint preRollMs) {
+  return startPreRollRecording(fd, preRollMs);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopPreRollRecordingNative(
+    JNIEnv* env,
+    jobject self) {
+  return stopPreRollRecording();
+}
+
+// Instant replay memory of a motion standby's pre-roll, or of the replay an
+// H.264 or H.265 event records from.
+static constexpr int64_t kMotionReplayBudget = 16 << 20;
+
+static void endMotionRecording() {
+  switch (std::exchange(motionRecording_, MotionRecording::kNone)) {
+    case MotionRecording::kEncoded:
+      stopRecording();
+      break;
+    case MotionRecording::kMjpeg:
+      uvcStreamer_->stopMjpegRecording();
+      break;
+    case MotionRecording::kPassthrough:
+      stopPreRollRecording();
+      stopInstantReplay();
+      break;
+    case MotionRecording::kNone:
+      break;
+  }
+}
+
+static bool startMotionRecording(int fd, int32_t preRollMs, bool hevc, int32_t bitRate) {
+  switch (uvcStreamer_->captureFrameFormat()) {
+    case UVC_FRAME_FORMAT_MJPEG:
+      if (uvcStreamer_->startMjpegRecording(fd)) {
+        motionRecording_ = MotionRecording::kMjpeg;
+      }
+      break;
+    case UVC_FRAME_FORMAT_H264:
+    case UVC_FRAME_FORMAT_H265:
+      // The camera's own frames, from the first keyframe on.
+      if (instantReplay_ == nullptr &&
+          startInstantReplay(std::max(preRollMs, 1000), kMotionReplayBudget, hevc, bitRate)) {
+        if (startPreRollRecording(fd, 0)) {
+          motionRecording_ = MotionRecording::kPassthrough;
+        } else {
+          stopInstantReplay();
+        }
+      }
+      break;
+    default:
+      if (startRecording(fd, hevc, bitRate)) {
+        motionRecording_ = MotionRecording::kEncoded;
+      }
+      break;
+  }
+  return motionRecording_ != MotionRecording::kNone;
+}
+
+// MotionStandby::Actions::enterStandby, on the video lane.
+static bool enterMotionStandby(int32_t preRollMs, bool hevc, int32_t bitRate) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  endMotionRecording();
+  NegotiationCache::Mode mode{};
+  if (!uvcStreamer_->standbyMode(MotionStandby::kStandbyMinFps, mode) ||
+      !reconfigureVideo(mode.width, mode.height, mode.fps, mode.format)) {
+    return false;
+  }
+  if (preRollMs > 0 && instantReplay_ == nullptr) {
+    // Encoded at the full mode's bits per pixel, with a floor for the tiny
+    // standby frames.
+    int64_t fullPixels = (int64_t)motionFullMode_.width * motionFullMode_.height;
+    int64_t standbyPixels = (int64_t)mode.width * mode.height;
+    int32_t standbyBitRate = (int32_t)std::max<int64_t>(
+        fullPixels > 0 ? bitRate * standbyPixels / fullPixels : bitRate, 250'000);
+    motionOwnsReplay_ =
+        startInstantReplay(preRollMs, kMotionReplayBudget, hevc, standbyBitRate);
+  }
+  return true;
+}
+
+// MotionStandby::Actions::beginEvent, on the video lane.
+static bool beginMotionEvent(int32_t preRollMs, bool hevc, int32_t bitRate) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  int recordingFd;
+  int preRollFd;
+  {
+    std::lock_guard lk(motionFdsMutex_);
+    recordingFd = std::exchange(motionRecordingFd_, -1);
+    preRollFd = std::exchange(motionPreRollFd_, -1);
+  }
+  if (motionOwnsReplay_) {
+    // What the standby stream saw up to the motion. Its encoder stops with
+    // the replay, which the format switch below would not allow to run.
+    if (preRollFd >= 0 && startPreRollRecording(preRollFd, preRollMs)) {
+      stopPreRollRecording();
+    }
+    stopInstantReplay();
+    motionOwnsReplay_ = false;
+  }
+  const NegotiationCache::Mode& full = motionFullMode_;
+  if (!reconfigureVideo(full.width, full.height, full.fps, full.format)) {
+    std::lock_guard lk(motionFdsMutex_);
+    motionRecordingFd_ = recordingFd;
+    return false;
+  }
+  if (recordingFd >= 0 && !startMotionRecording(recordingFd, preRollMs, hevc, bitRate)) {
+    CLOGE("Motion event in format %d, but its recording did not start", full.format);
+  }
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startMotionStandbyNative(
+    JNIEnv* env,
+    jobject self,
+    jint quietPeriodMs,
+    jint preRollMs,
+    jboolean hevc,
+    jint bitRate,
+    jobject jListener) {
+  NegotiationCache::Mode standby{};
+  if (uvcStreamer_ == nullptr || motionStandby_ != nullptr || quietPeriodMs <= 0 ||
+      preRollMs < 0 || !uvcStreamer_->standbyMode(MotionStandby::kStandbyMinFps, standby)) {
+    return false;
+  }
+  MotionStandby::Listener listener{};
+  if (jListener != nullptr) {
+    jmethodID onMotion =
+        env->GetMethodID(env->GetObjectClass(jListener), "onMotionStandby", "(Z)V");
+    if (onMotion == nullptr) {
+      return false;
+    }
+    std::shared_ptr<_jobject> ref(env->NewGlobalRef(jListener), [](jobject ref) {
+      withJniEnv([ref](JNIEnv* threadEnv) { threadEnv->DeleteGlobalRef(ref); });
+    });
+    listener = [ref, onMotion](bool event) {
+      withJniEnv([&](JNIEnv* threadEnv) {
+        threadEnv->CallVoidMethod(ref.get(), onMotion, (jboolean)event);
+      });
+    };
+  }
+  // The mode streaming now is the one events record in.
+  motionFullMode_ = {
+      -1,
+      uvcStreamer_->captureFrameFormat(),
+      uvcStreamer_->captureWidth(),
+      uvcStreamer_->captureHeight(),
+      uvcStreamer_->captureFps()};
+  auto detector = std::make_shared<MotionDetector>(MotionDetector::Config{});
+  uvcStreamer_->setMotionDetector(detector);
+  bool encodeHevc = hevc;
+  MotionStandby::Actions actions{
+      .enterStandby = [=] { return enterMotionStandby(preRollMs, encodeHevc, bitRate); },
+      .beginEvent = [=] { return beginMotionEvent(preRollMs, encodeHevc, bitRate); },
+  };
+  motionStandby_ = std::make_shared<MotionStandby>(
+      std::move(detector), milliseconds(quietPeriodMs), std::move(actions), std::move(listener));
+  motionStandby_->start();
+  return true;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_armMotionRecordingNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd,
+    jint preRollFd) {
+  std::lock_guard lk(motionFdsMutex_);
+  motionRecordingFd_ = fd;
+  motionPreRollFd_ = preRollFd;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopMotionStandbyNative(
+    JNIEnv* env,
+    jobject self) {
+  if (motionStandby_ == nullptr) {
+    return false;
+  }
+  motionStandby_->stop();
+  // After a switch that may still be queued, back in the full mode.
+  StreamerController::shared().post(
+      {StreamerController::kVideoLane,
+       StreamerController::Priority::kNormal,
+       StreamerController::kNoCoalescing,
+       []() -> StreamerController::Result {
+         if (uvcStreamer_ == nullptr) {
+           releaseMotionStandby();
+           return false;
+         }
+         endMotionRecording();
+         if (motionOwnsReplay_) {
+           stopInstantReplay();
+         }
+         uvcStreamer_->setMotionDetector(nullptr);
+         releaseMotionStandby();
+         const NegotiationCache::Mode& full = motionFullMode_;
+         return reconfigureVideo(full.width, full.height, full.fps, full.format);
+       }},
+      nullptr);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startMjpegRecordingNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd) {
+  return uvcStreamer_ != nullptr && uvcStreamer_->startMjpegRecording(fd);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopMjpegRecordingNative(
+    JNIEnv* env,
+    jobject self) {
+  return uvcStreamer_ != nullptr && uvcStreamer_->stopMjpegRecording();
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startFrameLogNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd) {
+  return uvcStreamer_ != nullptr && uvcStreamer_->startFrameLog(fd);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopFrameLogNative(
+    JNIEnv* env,
+    jobject self) {
+  return uvcStreamer_ != nullptr && uvcStreamer_->stopFrameLog();
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startFrameTapNative(
+    JNIEnv* env,
+    jobject self,
+    jint format,
+    jint width,
+    jint height,
+    jint bufferCount,
+    jintArray jLevels) {
+  if (uvcStreamer_ == nullptr || format < 0 || format > (jint)FrameTapFormat::LUMA ||
+      bufferCount <= 0) {
+    return false;
+  }
+  FrameTap::Config config;
+  config.format = (FrameTapFormat)format;
+  config.width = width;
+  config.height = height;
+  config.bufferCount = bufferCount;
+  if (jLevels != nullptr) {
+    // Width and height pairs.
+    jsize count = env->GetArrayLength(jLevels);
+    std::vector<jint> sizes(count);
+    env->GetIntArrayRegion(jLevels, 0, count, sizes.data());
+    for (jsize i = 0; i + 1 < count; i += 2) {
+      config.levels.push_back({sizes[i], sizes[i + 1]});
+    }
+  }
+  return uvcStreamer_->startFrameTap(config);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startTensorTapNative(
+    JNIEnv* env,
+    jobject self,
+    jint layout,
+    jint type,
+    jint width,
+    jint height,
+    jintArray jCrop,
+    jfloatArray jNormalization,
+    jint zeroPoint,
+    jint bufferCount,
+    jboolean hardwareBuffers) {
+  if (uvcStreamer_ == nullptr || layout < 0 || layout > (jint)TensorLayout::NCHW || type < 0 ||
+      type > (jint)TensorType::UINT8 || bufferCount <= 0 || jNormalization == nullptr ||
+      env->GetArrayLength(jNormalization) < 7) {
+    return false;
+  }
+  FrameTap::Config config;
+  config.format = FrameTapFormat::TENSOR;
+  config.bufferCount = bufferCount;
+  config.hardwareBuffers = hardwareBuffers;
+  TensorSpec& tensor = config.tensor;
+  tensor.layout = (TensorLayout)layout;
+  tensor.type = (TensorType)type;
+  tensor.width = width;
+  tensor.height = height;
+  if (jCrop != nullptr && env->GetArrayLength(jCrop) >= 4) {
+    jint crop[4];
+    env->GetIntArrayRegion(jCrop, 0, 4, crop);
+    tensor.crop = {crop[0], crop[1], crop[2], crop[3]};
+  }
+  // Means, standard deviations, then the quantization scale.
+  jfloat normalization[7];
+  env->GetFloatArrayRegion(jNormalization, 0, 7, normalization);
+  std::copy(normalization, normalization + 3, tensor.mean.begin());
+  std::copy(normalization + 3, normalization + 6, tensor.std.begin());
+  tensor.scale = normalization[6];
+  tensor.zeroPoint = zeroPoint;
+  return uvcStreamer_->startFrameTap(config);
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopFrameTapNative(
+    JNIEnv* env,
+    jobject self) {
+  if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->stopFrameTap();
+  }
+}
+
+JNIEXPORT jobjectArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_frameTapBuffersNative(
+    JNIEnv* env,
+    jobject self) {
+  std::vector<uint8_t*> buffers;
+  size_t capacity = uvcStreamer_ != nullptr ? uvcStreamer_->frameTapBuffers(buffers) : 0;
+  jclass byteBufferClass = env->FindClass("java/nio/ByteBuffer");
+  jobjectArray result = env->NewObjectArray(buffers.size(), byteBufferClass, nullptr);
+  if (result == nullptr) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < buffers.size(); i++) {
+    jobject buffer = env->NewDirectByteBuffer(buffers[i], capacity);
+    env->SetObjectArrayElement(result, i, buffer);
+    env->DeleteLocalRef(buffer);
+  }
+  return result;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_frameTapHardwareBuffersNative(
+    JNIEnv* env,
+    jobject self) {
+  std::vector<AHardwareBuffer*> buffers;
+  if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->frameTapHardwareBuffers(buffers);
+  }
+  jclass hardwareBufferClass = env->FindClass("android/hardware/HardwareBuffer");
+  jobjectArray result = env->NewObjectArray(buffers.size(), hardwareBufferClass, nullptr);
+  if (result == nullptr) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < buffers.size(); i++) {
+    // Holds a reference of its own, so it outlives the tap until closed or collected.
+    jobject buffer = AHardwareBuffer_toHardwareBuffer(env, buffers[i]);
+    env->SetObjectArrayElement(result, i, buffer);
+    env->DeleteLocalRef(buffer);
+  }
+  return result;
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_acquireTappedFrameNative(
+    JNIEnv* env,
+    jobject self,
+    jlongArray info) {
+  FrameTap::FrameInfo frameInfo;
+  int32_t index = uvcStreamer_ != nullptr ? uvcStreamer_->acquireTappedFrame(frameInfo) : -1;
+  if (index >= 0) {
+    jlong values[7 + FrameTap::kMaxLevels * 4] = {
+        frameInfo.captureTimeNs,
+        frameInfo.sequence,
+        frameInfo.width,
+        frameInfo.height,
+        frameInfo.stride,
+        frameInfo.size,
+        frameInfo.levelCount,
+    };
+    for (size_t i = 0; i < frameInfo.levelCount; i++) {
+      const FramePyramid::Level& level = frameInfo.levels[i];
+      jlong* fields = values + 7 + i * 4;
+      fields[0] = (jlong)level.offset;
+      fields[1] = level.width;
+      fields[2] = level.height;
+      fields[3] = level.stride;
+    }
+    jsize count = std::min<jsize>(env->GetArrayLength(info), std::size(values));
+    env->SetLongArrayRegion(info, 0, count, values);
+  }
+  return index;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_releaseTappedFrameNative(
+    JNIEnv* env,
+    jobject self,
+    jint index) {
+  if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->releaseTappedFrame(index);
+  }
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startFrameServerNative(
+    JNIEnv* env,
+    jobject self,
+    jstring jName,
+    jint format,
+    jint width,
+    jint height,
+    jint bufferCount,
+    jintArray jAllowedUids) {
+  // FrameTapFormat has no fanout layout for RAW.
+  if (uvcStreamer_ == nullptr || bufferCount <= 0 ||
+      (format != (jint)FrameTapFormat::NV12 && format != (jint)FrameTapFormat::RGBA)) {
+    return false;
+  }
+  FrameServer::Config config;
+  config.format =
+      format == (jint)FrameTapFormat::NV12 ? FanoutFormat::NV12 : FanoutFormat::RGBA;
+  config.width = width;
+  config.height = height;
+  config.bufferCount = bufferCount;
+  if (jAllowedUids != nullptr) {
+    jsize count = env->GetArrayLength(jAllowedUids);
+    std::vector<jint> uids(count);
+    env->GetIntArrayRegion(jAllowedUids, 0, count, uids.data());
+    config.allowedUids.assign(uids.begin(), uids.end());
+  }
+  const char* name = env->GetStringUTFChars(jName, nullptr);
+  bool started = uvcStreamer_->startFrameServer(config, name);
+  env->ReleaseStringUTFChars(jName, name);
+  return started;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopFrameServerNative(
+    JNIEnv* env,
+    jobject self) {
+  if (uvcStreamer_ != nullptr) {
+    uvcStreamer_->stopFrameServer();
+  }
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_openAudioTapNative(
+    JNIEnv* env,
+    jobject self,
+    jint overflow) {
+  if (streamer_ == nullptr || overflow < 0 || overflow > (jint)AudioTap::Overflow::NEWEST) {
+    return -1;
+  }
+  return streamer_->audioTap().open((AudioTap::Overflow)overflow);
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_closeAudioTapNative(
+    JNIEnv* env,
+    jobject self,
+    jint reader) {
+  if (streamer_ != nullptr) {
+    streamer_->audioTap().close(reader);
+  }
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setAudioProcessingNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled,
+    jboolean softClip) {
+  if (streamer_ == nullptr || !streamer_->gainStage().supported()) {
+    return false;
+  }
+  AudioGainStage& gainStage = streamer_->gainStage();
+  gainStage.setSoftClip(softClip);
+  gainStage.setEnabled(enabled);
+  CLOGI("Audio processing %s, soft clipping %s", enabled ? "on" : "off", softClip ? "on" : "off");
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setAudioGainNative(
+    JNIEnv* env,
+    jobject self,
+    jint channel,
+    jfloat gainDb) {
+  if (streamer_ == nullptr || channel < -1 || channel >= (jint)AudioGainStage::kMaxChannels) {
+    return false;
+  }
+  streamer_->gainStage().setGain(
+      channel < 0 ? AudioGainStage::kAllChannels : (uint32_t)channel,
+      std::pow(10.0f, gainDb / 20.0f));
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setAudioMutedNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean muted) {
+  if (streamer_ == nullptr) {
+    return false;
+  }
+  streamer_->gainStage().setMuted(muted);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startAudioLoopbackNative(
+    JNIEnv* env,
+    jobject self,
+    jint bursts) {
+  if (streamer_ == nullptr || bursts <= 0) {
+    return false;
+  }
+  return streamer_->startLoopbackMeasurement(bursts);
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cancelAudioLoopbackNative(
+    JNIEnv* env,
+    jobject self) {
+  if (streamer_ != nullptr) {
+    streamer_->cancelLoopbackMeasurement();
+  }
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_audioLoopbackReportNative(
+    JNIEnv* env,
+    jobject self,
+    jdoubleArray jReport) {
+  LoopbackMeter::Report report;
+  if (streamer_ == nullptr || !streamer_->loopbackReport(report)) {
+    return -1;
+  }
+  jdouble values[] = {
+      report.roundTripMs,
+      report.roundTripMinMs,
+      report.roundTripMaxMs,
+      report.jitterMs,
+      report.outputMs,
+      report.inputMs,
+      report.passThroughMs,
+      report.peakRatio,
+      (jdouble)report.captured,
+      (jdouble)report.bursts,
+  };
+  jsize count = std::min<jsize>(env->GetArrayLength(jReport), std::size(values));
+  env->SetDoubleArrayRegion(jReport, 0, count, values);
+  if (report.captured < report.bursts) {
+    return report.detected;
+  }
+  CLOGI(
+      "Loopback %u/%u bursts: round trip %.2f ms (%.2f to %.2f, jitter %.2f), output %.2f ms, "
+      "input %.2f ms, microphone to speaker %.2f ms",
+      report.detected,
+      report.captured,
+      report.roundTripMs,
+      report.roundTripMinMs,
+      report.roundTripMaxMs,
+      report.jitterMs,
+      report.outputMs,
+      report.inputMs,
+      report.passThroughMs);
+  return report.detected;
+}
+
+JNIEXPORT jintArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_audioTapFormatNative(
+    JNIEnv* env,
+    jobject self) {
+  if (streamer_ == nullptr) {
+    return env->NewIntArray(0);
+  }
+  jint values[] = {
+      (jint)streamer_->outputSampleRate(),
+      (jint)streamer_->outputChannelCount(),
+      (jint)PcmConverter::aaudioFormat(streamer_->outputEncoding()),
+  };
+  jintArray result = env->NewIntArray(std::size(values));
+  if (result != nullptr) {
+    env->SetIntArrayRegion(result, 0, std::size(values), values);
+  }
+  return result;
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_readAudioTapNative(
+    JNIEnv* env,
+    jobject self,
+    jint reader,
+    jobject buffer,
+    jlongArray info) {
+  uint8_t* data = static_cast<uint8_t*>(env->GetDirectBufferAddress(buffer));
+  jlong capacity = env->GetDirectBufferCapacity(buffer);
+  if (streamer_ == nullptr || data == nullptr || capacity <= 0) {
+    return 0;
+  }
+  AudioTap::Block block;
+  size_t copied = streamer_->audioTap().read(reader, data, capacity, block);
+  jlong values[] = {
+      block.timeNs,
+      (jlong)block.framePosition,
+      (jlong)block.lostFrames,
+      block.frames,
+  };
+  jsize count = std::min<jsize>(env->GetArrayLength(info), std::size(values));
+  env->SetLongArrayRegion(info, 0, count, values);
+  return copied;
+}
+
+JNIEXPORT jstring JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_streamingStatsSummaryString(
+    JNIEnv* env,
+    jobject self) {
+  std::string result = "";
+  if (streamer_ != nullptr) {
+    result += streamer_->statsSummaryString();
+    result += "\n";
+  }
+  if (uvcStreamer_ != nullptr) {
+    result += uvcStreamer_->statsSummaryString();
+    result += "\n";
+  }
+  if (networkSink_ != nullptr) {
+    result += networkSink_->summary();
+    result += "\n";
+  }
+  result += ThreadPolicies::summary();
+  std::lock_guard lk(summaryMutex_);
+  if (lastSummaryString_ == nullptr || result != lastSummary_) {
+    jstring summary = env->NewStringUTF(result.c_str());
+    if (summary == nullptr) {
+      return nullptr;
+    }
+    if (lastSummaryString_ != nullptr) {
+      env->DeleteGlobalRef(lastSummaryString_);
+    }
+    lastSummaryString_ = static_cast<jstring>(env->NewGlobalRef(summary));
+    lastSummary_ = std::move(result);
+    return summary;
+  }
+  return static_cast<jstring>(env->NewLocalRef(lastSummaryString_));
+}
+
+JNIEXPORT jstring JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_nativeMemorySummaryNative(
+    JNIEnv* env,
+    jobject self) {
+  constexpr double kMiB = 1024.0 * 1024.0;
+  std::string result = "";
+  if (uvcStreamer_ != nullptr) {
+    result += uvcStreamer_->memorySummaryString();
+    result += "\n";
+  }
+  {
+    std::lock_guard lk(sessionsMutex_);
+    for (const auto& [handle, session] : sessions_) {
+      result += std::format("session {} ", handle);
+      result += session.video->memorySummaryString();
+      result += "\n";
+    }
+  }
+  struct mallinfo heap = mallinfo();
+  result += std::format(
+      "frame buffer stash {:.1f} MiB, aligned buffers {:.1f} MiB, native heap {:.1f} MiB in use",
+      uvc_frame_buffer_stash_bytes() / kMiB,
+      BufferAllocator::liveBytes() / kMiB,
+      heap.uordblks / kMiB);
+  return env->NewStringUTF(result.c_str());
+}
+
+JNIEXPORT jlong JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_trimNativeMemoryNative(
+    JNIEnv* env,
+    jobject self) {
+  size_t freed = uvc_frame_buffer_stash_bytes();
+  uvc_release_frame_buffer_stash();
+  if (uvcStreamer_ != nullptr) {
+    freed += uvcStreamer_->trimMemory();
+  }
+  {
+    std::lock_guard lk(sessionsMutex_);
+    for (auto& [handle, session] : sessions_) {
+      freed += session.video->trimMemory();
+    }
+  }
+  CLOGI("Trimmed %zu bytes of stream buffers", freed);
+  return (jlong)freed;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoTransferOptionsNative(
+    JNIEnv* env,
+    jobject self,
+    jint numTransfers,
+    jint packetsPerTransfer,
+    jint bulkTransferSize,
+    jint timeoutMs,
+    jboolean fitIsoBandwidth) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setTransferOptions({
+      .num_transfers = (uint32_t)std::max(numTransfers, 0),
+      .packets_per_transfer = (uint32_t)std::max(packetsPerTransfer, 0),
+      .bulk_transfer_size = (uint32_t)std::max(bulkTransferSize, 0),
+      .transfer_timeout_ms = (uint32_t)std::max(timeoutMs, 0),
+      .fit_iso_bandwidth = fitIsoBandwidth,
+  });
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoInlineFrameCallbackNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setInlineFrameCallback(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoMjpegDecodeSkippingNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled,
+    jboolean validateSkipped) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setMjpegDecodeSkipping(enabled, validateSkipped);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoChangeDetectionNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled,
+    jdouble threshold,
+    jint refreshIntervalMs,
+    jboolean partialUpdates) {
+  if (uvcStreamer_ == nullptr || threshold < 0 || refreshIntervalMs <= 0) {
+    return false;
+  }
+  FrameChangeDetector::Config config{};
+  config.enabled = enabled;
+  config.threshold = threshold;
+  config.refreshIntervalNs = (int64_t)refreshIntervalMs * 1'000'000;
+  config.partialUpdates = partialUpdates;
+  uvcStreamer_->setChangeDetection(config);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoMjpegDecodeWorkersNative(
+    JNIEnv* env,
+    jobject self,
+    jint workers) {
+  if (uvcStreamer_ == nullptr || workers < 0) {
+    return false;
+  }
+  uvcStreamer_->setMjpegDecodeWorkers(workers);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoHardwareMjpegDecodingNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setHardwareMjpegDecoding(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoGpuMjpegDecodingNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setGpuMjpegDecoding(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoVulkanConversionNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setVulkanConversion(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoDeinterlaceNative(
+    JNIEnv* env,
+    jobject self,
+    jint mode,
+    jboolean forced) {
+  if (uvcStreamer_ == nullptr || mode < (jint)DeinterlaceMode::OFF ||
+      mode > (jint)DeinterlaceMode::ADAPTIVE) {
+    return false;
+  }
+  uvcStreamer_->setDeinterlace(static_cast<DeinterlaceMode>(mode), forced);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoLumaStatsNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setLumaStats(enabled);
+  return true;
+}
+
+JNIEXPORT jlong JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_videoLumaHistogramNative(
+    JNIEnv* env,
+    jobject self,
+    jintArray jHistogram) {
+  LumaStats stats;
+  jsize bins = env->GetArrayLength(jHistogram);
+  if (uvcStreamer_ == nullptr || bins <= 0 || LumaStats::kBins % bins != 0 ||
+      !uvcStreamer_->latestLumaStats(stats)) {
+    return -1;
+  }
+  std::array<uint32_t, LumaStats::kBins> folded{};
+  stats.fold(folded.data(), bins);
+  env->SetIntArrayRegion(jHistogram, 0, bins, reinterpret_cast<const jint*>(folded.data()));
+  return stats.sequence;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoLensCorrectionNative(
+    JNIEnv* env,
+    jobject self,
+    jint model,
+    jfloat focal,
+    jfloat centerX,
+    jfloat centerY,
+    jfloatArray coefficients,
+    jfloat scale) {
+  LensCalibration lens{};
+  if (uvcStreamer_ == nullptr || model < (jint)LensCalibration::Model::NONE ||
+      model > (jint)LensCalibration::Model::FISHEYE ||
+      (coefficients != nullptr && env->GetArrayLength(coefficients) > (jsize)lens.k.size())) {
+    return false;
+  }
+  lens.model = static_cast<LensCalibration::Model>(model);
+  lens.focal = focal;
+  lens.centerX = centerX;
+  lens.centerY = centerY;
+  lens.scale = scale;
+  if (coefficients != nullptr) {
+    env->GetFloatArrayRegion(coefficients, 0, env->GetArrayLength(coefficients), lens.k.data());
+  }
+  if (lens.model != LensCalibration::Model::NONE && !lens.enabled()) {
+    return false;
+  }
+  uvcStreamer_->setLensCorrection(lens);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoOverlayNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean timestamp,
+    jstring jText,
+    jint corner,
+    jint scale,
+    jint color) {
+  if (uvcStreamer_ == nullptr || corner < (jint)OverlayConfig::Corner::TOP_LEFT ||
+      corner > (jint)OverlayConfig::Corner::BOTTOM_RIGHT || scale < 1 ||
+      scale > TextOverlay::kMaxScale) {
+    return false;
+  }
+  OverlayConfig config{};
+  config.timestamp = timestamp;
+  if (jText != nullptr) {
+    const char* text = env->GetStringUTFChars(jText, nullptr);
+    config.text = text;
+    env->ReleaseStringUTFChars(jText, text);
+  }
+  config.corner = static_cast<OverlayConfig::Corner>(corner);
+  config.scale = scale;
+  config.color = (uint32_t)color;
+  uvcStreamer_->setOverlay(config);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoSliceConversionNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setSliceConversion(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoRenderAheadNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setRenderAhead(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setSmoothPlaybackNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setSmoothPlayback(enabled);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setSlowFrameRecorderNative(
+    JNIEnv* env,
+    jobject self,
+    jfloat frameIntervals) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setSlowFrameBudget(std::max(frameIntervals, 0.0f));
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoHdrDataSpaceNative(
+    JNIEnv* env,
+    jobject self,
+    jint dataSpace) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setHdrDataSpace(dataSpace);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoCropNative(
+    JNIEnv* env,
+    jobject self,
+    jint x,
+    jint y,
+    jint width,
+    jint height) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  uvcStreamer_->setCrop({x, y, width, height});
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoWhiteBalanceNative(
+    JNIEnv* env,
+    jobject self,
+    jfloat red,
+    jfloat green,
+    jfloat blue) {
+  if (uvcStreamer_ == nullptr || !(red >= 0 && green >= 0 && blue >= 0)) {
+    return false;
+  }
+  uvcStreamer_->setWhiteBalance({red, green, blue});
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoDepthRangeNative(
+    JNIEnv* env,
+    jobject self,
+    jint nearClip,
+    jint farClip,
+    jint palette) {
+  if (uvcStreamer_ == nullptr || nearClip < 0 || farClip <= nearClip || farClip > UINT16_MAX ||
+      palette < (jint)DepthPalette::TURBO || palette > (jint)DepthPalette::GRAY) {
+    return false;
+  }
+  uvcStreamer_->setDepthRange(
+      {(uint16_t)nearClip, (uint16_t)farClip, static_cast<DepthPalette>(palette)});
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoOrientationNative(
+    JNIEnv* env,
+    jobject self,
+    jint rotationDegrees,
+    jboolean mirrorHorizontal,
+    jboolean mirrorVertical) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  return uvcStreamer_->setOrientation(rotationDegrees, mirrorHorizontal, mirrorVertical);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_addVideoSurfaceNative(
+    JNIEnv* env,
+    jobject self,
+    jobject jSurface,
+    jint maxFps) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  // The streamer takes its own reference.
+  ANativeWindowOwner window(ANativeWindow_fromSurface(env, jSurface), &ANativeWindow_release);
+  return window != nullptr && uvcStreamer_->addSecondaryPreview(window.get(), maxFps);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_removeVideoSurfaceNative(
+    JNIEnv* env,
+    jobject self,
+    jobject jSurface) {
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  ANativeWindowOwner window(ANativeWindow_fromSurface(env, jSurface), &ANativeWindow_release);
+  return window != nullptr && uvcStreamer_->removeSecondaryPreview(window.get());
+}
+
+static bool setVideoSurface(ANativeWindowOwner window) {
+  // A startup in progress configures the streamer with the old window.
+  startup_.wait();
+  if (uvcStreamer_ == nullptr) {
+    return false;
+  }
+  if (window.get() == previewWindow_.get()) {
+    return true;
+  }
+  if (!uvcStreamer_->setPreviewWindow(window.get())) {
+    return false;
+  }
+  // The render thread is done with the old window, released here.
+  previewWindow_.swap(window);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoSurfaceNative(
+    JNIEnv* env,
+    jobject self,
+    jobject jSurface) {
+  return setVideoSurface(ANativeWindowOwner(
+      jSurface != nullptr ? ANativeWindow_fromSurface(env, jSurface) : nullptr,
+      &ANativeWindow_release));
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setUsbLooperEventsNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  UsbSession::setUseLooper(enabled);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_thermalStatusNative(JNIEnv* env, jobject self) {
+  // Kept for the life of the process.
+  static AThermalManager* thermalManager = AThermal_acquireManager();
+  return thermalManager != nullptr ? AThermal_getCurrentThermalStatus(thermalManager)
+                                   : ATHERMAL_STATUS_ERROR;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoPowerProfileNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled,
+    jint targetFps,
+    jboolean rgb565Preview) {
+  UsbVideoStreamer::setPowerProfile({(bool)enabled, std::max(targetFps, 0), (bool)rgb565Preview});
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoEncoderSettingsNative(
+    JNIEnv* env,
+    jobject self,
+    jint averageBitrate,
+    jint keyframeIntervalMs) {
+  UsbVideoStreamer::setEncoderSettings(
+      {(uint32_t)std::max(averageBitrate, 0), (uint32_t)std::max(keyframeIntervalMs, 0)});
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setVideoFastStartNative(
+    JNIEnv* env,
+    jobject self,
+    jboolean enabled) {
+  videoFastStart_ = enabled;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setThreadPolicyNative(
+    JNIEnv* env,
+    jobject self,
+    jint role,
+    jint nice,
+    jint fifoPriority,
+    jboolean performanceCores,
+    jlong targetWorkNs) {
+  if (role < 0 || role >= (jint)kThreadRoles) {
+    CLOGE("Invalid thread role %d", role);
+    return;
+  }
+  ThreadPolicy policy{};
+  policy.nice = nice;
+  policy.fifoPriority = fifoPriority;
+  policy.performanceCores = performanceCores;
+  policy.targetWorkNs = targetWorkNs;
+  ThreadPolicies::set((ThreadRole)role, policy);
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setAvSyncMaxSkewNative(
+    JNIEnv* env,
+    jobject self,
+    jint maxSkewMs) {
+  AvSync::shared().setMaxSkew(milliseconds(maxSkewMs));
+}
+
+JNIEXPORT jobject JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_streamingStatsBufferNative(
+    JNIEnv* env,
+    jobject self) {
+  StreamingStats& stats = StreamingStats::shared();
+  return env->NewDirectByteBuffer(&stats, sizeof(stats));
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_streamingLatencyPercentilesNative(
+    JNIEnv* env,
+    jobject self) {
+  std::vector<int64_t> percentiles;
+  if (uvcStreamer_ != nullptr) {
+    percentiles = uvcStreamer_->latencyPercentiles();
+  }
+  jlongArray result = env->NewLongArray(percentiles.size());
+  if (result != nullptr) {
+    env->SetLongArrayRegion(
+        result, 0, percentiles.size(), reinterpret_cast<const jlong*>(percentiles.data()));
+  }
+  return result;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_meta_usbvideo_UsbVideoNativeLibrary_connectUsbAudioStreamingNative(
+    JNIEnv* env,
+    jobject tis,
+    jint deviceFd,
+    jint jAudioFormat,
+    jint samplingFrequency,
+    jint subFrameSize,
+    jint channelCount,
+    jint jAudioPerfMode,
+    jint outputFramesPerBuffer,
+    jboolean exclusive,
+    jint nativeSampleRate) {
+  if (streamer_ != nullptr) {
+    //CLOGE("startUsbAudioStreamingNative called before stopUsbAudioStreamingNative was called");
+    return true;
+  }
+  StreamerReaper::shared().drain();
+  streamer_ = std::make_unique<UsbAudioStreamer>(
+      (intptr_t)deviceFd,
+      jAudioFormat,
+      samplingFrequency,
+      subFrameSize,
+      channelCount,
+      jAudioPerfMode,
+      outputFramesPerBuffer,
+      exclusive,
+      nativeSampleRate);
+  watchDeviceLoss(*streamer_);
+  return streamer_ != nullptr;
+}
+
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_connectUsbStreamingAsyncNative(
+    JNIEnv* env,
+    jobject self,
+    jint audioDeviceFd,
+    jint jAudioFormat,
+    jint samplingFrequency,
+    jint subFrameSize,
+    jint channelCount,
+    jint jAudioPerfMode,
+    jint outputFramesPerBuffer,
+    jboolean exclusive,
+    jint nativeSampleRate,
+    jint videoDeviceFd,
+    jint width,
+    jint height,
+    jint fps,
+    jint libuvcFrameFormat,
+    jobject jSurface,
+    jobject jListener) {
+  if (streamer_ != nullptr || uvcStreamer_ != nullptr) {
+    CLOGE("connectUsbStreamingAsyncNative called while streamers are connected");
+    return false;
+  }
+  jclass listenerClass = env->GetObjectClass(jListener);
+  jmethodID onComplete =
+      env->GetMethodID(listenerClass, "onStartupComplete", "(ZZLjava/lang/String;)V");
+  if (onComplete == nullptr) {
+    return false;
+  }
+  // The surface must be resolved on a thread attached to the VM; none streams headless.
+  previewWindow_.reset(jSurface != nullptr ? ANativeWindow_fromSurface(env, jSurface) : nullptr);
+  jobject listener = env->NewGlobalRef(jListener);
+
+  StartupOrchestrator::Pipeline audio;
+  if (audioDeviceFd >= 0) {
+    audio = [=](StartupOrchestrator::PhaseLog& log) {
+      StreamerReaper::shared().drain();
+      log.mark("teardown");
+      streamer_ = std::make_unique<UsbAudioStreamer>(
+          (intptr_t)audioDeviceFd,
+          jAudioFormat,
+          samplingFrequency,
+          subFrameSize,
+          channelCount,
+          jAudioPerfMode,
+          outputFramesPerBuffer,
+          exclusive,
+          nativeSampleRate);
+      watchDeviceLoss(*streamer_);
+      log.mark("open");
+      if (log.cancelled()) {
+        return false;
+      }
+      bool started = streamer_->start();
+      log.mark("start");
+      return started;
+    };
+  }
+  StartupOrchestrator::Pipeline video = [=](StartupOrchestrator::PhaseLog& log) {
+    StreamerReaper::shared().drain();
+    log.mark("teardown");
+    uvcStreamer_ = std::make_unique<UsbVideoStreamer>(
+        (intptr_t)videoDeviceFd,
+        width,
+        height,
+        fps,
+        static_cast<uvc_frame_format>(libuvcFrameFormat));
+    watchDeviceLoss(*uvcStreamer_);
+    uvcStreamer_->setFastStart(videoFastStart_);
+    log.mark("negotiate");
+    if (log.cancelled()) {
+      return false;
+    }
+    if (!uvcStreamer_->configureOutput(previewWindow_.get())) {
+      log.mark("configure");
+      return false;
+    }
+    log.mark("configure");
+    bool started = uvcStreamer_->start();
+    log.mark("start");
+    // A cancelled fast start stays in the cheap mode it is about to leave.
+    if (started && uvcStreamer_->isFastStarting() && !log.cancelled()) {
+      // The cheap mode's frame is up; the requested one follows, with the
+      // completion reported after it.
+      uvcStreamer_->awaitFirstFrame(UsbVideoStreamer::kFirstFrameTimeout);
+      log.mark("first frame");
+      started = uvcStreamer_->finishFastStart();
+      log.mark("upgrade");
+    }
+    return started;
+  };
+  auto complete = [listener, onComplete](const StartupOrchestrator::Result& result) {
+    withJniEnv([&](JNIEnv* threadEnv) {
+      jstring breakdown = threadEnv->NewStringUTF(result.breakdown.c_str());
+      threadEnv->CallVoidMethod(listener, onComplete, result.audio, result.video, breakdown);
+      threadEnv->DeleteLocalRef(breakdown);
+      threadEnv->DeleteGlobalRef(listener);
+    });
+  };
+  bool running = startup_.run(std::move(audio), std::move(video), std::move(complete));
+  if (!running) {
+    env->DeleteGlobalRef(listener);
+  }
+  return running;
+}
+
+static void disconnectAudio() {
+  startup_.cancelAudio();
+  startup_.wait();
+  reconnect().finish(false);
+  if (streamer_ != nullptr) {
+    streamer_->setRecorder(nullptr);
+    retireStreamers(
+        nullptr, std::move(streamer_), ANativeWindowOwner(nullptr, &ANativeWindow_release));
+  }
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_disconnectUsbAudioStreamingNative(
+        JNIEnv* env,
+        jobject self) {
+  disconnectAudio();
+}
+
+// Commands of postStreamerCommandNative, in the order of StreamerCommand in
+// UsbVideoNativeLibrary.kt.
+enum class StreamerCommandType : jint {
+  kStartAudio,
+  kStopAudio,
+  kStartVideo,
+  kStopVideo,
+  // Stops the stream when it cannot be paused; the result tells which.
+  kPauseVideo,
+  kResumeVideo,
+  // Takes width, height, fps and the libuvc frame format.
+  kReconfigureVideo,
+  kSetVideoSurface,
+  kDisconnectAudio,
+  kDisconnectVideo,
+  kCount,
+};
+
+// Calls listener.onStreamerCommandComplete with the result of every command
+// it was passed to. A null listener ignores them.
+static StreamerController::Callback streamerCallback(JNIEnv* env, jobject jListener) {
+  if (jListener == nullptr) {
+    return nullptr;
+  }
+  jmethodID onComplete =
+      env->GetMethodID(env->GetObjectClass(jListener), "onStreamerCommandComplete", "(J)V");
+  if (onComplete == nullptr) {
+    return nullptr;
+  }
+  std::shared_ptr<_jobject> listener(env->NewGlobalRef(jListener), [](jobject ref) {
+    withJniEnv([ref](JNIEnv* threadEnv) { threadEnv->DeleteGlobalRef(ref); });
+  });
+  return [listener, onComplete](StreamerController::Result result) {
+    withJniEnv([&](JNIEnv* threadEnv) {
+      threadEnv->CallVoidMethod(listener.get(), onComplete, (jlong)result);
+    });
+  };
+}
+
+// The lanes, priority and work of command, which a command with the same type
+// queued right before it makes redundant. The streamer globals a command
+// touches are only touched on its lanes: the audio lane owns streamer_, the
+// video lane uvcStreamer_ and the preview window; the recording and
+// network sinks span both.
+static std::optional<StreamerController::Command> streamerCommand(
+    StreamerCommandType type,
+    std::vector<jint> args,
+    std::shared_ptr<ANativeWindow> window) {
+  using Lane = StreamerController::Lane;
+  using Priority = StreamerController::Priority;
+  auto command = [type](Lane lane, Priority priority, StreamerController::Work work) {
+    return StreamerController::Command{
+        lane, priority, static_cast<uint64_t>(type) + 1, std::move(work)};
+  };
+  switch (type) {
+    case StreamerCommandType::kStartAudio:
+      return command(Lane::kAudioLane, Priority::kNormal, [] {
+        return streamer_ != nullptr && streamer_->start();
+      });
+    case StreamerCommandType::kStopAudio:
+      return command(Lane::kAudioLane, Priority::kNormal, [] {
+        return streamer_ != nullptr && streamer_->requestStop();
+      });
+    case StreamerCommandType::kStartVideo:
+      return command(Lane::kVideoLane, Priority::kNormal, [] {
+        return uvcStreamer_ != nullptr && uvcStreamer_->start();
+      });
+    case StreamerCommandType::kStopVideo:
+      return command(Lane::kVideoLane, Priority::kNormal, [] {
+        return uvcStreamer_ != nullptr && uvcStreamer_->requestStop();
+      });
+    case StreamerCommandType::kPauseVideo:
+      return command(Lane::kVideoLane, Priority::kNormal, [] {
+        if (uvcStreamer_ == nullptr) {
+          return false;
+        }
+        if (uvcStreamer_->pause()) {
+          return true;
+        }
+        uvcStreamer_->requestStop();
+        return false;
+      });
+    case StreamerCommandType::kResumeVideo:
+      return command(Lane::kVideoLane, Priority::kNormal, [] {
+        return uvcStreamer_ != nullptr && uvcStreamer_->resume();
+      });
+    case StreamerCommandType::kReconfigureVideo:
+      if (args.size() != 4) {
+        return std::nullopt;
+      }
+      return command(Lane::kVideoLane, Priority::kNormal, [args] {
+        return reconfigureVideo(args[0], args[1], args[2], args[3]);
+      });
+    case StreamerCommandType::kSetVideoSurface:
+      // Ahead of format switches, the view may be about to release its surface.
+      return command(Lane::kVideoLane, Priority::kHigh, [window] {
+        if (window != nullptr) {
+          ANativeWindow_acquire(window.get());
+        }
+        return setVideoSurface(ANativeWindowOwner(window.get(), &ANativeWindow_release));
+      });
+    case StreamerCommandType::kDisconnectAudio:
+      return command(Lane::kAudioLane, Priority::kNormal, [] {
+        disconnectAudio();
+        return true;
+      });
+    case StreamerCommandType::kDisconnectVideo:
+      return command(Lane::kBothLanes, Priority::kNormal, [] {
+        disconnectVideo();
+        return true;
+      });
+    case StreamerCommandType::kCount:
+      break;
+  }
+  return std::nullopt;
+}
+
+JNIEXPORT jlong JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_postStreamerCommandNative(
+    JNIEnv* env,
+    jobject self,
+    jint jType,
+    jintArray jArgs,
+    jobject jSurface,
+    jobject jListener) {
+  if (jType < 0 || jType >= static_cast<jint>(StreamerCommandType::kCount)) {
+    CLOGE("Unknown streamer command %d", jType);
+    return 0;
+  }
+  std::vector<jint> args;
+  if (jArgs != nullptr) {
+    args.resize(env->GetArrayLength(jArgs));
+    env->GetIntArrayRegion(jArgs, 0, static_cast<jsize>(args.size()), args.data());
+  }
+  std::shared_ptr<ANativeWindow> window;
+  if (jSurface != nullptr) {
+    window.reset(ANativeWindow_fromSurface(env, jSurface), &ANativeWindow_release);
+  }
+  std::optional<StreamerController::Command> command =
+      streamerCommand(static_cast<StreamerCommandType>(jType), std::move(args), std::move(window));
+  if (!command.has_value()) {
+    CLOGE("Bad arguments for streamer command %d", jType);
+    return 0;
+  }
+  return static_cast<jlong>(StreamerController::shared().post(
+      std::move(*command), streamerCallback(env, jListener)));
+}
+
+JNIEXPORT jlong JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_postStreamerCallNative(
+    JNIEnv* env,
+    jobject self,
+    jint lanes,
+    jint priority,
+    jobject jBody,
+    jobject jListener) {
+  if (jBody == nullptr || lanes <= 0 || lanes > StreamerController::kBothLanes || priority < 0 ||
+      priority > static_cast<jint>(StreamerController::Priority::kHigh)) {
+    return 0;
+  }
+  jmethodID run = env->GetMethodID(env->GetObjectClass(jBody), "run", "()V");
+  if (run == nullptr) {
+    return 0;
+  }
+  std::shared_ptr<_jobject> body(env->NewGlobalRef(jBody), [](jobject ref) {
+    withJniEnv([ref](JNIEnv* threadEnv) { threadEnv->DeleteGlobalRef(ref); });
+  });
+  StreamerController::Command command{
+      static_cast<StreamerController::Lane>(lanes),
+      static_cast<StreamerController::Priority>(priority),
+      StreamerController::kNoCoalescing,
+      [body, run]() -> StreamerController::Result {
+        withJniEnv([&](JNIEnv* threadEnv) {
+          // The body reports its own exceptions, one escaping it is dropped.
+          threadEnv->CallVoidMethod(body.get(), run);
+          if (threadEnv->ExceptionCheck()) {
+            threadEnv->ExceptionDescribe();
+            threadEnv->ExceptionClear();
+          }
+        });
+        return 0;
+      }};
+  return static_cast<jlong>(
+      StreamerController::shared().post(std::move(command), streamerCallback(env, jListener)));
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cancelStreamerCommandsNative(
+    JNIEnv* env,
+    jobject self,
+    jint lanes) {
+  StreamerController::shared().cancel(
+      static_cast<StreamerController::Lane>(lanes & StreamerController::kBothLanes));
+}
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setDeviceLostListenerNative(
+    JNIEnv* env,
+    jobject self,
+    jobject jListener) {
+  if (jListener == nullptr) {
+    reconnect().setListener(nullptr);
+    return;
+  }
+  jmethodID onLost = env->GetMethodID(env->GetObjectClass(jListener), "onUsbDeviceLost", "()V");
+  if (onLost == nullptr) {
+    return;
+  }
+  // Dropped with the last copy of the listener, which may be running.
+  std::shared_ptr<_jobject> listener(env->NewGlobalRef(jListener), [](jobject ref) {
+    withJniEnv([ref](JNIEnv* threadEnv) { threadEnv->DeleteGlobalRef(ref); });
+  });
+  reconnect().setListener([listener, onLost] {
+    withJniEnv([&](JNIEnv* threadEnv) { threadEnv->CallVoidMethod(listener.get(), onLost); });
+  });
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_awaitReconnectNative(
+    JNIEnv* env,
+    jobject self) {
+  startup_.wait();
+  if (streamer_ == nullptr && uvcStreamer_ == nullptr) {
+    return false;
+  }
+  return reconnect().hold();
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_isReconnectPendingNative(
+    JNIEnv* env,
+    jobject self) {
+  return reconnect().isPending();
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_reconnectUsbStreamingNative(
+    JNIEnv* env,
+    jobject self,
+    jint audioDeviceFd,
+    jint videoDeviceFd) {
+  startup_.wait();
+  if (!reconnect().isPending()) {
+    return false;
+  }
+  bool reattached = true;
+  if (uvcStreamer_ != nullptr) {
+    reattached = videoDeviceFd >= 0 &&
+        uvcStreamer_->reattach(UvcDevice::open((intptr_t)videoDeviceFd));
+  }
+  if (reattached && streamer_ != nullptr) {
+    reattached = audioDeviceFd >= 0 && streamer_->reattach((intptr_t)audioDeviceFd);
+  }
+  reconnect().finish(reattached);
+  return reattached;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startUsbAudioStreamingNative(
+        JNIEnv* env,
+        jobject self) {
+  if (streamer_ != nullptr) {
+    streamer_->start();
+  }
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopUsbAudioStreamingNative(
+    JNIEnv* env,
+    jobject self) {
+  if (streamer_ != nullptr) {
+    streamer_->requestStop();
+  }
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_openCameraSessionNative(
+    JNIEnv* env,
+    jobject self,
+    jint deviceFd,
+    jint width,
+    jint height,
+    jint fps,
+    jint libuvcFrameFormat,
+    jobject jSurface) {
+  std::lock_guard lk(sessionsMutex_);
+  StreamerReaper::shared().drain();
+  std::shared_ptr<UvcDevice> device = UvcDevice::open((intptr_t)deviceFd);
+  if (device == nullptr) {
+    return -1;
+  }
+  return addCameraSession(
+      env, std::move(device), -1, width, height, fps, libuvcFrameFormat, jSurface);
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_openReplaySessionNative(
+    JNIEnv* env,
+    jobject self,
+    jint fd,
+    jboolean realtime,
+    jint loops,
+    jobject jSurface) {
+  std::lock_guard lk(sessionsMutex_);
+  uint32_t statsSlot = freeStatsSlot();
+  if (statsSlot == 0) {
+    CLOGE("No stats block left for a replay session");
+    return -1;
+  }
+  constexpr uint32_t kFrameQueueDepth = 2;
+  auto player = std::make_unique<FrameLogPlayer>();
+  if (!player->open(fd, kFrameQueueDepth + UsbVideoStreamer::kPoolFramesBesidesQueue)) {
+    return -1;
+  }
+  FrameLogPlayer::Options options{.realtime = (bool)realtime, .loops = (uint32_t)loops};
+  CameraSession session;
+  session.statsSlot = statsSlot;
+  session.video = std::make_unique<UsbVideoStreamer>(
+      std::move(player),
+      options,
+      kFrameQueueDepth,
+      FrameDropPolicy::DROP_OLDEST,
+      StreamingStats::forSession(statsSlot));
+  session.previewWindow.reset(ANativeWindow_fromSurface(env, jSurface));
+  if (!session.video->configureOutput(session.previewWindow.get())) {
+    return -1;
+  }
+  jint handle = nextSessionHandle_++;
+  sessions_.emplace(handle, std::move(session));
+  CLOGI("Opened replay session %d, stats block %u", handle, statsSlot);
+  return handle;
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_openCameraStreamSessionNative(
+    JNIEnv* env,
+    jobject self,
+    jint cameraHandle,
+    jint interfaceNumber,
+    jint width,
+    jint height,
+    jint fps,
+    jint libuvcFrameFormat,
+    jobject jSurface) {
+  std::lock_guard lk(sessionsMutex_);
+  StreamerReaper::shared().drain();
+  UsbVideoStreamer* camera = findVideoStreamer(cameraHandle);
+  if (camera == nullptr || camera->device() == nullptr) {
+    return -1;
+  }
+  return addCameraSession(
+      env, camera->device(), interfaceNumber, width, height, fps, libuvcFrameFormat, jSurface);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_pairCameraSessionsNative(
+    JNIEnv* env,
+    jobject self,
+    jint firstHandle,
+    jint secondHandle) {
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* first = findVideoStreamer(firstHandle);
+  UsbVideoStreamer* second = findVideoStreamer(secondHandle);
+  // PTS only compare within one device clock.
+  if (first == nullptr || second == nullptr || first == second ||
+      first->device() != second->device() || first->isRunning() || second->isRunning()) {
+    return false;
+  }
+  int32_t fps = std::max({first->captureFps(), second->captureFps(), 1});
+  auto pairer = std::make_shared<FramePairer>(first->clockFrequency(), nanoseconds(500ms) / fps);
+  first->setFramePairer(pairer, 0);
+  second->setFramePairer(pairer, 1);
+  return true;
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cameraSessionPairingStatsNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  FramePairer::Stats stats;
+  {
+    std::lock_guard lk(sessionsMutex_);
+    UsbVideoStreamer* streamer = findVideoStreamer(handle);
+    if (streamer == nullptr || streamer->framePairer() == nullptr) {
+      return env->NewLongArray(0);
+    }
+    stats = streamer->framePairer()->stats();
+  }
+  jlong values[] = {
+      (jlong)stats.pairs,
+      (jlong)stats.unpaired,
+      stats.lastSkewUs,
+      stats.lastSequences[0],
+      stats.lastSequences[1],
+  };
+  jlongArray result = env->NewLongArray(std::size(values));
+  if (result != nullptr) {
+    env->SetLongArrayRegion(result, 0, std::size(values), values);
+  }
+  return result;
+}
+
+// Detaches the synchronized sessions, which must be stopped. Under sessionsMutex_.
+static bool detachFrameSynchronizer() {
+  for (jint handle : synchronizedHandles_) {
+    UsbVideoStreamer* streamer = findVideoStreamer(handle);
+    if (streamer != nullptr && streamer->isRunning()) {
+      return false;
+    }
+  }
+  for (jint handle : synchronizedHandles_) {
+    UsbVideoStreamer* streamer = findVideoStreamer(handle);
+    if (streamer != nullptr && streamer->frameSynchronizer() == frameSynchronizer_) {
+      streamer->setFrameSynchronizer(nullptr, 0);
+    }
+  }
+  synchronizedHandles_.clear();
+  frameSynchronizer_ = nullptr;
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_synchronizeCameraSessionsNative(
+    JNIEnv* env,
+    jobject self,
+    jintArray jHandles,
+    jint toleranceUs,
+    jint maxWaitMs) {
+  jsize count = env->GetArrayLength(jHandles);
+  if (count < 2 || count > (jsize)FrameSynchronizer::kMaxStreams) {
+    return false;
+  }
+  std::vector<jint> handles(count);
+  env->GetIntArrayRegion(jHandles, 0, count, handles.data());
+  std::lock_guard lk(sessionsMutex_);
+  std::vector<UsbVideoStreamer*> streamers;
+  int32_t slowestFps = INT32_MAX;
+  for (jint handle : handles) {
+    UsbVideoStreamer* streamer = findVideoStreamer(handle);
+    if (streamer == nullptr || streamer->isRunning() ||
+        std::find(streamers.begin(), streamers.end(), streamer) != streamers.end()) {
+      return false;
+    }
+    streamers.push_back(streamer);
+    slowestFps = std::min(slowestFps, std::max(streamer->captureFps(), 1));
+  }
+  if (!detachFrameSynchronizer()) {
+    return false;
+  }
+  // By default half a frame of the slowest camera, and three of its frames.
+  nanoseconds tolerance =
+      toleranceUs > 0 ? nanoseconds(microseconds(toleranceUs)) : nanoseconds(500ms) / slowestFps;
+  nanoseconds maxWait =
+      maxWaitMs > 0 ? nanoseconds(milliseconds(maxWaitMs)) : nanoseconds(3s) / slowestFps;
+  frameSynchronizer_ = std::make_shared<FrameSynchronizer>(count, tolerance, maxWait);
+  for (jsize i = 0; i < count; i++) {
+    streamers[i]->setFrameSynchronizer(frameSynchronizer_, i);
+  }
+  synchronizedHandles_ = std::move(handles);
+  CLOGI(
+      "Synchronizing %d camera sessions within %.2f ms, waiting up to %.1f ms",
+      count,
+      tolerance.count() / 1e6,
+      maxWait.count() / 1e6);
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopSynchronizingCameraSessionsNative(
+    JNIEnv* env,
+    jobject self) {
+  std::lock_guard lk(sessionsMutex_);
+  return detachFrameSynchronizer();
+}
+
+JNIEXPORT jobjectArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_acquireSynchronizedFramesNative(
+    JNIEnv* env,
+    jobject self,
+    jint timeoutMs,
+    jlongArray jInfo) {
+  std::shared_ptr<FrameSynchronizer> synchronizer;
+  {
+    std::lock_guard lk(sessionsMutex_);
+    synchronizer = frameSynchronizer_;
+  }
+  FrameSynchronizer::Set set;
+  if (synchronizer == nullptr ||
+      !synchronizer->acquire(set, milliseconds(std::max(timeoutMs, 0)))) {
+    return nullptr;
+  }
+  // The set number, its spread, then six values per frame.
+  std::vector<jlong> info{(jlong)set.number, set.spreadNs};
+  jclass byteBufferClass = env->FindClass("java/nio/ByteBuffer");
+  jobjectArray result = env->NewObjectArray(set.streams, byteBufferClass, nullptr);
+  for (uint32_t s = 0; s < set.streams; s++) {
+    uvc_frame_t* frame = set.frames[s];
+    info.insert(
+        info.end(),
+        {set.captureNs[s],
+         frame->sequence,
+         (jlong)frame->width,
+         (jlong)frame->height,
+         (jlong)frame->frame_format,
+         (jlong)frame->data_bytes});
+    if (result != nullptr) {
+      jobject buffer = env->NewDirectByteBuffer(frame->data, frame->data_bytes);
+      env->SetObjectArrayElement(result, s, buffer);
+      env->DeleteLocalRef(buffer);
+    }
+  }
+  jsize length = std::min<jsize>(env->GetArrayLength(jInfo), info.size());
+  env->SetLongArrayRegion(jInfo, 0, length, info.data());
+  if (result == nullptr) {
+    synchronizer->release();
+  }
+  return result;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_releaseSynchronizedFramesNative(
+    JNIEnv* env,
+    jobject self) {
+  std::shared_ptr<FrameSynchronizer> synchronizer;
+  {
+    std::lock_guard lk(sessionsMutex_);
+    synchronizer = frameSynchronizer_;
+  }
+  if (synchronizer != nullptr) {
+    synchronizer->release();
+  }
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_frameSynchronizerStatsNative(
+    JNIEnv* env,
+    jobject self) {
+  FrameSynchronizer::Stats stats;
+  {
+    std::lock_guard lk(sessionsMutex_);
+    if (frameSynchronizer_ == nullptr) {
+      return env->NewLongArray(0);
+    }
+    stats = frameSynchronizer_->stats();
+  }
+  jlong values[] = {
+      (jlong)stats.sets,
+      (jlong)stats.stale,
+      (jlong)stats.timedOut,
+      (jlong)stats.superseded,
+      stats.lastSpreadUs,
+  };
+  jlongArray result = env->NewLongArray(std::size(values));
+  if (result != nullptr) {
+    env->SetLongArrayRegion(result, 0, std::size(values), values);
+  }
+  return result;
+}
+
+JNIEXPORT jintArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_uvcControlUnitsNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* streamer = findVideoStreamer(handle);
+  if (streamer == nullptr || streamer->device() == nullptr) {
+    return nullptr;
+  }
+  uvc_device_handle_t* deviceHandle = streamer->device()->handle();
+  const uvc_input_terminal_t* camera = uvc_get_camera_terminal(deviceHandle);
+  const uvc_processing_unit_t* processing = uvc_get_processing_units(deviceHandle);
+  jint units[] = {
+      camera != nullptr ? camera->bTerminalID : 0,
+      processing != nullptr ? processing->bUnitID : 0,
+  };
+  jintArray result = env->NewIntArray(std::size(units));
+  if (result != nullptr) {
+    env->SetIntArrayRegion(result, 0, std::size(units), units);
+  }
+  return result;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_setUvcControlNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jint unit,
+    jint selector,
+    jbyteArray jValue,
+    jobject jListener) {
+  std::shared_ptr<UvcDevice> device = findDevice(handle);
+  if (device == nullptr) {
+    return false;
+  }
+  std::vector<uint8_t> value(env->GetArrayLength(jValue));
+  env->GetByteArrayRegion(jValue, 0, value.size(), reinterpret_cast<jbyte*>(value.data()));
+  device->controls().set(
+      unit, selector, value.data(), value.size(), controlCallback(env, jListener));
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_getUvcControlNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jint unit,
+    jint selector,
+    jint request,
+    jint length,
+    jobject jListener) {
+  std::shared_ptr<UvcDevice> device = findDevice(handle);
+  if (device == nullptr) {
+    return false;
+  }
+  device->controls().get(
+      unit,
+      selector,
+      static_cast<uvc_req_code>(request),
+      length,
+      controlCallback(env, jListener));
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_requestSnapshotNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jobject bitmap,
+    jobject jListener) {
+  jmethodID onSnapshot = env->GetMethodID(env->GetObjectClass(jListener), "onSnapshot", "(Z)V");
+  if (onSnapshot == nullptr) {
+    return false;
+  }
+  jobject listener = env->NewGlobalRef(jListener);
+  auto done = [listener, onSnapshot](JNIEnv* threadEnv, bool ok) {
+    threadEnv->CallVoidMethod(listener, onSnapshot, (jboolean)ok);
+    threadEnv->DeleteGlobalRef(listener);
+  };
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* streamer = findVideoStreamer(handle);
+  if (streamer == nullptr || !streamer->requestSnapshot(env, bitmap, done)) {
+    env->DeleteGlobalRef(listener);
+    return false;
+  }
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_requestJpegSnapshotNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jint width,
+    jint height,
+    jint quality,
+    jobject jListener) {
+  jmethodID onSnapshot =
+      env->GetMethodID(env->GetObjectClass(jListener), "onJpegSnapshot", "(ZII[B)V");
+  if (onSnapshot == nullptr) {
+    return false;
+  }
+  jobject listener = env->NewGlobalRef(jListener);
+  auto done = [listener, onSnapshot](
+                  bool ok, int32_t width, int32_t height, std::vector<uint8_t> jpeg) {
+    withJniEnv([&](JNIEnv* threadEnv) {
+      jbyteArray image = nullptr;
+      if (ok) {
+        image = threadEnv->NewByteArray(jpeg.size());
+        if (image != nullptr) {
+          threadEnv->SetByteArrayRegion(
+              image, 0, jpeg.size(), reinterpret_cast<const jbyte*>(jpeg.data()));
+        }
+      }
+      threadEnv->CallVoidMethod(
+          listener, onSnapshot, (jboolean)(image != nullptr), width, height, image);
+      if (image != nullptr) {
+        threadEnv->DeleteLocalRef(image);
+      }
+      threadEnv->DeleteGlobalRef(listener);
+    });
+  };
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* streamer = findVideoStreamer(handle);
+  if (streamer == nullptr || !streamer->requestJpegSnapshot(width, height, quality, done)) {
+    env->DeleteGlobalRef(listener);
+    return false;
+  }
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_enableStillCaptureNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jint width,
+    jint height) {
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* streamer = findVideoStreamer(handle);
+  return streamer != nullptr && streamer->enableStillCapture(width, height);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_captureStillNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jobject jListener) {
+  jmethodID onCaptured =
+      env->GetMethodID(env->GetObjectClass(jListener), "onStillCaptured", "(ZII[B)V");
+  if (onCaptured == nullptr) {
+    return false;
+  }
+  jobject listener = env->NewGlobalRef(jListener);
+  auto done = [listener, onCaptured](
+                  bool ok, int32_t width, int32_t height, std::vector<uint8_t> data) {
+    withJniEnv([&](JNIEnv* threadEnv) {
+      jbyteArray image = nullptr;
+      if (ok) {
+        image = threadEnv->NewByteArray(data.size());
+        if (image != nullptr) {
+          threadEnv->SetByteArrayRegion(
+              image, 0, data.size(), reinterpret_cast<const jbyte*>(data.data()));
+        }
+      }
+      threadEnv->CallVoidMethod(
+          listener, onCaptured, (jboolean)(image != nullptr), width, height, image);
+      if (image != nullptr) {
+        threadEnv->DeleteLocalRef(image);
+      }
+      threadEnv->DeleteGlobalRef(listener);
+    });
+  };
+  std::lock_guard lk(sessionsMutex_);
+  UsbVideoStreamer* streamer = findVideoStreamer(handle);
+  if (streamer == nullptr || !streamer->captureStill(done)) {
+    env->DeleteGlobalRef(listener);
+    return false;
+  }
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_connectCameraSessionAudioNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle,
+    jint deviceFd,
+    jint jAudioFormat,
+    jint samplingFrequency,
+    jint subFrameSize,
+    jint channelCount,
+    jint jAudioPerfMode,
+    jint outputFramesPerBuffer,
+    jboolean exclusive,
+    jint nativeSampleRate) {
+  std::lock_guard lk(sessionsMutex_);
+  CameraSession* session = findSession(handle);
+  if (session == nullptr || session->audio != nullptr) {
+    return false;
+  }
+  StreamerReaper::shared().drain();
+  session->audio = std::make_unique<UsbAudioStreamer>(
+      (intptr_t)deviceFd,
+      jAudioFormat,
+      samplingFrequency,
+      subFrameSize,
+      channelCount,
+      jAudioPerfMode,
+      outputFramesPerBuffer,
+      exclusive,
+      nativeSampleRate,
+      StreamingStats::forSession(session->statsSlot));
+  return true;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_startCameraSessionNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  CameraSession* session = findSession(handle);
+  if (session == nullptr || !session->video->start()) {
+    return false;
+  }
+  if (session->audio != nullptr) {
+    session->audio->start();
+  }
+  return true;
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_stopCameraSessionNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  CameraSession* session = findSession(handle);
+  if (session == nullptr) {
+    return;
+  }
+  if (session->audio != nullptr) {
+    session->audio->requestStop();
+  }
+  session->video->requestStop();
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_closeCameraSessionNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  auto it = sessions_.find(handle);
+  if (it == sessions_.end()) {
+    return;
+  }
+  // Streamers go before the window they draw into.
+  CameraSession& session = it->second;
+  retireStreamers(
+      std::move(session.video), std::move(session.audio), std::move(session.previewWindow));
+  sessions_.erase(it);
+}
+
+JNIEXPORT jobject JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cameraSessionStatsBufferNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  CameraSession* session = findSession(handle);
+  if (session == nullptr) {
+    return nullptr;
+  }
+  StreamingStats& stats = StreamingStats::forSession(session->statsSlot);
+  return env->NewDirectByteBuffer(&stats, sizeof(stats));
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_openFrameEventsNative(
+    JNIEnv* env,
+    jobject self,
+    jlong stats) {
+  FrameEventQueue* events = frameEventsFromHandle(stats);
+  return events != nullptr && events->open();
+}
+
+JNIEXPORT void JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_closeFrameEventsNative(
+    JNIEnv* env,
+    jobject self,
+    jlong stats) {
+  FrameEventQueue* events = frameEventsFromHandle(stats);
+  if (events != nullptr) {
+    events->close();
+  }
+}
+
+JNIEXPORT jint JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_readFrameEventsNative(
+    JNIEnv* env,
+    jobject self,
+    jlong stats,
+    jobject jBuffer,
+    jint minCount,
+    jint maxWaitMs) {
+  FrameEventQueue* events = frameEventsFromHandle(stats);
+  auto* data = static_cast<FrameEvent*>(env->GetDirectBufferAddress(jBuffer));
+  jlong capacity = env->GetDirectBufferCapacity(jBuffer);
+  if (events == nullptr || data == nullptr || capacity < (jlong)sizeof(FrameEvent)) {
+    return 0;
+  }
+  return events->read(
+      data, capacity / sizeof(FrameEvent), std::max(minCount, 1), milliseconds(maxWaitMs));
+}
+
+JNIEXPORT jlong JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cameraSessionStatsHandleNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::lock_guard lk(sessionsMutex_);
+  CameraSession* session = findSession(handle);
+  if (session == nullptr) {
+    return 0;
+  }
+  return reinterpret_cast<jlong>(&StreamingStats::forSession(session->statsSlot));
+}
+
+JNIEXPORT jstring JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cameraSessionStatsSummaryNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::string result = "";
+  {
+    std::lock_guard lk(sessionsMutex_);
+    CameraSession* session = findSession(handle);
+    if (session != nullptr && session->audio != nullptr) {
+      result += session->audio->statsSummaryString();
+      result += "\n";
+    }
+    if (session != nullptr) {
+      result += session->video->statsSummaryString();
+    }
+  }
+  return env->NewStringUTF(result.c_str());
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_cameraSessionLatencyPercentilesNative(
+    JNIEnv* env,
+    jobject self,
+    jint handle) {
+  std::vector<int64_t> percentiles;
+  {
+    std::lock_guard lk(sessionsMutex_);
+    CameraSession* session = findSession(handle);
+    if (session != nullptr) {
+      percentiles = session->video->latencyPercentiles();
+    }
+  }
+  jlongArray result = env->NewLongArray(percentiles.size());
+  if (result != nullptr) {
+    env->SetLongArrayRegion(
+        result, 0, percentiles.size(), reinterpret_cast<const jlong*>(percentiles.data()));
+  }
+  return result;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_meta_usbvideo_UsbVideoNativeLibrary_writeProfileNative(
+    JNIEnv* env,
+    jobject self,
+    jstring path) {
+#if defined(USB_VIDEO_PGO_GENERATE)
+  const char* pathChars = env->GetStringUTFChars(path, nullptr);
+  if (pathChars == nullptr) {
+    return false;
+  }
+  __llvm_profile_set_filename(pathChars);
+  env->ReleaseStringUTFChars(path, pathChars);
+  bool written = __llvm_profile_write_file() == 0;
+  if (!written) {
+    CLOGE("Could not write the profile");
+  }
+  return written;
+#else
+  return false;
+#endif
 }
 
 } // extern "C"
@@ -18,9 +18,6 @@
 
 #include <android/bitmap.h>
 #include <android/data_space.h>
-#if __ANDROID_MIN_SDK_VERSION__ >= 30
-#include <android/imagedecoder.h>
-#endif
 #include <android/log.h>
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
@@ -35,12 +32,22 @@
 
 #include <chrono>
 #include <format>
+#include <limits>
+#include <optional>
 
 #include <memory.h>
-#include <sys/prctl.h>
 #include <unistd.h>
 #include <cstring>
 
+#include "AvSync.h"
+#include "BusBandwidthPlanner.h"
+#include "HardwareFrameBuffers.h"
+#include "HotLog.h"
+#include "ModeSelector.h"
+#include "StreamWatchdog.h"
+#include "ThreadPolicy.h"
+#include "Trace.h"
+
 #define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "UsbVideoStreamer", __VA_ARGS__)
 
 #define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "UsbVideoStreamer", __VA_ARGS__)
@@ -48,54 +55,110 @@
 
 #define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "UsbVideoStreamer", __VA_ARGS__)
 
+// For the capture and render threads, see HotLog.
+#define HLOGI(...) HOT_LOG(ANDROID_LOG_INFO, "UsbVideoStreamer", __VA_ARGS__)
+#define HLOGE_EVERY(interval, ...) \
+  HOT_LOG_EVERY(ANDROID_LOG_ERROR, "UsbVideoStreamer", interval, __VA_ARGS__)
+
+std::atomic<PowerProfile> UsbVideoStreamer::defaultPowerProfile_{};
+std::atomic<UvcEncoderControl::Settings> UsbVideoStreamer::defaultEncoderSettings_{};
+
+// Frame based payloads: one encoded access unit per frame, for MediaCodec.
+static bool isFrameBased(uvc_frame_format format) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_H264:
+    case UVC_FRAME_FORMAT_H265:
+    case UVC_FRAME_FORMAT_VP8:
+    case UVC_FRAME_FORMAT_VP9:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// The rate a committed control block has the camera send, which libuvc picks
+// nearest to the requested fps the frame descriptor allows.
+static int32_t negotiatedFps(const uvc_stream_ctrl_t& ctrl, int32_t fps) {
+  return ctrl.dwFrameInterval != 0 ? (int32_t)(10'000'000 / ctrl.dwFrameInterval) : fps;
+}
+
+void UsbVideoStreamer::setPowerProfile(const PowerProfile& powerProfile) {
+  defaultPowerProfile_ = powerProfile;
+}
+
+void UsbVideoStreamer::setEncoderSettings(const UvcEncoderControl::Settings& settings) {
+  defaultEncoderSettings_ = settings;
+}
+
 UsbVideoStreamer::UsbVideoStreamer(
     intptr_t deviceFD,
     int32_t width,
     int32_t height,
     int32_t fps,
-    uvc_frame_format uvcFrameFormat)
-    : deviceFD_(deviceFD),
+    uvc_frame_format uvcFrameFormat,
+    uint32_t frameQueueDepth,
+    FrameDropPolicy frameDropPolicy,
+    StreamingStats& streamingStats)
+    : UsbVideoStreamer(
+          UvcDevice::open(deviceFD),
+          -1,
+          width,
+          height,
+          fps,
+          uvcFrameFormat,
+          frameQueueDepth,
+          frameDropPolicy,
+          streamingStats) {}
+
+UsbVideoStreamer::UsbVideoStreamer(
+    std::shared_ptr<UvcDevice> device,
+    int32_t interfaceNumber,
+    int32_t width,
+    int32_t height,
+    int32_t fps,
+    uvc_frame_format uvcFrameFormat,
+    uint32_t frameQueueDepth,
+    FrameDropPolicy frameDropPolicy,
+    StreamingStats& streamingStats)
+    : device_(std::move(device)),
       width_(width),
       height_(height),
       fps_(fps),
-      uvcFrameFormat_(uvcFrameFormat) {
-  if (libusb_set_option(nullptr, LIBUSB_OPTION_WEAK_AUTHORITY) != LIBUSB_SUCCESS) {
-    ULOGE("libusb setting no discovery option failed");
-  }
-
-  // Initialize a UVC service context. Libuvc will set up its own libusb context.
-  uvc_error_t res = uvc_init(&uvcContext_, nullptr);
-  if (res != UVC_SUCCESS) {
-    ULOGE("uvc_init failed %s", uvc_strerror(res));
-    return;
-  }
-  ULOGE("UVC initialized");
-
-  if ((uvc_wrap(deviceFD, uvcContext_, &deviceHandle_) != UVC_SUCCESS) ||
-      (deviceHandle_ == nullptr)) {
-    ULOGE("uvc_wrap error");
+      uvcFrameFormat_(uvcFrameFormat),
+      streamingStats_(streamingStats),
+      avSync_(&streamingStats == &StreamingStats::shared() ? &AvSync::shared() : nullptr),
+      latencyStats_(streamingStats),
+      frameQueue_(frameQueueDepth),
+      frameDropPolicy_(frameDropPolicy) {
+  stats_.streamingStats = &streamingStats_;
+  stats_.frameEvents = FrameEventQueue::forStats(streamingStats_);
+  if (device_ == nullptr) {
     return;
   }
+  deviceHandle_ = device_->handle();
+  fps = powerProfileFps(interfaceNumber, uvcFrameFormat_, width, height, fps);
 
-  res = uvc_get_stream_ctrl_format_size(
-      deviceHandle_,
-      &streamCtrl_, /* result stored in ctrl */
-      uvcFrameFormat_,
-      width,
-      height,
-      fps);
+  // A camera seen before gets the control block it committed last time,
+  // without another PROBE round; configureOutput() validates it.
+  negotiationKey_ = NegotiationCache::deviceKey(deviceHandle_);
+  negotiationMode_ = {interfaceNumber, uvcFrameFormat_, width, height, fps};
+  cachedNegotiation_ =
+      NegotiationCache::shared().find(negotiationKey_, negotiationMode_, streamCtrl_);
+  uvc_error_t res = cachedNegotiation_ ? UVC_SUCCESS : negotiate(negotiationMode_, streamCtrl_);
   if (res == UVC_SUCCESS) {
     captureFrameWidth_ = width;
     captureFrameHeight_ = height;
-    captureFrameFps_ = fps;
+    captureFrameFps_ = negotiatedFps(streamCtrl_, fps);
     captureFrameFormat_ = uvcFrameFormat_;
     isStreamControlNegotiated_ = true;
     ULOGI(
-        "uvc_get_stream_ctrl_format_size found for %dx%d@%dfps format: %d",
+        "%s stream control for %dx%d@%dfps format: %d, the camera sends %d fps",
+        cachedNegotiation_ ? "Cached" : "Negotiated",
         width,
         height,
         fps,
-        uvcFrameFormat_);
+        uvcFrameFormat_,
+        captureFrameFps_);
   } else {
     isStreamControlNegotiated_ = false;
     ULOGE(
@@ -108,6 +171,170 @@ UsbVideoStreamer::UsbVideoStreamer(
   }
 }
 
+UsbVideoStreamer::UsbVideoStreamer(
+    std::unique_ptr<FrameLogPlayer> player,
+    const FrameLogPlayer::Options& replayOptions,
+    uint32_t frameQueueDepth,
+    FrameDropPolicy frameDropPolicy,
+    StreamingStats& streamingStats)
+    : player_(std::move(player)),
+      replayOptions_(replayOptions),
+      width_(player_->header().width),
+      height_(player_->header().height),
+      fps_(player_->header().frameInterval != 0 ? 10'000'000 / player_->header().frameInterval : 0),
+      uvcFrameFormat_(static_cast<uvc_frame_format>(player_->header().frameFormat)),
+      streamingStats_(streamingStats),
+      avSync_(&streamingStats == &StreamingStats::shared() ? &AvSync::shared() : nullptr),
+      latencyStats_(streamingStats),
+      frameQueue_(frameQueueDepth),
+      frameDropPolicy_(frameDropPolicy) {
+  stats_.streamingStats = &streamingStats_;
+  stats_.frameEvents = FrameEventQueue::forStats(streamingStats_);
+  // What the backends read of a negotiated control block.
+  const FrameLogHeader& header = player_->header();
+  streamCtrl_.dwFrameInterval = header.frameInterval;
+  streamCtrl_.dwClockFrequency = header.clockFrequency;
+  streamCtrl_.dwMaxVideoFrameSize = header.maxFrameSize;
+  captureFrameWidth_ = width_;
+  captureFrameHeight_ = height_;
+  captureFrameFps_ = fps_;
+  captureFrameFormat_ = uvcFrameFormat_;
+  isStreamControlNegotiated_ = true;
+  ULOGI("Replaying format %d %dx%d@%dfps", uvcFrameFormat_, width_, height_, fps_);
+}
+
+int32_t UsbVideoStreamer::powerProfileFps(
+    int32_t interfaceNumber,
+    uvc_frame_format format,
+    int32_t width,
+    int32_t height,
+    int32_t fps) const {
+  if (!powerProfile_.enabled || powerProfile_.targetFps <= 0 || powerProfile_.targetFps >= fps) {
+    return fps;
+  }
+  // A slower frame interval also needs a smaller altsetting on iso cameras.
+  int slowest = uvc_get_slowest_frame_rate(
+      deviceHandle_, interfaceNumber, format, width, height, powerProfile_.targetFps);
+  if (slowest <= 0 || slowest >= fps) {
+    return fps;
+  }
+  ULOGI("Power profile: %d fps instead of %d", slowest, fps);
+  return slowest;
+}
+
+uvc_error_t UsbVideoStreamer::negotiate(
+    const NegotiationCache::Mode& mode,
+    uvc_stream_ctrl_t& ctrl) {
+  return uvc_get_stream_ctrl_format_size_on_interface(
+      deviceHandle_,
+      &ctrl,
+      mode.interfaceNumber,
+      static_cast<uvc_frame_format>(mode.format),
+      mode.width,
+      mode.height,
+      mode.fps);
+}
+
+void UsbVideoStreamer::beginFastStart() {
+  ModeSelector::Candidate cheap{};
+  if (!ModeSelector::cheapest(*device_, streamCtrl_.bInterfaceNumber, captureFrameFps_, cheap) ||
+      (int64_t)cheap.width * cheap.height >= (int64_t)captureFrameWidth_ * captureFrameHeight_) {
+    return;
+  }
+  NegotiationCache::Mode mode{
+      streamCtrl_.bInterfaceNumber, cheap.format, cheap.width, cheap.height, cheap.fps};
+  uvc_stream_ctrl_t ctrl{};
+  bool cached = NegotiationCache::shared().find(negotiationKey_, mode, ctrl);
+  uvc_error_t res = cached ? UVC_SUCCESS : negotiate(mode, ctrl);
+  if (res != UVC_SUCCESS) {
+    ULOGW("No fast start in %dx%d: %s", cheap.width, cheap.height, uvc_strerror(res));
+    return;
+  }
+  // Probed already, so finishFastStart() only commits it.
+  if (!cachedNegotiation_) {
+    NegotiationCache::shared().store(negotiationKey_, negotiationMode_, streamCtrl_);
+  }
+  fastStartTarget_ = negotiationMode_;
+  streamCtrl_ = ctrl;
+  negotiationMode_ = mode;
+  cachedNegotiation_ = cached;
+  uvcFrameFormat_ = cheap.format;
+  width_ = captureFrameWidth_ = cheap.width;
+  height_ = captureFrameHeight_ = cheap.height;
+  fps_ = cheap.fps;
+  captureFrameFps_ = negotiatedFps(ctrl, cheap.fps);
+  captureFrameFormat_ = cheap.format;
+  fastStarting_ = true;
+  ULOGI(
+      "Fast start in format %d %dx%d@%dfps before %dx%d",
+      cheap.format,
+      cheap.width,
+      cheap.height,
+      cheap.fps,
+      fastStartTarget_.width,
+      fastStartTarget_.height);
+}
+
+void UsbVideoStreamer::setFastStart(bool fastStart) {
+  fastStart_ = fastStart;
+}
+
+bool UsbVideoStreamer::isFastStarting() const {
+  return fastStarting_;
+}
+
+bool UsbVideoStreamer::awaitFirstFrame(nanoseconds timeout) {
+  std::unique_lock lk(firstShownMutex_);
+  return firstShownChange_.wait_for(lk, timeout, [this] { return firstFrameShown_.load(); });
+}
+
+bool UsbVideoStreamer::finishFastStart() {
+  if (!fastStarting_) {
+    return true;
+  }
+  const NegotiationCache::Mode& target = fastStartTarget_;
+  if (!reconfigure(
+          target.width, target.height, target.fps, static_cast<uvc_frame_format>(target.format))) {
+    ULOGE("Fast start stays at %dx%d, the requested mode failed", width_, height_);
+    return false;
+  }
+  return true;
+}
+
+void UsbVideoStreamer::noteFirstFrameShown() {
+  {
+    std::lock_guard lk(firstShownMutex_);
+    firstFrameShown_ = true;
+  }
+  firstShownChange_.notify_all();
+  steady_clock::duration sinceCreated = steady_clock::now() - createdAt_;
+  VideoRenderCounters& render = streamingStats_.videoRender;
+  if (!firstFrameReported_) {
+    firstFrameReported_ = true;
+    render.firstFrameUs.set(duration_cast<microseconds>(sinceCreated).count());
+  }
+  if (!fullQualityReported_ && !fastStarting_) {
+    fullQualityReported_ = true;
+    render.fullQualityUs.set(duration_cast<microseconds>(sinceCreated).count());
+    HLOGI(
+        "Requested mode on screen %.1f ms after connect, first frame after %.1f ms",
+        duration<double, std::milli>(sinceCreated).count(),
+        render.firstFrameUs.load() / 1000.0);
+  }
+}
+
+void UsbVideoStreamer::setFramePairer(std::shared_ptr<FramePairer> pairer, uint32_t stream) {
+  framePairer_ = std::move(pairer);
+  framePairerStream_ = stream;
+}
+
+void UsbVideoStreamer::setFrameSynchronizer(
+    std::shared_ptr<FrameSynchronizer> synchronizer,
+    uint32_t stream) {
+  frameSynchronizer_ = std::move(synchronizer);
+  frameSynchronizerStream_ = stream;
+}
+
 bool UsbVideoStreamer::configureOutput(ANativeWindow* previewWindow) {
   if (!isStreamControlNegotiated_) {
     return false;
@@ -115,131 +342,2470 @@ bool UsbVideoStreamer::configureOutput(ANativeWindow* previewWindow) {
   if (previewWindow_ == nullptr) {
     previewWindow_ = previewWindow;
   }
+  fastPaths_ = FastPaths::get();
+  if (fastPaths_.allowed != FastPaths::kAll) {
+    ULOGI(
+        "Cohort %u, fast paths off: %s",
+        fastPaths_.cohort,
+        FastPaths::names(~fastPaths_.allowed & FastPaths::kAll).c_str());
+  }
+  if (fastStart_ && player_ == nullptr && !pullMode_ && previewWindow_ != nullptr &&
+      !fastStarting_) {
+    beginFastStart();
+  }
+  updateHeadless();
+  latencyStats_.setClockFrequency(streamCtrl_.dwClockFrequency);
+  deviceClock_.reset(streamCtrl_.dwClockFrequency);
+  if (player_ != nullptr) {
+    // Recorded frames need neither a device nor a negotiation.
+    streamHandle_ = player_->streamHandle();
+    if (!configureBackends()) {
+      streamHandle_ = nullptr;
+      return false;
+    }
+    state_ = StreamerState::READY_TO_START;
+    return true;
+  }
+  if (openStream() != UVC_SUCCESS) {
+    return false;
+  }
+  if (!configureBackends()) {
+    uvc_stream_close(streamHandle_);
+    streamHandle_ = nullptr;
+    device_->removeStream();
+    return false;
+  }
+  state_ = StreamerState::READY_TO_START;
+  return true;
+}
+
+uvc_error_t UsbVideoStreamer::openStream() {
   uvc_error_t ret = uvc_stream_open_ctrl(deviceHandle_, &streamHandle_, &streamCtrl_);
-  return ret == UVC_SUCCESS;
+  if (ret != UVC_SUCCESS && cachedNegotiation_) {
+    ULOGW("Cached stream control refused: %s, negotiating", uvc_strerror(ret));
+    NegotiationCache::shared().evict(negotiationKey_, negotiationMode_);
+    cachedNegotiation_ = false;
+    ret = negotiate(negotiationMode_, streamCtrl_);
+    if (ret == UVC_SUCCESS) {
+      ret = uvc_stream_open_ctrl(deviceHandle_, &streamHandle_, &streamCtrl_);
+    }
+  }
+  if (ret != UVC_SUCCESS) {
+    return ret;
+  }
+  if (!cachedNegotiation_) {
+    NegotiationCache::shared().store(negotiationKey_, negotiationMode_, streamCtrl_);
+  }
+  uvc_stream_set_device_lost_callback(streamHandle_, deviceLostCallback, this);
+  device_->addStream();
+  return UVC_SUCCESS;
 }
 
-bool UsbVideoStreamer::start() {
-  if (streamHandle_ == nullptr) {
+void UsbVideoStreamer::deviceLostCallback(void* userPtr) {
+  UsbVideoStreamer* streamer = static_cast<UsbVideoStreamer*>(userPtr);
+  ULOGW("Camera lost");
+  if (streamer->deviceLostListener_) {
+    streamer->deviceLostListener_();
+  }
+}
+
+void UsbVideoStreamer::setDeviceLostListener(std::function<void()> listener) {
+  deviceLostListener_ = std::move(listener);
+}
+
+bool UsbVideoStreamer::isDeviceLost() const {
+  return streamHandle_ != nullptr && player_ == nullptr && uvc_stream_device_lost(streamHandle_);
+}
+
+bool UsbVideoStreamer::configureBackends() {
+  // Playback streams have no descriptors and get the format's defaults.
+  const uvc_format_desc_t* formatDesc =
+      player_ == nullptr ? uvc_get_stream_format_desc(streamHandle_) : nullptr;
+  colorimetry_ = Colorimetry::of(formatDesc, captureFrameFormat_);
+  frameConverter_.setColorimetry(colorimetry_);
+  // D0 interlaced, D1 one field per frame rather than both woven, D2 field 1,
+  // the top one, first.
+  uint8_t interlaceFlags = formatDesc != nullptr ? formatDesc->bmInterlaceFlags : 0;
+  bool woven = (interlaceFlags & 0x3) == 0x1;
+  frameConverter_.setDeinterlace(
+      woven || deinterlaceForced_ ? deinterlaceMode_ : DeinterlaceMode::OFF,
+      !woven || (interlaceFlags & 0x4) != 0);
+  if (frameConverter_.deinterlace() != DeinterlaceMode::OFF) {
+    ULOGI("Deinterlacing, mode %d flags 0x%x", (int)deinterlaceMode_, interlaceFlags);
+  }
+  fanout_.setColorimetry(colorimetry_);
+  if (previewWindow_ == nullptr) {
+    // Headless: every preview backend waits for a window, and consumers
+    // convert what they need through fanout_.
+    ULOGI("Streaming format %d headless", captureFrameFormat_);
+    return true;
+  }
+  // MJPEG falls back to the CPU when there is no hardware decoder.
+  bool mjpeg = captureFrameFormat_ == UVC_FRAME_FORMAT_MJPEG;
+  if (MediaCodecDecoder::supportsFormat(captureFrameFormat_) &&
+      (!mjpeg || (hardwareMjpegDecoding_ && fastPaths_.allows(FAST_PATH_HARDWARE_MJPEG)))) {
+    if (videoDecoder_ == nullptr) {
+      videoDecoder_ = std::make_unique<MediaCodecDecoder>();
+      if (!videoDecoder_->init(
+              previewWindow_,
+              captureFrameWidth_,
+              captureFrameHeight_,
+              captureFrameFormat_,
+              streamCtrl_.dwMaxVideoFrameSize)) {
+        videoDecoder_ = nullptr;
+        if (!mjpeg) {
+          return false;
+        }
+        ULOGW("No hardware MJPEG decoder, decoding on the CPU");
+      }
+    }
+    if (videoDecoder_ != nullptr) {
+      return true;
+    }
+  }
+  ULOGI("Converting format %d as %s", captureFrameFormat_, colorimetry_.name());
+  changeDetector_.invalidate();
+  bool yuvWindow = nativeYuvOutput_ &&
+      FrameConverter::isSupported(captureFrameFormat_, FrameConverter::kYv12WindowFormat);
+  if (yuvWindow) {
+    setWindowGeometry(FrameConverter::kYv12WindowFormat);
+    yuvWindow = ANativeWindow_getFormat(previewWindow_) == FrameConverter::kYv12WindowFormat;
+    if (!yuvWindow) {
+      ULOGW("Preview window refused YV12 buffers, converting to RGB");
+    }
+  }
+  bool hdrWindow = !yuvWindow && hdrDataSpace_ != ADATASPACE_UNKNOWN &&
+      FrameConverter::isSupported(captureFrameFormat_, kHdrWindowFormat);
+  if (hdrWindow) {
+    setWindowGeometry(kHdrWindowFormat);
+    hdrWindow = ANativeWindow_getFormat(previewWindow_) == kHdrWindowFormat &&
+        setWindowDataSpace(hdrDataSpace_);
+    if (!hdrWindow) {
+      ULOGW("Preview window refused 10 bit buffers, converting to 8 bit RGB");
+    }
+  }
+  if (!hdrWindow) {
+    // The compositor converts YV12 with the stream's matrix; RGB keeps the
+    // default.
+    setWindowDataSpace(yuvWindow ? yuvDataSpace(colorimetry_) : ADATASPACE_UNKNOWN);
+  }
+  // Window formats only the CPU path writes.
+  bool cpuOnlyWindow = yuvWindow || hdrWindow;
+  cpuOnlyWindow_ = cpuOnlyWindow;
+  // Writes the presenter's buffers at the capture size, for the layer to
+  // scale, with none of the CPU path's per frame stages.
+  if (!cpuOnlyWindow && vulkanConversion_ && fastPaths_.allows(FAST_PATH_VULKAN_CONVERSION) &&
+      gpuConversion_ && glRenderer_ == nullptr && vulkanConverter_ == nullptr &&
+      VulkanConverter::supportsFormat(captureFrameFormat_) && !lens_.enabled() && !cpuScaling_ &&
+      frameConverter_.deinterlace() == DeinterlaceMode::OFF) {
+    vulkanConverter_ = std::make_unique<VulkanConverter>();
+    if (!vulkanConverter_->init(
+            captureFrameWidth_, captureFrameHeight_, captureFrameFormat_, colorimetry_) ||
+        (presenter_ == nullptr && !initPresenter())) {
+      ULOGW("Vulkan conversion unavailable, falling back to the GL preview");
+      vulkanConverter_ = nullptr;
+      presenter_ = nullptr;
+    }
+  }
+  if (!cpuOnlyWindow && fastPaths_.allows(FAST_PATH_GPU_CONVERSION) && gpuConversion_ &&
+      glRenderer_ == nullptr && vulkanConverter_ == nullptr && gpuDrawsFormat()) {
+    setWindowGeometry(0);
+    glRenderer_ = std::make_unique<GlPreviewRenderer>();
+    if (!glRenderer_->init(
+            previewWindow_,
+            captureFrameWidth_,
+            captureFrameHeight_,
+            captureFrameFormat_,
+            colorimetry_,
+            lens_)) {
+      ULOGW("GL preview unavailable, falling back to libyuv conversion");
+      glRenderer_ = nullptr;
+    } else {
+      glRenderer_->setWhiteBalance(appliedWhiteBalance_);
+    }
+  }
+  // Balanced CPU conversion presents on a layer of its own, leaving the
+  // window unconnected for the GL preview to come back to.
+  if (!cpuOnlyWindow && glRenderer_ == nullptr &&
+      ((surfaceControlPresentation_ && fastPaths_.allows(FAST_PATH_SURFACE_CONTROL)) ||
+       !gpuConversion_) &&
+      presenter_ == nullptr &&
+      !initPresenter()) {
+    ULOGW("SurfaceControl presentation unavailable, falling back to window buffers");
+    presenter_ = nullptr;
+  }
+  if (!cpuOnlyWindow && glRenderer_ == nullptr && presenter_ == nullptr) {
+    setWindowGeometry(cpuWindowFormat());
+  }
+  if (avSync_ != nullptr) {
+    avSync_->setVideoDelayAvailable(presenter_ != nullptr);
+  }
+  applyTransform();
+  int32_t windowFormat =
+      presenter_ != nullptr ? kPreviewWindowFormat : ANativeWindow_getFormat(previewWindow_);
+  if (glRenderer_ == nullptr && !frameConverter_.configure(captureFrameFormat_, windowFormat)) {
     return false;
   }
-  uvc_error_t ret = uvc_stream_start(streamHandle_, captureFrameCallback, this, 0);
-  ULOGE("uvc_stream_start %d", ret);
-  return ret == UVC_SUCCESS;
+  frameConverter_.setDither(windowFormat == AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM);
+  frameConverter_.setLensCorrection(lens_);
+  overlay_.configure(overlayConfig_);
+  frameConverter_.setOverlay(overlay_.enabled() ? &overlay_ : nullptr);
+  if (glRenderer_ != nullptr) {
+    glRenderer_->setOverlay(overlay_.enabled() ? &overlay_ : nullptr);
+  }
+  bool rgbaWindow = windowFormat == AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM ||
+      windowFormat == AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+  // The pool decodes straight to the window's size, past lens correction.
+  if (glRenderer_ == nullptr && mjpegDecodePool_ == nullptr && !lens_.enabled() &&
+      captureFrameFormat_ == UVC_FRAME_FORMAT_MJPEG && rgbaWindow &&
+      fastPaths_.allows(FAST_PATH_MJPEG_DECODE_POOL)) {
+    size_t workers = mjpegDecodeWorkers_;
+    if (workers == 0) {
+      int64_t pixelRate = (int64_t)captureFrameWidth_ * captureFrameHeight_ * captureFrameFps_;
+      workers = pixelRate >= kParallelDecodeMinPixelRate
+          ? std::min(ThreadPolicies::performanceCores().size(), kMaxMjpegDecodeWorkers)
+          : 1;
+    }
+    if (workers > 1) {
+      mjpegDecodePool_ = std::make_unique<MjpegDecodePool>(workers, [this] {
+        std::unique_lock lk(frameQueueMutex_);
+        frameQueueChange_.notify_all();
+      });
+      decodeWidth_ = cpuScaling_ ? ANativeWindow_getWidth(previewWindow_) : captureFrameWidth_;
+      decodeHeight_ = cpuScaling_ ? ANativeWindow_getHeight(previewWindow_) : captureFrameHeight_;
+    }
+  }
+  if (glRenderer_ == nullptr && stripeWorkers_ == nullptr &&
+      captureFrameHeight_ >= kParallelConversionMinHeight &&
+      fastPaths_.allows(FAST_PATH_STRIPE_CONVERSION)) {
+    stripeWorkers_ = StripeWorkerPool::shared();
+    if (stripeWorkers_->threadCount() > 1) {
+      frameConverter_.setWorkerPool(stripeWorkers_.get(), kParallelConversionMinHeight);
+    } else {
+      stripeWorkers_ = nullptr;
+    }
+  }
+  if (schedulerSession_ == nullptr && (mjpegDecodePool_ != nullptr || stripeWorkers_ != nullptr)) {
+    schedulerSession_ = TaskScheduler::shared()->openSession(nanoseconds(frameIntervalNs()));
+  }
+  return true;
 }
 
-bool UsbVideoStreamer::stop() {
-  if (streamHandle_ == nullptr) {
+bool UsbVideoStreamer::reconfigure(
+    int32_t width,
+    int32_t height,
+    int32_t fps,
+    uvc_frame_format uvcFrameFormat) {
+  if (streamHandle_ == nullptr || player_ != nullptr) {
+    return false;
+  }
+  {
+    std::unique_lock lk(recorderMutex_);
+    if (recorder_ != nullptr) {
+      ULOGE("The format cannot change while recording");
+      return false;
+    }
+  }
+  steady_clock::time_point startedAt = steady_clock::now();
+  bool wasRunning = isRunning();
+  // Also finishes a stop that was only requested.
+  stop();
+  // All are set up for the old format; consumers restart them.
+  stopMjpegRecording();
+  stopFrameLog();
+  stopFrameTap();
+  stopFrameServer();
+  disableStillCapture();
+
+  // The device handle, its parsed descriptors and the stream handle stay;
+  // only the stream's commit, and its probe unless cached, run again.
+  fps = powerProfileFps(streamCtrl_.bInterfaceNumber, uvcFrameFormat, width, height, fps);
+  NegotiationCache::Mode mode{streamCtrl_.bInterfaceNumber, uvcFrameFormat, width, height, fps};
+  uvc_stream_ctrl_t ctrl{};
+  bool cached = NegotiationCache::shared().find(negotiationKey_, mode, ctrl);
+  uvc_error_t res = cached ? uvc_stream_ctrl(streamHandle_, &ctrl) : UVC_ERROR_OTHER;
+  if (cached && res != UVC_SUCCESS) {
+    ULOGW("Cached stream control refused: %s, negotiating", uvc_strerror(res));
+    NegotiationCache::shared().evict(negotiationKey_, mode);
+    cached = false;
+  }
+  if (!cached) {
+    res = negotiate(mode, ctrl);
+    if (res == UVC_SUCCESS) {
+      res = uvc_stream_ctrl(streamHandle_, &ctrl);
+    }
+    if (res == UVC_SUCCESS) {
+      NegotiationCache::shared().store(negotiationKey_, mode, ctrl);
+    }
+  }
+  if (res != UVC_SUCCESS) {
+    ULOGE(
+        "Cannot switch to format %d %dx%d@%dfps: %s",
+        uvcFrameFormat,
+        width,
+        height,
+        fps,
+        uvc_strerror(res));
+    // Commit the old format again in case the camera took part of the new one.
+    if (uvc_stream_ctrl(streamHandle_, &streamCtrl_) == UVC_SUCCESS && wasRunning) {
+      start();
+    }
+    return false;
+  }
+  streamCtrl_ = ctrl;
+  negotiationMode_ = mode;
+  cachedNegotiation_ = cached;
+  // Whatever was asked for last is the requested mode now.
+  fastStarting_ = false;
+  uvcFrameFormat_ = uvcFrameFormat;
+  width_ = width;
+  height_ = height;
+  fps_ = fps;
+  captureFrameWidth_ = width;
+  captureFrameHeight_ = height;
+  captureFrameFps_ = negotiatedFps(ctrl, fps);
+  captureFrameFormat_ = uvcFrameFormat;
+
+  // Backends are sized for the old format; only the window is kept.
+  glRenderer_ = nullptr;
+  vulkanConverter_ = nullptr;
+  conversionBalancer_.reset();
+  gpuConversion_ = true;
+  videoDecoder_ = nullptr;
+  presenter_ = nullptr;
+  frameConverter_.setWorkerPool(nullptr, 0);
+  stripeWorkers_ = nullptr;
+  mjpegDecodePool_ = nullptr;
+  latencyStats_.setClockFrequency(streamCtrl_.dwClockFrequency);
+  deviceClock_.reset(streamCtrl_.dwClockFrequency);
+  if (!configureBackends()) {
+    ULOGE("No preview backend for format %d %dx%d", uvcFrameFormat, width, height);
     return false;
   }
-  return uvc_stream_stop(streamHandle_) == UVC_SUCCESS;
+  bool started = !wasRunning || start();
+  ULOGI(
+      "Switched to format %d %dx%d@%dfps in %.1f ms",
+      uvcFrameFormat,
+      width,
+      height,
+      fps,
+      duration<double, std::milli>(steady_clock::now() - startedAt).count());
+  return started;
 }
 
-static std::string fourccFormatFromUvcFrameFormat(uvc_frame_format frameFormat) {
-  switch (frameFormat) {
-    case UVC_FRAME_FORMAT_YUYV:
-      return "YUYV";
-    case UVC_FRAME_FORMAT_UYVY:
-      return "UYVY";
-    case UVC_FRAME_FORMAT_MJPEG:
-      return "MJPG";
-    case UVC_FRAME_FORMAT_H264:
-      return "H264";
-    case UVC_FRAME_FORMAT_NV12:
-      return "NV12";
-    default:
-      return "";
+bool UsbVideoStreamer::setPreviewWindow(ANativeWindow* window) {
+  if (state_ == StreamerState::INITIAL) {
+    return false;
   }
-  return "";
+  std::unique_lock lk(frameQueueMutex_);
+  if (!windowSwapsAccepted_) {
+    lk.unlock();
+    bindPreviewWindow(window);
+    return true;
+  }
+  pendingWindow_ = window;
+  windowSwapPending_ = true;
+  frameQueueChange_.notify_all();
+  windowSwapped_.wait(lk, [this] { return !windowSwapPending_; });
+  return true;
 }
 
-static bool isValidMjpegFrame(uvc_frame_t* frame) {
-  // See https://en.wikipedia.org/wiki/JPEG_File_Interchange_Format
-  if (frame->data_bytes < 6 || frame->data == nullptr) {
-    ULOGE("Invalid MJPEG frame size %zu ptr %p", frame->data_bytes, frame->data);
+void UsbVideoStreamer::applyPendingWindow() {
+  std::unique_lock lk(frameQueueMutex_);
+  if (!windowSwapPending_) {
+    return;
+  }
+  ANativeWindow* window = pendingWindow_;
+  lk.unlock();
+  bindPreviewWindow(window);
+  lk.lock();
+  pendingWindow_ = nullptr;
+  windowSwapPending_ = false;
+  windowSwapped_.notify_all();
+}
+
+void UsbVideoStreamer::bindPreviewWindow(ANativeWindow* window) {
+  if (window == previewWindow_) {
+    return;
+  }
+  // A locked slice is a buffer of the old window.
+  releaseSlice();
+  renderAhead_ = nullptr;
+  previewWindow_ = window;
+  windowDataSpace_ = ADATASPACE_UNKNOWN;
+  frameRateApplied_ = false;
+  // Both backends are worth trying on a new window.
+  conversionBalancer_.reset();
+  gpuConversion_ = true;
+  if (glRenderer_ != nullptr) {
+    // Keeps the context, its textures and the recording window.
+    if (window != nullptr) {
+      setWindowGeometry(0);
+      applyTransform();
+    }
+    if (!glRenderer_->setWindow(window)) {
+      ULOGE("GL preview could not switch windows");
+    }
+  } else if (videoDecoder_ != nullptr) {
+    if (!videoDecoder_->setWindow(window)) {
+      ULOGE("Video decoder could not switch windows");
+    }
+    if (window != nullptr) {
+      // Frames dropped without a window left the decoder without references.
+      requestKeyframe("new window");
+    }
+    applyTransform();
+  } else {
+    // The presenter's layer is a child of the old window, and the converter
+    // holds its buffers.
+    vulkanConverter_ = nullptr;
+    presenter_ = nullptr;
+    if (window != nullptr && !configureBackends()) {
+      ULOGE("No preview backend for the new window, showing nothing");
+      previewWindow_ = nullptr;
+    }
+    // A GL preview that failed for the first window may work for this one.
+    if (glRenderer_ != nullptr && rendering_ &&
+        std::this_thread::get_id() == renderThread_.get_id() && !glRenderer_->makeCurrent()) {
+      ULOGE("GL preview could not be made current on the render thread");
+    }
+  }
+  if (avSync_ != nullptr) {
+    avSync_->setVideoDelayAvailable(presenter_ != nullptr);
+  }
+  slicing_ = slicing_ && canSlice();
+  updateHeadless();
+  publishFastPaths();
+  ULOGI("Preview window %s", previewWindow_ != nullptr ? "switched" : "detached");
+}
+
+bool UsbVideoStreamer::switchConversionBackend(ConversionBackend backend) {
+  // A locked slice is a buffer of the window the CPU path connected.
+  releaseSlice();
+  renderAhead_ = nullptr;
+  bool onRenderThread = rendering_ && std::this_thread::get_id() == renderThread_.get_id();
+  if (glRenderer_ != nullptr) {
+    if (onRenderThread) {
+      glRenderer_->releaseCurrent();
+    }
+    // Disconnects the window for the CPU path.
+    glRenderer_ = nullptr;
+  }
+  vulkanConverter_ = nullptr;
+  presenter_ = nullptr;
+  gpuConversion_ = backend == ConversionBackend::GPU;
+  if (!configureBackends()) {
+    ULOGE("No preview backend after moving conversion, showing nothing");
+    previewWindow_ = nullptr;
+  }
+  if (glRenderer_ != nullptr && onRenderThread && !glRenderer_->makeCurrent()) {
+    ULOGE("GL preview could not be made current on the render thread");
+  }
+  if (avSync_ != nullptr) {
+    avSync_->setVideoDelayAvailable(presenter_ != nullptr);
+  }
+  slicing_ = slicing_ && canSlice();
+  // What configureBackends() fell back to, when it did.
+  gpuConversion_ = glRenderer_ != nullptr;
+  publishFastPaths();
+  return gpuConversion_ == (backend == ConversionBackend::GPU);
+}
+
+bool UsbVideoStreamer::balancesConversion() const {
+  // Either backend converting means the other could, unless the GL preview
+  // already failed to start.
+  return fastPaths_.allows(FAST_PATH_GPU_CONVERSION) && !cpuOnlyWindow_ &&
+      videoDecoder_ == nullptr &&
+      mjpegDecodePool_ == nullptr && gpuDrawsFormat() &&
+      (glRenderer_ != nullptr || !gpuConversion_);
+}
+
+bool UsbVideoStreamer::gpuDrawsFormat() const {
+  if (captureFrameFormat_ == UVC_FRAME_FORMAT_MJPEG) {
+    return gpuMjpegDecoding_ && fastPaths_.allows(FAST_PATH_GPU_MJPEG);
+  }
+  return GlPreviewRenderer::supportsFormat(captureFrameFormat_);
+}
+
+void UsbVideoStreamer::balanceConversion(nanoseconds queueDelay, nanoseconds cost) {
+  if (!balancesConversion()) {
+    return;
+  }
+  ConversionBackend backend =
+      glRenderer_ != nullptr ? ConversionBackend::GPU : ConversionBackend::CPU;
+  ConversionBackend next = conversionBalancer_.record(
+      backend, queueDelay, cost, nanoseconds(frameIntervalNs()), steady_clock::now());
+  const ConversionBalancer::Load& cpu = conversionBalancer_.load(ConversionBackend::CPU);
+  const ConversionBalancer::Load& gpu = conversionBalancer_.load(ConversionBackend::GPU);
+  VideoRenderCounters& render = streamingStats_.videoRender;
+  render.conversionBackend.set((uint64_t)backend);
+  render.conversionSwitches.set(conversionBalancer_.switches());
+  render.cpuConversionCostUs.set(duration_cast<microseconds>(cpu.cost).count());
+  render.cpuConversionQueueDelayUs.set(duration_cast<microseconds>(cpu.queueDelay).count());
+  render.gpuConversionCostUs.set(duration_cast<microseconds>(gpu.cost).count());
+  render.gpuConversionQueueDelayUs.set(duration_cast<microseconds>(gpu.queueDelay).count());
+  if (next == backend) {
+    return;
+  }
+  bool cpuNext = next == ConversionBackend::CPU;
+  const ConversionBalancer::Load& load = cpuNext ? gpu : cpu;
+  bool switched;
+  {
+    std::unique_lock lk(recorderMutex_);
+    // Recordings are drawn by the GL preview.
+    if (recorder_ != nullptr) {
+      return;
+    }
+    ULOGI(
+        "Moving preview conversion to the %s: %.1f ms per frame and %.1f ms queued on the %s",
+        cpuNext ? "CPU" : "GPU",
+        duration<double, std::milli>(load.cost).count(),
+        duration<double, std::milli>(load.queueDelay).count(),
+        cpuNext ? "GPU" : "CPU");
+    switched = switchConversionBackend(next);
+  }
+  if (!switched) {
+    ULOGW("Preview conversion could not move to the %s", cpuNext ? "CPU" : "GPU");
+    conversionBalancer_.switchFailed(next);
+  }
+  updateHeadless();
+}
+
+void UsbVideoStreamer::restoreGpuConversion() {
+  std::unique_lock lk(frameQueueMutex_);
+  if (!windowSwapsAccepted_) {
+    lk.unlock();
+    std::unique_lock recorderLock(recorderMutex_);
+    switchConversionBackend(ConversionBackend::GPU);
+    return;
+  }
+  gpuConversionPending_ = true;
+  frameQueueChange_.notify_all();
+  gpuConversionRestored_.wait(lk, [this] { return !gpuConversionPending_; });
+}
+
+void UsbVideoStreamer::applyGpuConversion() {
+  std::unique_lock lk(frameQueueMutex_);
+  if (!gpuConversionPending_) {
+    return;
+  }
+  lk.unlock();
+  if (!gpuConversion_) {
+    std::unique_lock recorderLock(recorderMutex_);
+    if (!switchConversionBackend(ConversionBackend::GPU)) {
+      conversionBalancer_.switchFailed(ConversionBackend::GPU);
+    }
+  }
+  lk.lock();
+  gpuConversionPending_ = false;
+  gpuConversionRestored_.notify_all();
+}
+
+void UsbVideoStreamer::publishFastPaths() {
+  bool mjpeg = captureFrameFormat_ == UVC_FRAME_FORMAT_MJPEG;
+  bool inlineCallback = player_ == nullptr && !pullMode_ &&
+      (startFlags_ & UVC_STREAM_FLAG_INLINE_CALLBACK) != 0;
+  bool renderAhead = presenter_ == nullptr && !slicing_ && renderAheadEnabled_ &&
+      fastPaths_.allows(FAST_PATH_RENDER_AHEAD);
+  uint32_t paths = 0;
+  paths |= glRenderer_ != nullptr ? FAST_PATH_GPU_CONVERSION : 0;
+  paths |= vulkanConverter_ != nullptr ? FAST_PATH_VULKAN_CONVERSION : 0;
+  paths |= presenter_ != nullptr ? FAST_PATH_SURFACE_CONTROL : 0;
+  // Only the GPU backends import the slots, and not of MJPEG frames.
+  paths |= (glRenderer_ != nullptr || vulkanConverter_ != nullptr) && !mjpeg &&
+          HardwareFrameBuffers::enabled()
+      ? FAST_PATH_HARDWARE_FRAME_BUFFERS
+      : 0;
+  paths |= inlineCallback ? FAST_PATH_INLINE_CALLBACK : 0;
+  paths |= slicing_ ? FAST_PATH_SLICE_CONVERSION : 0;
+  paths |= renderAhead ? FAST_PATH_RENDER_AHEAD : 0;
+  paths |= stripeWorkers_ != nullptr ? FAST_PATH_STRIPE_CONVERSION : 0;
+  paths |= mjpegDecodePool_ != nullptr ? FAST_PATH_MJPEG_DECODE_POOL : 0;
+  paths |= mjpeg && videoDecoder_ != nullptr ? FAST_PATH_HARDWARE_MJPEG : 0;
+  paths |= mjpeg && glRenderer_ != nullptr ? FAST_PATH_GPU_MJPEG : 0;
+  paths |= mjpeg && mjpegDecodeSkipping_ && fastPaths_.allows(FAST_PATH_MJPEG_DECODE_SKIPPING)
+      ? FAST_PATH_MJPEG_DECODE_SKIPPING
+      : 0;
+  VideoRenderCounters& render = streamingStats_.videoRender;
+  if (render.fastPaths.load() != paths || render.fastPathCohort.load() != fastPaths_.cohort) {
+    ULOGI("Cohort %u running on: %s", fastPaths_.cohort, FastPaths::names(paths).c_str());
+  }
+  render.fastPaths.set(paths);
+  render.fastPathCohort.set(fastPaths_.cohort);
+}
+
+void UsbVideoStreamer::updateHeadless() {
+  std::unique_lock lk(recorderMutex_);
+  headless_ = previewWindow_ == nullptr && (glRenderer_ == nullptr || recorder_ == nullptr);
+}
+
+void UsbVideoStreamer::setNativeYuvOutput(bool nativeYuvOutput) {
+  nativeYuvOutput_ = nativeYuvOutput;
+}
+
+void UsbVideoStreamer::setSurfaceControlPresentation(bool surfaceControlPresentation) {
+  surfaceControlPresentation_ = surfaceControlPresentation;
+}
+
+bool UsbVideoStreamer::initPresenter() {
+  // The child layer is scaled by its own geometry; reset the window to its
+  // default size so that is what the preview fills.
+  ANativeWindow_setBuffersGeometry(previewWindow_, 0, 0, 0);
+  int32_t width = cpuScaling_ ? ANativeWindow_getWidth(previewWindow_) : captureFrameWidth_;
+  int32_t height = cpuScaling_ ? ANativeWindow_getHeight(previewWindow_) : captureFrameHeight_;
+  presenter_ = std::make_unique<SurfaceControlPresenter>(avSync_);
+  return presenter_->init(
+      previewWindow_, width, height, kPreviewWindowFormat, streamCtrl_.dwClockFrequency);
+}
+
+bool UsbVideoStreamer::fallBackToRgbWindow() {
+  ULOGW("YV12 preview buffers unavailable, falling back to RGB conversion");
+  setWindowGeometry(cpuWindowFormat());
+  setWindowDataSpace(ADATASPACE_UNKNOWN);
+  return frameConverter_.configure(captureFrameFormat_, ANativeWindow_getFormat(previewWindow_));
+}
+
+void UsbVideoStreamer::setCpuScaling(bool cpuScaling) {
+  cpuScaling_ = cpuScaling;
+  frameConverter_.setCpuScaling(cpuScaling);
+}
+
+int32_t UsbVideoStreamer::cpuWindowFormat() const {
+  return powerProfile_.enabled && powerProfile_.rgb565Preview
+      ? AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM
+      : kPreviewWindowFormat;
+}
+
+void UsbVideoStreamer::setWindowGeometry(int32_t format) {
+  // Buffers at the capture size leave scaling to the view to SurfaceFlinger
+  // and the HWC. With CPU scaling they keep the window's own size instead.
+  // The GL preview, which keeps the window's format, draws whole frames.
+  FrameCrop crop = format != 0 ? visibleCrop() : FrameCrop{};
+  int32_t width = cpuScaling_ ? 0 : (crop.empty() ? captureFrameWidth_ : crop.width);
+  int32_t height = cpuScaling_ ? 0 : (crop.empty() ? captureFrameHeight_ : crop.height);
+  int32_t result = ANativeWindow_setBuffersGeometry(previewWindow_, width, height, format);
+  if (result != 0) {
+    ULOGW(
+        "ANativeWindow_setBuffersGeometry %dx%d format %d error %d", width, height, format, result);
+  }
+}
+
+void UsbVideoStreamer::setTransferOptions(const uvc_stream_options_t& transferOptions) {
+  transferOptions_ = transferOptions;
+}
+
+void UsbVideoStreamer::setInlineFrameCallback(bool inlineFrameCallback) {
+  inlineFrameCallback_ = inlineFrameCallback;
+}
+
+void UsbVideoStreamer::setPullMode(bool pullMode) {
+  pullMode_ = pullMode;
+}
+
+uvc_frame_t* UsbVideoStreamer::acquireFrame(microseconds timeout) {
+  if (!pullMode_ || state_ != StreamerState::STARTED) {
+    return nullptr;
+  }
+  // libuvc waits forever for 0 and returns right away for -1.
+  int32_t timeoutUs = timeout.count() <= 0
+      ? -1
+      : (int32_t)std::min<int64_t>(timeout.count(), std::numeric_limits<int32_t>::max());
+  uvc_frame_t* frame = nullptr;
+  uvc_error_t ret = uvc_stream_acquire_frame(streamHandle_, &frame, timeoutUs);
+  if (ret != UVC_SUCCESS) {
+    return nullptr;
+  }
+  if (!firstFrameSeen_.exchange(true)) {
+    ULOGI(
+        "First pulled frame %.1f ms after start",
+        duration<double, std::milli>(steady_clock::now() - startedAt_).count());
+  }
+  lastFrameNs_.store(steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+  publishTransport(frame->sequence);
+  VideoCaptureCounters& captureCounters = streamingStats_.videoCapture;
+  captureCounters.frames.add();
+  captureCounters.bytes.add(frame->data_bytes);
+  return frame;
+}
+
+void UsbVideoStreamer::releaseFrame(uvc_frame_t* frame) {
+  if (frame != nullptr) {
+    uvc_release_frame(frame);
+  }
+}
+
+bool UsbVideoStreamer::startPulling() {
+  if (player_ != nullptr) {
+    ULOGE("Frame log replay only delivers frames to the render thread");
+    stop();
     return false;
   }
-  u_int8_t soi1 = *(u_int8_t*)frame->data;
-  u_int8_t soi2 = *((u_int8_t*)frame->data + 1);
-  // JPEG frame start of image (SOI) is 0xff 0xd8.
-  if (soi1 != 0xff || soi2 != 0xd8) {
-    ULOGE("Invalid MJPEG frame SOI. size: %zu SOI: %x%x", frame->data_bytes, soi1, soi2);
+  uvc_stream_options_t options = transferOptions_;
+  if (options.frame_pool_size == 0) {
+    options.frame_pool_size = kPullModePoolFrames;
+  }
+  uvc_error_t ret;
+  {
+    std::lock_guard lk(device_->startMutex());
+    if (device_->streamCount() > 1) {
+      options.fit_iso_bandwidth = 1;
+    }
+    ret = uvc_stream_start_with_options(
+        streamHandle_, nullptr, nullptr, UVC_STREAM_FLAG_POLLED_FRAMES, &options);
+  }
+  if (ret != UVC_SUCCESS) {
+    ULOGE("uvc_stream_start in pull mode %d", ret);
+    stop();
+    return false;
+  }
+  uvc_stream_options_t used;
+  uvc_stream_get_options(streamHandle_, &used);
+  ULOGI("Pull mode, %u frame buffers", used.frame_pool_size);
+  state_ = StreamerState::STARTED;
+  return true;
+}
+
+void UsbVideoStreamer::setMjpegDecodeSkipping(bool enabled, bool validateSkipped) {
+  mjpegDecodeSkipping_ = enabled;
+  validateSkippedJpegs_ = validateSkipped;
+}
+
+void UsbVideoStreamer::setChangeDetection(const FrameChangeDetector::Config& config) {
+  changeDetector_.setConfig(config);
+}
+
+void UsbVideoStreamer::setMjpegDecodeWorkers(uint32_t workers) {
+  mjpegDecodeWorkers_ = workers;
+}
+
+void UsbVideoStreamer::setHardwareMjpegDecoding(bool hardwareMjpegDecoding) {
+  hardwareMjpegDecoding_ = hardwareMjpegDecoding;
+}
+
+void UsbVideoStreamer::setGpuMjpegDecoding(bool gpuMjpegDecoding) {
+  gpuMjpegDecoding_ = gpuMjpegDecoding;
+}
+
+void UsbVideoStreamer::setVulkanConversion(bool vulkanConversion) {
+  vulkanConversion_ = vulkanConversion;
+}
+
+void UsbVideoStreamer::setDeinterlace(DeinterlaceMode mode, bool forced) {
+  deinterlaceMode_ = mode;
+  deinterlaceForced_ = forced;
+}
+
+void UsbVideoStreamer::setLensCorrection(const LensCalibration& lens) {
+  lens_ = lens;
+}
+
+void UsbVideoStreamer::setOverlay(const OverlayConfig& config) {
+  overlayConfig_ = config;
+}
+
+void UsbVideoStreamer::setLumaStats(bool enabled) {
+  frameConverter_.setLumaStats(enabled);
+  if (!enabled) {
+    std::unique_lock lk(lumaStatsMutex_);
+    hasLuma_ = false;
+  }
+}
+
+bool UsbVideoStreamer::latestLumaStats(LumaStats& stats) {
+  std::unique_lock lk(lumaStatsMutex_);
+  stats = latestLuma_;
+  return hasLuma_;
+}
+
+bool UsbVideoStreamer::addSecondaryPreview(ANativeWindow* window, int32_t maxFps) {
+  return secondaryPreviews_.add(window, maxFps);
+}
+
+bool UsbVideoStreamer::removeSecondaryPreview(ANativeWindow* window) {
+  return secondaryPreviews_.remove(window);
+}
+
+void UsbVideoStreamer::setHdrDataSpace(int32_t dataSpace) {
+  hdrDataSpace_ = dataSpace;
+}
+
+void UsbVideoStreamer::setSliceConversion(bool sliceConversion) {
+  sliceConversion_ = sliceConversion;
+}
+
+void UsbVideoStreamer::setRenderAhead(bool renderAhead) {
+  renderAheadEnabled_ = renderAhead;
+}
+
+void UsbVideoStreamer::setSmoothPlayback(bool smoothPlayback) {
+  smoothPlayback_ = smoothPlayback;
+}
+
+void UsbVideoStreamer::setSlowFrameBudget(float frameIntervals) {
+  slowFrames_.setBudgetMultiple(frameIntervals);
+}
+
+void UsbVideoStreamer::setCrop(const FrameCrop& crop) {
+  crop_ = crop;
+  changeDetector_.invalidate();
+}
+
+void UsbVideoStreamer::setWhiteBalance(const WhiteBalance& whiteBalance) {
+  whiteBalance_ = whiteBalance;
+  changeDetector_.invalidate();
+}
+
+void UsbVideoStreamer::setDepthRange(const DepthRange& range) {
+  depthRange_ = range;
+  changeDetector_.invalidate();
+}
+
+// The compositor mirrors before it rotates, so after a quarter turn a
+// horizontal mirror of the picture is a vertical one of the buffer.
+static int32_t windowTransform(int32_t rotation, bool mirrorHorizontal, bool mirrorVertical) {
+  int32_t transform = ANATIVEWINDOW_TRANSFORM_IDENTITY;
+  switch (rotation) {
+    case 0:
+      break;
+    case 90:
+      transform = ANATIVEWINDOW_TRANSFORM_ROTATE_90;
+      break;
+    case 180:
+      transform = ANATIVEWINDOW_TRANSFORM_ROTATE_180;
+      break;
+    case 270:
+      transform = ANATIVEWINDOW_TRANSFORM_ROTATE_270;
+      break;
+    default:
+      return -1;
+  }
+  bool quarterTurn = rotation == 90 || rotation == 270;
+  if (mirrorHorizontal) {
+    transform ^= quarterTurn ? ANATIVEWINDOW_TRANSFORM_MIRROR_VERTICAL
+                             : ANATIVEWINDOW_TRANSFORM_MIRROR_HORIZONTAL;
+  }
+  if (mirrorVertical) {
+    transform ^= quarterTurn ? ANATIVEWINDOW_TRANSFORM_MIRROR_HORIZONTAL
+                             : ANATIVEWINDOW_TRANSFORM_MIRROR_VERTICAL;
+  }
+  return transform;
+}
+
+bool UsbVideoStreamer::setOrientation(
+    int32_t rotation,
+    bool mirrorHorizontal,
+    bool mirrorVertical) {
+  int32_t transform = windowTransform(rotation, mirrorHorizontal, mirrorVertical);
+  if (transform < 0) {
+    ULOGE("Unsupported rotation %d", rotation);
+    return false;
+  }
+  transform_ = transform;
+  applyTransform();
+  changeDetector_.invalidate();
+  return true;
+}
+
+// The SurfaceControl presenter takes it with each frame instead.
+void UsbVideoStreamer::applyTransform() {
+  int32_t transform = transform_;
+  if (previewWindow_ == nullptr) {
+    return;
+  }
+  int32_t result = ANativeWindow_setBuffersTransform(previewWindow_, transform);
+  if (result != 0) {
+    ULOGW("Could not set the preview transform to %d: %d", transform, result);
+  }
+}
+
+void UsbVideoStreamer::applyFrameRate() {
+  if (previewWindow_ == nullptr) {
+    return;
+  }
+  // Fractional rates such as 29.97 fps come from the exact frame interval.
+  float fps = streamCtrl_.dwFrameInterval != 0 ? 1e7f / streamCtrl_.dwFrameInterval
+                                               : (float)captureFrameFps_;
+  fps /= std::max<uint32_t>(decimation_, 1);
+  if (fps <= 0) {
+    return;
+  }
+  // Presented buffers go to the child layer, not the window.
+  if (presenter_ != nullptr) {
+    presenter_->setFrameRate(fps);
+  } else {
+    int32_t result = ANativeWindow_setFrameRate(
+        previewWindow_, fps, ANATIVEWINDOW_FRAME_RATE_COMPATIBILITY_FIXED_SOURCE);
+    if (result != 0) {
+      ULOGW("Could not set the preview frame rate to %.2f fps: %d", fps, result);
+      return;
+    }
+  }
+  ULOGI("Preview frame rate %.2f fps", fps);
+}
+
+bool UsbVideoStreamer::setWindowDataSpace(int32_t dataSpace) {
+  if (dataSpace == windowDataSpace_) {
+    return true;
+  }
+  int32_t result = ANativeWindow_setBuffersDataSpace(previewWindow_, dataSpace);
+  if (result != 0) {
+    ULOGW("Could not set the preview data space to 0x%x: %d", dataSpace, result);
+    return false;
+  }
+  windowDataSpace_ = dataSpace;
+  return true;
+}
+
+int32_t UsbVideoStreamer::yuvDataSpace(const Colorimetry& colorimetry) {
+  // The NDK only names limited range BT.709 and full range BT.2020. YV12
+  // comes from limited range UVC formats and never from P010, the only
+  // BT.2020 source, so they are enough.
+  switch (colorimetry.matrix) {
+    case Colorimetry::Matrix::BT709:
+      return ADATASPACE_BT709;
+    case Colorimetry::Matrix::BT2020:
+      return ADATASPACE_BT2020;
+    case Colorimetry::Matrix::BT601:
+      break;
+  }
+  return colorimetry.fullRange ? ADATASPACE_JFIF : ADATASPACE_BT601_525;
+}
+
+bool UsbVideoStreamer::reattach(std::shared_ptr<UvcDevice> device) {
+  if (streamHandle_ == nullptr || player_ != nullptr || device == nullptr) {
+    return false;
+  }
+  if (NegotiationCache::deviceKey(device->handle()) != negotiationKey_) {
+    ULOGE("Cannot reattach the stream to another camera");
+    return false;
+  }
+  steady_clock::time_point startedAt = steady_clock::now();
+  bool wasRunning = isRunning() || state_ == StreamerState::STARTING;
+  // Nothing is left in flight on a lost device, so this does not wait.
+  stop();
+  // Sends its requests on the old handle.
+  disableStillCapture();
+
+  // Closing sets the interface back to its zero bandwidth altsetting.
+  uvc_stream_close(streamHandle_);
+  BusBandwidthPlanner::shared().release(this);
+  streamHandle_ = nullptr;
+  device_->removeStream();
+  device_ = std::move(device);
+  deviceHandle_ = device_->handle();
+  // The camera starts over, so the committed control block is the cached one.
+  uvc_error_t ret = openStream();
+  if (ret != UVC_SUCCESS) {
+    ULOGE("Cannot reopen the stream on the reattached camera: %s", uvc_strerror(ret));
+    state_ = StreamerState::ERROR;
+    return false;
+  }
+  state_ = StreamerState::READY_TO_START;
+  bool started = !wasRunning || start();
+  ULOGI(
+      "Reattached the stream in %.1f ms",
+      duration<double, std::milli>(steady_clock::now() - startedAt).count());
+  return started;
+}
+
+FrameCrop UsbVideoStreamer::visibleCrop() const {
+  return crop_.load().within(captureFrameWidth_, captureFrameHeight_, 2);
+}
+
+bool UsbVideoStreamer::canSlice() const {
+  // The progress of frames comes from libuvc, and only the CPU window path
+  // converts them.
+  bool compressed =
+      captureFrameFormat_ == UVC_FRAME_FORMAT_MJPEG || isFrameBased(captureFrameFormat_);
+  return sliceConversion_ && fastPaths_.allows(FAST_PATH_SLICE_CONVERSION) && !pacing_ &&
+      player_ == nullptr && !powerProfile_.enabled && !compressed &&
+      previewWindow_ != nullptr && glRenderer_ == nullptr && vulkanConverter_ == nullptr &&
+      videoDecoder_ == nullptr && mjpegDecodePool_ == nullptr;
+}
+
+bool UsbVideoStreamer::start() {
+  if (streamHandle_ == nullptr) {
+    return false;
+  }
+  // A restart right after requestStop() waits for the cancellations here.
+  if (!finishStop()) {
+    return false;
+  }
+  state_ = StreamerState::STARTING;
+  latencyStats_.reset();
+  slowFrames_.reset();
+  startedAt_ = steady_clock::now();
+  firstFrameSeen_ = false;
+  firstFrameShown_ = false;
+  publishedTransport_ = {};
+  lastCaptureSequence_ = 0;
+  mjpegEoiSeen_ = false;
+  if (pullMode_) {
+    publishFastPaths();
+    return startPulling();
+  }
+  pacing_ = smoothPlayback_;
+  jitterBuffer_.reset(frameIntervalNs());
+  conversionBalancer_.reset();
+  slicing_ = canSlice();
+  slice_ = {};
+  frameRateApplied_ = false;
+  if (!rendering_.exchange(true)) {
+    {
+      std::unique_lock lk(frameQueueMutex_);
+      windowSwapsAccepted_ = true;
+    }
+    renderThread_ = std::thread(&UsbVideoStreamer::renderLoop, this);
+  }
+  if (player_ != nullptr) {
+    isCaptureThreadNamed_ = true;
+    if (!player_->start(captureFrameCallback, this, replayOptions_)) {
+      stop();
+      return false;
+    }
+    publishFastPaths();
+    state_ = StreamerState::STARTED;
+    return true;
+  }
+  // Frames are lent out of libuvc's pool instead of being copied into the stream's frame.
+  uvc_stream_options_t options = transferOptions_;
+  if (options.frame_pool_size == 0) {
+    // Besides the queued frames: the one being filled, one waiting for the
+    // callback, the one being rendered, the last good one and one held by the
+    // tap or recorder.
+    options.frame_pool_size = frameQueue_.capacity() + kPoolFramesBesidesQueue;
+    if (mjpegDecodePool_ != nullptr) {
+      options.frame_pool_size += mjpegDecodePool_->workerCount();
+    }
+    if (pacing_) {
+      options.frame_pool_size += JitterBuffer::kCapacity;
+    }
+    if (fastPaths_.allows(FAST_PATH_GPU_CONVERSION) &&
+        captureFrameFormat_ != UVC_FRAME_FORMAT_MJPEG &&
+        GlPreviewRenderer::supportsFormat(captureFrameFormat_) &&
+        HardwareFrameBuffers::enabled()) {
+      // Drawn from their slots and held until the GPU is done with them.
+      options.frame_pool_size += GlPreviewRenderer::kHeldFrameCount;
+    } else if (vulkanConverter_ != nullptr && HardwareFrameBuffers::enabled()) {
+      options.frame_pool_size += VulkanConverter::kHeldFrameCount;
+    }
+  }
+  if (slicing_) {
+    options.progress_bytes = std::max<uint32_t>(streamCtrl_.dwMaxVideoFrameSize / kSliceBands, 1);
+  }
+  uint8_t flags = UVC_STREAM_FLAG_BORROWED_FRAMES;
+  decimation_ = 1;
+  decimationCount_ = 0;
+  if (powerProfile_.enabled) {
+    // Fewer completions to wake up for, the smallest altsetting the format
+    // fits and no callback thread.
+    if (options.transfer_duration_us == 0) {
+      options.transfer_duration_us = kPowerProfileTransferUs;
+    }
+    options.fit_iso_bandwidth = 1;
+    if (powerProfile_.targetFps > 0 && captureFrameFps_ > powerProfile_.targetFps) {
+      decimation_ = captureFrameFps_ / powerProfile_.targetFps;
+    }
+  }
+  if (fps_ > 0 && captureFrameFps_ / fps_ > (int32_t)decimation_) {
+    // A rate below the camera's slowest, such as a time-lapse's: libuvc
+    // negotiated the slowest, and the rest are dropped before queueing.
+    decimation_ = captureFrameFps_ / fps_;
+  }
+  if (((inlineFrameCallback_ && fastPaths_.allows(FAST_PATH_INLINE_CALLBACK)) ||
+       powerProfile_.enabled) &&
+      frameDropPolicy_ != FrameDropPolicy::BLOCK) {
+    // The callback only enqueues and returns, so it can run on the event thread.
+    flags |= UVC_STREAM_FLAG_INLINE_CALLBACK;
+  }
+  // The shared USB event thread keeps its own name.
+  isCaptureThreadNamed_ = (flags & UVC_STREAM_FLAG_INLINE_CALLBACK) != 0;
+  {
+    std::unique_ptr<UvcEncoderControl> encoder =
+        isFrameBased(captureFrameFormat_) ? UvcEncoderControl::find(device_) : nullptr;
+    if (encoder != nullptr) {
+      encoder->apply(defaultEncoderSettings_.load());
+    }
+    std::lock_guard lk(encoderMutex_);
+    encoder_ = std::move(encoder);
+  }
+  startOptions_ = options;
+  startFlags_ = flags;
+  uint64_t cameraReserved;
+  uvc_error_t ret = startTransfers(cameraReserved);
+  ULOGE("uvc_stream_start %d", ret);
+  if (ret != UVC_SUCCESS) {
+    stop();
+    return false;
+  }
+  // Decoders and receivers can start at once instead of at the camera's
+  // next periodic keyframe.
+  requestKeyframe("stream start");
+  uvc_stream_options_t used;
+  uvc_stream_get_options(streamHandle_, &used);
+  if (used.bulk_transfer_size != 0) {
+    ULOGI(
+        "%u bulk transfers of %u bytes, timeout %u ms",
+        used.num_transfers,
+        used.bulk_transfer_size,
+        used.transfer_timeout_ms);
+  } else {
+    ULOGI(
+        "%u iso transfers of %u packets, timeout %u ms",
+        used.num_transfers,
+        used.packets_per_transfer,
+        used.transfer_timeout_ms);
+  }
+  if (decimation_ > 1) {
+    ULOGI("Rendering one in %u frames of %d fps", decimation_, captureFrameFps_);
+  }
+  if (slicing_) {
+    ULOGI("Converting frames in bands of %u bytes as they arrive", used.progress_bytes);
+  }
+  uvc_stream_bandwidth_t bandwidth;
+  uvc_stream_get_bandwidth(streamHandle_, &bandwidth);
+  BusBandwidthPlanner::Bus bus = device_->bus();
+  UsbTransportCounters& transport = streamingStats_.transport.video;
+  transport.reservedBytesPerPacket.set(bandwidth.reserved_bytes);
+  transport.packetIntervalUs.set(bandwidth.interval_us);
+  if (bandwidth.interval_us != 0) {
+    uint64_t reserved = (uint64_t)bandwidth.reserved_bytes * 1'000'000 / bandwidth.interval_us;
+    uint64_t needed = (uint64_t)bandwidth.needed_bytes * 1'000'000 / bandwidth.interval_us;
+    VideoCaptureCounters& captureCounters = streamingStats_.videoCapture;
+    captureCounters.isoReservedBytesPerSecond.set(reserved);
+    captureCounters.isoNeededBytesPerSecond.set(needed);
+    ULOGI(
+        "Altsetting %u reserves %.1f MB/s, the format needs %.1f MB/s",
+        bandwidth.altsetting,
+        reserved / 1e6,
+        needed / 1e6);
+    if (device_->streamCount() > 1 && bus.budget != 0) {
+      ULOGI(
+          "Streams of the camera reserve %.1f of the bus's %.1f MB/s",
+          cameraReserved / 1e6,
+          bus.budget / 1e6);
+    }
+  }
+  ULOGI(
+      "%u frame buffers, callback on the %s thread",
+      used.frame_pool_size,
+      (flags & UVC_STREAM_FLAG_INLINE_CALLBACK) ? "USB event" : "libuvc");
+  publishFastPaths();
+  state_ = StreamerState::STARTED;
+  StreamWatchdog::shared().watch(this, [this](steady_clock::time_point now) { checkStall(now); });
+  return true;
+}
+
+void UsbVideoStreamer::checkStall(steady_clock::time_point now) {
+  if (state_ != StreamerState::STARTED || isDeviceLost()) {
+    return;
+  }
+  WatchdogCounters& counters = streamingStats_.watchdog.video;
+  counters.transfersInFlight.set(uvc_stream_transfers_in_flight(streamHandle_));
+  int rearmed = uvc_stream_rearm_transfers(streamHandle_);
+  if (rearmed > 0) {
+    ULOGW("Submitted %d failed transfers again", rearmed);
+    counters.transfersRearmed.addShared(rearmed);
+  }
+  bool framesSeen = firstFrameSeen_.load();
+  steady_clock::time_point lastFrame{nanoseconds(lastFrameNs_.load(std::memory_order_relaxed))};
+  nanoseconds stalled = now - std::max(startedAt_, lastFrame);
+  nanoseconds timeout = kFirstFrameTimeout;
+  if (framesSeen) {
+    stallRestarts_ = 0;
+    timeout = std::max(kStallTimeout, nanoseconds(kStallFrameIntervals * frameIntervalNs()));
+    uint64_t stalledUs = duration_cast<microseconds>(stalled).count();
+    if (stalledUs > counters.longestStallUs.load()) {
+      counters.longestStallUs.set(stalledUs);
+    }
+  }
+  if (stalled < timeout || stallRestarts_ >= kMaxStallRestarts) {
+    return;
+  }
+  counters.stalls.add();
+  stallRestarts_++;
+  ULOGW(
+      "No frame for %.1f ms, restarting the stream (%u of %u)",
+      duration<double, std::milli>(stalled).count(),
+      stallRestarts_,
+      kMaxStallRestarts);
+  // requestStop() drops this check, and start() adds it back.
+  counters.restarts.add();
+  if (!stop() || !start()) {
+    ULOGE("Restarting the stalled stream failed");
+    counters.failedRestarts.add();
+  }
+}
+
+bool UsbVideoStreamer::requestStop() {
+  // Waits for a stall check in progress, unless this is one.
+  StreamWatchdog::shared().unwatch(this);
+  StreamerState state = state_;
+  if (state != StreamerState::STARTED && state != StreamerState::STARTING) {
+    return false;
+  }
+  state_ = StreamerState::STOPPING;
+  if (player_ != nullptr) {
+    player_->requestStop();
+  } else if (!transfersPaused_) {
+    uvc_stream_stop_async(streamHandle_);
+  }
+  // The render thread exits after its current frame; finishStop() joins it.
+  if (rendering_.exchange(false)) {
+    std::unique_lock lk(frameQueueMutex_);
+    frameQueueChange_.notify_all();
+  }
+  return true;
+}
+
+bool UsbVideoStreamer::finishStop() {
+  if (state_ != StreamerState::STOPPING) {
+    return state_ != StreamerState::ERROR;
+  }
+  // Stopping libuvc, or the player, joins the capture thread, so nothing is
+  // enqueued after this.
+  bool stopped = player_ != nullptr
+      ? player_->stop()
+      : transfersPaused_ || uvc_stream_stop(streamHandle_) == UVC_SUCCESS;
+  transfersPaused_ = false;
+  // The camera took the cached control block but sent nothing with it.
+  if (stopped && cachedNegotiation_ && !firstFrameSeen_ &&
+      steady_clock::now() - startedAt_ >= kFirstFrameTimeout) {
+    ULOGW("No frame with the cached stream control");
+    NegotiationCache::shared().evict(negotiationKey_, negotiationMode_);
+    cachedNegotiation_ = false;
+  }
+  if (renderThread_.joinable()) {
+    renderThread_.join();
+  }
+  captureHint_.close();
+  captureHintOpened_ = false;
+  drainFrameQueue();
+  if (frameSynchronizer_ != nullptr) {
+    frameSynchronizer_->flush(frameSynchronizerStream_);
+  }
+  state_ = StreamerState::READY_TO_START;
+  return stopped;
+}
+
+uvc_error_t UsbVideoStreamer::startTransfers(uint64_t& cameraReserved) {
+  BusBandwidthPlanner& planner = BusBandwidthPlanner::shared();
+  BusBandwidthPlanner::Bus bus = device_->bus();
+  // Other streams of the camera, and of other devices on the bus, pick
+  // their altsetting one after the other, each leaving the bandwidth it
+  // does not need to the next.
+  std::lock_guard busLock(planner.startMutex());
+  std::lock_guard lk(device_->startMutex());
+  uvc_stream_options_t options = startOptions_;
+  if (device_->streamCount() > 1 || planner.others(bus, this) > 0) {
+    options.fit_iso_bandwidth = 1;
+  }
+  uvc_error_t ret = uvc_stream_start_with_options(
+      streamHandle_, captureFrameCallback, this, startFlags_, &options);
+  cameraReserved = device_->reservedIsoBandwidth();
+  uvc_stream_bandwidth_t bandwidth{};
+  if (ret == UVC_SUCCESS) {
+    uvc_stream_get_bandwidth(streamHandle_, &bandwidth);
+  }
+  if (bandwidth.interval_us != 0) {
+    planner.reserve(
+        this,
+        device_.get(),
+        bus,
+        (uint64_t)bandwidth.reserved_bytes * 1'000'000 / bandwidth.interval_us);
+  }
+  return ret;
+}
+
+bool UsbVideoStreamer::pause() {
+  if (state_ != StreamerState::STARTED || player_ != nullptr || pullMode_ || transfersPaused_) {
+    return false;
+  }
+  steady_clock::time_point pausedAt = steady_clock::now();
+  StreamWatchdog::shared().unwatch(this);
+  // Frees the transfers but keeps their buffers as spares, and the frame
+  // pool; the render thread idles on the empty queue with its GL context.
+  uvc_stream_stop(streamHandle_);
+  transfersPaused_ = true;
+  drainFrameQueue();
+  if (frameSynchronizer_ != nullptr) {
+    frameSynchronizer_->flush(frameSynchronizerStream_);
+  }
+  uvc_stream_bandwidth_t bandwidth;
+  uvc_stream_get_bandwidth(streamHandle_, &bandwidth);
+  if (bandwidth.interval_us != 0) {
+    // Altsetting 0 gives the bus its bandwidth back and lets the camera idle.
+    BusBandwidthPlanner& planner = BusBandwidthPlanner::shared();
+    std::lock_guard busLock(planner.startMutex());
+    std::lock_guard lk(device_->startMutex());
+    int status = libusb_set_interface_alt_setting(
+        uvc_get_libusb_handle(deviceHandle_), streamCtrl_.bInterfaceNumber, 0);
+    if (status != LIBUSB_SUCCESS) {
+      ULOGW("Cannot set altsetting 0 while paused: %s", libusb_error_name(status));
+    }
+    planner.release(this);
+  }
+  ULOGI(
+      "Paused in %.2f ms",
+      duration_cast<microseconds>(steady_clock::now() - pausedAt).count() / 1e3);
+  return true;
+}
+
+bool UsbVideoStreamer::resume() {
+  if (!transfersPaused_) {
+    return start();
+  }
+  if (state_ != StreamerState::STARTED) {
+    return false;
+  }
+  steady_clock::time_point resumedAt = steady_clock::now();
+  startedAt_ = resumedAt;
+  publishedTransport_ = {};
+  lastCaptureSequence_ = 0;
+  slice_ = {};
+  uint64_t cameraReserved;
+  uvc_error_t ret = startTransfers(cameraReserved);
+  if (ret != UVC_SUCCESS) {
+    ULOGE("Cannot resume: %s", uvc_strerror(ret));
+    stop();
+    return false;
+  }
+  transfersPaused_ = false;
+  requestKeyframe("stream resume");
+  StreamWatchdog::shared().watch(this, [this](steady_clock::time_point now) { checkStall(now); });
+  ULOGI(
+      "Resumed in %.2f ms",
+      duration_cast<microseconds>(steady_clock::now() - resumedAt).count() / 1e3);
+  return true;
+}
+
+bool UsbVideoStreamer::stop() {
+  if (streamHandle_ == nullptr) {
+    return false;
+  }
+  requestStop();
+  return finishStop();
+}
+
+StreamerState UsbVideoStreamer::state() const {
+  return state_;
+}
+
+bool UsbVideoStreamer::isRunning() const {
+  return rendering_;
+}
+
+bool UsbVideoStreamer::attachRecorder(StreamRecorder* recorder) {
+  if (!gpuConversion_) {
+    restoreGpuConversion();
+  }
+  {
+    std::unique_lock lk(recorderMutex_);
+    if (glRenderer_ == nullptr) {
+      ULOGE("Recording needs the GL preview, unavailable for format %d", captureFrameFormat_);
+      return false;
+    }
+    recorder_ = recorder;
+  }
+  updateHeadless();
+  return true;
+}
+
+void UsbVideoStreamer::detachRecorder() {
+  {
+    std::unique_lock lk(recorderMutex_);
+    recorder_ = nullptr;
+  }
+  updateHeadless();
+}
+
+bool UsbVideoStreamer::startMjpegRecording(int fd) {
+  if (captureFrameFormat_ != UVC_FRAME_FORMAT_MJPEG) {
+    ULOGE("Raw recording needs an MJPEG stream, not format %d", captureFrameFormat_);
+    return false;
+  }
+  auto recorder = std::make_unique<MjpegRecorder>();
+  if (!recorder->start(
+          fd,
+          captureFrameWidth_,
+          captureFrameHeight_,
+          streamCtrl_.dwFrameInterval,
+          streamCtrl_.dwClockFrequency)) {
+    return false;
+  }
+  std::unique_lock lk(mjpegRecorderMutex_);
+  if (mjpegRecorder_ != nullptr) {
+    return false;
+  }
+  mjpegRecorder_ = std::move(recorder);
+  return true;
+}
+
+bool UsbVideoStreamer::setNetworkSink(std::shared_ptr<RtpSender> sink) {
+  if (sink != nullptr && captureFrameFormat_ != UVC_FRAME_FORMAT_H264 &&
+      captureFrameFormat_ != UVC_FRAME_FORMAT_H265) {
+    ULOGE("Network passthrough needs an H.264 or H.265 stream, not format %d", captureFrameFormat_);
+    return false;
+  }
+  std::unique_lock lk(networkSinkMutex_);
+  networkSink_ = std::move(sink);
+  return true;
+}
+
+bool UsbVideoStreamer::requestKeyframe(const char* reason) {
+  std::lock_guard lk(encoderMutex_);
+  return encoder_ != nullptr && encoder_->requestKeyframe(reason);
+}
+
+bool UsbVideoStreamer::stopMjpegRecording() {
+  std::unique_ptr<MjpegRecorder> recorder;
+  {
+    std::unique_lock lk(mjpegRecorderMutex_);
+    recorder = std::move(mjpegRecorder_);
+  }
+  return recorder != nullptr && recorder->stop();
+}
+
+bool UsbVideoStreamer::startFrameLog(int fd) {
+  FrameLogHeader header{
+      .frameFormat = (uint32_t)captureFrameFormat_,
+      .width = (uint32_t)captureFrameWidth_,
+      .height = (uint32_t)captureFrameHeight_,
+      .frameInterval = streamCtrl_.dwFrameInterval,
+      .clockFrequency = streamCtrl_.dwClockFrequency,
+      .maxFrameSize = streamCtrl_.dwMaxVideoFrameSize,
+  };
+  auto recorder = std::make_unique<FrameLogRecorder>();
+  if (!recorder->start(fd, header)) {
+    return false;
+  }
+  std::unique_lock lk(frameLogRecorderMutex_);
+  if (frameLogRecorder_ != nullptr) {
+    return false;
+  }
+  frameLogRecorder_ = std::move(recorder);
+  return true;
+}
+
+bool UsbVideoStreamer::stopFrameLog() {
+  std::unique_ptr<FrameLogRecorder> recorder;
+  {
+    std::unique_lock lk(frameLogRecorderMutex_);
+    recorder = std::move(frameLogRecorder_);
+  }
+  return recorder != nullptr && recorder->stop();
+}
+
+bool UsbVideoStreamer::setInstantReplay(std::shared_ptr<InstantReplay> replay) {
+  if (replay != nullptr && captureFrameFormat_ != UVC_FRAME_FORMAT_MJPEG &&
+      captureFrameFormat_ != UVC_FRAME_FORMAT_H264 &&
+      captureFrameFormat_ != UVC_FRAME_FORMAT_H265) {
+    ULOGE(
+        "Instant replay needs an MJPEG, H.264 or H.265 stream, not format %d",
+        captureFrameFormat_);
+    return false;
+  }
+  bool attached = replay != nullptr;
+  {
+    std::unique_lock lk(instantReplayMutex_);
+    instantReplay_ = std::move(replay);
+  }
+  if (attached && captureFrameFormat_ != UVC_FRAME_FORMAT_MJPEG) {
+    // The window is saved from its first keyframe.
+    requestKeyframe("instant replay");
+  }
+  return true;
+}
+
+void UsbVideoStreamer::setMotionDetector(std::shared_ptr<MotionDetector> detector) {
+  std::unique_lock lk(motionDetectorMutex_);
+  motionDetector_ = std::move(detector);
+}
+
+bool UsbVideoStreamer::standbyMode(int32_t minFps, NegotiationCache::Mode& mode) const {
+  ModeSelector::Candidate cheap{};
+  if (device_ == nullptr ||
+      !ModeSelector::cheapest(*device_, streamCtrl_.bInterfaceNumber, minFps, cheap)) {
+    return false;
+  }
+  int slowest = uvc_get_slowest_frame_rate(
+      deviceHandle_, streamCtrl_.bInterfaceNumber, cheap.format, cheap.width, cheap.height, minFps);
+  mode = {
+      streamCtrl_.bInterfaceNumber,
+      cheap.format,
+      cheap.width,
+      cheap.height,
+      slowest > 0 ? slowest : cheap.fps};
+  return true;
+}
+
+bool UsbVideoStreamer::startFrameTap(const FrameTap::Config& config) {
+  auto tap = std::make_unique<FrameTap>(fanout_);
+  if (!tap->start(
+          config,
+          captureFrameWidth_,
+          captureFrameHeight_,
+          captureFrameFormat_,
+          streamCtrl_.dwMaxVideoFrameSize)) {
+    return false;
+  }
+  std::unique_lock lk(frameTapMutex_);
+  if (frameTap_ != nullptr) {
+    return false;
+  }
+  frameTap_ = std::move(tap);
+  return true;
+}
+
+void UsbVideoStreamer::stopFrameTap() {
+  std::unique_ptr<FrameTap> tap;
+  {
+    std::unique_lock lk(frameTapMutex_);
+    tap = std::move(frameTap_);
+  }
+  if (tap != nullptr) {
+    tap->stop();
+  }
+}
+
+bool UsbVideoStreamer::startFrameServer(const FrameServer::Config& config, const char* name) {
+  auto server = std::make_unique<FrameServer>(fanout_);
+  if (!server->start(config, name, captureFrameWidth_, captureFrameHeight_, captureFrameFormat_)) {
+    return false;
+  }
+  std::unique_lock lk(frameServerMutex_);
+  if (frameServer_ != nullptr) {
+    return false;
+  }
+  frameServer_ = std::move(server);
+  return true;
+}
+
+void UsbVideoStreamer::stopFrameServer() {
+  std::unique_ptr<FrameServer> server;
+  {
+    std::unique_lock lk(frameServerMutex_);
+    server = std::move(frameServer_);
+  }
+  if (server != nullptr) {
+    server->stop();
+  }
+}
+
+size_t UsbVideoStreamer::frameTapBuffers(std::vector<uint8_t*>& buffers) {
+  std::unique_lock lk(frameTapMutex_);
+  buffers.clear();
+  if (frameTap_ == nullptr) {
+    return 0;
+  }
+  for (size_t i = 0; i < frameTap_->bufferCount(); i++) {
+    if (frameTap_->bufferData(i) == nullptr) {
+      buffers.clear();
+      return 0;
+    }
+    buffers.push_back(frameTap_->bufferData(i));
+  }
+  return frameTap_->bufferCapacity();
+}
+
+size_t UsbVideoStreamer::frameTapHardwareBuffers(std::vector<AHardwareBuffer*>& buffers) {
+  std::unique_lock lk(frameTapMutex_);
+  buffers.clear();
+  if (frameTap_ == nullptr) {
+    return 0;
+  }
+  for (size_t i = 0; i < frameTap_->bufferCount(); i++) {
+    if (frameTap_->hardwareBuffer(i) == nullptr) {
+      buffers.clear();
+      return 0;
+    }
+    buffers.push_back(frameTap_->hardwareBuffer(i));
+  }
+  return frameTap_->bufferCapacity();
+}
+
+int32_t UsbVideoStreamer::acquireTappedFrame(FrameTap::FrameInfo& info) {
+  std::unique_lock lk(frameTapMutex_);
+  return frameTap_ != nullptr ? frameTap_->acquire(info) : -1;
+}
+
+void UsbVideoStreamer::releaseTappedFrame(int32_t index) {
+  std::unique_lock lk(frameTapMutex_);
+  if (frameTap_ != nullptr) {
+    frameTap_->release(index);
+  }
+}
+
+bool UsbVideoStreamer::enableStillCapture(int32_t width, int32_t height) {
+  if (streamHandle_ == nullptr || device_ == nullptr) {
+    return false;
+  }
+  // Method 2 stills come through the stream's own frame buffers.
+  bool restart = isRunning() &&
+      StillCapture::needsStoppedStream(deviceHandle_, streamCtrl_.bInterfaceNumber);
+  if (restart) {
+    stop();
+  }
+  disableStillCapture();
+  auto stillCapture = std::make_unique<StillCapture>(device_, streamHandle_);
+  bool configured = stillCapture->configure(streamCtrl_, width, height);
+  if (configured) {
+    std::unique_lock lk(stillCaptureMutex_);
+    stillCapture_ = std::move(stillCapture);
+  }
+  if (restart && !start()) {
+    return false;
+  }
+  return configured;
+}
+
+void UsbVideoStreamer::disableStillCapture() {
+  std::unique_ptr<StillCapture> stillCapture;
+  {
+    std::unique_lock lk(stillCaptureMutex_);
+    stillCapture = std::move(stillCapture_);
+  }
+}
+
+bool UsbVideoStreamer::requestSnapshot(
+    JNIEnv* env,
+    jobject bitmap,
+    BitmapSnapshot::Callback done) {
+  if (streamHandle_ == nullptr) {
+    return false;
+  }
+  return snapshot_.request(env, bitmap, captureFrameFormat_, std::move(done));
+}
+
+bool UsbVideoStreamer::requestJpegSnapshot(
+    int32_t width,
+    int32_t height,
+    int32_t quality,
+    JpegSnapshot::Callback done) {
+  if (streamHandle_ == nullptr) {
+    return false;
+  }
+  return jpegSnapshot_.request(captureFrameFormat_, width, height, quality, std::move(done));
+}
+
+bool UsbVideoStreamer::captureStill(StillCapture::Callback done) {
+  std::unique_lock lk(stillCaptureMutex_);
+  if (stillCapture_ == nullptr || !isRunning()) {
+    return false;
+  }
+  return stillCapture_->capture(std::move(done));
+}
+
+static std::string fourccFormatFromUvcFrameFormat(uvc_frame_format frameFormat) {
+  switch (frameFormat) {
+    case UVC_FRAME_FORMAT_YUYV:
+      return "YUYV";
+    case UVC_FRAME_FORMAT_UYVY:
+      return "UYVY";
+    case UVC_FRAME_FORMAT_MJPEG:
+      return "MJPG";
+    case UVC_FRAME_FORMAT_H264:
+      return "H264";
+    case UVC_FRAME_FORMAT_H265:
+      return "H265";
+    case UVC_FRAME_FORMAT_VP8:
+      return "VP80";
+    case UVC_FRAME_FORMAT_VP9:
+      return "VP90";
+    case UVC_FRAME_FORMAT_NV12:
+      return "NV12";
+    case UVC_FRAME_FORMAT_GRAY16:
+      return "Y16 ";
+    case UVC_FRAME_FORMAT_BY8:
+      return "BY8 ";
+    case UVC_FRAME_FORMAT_BA81:
+      return "BA81";
+    case UVC_FRAME_FORMAT_SGRBG8:
+      return "GRBG";
+    case UVC_FRAME_FORMAT_SGBRG8:
+      return "GBRG";
+    case UVC_FRAME_FORMAT_SRGGB8:
+      return "RGGB";
+    case UVC_FRAME_FORMAT_SBGGR8:
+      return "BGGR";
+    case UVC_FRAME_FORMAT_SGRBG10:
+      return "BA10";
+    case UVC_FRAME_FORMAT_SGBRG10:
+      return "GB10";
+    case UVC_FRAME_FORMAT_SRGGB10:
+      return "RG10";
+    case UVC_FRAME_FORMAT_SBGGR10:
+      return "BG10";
+    case UVC_FRAME_FORMAT_SGRBG16:
+      return "GR16";
+    case UVC_FRAME_FORMAT_SGBRG16:
+      return "GB16";
+    case UVC_FRAME_FORMAT_SRGGB16:
+      return "RG16";
+    case UVC_FRAME_FORMAT_SBGGR16:
+      return "BYR2";
+    case UVC_FRAME_FORMAT_Z16:
+      return "Z16 ";
+    default:
+      return "";
+  }
+  return "";
+}
+
+// eoiSeen is whether an earlier frame of the stream ended with an end of
+// image marker; set once this one does. Some cameras never send one.
+static bool isValidMjpegFrame(uvc_frame_t* frame, bool& eoiSeen) {
+  // See https://en.wikipedia.org/wiki/JPEG_File_Interchange_Format
+  if (frame->data_bytes < 6 || frame->data == nullptr) {
+    HLOGE_EVERY(1s, "Invalid MJPEG frame size %zu ptr %p", frame->data_bytes, frame->data);
+    return false;
+  }
+  const u_int8_t* data = (const u_int8_t*)frame->data;
+  u_int8_t soi1 = data[0];
+  u_int8_t soi2 = data[1];
+  // JPEG frame start of image (SOI) is 0xff 0xd8.
+  if (soi1 != 0xff || soi2 != 0xd8) {
+    HLOGE_EVERY(1s, "Invalid MJPEG frame SOI. size: %zu SOI: %x%x", frame->data_bytes, soi1, soi2);
+    return false;
+  }
+  // End of image (EOI) is 0xff 0xd9, possibly followed by zero padding.
+  size_t end = frame->data_bytes;
+  while (end > 4 && data[end - 1] == 0) {
+    end--;
+  }
+  if (data[end - 2] == 0xff && data[end - 1] == 0xd9) {
+    eoiSeen = true;
+  } else if (eoiSeen) {
+    HLOGE_EVERY(1s, "Truncated MJPEG frame without EOI, size: %zu", frame->data_bytes);
     return false;
   }
   return true;
 }
 
 std::string UsbVideoStreamer::statsSummaryString() const {
+  std::string powerProfile = powerProfile_.enabled
+      ? std::format(", power profile 1/{} of {} fps", decimation_, captureFrameFps_)
+      : "";
+  uint64_t captured = streamingStats_.videoCapture.frames.load();
+  std::string unchanged = changeDetector_.config().enabled && captured > 0
+      ? std::format(
+            ", {:.0f}% unchanged",
+            100.0 * streamingStats_.videoRender.framesUnchanged.load() / captured)
+      : "";
   return std::format(
-      "{} {}x{} @{} fps",
+      "{} {}x{} @{} fps{}{}",
       fourccFormatFromUvcFrameFormat(captureFrameFormat_),
       captureFrameWidth_,
       captureFrameHeight_,
-      stats_.fps);
-  ;
+      streamingStats_.videoRender.fps.load(),
+      powerProfile,
+      unchanged);
+}
+
+std::string UsbVideoStreamer::memorySummaryString() const {
+  constexpr double kMiB = 1024.0 * 1024.0;
+  uvc_stream_memory_t memory{};
+  if (streamHandle_ != nullptr) {
+    uvc_stream_get_memory(streamHandle_, &memory);
+  }
+  size_t decodeBytes = mjpegDecodePool_ != nullptr ? mjpegDecodePool_->bufferBytes() : 0;
+  return std::format(
+      "video {}x{}: transfers {:.1f} MiB, spare transfers {:.1f} MiB ({:.1f} MiB usbfs), "
+      "frame pool {:.1f} MiB, polling {:.1f} MiB, render scratch {:.1f} MiB, "
+      "decode workers {:.1f} MiB",
+      captureFrameWidth_,
+      captureFrameHeight_,
+      memory.transfer_bytes / kMiB,
+      memory.spare_transfer_bytes / kMiB,
+      memory.usbfs_bytes / kMiB,
+      memory.frame_pool_bytes / kMiB,
+      (memory.polling_bytes + memory.metadata_bytes) / kMiB,
+      renderScratchBytes_.load() / kMiB,
+      decodeBytes / kMiB);
+}
+
+size_t UsbVideoStreamer::trimMemory() {
+  if (renderThread_.joinable()) {
+    renderScratchTrim_ = true;
+  } else {
+    releaseRenderScratch();
+  }
+  return streamHandle_ != nullptr ? uvc_stream_trim_buffers(streamHandle_) : 0;
+}
+
+void UsbVideoStreamer::publishUsage() {
+  uvc_stream_memory_t memory{};
+  if (streamHandle_ != nullptr) {
+    uvc_stream_get_memory(streamHandle_, &memory);
+  }
+  MemoryCounters& counters = streamingStats_.memory;
+  counters.videoTransferBytes.set(memory.transfer_bytes + memory.spare_transfer_bytes);
+  counters.videoUsbfsBytes.set(memory.usbfs_bytes);
+  counters.videoFramePoolBytes.set(memory.frame_pool_bytes);
+  counters.videoPollingBytes.set(memory.polling_bytes + memory.metadata_bytes);
+  counters.renderScratchBytes.set(renderScratchBytes_.load(std::memory_order_relaxed));
+  counters.decodeWorkerBytes.set(
+      mjpegDecodePool_ != nullptr ? mjpegDecodePool_->bufferBytes() : 0);
+  if (schedulerSession_ != nullptr) {
+    TaskScheduler::Session::Stats scheduling = schedulerSession_->stats();
+    streamingStats_.videoRender.deadlineJobs.set(scheduling.jobs);
+    streamingStats_.videoRender.deadlineMisses.set(scheduling.missed);
+    streamingStats_.videoRender.framesShed.set(scheduling.shed);
+  }
+  streamingStats_.publishProcessUsage();
+}
+
+void UsbVideoStreamer::releaseRenderScratch() {
+  renderScratchTrim_ = false;
+  frameConverter_.releaseScratch();
+  renderScratchBytes_ = 0;
+}
+
+int64_t UsbVideoStreamer::frameIntervalNs() const {
+  return captureFrameFps_ > 0 ? 1'000'000'000 / captureFrameFps_ : 0;
+}
+
+std::vector<int64_t> UsbVideoStreamer::latencyPercentiles() {
+  return latencyStats_.percentiles();
 }
 
 UsbVideoStreamer::~UsbVideoStreamer() {
-  if (deviceHandle_ != nullptr) {
-    ULOGI("Close device handle");
-    uvc_close(deviceHandle_);
-    deviceHandle_ = nullptr;
+  stop();
+  state_ = StreamerState::DESTROYING;
+  stopMjpegRecording();
+  stopFrameLog();
+  stopFrameTap();
+  stopFrameServer();
+  disableStillCapture();
+  snapshot_.stop();
+  jpegSnapshot_.stop();
+  fanout_.reset();
+  glRenderer_ = nullptr;
+  vulkanConverter_ = nullptr;
+  videoDecoder_ = nullptr;
+  presenter_ = nullptr;
+  if (avSync_ != nullptr) {
+    avSync_->setVideoDelayAvailable(false);
   }
 
-  if (uvcContext_ != nullptr) {
-    ULOGI("Exit UVC Context");
-    uvc_exit(uvcContext_);
-    uvcContext_ = nullptr;
+  if (streamHandle_ != nullptr && player_ == nullptr) {
+    uvc_stream_close(streamHandle_);
+    BusBandwidthPlanner::shared().release(this);
+    device_->removeStream();
   }
+  streamHandle_ = nullptr;
+  // Closes the playback stream, once every frame was given back.
+  player_ = nullptr;
+  // The device closes with the last stream of the camera.
+  deviceHandle_ = nullptr;
+  device_ = nullptr;
 
   ULOGI("UsbVideoStreamer destroyed");
 }
 
+void UsbVideoStreamer::publishTransport(uint32_t sequence) {
+  UsbTransportCounters& counters = streamingStats_.transport.video;
+  // Stills share the stream's sequence numbers, so every frame counts.
+  if (lastCaptureSequence_ != 0 && sequence > lastCaptureSequence_ + 1) {
+    counters.sequenceGaps.add(sequence - lastCaptureSequence_ - 1);
+  }
+  lastCaptureSequence_ = sequence;
+
+  uvc_stream_transport_t transport;
+  uvc_stream_get_transport(streamHandle_, &transport);
+  uvc_stream_transport_t& published = publishedTransport_;
+  counters.packets.add(transport.packets - published.packets);
+  counters.packetErrors.add(transport.packet_errors - published.packet_errors);
+  counters.shortPackets.add(transport.short_packets - published.short_packets);
+  counters.emptyPackets.add(transport.empty_packets - published.empty_packets);
+  counters.bytes.add(transport.bytes - published.bytes);
+  counters.maxPacketBytes.set(transport.max_packet_bytes);
+  counters.headerErrors.add(transport.header_errors - published.header_errors);
+  counters.incompleteFrames.add(transport.incomplete_frames - published.incomplete_frames);
+  counters.framesWithoutEof.add(transport.frames_without_eof - published.frames_without_eof);
+  counters.oversizeFrames.add(transport.oversize_frames - published.oversize_frames);
+  counters.truncatedFrames.add(transport.truncated_frames - published.truncated_frames);
+  published = transport;
+
+  libusb_transfer_syscalls syscalls;
+  libusb_get_transfer_syscalls(&syscalls);
+  streamingStats_.transport.urbSubmits.set(syscalls.urb_submits);
+  streamingStats_.transport.urbReaps.set(syscalls.urb_reaps);
+  streamingStats_.transport.emptyReaps.set(syscalls.empty_reaps);
+}
+
 /* This callback function runs once per frame. */
 void UsbVideoStreamer::captureFrameCallback(uvc_frame_t* frame, void* user_data) {
+  TRACE_SCOPE("captureFrameCallback");
+  // Hand the borrowed buffer back to libuvc's pool unless the render queue takes it.
+  std::unique_ptr<uvc_frame_t, decltype(&uvc_release_frame)> borrowedFrame(
+      frame, &uvc_release_frame);
+  UsbVideoStreamer* self = (UsbVideoStreamer*)user_data;
+  if (!self->captureHintOpened_) {
+    // On whichever thread runs the callbacks, the USB event thread when inline.
+    self->captureHint_.open(ThreadRole::CAPTURE, self->frameIntervalNs());
+    self->captureHintOpened_ = true;
+  }
+  PerformanceHint::Work work(self->captureHint_);
+  self->lastFrameNs_.store(
+      steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+  if (!self->firstFrameSeen_.load(std::memory_order_relaxed)) {
+    self->firstFrameSeen_ = true;
+    steady_clock::time_point now = steady_clock::now();
+    HLOGI(
+        "First frame %.1f ms after connect, %.1f ms after start, %s stream control",
+        duration<double, std::milli>(now - self->createdAt_).count(),
+        duration<double, std::milli>(now - self->startedAt_).count(),
+        self->cachedNegotiation_ ? "cached" : "negotiated");
+  }
+  self->publishTransport(frame->sequence);
+  {
+    // Stills are delivered on their own, never previewed.
+    std::unique_lock lk(self->stillCaptureMutex_);
+    if (self->stillCapture_ != nullptr && self->stillCapture_->offer(frame)) {
+      return;
+    }
+  }
+  if (self->framePairer_ != nullptr) {
+    self->framePairer_->offer(self->framePairerStream_, frame);
+  }
+  VideoCaptureCounters& captureCounters = self->streamingStats_.videoCapture;
+  captureCounters.frames.add();
+  self->stats_.recordEvent(FrameEventKind::CAPTURED, frame);
+  captureCounters.bytes.add(frame->data_bytes);
+  captureCounters.isoPacketErrors.set(self->publishedTransport_.packet_errors);
+  // Lost packets shift or cut the data after them; counted with the transport.
+  if (frame->incomplete) {
+    self->stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
+    return;
+  }
   size_t expectedSize;
   switch (frame->frame_format) {
     case UVC_FRAME_FORMAT_NV12:
       expectedSize = frame->width * frame->height + frame->width * frame->height / 2;
       if (frame->data_bytes != expectedSize) {
-        ULOGE(
+        HLOGE_EVERY(
+            1s,
             "Invalid NV12 frame size %zu vs expected %zu for %dx%d, step %zu frame",
             frame->data_bytes,
             expectedSize,
             frame->width,
             frame->height,
             frame->step);
+        self->stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
         return;
       }
       break;
     case UVC_FRAME_FORMAT_YUYV:
       expectedSize = frame->width * frame->height * 2;
       if (frame->data_bytes != expectedSize) {
-        ULOGE(
+        HLOGE_EVERY(
+            1s,
             "Invalid YUYV frame size %zu vs expected %zu for %dx%d, step %zu frame",
             frame->data_bytes,
             expectedSize,
             frame->width,
             frame->height,
             frame->step);
+        self->stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
         return;
       }
       break;
     case UVC_FRAME_FORMAT_MJPEG:
-      if (!isValidMjpegFrame(frame)) {
+      if (!isValidMjpegFrame(frame, self->mjpegEoiSeen_)) {
+        self->stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
+        return;
+      }
+      break;
+    case UVC_FRAME_FORMAT_H264:
+    case UVC_FRAME_FORMAT_H265:
+    case UVC_FRAME_FORMAT_VP8:
+    case UVC_FRAME_FORMAT_VP9:
+      if (frame->data_bytes == 0 || frame->data == nullptr) {
+        HLOGE_EVERY(
+            1s, "Empty %s frame", fourccFormatFromUvcFrameFormat(frame->frame_format).c_str());
+        self->stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
         return;
       }
       break;
     default:
+      // Raw frames are read whole; mosaics read the rows next to the ones
+      // converted too.
+      if (frame->frame_format != UVC_FRAME_FORMAT_GRAY16 &&
+          frame->frame_format != UVC_FRAME_FORMAT_Z16 &&
+          !demosaic::isBayer(frame->frame_format)) {
+        break;
+      }
+      expectedSize = frame->step * frame->height;
+      if (frame->data_bytes < expectedSize) {
+        HLOGE_EVERY(
+            1s,
+            "Short %s frame of %zu bytes, expected %zu for %dx%d",
+            fourccFormatFromUvcFrameFormat(frame->frame_format).c_str(),
+            frame->data_bytes,
+            expectedSize,
+            frame->width,
+            frame->height);
+        self->stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
+        return;
+      }
       break;
   }
 
-  UsbVideoStreamer* self = (UsbVideoStreamer*)user_data;
-  ANativeWindow* preview_window = self->previewWindow_;
-  UsbVideoStreamerStats& stats = self->stats_;
+  {
+    std::unique_lock lk(self->frameLogRecorderMutex_);
+    if (self->frameLogRecorder_ != nullptr) {
+      self->frameLogRecorder_->addFrame(frame);
+    }
+  }
+  if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG ||
+      frame->frame_format == UVC_FRAME_FORMAT_H264 ||
+      frame->frame_format == UVC_FRAME_FORMAT_H265) {
+    std::unique_lock lk(self->instantReplayMutex_);
+    if (self->instantReplay_ != nullptr) {
+      self->instantReplay_->addFrame(frame);
+    }
+  }
+  if (frame->frame_format == UVC_FRAME_FORMAT_H264 ||
+      frame->frame_format == UVC_FRAME_FORMAT_H265) {
+    std::unique_lock lk(self->networkSinkMutex_);
+    if (self->networkSink_ != nullptr) {
+      if (self->networkSink_->takeKeyframeRequest()) {
+        self->requestKeyframe("network sink");
+      }
+      self->networkSink_->sendAccessUnit(
+          (const uint8_t*)frame->data,
+          frame->data_bytes,
+          frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+              frame->capture_time_finished.tv_nsec);
+    }
+  }
+  if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+    std::unique_lock lk(self->mjpegRecorderMutex_);
+    if (self->mjpegRecorder_ != nullptr) {
+      self->mjpegRecorder_->addFrame(frame);
+    }
+  }
+  {
+    std::unique_lock lk(self->frameTapMutex_);
+    if (self->frameTap_ != nullptr) {
+      self->frameTap_->offer(frame);
+    }
+  }
+  self->jpegSnapshot_.offer(frame);
+  {
+    std::unique_lock lk(self->frameServerMutex_);
+    if (self->frameServer_ != nullptr) {
+      self->frameServer_->offer(frame);
+    }
+  }
+  if (!self->isCaptureThreadNamed_) {
+    ThreadPolicies::apply(ThreadRole::CAPTURE, "usb_video_capture");
+    self->isCaptureThreadNamed_ = true;
+  }
+  // Recorders, taps and stills above still see every frame.
+  if (self->decimation_ > 1 && self->decimationCount_++ % self->decimation_ != 0) {
+    return;
+  }
+  // Headless, the frame goes back to the pool unless a consumer of the render
+  // thread waits for one.
+  if (self->headless_.load(std::memory_order_relaxed) && !self->snapshot_.requested() &&
+      self->secondaryPreviews_.empty() && self->frameSynchronizer_ == nullptr) {
+    return;
+  }
+  if (self->enqueueFrame(frame)) {
+    borrowedFrame.release();
+  }
+  TRACE_COUNTER("frameQueueDepth", self->frameQueue_.size());
+}
+
+bool UsbVideoStreamer::enqueueFrame(uvc_frame_t* frame) {
+  TRACE_SCOPE("enqueueFrame");
+  int64_t now = steady_clock::now().time_since_epoch().count();
+  if (frameDropPolicy_ == FrameDropPolicy::LATEST_ONLY) {
+    // A queued frame is stale as soon as a newer one arrives.
+    uvc_frame_t* stale;
+    int64_t enqueueTime;
+    while (frameQueue_.tryPop(stale, enqueueTime)) {
+      stats_.recordDrop(FrameDropCause::DECODE_BUSY, stale);
+      uvc_release_frame(stale);
+    }
+  }
+  while (!frameQueue_.tryPush(frame, now)) {
+    if (!rendering_) {
+      return false;
+    }
+    if (frameDropPolicy_ != FrameDropPolicy::BLOCK) {
+      uvc_frame_t* oldest;
+      int64_t enqueueTime;
+      if (frameQueue_.tryPop(oldest, enqueueTime)) {
+        stats_.recordDrop(FrameDropCause::DECODE_BUSY, oldest);
+        uvc_release_frame(oldest);
+      }
+    } else {
+      std::unique_lock lk(frameQueueMutex_);
+      frameQueueChange_.wait_for(lk, 10ms, [this] { return !frameQueue_.full() || !rendering_; });
+    }
+  }
+  std::unique_lock lk(frameQueueMutex_);
+  frameQueueChange_.notify_all();
+  return true;
+}
+
+void UsbVideoStreamer::drainFrameQueue() {
+  uvc_frame_t* frame;
+  int64_t enqueueTime;
+  while (frameQueue_.tryPop(frame, enqueueTime)) {
+    uvc_release_frame(frame);
+  }
+}
+
+void UsbVideoStreamer::renderLoop() {
+  ThreadPolicies::apply(ThreadRole::RENDER, "usb_video_render");
+  PerformanceHint performanceHint;
+  performanceHint.open(ThreadRole::RENDER, frameIntervalNs());
+  if (glRenderer_ != nullptr && !glRenderer_->makeCurrent()) {
+    ULOGE("GL preview could not be made current on the render thread");
+  }
+  milliseconds idleWait = powerProfile_.enabled ? kPowerProfileRenderIdleWait : kRenderIdleWait;
+  steady_clock::time_point publishedAt = steady_clock::now();
+  while (rendering_) {
+    if (renderScratchTrim_.load(std::memory_order_relaxed)) {
+      releaseRenderScratch();
+    }
+    if (windowSwapPending_.load(std::memory_order_acquire)) {
+      applyPendingWindow();
+    }
+    if (gpuConversionPending_.load(std::memory_order_acquire)) {
+      applyGpuConversion();
+      updateHeadless();
+    }
+    bool headless = headless_.load(std::memory_order_relaxed);
+    if (headless && steady_clock::now() - publishedAt >= 1s) {
+      // renderFrame() publishes it otherwise.
+      publishUsage();
+      publishedAt = steady_clock::now();
+    }
+    uvc_frame_t* frame;
+    int64_t enqueueTime;
+    if (pacing_) {
+      if (!takePacedFrame(frame, enqueueTime, idleWait, performanceHint)) {
+        continue;
+      }
+    } else if (!frameQueue_.tryPop(frame, enqueueTime)) {
+      if (mjpegDecodePool_ != nullptr && presentDecoded(false, performanceHint)) {
+        continue;
+      }
+      if (slicing_ && convertArrivingRows(idleWait)) {
+        continue;
+      }
+      milliseconds wait = transfersPaused_.load(std::memory_order_relaxed)
+          ? kPausedRenderIdleWait
+          : headless ? kHeadlessRenderIdleWait : idleWait;
+      std::unique_lock lk(frameQueueMutex_);
+      frameQueueChange_.wait_for(lk, wait, [this] {
+        return !frameQueue_.empty() || !rendering_ || windowSwapPending_ ||
+            gpuConversionPending_ || (mjpegDecodePool_ != nullptr && mjpegDecodePool_->hasNext());
+      });
+      continue;
+    }
+    if (frameDropPolicy_ == FrameDropPolicy::BLOCK) {
+      std::unique_lock lk(frameQueueMutex_);
+      frameQueueChange_.notify_all();
+    } else if (
+        !pacing_ &&
+        (frameDropPolicy_ == FrameDropPolicy::LATEST_ONLY ||
+         (frame->frame_format == UVC_FRAME_FORMAT_MJPEG && mjpegDecodeSkipping_ &&
+          fastPaths_.allows(FAST_PATH_MJPEG_DECODE_SKIPPING)))) {
+      // Skip ahead to anything that arrived since the pop. A JPEG decoded
+      // now would be overwritten by the next one before it is seen.
+      frame = skipToNewest(frame, enqueueTime);
+    }
+    stats_.recordQueueDelay(
+        steady_clock::now() - steady_clock::time_point(nanoseconds(enqueueTime)));
+    // Decode and stripe jobs are due when the next frame arrives, or with
+    // smooth playback one frame interval after it was taken.
+    std::optional<TaskScheduler::DeadlineScope> deadline;
+    if (!headless && schedulerSession_ != nullptr) {
+      if (schedulerSession_->takeShedRequest()) {
+        stats_.recordDrop(FrameDropCause::DECODE_BUSY, frame);
+        uvc_release_frame(frame);
+        continue;
+      }
+      schedulerSession_->setPeriod(nanoseconds(frameIntervalNs()));
+      int64_t dueFromNs =
+          pacing_ ? steady_clock::now().time_since_epoch().count() : enqueueTime;
+      deadline.emplace(schedulerSession_, dueFromNs + frameIntervalNs());
+    }
+    {
+      std::unique_lock lk(motionDetectorMutex_);
+      if (motionDetector_ != nullptr) {
+        motionDetector_->update(frame, steady_clock::now().time_since_epoch().count());
+      }
+    }
+    if (!headless && mjpegDecodePool_ != nullptr &&
+        frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+      decodeInParallel(frame, enqueueTime, performanceHint);
+      continue;
+    }
+    // Slice conversion already wrote the arriving frame's rows.
+    if (!slicing_ && !headless &&
+        !changeDetector_.shouldShow(frame, steady_clock::now().time_since_epoch().count())) {
+      streamingStats_.videoRender.framesUnchanged.add();
+      snapshot_.offer(frame);
+      uvc_release_frame(frame);
+      continue;
+    }
+    {
+      PerformanceHint::Work work(performanceHint);
+      renderFrame(frame, enqueueTime);
+    }
+    snapshot_.offer(frame);
+    secondaryPreviews_.offer(frame, fanout_, steady_clock::now().time_since_epoch().count());
+    uvc_release_frame(frame);
+  }
+  if (mjpegDecodePool_ != nullptr) {
+    // Frames still decoding go back to libuvc before the stream stops.
+    mjpegDecodePool_->drain();
+  }
+  releaseJitterBuffer();
+  releaseSlice();
+  renderAhead_ = nullptr;
+  if (lastGoodFrame_ != nullptr) {
+    uvc_release_frame(lastGoodFrame_);
+    lastGoodFrame_ = nullptr;
+  }
+  if (renderScratchTrim_) {
+    releaseRenderScratch();
+  }
+  if (glRenderer_ != nullptr) {
+    glRenderer_->releaseHeldFrames();
+    glRenderer_->releaseCurrent();
+  }
+  if (vulkanConverter_ != nullptr) {
+    vulkanConverter_->releaseHeldFrames();
+  }
+  {
+    std::unique_lock lk(frameQueueMutex_);
+    windowSwapsAccepted_ = false;
+  }
+  // A swap requested after the last frame is applied here, off the context.
+  applyPendingWindow();
+  applyGpuConversion();
+}
+
+void UsbVideoStreamer::decodeInParallel(
+    uvc_frame_t* frame,
+    int64_t enqueueTime,
+    PerformanceHint& hint) {
+  // Every worker holds a frame: presenting the oldest frees its worker.
+  while (mjpegDecodePool_->full() && presentDecoded(true, hint)) {
+  }
+  FrameCrop crop = crop_.load(std::memory_order_relaxed);
+  if (!mjpegDecodePool_->submit(frame, enqueueTime, decodeWidth_, decodeHeight_, crop)) {
+    stats_.recordDrop(FrameDropCause::DECODE_BUSY, frame);
+    uvc_release_frame(frame);
+    return;
+  }
+  while (presentDecoded(false, hint)) {
+  }
+}
+
+bool UsbVideoStreamer::presentDecoded(bool wait, PerformanceHint& hint) {
+  MjpegDecodePool::Decoded decoded;
+  if (!mjpegDecodePool_->takeNext(decoded, wait)) {
+    return false;
+  }
+  if (decoded.ok) {
+    {
+      PerformanceHint::Work work(hint);
+      renderFrame(decoded.frame, decoded.enqueueNs, &decoded);
+    }
+    snapshot_.offer(decoded.frame);
+    secondaryPreviews_.offer(
+        decoded.frame, fanout_, steady_clock::now().time_since_epoch().count());
+  } else {
+    stats_.recordDrop(FrameDropCause::INVALID_SIZE, decoded.frame);
+  }
+  mjpegDecodePool_->recycle(decoded);
+  uvc_release_frame(decoded.frame);
+  return true;
+}
+
+bool UsbVideoStreamer::convertArrivingRows(milliseconds timeout) {
+  uvc_frame_t progress;
+  uvc_error_t ret = uvc_stream_wait_frame_progress(
+      streamHandle_,
+      slice_.sequence,
+      slice_.locked ? slice_.bytes + 1 : 0,
+      (int32_t)duration_cast<microseconds>(timeout).count(),
+      &progress);
+  if (ret != UVC_SUCCESS && ret != UVC_ERROR_TIMEOUT) {
+    return false;
+  }
+  if (slice_.locked && progress.sequence != slice_.sequence) {
+    // Complete, and on its way through the queue unless libuvc dropped it.
+    return false;
+  }
+  if (!slice_.locked) {
+    TRACE_SCOPE("lockBuffer");
+    // Without a buffer, the frame is rendered the regular way on pop.
+    bool locked = presenter_ != nullptr
+        ? presenter_->lock(&slice_.buffer)
+        : ANativeWindow_lock(previewWindow_, &slice_.buffer, nullptr) == 0;
+    if (!locked) {
+      return false;
+    }
+    slice_.locked = true;
+    slice_.sequence = progress.sequence;
+    slice_.data = progress.data;
+    slice_.rows = 0;
+    if (slice_.buffer.format != frameConverter_.windowFormat() ||
+        progress.frame_format != frameConverter_.frameFormat()) {
+      frameConverter_.configure(progress.frame_format, slice_.buffer.format);
+    }
+    slice_.converting = frameConverter_.convertsRows(&progress, slice_.buffer);
+  }
+  slice_.bytes = progress.data_bytes;
+  int32_t rows = FrameConverter::completedRows(&progress, progress.data_bytes);
+  if (slice_.converting && rows > slice_.rows) {
+    slice_.converting =
+        frameConverter_.convertRows(&progress, slice_.buffer, slice_.rows, rows - slice_.rows);
+    slice_.rows = rows;
+  }
+  return true;
+}
+
+void UsbVideoStreamer::releaseSlice() {
+  if (!slice_.locked) {
+    return;
+  }
+  slice_.locked = false;
+  if (presenter_ != nullptr) {
+    presenter_->unlock();
+  } else {
+    // A window buffer cannot be unlocked without posting it.
+    ANativeWindow_unlockAndPost(previewWindow_);
+  }
+}
+
+bool UsbVideoStreamer::takePacedFrame(
+    uvc_frame_t*& frame,
+    int64_t& enqueueTime,
+    milliseconds idleWait,
+    PerformanceHint& performanceHint) {
+  if (transfersPaused_.load(std::memory_order_relaxed)) {
+    // Released like the frame queue, so nothing stale shows on resume.
+    releaseJitterBuffer();
+  }
+  uvc_frame_t* arrived;
+  int64_t arrivedAt;
+  bool dequeued = false;
+  while (frameQueue_.tryPop(arrived, arrivedAt)) {
+    dequeued = true;
+    // The capture time on the host's clock, once the device clock is
+    // recovered; the frame's own SCR sample is added when it renders.
+    int64_t captureNs = 0;
+    FrameTimeline timeline = FrameTimeline::forFrame(arrived, arrivedAt);
+    if (timeline.pts != 0) {
+      DeviceClock::Estimate capture = deviceClock_.toHost(timeline.pts);
+      captureNs = capture.confident ? capture.hostNs : 0;
+    }
+    if (uvc_frame_t* evicted = jitterBuffer_.push(arrived, arrivedAt, captureNs)) {
+      stats_.recordDrop(FrameDropCause::DECODE_BUSY, evicted);
+      uvc_release_frame(evicted);
+    }
+  }
+  if (dequeued && frameDropPolicy_ == FrameDropPolicy::BLOCK) {
+    std::unique_lock lk(frameQueueMutex_);
+    frameQueueChange_.notify_all();
+  }
+  int64_t now = steady_clock::now().time_since_epoch().count();
+  if (jitterBuffer_.pop(now, frame, enqueueTime)) {
+    return true;
+  }
+  if (mjpegDecodePool_ != nullptr && presentDecoded(false, performanceHint)) {
+    return false;
+  }
+  nanoseconds wait = transfersPaused_.load(std::memory_order_relaxed)
+      ? kPausedRenderIdleWait
+      : headless_.load(std::memory_order_relaxed) ? kHeadlessRenderIdleWait : idleWait;
+  if (!jitterBuffer_.empty()) {
+    wait = std::min(wait, nanoseconds(jitterBuffer_.nextDueNs() - now));
+  }
+  std::unique_lock lk(frameQueueMutex_);
+  frameQueueChange_.wait_for(lk, wait, [this] {
+    return !frameQueue_.empty() || !rendering_ || windowSwapPending_ ||
+        (mjpegDecodePool_ != nullptr && mjpegDecodePool_->hasNext());
+  });
+  return false;
+}
+
+void UsbVideoStreamer::releaseJitterBuffer() {
+  uvc_frame_t* frame;
+  int64_t enqueueTime;
+  while (jitterBuffer_.take(frame, enqueueTime)) {
+    uvc_release_frame(frame);
+  }
+}
+
+uvc_frame_t* UsbVideoStreamer::skipToNewest(uvc_frame_t* frame, int64_t& enqueueTime) {
+  bool isMjpeg = frame->frame_format == UVC_FRAME_FORMAT_MJPEG;
+  bool validate = isMjpeg && validateSkippedJpegs_;
+  uvc_frame_t* newer;
+  int64_t newerEnqueueTime;
+  while (frameQueue_.tryPop(newer, newerEnqueueTime)) {
+    if (validate && !libyuv::ValidateJpeg((const uint8_t*)frame->data, frame->data_bytes)) {
+      stats_.recordDrop(FrameDropCause::INVALID_SIZE, frame);
+    } else {
+      stats_.recordDrop(FrameDropCause::DECODE_BUSY, frame);
+    }
+    if (isMjpeg) {
+      streamingStats_.videoRender.decodesSkipped.add();
+    }
+    uvc_release_frame(frame);
+    frame = newer;
+    enqueueTime = newerEnqueueTime;
+  }
+  return frame;
+}
+
+/* Runs on the render thread once per dequeued frame. */
+void UsbVideoStreamer::renderFrame(
+    uvc_frame_t* frame,
+    int64_t callbackNs,
+    const MjpegDecodePool::Decoded* decoded) {
+  TRACE_SCOPE("renderFrame");
+  FrameTimeline timeline = FrameTimeline::forFrame(frame, callbackNs);
+  bool recordingSlowFrames = slowFrames_.enabled();
+  int64_t renderCpuStartNs = recordingSlowFrames ? SlowFrameRecorder::threadCpuNs() : 0;
+  uint32_t queueDepth = frameQueue_.size();
+  if (timeline.scr != 0) {
+    deviceClock_.addSample(
+        timeline.scr,
+        (frame->meta.flags & UVC_FRAME_META_SCR_SOF) ? frame->meta.scr_sof : -1,
+        timeline.usbCompleteNs);
+  }
+  if (timeline.pts != 0) {
+    DeviceClock::Estimate capture = deviceClock_.toHost(timeline.pts);
+    if (capture.confident) {
+      timeline.captureNs = capture.hostNs;
+      timeline.captureJitterNs = capture.jitterNs;
+    }
+  }
+  if (frameSynchronizer_ != nullptr) {
+    // Cameras share no clock, so only host times compare.
+    frameSynchronizer_->offer(
+        frameSynchronizerStream_,
+        frame,
+        timeline.captureNs != 0 ? timeline.captureNs : timeline.usbCompleteNs);
+  }
+  // A pool decoded frame was converted from the start of its decode.
+  timeline.renderStartNs =
+      decoded != nullptr ? decoded->decodeStartNs : steady_clock::now().time_since_epoch().count();
+  UsbVideoStreamerStats& stats = stats_;
   bool first_call = stats.lastFpsUpdate.time_since_epoch().count() == 0;
   if (first_call) {
-    prctl(PR_SET_NAME, "usb_video_capture");
     ULOGI("__ANDROID_MIN_SDK_VERSION__ %d", __ANDROID_MIN_SDK_VERSION__);
     ULOGI(
         "Capture frame format: %d data bytes: %zu step: %zd %dx%d",
@@ -248,144 +2814,456 @@ void UsbVideoStreamer::captureFrameCallback(uvc_frame_t* frame, void* user_data)
         frame->step,
         frame->width,
         frame->height);
-    stats.captureRenderClock_ = high_resolution_clock::now();
-  } else {
-    stats.recordCapture();
   }
 
-  ANativeWindow_Buffer buffer;
-  auto status = ANativeWindow_lock(preview_window, &buffer, nullptr);
-  if (status != 0) {
-    ULOGE("ANativeWindow_lock failed with error %d", status);
+  // Without a window only the GL preview has work left, for the recording.
+  if (headless_.load(std::memory_order_relaxed)) {
     return;
   }
-
-  if (first_call) {
-    ULOGE(
-        "Display buffer format: %d  stride: %d %dx%d",
-        buffer.format,
-        buffer.stride,
-        buffer.width,
-        buffer.height);
+  if (!frameRateApplied_.exchange(true, std::memory_order_relaxed)) {
+    applyFrameRate();
   }
-
-  if (frame->frame_format == UVC_FRAME_FORMAT_NV12) {
-    int32_t hardware_buffer_format = buffer.format;
-    if (hardware_buffer_format == AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM) {
-      uint8_t* src_y = (uint8_t*)frame->data;
-      uint8_t* dest_rgb = (uint8_t*)buffer.bits;
-      libyuv::NV21ToARGB(
-          src_y,
-          frame->step,
-          (src_y + frame->width * frame->height),
-          frame->step,
-          dest_rgb,
-          buffer.stride * 4,
-          buffer.width,
-          buffer.height);
-    } else if (hardware_buffer_format == AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM) {
-      uint8_t* src_y = (uint8_t*)frame->data;
-      uint8_t* dest_rgb = (uint8_t*)buffer.bits;
-      libyuv::NV21ToRGB24(
-          src_y,
-          frame->step,
-          (src_y + frame->width * frame->height),
-          frame->step,
-          dest_rgb,
-          buffer.stride * 3,
-          buffer.width,
-          buffer.height);
-    } else {
-      ULOGE("Unsupported hardware format for UVC_FRAME_FORMAT_NV12 %d", hardware_buffer_format);
-    }
-  } else if (frame->frame_format == UVC_FRAME_FORMAT_YUYV) {
-    uint8_t* src_yuy2 = (uint8_t*)frame->data;
-    uint8_t* dest_rgba = (uint8_t*)buffer.bits;
-    libyuv::YUY2ToARGB(
-        src_yuy2, frame->step, dest_rgba, 4 * buffer.stride, buffer.width, buffer.height);
-    libyuv::ABGRToARGB(
-        dest_rgba, 4 * buffer.stride, dest_rgba, 4 * buffer.stride, buffer.width, buffer.height);
-  } else if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
-#if __ANDROID_MIN_SDK_VERSION__ >= 30
-    AImageDecoder* decoder;
-    int result = AImageDecoder_createFromBuffer(frame->data, frame->data_bytes, &decoder);
-    if (result == ANDROID_IMAGE_DECODER_SUCCESS) {
-      size_t stride = buffer.stride * 4;
-      size_t size = buffer.height * stride;
-      result = AImageDecoder_decodeImage(decoder, buffer.bits, stride, size);
-      if (result != ANDROID_IMAGE_DECODER_SUCCESS) {
-        const AImageDecoderHeaderInfo* info = AImageDecoder_getHeaderInfo(decoder);
-        ULOGE(
-            "MJPG decoding error %d frame size %zu %dx%d, step %zu, decoded image header: %d X %d stride %zu mime-type %s",
-            result,
-            frame->data_bytes,
-            frame->width,
-            frame->height,
-            frame->step,
-            AImageDecoderHeaderInfo_getWidth(info),
-            AImageDecoderHeaderInfo_getHeight(info),
-            stride,
-            AImageDecoderHeaderInfo_getMimeType(info));
-        memset(buffer.bits, 0, size);
-      }
-      AImageDecoder_delete(decoder);
-    } else {
-      ULOGE(
-          "MJPG AImageDecoder_createFromBuffer error %d frame size %zu %dx%d, step %zu",
-          result,
-          frame->data_bytes,
-          frame->width,
-          frame->height,
-          frame->step);
-    }
-#else
-    std::unique_ptr<uvc_frame_t, decltype(&uvc_free_frame)> rgb_frame_ptr(
-        uvc_allocate_frame(frame->width * frame->height * 3), &uvc_free_frame);
-    uvc_frame_t* rgb_frame = rgb_frame_ptr.get();
-    uvc_mjpeg2rgb(frame, rgb_frame);
-    uint8_t* src_rgb = (uint8_t*)rgb_frame->data;
-    uint8_t* dest_rgba = (uint8_t*)buffer.bits;
-    int32_t hardware_buffer_format = buffer.format;
-    if (hardware_buffer_format == AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM) {
-      libyuv::RGB24ToARGB(
-          src_rgb, rgb_frame->step, dest_rgba, buffer.stride * 4, buffer.width, buffer.height);
-    } else {
-      ULOGE("Unsupported hardware_buffer_format  %d for MJPEG frame", hardware_buffer_format);
+  if (overlay_.enabled()) {
+    overlay_.update(
+        frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+        frame->capture_time_finished.tv_nsec);
+  }
+  WhiteBalance whiteBalance = whiteBalance_.load(std::memory_order_relaxed);
+  if (whiteBalance != appliedWhiteBalance_) {
+    appliedWhiteBalance_ = whiteBalance;
+    frameConverter_.setWhiteBalance(whiteBalance);
+    if (glRenderer_ != nullptr) {
+      glRenderer_->setWhiteBalance(whiteBalance);
     }
-#endif
-  } else {
-    ULOGE("Unsupported  frame->frame_format %d", frame->frame_format);
   }
-  ANativeWindow_unlockAndPost(preview_window);
+  DepthRange depthRange = depthRange_.load(std::memory_order_relaxed);
+  if (depthRange != appliedDepthRange_) {
+    appliedDepthRange_ = depthRange;
+    frameConverter_.setDepthRange(depthRange);
+  }
+  if (videoDecoder_ != nullptr) {
+    TRACE_SCOPE("decodeFrame");
+    if (!videoDecoder_->queueFrame(frame)) {
+      stats.recordDrop(FrameDropCause::DECODE_BUSY, frame);
+      // The frames after it reference what the decoder never saw.
+      requestKeyframe("decoder dropped a frame");
+      return;
+    }
+    timeline.convertedNs = steady_clock::now().time_since_epoch().count();
+  } else if (glRenderer_ != nullptr) {
+    TRACE_SCOPE("glRenderFrame");
+    std::unique_lock lk(recorderMutex_);
+    glRenderer_->setRecordingWindow(recorder_ != nullptr ? recorder_->inputWindow() : nullptr);
+    if (!glRenderer_->renderFrame(frame)) {
+      ULOGE("GL preview failed to render frame %u", frame->sequence);
+    }
+    timeline.convertedNs = steady_clock::now().time_since_epoch().count();
+  } else if (
+      vulkanConverter_ != nullptr && !overlay_.enabled() &&
+      crop_.load(std::memory_order_relaxed).empty() && whiteBalance == WhiteBalance{}) {
+    TRACE_SCOPE("vulkanConvertFrame");
+    if (!renderWithVulkan(frame, timeline)) {
+      return;
+    }
+  } else if (!renderToWindowBuffer(frame, first_call, timeline, decoded)) {
+    return;
+  }
+  timeline.postedNs = steady_clock::now().time_since_epoch().count();
+  balanceConversion(
+      nanoseconds(timeline.renderStartNs - callbackNs),
+      nanoseconds(timeline.postedNs - timeline.renderStartNs));
+  latencyStats_.record(timeline);
+  if (pacing_) {
+    jitterBuffer_.presented(frame->sequence, timeline.postedNs);
+  }
+  if (recordingSlowFrames) {
+    slowFrames_.record(
+        {frame->sequence,
+         queueDepth,
+         timeline,
+         SlowFrameRecorder::threadCpuNs() - renderCpuStartNs},
+        frameIntervalNs());
+  }
+  // Only the CPU path measures, and only the frames it converted whole.
+  LumaStats luma;
+  bool measured = videoDecoder_ == nullptr && glRenderer_ == nullptr &&
+      frameConverter_.lumaStats(luma) && luma.sequence == frame->sequence;
+  if (measured) {
+    std::unique_lock lk(lumaStatsMutex_);
+    latestLuma_ = luma;
+    hasLuma_ = true;
+  }
+  stats.recordEvent(
+      FrameEventKind::RENDERED,
+      frame,
+      0,
+      (uint32_t)((timeline.postedNs - timeline.usbCompleteNs) / 1000),
+      measured ? &luma : nullptr);
 
-  stats.recordRender();
-  stats.recordFrame();
+  if (!firstFrameShown_.load(std::memory_order_relaxed)) {
+    noteFirstFrameShown();
+  }
+  steady_clock::time_point now{nanoseconds(timeline.postedNs)};
+  if (stats.recordFrame(now)) {
+    latencyStats_.publish();
+    publishUsage();
+  }
   stats.frames++;
   auto frame_count = stats.frames;
-  auto now = steady_clock::now();
   if (first_call) {
     stats.lastFpsUpdate = now;
   }
   duration<float> diff = duration_cast<seconds>(now - stats.lastFpsUpdate);
   if (diff >= 10.0s) {
     auto fps = frame_count / diff.count();
-    duration<double, seconds::period> captureDuration(stats.capture_);
-    duration<double, seconds::period> renderDuration(stats.render_);
-    auto capturePlusRender = captureDuration.count() + renderDuration.count();
-    ULOGI(
-        "Captured %dx%d %u frames in %.1f secs. fps: %.1f. Capture time: %.2f (%.0f%%) Render Time: %.2f (%.0f%%)",
+    // CPU time of every capture and render thread of the process.
+    uint64_t captureCpuNs = ThreadPolicies::usage(ThreadRole::CAPTURE).cpuTimeNs;
+    uint64_t renderCpuNs = ThreadPolicies::usage(ThreadRole::RENDER).cpuTimeNs;
+    duration<double, milliseconds::period> captureCpu(
+        nanoseconds(captureCpuNs - stats.loggedCaptureCpuNs_));
+    duration<double, milliseconds::period> renderCpu(
+        nanoseconds(renderCpuNs - stats.loggedRenderCpuNs_));
+    stats.loggedCaptureCpuNs_ = captureCpuNs;
+    stats.loggedRenderCpuNs_ = renderCpuNs;
+    duration<double, milliseconds::period> queueDelay(stats.queueDelay_);
+    duration<double, milliseconds::period> maxQueueDelay(stats.maxQueueDelay_);
+    duration<double, microseconds::period> decodeSetup(stats.decodeSetup_);
+    HLOGI(
+        "Captured %dx%d %u frames in %.1f secs. fps: %.1f. CPU ms per frame capture: %.2f render: %.2f Queue delay avg: %.2f ms max: %.2f ms dropped busy: %u lock: %u size: %u Decode setup avg: %.0f us",
         frame->width,
         frame->height,
         frame_count,
         diff.count(),
         fps,
-        captureDuration.count(),
-        captureDuration.count() * 100 / capturePlusRender,
-        renderDuration.count(),
-        renderDuration.count() * 100 / capturePlusRender);
+        captureCpu.count() / frame_count,
+        renderCpu.count() / frame_count,
+        queueDelay.count() / frame_count,
+        maxQueueDelay.count(),
+        stats.takeDrops(FrameDropCause::DECODE_BUSY),
+        stats.takeDrops(FrameDropCause::WINDOW_LOCK_FAILED),
+        stats.takeDrops(FrameDropCause::INVALID_SIZE),
+        decodeSetup.count() / frame_count);
+    // Since the process started: losses here point at the bus, not the CPU.
+    const UsbTransportCounters& transport = streamingStats_.transport.video;
+    HLOGI(
+        "USB packets: %llu errors: %llu short: %llu empty: %llu max bytes: %llu of %llu "
+        "header errors: %llu incomplete frames: %llu without EOF: %llu sequence gaps: %llu "
+        "oversize: %llu truncated: %llu",
+        (unsigned long long)transport.packets.load(),
+        (unsigned long long)transport.packetErrors.load(),
+        (unsigned long long)transport.shortPackets.load(),
+        (unsigned long long)transport.emptyPackets.load(),
+        (unsigned long long)transport.maxPacketBytes.load(),
+        (unsigned long long)transport.reservedBytesPerPacket.load(),
+        (unsigned long long)transport.headerErrors.load(),
+        (unsigned long long)transport.incompleteFrames.load(),
+        (unsigned long long)transport.framesWithoutEof.load(),
+        (unsigned long long)transport.sequenceGaps.load(),
+        (unsigned long long)transport.oversizeFrames.load(),
+        (unsigned long long)transport.truncatedFrames.load());
+    const TransportCounters& transports = streamingStats_.transport;
+    uint64_t urbIoctls = transports.urbSubmits.load() + transports.urbReaps.load();
+    HLOGI(
+        "usbfs ioctls per frame: %.1f, since start submits: %llu reaps: %llu empty: %llu",
+        (double)(urbIoctls - stats.loggedUrbIoctls_) / frame_count,
+        (unsigned long long)transports.urbSubmits.load(),
+        (unsigned long long)transports.urbReaps.load(),
+        (unsigned long long)transports.emptyReaps.load());
+    stats.loggedUrbIoctls_ = urbIoctls;
+    // CPU time a frame of this mode costs, for the mode selector.
+    double frameCpuMs = renderCpu.count() / frame_count;
+    if (stripeWorkers_ != nullptr) {
+      std::string busy;
+      std::vector<nanoseconds> busyTimes = stripeWorkers_->takeBusyTimes();
+      for (size_t i = 0; i < busyTimes.size(); i++) {
+        duration<double, milliseconds::period> busyMs(busyTimes[i]);
+        busy += std::format(" {:.2f}", busyMs.count() / frame_count);
+        // The render thread's share is in its CPU time already.
+        if (i + 1 < busyTimes.size()) {
+          frameCpuMs += busyMs.count() / frame_count;
+        }
+      }
+      HLOGI("Stripe conversion busy ms per frame, workers then render thread:%s", busy.c_str());
+    }
+    if (mjpegDecodePool_ != nullptr) {
+      std::string busy;
+      for (nanoseconds busyTime : mjpegDecodePool_->takeBusyTimes()) {
+        duration<double, milliseconds::period> busyMs(busyTime);
+        busy += std::format(" {:.2f}", busyMs.count() / frame_count);
+        frameCpuMs += busyMs.count() / frame_count;
+      }
+      HLOGI("MJPEG decode busy ms per frame by worker:%s", busy.c_str());
+    }
+    if (device_ != nullptr) {
+      ModeCostModel::shared().record(
+          captureFrameFormat_, frame->width, frame->height, frameCpuMs * 1000);
+    }
+    HLOGI("Latency p50/p95/p99 ms:%s", latencyStats_.summary().c_str());
+    if (deviceClock_.samples() >= DeviceClock::kMinSamples) {
+      HLOGI(
+          "Device clock drift %.1f ppm jitter %.3f ms",
+          deviceClock_.driftPpm(),
+          deviceClock_.jitterNs() / 1e6);
+    }
+    if (pacing_) {
+      JitterBuffer::Report jitter = jitterBuffer_.takeReport();
+      HLOGI(
+          "Smooth playback depth %u delay %.2f ms, %u frames held avg %.2f ms max %.2f ms, "
+          "present jitter p95 %.2f ms, %u late, %u overflowed",
+          jitter.targetDepth,
+          jitter.delayNs / 1e6,
+          jitter.frames,
+          jitter.meanAddedNs / 1e6,
+          jitter.maxAddedNs / 1e6,
+          jitter.presentJitterP95Ns / 1e6,
+          jitter.late,
+          jitter.overflows);
+      VideoRenderCounters& render = streamingStats_.videoRender;
+      render.jitterBufferDepth.set(jitter.targetDepth);
+      render.jitterBufferDelayUs.set(std::max<int64_t>(jitter.delayNs / 1000, 0));
+      render.presentJitterUs.set(jitter.presentJitterP95Ns / 1000);
+      render.addedLatencyUs.set(jitter.meanAddedNs / 1000);
+      render.jitterBufferLateFrames.add(jitter.late);
+    }
+    if (presenter_ != nullptr) {
+      SurfaceControlPresenter::LatencyStats latency = presenter_->takeLatencyStats();
+      duration<double, milliseconds::period> total(latency.total);
+      duration<double, milliseconds::period> max(latency.max);
+      HLOGI(
+          "Capture to present latency over %u frames avg: %.2f ms max: %.2f ms",
+          latency.frames,
+          latency.frames > 0 ? total.count() / latency.frames : 0.0,
+          max.count());
+    }
     stats.lastFpsUpdate = now;
     stats.frames = 0;
-    stats.capture_ = 0ns;
-    stats.render_ = 0ns;
+    stats.queueDelay_ = 0ns;
+    stats.maxQueueDelay_ = 0ns;
+    stats.decodeSetup_ = 0ns;
+  }
+}
+
+bool UsbVideoStreamer::renderWithVulkan(uvc_frame_t* frame, FrameTimeline& timeline) {
+  AHardwareBuffer* buffer = nullptr;
+  int releaseFence = -1;
+  int64_t lockStartNs = steady_clock::now().time_since_epoch().count();
+  bool acquired = presenter_->acquire(&buffer, &releaseFence);
+  timeline.windowLockNs = steady_clock::now().time_since_epoch().count() - lockStartNs;
+  if (!acquired) {
+    stats_.recordDrop(FrameDropCause::WINDOW_LOCK_FAILED, frame);
+    return false;
+  }
+  // The GPU waits for the compositor's release and the compositor for the
+  // GPU's writes; the render thread waits for neither where fences cross.
+  int doneFence = -1;
+  if (!vulkanConverter_->convert(frame, buffer, releaseFence, doneFence)) {
+    ULOGE("Vulkan conversion failed for frame %u", frame->sequence);
+    streamingStats_.videoRender.framesConcealed.add();
+    presenter_->unlock();
+    return false;
+  }
+  timeline.convertedNs = steady_clock::now().time_since_epoch().count();
+  TRACE_SCOPE("postBuffer");
+  presenter_->setTransform(transform_.load(std::memory_order_relaxed));
+  presenter_->present(frame, timeline.captureNs, doneFence);
+  return true;
+}
+
+bool UsbVideoStreamer::renderToWindowBuffer(
+    uvc_frame_t* frame,
+    bool logBufferInfo,
+    FrameTimeline& timeline,
+    const MjpegDecodePool::Decoded* decoded) {
+  ANativeWindow* preview_window = previewWindow_;
+  FrameCrop crop = crop_.load(std::memory_order_relaxed);
+  if (crop != appliedCrop_) {
+    appliedCrop_ = crop;
+    frameConverter_.setCrop(crop);
+    // The next buffers come at the crop's size.
+    if (presenter_ == nullptr && !cpuScaling_) {
+      setWindowGeometry(frameConverter_.windowFormat());
+    }
+  }
+  ANativeWindow_Buffer buffer;
+  // Rows of a partial update, when the window kept the others.
+  int32_t dirtyFirstRow = 0;
+  int32_t dirtyRows = 0;
+  // The rows slice conversion did ahead count for this frame only.
+  bool sliced = slice_.locked;
+  int32_t slicedRows = 0;
+  // Slicing locks the window buffer itself.
+  bool renderAhead = presenter_ == nullptr && !slicing_ &&
+      renderAheadEnabled_.load(std::memory_order_relaxed) &&
+      fastPaths_.allows(FAST_PATH_RENDER_AHEAD);
+  if (!renderAhead) {
+    renderAhead_ = nullptr;
+  } else if (renderAhead_ == nullptr) {
+    renderAhead_ = std::make_unique<RenderAheadWindow>(preview_window);
+  }
+  RenderAheadWindow::Target aheadTarget = RenderAheadWindow::Target::NONE;
+  if (sliced) {
+    buffer = slice_.buffer;
+    slice_.locked = false;
+    if (slice_.converting && frame->sequence == slice_.sequence && frame->data == slice_.data) {
+      slicedRows = slice_.rows;
+    }
+  } else if (presenter_ != nullptr) {
+    TRACE_SCOPE("lockBuffer");
+    // All buffers queued or on screen: the compositor is behind, drop this one.
+    int64_t lockStartNs = steady_clock::now().time_since_epoch().count();
+    bool locked = presenter_->lock(&buffer);
+    timeline.windowLockNs = steady_clock::now().time_since_epoch().count() - lockStartNs;
+    if (!locked) {
+      stats_.recordDrop(FrameDropCause::WINDOW_LOCK_FAILED, frame);
+      return false;
+    }
+  } else if (renderAhead) {
+    bool lockFailed = false;
+    aheadTarget = renderAhead_->acquire(&buffer, timeline.windowLockNs, lockFailed);
+    if (lockFailed) {
+      // Some compositors accept the YV12 geometry and only fail to allocate.
+      if (frameConverter_.windowFormat() == FrameConverter::kYv12WindowFormat) {
+        fallBackToRgbWindow();
+      }
+      renderAhead_->retry();
+    }
+    if (aheadTarget == RenderAheadWindow::Target::NONE) {
+      stats_.recordDrop(FrameDropCause::WINDOW_LOCK_FAILED, frame);
+      return false;
+    }
+  } else {
+    TRACE_SCOPE("lockBuffer");
+    // Only the rows that changed are redrawn; the window copies the rest
+    // back from the buffer posted before, and may widen the bounds to the
+    // whole buffer when it cannot.
+    FrameChangeDetector::RowBand band;
+    ARect dirty{};
+    // A label that changed is redrawn wherever the frame did not.
+    bool partial = decoded == nullptr && changeDetector_.dirtyRows(frame, band) &&
+        overlay_.revision() == overlayPosted_;
+    if (partial) {
+      dirty = {0, band.first, ANativeWindow_getWidth(preview_window), band.first + band.count};
+    }
+    int64_t lockStartNs = steady_clock::now().time_since_epoch().count();
+    auto status = ANativeWindow_lock(preview_window, &buffer, partial ? &dirty : nullptr);
+    // Some compositors accept the YV12 geometry and only fail to allocate.
+    if (status != 0 && frameConverter_.windowFormat() == FrameConverter::kYv12WindowFormat &&
+        fallBackToRgbWindow()) {
+      partial = false;
+      status = ANativeWindow_lock(preview_window, &buffer, nullptr);
+    }
+    timeline.windowLockNs = steady_clock::now().time_since_epoch().count() - lockStartNs;
+    if (status != 0) {
+      ULOGE("ANativeWindow_lock failed with error %d", status);
+      stats_.recordDrop(FrameDropCause::WINDOW_LOCK_FAILED, frame);
+      return false;
+    }
+    if (partial && (dirty.top > 0 || dirty.bottom < buffer.height)) {
+      dirtyFirstRow = std::max(dirty.top, 0) & ~1;
+      dirtyRows = std::min(dirty.bottom, buffer.height) - dirtyFirstRow;
+    }
+  }
+  // The converter blends the label into the rows it writes, decoded frames
+  // included; the others kept it from the buffer posted before.
+  auto post = [&] {
+    TRACE_SCOPE("postBuffer");
+    if (presenter_ != nullptr) {
+      presenter_->setTransform(transform_.load(std::memory_order_relaxed));
+      presenter_->present(frame, timeline.captureNs);
+    } else if (renderAhead) {
+      // A frame left for the next window buffer counts as posted here.
+      if (renderAhead_->post()) {
+        stats_.recordDrop(FrameDropCause::WINDOW_LOCK_FAILED, &renderedAheadFrame_);
+      }
+      if (aheadTarget == RenderAheadWindow::Target::PRIVATE) {
+        renderedAheadFrame_ = *frame;
+      }
+    } else {
+      ANativeWindow_unlockAndPost(preview_window);
+    }
+  };
+  // Leaves the last good frame on screen in place of one that failed to
+  // convert, rather than posting what the converter left in the buffer.
+  auto conceal = [&] {
+    TRACE_SCOPE("concealFrame");
+    streamingStats_.videoRender.framesConcealed.add();
+    if (presenter_ != nullptr) {
+      presenter_->unlock();
+      return;
+    }
+    if (aheadTarget == RenderAheadWindow::Target::PRIVATE) {
+      renderAhead_->discard();
+      return;
+    }
+    // A window buffer cannot be unlocked without posting it, so it gets the
+    // last good frame again, straight from the pool.
+    if (lastGoodFrame_ != nullptr) {
+      frameConverter_.convert(lastGoodFrame_, buffer);
+    }
+    if (renderAhead) {
+      renderAhead_->post();
+      return;
+    }
+    ANativeWindow_unlockAndPost(preview_window);
+  };
+
+  if (logBufferInfo) {
+    ULOGE(
+        "Display buffer format: %d  stride: %d %dx%d",
+        buffer.format,
+        buffer.stride,
+        buffer.width,
+        buffer.height);
+  }
+
+  // The window format is resolved in configureOutput(); only a format change
+  // after that needs a lookup.
+  if (buffer.format != frameConverter_.windowFormat() ||
+      frame->frame_format != frameConverter_.frameFormat()) {
+    frameConverter_.configure(frame->frame_format, buffer.format);
+  }
+  if (decoded != nullptr) {
+    TRACE_SCOPE("copyDecoded");
+    // Later frames are decoded at the size the window hands out.
+    decodeWidth_ = buffer.width;
+    decodeHeight_ = buffer.height;
+    frameConverter_.copyRgba(
+        decoded->rgba, (int32_t)decoded->stride, decoded->width, decoded->height, buffer);
+  } else if (
+      dirtyRows > 0 && frame->width == (uint32_t)buffer.width &&
+      frame->height == (uint32_t)buffer.height && frameConverter_.convertsRows(frame, buffer)) {
+    if (!frameConverter_.convertRows(frame, buffer, dirtyFirstRow, dirtyRows)) {
+      conceal();
+      return false;
+    }
+    streamingStats_.videoRender.framesPartial.add();
+  } else if (slicedRows > 0 && frameConverter_.convertsRows(frame, buffer)) {
+    if (!frameConverter_.convertRows(frame, buffer, slicedRows, buffer.height - slicedRows)) {
+      conceal();
+      return false;
+    }
+  } else if (!frameConverter_.convert(frame, buffer)) {
+    conceal();
+    return false;
+  } else if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+    stats_.recordDecodeSetup(frameConverter_.mjpegDecoder().lastSetupTime());
+  }
+  overlayPosted_ = overlay_.revision();
+  if (decoded == nullptr) {
+    renderScratchBytes_.store(frameConverter_.scratchBytes(), std::memory_order_relaxed);
+    if (frame != lastGoodFrame_) {
+      uvc_retain_frame(frame);
+      if (lastGoodFrame_ != nullptr) {
+        uvc_release_frame(lastGoodFrame_);
+      }
+      lastGoodFrame_ = frame;
+    }
   }
+  timeline.convertedNs = steady_clock::now().time_since_epoch().count();
+  if (buffer.format == AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM ||
+      buffer.format == AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM) {
+    secondaryPreviews_.present(buffer, frame->sequence, timeline.convertedNs);
+  }
+  post();
+  return true;
 }
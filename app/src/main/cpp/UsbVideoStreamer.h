@@ -16,51 +16,192 @@
 
 #pragma once
 
+#include <android/data_space.h>
+#include <android/hardware_buffer.h>
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
 #include <libusb/libusb.h>
 #include <libuvc/libuvc.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "BitmapSnapshot.h"
+#include "Colorimetry.h"
+#include "ConversionBalancer.h"
+#include "Demosaic.h"
+#include "DepthColorizer.h"
+#include "DeviceClock.h"
+#include "FastPaths.h"
+#include "FrameChangeDetector.h"
+#include "FrameConverter.h"
+#include "FrameCrop.h"
+#include "FrameEventQueue.h"
+#include "FrameFanout.h"
+#include "FrameLatencyStats.h"
+#include "FrameLogPlayer.h"
+#include "FrameLogRecorder.h"
+#include "InstantReplay.h"
+#include "JpegSnapshot.h"
+#include "JitterBuffer.h"
+#include "FrameServer.h"
+#include "FramePairer.h"
+#include "FrameSynchronizer.h"
+#include "FrameTap.h"
+#include "GlPreviewRenderer.h"
+#include "MediaCodecDecoder.h"
+#include "MjpegDecodePool.h"
+#include "MjpegRecorder.h"
+#include "MotionDetector.h"
+#include "NegotiationCache.h"
+#include "RateMeter.h"
+#include "RenderAheadWindow.h"
+#include "RtpSender.h"
+#include "SecondaryPreviews.h"
+#include "SlowFrameRecorder.h"
+#include "SpscQueue.h"
+#include "StillCapture.h"
+#include "StreamRecorder.h"
+#include "StreamerState.h"
+#include "StreamingStats.h"
+#include "StripeWorkerPool.h"
+#include "TaskScheduler.h"
+#include "SurfaceControlPresenter.h"
+#include "TextOverlay.h"
+#include "ThreadPolicy.h"
+#include "UsbSession.h"
+#include "UvcDevice.h"
+#include "UvcEncoderControl.h"
+#include "VulkanConverter.h"
+
 using namespace std::chrono;
 
+// What the capture thread does when the render queue is full.
+enum class FrameDropPolicy : int {
+  DROP_OLDEST, // evict the oldest queued frame to make room for the new one
+  BLOCK, // wait for the render thread, letting libuvc drop frames upstream
+  LATEST_ONLY, // replace whatever is queued, so only the newest frame is rendered
+};
+
+// Why a captured frame never reached the screen.
+enum class FrameDropCause : uint8_t {
+  DECODE_BUSY, // superseded while the render thread or video decoder was busy
+  WINDOW_LOCK_FAILED, // no window or presenter buffer could be locked
+  INVALID_SIZE, // payload size does not match the negotiated format
+  COUNT,
+};
+static_assert((size_t)FrameDropCause::COUNT == kVideoDropCauses);
+
+class AvSync;
+
+// Trades frame rate for CPU time and wakeups when streaming video.
+struct PowerProfile {
+  bool enabled{false};
+  // Frames per second to deliver: the camera runs at its slowest rate at or
+  // above it, up to the requested one, and every Nth frame is rendered when
+  // that is still faster. Zero keeps the requested rate.
+  int32_t targetFps{};
+  // Fills CPU preview buffers as dithered RGB565, half the bytes RGBA
+  // writes and the compositor reads, for thumbnails and other small views.
+  bool rgb565Preview{false};
+};
+
 struct UsbVideoStreamerStats {
-  u_int64_t total_bytes = 0;
-  uint16_t usb_cb_counter = 0;
-  uint16_t frames = 0;
+  // Rendered frames in the 10 second log window.
+  uint64_t frames = 0;
   steady_clock::time_point lastFpsUpdate{0s};
-  uint8_t fps = 0; // memoize value of current FPS when second rolls over
-  uint8_t currentFps = 0;
-  steady_clock::time_point t0{high_resolution_clock::now()};
-
-  steady_clock::time_point captureRenderClock_{high_resolution_clock::now()};
-  nanoseconds capture_{0ns};
-  nanoseconds render_{0ns};
-
-  void recordCapture() {
-    auto now = high_resolution_clock::now();
-    capture_ += (now - captureRenderClock_);
-    captureRenderClock_ = now;
+  RateMeter frameRate{};
+
+  // CPU time of the capture and render threads at the last periodic log.
+  uint64_t loggedCaptureCpuNs_{0};
+  uint64_t loggedRenderCpuNs_{0};
+  // usbfs submit and reap ioctls of the process at the last periodic log.
+  uint64_t loggedUrbIoctls_{0};
+
+  // Time frames spent in the capture -> render queue.
+  nanoseconds queueDelay_{0ns};
+  nanoseconds maxQueueDelay_{0ns};
+  // Drop totals at the last takeDrops(), the totals live in StreamingStats.
+  std::array<uint64_t, kVideoDropCauses> loggedDrops_{};
+  StreamingStats* streamingStats{&StreamingStats::shared()};
+
+  // Null for a stats block that is not a session's.
+  FrameEventQueue* frameEvents{nullptr};
+
+  // Called from both the capture and render threads.
+  void recordDrop(FrameDropCause cause, const uvc_frame_t* frame) {
+    streamingStats->videoDrops.drops[(size_t)cause].addShared();
+    recordEvent(FrameEventKind::DROPPED, frame, (uint8_t)cause);
+  }
+
+  // Queues an event for the app while it reads them. Any thread.
+  void recordEvent(
+      FrameEventKind kind,
+      const uvc_frame_t* frame,
+      uint8_t cause = 0,
+      uint32_t latencyUs = 0,
+      const LumaStats* luma = nullptr) {
+    if (frameEvents == nullptr || !frameEvents->isOpen()) {
+      return;
+    }
+    FrameEvent event;
+    event.timeNs = steady_clock::now().time_since_epoch().count();
+    event.captureTimeNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+        frame->capture_time_finished.tv_nsec;
+    event.sequence = frame->sequence;
+    event.bytes = frame->data_bytes;
+    event.latencyUs = latencyUs;
+    event.kind = kind;
+    event.cause = cause;
+    if (luma != nullptr) {
+      event.lumaMean = (uint16_t)std::lround(luma->mean() * 256);
+      event.lumaDark = (uint16_t)std::lround(luma->darkClipped() * 65535);
+      event.lumaBright = (uint16_t)std::lround(luma->brightClipped() * 65535);
+    }
+    frameEvents->push(event);
   }
 
-  void recordRender() {
-    auto now = high_resolution_clock::now();
-    render_ += (now - captureRenderClock_);
-    captureRenderClock_ = now;
+  // Drops since the last call. Render thread only.
+  uint32_t takeDrops(FrameDropCause cause) {
+    uint64_t total = streamingStats->videoDrops.drops[(size_t)cause].load();
+    uint32_t drops = total - loggedDrops_[(size_t)cause];
+    loggedDrops_[(size_t)cause] = total;
+    return drops;
   }
 
-  void recordFrame() {
-    currentFps++;
-    auto now = high_resolution_clock::now();
-    if (now - t0 >= 1s) {
-      t0 = now;
-      fps = currentFps;
-      currentFps = 0;
+  // Per-frame MJPEG decoder setup, excluding the decode itself.
+  nanoseconds decodeSetup_{0ns};
+
+  void recordDecodeSetup(nanoseconds setup) {
+    decodeSetup_ += setup;
+  }
+
+  void recordQueueDelay(nanoseconds delay) {
+    queueDelay_ += delay;
+    maxQueueDelay_ = std::max(maxQueueDelay_, delay);
+  }
+
+  // Returns true once a second, after publishing the frame rates.
+  bool recordFrame(steady_clock::time_point now) {
+    streamingStats->videoRender.frames.add();
+    if (!frameRate.add(1, now)) {
+      return false;
     }
+    RateMeter::Snapshot rate = frameRate.snapshot();
+    streamingStats->videoRender.fps.set(std::llround(rate.windowRate));
+    streamingStats->videoRender.fpsSmoothedMilli.set(std::llround(rate.smoothedRate * 1000));
+    return true;
   }
 };
 
@@ -71,30 +212,514 @@ struct CaptureFrameCallbackData {
 
 class UsbVideoStreamer final {
  public:
+  // Frames this tall are converted in parallel stripes on the CPU path.
+  static constexpr int32_t kParallelConversionMinHeight = 1440;
+  // Window buffer format for the CPU path. Opaque, so the compositor does not
+  // blend the preview.
+  static constexpr int32_t kPreviewWindowFormat = AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+  // Window buffer format of 10 bit streams with an HDR data space.
+  static constexpr int32_t kHdrWindowFormat = AHARDWAREBUFFER_FORMAT_R10G10B10A2_UNORM;
+  // MJPEG streams of at least this many pixels per second are decoded on
+  // several workers unless setMjpegDecodeWorkers() picks the count.
+  static constexpr int64_t kParallelDecodeMinPixelRate = 1920 * 1080 * 50;
+  static constexpr size_t kMaxMjpegDecodeWorkers = 4;
+  // libuvc frame buffers beyond the frame queue's, unless set through
+  // setTransferOptions().
+  static constexpr uint32_t kPoolFramesBesidesQueue = 5;
+  // libuvc frame buffers in pull mode unless set through
+  // setTransferOptions(): the one being filled, one waiting and two held.
+  static constexpr uint32_t kPullModePoolFrames = 4;
+  // A start with a cached stream control that shows no frame this long and
+  // is stopped evicts the entry.
+  static constexpr nanoseconds kFirstFrameTimeout = 2s;
+  // Once frames flowed, StreamWatchdog restarts a stream without one for
+  // this long, or kStallFrameIntervals frame intervals if longer, and gives
+  // up after kMaxStallRestarts restarts without a frame in between.
+  static constexpr nanoseconds kStallTimeout = 1s;
+  static constexpr int64_t kStallFrameIntervals = 5;
+  static constexpr uint32_t kMaxStallRestarts = 3;
+
+  // Bus time each USB transfer covers under the power profile, unless
+  // setTransferOptions() sizes them.
+  static constexpr uint32_t kPowerProfileTransferUs = 16'000;
+  // How long the render thread sleeps with an empty queue.
+  static constexpr milliseconds kRenderIdleWait = 10ms;
+  static constexpr milliseconds kPowerProfileRenderIdleWait = 100ms;
+  // Headless, frames wake the render thread only for its consumers; the
+  // timeout is left to publish the thread and memory usage.
+  static constexpr milliseconds kHeadlessRenderIdleWait = 1000ms;
+  // Paused, nothing arrives until resume() and its frames wake the thread.
+  static constexpr milliseconds kPausedRenderIdleWait = 1000ms;
+  // Slice conversion hears from libuvc this many times per frame.
+  static constexpr uint32_t kSliceBands = 8;
+
   static void captureFrameCallback(uvc_frame_t* frame, void* user_data);
+  // Takes effect for streamers created afterwards.
+  static void setPowerProfile(const PowerProfile& powerProfile);
+  // Bitrate and keyframe interval of H.264 and H.265 cameras, applied by
+  // every start() from now on.
+  static void setEncoderSettings(const UvcEncoderControl::Settings& settings);
   UsbVideoStreamer(
       intptr_t deviceFD,
       int32_t width,
       int32_t height,
       int32_t fps,
-      uvc_frame_format uvcFrameFormat);
+      uvc_frame_format uvcFrameFormat,
+      uint32_t frameQueueDepth = 2,
+      FrameDropPolicy frameDropPolicy = FrameDropPolicy::DROP_OLDEST,
+      StreamingStats& streamingStats = StreamingStats::shared());
+  // Streams the VideoStreaming interface interfaceNumber of a camera whose
+  // other interfaces other streamers may use; -1 takes the first one with
+  // the format.
+  UsbVideoStreamer(
+      std::shared_ptr<UvcDevice> device,
+      int32_t interfaceNumber,
+      int32_t width,
+      int32_t height,
+      int32_t fps,
+      uvc_frame_format uvcFrameFormat,
+      uint32_t frameQueueDepth = 2,
+      FrameDropPolicy frameDropPolicy = FrameDropPolicy::DROP_OLDEST,
+      StreamingStats& streamingStats = StreamingStats::shared());
+  // Replays a frame log from player through the capture callback and
+  // preview instead of streaming a camera. There is no device: format
+  // switches and stills are unavailable.
+  UsbVideoStreamer(
+      std::unique_ptr<FrameLogPlayer> player,
+      const FrameLogPlayer::Options& replayOptions,
+      uint32_t frameQueueDepth = 2,
+      FrameDropPolicy frameDropPolicy = FrameDropPolicy::DROP_OLDEST,
+      StreamingStats& streamingStats = StreamingStats::shared());
   ~UsbVideoStreamer();
+  // Scale frames to the window size with libyuv instead of leaving it to the
+  // compositor. Takes effect on the next configureOutput().
+  void setCpuScaling(bool cpuScaling);
+  // Send NV12, YUYV and UYVY frames to YV12 window buffers with a plane copy
+  // and let the compositor convert them. Falls back to the RGB path when the
+  // window does not take YV12. Takes effect on the next configureOutput().
+  void setNativeYuvOutput(bool nativeYuvOutput);
+  // Present CPU converted frames as AHardwareBuffers on an ASurfaceControl,
+  // paced by the frames' PTS, instead of through the window's BufferQueue.
+  // Takes effect on the next configureOutput().
+  void setSurfaceControlPresentation(bool surfaceControlPresentation);
+  // Transfer geometry for libuvc, zero fields sized from the stream format and
+  // bus speed. Takes effect on the next start().
+  void setTransferOptions(const uvc_stream_options_t& transferOptions);
+  // Run the frame callback on the USB event thread instead of a libuvc thread,
+  // saving a wakeup per frame. Ignored with FrameDropPolicy::BLOCK, which can
+  // wait in the callback. Takes effect on the next start().
+  void setInlineFrameCallback(bool inlineFrameCallback);
+  // Leave frames in libuvc's pool for acquireFrame() instead of rendering
+  // them: no callback or render thread runs, and frames the consumer does not
+  // take in time are dropped before any copy. The preview, decoders and
+  // consumers see nothing, and StreamWatchdog leaves the stream alone since
+  // the consumer sets the pace. Not with frame log replay. Takes effect on
+  // the next start().
+  void setPullMode(bool pullMode);
+  // Pull mode only: the oldest completed frame, held exclusively until
+  // releaseFrame(), or nullptr after timeout (0 returns right away) or when
+  // the stream is not running. Every frame must be released before stop().
+  uvc_frame_t* acquireFrame(microseconds timeout);
+  void releaseFrame(uvc_frame_t* frame);
+  // Let the render thread pass over MJPEG frames that have a newer one queued
+  // behind them instead of decoding each, on by default. validateSkipped
+  // scans the skipped frames with libyuv::ValidateJpeg so corrupt ones are
+  // still counted as such. Ignored with FrameDropPolicy::BLOCK.
+  void setMjpegDecodeSkipping(bool enabled, bool validateSkipped);
+  // Skips converting and posting frames that look like the last one shown,
+  // for static scenes; the count is the framesUnchanged render counter.
+  // With partial updates, the CPU path redraws only the rows that changed.
+  // Ignored with slice conversion, and for compressed formats. Takes effect
+  // from the next frame.
+  void setChangeDetection(const FrameChangeDetector::Config& config);
+  // Decode MJPEG frames on this many workers at once, presenting them in
+  // capture order, on the CPU path. 0 picks one per performance core, up to
+  // kMaxMjpegDecodeWorkers, for streams of kParallelDecodeMinPixelRate and
+  // single threaded decoding below it; 1 decodes on the render thread. Takes
+  // effect on the next configureOutput().
+  void setMjpegDecodeWorkers(uint32_t workers);
+  // Decode MJPEG with the vendor's hardware decoder through AMediaCodec,
+  // straight into the window, when the device has one; the CPU decoders
+  // otherwise. Takes effect on the next configureOutput().
+  void setHardwareMjpegDecoding(bool hardwareMjpegDecoding);
+  // Decode MJPEG on the GL preview instead: Huffman decoding on the render
+  // thread, the inverse DCT and color conversion in a GLES 3.1 compute
+  // shader, see GlPreviewRenderer. Hardware decoding goes first when both are
+  // on, and the CPU decoders without a GLES 3.1 context. Frames that are not
+  // baseline JPEGs, which UVC cameras do not send, are not shown. Takes
+  // effect on the next configureOutput().
+  void setGpuMjpegDecoding(bool gpuMjpegDecoding);
+  // Convert YUYV, NV12 and P010 previews in a Vulkan compute shader, see
+  // VulkanConverter, in place of the GL preview, presenting through
+  // SurfaceControl. Frames with a crop, label or white balance still convert
+  // on the CPU, and recording, which needs the GL preview, is unavailable.
+  // Off by default. Takes effect on the next configureOutput().
+  void setVulkanConversion(bool vulkanConversion);
+  // Deinterlace YUYV and UYVY streams whose format descriptor reports both
+  // fields woven into each frame with mode, or every such stream when
+  // forced, for capture cards that leave bmInterlaceFlags clear. CPU path
+  // only. ADAPTIVE and unforced by default. Takes effect on the next
+  // configureOutput().
+  void setDeinterlace(DeinterlaceMode mode, bool forced);
+  // Undistort frames with lens on the GL preview and on the CPU path into
+  // RGBA windows, the latter then decoding MJPEG on the render thread only.
+  // Takes effect on the next configureOutput().
+  void setLensCorrection(const LensCalibration& lens);
+  // Burn a timestamp and/or watermark into the GL preview and its recording,
+  // and into RGBA windows on the CPU path; not into frames MediaCodec
+  // decodes. Takes effect on the next configureOutput().
+  void setOverlay(const OverlayConfig& config);
+  // Gather a luma histogram, mean and clipping of YUYV, UYVY and NV12 frames
+  // while the CPU path converts them, attached to their RENDERED events and
+  // kept for latestLumaStats(). Takes effect from the next frame.
+  void setLumaStats(bool enabled);
+  // Of the latest frame measured; false when there is none.
+  bool latestLumaStats(LumaStats& stats);
+  // Convert uncompressed frames into a window buffer locked while libuvc is
+  // still assembling them, band by band as their rows arrive, so conversion
+  // overlaps the transfer. CPU window path only, not with the power profile
+  // or a frame log player. Takes effect on the next start().
+  void setSliceConversion(bool sliceConversion);
+  // Locks the preview window's buffers ahead on a thread of their own, so
+  // the render thread converts into a private buffer instead of waiting when
+  // the compositor is behind, see RenderAheadWindow. CPU window path only,
+  // without partial updates; not while slice conversion runs. Takes effect
+  // from the next frame.
+  void setRenderAhead(bool renderAhead);
+  // Holds arrived frames back by one to three frame intervals in a
+  // JitterBuffer and presents them at an even cadence, from the device clock
+  // when it is recovered, trading latency for smooth motion. Not with slice
+  // conversion. Takes effect on the next start().
+  void setSmoothPlayback(bool smoothPlayback);
+  // Dumps the stage timings of the last frames to logcat when one takes
+  // longer than this many frame intervals from USB completion to post, see
+  // SlowFrameRecorder. 0, the default, turns it off. From the next frame.
+  void setSlowFrameBudget(float frameIntervals);
+  // Converts P010 frames on the CPU into R10G10B10A2 window buffers tagged
+  // with dataSpace, an ADataSpace such as ADATASPACE_BT2020_PQ, keeping all
+  // 10 bits and the HDR signal for the compositor to tone map. Falls back to
+  // 8 bit RGB when the window refuses either. ADATASPACE_UNKNOWN turns it
+  // off. Takes effect from the next configureOutput() or reconfigure().
+  void setHdrDataSpace(int32_t dataSpace);
+  // Shows only crop of the frames, a digital zoom, converting or decoding
+  // nothing outside it. Window buffers take the crop's size and the
+  // compositor scales them, unless CPU scaling or SurfaceControl presentation
+  // scales the crop into them. The GL preview shows whole frames. Takes
+  // effect from the next frame.
+  void setCrop(const FrameCrop& crop);
+  // Gains raw Bayer frames are white balanced with, on the CPU and GPU
+  // alike. Takes effect from the next frame.
+  void setWhiteBalance(const WhiteBalance& whiteBalance);
+  // The depths of Z16 streams shown and the palette they are colored with
+  // on the CPU preview path. Takes effect from the next frame.
+  void setDepthRange(const DepthRange& range);
+  // Rotates the preview clockwise by rotation degrees, a multiple of 90,
+  // after mirroring it, for cameras mounted sideways or facing the user. The
+  // compositor applies it as the window's buffer transform, so no backend
+  // spends a pass over the frame on it. Returns false for other rotations.
+  bool setOrientation(int32_t rotation, bool mirrorHorizontal, bool mirrorVertical);
+  // Also shows the stream in window, at its own size and at most maxFps
+  // frames per second, 0 for every frame, scaled from the frames converted
+  // for the preview; see SecondaryPreviews. Returns false when it was
+  // already added.
+  bool addSecondaryPreview(ANativeWindow* window, int32_t maxFps);
+  bool removeSecondaryPreview(ANativeWindow* window);
   bool configureOutput(ANativeWindow* previewWindow);
+  // Shows the stream in window from the next frame on, or in no window when
+  // null, without stopping or renegotiating it: recorders, taps, stills and
+  // the frame server keep getting every frame. While streaming the render
+  // thread switches between two frames, and this returns once it let go of
+  // the old window, which the caller may then release. False before
+  // configureOutput().
+  bool setPreviewWindow(ANativeWindow* window);
+  // Switches the open stream to another format on the same device handle:
+  // stops it, probes and commits the new format, rebuilds the preview
+  // backends and restarts it if it was running. libuvc reuses its transfer
+  // and frame buffers when they are large enough. Stops the frame tap and
+  // MJPEG recording; fails while recording. The old format is kept when the
+  // new one cannot be negotiated.
+  bool reconfigure(int32_t width, int32_t height, int32_t fps, uvc_frame_format uvcFrameFormat);
+  // Streams the camera's cheapest uncompressed mode first, see
+  // ModeSelector::cheapest(), so a frame is on screen a couple of frame
+  // intervals after start(), and leaves the requested mode to
+  // finishFastStart(). The cheap mode's control block is cached like any
+  // other, so later fast starts skip its probe. Not headless, in pull mode or
+  // with frame log replay. Takes effect on the next configureOutput().
+  void setFastStart(bool fastStart);
+  // A fast start streams the cheap mode and has finishFastStart() ahead.
+  bool isFastStarting() const;
+  // Waits up to timeout for the first frame since start() to be shown;
+  // false when none was.
+  bool awaitFirstFrame(nanoseconds timeout);
+  // Switches a fast start to the requested mode with reconfigure(), keeping
+  // the cheap one when that fails. True when no fast start was pending.
+  bool finishFastStart();
+  // Moves the open stream to device, the same camera opened again after it
+  // was lost: stops the stream, reopens it there with the committed control
+  // block and restarts it if it was running. The backends, preview window
+  // and consumers stay, and libuvc takes its frame buffers from the stash;
+  // still capture has to be enabled again. False for another camera.
+  bool reattach(std::shared_ptr<UvcDevice> device);
+  // Called at most once per start, on the USB event thread, when a transfer
+  // finds the device gone. It must return right away. Before
+  // configureOutput().
+  void setDeviceLostListener(std::function<void()> listener);
+  // A transfer found the device gone since the stream last started.
+  bool isDeviceLost() const;
+  // Finishes a stop still pending from requestStop() first.
   bool start();
+  // Cancels the transfers and tells the render thread to exit without
+  // waiting for either; the streamer is STOPPING until finishStop(). Returns
+  // false when it was not started.
+  bool requestStop();
+  // Waits for what requestStop() cancelled, joins the capture and render
+  // threads and moves to READY_TO_START.
+  bool finishStop();
   bool stop();
+  // Cancels the transfers of a STARTED camera stream but keeps their
+  // buffers, the frame pool, the committed stream control, decoders and the
+  // render thread, and sets altsetting 0 so the bus gets its bandwidth back
+  // and the camera idles. The streamer stays STARTED and running; resume()
+  // only resubmits the transfers. False for replays, pulled streams and
+  // streams not started or already paused.
+  bool pause();
+  // Resumes a paused stream, or start()s one that is not paused.
+  bool resume();
+  bool isPaused() const {
+    return transfersPaused_;
+  }
   bool isRunning() const;
+  StreamerState state() const;
+  // Draws every previewed frame into recorder's input window as well, so
+  // recording shares the preview's capture and upload. Needs the GL preview,
+  // used for raw NV12 and YUYV streams. detachRecorder() returns once no
+  // frame is being drawn into it.
+  bool attachRecorder(StreamRecorder* recorder);
+  void detachRecorder();
+  // Writes the camera's JPEG frames unchanged to an AVI file at fd, which the
+  // caller keeps open until stopMjpegRecording(). MJPEG streams only.
+  bool startMjpegRecording(int fd);
+  bool stopMjpegRecording();
+  // Sends the camera's H.264 or H.265 frames to sink as they arrive, from the
+  // capture thread. The sink's keyframe requests go to the camera's encoder,
+  // see requestKeyframe(). Fails for other formats; null detaches.
+  bool setNetworkSink(std::shared_ptr<RtpSender> sink);
+  // Asks an H.264, H.265 or VP8 camera for a key frame, as every start() and the
+  // video decoder after lost input do. False when the camera has no encoder
+  // controls or was just asked. Any thread; reason is a string literal.
+  bool requestKeyframe(const char* reason);
+  // Appends every captured frame to a frame log at fd for FrameLogPlayer,
+  // which the caller keeps open until stopFrameLog().
+  bool startFrameLog(int fd);
+  bool stopFrameLog();
+  // Keeps the camera's MJPEG, H.264 or H.265 frames in replay as they
+  // arrive, from the capture thread. Fails for other formats; null detaches.
+  bool setInstantReplay(std::shared_ptr<InstantReplay> replay);
+  // Shows every frame the render thread takes to detector, headless or not,
+  // across format switches; null detaches it.
+  void setMotionDetector(std::shared_ptr<MotionDetector> detector);
+  // The mode MotionStandby idles the camera in: the fewest pixels of YUYV
+  // or NV12 on the stream's interface, at the slowest rate from minFps on.
+  bool standbyMode(int32_t minFps, NegotiationCache::Mode& mode) const;
+  // Publishes converted copies of captured frames for consumers such as ML
+  // models, see FrameTap. Buffers stay valid until stopFrameTap().
+  bool startFrameTap(const FrameTap::Config& config);
+  void stopFrameTap();
+  // Fills buffers with the tap's buffer addresses and returns their capacity,
+  // or 0 when no tap of plain memory is running.
+  size_t frameTapBuffers(std::vector<uint8_t*>& buffers);
+  // The same for a tap of hardware buffers, which are released with it.
+  size_t frameTapHardwareBuffers(std::vector<AHardwareBuffer*>& buffers);
+  int32_t acquireTappedFrame(FrameTap::FrameInfo& info);
+  void releaseTappedFrame(int32_t index);
+  // Shares captured frames with other processes on the abstract socket
+  // @name, see FrameServer.
+  bool startFrameServer(const FrameServer::Config& config, const char* name);
+  void stopFrameServer();
+  // Negotiates width x height stills next to the stream, see StillCapture.
+  // Restarts a running stream of a method 2 camera to size its buffers; the
+  // stream's own format does not change. A format switch disables it.
+  bool enableStillCapture(int32_t width, int32_t height);
+  // Fills bitmap from the next previewed frame without delaying the
+  // preview, see BitmapSnapshot. Not for H.264 and H.265 streams.
+  bool requestSnapshot(JNIEnv* env, jobject bitmap, BitmapSnapshot::Callback done);
+  // Encodes the next captured frame to JPEG off the streaming threads, see
+  // JpegSnapshot. Not for H.264 and H.265 streams.
+  bool requestJpegSnapshot(
+      int32_t width,
+      int32_t height,
+      int32_t quality,
+      JpegSnapshot::Callback done);
+  // Triggers a still and returns without waiting for it; done gets it and
+  // must not call back into the streamer.
+  bool captureStill(StillCapture::Callback done);
+  int32_t captureWidth() const {
+    return captureFrameWidth_;
+  }
+  int32_t captureHeight() const {
+    return captureFrameHeight_;
+  }
+  int32_t captureFps() const {
+    return captureFrameFps_;
+  }
+  uvc_frame_format captureFrameFormat() const {
+    return captureFrameFormat_;
+  }
+  // PTS clock of the negotiated stream in Hz.
+  uint32_t clockFrequency() const {
+    return streamCtrl_.dwClockFrequency;
+  }
+  // Null when the device could not be opened.
+  const std::shared_ptr<UvcDevice>& device() const {
+    return device_;
+  }
+  // Offers every captured frame to pairer as its stream, 0 or 1, to match
+  // it with another stream of the camera. Before start().
+  void setFramePairer(std::shared_ptr<FramePairer> pairer, uint32_t stream);
+  const std::shared_ptr<FramePairer>& framePairer() const {
+    return framePairer_;
+  }
+  // Offers every rendered frame to synchronizer as its stream, with its host
+  // capture time, to match it with other cameras' frames. Before start().
+  void setFrameSynchronizer(std::shared_ptr<FrameSynchronizer> synchronizer, uint32_t stream);
+  const std::shared_ptr<FrameSynchronizer>& frameSynchronizer() const {
+    return frameSynchronizer_;
+  }
   std::string statsSummaryString() const;
+  // Native buffers of the stream by use.
+  std::string memorySummaryString() const;
+  // Frees the buffers the stream does not use right now, see
+  // uvc_stream_trim_buffers(), and the render scratch frames, which a running
+  // render thread frees before its next frame. Returns the bytes libuvc freed.
+  // On the thread that starts and stops the stream.
+  size_t trimMemory();
+  // Per stage latency percentiles since start(), see FrameLatencyStats.
+  std::vector<int64_t> latencyPercentiles();
 
  private:
-  uvc_context_t* uvcContext_{};
+  // Shared with the streamers of the camera's other streaming interfaces.
+  std::shared_ptr<UvcDevice> device_{};
   uvc_device_handle_t* deviceHandle_{};
   uvc_stream_ctrl_t streamCtrl_{};
   bool isStreamControlNegotiated_{false};
+  // streamCtrl_ came from NegotiationCache and has not been evicted.
+  bool cachedNegotiation_{false};
+  std::string negotiationKey_{};
+  NegotiationCache::Mode negotiationMode_{};
   uvc_stream_handle_t *streamHandle_{nullptr};
+  std::function<void()> deviceLostListener_{};
 
   ANativeWindow* previewWindow_{};
+  // No preview window, and no GL recording: the render thread only serves
+  // snapshots and secondary previews, converting nothing for a preview.
+  std::atomic<bool> headless_{false};
+  // GPU preview backend for raw YUV formats. When null, frames are converted
+  // on the CPU with libyuv into the locked window buffer.
+  std::unique_ptr<GlPreviewRenderer> glRenderer_{};
+  // Converts raw YUV frames into presenter_'s buffers instead of the GL
+  // preview when enabled and available.
+  std::unique_ptr<VulkanConverter> vulkanConverter_{};
+  // Moves preview conversion between glRenderer_ and the CPU when one of
+  // them falls behind. Render thread.
+  ConversionBalancer conversionBalancer_{};
+  // False while conversionBalancer_ has moved conversion to the CPU.
+  std::atomic<bool> gpuConversion_{true};
+  // Window formats only the CPU backends write.
+  bool cpuOnlyWindow_{false};
+  // Splits CPU conversion of tall frames across the performance cores. The
+  // pool is shared by every streamer in the process.
+  std::shared_ptr<StripeWorkerPool> stripeWorkers_{};
+  // Decodes H.264 and H.265 streams straight into the window. When set,
+  // none of the other backends are used.
+  std::unique_ptr<MediaCodecDecoder> videoDecoder_{};
+  // Replaces window buffer locking on the CPU path when enabled.
+  std::unique_ptr<SurfaceControlPresenter> presenter_{};
+  FrameConverter frameConverter_{};
+  // Held by the render thread while it draws a frame into recorder_.
+  std::mutex recorderMutex_;
+  StreamRecorder* recorder_{};
+  // Held by the capture thread while it hands a frame to mjpegRecorder_.
+  std::mutex mjpegRecorderMutex_;
+  std::unique_ptr<MjpegRecorder> mjpegRecorder_{};
+  // Held by the capture thread while it hands a frame to frameLogRecorder_.
+  std::mutex frameLogRecorderMutex_;
+  std::unique_ptr<FrameLogRecorder> frameLogRecorder_{};
+  // Held by the capture thread while it hands a frame to instantReplay_.
+  std::mutex instantReplayMutex_;
+  std::shared_ptr<InstantReplay> instantReplay_{};
+  // Held by the render thread while it hands a frame to motionDetector_.
+  std::mutex motionDetectorMutex_;
+  std::shared_ptr<MotionDetector> motionDetector_{};
+  // Held by the capture thread while it hands a frame to networkSink_.
+  std::mutex networkSinkMutex_;
+  std::shared_ptr<RtpSender> networkSink_{};
+  // Found by start() for frame based streams, null when the camera's
+  // encoder has no controls.
+  std::mutex encoderMutex_;
+  std::unique_ptr<UvcEncoderControl> encoder_{};
+  static std::atomic<UvcEncoderControl::Settings> defaultEncoderSettings_;
+  // Source of the frames instead of a device when replaying a frame log.
+  std::unique_ptr<FrameLogPlayer> player_{};
+  FrameLogPlayer::Options replayOptions_{};
+  // Conversions of the latest frame shared by frameTap_ and the snapshots.
+  FrameFanout fanout_{};
+  // Held by the capture thread while it offers a frame to frameTap_.
+  std::mutex frameTapMutex_;
+  std::unique_ptr<FrameTap> frameTap_{};
+  std::mutex frameServerMutex_;
+  std::unique_ptr<FrameServer> frameServer_{};
+  // Offered every frame the render thread posted.
+  BitmapSnapshot snapshot_{fanout_};
+  // Offered every frame the capture thread received.
+  JpegSnapshot jpegSnapshot_{fanout_};
+  SecondaryPreviews secondaryPreviews_{};
+  // Held by the capture thread while it offers a frame to stillCapture_.
+  std::mutex stillCaptureMutex_;
+  std::unique_ptr<StillCapture> stillCapture_{};
+  bool cpuScaling_{false};
+  bool nativeYuvOutput_{false};
+  bool surfaceControlPresentation_{false};
+  // FastPaths as of configureOutput(), for the rest of the session.
+  FastPaths::Selection fastPaths_{};
+  uvc_stream_options_t transferOptions_{};
+  // What the last start() submitted the transfers with, for resume().
+  uvc_stream_options_t startOptions_{};
+  uint8_t startFlags_{};
+  std::atomic<bool> transfersPaused_{false};
+  bool inlineFrameCallback_{false};
+  bool pullMode_{false};
+  std::atomic<bool> mjpegDecodeSkipping_{true};
+  std::atomic<bool> validateSkippedJpegs_{false};
+  FrameChangeDetector changeDetector_{};
+  static std::atomic<PowerProfile> defaultPowerProfile_;
+  const PowerProfile powerProfile_{defaultPowerProfile_.load()};
+  // Render one in decimation_ captured frames, counting in decimationCount_.
+  uint32_t decimation_{1};
+  uint32_t decimationCount_{};
+  std::shared_ptr<FramePairer> framePairer_{};
+  uint32_t framePairerStream_{};
+  std::shared_ptr<FrameSynchronizer> frameSynchronizer_{};
+  uint32_t frameSynchronizerStream_{};
+  // For time to first frame, logged once per start().
+  steady_clock::time_point createdAt_{steady_clock::now()};
+  steady_clock::time_point startedAt_{};
+  std::atomic<bool> firstFrameSeen_{false};
+  // Shown by the render thread, for awaitFirstFrame() and the render
+  // counters' time to first frame and to the requested mode.
+  std::atomic<bool> firstFrameShown_{false};
+  std::mutex firstShownMutex_;
+  std::condition_variable firstShownChange_;
+  bool firstFrameReported_{false};
+  bool fullQualityReported_{false};
+  // setFastStart(): fastStartTarget_ is the requested mode while
+  // fastStarting_ streams the cheap one.
+  bool fastStart_{false};
+  std::atomic<bool> fastStarting_{false};
+  NegotiationCache::Mode fastStartTarget_{};
+  // steady_clock time of the last frame, for checkStall().
+  std::atomic<int64_t> lastFrameNs_{0};
+  uint32_t stallRestarts_{0};
 
-  intptr_t deviceFD_;
   int32_t width_;
   int32_t height_;
   int32_t fps_;
@@ -105,5 +730,233 @@ class UsbVideoStreamer final {
   int32_t captureFrameFps_{};
   uvc_frame_format captureFrameFormat_{};
 
+  // Counters of this session, StreamingStats::shared() for the default one.
+  StreamingStats& streamingStats_;
+  // Only the session on the shared stats block takes part in A/V sync.
+  AvSync* avSync_{};
   UsbVideoStreamerStats stats_{};
+  FrameLatencyStats latencyStats_;
+  // Device to host clock mapping of the stream, render thread only.
+  DeviceClock deviceClock_;
+
+  // Capture -> render pipeline. Queued frames are borrowed from libuvc's pool
+  // and released by whichever thread takes them out of the queue.
+  SpscQueue<uvc_frame_t*> frameQueue_;
+  FrameDropPolicy frameDropPolicy_;
+  std::atomic<StreamerState> state_{StreamerState::INITIAL};
+  std::thread renderThread_{};
+  std::atomic<bool> rendering_{false};
+  std::mutex frameQueueMutex_;
+  std::condition_variable frameQueueChange_;
+  // A setPreviewWindow() the render thread has yet to apply, and whether one
+  // runs to apply it. Guarded by frameQueueMutex_.
+  ANativeWindow* pendingWindow_{};
+  std::atomic<bool> windowSwapPending_{false};
+  bool windowSwapsAccepted_{false};
+  std::condition_variable windowSwapped_;
+  // An attachRecorder() waiting for the render thread to move conversion
+  // back to the GPU. Guarded by frameQueueMutex_ like the window swap.
+  std::atomic<bool> gpuConversionPending_{false};
+  std::condition_variable gpuConversionRestored_;
+  bool isCaptureThreadNamed_{false};
+  uint32_t mjpegDecodeWorkers_{0};
+  bool hardwareMjpegDecoding_{false};
+  bool gpuMjpegDecoding_{false};
+  bool vulkanConversion_{false};
+  DeinterlaceMode deinterlaceMode_{DeinterlaceMode::ADAPTIVE};
+  bool deinterlaceForced_{false};
+  LensCalibration lens_{};
+  OverlayConfig overlayConfig_{};
+  // Render thread only once configured.
+  TextOverlay overlay_{};
+  // The label revision last blended into a CPU window buffer.
+  uint32_t overlayPosted_{};
+  std::mutex lumaStatsMutex_;
+  LumaStats latestLuma_{};
+  bool hasLuma_{false};
+  // Wakes the render thread through frameQueueChange_, so it comes after it.
+  std::unique_ptr<MjpegDecodePool> mjpegDecodePool_{};
+  // This stream's frames on the TaskScheduler that the stripe and decode
+  // jobs run on, set once either is used.
+  std::shared_ptr<TaskScheduler::Session> schedulerSession_{};
+  // Size the pool decodes to, that of the latest window buffer.
+  int32_t decodeWidth_{};
+  int32_t decodeHeight_{};
+  bool sliceConversion_{false};
+  std::atomic<bool> renderAheadEnabled_{false};
+  std::atomic<bool> smoothPlayback_{false};
+  // smoothPlayback_ as of start(), and the frames it holds. Render thread.
+  bool pacing_{false};
+  JitterBuffer jitterBuffer_{};
+  // Render thread, dropped with the window it locks.
+  std::unique_ptr<RenderAheadWindow> renderAhead_{};
+  // Header of the frame rendered ahead last, the one dropped when a newer
+  // frame replaces it. Render thread.
+  uvc_frame_t renderedAheadFrame_{};
+  SlowFrameRecorder slowFrames_{};
+  int32_t hdrDataSpace_{ADATASPACE_UNKNOWN};
+  // What the preview window's buffers are tagged with.
+  int32_t windowDataSpace_{ADATASPACE_UNKNOWN};
+  // Cleared by start() and new windows, set once the render thread asked for
+  // the frame rate.
+  std::atomic<bool> frameRateApplied_{false};
+  // From the negotiated format's color matching descriptor.
+  Colorimetry colorimetry_{};
+  std::atomic<FrameCrop> crop_{};
+  std::atomic<WhiteBalance> whiteBalance_{};
+  std::atomic<DepthRange> depthRange_{};
+  // What frameConverter_ and glRenderer_ were given. Render thread.
+  WhiteBalance appliedWhiteBalance_{};
+  DepthRange appliedDepthRange_{};
+  // ANativeWindowTransform from setOrientation().
+  std::atomic<int32_t> transform_{ANATIVEWINDOW_TRANSFORM_IDENTITY};
+  // What frameConverter_ and the window geometry were set up for. Render thread.
+  FrameCrop appliedCrop_{};
+  // Slice conversion for this start, and the window buffer locked for the
+  // frame libuvc is assembling. Render thread.
+  bool slicing_{false};
+  struct Slice {
+    bool locked{};
+    // False when the pair has no row converter; the frame converts on pop.
+    bool converting{};
+    uint32_t sequence{};
+    const void* data{};
+    size_t bytes{};
+    int32_t rows{};
+    ANativeWindow_Buffer buffer{};
+  };
+  Slice slice_{};
+  // frameConverter_'s scratch as of the last frame, and a trimMemory() for the
+  // render thread.
+  std::atomic<size_t> renderScratchBytes_{0};
+  std::atomic<bool> renderScratchTrim_{false};
+  // The last frame converted into a window buffer, kept out of libuvc's pool
+  // to convert again in place of one that fails. Render thread.
+  uvc_frame_t* lastGoodFrame_{};
+  // Whether an MJPEG frame of the stream ended with EOI, after which frames
+  // without one are taken for truncated. Capture thread.
+  bool mjpegEoiSeen_{false};
+  // ADPF session of the thread running frame callbacks, opened on the first one.
+  PerformanceHint captureHint_{};
+  bool captureHintOpened_{false};
+  // libuvc's transport counters restart with the stream, the stats block's
+  // keep counting: what was added of them so far. Capture thread.
+  uvc_stream_transport_t publishedTransport_{};
+  uint32_t lastCaptureSequence_{};
+
+  // Before the stream is stopped for good or switches format.
+  void disableStillCapture();
+  void setWindowGeometry(int32_t format);
+  // crop_ within the capture size, empty for whole frames.
+  FrameCrop visibleCrop() const;
+  // Format of window buffers the CPU converts into: kPreviewWindowFormat, or
+  // RGB565 as the power profile asks.
+  int32_t cpuWindowFormat() const;
+  // Sets transform_ on the preview window.
+  void applyTransform();
+  // Asks the display for the rate frames are shown at, the camera's over
+  // the decimation, so a 90 or 120 Hz panel can switch to a multiple of it.
+  // On the render thread, which owns the presenter's transactions.
+  void applyFrameRate();
+  // Tags the preview window's buffers, unless they already are. Returns false
+  // when the window refuses.
+  bool setWindowDataSpace(int32_t dataSpace);
+  // What the compositor converts YV12 buffers of the stream with.
+  static int32_t yuvDataSpace(const Colorimetry& colorimetry);
+  // Opens streamHandle_ with streamCtrl_, negotiating again when the cached
+  // one is refused, and registers it with the device.
+  uvc_error_t openStream();
+  // Picks the altsetting and submits the transfers with startOptions_, and
+  // reserves the bandwidth with BusBandwidthPlanner.
+  uvc_error_t startTransfers(uint64_t& cameraReserved);
+  static void deviceLostCallback(void* userPtr);
+  // Output side of configureOutput() for the negotiated format.
+  bool configureBackends();
+  // The rate to negotiate for a requested one under the power profile.
+  int32_t powerProfileFps(
+      int32_t interfaceNumber,
+      uvc_frame_format format,
+      int32_t width,
+      int32_t height,
+      int32_t fps) const;
+  // Full PROBE round for mode.
+  uvc_error_t negotiate(const NegotiationCache::Mode& mode, uvc_stream_ctrl_t& ctrl);
+  // Commits the cheap mode of a fast start in place of the requested one.
+  void beginFastStart();
+  // Render thread, for the first frame shown after each start().
+  void noteFirstFrameShown();
+  bool initPresenter();
+  bool fallBackToRgbWindow();
+  // Rebinds the preview backends to window. Render thread, or while none runs.
+  void bindPreviewWindow(ANativeWindow* window);
+  void applyPendingWindow();
+  // Rebuilds the preview backends for conversion on backend; false when
+  // another one had to be taken. Render thread, or while none runs, with
+  // recorderMutex_ held.
+  bool switchConversionBackend(ConversionBackend backend);
+  bool balancesConversion() const;
+  // Whether the GL preview may draw the stream's format.
+  bool gpuDrawsFormat() const;
+  // Render thread, after each frame posted.
+  void balanceConversion(nanoseconds queueDelay, nanoseconds cost);
+  // For attachRecorder(): back to the GPU, from the render thread if one
+  // runs.
+  void restoreGpuConversion();
+  void applyGpuConversion();
+  void updateHeadless();
+  bool canSlice() const;
+  // The FastPaths the backends and the stream run on, into streamingStats_.
+  void publishFastPaths();
+  bool enqueueFrame(uvc_frame_t* frame);
+  void drainFrameQueue();
+  // The newest of frame and the frames queued behind it, releasing the
+  // others as drops. Render thread.
+  uvc_frame_t* skipToNewest(uvc_frame_t* frame, int64_t& enqueueTime);
+  // Moves the queued frames into the jitter buffer and takes the oldest once
+  // it is due, otherwise presents a decoded frame or waits for either.
+  // Render thread.
+  bool takePacedFrame(
+      uvc_frame_t*& frame,
+      int64_t& enqueueTime,
+      milliseconds idleWait,
+      PerformanceHint& performanceHint);
+  void releaseJitterBuffer();
+  // Target of the capture and render ADPF sessions.
+  int64_t frameIntervalNs() const;
+  // Re-arms failed transfers, and restarts the stream when no frame came for
+  // the stall timeout. Watchdog thread, while started.
+  void checkStall(steady_clock::time_point now);
+  void renderLoop();
+  void releaseRenderScratch();
+  // Republishes the memory and thread counters of the stats block. Render
+  // thread, once a second.
+  void publishUsage();
+  // Adds what libuvc's transport counters gained since the last frame to the
+  // stats block. Capture thread.
+  void publishTransport(uint32_t sequence);
+  // start() of pull mode.
+  bool startPulling();
+  // Hands frame to mjpegDecodePool_, presenting decoded frames to make room.
+  void decodeInParallel(uvc_frame_t* frame, int64_t enqueueTime, PerformanceHint& hint);
+  // Presents the next decoded frame of the pool, if any; with wait, once the
+  // one being decoded is done.
+  bool presentDecoded(bool wait, PerformanceHint& hint);
+  // Converts the rows of the frame being assembled that arrived since the
+  // last call into slice_'s buffer, locking one for it first. Returns false
+  // when no rows are arriving before the queued frame, which is then next.
+  bool convertArrivingRows(milliseconds timeout);
+  // Gives back a buffer locked for a frame that will not be rendered.
+  void releaseSlice();
+  // decoded is the frame's RGBA from the pool, copied instead of converting.
+  void renderFrame(
+      uvc_frame_t* frame,
+      int64_t callbackNs,
+      const MjpegDecodePool::Decoded* decoded = nullptr);
+  bool renderToWindowBuffer(
+      uvc_frame_t* frame,
+      bool logBufferInfo,
+      FrameTimeline& timeline,
+      const MjpegDecodePool::Decoded* decoded);
+  // Converts frame with vulkanConverter_ into a presenter_ buffer.
+  bool renderWithVulkan(uvc_frame_t* frame, FrameTimeline& timeline);
 };
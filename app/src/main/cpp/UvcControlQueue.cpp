@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "UvcControlQueue.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "UvcControlQueue", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "UvcControlQueue", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "UvcControlQueue", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "UvcControlQueue", __VA_ARGS__)
+
+UvcControlQueue::UvcControlQueue(uvc_device_handle_t* deviceHandle)
+    : usbHandle_(uvc_get_libusb_handle(deviceHandle)),
+      interfaceNumber_(uvc_get_control_interface_number(deviceHandle)),
+      transfer_(libusb_alloc_transfer(0)),
+      buffer_(LIBUSB_CONTROL_SETUP_SIZE + kMaxPayload) {}
+
+UvcControlQueue::~UvcControlQueue() {
+  std::deque<Request> dropped;
+  {
+    std::unique_lock lk(mutex_);
+    closing_ = true;
+    if (inFlight_) {
+      libusb_cancel_transfer(transfer_);
+      idle_.wait(lk, [this] { return !inFlight_; });
+    }
+    dropped.swap(queue_);
+  }
+  for (Request& request : dropped) {
+    for (Callback& callback : request.callbacks) {
+      callback(UVC_ERROR_INTERRUPTED, nullptr, 0);
+    }
+  }
+  libusb_free_transfer(transfer_);
+}
+
+void UvcControlQueue::set(
+    uint8_t unit,
+    uint8_t selector,
+    const void* data,
+    uint16_t length,
+    Callback done) {
+  enqueueSet(unit << 8 | interfaceNumber_, selector, data, length, std::move(done));
+}
+
+void UvcControlQueue::setStreaming(
+    uint8_t interfaceNumber,
+    uint8_t selector,
+    const void* data,
+    uint16_t length,
+    Callback done) {
+  enqueueSet(interfaceNumber, selector, data, length, std::move(done));
+}
+
+void UvcControlQueue::enqueueSet(
+    uint16_t index,
+    uint8_t selector,
+    const void* data,
+    uint16_t length,
+    Callback done) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  Request request{
+      .request = UVC_SET_CUR,
+      .index = index,
+      .selector = selector,
+      .length = length,
+      .data = std::vector<uint8_t>(bytes, bytes + length),
+  };
+  if (done) {
+    request.callbacks.push_back(std::move(done));
+  }
+  enqueue(std::move(request));
+}
+
+void UvcControlQueue::get(
+    uint8_t unit,
+    uint8_t selector,
+    uvc_req_code request,
+    uint16_t length,
+    Callback done) {
+  uint16_t index = unit << 8 | interfaceNumber_;
+  if (cacheable(request)) {
+    std::unique_lock lk(mutex_);
+    auto it = cache_.find(cacheKey(request, index, selector));
+    if (it != cache_.end()) {
+      stats_.cacheHits++;
+      std::vector<uint8_t> answer = it->second;
+      lk.unlock();
+      if (done) {
+        done(UVC_SUCCESS, answer.data(), (uint16_t)answer.size());
+      }
+      return;
+    }
+  }
+  Request get{
+      .request = (uint8_t)request,
+      .index = index,
+      .selector = selector,
+      .length = length,
+  };
+  if (done) {
+    get.callbacks.push_back(std::move(done));
+  }
+  enqueue(std::move(get));
+}
+
+Task<UvcControlQueue::Answer> UvcControlQueue::setAsync(
+    ControlExecutor& executor,
+    uint8_t unit,
+    uint8_t selector,
+    std::vector<uint8_t> data) {
+  co_return co_await awaitCallback<Answer>(executor, [&](std::function<void(Answer)> resume) {
+    set(unit,
+        selector,
+        data.data(),
+        static_cast<uint16_t>(data.size()),
+        [resume](uvc_error_t result, const uint8_t*, uint16_t) { resume(Answer{result}); });
+  });
+}
+
+Task<UvcControlQueue::Answer> UvcControlQueue::getAsync(
+    ControlExecutor& executor,
+    uint8_t unit,
+    uint8_t selector,
+    uvc_req_code request,
+    uint16_t length) {
+  co_return co_await awaitCallback<Answer>(executor, [&](std::function<void(Answer)> resume) {
+    get(unit,
+        selector,
+        request,
+        length,
+        [resume](uvc_error_t result, const uint8_t* data, uint16_t length) {
+          resume(Answer{result, std::vector<uint8_t>(data, data + length)});
+        });
+  });
+}
+
+UvcControlQueue::Stats UvcControlQueue::stats() {
+  std::lock_guard lk(mutex_);
+  return stats_;
+}
+
+bool UvcControlQueue::cacheable(uint8_t request) {
+  switch (request) {
+    case UVC_GET_MIN:
+    case UVC_GET_MAX:
+    case UVC_GET_RES:
+    case UVC_GET_DEF:
+    case UVC_GET_LEN:
+    case UVC_GET_INFO:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t UvcControlQueue::cacheKey(uint8_t request, uint16_t index, uint8_t selector) {
+  return (uint32_t)request << 24 | (uint32_t)index << 8 | selector;
+}
+
+uvc_error_t UvcControlQueue::resultOf(const libusb_transfer* transfer, const Request& request) {
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      if (request.request == UVC_SET_CUR && transfer->actual_length != request.length) {
+        return UVC_ERROR_IO;
+      }
+      return UVC_SUCCESS;
+    case LIBUSB_TRANSFER_STALL:
+      // The control or the request is not supported.
+      return UVC_ERROR_PIPE;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return UVC_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return UVC_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return UVC_ERROR_INTERRUPTED;
+    default:
+      return UVC_ERROR_IO;
+  }
+}
+
+void UvcControlQueue::enqueue(Request request) {
+  if (request.length > kMaxPayload) {
+    ULOGE("Control payload of %u bytes is too large", request.length);
+    for (Callback& callback : request.callbacks) {
+      callback(UVC_ERROR_INVALID_PARAM, nullptr, 0);
+    }
+    return;
+  }
+  std::unique_lock lk(mutex_);
+  if (closing_ || usbHandle_ == nullptr || transfer_ == nullptr) {
+    lk.unlock();
+    for (Callback& callback : request.callbacks) {
+      callback(UVC_ERROR_INTERRUPTED, nullptr, 0);
+    }
+    return;
+  }
+  if (request.request == UVC_SET_CUR) {
+    // The front request is in flight; anything behind it has not been sent.
+    auto queued = std::find_if(
+        queue_.begin() + (inFlight_ ? 1 : 0), queue_.end(), [&request](const Request& other) {
+          return other.request == UVC_SET_CUR && other.index == request.index &&
+              other.selector == request.selector;
+        });
+    if (queued != queue_.end()) {
+      queued->data = std::move(request.data);
+      queued->length = request.length;
+      for (Callback& callback : request.callbacks) {
+        queued->callbacks.push_back(std::move(callback));
+      }
+      stats_.coalesced++;
+      return;
+    }
+  }
+  queue_.push_back(std::move(request));
+  if (!inFlight_ && !submitFrontLocked()) {
+    // Fails the request right away rather than leaving the queue stuck.
+    Request failed = std::move(queue_.front());
+    queue_.pop_front();
+    lk.unlock();
+    for (Callback& callback : failed.callbacks) {
+      callback(UVC_ERROR_IO, nullptr, 0);
+    }
+  }
+}
+
+bool UvcControlQueue::submitFrontLocked() {
+  const Request& request = queue_.front();
+  bool isSet = request.request == UVC_SET_CUR;
+  libusb_fill_control_setup(
+      buffer_.data(),
+      isSet ? kRequestTypeSet : kRequestTypeGet,
+      request.request,
+      request.selector << 8,
+      request.index,
+      request.length);
+  if (isSet) {
+    memcpy(buffer_.data() + LIBUSB_CONTROL_SETUP_SIZE, request.data.data(), request.length);
+  }
+  libusb_fill_control_transfer(
+      transfer_,
+      usbHandle_,
+      buffer_.data(),
+      &UvcControlQueue::onTransferComplete,
+      this,
+      kTimeoutMs);
+  int status = libusb_submit_transfer(transfer_);
+  if (status != LIBUSB_SUCCESS) {
+    ULOGE(
+        "Control request %#x to index %#x selector %u failed: %s",
+        request.request,
+        request.index,
+        request.selector,
+        libusb_error_name(status));
+    return false;
+  }
+  inFlight_ = true;
+  stats_.sent++;
+  return true;
+}
+
+void LIBUSB_CALL UvcControlQueue::onTransferComplete(libusb_transfer* transfer) {
+  UvcControlQueue* self = static_cast<UvcControlQueue*>(transfer->user_data);
+  const uint8_t* data = libusb_control_transfer_get_data(transfer);
+  uvc_error_t result;
+  {
+    std::lock_guard lk(self->mutex_);
+    result = resultOf(transfer, self->queue_.front());
+  }
+  self->complete(result, data, (uint16_t)transfer->actual_length);
+}
+
+void UvcControlQueue::complete(uvc_error_t result, const uint8_t* data, uint16_t length) {
+  std::vector<Callback> callbacks;
+  std::vector<uint8_t> answer;
+  std::vector<Request> failed;
+  {
+    std::lock_guard lk(mutex_);
+    Request done = std::move(queue_.front());
+    queue_.pop_front();
+    inFlight_ = false;
+    callbacks = std::move(done.callbacks);
+    if (result == UVC_SUCCESS && done.request != UVC_SET_CUR) {
+      answer.assign(data, data + length);
+      if (cacheable(done.request)) {
+        cache_[cacheKey(done.request, done.index, done.selector)] = answer;
+      }
+    }
+    // The next request goes out before this one's callbacks run.
+    while (!closing_ && !queue_.empty() && !submitFrontLocked()) {
+      failed.push_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+    if (!inFlight_) {
+      idle_.notify_all();
+    }
+  }
+  if (result != UVC_SUCCESS && result != UVC_ERROR_INTERRUPTED) {
+    ULOGW("Control request failed: %s", uvc_strerror(result));
+  }
+  for (Callback& callback : callbacks) {
+    callback(result, answer.data(), (uint16_t)answer.size());
+  }
+  for (Request& request : failed) {
+    for (Callback& callback : request.callbacks) {
+      callback(UVC_ERROR_IO, nullptr, 0);
+    }
+  }
+}
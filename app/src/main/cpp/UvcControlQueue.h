@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "ControlTask.h"
+
+#include <libusb/libusb.h>
+#include <libuvc/libuvc.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Sends GET and SET requests to a camera's terminals and units as async
+// control transfers on the shared USB session, instead of libuvc's blocking
+// uvc_get_ctrl() and uvc_set_ctrl().
+//
+// Requests go out one at a time, in order, and complete on the USB event
+// thread. A SET_CUR still queued for the same control is replaced by a newer
+// one, so dragging a slider only sends the latest value. Answers to GET_MIN,
+// GET_MAX, GET_RES, GET_DEF, GET_LEN and GET_INFO do not change while the
+// device is open and are served from a cache after the first read.
+class UvcControlQueue final {
+ public:
+  // Runs on the USB event thread, or on the caller's for cached answers, and
+  // must return quickly. data holds the answer of a GET.
+  using Callback = std::function<void(uvc_error_t result, const uint8_t* data, uint16_t length)>;
+
+  struct Answer {
+    uvc_error_t result{UVC_SUCCESS};
+    // What a GET returned.
+    std::vector<uint8_t> data{};
+  };
+
+  struct Stats {
+    uint64_t sent{};
+    uint64_t coalesced{};
+    uint64_t cacheHits{};
+  };
+
+  explicit UvcControlQueue(uvc_device_handle_t* deviceHandle);
+  UvcControlQueue(const UvcControlQueue&) = delete;
+  UvcControlQueue& operator=(const UvcControlQueue&) = delete;
+  // Fails what is queued with UVC_ERROR_INTERRUPTED and waits for the
+  // request in flight.
+  ~UvcControlQueue();
+
+  // unit is the terminal or unit ID, selector the control within it.
+  void set(uint8_t unit, uint8_t selector, const void* data, uint16_t length, Callback done);
+  void get(uint8_t unit, uint8_t selector, uvc_req_code request, uint16_t length, Callback done);
+  // SET_CUR of a VideoStreaming interface control, such as the still image
+  // trigger.
+  void setStreaming(
+      uint8_t interfaceNumber,
+      uint8_t selector,
+      const void* data,
+      uint16_t length,
+      Callback done);
+
+  // set() and get() for coroutines on the control plane, resuming on
+  // executor once the request completed.
+  Task<Answer> setAsync(
+      ControlExecutor& executor,
+      uint8_t unit,
+      uint8_t selector,
+      std::vector<uint8_t> data);
+  Task<Answer> getAsync(
+      ControlExecutor& executor,
+      uint8_t unit,
+      uint8_t selector,
+      uvc_req_code request,
+      uint16_t length);
+
+  Stats stats();
+
+ private:
+  static constexpr uint8_t kRequestTypeSet = 0x21;
+  static constexpr uint8_t kRequestTypeGet = 0xa1;
+  static constexpr unsigned int kTimeoutMs = 1000;
+  // Largest control payload; UVC 1.5 controls stay well below it.
+  static constexpr uint16_t kMaxPayload = 512;
+
+  struct Request {
+    uint8_t request{};
+    // wIndex: the entity ID over the interface number.
+    uint16_t index{};
+    uint8_t selector{};
+    uint16_t length{};
+    std::vector<uint8_t> data{};
+    std::vector<Callback> callbacks{};
+  };
+
+  libusb_device_handle* usbHandle_{};
+  uint8_t interfaceNumber_{};
+  libusb_transfer* transfer_{};
+  std::vector<uint8_t> buffer_{};
+
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::deque<Request> queue_{};
+  bool inFlight_{false};
+  bool closing_{false};
+  // Static answers by request, wIndex and selector.
+  std::map<uint32_t, std::vector<uint8_t>> cache_{};
+  Stats stats_{};
+
+  static bool cacheable(uint8_t request);
+  static uint32_t cacheKey(uint8_t request, uint16_t index, uint8_t selector);
+  static uvc_error_t resultOf(const libusb_transfer* transfer, const Request& request);
+  static void LIBUSB_CALL onTransferComplete(libusb_transfer* transfer);
+
+  void enqueueSet(
+      uint16_t index,
+      uint8_t selector,
+      const void* data,
+      uint16_t length,
+      Callback done);
+  void enqueue(Request request);
+  // Called with mutex_ held. Returns false when the submission failed.
+  bool submitFrontLocked();
+  void complete(uvc_error_t result, const uint8_t* data, uint16_t length);
+};
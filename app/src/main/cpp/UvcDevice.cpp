@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UvcDevice.h"
+
+#include <android/log.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "UvcDevice", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "UvcDevice", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "UvcDevice", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "UvcDevice", __VA_ARGS__)
+
+static std::mutex keptMutex_;
+static std::shared_ptr<UvcDevice> kept_{};
+
+// The fd may have been closed and its number reused since the device was kept.
+static bool sameDeviceNode(int a, int b) {
+  struct stat statA;
+  struct stat statB;
+  return fstat(a, &statA) == 0 && fstat(b, &statB) == 0 && statA.st_rdev == statB.st_rdev &&
+      statA.st_ino == statB.st_ino;
+}
+
+std::shared_ptr<UvcDevice> UvcDevice::open(intptr_t deviceFD) {
+  std::shared_ptr<UvcDevice> device;
+  {
+    std::lock_guard lk(keptMutex_);
+    device = std::move(kept_);
+  }
+  if (device != nullptr && device->sourceFD_ == (int)deviceFD &&
+      sameDeviceNode(device->sourceFD_, device->deviceFD_)) {
+    ULOGI("UVC device on fd %d reused", (int)deviceFD);
+    return device;
+  }
+  device = nullptr;
+  return create(deviceFD);
+}
+
+std::shared_ptr<UvcDevice> UvcDevice::openKept(intptr_t deviceFD) {
+  std::shared_ptr<UvcDevice> device = open(deviceFD);
+  std::lock_guard lk(keptMutex_);
+  kept_ = device;
+  return device;
+}
+
+void UvcDevice::releaseKept() {
+  std::shared_ptr<UvcDevice> device;
+  {
+    std::lock_guard lk(keptMutex_);
+    device = std::move(kept_);
+  }
+}
+
+std::shared_ptr<UvcDevice> UvcDevice::create(intptr_t deviceFD) {
+  std::shared_ptr<UvcDevice> device(new UvcDevice());
+  // libuvc runs on the shared libusb context, whose event thread services
+  // its transfers; it starts no handler thread of its own.
+  device->session_ = UsbSession::shared();
+  if (device->session_ == nullptr) {
+    return nullptr;
+  }
+  uvc_error_t res = uvc_init(&device->uvcContext_, device->session_->context());
+  if (res != UVC_SUCCESS) {
+    ULOGE("uvc_init failed %s", uvc_strerror(res));
+    return nullptr;
+  }
+  device->sourceFD_ = (int)deviceFD;
+  device->deviceFD_ = dup((int)deviceFD);
+  if (device->deviceFD_ < 0) {
+    ULOGE("dup of fd %d failed: %s", (int)deviceFD, strerror(errno));
+    return nullptr;
+  }
+  res = uvc_wrap(device->deviceFD_, device->uvcContext_, &device->deviceHandle_);
+  if (res != UVC_SUCCESS || device->deviceHandle_ == nullptr) {
+    ULOGE("uvc_wrap failed %s", uvc_strerror(res));
+    return nullptr;
+  }
+  device->controls_ = std::make_unique<UvcControlQueue>(device->deviceHandle_);
+  ULOGI("UVC device on fd %d opened", (int)deviceFD);
+  return device;
+}
+
+UvcDevice::~UvcDevice() {
+  // Its transfer goes before the device handle it was sent on.
+  controls_ = nullptr;
+  if (deviceHandle_ != nullptr) {
+    ULOGI("Close device handle");
+    uvc_close(deviceHandle_);
+  }
+  if (uvcContext_ != nullptr) {
+    uvc_exit(uvcContext_);
+  }
+  if (deviceFD_ >= 0) {
+    close(deviceFD_);
+  }
+}
+
+void UvcDevice::addStream() {
+  std::lock_guard lk(mutex_);
+  streams_++;
+}
+
+void UvcDevice::removeStream() {
+  std::lock_guard lk(mutex_);
+  streams_--;
+}
+
+uint32_t UvcDevice::streamCount() const {
+  std::lock_guard lk(mutex_);
+  return streams_;
+}
+
+uint64_t UvcDevice::isoBusBudget() const {
+  return bus().budget;
+}
+
+BusBandwidthPlanner::Bus UvcDevice::bus() const {
+  return BusBandwidthPlanner::busOf(uvc_get_libusb_handle(deviceHandle_));
+}
+
+uint64_t UvcDevice::reservedIsoBandwidth() const {
+  return uvc_get_reserved_iso_bandwidth(deviceHandle_);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <libusb/libusb.h>
+#include <libuvc/libuvc.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "BusBandwidthPlanner.h"
+#include "UsbSession.h"
+#include "UvcControlQueue.h"
+
+// One libuvc context and device handle on the shared USB session, held by the
+// streamer of every VideoStreaming interface of a camera. Depth and color or
+// dual sensor cameras expose several; libuvc can only wrap their fd once.
+//
+// Isochronous streams of the device share the bus's periodic bandwidth. The
+// streamers start under startMutex() and, once more than one is open, reserve
+// only what their format needs, so the altsettings they pick add up. Other
+// cameras and audio interfaces on the bus are accounted for by
+// BusBandwidthPlanner.
+//
+// The device wraps a duplicate of the caller's fd, so it can be torn down
+// after the app closed its UsbDeviceConnection.
+class UvcDevice final {
+ public:
+  UvcDevice(const UvcDevice&) = delete;
+  UvcDevice& operator=(const UvcDevice&) = delete;
+  ~UvcDevice();
+
+  // Null if the session, libuvc or the fd could not be set up. Returns the
+  // device openKept() holds for the same fd, if any.
+  static std::shared_ptr<UvcDevice> open(intptr_t deviceFD);
+  // Opens the device like open() and holds on to it until the next open()
+  // of the fd takes it, so reading its formats before connecting costs no
+  // second uvc_wrap() and parse of the descriptors.
+  static std::shared_ptr<UvcDevice> openKept(intptr_t deviceFD);
+  // Drops the device openKept() holds, when no open() is coming.
+  static void releaseKept();
+
+  uvc_device_handle_t* handle() const {
+    return deviceHandle_;
+  }
+
+  // Camera controls, sent without blocking the caller or the streams.
+  UvcControlQueue& controls() {
+    return *controls_;
+  }
+
+  // Streamers register while they hold a stream handle on the device.
+  void addStream();
+  void removeStream();
+  uint32_t streamCount() const;
+
+  // Held while a stream picks its altsetting and submits its transfers.
+  std::mutex& startMutex() {
+    return startMutex_;
+  }
+
+  // Periodic bandwidth the bus leaves isochronous endpoints, in bytes per
+  // second, zero for an unknown speed.
+  uint64_t isoBusBudget() const;
+  // The bus the device is on, for BusBandwidthPlanner.
+  BusBandwidthPlanner::Bus bus() const;
+  // What the device's running streams reserve, in bytes per second. Call
+  // with startMutex() held.
+  uint64_t reservedIsoBandwidth() const;
+
+ private:
+  std::shared_ptr<UsbSession> session_{};
+  uvc_context_t* uvcContext_{};
+  uvc_device_handle_t* deviceHandle_{};
+  int deviceFD_{-1};
+  // The caller's fd deviceFD_ duplicates.
+  int sourceFD_{-1};
+  std::unique_ptr<UvcControlQueue> controls_{};
+  mutable std::mutex mutex_;
+  uint32_t streams_{};
+  std::mutex startMutex_;
+
+  UvcDevice() = default;
+  static std::shared_ptr<UvcDevice> create(intptr_t deviceFD);
+};
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "UvcEncoderControl.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "UvcEncoderControl", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "UvcEncoderControl", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "UvcEncoderControl", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "UvcEncoderControl", __VA_ARGS__)
+
+// {A29E7641-DE04-47E3-8B2B-F4341AFF003B} as it appears in the descriptor.
+static constexpr uint8_t kH264ExtensionUnitGuid[16] = {
+    0x41, 0x76, 0x9e, 0xa2, 0x04, 0xde, 0xe3, 0x47,
+    0x8b, 0x2b, 0xf4, 0x34, 0x1a, 0xff, 0x00, 0x3b};
+
+static void putLe16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xff;
+  out[1] = value >> 8;
+}
+
+static void putLe32(uint8_t* out, uint32_t value) {
+  putLe16(out, value & 0xffff);
+  putLe16(out + 2, value >> 16);
+}
+
+static uint32_t le32(const uint8_t* in) {
+  return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+std::unique_ptr<UvcEncoderControl> UvcEncoderControl::find(std::shared_ptr<UvcDevice> device) {
+  if (device == nullptr) {
+    return nullptr;
+  }
+  uvc_device_handle_t* handle = device->handle();
+  const uvc_encoding_unit_t* encodingUnit = uvc_get_encoding_units(handle);
+  if (encodingUnit != nullptr) {
+    std::unique_ptr<UvcEncoderControl> control(
+        new UvcEncoderControl(std::move(device), Unit::ENCODING, encodingUnit->bUnitID));
+    control->controls_ = encodingUnit->bmControls;
+    control->runtimeControls_ = encodingUnit->bmControlsRuntime;
+    uint8_t sync[4];
+    if (has(control->controls_, UVC_EU_SYNC_REF_FRAME_CONTROL) &&
+        uvc_get_ctrl(
+            handle, control->unitId_, UVC_EU_SYNC_REF_FRAME_CONTROL, sync, sizeof(sync),
+            UVC_GET_CUR) == sizeof(sync)) {
+      control->syncFrameIntervalMs_ = sync[1] | sync[2] << 8;
+    }
+    ULOGI(
+        "Encoding unit %u, controls 0x%06x, at runtime 0x%06x",
+        control->unitId_,
+        control->controls_,
+        control->runtimeControls_);
+    return control;
+  }
+  for (const uvc_extension_unit_t* unit = uvc_get_extension_units(handle); unit != nullptr;
+       unit = unit->next) {
+    if (memcmp(unit->guidExtensionCode, kH264ExtensionUnitGuid, sizeof(kH264ExtensionUnitGuid)) !=
+        0) {
+      continue;
+    }
+    std::unique_ptr<UvcEncoderControl> control(
+        new UvcEncoderControl(std::move(device), Unit::H264_EXTENSION, unit->bUnitID));
+    // The extension unit's controls all apply while streaming.
+    control->controls_ = (uint32_t)unit->bmControls;
+    control->runtimeControls_ = control->controls_;
+    ULOGI("H.264 extension unit %u, controls 0x%04x", control->unitId_, control->controls_);
+    return control;
+  }
+  return nullptr;
+}
+
+UvcEncoderControl::UvcEncoderControl(std::shared_ptr<UvcDevice> device, Unit unit, uint8_t unitId)
+    : device_(std::move(device)), unit_(unit), unitId_(unitId) {}
+
+bool UvcEncoderControl::setBlocking(uint8_t selector, const uint8_t* data, int length) {
+  int ret = uvc_set_ctrl(device_->handle(), unitId_, selector, (void*)data, length);
+  if (ret != length) {
+    ULOGE("Unit %u control 0x%02x SET_CUR error %d", unitId_, selector, ret);
+    return false;
+  }
+  return true;
+}
+
+void UvcEncoderControl::apply(const Settings& settings) {
+  std::lock_guard lk(mutex_);
+  if (unit_ == Unit::ENCODING) {
+    if (settings.averageBitrate != 0) {
+      uint8_t bitrate[4];
+      putLe32(bitrate, settings.averageBitrate);
+      if (!has(controls_, UVC_EU_AVERAGE_BITRATE_CONTROL)) {
+        ULOGW("The encoding unit has no average bitrate control");
+      } else if (setBlocking(UVC_EU_AVERAGE_BITRATE_CONTROL, bitrate, sizeof(bitrate))) {
+        ULOGI("Encoding at %u bits per second", settings.averageBitrate);
+      }
+    }
+    if (settings.keyframeIntervalMs != 0) {
+      uint8_t sync[4] = {kSyncFrameIdr};
+      uint16_t interval = std::min<uint32_t>(settings.keyframeIntervalMs, UINT16_MAX);
+      putLe16(sync + 1, interval);
+      if (!has(controls_, UVC_EU_SYNC_REF_FRAME_CONTROL)) {
+        ULOGW("The encoding unit has no sync frame control");
+      } else if (setBlocking(UVC_EU_SYNC_REF_FRAME_CONTROL, sync, sizeof(sync))) {
+        syncFrameIntervalMs_ = interval;
+        ULOGI("An IDR frame every %u ms", interval);
+      }
+    }
+    return;
+  }
+  if (settings.averageBitrate != 0) {
+    // wLayerID, dwPeakBitrate, dwAverageBitrate: the peak stays unless the
+    // average would exceed it.
+    uint8_t layers[10];
+    int ret = uvc_get_ctrl(
+        device_->handle(), unitId_, kUvcxBitrateLayersControl, layers, sizeof(layers),
+        UVC_GET_CUR);
+    if (ret != sizeof(layers)) {
+      ULOGE("UVCX bitrate GET_CUR error %d", ret);
+    } else {
+      putLe16(layers, 0);
+      putLe32(layers + 2, std::max(le32(layers + 2), settings.averageBitrate));
+      putLe32(layers + 6, settings.averageBitrate);
+      if (setBlocking(kUvcxBitrateLayersControl, layers, sizeof(layers))) {
+        ULOGI("Encoding at %u bits per second", settings.averageBitrate);
+      }
+    }
+  }
+  if (settings.keyframeIntervalMs != 0) {
+    ULOGW("The H.264 extension unit negotiates its keyframe interval, keeping the camera's");
+  }
+}
+
+bool UvcEncoderControl::requestKeyframe(const char* reason) {
+  uint8_t selector;
+  uint8_t data[4] = {};
+  uint16_t length;
+  {
+    std::lock_guard lk(mutex_);
+    steady_clock::time_point now = steady_clock::now();
+    if (now - lastKeyframe_ < kMinKeyframeGap) {
+      return false;
+    }
+    if (unit_ == Unit::ENCODING) {
+      // Every SET_CUR has the encoder send a sync frame right away.
+      selector = UVC_EU_SYNC_REF_FRAME_CONTROL;
+      data[0] = kSyncFrameIdr;
+      putLe16(data + 1, syncFrameIntervalMs_);
+      length = 4;
+    } else {
+      // wLayerID, wPicType.
+      selector = kUvcxPictureTypeControl;
+      putLe16(data + 2, kUvcxIdrWithParameterSets);
+      length = 4;
+    }
+    if (!has(runtimeControls_, selector)) {
+      return false;
+    }
+    lastKeyframe_ = now;
+  }
+  ULOGD("Requesting an IDR frame: %s", reason);
+  uint8_t unitId = unitId_;
+  // The queue outlives this object when other streams share the device, so
+  // the callback keeps nothing of it.
+  device_->controls().set(
+      unitId_,
+      selector,
+      data,
+      length,
+      [unitId, reason](uvc_error_t result, const uint8_t* answer, uint16_t answerLength) {
+        if (result != UVC_SUCCESS) {
+          ULOGW("Unit %u keyframe request (%s) error %d", unitId, reason, result);
+        }
+      });
+  return true;
+}
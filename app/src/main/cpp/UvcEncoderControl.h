@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "UvcDevice.h"
+
+using namespace std::chrono;
+
+// The H.264 or H.265 encoder of a camera: asks it for IDR frames and sets its
+// bitrate and keyframe interval.
+//
+// UVC 1.5 cameras describe it as an encoding unit. Earlier H.264 cameras,
+// such as the Logitech C920 family, expose the same controls through the
+// H.264 extension unit of the USB-IF's UVC H.264 payload specification;
+// there the keyframe interval is part of the payload configuration the
+// stream negotiates and cannot be changed here.
+//
+// Keyframe requests go out as async control transfers on the device's
+// UvcControlQueue, so the capture and render threads can make them.
+class UvcEncoderControl final {
+ public:
+  struct Settings {
+    // Average bitrate in bits per second, zero keeps the camera's.
+    uint32_t averageBitrate{};
+    // Time between the periodic IDR frames, zero keeps the camera's.
+    uint32_t keyframeIntervalMs{};
+  };
+
+  // Requests closer together than this are answered by the keyframe already
+  // on its way.
+  static constexpr milliseconds kMinKeyframeGap = 200ms;
+
+  // Null when the camera has neither an encoding unit nor the H.264
+  // extension unit.
+  static std::unique_ptr<UvcEncoderControl> find(std::shared_ptr<UvcDevice> device);
+  UvcEncoderControl(const UvcEncoderControl&) = delete;
+  UvcEncoderControl& operator=(const UvcEncoderControl&) = delete;
+
+  // Blocks on the control transfers. Before the stream starts: encoders
+  // need not take their bitrate and keyframe interval while streaming.
+  void apply(const Settings& settings);
+  // Asks for an IDR frame with SPS and PPS, without blocking. Returns false
+  // when the request was dropped, as too close to the last one or because
+  // the encoder cannot take it while streaming. Any thread; reason is
+  // logged and must be a string literal.
+  bool requestKeyframe(const char* reason);
+
+ private:
+  enum class Unit {
+    ENCODING,
+    H264_EXTENSION,
+  };
+
+  // Controls of the H.264 extension unit ("UVCX" controls).
+  static constexpr uint8_t kUvcxPictureTypeControl = 0x09;
+  static constexpr uint8_t kUvcxBitrateLayersControl = 0x0e;
+  // wPicType of kUvcxPictureTypeControl.
+  static constexpr uint16_t kUvcxIdrWithParameterSets = 2;
+  // bSyncFrameType of UVC_EU_SYNC_REF_FRAME_CONTROL.
+  static constexpr uint8_t kSyncFrameIdr = 1;
+
+  std::shared_ptr<UvcDevice> device_{};
+  Unit unit_{};
+  uint8_t unitId_{};
+  // Bit n is control selector n + 1.
+  uint32_t controls_{};
+  uint32_t runtimeControls_{};
+
+  std::mutex mutex_;
+  steady_clock::time_point lastKeyframe_{};
+  // wSyncFrameInterval, sent again with every keyframe request so it keeps
+  // the periodic keyframes.
+  uint16_t syncFrameIntervalMs_{};
+
+  UvcEncoderControl(std::shared_ptr<UvcDevice> device, Unit unit, uint8_t unitId);
+  static bool has(uint32_t controls, uint8_t selector) {
+    return ((controls >> (selector - 1)) & 1) != 0;
+  }
+  bool setBlocking(uint8_t selector, const uint8_t* data, int length);
+};
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "UvcFormatTable.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+template <typename T>
+void append(std::vector<uint8_t>& table, const T& value) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+  table.insert(table.end(), bytes, bytes + sizeof(T));
+}
+
+uint8_t countOf(uint32_t count) {
+  return (uint8_t)std::min<uint32_t>(count, UINT8_MAX);
+}
+
+void appendFrame(std::vector<uint8_t>& table, const uvc_frame_desc_t* frame) {
+  UvcFrameRecord record{};
+  record.frameIndex = frame->bFrameIndex;
+  record.capabilities = frame->bmCapabilities;
+  record.intervalType = frame->bFrameIntervalType;
+  record.width = frame->wWidth;
+  record.height = frame->wHeight;
+  record.maxFrameBytes = frame->dwMaxVideoFrameBufferSize;
+  record.defaultInterval = frame->dwDefaultFrameInterval;
+  record.minBitRate = frame->dwMinBitRate;
+  record.maxBitRate = frame->dwMaxBitRate;
+  if (frame->bFrameIntervalType == 0) {
+    record.intervalCount = 3;
+    append(table, record);
+    append(table, frame->dwMinFrameInterval);
+    append(table, frame->dwMaxFrameInterval);
+    append(table, frame->dwFrameIntervalStep);
+    return;
+  }
+  uint32_t count = 0;
+  while (frame->intervals != nullptr && frame->intervals[count] != 0 && count < UINT8_MAX) {
+    count++;
+  }
+  record.intervalCount = (uint8_t)count;
+  append(table, record);
+  for (uint32_t i = 0; i < count; i++) {
+    append(table, frame->intervals[i]);
+  }
+}
+
+void appendFormat(
+    std::vector<uint8_t>& table,
+    uint8_t interfaceNumber,
+    uint8_t stillCaptureMethod,
+    const uvc_format_desc_t* format) {
+  UvcFormatRecord record{};
+  record.interfaceNumber = interfaceNumber;
+  record.stillCaptureMethod = stillCaptureMethod;
+  record.descriptorSubtype = (uint8_t)format->bDescriptorSubtype;
+  record.formatIndex = format->bFormatIndex;
+  if (format->bDescriptorSubtype != UVC_VS_FORMAT_MJPEG) {
+    memcpy(record.guidFormat, format->guidFormat, sizeof(record.guidFormat));
+  }
+  record.bitsPerPixel = format->bBitsPerPixel;
+  record.defaultFrameIndex = format->bDefaultFrameIndex;
+  record.aspectRatioX = format->bAspectRatioX;
+  record.aspectRatioY = format->bAspectRatioY;
+  record.interlaceFlags = format->bmInterlaceFlags;
+  record.colorPrimaries = format->bColorPrimaries;
+  record.transferCharacteristics = format->bTransferCharacteristics;
+  record.matrixCoefficients = format->bMatrixCoefficients;
+
+  uint32_t frameCount = 0;
+  for (const uvc_frame_desc_t* frame = format->frame_descs; frame != nullptr;
+       frame = frame->next) {
+    frameCount++;
+  }
+  // libuvc keeps at most one still descriptor per format.
+  std::vector<UvcStillSize> stillSizes;
+  const uvc_still_frame_desc_t* still = format->still_frame_desc;
+  if (still != nullptr) {
+    record.stillEndpoint = still->bEndPointAddress;
+    for (const uvc_still_frame_res_t* size = still->imageSizePatterns; size != nullptr;
+         size = size->next) {
+      stillSizes.push_back({size->wWidth, size->wHeight});
+    }
+  }
+  record.frameCount = countOf(frameCount);
+  record.stillSizeCount = countOf(stillSizes.size());
+  append(table, record);
+  for (uint32_t i = 0; i < record.stillSizeCount; i++) {
+    append(table, stillSizes[i]);
+  }
+  const uvc_frame_desc_t* frame = format->frame_descs;
+  for (uint32_t i = 0; i < record.frameCount; i++, frame = frame->next) {
+    appendFrame(table, frame);
+  }
+}
+
+} // namespace
+
+std::vector<uint8_t> encodeUvcFormatTable(uvc_device_handle_t* deviceHandle) {
+  std::vector<uint8_t> table;
+  if (deviceHandle == nullptr) {
+    return table;
+  }
+  UvcFormatTableHeader header{};
+  memcpy(header.magic, kUvcFormatTableMagic, sizeof(header.magic));
+  header.version = kUvcFormatTableVersion;
+  append(table, header);
+
+  uint32_t formatCount = 0;
+  uint8_t interfaceNumber;
+  uint8_t stillCaptureMethod;
+  const uvc_format_desc_t* formats;
+  for (int index = 0;
+       uvc_get_stream_interface(
+           deviceHandle, index, &interfaceNumber, &stillCaptureMethod, &formats) == UVC_SUCCESS;
+       index++) {
+    for (const uvc_format_desc_t* format = formats;
+         format != nullptr && formatCount < UINT16_MAX;
+         format = format->next) {
+      appendFormat(table, interfaceNumber, stillCaptureMethod, format);
+      formatCount++;
+    }
+  }
+  if (formatCount == 0) {
+    return {};
+  }
+  header.formatCount = (uint16_t)formatCount;
+  memcpy(table.data(), &header, sizeof(header));
+  return table;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <libuvc/libuvc.h>
+
+#include <cstdint>
+#include <vector>
+
+// Every format, frame size, frame interval, still size and color matching
+// entry of a camera's VideoStreaming interfaces, as libuvc parsed them when
+// it opened the device, in one little endian blob. The app reads it instead
+// of parsing the raw descriptors a second time, with UvcFormatTable.kt.
+//
+// A UvcFormatTableHeader is followed by formatCount formats, each a
+// UvcFormatRecord, its stillSizeCount UvcStillSize and its frameCount frames.
+// A frame is a UvcFrameRecord followed by intervalCount uint32_t intervals
+// in 100 ns units: the discrete ones, or the minimum, maximum and step of a
+// continuous range. Everything is 4 byte aligned.
+static constexpr char kUvcFormatTableMagic[4] = {'U', 'V', 'C', 'T'};
+static constexpr uint16_t kUvcFormatTableVersion = 1;
+
+struct UvcFormatTableHeader {
+  char magic[4];
+  uint16_t version;
+  uint16_t formatCount;
+};
+static_assert(sizeof(UvcFormatTableHeader) == 8);
+
+struct UvcFormatRecord {
+  uint8_t interfaceNumber;
+  uint8_t stillCaptureMethod; // bStillCaptureMethod of the interface
+  uint8_t descriptorSubtype; // uvc_vs_desc_subtype
+  uint8_t formatIndex;
+  uint8_t guidFormat[16]; // starts with the fourcc, zero for MJPEG
+  uint8_t bitsPerPixel; // bmFlags for MJPEG
+  uint8_t defaultFrameIndex;
+  uint8_t aspectRatioX;
+  uint8_t aspectRatioY;
+  uint8_t interlaceFlags;
+  // Zero without a color matching descriptor.
+  uint8_t colorPrimaries;
+  uint8_t transferCharacteristics;
+  uint8_t matrixCoefficients;
+  uint8_t frameCount;
+  uint8_t stillSizeCount;
+  uint8_t stillEndpoint; // zero for method 1 and 2 stills
+  uint8_t reserved;
+};
+static_assert(sizeof(UvcFormatRecord) == 32);
+
+struct UvcStillSize {
+  uint16_t width;
+  uint16_t height;
+};
+
+struct UvcFrameRecord {
+  uint8_t frameIndex;
+  uint8_t capabilities;
+  uint8_t intervalType; // bFrameIntervalType, zero for a continuous range
+  uint8_t intervalCount;
+  uint16_t width;
+  uint16_t height;
+  uint32_t maxFrameBytes; // zero for frame based formats
+  uint32_t defaultInterval;
+  uint32_t minBitRate;
+  uint32_t maxBitRate;
+};
+static_assert(sizeof(UvcFrameRecord) == 24);
+
+// The table of the device, empty when it has no VideoStreaming interface.
+std::vector<uint8_t> encodeUvcFormatTable(uvc_device_handle_t* deviceHandle);
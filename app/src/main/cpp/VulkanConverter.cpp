@@ -0,0 +1,860 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VulkanConverter.h"
+
+#include <android/log.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "HardwareFrameBuffers.h"
+
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "VulkanConverter", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "VulkanConverter", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "VulkanConverter", __VA_ARGS__)
+
+namespace {
+
+// SPIR-V of shaders/VulkanConvert.comp for each format, glslc's C
+// initializer output.
+constexpr uint32_t kYuyvShader[] =
+#include "VulkanConvertYUYV.spv.inc"
+    ;
+constexpr uint32_t kNv12Shader[] =
+#include "VulkanConvertNV12.spv.inc"
+    ;
+constexpr uint32_t kP010Shader[] =
+#include "VulkanConvertP010.spv.inc"
+    ;
+
+// The shader's local size.
+constexpr uint32_t kGroupSize = 16;
+
+constexpr VkExternalMemoryHandleTypeFlagBits kHardwareBufferHandle =
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_ANDROID_HARDWARE_BUFFER_BIT_ANDROID;
+
+void closeFence(int& fence) {
+  if (fence >= 0) {
+    close(fence);
+    fence = -1;
+  }
+}
+
+// Sync files poll readable once signaled. Failed conversions wait too, so
+// the output is free to write once handed back.
+void waitForFence(int& fence) {
+  if (fence < 0) {
+    return;
+  }
+  pollfd pfd{fence, POLLIN, 0};
+  while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+  }
+  closeFence(fence);
+}
+
+bool hasExtension(const std::vector<VkExtensionProperties>& extensions, const char* name) {
+  for (const VkExtensionProperties& extension : extensions) {
+    if (strcmp(extension.extensionName, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether hardware buffers of the size import as RGBA storage images.
+bool importsOutputs(VkPhysicalDevice device, int32_t width, int32_t height) {
+  VkPhysicalDeviceExternalImageFormatInfo external{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO};
+  external.handleType = kHardwareBufferHandle;
+  VkPhysicalDeviceImageFormatInfo2 info{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2};
+  info.pNext = &external;
+  info.format = VK_FORMAT_R8G8B8A8_UNORM;
+  info.type = VK_IMAGE_TYPE_2D;
+  info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  info.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  VkExternalImageFormatProperties externalProperties{
+      VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES};
+  VkImageFormatProperties2 properties{VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2};
+  properties.pNext = &externalProperties;
+  if (vkGetPhysicalDeviceImageFormatProperties2(device, &info, &properties) != VK_SUCCESS) {
+    return false;
+  }
+  const VkExtent3D& maxExtent = properties.imageFormatProperties.maxExtent;
+  return (externalProperties.externalMemoryProperties.externalMemoryFeatures &
+          VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT) != 0 &&
+      (uint32_t)width <= maxExtent.width && (uint32_t)height <= maxExtent.height;
+}
+
+bool importsSlots(VkPhysicalDevice device) {
+  VkPhysicalDeviceExternalBufferInfo info{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_BUFFER_INFO};
+  info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  info.handleType = kHardwareBufferHandle;
+  VkExternalBufferProperties properties{VK_STRUCTURE_TYPE_EXTERNAL_BUFFER_PROPERTIES};
+  vkGetPhysicalDeviceExternalBufferProperties(device, &info, &properties);
+  return (properties.externalMemoryProperties.externalMemoryFeatures &
+          VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT) != 0;
+}
+
+} // namespace
+
+VulkanConverter::~VulkanConverter() {
+  destroy();
+}
+
+bool VulkanConverter::supportsFormat(uvc_frame_format format) {
+  return format == UVC_FRAME_FORMAT_YUYV || format == UVC_FRAME_FORMAT_NV12 ||
+      format == UVC_FRAME_FORMAT_P010;
+}
+
+bool VulkanConverter::init(
+    int32_t width,
+    int32_t height,
+    uvc_frame_format format,
+    const Colorimetry& colorimetry) {
+  destroy();
+  if (!supportsFormat(format) || width <= 0 || height <= 0) {
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  format_ = format;
+  colorimetry_ = colorimetry;
+  if (!initInstance() || !initDevice() || !initPipeline() || !initSubmissions()) {
+    destroy();
+    return false;
+  }
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice_, &properties);
+  ULOGI(
+      "Converting format %d %dx%d on %s, slots %s, sync files in %d out %d",
+      format,
+      width,
+      height,
+      properties.deviceName,
+      importsSlots_ ? "imported" : "copied",
+      importsSyncFiles_,
+      exportsSyncFiles_);
+  return true;
+}
+
+bool VulkanConverter::initInstance() {
+  uint32_t version = VK_API_VERSION_1_0;
+  if (vkEnumerateInstanceVersion(&version) != VK_SUCCESS || version < VK_API_VERSION_1_1) {
+    ULOGW("No Vulkan 1.1 instance");
+    return false;
+  }
+  VkApplicationInfo app{VK_STRUCTURE_TYPE_APPLICATION_INFO};
+  app.pApplicationName = "usbvideo";
+  app.apiVersion = VK_API_VERSION_1_1;
+  VkInstanceCreateInfo info{VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
+  info.pApplicationInfo = &app;
+  VkResult result = vkCreateInstance(&info, nullptr, &instance_);
+  if (result != VK_SUCCESS) {
+    ULOGW("vkCreateInstance failed %d", result);
+    instance_ = VK_NULL_HANDLE;
+    return false;
+  }
+  return true;
+}
+
+bool VulkanConverter::initDevice() {
+  uint32_t count = 0;
+  vkEnumeratePhysicalDevices(instance_, &count, nullptr);
+  std::vector<VkPhysicalDevice> devices(count);
+  vkEnumeratePhysicalDevices(instance_, &count, devices.data());
+  bool syncFiles = false;
+  for (VkPhysicalDevice device : devices) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+    if (properties.apiVersion < VK_API_VERSION_1_1 ||
+        !hasExtension(
+            extensions, VK_ANDROID_EXTERNAL_MEMORY_ANDROID_HARDWARE_BUFFER_EXTENSION_NAME) ||
+        !hasExtension(extensions, VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME) ||
+        !importsOutputs(device, width_, height_)) {
+      continue;
+    }
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+    for (uint32_t i = 0; i < familyCount && physicalDevice_ == VK_NULL_HANDLE; i++) {
+      if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0) {
+        physicalDevice_ = device;
+        queueFamily_ = i;
+      }
+    }
+    if (physicalDevice_ != VK_NULL_HANDLE) {
+      syncFiles = hasExtension(extensions, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME);
+      break;
+    }
+  }
+  if (physicalDevice_ == VK_NULL_HANDLE) {
+    ULOGW("No Vulkan device imports %dx%d hardware buffers for compute", width_, height_);
+    return false;
+  }
+  importsSlots_ = importsSlots(physicalDevice_);
+  if (syncFiles) {
+    VkPhysicalDeviceExternalSemaphoreInfo info{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO};
+    info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+    VkExternalSemaphoreProperties properties{VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES};
+    vkGetPhysicalDeviceExternalSemaphoreProperties(physicalDevice_, &info, &properties);
+    importsSyncFiles_ =
+        (properties.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT) != 0;
+    exportsSyncFiles_ =
+        (properties.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT) != 0;
+  }
+
+  float priority = 1.0f;
+  VkDeviceQueueCreateInfo queueInfo{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+  queueInfo.queueFamilyIndex = queueFamily_;
+  queueInfo.queueCount = 1;
+  queueInfo.pQueuePriorities = &priority;
+  // The extension's other dependencies are core in 1.1.
+  std::vector<const char*> extensions{
+      VK_ANDROID_EXTERNAL_MEMORY_ANDROID_HARDWARE_BUFFER_EXTENSION_NAME,
+      VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME,
+  };
+  if (importsSyncFiles_ || exportsSyncFiles_) {
+    extensions.push_back(VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME);
+  }
+  VkDeviceCreateInfo info{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+  info.queueCreateInfoCount = 1;
+  info.pQueueCreateInfos = &queueInfo;
+  info.enabledExtensionCount = (uint32_t)extensions.size();
+  info.ppEnabledExtensionNames = extensions.data();
+  VkResult result = vkCreateDevice(physicalDevice_, &info, nullptr, &device_);
+  if (result != VK_SUCCESS) {
+    ULOGW("vkCreateDevice failed %d", result);
+    device_ = VK_NULL_HANDLE;
+    return false;
+  }
+  vkGetDeviceQueue(device_, queueFamily_, 0, &queue_);
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice_, &memoryProperties_);
+  getHardwareBufferProperties_ = (PFN_vkGetAndroidHardwareBufferPropertiesANDROID)
+      vkGetDeviceProcAddr(device_, "vkGetAndroidHardwareBufferPropertiesANDROID");
+  if (importsSyncFiles_ || exportsSyncFiles_) {
+    importSemaphoreFd_ =
+        (PFN_vkImportSemaphoreFdKHR)vkGetDeviceProcAddr(device_, "vkImportSemaphoreFdKHR");
+    getSemaphoreFd_ = (PFN_vkGetSemaphoreFdKHR)vkGetDeviceProcAddr(device_, "vkGetSemaphoreFdKHR");
+  }
+  importsSyncFiles_ = importsSyncFiles_ && importSemaphoreFd_ != nullptr;
+  exportsSyncFiles_ = exportsSyncFiles_ && getSemaphoreFd_ != nullptr;
+  return getHardwareBufferProperties_ != nullptr;
+}
+
+bool VulkanConverter::initPipeline() {
+  VkShaderModuleCreateInfo moduleInfo{VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+  if (format_ == UVC_FRAME_FORMAT_YUYV) {
+    moduleInfo.codeSize = sizeof(kYuyvShader);
+    moduleInfo.pCode = kYuyvShader;
+  } else if (format_ == UVC_FRAME_FORMAT_NV12) {
+    moduleInfo.codeSize = sizeof(kNv12Shader);
+    moduleInfo.pCode = kNv12Shader;
+  } else {
+    moduleInfo.codeSize = sizeof(kP010Shader);
+    moduleInfo.pCode = kP010Shader;
+  }
+  VkShaderModule module = VK_NULL_HANDLE;
+  if (vkCreateShaderModule(device_, &moduleInfo, nullptr, &module) != VK_SUCCESS) {
+    ULOGE("vkCreateShaderModule failed");
+    return false;
+  }
+
+  VkDescriptorSetLayoutBinding bindings[2]{};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkDescriptorSetLayoutCreateInfo setInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+  setInfo.bindingCount = 2;
+  setInfo.pBindings = bindings;
+  VkPushConstantRange range{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Parameters)};
+  VkPipelineLayoutCreateInfo layoutInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout_;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &range;
+  bool created =
+      vkCreateDescriptorSetLayout(device_, &setInfo, nullptr, &setLayout_) == VK_SUCCESS &&
+      vkCreatePipelineLayout(device_, &layoutInfo, nullptr, &pipelineLayout_) == VK_SUCCESS;
+  if (created) {
+    VkComputePipelineCreateInfo pipelineInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout_;
+    created = vkCreateComputePipelines(
+                  device_, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline_) == VK_SUCCESS;
+  }
+  vkDestroyShaderModule(device_, module, nullptr);
+  if (!created) {
+    ULOGE("Compute pipeline creation failed");
+  }
+  return created;
+}
+
+bool VulkanConverter::initSubmissions() {
+  VkDescriptorPoolSize sizes[] = {
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, (uint32_t)kHeldFrameCount},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, (uint32_t)kHeldFrameCount},
+  };
+  VkDescriptorPoolCreateInfo descriptorInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+  descriptorInfo.maxSets = (uint32_t)kHeldFrameCount;
+  descriptorInfo.poolSizeCount = (uint32_t)std::size(sizes);
+  descriptorInfo.pPoolSizes = sizes;
+  VkCommandPoolCreateInfo commandInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+  commandInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  commandInfo.queueFamilyIndex = queueFamily_;
+  if (vkCreateDescriptorPool(device_, &descriptorInfo, nullptr, &descriptorPool_) != VK_SUCCESS ||
+      vkCreateCommandPool(device_, &commandInfo, nullptr, &commandPool_) != VK_SUCCESS) {
+    ULOGE("Descriptor or command pool creation failed");
+    return false;
+  }
+  VkExportSemaphoreCreateInfo exportInfo{VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO};
+  exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+  for (Submission& submission : submissions_) {
+    VkCommandBufferAllocateInfo commandsInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    commandsInfo.commandPool = commandPool_;
+    commandsInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandsInfo.commandBufferCount = 1;
+    VkDescriptorSetAllocateInfo setInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    setInfo.descriptorPool = descriptorPool_;
+    setInfo.descriptorSetCount = 1;
+    setInfo.pSetLayouts = &setLayout_;
+    VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    VkSemaphoreCreateInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    VkSemaphoreCreateInfo doneInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    doneInfo.pNext = exportsSyncFiles_ ? &exportInfo : nullptr;
+    if (vkAllocateCommandBuffers(device_, &commandsInfo, &submission.commands) != VK_SUCCESS ||
+        vkAllocateDescriptorSets(device_, &setInfo, &submission.descriptors) != VK_SUCCESS ||
+        vkCreateFence(device_, &fenceInfo, nullptr, &submission.fence) != VK_SUCCESS ||
+        vkCreateSemaphore(device_, &waitInfo, nullptr, &submission.waitSemaphore) != VK_SUCCESS ||
+        vkCreateSemaphore(device_, &doneInfo, nullptr, &submission.doneSemaphore) != VK_SUCCESS) {
+      ULOGE("Submission setup failed");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool VulkanConverter::convert(
+    uvc_frame_t* frame,
+    AHardwareBuffer* output,
+    int waitFence,
+    int& doneFence) {
+  doneFence = -1;
+  size_t rows = format_ == UVC_FRAME_FORMAT_YUYV ? height_ : height_ + height_ / 2;
+  size_t bytes = frame->step * rows;
+  if (frame->width != (uint32_t)width_ || frame->height != (uint32_t)height_ ||
+      frame->data_bytes < bytes) {
+    ULOGE(
+        "Frame %ux%u of %zu bytes does not match %dx%d",
+        frame->width,
+        frame->height,
+        frame->data_bytes,
+        width_,
+        height_);
+    waitForFence(waitFence);
+    return false;
+  }
+  Submission& submission = submissions_[nextSubmission_];
+  nextSubmission_ = (nextSubmission_ + 1) % kHeldFrameCount;
+  finish(submission);
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = outputView(output, image);
+  VkBuffer source = view != VK_NULL_HANDLE ? slotBuffer(frame, bytes) : VK_NULL_HANDLE;
+  bool fromSlot = source != VK_NULL_HANDLE;
+  if (view != VK_NULL_HANDLE && !fromSlot) {
+    source = stage(submission, frame, bytes);
+  }
+  if (source == VK_NULL_HANDLE) {
+    waitForFence(waitFence);
+    return false;
+  }
+  bool waits = waitFence >= 0 && importWaitFence(submission, waitFence);
+  if (!waits) {
+    waitForFence(waitFence);
+  }
+
+  VkDescriptorBufferInfo bufferInfo{source, 0, VK_WHOLE_SIZE};
+  VkDescriptorImageInfo imageInfo{VK_NULL_HANDLE, view, VK_IMAGE_LAYOUT_GENERAL};
+  VkWriteDescriptorSet writes[2]{};
+  for (VkWriteDescriptorSet& write : writes) {
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = submission.descriptors;
+    write.descriptorCount = 1;
+  }
+  writes[0].dstBinding = 0;
+  writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  writes[0].pBufferInfo = &bufferInfo;
+  writes[1].dstBinding = 1;
+  writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  writes[1].pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(device_, 2, writes, 0, nullptr);
+
+  // Slots and outputs come from and go back to the CPU and the compositor,
+  // foreign queues; the staging copy is the host's, made visible by the
+  // submission. Every output pixel is written, so its contents are not.
+  VkBufferMemoryBarrier sourceBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+  sourceBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  sourceBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+  sourceBarrier.dstQueueFamilyIndex = queueFamily_;
+  sourceBarrier.buffer = source;
+  sourceBarrier.size = VK_WHOLE_SIZE;
+  VkImageMemoryBarrier outputBarrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+  outputBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  outputBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  outputBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  outputBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+  outputBarrier.dstQueueFamilyIndex = queueFamily_;
+  outputBarrier.image = image;
+  outputBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  VkCommandBuffer commands = submission.commands;
+  VkCommandBufferBeginInfo begin{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+  begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commands, &begin);
+  vkCmdPipelineBarrier(
+      commands,
+      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      0,
+      nullptr,
+      fromSlot ? 1 : 0,
+      &sourceBarrier,
+      1,
+      &outputBarrier);
+  Colorimetry::Coefficients weights = colorimetry_.coefficients();
+  Parameters parameters{
+      {weights.crR, weights.cbG, weights.crG, weights.cbB},
+      {weights.yOffset, weights.yScale},
+      {width_, height_},
+      (int32_t)frame->step,
+      (int32_t)(frame->step * height_),
+  };
+  vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+  vkCmdBindDescriptorSets(
+      commands,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      pipelineLayout_,
+      0,
+      1,
+      &submission.descriptors,
+      0,
+      nullptr);
+  vkCmdPushConstants(
+      commands,
+      pipelineLayout_,
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(parameters),
+      &parameters);
+  vkCmdDispatch(
+      commands, (width_ + kGroupSize - 1) / kGroupSize, (height_ + kGroupSize - 1) / kGroupSize, 1);
+  sourceBarrier.srcAccessMask = 0;
+  sourceBarrier.dstAccessMask = 0;
+  std::swap(sourceBarrier.srcQueueFamilyIndex, sourceBarrier.dstQueueFamilyIndex);
+  outputBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  outputBarrier.dstAccessMask = 0;
+  outputBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  std::swap(outputBarrier.srcQueueFamilyIndex, outputBarrier.dstQueueFamilyIndex);
+  vkCmdPipelineBarrier(
+      commands,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
+      0,
+      nullptr,
+      fromSlot ? 1 : 0,
+      &sourceBarrier,
+      1,
+      &outputBarrier);
+  if (vkEndCommandBuffer(commands) != VK_SUCCESS) {
+    ULOGE("vkEndCommandBuffer failed");
+    return false;
+  }
+
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  VkSubmitInfo submit{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+  submit.waitSemaphoreCount = waits ? 1 : 0;
+  submit.pWaitSemaphores = &submission.waitSemaphore;
+  submit.pWaitDstStageMask = &waitStage;
+  submit.commandBufferCount = 1;
+  submit.pCommandBuffers = &commands;
+  submit.signalSemaphoreCount = exportsSyncFiles_ ? 1 : 0;
+  submit.pSignalSemaphores = &submission.doneSemaphore;
+  vkResetFences(device_, 1, &submission.fence);
+  VkResult result = vkQueueSubmit(queue_, 1, &submit, submission.fence);
+  if (result != VK_SUCCESS) {
+    ULOGE("vkQueueSubmit failed %d", result);
+    return false;
+  }
+  submission.pending = true;
+  if (fromSlot) {
+    uvc_retain_frame(frame);
+    submission.frame = frame;
+  }
+  if (exportsSyncFiles_) {
+    VkSemaphoreGetFdInfoKHR info{VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR};
+    info.semaphore = submission.doneSemaphore;
+    info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+    if (getSemaphoreFd_(device_, &info, &doneFence) == VK_SUCCESS) {
+      return true;
+    }
+    // Left signaled, so no later submission may signal it again.
+    ULOGW("Semaphore export failed, waiting for conversions on the CPU");
+    exportsSyncFiles_ = false;
+    doneFence = -1;
+  }
+  vkWaitForFences(device_, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+  return true;
+}
+
+void VulkanConverter::finish(Submission& submission) {
+  if (submission.pending) {
+    // Usually signaled long ago, kHeldFrameCount frames back.
+    vkWaitForFences(device_, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+    submission.pending = false;
+  }
+  if (submission.frame != nullptr) {
+    uvc_release_frame(submission.frame);
+    submission.frame = nullptr;
+  }
+}
+
+void VulkanConverter::releaseHeldFrames() {
+  for (Submission& submission : submissions_) {
+    finish(submission);
+  }
+}
+
+VkBuffer VulkanConverter::slotBuffer(const uvc_frame_t* frame, size_t bytes) {
+  HardwareFrameBuffers::Slot found;
+  if (!importsSlots_ || !HardwareFrameBuffers::find(frame->data, found) || bytes > found.bytes) {
+    return VK_NULL_HANDLE;
+  }
+  useCount_++;
+  ImportedSlot* oldest = &importedSlots_[0];
+  for (ImportedSlot& slot : importedSlots_) {
+    if (slot.id == found.id) {
+      slot.usedAt = useCount_;
+      return slot.handle;
+    }
+    if (slot.usedAt < oldest->usedAt) {
+      oldest = &slot;
+    }
+  }
+  // The least recently used import is no longer read by the GPU: the
+  // submissions reading it finished, or it belongs to a freed slot.
+  releaseImportedSlot(*oldest);
+  ImportedSlot& slot = *oldest;
+  VkExternalMemoryBufferCreateInfo external{VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO};
+  external.handleTypes = kHardwareBufferHandle;
+  VkBufferCreateInfo info{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  info.pNext = &external;
+  info.size = found.bytes;
+  info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(device_, &info, nullptr, &slot.handle) != VK_SUCCESS ||
+      !importMemory(found.buffer, slot.handle, VK_NULL_HANDLE, slot.memory) ||
+      vkBindBufferMemory(device_, slot.handle, slot.memory, 0) != VK_SUCCESS) {
+    ULOGW("Frame slot import failed, copying frames");
+    releaseImportedSlot(slot);
+    importsSlots_ = false;
+    return VK_NULL_HANDLE;
+  }
+  AHardwareBuffer_acquire(found.buffer);
+  slot.id = found.id;
+  slot.buffer = found.buffer;
+  slot.usedAt = useCount_;
+  return slot.handle;
+}
+
+VkImageView VulkanConverter::outputView(AHardwareBuffer* output, VkImage& image) {
+  useCount_++;
+  ImportedOutput* oldest = &importedOutputs_[0];
+  for (ImportedOutput& imported : importedOutputs_) {
+    if (imported.buffer == output) {
+      imported.usedAt = useCount_;
+      image = imported.image;
+      return imported.view;
+    }
+    if (imported.usedAt < oldest->usedAt) {
+      oldest = &imported;
+    }
+  }
+  if (oldest->buffer != nullptr) {
+    // Outputs of a presenter replaced since, which may still be written.
+    vkQueueWaitIdle(queue_);
+    releaseImportedOutput(*oldest);
+  }
+  AHardwareBuffer_Desc desc;
+  AHardwareBuffer_describe(output, &desc);
+  if ((desc.format != AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM &&
+       desc.format != AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM) ||
+      desc.width != (uint32_t)width_ || desc.height != (uint32_t)height_) {
+    ULOGE("Output %ux%u format %u is not RGBA of the frames", desc.width, desc.height, desc.format);
+    return VK_NULL_HANDLE;
+  }
+  ImportedOutput& imported = *oldest;
+  VkExternalMemoryImageCreateInfo external{VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO};
+  external.handleTypes = kHardwareBufferHandle;
+  VkImageCreateInfo info{VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+  info.pNext = &external;
+  info.imageType = VK_IMAGE_TYPE_2D;
+  // R8G8B8X8 buffers import as this too.
+  info.format = VK_FORMAT_R8G8B8A8_UNORM;
+  info.extent = {desc.width, desc.height, 1};
+  info.mipLevels = 1;
+  info.arrayLayers = 1;
+  info.samples = VK_SAMPLE_COUNT_1_BIT;
+  info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  info.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (vkCreateImage(device_, &info, nullptr, &imported.image) != VK_SUCCESS ||
+      !importMemory(output, VK_NULL_HANDLE, imported.image, imported.memory) ||
+      vkBindImageMemory(device_, imported.image, imported.memory, 0) != VK_SUCCESS) {
+    ULOGE("Output buffer import failed");
+    releaseImportedOutput(imported);
+    return VK_NULL_HANDLE;
+  }
+  VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+  viewInfo.image = imported.image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  if (vkCreateImageView(device_, &viewInfo, nullptr, &imported.view) != VK_SUCCESS) {
+    ULOGE("vkCreateImageView failed");
+    releaseImportedOutput(imported);
+    return VK_NULL_HANDLE;
+  }
+  AHardwareBuffer_acquire(output);
+  imported.buffer = output;
+  imported.usedAt = useCount_;
+  image = imported.image;
+  return imported.view;
+}
+
+VkBuffer VulkanConverter::stage(Submission& submission, const uvc_frame_t* frame, size_t bytes) {
+  Staging& staging = submission.staging;
+  if (staging.bytes < bytes) {
+    releaseStaging(staging);
+    VkBufferCreateInfo info{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    info.size = bytes;
+    info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device_, &info, nullptr, &staging.handle) != VK_SUCCESS) {
+      ULOGE("vkCreateBuffer of %zu bytes failed", bytes);
+      return VK_NULL_HANDLE;
+    }
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device_, staging.handle, &requirements);
+    int32_t type = memoryType(
+        requirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    VkMemoryAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocateInfo.allocationSize = requirements.size;
+    allocateInfo.memoryTypeIndex = (uint32_t)type;
+    if (type < 0 ||
+        vkAllocateMemory(device_, &allocateInfo, nullptr, &staging.memory) != VK_SUCCESS ||
+        vkBindBufferMemory(device_, staging.handle, staging.memory, 0) != VK_SUCCESS ||
+        vkMapMemory(device_, staging.memory, 0, VK_WHOLE_SIZE, 0, &staging.data) != VK_SUCCESS) {
+      ULOGE("Host visible memory of %zu bytes unavailable", bytes);
+      releaseStaging(staging);
+      return VK_NULL_HANDLE;
+    }
+    staging.bytes = bytes;
+  }
+  memcpy(staging.data, frame->data, bytes);
+  return staging.handle;
+}
+
+bool VulkanConverter::importMemory(
+    AHardwareBuffer* buffer,
+    VkBuffer dedicatedBuffer,
+    VkImage dedicatedImage,
+    VkDeviceMemory& memory) {
+  VkAndroidHardwareBufferPropertiesANDROID properties{
+      VK_STRUCTURE_TYPE_ANDROID_HARDWARE_BUFFER_PROPERTIES_ANDROID};
+  if (getHardwareBufferProperties_(device_, buffer, &properties) != VK_SUCCESS) {
+    return false;
+  }
+  int32_t type = memoryType(properties.memoryTypeBits, 0);
+  if (type < 0) {
+    return false;
+  }
+  VkMemoryDedicatedAllocateInfo dedicated{VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO};
+  dedicated.image = dedicatedImage;
+  dedicated.buffer = dedicatedBuffer;
+  VkImportAndroidHardwareBufferInfoANDROID import{
+      VK_STRUCTURE_TYPE_IMPORT_ANDROID_HARDWARE_BUFFER_INFO_ANDROID};
+  import.pNext = &dedicated;
+  import.buffer = buffer;
+  VkMemoryAllocateInfo info{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+  info.pNext = &import;
+  info.allocationSize = properties.allocationSize;
+  info.memoryTypeIndex = (uint32_t)type;
+  if (vkAllocateMemory(device_, &info, nullptr, &memory) != VK_SUCCESS) {
+    memory = VK_NULL_HANDLE;
+    return false;
+  }
+  return true;
+}
+
+bool VulkanConverter::importWaitFence(Submission& submission, int waitFence) {
+  if (!importsSyncFiles_) {
+    return false;
+  }
+  // Temporary, as sync files are; the submission's wait consumes it. The
+  // semaphore owns the fence once imported.
+  VkImportSemaphoreFdInfoKHR info{VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR};
+  info.semaphore = submission.waitSemaphore;
+  info.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT;
+  info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+  info.fd = waitFence;
+  return importSemaphoreFd_(device_, &info) == VK_SUCCESS;
+}
+
+int32_t VulkanConverter::memoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) const {
+  for (uint32_t i = 0; i < memoryProperties_.memoryTypeCount; i++) {
+    if ((typeBits & (1u << i)) != 0 &&
+        (memoryProperties_.memoryTypes[i].propertyFlags & flags) == flags) {
+      return (int32_t)i;
+    }
+  }
+  return -1;
+}
+
+void VulkanConverter::releaseImportedSlot(ImportedSlot& slot) {
+  if (slot.handle != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device_, slot.handle, nullptr);
+  }
+  if (slot.memory != VK_NULL_HANDLE) {
+    vkFreeMemory(device_, slot.memory, nullptr);
+  }
+  if (slot.buffer != nullptr) {
+    AHardwareBuffer_release(slot.buffer);
+  }
+  slot = ImportedSlot{};
+}
+
+void VulkanConverter::releaseImportedOutput(ImportedOutput& output) {
+  if (output.view != VK_NULL_HANDLE) {
+    vkDestroyImageView(device_, output.view, nullptr);
+  }
+  if (output.image != VK_NULL_HANDLE) {
+    vkDestroyImage(device_, output.image, nullptr);
+  }
+  if (output.memory != VK_NULL_HANDLE) {
+    vkFreeMemory(device_, output.memory, nullptr);
+  }
+  if (output.buffer != nullptr) {
+    AHardwareBuffer_release(output.buffer);
+  }
+  output = ImportedOutput{};
+}
+
+void VulkanConverter::releaseStaging(Staging& staging) {
+  if (staging.handle != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device_, staging.handle, nullptr);
+  }
+  if (staging.memory != VK_NULL_HANDLE) {
+    // Unmapped with it.
+    vkFreeMemory(device_, staging.memory, nullptr);
+  }
+  staging = Staging{};
+}
+
+void VulkanConverter::destroy() {
+  if (device_ != VK_NULL_HANDLE) {
+    vkDeviceWaitIdle(device_);
+    for (Submission& submission : submissions_) {
+      submission.pending = false;
+      finish(submission);
+      releaseStaging(submission.staging);
+      if (submission.fence != VK_NULL_HANDLE) {
+        vkDestroyFence(device_, submission.fence, nullptr);
+      }
+      if (submission.waitSemaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(device_, submission.waitSemaphore, nullptr);
+      }
+      if (submission.doneSemaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(device_, submission.doneSemaphore, nullptr);
+      }
+      // Command buffers and descriptor sets go with their pools.
+      submission = Submission{};
+    }
+    for (ImportedSlot& slot : importedSlots_) {
+      releaseImportedSlot(slot);
+    }
+    for (ImportedOutput& output : importedOutputs_) {
+      releaseImportedOutput(output);
+    }
+    if (pipeline_ != VK_NULL_HANDLE) {
+      vkDestroyPipeline(device_, pipeline_, nullptr);
+    }
+    if (pipelineLayout_ != VK_NULL_HANDLE) {
+      vkDestroyPipelineLayout(device_, pipelineLayout_, nullptr);
+    }
+    if (setLayout_ != VK_NULL_HANDLE) {
+      vkDestroyDescriptorSetLayout(device_, setLayout_, nullptr);
+    }
+    if (descriptorPool_ != VK_NULL_HANDLE) {
+      vkDestroyDescriptorPool(device_, descriptorPool_, nullptr);
+    }
+    if (commandPool_ != VK_NULL_HANDLE) {
+      vkDestroyCommandPool(device_, commandPool_, nullptr);
+    }
+    vkDestroyDevice(device_, nullptr);
+  }
+  if (instance_ != VK_NULL_HANDLE) {
+    vkDestroyInstance(instance_, nullptr);
+  }
+  instance_ = VK_NULL_HANDLE;
+  physicalDevice_ = VK_NULL_HANDLE;
+  device_ = VK_NULL_HANDLE;
+  queue_ = VK_NULL_HANDLE;
+  pipeline_ = VK_NULL_HANDLE;
+  pipelineLayout_ = VK_NULL_HANDLE;
+  setLayout_ = VK_NULL_HANDLE;
+  descriptorPool_ = VK_NULL_HANDLE;
+  commandPool_ = VK_NULL_HANDLE;
+  importsSlots_ = false;
+  importsSyncFiles_ = false;
+  exportsSyncFiles_ = false;
+  getHardwareBufferProperties_ = nullptr;
+  importSemaphoreFd_ = nullptr;
+  getSemaphoreFd_ = nullptr;
+  nextSubmission_ = 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#define VK_USE_PLATFORM_ANDROID_KHR
+#include <android/hardware_buffer.h>
+#include <libuvc/libuvc.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+
+#include "Colorimetry.h"
+
+// Converts raw YUYV, NV12 or P010 camera frames to RGBA AHardwareBuffers in
+// a Vulkan compute shader, for devices where GLES external sampling is slow
+// or missing. The shaders are shaders/VulkanConvert.comp, compiled to
+// SPIR-V by glslc at build time.
+//
+// Frames whose data is a HardwareFrameBuffers slot are imported as storage
+// buffers through VK_ANDROID_external_memory_android_hardware_buffer and
+// read where libuvc reassembled them; others are copied into a host visible
+// buffer first. The output buffers are imported the same way, as storage
+// images, and handed between the compositor and the queue as foreign
+// memory. Fences go both ways as sync files where the driver exports and
+// imports them, and are waited for on the CPU otherwise.
+//
+// No lens correction, scaling or label: streams that need them are
+// converted by FrameConverter.
+//
+// init() may run on any thread; the others must then be called from one
+// thread at a time.
+class VulkanConverter final {
+ public:
+  // Frames convert() may keep referenced until the GPU read them, which the
+  // frame pool must have besides the ones in flight.
+  static constexpr size_t kHeldFrameCount = 3;
+
+  VulkanConverter() = default;
+  VulkanConverter(const VulkanConverter&) = delete;
+  VulkanConverter& operator=(const VulkanConverter&) = delete;
+  ~VulkanConverter();
+
+  static bool supportsFormat(uvc_frame_format format);
+
+  // False when there is no Vulkan 1.1 device that imports hardware buffers
+  // as storage buffers and RGBA storage images.
+  bool init(
+      int32_t width,
+      int32_t height,
+      uvc_frame_format format,
+      const Colorimetry& colorimetry);
+  // Writes frame into output, an R8G8B8A8 or R8G8B8X8 buffer of its size
+  // with GPU sampled image usage, once waitFence signals; -1 for none, and
+  // owned either way. doneFence is set to a fence the caller then owns that
+  // signals once output is written, or -1 when convert() waited for that.
+  // Retains frame while the GPU reads it from its slot.
+  bool convert(uvc_frame_t* frame, AHardwareBuffer* output, int waitFence, int& doneFence);
+  // Waits for the GPU and gives back the frames it read from their slots,
+  // before the stream stops.
+  void releaseHeldFrames();
+
+ private:
+  // Slots and outputs kept imported, the least recently used going first; a
+  // pool has fewer slots, and a presenter three outputs.
+  static constexpr size_t kImportedSlotCount = 16;
+  static constexpr size_t kImportedOutputCount = 4;
+
+  // The push constants of shaders/VulkanConvert.comp.
+  struct Parameters {
+    float chroma[4];
+    float luma[2];
+    int32_t size[2];
+    int32_t step;
+    int32_t chromaOffset;
+  };
+  // A HardwareFrameBuffers slot imported as a storage buffer.
+  struct ImportedSlot {
+    uint64_t id{};
+    // Referenced, as the slot may be freed while imported.
+    AHardwareBuffer* buffer{};
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkBuffer handle{VK_NULL_HANDLE};
+    uint64_t usedAt{};
+  };
+  struct ImportedOutput {
+    // Referenced, so its address is not reused while imported.
+    AHardwareBuffer* buffer{};
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkImage image{VK_NULL_HANDLE};
+    VkImageView view{VK_NULL_HANDLE};
+    uint64_t usedAt{};
+  };
+  // A host visible copy of a frame that is not in a slot.
+  struct Staging {
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkBuffer handle{VK_NULL_HANDLE};
+    VkDeviceSize bytes{};
+    void* data{};
+  };
+  // One frame in flight, reused once its fence signaled.
+  struct Submission {
+    VkCommandBuffer commands{VK_NULL_HANDLE};
+    VkDescriptorSet descriptors{VK_NULL_HANDLE};
+    VkFence fence{VK_NULL_HANDLE};
+    // The output's release fence, imported; and the one convert() hands out.
+    VkSemaphore waitSemaphore{VK_NULL_HANDLE};
+    VkSemaphore doneSemaphore{VK_NULL_HANDLE};
+    Staging staging{};
+    uvc_frame_t* frame{};
+    bool pending{false};
+  };
+
+  VkInstance instance_{VK_NULL_HANDLE};
+  VkPhysicalDevice physicalDevice_{VK_NULL_HANDLE};
+  VkDevice device_{VK_NULL_HANDLE};
+  VkQueue queue_{VK_NULL_HANDLE};
+  uint32_t queueFamily_{};
+  VkPhysicalDeviceMemoryProperties memoryProperties_{};
+  // Whether slots are read in place, or copied.
+  bool importsSlots_{false};
+  // Whether fences cross as sync files, or are waited for on the CPU.
+  bool importsSyncFiles_{false};
+  bool exportsSyncFiles_{false};
+  PFN_vkGetAndroidHardwareBufferPropertiesANDROID getHardwareBufferProperties_{};
+  PFN_vkImportSemaphoreFdKHR importSemaphoreFd_{};
+  PFN_vkGetSemaphoreFdKHR getSemaphoreFd_{};
+  VkDescriptorSetLayout setLayout_{VK_NULL_HANDLE};
+  VkPipelineLayout pipelineLayout_{VK_NULL_HANDLE};
+  VkPipeline pipeline_{VK_NULL_HANDLE};
+  VkDescriptorPool descriptorPool_{VK_NULL_HANDLE};
+  VkCommandPool commandPool_{VK_NULL_HANDLE};
+  std::array<Submission, kHeldFrameCount> submissions_{};
+  size_t nextSubmission_{};
+  std::array<ImportedSlot, kImportedSlotCount> importedSlots_{};
+  std::array<ImportedOutput, kImportedOutputCount> importedOutputs_{};
+  uint64_t useCount_{};
+  int32_t width_{};
+  int32_t height_{};
+  uvc_frame_format format_{};
+  Colorimetry colorimetry_{};
+
+  bool initInstance();
+  // Picks the first device with a compute queue and the extensions.
+  bool initDevice();
+  bool initPipeline();
+  bool initSubmissions();
+  // Waits for submission, then gives back its frame.
+  void finish(Submission& submission);
+  // The storage buffer of frame's slot, null to copy the frame instead.
+  VkBuffer slotBuffer(const uvc_frame_t* frame, size_t bytes);
+  // Imported output, the view of its storage image; null when it cannot be.
+  VkImageView outputView(AHardwareBuffer* output, VkImage& image);
+  // Copies frame into the submission's staging buffer, grown to bytes.
+  VkBuffer stage(Submission& submission, const uvc_frame_t* frame, size_t bytes);
+  bool importMemory(
+      AHardwareBuffer* buffer,
+      VkBuffer dedicatedBuffer,
+      VkImage dedicatedImage,
+      VkDeviceMemory& memory);
+  // Where waitFence, owned, has the submission wait; false to wait on the CPU.
+  bool importWaitFence(Submission& submission, int waitFence);
+  int32_t memoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) const;
+  void releaseImportedSlot(ImportedSlot& slot);
+  void releaseImportedOutput(ImportedOutput& output);
+  void releaseStaging(Staging& staging);
+  void destroy();
+};
@@ -39,4 +39,17 @@ inline aaudio_performance_mode_t convertPerfMode(int jPerfMode) {
       return AAUDIO_PERFORMANCE_MODE_NONE;
   }
 }
+inline const char* perfModeName(aaudio_performance_mode_t perfMode) {
+  switch (perfMode) {
+    case AAUDIO_PERFORMANCE_MODE_LOW_LATENCY:
+      return "low latency";
+    case AAUDIO_PERFORMANCE_MODE_POWER_SAVING:
+      return "power saving";
+    default:
+      return "default";
+  }
+}
+inline const char* sharingModeName(aaudio_sharing_mode_t sharingMode) {
+  return sharingMode == AAUDIO_SHARING_MODE_EXCLUSIVE ? "exclusive" : "shared";
+}
 #endif // USB_VIDEO_AAUDIO_TYPE_CONVERSION_H
@@ -0,0 +1,870 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Deterministic simulation of the USB audio path, to reproduce and measure
+// glitches without a device.
+//
+// A synthetic device sends isochronous packets of a sine at its own clock,
+// off the nominal rate by a configurable drift, with completions delayed by
+// random jitter and packets failing at a given rate. The packets go through
+// the same steps as in UsbAudioStreamer: PcmConverter to float, AudioConcealer
+// for errored packets, ChannelMixer and AsyncResampler into the playback ring,
+// and AudioGainStage on the ring when a scenario turns it on.
+// A simulated AAudio callback drains the ring at the output rate, bursts at a
+// time with its own jitter, and AudioTap readers follow the ring on the side.
+//
+// Time is simulated and the random generator seeded, so every count in the
+// report is the same from run to run; only the CPU times per USB completion
+// and per callback, measured on the thread's CPU clock, vary. The first
+// second is left out of the counts, as AudioLatencyTuner leaves out startup.
+//
+// With --loopback it runs LoopbackMeter instead, against a speaker and a USB
+// microphone of known latencies, and reports what the meter measured next to
+// the round trip it should find.
+
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "AsyncResampler.h"
+#include "AudioConcealer.h"
+#include "AudioGainStage.h"
+#include "AudioTap.h"
+#include "ChannelMixer.h"
+#include "LoopbackMeter.h"
+#include "PcmConverter.h"
+#include "RingBuffer.h"
+
+using namespace std::chrono;
+
+namespace {
+
+constexpr int64_t kNsPerSecond = 1'000'000'000;
+// Excluded from the counts, while the ring first fills.
+constexpr int64_t kWarmupNs = kNsPerSecond;
+// UsbAudioStreamer's kSpareTransfers on top of the transfers in flight.
+constexpr uint32_t kSpareTransfers = 4;
+constexpr double kToneHz = 997.0;
+
+struct Scenario {
+  std::string name;
+  uint32_t inputRate{48000};
+  uint32_t outputRate{48000};
+  uint32_t channels{2};
+  uint32_t channelMask{0x3};
+  uint32_t outputChannels{2};
+  PcmEncoding inputEncoding{PcmEncoding::I16};
+  PcmEncoding outputEncoding{PcmEncoding::I16};
+  uint32_t packetIntervalUs{1000};
+  int32_t framesPerBurst{192};
+  // AAudio buffer capacity, which sets the transfers in flight.
+  int32_t bufferCapacityFrames{192 * 4};
+  double driftPpm{0};
+  // Completions and callbacks come up to this late, uniformly distributed.
+  uint32_t usbJitterUs{0};
+  uint32_t callbackJitterUs{0};
+  double packetErrorRate{0};
+  uint32_t targetFillMs{8};
+  uint32_t tapReaders{0};
+  uint32_t tapPeriodMs{10};
+  // AudioGainStage at this gain, muted and unmuted every muteToggleMs
+  // when not zero.
+  bool gainStage{false};
+  float gainDb{0};
+  bool softClip{false};
+  uint32_t muteToggleMs{0};
+};
+
+// The speaker and microphone of a loopback measurement.
+struct LoopbackScenario {
+  std::string name;
+  uint32_t outputRate{48000};
+  uint32_t inputRate{48000};
+  uint32_t inputChannels{1};
+  int32_t framesPerBurst{192};
+  // From the callback handing a frame over to the speaker playing it, as
+  // AAudio's timestamps report it, and on to the microphone.
+  double outputLatencyMs{20};
+  double acousticMs{1};
+  // From the microphone until the transfer holding it completes, plus up to
+  // usbJitterUs later.
+  double inputLatencyMs{4};
+  uint32_t transferMs{4};
+  uint32_t usbJitterUs{0};
+  // Of the sequence at the microphone, and the RMS of its noise.
+  double gain{0.5};
+  double noise{0.001};
+  // Microphone audio waiting in the ring, for the pass-through latency.
+  double bufferedMs{8};
+};
+
+struct Options {
+  std::regex filter{".*"};
+  double seconds{60};
+  uint32_t seed{1};
+  bool tsv{false};
+  bool loopback{false};
+  uint32_t bursts{10};
+};
+
+struct Result {
+  uint64_t underruns{};
+  uint64_t overruns{};
+  uint64_t framesConcealed{};
+  uint64_t packetFramesConcealed{};
+  uint64_t tapLostFrames{};
+  double fillP50Ms{};
+  double fillP99Ms{};
+  // Measured drift correction at the end, against the configured drift.
+  double ratioPpm{};
+  double usbMeanUs{};
+  double usbP99Us{};
+  double callbackMeanUs{};
+  double callbackP99Us{};
+};
+
+int64_t threadCpuNs() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * kNsPerSecond + ts.tv_nsec;
+}
+
+template <typename T>
+double percentile(std::vector<T> values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return (double)values[index];
+}
+
+template <typename T>
+double mean(const std::vector<T>& values) {
+  double sum = 0;
+  for (T value : values) {
+    sum += value;
+  }
+  return values.empty() ? 0 : sum / values.size();
+}
+
+// Writes a sample in [-1, 1] as a USB subframe.
+void writeSample(float value, PcmEncoding encoding, uint8_t* dst) {
+  switch (encoding) {
+    case PcmEncoding::I16: {
+      int16_t sample = (int16_t)std::lrint(value * 32767.0f);
+      memcpy(dst, &sample, sizeof(sample));
+      break;
+    }
+    case PcmEncoding::I24_PACKED: {
+      int32_t sample = (int32_t)std::lrint(value * 8388607.0f);
+      dst[0] = sample & 0xff;
+      dst[1] = (sample >> 8) & 0xff;
+      dst[2] = (sample >> 16) & 0xff;
+      break;
+    }
+    case PcmEncoding::I32: {
+      int32_t sample = (int32_t)std::lrint(value * 2147483520.0f);
+      memcpy(dst, &sample, sizeof(sample));
+      break;
+    }
+    case PcmEncoding::FLOAT:
+      memcpy(dst, &value, sizeof(value));
+      break;
+  }
+}
+
+// The device and host sides of one stream, with buffers sized the way
+// UsbAudioStreamer::allocateTransferRequests() sizes them.
+class SimulatedStream final {
+ public:
+  SimulatedStream(const Scenario& scenario, uint32_t seed) : scenario_(scenario), random_(seed) {}
+
+  Result run(double seconds);
+
+ private:
+  const Scenario& scenario_;
+  std::mt19937 random_;
+
+  PcmConverter inputConverter_{};
+  PcmConverter outputConverter_{};
+  ChannelMixer mixer_{};
+  AsyncResampler resampler_{};
+  AudioConcealer packetConcealer_{};
+  AudioConcealer playbackConcealer_{};
+  AudioGainStage gainStage_{};
+  bool muted_{false};
+  std::unique_ptr<RingBufferPcm> ring_{};
+  AudioTap tap_{};
+
+  size_t frameBytes_{};
+  size_t outputFrameBytes_{};
+  uint32_t resampledChannels_{};
+  uint32_t nominalPacketBytes_{};
+  uint32_t packetsPerTransfer_{};
+  std::vector<uint8_t> transfer_{};
+  std::vector<uint32_t> packetBytes_{};
+  std::vector<bool> packetErrors_{};
+  std::vector<float> resamplerInput_{};
+  std::vector<float> resamplerOutput_{};
+  std::vector<float> mixBuffer_{};
+  std::vector<uint8_t> callbackBuffer_{};
+
+  double devicePhase_{};
+  double deviceFrameCarry_{};
+  int64_t framesPlayed_{};
+  // On the output's clock, without the callback jitter, as
+  // AAudioStream_getTimestamp() reports it.
+  int64_t framesPlayedAtNs_{};
+  int64_t outputTimestampAtNs_{-kNsPerSecond};
+
+  void setUp();
+  void fillTransfer();
+  void completeTransfer(int64_t nowNs, Result& result, bool counted);
+  void playbackCallback(int64_t nowNs, Result& result, bool counted);
+};
+
+void SimulatedStream::setUp() {
+  const Scenario& s = scenario_;
+  inputConverter_.init(s.inputEncoding, PcmEncoding::FLOAT);
+  outputConverter_.init(PcmEncoding::FLOAT, s.outputEncoding);
+  mixer_.init(s.channels, s.channelMask, s.outputChannels);
+  packetConcealer_.init(PcmEncoding::FLOAT, s.channels, s.inputRate);
+  playbackConcealer_.init(s.outputEncoding, s.outputChannels, s.outputRate);
+  gainStage_.init(s.outputEncoding, s.outputChannels, s.outputRate);
+  gainStage_.setGain(AudioGainStage::kAllChannels, std::pow(10.0f, s.gainDb / 20.0f));
+  gainStage_.setSoftClip(s.softClip);
+  gainStage_.setEnabled(s.gainStage);
+  frameBytes_ = s.channels * PcmConverter::bytesPerSample(s.inputEncoding);
+  outputFrameBytes_ = s.outputChannels * PcmConverter::bytesPerSample(s.outputEncoding);
+  resampledChannels_ = std::min(s.channels, s.outputChannels);
+
+  uint64_t nominalFrames = (uint64_t)s.inputRate * s.packetIntervalUs / 1'000'000;
+  nominalPacketBytes_ = nominalFrames * frameBytes_;
+  uint64_t packetFrames = ((uint64_t)s.inputRate * s.packetIntervalUs + 999'999) / 1'000'000 + 1;
+  uint32_t maxPacketBytes = packetFrames * frameBytes_;
+  uint32_t burstBytes = s.framesPerBurst * frameBytes_;
+  packetsPerTransfer_ =
+      std::max<uint32_t>(2, (burstBytes + nominalPacketBytes_ - 1) / nominalPacketBytes_);
+  size_t framesPerTransfer = maxPacketBytes * packetsPerTransfer_ / frameBytes_;
+  uint32_t transfers = std::max<int32_t>(
+      2, (s.bufferCapacityFrames + s.framesPerBurst - 1) / s.framesPerBurst);
+
+  transfer_.resize(maxPacketBytes * packetsPerTransfer_);
+  packetBytes_.resize(packetsPerTransfer_);
+  packetErrors_.resize(packetsPerTransfer_);
+  resampler_.init(resampledChannels_, s.inputRate, s.outputRate, framesPerTransfer);
+  resampler_.setTargetFill((size_t)s.targetFillMs * s.outputRate / 1000);
+  size_t outputFramesPerTransfer = resampler_.maxOutputFrames(framesPerTransfer);
+  size_t ringBytes = outputFramesPerTransfer * (transfers + kSpareTransfers) * outputFrameBytes_;
+  ring_ = std::make_unique<RingBufferPcm>(ringBytes);
+  tap_.attach(ring_.get(), outputFrameBytes_, s.outputRate);
+  resamplerInput_.resize(framesPerTransfer * s.channels);
+  resamplerOutput_.resize(outputFramesPerTransfer * s.outputChannels);
+  if (mixer_.isIdentity()) {
+    mixBuffer_.clear();
+  } else if (s.channels >= s.outputChannels) {
+    mixBuffer_.resize(framesPerTransfer * resampledChannels_);
+  } else {
+    mixBuffer_.resize(outputFramesPerTransfer * resampledChannels_);
+  }
+  callbackBuffer_.resize(s.framesPerBurst * outputFrameBytes_);
+}
+
+// The device's packets for one transfer, at its drifting clock.
+void SimulatedStream::fillTransfer() {
+  const Scenario& s = scenario_;
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  double deviceRate = s.inputRate * (1.0 + s.driftPpm * 1e-6);
+  size_t maxPacketBytes = transfer_.size() / packetsPerTransfer_;
+  size_t sampleBytes = PcmConverter::bytesPerSample(s.inputEncoding);
+  for (uint32_t p = 0; p < packetsPerTransfer_; p++) {
+    deviceFrameCarry_ += deviceRate * s.packetIntervalUs / 1e6;
+    size_t frames = std::min<size_t>((size_t)deviceFrameCarry_, maxPacketBytes / frameBytes_);
+    deviceFrameCarry_ -= frames;
+    uint8_t* packet = transfer_.data() + p * maxPacketBytes;
+    for (size_t f = 0; f < frames; f++) {
+      float value = 0.5f * (float)std::sin(devicePhase_);
+      devicePhase_ += 2 * M_PI * kToneHz / s.inputRate;
+      for (uint32_t c = 0; c < s.channels; c++) {
+        writeSample(value, s.inputEncoding, packet + (f * s.channels + c) * sampleBytes);
+      }
+    }
+    devicePhase_ = std::fmod(devicePhase_, 2 * M_PI);
+    packetBytes_[p] = frames * frameBytes_;
+    packetErrors_[p] = chance(random_) < s.packetErrorRate;
+  }
+}
+
+// UsbAudioStreamer::transferCallback() and writeResampled().
+void SimulatedStream::completeTransfer(int64_t nowNs, Result& result, bool counted) {
+  const Scenario& s = scenario_;
+  size_t maxPacketBytes = transfer_.size() / packetsPerTransfer_;
+  float* input = resamplerInput_.data();
+  size_t inputSamples = 0;
+  for (uint32_t p = 0; p < packetsPerTransfer_; p++) {
+    if (packetErrors_[p]) {
+      size_t frames = std::min(
+          nominalPacketBytes_ / frameBytes_,
+          (resamplerInput_.size() - inputSamples) / s.channels);
+      packetConcealer_.conceal(reinterpret_cast<uint8_t*>(input + inputSamples), frames);
+      result.packetFramesConcealed += counted ? frames : 0;
+      inputSamples += frames * s.channels;
+      continue;
+    }
+    size_t samples = std::min<size_t>(
+        packetBytes_[p] / inputConverter_.inputBytesPerSample(),
+        resamplerInput_.size() - inputSamples);
+    samples -= samples % s.channels;
+    inputConverter_.convert(
+        transfer_.data() + p * maxPacketBytes,
+        reinterpret_cast<uint8_t*>(input + inputSamples),
+        samples);
+    packetConcealer_.played(reinterpret_cast<uint8_t*>(input + inputSamples), samples / s.channels);
+    inputSamples += samples;
+  }
+  size_t inputFrames = inputSamples / s.channels;
+
+  resampler_.recordInput(inputFrames, nowNs);
+  if (nowNs - outputTimestampAtNs_ >= kNsPerSecond && framesPlayed_ > 0) {
+    resampler_.recordOutputTimestamp(framesPlayed_, framesPlayedAtNs_);
+    outputTimestampAtNs_ = nowNs;
+  }
+  size_t outputFrames;
+  if (mixer_.isIdentity()) {
+    outputFrames = resampler_.process(input, inputFrames, resamplerOutput_.data());
+  } else if (s.channels >= s.outputChannels) {
+    mixer_.process(input, inputFrames, mixBuffer_.data());
+    outputFrames = resampler_.process(mixBuffer_.data(), inputFrames, resamplerOutput_.data());
+  } else {
+    outputFrames = resampler_.process(input, inputFrames, mixBuffer_.data());
+    mixer_.process(mixBuffer_.data(), outputFrames, resamplerOutput_.data());
+  }
+  size_t outputSamples = outputFrames * s.outputChannels;
+  RingBufferPcm::Spans freeSpace =
+      ring_->peekWrite(outputSamples * outputConverter_.outputBytesPerSample());
+  size_t written = outputConverter_.convertInto(
+      freeSpace, 0, reinterpret_cast<const uint8_t*>(resamplerOutput_.data()), outputSamples);
+  bool muted = s.muteToggleMs > 0 && nowNs / (s.muteToggleMs * 1'000'000LL) % 2 == 1;
+  if (muted != muted_) {
+    gainStage_.setMuted(muted);
+    muted_ = muted;
+  }
+  gainStage_.process(freeSpace, written);
+  ring_->commitWrite(written);
+  tap_.published(ring_->writePosition(), nowNs);
+  if (written != outputSamples * outputConverter_.outputBytesPerSample() && counted) {
+    result.overruns++;
+  }
+  resampler_.recordFill(ring_->size() / outputFrameBytes_);
+}
+
+// UsbAudioStreamer::audioPlaybackCallback().
+void SimulatedStream::playbackCallback(int64_t nowNs, Result& result, bool counted) {
+  int32_t numFrames = scenario_.framesPerBurst;
+  RingBufferPcm::Spans buffered = ring_->peekRead(ring_->capacity());
+  size_t framesRead = std::min<size_t>(buffered.size() / outputFrameBytes_, numFrames);
+  size_t bytesRead = framesRead * outputFrameBytes_;
+  uint8_t* output = callbackBuffer_.data();
+  ring_->commitRead(buffered.copyTo(0, output, bytesRead));
+  playbackConcealer_.played(output, framesRead);
+  if (framesRead < (size_t)numFrames) {
+    playbackConcealer_.conceal(output + bytesRead, numFrames - framesRead);
+    if (counted) {
+      result.underruns++;
+      result.framesConcealed += numFrames - framesRead;
+    }
+  }
+  framesPlayed_ += numFrames;
+}
+
+Result SimulatedStream::run(double seconds) {
+  const Scenario& s = scenario_;
+  setUp();
+  Result result{};
+  std::uniform_int_distribution<int64_t> usbJitter(0, (int64_t)s.usbJitterUs * 1000);
+  std::uniform_int_distribution<int64_t> callbackJitter(0, (int64_t)s.callbackJitterUs * 1000);
+  int64_t endNs = (int64_t)(seconds * kNsPerSecond);
+  int64_t transferPeriodNs = (int64_t)packetsPerTransfer_ * s.packetIntervalUs * 1000;
+  int64_t burstPeriodNs = (int64_t)s.framesPerBurst * kNsPerSecond / s.outputRate;
+  int64_t tapPeriodNs = (int64_t)s.tapPeriodMs * 1'000'000;
+
+  std::vector<int32_t> readers;
+  for (uint32_t i = 0; i < s.tapReaders; i++) {
+    // Alternating, so both overflow policies get exercised.
+    AudioTap::Overflow overflow =
+        i % 2 == 0 ? AudioTap::Overflow::OLDEST : AudioTap::Overflow::NEWEST;
+    readers.push_back(tap_.open(overflow));
+  }
+  std::vector<uint8_t> tapBuffer(ring_->capacity());
+  // Frames lost by the end, and by the end of the warmup.
+  std::vector<uint64_t> tapLost(readers.size());
+  std::vector<uint64_t> tapLostAtWarmup(readers.size());
+
+  std::vector<int64_t> usbCpuNs;
+  std::vector<int64_t> callbackCpuNs;
+  std::vector<double> fillMs;
+  int64_t transfers = 0;
+  int64_t callbacks = 0;
+  int64_t tapReads = 0;
+  int64_t lastCompletionNs = 0;
+  fillTransfer();
+  int64_t nextCompletionNs = transferPeriodNs + usbJitter(random_);
+  int64_t nextCallbackNs = burstPeriodNs + callbackJitter(random_);
+  int64_t nextTapNs = tapPeriodNs;
+  while (true) {
+    int64_t nowNs = std::min({nextCompletionNs, nextCallbackNs, nextTapNs});
+    if (nowNs >= endNs) {
+      break;
+    }
+    bool counted = nowNs >= kWarmupNs;
+    if (nowNs == nextCompletionNs) {
+      int64_t startNs = threadCpuNs();
+      completeTransfer(nowNs, result, counted);
+      if (counted) {
+        usbCpuNs.push_back(threadCpuNs() - startNs);
+      }
+      lastCompletionNs = nowNs;
+      transfers++;
+      fillTransfer();
+      // Completions stay in order, however late the previous one was.
+      nextCompletionNs =
+          std::max(lastCompletionNs, (transfers + 1) * transferPeriodNs + usbJitter(random_));
+    } else if (nowNs == nextCallbackNs) {
+      if (counted) {
+        fillMs.push_back(ring_->size() / outputFrameBytes_ * 1000.0 / s.outputRate);
+      }
+      int64_t startNs = threadCpuNs();
+      playbackCallback(nowNs, result, counted);
+      if (counted) {
+        callbackCpuNs.push_back(threadCpuNs() - startNs);
+      }
+      callbacks++;
+      framesPlayedAtNs_ = callbacks * burstPeriodNs;
+      nextCallbackNs = (callbacks + 1) * burstPeriodNs + callbackJitter(random_);
+    } else {
+      for (size_t i = 0; i < readers.size(); i++) {
+        AudioTap::Block block;
+        // Readers skip every fourth read, so that they fall behind now and then.
+        if ((tapReads + i) % 4 != 0) {
+          tap_.read(readers[i], tapBuffer.data(), tapBuffer.size(), block);
+          (counted ? tapLost[i] : tapLostAtWarmup[i]) = block.lostFrames;
+        }
+      }
+      tapReads++;
+      nextTapNs += tapPeriodNs;
+    }
+  }
+  for (int32_t reader : readers) {
+    tap_.close(reader);
+  }
+  for (size_t i = 0; i < readers.size(); i++) {
+    result.tapLostFrames += tapLost[i] - std::min(tapLost[i], tapLostAtWarmup[i]);
+  }
+
+  result.fillP50Ms = percentile(fillMs, 0.5);
+  result.fillP99Ms = percentile(fillMs, 0.99);
+  result.ratioPpm = (resampler_.ratio() / resampler_.nominalRatio() - 1) * 1e6;
+  result.usbMeanUs = mean(usbCpuNs) / 1000;
+  result.usbP99Us = percentile(usbCpuNs, 0.99) / 1000;
+  result.callbackMeanUs = mean(callbackCpuNs) / 1000;
+  result.callbackP99Us = percentile(callbackCpuNs, 0.99) / 1000;
+  return result;
+}
+
+std::vector<Scenario> scenarios() {
+  std::vector<Scenario> list;
+  Scenario clean{.name = "clean/48k_s16_stereo"};
+  list.push_back(clean);
+
+  Scenario fast = clean;
+  fast.name = "drift/+300ppm";
+  fast.driftPpm = 300;
+  list.push_back(fast);
+  Scenario slow = clean;
+  slow.name = "drift/-300ppm";
+  slow.driftPpm = -300;
+  list.push_back(slow);
+
+  Scenario jitter = clean;
+  jitter.name = "jitter/usb_4ms_callback_1ms";
+  jitter.usbJitterUs = 4000;
+  jitter.callbackJitterUs = 1000;
+  list.push_back(jitter);
+
+  Scenario errors = clean;
+  errors.name = "errors/1pct_packets";
+  errors.packetErrorRate = 0.01;
+  list.push_back(errors);
+
+  Scenario lowLatency = clean;
+  lowLatency.name = "low_latency/96_frame_bursts_2ms_fill";
+  lowLatency.framesPerBurst = 96;
+  lowLatency.bufferCapacityFrames = 96 * 4;
+  lowLatency.targetFillMs = 2;
+  lowLatency.usbJitterUs = 1000;
+  list.push_back(lowLatency);
+
+  Scenario resample = clean;
+  resample.name = "resample/44k1_s24_to_48k_float";
+  resample.inputRate = 44100;
+  resample.inputEncoding = PcmEncoding::I24_PACKED;
+  resample.outputEncoding = PcmEncoding::FLOAT;
+  resample.driftPpm = 100;
+  list.push_back(resample);
+
+  Scenario downmix = clean;
+  downmix.name = "downmix/7.1_float_to_stereo";
+  downmix.channels = 8;
+  downmix.channelMask = 0x63f;
+  downmix.inputEncoding = PcmEncoding::FLOAT;
+  downmix.outputEncoding = PcmEncoding::FLOAT;
+  list.push_back(downmix);
+
+  Scenario upmix = clean;
+  upmix.name = "upmix/mono_s16_to_stereo";
+  upmix.channels = 1;
+  upmix.channelMask = 0x4;
+  list.push_back(upmix);
+
+  Scenario taps = clean;
+  taps.name = "taps/4_readers";
+  taps.tapReaders = 4;
+  taps.tapPeriodMs = 10;
+  list.push_back(taps);
+
+  Scenario gain = clean;
+  gain.name = "gain/s16_stereo_+6dB_soft_clip_mute";
+  gain.gainStage = true;
+  gain.gainDb = 6;
+  gain.softClip = true;
+  gain.muteToggleMs = 250;
+  list.push_back(gain);
+  Scenario gainFloat = clean;
+  gainFloat.name = "gain/float_5.1_-6dB";
+  gainFloat.channels = 6;
+  gainFloat.channelMask = 0x3f;
+  gainFloat.outputChannels = 6;
+  gainFloat.inputEncoding = PcmEncoding::FLOAT;
+  gainFloat.outputEncoding = PcmEncoding::FLOAT;
+  gainFloat.gainStage = true;
+  gainFloat.gainDb = -6;
+  list.push_back(gainFloat);
+
+  Scenario stress = clean;
+  stress.name = "stress/drift_jitter_errors_taps";
+  stress.driftPpm = 500;
+  stress.usbJitterUs = 3000;
+  stress.callbackJitterUs = 1000;
+  stress.packetErrorRate = 0.005;
+  stress.tapReaders = 2;
+  list.push_back(stress);
+  return list;
+}
+
+// Steps the playback callbacks and the USB completions in time order, the
+// microphone hearing the speaker's output delayed by the scenario's latencies.
+LoopbackMeter::Report runLoopback(const LoopbackScenario& s, uint32_t bursts, uint32_t seed) {
+  LoopbackMeter meter;
+  meter.start(bursts, s.outputRate, 1, s.inputRate, s.inputChannels);
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, s.noise);
+  std::uniform_int_distribution<int64_t> usbJitter(0, (int64_t)s.usbJitterUs * 1000);
+  int64_t outputLatencyNs = (int64_t)(s.outputLatencyMs * 1e6);
+  int64_t heardAfterNs = outputLatencyNs + (int64_t)(s.acousticMs * 1e6);
+  int64_t inputLatencyNs = (int64_t)(s.inputLatencyMs * 1e6);
+  int64_t bufferedNs = (int64_t)(s.bufferedMs * 1e6);
+  size_t transferFrames = (size_t)s.inputRate * s.transferMs / 1000;
+
+  std::vector<float> played;
+  std::vector<float> callback(s.framesPerBurst);
+  std::vector<float> transfer(transferFrames * s.inputChannels);
+  int64_t callbacks = 0;
+  int64_t transfers = 0;
+  int64_t lastCompletionNs = 0;
+  int64_t nextTimestampNs = 0;
+  // Bounded, should the meter never finish.
+  int64_t endNs = (int64_t)bursts * (LoopbackMeter::kWindowMs + LoopbackMeter::kGapMs + 500) *
+      1'000'000;
+  while (meter.active()) {
+    int64_t callbackNs = callbacks * s.framesPerBurst * kNsPerSecond / s.outputRate;
+    int64_t completionNs = std::max(
+        lastCompletionNs,
+        (int64_t)((transfers + 1) * transferFrames * kNsPerSecond / s.inputRate) +
+            inputLatencyNs + usbJitter(random));
+    if (std::min(callbackNs, completionNs) >= endNs) {
+      break;
+    }
+    if (callbackNs <= completionNs) {
+      int64_t streamFrame = callbacks * s.framesPerBurst;
+      meter.render(callback.data(), s.framesPerBurst, streamFrame, callbackNs, bufferedNs);
+      played.insert(played.end(), callback.begin(), callback.end());
+      callbacks++;
+      continue;
+    }
+    // The microphone samples what the speaker played heardAfterNs earlier.
+    for (size_t f = 0; f < transferFrames; f++) {
+      int64_t sampledNs =
+          (int64_t)((transfers * transferFrames + f) * kNsPerSecond / s.inputRate) - heardAfterNs;
+      int64_t frame = sampledNs >= 0 ? sampledNs * s.outputRate / kNsPerSecond : -1;
+      float value = frame >= 0 && frame < (int64_t)played.size() ? played[frame] : 0.0f;
+      for (uint32_t c = 0; c < s.inputChannels; c++) {
+        transfer[f * s.inputChannels + c] = (float)(s.gain * value + noise(random));
+      }
+    }
+    if (completionNs >= nextTimestampNs) {
+      int64_t frame = callbacks * s.framesPerBurst;
+      meter.recordOutputTimestamp(frame, frame * kNsPerSecond / s.outputRate + outputLatencyNs);
+      nextTimestampNs = completionNs + kNsPerSecond;
+    }
+    meter.capture(transfer.data(), transferFrames, completionNs);
+    lastCompletionNs = completionNs;
+    transfers++;
+  }
+  LoopbackMeter::Report report;
+  meter.report(report);
+  return report;
+}
+
+std::vector<LoopbackScenario> loopbackScenarios() {
+  std::vector<LoopbackScenario> list;
+  LoopbackScenario clean{.name = "loopback/48k_mono_mic"};
+  list.push_back(clean);
+
+  LoopbackScenario narrow = clean;
+  narrow.name = "loopback/16k_mic";
+  narrow.inputRate = 16000;
+  list.push_back(narrow);
+
+  LoopbackScenario cd = clean;
+  cd.name = "loopback/44k1_speaker_48k_stereo_mic";
+  cd.outputRate = 44100;
+  cd.inputChannels = 2;
+  list.push_back(cd);
+
+  LoopbackScenario jitter = clean;
+  jitter.name = "loopback/usb_jitter_2ms";
+  jitter.usbJitterUs = 2000;
+  list.push_back(jitter);
+
+  LoopbackScenario noisy = clean;
+  noisy.name = "loopback/noisy_room";
+  noisy.gain = 0.1;
+  noisy.noise = 0.05;
+  list.push_back(noisy);
+
+  LoopbackScenario wireless = clean;
+  wireless.name = "loopback/wireless_speaker_180ms";
+  wireless.outputLatencyMs = 180;
+  wireless.acousticMs = 3;
+  list.push_back(wireless);
+  return list;
+}
+
+int runLoopbackScenarios(const Options& options) {
+  if (options.tsv) {
+    printf(
+        "name	detected	bursts	expected ms	round trip ms	error ms	min ms	max ms	"
+        "jitter ms	output ms	input ms	pass-through ms	peak ratio\n");
+  } else {
+    printf(
+        "%-38s %5s %8s %8s %7s %7s %7s %7s %8s %7s %8s %6s\n",
+        "Scenario",
+        "found",
+        "expect",
+        "rtt ms",
+        "error",
+        "min",
+        "max",
+        "jitter",
+        "out ms",
+        "in ms",
+        "mic>spk",
+        "peak");
+  }
+  for (const LoopbackScenario& scenario : loopbackScenarios()) {
+    if (!std::regex_search(scenario.name, options.filter)) {
+      continue;
+    }
+    LoopbackMeter::Report r = runLoopback(scenario, options.bursts, options.seed);
+    // Completions come half the jitter late on average.
+    double expectedMs = scenario.outputLatencyMs + scenario.acousticMs +
+        scenario.inputLatencyMs + scenario.usbJitterUs / 2000.0;
+    double errorMs = r.detected > 0 ? r.roundTripMs - expectedMs : 0;
+    if (options.tsv) {
+      printf(
+          "%s\t%u\t%u\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.1f\n",
+          scenario.name.c_str(),
+          r.detected,
+          r.bursts,
+          expectedMs,
+          r.roundTripMs,
+          errorMs,
+          r.roundTripMinMs,
+          r.roundTripMaxMs,
+          r.jitterMs,
+          r.outputMs,
+          r.inputMs,
+          r.passThroughMs,
+          r.peakRatio);
+    } else {
+      printf(
+          "%-38s %2u/%-2u %8.3f %8.3f %7.3f %7.3f %7.3f %7.3f %8.3f %7.3f %8.3f %6.1f\n",
+          scenario.name.c_str(),
+          r.detected,
+          r.bursts,
+          expectedMs,
+          r.roundTripMs,
+          errorMs,
+          r.roundTripMinMs,
+          r.roundTripMaxMs,
+          r.jitterMs,
+          r.outputMs,
+          r.inputMs,
+          r.passThroughMs,
+          r.peakRatio);
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
+
+void printUsage(const char* program) {
+  fprintf(
+      stderr,
+      "Usage: %s [--filter=REGEX] [--seconds=SECONDS] [--seed=N] [--tsv]\n"
+      "          [--loopback] [--bursts=N]\n"
+      "  --filter   runs the scenarios whose name matches REGEX\n"
+      "  --seconds  simulated time per scenario (default 60)\n"
+      "  --seed     seeds the jitter and packet errors (default 1)\n"
+      "  --tsv      prints tab separated values\n"
+      "  --loopback runs the loopback latency scenarios instead\n"
+      "  --bursts   bursts per loopback scenario (default 10)\n",
+      program);
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--filter") {
+      options.filter = std::regex(value);
+    } else if (key == "--seconds") {
+      options.seconds = std::max(2.0, atof(value.c_str()));
+    } else if (key == "--seed") {
+      options.seed = strtoul(value.c_str(), nullptr, 10);
+    } else if (key == "--tsv") {
+      options.tsv = true;
+    } else if (key == "--loopback") {
+      options.loopback = true;
+    } else if (key == "--bursts") {
+      options.bursts = std::clamp<uint32_t>(
+          strtoul(value.c_str(), nullptr, 10), 1, LoopbackMeter::kMaxBursts);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options{};
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  if (options.loopback) {
+    return runLoopbackScenarios(options);
+  }
+  if (options.tsv) {
+    printf(
+        "name\tunderruns\toverruns\tconcealed\tpacket concealed\tfill p50 ms\tfill p99 ms\t"
+        "drift ppm\tusb us\tusb p99 us\tcallback us\tcallback p99 us\ttap lost\n");
+  } else {
+    printf(
+        "%-38s %6s %6s %9s %9s %7s %7s %8s %7s %7s %7s %7s %9s\n",
+        "Scenario",
+        "under",
+        "over",
+        "conceal",
+        "pkt conc",
+        "p50 ms",
+        "p99 ms",
+        "ppm",
+        "usb us",
+        "p99",
+        "cb us",
+        "p99",
+        "tap lost");
+  }
+  for (const Scenario& scenario : scenarios()) {
+    if (!std::regex_search(scenario.name, options.filter)) {
+      continue;
+    }
+    SimulatedStream stream(scenario, options.seed);
+    Result r = stream.run(options.seconds);
+    if (options.tsv) {
+      printf(
+          "%s\t%llu\t%llu\t%llu\t%llu\t%.2f\t%.2f\t%.1f\t%.2f\t%.2f\t%.2f\t%.2f\t%llu\n",
+          scenario.name.c_str(),
+          (unsigned long long)r.underruns,
+          (unsigned long long)r.overruns,
+          (unsigned long long)r.framesConcealed,
+          (unsigned long long)r.packetFramesConcealed,
+          r.fillP50Ms,
+          r.fillP99Ms,
+          r.ratioPpm,
+          r.usbMeanUs,
+          r.usbP99Us,
+          r.callbackMeanUs,
+          r.callbackP99Us,
+          (unsigned long long)r.tapLostFrames);
+    } else {
+      printf(
+          "%-38s %6llu %6llu %9llu %9llu %7.2f %7.2f %8.1f %7.2f %7.2f %7.2f %7.2f %9llu\n",
+          scenario.name.c_str(),
+          (unsigned long long)r.underruns,
+          (unsigned long long)r.overruns,
+          (unsigned long long)r.framesConcealed,
+          (unsigned long long)r.packetFramesConcealed,
+          r.fillP50Ms,
+          r.fillP99Ms,
+          r.ratioPpm,
+          r.usbMeanUs,
+          r.usbP99Us,
+          r.callbackMeanUs,
+          r.callbackP99Us,
+          (unsigned long long)r.tapLostFrames);
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
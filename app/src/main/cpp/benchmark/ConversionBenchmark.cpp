@@ -0,0 +1,1546 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks of the per frame conversion work of the preview path.
+//
+// Every case runs on synthetic frames, or on the JPEG files given with
+// --jpeg and the frame logs given with --frame_log, and reports frames per
+// second, GB/s of pixel data read and written and CPU cycles per output
+// pixel. Case names and the order they run in only depend on the build and
+// the inputs, so two runs can be compared with diff or a paste of their --tsv
+// output.
+//
+// The cases go through FrameConverter, the code the render thread runs for
+// each frame, for every supported (frame format, window format) pair, and
+// through the libyuv kernels underneath. On the host, MJPEG is decoded with
+// libjpeg as on releases before API 30. JPEG files are also Huffman decoded
+// by JpegEntropyDecoder, the CPU half of the GL preview's MJPEG decode.
+//
+// The backend cases convert YUYV, NV12 and P010 frames to RGBA at their
+// size with each preview backend the device has: FrameConverter's libyuv
+// kernels, the GL preview and VulkanConverter, timed until the output is
+// written.
+//
+// Converter cases also report PSNR and SSIM of their output against a
+// floating point conversion of the same frames, so a faster kernel that is
+// also lossier shows up in the same table. The reference repeats chroma over
+// the pixels sharing it, decodes MJPEG with libyuv at the full size and box
+// filters to the window size, so it exists for whole fractions of the frame
+// only.
+
+#include <libyuv.h>
+#include <libyuv/convert_argb.h>
+#include <libyuv/mjpeg_decoder.h>
+#include <libyuv/rotate_argb.h>
+#include <libyuv/scale_argb.h>
+
+#include <android/hardware_buffer.h>
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+#if defined(__ANDROID__)
+#include <media/NdkImageReader.h>
+#include <poll.h>
+#endif
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "Colorimetry.h"
+#include "CpuFeatures.h"
+#include "Demosaic.h"
+#include "FrameConverter.h"
+#include "FrameLog.h"
+#include "JpegEntropyDecoder.h"
+#include "LensCorrection.h"
+#include "StripeWorkerPool.h"
+#if defined(__ANDROID__)
+#include "GlPreviewRenderer.h"
+#include "VulkanConverter.h"
+#endif
+
+using namespace std::chrono;
+
+namespace {
+
+struct Resolution {
+  int32_t width;
+  int32_t height;
+};
+
+constexpr Resolution kResolutions[] = {
+    {640, 480},
+    {1280, 720},
+    {1920, 1080},
+    {3840, 2160},
+};
+
+// Iterations run before timing, to fault in buffers and warm the caches.
+constexpr int kWarmupIterations = 3;
+
+struct Quality {
+  double psnr;
+  double ssim;
+};
+
+struct Benchmark {
+  std::string name;
+  // Output pixels and bytes read plus written by one iteration.
+  uint64_t pixels;
+  uint64_t bytes;
+  std::function<bool()> run;
+  // Measures the output against the reference; false without one.
+  std::function<bool(Quality&)> quality{};
+};
+
+struct Options {
+  std::regex filter{".*"};
+  duration<double> minTime{0.2};
+  int repetitions{1};
+  bool tsv{false};
+  bool parallel{false};
+  std::vector<std::string> jpegPaths{};
+  std::vector<std::string> frameLogPaths{};
+};
+
+struct Result {
+  double fps;
+  double gbps;
+  // Negative when the cycle counter is not available.
+  double cyclesPerPixel;
+};
+
+// CPU cycles spent in user space by the calling thread. Android only allows
+// perf events from the shell with `setprop security.perf_harden 0`.
+class CycleCounter final {
+ public:
+  CycleCounter() {
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  CycleCounter(const CycleCounter&) = delete;
+  CycleCounter& operator=(const CycleCounter&) = delete;
+  ~CycleCounter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool available() const {
+    return fd_ >= 0;
+  }
+
+  uint64_t read() const {
+    uint64_t cycles = 0;
+    if (fd_ < 0 || ::read(fd_, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+      return 0;
+    }
+    return cycles;
+  }
+
+ private:
+  int fd_{-1};
+};
+
+// Deterministic noise, so every run converts the same pixels.
+std::vector<uint8_t> makePattern(size_t size) {
+  std::vector<uint8_t> bytes(size);
+  uint32_t state = 0x9e3779b9;
+  for (uint8_t& byte : bytes) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    byte = (uint8_t)state;
+  }
+  return bytes;
+}
+
+std::string sizeName(int32_t width, int32_t height) {
+  return std::to_string(width) + "x" + std::to_string(height);
+}
+
+// Dimensions from the first start of frame marker of a baseline or
+// progressive JPEG.
+bool jpegSize(const std::vector<uint8_t>& jpeg, int32_t& width, int32_t& height) {
+  size_t pos = 2;
+  while (pos + 9 <= jpeg.size()) {
+    if (jpeg[pos] != 0xff) {
+      return false;
+    }
+    uint8_t marker = jpeg[pos + 1];
+    size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+    bool isSof = marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 &&
+        marker != 0xcc;
+    if (isSof) {
+      height = (jpeg[pos + 5] << 8) | jpeg[pos + 6];
+      width = (jpeg[pos + 7] << 8) | jpeg[pos + 8];
+      return width > 0 && height > 0;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+struct JpegInput {
+  std::string name;
+  std::vector<uint8_t> data;
+  int32_t width;
+  int32_t height;
+};
+
+bool loadJpegs(const std::vector<std::string>& paths, std::vector<JpegInput>& jpegs) {
+  for (const std::string& path : paths) {
+    std::ifstream file(path, std::ios::binary);
+    JpegInput jpeg{};
+    jpeg.data.assign(std::istreambuf_iterator<char>(file), {});
+    if (!file || !jpegSize(jpeg.data, jpeg.width, jpeg.height)) {
+      fprintf(stderr, "%s is not a readable JPEG\n", path.c_str());
+      return false;
+    }
+    size_t slash = path.find_last_of('/');
+    jpeg.name = slash == std::string::npos ? path : path.substr(slash + 1);
+    jpegs.push_back(std::move(jpeg));
+  }
+  return true;
+}
+
+void addLibyuvBenchmarks(std::vector<Benchmark>& benchmarks, const std::vector<JpegInput>& jpegs) {
+  for (const Resolution& res : kResolutions) {
+    int32_t w = res.width;
+    int32_t h = res.height;
+    uint64_t pixels = (uint64_t)w * h;
+    std::string size = sizeName(w, h);
+    auto yuy2 = std::make_shared<std::vector<uint8_t>>(makePattern(pixels * 2));
+    auto nv21 = std::make_shared<std::vector<uint8_t>>(makePattern(pixels * 3 / 2));
+    auto argb = std::make_shared<std::vector<uint8_t>>(makePattern(pixels * 4));
+    auto out = std::make_shared<std::vector<uint8_t>>(pixels * 4);
+
+    // The two pass conversion to R, G, B, A memory order.
+    benchmarks.push_back(
+        {"libyuv/YUY2ToARGB+ABGRToARGB/" + size, pixels, pixels * (2 + 4 + 8), [=] {
+           return libyuv::YUY2ToARGB(yuy2->data(), w * 2, out->data(), w * 4, w, h) == 0 &&
+               libyuv::ABGRToARGB(out->data(), w * 4, out->data(), w * 4, w, h) == 0;
+         }});
+    benchmarks.push_back({"libyuv/NV21ToARGB/" + size, pixels, pixels * (3 + 8) / 2, [=] {
+                            const uint8_t* vu = nv21->data() + pixels;
+                            return libyuv::NV21ToARGB(
+                                       nv21->data(), w, vu, w, out->data(), w * 4, w, h) == 0;
+                          }});
+    benchmarks.push_back({"libyuv/NV21ToRGB24/" + size, pixels, pixels * (3 + 6) / 2, [=] {
+                            const uint8_t* vu = nv21->data() + pixels;
+                            return libyuv::NV21ToRGB24(
+                                       nv21->data(), w, vu, w, out->data(), w * 3, w, h) == 0;
+                          }});
+    for (libyuv::RotationMode mode : {libyuv::kRotate90, libyuv::kRotate180}) {
+      int32_t outStride = mode == libyuv::kRotate90 ? h * 4 : w * 4;
+      benchmarks.push_back(
+          {"libyuv/ARGBRotate" + std::to_string((int)mode) + "/" + size,
+           pixels,
+           pixels * 8,
+           [=] {
+             return libyuv::ARGBRotate(
+                        argb->data(), w * 4, out->data(), outStride, w, h, mode) == 0;
+           }});
+    }
+  }
+
+  // One step down the resolution ladder, as CPU scaling does for a camera
+  // mode larger than the window.
+  for (size_t i = 1; i < std::size(kResolutions); i++) {
+    Resolution from = kResolutions[i];
+    Resolution to = kResolutions[i - 1];
+    auto src = std::make_shared<std::vector<uint8_t>>(
+        makePattern((size_t)from.width * from.height * 4));
+    auto dst = std::make_shared<std::vector<uint8_t>>((size_t)to.width * to.height * 4);
+    std::string sizes = sizeName(from.width, from.height) + "->" + sizeName(to.width, to.height);
+    uint64_t pixels = (uint64_t)to.width * to.height;
+    uint64_t bytes = ((uint64_t)from.width * from.height + pixels) * 4;
+    for (auto [filter, filterName] : {
+             std::pair{libyuv::kFilterBilinear, "Bilinear"},
+             std::pair{libyuv::kFilterBox, "Box"},
+         }) {
+      benchmarks.push_back(
+          {std::string("libyuv/ARGBScale") + filterName + "/" + sizes, pixels, bytes, [=] {
+             return libyuv::ARGBScale(
+                        src->data(),
+                        from.width * 4,
+                        from.width,
+                        from.height,
+                        dst->data(),
+                        to.width * 4,
+                        to.width,
+                        to.height,
+                        filter) == 0;
+           }});
+    }
+  }
+
+#if defined(HAVE_JPEG)
+  for (const JpegInput& jpeg : jpegs) {
+    int32_t w = jpeg.width;
+    int32_t h = jpeg.height;
+    uint64_t pixels = (uint64_t)w * h;
+    auto data = std::make_shared<std::vector<uint8_t>>(jpeg.data);
+    auto out = std::make_shared<std::vector<uint8_t>>(pixels * 4);
+    benchmarks.push_back(
+        {"libyuv/MJPGToARGB/" + jpeg.name + "/" + sizeName(w, h),
+         pixels,
+         data->size() + pixels * 4,
+         [=] {
+           return libyuv::MJPGToARGB(
+                      data->data(), data->size(), out->data(), w * 4, w, h, w, h) == 0;
+         }});
+    // The raw YCbCr decode FrameFanout uses for NV12 consumers.
+    benchmarks.push_back(
+        {"libyuv/MJPGToNV12/" + jpeg.name + "/" + sizeName(w, h),
+         pixels,
+         data->size() + pixels * 3 / 2,
+         [=] {
+           uint8_t* y = out->data();
+           return libyuv::MJPGToNV12(
+                      data->data(), data->size(), y, w, y + pixels, w, w, h, w, h) == 0;
+         }});
+  }
+#else
+  (void)jpegs;
+#endif
+}
+
+// Coefficients out for GlPreviewRenderer's compute shader; the pixels are
+// the frame's.
+void addJpegEntropyBenchmarks(
+    std::vector<Benchmark>& benchmarks,
+    const std::vector<JpegInput>& jpegs) {
+  for (const JpegInput& jpeg : jpegs) {
+    auto data = std::make_shared<std::vector<uint8_t>>(jpeg.data);
+    auto decoder = std::make_shared<JpegEntropyDecoder>();
+    if (!decoder->decode(data->data(), data->size(), jpeg.width, jpeg.height)) {
+      fprintf(stderr, "%s is not a baseline JPEG, no entropy decode case\n", jpeg.name.c_str());
+      continue;
+    }
+    benchmarks.push_back(
+        {"JpegEntropyDecoder/" + jpeg.name + "/" + sizeName(jpeg.width, jpeg.height),
+         (uint64_t)jpeg.width * jpeg.height,
+         data->size() + decoder->coefficientCount() * sizeof(int16_t),
+         [=, width = jpeg.width, height = jpeg.height] {
+           return decoder->decode(data->data(), data->size(), width, height);
+         }});
+  }
+}
+
+// Lens correction's remap with NEON, or the scalar loop off Arm, and with its
+// dotprod variant on CPUs that have it, which has to write the same bytes.
+void addDewarpBenchmarks(std::vector<Benchmark>& benchmarks) {
+  LensCalibration lens{};
+  lens.model = LensCalibration::Model::RADIAL;
+  lens.k = {-0.25f, 0.05f, 0.0f, 0.0f};
+  for (const Resolution& res : kResolutions) {
+    int32_t w = res.width;
+    int32_t h = res.height;
+    uint64_t pixels = (uint64_t)w * h;
+    auto map = std::make_shared<DewarpMap>();
+    if (!map->build(lens, w, h, w, h)) {
+      continue;
+    }
+    auto src = std::make_shared<std::vector<uint8_t>>(makePattern(pixels * 4));
+    auto out = std::make_shared<std::vector<uint8_t>>(pixels * 4);
+    std::string size = sizeName(w, h);
+    // A table entry and two source pixels read per pixel written.
+    uint64_t bytes = pixels * (4 + 8 + 4);
+    benchmarks.push_back({"DewarpMap/remapRows/" + size, pixels, bytes, [=] {
+                            map->remapRows(src->data(), w * 4, out->data(), w * 4, 0, h, false);
+                            return true;
+                          }});
+    if (!DewarpMap::hasDotProd()) {
+      continue;
+    }
+    std::vector<uint8_t> expected(pixels * 4);
+    map->remapRows(src->data(), w * 4, expected.data(), w * 4, 0, h, false);
+    map->remapRows(src->data(), w * 4, out->data(), w * 4, 0, h);
+    bool same = expected == *out;
+    if (!same) {
+      fprintf(stderr, "DewarpMap dotprod and NEON remaps differ at %s\n", size.c_str());
+    }
+    benchmarks.push_back({"DewarpMap/remapRows+dotprod/" + size, pixels, bytes, [=] {
+                            map->remapRows(src->data(), w * 4, out->data(), w * 4, 0, h);
+                            return same;
+                          }});
+  }
+}
+
+struct NamedFormat {
+  int32_t format;
+  const char* name;
+};
+
+// What captureFrameCallback sees: every format FrameConverter has a source
+// for, with MJPEG benchmarked on real frames only.
+constexpr NamedFormat kFrameFormats[] = {
+    {UVC_FRAME_FORMAT_YUYV, "YUYV"},
+    {UVC_FRAME_FORMAT_UYVY, "UYVY"},
+    {UVC_FRAME_FORMAT_NV12, "NV12"},
+    {UVC_FRAME_FORMAT_GRAY8, "GRAY8"},
+    {UVC_FRAME_FORMAT_BGR, "BGR"},
+    {UVC_FRAME_FORMAT_P010, "P010"},
+    {UVC_FRAME_FORMAT_GRAY16, "GRAY16"},
+    {UVC_FRAME_FORMAT_SRGGB8, "RGGB8"},
+    {UVC_FRAME_FORMAT_SGRBG10, "GRBG10"},
+    {UVC_FRAME_FORMAT_SBGGR16, "BGGR16"},
+    {UVC_FRAME_FORMAT_Z16, "Z16"},
+};
+
+constexpr NamedFormat kWindowFormats[] = {
+    {AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM, "RGBA8888"},
+    {AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM, "RGBX8888"},
+    {AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM, "RGB888"},
+    {AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM, "RGB565"},
+    {FrameConverter::kYv12WindowFormat, "YV12"},
+    {AHARDWAREBUFFER_FORMAT_R10G10B10A2_UNORM, "RGBA1010102"},
+};
+
+// Payload bytes of a frame, twice for 16 bit samples.
+size_t frameSize(int32_t format, int32_t width, int32_t height) {
+  size_t pixels = (size_t)width * height;
+  switch (format) {
+    case UVC_FRAME_FORMAT_YUYV:
+    case UVC_FRAME_FORMAT_UYVY:
+      return pixels * 2;
+    case UVC_FRAME_FORMAT_NV12:
+      return pixels * 3 / 2;
+    case UVC_FRAME_FORMAT_GRAY8:
+    case UVC_FRAME_FORMAT_SRGGB8:
+      return pixels;
+    case UVC_FRAME_FORMAT_GRAY16:
+    case UVC_FRAME_FORMAT_SGRBG10:
+    case UVC_FRAME_FORMAT_SBGGR16:
+    case UVC_FRAME_FORMAT_Z16:
+      return pixels * 2;
+    case UVC_FRAME_FORMAT_BGR:
+      return pixels * 3;
+    case UVC_FRAME_FORMAT_P010:
+      return pixels * 3;
+    default:
+      return 0;
+  }
+}
+
+size_t frameStep(int32_t format, int32_t width) {
+  switch (format) {
+    case UVC_FRAME_FORMAT_YUYV:
+    case UVC_FRAME_FORMAT_UYVY:
+    case UVC_FRAME_FORMAT_P010:
+    case UVC_FRAME_FORMAT_GRAY16:
+    case UVC_FRAME_FORMAT_SGRBG10:
+    case UVC_FRAME_FORMAT_SBGGR16:
+    case UVC_FRAME_FORMAT_Z16:
+      return (size_t)width * 2;
+    case UVC_FRAME_FORMAT_BGR:
+      return (size_t)width * 3;
+    default:
+      return width;
+  }
+}
+
+// Bytes the converter writes for the visible pixels, without stride padding.
+uint64_t windowBytes(int32_t windowFormat, int32_t width, int32_t height) {
+  uint64_t pixels = (uint64_t)width * height;
+  switch (windowFormat) {
+    case AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM:
+      return pixels * 3;
+    case AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM:
+      return pixels * 2;
+    case FrameConverter::kYv12WindowFormat:
+      return pixels * 3 / 2;
+    default:
+      return pixels * 4;
+  }
+}
+
+const char* frameFormatName(uint32_t format) {
+  if (format == UVC_FRAME_FORMAT_MJPEG) {
+    return "MJPEG";
+  }
+  for (const NamedFormat& named : kFrameFormats) {
+    if ((uint32_t)named.format == format) {
+      return named.name;
+    }
+  }
+  return nullptr;
+}
+
+// Frames spread over a frame log that its cases are measured on.
+constexpr size_t kCorpusFrames = 8;
+
+struct FrameLogInput {
+  std::string name;
+  int32_t format;
+  int32_t width;
+  int32_t height;
+  // The first is the one timed.
+  std::vector<std::vector<uint8_t>> frames;
+};
+
+// Up to kCorpusFrames complete frames of each log FrameLogRecorder wrote.
+bool loadFrameLogs(const std::vector<std::string>& paths, std::vector<FrameLogInput>& logs) {
+  for (const std::string& path : paths) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    std::streamoff fileSize = file.tellg();
+    FrameLogHeader header{};
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, kFrameLogMagic, sizeof(kFrameLogMagic)) != 0 ||
+        header.version != kFrameLogVersion) {
+      fprintf(stderr, "%s is not a version %u frame log\n", path.c_str(), kFrameLogVersion);
+      return false;
+    }
+    if (frameFormatName(header.frameFormat) == nullptr) {
+      fprintf(stderr, "%s has frames of unsupported format %u\n", path.c_str(), header.frameFormat);
+      return false;
+    }
+    // Payload offsets and sizes of the records, without short uncompressed
+    // frames and a last record cut short.
+    std::vector<std::pair<std::streamoff, uint32_t>> payloads;
+    size_t minSize =
+        std::max<size_t>(1, frameSize(header.frameFormat, header.width, header.height));
+    std::streamoff offset = header.headerSize;
+    FrameLogRecord record{};
+    while (offset + (std::streamoff)sizeof(record) <= fileSize && file.seekg(offset) &&
+           file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+      std::streamoff payload = offset + sizeof(record);
+      if (record.size >= minSize && payload + record.size <= fileSize) {
+        payloads.emplace_back(payload, record.size);
+      }
+      offset += frameLogRecordSpan(record.size);
+    }
+    file.clear();
+
+    FrameLogInput log{};
+    size_t slash = path.find_last_of('/');
+    log.name = slash == std::string::npos ? path : path.substr(slash + 1);
+    log.format = header.frameFormat;
+    log.width = header.width;
+    log.height = header.height;
+    size_t count = std::min(kCorpusFrames, payloads.size());
+    for (size_t i = 0; i < count; i++) {
+      auto [payload, size] = payloads[i * payloads.size() / count];
+      std::vector<uint8_t> frame(size);
+      if (!file.seekg(payload) || !file.read(reinterpret_cast<char*>(frame.data()), size)) {
+        break;
+      }
+      log.frames.push_back(std::move(frame));
+    }
+    if (log.frames.empty()) {
+      fprintf(stderr, "%s has no complete frames\n", path.c_str());
+      return false;
+    }
+    logs.push_back(std::move(log));
+  }
+  return true;
+}
+
+// 8 bit R, G and B planes that quality is measured on.
+struct RgbPlanes {
+  int32_t width{};
+  int32_t height{};
+  std::vector<uint8_t> planes[3]{};
+
+  void resize(int32_t w, int32_t h) {
+    width = w;
+    height = h;
+    for (std::vector<uint8_t>& plane : planes) {
+      plane.resize((size_t)w * h);
+    }
+  }
+};
+
+// Y, U and V code values over 0-255 in floating point RGB over 0-255.
+void yuvToRgb(const Colorimetry::Coefficients& c, float y, float u, float v, float rgb[3]) {
+  float luma = (y / 255 - c.yOffset) * c.yScale;
+  float cb = (u - 128) / 255;
+  float cr = (v - 128) / 255;
+  rgb[0] = (luma + c.crR * cr) * 255;
+  rgb[1] = (luma - c.cbG * cb - c.crG * cr) * 255;
+  rgb[2] = (luma + c.cbB * cb) * 255;
+}
+
+// Averages factor x factor blocks of the pixels of area, clamped to 0-255,
+// into out.
+template <typename Pixel>
+void boxFilter(const FrameCrop& area, int32_t factor, RgbPlanes& out, const Pixel& pixel) {
+  out.resize(area.width / factor, area.height / factor);
+  float scale = 1.0f / (factor * factor);
+  for (int32_t y = 0; y < out.height; y++) {
+    for (int32_t x = 0; x < out.width; x++) {
+      float sum[3]{};
+      for (int32_t dy = 0; dy < factor; dy++) {
+        for (int32_t dx = 0; dx < factor; dx++) {
+          float rgb[3];
+          pixel(area.x + x * factor + dx, area.y + y * factor + dy, rgb);
+          for (int i = 0; i < 3; i++) {
+            sum[i] += std::clamp(rgb[i], 0.0f, 255.0f);
+          }
+        }
+      }
+      for (int i = 0; i < 3; i++) {
+        out.planes[i][(size_t)y * out.width + x] = (uint8_t)std::lround(sum[i] * scale);
+      }
+    }
+  }
+}
+
+// What the converter should write for the crop of a frame, or all of it,
+// at width x height.
+bool referenceRgb(
+    const uvc_frame_t* frame,
+    const Colorimetry& colorimetry,
+    const FrameCrop& crop,
+    int32_t width,
+    int32_t height,
+    RgbPlanes& out) {
+  FrameCrop area = crop.empty() ? FrameCrop{0, 0, (int32_t)frame->width, (int32_t)frame->height}
+                                : crop;
+  int32_t factor = area.width / std::max(1, width);
+  if (factor < 1 || area.width != width * factor || area.height != height * factor) {
+    return false;
+  }
+  const auto* src = static_cast<const uint8_t*>(frame->data);
+  size_t step = frame->step;
+  size_t chroma = step * frame->height;
+  Colorimetry::Coefficients c = colorimetry.coefficients();
+  switch (frame->frame_format) {
+    case UVC_FRAME_FORMAT_YUYV:
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        const uint8_t* pair = src + y * step + (x & ~1) * 2;
+        yuvToRgb(c, pair[(x & 1) * 2], pair[1], pair[3], rgb);
+      });
+      return true;
+    case UVC_FRAME_FORMAT_UYVY:
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        const uint8_t* pair = src + y * step + (x & ~1) * 2;
+        yuvToRgb(c, pair[1 + (x & 1) * 2], pair[0], pair[2], rgb);
+      });
+      return true;
+    case UVC_FRAME_FORMAT_NV12:
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        const uint8_t* uv = src + chroma + (y / 2) * step + (x & ~1);
+        yuvToRgb(c, src[y * step + x], uv[0], uv[1], rgb);
+      });
+      return true;
+    case UVC_FRAME_FORMAT_P010:
+      // 10 bit samples in the high bits, over 4 for 8 bit code values.
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        auto sample = [&](size_t offset) {
+          uint16_t value;
+          memcpy(&value, src + offset, sizeof(value));
+          return (value >> 6) / 4.0f;
+        };
+        size_t uv = chroma + (y / 2) * step + (x & ~1) * 2;
+        yuvToRgb(c, sample(y * step + x * 2), sample(uv), sample(uv + 2), rgb);
+      });
+      return true;
+    case UVC_FRAME_FORMAT_GRAY8:
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        rgb[0] = rgb[1] = rgb[2] = src[y * step + x];
+      });
+      return true;
+    case UVC_FRAME_FORMAT_BGR:
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        const uint8_t* bgr = src + y * step + x * 3;
+        rgb[0] = bgr[2];
+        rgb[1] = bgr[1];
+        rgb[2] = bgr[0];
+      });
+      return true;
+#if defined(HAVE_JPEG)
+    case UVC_FRAME_FORMAT_MJPEG: {
+      // The planes as coded, chroma repeated over the pixels sharing it.
+      libyuv::MJpegDecoder decoder;
+      if (!decoder.LoadFrame(src, frame->data_bytes) ||
+          decoder.GetWidth() != (int)frame->width || decoder.GetHeight() != (int)frame->height) {
+        return false;
+      }
+      int components = decoder.GetNumComponents();
+      bool isYuv =
+          decoder.GetColorSpace() == libyuv::MJpegDecoder::kColorSpaceYCbCr && components == 3;
+      bool isGray =
+          decoder.GetColorSpace() == libyuv::MJpegDecoder::kColorSpaceGrayscale && components == 1;
+      if (!isYuv && !isGray) {
+        return false;
+      }
+      // DecodeToBuffers() frees the frame's component info, so the layout is
+      // read before it.
+      std::vector<uint8_t> planes[3];
+      uint8_t* planePointers[3]{};
+      int horizontalSampling[3]{};
+      int verticalSampling[3]{};
+      size_t strides[3]{};
+      for (int i = 0; i < components; i++) {
+        planes[i].resize(decoder.GetComponentSize(i));
+        planePointers[i] = planes[i].data();
+        horizontalSampling[i] = decoder.GetHorizSubSampFactor(i);
+        verticalSampling[i] = decoder.GetVertSubSampFactor(i);
+        strides[i] = decoder.GetComponentStride(i);
+      }
+      if (!decoder.DecodeToBuffers(planePointers, frame->width, frame->height)) {
+        return false;
+      }
+      auto sample = [&](int i, int32_t x, int32_t y) {
+        size_t row = (size_t)(y / verticalSampling[i]) * strides[i];
+        return planes[i][row + x / horizontalSampling[i]];
+      };
+      // JFIF, as the decoder has it.
+      c = Colorimetry{Colorimetry::Matrix::BT601, true}.coefficients();
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        if (isGray) {
+          rgb[0] = rgb[1] = rgb[2] = sample(0, x, y);
+        } else {
+          yuvToRgb(c, sample(0, x, y), sample(1, x, y), sample(2, x, y), rgb);
+        }
+      });
+      return true;
+    }
+#endif
+    case UVC_FRAME_FORMAT_GRAY16:
+      boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+        rgb[0] = rgb[1] = rgb[2] = src[y * step + x * 2 + 1];
+      });
+      return true;
+    default:
+      break;
+  }
+  BayerLayout layout = demosaic::bayerLayout(frame->frame_format);
+  if (layout.bits == 0) {
+    return false;
+  }
+  // Unity gains; samples over 8 bits, clamped. The crop is demosaiced on its
+  // own, its edges mirrored.
+  auto raw = [&](int32_t x, int32_t y) {
+    auto mirror = [](int32_t i, int32_t first, int32_t size) {
+      i -= first;
+      i = i < 0 ? -i : (i >= size ? 2 * (size - 1) - i : i);
+      return first + i;
+    };
+    x = mirror(x, area.x, area.width);
+    y = mirror(y, area.y, area.height);
+    if (layout.bits == 8) {
+      return (float)src[y * step + x];
+    }
+    uint16_t value;
+    memcpy(&value, src + y * step + x * 2, sizeof(value));
+    return std::min(255.0f, value / (float)(1 << (layout.bits - 8)));
+  };
+  boxFilter(area, factor, out, [&](int32_t x, int32_t y, float rgb[3]) {
+    bool redRow = (y & 1) == layout.redY;
+    bool redColumn = (x & 1) == layout.redX;
+    float across = (raw(x - 1, y) + raw(x + 1, y)) / 2;
+    float down = (raw(x, y - 1) + raw(x, y + 1)) / 2;
+    if (redRow == redColumn) {
+      int32_t own = redRow ? 0 : 2;
+      rgb[own] = raw(x, y);
+      rgb[1] = (across + down) / 2;
+      rgb[2 - own] =
+          (raw(x - 1, y - 1) + raw(x + 1, y - 1) + raw(x - 1, y + 1) + raw(x + 1, y + 1)) / 4;
+    } else {
+      rgb[1] = raw(x, y);
+      rgb[redRow ? 0 : 2] = across;
+      rgb[redRow ? 2 : 0] = down;
+    }
+  });
+  return true;
+}
+
+// The RGB of a window buffer widened to 8 bits, or false for YUV buffers.
+bool windowRgb(const ANativeWindow_Buffer& buffer, RgbPlanes& out) {
+  const auto* bits = static_cast<const uint8_t*>(buffer.bits);
+  out.resize(buffer.width, buffer.height);
+  for (int32_t y = 0; y < buffer.height; y++) {
+    for (int32_t x = 0; x < buffer.width; x++) {
+      size_t pixel = (size_t)y * buffer.stride + x;
+      uint8_t rgb[3];
+      switch (buffer.format) {
+        case AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM:
+        case AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM:
+          memcpy(rgb, bits + pixel * 4, 3);
+          break;
+        case AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM:
+          memcpy(rgb, bits + pixel * 3, 3);
+          break;
+        case AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM: {
+          uint16_t value;
+          memcpy(&value, bits + pixel * 2, sizeof(value));
+          uint8_t r = value >> 11;
+          uint8_t g = (value >> 5) & 0x3f;
+          uint8_t b = value & 0x1f;
+          rgb[0] = (r << 3) | (r >> 2);
+          rgb[1] = (g << 2) | (g >> 4);
+          rgb[2] = (b << 3) | (b >> 2);
+          break;
+        }
+        case AHARDWAREBUFFER_FORMAT_R10G10B10A2_UNORM: {
+          uint32_t value;
+          memcpy(&value, bits + pixel * 4, sizeof(value));
+          for (int i = 0; i < 3; i++) {
+            rgb[i] = (uint8_t)((((value >> (i * 10)) & 0x3ff) * 255 + 511) / 1023);
+          }
+          break;
+        }
+        default:
+          return false;
+      }
+      for (int i = 0; i < 3; i++) {
+        out.planes[i][(size_t)y * buffer.width + x] = rgb[i];
+      }
+    }
+  }
+  return true;
+}
+
+// A frame and a fake locked window buffer with a gralloc like stride.
+struct ConversionCase {
+  FrameConverter converter{};
+  std::vector<std::vector<uint8_t>> payloads{};
+  uvc_frame_t frame{};
+  std::vector<uint8_t> bits{};
+  ANativeWindow_Buffer buffer{};
+  FrameCrop crop{};
+
+  ConversionCase(
+      int32_t frameFormat,
+      int32_t frameWidth,
+      int32_t frameHeight,
+      std::vector<std::vector<uint8_t>> frames,
+      int32_t windowFormat,
+      int32_t windowWidth,
+      int32_t windowHeight,
+      StripeWorkerPool* workerPool,
+      const FrameCrop& frameCrop,
+      bool dither)
+      : payloads(std::move(frames)), crop(frameCrop) {
+    frame.data = payloads[0].data();
+    frame.data_bytes = payloads[0].size();
+    frame.width = frameWidth;
+    frame.height = frameHeight;
+    frame.step = frameStep(frameFormat, frameWidth);
+    frame.frame_format = (uvc_frame_format)frameFormat;
+    int32_t stride = (windowWidth + 63) & ~63;
+    size_t bufferSize = (size_t)stride * windowHeight * 4;
+    if (windowFormat == FrameConverter::kYv12WindowFormat) {
+      size_t chromaStride = ((stride / 2) + 15) & ~15;
+      bufferSize = (size_t)stride * windowHeight + chromaStride * windowHeight;
+    }
+    bits.resize(bufferSize);
+    buffer.width = windowWidth;
+    buffer.height = windowHeight;
+    buffer.stride = stride;
+    buffer.format = windowFormat;
+    buffer.bits = bits.data();
+    converter.configure(frame.frame_format, windowFormat);
+    converter.setCpuScaling(true);
+    converter.setWorkerPool(workerPool, 0);
+    converter.setCrop(crop);
+    converter.setDither(dither);
+  }
+
+  // Converts every payload and compares it with its reference: PSNR over
+  // the squared error of all of them and their mean SSIM, both over the
+  // R, G and B planes.
+  bool quality(Quality& result) {
+    uint64_t sse = 0;
+    uint64_t samples = 0;
+    double ssim = 0;
+    RgbPlanes reference{};
+    RgbPlanes output{};
+    bool measured = true;
+    for (const std::vector<uint8_t>& payload : payloads) {
+      frame.data = const_cast<uint8_t*>(payload.data());
+      frame.data_bytes = payload.size();
+      measured = converter.convert(&frame, buffer) &&
+          referenceRgb(
+              &frame, converter.colorimetry(), crop, buffer.width, buffer.height, reference) &&
+          windowRgb(buffer, output);
+      if (!measured) {
+        break;
+      }
+      for (int i = 0; i < 3; i++) {
+        sse += libyuv::ComputeSumSquareErrorPlane(
+            reference.planes[i].data(),
+            reference.width,
+            output.planes[i].data(),
+            output.width,
+            output.width,
+            output.height);
+        ssim += libyuv::CalcFrameSsim(
+                    reference.planes[i].data(),
+                    reference.width,
+                    output.planes[i].data(),
+                    output.width,
+                    output.width,
+                    output.height) /
+            (3 * payloads.size());
+      }
+      samples += (uint64_t)output.width * output.height * 3;
+    }
+    frame.data = payloads[0].data();
+    frame.data_bytes = payloads[0].size();
+    if (measured) {
+      result = {libyuv::SumSquareErrorToPsnr(sse, samples), ssim};
+    }
+    return measured;
+  }
+};
+
+void addConversion(
+    std::vector<Benchmark>& benchmarks,
+    const std::string& name,
+    int32_t frameFormat,
+    int32_t frameWidth,
+    int32_t frameHeight,
+    std::vector<std::vector<uint8_t>> payloads,
+    const NamedFormat& window,
+    int32_t windowWidth,
+    int32_t windowHeight,
+    StripeWorkerPool* workerPool,
+    const FrameCrop& crop = {},
+    bool dither = false) {
+  uint64_t payloadBytes = payloads[0].size();
+  auto conversion = std::make_shared<ConversionCase>(
+      frameFormat,
+      frameWidth,
+      frameHeight,
+      std::move(payloads),
+      window.format,
+      windowWidth,
+      windowHeight,
+      workerPool,
+      crop,
+      dither);
+  std::string sizes = sizeName(frameWidth, frameHeight);
+  if (!crop.empty()) {
+    sizes += "/crop" + sizeName(crop.width, crop.height);
+  }
+  if (frameWidth != windowWidth || frameHeight != windowHeight) {
+    sizes += "->" + sizeName(windowWidth, windowHeight);
+  }
+  benchmarks.push_back(
+      {"convert/" + name + "/" + sizes + "/" + window.name + (dither ? "/dither" : ""),
+       (uint64_t)windowWidth * windowHeight,
+       payloadBytes + windowBytes(window.format, windowWidth, windowHeight),
+       [conversion] {
+         return conversion->converter.convert(&conversion->frame, conversion->buffer);
+       },
+       [conversion](Quality& quality) { return conversion->quality(quality); }});
+}
+
+std::vector<std::vector<uint8_t>> corpusOf(std::vector<uint8_t> payload) {
+  std::vector<std::vector<uint8_t>> payloads;
+  payloads.push_back(std::move(payload));
+  return payloads;
+}
+
+void addConverterBenchmarks(
+    std::vector<Benchmark>& benchmarks,
+    const std::vector<JpegInput>& jpegs,
+    const std::vector<FrameLogInput>& logs,
+    StripeWorkerPool* workerPool) {
+  for (const NamedFormat& format : kFrameFormats) {
+    for (const NamedFormat& window : kWindowFormats) {
+      auto frameFormat = (uvc_frame_format)format.format;
+      if (!FrameConverter::isSupported(frameFormat, window.format)) {
+        continue;
+      }
+      for (const Resolution& res : kResolutions) {
+        std::vector<uint8_t> payload =
+            makePattern(frameSize(format.format, res.width, res.height));
+        addConversion(
+            benchmarks,
+            format.name,
+            format.format,
+            res.width,
+            res.height,
+            corpusOf(std::move(payload)),
+            window,
+            res.width,
+            res.height,
+            workerPool);
+      }
+    }
+  }
+
+  // CPU scaling from a camera mode one step larger than the window, which
+  // only 32 bit buffers get.
+  for (const NamedFormat& format : kFrameFormats) {
+    const NamedFormat& window = kWindowFormats[0];
+    if (!FrameConverter::isSupported((uvc_frame_format)format.format, window.format)) {
+      continue;
+    }
+    for (size_t i = 1; i < std::size(kResolutions); i++) {
+      Resolution from = kResolutions[i];
+      Resolution to = kResolutions[i - 1];
+      addConversion(
+          benchmarks,
+          format.name,
+          format.format,
+          from.width,
+          from.height,
+          corpusOf(makePattern(frameSize(format.format, from.width, from.height))),
+          window,
+          to.width,
+          to.height,
+          workerPool);
+    }
+  }
+
+  // A 2x digital zoom: the centre quarter of a 1080p frame into buffers the
+  // compositor scales, against converting it all.
+  Resolution zoomed = kResolutions[2];
+  FrameCrop centre{zoomed.width / 4, zoomed.height / 4, zoomed.width / 2, zoomed.height / 2};
+  for (const NamedFormat& format : kFrameFormats) {
+    const NamedFormat& window = kWindowFormats[0];
+    if (!FrameConverter::isSupported((uvc_frame_format)format.format, window.format)) {
+      continue;
+    }
+    addConversion(
+        benchmarks,
+        format.name,
+        format.format,
+        zoomed.width,
+        zoomed.height,
+        corpusOf(makePattern(frameSize(format.format, zoomed.width, zoomed.height))),
+        window,
+        centre.width,
+        centre.height,
+        workerPool,
+        centre);
+  }
+
+  // The power profile's dithered RGB565 preview, against the plain one above.
+  const NamedFormat& rgb565 = kWindowFormats[3];
+  for (const NamedFormat& format : kFrameFormats) {
+    if (!FrameConverter::isSupported((uvc_frame_format)format.format, rgb565.format)) {
+      continue;
+    }
+    addConversion(
+        benchmarks,
+        format.name,
+        format.format,
+        zoomed.width,
+        zoomed.height,
+        corpusOf(makePattern(frameSize(format.format, zoomed.width, zoomed.height))),
+        rgb565,
+        zoomed.width,
+        zoomed.height,
+        workerPool,
+        {},
+        true);
+  }
+
+  // MJPEG through MjpegDecoder, AImageDecoder or libjpeg depending on the
+  // minimum SDK, at the frame size and decoded straight to half of it.
+  for (const JpegInput& jpeg : jpegs) {
+    for (const NamedFormat& window : kWindowFormats) {
+      if (!FrameConverter::isSupported(UVC_FRAME_FORMAT_MJPEG, window.format)) {
+        continue;
+      }
+      for (int32_t denom : {1, 2}) {
+        addConversion(
+            benchmarks,
+            "MJPEG/" + jpeg.name,
+            UVC_FRAME_FORMAT_MJPEG,
+            jpeg.width,
+            jpeg.height,
+            corpusOf(jpeg.data),
+            window,
+            jpeg.width / denom,
+            jpeg.height / denom,
+            workerPool);
+      }
+    }
+  }
+
+  // Recorded camera frames, MJPEG ones also decoded to half the size.
+  for (const FrameLogInput& log : logs) {
+    auto frameFormat = (uvc_frame_format)log.format;
+    for (const NamedFormat& window : kWindowFormats) {
+      if (!FrameConverter::isSupported(frameFormat, window.format)) {
+        continue;
+      }
+      for (int32_t denom : {1, 2}) {
+        if (denom > 1 && frameFormat != UVC_FRAME_FORMAT_MJPEG) {
+          break;
+        }
+        addConversion(
+            benchmarks,
+            std::string(frameFormatName(log.format)) + "/" + log.name,
+            log.format,
+            log.width,
+            log.height,
+            log.frames,
+            window,
+            log.width / denom,
+            log.height / denom,
+            workerPool);
+      }
+    }
+  }
+}
+
+// PSNR and SSIM over the R, G and B planes of one output.
+Quality qualityOf(const RgbPlanes& reference, const RgbPlanes& output) {
+  uint64_t sse = 0;
+  double ssim = 0;
+  for (int i = 0; i < 3; i++) {
+    sse += libyuv::ComputeSumSquareErrorPlane(
+        reference.planes[i].data(),
+        reference.width,
+        output.planes[i].data(),
+        output.width,
+        output.width,
+        output.height);
+    ssim += libyuv::CalcFrameSsim(
+                reference.planes[i].data(),
+                reference.width,
+                output.planes[i].data(),
+                output.width,
+                output.width,
+                output.height) /
+        3;
+  }
+  return {libyuv::SumSquareErrorToPsnr(sse, (uint64_t)output.width * output.height * 3), ssim};
+}
+
+#if defined(__ANDROID__)
+// A frame of a pattern, heap memory rather than a HardwareFrameBuffers slot,
+// so both GPU backends copy it to the GPU first, as the render thread's
+// frames are without slots.
+struct BackendFrame {
+  std::vector<uint8_t> payload{};
+  uvc_frame_t frame{};
+  Colorimetry colorimetry{};
+
+  BackendFrame(uvc_frame_format format, int32_t width, int32_t height)
+      : payload(makePattern(frameSize(format, width, height))),
+        colorimetry(Colorimetry::of(nullptr, format)) {
+    frame.data = payload.data();
+    frame.data_bytes = payload.size();
+    frame.width = width;
+    frame.height = height;
+    frame.step = frameStep(format, width);
+    frame.frame_format = format;
+  }
+
+  // Of an RGBA output, against the floating point conversion.
+  bool quality(const ANativeWindow_Buffer& buffer, Quality& result) const {
+    RgbPlanes reference{};
+    RgbPlanes output{};
+    if (!referenceRgb(&frame, colorimetry, {}, frame.width, frame.height, reference) ||
+        !windowRgb(buffer, output)) {
+      return false;
+    }
+    result = qualityOf(reference, output);
+    return true;
+  }
+};
+
+// The GL preview drawing into an image reader's window, whose images are
+// taken back, and the draw so waited for, after each frame.
+struct GlBackend {
+  // First, so the window, which goes with the reader, outlives the renderer.
+  std::unique_ptr<AImageReader, decltype(&AImageReader_delete)> reader{
+      nullptr, &AImageReader_delete};
+  GlPreviewRenderer renderer{};
+
+  ~GlBackend() {
+    renderer.releaseCurrent();
+  }
+
+  bool init(const BackendFrame& input) {
+    AImageReader* created = nullptr;
+    if (AImageReader_newWithUsage(
+            input.frame.width,
+            input.frame.height,
+            AIMAGE_FORMAT_RGBA_8888,
+            AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE | AHARDWAREBUFFER_USAGE_CPU_READ_RARELY,
+            4,
+            &created) != AMEDIA_OK) {
+      return false;
+    }
+    reader.reset(created);
+    ANativeWindow* window = nullptr;
+    return AImageReader_getWindow(reader.get(), &window) == AMEDIA_OK &&
+        renderer.init(
+            window,
+            input.frame.width,
+            input.frame.height,
+            input.frame.frame_format,
+            input.colorimetry,
+            {}) &&
+        renderer.makeCurrent();
+  }
+
+  // Waits for the image the frame was drawn into, which quality() reads if
+  // given.
+  bool run(BackendFrame& input, Quality* quality = nullptr) {
+    if (!renderer.makeCurrent() || !renderer.renderFrame(&input.frame)) {
+      return false;
+    }
+    AImage* image = nullptr;
+    if (AImageReader_acquireLatestImage(reader.get(), &image) != AMEDIA_OK) {
+      return false;
+    }
+    bool measured = quality == nullptr;
+    uint8_t* bits = nullptr;
+    int length = 0;
+    int32_t rowStride = 0;
+    if (quality != nullptr && AImage_getPlaneData(image, 0, &bits, &length) == AMEDIA_OK &&
+        AImage_getPlaneRowStride(image, 0, &rowStride) == AMEDIA_OK) {
+      ANativeWindow_Buffer buffer{
+          (int32_t)input.frame.width,
+          (int32_t)input.frame.height,
+          rowStride / 4,
+          AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM,
+          bits};
+      measured = input.quality(buffer, *quality);
+    }
+    AImage_delete(image);
+    return measured;
+  }
+};
+
+// VulkanConverter writing a hardware buffer, waited for on its fence.
+struct VulkanBackend {
+  VulkanConverter converter{};
+  AHardwareBuffer* output{};
+
+  ~VulkanBackend() {
+    if (output != nullptr) {
+      AHardwareBuffer_release(output);
+    }
+  }
+
+  bool init(const BackendFrame& input) {
+    AHardwareBuffer_Desc desc{};
+    desc.width = input.frame.width;
+    desc.height = input.frame.height;
+    desc.layers = 1;
+    desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+    desc.usage = AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE | AHARDWAREBUFFER_USAGE_CPU_READ_RARELY;
+    return AHardwareBuffer_allocate(&desc, &output) == 0 &&
+        converter.init(
+            input.frame.width, input.frame.height, input.frame.frame_format, input.colorimetry);
+  }
+
+  bool run(BackendFrame& input, Quality* quality = nullptr) {
+    int doneFence = -1;
+    if (!converter.convert(&input.frame, output, -1, doneFence)) {
+      return false;
+    }
+    if (doneFence >= 0) {
+      pollfd pfd{doneFence, POLLIN, 0};
+      while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+      }
+      close(doneFence);
+    }
+    if (quality == nullptr) {
+      return true;
+    }
+    void* bits = nullptr;
+    if (AHardwareBuffer_lock(output, AHARDWAREBUFFER_USAGE_CPU_READ_RARELY, -1, nullptr, &bits) !=
+        0) {
+      return false;
+    }
+    AHardwareBuffer_Desc desc;
+    AHardwareBuffer_describe(output, &desc);
+    ANativeWindow_Buffer buffer{
+        (int32_t)desc.width,
+        (int32_t)desc.height,
+        (int32_t)desc.stride,
+        (int32_t)desc.format,
+        bits};
+    bool measured = input.quality(buffer, *quality);
+    AHardwareBuffer_unlock(output, nullptr);
+    return measured;
+  }
+};
+
+template <typename Backend>
+void addGpuBackend(
+    std::vector<Benchmark>& benchmarks,
+    const std::string& name,
+    uvc_frame_format format,
+    int32_t width,
+    int32_t height) {
+  auto input = std::make_shared<BackendFrame>(format, width, height);
+  auto backend = std::make_shared<Backend>();
+  if (!backend->init(*input)) {
+    fprintf(stderr, "%s unavailable, skipped\n", name.c_str());
+    return;
+  }
+  uint64_t pixels = (uint64_t)width * height;
+  benchmarks.push_back(
+      {name,
+       pixels,
+       input->payload.size() + pixels * 4,
+       [input, backend] { return backend->run(*input); },
+       [input, backend](Quality& quality) { return backend->run(*input, &quality); }});
+}
+#endif
+
+// The three preview backends side by side for the formats all but the GL
+// preview take, which has no P010.
+void addBackendBenchmarks(std::vector<Benchmark>& benchmarks, StripeWorkerPool* workerPool) {
+  constexpr NamedFormat kBackendFormats[] = {
+      {UVC_FRAME_FORMAT_YUYV, "YUYV"},
+      {UVC_FRAME_FORMAT_NV12, "NV12"},
+      {UVC_FRAME_FORMAT_P010, "P010"},
+  };
+  const NamedFormat& window = kWindowFormats[1];
+  for (const NamedFormat& format : kBackendFormats) {
+    for (const Resolution& res : kResolutions) {
+      std::string prefix = std::string("backend/") + format.name + "/" +
+          sizeName(res.width, res.height) + "/";
+      auto conversion = std::make_shared<ConversionCase>(
+          format.format,
+          res.width,
+          res.height,
+          corpusOf(makePattern(frameSize(format.format, res.width, res.height))),
+          window.format,
+          res.width,
+          res.height,
+          workerPool,
+          FrameCrop{},
+          false);
+      benchmarks.push_back(
+          {prefix + "libyuv",
+           (uint64_t)res.width * res.height,
+           conversion->payloads[0].size() + windowBytes(window.format, res.width, res.height),
+           [conversion] {
+             return conversion->converter.convert(&conversion->frame, conversion->buffer);
+           },
+           [conversion](Quality& quality) { return conversion->quality(quality); }});
+#if defined(__ANDROID__)
+      auto frameFormat = (uvc_frame_format)format.format;
+      if (GlPreviewRenderer::supportsFormat(frameFormat)) {
+        addGpuBackend<GlBackend>(benchmarks, prefix + "GLES", frameFormat, res.width, res.height);
+      }
+      addGpuBackend<VulkanBackend>(
+          benchmarks, prefix + "Vulkan", frameFormat, res.width, res.height);
+#endif
+    }
+  }
+}
+
+bool measure(
+    const Benchmark& benchmark,
+    const Options& options,
+    const CycleCounter& cycleCounter,
+    Result& result) {
+  for (int i = 0; i < kWarmupIterations; i++) {
+    if (!benchmark.run()) {
+      return false;
+    }
+  }
+  std::vector<Result> repetitions;
+  for (int r = 0; r < options.repetitions; r++) {
+    uint64_t iterations = 0;
+    uint64_t startCycles = cycleCounter.read();
+    steady_clock::time_point start = steady_clock::now();
+    duration<double> elapsed{};
+    do {
+      if (!benchmark.run()) {
+        return false;
+      }
+      iterations++;
+      elapsed = steady_clock::now() - start;
+    } while (elapsed < options.minTime);
+    uint64_t cycles = cycleCounter.read() - startCycles;
+    double seconds = elapsed.count();
+    repetitions.push_back({
+        iterations / seconds,
+        iterations * benchmark.bytes / seconds / 1e9,
+        // Stripes on the pool threads are not counted.
+        cycleCounter.available() && !options.parallel
+            ? (double)cycles / (iterations * benchmark.pixels)
+            : -1,
+    });
+  }
+  // The median repetition by frame rate, so one preempted run does not
+  // skew the comparison.
+  std::sort(repetitions.begin(), repetitions.end(), [](const Result& a, const Result& b) {
+    return a.fps < b.fps;
+  });
+  result = repetitions[repetitions.size() / 2];
+  return true;
+}
+
+void printUsage(const char* program) {
+  fprintf(
+      stderr,
+      "Usage: %s [--filter=REGEX] [--min_time=SECONDS] [--repetitions=N] [--parallel]\n"
+      "          [--tsv] [--jpeg=FILE]... [--frame_log=FILE]...\n"
+      "  --filter       runs the cases whose name matches REGEX\n"
+      "  --min_time     times each repetition for at least SECONDS (default 0.2)\n"
+      "  --repetitions  reports the median of N repetitions (default 1)\n"
+      "  --parallel     converts in stripes on the worker pool, cycles are not reported\n"
+      "  --tsv          prints tab separated values\n"
+      "  --jpeg         adds MJPEG decode cases for a camera frame saved as a JPEG\n"
+      "  --frame_log    adds cases for the frames of a log FrameLogRecorder wrote\n",
+      program);
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--filter") {
+      options.filter = std::regex(value);
+    } else if (key == "--min_time") {
+      options.minTime = duration<double>(atof(value.c_str()));
+    } else if (key == "--repetitions") {
+      options.repetitions = std::max(1, atoi(value.c_str()));
+    } else if (key == "--parallel") {
+      options.parallel = true;
+    } else if (key == "--tsv") {
+      options.tsv = true;
+    } else if (key == "--jpeg" && !value.empty()) {
+      options.jpegPaths.push_back(value);
+    } else if (key == "--frame_log" && !value.empty()) {
+      options.frameLogPaths.push_back(value);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#if !defined(__ANDROID__)
+  // Converter setup messages would break up the table on the terminal.
+  setenv("USB_VIDEO_LOG_LEVEL", "W", 0);
+#endif
+  Options options{};
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  std::vector<JpegInput> jpegs;
+  std::vector<FrameLogInput> logs;
+  if (!loadJpegs(options.jpegPaths, jpegs) || !loadFrameLogs(options.frameLogPaths, logs)) {
+    return 1;
+  }
+
+  std::vector<Benchmark> benchmarks;
+  addLibyuvBenchmarks(benchmarks, jpegs);
+  addJpegEntropyBenchmarks(benchmarks, jpegs);
+  addDewarpBenchmarks(benchmarks);
+  std::shared_ptr<StripeWorkerPool> workerPool;
+  if (options.parallel) {
+    workerPool = StripeWorkerPool::shared();
+  }
+  addConverterBenchmarks(benchmarks, jpegs, logs, workerPool.get());
+  addBackendBenchmarks(benchmarks, workerPool.get());
+
+  CycleCounter cycleCounter;
+  if (!cycleCounter.available() && !options.parallel) {
+    fprintf(stderr, "CPU cycle counter unavailable: %s\n", strerror(errno));
+  }
+  // On stderr, so the tables of two devices still diff case by case.
+  const CpuFeatures& cpu = CpuFeatures::get();
+  fprintf(stderr, "CPU %s, libyuv flags 0x%x\n", cpu.summary().c_str(), cpu.libyuvFlags);
+  int failures = 0;
+  if (!cpu.libyuvAgrees()) {
+    fprintf(stderr, "libyuv and the kernel disagree on NEON or AVX2, kernels are not those\n");
+    failures++;
+  }
+  if (options.tsv) {
+    printf("name\tfps\tGB/s\tcycles/pixel\tPSNR dB\tSSIM\n");
+  } else {
+    printf(
+        "%-56s %10s %8s %12s %8s %7s\n",
+        "Benchmark",
+        "fps",
+        "GB/s",
+        "cycles/pixel",
+        "PSNR dB",
+        "SSIM");
+  }
+  for (const Benchmark& benchmark : benchmarks) {
+    if (!std::regex_search(benchmark.name, options.filter)) {
+      continue;
+    }
+    Result result{};
+    if (!measure(benchmark, options, cycleCounter, result)) {
+      fprintf(stderr, "%s failed\n", benchmark.name.c_str());
+      failures++;
+      continue;
+    }
+    char cycles[16] = "-";
+    if (result.cyclesPerPixel >= 0) {
+      snprintf(cycles, sizeof(cycles), "%.2f", result.cyclesPerPixel);
+    }
+    // After timing, not to disturb the caches it ran with.
+    Quality quality{};
+    char psnr[16] = "-";
+    char ssim[16] = "-";
+    if (benchmark.quality && benchmark.quality(quality)) {
+      snprintf(psnr, sizeof(psnr), "%.2f", quality.psnr);
+      snprintf(ssim, sizeof(ssim), "%.4f", quality.ssim);
+    }
+    if (options.tsv) {
+      printf(
+          "%s\t%.1f\t%.3f\t%s\t%s\t%s\n",
+          benchmark.name.c_str(),
+          result.fps,
+          result.gbps,
+          cycles,
+          psnr,
+          ssim);
+    } else {
+      printf(
+          "%-56s %10.1f %8.3f %12s %8s %7s\n",
+          benchmark.name.c_str(),
+          result.fps,
+          result.gbps,
+          cycles,
+          psnr,
+          ssim);
+    }
+    fflush(stdout);
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Throughput of libuvc's payload path, without a device.
+//
+// A generator writes the payloads a camera would send for a few frames:
+// a header of 2 bytes, or 12 with PTS and SCR, optionally followed by
+// metadata, the frame ID toggling from frame to frame and EOF on the last
+// payload of each. Isochronous packets are sized for full, high and super
+// speed, some of them empty the way a camera pads a reservation it does
+// not fill, and some with the error bit set. Bulk transfers hold several
+// dwMaxPayloadTransferSize payloads back to back, up to the short payload
+// ending a frame. MJPEG-like cases vary the frame size from frame to frame.
+//
+// The payloads are fed to a uvc_stream_open_synthetic() stream, packet by
+// packet for isochronous cases and transfer by transfer for bulk ones, which
+// parses the headers, assembles the frames in the pool and hands each to an
+// inline callback, as a started stream does from its transfer callback.
+// Generating happens before timing, so only libuvc is measured.
+//
+// How payloads are copied into the frame matters past the copy itself, so
+// the callback can stand in for the consumer: --read_frames reads every
+// frame back, as a converter would, and --working_set_kb reads a buffer of
+// that size per frame, the data the event and render threads keep cached.
+// Comparing --streaming_copy_bytes=off with the default shows what the
+// non-temporal copy of large payloads costs or saves with either.
+
+#include <libuvc/libuvc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace {
+
+// Iterations run before timing, to fault in buffers and warm the caches.
+constexpr int kWarmupIterations = 3;
+// Frames generated per case; an iteration feeds all of them.
+constexpr uint32_t kFrames = 8;
+constexpr uint32_t kPoolSize = 4;
+constexpr uint8_t kEndOfHeader = 0x80;
+constexpr uint8_t kError = 0x40;
+constexpr uint8_t kScr = 0x08;
+constexpr uint8_t kPts = 0x04;
+constexpr uint8_t kEndOfFrame = 0x02;
+constexpr uint8_t kFrameId = 0x01;
+
+struct Scenario {
+  std::string name;
+  bool bulk{false};
+  // Largest payload: a packet's for isochronous cases,
+  // dwMaxPayloadTransferSize for bulk ones.
+  uint32_t payloadBytes{3072};
+  uint32_t payloadsPerTransfer{1};
+  uvc_frame_format format{UVC_FRAME_FORMAT_YUYV};
+  uint32_t width{1280};
+  uint32_t height{720};
+  // Frames vary between half and all of it when set, like MJPEG.
+  bool variableSize{false};
+  // Frame bytes when variableSize is set, dwMaxVideoFrameSize otherwise.
+  uint32_t frameBytes{1280 * 720 * 2};
+  // 2, 12 with PTS and SCR, or more with metadata after them.
+  uint32_t headerBytes{12};
+  // Isochronous packets without a payload, and payloads with the error bit.
+  double emptyRate{0};
+  double errorRate{0};
+};
+
+struct Options {
+  std::regex filter{".*"};
+  duration<double> minTime{0.2};
+  int repetitions{1};
+  uint32_t seed{1};
+  bool tsv{false};
+  // uvc_stream_options_t's, 0 for libuvc's default.
+  uint32_t streamingCopyBytes{0};
+  bool readFrames{false};
+  size_t workingSetBytes{0};
+};
+
+// The payloads of kFrames frames, back to back in data. A transfer is one
+// isochronous packet, or one bulk transfer of several payloads.
+struct PayloadStream {
+  std::vector<uint8_t> data;
+  std::vector<size_t> transferOffsets;
+  std::vector<size_t> transferBytes;
+  uint64_t payloads{};
+  uint64_t frameBytes{};
+  uint32_t maxFrameBytes{};
+};
+
+struct Result {
+  double packetsPerSecond{};
+  double nsPerPacket{};
+  double gbps{};
+  double fps{};
+};
+
+// What the frame callback saw, and what it reads as the consumer.
+struct Received {
+  uint64_t frames{};
+  uint64_t bytes{};
+  uint64_t incomplete{};
+  bool readFrames{false};
+  std::vector<uint64_t> workingSet;
+  // Keeps the reads from being optimized out.
+  uint64_t checksum{};
+};
+
+uint64_t sum(const uint8_t* data, size_t bytes) {
+  uint64_t total = 0;
+  for (size_t i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    total += word;
+  }
+  return total;
+}
+
+void frameCallback(uvc_frame_t* frame, void* user_ptr) {
+  Received* received = static_cast<Received*>(user_ptr);
+  received->frames++;
+  received->bytes += frame->data_bytes;
+  received->incomplete += frame->incomplete ? 1 : 0;
+  if (received->readFrames) {
+    received->checksum += sum(static_cast<const uint8_t*>(frame->data), frame->data_bytes);
+  }
+  received->checksum +=
+      std::accumulate(received->workingSet.begin(), received->workingSet.end(), uint64_t{0});
+}
+
+// Writes a payload header of s.headerBytes.
+void writeHeader(
+    const Scenario& s,
+    uint8_t* dst,
+    uint8_t bits,
+    uint32_t pts,
+    uint32_t scr,
+    uint16_t sof) {
+  dst[0] = s.headerBytes;
+  dst[1] = kEndOfHeader | bits;
+  if (s.headerBytes >= 12) {
+    dst[1] |= kPts | kScr;
+    memcpy(dst + 2, &pts, sizeof(pts));
+    memcpy(dst + 6, &scr, sizeof(scr));
+    memcpy(dst + 10, &sof, sizeof(sof));
+    // Metadata, which libuvc copies out per payload.
+    for (uint32_t i = 12; i < s.headerBytes; i++) {
+      dst[i] = i;
+    }
+  }
+}
+
+PayloadStream generate(const Scenario& s, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  std::uniform_int_distribution<uint32_t> frameSize(s.frameBytes / 2, s.frameBytes);
+  uint32_t dataPerPayload = s.payloadBytes - s.headerBytes;
+  PayloadStream stream{};
+  stream.maxFrameBytes = s.variableSize ? s.width * s.height * 2 : s.frameBytes;
+
+  uint32_t pts = 0;
+  uint32_t scr = 0;
+  uint16_t sof = 0;
+  uint8_t pattern = 0;
+  for (uint32_t f = 0; f < kFrames; f++) {
+    uint32_t bytes = s.variableSize ? frameSize(random) : s.frameBytes;
+    uint8_t fid = f % 2 == 0 ? 0 : kFrameId;
+    pts += 33'333 * 48;
+    stream.frameBytes += bytes;
+    uint32_t sent = 0;
+    size_t transferStart = stream.data.size();
+    uint32_t inTransfer = 0;
+    while (sent < bytes) {
+      if (!s.bulk && chance(random) < s.emptyRate) {
+        stream.transferOffsets.push_back(stream.data.size());
+        stream.transferBytes.push_back(0);
+        stream.payloads++;
+        transferStart = stream.data.size();
+        continue;
+      }
+      uint32_t data = std::min(dataPerPayload, bytes - sent);
+      bool last = sent + data == bytes;
+      bool error = chance(random) < s.errorRate;
+      uint8_t bits = fid | (last ? kEndOfFrame : 0) | (error ? kError : 0);
+      scr += 1000;
+      sof = (sof + 1) & 0x7ff;
+      size_t offset = stream.data.size();
+      stream.data.resize(offset + s.headerBytes + data);
+      writeHeader(s, stream.data.data() + offset, bits, pts, scr, sof);
+      memset(stream.data.data() + offset + s.headerBytes, pattern++, data);
+      sent += data;
+      stream.payloads++;
+      inTransfer++;
+      // Isochronous packets go one by one; a bulk transfer ends when it is
+      // full or on the short payload ending the frame.
+      if (!s.bulk || inTransfer == s.payloadsPerTransfer || last) {
+        stream.transferOffsets.push_back(transferStart);
+        stream.transferBytes.push_back(stream.data.size() - transferStart);
+        transferStart = stream.data.size();
+        inTransfer = 0;
+      }
+    }
+  }
+  return stream;
+}
+
+// Feeds every transfer of the stream once.
+void feed(const Scenario& s, uvc_stream_handle_t* strmh, PayloadStream& stream) {
+  uint8_t* data = stream.data.data();
+  size_t transfers = stream.transferOffsets.size();
+  for (size_t i = 0; i < transfers; i++) {
+    uint8_t* transfer = data + stream.transferOffsets[i];
+    if (s.bulk) {
+      uvc_stream_feed_bulk(strmh, transfer, stream.transferBytes[i]);
+    } else {
+      uvc_stream_feed_payload(strmh, transfer, stream.transferBytes[i], s.payloadBytes);
+    }
+  }
+}
+
+bool measure(const Scenario& s, const Options& options, Result& result) {
+  PayloadStream stream = generate(s, options.seed);
+  Received received{};
+  received.readFrames = options.readFrames;
+  received.workingSet.resize(options.workingSetBytes / sizeof(uint64_t), 1);
+  uvc_stream_options_t streamOptions{};
+  streamOptions.frame_pool_size = kPoolSize;
+  streamOptions.streaming_copy_bytes = options.streamingCopyBytes;
+  uvc_stream_handle_t* strmh = nullptr;
+  uvc_error_t ret = uvc_stream_open_synthetic(
+      &strmh,
+      s.format,
+      s.width,
+      s.height,
+      stream.maxFrameBytes,
+      s.payloadBytes,
+      &streamOptions,
+      frameCallback,
+      &received);
+  if (ret != UVC_SUCCESS) {
+    fprintf(stderr, "uvc_stream_open_synthetic: %s\n", uvc_strerror(ret));
+    return false;
+  }
+
+  for (int i = 0; i < kWarmupIterations; i++) {
+    feed(s, strmh, stream);
+  }
+  // The frames of every iteration come out whole, unless errors hit an EOF
+  // and the frame ID of the next frame ends it instead.
+  bool ok = received.frames + 1 >= (uint64_t)kWarmupIterations * kFrames;
+  if (s.errorRate == 0) {
+    ok = ok && received.bytes == kWarmupIterations * stream.frameBytes &&
+        received.incomplete == 0;
+  }
+  if (!ok) {
+    fprintf(
+        stderr,
+        "%s: %llu frames of %llu bytes, %llu incomplete\n",
+        s.name.c_str(),
+        (unsigned long long)received.frames,
+        (unsigned long long)received.bytes,
+        (unsigned long long)received.incomplete);
+    uvc_stream_close(strmh);
+    return false;
+  }
+
+  std::vector<Result> repetitions;
+  for (int r = 0; r < options.repetitions; r++) {
+    uint64_t iterations = 0;
+    steady_clock::time_point start = steady_clock::now();
+    duration<double> elapsed{};
+    do {
+      feed(s, strmh, stream);
+      iterations++;
+      elapsed = steady_clock::now() - start;
+    } while (elapsed < options.minTime);
+    double seconds = elapsed.count();
+    double packets = (double)iterations * stream.payloads;
+    repetitions.push_back({
+        packets / seconds,
+        seconds * 1e9 / packets,
+        iterations * stream.data.size() / seconds / 1e9,
+        iterations * kFrames / seconds,
+    });
+  }
+  uvc_stream_close(strmh);
+  // The median repetition, so one preempted run does not skew the
+  // comparison.
+  std::sort(repetitions.begin(), repetitions.end(), [](const Result& a, const Result& b) {
+    return a.packetsPerSecond < b.packetsPerSecond;
+  });
+  result = repetitions[repetitions.size() / 2];
+  return true;
+}
+
+std::vector<Scenario> scenarios() {
+  std::vector<Scenario> list;
+  // 1023 byte packets, one per frame of 1 ms.
+  list.push_back(
+      {.name = "iso/full/1023/hdr12/yuyv_160x120",
+       .payloadBytes = 1023,
+       .width = 160,
+       .height = 120,
+       .frameBytes = 160 * 120 * 2});
+
+  // 3 transactions of 1024 bytes per microframe.
+  Scenario high{.name = "iso/high/3072/hdr12/yuyv_1280x720"};
+  Scenario bare = high;
+  bare.name = "iso/high/3072/hdr2/yuyv_1280x720";
+  bare.headerBytes = 2;
+  list.push_back(bare);
+  list.push_back(high);
+  Scenario metadata = high;
+  metadata.name = "iso/high/3072/hdr12_meta20/yuyv_1280x720";
+  metadata.headerBytes = 32;
+  list.push_back(metadata);
+  Scenario empty = high;
+  empty.name = "iso/high/3072/hdr12/yuyv_1280x720_empty25pct";
+  empty.emptyRate = 0.25;
+  list.push_back(empty);
+  Scenario errors = high;
+  errors.name = "iso/high/3072/hdr12/yuyv_1280x720_errors1pct";
+  errors.errorRate = 0.01;
+  list.push_back(errors);
+  Scenario mjpeg = high;
+  mjpeg.name = "iso/high/3072/hdr12/mjpeg_1920x1080";
+  mjpeg.format = UVC_FRAME_FORMAT_MJPEG;
+  mjpeg.width = 1920;
+  mjpeg.height = 1080;
+  mjpeg.variableSize = true;
+  mjpeg.frameBytes = 400'000;
+  mjpeg.emptyRate = 0.1;
+  list.push_back(mjpeg);
+
+  // 3 bursts of 16 packets of 1024 bytes per service interval.
+  Scenario super = high;
+  super.name = "iso/super/49152/hdr12/yuyv_1920x1080";
+  super.payloadBytes = 49152;
+  super.width = 1920;
+  super.height = 1080;
+  super.frameBytes = 1920 * 1080 * 2;
+  list.push_back(super);
+
+  Scenario bulkHigh = high;
+  bulkHigh.name = "bulk/high/16k_x8/hdr12/yuyv_1280x720";
+  bulkHigh.bulk = true;
+  bulkHigh.payloadBytes = 16384;
+  bulkHigh.payloadsPerTransfer = 8;
+  list.push_back(bulkHigh);
+  Scenario bulkSuper = super;
+  bulkSuper.name = "bulk/super/64k_x16/hdr12/yuyv_1920x1080";
+  bulkSuper.bulk = true;
+  bulkSuper.payloadBytes = 65536;
+  bulkSuper.payloadsPerTransfer = 16;
+  list.push_back(bulkSuper);
+  Scenario bulkMjpeg = bulkSuper;
+  bulkMjpeg.name = "bulk/super/64k_x16/hdr12/mjpeg_3840x2160";
+  bulkMjpeg.format = UVC_FRAME_FORMAT_MJPEG;
+  bulkMjpeg.width = 3840;
+  bulkMjpeg.height = 2160;
+  bulkMjpeg.variableSize = true;
+  bulkMjpeg.frameBytes = 1'500'000;
+  list.push_back(bulkMjpeg);
+  return list;
+}
+
+void printUsage(const char* program) {
+  fprintf(
+      stderr,
+      "Usage: %s [--filter=REGEX] [--min_time=SECONDS] [--repetitions=N] [--seed=N]\n"
+      "          [--streaming_copy_bytes=N|off] [--read_frames] [--working_set_kb=N] [--tsv]\n"
+      "  --filter       runs the cases whose name matches REGEX\n"
+      "  --min_time     times each repetition for at least SECONDS (default 0.2)\n"
+      "  --repetitions  reports the median of N repetitions (default 1)\n"
+      "  --seed         seeds the frame sizes, empty and errored packets (default 1)\n"
+      "  --streaming_copy_bytes\n"
+      "                 copies payloads of N bytes and more with non-temporal stores,\n"
+      "                 off for never (default libuvc's)\n"
+      "  --read_frames  reads every frame back in the callback\n"
+      "  --working_set_kb\n"
+      "                 reads N KB of other data in the callback per frame (default 0)\n"
+      "  --tsv          prints tab separated values\n",
+      program);
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    if (key == "--filter") {
+      options.filter = std::regex(value);
+    } else if (key == "--min_time") {
+      options.minTime = duration<double>(atof(value.c_str()));
+    } else if (key == "--repetitions") {
+      options.repetitions = std::max(1, atoi(value.c_str()));
+    } else if (key == "--seed") {
+      options.seed = strtoul(value.c_str(), nullptr, 10);
+    } else if (key == "--streaming_copy_bytes") {
+      options.streamingCopyBytes =
+          value == "off" ? UINT32_MAX : (uint32_t)strtoul(value.c_str(), nullptr, 10);
+    } else if (key == "--read_frames") {
+      options.readFrames = true;
+    } else if (key == "--working_set_kb") {
+      options.workingSetBytes = strtoul(value.c_str(), nullptr, 10) * 1024;
+    } else if (key == "--tsv") {
+      options.tsv = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options{};
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  if (options.tsv) {
+    printf("name\tpackets/s\tns/packet\tGB/s\tfps\n");
+  } else {
+    printf("%-48s %12s %10s %8s %10s\n", "Benchmark", "packets/s", "ns/packet", "GB/s", "fps");
+  }
+  int failures = 0;
+  for (const Scenario& scenario : scenarios()) {
+    if (!std::regex_search(scenario.name, options.filter)) {
+      continue;
+    }
+    Result r{};
+    if (!measure(scenario, options, r)) {
+      fprintf(stderr, "%s failed\n", scenario.name.c_str());
+      failures++;
+      continue;
+    }
+    if (options.tsv) {
+      printf(
+          "%s\t%.0f\t%.1f\t%.3f\t%.1f\n",
+          scenario.name.c_str(),
+          r.packetsPerSecond,
+          r.nsPerPacket,
+          r.gbps,
+          r.fps);
+    } else {
+      printf(
+          "%-48s %12.0f %10.1f %8.3f %10.1f\n",
+          scenario.name.c_str(),
+          r.packetsPerSecond,
+          r.nsPerPacket,
+          r.gbps,
+          r.fps);
+    }
+    fflush(stdout);
+  }
+  return failures == 0 ? 0 : 1;
+}
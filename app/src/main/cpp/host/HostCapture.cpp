@@ -0,0 +1,638 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Streams a UVC camera on a Linux host through the capture and convert core
+// of the app: the shared USB event thread, libuvc's borrowed frames handed
+// to a render thread through a SpscQueue, and FrameConverter writing each
+// frame into a window buffer. It exists to run perf, valgrind and the
+// sanitizers on those paths against a real camera.
+//
+// The window is plain memory; --output appends every converted buffer to a
+// file to check the pixels. Audio and the GPU and MediaCodec backends stay
+// on Android.
+//
+// --frame_log replays a log FrameLogRecorder wrote, looped at its recorded
+// pace, instead of a camera. --soak samples memory, descriptors and latency
+// every --sample_seconds and writes a SoakMonitor JSON report that flags what
+// grew or drifted, for runs of hours:
+//   usbvideo_host --frame_log=desk.uvcflog --seconds=0 --soak=soak.json
+
+#include <android/hardware_buffer.h>
+#include <android/log.h>
+#include <android/native_window.h>
+#include <libuvc/libuvc.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BufferAllocator.h"
+#include "FrameConverter.h"
+#include "FrameLogPlayer.h"
+#include "LatencyHistogram.h"
+#include "SoakMonitor.h"
+#include "SpscQueue.h"
+#include "StripeWorkerPool.h"
+#include "UvcDevice.h"
+
+#define ULOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "HostCapture", __VA_ARGS__)
+#define ULOGI(...) __android_log_print(ANDROID_LOG_INFO, "HostCapture", __VA_ARGS__)
+#define ULOGW(...) __android_log_print(ANDROID_LOG_WARN, "HostCapture", __VA_ARGS__)
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "HostCapture", __VA_ARGS__)
+
+using namespace std::chrono;
+
+namespace {
+
+struct NamedFormat {
+  const char* name;
+  int32_t format;
+};
+
+constexpr NamedFormat kFrameFormats[] = {
+    {"mjpeg", UVC_FRAME_FORMAT_MJPEG},
+    {"yuyv", UVC_FRAME_FORMAT_YUYV},
+    {"uyvy", UVC_FRAME_FORMAT_UYVY},
+    {"nv12", UVC_FRAME_FORMAT_NV12},
+    {"gray8", UVC_FRAME_FORMAT_GRAY8},
+    {"bgr", UVC_FRAME_FORMAT_BGR},
+    {"p010", UVC_FRAME_FORMAT_P010},
+};
+
+constexpr NamedFormat kWindowFormats[] = {
+    {"rgba8888", AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM},
+    {"rgbx8888", AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM},
+    {"rgb888", AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM},
+    {"rgb565", AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM},
+    {"yv12", FrameConverter::kYv12WindowFormat},
+};
+
+// Same threshold as UsbVideoStreamer for converting in stripes.
+constexpr int32_t kParallelConversionMinHeight = 1440;
+// Frame buffers besides the queued ones, as UsbVideoStreamer sizes its pool:
+// the one being filled, one in the callback and the one being converted.
+constexpr uint32_t kPoolFramesBesidesQueue = 3;
+
+struct Options {
+  std::string devicePath{};
+  int32_t frameFormat{UVC_FRAME_FORMAT_MJPEG};
+  int32_t width{1920};
+  int32_t height{1080};
+  int32_t fps{30};
+  int32_t windowFormat{AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM};
+  int32_t windowWidth{}; // zero for the frame size
+  int32_t windowHeight{};
+  uint32_t queueDepth{2};
+  int seconds{10};
+  bool parallel{false};
+  std::string outputPath{};
+  std::string frameLogPath{};
+  std::string soakPath{};
+  int sampleSeconds{60};
+};
+
+std::atomic<bool> interrupted{false};
+
+int64_t nowNs() {
+  return steady_clock::now().time_since_epoch().count();
+}
+
+// A window buffer in memory, with a stride rounded up like gralloc's.
+class HostWindow final {
+ public:
+  HostWindow(int32_t width, int32_t height, int32_t format, int outputFd)
+      : outputFd_(outputFd) {
+    int32_t stride = (width + 63) & ~63;
+    size_t size = (size_t)stride * height * bytesPerPixel(format);
+    if (format == FrameConverter::kYv12WindowFormat) {
+      size_t chromaStride = ((stride / 2) + 15) & ~15;
+      size = (size_t)stride * height + chromaStride * height;
+    }
+    bits_.resize(size);
+    buffer_.width = width;
+    buffer_.height = height;
+    buffer_.stride = stride;
+    buffer_.format = format;
+    buffer_.bits = bits_.data();
+  }
+
+  const ANativeWindow_Buffer& buffer() const {
+    return buffer_;
+  }
+
+  bool post() {
+    if (outputFd_ < 0) {
+      return true;
+    }
+    if (write(outputFd_, bits_.data(), bits_.size()) != (ssize_t)bits_.size()) {
+      ULOGE("Output write failed: %s", strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t> bits_{};
+  ANativeWindow_Buffer buffer_{};
+  int outputFd_;
+
+  static int32_t bytesPerPixel(int32_t format) {
+    switch (format) {
+      case AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM:
+        return 3;
+      case AHARDWAREBUFFER_FORMAT_R5G6B5_UNORM:
+        return 2;
+      case FrameConverter::kYv12WindowFormat:
+        return 1;
+      default:
+        return 4;
+    }
+  }
+};
+
+class HostPipeline final {
+ public:
+  explicit HostPipeline(const Options& options)
+      : options_(options), frameQueue_(options.queueDepth) {}
+  HostPipeline(const HostPipeline&) = delete;
+  HostPipeline& operator=(const HostPipeline&) = delete;
+  ~HostPipeline() {
+    stop();
+    // The player closes its own stream.
+    if (streamHandle_ != nullptr && player_ == nullptr) {
+      uvc_stream_close(streamHandle_);
+      device_->removeStream();
+    }
+    if (outputFd_ >= 0) {
+      close(outputFd_);
+    }
+  }
+
+  bool open(int deviceFd) {
+    device_ = UvcDevice::open(deviceFd);
+    if (device_ == nullptr) {
+      return false;
+    }
+    uvc_stream_ctrl_t ctrl;
+    auto frameFormat = (uvc_frame_format)options_.frameFormat;
+    uvc_error_t res = uvc_get_stream_ctrl_format_size(
+        device_->handle(), &ctrl, frameFormat, options_.width, options_.height, options_.fps);
+    if (res != UVC_SUCCESS) {
+      ULOGE(
+          "No %dx%d@%dfps mode in format %d: %s",
+          options_.width,
+          options_.height,
+          options_.fps,
+          frameFormat,
+          uvc_strerror(res));
+      return false;
+    }
+    res = uvc_stream_open_ctrl(device_->handle(), &streamHandle_, &ctrl);
+    if (res != UVC_SUCCESS) {
+      ULOGE("uvc_stream_open_ctrl failed %s", uvc_strerror(res));
+      streamHandle_ = nullptr;
+      return false;
+    }
+    device_->addStream();
+    if (!configure(options_.width, options_.height)) {
+      return false;
+    }
+    converter_.setColorimetry(
+        Colorimetry::of(uvc_get_stream_format_desc(streamHandle_), frameFormat));
+    frameInterval_ = ctrl.dwFrameInterval;
+    return true;
+  }
+
+  // Replays the frame log at fd instead of a camera, with the log's mode.
+  bool openPlayback(int fd) {
+    player_ = std::make_unique<FrameLogPlayer>();
+    if (!player_->open(fd, frameQueue_.capacity() + kPoolFramesBesidesQueue)) {
+      return false;
+    }
+    const FrameLogHeader& header = player_->header();
+    streamHandle_ = player_->streamHandle();
+    options_.frameFormat = (int32_t)header.frameFormat;
+    frameInterval_ = header.frameInterval;
+    return configure((int32_t)header.width, (int32_t)header.height);
+  }
+
+  // The converter, worker pool, output file and window for frames of this size.
+  bool configure(int32_t width, int32_t height) {
+    options_.width = width;
+    options_.height = height;
+    if (!converter_.configure((uvc_frame_format)options_.frameFormat, options_.windowFormat)) {
+      return false;
+    }
+    converter_.setCpuScaling(true);
+    if (options_.parallel || options_.height >= kParallelConversionMinHeight) {
+      workerPool_ = StripeWorkerPool::shared();
+      converter_.setWorkerPool(
+          workerPool_.get(), options_.parallel ? 0 : kParallelConversionMinHeight);
+    }
+    if (!options_.outputPath.empty()) {
+      outputFd_ = ::open(options_.outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (outputFd_ < 0) {
+        ULOGE("Cannot open %s: %s", options_.outputPath.c_str(), strerror(errno));
+        return false;
+      }
+    }
+    window_ = std::make_unique<HostWindow>(
+        options_.windowWidth != 0 ? options_.windowWidth : options_.width,
+        options_.windowHeight != 0 ? options_.windowHeight : options_.height,
+        options_.windowFormat,
+        outputFd_);
+    return true;
+  }
+
+  bool start() {
+    rendering_ = true;
+    renderThread_ = std::thread(&HostPipeline::renderLoop, this);
+    if (player_ != nullptr) {
+      FrameLogPlayer::Options playback{};
+      playback.loops = 0;
+      if (!player_->start(&HostPipeline::playbackFrameCallback, this, playback)) {
+        ULOGE("Frame log playback failed to start");
+        stop();
+        return false;
+      }
+      streaming_ = true;
+      logStart();
+      return true;
+    }
+    uvc_stream_options_t options{};
+    options.frame_pool_size = frameQueue_.capacity() + kPoolFramesBesidesQueue;
+    uvc_error_t res;
+    {
+      std::lock_guard lk(device_->startMutex());
+      res = uvc_stream_start_with_options(
+          streamHandle_,
+          &HostPipeline::captureFrameCallback,
+          this,
+          UVC_STREAM_FLAG_BORROWED_FRAMES | UVC_STREAM_FLAG_INLINE_CALLBACK,
+          &options);
+    }
+    if (res != UVC_SUCCESS) {
+      ULOGE("uvc_stream_start failed %s", uvc_strerror(res));
+      stop();
+      return false;
+    }
+    streaming_ = true;
+    logStart();
+    return true;
+  }
+
+  void logStart() const {
+    ULOGI(
+        "Streaming format %d %dx%d at %.2f fps into window format %d %dx%d",
+        options_.frameFormat,
+        options_.width,
+        options_.height,
+        frameInterval_ != 0 ? 1e7 / frameInterval_ : 0.0,
+        options_.windowFormat,
+        window_->buffer().width,
+        window_->buffer().height);
+  }
+
+  void stop() {
+    if (streaming_.exchange(false)) {
+      if (player_ != nullptr) {
+        player_->stop();
+      } else {
+        uvc_stream_stop(streamHandle_);
+      }
+    }
+    if (rendering_.exchange(false)) {
+      {
+        std::unique_lock lk(frameQueueMutex_);
+        frameQueueChange_.notify_all();
+      }
+      renderThread_.join();
+    }
+    uvc_frame_t* frame;
+    int64_t enqueueTime;
+    while (frameQueue_.tryPop(frame, enqueueTime)) {
+      uvc_release_frame(frame);
+    }
+  }
+
+  // Called once a second from the main thread.
+  void report() {
+    uint64_t rendered = rendered_.load(std::memory_order_relaxed);
+    ULOGI(
+        "%llu frames rendered, %llu dropped, convert p50 %lld us p99 %lld us, "
+        "USB to render p50 %lld us p99 %lld us",
+        (unsigned long long)(rendered - lastRendered_),
+        (unsigned long long)dropped_.exchange(0, std::memory_order_relaxed),
+        (long long)convertTimes_.percentile(0.5).count(),
+        (long long)convertTimes_.percentile(0.99).count(),
+        (long long)usbToRenderTimes_.percentile(0.5).count(),
+        (long long)usbToRenderTimes_.percentile(0.99).count());
+    lastRendered_ = rendered;
+  }
+
+  // The process levels, and the latency and frames since the last sample.
+  // From the main thread.
+  SoakMonitor::Sample soakSample(int64_t elapsedMs) {
+    SoakMonitor::Sample sample = SoakMonitor::sampleProcess(elapsedMs);
+    std::vector<int64_t> latencies;
+    {
+      std::lock_guard lk(soakMutex_);
+      latencies.swap(soakLatenciesUs_);
+    }
+    if (!latencies.empty()) {
+      auto at = [&](double fraction) {
+        auto nth = latencies.begin() + (ptrdiff_t)(fraction * (latencies.size() - 1));
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        return *nth;
+      };
+      sample.latencyP50Us = at(0.5);
+      sample.latencyP99Us = at(0.99);
+    }
+    uint64_t rendered = rendered_.load(std::memory_order_relaxed);
+    uint64_t dropped = totalDropped_.load(std::memory_order_relaxed);
+    sample.frames = rendered - soakRendered_;
+    sample.drops = dropped - soakDropped_;
+    soakRendered_ = rendered;
+    soakDropped_ = dropped;
+    return sample;
+  }
+
+  std::string describe() const {
+    char description[160];
+    snprintf(
+        description,
+        sizeof(description),
+        "%s format %d %dx%d at %.2f fps into window format %d %dx%d",
+        player_ != nullptr ? options_.frameLogPath.c_str() : options_.devicePath.c_str(),
+        options_.frameFormat,
+        options_.width,
+        options_.height,
+        frameInterval_ != 0 ? 1e7 / frameInterval_ : 0.0,
+        options_.windowFormat,
+        window_->buffer().width,
+        window_->buffer().height);
+    return description;
+  }
+
+ private:
+  Options options_;
+  std::shared_ptr<UvcDevice> device_{};
+  std::unique_ptr<FrameLogPlayer> player_{};
+  uvc_stream_handle_t* streamHandle_{};
+  uint32_t frameInterval_{};
+  FrameConverter converter_{};
+  std::shared_ptr<StripeWorkerPool> workerPool_{};
+  std::unique_ptr<HostWindow> window_{};
+  int outputFd_{-1};
+
+  SpscQueue<uvc_frame_t*> frameQueue_;
+  std::mutex frameQueueMutex_;
+  std::condition_variable frameQueueChange_;
+  std::thread renderThread_{};
+  std::atomic<bool> rendering_{false};
+  std::atomic<bool> streaming_{false};
+
+  std::atomic<uint64_t> rendered_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> totalDropped_{0};
+  uint64_t lastRendered_{};
+  // USB completion to post of the frames since the last soak sample.
+  std::mutex soakMutex_;
+  std::vector<int64_t> soakLatenciesUs_{};
+  uint64_t soakRendered_{};
+  uint64_t soakDropped_{};
+  // Since the start, written by the render thread.
+  LatencyHistogram convertTimes_{};
+  LatencyHistogram usbToRenderTimes_{};
+
+  void countDrop() {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    totalDropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // On the playback thread, which hands over its reference to the frame.
+  static void playbackFrameCallback(uvc_frame_t* frame, void* userData) {
+    captureFrameCallback(frame, userData);
+    uvc_release_frame(frame);
+  }
+
+  // On the USB event thread: only queues the frame, as UsbVideoStreamer does
+  // with an inline callback.
+  static void captureFrameCallback(uvc_frame_t* frame, void* userData) {
+    auto* pipeline = static_cast<HostPipeline*>(userData);
+    uvc_retain_frame(frame);
+    if (!pipeline->frameQueue_.tryPush(frame, nowNs())) {
+      // Newest first: the oldest queued frame makes room.
+      uvc_frame_t* oldest;
+      int64_t enqueueTime;
+      if (pipeline->frameQueue_.tryPop(oldest, enqueueTime)) {
+        uvc_release_frame(oldest);
+        pipeline->countDrop();
+      }
+      if (!pipeline->frameQueue_.tryPush(frame, nowNs())) {
+        uvc_release_frame(frame);
+        pipeline->countDrop();
+        return;
+      }
+    }
+    std::unique_lock lk(pipeline->frameQueueMutex_);
+    pipeline->frameQueueChange_.notify_all();
+  }
+
+  void renderLoop() {
+    prctl(PR_SET_NAME, "usb_video_render");
+    while (rendering_) {
+      uvc_frame_t* frame;
+      int64_t enqueueTime;
+      if (!frameQueue_.tryPop(frame, enqueueTime)) {
+        std::unique_lock lk(frameQueueMutex_);
+        frameQueueChange_.wait_for(
+            lk, 10ms, [this] { return !frameQueue_.empty() || !rendering_; });
+        continue;
+      }
+      renderFrame(frame);
+      uvc_release_frame(frame);
+    }
+  }
+
+  void renderFrame(const uvc_frame_t* frame) {
+    int64_t usbCompleteNs = frame->capture_time_finished.tv_sec * 1'000'000'000LL +
+        frame->capture_time_finished.tv_nsec;
+    int64_t startNs = nowNs();
+    if (!converter_.convert(frame, window_->buffer())) {
+      ULOGW("Frame %u failed to convert", frame->sequence);
+      countDrop();
+      return;
+    }
+    int64_t convertedNs = nowNs();
+    window_->post();
+    convertTimes_.record(nanoseconds(convertedNs - startNs));
+    if (usbCompleteNs != 0) {
+      usbToRenderTimes_.record(nanoseconds(startNs - usbCompleteNs));
+      if (!options_.soakPath.empty()) {
+        int64_t postedNs = nowNs();
+        std::lock_guard lk(soakMutex_);
+        soakLatenciesUs_.push_back((postedNs - usbCompleteNs) / 1000);
+      }
+    }
+    rendered_.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+bool parseFormat(const std::string& name, const auto& formats, int32_t& format) {
+  for (const NamedFormat& named : formats) {
+    if (name == named.name) {
+      format = named.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parseSize(const std::string& value, int32_t& width, int32_t& height) {
+  return sscanf(value.c_str(), "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      options.devicePath = arg;
+      continue;
+    }
+    size_t equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    bool valid = true;
+    if (key == "--format") {
+      valid = parseFormat(value, kFrameFormats, options.frameFormat);
+    } else if (key == "--size") {
+      valid = parseSize(value, options.width, options.height);
+    } else if (key == "--fps") {
+      options.fps = atoi(value.c_str());
+    } else if (key == "--window") {
+      valid = parseFormat(value, kWindowFormats, options.windowFormat);
+    } else if (key == "--window_size") {
+      valid = parseSize(value, options.windowWidth, options.windowHeight);
+    } else if (key == "--queue") {
+      options.queueDepth = std::max(1, atoi(value.c_str()));
+    } else if (key == "--seconds") {
+      options.seconds = atoi(value.c_str());
+    } else if (key == "--parallel") {
+      options.parallel = true;
+    } else if (key == "--output") {
+      options.outputPath = value;
+    } else if (key == "--frame_log" && !value.empty()) {
+      options.frameLogPath = value;
+    } else if (key == "--soak" && !value.empty()) {
+      options.soakPath = value;
+    } else if (key == "--sample_seconds") {
+      options.sampleSeconds = std::max(1, atoi(value.c_str()));
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      fprintf(stderr, "Bad option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return options.devicePath.empty() != options.frameLogPath.empty();
+}
+
+void printUsage(const char* program) {
+  fprintf(
+      stderr,
+      "Usage: %s /dev/bus/usb/BUS/DEVICE|--frame_log=FILE [options]\n"
+      "  --format=mjpeg|yuyv|uyvy|nv12|gray8|bgr|p010  camera format (mjpeg)\n"
+      "  --size=WxH, --fps=N         camera mode (1920x1080, 30)\n"
+      "  --window=rgba8888|rgbx8888|rgb888|rgb565|yv12  window format (rgba8888)\n"
+      "  --window_size=WxH           window size, scaled on the CPU (the mode's)\n"
+      "  --queue=N                   frames queued for the render thread (2)\n"
+      "  --seconds=N                 streaming time, 0 until interrupted (10)\n"
+      "  --parallel                  converts every frame in stripes on the worker pool\n"
+      "  --output=FILE               appends every converted window buffer to FILE\n"
+      "  --frame_log=FILE            replays a frame log in a loop instead of a camera\n"
+      "  --soak=FILE                 writes a JSON report of memory, fd and latency trends\n"
+      "  --sample_seconds=N          soak sampling interval (60)\n"
+      "The device node must be writable; lsusb shows its bus and device numbers.\n",
+      program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options{};
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  bool replaying = !options.frameLogPath.empty();
+  const std::string& path = replaying ? options.frameLogPath : options.devicePath;
+  int fd = open(path.c_str(), (replaying ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+  if (fd < 0) {
+    ULOGE("Cannot open %s: %s", path.c_str(), strerror(errno));
+    return 1;
+  }
+  signal(SIGINT, [](int) { interrupted = true; });
+  BufferAllocator::installForLibuvc();
+
+  bool streamed = false;
+  {
+    HostPipeline pipeline(options);
+    // The device keeps a duplicate of the fd, the player its mapping.
+    bool opened = replaying ? pipeline.openPlayback(fd) : pipeline.open(fd);
+    close(fd);
+    if (opened && pipeline.start()) {
+      streamed = true;
+      SoakMonitor soak;
+      for (int elapsed = 0; !interrupted && (options.seconds == 0 || elapsed < options.seconds);
+           elapsed++) {
+        std::this_thread::sleep_for(1s);
+        pipeline.report();
+        if (!options.soakPath.empty() && (elapsed + 1) % options.sampleSeconds == 0) {
+          soak.add(pipeline.soakSample((int64_t)(elapsed + 1) * 1000));
+        }
+      }
+      pipeline.stop();
+      if (!options.soakPath.empty()) {
+        std::vector<SoakMonitor::Finding> findings = soak.findings();
+        for (const SoakMonitor::Finding& finding : findings) {
+          ULOGW(
+              "Soak %s of %s: %.1f to %.1f, %.1f per hour",
+              finding.kind.c_str(),
+              finding.metric.c_str(),
+              finding.first,
+              finding.last,
+              finding.slopePerHour);
+        }
+        streamed = soak.writeJson(options.soakPath, pipeline.describe()) && findings.empty();
+      }
+    }
+  }
+  return streamed ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <android/log.h>
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+int minimumPriority() {
+  static const int priority = [] {
+    const char* level = getenv("USB_VIDEO_LOG_LEVEL");
+    switch (level != nullptr ? level[0] : 'I') {
+      case 'V':
+        return ANDROID_LOG_VERBOSE;
+      case 'D':
+        return ANDROID_LOG_DEBUG;
+      case 'W':
+        return ANDROID_LOG_WARN;
+      case 'E':
+        return ANDROID_LOG_ERROR;
+      default:
+        return ANDROID_LOG_INFO;
+    }
+  }();
+  return priority;
+}
+
+char priorityLetter(int prio) {
+  static constexpr char kLetters[] = "??VDIWEFS";
+  return prio >= 0 && prio <= ANDROID_LOG_SILENT ? kLetters[prio] : '?';
+}
+
+} // namespace
+
+int __android_log_write(int prio, const char* tag, const char* text) {
+  return __android_log_print(prio, tag, "%s", text);
+}
+
+int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int result = __android_log_vprint(prio, tag, fmt, ap);
+  va_end(ap);
+  return result;
+}
+
+int __android_log_vprint(int prio, const char* tag, const char* fmt, va_list ap) {
+  if (prio < minimumPriority()) {
+    return 0;
+  }
+  // One write per message, so lines of concurrent threads do not interleave.
+  char line[1024];
+  int prefix = snprintf(line, sizeof(line), "%c/%s: ", priorityLetter(prio), tag);
+  int length = prefix + vsnprintf(line + prefix, sizeof(line) - prefix - 1, fmt, ap);
+  length = std::min<int>(length, sizeof(line) - 2);
+  if (length > 0 && line[length - 1] == '\n') {
+    length--;
+  }
+  line[length++] = '\n';
+  return (int)write(STDERR_FILENO, line, length);
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Checks JpegEntropyDecoder against libjpeg's own coefficient read, on
+// frames libjpeg encodes the way UVC cameras do. Run by ctest:
+//   ctest --test-dir build-host --output-on-failure
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "JpegEntropyDecoder.h"
+
+namespace {
+
+struct Frame {
+  int32_t width;
+  int32_t height;
+  // 1 for grayscale, else YCbCr with these luma samples per chroma sample.
+  int32_t components;
+  int32_t horizontalSampling;
+  int32_t verticalSampling;
+  // MCUs between restart markers, 0 for none.
+  int32_t restartInterval;
+  // Optimized Huffman tables instead of the Annex K ones.
+  bool optimized;
+};
+
+std::vector<uint8_t> encode(const Frame& frame) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_compress(&cinfo);
+  unsigned char* out = nullptr;
+  unsigned long outSize = 0;
+  jpeg_mem_dest(&cinfo, &out, &outSize);
+  cinfo.image_width = frame.width;
+  cinfo.image_height = frame.height;
+  cinfo.input_components = frame.components;
+  cinfo.in_color_space = frame.components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 85, TRUE);
+  if (frame.components == 3) {
+    cinfo.comp_info[0].h_samp_factor = frame.horizontalSampling;
+    cinfo.comp_info[0].v_samp_factor = frame.verticalSampling;
+  }
+  cinfo.restart_interval = frame.restartInterval;
+  cinfo.optimize_coding = frame.optimized;
+  jpeg_start_compress(&cinfo, TRUE);
+  std::vector<uint8_t> row(frame.width * frame.components);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    int32_t y = cinfo.next_scanline;
+    for (int32_t x = 0; x < frame.width * frame.components; x++) {
+      row[x] = (uint8_t)(x * 7 + y * 3 + (x * y) % 37 * 5);
+    }
+    JSAMPROW rows = row.data();
+    jpeg_write_scanlines(&cinfo, &rows, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  std::vector<uint8_t> jpeg(out, out + outSize);
+  free(out);
+  jpeg_destroy_compress(&cinfo);
+  return jpeg;
+}
+
+// Number of coefficients and quantizer steps that differ from libjpeg's.
+int32_t mismatches(const JpegEntropyDecoder& decoder, const std::vector<uint8_t>& jpeg) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr error;
+  cinfo.err = jpeg_std_error(&error);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+  jpeg_read_header(&cinfo, TRUE);
+  jvirt_barray_ptr* coefficients = jpeg_read_coefficients(&cinfo);
+  int32_t count = 0;
+  for (int32_t mcuY = 0; mcuY < decoder.mcusHigh(); mcuY++) {
+    for (int32_t mcuX = 0; mcuX < decoder.mcusWide(); mcuX++) {
+      const int16_t* mcu = decoder.coefficients() +
+          ((size_t)mcuY * decoder.mcusWide() + mcuX) * decoder.blocksPerMcu() * 64;
+      for (int32_t c = 0; c < decoder.componentCount(); c++) {
+        int32_t blocksWide = c == 0 ? decoder.lumaBlocksWide() : 1;
+        int32_t blocksHigh = c == 0 ? decoder.lumaBlocksHigh() : 1;
+        const jpeg_component_info& component = cinfo.comp_info[c];
+        for (int32_t by = 0; by < blocksHigh; by++) {
+          int32_t row = mcuY * blocksHigh + by;
+          JBLOCKARRAY rows = cinfo.mem->access_virt_barray(
+              (j_common_ptr)&cinfo, coefficients[c], row, 1, FALSE);
+          for (int32_t bx = 0; bx < blocksWide; bx++, mcu += 64) {
+            int32_t column = mcuX * blocksWide + bx;
+            // Blocks padding the frame out to whole MCUs are not stored.
+            if (row >= (int32_t)component.height_in_blocks ||
+                column >= (int32_t)component.width_in_blocks) {
+              continue;
+            }
+            for (int32_t k = 0; k < 64; k++) {
+              count += rows[0][column][k] != mcu[k];
+            }
+          }
+        }
+      }
+    }
+  }
+  for (int32_t c = 0; c < decoder.componentCount(); c++) {
+    for (int32_t k = 0; k < 64; k++) {
+      count += cinfo.comp_info[c].quant_table->quantval[k] != decoder.quantTables()[c * 64 + k];
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return count;
+}
+
+bool decodes(JpegEntropyDecoder& decoder, const Frame& frame, const char* name) {
+  std::vector<uint8_t> jpeg = encode(frame);
+  if (!decoder.decode(jpeg.data(), jpeg.size(), frame.width, frame.height)) {
+    fprintf(stderr, "%s: not decoded\n", name);
+    return false;
+  }
+  int32_t count = mismatches(decoder, jpeg);
+  if (count != 0) {
+    fprintf(stderr, "%s: %d coefficients differ from libjpeg's\n", name, count);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  int32_t failures = 0;
+  JpegEntropyDecoder decoder;
+  failures += !decodes(decoder, {640, 480, 3, 2, 1, 0, false}, "4:2:2");
+  failures += !decodes(decoder, {641, 479, 3, 2, 2, 0, true}, "odd sized optimized 4:2:0");
+  failures += !decodes(decoder, {333, 217, 3, 1, 1, 0, false}, "4:4:4");
+  failures += !decodes(decoder, {203, 101, 1, 1, 1, 0, false}, "grayscale");
+  // The restart interval of one frame must not carry over to the next.
+  failures += !decodes(decoder, {1280, 720, 3, 2, 1, 17, false}, "4:2:2 with restarts");
+  failures += !decodes(decoder, {1280, 720, 3, 2, 1, 0, false}, "4:2:2 after restarts");
+
+  // Neither a frame of another size nor a corrupt frame header may get past
+  // the header.
+  std::vector<uint8_t> jpeg = encode({640, 480, 3, 2, 1, 0, false});
+  if (decoder.decode(jpeg.data(), jpeg.size(), 640, 360)) {
+    fprintf(stderr, "640x480 frame taken for 640x360\n");
+    failures++;
+  }
+  for (size_t i = 0; i + 8 < jpeg.size(); i++) {
+    if (jpeg[i] == 0xFF && jpeg[i + 1] == 0xC0) {
+      // SOF0 height and width, after its length and sample precision.
+      jpeg[i + 5] = jpeg[i + 7] = 0xFF;
+      break;
+    }
+  }
+  if (decoder.decode(jpeg.data(), jpeg.size(), 640, 480)) {
+    fprintf(stderr, "Frame with a corrupt size decoded\n");
+    failures++;
+  }
+  if (failures != 0) {
+    fprintf(stderr, "%d JpegEntropyDecoder checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SoakMonitor.h"
+
+#include <android/log.h>
+
+#include <dirent.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#define ULOGE(...) __android_log_print(ANDROID_LOG_ERROR, "SoakMonitor", __VA_ARGS__)
+
+namespace {
+
+// Judged samples needed before anything is flagged.
+constexpr size_t kMinJudgedSamples = 5;
+// Share of the steps between judged samples that must not go down for a
+// level to count as growing.
+constexpr double kMonotonicSteps = 0.8;
+
+struct Metric {
+  const char* name;
+  bool drift; // compared by thirds rather than required to grow
+  double threshold; // smallest change flagged, in the metric's unit
+  double (*value)(const SoakMonitor::Sample&);
+};
+
+double level(int64_t value) {
+  return value == SoakMonitor::kNone ? NAN : (double)value;
+}
+
+const Metric kMetrics[] = {
+    {"rssBytes", false, 4 << 20, [](const SoakMonitor::Sample& s) { return (double)s.rssBytes; }},
+    {"pssBytes",
+     false,
+     4 << 20,
+     [](const SoakMonitor::Sample& s) { return s.pssBytes != 0 ? (double)s.pssBytes : NAN; }},
+    {"nativeHeapBytes",
+     false,
+     1 << 20,
+     [](const SoakMonitor::Sample& s) { return (double)s.nativeHeapBytes; }},
+    {"openFds", false, 2, [](const SoakMonitor::Sample& s) { return (double)s.openFds; }},
+    {"latencyP50Us",
+     true,
+     1000,
+     [](const SoakMonitor::Sample& s) { return level(s.latencyP50Us); }},
+    {"latencyP99Us",
+     true,
+     2000,
+     [](const SoakMonitor::Sample& s) { return level(s.latencyP99Us); }},
+    {"avSkewUs", true, 5000, [](const SoakMonitor::Sample& s) { return level(s.avSkewUs); }},
+};
+
+uint64_t statusKiB(FILE* file, const char* key) {
+  char line[256];
+  size_t keyLength = strlen(key);
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    if (strncmp(line, key, keyLength) == 0) {
+      return strtoull(line + keyLength, nullptr, 10);
+    }
+  }
+  return 0;
+}
+
+uint64_t procKiB(const char* path, const char* key) {
+  FILE* file = fopen(path, "re");
+  if (file == nullptr) {
+    return 0;
+  }
+  uint64_t kiB = statusKiB(file, key);
+  fclose(file);
+  return kiB;
+}
+
+uint32_t countOpenFds() {
+  DIR* dir = opendir("/proc/self/fd");
+  if (dir == nullptr) {
+    return 0;
+  }
+  uint32_t count = 0;
+  while (dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      count++;
+    }
+  }
+  closedir(dir);
+  // Less the one opendir() holds.
+  return count > 0 ? count - 1 : 0;
+}
+
+uint64_t nativeHeapBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return mallinfo2().uordblks;
+#else
+  return mallinfo().uordblks;
+#endif
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 != 0 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Least squares, per hour of elapsed time.
+double slopePerHour(const std::vector<double>& hours, const std::vector<double>& values) {
+  size_t n = values.size();
+  double meanX = 0;
+  double meanY = 0;
+  for (size_t i = 0; i < n; i++) {
+    meanX += hours[i] / n;
+    meanY += values[i] / n;
+  }
+  double covariance = 0;
+  double variance = 0;
+  for (size_t i = 0; i < n; i++) {
+    covariance += (hours[i] - meanX) * (values[i] - meanY);
+    variance += (hours[i] - meanX) * (hours[i] - meanX);
+  }
+  return variance > 0 ? covariance / variance : 0;
+}
+
+void writeString(FILE* file, const std::string& value) {
+  fputc('"', file);
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+    }
+    fputc((unsigned char)c < 0x20 ? ' ' : c, file);
+  }
+  fputc('"', file);
+}
+
+void writeLevel(FILE* file, const char* key, int64_t value) {
+  if (value == SoakMonitor::kNone) {
+    fprintf(file, ", \"%s\": null", key);
+  } else {
+    fprintf(file, ", \"%s\": %" PRId64, key, value);
+  }
+}
+
+} // namespace
+
+SoakMonitor::Sample SoakMonitor::sampleProcess(int64_t elapsedMs) {
+  Sample sample;
+  sample.elapsedMs = elapsedMs;
+  sample.rssBytes = procKiB("/proc/self/status", "VmRSS:") * 1024;
+  sample.pssBytes = procKiB("/proc/self/smaps_rollup", "Pss:") * 1024;
+  sample.nativeHeapBytes = nativeHeapBytes();
+  sample.openFds = countOpenFds();
+  return sample;
+}
+
+void SoakMonitor::add(const Sample& sample) {
+  samples_.push_back(sample);
+}
+
+std::vector<SoakMonitor::Finding> SoakMonitor::findings() const {
+  std::vector<Finding> findings;
+  if (samples_.empty()) {
+    return findings;
+  }
+  int64_t warmupMs = (int64_t)(samples_.back().elapsedMs * kWarmupFraction);
+  for (const Metric& metric : kMetrics) {
+    std::vector<double> hours;
+    std::vector<double> values;
+    for (const Sample& sample : samples_) {
+      double value = metric.value(sample);
+      if (sample.elapsedMs >= warmupMs && !std::isnan(value)) {
+        hours.push_back(sample.elapsedMs / 3.6e6);
+        values.push_back(value);
+      }
+    }
+    if (values.size() < kMinJudgedSamples) {
+      continue;
+    }
+    double slope = slopePerHour(hours, values);
+    if (metric.drift) {
+      size_t third = values.size() / 3;
+      double first = median({values.begin(), values.begin() + third});
+      double last = median({values.end() - third, values.end()});
+      if (std::abs(last - first) >= metric.threshold && (last - first) * slope > 0) {
+        findings.push_back({metric.name, "drift", first, last, slope});
+      }
+      continue;
+    }
+    size_t rising = 0;
+    for (size_t i = 1; i < values.size(); i++) {
+      rising += values[i] >= values[i - 1];
+    }
+    double first = values.front();
+    double last = values.back();
+    if (last - first >= metric.threshold && slope > 0 &&
+        rising >= kMonotonicSteps * (values.size() - 1)) {
+      findings.push_back({metric.name, "growth", first, last, slope});
+    }
+  }
+  return findings;
+}
+
+bool SoakMonitor::writeJson(const std::string& path, const std::string& description) const {
+  FILE* file = fopen(path.c_str(), "we");
+  if (file == nullptr) {
+    ULOGE("Cannot open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  std::vector<Finding> found = findings();
+  fprintf(file, "{\n  \"run\": ");
+  writeString(file, description);
+  fprintf(file, ",\n  \"passed\": %s,\n  \"findings\": [", found.empty() ? "true" : "false");
+  for (size_t i = 0; i < found.size(); i++) {
+    const Finding& finding = found[i];
+    fprintf(
+        file,
+        "%s\n    {\"metric\": \"%s\", \"kind\": \"%s\", \"first\": %.1f, \"last\": %.1f, "
+        "\"slopePerHour\": %.1f}",
+        i == 0 ? "" : ",",
+        finding.metric.c_str(),
+        finding.kind.c_str(),
+        finding.first,
+        finding.last,
+        finding.slopePerHour);
+  }
+  fprintf(file, "%s],\n  \"samples\": [", found.empty() ? "" : "\n  ");
+  for (size_t i = 0; i < samples_.size(); i++) {
+    const Sample& sample = samples_[i];
+    fprintf(
+        file,
+        "%s\n    {\"elapsedMs\": %" PRId64 ", \"rssBytes\": %" PRIu64 ", \"pssBytes\": %" PRIu64
+        ", \"nativeHeapBytes\": %" PRIu64 ", \"openFds\": %" PRIu32,
+        i == 0 ? "" : ",",
+        sample.elapsedMs,
+        sample.rssBytes,
+        sample.pssBytes,
+        sample.nativeHeapBytes,
+        sample.openFds);
+    writeLevel(file, "latencyP50Us", sample.latencyP50Us);
+    writeLevel(file, "latencyP99Us", sample.latencyP99Us);
+    writeLevel(file, "avSkewUs", sample.avSkewUs);
+    fprintf(
+        file,
+        ", \"frames\": %" PRIu64 ", \"drops\": %" PRIu64 "}",
+        sample.frames,
+        sample.drops);
+  }
+  fprintf(file, "%s]\n}\n", samples_.empty() ? "" : "\n  ");
+  bool written = ferror(file) == 0;
+  if (fclose(file) != 0 || !written) {
+    ULOGE("Writing %s failed", path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Samples a long streaming run once an interval and flags what keeps
+// growing or drifting over it, for soak runs of hours: leaked memory or
+// descriptors, buffers that libuvc keeps reallocating larger, and latency
+// that creeps up as counters wrap or rings slip.
+//
+// The process levels come from /proc and the allocator; the caller adds
+// the latency percentiles and frame counts of the interval. Samples taken
+// in the first kWarmupFraction of the run are reported but not judged, as
+// pools and caches fill then.
+class SoakMonitor final {
+ public:
+  static constexpr int64_t kNone = INT64_MIN;
+
+  struct Sample {
+    int64_t elapsedMs{};
+    uint64_t rssBytes{};
+    uint64_t pssBytes{}; // 0 without /proc/self/smaps_rollup
+    uint64_t nativeHeapBytes{};
+    uint32_t openFds{};
+    // Of the frames of the interval, kNone without any.
+    int64_t latencyP50Us{kNone};
+    int64_t latencyP99Us{kNone};
+    // Audio ahead of video, kNone when the run has no audio.
+    int64_t avSkewUs{kNone};
+    uint64_t frames{};
+    uint64_t drops{};
+  };
+
+  struct Finding {
+    std::string metric;
+    // "growth" for levels that only go up, "drift" for latencies.
+    std::string kind;
+    double first;
+    double last;
+    double slopePerHour;
+  };
+
+  static constexpr double kWarmupFraction = 0.1;
+
+  // The process levels now; the caller fills in the rest.
+  static Sample sampleProcess(int64_t elapsedMs);
+
+  void add(const Sample& sample);
+  const std::vector<Sample>& samples() const {
+    return samples_;
+  }
+  std::vector<Finding> findings() const;
+
+  // The samples and findings as JSON, with description as its "run".
+  bool writeJson(const std::string& path, const std::string& description) const;
+
+ private:
+  std::vector<Sample> samples_{};
+};
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Prints the records of a TelemetryLog file as CSV, oldest first:
+//   adb exec-out run-as com.meta.usbvideo cat files/telemetry.uvtl > telemetry.uvtl
+//   build-host/host/usbvideo_telemetry telemetry.uvtl > telemetry.csv
+// The file may be copied while the app writes it; the record being written
+// then is the only one that can be torn.
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "TelemetryLog.h"
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <telemetry file>\n", argv[0]);
+    return 2;
+  }
+  FILE* file = fopen(argv[1], "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+  TelemetryFileHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != kTelemetryMagic) {
+    fprintf(stderr, "%s is not a telemetry file\n", argv[1]);
+    fclose(file);
+    return 1;
+  }
+  if (header.version != kTelemetryVersion || header.recordSize != sizeof(TelemetryRecord)) {
+    fprintf(stderr,
+            "%s has version %" PRIu32 " with %" PRIu32 " byte records, expected %" PRIu32
+            " with %zu\n",
+            argv[1],
+            header.version,
+            header.recordSize,
+            kTelemetryVersion,
+            sizeof(TelemetryRecord));
+    fclose(file);
+    return 1;
+  }
+  std::vector<TelemetryRecord> records(header.capacity);
+  size_t read = fread(records.data(), sizeof(TelemetryRecord), records.size(), file);
+  fclose(file);
+
+  uint64_t written = header.written.load(std::memory_order_relaxed);
+  uint64_t count = std::min<uint64_t>({written, header.capacity, read});
+  printf("wall_ms,fps,latency_p50_us,latency_p95_us,latency_p99_us,drops,video_usb_errors,"
+         "audio_usb_errors,xruns,underruns,sampling_frequency,av_skew_us,usb_cpu,capture_cpu,"
+         "render_cpu,convert_cpu,native_heap_kib,thermal,video,audio,fast_paths,cohort\n");
+  for (uint64_t i = written - count; i < written; i++) {
+    const TelemetryRecord& r = records[i % header.capacity];
+    printf("%" PRIu64 ",%.1f,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32
+           ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRId32 ",%.3f,%.3f,%.3f,%.3f"
+           ",%" PRIu32 ",%d,%d,%d,0x%" PRIx32 ",%" PRIu32 "\n",
+           r.wallTimeMs,
+           r.videoFpsDeci / 10.0,
+           r.totalLatencyUs[0],
+           r.totalLatencyUs[1],
+           r.totalLatencyUs[2],
+           r.videoDrops,
+           r.videoPacketErrors,
+           r.audioPacketErrors,
+           r.audioXruns,
+           r.audioUnderruns,
+           r.audioSamplingFrequency,
+           r.avSkewUs,
+           r.cpuPermille[0] / 1000.0,
+           r.cpuPermille[1] / 1000.0,
+           r.cpuPermille[2] / 1000.0,
+           r.cpuPermille[3] / 1000.0,
+           r.nativeHeapKiB,
+           r.thermalStatus,
+           (r.flags & TELEMETRY_VIDEO_RUNNING) != 0,
+           (r.flags & TELEMETRY_AUDIO_RUNNING) != 0,
+           r.fastPaths,
+           r.fastPathCohort);
+  }
+  return 0;
+}
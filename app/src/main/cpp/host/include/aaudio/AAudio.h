@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#pragma once
+
+// Host stand-in for the part of the NDK's <aaudio/AAudio.h> the audio
+// converters use, its sample formats, for the audio benchmark.
+
+#include <stdint.h>
+
+typedef int32_t aaudio_format_t;
+
+enum {
+  AAUDIO_FORMAT_INVALID = -1,
+  AAUDIO_FORMAT_UNSPECIFIED = 0,
+  AAUDIO_FORMAT_PCM_I16,
+  AAUDIO_FORMAT_PCM_FLOAT,
+  AAUDIO_FORMAT_PCM_I24_PACKED,
+  AAUDIO_FORMAT_PCM_I32,
+};
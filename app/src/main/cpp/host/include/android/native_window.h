@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// Host stand-in for the part of the NDK's <android/native_window.h> the
+// converters use. On the host a window is just memory described by an
+// ANativeWindow_Buffer, see HostWindow in HostCapture.cpp.
+
+#include <stdint.h>
+
+typedef struct ANativeWindow_Buffer {
+  int32_t width;
+  int32_t height;
+  // In pixels.
+  int32_t stride;
+  int32_t format;
+  void* bits;
+  uint32_t reserved[6];
+} ANativeWindow_Buffer;
@@ -1681,20 +1681,15 @@ uint32_t API_EXPORTED libusb_transfer_get_stream_id(
  * Do not call this function with the usbi_transfer lock held. User-specified
  * callback functions may attempt to directly resubmit the transfer, which
  * will attempt to take the lock. */
-int usbi_handle_transfer_completion(struct usbi_transfer *itransfer,
+/* Reports a transfer already off the flying list to its callback. Called with
+ * the event waiters lock held. */
+static void finish_transfer(struct usbi_transfer *itransfer,
 	enum libusb_transfer_status status)
 {
 	struct libusb_transfer *transfer =
 		USBI_TRANSFER_TO_LIBUSB_TRANSFER(itransfer);
 	struct libusb_context *ctx = ITRANSFER_CTX(itransfer);
 	uint8_t flags;
-	int r;
-
-	usbi_mutex_lock(&ctx->flying_transfers_lock);
-	r = remove_from_flying_list(itransfer);
-	usbi_mutex_unlock(&ctx->flying_transfers_lock);
-	if (r < 0)
-		usbi_err(ctx, "failed to set timer for next timeout");
 
 	usbi_mutex_lock(&itransfer->lock);
 	itransfer->state_flags &= ~USBI_TRANSFER_IN_FLIGHT;
@@ -1716,15 +1711,60 @@ int usbi_handle_transfer_completion(struct usbi_transfer *itransfer,
 	transfer->actual_length = itransfer->transferred;
 	usbi_dbg(ctx, "transfer %p has callback %p",
 		 (void *) transfer, transfer->callback);
-	if (transfer->callback) {
-		libusb_lock_event_waiters (ctx);
+	if (transfer->callback)
 		transfer->callback(transfer);
-		libusb_unlock_event_waiters(ctx);
-	}
 	/* transfer might have been freed by the above call, do not use from
 	 * this point. */
 	if (flags & LIBUSB_TRANSFER_FREE_TRANSFER)
 		libusb_free_transfer(transfer);
+}
+
+int usbi_handle_transfer_completion(struct usbi_transfer *itransfer,
+	enum libusb_transfer_status status)
+{
+	struct libusb_context *ctx = ITRANSFER_CTX(itransfer);
+	int r;
+
+	usbi_mutex_lock(&ctx->flying_transfers_lock);
+	r = remove_from_flying_list(itransfer);
+	usbi_mutex_unlock(&ctx->flying_transfers_lock);
+	if (r < 0)
+		usbi_err(ctx, "failed to set timer for next timeout");
+
+	libusb_lock_event_waiters(ctx);
+	finish_transfer(itransfer, status);
+	libusb_unlock_event_waiters(ctx);
+	return r;
+}
+
+/* Like usbi_handle_transfer_completion() for the transfers a backend
+ * collected in batch, all of ctx, which are reported in order. The flying
+ * list and event waiters locks are taken once for the batch instead of once
+ * per transfer, which counts when a wakeup completes many small isochronous
+ * transfers. Leaves the batch empty. */
+int usbi_handle_transfer_completions(struct libusb_context *ctx,
+	struct usbi_completion_batch *batch)
+{
+	unsigned int i;
+	int r = 0;
+
+	if (!batch->count)
+		return 0;
+
+	usbi_mutex_lock(&ctx->flying_transfers_lock);
+	for (i = 0; i < batch->count; i++) {
+		if (remove_from_flying_list(batch->transfers[i]) < 0)
+			r = LIBUSB_ERROR_OTHER;
+	}
+	usbi_mutex_unlock(&ctx->flying_transfers_lock);
+	if (r < 0)
+		usbi_err(ctx, "failed to set timer for next timeout");
+
+	libusb_lock_event_waiters(ctx);
+	for (i = 0; i < batch->count; i++)
+		finish_transfer(batch->transfers[i], batch->status[i]);
+	libusb_unlock_event_waiters(ctx);
+	batch->count = 0;
 	return r;
 }
 
@@ -1099,6 +1099,26 @@ struct libusb_version {
 	const char *describe;
 };
 
+/** \ingroup libusb_misc
+ * usbfs ioctls issued for transfers since the library was loaded, summed over
+ * every context and device of the process, from
+ * libusb_get_transfer_syscalls(). Only the Linux backend counts them. The
+ * counters wrap around at ULONG_MAX.
+ */
+struct libusb_transfer_syscalls {
+	/** URBs submitted, one per URB of a transfer */
+	unsigned long urb_submits;
+
+	/** Reaps, including the ones that found no completed URB */
+	unsigned long urb_reaps;
+
+	/** Reaps that found no completed URB, about one per event wakeup */
+	unsigned long empty_reaps;
+
+	/** URBs discarded by cancellations and failed submissions */
+	unsigned long urb_discards;
+};
+
 /** \ingroup libusb_lib
  * Structure representing a libusb session. The concept of individual libusb
  * sessions allows for your program to use two libraries (or dynamically
@@ -1584,6 +1604,7 @@ int LIBUSB_CALL libusb_has_capability(uint32_t capability);
 const char * LIBUSB_CALL libusb_error_name(int errcode);
 int LIBUSB_CALL libusb_setlocale(const char *locale);
 const char * LIBUSB_CALL libusb_strerror(int errcode);
+void LIBUSB_CALL libusb_get_transfer_syscalls(struct libusb_transfer_syscalls *syscalls);
 
 ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context *ctx,
 	libusb_device ***list);
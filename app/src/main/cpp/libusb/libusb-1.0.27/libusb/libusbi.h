@@ -804,8 +804,20 @@ struct libusb_device *usbi_get_device_by_session_id(struct libusb_context *ctx,
 int usbi_sanitize_device(struct libusb_device *dev);
 void usbi_handle_disconnect(struct libusb_device_handle *dev_handle);
 
+/* Completions a backend collects while it reaps, for
+ * usbi_handle_transfer_completions() */
+#define USBI_COMPLETION_BATCH_SIZE	32
+
+struct usbi_completion_batch {
+	unsigned int count;
+	struct usbi_transfer *transfers[USBI_COMPLETION_BATCH_SIZE];
+	enum libusb_transfer_status status[USBI_COMPLETION_BATCH_SIZE];
+};
+
 int usbi_handle_transfer_completion(struct usbi_transfer *itransfer,
 	enum libusb_transfer_status status);
+int usbi_handle_transfer_completions(struct libusb_context *ctx,
+	struct usbi_completion_batch *batch);
 int usbi_handle_transfer_cancellation(struct usbi_transfer *itransfer);
 void usbi_signal_transfer_completion(struct usbi_transfer *itransfer);
 
@@ -89,6 +89,18 @@ static int usbdev_names = 0;
  */
 static unsigned int max_iso_packet_len = 0;
 
+/* usbfs ioctls issued for transfers, for libusb_get_transfer_syscalls() */
+static usbi_atomic_t urb_submits;
+static usbi_atomic_t urb_reaps;
+static usbi_atomic_t empty_reaps;
+static usbi_atomic_t urb_discards;
+
+/* Most URBs reaped per handle and event. A deep isochronous queue completes
+ * many URBs between two wakeups of the event thread, and stopping short of
+ * them costs another poll round trip each; the bound still keeps one busy
+ * handle from starving the others. */
+#define MAX_REAPS_PER_EVENT		256
+
 /* is sysfs available (mounted) ? */
 static int sysfs_available = -1;
 
@@ -1874,6 +1886,7 @@ static int discard_urbs(struct usbi_transfer *itransfer, int first, int last_plu
 		else
 			urb = &tpriv->urbs[i];
 
+		usbi_atomic_inc(&urb_discards);
 		if (ioctl(hpriv->fd, IOCTL_USBFS_DISCARDURB, urb) == 0)
 			continue;
 
@@ -2022,6 +2035,7 @@ static int submit_bulk_transfer(struct usbi_transfer *itransfer)
 		    (transfer->flags & LIBUSB_TRANSFER_ADD_ZERO_PACKET))
 			urb->flags |= USBFS_URB_ZERO_PACKET;
 
+		usbi_atomic_inc(&urb_submits);
 		r = ioctl(hpriv->fd, IOCTL_USBFS_SUBMITURB, urb);
 		if (r == 0)
 			continue;
@@ -2173,7 +2187,10 @@ static int submit_iso_transfer(struct usbi_transfer *itransfer)
 
 	/* submit URBs */
 	for (i = 0; i < num_urbs; i++) {
-		int r = ioctl(hpriv->fd, IOCTL_USBFS_SUBMITURB, urbs[i]);
+		int r;
+
+		usbi_atomic_inc(&urb_submits);
+		r = ioctl(hpriv->fd, IOCTL_USBFS_SUBMITURB, urbs[i]);
 
 		if (r == 0)
 			continue;
@@ -2253,6 +2270,7 @@ static int submit_control_transfer(struct usbi_transfer *itransfer)
 	urb->buffer = transfer->buffer;
 	urb->buffer_length = transfer->length;
 
+	usbi_atomic_inc(&urb_submits);
 	r = ioctl(hpriv->fd, IOCTL_USBFS_SUBMITURB, urb);
 	if (r < 0) {
 		free(urb);
@@ -2341,8 +2359,20 @@ static void op_clear_transfer_priv(struct usbi_transfer *itransfer)
 	}
 }
 
+/* Queues the completion of a transfer whose URBs are all reaped, reported
+ * when its handle's reaps end or the batch fills up */
+static int batch_completion(struct usbi_completion_batch *batch,
+	struct usbi_transfer *itransfer, enum libusb_transfer_status status)
+{
+	batch->transfers[batch->count] = itransfer;
+	batch->status[batch->count] = status;
+	if (++batch->count < USBI_COMPLETION_BATCH_SIZE)
+		return 0;
+	return usbi_handle_transfer_completions(ITRANSFER_CTX(itransfer), batch);
+}
+
 static int handle_bulk_completion(struct usbi_transfer *itransfer,
-	struct usbfs_urb *urb)
+	struct usbfs_urb *urb, struct usbi_completion_batch *batch)
 {
 	struct linux_transfer_priv *tpriv = usbi_get_transfer_priv(itransfer);
 	struct libusb_transfer *transfer = USBI_TRANSFER_TO_LIBUSB_TRANSFER(itransfer);
@@ -2473,13 +2503,15 @@ completed:
 	free(tpriv->urbs);
 	tpriv->urbs = NULL;
 	usbi_mutex_unlock(&itransfer->lock);
-	return tpriv->reap_action == CANCELLED ?
-		usbi_handle_transfer_cancellation(itransfer) :
-		usbi_handle_transfer_completion(itransfer, tpriv->reap_status);
+	if (tpriv->reap_action != CANCELLED)
+		return batch_completion(batch, itransfer, tpriv->reap_status);
+	/* keep completions in order */
+	usbi_handle_transfer_completions(ITRANSFER_CTX(itransfer), batch);
+	return usbi_handle_transfer_cancellation(itransfer);
 }
 
 static int handle_iso_completion(struct usbi_transfer *itransfer,
-	struct usbfs_urb *urb)
+	struct usbfs_urb *urb, struct usbi_completion_batch *batch)
 {
 	struct libusb_transfer *transfer =
 		USBI_TRANSFER_TO_LIBUSB_TRANSFER(itransfer);
@@ -2556,15 +2588,17 @@ static int handle_iso_completion(struct usbi_transfer *itransfer,
 		usbi_dbg(TRANSFER_CTX(transfer), "CANCEL: urb status %d", urb->status);
 
 		if (tpriv->num_retired == num_urbs) {
+			enum reap_action action = tpriv->reap_action;
+
 			usbi_dbg(TRANSFER_CTX(transfer), "CANCEL: last URB handled, reporting");
 			free_iso_urbs(tpriv);
-			if (tpriv->reap_action == CANCELLED) {
-				usbi_mutex_unlock(&itransfer->lock);
+			usbi_mutex_unlock(&itransfer->lock);
+			/* keep completions in order */
+			usbi_handle_transfer_completions(TRANSFER_CTX(transfer), batch);
+			if (action == CANCELLED)
 				return usbi_handle_transfer_cancellation(itransfer);
-			} else {
-				usbi_mutex_unlock(&itransfer->lock);
+			else
 				return usbi_handle_transfer_completion(itransfer, LIBUSB_TRANSFER_ERROR);
-			}
 		}
 		goto out;
 	}
@@ -2590,7 +2624,7 @@ static int handle_iso_completion(struct usbi_transfer *itransfer,
 		usbi_dbg(TRANSFER_CTX(transfer), "all URBs in transfer reaped --> complete!");
 		free_iso_urbs(tpriv);
 		usbi_mutex_unlock(&itransfer->lock);
-		return usbi_handle_transfer_completion(itransfer, status);
+		return batch_completion(batch, itransfer, status);
 	}
 
 out:
@@ -2659,7 +2693,10 @@ static int handle_control_completion(struct usbi_transfer *itransfer,
 	return usbi_handle_transfer_completion(itransfer, status);
 }
 
-static int reap_for_handle(struct libusb_device_handle *handle)
+/* Reaps one URB of handle. Isochronous and bulk transfers it completes are
+ * added to batch, which the caller reports once it is done reaping. */
+static int reap_for_handle(struct libusb_device_handle *handle,
+	struct usbi_completion_batch *batch)
 {
 	struct linux_device_handle_priv *hpriv = usbi_get_device_handle_priv(handle);
 	int r;
@@ -2667,10 +2704,13 @@ static int reap_for_handle(struct libusb_device_handle *handle)
 	struct usbi_transfer *itransfer;
 	struct libusb_transfer *transfer;
 
+	usbi_atomic_inc(&urb_reaps);
 	r = ioctl(hpriv->fd, IOCTL_USBFS_REAPURBNDELAY, &urb);
 	if (r < 0) {
-		if (errno == EAGAIN)
+		if (errno == EAGAIN) {
+			usbi_atomic_inc(&empty_reaps);
 			return 1;
+		}
 		if (errno == ENODEV)
 			return LIBUSB_ERROR_NO_DEVICE;
 
@@ -2685,12 +2725,13 @@ static int reap_for_handle(struct libusb_device_handle *handle)
 
 	switch (transfer->type) {
 	case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
-		return handle_iso_completion(itransfer, urb);
+		return handle_iso_completion(itransfer, urb, batch);
 	case LIBUSB_TRANSFER_TYPE_BULK:
 	case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
 	case LIBUSB_TRANSFER_TYPE_INTERRUPT:
-		return handle_bulk_completion(itransfer, urb);
+		return handle_bulk_completion(itransfer, urb, batch);
 	case LIBUSB_TRANSFER_TYPE_CONTROL:
+		usbi_handle_transfer_completions(HANDLE_CTX(handle), batch);
 		return handle_control_completion(itransfer, urb);
 	default:
 		usbi_err(HANDLE_CTX(handle), "unrecognised transfer type %u", transfer->type);
@@ -2702,9 +2743,11 @@ static int op_handle_events(struct libusb_context *ctx,
 	void *event_data, unsigned int count, unsigned int num_ready)
 {
 	struct pollfd *fds = event_data;
+	struct usbi_completion_batch batch;
 	unsigned int n;
 	int r;
 
+	batch.count = 0;
 	usbi_mutex_lock(&ctx->open_devs_lock);
 	for (n = 0; n < count && num_ready > 0; n++) {
 		struct pollfd *pollfd = &fds[n];
@@ -2745,8 +2788,9 @@ static int op_handle_events(struct libusb_context *ctx,
 
 			if (hpriv->caps & USBFS_CAP_REAP_AFTER_DISCONNECT) {
 				do {
-					r = reap_for_handle(handle);
+					r = reap_for_handle(handle, &batch);
 				} while (r == 0);
+				usbi_handle_transfer_completions(ctx, &batch);
 			}
 
 			usbi_handle_disconnect(handle);
@@ -2755,8 +2799,11 @@ static int op_handle_events(struct libusb_context *ctx,
 
 		reap_count = 0;
 		do {
-			r = reap_for_handle(handle);
-		} while (r == 0 && ++reap_count <= 25);
+			r = reap_for_handle(handle, &batch);
+		} while (r == 0 && ++reap_count <= MAX_REAPS_PER_EVENT);
+		/* callbacks of the transfers reaped above, in one pass */
+		if (usbi_handle_transfer_completions(ctx, &batch) < 0 && r >= 0)
+			r = LIBUSB_ERROR_OTHER;
 
 		if (r == 1 || r == LIBUSB_ERROR_NO_DEVICE)
 			continue;
@@ -2770,6 +2817,14 @@ out:
 	return r;
 }
 
+void API_EXPORTED libusb_get_transfer_syscalls(struct libusb_transfer_syscalls *syscalls)
+{
+	syscalls->urb_submits = (unsigned long)usbi_atomic_load(&urb_submits);
+	syscalls->urb_reaps = (unsigned long)usbi_atomic_load(&urb_reaps);
+	syscalls->empty_reaps = (unsigned long)usbi_atomic_load(&empty_reaps);
+	syscalls->urb_discards = (unsigned long)usbi_atomic_load(&urb_discards);
+}
+
 const struct usbi_os_backend usbi_backend = {
 	.name = "Linux usbfs",
 	.caps = USBI_CAP_HAS_HID_ACCESS|USBI_CAP_SUPPORTS_DETACH_KERNEL_DRIVER,
@@ -73,6 +73,8 @@ struct usbfs_iso_packet_desc {
 #define MAX_BULK_BUFFER_LENGTH		16384
 #define MAX_CTRL_BUFFER_LENGTH		4096
 
+/* usbfs rejects isochronous URBs of more packets, so a transfer costs a
+ * submit and a reap per 128 of them */
 #define MAX_ISO_PACKETS_PER_URB		128
 
 struct usbfs_urb {
@@ -87,6 +87,25 @@ enum uvc_frame_format {
   UVC_FRAME_FORMAT_NV12,
   /** YUV: P010 */
   UVC_FRAME_FORMAT_P010,
+  /** H.265/HEVC frame based payload */
+  UVC_FRAME_FORMAT_H265,
+  /** VP8 frame based or UVC 1.5 VP8 payload */
+  UVC_FRAME_FORMAT_VP8,
+  /** VP9 frame based payload */
+  UVC_FRAME_FORMAT_VP9,
+  /* Raw colour mosaic images of 10 bit samples in the low bits of little
+   * endian 16 bit words */
+  UVC_FRAME_FORMAT_SGRBG10,
+  UVC_FRAME_FORMAT_SGBRG10,
+  UVC_FRAME_FORMAT_SRGGB10,
+  UVC_FRAME_FORMAT_SBGGR10,
+  /* Raw colour mosaic images of little endian 16 bit samples */
+  UVC_FRAME_FORMAT_SGRBG16,
+  UVC_FRAME_FORMAT_SGBRG16,
+  UVC_FRAME_FORMAT_SRGGB16,
+  UVC_FRAME_FORMAT_SBGGR16,
+  /** Depth maps of little endian 16 bit samples */
+  UVC_FRAME_FORMAT_Z16,
   /** Number of formats understood */
   UVC_FRAME_FORMAT_COUNT,
 };
@@ -120,7 +139,15 @@ enum uvc_vs_desc_subtype {
   UVC_VS_COLORFORMAT = 0x0d,
   UVC_VS_FORMAT_FRAME_BASED = 0x10,
   UVC_VS_FRAME_FRAME_BASED = 0x11,
-  UVC_VS_FORMAT_STREAM_BASED = 0x12
+  UVC_VS_FORMAT_STREAM_BASED = 0x12,
+  /** UVC 1.5 H.264 and VP8 payload descriptors, which carry no GUID; libuvc
+   * gives their formats the frame based H.264 and VP8 ones */
+  UVC_VS_FORMAT_H264 = 0x13,
+  UVC_VS_FRAME_H264 = 0x14,
+  UVC_VS_FORMAT_H264_SIMULCAST = 0x15,
+  UVC_VS_FORMAT_VP8 = 0x16,
+  UVC_VS_FRAME_VP8 = 0x17,
+  UVC_VS_FORMAT_VP8_SIMULCAST = 0x18
 };
 
 struct uvc_format_desc;
@@ -220,6 +247,12 @@ typedef struct uvc_format_desc {
   uint8_t bmInterlaceFlags;
   uint8_t bCopyProtect;
   uint8_t bVariableSize;
+  /** From the color matching descriptor following the format's frames (3.9.2.6),
+   * zero when it has none: the defaults are BT.709 primaries and transfer and
+   * SMPTE 170M (BT.601) matrix coefficients */
+  uint8_t bColorPrimaries;
+  uint8_t bTransferCharacteristics;
+  uint8_t bMatrixCoefficients;
   /** Available frame specifications for this format */
   struct uvc_frame_desc *frame_descs;
   struct uvc_still_frame_desc *still_frame_desc;
@@ -292,6 +325,31 @@ enum uvc_pu_ctrl_selector {
   UVC_PU_CONTRAST_AUTO_CONTROL = 0x13
 };
 
+/** Encoding unit control selector (UVC 1.5, A.9.6) */
+enum uvc_eu_ctrl_selector {
+  UVC_EU_CONTROL_UNDEFINED = 0x00,
+  UVC_EU_SELECT_LAYER_CONTROL = 0x01,
+  UVC_EU_PROFILE_TOOLSET_CONTROL = 0x02,
+  UVC_EU_VIDEO_RESOLUTION_CONTROL = 0x03,
+  UVC_EU_MIN_FRAME_INTERVAL_CONTROL = 0x04,
+  UVC_EU_SLICE_MODE_CONTROL = 0x05,
+  UVC_EU_RATE_CONTROL_MODE_CONTROL = 0x06,
+  UVC_EU_AVERAGE_BITRATE_CONTROL = 0x07,
+  UVC_EU_CPB_SIZE_CONTROL = 0x08,
+  UVC_EU_PEAK_BIT_RATE_CONTROL = 0x09,
+  UVC_EU_QUANTIZATION_PARAMS_CONTROL = 0x0a,
+  UVC_EU_SYNC_REF_FRAME_CONTROL = 0x0b,
+  UVC_EU_LTR_BUFFER_CONTROL = 0x0c,
+  UVC_EU_LTR_PICTURE_CONTROL = 0x0d,
+  UVC_EU_LTR_VALIDATION_CONTROL = 0x0e,
+  UVC_EU_LEVEL_IDC_LIMIT_CONTROL = 0x0f,
+  UVC_EU_SEI_PAYLOADTYPE_CONTROL = 0x10,
+  UVC_EU_QP_RANGE_CONTROL = 0x11,
+  UVC_EU_PRIORITY_CONTROL = 0x12,
+  UVC_EU_START_OR_STOP_LAYER_CONTROL = 0x13,
+  UVC_EU_ERROR_RESILIENCY_CONTROL = 0x14
+};
+
 /** USB terminal type (B.1) */
 enum uvc_term_type {
   UVC_TT_VENDOR_SPECIFIC = 0x0100,
@@ -400,6 +458,20 @@ typedef struct uvc_extension_unit {
   uint64_t bmControls;
 } uvc_extension_unit_t;
 
+/** UVC 1.5 video encoder of H.264, VP8 or H.265 payloads */
+typedef struct uvc_encoding_unit {
+  struct uvc_encoding_unit *prev, *next;
+  /** Index of the encoding unit within the device */
+  uint8_t bUnitID;
+  /** Index of the unit from which the encoder accepts images */
+  uint8_t bSourceID;
+  /** Controls the host may set before streaming; bit n is selector n + 1
+   * of {uvc_eu_ctrl_selector} */
+  uint32_t bmControls;
+  /** Controls the host may also set while streaming */
+  uint32_t bmControlsRuntime;
+} uvc_encoding_unit_t;
+
 enum uvc_status_class {
   UVC_STATUS_CLASS_CONTROL = 0x10,
   UVC_STATUS_CLASS_CONTROL_CAMERA = 0x11,
@@ -449,6 +521,72 @@ typedef struct uvc_device_descriptor {
   const char *product;
 } uvc_device_descriptor_t;
 
+/** Allocator of frame and heap transfer buffers, see uvc_set_buffer_allocator()
+ * @ingroup frame
+ */
+typedef struct uvc_buffer_allocator {
+  /** At least bytes, or NULL */
+  void *(*alloc)(size_t bytes, void *user_ptr);
+  void (*free)(void *buf, void *user_ptr);
+  void *user_ptr;
+  /** Frame pool slots when set, or NULL to use alloc; freed through free */
+  void *(*alloc_frame)(size_t bytes, void *user_ptr);
+} uvc_buffer_allocator_t;
+
+/** Fields of uvc_frame_meta_t that the device sent for a frame
+ * @ingroup streaming
+ */
+enum uvc_frame_meta_flags {
+  /** scr_sof holds the SOF token counter of the SCR */
+  UVC_FRAME_META_SCR_SOF = 1 << 0,
+  /** header_pts and header_scr come from a metadata UsbVideoHeader item */
+  UVC_FRAME_META_USB_VIDEO_HEADER = 1 << 1,
+  UVC_FRAME_META_EXPOSURE_TIME = 1 << 2,
+  UVC_FRAME_META_EXPOSURE_COMPENSATION = 1 << 3,
+  UVC_FRAME_META_ISO_SPEED = 1 << 4,
+  UVC_FRAME_META_FOCUS_STATE = 1 << 5,
+  UVC_FRAME_META_LENS_POSITION = 1 << 6,
+  UVC_FRAME_META_WHITE_BALANCE = 1 << 7,
+  /** face_count and faces come from a face detection item */
+  UVC_FRAME_META_FACES = 1 << 8,
+};
+
+/** Most face rectangles kept per frame by uvc_parse_frame_meta() */
+#define UVC_FRAME_META_MAX_FACES 4
+
+/** A face rectangle, in the pixel space the device reports it in */
+typedef struct uvc_frame_meta_face {
+  int32_t left, top, right, bottom;
+} uvc_frame_meta_face_t;
+
+/** Per-frame fields decoded from the payload headers and the UVC 1.5
+ * metadata items (KSCAMERA_METADATA_ITEMHEADER) a device appends to them.
+ * Only the fields whose bit is set in flags are valid; decoding never
+ * allocates, so it stays embedded in pooled frames.
+ * @ingroup streaming
+ */
+typedef struct uvc_frame_meta {
+  /** enum uvc_frame_meta_flags */
+  uint32_t flags;
+  /** 11 bit USB SOF token counter of the last SCR */
+  uint16_t scr_sof;
+  /** Number of valid entries of faces, at most UVC_FRAME_META_MAX_FACES */
+  uint8_t face_count;
+  /** Exposure time, in 100 ns units */
+  uint64_t exposure_time;
+  /** Exposure compensation value, in the device's step units */
+  int32_t exposure_compensation;
+  uint32_t iso_speed;
+  /** Focus state, KSCAMERA_EXTENDEDPROP_FOCUSSTATE_* */
+  uint32_t focus_state;
+  uint32_t lens_position;
+  /** White balance, in Kelvin */
+  uint32_t white_balance;
+  /** PTS and SCR STC copied by the device into a UsbVideoHeader item */
+  uint32_t header_pts, header_scr;
+  uvc_frame_meta_face_t faces[UVC_FRAME_META_MAX_FACES];
+} uvc_frame_meta_t;
+
 /** An image frame received from the UVC device
  * @ingroup streaming
  */
@@ -485,6 +623,21 @@ typedef struct uvc_frame {
   void *metadata;
   /** Size of metadata buffer */
   size_t metadata_bytes;
+  /** Presentation time stamp from the payload headers, in units of the
+   * stream's dwClockFrequency. Zero if the device does not send one. */
+  uint32_t pts;
+  /** Source clock reference (STC part of the SCR) of the last payload of
+   * the frame, in the same units. Zero if the device does not send one. */
+  uint32_t last_scr;
+  /** Set when the payloads carried the still image bit: a method 2 still
+   * captured at the size set with uvc_stream_set_still(). */
+  uint8_t still;
+  /** Set when a packet or payload of the frame was lost or carried the UVC
+   * error bit, so its data is likely damaged. */
+  uint8_t incomplete;
+  /** Fields decoded from the payload headers and metadata, see
+   * uvc_parse_frame_meta() */
+  uvc_frame_meta_t meta;
 } uvc_frame_t;
 
 /** A callback function to handle incoming assembled UVC frames
@@ -492,6 +645,139 @@ typedef struct uvc_frame {
  */
 typedef void(uvc_frame_callback_t)(struct uvc_frame *frame, void *user_ptr);
 
+/** Called once, on the libusb event thread, when a transfer of a running
+ * stream finds the device gone. Must not stop or close the stream.
+ * @ingroup streaming
+ */
+typedef void(uvc_device_lost_callback_t)(void *user_ptr);
+
+/** Flags accepted by uvc_stream_start(). Bit 0 is reserved for backward
+ * compatibility.
+ * @ingroup streaming
+ */
+enum uvc_stream_flags {
+  /** Let the callback keep frames past its return. Callback frames always
+   * point straight into the stream's refcounted pool; with this flag the
+   * callback owns one reference and must drop it with uvc_release_frame(),
+   * possibly after the callback has returned. All references must be dropped
+   * before uvc_stream_close(). */
+  UVC_STREAM_FLAG_BORROWED_FRAMES = (1 << 1),
+  /** Call the callback on the libusb event thread as each frame completes,
+   * instead of waking a libuvc thread for it. Saves a wakeup and a context
+   * switch per frame, but the callback holds up every transfer on the libusb
+   * context while it runs, so it must only hand the frame off and return. */
+  UVC_STREAM_FLAG_INLINE_CALLBACK = (1 << 2),
+  /** Without a callback, assemble frames in the pool anyway, for
+   * uvc_stream_acquire_frame(). No libuvc thread is started; frames the
+   * caller does not take in time are dropped before any copy, and a held
+   * frame is the caller's alone until uvc_release_frame(). */
+  UVC_STREAM_FLAG_POLLED_FRAMES = (1 << 3),
+};
+
+/** Transfer geometry for uvc_stream_start_with_options(). Zero fields are
+ * sized from the stream's dwMaxVideoFrameSize, its dwMaxPayloadTransferSize
+ * and the bus speed; uvc_stream_get_options() reports what was used.
+ * @ingroup streaming
+ */
+typedef struct uvc_stream_options {
+  /** Transfers kept in flight, at most LIBUVC_NUM_TRANSFER_BUFS */
+  uint32_t num_transfers;
+  /** Isochronous packets per transfer */
+  uint32_t packets_per_transfer;
+  /** Bytes per bulk transfer, rounded down to whole dwMaxPayloadTransferSize
+   * payloads */
+  uint32_t bulk_transfer_size;
+  uint32_t transfer_timeout_ms;
+  /** Frame buffers of a stream with a callback, at most LIBUVC_NUM_FRAME_POOL_BUFS.
+   * Frames held by the consumer count against it. */
+  uint32_t frame_pool_size;
+  /** Nonzero picks the smallest isochronous altsetting that carries the
+   * format's frame size at its frame rate, instead of the first one holding
+   * dwMaxPayloadTransferSize, which many cameras over-report. Packet errors
+   * move the next start one altsetting up. */
+  uint32_t fit_iso_bandwidth;
+  /** Bus time one transfer covers when packets_per_transfer or
+   * bulk_transfer_size is zero, 4 ms when this is zero too. Longer transfers
+   * mean fewer completions to wake up for. */
+  uint32_t transfer_duration_us;
+  /** Nonzero publishes the frame being assembled each time this many more
+   * bytes of it arrived, for uvc_stream_wait_frame_progress(). Callback
+   * streams only. */
+  uint32_t progress_bytes;
+  /** Payloads with at least this many bytes of video data are copied into
+   * the frame with non-temporal stores, so assembling a frame of several MB
+   * does not evict what the event thread and the consumer work on. Zero for
+   * LIBUVC_STREAMING_COPY_BYTES, UINT32_MAX for never; never with
+   * progress_bytes, whose reader wants the rows in the cache. */
+  uint32_t streaming_copy_bytes;
+} uvc_stream_options_t;
+
+/** Isochronous bandwidth of a stream, from uvc_stream_get_bandwidth()
+ * @ingroup streaming
+ */
+typedef struct uvc_stream_bandwidth {
+  /** Zero for bulk streams */
+  uint32_t interval_us;
+  /** Per interval, of the selected altsetting's endpoint */
+  uint32_t reserved_bytes;
+  /** Per interval, for the negotiated frame size and rate */
+  uint32_t needed_bytes;
+  uint8_t altsetting;
+  /** Since the stream started */
+  uint64_t packets;
+  uint64_t packet_errors;
+} uvc_stream_bandwidth_t;
+
+/** Transport counters of the running or last started stream, from
+ * uvc_stream_get_transport(). The transfer callbacks store them atomically,
+ * so reading them takes no lock.
+ * @ingroup streaming
+ */
+typedef struct uvc_stream_transport {
+  /** Isochronous packets, or bulk payloads, since the stream started */
+  uint64_t packets;
+  uint64_t packet_errors;
+  /** Completed with video data but less than a full packet, such as the last
+   * one of a frame */
+  uint64_t short_packets;
+  /** Completed without video data, empty or a payload header only */
+  uint64_t empty_packets;
+  /** Received, payload headers included */
+  uint64_t bytes;
+  /** Payloads dropped for the UVC error bit or a bogus header length */
+  uint64_t header_errors;
+  /** Frames published with data missing, after a failed packet or a dropped
+   * payload */
+  uint64_t incomplete_frames;
+  /** Frames ended by the frame ID toggling rather than an end of frame bit */
+  uint64_t frames_without_eof;
+  /** Frames larger than the dwMaxVideoFrameSize of their control block,
+   * assembled in a pool buffer grown for them */
+  uint64_t oversize_frames;
+  /** Frames that ran out of buffer and were published without their end,
+   * also counted as incomplete */
+  uint64_t truncated_frames;
+  /** Largest isochronous packet, against uvc_stream_bandwidth_t::reserved_bytes */
+  uint32_t max_packet_bytes;
+} uvc_stream_transport_t;
+
+/** Buffers of a stream, from uvc_stream_get_memory()
+ * @ingroup streaming
+ */
+typedef struct uvc_stream_memory {
+  /** Of the transfers in flight */
+  size_t transfer_bytes;
+  /** Of the transfers of the last start, kept for the next one */
+  size_t spare_transfer_bytes;
+  /** Of those two, usbfs memory rather than heap */
+  size_t usbfs_bytes;
+  /** Frame buffers callback streams assemble and lend frames in */
+  size_t frame_pool_bytes;
+  /** Frame buffers of uvc_stream_get_frame() */
+  size_t polling_bytes;
+  size_t metadata_bytes;
+} uvc_stream_memory_t;
+
 /** Streaming mode, includes all information needed to select stream
  * @ingroup streaming
  */
@@ -512,6 +798,13 @@ typedef struct uvc_stream_ctrl {
   uint8_t bPreferredVersion;
   uint8_t bMinVersion;
   uint8_t bMaxVersion;
+  /** UVC 1.5 fields, kept as the device answered */
+  uint8_t bUsage;
+  uint8_t bBitDepthLuma;
+  uint8_t bmSettings;
+  uint8_t bMaxNumberOfRefFramesPlus1;
+  uint16_t bmRateControlModes;
+  uint64_t bmLayoutPerStream;
   uint8_t bInterfaceNumber;
 } uvc_stream_ctrl_t;
 
@@ -570,6 +863,7 @@ void uvc_close(uvc_device_handle_t *devh);
 
 uvc_device_t *uvc_get_device(uvc_device_handle_t *devh);
 struct libusb_device_handle *uvc_get_libusb_handle(uvc_device_handle_t *devh);
+uint8_t uvc_get_control_interface_number(uvc_device_handle_t *devh);
 
 void uvc_ref_device(uvc_device_t *dev);
 void uvc_unref_device(uvc_device_t *dev);
@@ -588,6 +882,7 @@ const uvc_output_terminal_t *uvc_get_output_terminals(uvc_device_handle_t *devh)
 const uvc_selector_unit_t *uvc_get_selector_units(uvc_device_handle_t *devh);
 const uvc_processing_unit_t *uvc_get_processing_units(uvc_device_handle_t *devh);
 const uvc_extension_unit_t *uvc_get_extension_units(uvc_device_handle_t *devh);
+const uvc_encoding_unit_t *uvc_get_encoding_units(uvc_device_handle_t *devh);
 
 uvc_error_t uvc_get_stream_ctrl_format_size(
     uvc_device_handle_t *devh,
@@ -597,6 +892,22 @@ uvc_error_t uvc_get_stream_ctrl_format_size(
     int fps
     );
 
+uvc_error_t uvc_get_stream_ctrl_format_size_on_interface(
+    uvc_device_handle_t *devh,
+    uvc_stream_ctrl_t *ctrl,
+    int interface_number,
+    enum uvc_frame_format format,
+    int width, int height,
+    int fps
+    );
+
+int uvc_get_slowest_frame_rate(
+    uvc_device_handle_t *devh,
+    int interface_number,
+    enum uvc_frame_format format,
+    int width, int height,
+    int min_fps);
+
 uvc_error_t uvc_get_still_ctrl_format_size(
     uvc_device_handle_t *devh,
     uvc_stream_ctrl_t *ctrl,
@@ -606,8 +917,23 @@ uvc_error_t uvc_get_still_ctrl_format_size(
 uvc_error_t uvc_trigger_still(
     uvc_device_handle_t *devh,
     uvc_still_ctrl_t *still_ctrl);
+int uvc_get_still_capture_method(uvc_device_handle_t *devh, uint8_t interface_number);
+uint8_t uvc_get_still_endpoint(uvc_device_handle_t *devh, const uvc_still_ctrl_t *still_ctrl);
+uvc_error_t uvc_get_still_size(
+    uvc_device_handle_t *devh,
+    const uvc_still_ctrl_t *still_ctrl,
+    uint16_t *width,
+    uint16_t *height);
+uvc_error_t uvc_stream_set_still(uvc_stream_handle_t *strmh, const uvc_still_ctrl_t *still_ctrl);
 
 const uvc_format_desc_t *uvc_get_format_descs(uvc_device_handle_t* );
+uvc_error_t uvc_get_stream_interface(
+    uvc_device_handle_t *devh,
+    int index,
+    uint8_t *interface_number,
+    uint8_t *still_capture_method,
+    const uvc_format_desc_t **format_descs);
+const uvc_format_desc_t *uvc_get_stream_format_desc(uvc_stream_handle_t *strmh);
 
 uvc_error_t uvc_probe_stream_ctrl(
     uvc_device_handle_t *devh,
@@ -634,10 +960,55 @@ void uvc_stop_streaming(uvc_device_handle_t *devh);
 
 uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t **strmh, uvc_stream_ctrl_t *ctrl);
 uvc_error_t uvc_stream_ctrl(uvc_stream_handle_t *strmh, uvc_stream_ctrl_t *ctrl);
+uvc_error_t uvc_stream_open_playback(
+    uvc_stream_handle_t **strmh,
+    enum uvc_frame_format frame_format,
+    uint32_t width,
+    uint32_t height,
+    size_t max_frame_bytes,
+    uint32_t pool_size);
+uvc_error_t uvc_stream_playback_frame(
+    uvc_stream_handle_t *strmh,
+    const void *data,
+    size_t bytes,
+    uint32_t pts,
+    const struct timespec *capture_time,
+    uvc_frame_t **frame);
+uvc_error_t uvc_stream_open_synthetic(
+    uvc_stream_handle_t **strmh,
+    enum uvc_frame_format frame_format,
+    uint32_t width,
+    uint32_t height,
+    size_t max_frame_bytes,
+    size_t max_payload_bytes,
+    const uvc_stream_options_t *options,
+    uvc_frame_callback_t *cb,
+    void *user_ptr);
+void uvc_stream_feed_payload(
+    uvc_stream_handle_t *strmh,
+    uint8_t *payload,
+    size_t payload_len,
+    size_t capacity);
+void uvc_stream_feed_bulk(uvc_stream_handle_t *strmh, uint8_t *buffer, size_t length);
 uvc_error_t uvc_stream_start(uvc_stream_handle_t *strmh,
     uvc_frame_callback_t *cb,
     void *user_ptr,
     uint8_t flags);
+uvc_error_t uvc_stream_start_with_options(uvc_stream_handle_t *strmh,
+    uvc_frame_callback_t *cb,
+    void *user_ptr,
+    uint8_t flags,
+    const uvc_stream_options_t *options);
+void uvc_stream_get_options(uvc_stream_handle_t *strmh, uvc_stream_options_t *options);
+uint64_t uvc_get_reserved_iso_bandwidth(uvc_device_handle_t *devh);
+void uvc_stream_get_bandwidth(uvc_stream_handle_t *strmh, uvc_stream_bandwidth_t *bandwidth);
+void uvc_stream_get_transport(uvc_stream_handle_t *strmh, uvc_stream_transport_t *transport);
+void uvc_stream_set_device_lost_callback(uvc_stream_handle_t *strmh,
+    uvc_device_lost_callback_t *cb,
+    void *user_ptr);
+int uvc_stream_device_lost(uvc_stream_handle_t *strmh);
+uint32_t uvc_stream_transfers_in_flight(uvc_stream_handle_t *strmh);
+int uvc_stream_rearm_transfers(uvc_stream_handle_t *strmh);
 uvc_error_t uvc_stream_start_iso(uvc_stream_handle_t *strmh,
     uvc_frame_callback_t *cb,
     void *user_ptr);
@@ -646,8 +1017,24 @@ uvc_error_t uvc_stream_get_frame(
     uvc_frame_t **frame,
     int32_t timeout_us
 );
+uvc_error_t uvc_stream_acquire_frame(
+    uvc_stream_handle_t *strmh,
+    uvc_frame_t **frame,
+    int32_t timeout_us
+);
+uvc_error_t uvc_stream_stop_async(uvc_stream_handle_t *strmh);
 uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh);
 void uvc_stream_close(uvc_stream_handle_t *strmh);
+void uvc_release_frame_buffer_stash(void);
+size_t uvc_frame_buffer_stash_bytes(void);
+void uvc_stream_get_memory(uvc_stream_handle_t *strmh, uvc_stream_memory_t *memory);
+size_t uvc_stream_trim_buffers(uvc_stream_handle_t *strmh);
+uvc_error_t uvc_stream_wait_frame_progress(
+    uvc_stream_handle_t *strmh,
+    uint32_t sequence,
+    size_t min_bytes,
+    int32_t timeout_us,
+    uvc_frame_t *progress);
 
 int uvc_get_ctrl_len(uvc_device_handle_t *devh, uint8_t unit, uint8_t ctrl);
 int uvc_get_ctrl(uvc_device_handle_t *devh, uint8_t unit, uint8_t ctrl, void *data, int len, enum uvc_req_code req_code);
@@ -783,10 +1170,15 @@ const char* uvc_strerror(uvc_error_t err);
 void uvc_print_diag(uvc_device_handle_t *devh, FILE *stream);
 void uvc_print_stream_ctrl(uvc_stream_ctrl_t *ctrl, FILE *stream);
 
+void uvc_set_buffer_allocator(const uvc_buffer_allocator_t *allocator);
 uvc_frame_t *uvc_allocate_frame(size_t data_bytes);
 void uvc_free_frame(uvc_frame_t *frame);
 
+void uvc_retain_frame(uvc_frame_t *frame);
+void uvc_release_frame(uvc_frame_t *frame);
+
 uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out);
+void uvc_parse_frame_meta(const void *metadata, size_t bytes, uvc_frame_meta_t *meta);
 
 uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out);
 uvc_error_t uvc_uyvy2rgb(uvc_frame_t *in, uvc_frame_t *out);
@@ -801,6 +1193,7 @@ uvc_error_t uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out);
 
 #ifdef LIBUVC_HAS_JPEG
 uvc_error_t uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_mjpeg2rgb_scaled(uvc_frame_t *in, uvc_frame_t *out, uint8_t scale_denom);
 uvc_error_t uvc_mjpeg2gray(uvc_frame_t *in, uvc_frame_t *out);
 #endif
 
@@ -69,6 +69,17 @@
 #define UVC_EXIT(code)
 #endif
 
+#if defined(UVC_TRACING) && defined(__ANDROID__)
+#include <android/trace.h>
+#define UVC_TRACE_BEGIN(name) ATrace_beginSection(name)
+#define UVC_TRACE_END() ATrace_endSection()
+#define UVC_TRACE_COUNTER(name, value) ATrace_setCounter(name, value)
+#else
+#define UVC_TRACE_BEGIN(name)
+#define UVC_TRACE_END()
+#define UVC_TRACE_COUNTER(name, value)
+#endif
+
 /* http://stackoverflow.com/questions/19452971/array-size-macro-that-rejects-pointers */
 #define IS_INDEXABLE(arg) (sizeof(arg[0]))
 #define IS_ARRAY(arg) (IS_INDEXABLE(arg) && (((void *) &arg) == ((void *) arg)))
@@ -95,7 +106,8 @@ enum uvc_vc_desc_subtype {
   UVC_VC_OUTPUT_TERMINAL = 0x03,
   UVC_VC_SELECTOR_UNIT = 0x04,
   UVC_VC_PROCESSING_UNIT = 0x05,
-  UVC_VC_EXTENSION_UNIT = 0x06
+  UVC_VC_EXTENSION_UNIT = 0x06,
+  UVC_VC_ENCODING_UNIT = 0x07
 };
 
 /** UVC endpoint descriptor subtype (A.7) */
@@ -191,6 +203,7 @@ typedef struct uvc_control_interface {
   struct uvc_selector_unit *selector_unit_descs;
   struct uvc_processing_unit *processing_unit_descs;
   struct uvc_extension_unit *extension_unit_descs;
+  struct uvc_encoding_unit *encoding_unit_descs;
   uint16_t bcdUVC;
   uint32_t dwClockFrequency;
   uint8_t bEndpointAddress;
@@ -233,6 +246,58 @@ typedef struct uvc_device_info {
 
 #define LIBUVC_XFER_META_BUF_SIZE ( 4 * 1024 )
 
+/* Alignment of frame buffers without a uvc_set_buffer_allocator() allocator,
+ * a cache line and a whole number of SIMD vectors */
+#define LIBUVC_BUFFER_ALIGNMENT 64
+
+/* Default uvc_stream_options_t streaming_copy_bytes: bulk and SuperSpeed
+ * isochronous payloads, not the at most 3072 byte ones of High Speed */
+#define LIBUVC_STREAMING_COPY_BYTES ( 16 * 1024 )
+
+/* Upper bound and default number of frame buffers backing a stream with a
+ * user callback. One is being filled by the transfer callbacks, completed ones
+ * wait in order for the user thread, and the rest can be held by the consumer.
+ * When all of them are in use, the oldest waiting frame is dropped.
+ */
+#ifndef LIBUVC_NUM_FRAME_POOL_BUFS
+#define LIBUVC_NUM_FRAME_POOL_BUFS 16
+#endif
+#ifndef LIBUVC_DEFAULT_FRAME_POOL_BUFS
+#define LIBUVC_DEFAULT_FRAME_POOL_BUFS 4
+#endif
+
+/** A frame buffer that payloads are assembled into and that is lent to the
+ * user in place */
+struct uvc_pooled_frame {
+  /** Must be first: handed out to the user as a uvc_frame_t pointer */
+  struct uvc_frame frame;
+  struct uvc_stream_handle *strmh;
+  uint8_t *buf, *meta_buf;
+  size_t buf_bytes;
+  /** Outstanding user references, protected by strmh->cb_mutex */
+  uint32_t refcount;
+  /** Completed and waiting in strmh->ready_slots */
+  uint8_t queued;
+  /* The completed frame, captured from the stream when it was published */
+  size_t bytes, meta_bytes;
+  uint32_t seq, pts, last_scr;
+  /* SOF counter of last_scr, or UVC_SCR_SOF_NONE */
+  uint16_t last_scr_sof;
+  uint8_t still, incomplete;
+  struct timespec capture_time;
+};
+
+/** last_scr_sof of a frame none of whose payloads carried an SCR */
+#define UVC_SCR_SOF_NONE 0xffff
+
+/** Format and geometry shared by every frame of a running stream */
+struct uvc_frame_template {
+  enum uvc_frame_format frame_format;
+  uint32_t width, height;
+  size_t step;
+  struct uvc_frame_desc *frame_desc;
+};
+
 struct uvc_stream_handle {
   struct uvc_device_handle *devh;
   struct uvc_stream_handle *prev, *next;
@@ -240,6 +305,9 @@ struct uvc_stream_handle {
 
   /** if true, stream is running (streaming video to host) */
   uint8_t running;
+  /** if true, uvc_stream_stop_async() cancelled the transfers and
+   * uvc_stream_stop() has not yet waited for them */
+  uint8_t stopping;
   /** Current control block */
   struct uvc_stream_ctrl cur_ctrl;
 
@@ -249,23 +317,97 @@ struct uvc_stream_handle {
   uint32_t seq, hold_seq;
   uint32_t pts, hold_pts;
   uint32_t last_scr, hold_last_scr;
+  /* 11 bit SOF token counter of last_scr, valid once a payload carried an SCR */
+  uint16_t last_scr_sof, hold_last_scr_sof;
+  uint8_t scr_sof_valid;
+  /* the frame being assembled carries the still image bit */
+  uint8_t still, hold_still;
+  /* method 2 still set with uvc_stream_set_still(), zero without one */
+  uint32_t still_max_bytes;
+  uint16_t still_width, still_height;
   size_t got_bytes, hold_bytes;
   uint8_t *outbuf, *holdbuf;
+  /* size of outbuf and holdbuf, grown by uvc_stream_ctrl() for larger formats */
+  size_t frame_buf_bytes;
+  /* largest frame above dwMaxVideoFrameSize since the format changed, zero
+   * while the camera kept to it; pool slots are sized for it */
+  size_t oversize_frame_bytes;
   pthread_mutex_t cb_mutex;
   pthread_cond_t cb_cond;
+  /* options.progress_bytes mode: sequence, bytes so far and buffer of the
+   * frame being assembled, under cb_mutex and signaled with progress_cond.
+   * progress_next_bytes is the transfer thread's got_bytes to publish at. */
+  uint32_t progress_seq;
+  size_t progress_bytes;
+  uint8_t *progress_buf;
+  size_t progress_next_bytes;
+  pthread_cond_t progress_cond;
   pthread_t cb_thread;
   uint32_t last_polled_seq;
   uvc_frame_callback_t *user_cb;
   void *user_ptr;
+  /* Only the first options.num_transfers entries are used */
   struct libusb_transfer *transfers[LIBUVC_NUM_TRANSFER_BUFS];
   uint8_t *transfer_bufs[LIBUVC_NUM_TRANSFER_BUFS];
+  /* Whether transfer_bufs[i] is usbfs memory from libusb_dev_mem_alloc */
+  uint8_t transfer_buf_dev_mem[LIBUVC_NUM_TRANSFER_BUFS];
+  size_t transfer_buf_bytes[LIBUVC_NUM_TRANSFER_BUFS];
+  /* transfers[i] failed while running and waits, not submitted, for
+   * uvc_stream_rearm_transfers(); under cb_mutex */
+  uint8_t transfer_parked[LIBUVC_NUM_TRANSFER_BUFS];
+  /* Buffers of freed transfers, kept until close so a restart, or a format
+   * change while stopped, reuses them when they are large enough */
+  uint8_t *spare_bufs[LIBUVC_NUM_TRANSFER_BUFS];
+  uint8_t spare_buf_dev_mem[LIBUVC_NUM_TRANSFER_BUFS];
+  size_t spare_buf_bytes[LIBUVC_NUM_TRANSFER_BUFS];
+  /** Transfer geometry of the running or last started stream */
+  struct uvc_stream_options options;
+  /* the camera's bulk payloads are shorter than dwMaxPayloadTransferSize, so
+   * they cannot be packed several to a transfer. Kept across restarts. */
+  uint8_t bulk_single_payload;
+  /* Isochronous bandwidth; packet counts are written by the transfer callbacks */
+  struct uvc_stream_bandwidth bandwidth;
+  /* Written by the transfer callbacks only, with relaxed atomic stores */
+  struct uvc_stream_transport transport;
+  /* The frame being assembled lost a packet or payload */
+  uint8_t frame_incomplete, hold_incomplete;
+  /* The frame being assembled ran out of buffer and lost its end */
+  uint8_t frame_truncated;
+  /* A transfer completed or resubmitted with no device, since the stream
+   * started; set by the transfer callbacks with an atomic store */
+  uint8_t device_lost;
+  uvc_device_lost_callback_t *device_lost_cb;
+  void *device_lost_user_ptr;
+  /* fit_iso_bandwidth mode: lowest altsetting index to consider, raised on
+   * packet errors and kept across restarts, and the error rate window */
+  int iso_min_alt_idx;
+  int iso_alt_idx;
+  uint32_t iso_window_packets, iso_window_errors;
   struct uvc_frame frame;
   enum uvc_frame_format frame_format;
+  /** Built by uvc_stream_start() from cur_ctrl, which only changes while stopped */
+  struct uvc_frame_template frame_template;
   struct timespec capture_time_finished;
 
   /* raw metadata buffer if available */
   uint8_t *meta_outbuf, *meta_holdbuf;
   size_t meta_got_bytes, meta_hold_bytes;
+
+  /* pooled-frame mode, for streams with a callback: outbuf/meta_outbuf point
+   * into out_slot while streaming, completed slots wait in ready_slots, oldest
+   * first, until the user thread hands them out */
+  uint8_t pooled_frames;
+  /* the user keeps references past the callback (UVC_STREAM_FLAG_BORROWED_FRAMES) */
+  uint8_t borrowed_frames;
+  /* the callback runs in the transfer callbacks, there is no cb_thread */
+  uint8_t inline_callback;
+  uint32_t dropped_frames;
+  struct uvc_pooled_frame frame_pool[LIBUVC_NUM_FRAME_POOL_BUFS];
+  uint32_t frame_pool_size;
+  struct uvc_pooled_frame *out_slot;
+  struct uvc_pooled_frame *ready_slots[LIBUVC_NUM_FRAME_POOL_BUFS];
+  uint32_t ready_head, ready_count;
+  uint8_t *own_outbuf, *own_meta_outbuf;
 };
 
 /** Handle on an open UVC device
@@ -312,6 +454,9 @@ uvc_error_t uvc_query_stream_ctrl(
     enum uvc_req_code req);
 
 void uvc_start_handler_thread(uvc_context_t *ctx);
+void *uvc_buffer_alloc(size_t bytes);
+void *uvc_frame_buffer_alloc(size_t bytes);
+void uvc_buffer_free(void *buf);
 uvc_error_t uvc_claim_if(uvc_device_handle_t *devh, int idx);
 uvc_error_t uvc_release_if(uvc_device_handle_t *devh, int idx);
 
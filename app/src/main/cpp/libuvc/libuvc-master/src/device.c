@@ -56,6 +56,10 @@ uvc_error_t uvc_parse_vc_extension_unit(uvc_device_t *dev,
 					uvc_device_info_t *info,
 					const unsigned char *block,
 					size_t block_size);
+uvc_error_t uvc_parse_vc_encoding_unit(uvc_device_t *dev,
+				       uvc_device_info_t *info,
+				       const unsigned char *block,
+				       size_t block_size);
 uvc_error_t uvc_parse_vc_header(uvc_device_t *dev,
 				uvc_device_info_t *info,
 				const unsigned char *block, size_t block_size);
@@ -90,9 +94,18 @@ uvc_error_t uvc_parse_vs_frame_format(uvc_streaming_interface_t *stream_if,
 uvc_error_t uvc_parse_vs_frame_frame(uvc_streaming_interface_t *stream_if,
 					    const unsigned char *block,
 					    size_t block_size);
+uvc_error_t uvc_parse_vs_format_h264_vp8(uvc_streaming_interface_t *stream_if,
+					 const unsigned char *block,
+					 size_t block_size);
+uvc_error_t uvc_parse_vs_frame_h264_vp8(uvc_streaming_interface_t *stream_if,
+					const unsigned char *block,
+					size_t block_size);
 uvc_error_t uvc_parse_vs_input_header(uvc_streaming_interface_t *stream_if,
 				      const unsigned char *block,
 				      size_t block_size);
+uvc_error_t uvc_parse_vs_color_format(uvc_streaming_interface_t *stream_if,
+					const unsigned char *block,
+					size_t block_size);
 
 void LIBUSB_CALL _uvc_status_callback(struct libusb_transfer *transfer);
 
@@ -467,6 +480,7 @@ void uvc_free_device_info(uvc_device_info_t *info) {
   uvc_input_terminal_t *input_term, *input_term_tmp;
   uvc_processing_unit_t *proc_unit, *proc_unit_tmp;
   uvc_extension_unit_t *ext_unit, *ext_unit_tmp;
+  uvc_encoding_unit_t *enc_unit, *enc_unit_tmp;
 
   uvc_streaming_interface_t *stream_if, *stream_if_tmp;
   uvc_format_desc_t *format, *format_tmp;
@@ -491,6 +505,11 @@ void uvc_free_device_info(uvc_device_info_t *info) {
     free(ext_unit);
   }
 
+  DL_FOREACH_SAFE(info->ctrl_if.encoding_unit_descs, enc_unit, enc_unit_tmp) {
+    DL_DELETE(info->ctrl_if.encoding_unit_descs, enc_unit);
+    free(enc_unit);
+  }
+
   DL_FOREACH_SAFE(info->stream_ifs, stream_if, stream_if_tmp) {
     DL_FOREACH_SAFE(stream_if->format_descs, format, format_tmp) {
       DL_FOREACH_SAFE(format->frame_descs, frame, frame_tmp) {
@@ -841,6 +860,18 @@ libusb_device_handle *uvc_get_libusb_handle(uvc_device_handle_t *devh) {
   return devh->usb_devh;
 }
 
+/** @brief Get the number of the VideoControl interface
+ * @ingroup device
+ *
+ * Control requests to terminals and units carry it in wIndex next to the
+ * terminal or unit ID.
+ *
+ * @param devh UVC device handle to an open device
+ */
+uint8_t uvc_get_control_interface_number(uvc_device_handle_t *devh) {
+  return devh->info->ctrl_if.bInterfaceNumber;
+}
+
 /**
  * @brief Get camera terminal descriptor for the open device.
  *
@@ -929,6 +960,19 @@ const uvc_extension_unit_t *uvc_get_extension_units(uvc_device_handle_t *devh) {
   return devh->info->ctrl_if.extension_unit_descs;
 }
 
+/**
+ * @brief Get the UVC 1.5 encoding unit descriptors for the open device.
+ *
+ * @note Do not modify the returned structure.
+ * @note The returned structure is part of a linked list. Iterate through
+ *       it by using the 'next' pointers.
+ *
+ * @param devh Device handle to an open UVC device
+ */
+const uvc_encoding_unit_t *uvc_get_encoding_units(uvc_device_handle_t *devh) {
+  return devh->info->ctrl_if.encoding_unit_descs;
+}
+
 /**
  * @brief Increment the reference count for a device
  * @ingroup device
@@ -1138,6 +1182,7 @@ uvc_error_t uvc_parse_vc_header(uvc_device_t *dev,
     info->ctrl_if.dwClockFrequency = DW_TO_INT(block + 7);
     break;
   case 0x0110:
+  case 0x0150:
     break;
   default:
     UVC_EXIT(UVC_ERROR_NOT_SUPPORTED);
@@ -1266,6 +1311,43 @@ uvc_error_t uvc_parse_vc_extension_unit(uvc_device_t *dev,
   return UVC_SUCCESS;
 }
 
+/** @internal
+ * @brief Parse a UVC 1.5 VideoControl encoding unit.
+ * @ingroup device
+ */
+uvc_error_t uvc_parse_vc_encoding_unit(uvc_device_t *dev,
+				       uvc_device_info_t *info,
+				       const unsigned char *block, size_t block_size) {
+  uvc_encoding_unit_t *unit;
+  int size_of_controls;
+  int i;
+
+  UVC_ENTER();
+
+  /* bmControls and bmControlsRuntime follow bControlSize, which is 3 in
+   * UVC 1.5. Bits past the 32 defined ones are dropped. */
+  size_of_controls = block_size > 6 ? block[6] : 0;
+  if (block_size < 7 + 2 * (size_t) size_of_controls) {
+    UVC_EXIT(UVC_ERROR_INVALID_DEVICE);
+    return UVC_ERROR_INVALID_DEVICE;
+  }
+
+  unit = calloc(1, sizeof(*unit));
+  unit->bUnitID = block[3];
+  unit->bSourceID = block[4];
+
+  for (i = (size_of_controls < 4 ? size_of_controls : 4) - 1; i >= 0; --i) {
+    unit->bmControls = block[7 + i] + (unit->bmControls << 8);
+    unit->bmControlsRuntime =
+        block[7 + size_of_controls + i] + (unit->bmControlsRuntime << 8);
+  }
+
+  DL_APPEND(info->ctrl_if.encoding_unit_descs, unit);
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+}
+
 /** @internal
  * Process a single VideoControl descriptor block
  * @ingroup device
@@ -1304,6 +1386,9 @@ uvc_error_t uvc_parse_vc(
   case UVC_VC_EXTENSION_UNIT:
     ret = uvc_parse_vc_extension_unit(dev, info, block, block_size);
     break;
+  case UVC_VC_ENCODING_UNIT:
+    ret = uvc_parse_vc_encoding_unit(dev, info, block, block_size);
+    break;
   default:
     ret = UVC_ERROR_INVALID_DEVICE;
   }
@@ -1402,6 +1487,15 @@ uvc_error_t uvc_parse_vs_format_uncompressed(uvc_streaming_interface_t *stream_i
   return UVC_SUCCESS;
 }
 
+/** @internal
+ * @brief Bytes to expect of an encoded frame, whose descriptor gives no
+ * size: an NV12 frame of its resolution, which no sane encoder's IDR frame
+ * exceeds. Larger frames grow the stream's buffers.
+ */
+static uint32_t _uvc_encoded_frame_bytes(const uvc_frame_desc_t *frame) {
+  return (uint32_t) frame->wWidth * frame->wHeight * 3 / 2;
+}
+
 /** @internal
  * @brief Parse a VideoStreaming frame format block.
  * @ingroup device
@@ -1476,6 +1570,12 @@ uvc_error_t uvc_parse_vs_frame_frame(uvc_streaming_interface_t *stream_if,
 
   UVC_ENTER();
 
+  if (!stream_if->format_descs || block_size < 26 ||
+      block_size < 26 + 4 * (size_t) (block[21] ? block[21] : 3)) {
+    UVC_EXIT(UVC_ERROR_INVALID_DEVICE);
+    return UVC_ERROR_INVALID_DEVICE;
+  }
+
   format = stream_if->format_descs->prev;
   frame = calloc(1, sizeof(*frame));
 
@@ -1491,6 +1591,7 @@ uvc_error_t uvc_parse_vs_frame_frame(uvc_streaming_interface_t *stream_if,
   frame->dwDefaultFrameInterval = DW_TO_INT(&block[17]);
   frame->bFrameIntervalType = block[21];
   frame->dwBytesPerLine = DW_TO_INT(&block[22]);
+  frame->dwMaxVideoFrameBufferSize = _uvc_encoded_frame_bytes(frame);
 
   if (block[21] == 0) {
     frame->dwMinFrameInterval = DW_TO_INT(&block[26]);
@@ -1513,6 +1614,106 @@ uvc_error_t uvc_parse_vs_frame_frame(uvc_streaming_interface_t *stream_if,
   return UVC_SUCCESS;
 }
 
+/** @internal
+ * @brief Parse a UVC 1.5 H.264 or VP8 format block, simulcast or not.
+ *
+ * They carry no GUID, so the format takes the frame based format's, and
+ * the rest of libuvc treats both alike.
+ * @ingroup device
+ */
+uvc_error_t uvc_parse_vs_format_h264_vp8(uvc_streaming_interface_t *stream_if,
+					 const unsigned char *block,
+					 size_t block_size) {
+  static const uint8_t h264_guid[16] = {
+    'H',  '2',  '6',  '4', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+  static const uint8_t vp8_guid[16] = {
+    'V',  'P',  '8',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+  uvc_format_desc_t *format;
+
+  UVC_ENTER();
+
+  if (block_size < 6) {
+    UVC_EXIT(UVC_ERROR_INVALID_DEVICE);
+    return UVC_ERROR_INVALID_DEVICE;
+  }
+
+  format = calloc(1, sizeof(*format));
+  format->parent = stream_if;
+  format->bDescriptorSubtype = block[2];
+  format->bFormatIndex = block[3];
+  format->bNumFrameDescriptors = block[4];
+  format->bDefaultFrameIndex = block[5];
+  if (block[2] == UVC_VS_FORMAT_H264 || block[2] == UVC_VS_FORMAT_H264_SIMULCAST)
+    memcpy(format->guidFormat, h264_guid, 16);
+  else
+    memcpy(format->guidFormat, vp8_guid, 16);
+  format->bVariableSize = 1;
+
+  DL_APPEND(stream_if->format_descs, format);
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Parse a UVC 1.5 H.264 or VP8 frame block.
+ *
+ * Both list discrete frame intervals after the bit rates; the H.264 one
+ * has its profile, level and SVC and MVC capabilities in between.
+ * @ingroup device
+ */
+uvc_error_t uvc_parse_vs_frame_h264_vp8(uvc_streaming_interface_t *stream_if,
+					const unsigned char *block,
+					size_t block_size) {
+  uvc_format_desc_t *format;
+  uvc_frame_desc_t *frame;
+  size_t rates, count;
+  const unsigned char *p;
+  int i;
+
+  UVC_ENTER();
+
+  /* dwMinBitRate, its H.264 or VP8 offset */
+  rates = block[2] == UVC_VS_FRAME_H264 ? 31 : 18;
+  if (!stream_if->format_descs || block_size < rates + 13) {
+    UVC_EXIT(UVC_ERROR_INVALID_DEVICE);
+    return UVC_ERROR_INVALID_DEVICE;
+  }
+  count = block[rates + 12];
+  if (count == 0 || block_size < rates + 13 + 4 * count) {
+    UVC_EXIT(UVC_ERROR_INVALID_DEVICE);
+    return UVC_ERROR_INVALID_DEVICE;
+  }
+
+  format = stream_if->format_descs->prev;
+  frame = calloc(1, sizeof(*frame));
+
+  frame->parent = format;
+
+  frame->bDescriptorSubtype = block[2];
+  frame->bFrameIndex = block[3];
+  frame->wWidth = SW_TO_SHORT(&block[4]);
+  frame->wHeight = SW_TO_SHORT(&block[6]);
+  frame->dwMinBitRate = DW_TO_INT(&block[rates]);
+  frame->dwMaxBitRate = DW_TO_INT(&block[rates + 4]);
+  frame->dwDefaultFrameInterval = DW_TO_INT(&block[rates + 8]);
+  frame->bFrameIntervalType = count;
+  frame->dwMaxVideoFrameBufferSize = _uvc_encoded_frame_bytes(frame);
+
+  frame->intervals = calloc(count + 1, sizeof(frame->intervals[0]));
+  p = &block[rates + 13];
+  for (i = 0; i < (int) count; ++i) {
+    frame->intervals[i] = DW_TO_INT(p);
+    p += 4;
+  }
+  frame->intervals[count] = 0;
+
+  DL_APPEND(format->frame_descs, frame);
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+}
+
 /** @internal
  * @brief Parse a VideoStreaming uncompressed frame block.
  * @ingroup device
@@ -1628,6 +1829,31 @@ uvc_error_t uvc_parse_vs_still_image_frame(uvc_streaming_interface_t *stream_if,
   return UVC_SUCCESS;
 }
 
+/** @internal
+ * Parse a VideoStreaming color matching descriptor, which applies to the
+ * format before it.
+ * @ingroup device
+ */
+uvc_error_t uvc_parse_vs_color_format(uvc_streaming_interface_t *stream_if,
+					const unsigned char *block,
+					size_t block_size) {
+  uvc_format_desc_t *format;
+
+  UVC_ENTER();
+
+  if (stream_if->format_descs == NULL || block_size < 6) {
+    UVC_EXIT(UVC_SUCCESS);
+    return UVC_SUCCESS;
+  }
+  format = stream_if->format_descs->prev;
+  format->bColorPrimaries = block[3];
+  format->bTransferCharacteristics = block[4];
+  format->bMatrixCoefficients = block[5];
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+}
+
 /** @internal
  * Process a single VideoStreaming descriptor block
  * @ingroup device
@@ -1672,7 +1898,7 @@ uvc_error_t uvc_parse_vs(
     UVC_DEBUG("unsupported descriptor subtype VS_FORMAT_DV");
     break;
   case UVC_VS_COLORFORMAT:
-    UVC_DEBUG("unsupported descriptor subtype VS_COLORFORMAT");
+    ret = uvc_parse_vs_color_format(stream_if, block, block_size);
     break;
   case UVC_VS_FORMAT_FRAME_BASED:
     ret = uvc_parse_vs_frame_format ( stream_if, block, block_size );
@@ -1683,6 +1909,16 @@ uvc_error_t uvc_parse_vs(
   case UVC_VS_FORMAT_STREAM_BASED:
     UVC_DEBUG("unsupported descriptor subtype VS_FORMAT_STREAM_BASED");
     break;
+  case UVC_VS_FORMAT_H264:
+  case UVC_VS_FORMAT_H264_SIMULCAST:
+  case UVC_VS_FORMAT_VP8:
+  case UVC_VS_FORMAT_VP8_SIMULCAST:
+    ret = uvc_parse_vs_format_h264_vp8(stream_if, block, block_size);
+    break;
+  case UVC_VS_FRAME_H264:
+  case UVC_VS_FRAME_VP8:
+    ret = uvc_parse_vs_frame_h264_vp8(stream_if, block, block_size);
+    break;
   default:
     /** @todo handle JPEG and maybe still frames or even DV... */
     //UVC_DEBUG("unsupported descriptor subtype: %d",descriptor_subtype);
@@ -1975,3 +2211,34 @@ const uvc_format_desc_t *uvc_get_format_descs(uvc_device_handle_t *devh) {
   return devh->info->stream_ifs->format_descs;
 }
 
+/**
+ * @brief Get a VideoStreaming interface of the open device.
+ *
+ * @note Do not modify the returned structures.
+ *
+ * @param devh Device handle to an open UVC device
+ * @param index Position of the interface in descriptor order, from zero
+ * @param[out] interface_number bInterfaceNumber of the interface
+ * @param[out] still_capture_method bStillCaptureMethod of its input header
+ * @param[out] format_descs Its format descriptions, NULL when it has none
+ * @return UVC_ERROR_NOT_FOUND past the last interface
+ */
+uvc_error_t uvc_get_stream_interface(
+    uvc_device_handle_t *devh,
+    int index,
+    uint8_t *interface_number,
+    uint8_t *still_capture_method,
+    const uvc_format_desc_t **format_descs) {
+  uvc_streaming_interface_t *stream_if;
+
+  DL_FOREACH(devh->info->stream_ifs, stream_if) {
+    if (index-- == 0) {
+      *interface_number = stream_if->bInterfaceNumber;
+      *still_capture_method = stream_if->bStillCaptureMethod;
+      *format_descs = stream_if->format_descs;
+      return UVC_SUCCESS;
+    }
+  }
+  return UVC_ERROR_NOT_FOUND;
+}
+
@@ -129,6 +129,12 @@ static const char *_uvc_name_for_format_subtype(uint8_t subtype) {
     return "MJPEGFormat";
   case UVC_VS_FORMAT_FRAME_BASED:
     return "FrameFormat";
+  case UVC_VS_FORMAT_H264:
+  case UVC_VS_FORMAT_H264_SIMULCAST:
+    return "H264Format";
+  case UVC_VS_FORMAT_VP8:
+  case UVC_VS_FORMAT_VP8_SIMULCAST:
+    return "VP8Format";
   default:
     return "Unknown";
   }
@@ -180,6 +186,10 @@ void uvc_print_diag(uvc_device_handle_t *devh, FILE *stream) {
           case UVC_VS_FORMAT_UNCOMPRESSED:
           case UVC_VS_FORMAT_MJPEG:
           case UVC_VS_FORMAT_FRAME_BASED:
+          case UVC_VS_FORMAT_H264:
+          case UVC_VS_FORMAT_H264_SIMULCAST:
+          case UVC_VS_FORMAT_VP8:
+          case UVC_VS_FORMAT_VP8_SIMULCAST:
             fprintf(stream,
                 "\t\%s(%d)\n"
                 "\t\t  bits per pixel: %d\n"
@@ -304,6 +314,10 @@ void uvc_print_frameformats(uvc_device_handle_t *devh) {
           case UVC_VS_FORMAT_UNCOMPRESSED:
           case UVC_VS_FORMAT_MJPEG:
           case UVC_VS_FORMAT_FRAME_BASED:
+          case UVC_VS_FORMAT_H264:
+          case UVC_VS_FORMAT_H264_SIMULCAST:
+          case UVC_VS_FORMAT_VP8:
+          case UVC_VS_FORMAT_VP8_SIMULCAST:
             printf("         \%s(%d)\n"
                 "            bits per pixel: %d\n"
                 "            GUID: ",
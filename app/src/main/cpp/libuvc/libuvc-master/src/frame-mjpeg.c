@@ -122,7 +122,7 @@ static void insert_huff_tables(j_decompress_ptr dinfo) {
   COPY_HUFF_TABLE(dinfo, ac_huff_tbl_ptrs[1], ac_chromi);
 }
 
-static uvc_error_t uvc_mjpeg_convert(uvc_frame_t *in, uvc_frame_t *out) {
+static uvc_error_t uvc_mjpeg_convert(uvc_frame_t *in, uvc_frame_t *out, uint8_t scale_denom) {
   struct jpeg_decompress_struct dinfo;
   struct error_mgr jerr;
   size_t lines_read;
@@ -150,6 +150,9 @@ static uvc_error_t uvc_mjpeg_convert(uvc_frame_t *in, uvc_frame_t *out) {
     goto fail;
 
   dinfo.dct_method = JDCT_IFAST;
+  /* IDCT scaling: decode straight at 1/2, 1/4 or 1/8 of the coded size */
+  dinfo.scale_num = 1;
+  dinfo.scale_denom = scale_denom;
 
   jpeg_start_decompress(&dinfo);
 
@@ -193,7 +196,40 @@ uvc_error_t uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  return uvc_mjpeg_convert(in, out);
+  return uvc_mjpeg_convert(in, out, 1);
+}
+
+/** @brief Convert an MJPEG frame to RGB at a reduced size
+ * @ingroup frame
+ *
+ * Scales in the DCT domain while decoding, which is much cheaper than
+ * decoding at full size and scaling the RGB output.
+ *
+ * @param in MJPEG frame
+ * @param out RGB frame, ceil(width / scale_denom) x ceil(height / scale_denom)
+ * @param scale_denom 1, 2, 4 or 8
+ */
+uvc_error_t uvc_mjpeg2rgb_scaled(uvc_frame_t *in, uvc_frame_t *out, uint8_t scale_denom) {
+  if (in->frame_format != UVC_FRAME_FORMAT_MJPEG)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (scale_denom != 1 && scale_denom != 2 && scale_denom != 4 && scale_denom != 8)
+    return UVC_ERROR_INVALID_PARAM;
+
+  out->width = (in->width + scale_denom - 1) / scale_denom;
+  out->height = (in->height + scale_denom - 1) / scale_denom;
+
+  if (uvc_ensure_frame_size(out, out->width * out->height * 3) < 0)
+    return UVC_ERROR_NO_MEM;
+
+  out->frame_format = UVC_FRAME_FORMAT_RGB;
+  out->step = out->width * 3;
+  out->sequence = in->sequence;
+  out->capture_time = in->capture_time;
+  out->capture_time_finished = in->capture_time_finished;
+  out->source = in->source;
+
+  return uvc_mjpeg_convert(in, out, scale_denom);
 }
 
 /** @brief Convert an MJPEG frame to GRAY8
@@ -218,5 +254,5 @@ uvc_error_t uvc_mjpeg2gray(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  return uvc_mjpeg_convert(in, out);
+  return uvc_mjpeg_convert(in, out, 1);
 }
@@ -37,14 +37,73 @@
  */
 #include "libuvc/libuvc.h"
 #include "libuvc/libuvc_internal.h"
+#include "libyuv/convert_argb.h"
+#include "libyuv/convert_from_argb.h"
+#include "libyuv/planar_functions.h"
+
+static const uvc_buffer_allocator_t *buffer_allocator;
+
+/** Allocate frame and heap transfer buffers with a custom allocator
+ * @ingroup frame
+ *
+ * Frame data of uvc_allocate_frame(), the frame pool, the polling buffers and
+ * transfer buffers that are not usbfs memory come from the allocator. Must be
+ * set before any frame or stream is created, since buffers are freed by the
+ * allocator current at the time. NULL goes back to LIBUVC_BUFFER_ALIGNMENT
+ * aligned heap memory.
+ *
+ * @param allocator Allocator, kept by reference
+ */
+void uvc_set_buffer_allocator(const uvc_buffer_allocator_t *allocator) {
+  buffer_allocator = allocator;
+}
+
+/** @internal
+ * @brief Frame or transfer buffer of at least bytes, or NULL
+ */
+void *uvc_buffer_alloc(size_t bytes) {
+  void *buf;
+
+  if (buffer_allocator)
+    return buffer_allocator->alloc(bytes, buffer_allocator->user_ptr);
+  if (posix_memalign(&buf, LIBUVC_BUFFER_ALIGNMENT, bytes ? bytes : 1))
+    return NULL;
+  return buf;
+}
+
+/** @internal
+ * @brief Frame pool slot of at least bytes, or NULL. Comes from the
+ * allocator's alloc_frame when it has one, which consumers may import
+ * frames of without a copy.
+ */
+void *uvc_frame_buffer_alloc(size_t bytes) {
+  if (buffer_allocator && buffer_allocator->alloc_frame)
+    return buffer_allocator->alloc_frame(bytes, buffer_allocator->user_ptr);
+  return uvc_buffer_alloc(bytes);
+}
+
+/** @internal
+ * @brief Free a buffer of uvc_buffer_alloc() or uvc_frame_buffer_alloc()
+ */
+void uvc_buffer_free(void *buf) {
+  if (!buf)
+    return;
+  if (buffer_allocator)
+    buffer_allocator->free(buf, buffer_allocator->user_ptr);
+  else
+    free(buf);
+}
 
 /** @internal */
 uvc_error_t uvc_ensure_frame_size(uvc_frame_t *frame, size_t need_bytes) {
   if (frame->library_owns_data) {
-    if (!frame->data || frame->data_bytes != need_bytes) {
-      frame->data_bytes = need_bytes;
-      frame->data = realloc(frame->data, frame->data_bytes);
+    if (!frame->data || frame->data_bytes < need_bytes) {
+      /* conversions overwrite the whole frame, nothing to copy */
+      uvc_buffer_free(frame->data);
+      frame->data = uvc_buffer_alloc(need_bytes);
     }
+    /* a larger buffer is kept, data_bytes being the size of the image in it */
+    frame->data_bytes = frame->data ? need_bytes : 0;
     if (!frame->data)
       return UVC_ERROR_NO_MEM;
     return UVC_SUCCESS;
@@ -73,7 +132,7 @@ uvc_frame_t *uvc_allocate_frame(size_t data_bytes) {
 
   if (data_bytes > 0) {
     frame->data_bytes = data_bytes;
-    frame->data = malloc(data_bytes);
+    frame->data = uvc_buffer_alloc(data_bytes);
 
     if (!frame->data) {
       free(frame);
@@ -92,8 +151,7 @@ uvc_frame_t *uvc_allocate_frame(size_t data_bytes) {
 void uvc_free_frame(uvc_frame_t *frame) {
   if (frame->library_owns_data)
   {
-    if (frame->data_bytes > 0)
-      free(frame->data);
+    uvc_buffer_free(frame->data);
     if (frame->metadata_bytes > 0)
       free(frame->metadata);
   }
@@ -101,8 +159,139 @@ void uvc_free_frame(uvc_frame_t *frame) {
   free(frame);
 }
 
-static inline unsigned char sat(int i) {
-  return (unsigned char)( i >= 255 ? 255 : (i < 0 ? 0 : i));
+/* KSCAMERA_METADATA_ITEMHEADER ids of the UVC 1.5 metadata format */
+#define META_ID_USB_VIDEO_HEADER 2u
+#define META_ID_CAPTURE_STATS 3u
+#define META_ID_FACE_DETECTION 0x80000001u
+
+/* KSCAMERA_METADATA_CAPTURESTATS flags */
+#define CAPTURE_STATS_EXPOSURE_TIME 0x1u
+#define CAPTURE_STATS_EXPOSURE_COMPENSATION 0x2u
+#define CAPTURE_STATS_ISO_SPEED 0x4u
+#define CAPTURE_STATS_FOCUS_STATE 0x8u
+#define CAPTURE_STATS_LENS_POSITION 0x10u
+#define CAPTURE_STATS_WHITE_BALANCE 0x20u
+
+static uint64_t qw_to_int(const uint8_t *p) {
+  return (uint64_t) (uint32_t) DW_TO_INT(p) | (uint64_t) (uint32_t) DW_TO_INT(p + 4) << 32;
+}
+
+static void parse_capture_stats(const uint8_t *item, uint32_t size, uvc_frame_meta_t *meta) {
+  uint32_t stats;
+
+  /* Flags, Reserved, ExposureTime, ExposureCompensationFlags,
+   * ExposureCompensationValue, IsoSpeed, FocusState, LensPosition, WhiteBalance
+   * after the item header, then fields that are not decoded */
+  if (size < 52)
+    return;
+  stats = DW_TO_INT(item + 8);
+  if (stats & CAPTURE_STATS_EXPOSURE_TIME) {
+    meta->exposure_time = qw_to_int(item + 16);
+    meta->flags |= UVC_FRAME_META_EXPOSURE_TIME;
+  }
+  if (stats & CAPTURE_STATS_EXPOSURE_COMPENSATION) {
+    meta->exposure_compensation = (int32_t) DW_TO_INT(item + 32);
+    meta->flags |= UVC_FRAME_META_EXPOSURE_COMPENSATION;
+  }
+  if (stats & CAPTURE_STATS_ISO_SPEED) {
+    meta->iso_speed = DW_TO_INT(item + 36);
+    meta->flags |= UVC_FRAME_META_ISO_SPEED;
+  }
+  if (stats & CAPTURE_STATS_FOCUS_STATE) {
+    meta->focus_state = DW_TO_INT(item + 40);
+    meta->flags |= UVC_FRAME_META_FOCUS_STATE;
+  }
+  if (stats & CAPTURE_STATS_LENS_POSITION) {
+    meta->lens_position = DW_TO_INT(item + 44);
+    meta->flags |= UVC_FRAME_META_LENS_POSITION;
+  }
+  if (stats & CAPTURE_STATS_WHITE_BALANCE) {
+    meta->white_balance = DW_TO_INT(item + 48);
+    meta->flags |= UVC_FRAME_META_WHITE_BALANCE;
+  }
+}
+
+static void parse_faces(const uint8_t *item, uint32_t size, uvc_frame_meta_t *meta) {
+  uint32_t count, stride, i;
+
+  /* Count, Flags and Timestamp, then Count entries that start with a RECT */
+  if (size < 8 + 16)
+    return;
+  count = DW_TO_INT(item + 8);
+  if (count == 0) {
+    meta->flags |= UVC_FRAME_META_FACES;
+    return;
+  }
+  stride = (size - 24) / count;
+  if (stride < 16)
+    return;
+  if (count > UVC_FRAME_META_MAX_FACES)
+    count = UVC_FRAME_META_MAX_FACES;
+  for (i = 0; i < count; i++) {
+    const uint8_t *rect = item + 24 + i * stride;
+    meta->faces[i].left = (int32_t) DW_TO_INT(rect);
+    meta->faces[i].top = (int32_t) DW_TO_INT(rect + 4);
+    meta->faces[i].right = (int32_t) DW_TO_INT(rect + 8);
+    meta->faces[i].bottom = (int32_t) DW_TO_INT(rect + 12);
+  }
+  meta->face_count = (uint8_t) count;
+  meta->flags |= UVC_FRAME_META_FACES;
+}
+
+/** @brief Decode the metadata items of a frame
+ * @ingroup frame
+ *
+ * Walks the KSCAMERA_METADATA_ITEMHEADER items (id, size including the
+ * header) that UVC 1.5 devices append to their payload headers, taking what
+ * it knows from the UsbVideoHeader, CaptureStats and face detection items
+ * and skipping the rest. Stops at the first malformed item. Clears meta
+ * first, including scr_sof, which comes from the payload headers instead.
+ *
+ * @param metadata Frame metadata, as in uvc_frame_t, or NULL
+ * @param bytes Size of metadata
+ * @param meta Decoded fields
+ */
+void uvc_parse_frame_meta(const void *metadata, size_t bytes, uvc_frame_meta_t *meta) {
+  const uint8_t *p = metadata;
+  size_t offset = 0;
+
+  memset(meta, 0, sizeof(*meta));
+  if (!p)
+    return;
+
+  while (bytes - offset >= 8) {
+    uint32_t id = DW_TO_INT(p + offset);
+    uint32_t size = DW_TO_INT(p + offset + 4);
+
+    if (size < 8 || size > bytes - offset)
+      break;
+
+    switch (id) {
+    case META_ID_USB_VIDEO_HEADER:
+      /* bLength, bmHeaderInfo, then PTS and SCR as flagged */
+      if (size >= 8 + 2) {
+        const uint8_t *header = p + offset + 8;
+        size_t at = 2;
+        if ((header[1] & (1 << 2)) && size >= 8 + at + 4) {
+          meta->header_pts = DW_TO_INT(header + at);
+          at += 4;
+        }
+        if ((header[1] & (1 << 3)) && size >= 8 + at + 6)
+          meta->header_scr = DW_TO_INT(header + at);
+        meta->flags |= UVC_FRAME_META_USB_VIDEO_HEADER;
+      }
+      break;
+    case META_ID_CAPTURE_STATS:
+      parse_capture_stats(p + offset, size, meta);
+      break;
+    case META_ID_FACE_DETECTION:
+      parse_faces(p + offset, size, meta);
+      break;
+    default:
+      break;
+    }
+    offset += size;
+  }
 }
 
 /** @brief Duplicate a frame, preserving color format
@@ -123,6 +312,9 @@ uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->pts = in->pts;
+  out->last_scr = in->last_scr;
+  out->meta = in->meta;
 
   memcpy(out->data, in->data, in->data_bytes);
 
@@ -139,82 +331,64 @@ uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out) {
   return UVC_SUCCESS;
 }
 
-#define YUYV2RGB_2(pyuv, prgb) { \
-    float r = 1.402f * ((pyuv)[3]-128); \
-    float g = -0.34414f * ((pyuv)[1]-128) - 0.71414f * ((pyuv)[3]-128); \
-    float b = 1.772f * ((pyuv)[1]-128); \
-    (prgb)[0] = sat(pyuv[0] + r); \
-    (prgb)[1] = sat(pyuv[0] + g); \
-    (prgb)[2] = sat(pyuv[0] + b); \
-    (prgb)[3] = sat(pyuv[2] + r); \
-    (prgb)[4] = sat(pyuv[2] + g); \
-    (prgb)[5] = sat(pyuv[2] + b); \
-    }
-#define IYUYV2RGB_2(pyuv, prgb) { \
-    int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
-    (prgb)[0] = sat(*(pyuv) + r); \
-    (prgb)[1] = sat(*(pyuv) + g); \
-    (prgb)[2] = sat(*(pyuv) + b); \
-    (prgb)[3] = sat((pyuv)[2] + r); \
-    (prgb)[4] = sat((pyuv)[2] + g); \
-    (prgb)[5] = sat((pyuv)[2] + b); \
-    }
-#define IYUYV2RGB_16(pyuv, prgb) IYUYV2RGB_8(pyuv, prgb); IYUYV2RGB_8(pyuv + 16, prgb + 24);
-#define IYUYV2RGB_8(pyuv, prgb) IYUYV2RGB_4(pyuv, prgb); IYUYV2RGB_4(pyuv + 8, prgb + 12);
-#define IYUYV2RGB_4(pyuv, prgb) IYUYV2RGB_2(pyuv, prgb); IYUYV2RGB_2(pyuv + 4, prgb + 6);
-
-/** @brief Convert a frame from YUYV to RGB
- * @ingroup frame
- *
- * @param in YUYV frame
- * @param out RGB frame
- */
-uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
-    return UVC_ERROR_INVALID_PARAM;
-
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
+/* Packed 4:2:2 to packed 24-bit RGB through a one row ARGB buffer, with the
+ * full range BT.601 matrix the scalar converters used. libyuv names formats
+ * by little endian word order, so its RGB24 is B, G, R in memory (libuvc BGR)
+ * and RAW is R, G, B (libuvc RGB). */
+static uvc_error_t uvc_yuv422_to_rgb24(uvc_frame_t *in, uvc_frame_t *out,
+                                      enum uvc_frame_format out_format) {
+  const int uyvy = in->frame_format == UVC_FRAME_FORMAT_UYVY;
+  const int width = in->width;
+  const int height = in->height;
+  const int in_step = in->step ? in->step : width * 2;
+  uint8_t *argb;
+  int y;
+
+  if (uvc_ensure_frame_size(out, (size_t)width * height * 3) < 0)
+    return UVC_ERROR_NO_MEM;
+  argb = uvc_buffer_alloc((size_t)width * 4);
+  if (!argb)
     return UVC_ERROR_NO_MEM;
 
   out->width = in->width;
   out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_RGB;
+  out->frame_format = out_format;
   out->step = in->width * 3;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *prgb = out->data;
-  uint8_t *prgb_end = prgb + out->data_bytes;
-
-  while (prgb < prgb_end) {
-    IYUYV2RGB_8(pyuv, prgb);
-
-    prgb += 3 * 8;
-    pyuv += 2 * 8;
+  for (y = 0; y < height; y++) {
+    const uint8_t *src = (const uint8_t *)in->data + (size_t)y * in_step;
+    uint8_t *dst = (uint8_t *)out->data + (size_t)y * out->step;
+
+    if (uyvy)
+      UYVYToARGBMatrix(src, in_step, argb, width * 4, &kYuvJPEGConstants, width, 1);
+    else
+      YUY2ToARGBMatrix(src, in_step, argb, width * 4, &kYuvJPEGConstants, width, 1);
+    if (out_format == UVC_FRAME_FORMAT_RGB)
+      ARGBToRAW(argb, width * 4, dst, out->step, width, 1);
+    else
+      ARGBToRGB24(argb, width * 4, dst, out->step, width, 1);
   }
 
+  uvc_buffer_free(argb);
   return UVC_SUCCESS;
 }
 
-#define IYUYV2BGR_2(pyuv, pbgr) { \
-    int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
-    (pbgr)[0] = sat(*(pyuv) + b); \
-    (pbgr)[1] = sat(*(pyuv) + g); \
-    (pbgr)[2] = sat(*(pyuv) + r); \
-    (pbgr)[3] = sat((pyuv)[2] + b); \
-    (pbgr)[4] = sat((pyuv)[2] + g); \
-    (pbgr)[5] = sat((pyuv)[2] + r); \
-    }
-#define IYUYV2BGR_16(pyuv, pbgr) IYUYV2BGR_8(pyuv, pbgr); IYUYV2BGR_8(pyuv + 16, pbgr + 24);
-#define IYUYV2BGR_8(pyuv, pbgr) IYUYV2BGR_4(pyuv, pbgr); IYUYV2BGR_4(pyuv + 8, pbgr + 12);
-#define IYUYV2BGR_4(pyuv, pbgr) IYUYV2BGR_2(pyuv, pbgr); IYUYV2BGR_2(pyuv + 4, pbgr + 6);
+/** @brief Convert a frame from YUYV to RGB
+ * @ingroup frame
+ *
+ * @param in YUYV frame
+ * @param out RGB frame
+ */
+uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+  if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
+    return UVC_ERROR_INVALID_PARAM;
+
+  return uvc_yuv422_to_rgb24(in, out, UVC_FRAME_FORMAT_RGB);
+}
 
 /** @brief Convert a frame from YUYV to BGR
  * @ingroup frame
@@ -226,47 +400,22 @@ uvc_error_t uvc_yuyv2bgr(uvc_frame_t *in, uvc_frame_t *out) {
   if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
-    return UVC_ERROR_NO_MEM;
-
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_BGR;
-  out->step = in->width * 3;
-  out->sequence = in->sequence;
-  out->capture_time = in->capture_time;
-  out->capture_time_finished = in->capture_time_finished;
-  out->source = in->source;
-
-  uint8_t *pyuv = in->data;
-  uint8_t *pbgr = out->data;
-  uint8_t *pbgr_end = pbgr + out->data_bytes;
-
-  while (pbgr < pbgr_end) {
-    IYUYV2BGR_8(pyuv, pbgr);
-
-    pbgr += 3 * 8;
-    pyuv += 2 * 8;
-  }
-
-  return UVC_SUCCESS;
+  return uvc_yuv422_to_rgb24(in, out, UVC_FRAME_FORMAT_BGR);
 }
 
-#define IYUYV2Y(pyuv, py) { \
-    (py)[0] = (pyuv[0]); \
-    }
+/* Every other byte of each YUYV row, starting at offset, into a GRAY8 frame */
+static uvc_error_t uvc_yuyv_pick(uvc_frame_t *in, uvc_frame_t *out, int offset) {
+  const int width = in->width;
+  const int height = in->height;
+  const int in_step = in->step ? in->step : width * 2;
+  const uint8_t *last;
+  uint8_t *dst;
+  int x;
 
-/** @brief Convert a frame from YUYV to Y (GRAY8)
- * @ingroup frame
- *
- * @param in YUYV frame
- * @param out GRAY8 frame
- */
-uvc_error_t uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out) {
   if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height) < 0)
+  if (uvc_ensure_frame_size(out, (size_t)width * height) < 0)
     return UVC_ERROR_NO_MEM;
 
   out->width = in->width;
@@ -278,75 +427,47 @@ uvc_error_t uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *py = out->data;
-  uint8_t *py_end = py + out->data_bytes;
-
-  while (py < py_end) {
-    IYUYV2Y(pyuv, py);
+  if (height <= 0)
+    return UVC_SUCCESS;
 
-    py += 1;
-    pyuv += 2;
+  /* YUY2ToY keeps the even bytes; one byte in it keeps the odd ones, but would
+   * then read one byte past the frame on the last row, done by hand instead */
+  if (offset == 0) {
+    YUY2ToY(in->data, in_step, out->data, out->step, width, height);
+    return UVC_SUCCESS;
   }
+  YUY2ToY((const uint8_t *)in->data + offset, in_step, out->data, out->step,
+          width, height - 1);
+  last = (const uint8_t *)in->data + (size_t)(height - 1) * in_step + offset;
+  dst = (uint8_t *)out->data + (size_t)(height - 1) * out->step;
+  for (x = 0; x < width; x++)
+    dst[x] = last[2 * x];
 
   return UVC_SUCCESS;
 }
 
-#define IYUYV2UV(pyuv, puv) { \
-    (puv)[0] = (pyuv[1]); \
-    }
+/** @brief Convert a frame from YUYV to Y (GRAY8)
+ * @ingroup frame
+ *
+ * @param in YUYV frame
+ * @param out GRAY8 frame
+ */
+uvc_error_t uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out) {
+  return uvc_yuyv_pick(in, out, 0);
+}
 
 /** @brief Convert a frame from YUYV to UV (GRAY8)
  * @ingroup frame
  *
+ * Interleaved U and V, one chroma sample per pixel.
+ *
  * @param in YUYV frame
  * @param out GRAY8 frame
  */
 uvc_error_t uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
-    return UVC_ERROR_INVALID_PARAM;
-
-  if (uvc_ensure_frame_size(out, in->width * in->height) < 0)
-    return UVC_ERROR_NO_MEM;
-
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_GRAY8;
-  out->step = in->width;
-  out->sequence = in->sequence;
-  out->capture_time = in->capture_time;
-  out->capture_time_finished = in->capture_time_finished;
-  out->source = in->source;
-
-  uint8_t *pyuv = in->data;
-  uint8_t *puv = out->data;
-  uint8_t *puv_end = puv + out->data_bytes;
-
-  while (puv < puv_end) {
-    IYUYV2UV(pyuv, puv);
-
-    puv += 1;
-    pyuv += 2;
-  }
-
-  return UVC_SUCCESS;
+  return uvc_yuyv_pick(in, out, 1);
 }
 
-#define IUYVY2RGB_2(pyuv, prgb) { \
-    int r = (22987 * ((pyuv)[2] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[0] - 128) - 11698 * ((pyuv)[2] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[0] - 128)) >> 14; \
-    (prgb)[0] = sat((pyuv)[1] + r); \
-    (prgb)[1] = sat((pyuv)[1] + g); \
-    (prgb)[2] = sat((pyuv)[1] + b); \
-    (prgb)[3] = sat((pyuv)[3] + r); \
-    (prgb)[4] = sat((pyuv)[3] + g); \
-    (prgb)[5] = sat((pyuv)[3] + b); \
-    }
-#define IUYVY2RGB_16(pyuv, prgb) IUYVY2RGB_8(pyuv, prgb); IUYVY2RGB_8(pyuv + 16, prgb + 24);
-#define IUYVY2RGB_8(pyuv, prgb) IUYVY2RGB_4(pyuv, prgb); IUYVY2RGB_4(pyuv + 8, prgb + 12);
-#define IUYVY2RGB_4(pyuv, prgb) IUYVY2RGB_2(pyuv, prgb); IUYVY2RGB_2(pyuv + 4, prgb + 6);
-
 /** @brief Convert a frame from UYVY to RGB
  * @ingroup frame
  * @param ini UYVY frame
@@ -356,47 +477,9 @@ uvc_error_t uvc_uyvy2rgb(uvc_frame_t *in, uvc_frame_t *out) {
   if (in->frame_format != UVC_FRAME_FORMAT_UYVY)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
-    return UVC_ERROR_NO_MEM;
-
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_RGB;
-  out->step = in->width *3;
-  out->sequence = in->sequence;
-  out->capture_time = in->capture_time;
-  out->capture_time_finished = in->capture_time_finished;
-  out->source = in->source;
-
-  uint8_t *pyuv = in->data;
-  uint8_t *prgb = out->data;
-  uint8_t *prgb_end = prgb + out->data_bytes;
-
-  while (prgb < prgb_end) {
-    IUYVY2RGB_8(pyuv, prgb);
-
-    prgb += 3 * 8;
-    pyuv += 2 * 8;
-  }
-
-  return UVC_SUCCESS;
+  return uvc_yuv422_to_rgb24(in, out, UVC_FRAME_FORMAT_RGB);
 }
 
-#define IUYVY2BGR_2(pyuv, pbgr) { \
-    int r = (22987 * ((pyuv)[2] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[0] - 128) - 11698 * ((pyuv)[2] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[0] - 128)) >> 14; \
-    (pbgr)[0] = sat((pyuv)[1] + b); \
-    (pbgr)[1] = sat((pyuv)[1] + g); \
-    (pbgr)[2] = sat((pyuv)[1] + r); \
-    (pbgr)[3] = sat((pyuv)[3] + b); \
-    (pbgr)[4] = sat((pyuv)[3] + g); \
-    (pbgr)[5] = sat((pyuv)[3] + r); \
-    }
-#define IUYVY2BGR_16(pyuv, pbgr) IUYVY2BGR_8(pyuv, pbgr); IUYVY2BGR_8(pyuv + 16, pbgr + 24);
-#define IUYVY2BGR_8(pyuv, pbgr) IUYVY2BGR_4(pyuv, pbgr); IUYVY2BGR_4(pyuv + 8, pbgr + 12);
-#define IUYVY2BGR_4(pyuv, pbgr) IUYVY2BGR_2(pyuv, pbgr); IUYVY2BGR_2(pyuv + 4, pbgr + 6);
-
 /** @brief Convert a frame from UYVY to BGR
  * @ingroup frame
  * @param ini UYVY frame
@@ -406,30 +489,7 @@ uvc_error_t uvc_uyvy2bgr(uvc_frame_t *in, uvc_frame_t *out) {
   if (in->frame_format != UVC_FRAME_FORMAT_UYVY)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
-    return UVC_ERROR_NO_MEM;
-
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_BGR;
-  out->step = in->width *3;
-  out->sequence = in->sequence;
-  out->capture_time = in->capture_time;
-  out->capture_time_finished = in->capture_time_finished;
-  out->source = in->source;
-
-  uint8_t *pyuv = in->data;
-  uint8_t *pbgr = out->data;
-  uint8_t *pbgr_end = pbgr + out->data_bytes;
-
-  while (pbgr < pbgr_end) {
-    IUYVY2BGR_8(pyuv, pbgr);
-
-    pbgr += 3 * 8;
-    pyuv += 2 * 8;
-  }
-
-  return UVC_SUCCESS;
+  return uvc_yuv422_to_rgb24(in, out, UVC_FRAME_FORMAT_BGR);
 }
 
 /** @brief Convert a frame to RGB
@@ -40,6 +40,12 @@
 #include "libuvc/libuvc_internal.h"
 #include "errno.h"
 
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #ifdef _MSC_VER
 
 #define DELTA_EPOCH_IN_MICROSECS  116444736000000000Ui64
@@ -72,9 +78,15 @@ uvc_frame_desc_t *uvc_find_frame_desc(uvc_device_handle_t *devh,
     uint16_t format_id, uint16_t frame_id);
 void *_uvc_user_caller(void *arg);
 void _uvc_populate_frame(uvc_stream_handle_t *strmh);
+uvc_frame_t *_uvc_populate_borrowed_frame(
+    uvc_stream_handle_t *strmh,
+    struct uvc_pooled_frame *slot);
 
 static uvc_streaming_interface_t *_uvc_get_stream_if(uvc_device_handle_t *devh, int interface_idx);
+static void _uvc_build_frame_template(uvc_stream_handle_t *strmh, uvc_frame_desc_t *frame_desc);
 static uvc_stream_handle_t *_uvc_get_stream_by_interface(uvc_device_handle_t *devh, int interface_idx);
+static void _uvc_stash_frame_buffer(void *buf, size_t bytes);
+static void *_uvc_take_frame_buffer(size_t min_bytes, size_t *bytes);
 
 struct format_table_entry {
   enum uvc_frame_format format;
@@ -135,12 +147,37 @@ struct format_table_entry *_get_format_entry(enum uvc_frame_format format) {
       {'R',  'G',  'G',  'B', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
     FMT(UVC_FRAME_FORMAT_SBGGR8,
       {'B',  'G',  'G',  'R', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
-    ABS_FMT(UVC_FRAME_FORMAT_COMPRESSED, 2,
-      {UVC_FRAME_FORMAT_MJPEG, UVC_FRAME_FORMAT_H264})
+    ABS_FMT(UVC_FRAME_FORMAT_COMPRESSED, 5,
+      {UVC_FRAME_FORMAT_MJPEG, UVC_FRAME_FORMAT_H264, UVC_FRAME_FORMAT_H265,
+       UVC_FRAME_FORMAT_VP8, UVC_FRAME_FORMAT_VP9})
     FMT(UVC_FRAME_FORMAT_MJPEG,
       {'M',  'J',  'P',  'G'})
     FMT(UVC_FRAME_FORMAT_H264,
       {'H',  '2',  '6',  '4', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_H265,
+      {'H',  '2',  '6',  '5', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_VP8,
+      {'V',  'P',  '8',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_VP9,
+      {'V',  'P',  '9',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SGRBG10,
+      {'B',  'A',  '1',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SGBRG10,
+      {'G',  'B',  '1',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SRGGB10,
+      {'R',  'G',  '1',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SBGGR10,
+      {'B',  'G',  '1',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SGRBG16,
+      {'G',  'R',  '1',  '6', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SGBRG16,
+      {'G',  'B',  '1',  '6', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SRGGB16,
+      {'R',  'G',  '1',  '6', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_SBGGR16,
+      {'B',  'Y',  'R',  '2', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_Z16,
+      {'Z',  '1',  '6',  ' ', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
 
     default:
       return NULL;
@@ -150,6 +187,29 @@ struct format_table_entry *_get_format_entry(enum uvc_frame_format format) {
   #undef FMT
 }
 
+/** @internal
+ * Other GUIDs cameras use for a format of the table, such as the 'HEVC'
+ * media subtype of Windows for H.265
+ */
+static const struct {
+  enum uvc_frame_format format;
+  uint8_t guid[16];
+} _uvc_format_aliases[] = {
+  {UVC_FRAME_FORMAT_H265,
+    {'H',  'E',  'V',  'C', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71}},
+};
+
+static enum uvc_frame_format _uvc_frame_format_for_alias(const uint8_t guid[16]) {
+  size_t i;
+
+  for (i = 0; i < sizeof(_uvc_format_aliases) / sizeof(_uvc_format_aliases[0]); ++i) {
+    if (!memcmp(guid, _uvc_format_aliases[i].guid, 16))
+      return _uvc_format_aliases[i].format;
+  }
+
+  return UVC_FRAME_FORMAT_UNKNOWN;
+}
+
 static uint8_t _uvc_frame_format_matches_guid(enum uvc_frame_format fmt, uint8_t guid[16]) {
   struct format_table_entry *format;
   int child_idx;
@@ -158,7 +218,8 @@ static uint8_t _uvc_frame_format_matches_guid(enum uvc_frame_format fmt, uint8_t
   if (!format)
     return 0;
 
-  if (!format->abstract_fmt && !memcmp(guid, format->guid, 16))
+  if (!format->abstract_fmt &&
+      (!memcmp(guid, format->guid, 16) || _uvc_frame_format_for_alias(guid) == fmt))
     return 1;
 
   for (child_idx = 0; child_idx < format->children_count; child_idx++) {
@@ -181,7 +242,7 @@ static enum uvc_frame_format uvc_frame_format_for_guid(uint8_t guid[16]) {
       return format->format;
   }
 
-  return UVC_FRAME_FORMAT_UNKNOWN;
+  return _uvc_frame_format_for_alias(guid);
 }
 
 /** @internal
@@ -196,13 +257,15 @@ uvc_error_t uvc_query_stream_ctrl(
     uvc_stream_ctrl_t *ctrl,
     uint8_t probe,
     enum uvc_req_code req) {
-  uint8_t buf[34];
+  uint8_t buf[48];
   size_t len;
   uvc_error_t err;
 
   memset(buf, 0, sizeof(buf));
 
-  if (devh->info->ctrl_if.bcdUVC >= 0x0110)
+  if (devh->info->ctrl_if.bcdUVC >= 0x0150)
+    len = 48;
+  else if (devh->info->ctrl_if.bcdUVC >= 0x0110)
     len = 34;
   else
     len = 26;
@@ -221,7 +284,7 @@ uvc_error_t uvc_query_stream_ctrl(
     INT_TO_DW(ctrl->dwMaxVideoFrameSize, buf + 18);
     INT_TO_DW(ctrl->dwMaxPayloadTransferSize, buf + 22);
 
-    if (len == 34) {
+    if (len >= 34) {
       INT_TO_DW ( ctrl->dwClockFrequency, buf + 26 );
       buf[30] = ctrl->bmFramingInfo;
       buf[31] = ctrl->bPreferredVersion;
@@ -229,6 +292,15 @@ uvc_error_t uvc_query_stream_ctrl(
       buf[33] = ctrl->bMaxVersion;
       /** @todo support UVC 1.1 */
     }
+    if (len == 48) {
+      buf[34] = ctrl->bUsage;
+      buf[35] = ctrl->bBitDepthLuma;
+      buf[36] = ctrl->bmSettings;
+      buf[37] = ctrl->bMaxNumberOfRefFramesPlus1;
+      SHORT_TO_SW(ctrl->bmRateControlModes, buf + 38);
+      INT_TO_DW((uint32_t) ctrl->bmLayoutPerStream, buf + 40);
+      INT_TO_DW((uint32_t) (ctrl->bmLayoutPerStream >> 32), buf + 44);
+    }
   }
 
   /* do the transfer */
@@ -259,7 +331,7 @@ uvc_error_t uvc_query_stream_ctrl(
     ctrl->dwMaxVideoFrameSize = DW_TO_INT(buf + 18);
     ctrl->dwMaxPayloadTransferSize = DW_TO_INT(buf + 22);
 
-    if (len == 34) {
+    if (len >= 34) {
       ctrl->dwClockFrequency = DW_TO_INT ( buf + 26 );
       ctrl->bmFramingInfo = buf[30];
       ctrl->bPreferredVersion = buf[31];
@@ -270,6 +342,18 @@ uvc_error_t uvc_query_stream_ctrl(
     else
       ctrl->dwClockFrequency = devh->info->ctrl_if.dwClockFrequency;
 
+    /* The device's answer is what a later SET_CUR of the H.264 or VP8
+     * payload sends back unless the host changes it. */
+    if (len == 48) {
+      ctrl->bUsage = buf[34];
+      ctrl->bBitDepthLuma = buf[35];
+      ctrl->bmSettings = buf[36];
+      ctrl->bMaxNumberOfRefFramesPlus1 = buf[37];
+      ctrl->bmRateControlModes = SW_TO_SHORT(buf + 38);
+      ctrl->bmLayoutPerStream =
+          (uint32_t) DW_TO_INT(buf + 40) | (uint64_t) (uint32_t) DW_TO_INT(buf + 44) << 32;
+    }
+
     /* fix up block for cameras that fail to set dwMax* */
     if (ctrl->dwMaxVideoFrameSize == 0) {
       uvc_frame_desc_t *frame = uvc_find_frame_desc(devh, ctrl->bFormatIndex, ctrl->bFrameIndex);
@@ -337,9 +421,11 @@ uvc_error_t uvc_query_still_ctrl(
   return UVC_SUCCESS;
 }
 
-/** Initiate a method 2 (in stream) still capture
+/** Initiate a method 2 (in stream) or method 3 (bulk still endpoint) still capture
  * @ingroup streaming
  *
+ * Method 3 stills are read from uvc_get_still_endpoint() by the caller.
+ *
  * @param[in] devh Device handle
  * @param[in] still_ctrl Still capture control block
  */
@@ -351,18 +437,19 @@ uvc_error_t uvc_trigger_still(
   uint8_t buf;
   uvc_error_t err;
 
-  /* Stream must be running for method 2 to work */
+  /* Stream must be running for method 2 and 3 to work */
   stream = _uvc_get_stream_by_interface(devh, still_ctrl->bInterfaceNumber);
   if (!stream || !stream->running)
     return UVC_ERROR_NOT_SUPPORTED;
 
-  /* Only method 2 is supported */
   stream_if = _uvc_get_stream_if(devh, still_ctrl->bInterfaceNumber);
-  if(!stream_if || stream_if->bStillCaptureMethod != 2)
+  if(!stream_if ||
+     (stream_if->bStillCaptureMethod != 2 && stream_if->bStillCaptureMethod != 3))
       return UVC_ERROR_NOT_SUPPORTED;
 
-  /* prepare for a SET transfer */
-  buf = 1;
+  /* prepare for a SET transfer: 1 sends the still in stream, 2 on the
+   * dedicated bulk pipe */
+  buf = stream_if->bStillCaptureMethod == 3 ? 2 : 1;
 
   /* do the transfer */
   err = libusb_control_transfer(
@@ -380,6 +467,192 @@ uvc_error_t uvc_trigger_still(
   return UVC_SUCCESS;
 }
 
+/** Get the still image capture method of a streaming interface
+ * @ingroup streaming
+ *
+ * @param[in] devh Device handle
+ * @param[in] interface_number VideoStreaming interface
+ * @return 0 without still support, 1 to 3 for the UVC still methods, or -1
+ * for an unknown interface
+ */
+int uvc_get_still_capture_method(uvc_device_handle_t *devh, uint8_t interface_number) {
+  uvc_streaming_interface_t *stream_if = _uvc_get_stream_if(devh, interface_number);
+
+  return stream_if ? stream_if->bStillCaptureMethod : -1;
+}
+
+/** @internal
+ * @brief Still frame descriptor of the negotiated still format
+ */
+static uvc_still_frame_desc_t *_uvc_find_still_desc(
+    uvc_device_handle_t *devh,
+    const uvc_still_ctrl_t *still_ctrl) {
+  uvc_streaming_interface_t *stream_if;
+  uvc_format_desc_t *format;
+
+  stream_if = _uvc_get_stream_if(devh, still_ctrl->bInterfaceNumber);
+  if (!stream_if)
+    return NULL;
+
+  DL_FOREACH(stream_if->format_descs, format) {
+    if (format->bFormatIndex == still_ctrl->bFormatIndex)
+      return format->still_frame_desc;
+  }
+
+  return NULL;
+}
+
+/** Get the bulk endpoint method 3 stills arrive on
+ * @ingroup streaming
+ *
+ * @param[in] devh Device handle
+ * @param[in] still_ctrl Negotiated still control block
+ * @return the endpoint address, 0 when the still comes with the video stream
+ */
+uint8_t uvc_get_still_endpoint(uvc_device_handle_t *devh, const uvc_still_ctrl_t *still_ctrl) {
+  uvc_still_frame_desc_t *still = _uvc_find_still_desc(devh, still_ctrl);
+
+  return still ? still->bEndPointAddress : 0;
+}
+
+/** Get the image size of a negotiated still control block
+ * @ingroup streaming
+ *
+ * @param[in] devh Device handle
+ * @param[in] still_ctrl Negotiated still control block
+ * @param[out] width Still width
+ * @param[out] height Still height
+ */
+uvc_error_t uvc_get_still_size(
+    uvc_device_handle_t *devh,
+    const uvc_still_ctrl_t *still_ctrl,
+    uint16_t *width,
+    uint16_t *height) {
+  uvc_still_frame_desc_t *still = _uvc_find_still_desc(devh, still_ctrl);
+  uvc_still_frame_res_t *sizePattern;
+
+  if (!still)
+    return UVC_ERROR_INVALID_PARAM;
+
+  DL_FOREACH(still->imageSizePatterns, sizePattern) {
+    if (sizePattern->bResolutionIndex == still_ctrl->bFrameIndex) {
+      *width = sizePattern->wWidth;
+      *height = sizePattern->wHeight;
+      return UVC_SUCCESS;
+    }
+  }
+
+  return UVC_ERROR_INVALID_PARAM;
+}
+
+/* Granularity of frame buffers grown past dwMaxVideoFrameSize, which also
+ * get a quarter more than the frame that outgrew them */
+#define UVC_FRAME_SLAB_ALIGN (64 * 1024)
+
+/** @internal
+ * @brief Buffer size for frames of up to bytes that no longer trust the
+ * control block
+ */
+static size_t _uvc_frame_slab_bytes(size_t bytes) {
+  bytes += bytes / 4;
+  return (bytes + UVC_FRAME_SLAB_ALIGN - 1) / UVC_FRAME_SLAB_ALIGN * UVC_FRAME_SLAB_ALIGN;
+}
+
+/** @internal
+ * @brief Largest frame of the stream: a frame of the committed format, or a
+ * method 2 still, or what the camera has been seen to send beyond them
+ */
+static size_t _uvc_max_frame_bytes(uvc_stream_handle_t *strmh) {
+  size_t bytes = strmh->cur_ctrl.dwMaxVideoFrameSize;
+  if (strmh->still_max_bytes > bytes)
+    bytes = strmh->still_max_bytes;
+  if (strmh->oversize_frame_bytes && _uvc_frame_slab_bytes(strmh->oversize_frame_bytes) > bytes)
+    bytes = _uvc_frame_slab_bytes(strmh->oversize_frame_bytes);
+  return bytes;
+}
+
+/** @internal
+ * @brief dwMaxVideoFrameSize of the frame being assembled: a still's when it
+ * carries the still image bit, since the buffers fit either
+ */
+static size_t _uvc_negotiated_frame_bytes(uvc_stream_handle_t *strmh) {
+  return strmh->still && strmh->still_max_bytes ?
+      strmh->still_max_bytes : strmh->cur_ctrl.dwMaxVideoFrameSize;
+}
+
+/** @internal
+ * @brief Grow outbuf and holdbuf to the largest frame for a polling start;
+ * callback streams assemble frames in the pool instead
+ */
+static uvc_error_t _uvc_grow_frame_buffers(uvc_stream_handle_t *strmh) {
+  size_t bytes = _uvc_max_frame_bytes(strmh);
+
+  /* the polling path assembles frames here */
+  if (strmh->frame_buf_bytes < bytes) {
+    uvc_buffer_free(strmh->outbuf);
+    uvc_buffer_free(strmh->holdbuf);
+    strmh->outbuf = uvc_buffer_alloc(bytes);
+    strmh->holdbuf = uvc_buffer_alloc(bytes);
+    if (!strmh->outbuf || !strmh->holdbuf) {
+      strmh->frame_buf_bytes = 0;
+      return UVC_ERROR_NO_MEM;
+    }
+    strmh->frame_buf_bytes = bytes;
+  }
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Free outbuf, holdbuf and the polled frame's copy; not while
+ * outbuf points into the pool
+ */
+static void _uvc_free_polling_buffers(uvc_stream_handle_t *strmh) {
+  uvc_buffer_free(strmh->outbuf);
+  uvc_buffer_free(strmh->holdbuf);
+  strmh->outbuf = strmh->holdbuf = NULL;
+  strmh->frame_buf_bytes = 0;
+  uvc_buffer_free(strmh->frame.data);
+  strmh->frame.data = NULL;
+  strmh->frame.data_bytes = 0;
+}
+
+/** Prepare a stream for method 2 stills of a negotiated still control block
+ * @ingroup streaming
+ *
+ * Frame buffers are sized for the larger of a video frame and a still, and
+ * frames carrying the still image bit are reported at the still's size. Must
+ * be called while the stream is stopped; NULL goes back to video frames only.
+ *
+ * @param strmh UVC stream handle
+ * @param still_ctrl Negotiated still control block, or NULL
+ */
+uvc_error_t uvc_stream_set_still(uvc_stream_handle_t *strmh, const uvc_still_ctrl_t *still_ctrl) {
+  uint16_t width, height;
+  uvc_error_t ret;
+
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if (!still_ctrl) {
+    strmh->still_max_bytes = 0;
+    strmh->still_width = strmh->still_height = 0;
+    return UVC_SUCCESS;
+  }
+
+  if (still_ctrl->bInterfaceNumber != strmh->stream_if->bInterfaceNumber)
+    return UVC_ERROR_INVALID_PARAM;
+
+  ret = uvc_get_still_size(strmh->devh, still_ctrl, &width, &height);
+  if (ret != UVC_SUCCESS)
+    return ret;
+
+  strmh->still_max_bytes = still_ctrl->dwMaxVideoFrameSize;
+  strmh->still_width = width;
+  strmh->still_height = height;
+
+  return UVC_SUCCESS;
+}
+
 /** @brief Reconfigure stream with a new stream format.
  * @ingroup streaming
  *
@@ -403,7 +676,13 @@ uvc_error_t uvc_stream_ctrl(uvc_stream_handle_t *strmh, uvc_stream_ctrl_t *ctrl)
   if (ret != UVC_SUCCESS)
     return ret;
 
+  /* what an earlier format sent past its dwMaxVideoFrameSize says nothing
+   * about this one */
+  if (ctrl->bFormatIndex != strmh->cur_ctrl.bFormatIndex ||
+      ctrl->bFrameIndex != strmh->cur_ctrl.bFrameIndex)
+    strmh->oversize_frame_bytes = 0;
   strmh->cur_ctrl = *ctrl;
+
   return UVC_SUCCESS;
 }
 
@@ -457,9 +736,69 @@ uvc_frame_desc_t *uvc_find_frame_desc(uvc_device_handle_t *devh,
   return NULL;
 }
 
+/** @brief Get the format descriptor of an open stream's control block
+ * @ingroup streaming
+ *
+ * @param strmh Stream handle
+ * @return The descriptor, or NULL for playback streams and control blocks
+ * naming none
+ */
+const uvc_format_desc_t *uvc_get_stream_format_desc(uvc_stream_handle_t *strmh) {
+  uvc_frame_desc_t *frame;
+
+  /* Playback streams have no interface */
+  if (!strmh->stream_if)
+    return NULL;
+  frame = uvc_find_frame_desc_stream(
+      strmh, strmh->cur_ctrl.bFormatIndex, strmh->cur_ctrl.bFrameIndex);
+  return frame ? frame->parent : NULL;
+}
+
+/** @internal
+ * @brief Frame interval of a frame descriptor for fps: the longest one no
+ * longer than 1/fps, so the camera sends at least fps frames a second and as
+ * few more as it can, or the shortest when all are longer. Continuous and
+ * stepwise ranges give an interval on their grid. fps zero takes the first
+ * listed interval, or the default one of a range.
+ */
+static uint32_t _uvc_nearest_frame_interval(const uvc_frame_desc_t *frame, int fps) {
+  uint32_t target, best = 0;
+
+  if (frame->intervals) {
+    uint32_t *interval;
+    if (fps <= 0)
+      return frame->intervals[0];
+    target = 10000000 / fps;
+    for (interval = frame->intervals; *interval; ++interval) {
+      if (best == 0 ||
+          (*interval <= target && (best > target || *interval > best)) ||
+          (*interval > target && best > target && *interval < best))
+        best = *interval;
+    }
+    return best;
+  }
+
+  if (fps <= 0)
+    return frame->dwDefaultFrameInterval;
+  target = 10000000 / fps;
+  if (target <= frame->dwMinFrameInterval)
+    return frame->dwMinFrameInterval;
+  if (target >= frame->dwMaxFrameInterval)
+    return frame->dwMaxFrameInterval;
+  if (frame->dwFrameIntervalStep == 0)
+    return target;
+  /* rounded down onto the grid, the faster neighbour */
+  return frame->dwMinFrameInterval + (target - frame->dwMinFrameInterval) /
+      frame->dwFrameIntervalStep * frame->dwFrameIntervalStep;
+}
+
 /** Get a negotiated streaming control block for some common parameters.
  * @ingroup streaming
  *
+ * The frame interval is the one of the size's descriptor nearest to fps, see
+ * uvc_get_stream_ctrl_format_size_on_interface(); dwFrameInterval of the
+ * result holds the rate the camera will send.
+ *
  * @param[in] devh Device handle
  * @param[in,out] ctrl Control block
  * @param[in] format_class Type of streaming format
@@ -473,12 +812,46 @@ uvc_error_t uvc_get_stream_ctrl_format_size(
     enum uvc_frame_format cf,
     int width, int height,
     int fps) {
+  return uvc_get_stream_ctrl_format_size_on_interface(devh, ctrl, -1, cf, width, height, fps);
+}
+
+/** Get a negotiated streaming control block on one streaming interface
+ * @ingroup streaming
+ *
+ * Devices with several VideoStreaming interfaces, such as depth and color
+ * cameras, offer the same formats on more than one of them.
+ *
+ * Any fps is accepted: the interval is the longest the frame descriptor
+ * allows that still gives fps, a listed one or one on the grid of a
+ * continuous or stepwise range, so slow rates such as a time-lapse's are
+ * sent at that rate by the camera. When the camera cannot go as fast the
+ * shortest interval is taken.
+ *
+ * @param[in] devh Device handle
+ * @param[in,out] ctrl Control block
+ * @param[in] interface_number bInterfaceNumber of the streaming interface, or
+ *            -1 for the first one offering the format
+ * @param[in] format_class Type of streaming format
+ * @param[in] width Desired frame width
+ * @param[in] height Desired frame height
+ * @param[in] fps Frame rate, frames per second
+ */
+uvc_error_t uvc_get_stream_ctrl_format_size_on_interface(
+    uvc_device_handle_t *devh,
+    uvc_stream_ctrl_t *ctrl,
+    int interface_number,
+    enum uvc_frame_format cf,
+    int width, int height,
+    int fps) {
   uvc_streaming_interface_t *stream_if;
 
   /* find a matching frame descriptor and interval */
   DL_FOREACH(devh->info->stream_ifs, stream_if) {
     uvc_format_desc_t *format;
 
+    if (interface_number >= 0 && stream_if->bInterfaceNumber != interface_number)
+      continue;
+
     DL_FOREACH(stream_if->format_descs, format) {
       uvc_frame_desc_t *frame;
 
@@ -489,7 +862,11 @@ uvc_error_t uvc_get_stream_ctrl_format_size(
         if (frame->wWidth != width || frame->wHeight != height)
           continue;
 
-        uint32_t *interval;
+        uint32_t interval = _uvc_nearest_frame_interval(frame, fps);
+        if (interval == 0)
+          continue;
+        if (fps > 0 && interval != 10000000 / (uint32_t) fps)
+          UVC_DEBUG("%d fps not offered, interval %u instead", fps, interval);
 
         ctrl->bInterfaceNumber = stream_if->bInterfaceNumber;
         UVC_DEBUG("claiming streaming interface %d", stream_if->bInterfaceNumber );
@@ -497,44 +874,91 @@ uvc_error_t uvc_get_stream_ctrl_format_size(
         /* get the max values */
         uvc_query_stream_ctrl( devh, ctrl, 1, UVC_GET_MAX);
 
-        if (frame->intervals) {
-          for (interval = frame->intervals; *interval; ++interval) {
-            // allow a fps rate of zero to mean "accept first rate available"
-            if (10000000 / *interval == (unsigned int) fps || fps == 0) {
+        ctrl->bmHint = (1 << 0); /* don't negotiate interval */
+        ctrl->bFormatIndex = format->bFormatIndex;
+        ctrl->bFrameIndex = frame->bFrameIndex;
+        ctrl->dwFrameInterval = interval;
 
-              ctrl->bmHint = (1 << 0); /* don't negotiate interval */
-              ctrl->bFormatIndex = format->bFormatIndex;
-              ctrl->bFrameIndex = frame->bFrameIndex;
-              ctrl->dwFrameInterval = *interval;
+        goto found;
+      }
+    }
+  }
 
-              goto found;
-            }
-          }
-        } else {
-          uint32_t interval_100ns = 10000000 / fps;
-          uint32_t interval_offset = interval_100ns - frame->dwMinFrameInterval;
+  return UVC_ERROR_INVALID_MODE;
+
+found:
+  return uvc_probe_stream_ctrl(devh, ctrl);
+}
+
+/** Slowest whole frame rate of a format and size that is at least min_fps
+ * @ingroup streaming
+ *
+ * Looks at the same frame descriptor uvc_get_stream_ctrl_format_size_on_interface()
+ * would pick, so the returned rate can be negotiated with it.
+ *
+ * @param[in] devh Device handle
+ * @param[in] interface_number bInterfaceNumber of the streaming interface, or
+ *            -1 for the first one offering the format
+ * @param[in] format_class Type of streaming format
+ * @param[in] width Frame width
+ * @param[in] height Frame height
+ * @param[in] min_fps Lowest acceptable frame rate, frames per second
+ * @return The frame rate, or 0 if the size has none at or above min_fps
+ */
+int uvc_get_slowest_frame_rate(
+    uvc_device_handle_t *devh,
+    int interface_number,
+    enum uvc_frame_format cf,
+    int width, int height,
+    int min_fps) {
+  uvc_streaming_interface_t *stream_if;
+
+  if (min_fps <= 0)
+    min_fps = 1;
+  DL_FOREACH(devh->info->stream_ifs, stream_if) {
+    uvc_format_desc_t *format;
+
+    if (interface_number >= 0 && stream_if->bInterfaceNumber != interface_number)
+      continue;
+
+    DL_FOREACH(stream_if->format_descs, format) {
+      uvc_frame_desc_t *frame;
 
-          if (interval_100ns >= frame->dwMinFrameInterval
-              && interval_100ns <= frame->dwMaxFrameInterval
-              && !(interval_offset
-                   && (interval_offset % frame->dwFrameIntervalStep))) {
+      if (!_uvc_frame_format_matches_guid(cf, format->guidFormat))
+        continue;
+
+      DL_FOREACH(format->frame_descs, frame) {
+        int slowest = 0;
+        int fps;
 
-            ctrl->bmHint = (1 << 0);
-            ctrl->bFormatIndex = format->bFormatIndex;
-            ctrl->bFrameIndex = frame->bFrameIndex;
-            ctrl->dwFrameInterval = interval_100ns;
+        if (frame->wWidth != width || frame->wHeight != height)
+          continue;
 
-            goto found;
+        if (frame->intervals) {
+          uint32_t *interval;
+          for (interval = frame->intervals; *interval; ++interval) {
+            fps = 10000000 / *interval;
+            if (fps >= min_fps && (slowest == 0 || fps < slowest))
+              slowest = fps;
+          }
+        } else if (frame->dwMinFrameInterval > 0) {
+          int fastest = 10000000 / frame->dwMinFrameInterval;
+          /* the first rate whose interval lies on the descriptor's grid */
+          for (fps = min_fps; fps <= fastest && slowest == 0; fps++) {
+            uint32_t interval_100ns = 10000000 / fps;
+            uint32_t interval_offset = interval_100ns - frame->dwMinFrameInterval;
+            if (interval_100ns <= frame->dwMaxFrameInterval
+                && !(interval_offset
+                     && frame->dwFrameIntervalStep
+                     && (interval_offset % frame->dwFrameIntervalStep)))
+              slowest = fps;
           }
         }
+        return slowest;
       }
     }
   }
-
-  return UVC_ERROR_INVALID_MODE;
-
-found:
-  return uvc_probe_stream_ctrl(devh, ctrl);
+  return 0;
 }
 
 /** Get a negotiated still control block for some common parameters.
@@ -558,8 +982,9 @@ uvc_error_t uvc_get_still_ctrl_format_size(
 
   stream_if = _uvc_get_stream_if(devh, ctrl->bInterfaceNumber);
 
-  /* Only method 2 is supported */
-  if(!stream_if || stream_if->bStillCaptureMethod != 2)
+  /* Method 1 stills are plain video frames and need no negotiation */
+  if(!stream_if ||
+     (stream_if->bStillCaptureMethod != 2 && stream_if->bStillCaptureMethod != 3))
     return UVC_ERROR_NOT_SUPPORTED;
 
   DL_FOREACH(stream_if->format_descs, format) {
@@ -567,7 +992,8 @@ uvc_error_t uvc_get_still_ctrl_format_size(
     if (ctrl->bFormatIndex != format->bFormatIndex)
       continue;
 
-    /* get the max values */
+    /* get the max values, from the interface the query goes to */
+    still_ctrl->bInterfaceNumber = ctrl->bInterfaceNumber;
     uvc_query_still_ctrl(devh, still_ctrl, 1, UVC_GET_MAX);
 
     //look for still format
@@ -651,55 +1077,336 @@ uvc_error_t uvc_probe_still_ctrl(
   return res;
 }
 
+/** @internal
+ * @brief Find a pool slot that is not being filled, not waiting for the user
+ * thread and not referenced by the user. Must be called with cb_mutex held.
+ */
+static struct uvc_pooled_frame *_uvc_find_free_slot(uvc_stream_handle_t *strmh) {
+  uint32_t i;
+
+  for (i = 0; i < strmh->frame_pool_size; i++) {
+    struct uvc_pooled_frame *slot = &strmh->frame_pool[i];
+    if (slot != strmh->out_slot && !slot->queued && slot->refcount == 0)
+      return slot;
+  }
+
+  return NULL;
+}
+
+/** @internal
+ * @brief Take the oldest completed slot off the ready queue
+ * Must be called with cb_mutex held and ready_count > 0.
+ */
+static struct uvc_pooled_frame *_uvc_pop_ready_slot(uvc_stream_handle_t *strmh) {
+  struct uvc_pooled_frame *slot = strmh->ready_slots[strmh->ready_head];
+
+  strmh->ready_head = (strmh->ready_head + 1) % LIBUVC_NUM_FRAME_POOL_BUFS;
+  strmh->ready_count--;
+  slot->queued = 0;
+  return slot;
+}
+
+/** @internal
+ * @brief Take the oldest completed slot off the ready queue with a reference
+ * for the user
+ * Must be called with cb_mutex held and ready_count > 0.
+ */
+static struct uvc_pooled_frame *_uvc_claim_ready_slot(uvc_stream_handle_t *strmh) {
+  struct uvc_pooled_frame *slot = _uvc_pop_ready_slot(strmh);
+
+  slot->refcount++;
+  return slot;
+}
+
+/** @internal
+ * @brief Empty the ready queue, its slots become free
+ * Must be called with cb_mutex held.
+ */
+static void _uvc_clear_ready_slots(uvc_stream_handle_t *strmh) {
+  while (strmh->ready_count > 0)
+    _uvc_pop_ready_slot(strmh);
+  strmh->ready_head = 0;
+}
+
+/** @internal
+ * @brief Publish the slot being filled and start filling a free one
+ * Must be called with cb_mutex held.
+ * @return 1 if the completed frame was published, 0 if it was dropped because
+ * the user holds every other slot
+ */
+static int _uvc_swap_pool_slots(uvc_stream_handle_t *strmh) {
+  struct uvc_pooled_frame *done = strmh->out_slot;
+  struct uvc_pooled_frame *next = _uvc_find_free_slot(strmh);
+
+  if (!next && strmh->ready_count > 0) {
+    /* the newest frame is worth more than the oldest one still waiting */
+    next = _uvc_pop_ready_slot(strmh);
+    strmh->dropped_frames++;
+  }
+
+  if (!next) {
+    /* overwrite the completed frame instead */
+    strmh->dropped_frames++;
+    return 0;
+  }
+
+  if (next->buf_bytes < strmh->oversize_frame_bytes) {
+    /* the camera sends more than it negotiated; grow the slot while it is
+     * empty, so the next frame is not copied over mid-frame */
+    size_t bytes;
+    uint8_t *buf = _uvc_take_frame_buffer(
+        _uvc_frame_slab_bytes(strmh->oversize_frame_bytes), &bytes);
+    if (buf) {
+      _uvc_stash_frame_buffer(next->buf, next->buf_bytes);
+      next->buf = buf;
+      next->buf_bytes = bytes;
+    }
+  }
+
+  done->bytes = strmh->got_bytes;
+  done->meta_bytes = strmh->meta_got_bytes;
+  done->seq = strmh->seq;
+  done->pts = strmh->pts;
+  done->last_scr = strmh->last_scr;
+  done->last_scr_sof = strmh->scr_sof_valid ? strmh->last_scr_sof : UVC_SCR_SOF_NONE;
+  done->still = strmh->still;
+  done->incomplete = strmh->frame_incomplete;
+  done->capture_time = strmh->capture_time_finished;
+  done->queued = 1;
+  strmh->ready_slots[(strmh->ready_head + strmh->ready_count) % LIBUVC_NUM_FRAME_POOL_BUFS] = done;
+  strmh->ready_count++;
+
+  strmh->out_slot = next;
+  strmh->outbuf = next->buf;
+  strmh->meta_outbuf = next->meta_buf;
+  return 1;
+}
+
+/** @internal
+ * @brief Add to a transport counter. The transfer callbacks are its only
+ * writer, so a relaxed load and store do, and readers need no lock.
+ */
+#define UVC_COUNT_TRANSPORT(strmh, field, n) \
+  __atomic_store_n(&(strmh)->transport.field, (strmh)->transport.field + (n), __ATOMIC_RELAXED)
+
+/** @internal
+ * @brief Move the frame being assembled to a pool buffer of at least
+ * need_bytes. Copies what arrived so far, which only a frame larger than
+ * its slot pays for; _uvc_swap_pool_slots() grows the other slots while
+ * they are empty.
+ * @return 1 if outbuf now holds need_bytes
+ */
+static int _uvc_grow_out_slot(uvc_stream_handle_t *strmh, size_t need_bytes) {
+  struct uvc_pooled_frame *slot = strmh->out_slot;
+  uint8_t *buf, *old_buf;
+  size_t bytes, old_bytes;
+
+  buf = _uvc_take_frame_buffer(_uvc_frame_slab_bytes(need_bytes), &bytes);
+  if (!buf)
+    return 0;
+  memcpy(buf, slot->buf, strmh->got_bytes);
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  old_buf = slot->buf;
+  old_bytes = slot->buf_bytes;
+  slot->buf = buf;
+  slot->buf_bytes = bytes;
+  strmh->outbuf = buf;
+  if (strmh->progress_buf == old_buf)
+    strmh->progress_buf = buf;
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  /* stashed rather than freed, progress readers may still be copying */
+  _uvc_stash_frame_buffer(old_buf, old_bytes);
+  return 1;
+}
+
 /** @internal
  * @brief Swap the working buffer with the presented buffer and notify consumers
  */
 void _uvc_swap_buffers(uvc_stream_handle_t *strmh) {
   uint8_t *tmp_buf;
-
+  struct uvc_pooled_frame *inline_slot = NULL;
+
+  UVC_TRACE_BEGIN("uvc_swap_buffers");
+  UVC_TRACE_COUNTER("uvc_frame_bytes", strmh->got_bytes);
+  if (strmh->frame_incomplete)
+    UVC_COUNT_TRANSPORT(strmh, incomplete_frames, 1);
+  if (strmh->frame_truncated)
+    UVC_COUNT_TRANSPORT(strmh, truncated_frames, 1);
+  if (strmh->got_bytes > _uvc_negotiated_frame_bytes(strmh)) {
+    UVC_COUNT_TRANSPORT(strmh, oversize_frames, 1);
+    if (strmh->got_bytes > strmh->oversize_frame_bytes)
+      strmh->oversize_frame_bytes = strmh->got_bytes;
+  }
   pthread_mutex_lock(&strmh->cb_mutex);
 
   (void)clock_gettime(CLOCK_MONOTONIC, &strmh->capture_time_finished);
 
-  /* swap the buffers */
-  tmp_buf = strmh->holdbuf;
-  strmh->hold_bytes = strmh->got_bytes;
-  strmh->holdbuf = strmh->outbuf;
-  strmh->outbuf = tmp_buf;
-  strmh->hold_last_scr = strmh->last_scr;
-  strmh->hold_pts = strmh->pts;
-  strmh->hold_seq = strmh->seq;
-  
-  /* swap metadata buffer */
-  tmp_buf = strmh->meta_holdbuf;
-  strmh->meta_holdbuf = strmh->meta_outbuf;
-  strmh->meta_outbuf = tmp_buf;
-  strmh->meta_hold_bytes = strmh->meta_got_bytes;
+  if (strmh->pooled_frames) {
+    if (_uvc_swap_pool_slots(strmh)) {
+      if (strmh->inline_callback && strmh->running)
+        inline_slot = _uvc_claim_ready_slot(strmh);
+      else
+        pthread_cond_broadcast(&strmh->cb_cond);
+    }
+  } else {
+    /* swap the buffers */
+    tmp_buf = strmh->holdbuf;
+    strmh->hold_bytes = strmh->got_bytes;
+    strmh->holdbuf = strmh->outbuf;
+    strmh->outbuf = tmp_buf;
+    strmh->hold_last_scr = strmh->last_scr;
+    strmh->hold_last_scr_sof = strmh->scr_sof_valid ? strmh->last_scr_sof : UVC_SCR_SOF_NONE;
+    strmh->hold_pts = strmh->pts;
+    strmh->hold_seq = strmh->seq;
+    strmh->hold_still = strmh->still;
+    strmh->hold_incomplete = strmh->frame_incomplete;
+
+    /* swap metadata buffer */
+    tmp_buf = strmh->meta_holdbuf;
+    strmh->meta_holdbuf = strmh->meta_outbuf;
+    strmh->meta_outbuf = tmp_buf;
+    strmh->meta_hold_bytes = strmh->meta_got_bytes;
+
+    pthread_cond_broadcast(&strmh->cb_cond);
+  }
+
+  if (strmh->options.progress_bytes && strmh->pooled_frames) {
+    /* seq moves on to the next frame once unlocked */
+    strmh->progress_seq = strmh->seq + 1;
+    strmh->progress_bytes = 0;
+    strmh->progress_buf = strmh->outbuf;
+    pthread_cond_broadcast(&strmh->progress_cond);
+  }
 
-  pthread_cond_broadcast(&strmh->cb_cond);
   pthread_mutex_unlock(&strmh->cb_mutex);
 
   strmh->seq++;
+  strmh->progress_next_bytes = strmh->options.progress_bytes;
   strmh->got_bytes = 0;
   strmh->meta_got_bytes = 0;
   strmh->last_scr = 0;
+  strmh->scr_sof_valid = 0;
   strmh->pts = 0;
+  strmh->still = 0;
+  strmh->frame_incomplete = 0;
+  strmh->frame_truncated = 0;
+  UVC_TRACE_END();
+
+  if (inline_slot) {
+    /* uvc_stream_stop() waits for the transfer this runs in, so the stream
+     * stays valid */
+    uvc_frame_t *inline_frame = _uvc_populate_borrowed_frame(strmh, inline_slot);
+    UVC_TRACE_BEGIN("uvc_user_callback");
+    strmh->user_cb(inline_frame, strmh->user_ptr);
+    UVC_TRACE_END();
+    if (!strmh->borrowed_frames)
+      uvc_release_frame(inline_frame);
+  }
 }
 
 /** @internal
- * @brief Process a payload transfer
- * 
- * Processes stream, places frames into buffer, signals listeners
- * (such as user callback thread and any polling thread) on new frame
- *
+ * @brief Fills in the default of options.streaming_copy_bytes
+ */
+static void _uvc_resolve_streaming_copy(uvc_stream_handle_t *strmh) {
+  if (strmh->options.progress_bytes)
+    strmh->options.streaming_copy_bytes = UINT32_MAX;
+  else if (!strmh->options.streaming_copy_bytes)
+    strmh->options.streaming_copy_bytes = LIBUVC_STREAMING_COPY_BYTES;
+}
+
+#if defined(__SSE2__) && !defined(__aarch64__)
+/** @internal
+ * @brief Streams whole cache lines with AVX2, which Android's x86 ABIs do
+ * not guarantee, so it is picked at run time
+ */
+__attribute__((target("avx2")))
+static void _uvc_stream_lines_avx2(uint8_t *dst, const uint8_t *src, size_t lines) {
+  for (; lines > 0; lines--, dst += 64, src += 64) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)src);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+    _mm256_stream_si256((__m256i *)dst, v0);
+    _mm256_stream_si256((__m256i *)(dst + 32), v1);
+  }
+}
+#endif
+
+/** @internal
+ * @brief Copies a payload's video data into the frame being assembled
+ *
+ * Payloads of at least options.streaming_copy_bytes bypass the caches with
+ * non-temporal stores of whole cache lines: a frame is written once here and
+ * read once by the consumer, usually after more of it arrived than the
+ * caches hold, so caching it only evicts the event thread's and the
+ * converter's working sets. The rest is a plain memcpy().
+ */
+static void _uvc_copy_payload(uvc_stream_handle_t *strmh, uint8_t *dst, const uint8_t *src,
+    size_t len) {
+#if defined(__aarch64__) || defined(__SSE2__)
+  if (len >= strmh->options.streaming_copy_bytes) {
+    size_t head = -(uintptr_t)dst & (LIBUVC_BUFFER_ALIGNMENT - 1);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+#if !defined(__aarch64__)
+    if (__builtin_cpu_supports("avx2")) {
+      size_t lines = len / 64;
+      _uvc_stream_lines_avx2(dst, src, lines);
+      dst += lines * 64;
+      src += lines * 64;
+      len -= lines * 64;
+    }
+#endif
+    for (; len >= 64; len -= 64, dst += 64, src += 64) {
+#if defined(__aarch64__)
+      uint8x16x4_t v = vld1q_u8_x4(src);
+      __asm__ volatile(
+          "stnp %q0, %q1, [%4]\n\t"
+          "stnp %q2, %q3, [%4, #32]"
+          :
+          : "w"(v.val[0]), "w"(v.val[1]), "w"(v.val[2]), "w"(v.val[3]), "r"(dst)
+          : "memory");
+#else
+      __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+      __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+      __m128i v2 = _mm_loadu_si128((const __m128i *)(src + 32));
+      __m128i v3 = _mm_loadu_si128((const __m128i *)(src + 48));
+      _mm_stream_si128((__m128i *)dst, v0);
+      _mm_stream_si128((__m128i *)(dst + 16), v1);
+      _mm_stream_si128((__m128i *)(dst + 32), v2);
+      _mm_stream_si128((__m128i *)(dst + 48), v3);
+#endif
+    }
+#if !defined(__aarch64__)
+    /* x86 streaming stores are weakly ordered, even against the lock that
+     * publishes the frame; the barrier that does on arm64 orders stnp too */
+    _mm_sfence();
+#endif
+  }
+#endif
+  memcpy(dst, src, len);
+}
+
+/** @internal
+ * @brief Process a payload transfer
+ * 
+ * Processes stream, places frames into buffer, signals listeners
+ * (such as user callback thread and any polling thread) on new frame
+ *
  * @param payload Contents of the payload transfer, either a packet (isochronous) or a full
  * transfer (bulk mode)
  * @param payload_len Length of the payload transfer
+ * @param capacity Length a full payload would have, for the transport counters
  */
-void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t payload_len) {
+void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t payload_len,
+    size_t capacity) {
   size_t header_len;
   uint8_t header_info;
   size_t data_len;
+  /* synthetic streams have no device */
+  int is_isight = strmh->devh && strmh->devh->is_isight;
 
   /* magic numbers for identifying header packets from some iSight cameras */
   static uint8_t isight_tag[] = {
@@ -707,9 +1414,14 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
     0xde, 0xad, 0xbe, 0xef, 0xde, 0xad, 0xfa, 0xce
   };
 
+  UVC_COUNT_TRANSPORT(strmh, packets, 1);
+  UVC_COUNT_TRANSPORT(strmh, bytes, payload_len);
+
   /* ignore empty payload transfers */
-  if (payload_len == 0)
+  if (payload_len == 0) {
+    UVC_COUNT_TRANSPORT(strmh, empty_packets, 1);
     return;
+  }
 
   /* Certain iSight cameras have strange behavior: They send header
    * information in a packet with no image data, and then the following
@@ -719,7 +1431,7 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
    * 0xdeadbeefdeadface(8), ??(16)
    */
 
-  if (strmh->devh->is_isight &&
+  if (is_isight &&
       (payload_len < 14 || memcmp(isight_tag, payload + 2, sizeof(isight_tag))) &&
       (payload_len < 15 || memcmp(isight_tag, payload + 3, sizeof(isight_tag)))) {
     /* The payload transfer doesn't have any iSight magic, so it's all image data */
@@ -730,10 +1442,12 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
 
     if (header_len > payload_len) {
       UVC_DEBUG("bogus packet: actual_len=%zd, header_len=%zd\n", payload_len, header_len);
+      UVC_COUNT_TRANSPORT(strmh, header_errors, 1);
+      strmh->frame_incomplete = 1;
       return;
     }
 
-    if (strmh->devh->is_isight)
+    if (is_isight)
       data_len = 0;
     else
       data_len = payload_len - header_len;
@@ -749,6 +1463,8 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
 
     if (header_info & 0x40) {
       UVC_DEBUG("bad packet: error bit set");
+      UVC_COUNT_TRANSPORT(strmh, header_errors, 1);
+      strmh->frame_incomplete = 1;
       return;
     }
 
@@ -756,19 +1472,24 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
       /* The frame ID bit was flipped, but we have image data sitting
          around from prior transfers. This means the camera didn't send
          an EOF for the last transfer of the previous frame. */
+      UVC_COUNT_TRANSPORT(strmh, frames_without_eof, 1);
       _uvc_swap_buffers(strmh);
     }
 
     strmh->fid = header_info & 1;
 
+    if (header_info & (1 << 5))
+      strmh->still = 1;
+
     if (header_info & (1 << 2)) {
       strmh->pts = DW_TO_INT(payload + variable_offset);
       variable_offset += 4;
     }
 
     if (header_info & (1 << 3)) {
-      /** @todo read the SOF token counter */
       strmh->last_scr = DW_TO_INT(payload + variable_offset);
+      strmh->last_scr_sof = SW_TO_SHORT(payload + variable_offset + 4) & 0x7ff;
+      strmh->scr_sof_valid = 1;
       variable_offset += 6;
     }
 
@@ -782,14 +1503,38 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
     }
   }
 
+  if (data_len == 0)
+    UVC_COUNT_TRANSPORT(strmh, empty_packets, 1);
+  else if (payload_len < capacity)
+    UVC_COUNT_TRANSPORT(strmh, short_packets, 1);
+
   if (data_len > 0) {
-    if (strmh->got_bytes + data_len > strmh->cur_ctrl.dwMaxVideoFrameSize)
-      data_len = strmh->cur_ctrl.dwMaxVideoFrameSize - strmh->got_bytes; /* Avoid overflow. */
-    memcpy(strmh->outbuf + strmh->got_bytes, payload + header_len, data_len);
+    size_t max_bytes = _uvc_negotiated_frame_bytes(strmh);
+    size_t buf_bytes = strmh->pooled_frames ?
+        strmh->out_slot->buf_bytes : strmh->frame_buf_bytes;
+    /* cameras that under-report dwMaxVideoFrameSize go on past it: the pool
+     * slot grows for them, the polling buffers drop the rest of the frame */
+    if (strmh->got_bytes + data_len > buf_bytes &&
+        !(strmh->pooled_frames && _uvc_grow_out_slot(strmh, strmh->got_bytes + data_len))) {
+      data_len = buf_bytes - strmh->got_bytes; /* Avoid overflow. */
+      strmh->frame_truncated = 1;
+      strmh->frame_incomplete = 1;
+    }
+    _uvc_copy_payload(strmh, strmh->outbuf + strmh->got_bytes, payload + header_len, data_len);
     strmh->got_bytes += data_len;
-    if (header_info & (1 << 1) || strmh->got_bytes == strmh->cur_ctrl.dwMaxVideoFrameSize) {
+    /* a full frame ends one without an EOF bit, unless the camera is known
+     * to send more than it negotiated */
+    if (header_info & (1 << 1) ||
+        (strmh->got_bytes == max_bytes && !strmh->oversize_frame_bytes)) {
       /* The EOF bit is set, so publish the complete frame */
       _uvc_swap_buffers(strmh);
+    } else if (strmh->options.progress_bytes && strmh->pooled_frames &&
+        strmh->got_bytes >= strmh->progress_next_bytes) {
+      pthread_mutex_lock(&strmh->cb_mutex);
+      strmh->progress_bytes = strmh->got_bytes;
+      pthread_cond_broadcast(&strmh->progress_cond);
+      pthread_mutex_unlock(&strmh->cb_mutex);
+      strmh->progress_next_bytes = strmh->got_bytes + strmh->options.progress_bytes;
     }
   }
 }
@@ -802,19 +1547,217 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
  *
  * @param transfer Active transfer
  */
+/* fit_iso_bandwidth headroom over the needed rate, and the packet error rate
+ * over a window of packets that moves the next start one altsetting up */
+#define UVC_ISO_BANDWIDTH_MARGIN_PCT 10
+#define UVC_ISO_ERROR_WINDOW_PACKETS 8000
+#define UVC_ISO_MAX_ERROR_PCT 1
+
+/** @internal
+ * @brief Count isochronous packets, and in fit_iso_bandwidth mode have the
+ * next start use a bigger altsetting when too many of them fail
+ */
+static void _uvc_count_iso_packets(uvc_stream_handle_t *strmh, int packets, int errors) {
+  strmh->bandwidth.packets += packets;
+  strmh->bandwidth.packet_errors += errors;
+  if (!strmh->options.fit_iso_bandwidth)
+    return;
+
+  strmh->iso_window_packets += packets;
+  strmh->iso_window_errors += errors;
+  if (strmh->iso_window_packets < UVC_ISO_ERROR_WINDOW_PACKETS)
+    return;
+  if (strmh->iso_window_errors * 100 > strmh->iso_window_packets * UVC_ISO_MAX_ERROR_PCT &&
+      strmh->iso_min_alt_idx <= strmh->iso_alt_idx) {
+    UVC_DEBUG("%u of %u packets failed, raising the altsetting on restart",
+        strmh->iso_window_errors, strmh->iso_window_packets);
+    strmh->iso_min_alt_idx = strmh->iso_alt_idx + 1;
+  }
+  strmh->iso_window_packets = 0;
+  strmh->iso_window_errors = 0;
+}
+
+/** @internal
+ * @brief Whether a payload starts with a plausible header: sized within the
+ * payload with the end-of-header bit set
+ */
+static int _uvc_is_payload_header(const uint8_t *payload, size_t payload_len) {
+  return payload_len >= 2 && payload[0] >= 2 && payload[0] <= payload_len && (payload[1] & 0x80);
+}
+
+/** @internal
+ * @brief Process the payloads of a bulk transfer
+ *
+ * Payloads are dwMaxPayloadTransferSize bytes except the last one of a frame,
+ * which ends in a short packet. A short packet ends the transfer as well, so
+ * a transfer can hold several payloads back to back and only its last one can
+ * be short.
+ */
+static void _uvc_process_bulk_payloads(uvc_stream_handle_t *strmh, uint8_t *buffer,
+    size_t length) {
+  size_t payload_size = strmh->cur_ctrl.dwMaxPayloadTransferSize;
+  size_t offset = 0;
+
+  if (payload_size == 0 || payload_size > length)
+    payload_size = length;
+
+  while (offset < length) {
+    uint8_t *payload = buffer + offset;
+    size_t payload_len = length - offset < payload_size ? length - offset : payload_size;
+
+    if (offset > 0 && !_uvc_is_payload_header(payload, payload_len)) {
+      /* Payloads end early without a short packet: from now on the transfers
+       * are resubmitted with room for a single one */
+      UVC_DEBUG("no payload header at offset %zu, one payload per bulk transfer", offset);
+      strmh->bulk_single_payload = 1;
+      break;
+    }
+    if (offset + payload_len < length)
+      __builtin_prefetch(payload + payload_len);
+    _uvc_process_payload(strmh, payload, payload_len, payload_size);
+    offset += payload_len;
+  }
+}
+
+/** @internal
+ * @brief Process the payloads of a bulk transfer, see _uvc_process_bulk_payloads()
+ */
+static void _uvc_process_bulk_transfer(uvc_stream_handle_t *strmh, struct libusb_transfer *transfer) {
+  _uvc_process_bulk_payloads(strmh, transfer->buffer, transfer->actual_length);
+
+  if (strmh->bulk_single_payload && strmh->cur_ctrl.dwMaxPayloadTransferSize)
+    transfer->length = strmh->cur_ctrl.dwMaxPayloadTransferSize;
+}
+
+/** @internal
+ * @brief Frees a transfer buffer of either kind
+ */
+static void _uvc_free_buffer(uvc_stream_handle_t *strmh, uint8_t *buffer, uint8_t dev_mem,
+    size_t length) {
+  if (dev_mem)
+    libusb_dev_mem_free(strmh->devh->usb_devh, buffer, length);
+  else
+    uvc_buffer_free(buffer);
+}
+
+/** @internal
+ * @brief Frees spare transfer buffers from index first on, and those smaller
+ * than length
+ *
+ * Run before allocating the transfers of a start, so they can get the usbfs
+ * memory the dropped spares held.
+ */
+static void _uvc_trim_spare_buffers(uvc_stream_handle_t *strmh, uint32_t first, size_t length) {
+  uint32_t i;
+
+  for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    if (strmh->spare_bufs[i] && (i >= first || strmh->spare_buf_bytes[i] < length)) {
+      _uvc_free_buffer(strmh, strmh->spare_bufs[i], strmh->spare_buf_dev_mem[i],
+          strmh->spare_buf_bytes[i]);
+      strmh->spare_bufs[i] = NULL;
+    }
+  }
+}
+
+/** @internal
+ * @brief Allocates the buffer of transfer i
+ *
+ * usbfs memory lets the kernel fill the buffer in place rather than copying
+ * every URB out of its own bounce buffer. There is only usbfs_memory_mb of it,
+ * and kernels or backends without mmap support have none, so heap memory is
+ * the fallback. The buffer transfer i had before the stream last stopped is
+ * reused when it is large enough.
+ */
+static uint8_t *_uvc_alloc_transfer_buffer(uvc_stream_handle_t *strmh, int i, size_t length) {
+  uint8_t *buffer;
+
+  if (strmh->spare_bufs[i] && strmh->spare_buf_bytes[i] >= length) {
+    buffer = strmh->spare_bufs[i];
+    strmh->transfer_buf_dev_mem[i] = strmh->spare_buf_dev_mem[i];
+    strmh->transfer_buf_bytes[i] = strmh->spare_buf_bytes[i];
+    strmh->spare_bufs[i] = NULL;
+    return buffer;
+  }
+  if (strmh->spare_bufs[i]) {
+    _uvc_free_buffer(strmh, strmh->spare_bufs[i], strmh->spare_buf_dev_mem[i],
+        strmh->spare_buf_bytes[i]);
+    strmh->spare_bufs[i] = NULL;
+  }
+  buffer = libusb_dev_mem_alloc(strmh->devh->usb_devh, length);
+  strmh->transfer_buf_dev_mem[i] = buffer != NULL;
+  if (!buffer)
+    buffer = uvc_buffer_alloc(length);
+  strmh->transfer_buf_bytes[i] = length;
+  return buffer;
+}
+
+/** @internal
+ * @brief Frees transfer i, keeping its buffer as a spare
+ */
+static void _uvc_free_transfer(uvc_stream_handle_t *strmh, int i) {
+  struct libusb_transfer *transfer = strmh->transfers[i];
+  if (strmh->spare_bufs[i])
+    _uvc_free_buffer(strmh, strmh->spare_bufs[i], strmh->spare_buf_dev_mem[i],
+        strmh->spare_buf_bytes[i]);
+  strmh->spare_bufs[i] = transfer->buffer;
+  strmh->spare_buf_dev_mem[i] = strmh->transfer_buf_dev_mem[i];
+  strmh->spare_buf_bytes[i] = strmh->transfer_buf_bytes[i];
+  strmh->transfer_buf_dev_mem[i] = 0;
+  strmh->transfer_parked[i] = 0;
+  libusb_free_transfer(transfer);
+  strmh->transfers[i] = NULL;
+}
+
+/** @internal
+ * @brief Keeps a transfer that failed while running for
+ * uvc_stream_rearm_transfers(), or frees it once the stream is stopping
+ */
+static void _uvc_park_transfer(uvc_stream_handle_t *strmh, struct libusb_transfer *transfer) {
+  int i;
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    if (strmh->transfers[i] == transfer) {
+      if (strmh->running) {
+        UVC_DEBUG("Parking transfer %d (%p)", i, transfer);
+        strmh->transfer_parked[i] = 1;
+      } else {
+        _uvc_free_transfer(strmh, i);
+      }
+      break;
+    }
+  }
+  pthread_cond_broadcast(&strmh->cb_cond);
+  pthread_mutex_unlock(&strmh->cb_mutex);
+}
+
+/** @internal
+ * @brief Reports the device gone, once per stream start
+ */
+static void _uvc_stream_device_lost(uvc_stream_handle_t *strmh) {
+  if (__atomic_exchange_n(&strmh->device_lost, 1, __ATOMIC_RELAXED))
+    return;
+  UVC_DEBUG("device lost");
+  if (strmh->device_lost_cb)
+    strmh->device_lost_cb(strmh->device_lost_user_ptr);
+}
+
 void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
   uvc_stream_handle_t *strmh = transfer->user_data;
 
   int resubmit = 1;
 
+  UVC_TRACE_BEGIN("uvc_stream_callback");
+
   switch (transfer->status) {
   case LIBUSB_TRANSFER_COMPLETED:
     if (transfer->num_iso_packets == 0) {
-      /* This is a bulk mode transfer, so it just has one payload transfer */
-      _uvc_process_payload(strmh, transfer->buffer, transfer->actual_length);
+      /* This is a bulk mode transfer, with one or more payload transfers */
+      _uvc_process_bulk_transfer(strmh, transfer);
     } else {
       /* This is an isochronous mode transfer, so each packet has a payload transfer */
       int packet_id;
+      int packet_errors = 0;
 
       for (packet_id = 0; packet_id < transfer->num_iso_packets; ++packet_id) {
         uint8_t *pktbuf;
@@ -824,30 +1767,52 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
 
         if (pkt->status != 0) {
           UVC_DEBUG("bad packet (isochronous transfer); status: %d", pkt->status);
+          packet_errors++;
+          /* part of the frame being assembled, or the start of the next one */
+          strmh->frame_incomplete = 1;
           continue;
         }
 
         pktbuf = libusb_get_iso_packet_buffer_simple(transfer, packet_id);
+        /* the next packet's header is parsed right after this one's copy */
+        if (packet_id + 1 < transfer->num_iso_packets)
+          __builtin_prefetch(libusb_get_iso_packet_buffer_simple(transfer, packet_id + 1));
 
-        _uvc_process_payload(strmh, pktbuf, pkt->actual_length);
+        if (pkt->actual_length > strmh->transport.max_packet_bytes)
+          __atomic_store_n(&strmh->transport.max_packet_bytes, pkt->actual_length,
+              __ATOMIC_RELAXED);
+        _uvc_process_payload(strmh, pktbuf, pkt->actual_length, pkt->length);
 
       }
+      _uvc_count_iso_packets(strmh, transfer->num_iso_packets, packet_errors);
+      if (packet_errors) {
+        UVC_COUNT_TRANSPORT(strmh, packets, packet_errors);
+        UVC_COUNT_TRANSPORT(strmh, packet_errors, packet_errors);
+      }
     }
     break;
-  case LIBUSB_TRANSFER_CANCELLED: 
   case LIBUSB_TRANSFER_ERROR:
+    if (strmh->running) {
+      /* often a passing bus error; the watchdog of the stream re-arms it */
+      UVC_DEBUG("not retrying transfer, status = %d", transfer->status);
+      _uvc_park_transfer(strmh, transfer);
+      resubmit = 0;
+      break;
+    }
+    /* fall through */
+  case LIBUSB_TRANSFER_CANCELLED:
   case LIBUSB_TRANSFER_NO_DEVICE: {
     int i;
     UVC_DEBUG("not retrying transfer, status = %d", transfer->status);
+    if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE && strmh->running)
+      _uvc_stream_device_lost(strmh);
     pthread_mutex_lock(&strmh->cb_mutex);
 
     /* Mark transfer as deleted. */
     for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
       if(strmh->transfers[i] == transfer) {
         UVC_DEBUG("Freeing transfer %d (%p)", i, transfer);
-        free(transfer->buffer);
-        libusb_free_transfer(transfer);
-        strmh->transfers[i] = NULL;
+        _uvc_free_transfer(strmh, i);
         break;
       }
     }
@@ -872,18 +1837,20 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
   if ( resubmit ) {
     if ( strmh->running ) {
       int libusbRet = libusb_submit_transfer(transfer);
-      if (libusbRet < 0)
+      if (libusbRet < 0 && libusbRet != LIBUSB_ERROR_NO_DEVICE) {
+        UVC_DEBUG("resubmitting transfer failed: %d", libusbRet);
+        _uvc_park_transfer(strmh, transfer);
+      } else if (libusbRet < 0)
       {
         int i;
+        _uvc_stream_device_lost(strmh);
         pthread_mutex_lock(&strmh->cb_mutex);
 
         /* Mark transfer as deleted. */
         for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
           if (strmh->transfers[i] == transfer) {
             UVC_DEBUG("Freeing failed transfer %d (%p)", i, transfer);
-            free(transfer->buffer);
-            libusb_free_transfer(transfer);
-            strmh->transfers[i] = NULL;
+            _uvc_free_transfer(strmh, i);
             break;
           }
         }
@@ -902,9 +1869,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
       for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
         if(strmh->transfers[i] == transfer) {
           UVC_DEBUG("Freeing orphan transfer %d (%p)", i, transfer);
-          free(transfer->buffer);
-          libusb_free_transfer(transfer);
-          strmh->transfers[i] = NULL;
+          _uvc_free_transfer(strmh, i);
           break;
         }
       }
@@ -916,6 +1881,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
       pthread_mutex_unlock(&strmh->cb_mutex);
     }
   }
+  UVC_TRACE_END();
 }
 
 /** Begin streaming video from the camera into the callback function.
@@ -1041,14 +2007,12 @@ uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t
   // Set up the streaming status and data space
   strmh->running = 0;
 
-  strmh->outbuf = malloc( ctrl->dwMaxVideoFrameSize );
-  strmh->holdbuf = malloc( ctrl->dwMaxVideoFrameSize );
-
   strmh->meta_outbuf = malloc( LIBUVC_XFER_META_BUF_SIZE );
   strmh->meta_holdbuf = malloc( LIBUVC_XFER_META_BUF_SIZE );
    
   pthread_mutex_init(&strmh->cb_mutex, NULL);
   pthread_cond_init(&strmh->cb_cond, NULL);
+  pthread_cond_init(&strmh->progress_cond, NULL);
 
   DL_APPEND(devh->streams, strmh);
 
@@ -1058,18 +2022,258 @@ uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t
   return UVC_SUCCESS;
 
 fail:
-  if(strmh)
+  if(strmh) {
+    uvc_buffer_free(strmh->outbuf);
+    uvc_buffer_free(strmh->holdbuf);
     free(strmh);
+  }
   UVC_EXIT(ret);
   return ret;
 }
 
+/* Frame pool buffers of closed streams, handed to the next stream that needs
+ * buffers of at most their size, so reopening a camera does not fault in
+ * fresh frame-sized allocations */
+#define UVC_FRAME_BUFFER_STASH_SIZE LIBUVC_NUM_FRAME_POOL_BUFS
+static pthread_mutex_t frame_buffer_stash_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+  void *buf;
+  size_t bytes;
+} frame_buffer_stash[UVC_FRAME_BUFFER_STASH_SIZE];
+
+/** @internal
+ * @brief Keep a frame buffer for a later stream, freeing the smallest one
+ * when the stash is full
+ */
+static void _uvc_stash_frame_buffer(void *buf, size_t bytes) {
+  int i, smallest = 0;
+
+  if (!buf)
+    return;
+  pthread_mutex_lock(&frame_buffer_stash_mutex);
+  for (i = 0; i < UVC_FRAME_BUFFER_STASH_SIZE; i++) {
+    if (frame_buffer_stash[i].bytes < frame_buffer_stash[smallest].bytes)
+      smallest = i;
+  }
+  if (frame_buffer_stash[smallest].bytes < bytes) {
+    void *evicted = frame_buffer_stash[smallest].buf;
+    frame_buffer_stash[smallest].buf = buf;
+    frame_buffer_stash[smallest].bytes = bytes;
+    buf = evicted;
+  }
+  pthread_mutex_unlock(&frame_buffer_stash_mutex);
+  uvc_buffer_free(buf);
+}
+
+/** @internal
+ * @brief Smallest stashed buffer of at least min_bytes, or a new one
+ */
+static void *_uvc_take_frame_buffer(size_t min_bytes, size_t *bytes) {
+  int i, best = -1;
+  void *buf;
+
+  pthread_mutex_lock(&frame_buffer_stash_mutex);
+  for (i = 0; i < UVC_FRAME_BUFFER_STASH_SIZE; i++) {
+    if (frame_buffer_stash[i].bytes >= min_bytes &&
+        (best < 0 || frame_buffer_stash[i].bytes < frame_buffer_stash[best].bytes))
+      best = i;
+  }
+  if (best >= 0) {
+    buf = frame_buffer_stash[best].buf;
+    *bytes = frame_buffer_stash[best].bytes;
+    frame_buffer_stash[best].buf = NULL;
+    frame_buffer_stash[best].bytes = 0;
+    pthread_mutex_unlock(&frame_buffer_stash_mutex);
+    return buf;
+  }
+  pthread_mutex_unlock(&frame_buffer_stash_mutex);
+  buf = uvc_frame_buffer_alloc(min_bytes);
+  *bytes = buf ? min_bytes : 0;
+  return buf;
+}
+
+/** @brief Free the frame buffers kept from closed streams
+ * @ingroup streaming
+ */
+void uvc_release_frame_buffer_stash(void) {
+  int i;
+
+  pthread_mutex_lock(&frame_buffer_stash_mutex);
+  for (i = 0; i < UVC_FRAME_BUFFER_STASH_SIZE; i++) {
+    uvc_buffer_free(frame_buffer_stash[i].buf);
+    frame_buffer_stash[i].buf = NULL;
+    frame_buffer_stash[i].bytes = 0;
+  }
+  pthread_mutex_unlock(&frame_buffer_stash_mutex);
+}
+
+/** @brief Bytes held by the frame buffers kept from closed streams
+ * @ingroup streaming
+ */
+size_t uvc_frame_buffer_stash_bytes(void) {
+  size_t bytes = 0;
+  int i;
+
+  pthread_mutex_lock(&frame_buffer_stash_mutex);
+  for (i = 0; i < UVC_FRAME_BUFFER_STASH_SIZE; i++)
+    bytes += frame_buffer_stash[i].bytes;
+  pthread_mutex_unlock(&frame_buffer_stash_mutex);
+  return bytes;
+}
+
+/** Report the buffers of a stream
+ * @ingroup streaming
+ *
+ * @param strmh UVC stream handle
+ * @param[out] memory Bytes by use
+ */
+void uvc_stream_get_memory(uvc_stream_handle_t *strmh, uvc_stream_memory_t *memory) {
+  int i;
+
+  memset(memory, 0, sizeof(*memory));
+  pthread_mutex_lock(&strmh->cb_mutex);
+  for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    if (strmh->transfers[i]) {
+      memory->transfer_bytes += strmh->transfer_buf_bytes[i];
+      if (strmh->transfer_buf_dev_mem[i])
+        memory->usbfs_bytes += strmh->transfer_buf_bytes[i];
+    }
+    if (strmh->spare_bufs[i]) {
+      memory->spare_transfer_bytes += strmh->spare_buf_bytes[i];
+      if (strmh->spare_buf_dev_mem[i])
+        memory->usbfs_bytes += strmh->spare_buf_bytes[i];
+    }
+  }
+  for (i = 0; i < LIBUVC_NUM_FRAME_POOL_BUFS; i++) {
+    if (strmh->frame_pool[i].buf)
+      memory->frame_pool_bytes += strmh->frame_pool[i].buf_bytes;
+    if (strmh->frame_pool[i].meta_buf)
+      memory->metadata_bytes += LIBUVC_XFER_META_BUF_SIZE;
+  }
+  memory->polling_bytes = strmh->frame_buf_bytes * 2 + strmh->frame.data_bytes;
+  if (strmh->meta_holdbuf)
+    memory->metadata_bytes += LIBUVC_XFER_META_BUF_SIZE * 2 + strmh->frame.metadata_bytes;
+  pthread_mutex_unlock(&strmh->cb_mutex);
+}
+
+/** Free the buffers a stream does not use right now
+ * @ingroup streaming
+ *
+ * A stopped stream gives up its spare transfer buffers, frame pool and
+ * polling buffers, which the next start allocates again for its format. A
+ * running one only gives up what its current mode does not need. Frames the
+ * user still references are kept. The frame buffer stash is left alone, see
+ * uvc_release_frame_buffer_stash().
+ *
+ * @param strmh UVC stream handle
+ * @return Bytes freed
+ */
+size_t uvc_stream_trim_buffers(uvc_stream_handle_t *strmh) {
+  uvc_stream_memory_t before, after;
+  uint32_t first_slot;
+  uint32_t i;
+  int stopped;
+
+  uvc_stream_get_memory(strmh, &before);
+  pthread_mutex_lock(&strmh->cb_mutex);
+  stopped = !strmh->running && !strmh->stopping;
+  if (stopped) {
+    _uvc_trim_spare_buffers(strmh, 0, 0);
+    _uvc_free_polling_buffers(strmh);
+  }
+  /* playback streams lend their pool out while never running */
+  first_slot = stopped && strmh->devh ? 0 : strmh->frame_pool_size;
+  for (i = first_slot; i < LIBUVC_NUM_FRAME_POOL_BUFS; i++) {
+    struct uvc_pooled_frame *slot = &strmh->frame_pool[i];
+    if (slot->buf && slot->refcount == 0 && !slot->queued && slot != strmh->out_slot) {
+      uvc_buffer_free(slot->buf);
+      slot->buf = NULL;
+      slot->buf_bytes = 0;
+    }
+  }
+  pthread_mutex_unlock(&strmh->cb_mutex);
+  uvc_stream_get_memory(strmh, &after);
+
+  return before.transfer_bytes + before.spare_transfer_bytes + before.frame_pool_bytes +
+      before.polling_bytes - after.transfer_bytes - after.spare_transfer_bytes -
+      after.frame_pool_bytes - after.polling_bytes;
+}
+
+/** @internal
+ * @brief Size the frame pool for the current control block and options, and
+ * pick the first slot to fill
+ */
+static uvc_error_t _uvc_prepare_frame_pool(uvc_stream_handle_t *strmh) {
+  size_t frame_bytes = _uvc_max_frame_bytes(strmh);
+  uvc_error_t ret = UVC_SUCCESS;
+  uint32_t i;
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+
+  strmh->out_slot = NULL;
+  _uvc_clear_ready_slots(strmh);
+
+  /* one slot being filled and at least one to hand out */
+  strmh->frame_pool_size = strmh->options.frame_pool_size;
+  if (!strmh->frame_pool_size)
+    strmh->frame_pool_size = LIBUVC_DEFAULT_FRAME_POOL_BUFS;
+  else if (strmh->frame_pool_size < 2)
+    strmh->frame_pool_size = 2;
+  else if (strmh->frame_pool_size > LIBUVC_NUM_FRAME_POOL_BUFS)
+    strmh->frame_pool_size = LIBUVC_NUM_FRAME_POOL_BUFS;
+  strmh->options.frame_pool_size = strmh->frame_pool_size;
+
+  /* slots left from a larger pool go to the stash */
+  for (i = strmh->frame_pool_size; i < LIBUVC_NUM_FRAME_POOL_BUFS; i++) {
+    struct uvc_pooled_frame *slot = &strmh->frame_pool[i];
+    if (slot->buf && slot->refcount == 0) {
+      _uvc_stash_frame_buffer(slot->buf, slot->buf_bytes);
+      slot->buf = NULL;
+      slot->buf_bytes = 0;
+    }
+  }
+
+  for (i = 0; i < strmh->frame_pool_size; i++) {
+    struct uvc_pooled_frame *slot = &strmh->frame_pool[i];
+    slot->strmh = strmh;
+    if (slot->buf && slot->refcount == 0 && slot->buf_bytes / 2 > frame_bytes) {
+      /* sized for a larger format than this one */
+      uvc_buffer_free(slot->buf);
+      slot->buf = NULL;
+      slot->buf_bytes = 0;
+    }
+    if (slot->buf_bytes < frame_bytes) {
+      if (slot->refcount > 0) {
+        /* cannot grow a buffer the user is still reading */
+        ret = UVC_ERROR_BUSY;
+        goto done;
+      }
+      _uvc_stash_frame_buffer(slot->buf, slot->buf_bytes);
+      slot->buf = _uvc_take_frame_buffer(frame_bytes, &slot->buf_bytes);
+    }
+    if (!slot->meta_buf)
+      slot->meta_buf = malloc(LIBUVC_XFER_META_BUF_SIZE);
+    if (!slot->buf || !slot->meta_buf) {
+      ret = UVC_ERROR_NO_MEM;
+      goto done;
+    }
+  }
+
+  strmh->out_slot = _uvc_find_free_slot(strmh);
+  if (!strmh->out_slot)
+    ret = UVC_ERROR_BUSY;
+
+done:
+  pthread_mutex_unlock(&strmh->cb_mutex);
+  return ret;
+}
+
 /** Begin streaming video from the stream into the callback function.
  * @ingroup streaming
  *
  * @param strmh UVC stream
  * @param cb   User callback function. See {uvc_frame_callback_t} for restrictions.
- * @param flags Stream setup flags, currently undefined. Set this to zero. The lower bit
+ * @param flags Stream setup flags from {uvc_stream_flags}, or zero. The lower bit
  * is reserved for backward compatibility.
  */
 uvc_error_t uvc_stream_start(
@@ -1077,6 +2281,265 @@ uvc_error_t uvc_stream_start(
     uvc_frame_callback_t *cb,
     void *user_ptr,
     uint8_t flags
+) {
+  return uvc_stream_start_with_options(strmh, cb, user_ptr, flags, NULL);
+}
+
+/* Defaults for stream transfers: each isochronous transfer covers about
+ * UVC_XFER_DURATION_US of bus time and the transfers in flight together
+ * about UVC_XFER_QUEUE_US, which rides out scheduling hiccups without
+ * growing past UVC_XFER_MAX_QUEUE_BYTES of buffers on fast buses. */
+#define UVC_XFER_DURATION_US 4000
+#define UVC_XFER_QUEUE_US 50000
+#define UVC_XFER_MAX_QUEUE_BYTES (32 * 1024 * 1024)
+#define UVC_XFER_MIN_TRANSFERS 4
+#define UVC_XFER_TIMEOUT_MS 5000
+/* Bulk transfer size at SuperSpeed, and rough bulk throughput per bus speed */
+#define UVC_BULK_XFER_BYTES_SUPER_SPEED (2 * 1024 * 1024)
+#define UVC_BULK_BYTES_PER_MS_SUPER_SPEED (400 * 1000)
+#define UVC_BULK_BYTES_PER_MS_HIGH_SPEED (40 * 1000)
+#define UVC_BULK_BYTES_PER_MS_FULL_SPEED 1000
+
+/** @internal
+ * @brief Isochronous service interval: one packet per microframe from high
+ * speed up, per frame below
+ */
+static size_t _uvc_iso_interval_us(uvc_stream_handle_t *strmh) {
+  int speed = libusb_get_device_speed(libusb_get_device(strmh->devh->usb_devh));
+  return speed >= LIBUSB_SPEED_HIGH ? 125 : 1000;
+}
+
+/** @internal
+ * @brief Bytes per interval the negotiated format needs: its largest frame at
+ * its frame interval, plus room for payload headers and some headroom
+ */
+static size_t _uvc_iso_needed_bytes(uvc_stream_handle_t *strmh, size_t interval_us) {
+  uint64_t frame_interval_100ns = strmh->cur_ctrl.dwFrameInterval;
+  uint64_t bytes;
+
+  if (frame_interval_100ns == 0)
+    return strmh->cur_ctrl.dwMaxPayloadTransferSize;
+  bytes = ((uint64_t) strmh->cur_ctrl.dwMaxVideoFrameSize * interval_us * 10 +
+      frame_interval_100ns - 1) / frame_interval_100ns;
+  bytes += bytes * UVC_ISO_BANDWIDTH_MARGIN_PCT / 100 + 12;
+  /* a payload never holds more than the camera asked for */
+  if (bytes > strmh->cur_ctrl.dwMaxPayloadTransferSize)
+    bytes = strmh->cur_ctrl.dwMaxPayloadTransferSize;
+  return bytes;
+}
+
+static uint32_t _uvc_clamp_transfers(size_t transfers) {
+  if (transfers < UVC_XFER_MIN_TRANSFERS)
+    return UVC_XFER_MIN_TRANSFERS;
+  if (transfers > LIBUVC_NUM_TRANSFER_BUFS)
+    return LIBUVC_NUM_TRANSFER_BUFS;
+  return transfers;
+}
+
+/** @internal
+ * @brief Fills the zero fields of options for an isochronous endpoint
+ */
+static void _uvc_size_iso_transfers(
+    uvc_stream_handle_t *strmh,
+    size_t bytes_per_packet,
+    uvc_stream_options_t *options) {
+  size_t interval_us = _uvc_iso_interval_us(strmh);
+  size_t frame_packets =
+      (strmh->cur_ctrl.dwMaxVideoFrameSize + bytes_per_packet - 1) / bytes_per_packet;
+
+  if (!options->packets_per_transfer) {
+    size_t duration_us =
+        options->transfer_duration_us ? options->transfer_duration_us : UVC_XFER_DURATION_US;
+    size_t packets = duration_us / interval_us;
+    /* Transfers are at most one frame long */
+    if (frame_packets > 0 && packets > frame_packets)
+      packets = frame_packets;
+    options->packets_per_transfer = packets > 0 ? packets : 1;
+  }
+  if (!options->num_transfers) {
+    size_t transfer_us = options->packets_per_transfer * interval_us;
+    size_t transfers = (UVC_XFER_QUEUE_US + transfer_us - 1) / transfer_us;
+    size_t max_transfers =
+        UVC_XFER_MAX_QUEUE_BYTES / (options->packets_per_transfer * bytes_per_packet);
+    if (transfers > max_transfers)
+      transfers = max_transfers;
+    options->num_transfers = _uvc_clamp_transfers(transfers);
+  }
+  options->bulk_transfer_size = 0;
+}
+
+/** @internal
+ * @brief Fills the zero fields of options for a bulk endpoint
+ */
+static void _uvc_size_bulk_transfers(
+    uvc_stream_handle_t *strmh,
+    uvc_stream_options_t *options) {
+  int speed = libusb_get_device_speed(libusb_get_device(strmh->devh->usb_devh));
+  int super_speed = speed >= LIBUSB_SPEED_SUPER;
+  size_t payload_size = strmh->cur_ctrl.dwMaxPayloadTransferSize;
+  size_t bytes_per_ms = UVC_BULK_BYTES_PER_MS_FULL_SPEED;
+
+  if (super_speed)
+    bytes_per_ms = UVC_BULK_BYTES_PER_MS_SUPER_SPEED;
+  else if (speed == LIBUSB_SPEED_HIGH)
+    bytes_per_ms = UVC_BULK_BYTES_PER_MS_HIGH_SPEED;
+  if (payload_size == 0)
+    payload_size = strmh->cur_ctrl.dwMaxVideoFrameSize;
+  /* Capture cards often report payloads of a few KB, so at SuperSpeed a
+   * transfer packs many of them to keep per-transfer overhead off the bus */
+  if (strmh->bulk_single_payload) {
+    options->bulk_transfer_size = payload_size;
+  } else if (!options->bulk_transfer_size && options->transfer_duration_us) {
+    size_t bytes = bytes_per_ms * options->transfer_duration_us / 1000;
+    /* Transfers are at most one frame long */
+    if (bytes > strmh->cur_ctrl.dwMaxVideoFrameSize)
+      bytes = strmh->cur_ctrl.dwMaxVideoFrameSize;
+    options->bulk_transfer_size = bytes;
+  } else if (!options->bulk_transfer_size) {
+    options->bulk_transfer_size = super_speed ? UVC_BULK_XFER_BYTES_SUPER_SPEED : payload_size;
+  }
+  /* Payloads must not straddle transfers */
+  if (options->bulk_transfer_size < payload_size)
+    options->bulk_transfer_size = payload_size;
+  else
+    options->bulk_transfer_size -= options->bulk_transfer_size % payload_size;
+
+  if (!options->num_transfers) {
+    /* Enough in flight to keep the bus busy for UVC_XFER_QUEUE_US */
+    size_t queue_bytes;
+    size_t transfers;
+    size_t max_transfers;
+    queue_bytes = bytes_per_ms * (UVC_XFER_QUEUE_US / 1000);
+    transfers = (queue_bytes + options->bulk_transfer_size - 1) / options->bulk_transfer_size;
+    max_transfers = UVC_XFER_MAX_QUEUE_BYTES / options->bulk_transfer_size;
+    if (transfers > max_transfers)
+      transfers = max_transfers;
+    options->num_transfers = _uvc_clamp_transfers(transfers);
+  }
+  options->packets_per_transfer = 0;
+}
+
+/** Reports the isochronous bandwidth reserved and used by the running or
+ * last started stream
+ * @ingroup streaming
+ */
+void uvc_stream_get_bandwidth(uvc_stream_handle_t *strmh, uvc_stream_bandwidth_t *bandwidth) {
+  *bandwidth = strmh->bandwidth;
+}
+
+/** Reports the transport counters of the running or last started stream
+ * @ingroup streaming
+ */
+void uvc_stream_get_transport(uvc_stream_handle_t *strmh, uvc_stream_transport_t *transport) {
+  const struct uvc_stream_transport *counters = &strmh->transport;
+
+  transport->packets = __atomic_load_n(&counters->packets, __ATOMIC_RELAXED);
+  transport->packet_errors = __atomic_load_n(&counters->packet_errors, __ATOMIC_RELAXED);
+  transport->short_packets = __atomic_load_n(&counters->short_packets, __ATOMIC_RELAXED);
+  transport->empty_packets = __atomic_load_n(&counters->empty_packets, __ATOMIC_RELAXED);
+  transport->bytes = __atomic_load_n(&counters->bytes, __ATOMIC_RELAXED);
+  transport->header_errors = __atomic_load_n(&counters->header_errors, __ATOMIC_RELAXED);
+  transport->incomplete_frames = __atomic_load_n(&counters->incomplete_frames, __ATOMIC_RELAXED);
+  transport->frames_without_eof = __atomic_load_n(&counters->frames_without_eof, __ATOMIC_RELAXED);
+  transport->max_packet_bytes = __atomic_load_n(&counters->max_packet_bytes, __ATOMIC_RELAXED);
+}
+
+/** Sets the function called when a transfer of the running stream finds the
+ * device gone, such as after the cable came off. Set it before starting the
+ * stream; NULL removes it.
+ * @ingroup streaming
+ */
+void uvc_stream_set_device_lost_callback(uvc_stream_handle_t *strmh,
+    uvc_device_lost_callback_t *cb,
+    void *user_ptr) {
+  strmh->device_lost_cb = cb;
+  strmh->device_lost_user_ptr = user_ptr;
+}
+
+/** Whether a transfer found the device gone since the stream last started
+ * @ingroup streaming
+ */
+int uvc_stream_device_lost(uvc_stream_handle_t *strmh) {
+  return __atomic_load_n(&strmh->device_lost, __ATOMIC_RELAXED);
+}
+
+/** Transfers of the running stream that are submitted, fewer than
+ * uvc_stream_options_t::num_transfers when some failed or were freed
+ * @ingroup streaming
+ */
+uint32_t uvc_stream_transfers_in_flight(uvc_stream_handle_t *strmh) {
+  uint32_t in_flight = 0;
+  int i;
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    if (strmh->transfers[i] != NULL && !strmh->transfer_parked[i])
+      in_flight++;
+  }
+  pthread_mutex_unlock(&strmh->cb_mutex);
+  return in_flight;
+}
+
+/** Submits again the transfers of the running stream that completed with an
+ * error, or could not be resubmitted, and were kept since
+ * @ingroup streaming
+ *
+ * @return Number of transfers submitted
+ */
+int uvc_stream_rearm_transfers(uvc_stream_handle_t *strmh) {
+  int rearmed = 0;
+  int i;
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS && strmh->running; i++) {
+    if (strmh->transfers[i] == NULL || !strmh->transfer_parked[i])
+      continue;
+    if (libusb_submit_transfer(strmh->transfers[i]) != LIBUSB_SUCCESS)
+      break;
+    strmh->transfer_parked[i] = 0;
+    rearmed++;
+  }
+  pthread_mutex_unlock(&strmh->cb_mutex);
+  return rearmed;
+}
+
+/** Isochronous bus bandwidth the device's running streams reserve, in
+ * bytes per second
+ * @ingroup streaming
+ */
+uint64_t uvc_get_reserved_iso_bandwidth(uvc_device_handle_t *devh) {
+  uvc_stream_handle_t *strmh;
+  uint64_t total = 0;
+
+  DL_FOREACH(devh->streams, strmh) {
+    if (strmh->running && strmh->bandwidth.interval_us > 0)
+      total += (uint64_t) strmh->bandwidth.reserved_bytes * 1000000 / strmh->bandwidth.interval_us;
+  }
+  return total;
+}
+
+/** Reports the transfer geometry of the running or last started stream
+ * @ingroup streaming
+ */
+void uvc_stream_get_options(uvc_stream_handle_t *strmh, uvc_stream_options_t *options) {
+  *options = strmh->options;
+}
+
+/** Begin streaming video from the stream into the callback function, with
+ * the given transfer geometry.
+ * @ingroup streaming
+ *
+ * @param strmh UVC stream
+ * @param cb   User callback function. See {uvc_frame_callback_t} for restrictions.
+ * @param flags Stream setup flags from {uvc_stream_flags}, or zero.
+ * @param options Transfer geometry, NULL or zero fields for what suits the stream.
+ */
+uvc_error_t uvc_stream_start_with_options(
+    uvc_stream_handle_t *strmh,
+    uvc_frame_callback_t *cb,
+    void *user_ptr,
+    uint8_t flags,
+    const uvc_stream_options_t *options
 ) {
   /* USB interface we'll be using */
   const struct libusb_interface *interface;
@@ -1095,16 +2558,40 @@ uvc_error_t uvc_stream_start(
 
   UVC_ENTER();
 
+  /* finish a stop that only cancelled the transfers */
+  if (strmh->stopping)
+    uvc_stream_stop(strmh);
+
   if (strmh->running) {
     UVC_EXIT(UVC_ERROR_BUSY);
     return UVC_ERROR_BUSY;
   }
 
+  if (options) {
+    strmh->options = *options;
+    if (strmh->options.num_transfers > LIBUVC_NUM_TRANSFER_BUFS)
+      strmh->options.num_transfers = LIBUVC_NUM_TRANSFER_BUFS;
+  } else {
+    memset(&strmh->options, 0, sizeof(strmh->options));
+  }
+  if (!strmh->options.transfer_timeout_ms)
+    strmh->options.transfer_timeout_ms = UVC_XFER_TIMEOUT_MS;
+  _uvc_resolve_streaming_copy(strmh);
+
+  memset(&strmh->bandwidth, 0, sizeof(strmh->bandwidth));
+  memset(&strmh->transport, 0, sizeof(strmh->transport));
+  strmh->frame_incomplete = 0;
+  strmh->frame_truncated = 0;
+  __atomic_store_n(&strmh->device_lost, 0, __ATOMIC_RELAXED);
+  strmh->iso_window_packets = 0;
+  strmh->iso_window_errors = 0;
+
   strmh->running = 1;
   strmh->seq = 1;
   strmh->fid = 0;
   strmh->pts = 0;
   strmh->last_scr = 0;
+  strmh->scr_sof_valid = 0;
 
   frame_desc = uvc_find_frame_desc_stream(strmh, ctrl->bFormatIndex, ctrl->bFrameIndex);
   if (!frame_desc) {
@@ -1118,6 +2605,28 @@ uvc_error_t uvc_stream_start(
     ret = UVC_ERROR_NOT_SUPPORTED;
     goto fail;
   }
+  _uvc_build_frame_template(strmh, frame_desc);
+
+  /* borrowed frames are only delivered through the callback thread, polled
+   * pool frames only without one */
+  if (((flags & UVC_STREAM_FLAG_BORROWED_FRAMES) && !cb) ||
+      ((flags & UVC_STREAM_FLAG_POLLED_FRAMES) && cb)) {
+    ret = UVC_ERROR_INVALID_PARAM;
+    goto fail;
+  }
+  if (cb || (flags & UVC_STREAM_FLAG_POLLED_FRAMES)) {
+    ret = _uvc_prepare_frame_pool(strmh);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+    /* frames are assembled in the pool, the polling buffers would only be a
+     * second and third copy */
+    _uvc_free_polling_buffers(strmh);
+  } else {
+    strmh->options.frame_pool_size = 0;
+    ret = _uvc_grow_frame_buffers(strmh);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+  }
 
   // Get the interface that provides the chosen format and frame configuration
   interface_id = strmh->stream_if->bInterfaceNumber;
@@ -1143,6 +2652,13 @@ uvc_error_t uvc_stream_start(
     int alt_idx, ep_idx;
     
     config_bytes_per_packet = strmh->cur_ctrl.dwMaxPayloadTransferSize;
+    strmh->bandwidth.interval_us = _uvc_iso_interval_us(strmh);
+    strmh->bandwidth.needed_bytes =
+        _uvc_iso_needed_bytes(strmh, strmh->bandwidth.interval_us);
+    if (strmh->options.fit_iso_bandwidth)
+      config_bytes_per_packet = strmh->bandwidth.needed_bytes;
+    else
+      strmh->iso_min_alt_idx = 0;
 
     /* Go through the altsettings and find one whose packets are at least
      * as big as our format's maximum per-packet usage. Assume that the
@@ -1175,16 +2691,11 @@ uvc_error_t uvc_stream_start(
         }
       }
 
-      if (endpoint_bytes_per_packet >= config_bytes_per_packet) {
-        /* Transfers will be at most one frame long: Divide the maximum frame size
-         * by the size of the endpoint and round up */
-        packets_per_transfer = (ctrl->dwMaxVideoFrameSize +
-                                endpoint_bytes_per_packet - 1) / endpoint_bytes_per_packet;
-
-        /* But keep a reasonable limit: Otherwise we start dropping data */
-        if (packets_per_transfer > 32)
-          packets_per_transfer = 32;
-        
+      /* an altsetting that failed before needs the next one up, if any */
+      if (endpoint_bytes_per_packet >= config_bytes_per_packet &&
+          (alt_idx >= strmh->iso_min_alt_idx || alt_idx == interface->num_altsetting - 1)) {
+        _uvc_size_iso_transfers(strmh, endpoint_bytes_per_packet, &strmh->options);
+        packets_per_transfer = strmh->options.packets_per_transfer;
         total_transfer_size = packets_per_transfer * endpoint_bytes_per_packet;
         break;
       }
@@ -1196,6 +2707,10 @@ uvc_error_t uvc_stream_start(
       goto fail;
     }
 
+    strmh->iso_alt_idx = alt_idx;
+    strmh->bandwidth.reserved_bytes = endpoint_bytes_per_packet;
+    strmh->bandwidth.altsetting = altsetting->bAlternateSetting;
+
     /* Select the altsetting */
     ret = libusb_set_interface_alt_setting(strmh->devh->usb_devh,
                                            altsetting->bInterfaceNumber,
@@ -1206,44 +2721,70 @@ uvc_error_t uvc_stream_start(
     }
 
     /* Set up the transfers */
-    for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS; ++transfer_id) {
+    _uvc_trim_spare_buffers(strmh, strmh->options.num_transfers, total_transfer_size);
+    for (transfer_id = 0; transfer_id < strmh->options.num_transfers; ++transfer_id) {
       transfer = libusb_alloc_transfer(packets_per_transfer);
       strmh->transfers[transfer_id] = transfer;      
-      strmh->transfer_bufs[transfer_id] = malloc(total_transfer_size);
+      strmh->transfer_bufs[transfer_id] =
+          _uvc_alloc_transfer_buffer(strmh, transfer_id, total_transfer_size);
 
       libusb_fill_iso_transfer(
         transfer, strmh->devh->usb_devh, format_desc->parent->bEndpointAddress,
         strmh->transfer_bufs[transfer_id],
-        total_transfer_size, packets_per_transfer, _uvc_stream_callback, (void*) strmh, 5000);
+        total_transfer_size, packets_per_transfer, _uvc_stream_callback, (void*) strmh,
+        strmh->options.transfer_timeout_ms);
 
       libusb_set_iso_packet_lengths(transfer, endpoint_bytes_per_packet);
     }
   } else {
-    for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS;
+    _uvc_size_bulk_transfers(strmh, &strmh->options);
+    _uvc_trim_spare_buffers(strmh, strmh->options.num_transfers,
+        strmh->options.bulk_transfer_size);
+    for (transfer_id = 0; transfer_id < strmh->options.num_transfers;
         ++transfer_id) {
       transfer = libusb_alloc_transfer(0);
       strmh->transfers[transfer_id] = transfer;
-      strmh->transfer_bufs[transfer_id] = malloc (
-          strmh->cur_ctrl.dwMaxPayloadTransferSize );
+      strmh->transfer_bufs[transfer_id] = _uvc_alloc_transfer_buffer(
+          strmh, transfer_id, strmh->options.bulk_transfer_size );
       libusb_fill_bulk_transfer ( transfer, strmh->devh->usb_devh,
           format_desc->parent->bEndpointAddress,
           strmh->transfer_bufs[transfer_id],
-          strmh->cur_ctrl.dwMaxPayloadTransferSize, _uvc_stream_callback,
-          ( void* ) strmh, 5000 );
+          strmh->options.bulk_transfer_size, _uvc_stream_callback,
+          ( void* ) strmh, strmh->options.transfer_timeout_ms );
     }
   }
 
   strmh->user_cb = cb;
   strmh->user_ptr = user_ptr;
 
+  strmh->borrowed_frames = (flags & UVC_STREAM_FLAG_BORROWED_FRAMES) != 0;
+  /* callback and polled pool frames are assembled in the pool and lent out
+   * without a copy */
+  strmh->pooled_frames = cb != NULL || (flags & UVC_STREAM_FLAG_POLLED_FRAMES) != 0;
+  if (strmh->pooled_frames) {
+    strmh->own_outbuf = strmh->outbuf;
+    strmh->own_meta_outbuf = strmh->meta_outbuf;
+    strmh->outbuf = strmh->out_slot->buf;
+    strmh->meta_outbuf = strmh->out_slot->meta_buf;
+    strmh->got_bytes = 0;
+    strmh->meta_got_bytes = 0;
+    strmh->dropped_frames = 0;
+    strmh->progress_seq = strmh->seq;
+    strmh->progress_bytes = 0;
+    strmh->progress_buf = strmh->outbuf;
+    strmh->progress_next_bytes = strmh->options.progress_bytes;
+  }
+
+  strmh->inline_callback = cb && (flags & UVC_STREAM_FLAG_INLINE_CALLBACK);
+
   /* If the user wants it, set up a thread that calls the user's function
    * with the contents of each frame.
    */
-  if (cb) {
+  if (cb && !strmh->inline_callback) {
     pthread_create(&strmh->cb_thread, NULL, _uvc_user_caller, (void*) strmh);
   }
 
-  for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS;
+  for (transfer_id = 0; transfer_id < strmh->options.num_transfers;
       transfer_id++) {
     ret = libusb_submit_transfer(strmh->transfers[transfer_id]);
     if (ret != UVC_SUCCESS) {
@@ -1253,10 +2794,8 @@ uvc_error_t uvc_stream_start(
   }
 
   if ( ret != UVC_SUCCESS && transfer_id >= 0 ) {
-    for ( ; transfer_id < LIBUVC_NUM_TRANSFER_BUFS; transfer_id++) {
-      free ( strmh->transfers[transfer_id]->buffer );
-      libusb_free_transfer ( strmh->transfers[transfer_id]);
-      strmh->transfers[transfer_id] = 0;
+    for ( ; transfer_id < strmh->options.num_transfers; transfer_id++) {
+      _uvc_free_transfer(strmh, transfer_id);
     }
     ret = UVC_SUCCESS;
   }
@@ -1295,13 +2834,15 @@ uvc_error_t uvc_stream_start_iso(
  */
 void *_uvc_user_caller(void *arg) {
   uvc_stream_handle_t *strmh = (uvc_stream_handle_t *) arg;
+  struct uvc_pooled_frame *slot;
+  uvc_frame_t *frame;
 
   uint32_t last_seq = 0;
 
   do {
     pthread_mutex_lock(&strmh->cb_mutex);
 
-    while (strmh->running && last_seq == strmh->hold_seq) {
+    while (strmh->running && strmh->ready_count == 0) {
       pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
     }
 
@@ -1310,68 +2851,146 @@ void *_uvc_user_caller(void *arg) {
       break;
     }
     
-    last_seq = strmh->hold_seq;
-    _uvc_populate_frame(strmh);
+    slot = _uvc_claim_ready_slot(strmh);
     
     pthread_mutex_unlock(&strmh->cb_mutex);
     
-    strmh->user_cb(&strmh->frame, strmh->user_ptr);
+    frame = _uvc_populate_borrowed_frame(strmh, slot);
+    /* Frames completed since the last callback that the user never sees */
+    UVC_TRACE_COUNTER("uvc_frames_skipped", last_seq ? frame->sequence - last_seq - 1 : 0);
+    last_seq = frame->sequence;
+    
+    UVC_TRACE_BEGIN("uvc_user_callback");
+    strmh->user_cb(frame, strmh->user_ptr);
+    UVC_TRACE_END();
+    if (!strmh->borrowed_frames)
+      uvc_release_frame(frame);
   } while(1);
 
   return NULL; // return value ignored
 }
 
 /** @internal
- * @brief Populate the fields of a frame to be handed to user code
- * must be called with stream cb lock held!
+ * @brief Describe the frames of the control block's format and frame
+ * descriptors, so that frames do not look them up while holding cb_mutex
  */
-void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
-  uvc_frame_t *frame = &strmh->frame;
-  uvc_frame_desc_t *frame_desc;
-
-  /** @todo this stuff that hits the main config cache should really happen
-   * in start() so that only one thread hits these data. all of this stuff
-   * is going to be reopen_on_change anyway
-   */
+static void _uvc_set_frame_template(
+    uvc_stream_handle_t *strmh,
+    enum uvc_frame_format frame_format,
+    uint32_t width,
+    uint32_t height) {
+  struct uvc_frame_template *tmpl = &strmh->frame_template;
 
-  frame_desc = uvc_find_frame_desc(strmh->devh, strmh->cur_ctrl.bFormatIndex,
-				   strmh->cur_ctrl.bFrameIndex);
+  tmpl->frame_format = frame_format;
+  tmpl->width = width;
+  tmpl->height = height;
 
-  frame->frame_format = strmh->frame_format;
-  
-  frame->width = frame_desc->wWidth;
-  frame->height = frame_desc->wHeight;
-  
-  switch (frame->frame_format) {
+  switch (tmpl->frame_format) {
   case UVC_FRAME_FORMAT_BGR:
-    frame->step = frame->width * 3;
+    tmpl->step = tmpl->width * 3;
     break;
   case UVC_FRAME_FORMAT_YUYV:
-    frame->step = frame->width * 2;
+  case UVC_FRAME_FORMAT_UYVY:
+    tmpl->step = tmpl->width * 2;
+    break;
+  case UVC_FRAME_FORMAT_GRAY8:
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+  case UVC_FRAME_FORMAT_SGRBG8:
+  case UVC_FRAME_FORMAT_SGBRG8:
+  case UVC_FRAME_FORMAT_SRGGB8:
+  case UVC_FRAME_FORMAT_SBGGR8:
+    tmpl->step = tmpl->width;
+    break;
+  case UVC_FRAME_FORMAT_GRAY16:
+  case UVC_FRAME_FORMAT_SGRBG10:
+  case UVC_FRAME_FORMAT_SGBRG10:
+  case UVC_FRAME_FORMAT_SRGGB10:
+  case UVC_FRAME_FORMAT_SBGGR10:
+  case UVC_FRAME_FORMAT_SGRBG16:
+  case UVC_FRAME_FORMAT_SGBRG16:
+  case UVC_FRAME_FORMAT_SRGGB16:
+  case UVC_FRAME_FORMAT_SBGGR16:
+  case UVC_FRAME_FORMAT_Z16:
+    tmpl->step = tmpl->width * 2;
     break;
   case UVC_FRAME_FORMAT_NV12:
-    frame->step = frame->width;
+    tmpl->step = tmpl->width;
     break;
   case UVC_FRAME_FORMAT_P010:
-    frame->step = frame->width * 2;
-        break;
-  case UVC_FRAME_FORMAT_MJPEG:
-    frame->step = 0;
+    tmpl->step = tmpl->width * 2;
     break;
+  case UVC_FRAME_FORMAT_MJPEG:
   case UVC_FRAME_FORMAT_H264:
-    frame->step = 0;
-    break;
+  case UVC_FRAME_FORMAT_H265:
+  case UVC_FRAME_FORMAT_VP8:
+  case UVC_FRAME_FORMAT_VP9:
   default:
-    frame->step = 0;
+    /* Compressed payloads have no rows; data_bytes is their size. */
+    tmpl->step = 0;
     break;
   }
+}
+
+static void _uvc_build_frame_template(uvc_stream_handle_t *strmh, uvc_frame_desc_t *frame_desc) {
+  _uvc_set_frame_template(strmh, strmh->frame_format, frame_desc->wWidth, frame_desc->wHeight);
+  strmh->frame_template.frame_desc = frame_desc;
+}
+
+/** @internal
+ * @brief Fill in the format and geometry fields of a frame from the stream's
+ * frame template
+ */
+static void _uvc_populate_frame_info(
+    uvc_stream_handle_t *strmh,
+    uvc_frame_t *frame,
+    uint8_t still) {
+  const struct uvc_frame_template *tmpl = &strmh->frame_template;
+
+  frame->frame_format = tmpl->frame_format;
+  frame->width = tmpl->width;
+  frame->height = tmpl->height;
+  frame->step = tmpl->step;
+  frame->still = still;
+  if (still && strmh->still_width && tmpl->width) {
+    frame->step = tmpl->step / tmpl->width * strmh->still_width;
+    frame->width = strmh->still_width;
+    frame->height = strmh->still_height;
+  }
+}
 
+/** @internal
+ * @brief Decode the metadata and SCR SOF of a frame into frame->meta
+ * @param meta_bytes Metadata of this frame, frame->metadata_bytes may be stale
+ * @param scr_sof SOF counter of the last SCR, or UVC_SCR_SOF_NONE
+ */
+static void _uvc_populate_frame_meta(uvc_frame_t *frame, size_t meta_bytes, uint16_t scr_sof) {
+  uvc_parse_frame_meta(meta_bytes > 0 ? frame->metadata : NULL, meta_bytes, &frame->meta);
+  if (scr_sof != UVC_SCR_SOF_NONE) {
+    frame->meta.scr_sof = scr_sof;
+    frame->meta.flags |= UVC_FRAME_META_SCR_SOF;
+  }
+}
+
+/** @internal
+ * @brief Populate the fields of a frame to be handed to user code
+ * must be called with stream cb lock held!
+ */
+void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
+  uvc_frame_t *frame = &strmh->frame;
+
+  _uvc_populate_frame_info(strmh, frame, strmh->hold_still);
+  frame->incomplete = strmh->hold_incomplete;
   frame->sequence = strmh->hold_seq;
   frame->capture_time_finished = strmh->capture_time_finished;
+  frame->pts = strmh->hold_pts;
+  frame->last_scr = strmh->hold_last_scr;
 
   /* copy the image data from the hold buffer to the frame (unnecessary extra buf?) */
   if (frame->data_bytes < strmh->hold_bytes) {
-    frame->data = realloc(frame->data, strmh->hold_bytes);
+    /* overwritten below, nothing to copy */
+    uvc_buffer_free(frame->data);
+    frame->data = uvc_buffer_alloc(strmh->hold_bytes);
   }
   frame->data_bytes = strmh->hold_bytes;
   memcpy(frame->data, strmh->holdbuf, frame->data_bytes);
@@ -1385,6 +3004,70 @@ void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
       frame->metadata_bytes = strmh->meta_hold_bytes;
       memcpy(frame->metadata, strmh->meta_holdbuf, frame->metadata_bytes);
   }
+  _uvc_populate_frame_meta(frame, strmh->meta_hold_bytes, strmh->hold_last_scr_sof);
+}
+
+/** @internal
+ * @brief Lend a completed slot to user code without copying it
+ * The slot must have been claimed with _uvc_claim_ready_slot(), whose reference
+ * the returned frame carries for the caller. The lock is not needed: nothing
+ * else writes a referenced slot, and the template only changes while stopped.
+ */
+uvc_frame_t *_uvc_populate_borrowed_frame(
+    uvc_stream_handle_t *strmh,
+    struct uvc_pooled_frame *slot) {
+  uvc_frame_t *frame = &slot->frame;
+
+  _uvc_populate_frame_info(strmh, frame, slot->still);
+  frame->incomplete = slot->incomplete;
+  frame->sequence = slot->seq;
+  frame->capture_time_finished = slot->capture_time;
+  frame->pts = slot->pts;
+  frame->last_scr = slot->last_scr;
+
+  frame->source = strmh->devh;
+  /* the pool owns the buffer, conversion functions must not realloc it */
+  frame->library_owns_data = 0;
+  frame->data = slot->buf;
+  frame->data_bytes = slot->bytes;
+  frame->metadata = slot->meta_bytes > 0 ? slot->meta_buf : NULL;
+  frame->metadata_bytes = slot->meta_bytes;
+  _uvc_populate_frame_meta(frame, slot->meta_bytes, slot->last_scr_sof);
+
+  return frame;
+}
+
+/** @brief Take an extra reference on a borrowed frame
+ * @ingroup streaming
+ *
+ * Only valid for frames delivered by a stream started with
+ * UVC_STREAM_FLAG_BORROWED_FRAMES.
+ *
+ * @param frame Frame received by the callback
+ */
+void uvc_retain_frame(uvc_frame_t *frame) {
+  struct uvc_pooled_frame *slot = (struct uvc_pooled_frame *) frame;
+
+  pthread_mutex_lock(&slot->strmh->cb_mutex);
+  slot->refcount++;
+  pthread_mutex_unlock(&slot->strmh->cb_mutex);
+}
+
+/** @brief Drop a reference on a borrowed frame
+ * @ingroup streaming
+ *
+ * Once the last reference is dropped the buffer goes back to the stream's pool
+ * and the frame must no longer be accessed.
+ *
+ * @param frame Frame received by the callback
+ */
+void uvc_release_frame(uvc_frame_t *frame) {
+  struct uvc_pooled_frame *slot = (struct uvc_pooled_frame *) frame;
+
+  pthread_mutex_lock(&slot->strmh->cb_mutex);
+  if (slot->refcount > 0)
+    slot->refcount--;
+  pthread_mutex_unlock(&slot->strmh->cb_mutex);
 }
 
 /** Poll for a frame
@@ -1407,6 +3090,10 @@ uvc_error_t uvc_stream_get_frame(uvc_stream_handle_t *strmh,
   if (strmh->user_cb)
     return UVC_ERROR_CALLBACK_EXISTS;
 
+  /* started with UVC_STREAM_FLAG_POLLED_FRAMES, see uvc_stream_acquire_frame() */
+  if (strmh->pooled_frames)
+    return UVC_ERROR_INVALID_MODE;
+
   pthread_mutex_lock(&strmh->cb_mutex);
 
   if (strmh->last_polled_seq < strmh->hold_seq) {
@@ -1467,6 +3154,131 @@ uvc_error_t uvc_stream_get_frame(uvc_stream_handle_t *strmh,
   return UVC_SUCCESS;
 }
 
+/** Take the oldest completed frame of a polled pool stream
+ * @ingroup streaming
+ *
+ * For streams started with UVC_STREAM_FLAG_POLLED_FRAMES. The frame points
+ * straight into the stream's pool and no other user sees it; drop it with
+ * uvc_release_frame(), and before uvc_stream_close(). While the caller holds
+ * every slot but the one being filled, new frames replace the oldest one
+ * waiting instead, as for callbacks.
+ *
+ * @param strmh UVC stream handle
+ * @param[out] frame Frame taken, NULL on error or timeout
+ * @param timeout_us >0: Wait at most N microseconds; 0: Wait indefinitely; -1: return immediately
+ * @return UVC_ERROR_TIMEOUT without a frame, UVC_ERROR_INTERRUPTED when the
+ * stream stopped while waiting
+ */
+uvc_error_t uvc_stream_acquire_frame(uvc_stream_handle_t *strmh,
+    uvc_frame_t **frame,
+    int32_t timeout_us) {
+  struct uvc_pooled_frame *slot = NULL;
+  struct timespec ts;
+  uvc_error_t ret = UVC_SUCCESS;
+
+  *frame = NULL;
+  if (!strmh->running)
+    return UVC_ERROR_INVALID_PARAM;
+  if (strmh->user_cb || !strmh->pooled_frames)
+    return UVC_ERROR_INVALID_MODE;
+
+  if (timeout_us > 0) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_us / 1000000;
+    ts.tv_nsec += (timeout_us % 1000000) * 1000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+  }
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  while (strmh->running && strmh->ready_count == 0 && timeout_us != -1) {
+    int err = timeout_us == 0 ?
+        pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex) :
+        pthread_cond_timedwait(&strmh->cb_cond, &strmh->cb_mutex, &ts);
+    if (err == ETIMEDOUT)
+      break;
+  }
+  if (!strmh->running)
+    ret = UVC_ERROR_INTERRUPTED;
+  else if (strmh->ready_count == 0)
+    ret = UVC_ERROR_TIMEOUT;
+  else
+    slot = _uvc_claim_ready_slot(strmh);
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  if (slot)
+    *frame = _uvc_populate_borrowed_frame(strmh, slot);
+  return ret;
+}
+
+/** Wait for more of the frame being assembled to arrive
+ * @ingroup streaming
+ *
+ * For streams started with uvc_stream_options_t's progress_bytes. Returns
+ * once the frame after sequence is being assembled, or frame sequence has
+ * at least min_bytes, filling in progress with the frame being assembled:
+ * its sequence, geometry, data and the data_bytes that arrived so far.
+ *
+ * Rows below data_bytes stay as they are until the frame completes, but the
+ * buffer may be reused for a later frame if this one is dropped. Converted
+ * rows are only valid if the callback then delivers frame sequence with the
+ * same data pointer.
+ *
+ * @param strmh UVC stream handle
+ * @param sequence Frame the caller has seen progress of, 0 for none
+ * @param min_bytes Bytes of frame sequence to wait for
+ * @param timeout_us >0: Wait at most N microseconds; 0: Wait indefinitely; -1: return immediately
+ * @param[out] progress Frame being assembled, also on UVC_ERROR_TIMEOUT
+ */
+uvc_error_t uvc_stream_wait_frame_progress(
+    uvc_stream_handle_t *strmh,
+    uint32_t sequence,
+    size_t min_bytes,
+    int32_t timeout_us,
+    uvc_frame_t *progress) {
+  struct timespec ts;
+  uvc_error_t ret = UVC_SUCCESS;
+
+  if (!strmh->running || !strmh->pooled_frames || !strmh->options.progress_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (timeout_us > 0) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_us / 1000000;
+    ts.tv_nsec += (timeout_us % 1000000) * 1000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec = ts.tv_nsec % 1000000000;
+  }
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  while (strmh->running && strmh->progress_seq == sequence &&
+      strmh->progress_bytes < min_bytes) {
+    if (timeout_us == -1) {
+      ret = UVC_ERROR_TIMEOUT;
+      break;
+    }
+    if (timeout_us == 0) {
+      pthread_cond_wait(&strmh->progress_cond, &strmh->cb_mutex);
+    } else if (pthread_cond_timedwait(&strmh->progress_cond, &strmh->cb_mutex, &ts) != 0) {
+      ret = UVC_ERROR_TIMEOUT;
+      break;
+    }
+  }
+  if (!strmh->running)
+    ret = UVC_ERROR_INVALID_PARAM;
+
+  memset(progress, 0, sizeof(*progress));
+  _uvc_populate_frame_info(strmh, progress, 0);
+  progress->sequence = strmh->progress_seq;
+  progress->data = strmh->progress_buf;
+  progress->data_bytes = strmh->progress_bytes;
+  progress->source = strmh->devh;
+  progress->library_owns_data = 0;
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  return ret;
+}
+
 /** @brief Stop streaming video
  * @ingroup streaming
  *
@@ -1482,20 +3294,22 @@ void uvc_stop_streaming(uvc_device_handle_t *devh) {
   }
 }
 
-/** @brief Stop stream.
+/** @brief Start stopping a stream without waiting.
  * @ingroup streaming
  *
- * Stops stream, ends threads and cancels pollers
+ * Cancels the transfers and returns. uvc_stream_stop(), uvc_stream_close()
+ * or the next start waits for the cancellations and the callback thread.
  *
- * @param devh UVC device
+ * @param strmh UVC stream handle
  */
-uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
+uvc_error_t uvc_stream_stop_async(uvc_stream_handle_t *strmh) {
   int i;
 
   if (!strmh->running)
     return UVC_ERROR_INVALID_PARAM;
 
   strmh->running = 0;
+  strmh->stopping = 1;
 
   pthread_mutex_lock(&strmh->cb_mutex);
 
@@ -1503,9 +3317,37 @@ uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
    *   necessarily completed but they will be free'd in _uvc_stream_callback().
    */
   for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
-    if(strmh->transfers[i] != NULL)
+    if (strmh->transfers[i] != NULL && strmh->transfer_parked[i])
+      _uvc_free_transfer(strmh, i);
+    else if(strmh->transfers[i] != NULL)
       libusb_cancel_transfer(strmh->transfers[i]);
   }
+  /* progress waiters return once they see running cleared */
+  pthread_cond_broadcast(&strmh->progress_cond);
+
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  return UVC_SUCCESS;
+}
+
+/** @brief Stop stream.
+ * @ingroup streaming
+ *
+ * Cancels the transfers unless uvc_stream_stop_async() already did, then
+ * waits for them and for the callback thread.
+ *
+ * @param strmh UVC stream handle
+ */
+uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
+  int i;
+
+  if (!strmh->stopping) {
+    uvc_error_t ret = uvc_stream_stop_async(strmh);
+    if (ret != UVC_SUCCESS)
+      return ret;
+  }
+
+  pthread_mutex_lock(&strmh->cb_mutex);
 
   /* Wait for transfers to complete/cancel */
   do {
@@ -1523,11 +3365,27 @@ uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
 
   /** @todo stop the actual stream, camera side? */
 
-  if (strmh->user_cb) {
+  if (strmh->user_cb && !strmh->inline_callback) {
     /* wait for the thread to stop (triggered by
      * LIBUSB_TRANSFER_CANCELLED transfer) */
     pthread_join(strmh->cb_thread, NULL);
   }
+  strmh->inline_callback = 0;
+  strmh->stopping = 0;
+
+  if (strmh->pooled_frames) {
+    /* give the stream its own buffers back for a possible polling restart */
+    pthread_mutex_lock(&strmh->cb_mutex);
+    strmh->outbuf = strmh->own_outbuf;
+    strmh->meta_outbuf = strmh->own_meta_outbuf;
+    strmh->out_slot = NULL;
+    _uvc_clear_ready_slots(strmh);
+    strmh->got_bytes = 0;
+    strmh->meta_got_bytes = 0;
+    strmh->pooled_frames = 0;
+    strmh->borrowed_frames = 0;
+    pthread_mutex_unlock(&strmh->cb_mutex);
+  }
 
   return UVC_SUCCESS;
 }
@@ -1540,23 +3398,247 @@ uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
  * @param strmh UVC stream handle
  */
 void uvc_stream_close(uvc_stream_handle_t *strmh) {
-  if (strmh->running)
-    uvc_stream_stop(strmh);
+  int i;
 
-  uvc_release_if(strmh->devh, strmh->stream_if->bInterfaceNumber);
+  if (strmh->running || strmh->stopping)
+    uvc_stream_stop(strmh);
 
-  if (strmh->frame.data)
-    free(strmh->frame.data);
+  /* playback streams have no device */
+  if (strmh->devh)
+    uvc_release_if(strmh->devh, strmh->stream_if->bInterfaceNumber);
 
-  free(strmh->outbuf);
-  free(strmh->holdbuf);
+  uvc_buffer_free(strmh->frame.data);
+  uvc_buffer_free(strmh->outbuf);
+  uvc_buffer_free(strmh->holdbuf);
+  _uvc_trim_spare_buffers(strmh, 0, 0);
 
   free(strmh->meta_outbuf);
   free(strmh->meta_holdbuf);
 
+  for (i = 0; i < LIBUVC_NUM_FRAME_POOL_BUFS; i++) {
+    if (strmh->frame_pool[i].refcount > 0)
+      UVC_DEBUG("closing stream with a borrowed frame still referenced");
+    _uvc_stash_frame_buffer(strmh->frame_pool[i].buf, strmh->frame_pool[i].buf_bytes);
+    free(strmh->frame_pool[i].meta_buf);
+  }
+
   pthread_cond_destroy(&strmh->cb_cond);
+  pthread_cond_destroy(&strmh->progress_cond);
   pthread_mutex_destroy(&strmh->cb_mutex);
 
-  DL_DELETE(strmh->devh->streams, strmh);
+  if (strmh->devh)
+    DL_DELETE(strmh->devh->streams, strmh);
   free(strmh);
 }
+
+/** Open a stream that plays back recorded frames instead of a device's
+ * @ingroup streaming
+ *
+ * The stream is never started. uvc_stream_playback_frame() lends its pool
+ * buffers out the way a stream started with UVC_STREAM_FLAG_BORROWED_FRAMES
+ * does, so recorded frames go through the same uvc_retain_frame() and
+ * uvc_release_frame() handling as live ones. Close it with
+ * uvc_stream_close().
+ *
+ * @param[out] strmhp Playback stream
+ * @param frame_format Format of the recorded frames
+ * @param width Frame width
+ * @param height Frame height
+ * @param max_frame_bytes Largest recorded frame
+ * @param pool_size Frame buffers, bounded like uvc_stream_options_t's
+ */
+uvc_error_t uvc_stream_open_playback(
+    uvc_stream_handle_t **strmhp,
+    enum uvc_frame_format frame_format,
+    uint32_t width,
+    uint32_t height,
+    size_t max_frame_bytes,
+    uint32_t pool_size) {
+  uvc_stream_handle_t *strmh;
+  uint32_t i;
+
+  strmh = calloc(1, sizeof(*strmh));
+  if (!strmh)
+    return UVC_ERROR_NO_MEM;
+
+  pthread_mutex_init(&strmh->cb_mutex, NULL);
+  pthread_cond_init(&strmh->cb_cond, NULL);
+  pthread_cond_init(&strmh->progress_cond, NULL);
+  strmh->frame_format = frame_format;
+  _uvc_set_frame_template(strmh, frame_format, width, height);
+  strmh->cur_ctrl.dwMaxVideoFrameSize = max_frame_bytes;
+
+  if (pool_size < 2)
+    pool_size = 2;
+  else if (pool_size > LIBUVC_NUM_FRAME_POOL_BUFS)
+    pool_size = LIBUVC_NUM_FRAME_POOL_BUFS;
+  strmh->frame_pool_size = pool_size;
+  strmh->options.frame_pool_size = pool_size;
+
+  for (i = 0; i < pool_size; i++) {
+    struct uvc_pooled_frame *slot = &strmh->frame_pool[i];
+    slot->strmh = strmh;
+    slot->buf = _uvc_take_frame_buffer(max_frame_bytes, &slot->buf_bytes);
+    if (!slot->buf) {
+      uvc_stream_close(strmh);
+      return UVC_ERROR_NO_MEM;
+    }
+  }
+
+  *strmhp = strmh;
+  return UVC_SUCCESS;
+}
+
+/** Lend a copy of a recorded frame out of a playback stream's pool
+ * @ingroup streaming
+ *
+ * The frame carries one reference for the caller, dropped with
+ * uvc_release_frame() like a live frame's.
+ *
+ * @param strmh Stream opened with uvc_stream_open_playback()
+ * @param data Frame payload
+ * @param bytes Payload size
+ * @param pts Presentation time stamp of the recorded frame
+ * @param capture_time USB completion time of the recorded frame
+ * @param[out] frame The lent frame
+ * @return UVC_ERROR_BUSY while every buffer is lent out
+ */
+uvc_error_t uvc_stream_playback_frame(
+    uvc_stream_handle_t *strmh,
+    const void *data,
+    size_t bytes,
+    uint32_t pts,
+    const struct timespec *capture_time,
+    uvc_frame_t **frame) {
+  struct uvc_pooled_frame *slot;
+
+  if (strmh->devh)
+    return UVC_ERROR_INVALID_PARAM;
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+  slot = _uvc_find_free_slot(strmh);
+  if (!slot) {
+    pthread_mutex_unlock(&strmh->cb_mutex);
+    return UVC_ERROR_BUSY;
+  }
+  if (bytes > slot->buf_bytes) {
+    pthread_mutex_unlock(&strmh->cb_mutex);
+    return UVC_ERROR_INVALID_PARAM;
+  }
+  slot->refcount = 1;
+  slot->seq = ++strmh->seq;
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  /* nothing else touches a referenced slot */
+  memcpy(slot->buf, data, bytes);
+  slot->bytes = bytes;
+  slot->meta_bytes = 0;
+  slot->pts = pts;
+  slot->last_scr = 0;
+  slot->last_scr_sof = UVC_SCR_SOF_NONE;
+  slot->still = 0;
+  slot->incomplete = 0;
+  slot->capture_time = *capture_time;
+
+  *frame = _uvc_populate_borrowed_frame(strmh, slot);
+  return UVC_SUCCESS;
+}
+
+/** Open a stream that assembles frames out of payloads from the caller
+ * @ingroup streaming
+ *
+ * Payloads fed with uvc_stream_feed_payload() and uvc_stream_feed_bulk()
+ * take the path a device's transfers take, through header parsing and pool
+ * assembly to an inline call of cb for every completed frame, which lets
+ * benchmarks and tests run it without a camera. The frame is released when
+ * cb returns. Close it with uvc_stream_close().
+ *
+ * @param[out] strmhp Synthetic stream
+ * @param frame_format Format of the frames
+ * @param width Frame width
+ * @param height Frame height
+ * @param max_frame_bytes dwMaxVideoFrameSize the payloads are assembled against
+ * @param max_payload_bytes dwMaxPayloadTransferSize, which splits bulk transfers
+ * @param options NULL or zero fields for the defaults; only frame_pool_size and
+ * streaming_copy_bytes apply
+ * @param cb Called with every completed frame
+ * @param user_ptr Passed to cb
+ */
+uvc_error_t uvc_stream_open_synthetic(
+    uvc_stream_handle_t **strmhp,
+    enum uvc_frame_format frame_format,
+    uint32_t width,
+    uint32_t height,
+    size_t max_frame_bytes,
+    size_t max_payload_bytes,
+    const uvc_stream_options_t *options,
+    uvc_frame_callback_t *cb,
+    void *user_ptr) {
+  uvc_stream_handle_t *strmh;
+  uvc_error_t ret;
+  uint32_t i;
+
+  if (!cb)
+    return UVC_ERROR_INVALID_PARAM;
+
+  ret = uvc_stream_open_playback(&strmh, frame_format, width, height, max_frame_bytes,
+      options ? options->frame_pool_size : 0);
+  if (ret != UVC_SUCCESS)
+    return ret;
+
+  for (i = 0; i < strmh->frame_pool_size; i++) {
+    strmh->frame_pool[i].meta_buf = malloc(LIBUVC_XFER_META_BUF_SIZE);
+    if (!strmh->frame_pool[i].meta_buf) {
+      uvc_stream_close(strmh);
+      return UVC_ERROR_NO_MEM;
+    }
+  }
+
+  if (options)
+    strmh->options.streaming_copy_bytes = options->streaming_copy_bytes;
+  _uvc_resolve_streaming_copy(strmh);
+  strmh->cur_ctrl.dwMaxPayloadTransferSize = max_payload_bytes;
+  strmh->out_slot = _uvc_find_free_slot(strmh);
+  strmh->outbuf = strmh->out_slot->buf;
+  strmh->meta_outbuf = strmh->out_slot->meta_buf;
+  strmh->user_cb = cb;
+  strmh->user_ptr = user_ptr;
+  strmh->pooled_frames = 1;
+  strmh->inline_callback = 1;
+  /* uvc_stream_close() stops it, and with no transfers that returns the
+   * assembly slot to the pool */
+  strmh->running = 1;
+
+  *strmhp = strmh;
+  return UVC_SUCCESS;
+}
+
+/** Feed one isochronous packet's payload to a synthetic stream
+ * @ingroup streaming
+ *
+ * @param strmh Stream opened with uvc_stream_open_synthetic()
+ * @param payload Header and data of the payload
+ * @param payload_len Length of the payload
+ * @param capacity Length a full payload would have, for the transport counters
+ */
+void uvc_stream_feed_payload(
+    uvc_stream_handle_t *strmh,
+    uint8_t *payload,
+    size_t payload_len,
+    size_t capacity) {
+  _uvc_process_payload(strmh, payload, payload_len, capacity);
+}
+
+/** Feed a bulk transfer's contents to a synthetic stream
+ * @ingroup streaming
+ *
+ * The transfer is split into max_payload_bytes payloads the way a completed
+ * bulk transfer is.
+ *
+ * @param strmh Stream opened with uvc_stream_open_synthetic()
+ * @param buffer Payloads back to back
+ * @param length Length of the transfer
+ */
+void uvc_stream_feed_bulk(uvc_stream_handle_t *strmh, uint8_t *buffer, size_t length) {
+  _uvc_process_bulk_payloads(strmh, buffer, length);
+}
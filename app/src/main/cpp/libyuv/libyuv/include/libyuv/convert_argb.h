@@ -784,6 +784,35 @@ int YUY2ToARGB(const uint8_t* src_yuy2,
                int width,
                int height);
 
+// Convert YUY2 to ARGB with matrix.
+LIBYUV_API
+int YUY2ToARGBMatrix(const uint8_t* src_yuy2,
+                     int src_stride_yuy2,
+                     uint8_t* dst_argb,
+                     int dst_stride_argb,
+                     const struct YuvConstants* yuvconstants,
+                     int width,
+                     int height);
+
+// Convert YUY2 to ABGR (RGBA in memory) in a single pass.
+LIBYUV_API
+int YUY2ToABGR(const uint8_t* src_yuy2,
+               int src_stride_yuy2,
+               uint8_t* dst_abgr,
+               int dst_stride_abgr,
+               int width,
+               int height);
+
+// Convert YUY2 to ABGR (RGBA in memory) with matrix.
+LIBYUV_API
+int YUY2ToABGRMatrix(const uint8_t* src_yuy2,
+                     int src_stride_yuy2,
+                     uint8_t* dst_abgr,
+                     int dst_stride_abgr,
+                     const struct YuvConstants* yuvconstants,
+                     int width,
+                     int height);
+
 // Convert UYVY to ARGB.
 LIBYUV_API
 int UYVYToARGB(const uint8_t* src_uyvy,
@@ -793,6 +822,16 @@ int UYVYToARGB(const uint8_t* src_uyvy,
                int width,
                int height);
 
+// Convert UYVY to ARGB with matrix.
+LIBYUV_API
+int UYVYToARGBMatrix(const uint8_t* src_uyvy,
+                     int src_stride_uyvy,
+                     uint8_t* dst_argb,
+                     int dst_stride_argb,
+                     const struct YuvConstants* yuvconstants,
+                     int width,
+                     int height);
+
 // Convert I010 to AR30.
 LIBYUV_API
 int I010ToAR30(const uint16_t* src_y,
@@ -1576,6 +1576,7 @@ ANY11C(UYVYToARGBRow_Any_AVX2, UYVYToARGBRow_AVX2, 1, 4, 4, 31)
 #endif
 #if defined(HAS_YUY2TOARGBROW_NEON)
 ANY11C(YUY2ToARGBRow_Any_NEON, YUY2ToARGBRow_NEON, 1, 4, 4, 7)
+ANY11C(YUY2ToABGRRow_Any_NEON, YUY2ToABGRRow_NEON, 1, 4, 4, 7)
 ANY11C(UYVYToARGBRow_Any_NEON, UYVYToARGBRow_NEON, 1, 4, 4, 7)
 #endif
 #if defined(HAS_YUY2TOARGBROW_MSA)
@@ -2516,6 +2516,28 @@ void YUY2ToARGBRow_C(const uint8_t* src_yuy2,
   }
 }
 
+void YUY2ToABGRRow_C(const uint8_t* src_yuy2,
+                     uint8_t* rgb_buf,
+                     const struct YuvConstants* yuvconstants,
+                     int width) {
+  int x;
+  for (x = 0; x < width - 1; x += 2) {
+    YuvPixel(src_yuy2[0], src_yuy2[1], src_yuy2[3], rgb_buf + 2, rgb_buf + 1,
+             rgb_buf + 0, yuvconstants);
+    rgb_buf[3] = 255;
+    YuvPixel(src_yuy2[2], src_yuy2[1], src_yuy2[3], rgb_buf + 6, rgb_buf + 5,
+             rgb_buf + 4, yuvconstants);
+    rgb_buf[7] = 255;
+    src_yuy2 += 4;
+    rgb_buf += 8;  // Advance 2 pixels.
+  }
+  if (width & 1) {
+    YuvPixel(src_yuy2[0], src_yuy2[1], src_yuy2[3], rgb_buf + 2, rgb_buf + 1,
+             rgb_buf + 0, yuvconstants);
+    rgb_buf[3] = 255;
+  }
+}
+
 void UYVYToARGBRow_C(const uint8_t* src_uyvy,
                      uint8_t* rgb_buf,
                      const struct YuvConstants* yuvconstants,
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo
+
+import android.content.Context
+import android.content.Intent
+import android.content.IntentFilter
+import android.os.BatteryManager
+import kotlin.math.abs
+
+/**
+ * Energy the phone draws while streaming, from the battery's current and voltage, per rendered
+ * video frame and per second, to compare formats and conversion backends on battery cost as well
+ * as speed.
+ *
+ * Fed one [Sample] per interval of the native stats, which republish once a second, it integrates
+ * the power between samples over a window of [Config.windowSamples] and over the whole session.
+ * Intervals that start or end on the charger are left out: the battery current then says nothing
+ * about what the phone draws. The battery is the whole phone, screen included, so compare readings
+ * taken under the same conditions. Android's power rail monitors need a newer SDK than this app
+ * builds against.
+ */
+class EnergyMeter(private val config: Config = Config()) {
+
+  data class Config(
+      // Samples per reading, as many as the native streamers' periodic summaries span.
+      val windowSamples: Int = 10,
+  )
+
+  /** Battery levels at a moment, and the cumulative counters from [StreamingStats]. */
+  data class Sample(
+      val elapsedNs: Long,
+      // In either sign; devices disagree on which is discharging.
+      val batteryCurrentUa: Long,
+      val batteryVoltageMv: Int,
+      val charging: Boolean,
+      val videoFramesRendered: Long,
+      val audioBytes: Long,
+  ) {
+    val milliwatts: Double
+      get() = abs(batteryCurrentUa) * batteryVoltageMv / 1e6
+
+    val valid: Boolean
+      get() =
+          !charging &&
+              batteryCurrentUa != Long.MIN_VALUE &&
+              batteryCurrentUa != 0L &&
+              batteryVoltageMv > 0
+
+    companion object {
+      fun of(stats: StreamingStats, battery: BatteryReader, elapsedNs: Long) =
+          Sample(
+              elapsedNs,
+              battery.currentUa(),
+              battery.voltageMv(),
+              battery.charging(),
+              stats.videoFramesRendered,
+              stats.audioBytes,
+          )
+    }
+  }
+
+  /** Average power and energy per rendered frame over [seconds]; no frames gives NaN per frame. */
+  data class Reading(
+      val seconds: Double,
+      val milliwatts: Double,
+      val millijoulesPerFrame: Double,
+      val videoFrames: Long,
+      val audioBytes: Long,
+  ) {
+    override fun toString() =
+        "%.0f mW, %.2f mJ/frame over %.0f s".format(milliwatts, millijoulesPerFrame, seconds)
+  }
+
+  private class Totals {
+    var seconds = 0.0
+    var millijoules = 0.0
+    var videoFrames = 0L
+    var audioBytes = 0L
+    var samples = 0
+
+    fun reading() =
+        Reading(
+            seconds,
+            if (seconds > 0) millijoules / seconds else 0.0,
+            if (videoFrames > 0) millijoules / videoFrames else Double.NaN,
+            videoFrames,
+            audioBytes,
+        )
+  }
+
+  private var previous: Sample? = null
+  private var window = Totals()
+  private var session = Totals()
+
+  /** Of everything measured since the last [reset], null before the first interval. */
+  val sessionReading: Reading?
+    get() = if (session.seconds > 0) session.reading() else null
+
+  /** Starts a new session, such as for another format. */
+  fun reset() {
+    previous = null
+    window = Totals()
+    session = Totals()
+  }
+
+  /** Leaves the time until the next sample out, such as while the stream is stopped. */
+  fun pause() {
+    previous = null
+  }
+
+  /** Returns the reading of a window that this sample completes, or null. */
+  fun onSample(sample: Sample): Reading? {
+    val last = previous
+    previous = sample
+    if (last == null || !last.valid || !sample.valid || sample.elapsedNs <= last.elapsedNs) {
+      return null
+    }
+    val seconds = (sample.elapsedNs - last.elapsedNs) / 1e9
+    // Trapezoidal, the battery current moving between samples.
+    val millijoules = (last.milliwatts + sample.milliwatts) / 2 * seconds
+    val videoFrames = (sample.videoFramesRendered - last.videoFramesRendered).coerceAtLeast(0)
+    val audioBytes = (sample.audioBytes - last.audioBytes).coerceAtLeast(0)
+    for (totals in listOf(window, session)) {
+      totals.seconds += seconds
+      totals.millijoules += millijoules
+      totals.videoFrames += videoFrames
+      totals.audioBytes += audioBytes
+      totals.samples++
+    }
+    if (window.samples < config.windowSamples) {
+      return null
+    }
+    val reading = window.reading()
+    window = Totals()
+    return reading
+  }
+}
+
+/** Battery current, voltage and charging state through [BatteryManager]. */
+class BatteryReader(private val context: Context) {
+  private val batteryManager = context.getSystemService(BatteryManager::class.java)
+
+  /** Instantaneous, in microamperes; Long.MIN_VALUE or 0 when the device does not report it. */
+  fun currentUa(): Long =
+      batteryManager?.getLongProperty(BatteryManager.BATTERY_PROPERTY_CURRENT_NOW)
+          ?: Long.MIN_VALUE
+
+  /** Of the last battery broadcast, -1 when there was none. */
+  fun voltageMv(): Int =
+      context
+          .registerReceiver(null, IntentFilter(Intent.ACTION_BATTERY_CHANGED))
+          ?.getIntExtra(BatteryManager.EXTRA_VOLTAGE, -1) ?: -1
+
+  fun charging(): Boolean = batteryManager?.isCharging ?: false
+}
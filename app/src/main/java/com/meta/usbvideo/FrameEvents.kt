@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import kotlin.concurrent.thread
+
+/** What happened to a frame, in the order of FrameEventKind in FrameEventQueue.h. */
+enum class FrameEventKind {
+  Captured,
+  Rendered,
+  Dropped,
+}
+
+/** Why a frame was dropped, in the order of FrameDropCause in UsbVideoStreamer.h. */
+enum class FrameDropCause {
+  DecodeBusy,
+  WindowLockFailed,
+  InvalidSize,
+}
+
+/**
+ * Frame events delivered together, read in place from the buffer the native side copied them into.
+ * Only valid during the [FrameEventStream] listener call it was passed to. Times are
+ * CLOCK_MONOTONIC nanoseconds, as from System.nanoTime().
+ */
+class FrameEventBatch internal constructor(internal val buffer: ByteBuffer) {
+
+  var size: Int = 0
+    internal set
+
+  /** Events the native side dropped since the stream opened because the reader fell behind. */
+  var lost: Long = 0
+    internal set
+
+  fun kind(index: Int): FrameEventKind = kinds[buffer.get(offset(index) + 28).toInt()]
+
+  /** Null unless [kind] is [FrameEventKind.Dropped]. */
+  fun dropCause(index: Int): FrameDropCause? =
+      if (kind(index) == FrameEventKind.Dropped) causes[buffer.get(offset(index) + 29).toInt()]
+      else null
+
+  fun timeNs(index: Int): Long = buffer.getLong(offset(index))
+
+  /** End of the frame's USB transfer. */
+  fun captureTimeNs(index: Int): Long = buffer.getLong(offset(index) + 8)
+
+  fun sequence(index: Int): Int = buffer.getInt(offset(index) + 16)
+
+  fun bytes(index: Int): Int = buffer.getInt(offset(index) + 20)
+
+  /** USB completion to post for [FrameEventKind.Rendered], 0 otherwise. */
+  fun latencyUs(index: Int): Int = buffer.getInt(offset(index) + 24)
+
+  /**
+   * Mean luma of a [FrameEventKind.Rendered] frame in 8 bit codes, with
+   * [UsbVideoNativeLibrary.setVideoLumaStatsNative] on; NaN when the frame was not measured.
+   */
+  fun lumaMean(index: Int): Float {
+    val mean = buffer.getShort(offset(index) + 30).toInt() and 0xffff
+    return if (mean == NO_LUMA) Float.NaN else mean / 256f
+  }
+
+  /** Share of the measured pixels at or below black, 16 in limited range; 0 when not measured. */
+  fun lumaDarkClipped(index: Int): Float =
+      (buffer.getShort(offset(index) + 32).toInt() and 0xffff) / 65535f
+
+  /** Share of the measured pixels at or above white, 235 in limited range; 0 when not measured. */
+  fun lumaBrightClipped(index: Int): Float =
+      (buffer.getShort(offset(index) + 34).toInt() and 0xffff) / 65535f
+
+  private fun offset(index: Int): Int {
+    if (index < 0 || index >= size) {
+      throw IndexOutOfBoundsException("Event $index of $size")
+    }
+    return index * RECORD_SIZE
+  }
+
+  companion object {
+    /** Bytes per event, sizeof(FrameEvent). */
+    const val RECORD_SIZE = 40
+
+    private const val NO_LUMA = 0xffff
+
+    private val kinds = FrameEventKind.values()
+    private val causes = FrameDropCause.values()
+
+    internal fun allocate(capacity: Int) =
+        FrameEventBatch(
+            ByteBuffer.allocateDirect(capacity * RECORD_SIZE).order(ByteOrder.nativeOrder()))
+  }
+}
+
+/**
+ * Delivers the frame events of the streamers behind a stats handle to [listener] on a thread of its
+ * own, in batches of up to [batchSize] events at least every [maxDelayMs] while there are any. One
+ * stream per handle can be open at a time; [close] stops it.
+ */
+class FrameEventStream
+private constructor(
+    private val statsHandle: Long,
+    private val batchSize: Int,
+    private val maxDelayMs: Int,
+    private val listener: (FrameEventBatch) -> Unit,
+) : AutoCloseable {
+
+  @Volatile private var open = true
+  private val reader =
+      thread(name = "FrameEvents") {
+        val batch = FrameEventBatch.allocate(batchSize)
+        while (open) {
+          batch.size =
+              UsbVideoNativeLibrary.readFrameEventsNative(
+                  statsHandle, batch.buffer, batchSize, maxDelayMs)
+          if (batch.size > 0) {
+            batch.lost = UsbVideoNativeLibrary.frameEventsLostNative(statsHandle)
+            listener(batch)
+          }
+        }
+      }
+
+  override fun close() {
+    open = false
+    UsbVideoNativeLibrary.closeFrameEventsNative(statsHandle)
+    if (Thread.currentThread() != reader) {
+      reader.join()
+    }
+  }
+
+  companion object {
+    /**
+     * Returns null when [statsHandle] is unknown or another stream reads it. Handles come from
+     * [UsbVideoNativeLibrary.statsHandleNative] and
+     * [UsbVideoNativeLibrary.cameraSessionStatsHandleNative].
+     */
+    fun open(
+        statsHandle: Long,
+        batchSize: Int = 64,
+        maxDelayMs: Int = 100,
+        listener: (FrameEventBatch) -> Unit,
+    ): FrameEventStream? {
+      require(batchSize > 0)
+      if (!UsbVideoNativeLibrary.openFrameEventsNative(statsHandle)) {
+        return null
+      }
+      return FrameEventStream(statsHandle, batchSize, maxDelayMs, listener)
+    }
+  }
+}
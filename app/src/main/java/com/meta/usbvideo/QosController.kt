@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo
+
+import com.meta.usbvideo.usb.VideoFormat
+
+/** AThermal_getCurrentThermalStatus values used by [QosController]. */
+const val THERMAL_STATUS_LIGHT = 1
+const val THERMAL_STATUS_SEVERE = 3
+
+/**
+ * Picks a cheaper video format when the pipeline cannot keep up with the current one, and the
+ * previous one again once there is headroom for it.
+ *
+ * Fed one [Sample] of the streaming stats per interval, it steps down after [Config.downSamples]
+ * pressured samples in a row: to a lower frame rate of the same format and size first, then to a
+ * smaller size of the same format, then to a format that is cheaper to decode. Formats stepped down
+ * from are kept, and after [Config.upSamples] samples in a row with headroom for the last of them
+ * it steps back up. A step up undone by the next step down doubles the samples the following one
+ * waits for, up to [Config.maxUpBackoff] times. Formats sending more than the USB path sustains,
+ * [Config.maxBytesPerSecond], are never stepped to, and a current one that does is stepped down
+ * from. The caller switches the stream and reports back through [onSwitched].
+ */
+class QosController(
+    private val formats: List<VideoFormat>,
+    initial: VideoFormat,
+    private val config: Config = Config(),
+) {
+
+  data class Config(
+      val downSamples: Int = 3,
+      val upSamples: Int = 10,
+      // Ignored samples after a switch, while the new format settles.
+      val settleSamples: Int = 2,
+      // Pressure when fewer of the captured frames are rendered.
+      val minRenderedRatio: Double = 0.85,
+      // Pressure when the p95 conversion or queue time takes more of the frame interval.
+      val maxConvertRatio: Double = 0.9,
+      val maxQueueRatio: Double = 2.0,
+      // Headroom when the next format up would still convert within this much of its interval.
+      val upConvertRatio: Double = 0.6,
+      // A step down within this many samples of a step up undoes it.
+      val upProbationSamples: Int = 30,
+      val maxUpBackoff: Int = 8,
+      // What the USB path sustains, as probed, 0 for no limit.
+      val maxBytesPerSecond: Long = 0,
+  )
+
+  /** Cumulative counters and current percentiles, as read from [StreamingStats]. */
+  data class Sample(
+      val framesCaptured: Long,
+      val framesRendered: Long,
+      val framesDropped: Long,
+      val convertP95Us: Long,
+      val queueP95Us: Long,
+      val thermalStatus: Int,
+  ) {
+    companion object {
+      fun of(stats: StreamingStats, thermalStatus: Int) =
+          Sample(
+              stats.videoFramesCaptured,
+              stats.videoFramesRendered,
+              stats.videoFramesDroppedBusy + stats.videoFramesDroppedWindowLock,
+              stats.videoLatencyUs(LatencyStage.Convert, LatencyPercentile.P95),
+              stats.videoLatencyUs(LatencyStage.Queue, LatencyPercentile.P95),
+              thermalStatus,
+          )
+    }
+  }
+
+  var current: VideoFormat = initial
+    private set
+
+  private val steppedDownFrom = ArrayDeque<VideoFormat>()
+  // Formats the stream refused, left out of later steps.
+  private val refused = mutableSetOf<VideoFormat>()
+  private var previous: Sample? = null
+  private var pressured = 0
+  private var headroom = 0
+  private var settling = config.settleSamples
+  private var upBackoff = 1
+  private var samplesSinceUp = Int.MAX_VALUE
+  private var pending: VideoFormat? = null
+
+  /** Starts over from [format], such as one the user picked. */
+  fun reset(format: VideoFormat) {
+    current = format
+    steppedDownFrom.clear()
+    refused.clear()
+    upBackoff = 1
+    samplesSinceUp = Int.MAX_VALUE
+    pending = null
+    restartCounting()
+  }
+
+  /** Returns the format to switch to, or null to stay on [current]. */
+  fun onSample(sample: Sample): VideoFormat? {
+    val last = previous
+    previous = sample
+    if (last == null || pending != null) {
+      return null
+    }
+    if (samplesSinceUp != Int.MAX_VALUE) {
+      samplesSinceUp++
+    }
+    if (settling > 0) {
+      settling--
+      return null
+    }
+    val captured = sample.framesCaptured - last.framesCaptured
+    if (captured <= 0) {
+      return null
+    }
+    val rendered = sample.framesRendered - last.framesRendered
+    val dropped = sample.framesDropped - last.framesDropped
+    val intervalUs = 1_000_000.0 / current.fps.coerceAtLeast(1)
+
+    val isPressured =
+        rendered < captured * config.minRenderedRatio ||
+            sample.convertP95Us > intervalUs * config.maxConvertRatio ||
+            sample.queueP95Us > intervalUs * config.maxQueueRatio ||
+            sample.thermalStatus >= THERMAL_STATUS_SEVERE ||
+            !fitsBandwidth(current)
+    pressured = if (isPressured) pressured + 1 else 0
+    if (pressured >= config.downSamples) {
+      val lower = stepDown(current, (formats - refused).filter { fitsBandwidth(it) }) ?: return null
+      if (samplesSinceUp <= config.upProbationSamples) {
+        upBackoff = (upBackoff * 2).coerceAtMost(config.maxUpBackoff)
+      }
+      steppedDownFrom.addLast(current)
+      return propose(lower)
+    }
+
+    val upper = steppedDownFrom.lastOrNull() ?: return null
+    val upIntervalUs = 1_000_000.0 / upper.fps.coerceAtLeast(1)
+    val upConvertUs = sample.convertP95Us * upper.area.toDouble() / current.area.coerceAtLeast(1)
+    val hasHeadroom =
+        !isPressured &&
+            dropped == 0L &&
+            upConvertUs < upIntervalUs * config.upConvertRatio &&
+            sample.thermalStatus <= THERMAL_STATUS_LIGHT &&
+            fitsBandwidth(upper)
+    headroom = if (hasHeadroom) headroom + 1 else 0
+    if (headroom >= config.upSamples * upBackoff) {
+      steppedDownFrom.removeLast()
+      samplesSinceUp = 0
+      return propose(upper)
+    }
+    return null
+  }
+
+  /** After the switch to a format [onSample] returned, with whether the stream took it. */
+  fun onSwitched(format: VideoFormat, switched: Boolean) {
+    if (format != pending) {
+      return
+    }
+    pending = null
+    if (switched) {
+      current = format
+    } else {
+      refused += format
+      if (steppedDownFrom.lastOrNull() == current) {
+        // A failed step down leaves nothing to step back up to.
+        steppedDownFrom.removeLast()
+      }
+    }
+    restartCounting()
+  }
+
+  private fun fitsBandwidth(format: VideoFormat): Boolean =
+      config.maxBytesPerSecond <= 0 || bytesPerSecond(format) <= config.maxBytesPerSecond
+
+  private fun propose(format: VideoFormat): VideoFormat {
+    pending = format
+    return format
+  }
+
+  private fun restartCounting() {
+    previous = null
+    pressured = 0
+    headroom = 0
+    settling = config.settleSamples
+  }
+
+  companion object {
+    /**
+     * The next cheaper format from [formats] below [from]: a lower frame rate, then a smaller size,
+     * then the most pixels per second of a format cheaper to decode, never at a higher frame rate.
+     * Null at the bottom.
+     */
+    fun stepDown(from: VideoFormat, formats: List<VideoFormat>): VideoFormat? {
+      val usable = formats.filter { decodeCost(it.fourccFormat) != null && it.fps <= from.fps }
+      val sameFormat = usable.filter { it.fourccFormat == from.fourccFormat }
+      return sameFormat
+          .filter { it.width == from.width && it.height == from.height && it.fps < from.fps }
+          .maxByOrNull { it.fps }
+          ?: sameFormat
+              .filter { it.area < from.area }
+              .maxWithOrNull(compareBy({ it.area }, { it.fps }))
+          ?: usable
+              .filter {
+                it.area <= from.area &&
+                    checkNotNull(decodeCost(it.fourccFormat)) <
+                        (decodeCost(from.fourccFormat) ?: Int.MAX_VALUE)
+              }
+              .maxWithOrNull(compareBy({ it.area * it.fps }, { it.fps }))
+    }
+
+    /** What a stream of the format sends, estimated like the native mode ranking for MJPEG. */
+    fun bytesPerSecond(format: VideoFormat): Long {
+      val bytesPerPixel =
+          when (format.fourccFormat) {
+            "YUY2" -> 2.0
+            "NV12" -> 1.5
+            "BY8 ",
+            "BA81",
+            "GRBG",
+            "GBRG",
+            "RGGB",
+            "BGGR" -> 1.0
+            "MJPG" -> 0.5
+            "H264",
+            "H265",
+            "HEVC",
+            "VP80",
+            "VP90" -> 0.1
+            else -> 2.0
+          }
+      return (format.area.toLong() * format.fps * bytesPerPixel).toLong()
+    }
+
+    /** CPU cost of getting a frame of the format on screen, or null for unsupported formats. */
+    private fun decodeCost(fourccFormat: String): Int? =
+        when (fourccFormat) {
+          "MJPG" -> 2
+          "H264",
+          "H265",
+          "HEVC",
+          "VP80",
+          "VP90" -> 1
+          "YUY2",
+          "NV12" -> 0
+          else -> null
+        }
+  }
+}
@@ -115,6 +115,11 @@ class StatusScreenViewHolder(
         videoStreamingStatus.text = ""
         audioStreamingStatus.text = ""
       }
+      is UsbDeviceState.Reconnecting -> {
+        usbDeviceStatus.text = context.getString(R.string.uvc_device_reconnecting)
+        videoStreamingStatus.text = ""
+        audioStreamingStatus.text = ""
+      }
       is UsbDeviceState.PermissionRequired -> {
         usbDeviceStatus.text = context.getString(R.string.uvc_device_permission_required)
         videoStreamingStatus.text = ""
@@ -169,15 +174,24 @@ class StatusScreenViewHolder(
         }
       }
       is UsbDeviceState.StreamingRestart -> {
-        audioStreamingStatus.text = context.getString(R.string.audio_streaming_wait_state)
+        audioStreamingStatus.text =
+            context.getString(
+                if (uvcDeviceFlow.audioOnly) R.string.audio_streaming_success
+                else R.string.audio_streaming_wait_state)
         videoStreamingStatus.text = context.getString(R.string.video_streaming_wait_state)
       }
       is UsbDeviceState.StreamingStop -> {
-        audioStreamingStatus.text = context.getString(R.string.audio_streaming_stopped)
+        audioStreamingStatus.text =
+            context.getString(
+                if (uvcDeviceFlow.audioOnly) R.string.audio_streaming_success
+                else R.string.audio_streaming_stopped)
         videoStreamingStatus.text = context.getString(R.string.video_streaming_stopped)
       }
       is UsbDeviceState.StreamingStopped -> {
-        audioStreamingStatus.text = context.getString(R.string.audio_streaming_stopped)
+        audioStreamingStatus.text =
+            context.getString(
+                if (uvcDeviceFlow.audioOnly) R.string.audio_streaming_success
+                else R.string.audio_streaming_stopped)
         videoStreamingStatus.text = context.getString(R.string.video_streaming_stopped)
       }
     }
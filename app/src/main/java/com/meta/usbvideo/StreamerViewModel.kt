@@ -37,7 +37,6 @@ import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.Lifecycle
 import androidx.lifecycle.LifecycleEventObserver
 import androidx.lifecycle.viewModelScope
-import com.meta.usbvideo.eventloop.EventLooper
 import com.meta.usbvideo.permission.CameraPermissionRequested
 import com.meta.usbvideo.permission.CameraPermissionRequired
 import com.meta.usbvideo.permission.CameraPermissionState
@@ -53,6 +52,8 @@ import com.meta.usbvideo.usb.UsbMonitor.getUsbManager
 import com.meta.usbvideo.usb.UsbMonitor.findUvcDevice
 import com.meta.usbvideo.usb.UsbMonitor.setState
 import com.meta.usbvideo.usb.VideoFormat
+import kotlinx.coroutines.Job
+import kotlinx.coroutines.awaitAll
 import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.MutableStateFlow
@@ -64,6 +65,9 @@ import kotlinx.coroutines.flow.filterNotNull
 import kotlinx.coroutines.flow.first
 import kotlinx.coroutines.flow.onCompletion
 import kotlinx.coroutines.flow.stateIn
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.runBlocking
+import kotlinx.coroutines.withTimeoutOrNull
 
 sealed interface UiAction
 
@@ -80,6 +84,12 @@ object DismissStreamingScreen : UiAction
 
 private const val TAG = "StreamerViewModel"
 private const val ACTION_USB_PERMISSION: String = "com.meta.usbvideo.USB_PERMISSION"
+private const val QOS_SAMPLE_INTERVAL_MS = 1000L
+private const val ENERGY_SAMPLE_INTERVAL_MS = 1000L
+// A little past the native ReconnectManager::kGracePeriod.
+private const val RECONNECT_GRACE_MS = 10_500L
+// How long a destroyed SurfaceView waits for the native side to let go of its surface.
+private const val SURFACE_DETACH_TIMEOUT_MS = 2_000L
 
 /** Reactively monitors the state of USB AVC device and implements state transitions methods */
 class StreamerViewModel(
@@ -94,16 +104,50 @@ class StreamerViewModel(
   var videoFormat: VideoFormat? = null
   var videoFormats: List<VideoFormat> = emptyList()
 
+  /** Lets [QosController] step the format down when the pipeline falls behind. */
+  var adaptiveQuality = true
+
+  /** Keeps the audio monitoring running in the background, with only the video stopped. */
+  var backgroundAudio = true
+
+  /**
+   * Previews in a SurfaceView, whose buffers the compositor can put on a hardware overlay, rather
+   * than a TextureView, whose frames the app's renderer draws again each time.
+   */
+  var surfaceViewPreview = true
+  private var qosController: QosController? = null
+  // Bytes per second the camera's USB path sustains, 0 when it kept up with every mode probed.
+  private var usbThroughputCeiling = 0L
+  private var qosJob: Job? = null
+  private var energyJob: Job? = null
+  private val batteryReader = BatteryReader(application)
+
+  /** Battery power and energy per frame of the current stream, see [EnergyMeter]; null before. */
+  var energyReading: EnergyMeter.Reading? = null
+    private set
+  private var reconnectJob: Job? = null
+
   fun setVideoFormatAt(index: Int) {
-    videoFormat = videoFormats.get(index)
+    val format = videoFormats.get(index)
+    videoFormat = format
+    qosController?.reset(format)
+    // A live stream switches in place instead of reconnecting the camera.
+    if (UsbMonitor.usbDeviceState is UsbDeviceState.Streaming) {
+      // Picking formats in a row switches once, to the last.
+      viewModelScope.launch {
+        val switched = UsbVideoNativeLibrary.postReconfigureUsbVideoStreaming(format).await() == 1L
+        Log.i(TAG, "reconfigureUsbVideoStreaming $format $switched")
+      }
+    }
   }
 
-  fun stopStreaming() {
+  fun stopStreaming(audioOnly: Boolean = false) {
     (UsbMonitor.usbDeviceState as? UsbDeviceState.Streaming)?.let {
       setState(UsbDeviceState.StreamingStop(
         it.usbDevice,
         it.audioStreamingConnection,
         it.videoStreamingConnection,
+        audioOnly = audioOnly && it.audioStreamingSuccess,
       ))
     }
   }
@@ -113,6 +157,7 @@ class StreamerViewModel(
         it.usbDevice,
         it.audioStreamingConnection,
         it.videoStreamingConnection,
+        it.audioOnly,
       ))
     }
   }
@@ -141,10 +186,17 @@ class StreamerViewModel(
     activity.registerReceiver(usbReceiver, IntentFilter(UsbManager.ACTION_USB_DEVICE_ATTACHED))
     activity.registerReceiver(usbReceiver, IntentFilter(UsbManager.ACTION_USB_DEVICE_DETACHED))
     activity.registerReceiver(usbReceiver, IntentFilter(ACTION_USB_PERMISSION), Context.RECEIVER_NOT_EXPORTED)
+    // Transfers notice a lost device before the detach broadcast arrives.
+    UsbVideoNativeLibrary.setDeviceLostListenerNative {
+      (UsbMonitor.usbDeviceState as? UsbDeviceState.Streaming)?.let {
+        setState(UsbDeviceState.Reconnecting(it.usbDevice))
+      }
+    }
     activity.lifecycle.addObserver(
       LifecycleEventObserver { _, event ->
         if (event == Lifecycle.Event.ON_DESTROY) {
           activity.unregisterReceiver(usbReceiver)
+          UsbVideoNativeLibrary.setDeviceLostListenerNative(null)
         }
       })
   }
@@ -162,13 +214,44 @@ class StreamerViewModel(
   private val videoSurfaceStateFlow = MutableStateFlow<Surface?>(null)
 
   fun surfaceTextureAvailable(surfaceTexture: SurfaceTexture, width: Int, height: Int) {
-    videoSurfaceStateFlow.value = Surface(surfaceTexture)
+    surfaceAvailable(Surface(surfaceTexture))
+  }
+
+  /** Shows the preview in [surface], a TextureView's or a SurfaceView's. */
+  fun surfaceAvailable(surface: Surface) {
+    videoSurfaceStateFlow.value = surface
+    // A stream that outlived the previous view, on rotation or an app switch, moves to this one.
+    UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.SetVideoSurface, surface = surface)
+  }
+
+  /**
+   * Takes the preview off a SurfaceView's surface and returns once the native side let go of it,
+   * as the surface is destroyed when the holder's callback returns. The stream keeps running.
+   */
+  fun surfaceDestroyed() {
+    Log.i(TAG, "surfaceDestroyed")
+    videoSurfaceStateFlow.value = null
+    val detached = UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.SetVideoSurface)
+    runBlocking {
+      if (withTimeoutOrNull(SURFACE_DETACH_TIMEOUT_MS) { detached.await() } == null) {
+        Log.w(TAG, "Preview still on the destroyed surface after $SURFACE_DETACH_TIMEOUT_MS ms")
+      }
+    }
   }
 
-  fun surfaceTextureDestroyed(surfaceTexture: SurfaceTexture) {
-    Log.e(TAG, "surfaceTextureDestroyed")
-    videoSurfaceStateFlow.value?.release()
+  /**
+   * Takes the preview off [surfaceTexture] and releases it once the native side let go of it, so
+   * the stream keeps running; returns false for the TextureView not to release it first.
+   */
+  fun surfaceTextureDestroyed(surfaceTexture: SurfaceTexture): Boolean {
+    Log.i(TAG, "surfaceTextureDestroyed")
+    val surface = videoSurfaceStateFlow.value
     videoSurfaceStateFlow.value = null
+    UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.SetVideoSurface).invokeOnCompletion {
+      surface?.release()
+      surfaceTexture.release()
+    }
+    return false
   }
 
   private suspend fun genSurface(): Surface {
@@ -215,45 +298,101 @@ class StreamerViewModel(
         usbDeviceState is UsbDeviceState.Attached -> {
           onUsbDeviceAttached(usbDeviceState.usbDevice)
         }
-        usbDeviceState is UsbDeviceState.Detached -> {
-          EventLooper.call {
-            UsbVideoNativeLibrary.stopUsbAudioStreamingNative()
-            UsbVideoNativeLibrary.stopUsbVideoStreamingNative()
-            UsbVideoNativeLibrary.disconnectUsbAudioStreamingNative()
-            UsbVideoNativeLibrary.disconnectUsbVideoStreamingNative()
-            UsbMonitor.disconnect()
+        usbDeviceState is UsbDeviceState.Detached &&
+            UsbVideoNativeLibrary.callOnStreamerLane(StreamerLane.Both) {
+              UsbVideoNativeLibrary.awaitReconnectNative()
+            } -> {
+          // The streamers outlive the app's connections, which go with the device.
+          UsbMonitor.disconnect()
+          if (UsbMonitor.usbDeviceState !is UsbDeviceState.Reconnecting) {
+            setState(UsbDeviceState.Reconnecting(usbDeviceState.usbDevice))
           }
+        }
+        usbDeviceState is UsbDeviceState.Reconnecting -> {
+          Log.i(TAG, "Waiting for ${usbDeviceState.usbDevice.deviceName} to come back")
+          awaitReconnect(usbDeviceState.usbDevice)
+        }
+        usbDeviceState is UsbDeviceState.Detached -> {
+          reconnectJob?.cancel()
+          // Restarts and format switches still queued are moot with the device gone.
+          UsbVideoNativeLibrary.cancelStreamerCommandsNative(StreamerLane.Both.mask)
+          val teardown =
+            listOf(
+              StreamerCommand.StopAudio,
+              StreamerCommand.StopVideo,
+              StreamerCommand.DisconnectAudio,
+              StreamerCommand.DisconnectVideo,
+            ).map { UsbVideoNativeLibrary.postStreamerCommand(it) }
+          // Closes the connections once the streamers let go of them.
+          UsbMonitor.disconnect()
+          teardown.awaitAll()
           emit(DismissStreamingScreen)
         }
+        usbDeviceState is UsbDeviceState.Connected &&
+            UsbVideoNativeLibrary.isReconnectPendingNative() -> {
+          val reconnected =
+            UsbVideoNativeLibrary.callOnStreamerLane(StreamerLane.Both) {
+              UsbVideoNativeLibrary.reconnectUsbStreaming(
+                usbDeviceState.audioStreamingConnection,
+                usbDeviceState.videoStreamingConnection,
+              )
+            }
+          Log.i(TAG, "reconnectUsbStreaming $reconnected")
+          if (reconnected) {
+            reconnectJob?.cancel()
+            setState(
+              UsbDeviceState.Streaming(
+                usbDeviceState.usbDevice,
+                usbDeviceState.audioStreamingConnection,
+                true,
+                "Success",
+                usbDeviceState.videoStreamingConnection,
+                true,
+                "Success",
+              )
+            )
+            videoFormat?.let { startQos(it) }
+            startEnergyMeter()
+          } else {
+            // Connect from scratch, as on a first attach.
+            listOf(StreamerCommand.DisconnectAudio, StreamerCommand.DisconnectVideo)
+              .map { UsbVideoNativeLibrary.postStreamerCommand(it) }
+              .awaitAll()
+            setState(
+              UsbDeviceState.Connected(
+                usbDeviceState.usbDevice,
+                usbDeviceState.audioStreamingConnection,
+                usbDeviceState.videoStreamingConnection,
+              )
+            )
+          }
+        }
         usbDeviceState is UsbDeviceState.Connected -> {
           Log.i(TAG, "usbDeviceState is UsbDeviceState.Connected")
           usbDeviceState.videoStreamingConnection.let {
             videoFormats = it.videoFormats
-            videoFormat = it.findBestVideoFormat(1920, 1080)
+            // Probed once per camera and bus speed, before the ranking that takes it into account.
+            usbThroughputCeiling =
+                UsbVideoNativeLibrary.callOnStreamerLane(StreamerLane.Video, StreamerPriority.Low) {
+                  it.probeThroughput()
+                }?.ceilingBytesPerSecond ?: 0L
+            videoFormat =
+                it.rankVideoFormats(1920, 1080).firstOrNull() ?: it.findBestVideoFormat(1920, 1080)
           }
           emit(PresentStreamingScreen)
           val videoStreamingSurface = genSurface()
-          val (audioStreamStatus, audioStreamMessage) =
-            EventLooper.call {
-              UsbVideoNativeLibrary.connectUsbAudioStreaming(
-                application.applicationContext,
-                usbDeviceState.audioStreamingConnection,
-              ).also {
-                UsbVideoNativeLibrary.startUsbAudioStreamingNative()
-              }
-            }
+          val startup =
+            UsbVideoNativeLibrary.connectUsbStreaming(
+              application.applicationContext,
+              usbDeviceState.audioStreamingConnection,
+              usbDeviceState.videoStreamingConnection,
+              videoStreamingSurface,
+              videoFormat,
+            )
+          val (audioStreamStatus, audioStreamMessage, videoStreamStatus, videoStreamMessage) = startup
           Log.i(TAG, "startUsbAudioStreaming $audioStreamStatus, $audioStreamMessage")
-          val (videoStreamStatus, videoStreamMessage) =
-            EventLooper.call {
-              UsbVideoNativeLibrary.connectUsbVideoStreaming(
-                usbDeviceState.videoStreamingConnection,
-                videoStreamingSurface,
-                videoFormat,
-              ).also {
-                UsbVideoNativeLibrary.startUsbVideoStreamingNative()
-              }
-            }
           Log.i(TAG, "startUsbVideoStreaming $videoStreamStatus, $videoStreamMessage")
+          Log.i(TAG, "Startup phases: ${startup.phaseBreakdown}")
           val streamingState =
             UsbDeviceState.Streaming(
               usbDeviceState.usbDevice,
@@ -265,38 +404,138 @@ class StreamerViewModel(
               videoStreamMessage,
             )
           setState(streamingState)
+          startEnergyMeter()
+          val startedFormat = videoFormat
+          if (videoStreamStatus && startedFormat != null) {
+            startQos(startedFormat)
+          }
         }
         usbDeviceState is UsbDeviceState.StreamingStop -> {
-          EventLooper.call {
-            UsbVideoNativeLibrary.stopUsbAudioStreamingNative()
-            UsbVideoNativeLibrary.stopUsbVideoStreamingNative()
-            setState(
-              UsbDeviceState.StreamingStopped(
-                usbDeviceState.usbDevice,
-                usbDeviceState.audioStreamingConnection,
-                usbDeviceState.videoStreamingConnection
-              )
+          // The audio stop and the video pause run side by side, on their own lanes.
+          val audioStop =
+            if (usbDeviceState.audioOnly) {
+              null
+            } else {
+              UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.StopAudio)
+            }
+          // Kept warm for the restart, which the UI asks for often.
+          val videoPause = UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.PauseVideo)
+          audioStop?.await()
+          videoPause.await()
+          setState(
+            UsbDeviceState.StreamingStopped(
+              usbDeviceState.usbDevice,
+              usbDeviceState.audioStreamingConnection,
+              usbDeviceState.videoStreamingConnection,
+              usbDeviceState.audioOnly,
             )
-          }
+          )
         }
         usbDeviceState is UsbDeviceState.StreamingRestart -> {
-          EventLooper.call {
-            UsbVideoNativeLibrary.startUsbAudioStreamingNative()
-            UsbVideoNativeLibrary.startUsbVideoStreamingNative()
-            //UsbVideoNativeLibrary.stopUsbVideoStreamingNative()
-            setState(
-              UsbDeviceState.Streaming(
-                usbDeviceState.usbDevice,
-                usbDeviceState.audioStreamingConnection,
-                true,
-                "Success",
-                usbDeviceState.videoStreamingConnection,
-                true,
-                "Success",
-              )
+          val audioStart =
+            if (usbDeviceState.audioOnly) {
+              null
+            } else {
+              UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.StartAudio)
+            }
+          val videoResume = UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.ResumeVideo)
+          audioStart?.await()
+          videoResume.await()
+          setState(
+            UsbDeviceState.Streaming(
+              usbDeviceState.usbDevice,
+              usbDeviceState.audioStreamingConnection,
+              true,
+              "Success",
+              usbDeviceState.videoStreamingConnection,
+              true,
+              "Success",
             )
+          )
+        }
+      }
+    }
+  }
+
+  /** Disconnects the streamers once the device stayed away past the grace period. */
+  private fun awaitReconnect(usbDevice: UsbDevice) {
+    if (reconnectJob?.isActive == true) {
+      return
+    }
+    reconnectJob = viewModelScope.launch {
+      delay(RECONNECT_GRACE_MS)
+      if (UsbMonitor.usbDeviceState !is UsbDeviceState.Streaming) {
+        Log.i(TAG, "${usbDevice.deviceName} did not come back")
+        setState(UsbDeviceState.Detached(usbDevice))
+      }
+    }
+  }
+
+  private fun startQos(format: VideoFormat) {
+    qosJob?.cancel()
+    if (!adaptiveQuality) {
+      return
+    }
+    val controller =
+        QosController(
+            videoFormats, format, QosController.Config(maxBytesPerSecond = usbThroughputCeiling))
+    qosController = controller
+    qosJob = viewModelScope.launch {
+      while (true) {
+        delay(QOS_SAMPLE_INTERVAL_MS)
+        when (UsbMonitor.usbDeviceState) {
+          is UsbDeviceState.Streaming -> Unit
+          is UsbDeviceState.StreamingStop,
+          is UsbDeviceState.StreamingStopped,
+          is UsbDeviceState.StreamingRestart -> continue
+          else -> break
+        }
+        // Stats reads do not queue behind the streamer commands.
+        val sample =
+          QosController.Sample.of(
+            StreamingStats.shared, UsbVideoNativeLibrary.thermalStatusNative())
+        val next = controller.onSample(sample) ?: continue
+        val switched = UsbVideoNativeLibrary.postReconfigureUsbVideoStreaming(next).await() == 1L
+        Log.i(TAG, "QoS switch from ${controller.current} to $next $switched")
+        controller.onSwitched(next, switched)
+        if (switched) {
+          videoFormat = next
+        }
+      }
+      if (qosController === controller) {
+        qosController = null
+      }
+    }
+  }
+
+  private fun startEnergyMeter() {
+    energyJob?.cancel()
+    val meter = EnergyMeter()
+    energyReading = null
+    energyJob = viewModelScope.launch {
+      var format = videoFormat
+      while (true) {
+        delay(ENERGY_SAMPLE_INTERVAL_MS)
+        when (UsbMonitor.usbDeviceState) {
+          is UsbDeviceState.Streaming -> Unit
+          is UsbDeviceState.StreamingStop,
+          is UsbDeviceState.StreamingStopped,
+          is UsbDeviceState.StreamingRestart -> {
+            meter.pause()
+            continue
           }
+          else -> break
+        }
+        // A QoS or user switch starts the comparison over.
+        if (videoFormat != format) {
+          format = videoFormat
+          meter.reset()
         }
+        val sample =
+          EnergyMeter.Sample.of(StreamingStats.shared, batteryReader, System.nanoTime())
+        val reading = meter.onSample(sample) ?: continue
+        energyReading = meter.sessionReading
+        Log.i(TAG, "Energy of $format: $reading; session ${meter.sessionReading}")
       }
     }
   }
@@ -511,6 +750,7 @@ class StreamerViewModel(
 
   private val mutableStartStopFlow = MutableStateFlow(Unit)
   val startStopSignal: Flow<Unit> = mutableStartStopFlow.asStateFlow().onCompletion {
-    stopStreaming()
+    // Backgrounded; the audio goes on unless the app opted out.
+    stopStreaming(audioOnly = backgroundAudio)
   }.stateIn(viewModelScope, SharingStarted.WhileSubscribed(stopTimeoutMillis = 10_000), Unit)
 }
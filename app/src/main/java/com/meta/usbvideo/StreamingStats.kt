@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+enum class LatencyStage {
+  Device,
+  Usb,
+  Queue,
+  Convert,
+  Post,
+  Total,
+  /** Waiting for a preview buffer, part of [Convert]. */
+  WindowLock,
+}
+
+enum class LatencyPercentile {
+  P50,
+  P95,
+  P99,
+}
+
+/** Where [StreamingStats.videoConversionBackend] converts the preview. */
+enum class ConversionBackend {
+  Cpu,
+  Gpu,
+}
+
+/** Streaming endpoints with transport counters in [StreamingStats]. */
+enum class UsbEndpoint {
+  Video,
+  Audio,
+}
+
+/**
+ * Live view of the native streaming counters in StreamingStats.h. Every getter reads native memory
+ * through a direct ByteBuffer, so polling allocates nothing and makes no JNI calls. Counters are
+ * cumulative for the process; percentiles are republished by the native side once a second.
+ */
+class StreamingStats private constructor(private val buffer: ByteBuffer) {
+
+  private val videoCapture = buffer.getInt(8)
+  private val videoDrops = buffer.getInt(12)
+  private val videoRender = buffer.getInt(16)
+  private val audio = buffer.getInt(20)
+  private val videoLatency = buffer.getInt(24)
+  private val audioLatency = buffer.getInt(28)
+  private val histogramStride = buffer.getInt(32)
+  private val avSync = buffer.getInt(40)
+  private val threads = buffer.getInt(44)
+  private val memory = buffer.getInt(48)
+  private val transport = buffer.getInt(52)
+  private val watchdog = buffer.getInt(56)
+
+  /** Number of buckets in each latency histogram, see LatencyHistogram.h. */
+  val histogramBucketCount: Int = buffer.getInt(36)
+
+  val videoFramesCaptured: Long
+    get() = buffer.getLong(videoCapture)
+
+  val videoBytesCaptured: Long
+    get() = buffer.getLong(videoCapture + 8)
+
+  /** Isochronous bandwidth the video altsetting reserves on the bus, 0 for bulk cameras. */
+  val videoIsoReservedBytesPerSecond: Long
+    get() = buffer.getLong(videoCapture + 16)
+
+  /** Isochronous bandwidth the negotiated video format needs. */
+  val videoIsoNeededBytesPerSecond: Long
+    get() = buffer.getLong(videoCapture + 24)
+
+  val videoIsoPacketErrors: Long
+    get() = buffer.getLong(videoCapture + 32)
+
+  val videoFramesDroppedBusy: Long
+    get() = buffer.getLong(videoDrops)
+
+  val videoFramesDroppedWindowLock: Long
+    get() = buffer.getLong(videoDrops + 8)
+
+  val videoFramesDroppedInvalidSize: Long
+    get() = buffer.getLong(videoDrops + 16)
+
+  val videoFramesRendered: Long
+    get() = buffer.getLong(videoRender)
+
+  val videoFps: Long
+    get() = buffer.getLong(videoRender + 8)
+
+  fun videoLatencyUs(stage: LatencyStage, percentile: LatencyPercentile): Long =
+      buffer.getLong(
+          videoRender +
+              16 +
+              8 * (stage.ordinal * LatencyPercentile.entries.size + percentile.ordinal))
+
+  /** MJPEG frames passed over for a newer queued one without being decoded. */
+  val videoDecodesSkipped: Long
+    get() =
+        buffer.getLong(
+            videoRender + 16 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Frames the change detector found unchanged and did not convert or post. */
+  val videoFramesUnchanged: Long
+    get() =
+        buffer.getLong(
+            videoRender + 24 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Frames that failed to convert, with the last good frame shown again instead. */
+  val videoFramesConcealed: Long
+    get() =
+        buffer.getLong(
+            videoRender + 32 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Exponentially weighted render rate; [videoFps] is over the last second. */
+  val videoFpsSmoothed: Double
+    get() =
+        buffer.getLong(
+            videoRender + 40 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size) /
+            1000.0
+
+  /** Microseconds from connecting the video streamer to its first frame on screen, 0 before. */
+  val videoFirstFrameUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 48 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * Microseconds from connecting the video streamer to its first frame of the requested mode on
+   * screen, later than [videoFirstFrameUs] after a fast start; 0 before.
+   */
+  val videoFullQualityUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 56 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Stripe conversion and MJPEG decode jobs the shared native scheduler ran for the stream. */
+  val videoDeadlineJobs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 64 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Those of [videoDeadlineJobs] that finished after the next frame was due. */
+  val videoDeadlineMisses: Long
+    get() =
+        buffer.getLong(
+            videoRender + 72 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * Frames skipped because the shared scheduler was oversubscribed and this stream had the most
+   * slack; also counted in [videoFramesDroppedBusy].
+   */
+  val videoFramesShed: Long
+    get() =
+        buffer.getLong(
+            videoRender + 80 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * Frames of which only the rows that changed since the last one shown were converted and posted,
+   * with change detection's partial updates.
+   */
+  val videoFramesPartial: Long
+    get() =
+        buffer.getLong(
+            videoRender + 88 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Target depth in frames of the smooth playback jitter buffer, 0 without smooth playback. */
+  val videoJitterBufferDepth: Long
+    get() =
+        buffer.getLong(
+            videoRender + 96 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Delay of the smooth playback jitter buffer past the frames' source times. */
+  val videoJitterBufferDelayUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 104 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * 95th percentile over the last second of how far the intervals between presented frames were
+   * from those between their source times, with smooth playback.
+   */
+  val videoPresentJitterUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 112 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Mean time over the last second that smooth playback held frames back. */
+  val videoAddedLatencyUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 120 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Frames smooth playback presented after they were due. */
+  val videoJitterBufferLateFrames: Long
+    get() =
+        buffer.getLong(
+            videoRender + 128 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * Backend converting the preview of raw NV12 and YUYV streams, moved to the less loaded one
+   * when the other falls behind.
+   */
+  val videoConversionBackend: ConversionBackend
+    get() {
+      val ordinal =
+          buffer.getLong(
+              videoRender + 136 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+      return ConversionBackend.entries[ordinal.toInt()]
+    }
+
+  /** Times preview conversion moved between the CPU and the GPU. */
+  val videoConversionSwitches: Long
+    get() =
+        buffer.getLong(
+            videoRender + 144 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * Smoothed time the CPU backend took per frame, from taking it off the render queue to posting
+   * it, as last measured while it converted.
+   */
+  val videoCpuConversionCostUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 152 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** Smoothed render queue delay while the CPU backend converted. */
+  val videoCpuConversionQueueDelayUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 160 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** As [videoCpuConversionCostUs], for the GPU backend. */
+  val videoGpuConversionCostUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 168 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /** As [videoCpuConversionQueueDelayUs], for the GPU backend. */
+  val videoGpuConversionQueueDelayUs: Long
+    get() =
+        buffer.getLong(
+            videoRender + 176 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+
+  /**
+   * UsbVideoNativeLibrary.FAST_PATH_* bits of the paths the stream runs on, of those
+   * [UsbVideoNativeLibrary.setFastPathsNative] allowed.
+   */
+  val videoFastPaths: Int
+    get() =
+        buffer
+            .getLong(
+                videoRender + 184 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+            .toInt()
+
+  /** Cohort of [UsbVideoNativeLibrary.setFastPathsNative] the stream was configured with. */
+  val videoFastPathCohort: Int
+    get() =
+        buffer
+            .getLong(
+                videoRender + 192 + 8 * LatencyStage.entries.size * LatencyPercentile.entries.size)
+            .toInt()
+
+  /** Share of [videoDeadlineJobs] that missed their deadline, 0 before the first. */
+  val videoDeadlineMissRatio: Double
+    get() = videoDeadlineJobs.let { if (it > 0) videoDeadlineMisses.toDouble() / it else 0.0 }
+
+  /** Share of the captured frames [videoFramesUnchanged] skipped, 0 before the first. */
+  val videoUnchangedRatio: Double
+    get() = videoFramesCaptured.let { if (it > 0) videoFramesUnchanged.toDouble() / it else 0.0 }
+
+  val audioUsbTransfers: Long
+    get() = buffer.getLong(audio)
+
+  val audioPlayerCallbacks: Long
+    get() = buffer.getLong(audio + 8)
+
+  val audioBytes: Long
+    get() = buffer.getLong(audio + 16)
+
+  val audioUnderruns: Long
+    get() = buffer.getLong(audio + 24)
+
+  val audioPacketErrors: Long
+    get() = buffer.getLong(audio + 32)
+
+  val audioSamplingFrequency: Long
+    get() = buffer.getLong(audio + 40)
+
+  /** Audio buffered ahead of the player. */
+  fun audioLatencyUs(percentile: LatencyPercentile): Long =
+      buffer.getLong(audio + 48 + 8 * percentile.ordinal)
+
+  val audioOverruns: Long
+    get() = buffer.getLong(audio + 72)
+
+  val audioXRuns: Long
+    get() = buffer.getLong(audio + 80)
+
+  /** AAudio buffer size picked by the latency tuner, in frames. */
+  val audioBufferSizeFrames: Long
+    get() = buffer.getLong(audio + 88)
+
+  /** Isochronous transfers the latency tuner keeps in flight. */
+  val audioInFlightTransfers: Long
+    get() = buffer.getLong(audio + 96)
+
+  /** Ring buffer fill the latency tuner aims for, in frames. */
+  val audioTargetFillFrames: Long
+    get() = buffer.getLong(audio + 104)
+
+  /** Ring buffer fill after the latest USB transfer, in frames. */
+  val audioRingFillFrames: Long
+    get() = buffer.getLong(audio + 112)
+
+  /** Estimated delay from the USB device to the speaker. */
+  val audioDeliveryLatencyUs: Long
+    get() = buffer.getLong(audio + 120)
+
+  /** Frames played in place of audio the ring buffer ran out of. */
+  val audioFramesConcealed: Long
+    get() = buffer.getLong(audio + 128)
+
+  /** Frames put in place of errored isochronous packets. */
+  val audioPacketFramesConcealed: Long
+    get() = buffer.getLong(audio + 136)
+
+  /** Exponentially weighted [audioSamplingFrequency], in Hz. */
+  val audioSamplingFrequencySmoothed: Double
+    get() = buffer.getLong(audio + 144) / 1000.0
+
+  /**
+   * Decaying peak of output [channel], below [METERED_AUDIO_CHANNELS], from 0 to 1 at full scale.
+   * Zero unless audio processing is on, see [UsbVideoNativeLibrary.setAudioProcessingNative].
+   */
+  fun audioLevelPeak(channel: Int): Double = buffer.getLong(audio + 152 + 8 * channel) / 1e6
+
+  /** RMS of output [channel] over about the last 300 ms, like [audioLevelPeak]. */
+  fun audioLevelRms(channel: Int): Double =
+      buffer.getLong(audio + 152 + 8 * (METERED_AUDIO_CHANNELS + channel)) / 1e6
+
+  /** Samples audio processing's gain took beyond full scale, clipped softly or saturated. */
+  val audioSamplesOverFullScale: Long
+    get() = buffer.getLong(audio + 152 + 16 * METERED_AUDIO_CHANNELS)
+
+  /**
+   * Time from starting the audio stream to its first USB sample playing, after the ring buffer
+   * filled to [audioTargetFillFrames]. Estimated from the frames AAudio held ahead of it.
+   */
+  val audioStartToAudibleUs: Long
+    get() = buffer.getLong(audio + 160 + 16 * METERED_AUDIO_CHANNELS)
+
+  /** Measured A/V skew, positive when video is presented after its audio. */
+  val avSyncSkewUs: Long
+    get() = buffer.getLong(avSync)
+
+  /** Delay added to audio to bring it in step with video. */
+  val avSyncAudioDelayUs: Long
+    get() = buffer.getLong(avSync + 8)
+
+  /** Delay added to video to bring it in step with audio. */
+  val avSyncVideoDelayUs: Long
+    get() = buffer.getLong(avSync + 16)
+
+  /** CPU time of the process's threads of [role], those that exited included. */
+  fun threadCpuTimeUs(role: ThreadRole): Long = threadCounter(role, 0)
+
+  /** Time the threads of [role] were runnable but waited for a CPU. */
+  fun threadRunDelayUs(role: ThreadRole): Long = threadCounter(role, 1)
+
+  /** Times the threads of [role] were put on a CPU, after a wakeup or a preemption. */
+  fun threadWakeups(role: ThreadRole): Long = threadCounter(role, 2)
+
+  /** Times the threads of [role] blocked, such as waiting for the next frame. */
+  fun threadVoluntarySwitches(role: ThreadRole): Long = threadCounter(role, 3)
+
+  /** Times the threads of [role] were preempted. */
+  fun threadInvoluntarySwitches(role: ThreadRole): Long = threadCounter(role, 4)
+
+  /** Threads of [role] running now. */
+  fun threadCount(role: ThreadRole): Long = threadCounter(role, 5)
+
+  private fun threadCounter(role: ThreadRole, index: Int): Long =
+      buffer.getLong(threads + 8 * (THREAD_COUNTERS * role.ordinal + index))
+
+  /** Instruction set extensions of the CPU, CpuFeatures flags in CpuFeatures.h. */
+  val cpuFeatures: Long
+    get() = buffer.getLong(threads + 8 * THREAD_COUNTERS * ThreadRole.entries.size)
+
+  /** Newest kernel variants the CPU could run: 0 armv8-a, 1 armv8.2 dotprod+fp16, 2 armv9 SVE2. */
+  val cpuTier: Int
+    get() = buffer.getLong(threads + 8 * (THREAD_COUNTERS * ThreadRole.entries.size + 1)).toInt()
+
+  /** libyuv's cpu_id flags, which pick the conversion kernels it runs. */
+  val libyuvCpuFlags: Long
+    get() = buffer.getLong(threads + 8 * (THREAD_COUNTERS * ThreadRole.entries.size + 2))
+
+  /** How long System.loadLibrary() of the native library took, 0 before the app reported it. */
+  val libraryLoadUs: Long
+    get() = buffer.getLong(threads + 8 * (THREAD_COUNTERS * ThreadRole.entries.size + 3))
+
+  /** The part of [libraryLoadUs] spent in the library's JNI_OnLoad. */
+  val jniOnLoadUs: Long
+    get() = buffer.getLong(threads + 8 * (THREAD_COUNTERS * ThreadRole.entries.size + 4))
+
+  /** Bytes the native library's loadable segments map: code, data and relocations. */
+  val libraryMappedBytes: Long
+    get() = buffer.getLong(threads + 8 * (THREAD_COUNTERS * ThreadRole.entries.size + 5))
+
+  /** Video transfer buffers in flight and kept for the next start, usbfs ones included. */
+  val videoTransferBytes: Long
+    get() = buffer.getLong(memory)
+
+  val videoUsbfsBytes: Long
+    get() = buffer.getLong(memory + 8)
+
+  val videoFramePoolBytes: Long
+    get() = buffer.getLong(memory + 16)
+
+  val videoPollingBytes: Long
+    get() = buffer.getLong(memory + 24)
+
+  val renderScratchBytes: Long
+    get() = buffer.getLong(memory + 32)
+
+  val decodeWorkerBytes: Long
+    get() = buffer.getLong(memory + 40)
+
+  /** Audio transfer buffers, ring buffer and resampler buffers. */
+  val audioBufferBytes: Long
+    get() = buffer.getLong(memory + 48)
+
+  /** Frame buffers stopped streams left for the next one, for the process. */
+  val frameBufferStashBytes: Long
+    get() = buffer.getLong(memory + 56)
+
+  /** Aligned buffers of the process, most video buffers above included. */
+  val alignedBufferBytes: Long
+    get() = buffer.getLong(memory + 64)
+
+  /** Native heap in use by the process. */
+  val nativeHeapBytes: Long
+    get() = buffer.getLong(memory + 72)
+
+  /** Isochronous packets, or bulk payloads, that [endpoint] completed, failed ones included. */
+  fun transportPackets(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 0)
+
+  fun transportPacketErrors(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 1)
+
+  /** Packets with less data than a full one, for audio less than the nominal rate carries. */
+  fun transportShortPackets(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 2)
+
+  /** Packets without data, or with a UVC payload header only. */
+  fun transportEmptyPackets(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 3)
+
+  fun transportBytes(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 4)
+
+  /** Bytes per packet the endpoint's altsetting reserves on the bus. */
+  fun transportReservedBytesPerPacket(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 5)
+
+  /** Largest packet of the running stream, to hold against the reserved bytes. */
+  fun transportMaxPacketBytes(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 6)
+
+  /** Time between packets, zero for bulk endpoints. */
+  fun transportPacketIntervalUs(endpoint: UsbEndpoint): Long = transportCounter(endpoint, 7)
+
+  /** Share of the reserved bandwidth the received bytes used, 0 for bulk endpoints. */
+  fun transportBusUtilization(endpoint: UsbEndpoint): Double {
+    val reserved = transportPackets(endpoint) * transportReservedBytesPerPacket(endpoint)
+    return if (reserved > 0) transportBytes(endpoint).toDouble() / reserved else 0.0
+  }
+
+  /** UVC payloads dropped for their error bit or a bogus header. */
+  val videoTransportHeaderErrors: Long
+    get() = transportCounter(UsbEndpoint.Video, 8)
+
+  /** Video frames published with a packet or payload missing. */
+  val videoIncompleteFrames: Long
+    get() = transportCounter(UsbEndpoint.Video, 9)
+
+  /** Video frames ended by the frame ID toggling instead of an end of frame bit. */
+  val videoFramesWithoutEof: Long
+    get() = transportCounter(UsbEndpoint.Video, 10)
+
+  /** Video frames missing between the sequence numbers libuvc delivered. */
+  val videoSequenceGaps: Long
+    get() = transportCounter(UsbEndpoint.Video, 11)
+
+  /** Video frames larger than the camera's dwMaxVideoFrameSize, kept whole in a grown buffer. */
+  val videoOversizeFrames: Long
+    get() = transportCounter(UsbEndpoint.Video, 12)
+
+  /** Video frames that ran out of buffer and lost their end, also counted as incomplete. */
+  val videoTruncatedFrames: Long
+    get() = transportCounter(UsbEndpoint.Video, 13)
+
+  /** usbfs URB submissions of the whole process, one per up to 128 isochronous packets. */
+  val usbfsUrbSubmits: Long
+    get() = buffer.getLong(transport + 8 * (TRANSPORT_COUNTERS * UsbEndpoint.entries.size))
+
+  /** usbfs reaps of the whole process, including [usbfsEmptyReaps]. */
+  val usbfsUrbReaps: Long
+    get() = buffer.getLong(transport + 8 * (TRANSPORT_COUNTERS * UsbEndpoint.entries.size + 1))
+
+  /** usbfs reaps that found no completed URB, about one per USB event wakeup. */
+  val usbfsEmptyReaps: Long
+    get() = buffer.getLong(transport + 8 * (TRANSPORT_COUNTERS * UsbEndpoint.entries.size + 2))
+
+  private fun transportCounter(endpoint: UsbEndpoint, index: Int): Long =
+      buffer.getLong(transport + 8 * (TRANSPORT_COUNTERS * endpoint.ordinal + index))
+
+  /** Transfers of [endpoint] submitted to the bus, as last seen by the stall watchdog. */
+  fun watchdogTransfersInFlight(endpoint: UsbEndpoint): Long = watchdogCounter(endpoint, 0)
+
+  /** Transfers that failed and were submitted again instead of being dropped. */
+  fun watchdogTransfersRearmed(endpoint: UsbEndpoint): Long = watchdogCounter(endpoint, 1)
+
+  /** Times [endpoint] went without a frame, or audio transfer, for the stall timeout. */
+  fun watchdogStalls(endpoint: UsbEndpoint): Long = watchdogCounter(endpoint, 2)
+
+  /** Streams stopped and started again for a stall, and those that failed to start. */
+  fun watchdogRestarts(endpoint: UsbEndpoint): Long = watchdogCounter(endpoint, 3)
+
+  fun watchdogFailedRestarts(endpoint: UsbEndpoint): Long = watchdogCounter(endpoint, 4)
+
+  fun watchdogLongestStallUs(endpoint: UsbEndpoint): Long = watchdogCounter(endpoint, 5)
+
+  private fun watchdogCounter(endpoint: UsbEndpoint, index: Int): Long =
+      buffer.getLong(watchdog + 8 * (WATCHDOG_COUNTERS * endpoint.ordinal + index))
+
+  /** Samples in one bucket of a video stage histogram, for drawing distributions. */
+  fun videoLatencyBucket(stage: LatencyStage, bucket: Int): Int =
+      buffer.getInt(videoLatency + stage.ordinal * histogramStride + 8 + 4 * bucket)
+
+  /** Samples in one bucket of the audio buffering histogram. */
+  fun audioLatencyBucket(bucket: Int): Int = buffer.getInt(audioLatency + 8 + 4 * bucket)
+
+  companion object {
+    private const val VERSION = 26
+    // Output channels with audio levels, kMeteredAudioChannels.
+    const val METERED_AUDIO_CHANNELS = 8
+    // Counters per role in ThreadUsageCounters.
+    private const val THREAD_COUNTERS = 6
+    // Counters per endpoint in UsbTransportCounters.
+    private const val TRANSPORT_COUNTERS = 14
+    // Counters per endpoint in WatchdogCounters.
+    private const val WATCHDOG_COUNTERS = 6
+
+    val shared: StreamingStats by lazy {
+      wrap(UsbVideoNativeLibrary.streamingStatsBufferNative())
+    }
+
+    /**
+     * Counters of a camera session from [UsbVideoNativeLibrary.openCameraSessionNative], or null
+     * when [handle] is not open. Blocks are reused by later sessions, which continue their counts.
+     */
+    fun forSession(handle: Int): StreamingStats? =
+        UsbVideoNativeLibrary.cameraSessionStatsBufferNative(handle)?.let { wrap(it) }
+
+    private fun wrap(nativeBuffer: ByteBuffer): StreamingStats {
+      val buffer = nativeBuffer.order(ByteOrder.nativeOrder())
+      check(buffer.getInt(0) == VERSION) { "Unexpected native stats layout ${buffer.getInt(0)}" }
+      return StreamingStats(buffer)
+    }
+  }
+}
@@ -18,6 +18,8 @@ package com.meta.usbvideo
 import android.graphics.SurfaceTexture
 import android.os.SystemClock
 import android.util.Log
+import android.view.SurfaceHolder
+import android.view.SurfaceView
 import android.view.TextureView
 import android.view.View
 import android.widget.TextView
@@ -26,6 +28,7 @@ import com.meta.usbvideo.eventloop.EventLooper
 import com.meta.usbvideo.ui.VideoContainerView
 
 private const val TAG = "StreamingViewHolder"
+private const val OVERLAY_TICK_MS = 500L
 
 class StreamingViewHolder(
   private val rootView: View,
@@ -39,7 +42,29 @@ class StreamingViewHolder(
   private var stateTransitionAt = 0L
   var isPlaying: Boolean = true
 
+  // A SurfaceView reports no frames, so its overlay updates on a timer.
+  private val overlayTicker =
+    object : Runnable {
+      override fun run() {
+        updateOverlay()
+        streamingStats.postDelayed(this, OVERLAY_TICK_MS)
+      }
+    }
+
   init {
+    if (streamerViewModel.surfaceViewPreview) {
+      addVideoSurfaceView()
+    } else {
+      addVideoTextureView()
+    }
+    if (overlayMode == OverlayMode.STREAMING_STATS) {
+      updateOverlayMode(OverlayMode.NONE)
+    } else {
+      updateOverlayMode(overlayMode.next())
+    }
+  }
+
+  private fun addVideoTextureView() {
     val videoTextureView = TextureView(videoFrame.context)
     videoTextureView.surfaceTextureListener =
       object : TextureView.SurfaceTextureListener {
@@ -69,44 +94,11 @@ class StreamingViewHolder(
 
         override fun onSurfaceTextureDestroyed(surfaceTexture: SurfaceTexture): Boolean {
           Log.d(TAG, "onSurfaceTextureDestroyed() called with: surface = $surfaceTexture")
-          streamerViewModel.surfaceTextureDestroyed(surfaceTexture)
-          return true
+          return streamerViewModel.surfaceTextureDestroyed(surfaceTexture)
         }
 
         override fun onSurfaceTextureUpdated(surfaceTexture: SurfaceTexture) {
-          if (overlayMode == OverlayMode.NONE) {
-            return
-          }
-          val now = SystemClock.uptimeMillis()
-          if (now - lastUpdatedAt > 999) {
-            val streamingStatsSummaryText =
-              if (overlayMode == OverlayMode.TOGGLE_TIP) {
-                rootView.context.getText(R.string.streaming_stats_toggle_tip)
-              } else {
-                streamerViewModel.getStreamingStatsSummaryString()
-              }
-            streamingStats.setText(streamingStatsSummaryText)
-            streamingStats.isVisible = streamingStatsSummaryText.isNotEmpty()
-            lastUpdatedAt = now
-          }
-
-          if (stateTransitionAt == 0L) {
-            stateTransitionAt = now
-          } else {
-            when (overlayMode) {
-              OverlayMode.INITIAL_STATS -> {
-                if (now - stateTransitionAt > 10_000) {
-                  updateOverlayMode(overlayMode.next())
-                }
-              }
-              OverlayMode.TOGGLE_TIP -> {
-                if (now - stateTransitionAt > 5_000) {
-                  updateOverlayMode(overlayMode.next())
-                }
-              }
-              else -> Unit
-            }
-          }
+          updateOverlay()
         }
       }
 
@@ -114,14 +106,72 @@ class StreamingViewHolder(
     val width = videoFormat?.width ?: 1920
     val height = videoFormat?.height ?: 1080
     videoFrame.addVideoTextureView(videoTextureView, width, height)
-    if (overlayMode == OverlayMode.STREAMING_STATS) {
-      updateOverlayMode(OverlayMode.NONE)
+  }
+
+  // The native side sets the buffers' size, format and transform; no SurfaceTexture sits between
+  // them and the compositor, which can then show them on a hardware overlay.
+  private fun addVideoSurfaceView() {
+    val videoSurfaceView = SurfaceView(videoFrame.context)
+    videoSurfaceView.holder.addCallback(
+      object : SurfaceHolder.Callback {
+        override fun surfaceCreated(holder: SurfaceHolder) {
+          Log.d(TAG, "surfaceCreated() called with: surface = ${holder.surface}")
+          streamerViewModel.surfaceAvailable(holder.surface)
+          streamingStats.post(overlayTicker)
+        }
+
+        override fun surfaceChanged(holder: SurfaceHolder, format: Int, width: Int, height: Int) {
+          Log.d(
+            TAG,
+            "surfaceChanged() called with: format = $format, width = $width, height = $height"
+          )
+        }
+
+        override fun surfaceDestroyed(holder: SurfaceHolder) {
+          Log.d(TAG, "surfaceDestroyed() called with: surface = ${holder.surface}")
+          streamingStats.removeCallbacks(overlayTicker)
+          streamerViewModel.surfaceDestroyed()
+        }
+      })
+    videoFrame.addVideoSurfaceView(videoSurfaceView)
+  }
+
+  private fun updateOverlay() {
+    if (overlayMode == OverlayMode.NONE) {
+      return
+    }
+    val now = SystemClock.uptimeMillis()
+    if (now - lastUpdatedAt > 999) {
+      val streamingStatsSummaryText =
+        if (overlayMode == OverlayMode.TOGGLE_TIP) {
+          rootView.context.getText(R.string.streaming_stats_toggle_tip)
+        } else {
+          streamerViewModel.getStreamingStatsSummaryString()
+        }
+      streamingStats.setText(streamingStatsSummaryText)
+      streamingStats.isVisible = streamingStatsSummaryText.isNotEmpty()
+      lastUpdatedAt = now
+    }
+
+    if (stateTransitionAt == 0L) {
+      stateTransitionAt = now
     } else {
-      updateOverlayMode(overlayMode.next())
+      when (overlayMode) {
+        OverlayMode.INITIAL_STATS -> {
+          if (now - stateTransitionAt > 10_000) {
+            updateOverlayMode(overlayMode.next())
+          }
+        }
+        OverlayMode.TOGGLE_TIP -> {
+          if (now - stateTransitionAt > 5_000) {
+            updateOverlayMode(overlayMode.next())
+          }
+        }
+        else -> Unit
+      }
     }
   }
 
-
   private enum class OverlayMode {
     INITIAL_STATS,
     TOGGLE_TIP,
@@ -16,13 +16,41 @@
 package com.meta.usbvideo
 
 import android.app.Application
+import android.content.ComponentCallbacks2
+import android.os.SystemClock
+import android.util.Log
+import com.meta.usbvideo.eventloop.EventLooper
 import com.meta.usbvideo.usb.UsbMonitor
+import java.io.File
+
+private const val TAG = "UsbVideoApplication"
+private const val TELEMETRY_FILE = "telemetry.uvtl"
 
 class UsbVideoApplication : Application() {
 
   override fun onCreate() {
     super.onCreate()
     UsbMonitor.init(this)
+    val loadStart = SystemClock.elapsedRealtimeNanos()
     System.loadLibrary("usbvideo")
+    UsbVideoNativeLibrary.recordLibraryLoadNative(
+        (SystemClock.elapsedRealtimeNanos() - loadStart) / 1000)
+    UsbVideoNativeLibrary.setNegotiationCacheDirNative(cacheDir.absolutePath)
+    val telemetry = File(filesDir, TELEMETRY_FILE)
+    if (!UsbVideoNativeLibrary.startTelemetryLogNative(telemetry.absolutePath, 0)) {
+      Log.w(TAG, "No telemetry log at $telemetry")
+    }
+  }
+
+  override fun onTrimMemory(level: Int) {
+    super.onTrimMemory(level)
+    if (level < ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN) {
+      return
+    }
+    EventLooper.post {
+      val freed = UsbVideoNativeLibrary.trimNativeMemoryNative()
+      Log.i(TAG, "Trimmed $freed bytes at level $level")
+      Log.i(TAG, UsbVideoNativeLibrary.nativeMemorySummaryNative())
+    }
   }
 }
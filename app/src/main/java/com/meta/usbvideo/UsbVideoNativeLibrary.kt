@@ -15,7 +15,9 @@
  */
 package com.meta.usbvideo
 
+import android.graphics.Bitmap
 import android.content.Context
+import android.hardware.HardwareBuffer
 import android.media.AudioManager
 import android.media.AudioTrack
 import android.view.Surface
@@ -23,6 +25,12 @@ import com.meta.usbvideo.usb.AudioStreamingConnection
 import com.meta.usbvideo.usb.AudioStreamingFormatTypeDescriptor
 import com.meta.usbvideo.usb.VideoFormat
 import com.meta.usbvideo.usb.VideoStreamingConnection
+import dalvik.annotation.optimization.CriticalNative
+import java.nio.ByteBuffer
+import kotlinx.coroutines.CompletableDeferred
+import kotlinx.coroutines.Deferred
+import kotlin.coroutines.resume
+import kotlin.coroutines.suspendCoroutine
 
 enum class UsbSpeed {
   Unknown,
@@ -32,46 +40,254 @@ enum class UsbSpeed {
   Super,
 }
 
+/** Layout of frames published by the frame tap, in the order of FrameTapFormat in FrameTap.h. */
+enum class FrameTapFormat {
+  /** The camera's payload as is, at capture size. */
+  Raw,
+  Nv12,
+  /** 8 bits per channel, R first in memory. */
+  Rgba,
+  /** The 8 bit Y plane of YUYV, UYVY and NV12 captures. */
+  Luma,
+  /** A model's input tensor, started with [UsbVideoNativeLibrary.startTensorTap]. */
+  Tensor,
+}
+
+/** Order of a tapped tensor's values, as TensorLayout in TensorConverter.h. */
+enum class TensorLayout {
+  /** R, G and B of each pixel together. */
+  Nhwc,
+  /** A plane of R, then G, then B. */
+  Nchw,
+}
+
+/** Type of a tapped tensor's values, as TensorType in TensorConverter.h. */
+enum class TensorType {
+  Float32,
+  /** round(normalized / scale) + zeroPoint, saturated, as TFLite quantizes inputs. */
+  Int8,
+  Uint8,
+}
+
+/** Where a lapped audio tap reader resumes, in the order of RingBuffer::Overflow. */
+enum class AudioTapOverflow {
+  /** At the oldest audio still buffered. */
+  Oldest,
+  /** At the latest audio. */
+  Newest,
+}
+
+/** Native threads with a scheduling policy, in the order of ThreadRole in ThreadPolicy.h. */
+enum class ThreadRole {
+  /** Dispatches USB completions of every stream. */
+  UsbEvents,
+  /** libuvc's frame callback thread, unused when callbacks run inline on [UsbEvents]. */
+  Capture,
+  Render,
+  /** Workers splitting large frame conversions. */
+  Convert,
+}
+
+/**
+ * Commands of [UsbVideoNativeLibrary.postStreamerCommand], in the order of StreamerCommandType in
+ * UsbVideoNativeLibrary.cpp. The audio ones run on the audio lane, the others but
+ * [DisconnectVideo] on the video lane.
+ */
+enum class StreamerCommand {
+  StartAudio,
+  StopAudio,
+  StartVideo,
+  StopVideo,
+  /** 1 when paused, 0 when the stream could not pause and was stopped instead. */
+  PauseVideo,
+  ResumeVideo,
+  /** Takes the width, height, fps and libuvc frame format; 1 once switched. */
+  ReconfigureVideo,
+  /** Takes the surface, or null to stream headless; runs ahead of the queued format switches. */
+  SetVideoSurface,
+  DisconnectAudio,
+  /** Runs on both lanes, it also stops the recording and network sinks. */
+  DisconnectVideo,
+}
+
+/** Threads of the native streamer controller a command runs on, as StreamerController::Lane. */
+enum class StreamerLane(val mask: Int) {
+  Audio(1),
+  Video(2),
+  /** Waits for both lanes and runs alone. */
+  Both(3),
+}
+
+/** Order of the commands queued on a lane, in the order of StreamerController::Priority. */
+enum class StreamerPriority {
+  Low,
+  Normal,
+  High,
+}
+
 object UsbVideoNativeLibrary {
 
-  fun getUsbSpeed(): UsbSpeed = UsbSpeed.values()[getUsbDeviceSpeed()]
+  /** Result of a streamer command dropped before it ran. */
+  const val STREAMER_COMMAND_CANCELLED = Long.MIN_VALUE
 
-  private external fun getUsbDeviceSpeed(): Int
+  /** Positions in the info array filled by [acquireTappedFrameNative]. */
+  const val TAP_INFO_CAPTURE_TIME_NS = 0
+  const val TAP_INFO_SEQUENCE = 1
+  const val TAP_INFO_WIDTH = 2
+  const val TAP_INFO_HEIGHT = 3
+  const val TAP_INFO_STRIDE = 4
+  const val TAP_INFO_SIZE = 5
+  const val TAP_INFO_LEVEL_COUNT = 6
+  /**
+   * Start of the levels of a pyramid tap, [TAP_INFO_LEVEL_FIELDS] longs each: the byte offset of
+   * the level in the buffer, its width, height and stride. The first level is the frame itself.
+   */
+  const val TAP_INFO_LEVELS = 7
+  const val TAP_INFO_LEVEL_OFFSET = 0
+  const val TAP_INFO_LEVEL_WIDTH = 1
+  const val TAP_INFO_LEVEL_HEIGHT = 2
+  const val TAP_INFO_LEVEL_STRIDE = 3
+  const val TAP_INFO_LEVEL_FIELDS = 4
+  const val TAP_MAX_LEVELS = 4
+  const val TAP_INFO_LENGTH = TAP_INFO_LEVELS + TAP_MAX_LEVELS * TAP_INFO_LEVEL_FIELDS
 
-  fun connectUsbAudioStreaming(
+  const val AUDIO_TAP_INFO_TIME_NS = 0
+  const val AUDIO_TAP_INFO_FRAME_POSITION = 1
+  const val AUDIO_TAP_INFO_LOST_FRAMES = 2
+  const val AUDIO_TAP_INFO_FRAMES = 3
+  const val AUDIO_TAP_INFO_LENGTH = 4
+
+  const val AUDIO_LOOPBACK_ROUND_TRIP_MS = 0
+  const val AUDIO_LOOPBACK_ROUND_TRIP_MIN_MS = 1
+  const val AUDIO_LOOPBACK_ROUND_TRIP_MAX_MS = 2
+  const val AUDIO_LOOPBACK_JITTER_MS = 3
+  const val AUDIO_LOOPBACK_OUTPUT_MS = 4
+  const val AUDIO_LOOPBACK_INPUT_MS = 5
+  const val AUDIO_LOOPBACK_PASS_THROUGH_MS = 6
+  const val AUDIO_LOOPBACK_PEAK_RATIO = 7
+  const val AUDIO_LOOPBACK_CAPTURED = 8
+  const val AUDIO_LOOPBACK_BURSTS = 9
+  const val AUDIO_LOOPBACK_REPORT_LENGTH = 10
+
+  private val usbSpeeds = UsbSpeed.values()
+
+  fun getUsbSpeed(): UsbSpeed = usbSpeeds[usbDeviceSpeedNative()]
+
+  // The getters below are registered from JNI_OnLoad and cost little more than a Kotlin call, so
+  // they can be polled per frame. Stats handles stay valid for the life of the process; an unknown
+  // handle reads as zeros.
+
+  @JvmStatic @CriticalNative private external fun usbDeviceSpeedNative(): Int
+
+  /** Stats handle of the default streamers. */
+  @JvmStatic @CriticalNative external fun statsHandleNative(): Long
+
+  @JvmStatic @CriticalNative external fun videoFpsNative(stats: Long): Long
+
+  /** Like [StreamingStats.videoLatencyUs], by [LatencyStage] and [LatencyPercentile] ordinal. */
+  @JvmStatic
+  @CriticalNative
+  external fun videoLatencyUsNative(stats: Long, stage: Int, percentile: Int): Long
+
+  @JvmStatic @CriticalNative external fun audioLatencyUsNative(stats: Long, percentile: Int): Long
+
+  /** Frames in the playback ring after the latest USB transfer. */
+  @JvmStatic @CriticalNative external fun audioRingFillFramesNative(stats: Long): Long
+
+  /** Frame events dropped since [openFrameEventsNative] because the reader fell behind. */
+  @JvmStatic @CriticalNative external fun frameEventsLostNative(stats: Long): Long
+
+  /**
+   * Starts queueing the frame events of the streamers behind [stats] for one reader; see
+   * [FrameEventStream]. False when the handle is unknown or a reader is open.
+   */
+  external fun openFrameEventsNative(stats: Long): Boolean
+
+  /** Stops queueing frame events and wakes the reader. */
+  external fun closeFrameEventsNative(stats: Long)
+
+  /**
+   * Waits until [minCount] frame events are queued, [maxWaitMs] passed or the queue was closed,
+   * then copies up to as many [FrameEventBatch.RECORD_SIZE] byte records as fit into the direct
+   * [buffer], from its start. Returns the count.
+   */
+  external fun readFrameEventsNative(
+      stats: Long,
+      buffer: ByteBuffer,
+      minCount: Int,
+      maxWaitMs: Int,
+  ): Int
+
+  /** Native playback parameters of an audio streaming interface, or why it cannot be played. */
+  private class AudioStreamingParams(
+      val deviceFD: Int,
+      val audioFormat: Int,
+      val samplingFrequency: Int,
+      val subFrameSize: Int,
+      val channelCount: Int,
+      val outputFramesPerBuffer: Int,
+      val nativeSampleRate: Int,
+  )
+
+  private fun audioStreamingParams(
       context: Context,
       audioStreamingConnection: AudioStreamingConnection,
-  ): Pair<Boolean, String> {
+  ): Pair<AudioStreamingParams?, String> {
     if (!audioStreamingConnection.supportsAudioStreaming) {
-      return false to "No Audio Streaming Interface"
+      return null to "No Audio Streaming Interface"
     }
 
     val audioFormat =
-        audioStreamingConnection.supportedAudioFormat ?: return false to "No Supported Audio Format"
+        audioStreamingConnection.supportedAudioFormat ?: return null to "No Supported Audio Format"
 
     if (!audioStreamingConnection.hasFormatTypeDescriptor) {
-      return false to "No Audio Streaming Format Descriptor"
+      return null to "No Audio Streaming Format Descriptor"
     }
 
     val format: AudioStreamingFormatTypeDescriptor = audioStreamingConnection.formatTypeDescriptor
 
-    val channelCount = format.bNrChannels
-    val samplingFrequency = format.tSamFreq.firstOrNull() ?: return false to "No Sample Rate"
-    val subFrameSize = format.bSubFrameSize
+    // UAC 2.0 descriptors list no rates; zero has the native side pick one of the device's clock.
+    val samplingFrequency = format.tSamFreq.firstOrNull() ?: 0
     val audioManager: AudioManager = context.getSystemService(Context.AUDIO_SERVICE) as AudioManager
     val outputFramesPerBuffer =
         audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_FRAMES_PER_BUFFER)?.toInt() ?: 0
+    val nativeSampleRate =
+        audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_SAMPLE_RATE)?.toInt() ?: 0
 
-    val deviceFD = audioStreamingConnection.deviceFD
-
-    return if (connectUsbAudioStreamingNative(
-        deviceFD,
+    return AudioStreamingParams(
+        audioStreamingConnection.deviceFD,
         audioFormat,
         samplingFrequency,
-        subFrameSize,
-        channelCount,
-        AudioTrack.PERFORMANCE_MODE_LOW_LATENCY,
+        format.bSubFrameSize,
+        audioStreamingConnection.channelCount,
         outputFramesPerBuffer,
+        nativeSampleRate,
+    ) to "Success"
+  }
+
+  /**
+   * With [exclusive], playback asks for an MMAP exclusive stream at the phone's native sample rate
+   * and resamples the device's audio to it, which keeps it on the low latency path.
+   */
+  fun connectUsbAudioStreaming(
+      context: Context,
+      audioStreamingConnection: AudioStreamingConnection,
+      exclusive: Boolean = true,
+  ): Pair<Boolean, String> {
+    val (params, message) = audioStreamingParams(context, audioStreamingConnection)
+    if (params == null) {
+      return false to message
+    }
+    return if (connectUsbAudioStreamingNative(
+        params.deviceFD,
+        params.audioFormat,
+        params.samplingFrequency,
+        params.subFrameSize,
+        params.channelCount,
+        audioPerformanceMode(),
+        params.outputFramesPerBuffer,
+        exclusive && !powerSaving,
+        params.nativeSampleRate,
     )) {
       true to "Success"
     } else {
@@ -79,6 +295,106 @@ object UsbVideoNativeLibrary {
     }
   }
 
+  /** Outcome of [connectUsbStreaming], with the time each startup phase took. */
+  data class StartupResult(
+      val audioStreamStatus: Boolean,
+      val audioStreamMessage: String,
+      val videoStreamStatus: Boolean,
+      val videoStreamMessage: String,
+      val phaseBreakdown: String,
+  )
+
+  /** Called on a native thread once both streamers are connected and started, or have failed. */
+  fun interface StartupListener {
+    fun onStartupComplete(audioOk: Boolean, videoOk: Boolean, phaseBreakdown: String)
+  }
+
+  /**
+   * Connects and starts the audio and video streamers like [connectUsbAudioStreaming] and
+   * [connectUsbVideoStreaming] followed by their starts, but with both pipelines running at the
+   * same time on native threads. Returns once both are done; the event thread is only held while
+   * the startup is handed off. Without a [surface] video streams headless, see
+   * [connectUsbVideoStreaming].
+   */
+  suspend fun connectUsbStreaming(
+      context: Context,
+      audioStreamingConnection: AudioStreamingConnection,
+      videoStreamingConnection: VideoStreamingConnection,
+      surface: Surface?,
+      frameFormat: VideoFormat?,
+      exclusive: Boolean = true,
+  ): StartupResult {
+    val videoFormat =
+        frameFormat
+            ?: return StartupResult(false, "Not started", false, "No supported video format", "")
+    val (audioParams, audioMessage) = audioStreamingParams(context, audioStreamingConnection)
+    return suspendCoroutine { cont ->
+      val listener = StartupListener { audioOk, videoOk, phaseBreakdown ->
+        cont.resume(
+            StartupResult(
+                audioOk,
+                when {
+                  audioParams == null -> audioMessage
+                  audioOk -> "Success"
+                  else -> "Native audio player failure. Check logs for errors."
+                },
+                videoOk,
+                if (videoOk) "Success" else "Native video player failure. Check logs for errors.",
+                phaseBreakdown,
+            ))
+      }
+      // Ordered with the streamer commands, alone on both lanes of the controller.
+      val connect = Runnable {
+        val started =
+            connectUsbStreamingAsyncNative(
+                audioParams?.deviceFD ?: -1,
+                audioParams?.audioFormat ?: 0,
+                audioParams?.samplingFrequency ?: 0,
+                audioParams?.subFrameSize ?: 0,
+                audioParams?.channelCount ?: 0,
+                audioPerformanceMode(),
+                audioParams?.outputFramesPerBuffer ?: 0,
+                exclusive && !powerSaving,
+                audioParams?.nativeSampleRate ?: 0,
+                videoStreamingConnection.deviceFD,
+                videoFormat.width,
+                videoFormat.height,
+                videoFormat.fps,
+                videoFormat.toLibuvcFrameFormat().ordinal,
+                surface,
+                listener,
+            )
+        if (!started) {
+          cont.resume(StartupResult(false, "Not started", false, "Startup already running", ""))
+        }
+      }
+      if (postStreamerCallNative(
+          StreamerLane.Both.mask, StreamerPriority.Normal.ordinal, connect, null) == 0L) {
+        cont.resume(StartupResult(false, "Not started", false, "Not started", ""))
+      }
+    }
+  }
+
+  /** A negative [audioDeviceFD] connects video only. */
+  private external fun connectUsbStreamingAsyncNative(
+      audioDeviceFD: Int,
+      jAudioFormat: Int,
+      samplingFrequency: Int,
+      subFrameSize: Int,
+      channelCount: Int,
+      jAudioPerfMode: Int,
+      outputFramesPerBuffer: Int,
+      exclusive: Boolean,
+      nativeSampleRate: Int,
+      videoDeviceFD: Int,
+      width: Int,
+      height: Int,
+      fps: Int,
+      libuvcFrameFormat: Int,
+      surface: Surface?,
+      listener: StartupListener,
+  ): Boolean
+
   private external fun connectUsbAudioStreamingNative(
       deviceFD: Int,
       jAudioFormat: Int,
@@ -87,6 +403,8 @@ object UsbVideoNativeLibrary {
       channelCount: Int,
       jAudioPerfMode: Int,
       outputFramesPerBuffer: Int,
+      exclusive: Boolean,
+      nativeSampleRate: Int,
   ): Boolean
 
   external fun disconnectUsbAudioStreamingNative()
@@ -95,9 +413,14 @@ object UsbVideoNativeLibrary {
 
   external fun stopUsbAudioStreamingNative()
 
+  /**
+   * Without a [surface] the stream runs headless, for recording, the frame tap, the frame server
+   * or snapshots with the screen off: nothing is converted or drawn for a preview until
+   * [setVideoSurfaceNative] gives it one.
+   */
   fun connectUsbVideoStreaming(
       videoStreamingConnection: VideoStreamingConnection,
-      surface: Surface,
+      surface: Surface?,
       frameFormat: VideoFormat?,
   ): Pair<Boolean, String> {
     val videoFormat = frameFormat ?: return false to "No supported video format"
@@ -116,17 +439,1219 @@ object UsbVideoNativeLibrary {
     }
   }
 
+  /**
+   * Every format, frame size, interval, still size and color matching entry of the camera at
+   * [deviceFD], as libuvc parsed them, for [com.meta.usbvideo.usb.UvcFormatTable]. The device is
+   * kept open for the next connect of [deviceFD], which then skips opening and parsing it again.
+   * Null when libuvc cannot open the device.
+   */
+  external fun videoFormatTableNative(deviceFD: Int): ByteArray?
+
+  /**
+   * The modes of the camera at [deviceFD] best first for a [surfaceWidth] x [surfaceHeight]
+   * preview, as libuvc frame format, width, height, fps, interface number and flags, six ints
+   * each. Flag 1 is set when the bus can carry the mode, 2 when this device can decode and convert
+   * it in time; modes with both come first. Null when libuvc cannot open the device, which is then
+   * kept open for the next connect like [videoFormatTableNative].
+   */
+  external fun rankVideoModesNative(deviceFD: Int, surfaceWidth: Int, surfaceHeight: Int): IntArray?
+
+  /**
+   * What the USB path of the camera at [deviceFD] sustains, the phone's controller, cable and hubs
+   * included, as the THROUGHPUT_* values. Streams the camera's highest bandwidth mode for
+   * [durationMs], 0 for three seconds, the first time the camera is seen at its bus speed, or when
+   * [reprobe] is set; returns the kept result otherwise. Blocks while probing, and none of the
+   * camera's streams may run. [rankVideoModesNative] and [planVideoModesNative] rank modes above a
+   * path's ceiling as not fitting the bus. Null when no mode could be streamed.
+   */
+  external fun probeUsbThroughputNative(
+      deviceFD: Int,
+      durationMs: Int,
+      reprobe: Boolean,
+  ): LongArray?
+
+  /** Offsets into [probeUsbThroughputNative]'s result. */
+  const val THROUGHPUT_INTERFACE = 0
+  const val THROUGHPUT_FRAME_FORMAT = 1
+  const val THROUGHPUT_WIDTH = 2
+  const val THROUGHPUT_HEIGHT = 3
+  const val THROUGHPUT_FPS = 4
+  const val THROUGHPUT_USB_SPEED = 5
+  /** What the probed mode sends, estimated for MJPEG. */
+  const val THROUGHPUT_MODE_BYTES_PER_SECOND = 6
+  const val THROUGHPUT_BYTES_PER_SECOND = 7
+  const val THROUGHPUT_PACKET_ERRORS_PPM = 8
+  const val THROUGHPUT_MILLI_FPS = 9
+  /** Standard deviation of the intervals between frame completions. */
+  const val THROUGHPUT_FRAME_JITTER_US = 10
+  /** Bytes per second modes must stay under, 0 when the path kept up with the probed mode. */
+  const val THROUGHPUT_CEILING_BYTES_PER_SECOND = 11
+
+  /**
+   * One mode per camera of [deviceFDs], laid out like [rankVideoModesNative], for cameras that
+   * start together: each camera's best mode, stepped down to lower bandwidth formats and sizes
+   * where the cameras sharing a USB bus would not fit together in what its running streams, audio
+   * included, leave them. Flag 1 is clear on the modes of a bus that does not fit even then. Call
+   * before connecting the cameras. Null when libuvc cannot open one of them.
+   */
+  external fun planVideoModesNative(
+      deviceFDs: IntArray,
+      surfaceWidth: Int,
+      surfaceHeight: Int,
+  ): IntArray?
+
   external fun connectUsbVideoStreamingNative(
     deviceFD: Int,
     width: Int,
     height: Int,
     fps: Int,
     libuvcFrameFormat: Int,
-    surface: Surface,
+    surface: Surface?,
   ): Boolean
   external fun startUsbVideoStreamingNative(): Boolean
   external fun stopUsbVideoStreamingNative()
+
+  /**
+   * Suspends the camera's USB traffic and gives the bus its bandwidth back, keeping the transfer
+   * and frame buffers, decoders and negotiated format, so [resumeUsbVideoStreamingNative] is near
+   * instant. False when the stream is not started, already paused, or a replay.
+   */
+  external fun pauseUsbVideoStreamingNative(): Boolean
+
+  /** Resumes a paused stream, or starts a stopped one like [startUsbVideoStreamingNative]. */
+  external fun resumeUsbVideoStreamingNative(): Boolean
   external fun disconnectUsbVideoStreamingNative()
 
+  /** Called on a native thread when a transfer of the default streamers finds the device gone. */
+  fun interface DeviceLostListener {
+    fun onUsbDeviceLost()
+  }
+
+  /** Tells [listener] once per loss of the default streamers' device; null removes it. */
+  external fun setDeviceLostListenerNative(listener: DeviceLostListener?)
+
+  /**
+   * Keeps the default streamers for the device to come back rather than having them disconnected,
+   * starting the wait if no transfer noticed the device gone yet. False when there are none, or
+   * once the device was gone for longer than the native grace period.
+   */
+  external fun awaitReconnectNative(): Boolean
+
+  /** Whether the default streamers wait for their lost device within the grace period. */
+  external fun isReconnectPendingNative(): Boolean
+
+  /**
+   * Resumes the default streamers kept by [awaitReconnectNative] on the connections of the device
+   * attached again, without negotiating or opening AAudio again. False when they could not be
+   * moved; disconnect and connect them again then.
+   */
+  fun reconnectUsbStreaming(
+      audioStreamingConnection: AudioStreamingConnection,
+      videoStreamingConnection: VideoStreamingConnection,
+  ): Boolean =
+      reconnectUsbStreamingNative(
+          if (audioStreamingConnection.supportsAudioStreaming) {
+            audioStreamingConnection.deviceFD
+          } else {
+            -1
+          },
+          videoStreamingConnection.deviceFD,
+      )
+
+  /** A negative fd fails the reattach of a streamer that is connected. */
+  private external fun reconnectUsbStreamingNative(audioDeviceFD: Int, videoDeviceFD: Int): Boolean
+
+  /**
+   * Keeps the stream controls each camera committed in [dir], so the next connection of the same
+   * camera can skip format negotiation, and what each format costs this device's CPU, for
+   * [rankVideoModesNative]. Call once, before the first camera is connected.
+   */
+  external fun setNegotiationCacheDirNative(dir: String)
+
+  /**
+   * Reports how long System.loadLibrary() took, logged with the library's mapped size and published
+   * as [StreamingStats.libraryLoadUs]. Call once, right after loading it.
+   */
+  external fun recordLibraryLoadNative(loadUs: Long)
+
+  /**
+   * Reassembles raw NV12 and YUYV frames into AHardwareBuffers the GL preview draws from without a
+   * copy. Takes effect for streams started afterwards; false when the device has no CPU and GPU
+   * shared data buffers, in which case frames stay in heap memory and are copied as before.
+   */
+  external fun setHardwareFrameBuffersNative(enabled: Boolean): Boolean
+
+  /**
+   * Allows the hot path implementations in [allowed], FAST_PATH_* bits, and turns the others off,
+   * for rolling new ones out to a share of devices. Call at session start: streams take the set
+   * when their output is configured and keep it. [cohort] names the rollout group; both are
+   * published as [StreamingStats.videoFastPaths] and in the telemetry log. All are allowed until
+   * this is called.
+   */
+  external fun setFastPathsNative(allowed: Int, cohort: Int)
+
+  /** Bits of [setFastPathsNative] and [StreamingStats.videoFastPaths], FastPath in FastPaths.h. */
+  const val FAST_PATH_GPU_CONVERSION = 1 shl 0
+  const val FAST_PATH_SURFACE_CONTROL = 1 shl 1
+  const val FAST_PATH_HARDWARE_FRAME_BUFFERS = 1 shl 2
+  const val FAST_PATH_INLINE_CALLBACK = 1 shl 3
+  const val FAST_PATH_SLICE_CONVERSION = 1 shl 4
+  const val FAST_PATH_RENDER_AHEAD = 1 shl 5
+  const val FAST_PATH_STRIPE_CONVERSION = 1 shl 6
+  const val FAST_PATH_MJPEG_DECODE_POOL = 1 shl 7
+  const val FAST_PATH_HARDWARE_MJPEG = 1 shl 8
+  const val FAST_PATH_MJPEG_DECODE_SKIPPING = 1 shl 9
+  const val FAST_PATH_GPU_MJPEG = 1 shl 10
+  const val FAST_PATH_VULKAN_CONVERSION = 1 shl 11
+  const val FAST_PATH_ALL = (1 shl 12) - 1
+
+  /**
+   * Appends a record of the streaming stats to the file at [path] once a second, keeping the last
+   * [capacity] of them, a week when 0, across runs. Records of an earlier run are kept when the
+   * capacity did not change. `usbvideo_telemetry` in cpp/host prints a pulled copy.
+   */
+  external fun startTelemetryLogNative(path: String, capacity: Int): Boolean
+
+  external fun stopTelemetryLogNative()
+
+  /**
+   * Switches the connected video stream to [videoFormat] without closing the camera, restarting it
+   * if it was streaming. Stops the frame tap and MJPEG recording, and fails while recording. The
+   * old format is kept when the camera does not take the new one.
+   */
+  fun reconfigureUsbVideoStreaming(videoFormat: VideoFormat): Boolean =
+      reconfigureUsbVideoStreamingNative(
+          videoFormat.width,
+          videoFormat.height,
+          videoFormat.fps,
+          videoFormat.toLibuvcFrameFormat().ordinal,
+      )
+
+  private external fun reconfigureUsbVideoStreamingNative(
+      width: Int,
+      height: Int,
+      fps: Int,
+      libuvcFrameFormat: Int,
+  ): Boolean
+
+  /** Called on a native thread with the result of a streamer command. */
+  fun interface StreamerCommandListener {
+    fun onStreamerCommandComplete(result: Long)
+  }
+
+  /**
+   * Queues [command] on the native streamer controller and returns at once; the result completes
+   * once it ran, with [STREAMER_COMMAND_CANCELLED] when it was dropped. A command posted right
+   * behind a pending one of the same type on its lanes replaces it, and both complete with the
+   * result of the one that ran.
+   */
+  fun postStreamerCommand(
+      command: StreamerCommand,
+      args: IntArray? = null,
+      surface: Surface? = null,
+  ): Deferred<Long> {
+    val result = CompletableDeferred<Long>()
+    val id = postStreamerCommandNative(command.ordinal, args, surface) { result.complete(it) }
+    if (id == 0L) {
+      result.complete(STREAMER_COMMAND_CANCELLED)
+    }
+    return result
+  }
+
+  /** Switches formats like [reconfigureUsbVideoStreaming], on the video lane. */
+  fun postReconfigureUsbVideoStreaming(videoFormat: VideoFormat): Deferred<Long> =
+      postStreamerCommand(
+          StreamerCommand.ReconfigureVideo,
+          intArrayOf(
+              videoFormat.width,
+              videoFormat.height,
+              videoFormat.fps,
+              videoFormat.toLibuvcFrameFormat().ordinal,
+          ),
+      )
+
+  /**
+   * Runs [block] on [lane] of the native streamer controller, ordered with the commands posted
+   * there, for native calls without a command of their own.
+   */
+  suspend fun <T> callOnStreamerLane(
+      lane: StreamerLane,
+      priority: StreamerPriority = StreamerPriority.Normal,
+      block: () -> T,
+  ): T {
+    val result = CompletableDeferred<T>()
+    val body = Runnable {
+      @Suppress("CatchGeneralException")
+      try {
+        result.complete(block())
+      } catch (e: Exception) {
+        result.completeExceptionally(e)
+      }
+    }
+    val id =
+        postStreamerCallNative(lane.mask, priority.ordinal, body) {
+          if (it == STREAMER_COMMAND_CANCELLED) {
+            result.cancel()
+          }
+        }
+    if (id == 0L) {
+      result.cancel()
+    }
+    return result.await()
+  }
+
+  /** Returns the id of the queued command, 0 when it is unknown or its [args] do not fit. */
+  private external fun postStreamerCommandNative(
+      command: Int,
+      args: IntArray?,
+      surface: Surface?,
+      listener: StreamerCommandListener?,
+  ): Long
+
+  private external fun postStreamerCallNative(
+      lanes: Int,
+      priority: Int,
+      body: Runnable,
+      listener: StreamerCommandListener?,
+  ): Long
+
+  /** Drops the commands still queued on [lanes], completing them as cancelled. */
+  external fun cancelStreamerCommandsNative(lanes: Int)
+
+  /**
+   * Records the preview, plus audio when it is streaming, to an MP4 file open for reading and
+   * writing at [fd]. The caller keeps ownership of [fd] and closes it after [stopRecordingNative].
+   * Needs a raw NV12 or YUYV stream, which is previewed with GL.
+   */
+  external fun startRecordingNative(fd: Int, hevc: Boolean, bitRate: Int): Boolean
+
+  /** Returns true when a playable file was written. Also ends a network stream it encodes. */
+  external fun stopRecordingNative(): Boolean
+
+  /**
+   * Sends the video stream as RTP over UDP to [host]:[port], with RTCP on the same port. H.264 and
+   * H.265 cameras are sent as they are; other streams are encoded like [startRecordingNative] at
+   * [bitRate], by the running recording when there is one. [mtu] bounds the datagrams, 0 picks a
+   * default. Send latency and counters are part of [streamingStatsSummaryString].
+   */
+  external fun startNetworkStreamNative(
+      host: String,
+      port: Int,
+      hevc: Boolean,
+      bitRate: Int,
+      mtu: Int,
+  ): Boolean
+
+  external fun stopNetworkStreamNative()
+
+  /**
+   * Asks the encoder for a keyframe, as a PLI or FIR from the receiver does. Passing an H.264 or
+   * H.265 stream through, that is the camera's encoder.
+   */
+  external fun requestNetworkKeyframeNative()
+
+  /**
+   * Keeps the last [windowMs] of video in memory, in at most [memoryBudget] bytes, for
+   * [saveInstantReplayNative]. MJPEG, H.264 and H.265 frames are kept as the camera sent them;
+   * other streams are encoded like [startRecordingNative] at [bitRate], by the running recording
+   * when there is one.
+   */
+  external fun startInstantReplayNative(
+      windowMs: Int,
+      memoryBudget: Long,
+      hevc: Boolean,
+      bitRate: Int,
+  ): Boolean
+
+  /**
+   * Writes the kept window, from its first keyframe, as a frame log for [openReplaySessionNative]
+   * to [fd], in the background and without interrupting the stream. [fd] is duplicated, so the
+   * caller can close it right away. False while the previous save is still being written.
+   */
+  external fun saveInstantReplayNative(fd: Int): Boolean
+
+  /** Frames the last save wrote, -1 while it is being written and 0 when it failed. */
+  external fun instantReplaySavedFramesNative(): Long
+
+  /** Also ends when the recording it encodes with stops. */
+  external fun stopInstantReplayNative()
+
+  /**
+   * Records the video from the instant replay, beginning [preRollMs] back at the keyframe before
+   * it, so the moment that triggered the recording is in it. The kept frames are written as they
+   * are, then the live ones as they come: MJPEG to AVI, H.264 and H.265, from the camera or the
+   * replay's encoder, to MP4. No audio. [fd] is open for reading and writing; the caller keeps
+   * ownership and closes it after [stopPreRollRecordingNative]. Needs [startInstantReplayNative].
+   */
+  external fun startPreRollRecordingNative(fd: Int, preRollMs: Int): Boolean
+
+  /** Returns true when a playable file was written. Also called when the instant replay stops. */
+  external fun stopPreRollRecordingNative(): Boolean
+
+  /**
+   * Called on a native thread after each switch of a motion standby: [event] true once motion
+   * started an event in the full mode, false once the stream is back in standby and the event's
+   * files are finalized.
+   */
+  fun interface MotionStandbyListener {
+    fun onMotionStandby(event: Boolean)
+  }
+
+  /**
+   * Idles the camera in its cheapest uncompressed mode at a few frames per second until something
+   * moves in front of it, then switches back to the mode streaming now and records an event to
+   * the fds of [armMotionRecordingNative], until no motion was seen for [quietPeriodMs]. With
+   * [preRollMs] the standby stream is kept in an instant replay, encoded like
+   * [startRecordingNative], and the [preRollMs] before the motion are written to a file of their
+   * own. Raw modes are recorded like [startRecordingNative] at [bitRate], MJPEG like
+   * [startMjpegRecordingNative], H.264 and H.265 as the camera sends them. False when there is no
+   * uncompressed mode to idle in, or a standby runs already.
+   */
+  external fun startMotionStandbyNative(
+      quietPeriodMs: Int,
+      preRollMs: Int,
+      hevc: Boolean,
+      bitRate: Int,
+      listener: MotionStandbyListener?,
+  ): Boolean
+
+  /**
+   * Sets the files the next motion event writes, both open for reading and writing, -1 for none.
+   * The caller keeps ownership: [preRollFd] is finalized when the event begins, [fd] when it ends.
+   */
+  external fun armMotionRecordingNative(fd: Int, preRollFd: Int)
+
+  /** Ends a motion standby and its event, if any, and switches back to the full mode. */
+  external fun stopMotionStandbyNative(): Boolean
+
+  /**
+   * Writes the camera's JPEG frames unchanged to an AVI file open for writing at [fd], without
+   * decoding or re-encoding them. MJPEG streams only. The caller keeps ownership of [fd] and
+   * closes it after [stopMjpegRecordingNative].
+   */
+  external fun startMjpegRecordingNative(fd: Int): Boolean
+
+  /** Returns true when a playable file was written. */
+  external fun stopMjpegRecordingNative(): Boolean
+
+  /**
+   * Appends every frame of the default stream, as the camera sent it and with its timing, to a
+   * frame log open for writing at [fd], for [openReplaySessionNative]. The caller keeps ownership
+   * of [fd] and closes it after [stopFrameLogNative].
+   */
+  external fun startFrameLogNative(fd: Int): Boolean
+
+  /** Returns false when a frame could not be written. */
+  external fun stopFrameLogNative(): Boolean
+
+  /**
+   * Publishes copies of the captured frames, converted to [format] and downscaled to [width] x
+   * [height] (0 keeps the capture size), into [bufferCount] native buffers. Frames are skipped
+   * rather than slowing down the preview when consumers hold every buffer.
+   *
+   * [FrameTapFormat.Luma] and [FrameTapFormat.Rgba] buffers also hold the frame at the smaller
+   * sizes of [levels], width and height pairs for up to [TAP_MAX_LEVELS] - 1 levels, such as 640,
+   * 480, 320, 240, built in the same pass over the frame; [acquireTappedFrameNative] reports where
+   * each level is.
+   */
+  fun startFrameTap(
+      format: FrameTapFormat,
+      width: Int = 0,
+      height: Int = 0,
+      bufferCount: Int = 3,
+      levels: IntArray? = null,
+  ): Boolean = startFrameTapNative(format.ordinal, width, height, bufferCount, levels)
+
+  private external fun startFrameTapNative(
+      format: Int,
+      width: Int,
+      height: Int,
+      bufferCount: Int,
+      levels: IntArray?,
+  ): Boolean
+
+  /**
+   * Publishes the captured frames as the input tensor of a model: the capture's [crop] (x, y,
+   * width and height, the whole frame when null) resized bilinearly to [width] x [height], in RGB
+   * normalized per channel as (value - [mean]) / [std] of 0-255 values and, for [TensorType.Int8]
+   * and [TensorType.Uint8], quantized with [scale] and [zeroPoint]. Each frame is converted in
+   * one pass over the YUYV, UYVY or NV12 capture, or over the NV12 decode of MJPEG ones.
+   *
+   * With [hardwareBuffers] the tensors are written into AHardwareBuffer BLOBs, from
+   * [frameTapHardwareBuffersNative], that GPU delegates can import; otherwise into the buffers of
+   * [frameTapBuffersNative]. Frames are acquired and released as with [startFrameTap].
+   */
+  fun startTensorTap(
+      width: Int,
+      height: Int,
+      layout: TensorLayout = TensorLayout.Nhwc,
+      type: TensorType = TensorType.Float32,
+      mean: FloatArray = floatArrayOf(0f, 0f, 0f),
+      std: FloatArray = floatArrayOf(255f, 255f, 255f),
+      scale: Float = 1f,
+      zeroPoint: Int = 0,
+      crop: IntArray? = null,
+      bufferCount: Int = 3,
+      hardwareBuffers: Boolean = false,
+  ): Boolean {
+    require(mean.size == 3 && std.size == 3) { "mean and std need a value per channel" }
+    return startTensorTapNative(
+        layout.ordinal,
+        type.ordinal,
+        width,
+        height,
+        crop,
+        mean + std + scale,
+        zeroPoint,
+        bufferCount,
+        hardwareBuffers,
+    )
+  }
+
+  private external fun startTensorTapNative(
+      layout: Int,
+      type: Int,
+      width: Int,
+      height: Int,
+      crop: IntArray?,
+      normalization: FloatArray,
+      zeroPoint: Int,
+      bufferCount: Int,
+      hardwareBuffers: Boolean,
+  ): Boolean
+
+  /** The buffers returned by [frameTapBuffersNative] must not be read after this. */
+  external fun stopFrameTapNative()
+
+  /**
+   * Direct buffers over the tap's native buffers, indexed by [acquireTappedFrameNative]. Empty for
+   * a tap of hardware buffers.
+   */
+  external fun frameTapBuffersNative(): Array<ByteBuffer>
+
+  /**
+   * The AHardwareBuffers of a tensor tap started with hardwareBuffers, indexed by
+   * [acquireTappedFrameNative], or an empty array. Each holds a reference of its own; close them
+   * once the tap is stopped.
+   */
+  external fun frameTapHardwareBuffersNative(): Array<HardwareBuffer>
+
+  /**
+   * Returns the index of the newest tapped frame and fills [info], of at least [TAP_INFO_LENGTH]
+   * longs, with its description, or returns -1 if no new frame is ready. The buffer is not
+   * overwritten until it is handed back with [releaseTappedFrameNative].
+   */
+  external fun acquireTappedFrameNative(info: LongArray): Int
+
+  external fun releaseTappedFrameNative(index: Int)
+
+  /**
+   * Shares the captured frames with other processes as AHardwareBuffers on the abstract Unix socket
+   * @[name], in the [format] and size of [startFrameTap] (Raw is not supported). Processes of other
+   * uids than this app's connect only when listed in [allowedUids]. See FrameServer.h for the
+   * socket protocol.
+   */
+  fun startFrameServer(
+      name: String,
+      format: FrameTapFormat,
+      width: Int = 0,
+      height: Int = 0,
+      bufferCount: Int = 4,
+      allowedUids: IntArray? = null,
+  ): Boolean =
+      startFrameServerNative(name, format.ordinal, width, height, bufferCount, allowedUids)
+
+  private external fun startFrameServerNative(
+      name: String,
+      format: Int,
+      width: Int,
+      height: Int,
+      bufferCount: Int,
+      allowedUids: IntArray?,
+  ): Boolean
+
+  /** Disconnects the clients; buffers they mapped stay valid in their processes. */
+  external fun stopFrameServerNative()
+
+  /**
+   * Opens a reader of the audio on its way to the speaker, which reads at its own pace without
+   * holding up playback: when it falls a whole buffer behind, it loses audio and resumes per
+   * [overflow]. Returns the reader, or -1 when none is left or no audio is streaming.
+   */
+  fun openAudioTap(overflow: AudioTapOverflow = AudioTapOverflow.Oldest): Int =
+      openAudioTapNative(overflow.ordinal)
+
+  private external fun openAudioTapNative(overflow: Int): Int
+
+  external fun closeAudioTapNative(reader: Int)
+
+  /**
+   * Sample rate, channel count and AAudio format of the tapped audio, the output stream's. Empty
+   * when no audio is streaming.
+   */
+  external fun audioTapFormatNative(): IntArray
+
+  /**
+   * Turns processing of the audio on its way to the speaker and the taps on or off: the gains and
+   * mute below, soft clipping above -2.5 dBFS when [softClip], and the level meters of
+   * [StreamingStats.audioLevelPeak]. Gain changes ramp over 20 ms, turning it off included. Returns
+   * false when no audio is streaming or its format is neither 16 bit nor float.
+   */
+  external fun setAudioProcessingNative(enabled: Boolean, softClip: Boolean): Boolean
+
+  /**
+   * Sets the gain of output [channel], or of every channel for -1, up to +24 dB. Applies while
+   * audio processing is on.
+   */
+  external fun setAudioGainNative(channel: Int, gainDb: Float): Boolean
+
+  /** Fades the audio out, or back in, while audio processing is on. */
+  external fun setAudioMutedNative(muted: Boolean): Boolean
+
+  /**
+   * Measures the round trip from the phone's speaker to the USB microphone: each of [bursts], up
+   * to 100, plays a 2047 chip maximum length sequence at -12 dBFS in place of the microphone's
+   * audio, then records half a second of the microphone to find it in by cross-correlation.
+   * Takes about 0.7 s a burst, during which the microphone is not played. Returns false when no
+   * audio is streaming or [bursts] is out of range.
+   */
+  external fun startAudioLoopbackNative(bursts: Int): Boolean
+
+  /** Stops a measurement early, playing the microphone again. */
+  external fun cancelAudioLoopbackNative()
+
+  /**
+   * Fills [report], of [AUDIO_LOOPBACK_REPORT_LENGTH] doubles, with the measurement over the
+   * bursts captured so far: the mean, least and greatest round trip from handing the sequence to
+   * AAudio until it came back over USB, its standard deviation, the part of it AAudio's timestamps
+   * put before the speaker and the part after, and the microphone to speaker latency of normal
+   * playback, in milliseconds, the mean correlation peak over its RMS, and the bursts captured and
+   * started. Correlates what was not yet, on the calling thread. Returns the bursts detected, or
+   * -1 when none was captured.
+   */
+  external fun audioLoopbackReportNative(report: DoubleArray): Int
+
+  /**
+   * Copies the whole frames of [reader] that fit into the direct [buffer], from its start, and
+   * fills [info], of at least [AUDIO_TAP_INFO_LENGTH] longs, with their description. Returns the
+   * bytes copied; the buffer's position and limit are left alone.
+   */
+  external fun readAudioTapNative(reader: Int, buffer: ByteBuffer, info: LongArray): Int
+
   external fun streamingStatsSummaryString(): String
+
+  /**
+   * Native buffers by use, one line per video stream, then the frame buffers kept from closed
+   * streams and the native heap in use.
+   */
+  external fun nativeMemorySummaryNative(): String
+
+  /**
+   * Frees the native buffers the video streams do not use right now: spare transfers and the frame
+   * pools of stopped streams, frame buffers kept from closed ones and render scratch frames. They
+   * are allocated again for the next stream. Call on the thread that starts and stops streaming.
+   * Returns the bytes freed, render scratch aside.
+   */
+  external fun trimNativeMemoryNative(): Long
+
+  /**
+   * Frame latency percentiles in microseconds since streaming started: p50, p95 and p99 for each
+   * of the device, usb, queue, convert, post, total and window lock stages, in that order. Empty
+   * when not streaming.
+   */
+  external fun streamingLatencyPercentilesNative(): LongArray
+
+  /**
+   * USB transfer geometry of the connected video stream, used from its next start. Zero leaves a
+   * value to libuvc, which covers about 4 ms of bus time per isochronous transfer and 50 ms in
+   * flight. [fitIsoBandwidth] reserves only the bus bandwidth the format needs rather than what the
+   * camera asks for, leaving room for other devices on the bus. Returns false when no video stream is
+   * connected.
+   */
+  external fun setVideoTransferOptionsNative(
+      numTransfers: Int = 0,
+      packetsPerTransfer: Int = 0,
+      bulkTransferSize: Int = 0,
+      timeoutMs: Int = 0,
+      fitIsoBandwidth: Boolean = false,
+  ): Boolean
+
+  /**
+   * Delivers captured frames to the render queue on the USB event thread rather than through a
+   * libuvc thread, saving a wakeup per frame; compare the USB to callback latency stage to see the
+   * gain. Used from the connected video stream's next start. Returns false when no video stream is
+   * connected.
+   */
+  external fun setVideoInlineFrameCallbackNative(enabled: Boolean): Boolean
+
+  /**
+   * Whether the render thread passes over a queued MJPEG frame without decoding it when a newer
+   * one is queued behind it, on by default; the count is [StreamingStats.videoDecodesSkipped].
+   * With [validateSkipped], skipped frames are still scanned for JPEG markers and corrupt ones
+   * counted as invalid. Takes effect immediately. Returns false when no video stream is connected.
+   */
+  external fun setVideoMjpegDecodeSkippingNative(enabled: Boolean, validateSkipped: Boolean): Boolean
+
+  /**
+   * Skips converting and posting frames of a static scene: a frame is shown only when its
+   * subsampled luma differs from the last one shown by a mean squared error above [threshold], in
+   * 8 bit codes, 6 to ignore sensor noise, or after [refreshIntervalMs], such as 1000, without one.
+   * The count is [StreamingStats.videoFramesUnchanged]. Off by default; compressed formats and
+   * slice conversion show every frame. With [partialUpdates], a frame shown on the CPU path locks,
+   * converts and posts only the band of rows that changed, counted in
+   * [StreamingStats.videoFramesPartial], and a whole frame at least every [refreshIntervalMs].
+   * Takes effect from the next frame. Returns false when no video stream is connected or the
+   * arguments are out of range.
+   */
+  external fun setVideoChangeDetectionNative(
+      enabled: Boolean,
+      threshold: Double,
+      refreshIntervalMs: Int,
+      partialUpdates: Boolean,
+  ): Boolean
+
+  /**
+   * Number of threads decoding MJPEG frames at once on the CPU preview path, each a whole frame,
+   * with frames still presented in capture order. 0, the default, uses one per performance core for
+   * 1080p50 and larger streams; 1 decodes on the render thread. Used from the connected video
+   * stream's next format switch. Returns false when no video stream is connected.
+   */
+  external fun setVideoMjpegDecodeWorkersNative(workers: Int): Boolean
+
+  /**
+   * Decodes MJPEG with the device's hardware JPEG decoder through MediaCodec, straight into the
+   * preview window, when the vendor ships one; the CPU decoders are used otherwise. Used from the
+   * connected video stream's next format switch. Returns false when no video stream is connected.
+   */
+  external fun setVideoHardwareMjpegDecodingNative(enabled: Boolean): Boolean
+
+  /**
+   * Decodes MJPEG on the GL preview: Huffman decoding stays on the CPU, while dequantization, the
+   * inverse DCT, chroma upsampling and color conversion run in a GLES 3.1 compute shader. Hardware
+   * decoding through MediaCodec is tried first when also enabled; the CPU decoders are used where
+   * neither starts. Progressive JPEGs are not shown. Used from the connected video stream's next format switch. Returns false when
+   * no video stream is connected.
+   */
+  external fun setVideoGpuMjpegDecodingNative(enabled: Boolean): Boolean
+
+  /**
+   * Converts YUYV, NV12 and P010 previews in a Vulkan compute shader instead of the GL preview,
+   * presenting the results through SurfaceControl, on devices with a Vulkan 1.1 driver that imports
+   * hardware buffers. Frames with a crop, a label or a white balance still convert on the CPU, and
+   * recording is unavailable while it is in use. Used from the connected video stream's next format
+   * switch. Returns false when no video stream is connected.
+   */
+  external fun setVideoVulkanConversionNative(enabled: Boolean): Boolean
+
+  /**
+   * How YUYV and UYVY frames whose format descriptor reports both fields of an interlaced picture
+   * woven together are deinterlaced on the CPU preview path: 0 not at all, 1 bob, interpolating
+   * the earlier field from the later one, 2 blend, filtering every row with its neighbours, or 3,
+   * the default, motion adaptive, interpolating only the rows that comb. With [forced], every
+   * YUYV and UYVY stream is deinterlaced, for capture cards that do not report interlacing. Used
+   * from the connected video stream's next format switch. Returns false when no video stream is
+   * connected or the mode is out of range.
+   */
+  external fun setVideoDeinterlaceNative(mode: Int, forced: Boolean): Boolean
+
+  /**
+   * Gathers a luma histogram of YUYV, UYVY and NV12 frames while the CPU preview path converts
+   * them, sampling every other pixel of every other row: the mean luma and the shares of clipped
+   * pixels are attached to their [FrameEventKind.Rendered] events, see [FrameEventBatch.lumaMean],
+   * and the histogram of the latest one is read with [videoLumaHistogramNative]. Off by default.
+   * Takes effect from the next frame. Returns false when no video stream is connected.
+   */
+  external fun setVideoLumaStatsNative(enabled: Boolean): Boolean
+
+  /**
+   * Fills [histogram], of 256 bins or a divisor of 256 such as 64, with the luma histogram of the
+   * latest frame measured since [setVideoLumaStatsNative], in sampled pixels per bin. Returns the
+   * frame's sequence, or -1 when there is none or the size does not divide 256.
+   */
+  external fun videoLumaHistogramNative(histogram: IntArray): Long
+
+  /**
+   * Corrects lens distortion from an OpenCV style calibration on the GL preview and on the CPU
+   * path into RGBA windows, through a remap table built once per calibration and size. [model] is
+   * 0 for none, 1 for radial distortion with up to 4 [coefficients] k1, k2, k3 and k4 of r^2 to
+   * r^8, or 2 for a fisheye with OpenCV's k1 to k4 of the incidence angle. [focal] is the focal
+   * length as a fraction of the image width and [centerX] and [centerY] the optical center as
+   * fractions of the image size, so one calibration fits every resolution of the same sensor area.
+   * [scale] below 1 zooms out to keep more of the field of view. Used from the connected video
+   * stream's next format switch. Returns false when no video stream is connected or the arguments
+   * are out of range.
+   */
+  external fun setVideoLensCorrectionNative(
+      model: Int,
+      focal: Float,
+      centerX: Float,
+      centerY: Float,
+      coefficients: FloatArray?,
+      scale: Float,
+  ): Boolean
+
+  /**
+   * Burns a line of text into the GL preview and the recording drawn with it, and into RGBA
+   * windows on the CPU preview path: with [timestamp], the local wall clock time each frame was
+   * captured, to the second, followed by [text], such as a watermark or case number. Lower case
+   * is drawn upper case, and characters outside ASCII as '?'. [corner] is 0 top left, 1 top
+   * right, 2 bottom left or 3 bottom right; [scale] of 1 to 16 output pixels per pixel of the 5x7
+   * font, and [color] an ARGB color over a translucent dark background. The label is only redrawn
+   * when its text changes, so each frame pays for blending its area alone. Neither timestamp nor
+   * text turns it off. Used from the connected video stream's next format switch. Returns false
+   * when no video stream is connected or the arguments are out of range.
+   */
+  external fun setVideoOverlayNative(
+      timestamp: Boolean,
+      text: String?,
+      corner: Int,
+      scale: Int,
+      color: Int,
+  ): Boolean
+
+  /**
+   * Converts YUYV, NV12 and other uncompressed frames on the CPU preview path in bands as their
+   * rows arrive over USB, into a buffer locked ahead of the frame, so that only the last band is
+   * left to convert once the frame is complete; compare the convert latency stage to see the gain.
+   * NV12 rows complete with their chroma, after the whole luma plane. Used from the connected video
+   * stream's next start. Returns false when no video stream is connected.
+   */
+  external fun setVideoSliceConversionNative(enabled: Boolean): Boolean
+
+  /**
+   * Locks the CPU preview's window buffers ahead on a native thread, so that when the compositor
+   * holds them all the frame is converted into a private buffer and copied into the window later
+   * rather than stalling the render thread; only the newest such frame waits, older ones are
+   * dropped. Turns off partial updates, and is ignored while slice conversion runs. The
+   * [LatencyStage.WindowLock] stage shows the waits. Returns false when no video stream is
+   * connected.
+   */
+  external fun setVideoRenderAheadNative(enabled: Boolean): Boolean
+
+  /**
+   * Holds arrived frames back by one to three frame intervals and presents them at an even cadence,
+   * paced by the camera's recovered clock when it has one, for smoother motion at the cost of
+   * latency. The depth adapts to the arrival jitter; [StreamingStats.videoJitterBufferDepth],
+   * [StreamingStats.videoPresentJitterUs] and [StreamingStats.videoAddedLatencyUs] report it. Turns
+   * off slice conversion. Takes effect on the next start; returns false when no video stream is
+   * connected.
+   */
+  external fun setSmoothPlaybackNative(enabled: Boolean): Boolean
+
+  /**
+   * Keeps the stage timings of the last 32 rendered frames, with the render thread CPU each took
+   * and the render queue depth, and writes them to logcat under the SlowFrameRecorder tag whenever
+   * a frame takes more than [frameIntervals] frame intervals from USB completion to post, at most
+   * once a second. 0 turns it off. Applies from the next frame; returns false when no video
+   * stream is connected.
+   */
+  external fun setSlowFrameRecorderNative(frameIntervals: Float): Boolean
+
+  /**
+   * Shows P010 streams of the connected video stream at full 10 bit precision: frames are
+   * converted with the BT.2020 matrix into R10G10B10A2 window buffers tagged with [dataSpace], such
+   * as `DataSpace.DATASPACE_BT2020_PQ` or `DataSpace.DATASPACE_BT2020_HLG`, so the compositor gets
+   * the HDR signal to tone map. Windows refusing either get 8 bit RGB as before, and 0 turns it
+   * off. Used from the next format switch or preview surface. Returns false when no video stream
+   * is connected.
+   */
+  external fun setVideoHdrDataSpaceNative(dataSpace: Int): Boolean
+
+  /**
+   * Shows only the [width] x [height] area at [x], [y] of the connected video stream's frames, in
+   * frame pixels, scaled to the preview: a digital zoom for which only the visible pixels are
+   * converted or decoded. Origin and size are rounded down to even pixels and clipped to the
+   * frame; a zero size shows whole frames again. The GL preview of raw NV12 and YUYV streams
+   * ignores it. Takes effect from the next frame. Returns false when no video stream is connected.
+   */
+  external fun setVideoCropNative(x: Int, y: Int, width: Int, height: Int): Boolean
+
+  /**
+   * White balances raw Bayer streams of the connected camera, such as RGGB or GRBG machine vision
+   * sensors that leave it to the host, with the [red], [green] and [blue] gains, 1 keeping a
+   * channel. Each sample is scaled before it is demosaiced, on the CPU and in the GL preview alike;
+   * gains are clamped below 16. Other formats ignore it. Takes effect from the next frame. Returns
+   * false when no video stream is connected or a gain is negative.
+   */
+  external fun setVideoWhiteBalanceNative(red: Float, green: Float, blue: Float): Boolean
+
+  /**
+   * Shows the depths from [nearClip] to [farClip] of a connected Z16 depth stream, in the camera's
+   * depth units, usually millimeters, colored with [palette]: 0 Turbo, red near to blue far, or 1
+   * gray, white near to black far. Nearer and farther depths and pixels without a depth are black.
+   * The colors come from a table built once per range, so changing it costs nothing per frame.
+   * Takes effect from the next frame. Returns false when no video stream is connected, the range is
+   * empty or past 65535, or the palette is out of range.
+   */
+  external fun setVideoDepthRangeNative(nearClip: Int, farClip: Int, palette: Int): Boolean
+
+  /**
+   * Rotates the connected video stream's preview clockwise by [rotationDegrees], one of 0, 90, 180
+   * and 270, after mirroring it left to right and top to bottom as asked, for cameras mounted
+   * sideways or facing the user. The compositor applies it, on every preview path, at no cost per
+   * frame. Snapshots, recordings and the frame tap keep the camera's orientation, and for 90 and
+   * 270 the caller swaps the aspect ratio of the preview's view. Returns false when no video stream
+   * is connected or for other rotations.
+   */
+  external fun setVideoOrientationNative(
+      rotationDegrees: Int,
+      mirrorHorizontal: Boolean,
+      mirrorVertical: Boolean,
+  ): Boolean
+
+  /**
+   * Also shows the connected video stream in [surface], such as a thumbnail or a picture in
+   * picture, at the surface's buffer size and at most [maxFps] frames per second, 0 for every
+   * frame. Frames converted for the preview are scaled into it rather than converted again, so a
+   * capped thumbnail only costs a scale on the frames it shows. H.264 and H.265 streams cannot fill
+   * it. Remove it with [removeVideoSurfaceNative] before the surface is destroyed. Returns false
+   * when no video stream is connected or the surface was already added.
+   */
+  external fun addVideoSurfaceNative(surface: Surface, maxFps: Int): Boolean
+
+  /** Stops showing the stream in a [surface] from [addVideoSurfaceNative]. */
+  external fun removeVideoSurfaceNative(surface: Surface): Boolean
+
+  /**
+   * Moves the preview of the connected camera to [surface], or takes it off screen when null,
+   * between two frames and without stopping the stream, so recording, the frame tap and the frame
+   * server carry on. The previous surface may be released once this returns. False with no camera
+   * connected.
+   */
+  external fun setVideoSurfaceNative(surface: Surface?): Boolean
+
+  /**
+   * Whether USB completions are dispatched by an ALooper watching libusb's fds, the default, or by
+   * a thread blocked in libusb's own poll. Applies from the next time no streamer is connected.
+   */
+  external fun setUsbLooperEventsNative(enabled: Boolean)
+
+  /** AThermal_getCurrentThermalStatus: 0 for none up to 6 for shutdown, -1 when unavailable. */
+  external fun thermalStatusNative(): Int
+
+  @Volatile private var powerSaving = false
+
+  private fun audioPerformanceMode(): Int =
+      if (powerSaving) AudioTrack.PERFORMANCE_MODE_POWER_SAVING
+      else AudioTrack.PERFORMANCE_MODE_LOW_LATENCY
+
+  /**
+   * Video streams connected from now on run the camera at its slowest frame rate of at least
+   * [targetFps] and render every Nth frame when that is still faster, with longer USB transfers,
+   * the smallest isochronous altsetting that fits and frame callbacks on the USB event thread.
+   * [targetFps] 0 keeps the format's rate. Audio connected from now on plays in shared power
+   * saving mode with USB transfers of 16 ms or more. Both trade latency for CPU time and wakeups.
+   * With [rgb565Preview] frames converted on the CPU fill RGB565 window buffers, dithered, at half
+   * the memory bandwidth of RGBA, for thumbnails and other small views. The GL, YV12 and
+   * SurfaceControl previews keep their formats, and MJPEG is then decoded on the render thread.
+   */
+  external fun setVideoPowerProfileNative(enabled: Boolean, targetFps: Int, rgb565Preview: Boolean)
+
+  /**
+   * Video streams started with [connectUsbStreaming] from now on show the camera's smallest YUYV or
+   * NV12 mode first, within a couple of frame intervals, and then switch to the requested format
+   * before the startup completes. The phase breakdown times both steps, as do
+   * [StreamingStats.videoFirstFrameUs] and [StreamingStats.videoFullQualityUs]. Headless streams
+   * start in the requested format.
+   */
+  external fun setVideoFastStartNative(enabled: Boolean)
+
+  /**
+   * H.264 and H.265 cameras started from now on encode at [averageBitrate] bits per second with an
+   * IDR frame every [keyframeIntervalMs], through their UVC 1.5 encoding unit or H.264 extension
+   * unit. Zero keeps the camera's setting. The extension unit takes only the bitrate.
+   */
+  external fun setVideoEncoderSettingsNative(averageBitrate: Int, keyframeIntervalMs: Int)
+
+  fun setPowerSavingProfile(enabled: Boolean, targetFps: Int = 0, rgb565Preview: Boolean = false) {
+    powerSaving = enabled
+    setVideoPowerProfileNative(enabled, targetFps, rgb565Preview)
+  }
+
+  /**
+   * Scheduling of the [role] threads started from now on: [nice], or SCHED_FIFO at [fifoPriority]
+   * when above 0 and permitted, pinned to the performance cores when [performanceCores]. On API 33
+   * and up the capture, render and audio USB work is reported to ADPF hint sessions aiming at the
+   * frame or transfer period; a [targetWorkNs] above 0 replaces that target and one below 0 opens
+   * no session. What the threads got is in [streamingStatsSummaryString].
+   */
+  external fun setThreadPolicyNative(
+      role: Int,
+      nice: Int,
+      fifoPriority: Int,
+      performanceCores: Boolean,
+      targetWorkNs: Long,
+  )
+
+  fun setThreadPolicy(
+      role: ThreadRole,
+      nice: Int,
+      fifoPriority: Int = 0,
+      performanceCores: Boolean = true,
+      targetWorkNs: Long = 0,
+  ) = setThreadPolicyNative(role.ordinal, nice, fifoPriority, performanceCores, targetWorkNs)
+
+  /**
+   * Largest A/V skew left uncorrected, 30 ms by default. Beyond it, whichever of audio and video is
+   * ahead is delayed; the skew is published in [StreamingStats.avSyncSkewUs].
+   */
+  external fun setAvSyncMaxSkewNative(maxSkewMs: Int)
+
+  /** Direct buffer over the native stats block; use [StreamingStats.shared] to read it. */
+  external fun streamingStatsBufferNative(): ByteBuffer
+
+  /**
+   * Opens another camera next to the default video stream and previews it on [surface]. Sessions
+   * share the USB event thread and conversion workers but have their own stats, read with
+   * [StreamingStats.forSession]. Only the default streams take part in A/V sync. Returns a handle
+   * for the other session calls, or -1 on failure or when eight cameras are already open.
+   */
+  external fun openCameraSessionNative(
+      deviceFD: Int,
+      width: Int,
+      height: Int,
+      fps: Int,
+      libuvcFrameFormat: Int,
+      surface: Surface,
+  ): Int
+
+  /**
+   * Opens a session that replays the frame log at [fd] into [surface] instead of streaming a
+   * camera, [loops] times, or until stopped for 0. Frames keep their recorded pace when [realtime],
+   * otherwise they go as fast as the pipeline takes them. Start, stop and close it like a camera
+   * session; the replay rate is logged when it ends. [fd] may be closed once this returns.
+   */
+  external fun openReplaySessionNative(
+      fd: Int,
+      realtime: Boolean,
+      loops: Int,
+      surface: Surface,
+  ): Int
+
+  /**
+   * Opens the VideoStreaming interface [interfaceNumber] of the camera behind [cameraHandle], or of
+   * the default video stream when it is 0, as a session of its own. For depth and color or dual
+   * sensor cameras. Streams of a camera that are started together reserve only the isochronous
+   * bandwidth their format needs. Returns the new session's handle, or -1.
+   */
+  external fun openCameraStreamSessionNative(
+      cameraHandle: Int,
+      interfaceNumber: Int,
+      width: Int,
+      height: Int,
+      fps: Int,
+      libuvcFrameFormat: Int,
+      surface: Surface,
+  ): Int
+
+  /**
+   * Matches the frames of two streams of one camera by PTS, 0 standing for the default stream. Both
+   * must be stopped. See [cameraSessionPairingStatsNative].
+   */
+  external fun pairCameraSessionsNative(firstHandle: Int, secondHandle: Int): Boolean
+
+  /**
+   * Pairs, unpaired frames, the skew of the last pair in microseconds and the sequence numbers of
+   * its two frames, as reported by [acquireTappedFrameNative]. Empty when the stream is not paired.
+   */
+  external fun cameraSessionPairingStatsNative(handle: Int): LongArray
+
+  /**
+   * Groups the frames of two to eight camera sessions, 0 standing for the default camera, into
+   * sets captured within [toleranceUs] of each other, waiting at most [maxWaitMs] for a late
+   * camera. Zero picks half and three frame intervals of the slowest camera. The sessions must be
+   * stopped, and replace any earlier group. See [acquireSynchronizedFramesNative].
+   */
+  external fun synchronizeCameraSessionsNative(
+      handles: IntArray,
+      toleranceUs: Int,
+      maxWaitMs: Int,
+  ): Boolean
+
+  /** Ungroups the synchronized sessions, which must be stopped. */
+  external fun stopSynchronizingCameraSessionsNative(): Boolean
+
+  /**
+   * Waits up to [timeoutMs] for the next synchronized set and returns direct buffers over its
+   * frames, in the order of the handles, filling [info] as described by the SYNC_INFO_* offsets.
+   * The buffers stay valid until [releaseSynchronizedFramesNative], which must be called before
+   * the next set is acquired. Returns null on timeout.
+   */
+  external fun acquireSynchronizedFramesNative(timeoutMs: Int, info: LongArray): Array<ByteBuffer>?
+
+  /** Hands the frames of the acquired set back to the cameras. */
+  external fun releaseSynchronizedFramesNative()
+
+  /**
+   * Sets formed, frames dropped as stale, sets given up on after the wait, sets superseded before
+   * being acquired and the spread of the last set in microseconds. Empty when not synchronizing.
+   */
+  external fun frameSynchronizerStatsNative(): LongArray
+
+  /** Offsets into the info of [acquireSynchronizedFramesNative]. */
+  const val SYNC_INFO_SET_NUMBER = 0
+  const val SYNC_INFO_SPREAD_NS = 1
+  /** First per frame value, each frame taking SYNC_INFO_FRAME_LENGTH of the following ones. */
+  const val SYNC_INFO_FRAMES = 2
+  const val SYNC_INFO_FRAME_CAPTURE_NS = 0
+  const val SYNC_INFO_FRAME_SEQUENCE = 1
+  const val SYNC_INFO_FRAME_WIDTH = 2
+  const val SYNC_INFO_FRAME_HEIGHT = 3
+  const val SYNC_INFO_FRAME_FORMAT = 4
+  const val SYNC_INFO_FRAME_BYTES = 5
+  const val SYNC_INFO_FRAME_LENGTH = 6
+
+  /** UVC request codes for [getUvcControlNative], from the UVC specification. */
+  const val UVC_GET_CUR = 0x81
+  const val UVC_GET_MIN = 0x82
+  const val UVC_GET_MAX = 0x83
+  const val UVC_GET_RES = 0x84
+  const val UVC_GET_LEN = 0x85
+  const val UVC_GET_INFO = 0x86
+  const val UVC_GET_DEF = 0x87
+
+  /**
+   * Gets the result of a camera control request, a libuvc uvc_error_t, and the answer of a GET.
+   * Called on the USB event thread, or before the request returns when the answer was cached; it
+   * must return quickly.
+   */
+  fun interface UvcControlListener {
+    fun onUvcControlComplete(result: Int, data: ByteArray?)
+  }
+
+  /**
+   * IDs of the camera terminal and processing unit of the camera streamed by [handle], 0 for the
+   * default stream, zero for one the camera lacks. Null when there is no such stream.
+   */
+  external fun uvcControlUnitsNative(handle: Int): IntArray?
+
+  /**
+   * Queues a SET_CUR of [value] to control [selector] of terminal or [unit] without waiting for the
+   * camera. A SET_CUR of the same control that was not sent yet is replaced, and its listener gets
+   * this one's result.
+   */
+  external fun setUvcControlNative(
+      handle: Int,
+      unit: Int,
+      selector: Int,
+      value: ByteArray,
+      listener: UvcControlListener?,
+  ): Boolean
+
+  /**
+   * Queues a [request], one of the UVC_GET codes, for [length] bytes. Answers to all but
+   * [UVC_GET_CUR] are cached while the camera is open.
+   */
+  external fun getUvcControlNative(
+      handle: Int,
+      unit: Int,
+      selector: Int,
+      request: Int,
+      length: Int,
+      listener: UvcControlListener?,
+  ): Boolean
+
+  /**
+   * Told by [requestSnapshotNative] whether the bitmap now holds a frame. Called on a native
+   * thread.
+   */
+  fun interface SnapshotListener {
+    fun onSnapshot(ok: Boolean)
+  }
+
+  /**
+   * Fills [bitmap], ARGB_8888 of any size, from the next previewed frame of [handle], 0 for the
+   * default stream, scaled to the bitmap. Returns without waiting and never delays the preview.
+   * False, without calling [listener], when a snapshot is already pending or the stream is H.264 or
+   * H.265. The bitmap must not be recycled before [listener] is called.
+   */
+  external fun requestSnapshotNative(
+      handle: Int,
+      bitmap: Bitmap,
+      listener: SnapshotListener,
+  ): Boolean
+
+  /**
+   * Gets the JPEG of [requestJpegSnapshotNative], [width] x [height], or false and null [jpeg]
+   * when the frame could not be converted or encoded. Called on a native thread at background
+   * priority.
+   */
+  fun interface JpegSnapshotListener {
+    fun onJpegSnapshot(ok: Boolean, width: Int, height: Int, jpeg: ByteArray?)
+  }
+
+  /**
+   * Encodes the next captured frame of [handle], 0 for the default stream, to a JPEG of [quality]
+   * 0-100, downscaled to [width] x [height] (0 keeps the capture size). The frame is converted and
+   * encoded natively off the streaming threads, so neither the UI nor the preview waits for it.
+   * False, without calling [listener], when a snapshot is already pending or the stream is H.264
+   * or H.265.
+   */
+  external fun requestJpegSnapshotNative(
+      handle: Int,
+      width: Int,
+      height: Int,
+      quality: Int,
+      listener: JpegSnapshotListener,
+  ): Boolean
+
+  /**
+   * Gets a still from [captureStillNative]: JPEG for MJPEG streams, the camera's raw payload for
+   * uncompressed ones. [data] is null and the size zero when the capture failed or timed out.
+   * Called on a native thread; it must return quickly.
+   */
+  fun interface StillCaptureListener {
+    fun onStillCaptured(ok: Boolean, width: Int, height: Int, data: ByteArray?)
+  }
+
+  /**
+   * Negotiates [width] x [height] stills, UVC still method 2 or 3, next to the stream of
+   * [handle], 0 for the default stream. The preview keeps its format; a method 2 camera's running
+   * stream restarts once to make room for the larger frames. A format switch disables it.
+   */
+  external fun enableStillCaptureNative(handle: Int, width: Int, height: Int): Boolean
+
+  /**
+   * Triggers a still on the running stream of [handle] and returns without waiting for it. False
+   * when stills are not enabled or one is still pending; otherwise [listener] is called once.
+   */
+  external fun captureStillNative(handle: Int, listener: StillCaptureListener): Boolean
+
+  /** Adds the session camera's microphone, played like [connectUsbAudioStreamingNative]'s. */
+  external fun connectCameraSessionAudioNative(
+      handle: Int,
+      deviceFD: Int,
+      jAudioFormat: Int,
+      samplingFrequency: Int,
+      subFrameSize: Int,
+      channelCount: Int,
+      jAudioPerfMode: Int,
+      outputFramesPerBuffer: Int,
+      exclusive: Boolean,
+      nativeSampleRate: Int,
+  ): Boolean
+
+  external fun startCameraSessionNative(handle: Int): Boolean
+
+  external fun stopCameraSessionNative(handle: Int)
+
+  /** Stops the session if needed and releases its streamers and preview surface. */
+  external fun closeCameraSessionNative(handle: Int)
+
+  /** Null when [handle] is not an open session. */
+  external fun cameraSessionStatsBufferNative(handle: Int): ByteBuffer?
+
+  /** Stats handle of the session for the getters above, 0 when [handle] is not an open session. */
+  external fun cameraSessionStatsHandleNative(handle: Int): Long
+
+  external fun cameraSessionStatsSummaryNative(handle: Int): String
+
+  /** Like [streamingLatencyPercentilesNative], for the session's video stream. */
+  external fun cameraSessionLatencyPercentilesNative(handle: Int): LongArray
+
+  /**
+   * Writes the execution profile gathered so far to [path], as a .profraw file for
+   * `llvm-profdata merge`. Only does anything in a USB_VIDEO_PGO=generate build, false otherwise.
+   */
+  external fun writeProfileNative(path: String): Boolean
 }
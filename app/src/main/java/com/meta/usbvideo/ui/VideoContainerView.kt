@@ -18,7 +18,9 @@ package com.meta.usbvideo.ui
 import android.content.Context
 import android.util.AttributeSet
 import android.view.Gravity
+import android.view.SurfaceView
 import android.view.TextureView
+import android.view.View
 import android.widget.FrameLayout
 import kotlin.math.abs
 
@@ -28,16 +30,32 @@ import kotlin.math.abs
  */
 class VideoContainerView(context: Context, attrs: AttributeSet) : FrameLayout(context, attrs) {
 
-  private var videoView: TextureView? = null
+  private var videoView: View? = null
 
   fun addVideoTextureView(videoView: TextureView, width: Int, height: Int) {
     this.videoView = videoView
     addView(videoView, FrameLayout.LayoutParams(width, height, Gravity.CENTER))
   }
 
+  /**
+   * Fills the container with [videoView]. Unlike a TextureView it is not scaled: the native side
+   * sizes its buffers to the frames and the compositor scales them to the view.
+   */
+  fun addVideoSurfaceView(videoView: SurfaceView) {
+    this.videoView = videoView
+    addView(
+        videoView,
+        FrameLayout.LayoutParams(
+            FrameLayout.LayoutParams.MATCH_PARENT,
+            FrameLayout.LayoutParams.MATCH_PARENT,
+            Gravity.CENTER,
+        ),
+    )
+  }
+
   override fun onLayout(changed: Boolean, left: Int, top: Int, right: Int, bottom: Int) {
     super.onLayout(changed, left, top, right, bottom)
-    val videoView = this.videoView ?: return
+    val videoView = this.videoView as? TextureView ?: return
     val width = videoView.width
     val height = videoView.height
     if (width > 0 && height > 0) {
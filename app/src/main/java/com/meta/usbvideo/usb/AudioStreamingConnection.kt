@@ -19,8 +19,8 @@ import android.hardware.usb.UsbDevice
 import android.hardware.usb.UsbDeviceConnection
 import android.media.AudioFormat
 import android.util.Log
+import com.meta.usbvideo.StreamerCommand
 import com.meta.usbvideo.UsbVideoNativeLibrary
-import com.meta.usbvideo.eventloop.EventLooper
 import java.io.Closeable
 import java.lang.Exception
 import java.nio.ByteBuffer
@@ -32,6 +32,13 @@ private const val USB_SUBCLASS_AUDIO_STREAMING = 0x02
 private const val UAC_FORMAT_TYPE_I_PCM = 0x1
 private const val UAC_FORMAT_TYPE_I_IEEE_FLOAT = 0x3
 
+// bmFormats bits of UAC 2.0 Type I formats.
+private const val UAC2_FORMAT_PCM = 0x1
+private const val UAC2_FORMAT_IEEE_FLOAT = 0x4
+// Lengths of the UAC 2.0 AS_GENERAL and Type I format descriptors.
+private const val UAC2_AS_GENERAL_LENGTH = 16
+private const val UAC2_FORMAT_TYPE_I_LENGTH = 6
+
 private const val UAC_AS_GENERAL = 0x1
 private const val UAC_AS_FORMAT = 0x2
 
@@ -79,6 +86,12 @@ class AudioStreamingConnection(
 
   val hasInterfaceDescriptor: Boolean = ::interfaceDescriptor.isInitialized
 
+  /** From the format type descriptor of UAC 1.0, from AS_GENERAL of UAC 2.0. */
+  val channelCount: Int
+    get() =
+        if (generalDescriptor.isUac2) generalDescriptor.bNrChannels
+        else formatTypeDescriptor.bNrChannels
+
   val supportedAudioFormat: Int? =
       if (::generalDescriptor.isInitialized && generalDescriptor.isSupportedFormat()) {
         generalDescriptor.toAudioFormat()
@@ -118,8 +131,10 @@ class AudioStreamingConnection(
 
   override fun close() {
     Log.e(TAG, "close: disconnectUsbAudioStreamingNative", )
-    EventLooper.post { UsbVideoNativeLibrary.disconnectUsbAudioStreamingNative() }
-    usbDeviceConnection.close()
+    // Closed once the streamer let go of it.
+    UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.DisconnectAudio).invokeOnCompletion {
+      usbDeviceConnection.close()
+    }
   }
 }
 
@@ -157,14 +172,38 @@ fun Descriptor.isAudioStreamingFormatTypeDescriptor(): Boolean {
  * wFormatTag               : 0x0001 (PCM)
  * Data (HexDump)           : 07 24 01 02 01 01 00                              .$.....
  * </pre>
+ *
+ * UAC 2.0 devices have a longer one, with bmControls, bFormatType and bmFormats in place of bDelay
+ * and wFormatTag, followed by bNrChannels, bmChannelConfig and iChannelNames. The first format of
+ * bmFormats is kept as [wFormatTag].
  */
 class AudioStreamingGeneralDescriptor(pack: ByteBuffer) {
   val bLength: Int = pack.getBInt()
   val bDescriptorType: Int = pack.getBInt()
   val bDescriptorSubtype: Int = pack.getBInt()
   val bTerminalLink: Int = pack.getBInt()
-  val bDelay: Int = pack.getBInt()
-  val wFormatTag: Int = pack.getWInt()
+  val isUac2: Boolean = bLength >= UAC2_AS_GENERAL_LENGTH
+  val bDelay: Int = if (isUac2) 0 else pack.getBInt()
+  val wFormatTag: Int
+  val bNrChannels: Int
+
+  init {
+    if (isUac2) {
+      pack.getBInt() // bmControls
+      pack.getBInt() // bFormatType
+      val bmFormats = pack.getInt()
+      wFormatTag =
+          when {
+            bmFormats and UAC2_FORMAT_PCM != 0 -> UAC_FORMAT_TYPE_I_PCM
+            bmFormats and UAC2_FORMAT_IEEE_FLOAT != 0 -> UAC_FORMAT_TYPE_I_IEEE_FLOAT
+            else -> 0
+          }
+      bNrChannels = pack.getBInt()
+    } else {
+      wFormatTag = pack.getWInt()
+      bNrChannels = 0
+    }
+  }
 
   fun isSupportedFormat(): Boolean =
       (wFormatTag == UAC_FORMAT_TYPE_I_PCM || wFormatTag == UAC_FORMAT_TYPE_I_IEEE_FLOAT)
@@ -198,14 +237,17 @@ class AudioStreamingFormatTypeDescriptor(pack: ByteBuffer) {
   val bDescriptorType: Int = pack.getBInt()
   val bDescriptorSubtype: Int = pack.getBInt()
   val bFormatType: Int = pack.getBInt()
-  val bNrChannels: Int = pack.getBInt()
+  // UAC 2.0 has bSubslotSize and bBitResolution only; channels are in AS_GENERAL, and the rates
+  // belong to the clock source, which the native side asks.
+  private val isUac2: Boolean = bLength == UAC2_FORMAT_TYPE_I_LENGTH
+  val bNrChannels: Int = if (isUac2) 0 else pack.getBInt()
   val bSubFrameSize: Int = pack.getBInt() // bytes per audio subFrame
   val bBitResolution: Int = pack.getBInt() // bits per sample
-  val bSamFreqType: Int = pack.getBInt()
+  val bSamFreqType: Int = if (isUac2) 0 else pack.getBInt()
   val tSamFreq: IntArray =
-      if (bSamFreqType == 0) {
-        intArrayOf(pack.getTInt(), pack.getTInt())
-      } else {
-        IntArray(bSamFreqType) { pack.getTInt() }
+      when {
+        isUac2 -> IntArray(0)
+        bSamFreqType == 0 -> intArrayOf(pack.getTInt(), pack.getTInt())
+        else -> IntArray(bSamFreqType) { pack.getTInt() }
       }
 }
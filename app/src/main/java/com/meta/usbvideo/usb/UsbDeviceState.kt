@@ -29,6 +29,9 @@ sealed interface UsbDeviceState {
 
   class Detached(val usbDevice: UsbDevice) : UsbDeviceState
 
+  /** Detached while streaming; the native streamers wait for the device to come back. */
+  class Reconnecting(val usbDevice: UsbDevice) : UsbDeviceState
+
   class PermissionRequired(val usbDevice: UsbDevice) : UsbDeviceState
 
   class PermissionRequested(val usbDevice: UsbDevice) : UsbDeviceState
@@ -53,20 +56,25 @@ sealed interface UsbDeviceState {
       val videoStreamingMessage: String,
   ) : UsbDeviceState
 
+  /** [audioOnly] when the audio kept streaming and only the video comes back. */
   class StreamingRestart(
     val usbDevice: UsbDevice,
     val audioStreamingConnection: AudioStreamingConnection,
     val videoStreamingConnection: VideoStreamingConnection,
+    val audioOnly: Boolean = false,
   ) : UsbDeviceState
 
+  /** [audioOnly] stops only the video, leaving the audio monitoring running. */
   class StreamingStop(
     val usbDevice: UsbDevice,
     val audioStreamingConnection: AudioStreamingConnection,
     val videoStreamingConnection: VideoStreamingConnection,
+    val audioOnly: Boolean = false,
   ) : UsbDeviceState
   class StreamingStopped(
       val usbDevice: UsbDevice,
       val audioStreamingConnection: AudioStreamingConnection,
       val videoStreamingConnection: VideoStreamingConnection,
+      val audioOnly: Boolean = false,
   ) : UsbDeviceState
 }
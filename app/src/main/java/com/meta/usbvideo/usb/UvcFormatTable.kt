@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.meta.usbvideo.usb
+
+import android.util.Log
+import com.meta.usbvideo.UsbVideoNativeLibrary
+import java.nio.BufferUnderflowException
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+private const val TAG = "UvcFormatTable"
+
+// Layout of the native table, see UvcFormatTable.h.
+private const val TABLE_MAGIC = 0x54435655 // "UVCT"
+private const val TABLE_VERSION = 1
+private const val FORMAT_RECORD_SIZE = 32
+private const val FRAME_RECORD_SIZE = 24
+
+// A.6. Video Class-Specific VS Interface Descriptor Subtypes
+private const val UVC_VS_FORMAT_MJPEG: Int = 0x06
+
+/** A frame size of a [UvcFormat] and the frame intervals it streams at, in 100 ns units. */
+data class UvcFrame(
+    val frameIndex: Int,
+    val width: Int,
+    val height: Int,
+    /** Zero for frame based formats, which do not report it. */
+    val maxFrameBytes: Int,
+    val defaultInterval: Int,
+    /** The discrete intervals, or the minimum, maximum and step of a [continuous] range. */
+    val intervals: List<Int>,
+    val continuous: Boolean,
+) {
+  val fps: Int = if (defaultInterval > 0) 10_000_000 / defaultInterval else 0
+}
+
+/** A still image size of a [UvcFormat]. */
+data class UvcStillSize(val width: Int, val height: Int)
+
+/** A format of a VideoStreaming interface with its frame sizes, stills and color matching. */
+data class UvcFormat(
+    val interfaceNumber: Int,
+    /** bStillCaptureMethod of the interface, 0 when it has no still support. */
+    val stillCaptureMethod: Int,
+    val formatIndex: Int,
+    val fourccFormat: String,
+    val bitsPerPixel: Int,
+    val defaultFrameIndex: Int,
+    /** From the color matching descriptor, 0 when there is none. */
+    val colorPrimaries: Int,
+    val transferCharacteristics: Int,
+    val matrixCoefficients: Int,
+    val stillSizes: List<UvcStillSize>,
+    val frames: List<UvcFrame>,
+)
+
+/**
+ * Every format of a camera's VideoStreaming interfaces. [read] takes it from the parse libuvc makes
+ * when it opens the camera, which the connect that follows reuses, so the descriptors are parsed
+ * once per connect.
+ */
+class UvcFormatTable(val formats: List<UvcFormat>) {
+
+  /** One [VideoFormat] per frame size, at its default frame interval. */
+  val videoFormats: List<VideoFormat> =
+      formats.flatMap { format ->
+        format.frames.map { VideoFormat(format.fourccFormat, it.width, it.height, it.fps) }
+      }
+
+  companion object {
+    /** The table of the camera at [deviceFD], or null when libuvc cannot open it. */
+    fun read(deviceFD: Int): UvcFormatTable? =
+        UsbVideoNativeLibrary.videoFormatTableNative(deviceFD)?.let { decode(it) }
+
+    /** Decodes an encodeUvcFormatTable() blob, null when it is malformed. */
+    fun decode(table: ByteArray): UvcFormatTable? {
+      val pack = ByteBuffer.wrap(table).order(ByteOrder.LITTLE_ENDIAN)
+      return try {
+        if (pack.getInt() != TABLE_MAGIC || pack.getWInt() != TABLE_VERSION) {
+          Log.e(TAG, "Unknown format table layout")
+          return null
+        }
+        UvcFormatTable(List(pack.getWInt()) { decodeFormat(pack) })
+      } catch (e: BufferUnderflowException) {
+        Log.e(TAG, "Truncated format table", e)
+        null
+      }
+    }
+
+    private fun decodeFormat(pack: ByteBuffer): UvcFormat {
+      val start = pack.position()
+      val interfaceNumber = pack.getBInt()
+      val stillCaptureMethod = pack.getBInt()
+      val descriptorSubtype = pack.getBInt()
+      val formatIndex = pack.getBInt()
+      val fourcc = ByteArray(4).also { pack.get(it) }
+      pack.position(start + 20)
+      val bitsPerPixel = pack.getBInt()
+      val defaultFrameIndex = pack.getBInt()
+      pack.position(start + 25)
+      val colorPrimaries = pack.getBInt()
+      val transferCharacteristics = pack.getBInt()
+      val matrixCoefficients = pack.getBInt()
+      val frameCount = pack.getBInt()
+      val stillSizeCount = pack.getBInt()
+      pack.position(start + FORMAT_RECORD_SIZE)
+      val stillSizes = List(stillSizeCount) { UvcStillSize(pack.getWInt(), pack.getWInt()) }
+      val frames = List(frameCount) { decodeFrame(pack) }
+      return UvcFormat(
+          interfaceNumber,
+          stillCaptureMethod,
+          formatIndex,
+          if (descriptorSubtype == UVC_VS_FORMAT_MJPEG) "MJPG" else String(fourcc),
+          bitsPerPixel,
+          defaultFrameIndex,
+          colorPrimaries,
+          transferCharacteristics,
+          matrixCoefficients,
+          stillSizes,
+          frames,
+      )
+    }
+
+    private fun decodeFrame(pack: ByteBuffer): UvcFrame {
+      val start = pack.position()
+      val frameIndex = pack.getBInt()
+      pack.getBInt() // bmCapabilities
+      val intervalType = pack.getBInt()
+      val intervalCount = pack.getBInt()
+      val width = pack.getWInt()
+      val height = pack.getWInt()
+      val maxFrameBytes = pack.getInt()
+      val defaultInterval = pack.getInt()
+      pack.position(start + FRAME_RECORD_SIZE)
+      return UvcFrame(
+          frameIndex,
+          width,
+          height,
+          maxFrameBytes,
+          defaultInterval,
+          List(intervalCount) { pack.getInt() },
+          intervalType == 0,
+      )
+    }
+
+    /**
+     * Parses the formats of the first video function in [rawDescriptors] in Kotlin, for hosts
+     * without the native library such as unit tests. Only sizes and default intervals are read.
+     */
+    fun fromRawDescriptors(rawDescriptors: ByteArray): UvcFormatTable {
+      val formats = mutableListOf<UvcFormat>()
+      var inVideoFunction = false
+      var interfaceNumber = 0
+      var format: UvcFormat? = null
+      val frames = mutableListOf<UvcFrame>()
+      fun endFormat() {
+        format?.let { formats.add(it.copy(frames = frames.toList())) }
+        format = null
+        frames.clear()
+      }
+      fun startFormat(formatIndex: Int, fourccFormat: String, defaultFrameIndex: Int) {
+        endFormat()
+        format =
+            UvcFormat(
+                interfaceNumber,
+                stillCaptureMethod = 0,
+                formatIndex,
+                fourccFormat,
+                bitsPerPixel = 0,
+                defaultFrameIndex,
+                colorPrimaries = 0,
+                transferCharacteristics = 0,
+                matrixCoefficients = 0,
+                stillSizes = emptyList(),
+                frames = emptyList(),
+            )
+      }
+      fun addFrame(frameIndex: Int, width: Int, height: Int, maxBytes: Int, interval: Int) {
+        if (format == null) {
+          Log.e(TAG, "Found a frame descriptor without a prior format descriptor")
+          return
+        }
+        frames.add(UvcFrame(frameIndex, width, height, maxBytes, interval, listOf(interval), false))
+      }
+      for (descriptor in UsbDescriptorParser(rawDescriptors).descriptors()) {
+        when {
+          !inVideoFunction ->
+              inVideoFunction = descriptor.isIADDescriptorWithVideoStreamingFunction()
+          descriptor.isIADDescriptor() -> break
+          descriptor.isInterfaceDescriptorWithVideoStreaming() ->
+              interfaceNumber = descriptor.buffer.getBInt(descriptor.offset + 2)
+          descriptor.isVSUncompressedFormatTypeDescriptor() ->
+              VSUncompressedFormatDescriptor(descriptor.buffer).let {
+                startFormat(it.bFormatIndex, it.fourccFormat, it.bDefaultFrameIndex)
+              }
+          descriptor.isMJPEGVideoFormatDescriptor() ->
+              VSMjpegFormatDescriptor(descriptor.buffer).let {
+                startFormat(it.bFormatIndex, it.fourccFormat, it.bDefaultFrameIndex)
+              }
+          descriptor.isVSFrameBasedFormatDescriptor() ->
+              VSFrameBasedFormatDescriptor(descriptor.buffer).let {
+                startFormat(it.bFormatIndex, it.fourccFormat, it.bDefaultFrameIndex)
+              }
+          descriptor.isVSFrameBasedFrameDescriptor() ->
+              VSFrameBasedFrameDescriptor(descriptor.buffer).let {
+                addFrame(it.bFrameIndex, it.wWidth, it.wHeight, 0, it.dwDefaultFrameInterval)
+              }
+          descriptor.isVSFrameDescriptor() ->
+              VSFrameDescriptor(descriptor.buffer).let {
+                addFrame(
+                    it.bFrameIndex,
+                    it.wWidth,
+                    it.wHeight,
+                    it.dwMaxVideoFrameBufferSize,
+                    it.dwDefaultFrameInterval)
+              }
+        }
+      }
+      endFormat()
+      return UvcFormatTable(formats)
+    }
+  }
+}
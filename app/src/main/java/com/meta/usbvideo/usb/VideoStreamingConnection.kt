@@ -19,8 +19,8 @@ import android.hardware.usb.UsbDevice
 import android.hardware.usb.UsbDeviceConnection
 import android.util.Log
 import android.util.Size
+import com.meta.usbvideo.StreamerCommand
 import com.meta.usbvideo.UsbVideoNativeLibrary
-import com.meta.usbvideo.eventloop.EventLooper
 import java.io.Closeable
 import java.nio.ByteBuffer
 
@@ -39,8 +39,33 @@ private const val UVC_VS_FORMAT_UNCOMPRESSED: Int = 0x04
 private const val UVC_VS_FRAME_UNCOMPRESSED: Int = 0x05
 private const val UVC_VS_FORMAT_MJPEG: Int = 0x06
 private const val UVC_VS_FRAME_MJPEG: Int = 0x07
-
-private val SUPPORTED_VIDEO_FOURCC_FORMATS: Array<String> = arrayOf("YUY2", "NV12", "MJPG")
+private const val UVC_VS_FORMAT_FRAME_BASED: Int = 0x10
+private const val UVC_VS_FRAME_FRAME_BASED: Int = 0x11
+
+// Raw Bayer, Y16 and Z16 are the formats of machine vision and depth cameras, which usually have
+// nothing else.
+private val SUPPORTED_VIDEO_FOURCC_FORMATS: Array<String> =
+    arrayOf(
+        "YUY2",
+        "NV12",
+        "MJPG",
+        "Y16 ",
+        "BY8 ",
+        "BA81",
+        "GRBG",
+        "GBRG",
+        "RGGB",
+        "BGGR",
+        "BA10",
+        "GB10",
+        "RG10",
+        "BG10",
+        "GR16",
+        "GB16",
+        "RG16",
+        "BYR2",
+        "Z16 ",
+    )
 
 private fun aspectRatio(width: Int, height: Int): Pair<Int, Int> {
   val divisor = gcd(width, height)
@@ -49,93 +74,82 @@ private fun aspectRatio(width: Int, height: Int): Pair<Int, Int> {
 
 private fun gcd(big: Int, small: Int): Int = if (small == 0) big else gcd(small, big % small)
 
+/**
+ * The video function of a camera. Its formats come from [formatTable], by default the table libuvc
+ * parsed natively when it opened the device, see [UvcFormatTable.read].
+ */
 class VideoStreamingConnection(
     private val usbDevice: UsbDevice,
     private val usbDeviceConnection: UsbDeviceConnection,
+    val formatTable: UvcFormatTable? = UvcFormatTable.read(usbDeviceConnection.fileDescriptor),
 ) : Closeable {
   val deviceFD: Int = usbDeviceConnection.fileDescriptor
-  lateinit var iadDescriptor: IADDescriptor
-  lateinit var interfaceDescriptor: InterfaceDescriptor
-  lateinit var endpointDescriptor: EndpointDescriptor
 
-  val videoFormats: List<VideoFormat>
+  val videoFormats: List<VideoFormat> = formatTable?.videoFormats ?: emptyList()
 
   init {
-    @Suppress("CatchGeneralException")
-    videoFormats =
-        try {
-          parseRawDescriptors(usbDeviceConnection.rawDescriptors)
-        } catch (e: Exception) {
-          Log.e(TAG, "Error in parsing USB descriptors for video streaming", e)
-          emptyList<VideoFormat>()
-        }
+    if (formatTable == null) {
+      Log.e(TAG, "No video formats could be read from ${usbDevice.productName}")
+    }
     Log.i(TAG, "---- Supported video formats and frame sizes ----")
     videoFormats.forEach { Log.i(TAG, it.toString()) }
   }
 
-  private fun parseRawDescriptors(rawDescriptors: ByteArray): List<VideoFormat> {
-    Log.i(TAG, "Parsing usb descriptors of ${usbDevice.productName} for video streaming")
-    val formatsBuilder = mutableListOf<VideoFormat>()
-    var fourccFormat: String? = null
-    for (descriptor in UsbDescriptorParser(rawDescriptors).descriptors()) {
-      when {
-        !::iadDescriptor.isInitialized ->
-            if (descriptor.isIADDescriptorWithVideoStreamingFunction()) {
-              Log.i(TAG, "Found IAD descriptor with video streaming function")
-              iadDescriptor = IADDescriptor(descriptor.buffer)
-            }
-        !::interfaceDescriptor.isInitialized &&
-            descriptor.isInterfaceDescriptorAtLeastOneEndpoint() &&
-            descriptor.isInterfaceDescriptorWithVideoStreaming() -> {
-          Log.i(TAG, "Found device interface with video streaming and endpoint > 0")
-          interfaceDescriptor = InterfaceDescriptor(descriptor.buffer)
-        }
-        descriptor.isVSUncompressedFormatTypeDescriptor() -> {
-          val uncompressedFormatDescriptor = VSUncompressedFormatDescriptor(descriptor.buffer)
-          fourccFormat = uncompressedFormatDescriptor.fourccFormat
-        }
-        descriptor.isMJPEGVideoFormatDescriptor() -> {
-          val mjpegFormatDescriptor = VSMjpegFormatDescriptor(descriptor.buffer)
-          fourccFormat = mjpegFormatDescriptor.fourccFormat
-        }
-        descriptor.isVSFrameDescriptor() -> {
-          if (fourccFormat != null) {
-            val vsFrameDescriptor = VSFrameDescriptor(descriptor.buffer)
-            formatsBuilder.add(
-                VideoFormat(
-                    fourccFormat,
-                    vsFrameDescriptor.width(),
-                    vsFrameDescriptor.height(),
-                    vsFrameDescriptor.fps(),
-                ))
-          } else {
-            Log.e(TAG, "Found Frame Type Descriptor without a prior format descriptor")
-          }
-        }
-        ::interfaceDescriptor.isInitialized && !::endpointDescriptor.isInitialized ->
-            if (descriptor.isEndpointDescriptorWithDirIN()) {
-              Log.i(TAG, "Found device interface endpoint")
-              endpointDescriptor = EndpointDescriptor(descriptor.buffer)
-            }
-        ::iadDescriptor.isInitialized && descriptor.isIADDescriptor() -> {
-          return formatsBuilder.toList()
-        }
-      }
-    }
-    return formatsBuilder.toList()
-  }
-
   override fun close() {
     Log.e(TAG, "close: disconnectUsbAudioStreamingNative", )
-    EventLooper.post {
-      Log.d("VideoStreamingDescriptor", "stopUsbVideoStreamingNative")
-      UsbVideoNativeLibrary.stopUsbVideoStreamingNative()
-      UsbVideoNativeLibrary.disconnectUsbVideoStreamingNative()
+    UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.StopVideo)
+    UsbVideoNativeLibrary.postStreamerCommand(StreamerCommand.DisconnectVideo).invokeOnCompletion {
       Log.i("VideoStreamingDescriptor", "Closing video streaming descriptor")
       usbDeviceConnection.close()
     }
   }
 
+  /**
+   * The camera's modes best first for a [width] x [height] preview, ranked natively by USB
+   * bandwidth, this device's decode and convert cost and display fit. Empty when the ranking is
+   * unavailable; [findBestVideoFormat] then still picks by size alone.
+   */
+  fun rankVideoFormats(width: Int, height: Int): List<VideoFormat> {
+    val modes = UsbVideoNativeLibrary.rankVideoModesNative(deviceFD, width, height)
+    return modes
+        ?.toList()
+        ?.chunked(6)
+        ?.mapNotNull { (format, modeWidth, modeHeight, fps) ->
+          fourccFormatOf(format)?.let { VideoFormat(it, modeWidth, modeHeight, fps) }
+        }
+        ?.distinct()
+        .orEmpty()
+        .also { Log.i(TAG, "Ranked video formats for ${width}x${height}: ${it.take(3)}") }
+  }
+
+  /**
+   * What the USB path to the camera sustains, measured by streaming its highest bandwidth mode the
+   * first time the camera is seen at its bus speed, or when [reprobe] is set, and kept after that.
+   * Blocks for a few seconds while probing, so call it before streaming and off the main thread.
+   * Null when the probe could not stream.
+   */
+  fun probeThroughput(reprobe: Boolean = false): UsbThroughput? {
+    val values = UsbVideoNativeLibrary.probeUsbThroughputNative(deviceFD, 0, reprobe) ?: return null
+    val probed =
+        fourccFormatOf(values[UsbVideoNativeLibrary.THROUGHPUT_FRAME_FORMAT].toInt())?.let {
+          VideoFormat(
+              it,
+              values[UsbVideoNativeLibrary.THROUGHPUT_WIDTH].toInt(),
+              values[UsbVideoNativeLibrary.THROUGHPUT_HEIGHT].toInt(),
+              values[UsbVideoNativeLibrary.THROUGHPUT_FPS].toInt(),
+          )
+        }
+    return UsbThroughput(
+            probed,
+            values[UsbVideoNativeLibrary.THROUGHPUT_BYTES_PER_SECOND],
+            values[UsbVideoNativeLibrary.THROUGHPUT_PACKET_ERRORS_PPM] / 1e6,
+            values[UsbVideoNativeLibrary.THROUGHPUT_MILLI_FPS] / 1e3,
+            values[UsbVideoNativeLibrary.THROUGHPUT_FRAME_JITTER_US],
+            values[UsbVideoNativeLibrary.THROUGHPUT_CEILING_BYTES_PER_SECOND],
+        )
+        .also { Log.i(TAG, "USB throughput: $it") }
+  }
+
   fun findBestVideoFormat(size: Size): VideoFormat? = findBestVideoFormat(size.width, size.height)
 
   fun findBestVideoFormat(width: Int, height: Int): VideoFormat? {
@@ -252,6 +266,16 @@ fun Descriptor.isMJPEGVideoFormatDescriptor(): Boolean {
       buffer.getBInt(offset + 2) == UVC_VS_FORMAT_MJPEG
 }
 
+fun Descriptor.isVSFrameBasedFormatDescriptor(): Boolean {
+  return bDescriptorType == USB_DT_CLASSSPECIFIC_INTERFACE &&
+      buffer.getBInt(offset + 2) == UVC_VS_FORMAT_FRAME_BASED
+}
+
+fun Descriptor.isVSFrameBasedFrameDescriptor(): Boolean {
+  return bDescriptorType == USB_DT_CLASSSPECIFIC_INTERFACE &&
+      buffer.getBInt(offset + 2) == UVC_VS_FRAME_FRAME_BASED
+}
+
 fun Descriptor.isVSFrameDescriptor(): Boolean {
   return bDescriptorType == USB_DT_CLASSSPECIFIC_INTERFACE &&
       buffer.getBInt(offset + 2) in intArrayOf(UVC_VS_FRAME_UNCOMPRESSED, UVC_VS_FRAME_MJPEG)
@@ -281,11 +305,43 @@ data class VideoFormat(
       "YUY2" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_YUYV
       "MJPG" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_MJPEG
       "NV12" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_NV12
+      "H264" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_H264
+      "H265",
+      "HEVC" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_H265
+      "VP80" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_VP8
+      "VP90" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_VP9
+      "Y16 " -> LibuvcFrameFormat.UVC_FRAME_FORMAT_GRAY16
+      "BY8 " -> LibuvcFrameFormat.UVC_FRAME_FORMAT_BY8
+      "BA81" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_BA81
+      "GRBG" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SGRBG8
+      "GBRG" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SGBRG8
+      "RGGB" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SRGGB8
+      "BGGR" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SBGGR8
+      "BA10" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SGRBG10
+      "GB10" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SGBRG10
+      "RG10" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SRGGB10
+      "BG10" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SBGGR10
+      "GR16" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SGRBG16
+      "GB16" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SGBRG16
+      "RG16" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SRGGB16
+      "BYR2" -> LibuvcFrameFormat.UVC_FRAME_FORMAT_SBGGR16
+      "Z16 " -> LibuvcFrameFormat.UVC_FRAME_FORMAT_Z16
       else -> throw IllegalArgumentException("Unsupported fourcc format $fourccFormat")
     }
   }
 }
 
+/** What [VideoStreamingConnection.probeThroughput] measured with [probedFormat]. */
+data class UsbThroughput(
+    val probedFormat: VideoFormat?,
+    val bytesPerSecond: Long,
+    val packetErrorRate: Double,
+    val framesPerSecond: Double,
+    val frameJitterUs: Long,
+    /** Bytes per second modes must stay under, 0 when the path kept up with [probedFormat]. */
+    val ceilingBytesPerSecond: Long,
+)
+
 /**
  * <pre>
  *        ------- VS Uncompressed Format Type Descriptor --------
@@ -425,6 +481,112 @@ class VSFrameDescriptor(pack: ByteBuffer) {
   }
 }
 
+/**
+ * Frame Based Format Descriptor, used by H.264, H.265 and VP8 cameras. Like the uncompressed format
+ * descriptor, the first 4 bytes of guidFormat are the fourcc.
+ * <pre>
+ *        ------- VS Frame Based Format Type Descriptor -------
+ * bLength                  : 0x1C (28 bytes)
+ * bDescriptorType          : 0x24 (Video Streaming Interface)
+ * bDescriptorSubtype       : 0x10 (Format Frame Based)
+ * bFormatIndex             : 0x03 (3)
+ * bNumFrameDescriptors     : 0x01 (1)
+ * guidFormat               : {34363248-0000-0010-8000-00AA00389B71} (H264)
+ * bBitsPerPixel            : 0x10 (16 bits per pixel)
+ * bDefaultFrameIndex       : 0x01 (Index 1)
+ * bAspectRatioX            : 0x00
+ * bAspectRatioY            : 0x00
+ * bmInterlaceFlags         : 0x00
+ * bCopyProtect             : 0x00 (No restrictions)
+ * bVariableSize            : 0x01 (Variable size)
+ * Data (HexDump)           : 1C 24 10 03 01 48 32 36 34 00 00 10 00 80 00 00   .$...H264.......
+ *                            AA 00 38 9B 71 10 01 00 00 00 00 01               ..8.q.......
+ * </pre>
+ */
+class VSFrameBasedFormatDescriptor(pack: ByteBuffer) {
+  val bLength: Int = pack.getBInt()
+  val bDescriptorType: Int = pack.getBInt()
+  val bDescriptorSubtype: Int = pack.getBInt()
+  val bFormatIndex: Int = pack.getBInt()
+  val bNumFrameDescriptors: Int = pack.getBInt()
+
+  val fourccFormat: String =
+      String(byteArrayOf(pack.get(), pack.get(), pack.get(), pack.get())).also {
+        pack.position(pack.position() + 12)
+      }
+
+  val bBitsPerPixel: Int = pack.getBInt()
+  val bDefaultFrameIndex: Int = pack.getBInt()
+  val bAspectRatioX: Int = pack.getBInt()
+  val bAspectRatioY: Int = pack.getBInt()
+  val bmInterlaceFlags: Int = pack.getBInt()
+  val bCopyProtect: Int = pack.getBInt()
+  val bVariableSize: Int = pack.getBInt()
+}
+
+/**
+ * Frame Based Frame Descriptor. Unlike the uncompressed frame descriptor, there is no
+ * dwMaxVideoFrameBufferSize, so dwDefaultFrameInterval directly follows the bit rates.
+ * <pre>
+ *        ------- VS Frame Based Frame Type Descriptor -------
+ * bLength                  : 0x1E (30 bytes)
+ * bDescriptorType          : 0x24 (Video Streaming Interface)
+ * bDescriptorSubtype       : 0x11 (Frame Based)
+ * bFrameIndex              : 0x01
+ * bmCapabilities           : 0x00
+ * wWidth                   : 0x0780 (1920)
+ * wHeight                  : 0x0438 (1080)
+ * dwMinBitRate             : 0x00989680 (10000000 bps)
+ * dwMaxBitRate             : 0x01312D00 (20000000 bps)
+ * dwDefaultFrameInterval   : 0x00051615 (33.3333 ms -> 30.0000 fps)
+ * bFrameIntervalType       : 0x01 (1 discrete frame interval supported)
+ * dwBytesPerLine           : 0x00000000
+ * adwFrameInterval[1]      : 0x00051615 (33.3333 ms -> 30.0000 fps)
+ * Data (HexDump)           : 1E 24 11 01 00 80 07 38 04 80 96 98 00 00 2D 31   .$.....8......-1
+ *                            01 15 16 05 00 01 00 00 00 00 15 16 05 00         ..............
+ * </pre>
+ */
+class VSFrameBasedFrameDescriptor(pack: ByteBuffer) {
+  val bLength: Int = pack.getBInt()
+  val bDescriptorType: Int = pack.getBInt()
+  val bDescriptorSubtype: Int = pack.getBInt()
+  val bFrameIndex: Int = pack.getBInt()
+  val bmCapabilities: Int = pack.getBInt()
+  val wWidth: Int = pack.getWInt()
+  val wHeight: Int = pack.getWInt()
+  val dwMinBitRate: Int = pack.getInt()
+  val dwMaxBitRate: Int = pack.getInt()
+  val dwDefaultFrameInterval: Int = pack.getInt()
+  val bFrameIntervalType: Int = pack.getBInt()
+  val dwBytesPerLine: Int = pack.getInt()
+
+  fun fps(): Int = 10_000_000 / dwDefaultFrameInterval
+}
+
+private fun fourccFormatOf(libuvcFrameFormat: Int): String? =
+    when (LibuvcFrameFormat.entries.getOrNull(libuvcFrameFormat)) {
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_YUYV -> "YUY2"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_MJPEG -> "MJPG"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_NV12 -> "NV12"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_GRAY16 -> "Y16 "
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_BY8 -> "BY8 "
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_BA81 -> "BA81"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SGRBG8 -> "GRBG"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SGBRG8 -> "GBRG"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SRGGB8 -> "RGGB"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SBGGR8 -> "BGGR"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SGRBG10 -> "BA10"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SGBRG10 -> "GB10"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SRGGB10 -> "RG10"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SBGGR10 -> "BG10"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SGRBG16 -> "GR16"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SGBRG16 -> "GB16"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SRGGB16 -> "RG16"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_SBGGR16 -> "BYR2"
+      LibuvcFrameFormat.UVC_FRAME_FORMAT_Z16 -> "Z16 "
+      else -> null
+    }
+
 /** Must be kept in-sync with https://fburl.com/code/kzplsk2y. */
 enum class LibuvcFrameFormat {
   /** Any supported format */
@@ -465,6 +627,30 @@ enum class LibuvcFrameFormat {
   /** YUV: P010 */
   UVC_FRAME_FORMAT_P010,
 
+  /** H.265/HEVC frame based payload */
+  UVC_FRAME_FORMAT_H265,
+
+  /** VP8 frame based or UVC 1.5 VP8 payload */
+  UVC_FRAME_FORMAT_VP8,
+
+  /** VP9 frame based payload */
+  UVC_FRAME_FORMAT_VP9,
+
+  /** Raw colour mosaic images, 10 bit samples in the low bits of 16 bit words */
+  UVC_FRAME_FORMAT_SGRBG10,
+  UVC_FRAME_FORMAT_SGBRG10,
+  UVC_FRAME_FORMAT_SRGGB10,
+  UVC_FRAME_FORMAT_SBGGR10,
+
+  /** Raw colour mosaic images, 16 bit samples */
+  UVC_FRAME_FORMAT_SGRBG16,
+  UVC_FRAME_FORMAT_SGBRG16,
+  UVC_FRAME_FORMAT_SRGGB16,
+  UVC_FRAME_FORMAT_SBGGR16,
+
+  /** Depth maps of 16 bit samples */
+  UVC_FRAME_FORMAT_Z16,
+
   /** Number of formats understood */
   UVC_FRAME_FORMAT_COUNT,
 }
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.meta.usbvideo
+
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+import org.junit.Test
+
+/** Tests [EnergyMeter] */
+class EnergyMeterTests {
+  private var elapsedNs = 0L
+  private var frames = 0L
+
+  /** One second at [fps], drawing [currentUa] at 4 V. */
+  private fun sample(
+      fps: Int = 30,
+      currentUa: Long = -1_000_000,
+      charging: Boolean = false,
+  ): EnergyMeter.Sample {
+    elapsedNs += 1_000_000_000
+    frames += fps
+    return EnergyMeter.Sample(elapsedNs, currentUa, 4_000, charging, frames, 0)
+  }
+
+  @Test
+  fun `reads power and energy per frame once a window`() {
+    val meter = EnergyMeter(EnergyMeter.Config(windowSamples = 2))
+    assertNull(meter.onSample(sample()))
+    assertNull(meter.onSample(sample()))
+    val reading = assertNotNull(meter.onSample(sample()))
+    assertEquals(2.0, reading.seconds, 1e-9)
+    assertEquals(4_000.0, reading.milliwatts, 1e-6)
+    assertEquals(60L, reading.videoFrames)
+    assertEquals(4_000.0 / 30, reading.millijoulesPerFrame, 1e-6)
+  }
+
+  @Test
+  fun `integrates the current between samples`() {
+    val meter = EnergyMeter(EnergyMeter.Config(windowSamples = 1))
+    meter.onSample(sample(currentUa = 500_000))
+    val reading = assertNotNull(meter.onSample(sample(currentUa = 1_500_000)))
+    assertEquals(4_000.0, reading.milliwatts, 1e-6)
+  }
+
+  @Test
+  fun `leaves out intervals on the charger and while paused`() {
+    val meter = EnergyMeter(EnergyMeter.Config(windowSamples = 1))
+    meter.onSample(sample())
+    assertNull(meter.onSample(sample(currentUa = 2_000_000, charging = true)))
+    assertNull(meter.onSample(sample()))
+    meter.pause()
+    assertNull(meter.onSample(sample()))
+    assertNotNull(meter.onSample(sample()))
+    val session = assertNotNull(meter.sessionReading)
+    assertEquals(1.0, session.seconds, 1e-9)
+    assertEquals(4_000.0, session.milliwatts, 1e-6)
+  }
+
+  @Test
+  fun `has no energy per frame without frames`() {
+    val meter = EnergyMeter(EnergyMeter.Config(windowSamples = 1))
+    meter.onSample(sample(fps = 0))
+    val reading = assertNotNull(meter.onSample(sample(fps = 0)))
+    assertTrue(reading.millijoulesPerFrame.isNaN())
+    meter.reset()
+    assertNull(meter.sessionReading)
+  }
+}
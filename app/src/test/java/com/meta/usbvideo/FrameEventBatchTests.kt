@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.meta.usbvideo
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+import kotlin.test.assertNull
+import org.junit.Test
+
+/** Tests [FrameEventBatch] against the FrameEvent layout in FrameEventQueue.h */
+class FrameEventBatchTests {
+  private val buffer =
+      ByteBuffer.allocateDirect(2 * FrameEventBatch.RECORD_SIZE).order(ByteOrder.nativeOrder())
+
+  private fun putEvent(
+      index: Int,
+      timeNs: Long,
+      sequence: Int,
+      latencyUs: Int,
+      kind: Int,
+      cause: Int,
+  ) {
+    val offset = index * FrameEventBatch.RECORD_SIZE
+    buffer.putLong(offset, timeNs)
+    buffer.putLong(offset + 8, timeNs - 5_000_000)
+    buffer.putInt(offset + 16, sequence)
+    buffer.putInt(offset + 20, 4_000)
+    buffer.putInt(offset + 24, latencyUs)
+    buffer.put(offset + 28, kind.toByte())
+    buffer.put(offset + 29, cause.toByte())
+  }
+
+  @Test
+  fun `reads events in place`() {
+    putEvent(0, 1_000_000_000, 7, 12_000, kind = 1, cause = 0)
+    putEvent(1, 1_010_000_000, 8, 0, kind = 2, cause = 1)
+    val batch = FrameEventBatch(buffer).apply { size = 2 }
+
+    assertEquals(FrameEventKind.Rendered, batch.kind(0))
+    assertNull(batch.dropCause(0))
+    assertEquals(1_000_000_000, batch.timeNs(0))
+    assertEquals(995_000_000, batch.captureTimeNs(0))
+    assertEquals(7, batch.sequence(0))
+    assertEquals(4_000, batch.bytes(0))
+    assertEquals(12_000, batch.latencyUs(0))
+
+    assertEquals(FrameEventKind.Dropped, batch.kind(1))
+    assertEquals(FrameDropCause.WindowLockFailed, batch.dropCause(1))
+    assertEquals(8, batch.sequence(1))
+  }
+
+  @Test
+  fun `only events of the batch can be read`() {
+    val batch = FrameEventBatch(buffer).apply { size = 1 }
+    assertFailsWith<IndexOutOfBoundsException> { batch.sequence(1) }
+  }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.meta.usbvideo
+
+import com.meta.usbvideo.usb.VideoFormat
+import kotlin.test.assertEquals
+import kotlin.test.assertNull
+import org.junit.Test
+
+/** Tests [QosController] */
+class QosControllerTests {
+  private val mjpeg1080p60 = VideoFormat("MJPG", 1920, 1080, 60)
+  private val mjpeg1080p30 = VideoFormat("MJPG", 1920, 1080, 30)
+  private val mjpeg720p60 = VideoFormat("MJPG", 1280, 720, 60)
+  private val mjpeg720p30 = VideoFormat("MJPG", 1280, 720, 30)
+  private val yuyv720p5 = VideoFormat("YUY2", 1280, 720, 5)
+  private val yuyv480p30 = VideoFormat("YUY2", 640, 480, 30)
+  private val formats =
+      listOf(mjpeg1080p60, mjpeg1080p30, mjpeg720p60, mjpeg720p30, yuyv720p5, yuyv480p30)
+
+  private val config = QosController.Config(downSamples = 2, upSamples = 3, settleSamples = 0)
+
+  private var captured = 0L
+  private var rendered = 0L
+
+  /** One second at [fps] with [renderedRatio] of the frames rendered. */
+  private fun sample(
+      fps: Int,
+      renderedRatio: Double = 1.0,
+      convertUs: Long = 1_000,
+      thermalStatus: Int = 0,
+  ): QosController.Sample {
+    captured += fps
+    rendered += (fps * renderedRatio).toLong()
+    return QosController.Sample(captured, rendered, 0, convertUs, 1_000, thermalStatus)
+  }
+
+  @Test
+  fun `steps down frame rate, then size, then format`() {
+    assertEquals(mjpeg1080p30, QosController.stepDown(mjpeg1080p60, formats))
+    assertEquals(mjpeg720p30, QosController.stepDown(mjpeg1080p30, formats))
+    assertEquals(yuyv480p30, QosController.stepDown(mjpeg720p30, formats))
+    assertNull(QosController.stepDown(yuyv480p30, formats))
+  }
+
+  @Test
+  fun `steps down after pressured samples in a row and back up with headroom`() {
+    val controller = QosController(formats, mjpeg1080p60, config)
+    controller.onSample(sample(60))
+    assertNull(controller.onSample(sample(60, renderedRatio = 0.6)))
+    assertEquals(mjpeg1080p30, controller.onSample(sample(60, renderedRatio = 0.6)))
+    controller.onSwitched(mjpeg1080p30, true)
+    assertEquals(mjpeg1080p30, controller.current)
+
+    controller.onSample(sample(30))
+    assertNull(controller.onSample(sample(30)))
+    assertNull(controller.onSample(sample(30)))
+    assertEquals(mjpeg1080p60, controller.onSample(sample(30)))
+  }
+
+  @Test
+  fun `stays down while the phone is hot`() {
+    val controller = QosController(formats, mjpeg1080p60, config)
+    controller.onSample(sample(60))
+    controller.onSample(sample(60, thermalStatus = THERMAL_STATUS_SEVERE))
+    assertEquals(
+        mjpeg1080p30, controller.onSample(sample(60, thermalStatus = THERMAL_STATUS_SEVERE)))
+    controller.onSwitched(mjpeg1080p30, true)
+
+    controller.onSample(sample(30))
+    repeat(10) { assertNull(controller.onSample(sample(30, thermalStatus = 2))) }
+  }
+
+  @Test
+  fun `refused formats are skipped`() {
+    val controller = QosController(formats, mjpeg1080p60, config)
+    controller.onSample(sample(60))
+    controller.onSample(sample(60, renderedRatio = 0.5))
+    assertEquals(mjpeg1080p30, controller.onSample(sample(60, renderedRatio = 0.5)))
+    controller.onSwitched(mjpeg1080p30, false)
+    assertEquals(mjpeg1080p60, controller.current)
+
+    controller.onSample(sample(60))
+    controller.onSample(sample(60, renderedRatio = 0.5))
+    assertEquals(mjpeg720p60, controller.onSample(sample(60, renderedRatio = 0.5)))
+  }
+
+  @Test
+  fun `stays within the probed USB throughput`() {
+    // Fits 1080p30 but not 1080p60 MJPEG.
+    val limited = config.copy(maxBytesPerSecond = 40_000_000)
+    val controller = QosController(formats, mjpeg1080p60, limited)
+    controller.onSample(sample(60))
+    assertNull(controller.onSample(sample(60)))
+    assertEquals(mjpeg1080p30, controller.onSample(sample(60)))
+    controller.onSwitched(mjpeg1080p30, true)
+
+    controller.onSample(sample(30))
+    repeat(10) { assertNull(controller.onSample(sample(30))) }
+  }
+}
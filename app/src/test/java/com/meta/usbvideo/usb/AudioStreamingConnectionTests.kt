@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.meta.usbvideo.usb
+
+import android.hardware.usb.UsbDevice
+import android.hardware.usb.UsbDeviceConnection
+import android.media.AudioFormat
+import android.util.Log
+import io.mockk.MockKAnnotations
+import io.mockk.every
+import io.mockk.impl.annotations.MockK
+import io.mockk.mockkStatic
+import kotlin.test.assertContentEquals
+import kotlin.test.assertEquals
+import kotlin.test.assertTrue
+import org.junit.Before
+import org.junit.Test
+
+// Audio streaming interface of a UAC 1.0 device: 16 bit stereo at 48 kHz.
+private const val Uac1Stereo48k: String =
+    """
+09 02 3D 00 01 01 00 80 32 09 04 01 00 00 01 02
+00 00 09 04 01 01 01 01 02 00 00 07 24 01 02 01
+01 00 0B 24 02 01 02 02 10 01 80 BB 00 09 05 82
+0D C0 00 01 00 00 07 25 01 01 00 00 00
+"""
+
+// Audio streaming interface of a UAC 2.0 device: 24 bit stereo, rates of its clock source.
+private const val Uac2Stereo24Bit: String =
+    """
+09 02 40 00 01 01 00 80 32 09 04 01 00 00 01 02
+20 00 09 04 01 01 01 01 02 20 00 10 24 01 03 00
+01 01 00 00 00 02 03 00 00 00 00 06 24 02 01 03
+18 07 05 81 05 26 01 04 08 25 01 00 00 00 00 00
+"""
+
+/** Tests [AudioStreamingConnection] */
+class AudioStreamingConnectionTests {
+  @MockK(relaxed = true) private lateinit var usbDevice: UsbDevice
+  @MockK(relaxed = true) private lateinit var usbDeviceConnection: UsbDeviceConnection
+
+  @Before
+  fun setUp() {
+    MockKAnnotations.init(this)
+    mockkStatic(Log::class)
+    every { Log.i(any(), any()) } returns 0
+    every { Log.e(any(), any()) } returns 0
+    every { Log.e(any(), any(), any()) } returns 0
+  }
+
+  @Test
+  fun `UAC 1_0 format type descriptor gives channels and rates`() {
+    val connection = audioStreamingConnection(Uac1Stereo48k)
+    assertTrue(connection.supportsAudioStreaming)
+    assertEquals(expected = AudioFormat.ENCODING_PCM_16BIT, connection.supportedAudioFormat)
+    assertEquals(expected = 2, connection.channelCount)
+    assertEquals(expected = 2, connection.formatTypeDescriptor.bSubFrameSize)
+    assertContentEquals(expected = intArrayOf(48_000), connection.formatTypeDescriptor.tSamFreq)
+  }
+
+  @Test
+  fun `UAC 2_0 descriptors give channels from AS_GENERAL and no rates`() {
+    val connection = audioStreamingConnection(Uac2Stereo24Bit)
+    assertTrue(connection.supportsAudioStreaming)
+    assertTrue(connection.generalDescriptor.isUac2)
+    assertEquals(expected = AudioFormat.ENCODING_PCM_16BIT, connection.supportedAudioFormat)
+    assertEquals(expected = 2, connection.channelCount)
+    assertEquals(expected = 3, connection.formatTypeDescriptor.bSubFrameSize)
+    assertEquals(expected = 24, connection.formatTypeDescriptor.bBitResolution)
+    assertEquals(expected = 0, connection.formatTypeDescriptor.tSamFreq.size)
+  }
+
+  private fun audioStreamingConnection(usbDescriptor: String): AudioStreamingConnection {
+    every { usbDeviceConnection.rawDescriptors } returns
+        usbDescriptor
+            .filter { it.isDigit() || it.isLetter() }
+            .chunked(2)
+            .map { it.toInt(16).toByte() }
+            .toByteArray()
+    return AudioStreamingConnection(usbDevice, usbDeviceConnection)
+  }
+}
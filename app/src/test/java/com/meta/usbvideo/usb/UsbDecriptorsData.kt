@@ -252,3 +252,17 @@ val CamLink: String =
 00 00 00
 """
     .trimIndent()
+
+// Synthetic MJPEG plus H.264 frame based camera, see VSFrameBasedFormatDescriptor.
+val FrameBasedH264: String =
+  """
+08 0B 00 02 0E 03 00 02 09 04 01 01 01 0E 02 00
+00 07 05 81 05 00 0C 01 0B 24 06 01 01 01 01 00
+00 00 00 1E 24 07 01 00 80 07 38 04 00 00 77 01
+00 00 77 01 00 48 3F 00 15 16 05 00 01 15 16 05
+00 1C 24 10 02 01 48 32 36 34 00 00 10 00 80 00
+00 AA 00 38 9B 71 10 01 00 00 00 00 01 1E 24 11
+01 00 80 07 38 04 80 96 98 00 00 2D 31 01 15 16
+05 00 01 00 00 00 00 15 16 05 00
+"""
+    .trimIndent()
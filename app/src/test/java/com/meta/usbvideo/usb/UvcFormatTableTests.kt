@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.meta.usbvideo.usb
+
+import android.util.Log
+import io.mockk.every
+import io.mockk.mockkStatic
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import kotlin.test.assertEquals
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import org.junit.Before
+import org.junit.Test
+
+/** Tests [UvcFormatTable] */
+class UvcFormatTableTests {
+  @Before
+  fun setUp() {
+    mockkStatic(Log::class)
+    every { Log.e(any(), any()) } returns 0
+    every { Log.e(any(), any(), any()) } returns 0
+  }
+
+  @Test
+  fun `decodes formats, stills and frames of the native table`() {
+    val table = assertNotNull(UvcFormatTable.decode(nativeTable()))
+    assertEquals(expected = 2, table.formats.size)
+
+    val mjpeg = table.formats[0]
+    assertEquals(expected = "MJPG", mjpeg.fourccFormat)
+    assertEquals(expected = 1, mjpeg.interfaceNumber)
+    assertEquals(expected = 2, mjpeg.stillCaptureMethod)
+    assertEquals(expected = 1, mjpeg.colorPrimaries)
+    assertEquals(expected = listOf(UvcStillSize(3840, 2160)), mjpeg.stillSizes)
+    assertEquals(expected = listOf(333_333, 666_666), mjpeg.frames.single().intervals)
+    assertEquals(expected = 30, mjpeg.frames.single().fps)
+
+    val yuy2 = table.formats[1]
+    assertEquals(expected = "YUY2", yuy2.fourccFormat)
+    assertEquals(expected = true, yuy2.frames.single().continuous)
+    assertEquals(expected = listOf(166_666, 1_000_000, 166_666), yuy2.frames.single().intervals)
+
+    assertEquals(
+        expected = listOf(VideoFormat("MJPG", 1920, 1080, 30), VideoFormat("YUY2", 640, 480, 60)),
+        table.videoFormats)
+  }
+
+  @Test
+  fun `rejects unknown and truncated tables`() {
+    val table = nativeTable()
+    assertNull(UvcFormatTable.decode(table.copyOf().also { it[0] = 0 }))
+    assertNull(UvcFormatTable.decode(table.copyOf(table.size - 4)))
+  }
+
+  /** An MJPEG format with a still size and two discrete intervals, a continuous YUY2 one. */
+  private fun nativeTable(): ByteArray {
+    val pack = ByteBuffer.allocate(256).order(ByteOrder.LITTLE_ENDIAN)
+    pack.put("UVCT".toByteArray()).putShort(1).putShort(2)
+    putFormat(pack, subtype = 0x06, fourcc = ByteArray(4), colorPrimaries = 1, stillSizes = 1)
+    pack.putShort(3840).putShort(2160)
+    putFrame(pack, 1920, 1080, defaultInterval = 333_333, intervalType = 2, intervals = 2)
+    pack.putInt(333_333).putInt(666_666)
+    putFormat(
+        pack, subtype = 0x04, fourcc = "YUY2".toByteArray(), colorPrimaries = 0, stillSizes = 0)
+    putFrame(pack, 640, 480, defaultInterval = 166_666, intervalType = 0, intervals = 3)
+    pack.putInt(166_666).putInt(1_000_000).putInt(166_666)
+    return pack.array().copyOf(pack.position())
+  }
+
+  private fun putFormat(
+      pack: ByteBuffer,
+      subtype: Int,
+      fourcc: ByteArray,
+      colorPrimaries: Int,
+      stillSizes: Int,
+  ) {
+    pack.put(1).put(2).put(subtype.toByte()).put(1)
+    pack.put(fourcc).put(ByteArray(12))
+    pack.put(16).put(1).put(16).put(9).put(0)
+    pack.put(colorPrimaries.toByte()).put(1).put(4)
+    pack.put(1).put(stillSizes.toByte()).put(0).put(0)
+  }
+
+  private fun putFrame(
+      pack: ByteBuffer,
+      width: Int,
+      height: Int,
+      defaultInterval: Int,
+      intervalType: Int,
+      intervals: Int,
+  ) {
+    pack.put(1).put(0).put(intervalType.toByte()).put(intervals.toByte())
+    pack.putShort(width.toShort()).putShort(height.toShort())
+    pack.putInt(width * height * 2).putInt(defaultInterval).putInt(0).putInt(0)
+  }
+}
@@ -69,6 +69,32 @@ class VideoStreamingConnectionTests {
     videoFormatAndFrameTester(CamLink, "YUY2", 1920, 1080, 59)
   }
 
+  @Test
+  fun `Frame based H264 descriptor test`() {
+    val videoStreamingConnection = videoStreamingConnection(FrameBasedH264)
+    val videoFormat: VideoFormat? = videoStreamingConnection.matchFormat("H264")
+    assertNotNull(videoFormat)
+    assertEquals(expected = 1920, videoFormat.width)
+    assertEquals(expected = 1080, videoFormat.height)
+    assertEquals(expected = 30, videoFormat.fps)
+    assertEquals(
+        expected = LibuvcFrameFormat.UVC_FRAME_FORMAT_H264, videoFormat.toLibuvcFrameFormat())
+    // H.264 is never picked automatically.
+    assertEquals(
+        expected = "MJPG", videoStreamingConnection.findBestVideoFormat(1920, 1080)?.fourccFormat)
+  }
+
+  private fun videoStreamingConnection(usbDescriptor: String): VideoStreamingConnection {
+    val rawDescriptors =
+        usbDescriptor
+          .filter { it.isDigit() || it.isLetter() }
+          .chunked(2)
+          .map { it.toInt(16).toByte() }
+          .toByteArray()
+    return VideoStreamingConnection(
+        usbDevice, usbDeviceConnection, UvcFormatTable.fromRawDescriptors(rawDescriptors))
+  }
+
   private fun videoFormatAndFrameTester(
     usbDescriptor: String,
     fourccFormat: String,
@@ -76,14 +102,7 @@ class VideoStreamingConnectionTests {
     height: Int,
     fps: Int,
   ) {
-    every { usbDeviceConnection.rawDescriptors } returns
-        usbDescriptor
-          .filter { it.isDigit() || it.isLetter() }
-          .chunked(2)
-          .map { it.toInt(16).toByte() }
-          .toByteArray()
-
-    val videoStreamingConnection = VideoStreamingConnection(usbDevice, usbDeviceConnection)
+    val videoStreamingConnection = videoStreamingConnection(usbDescriptor)
     val videoFormat: VideoFormat? = videoStreamingConnection.findBestVideoFormat(width, height)
     assertNotNull(videoFormat)
     assertEquals(expected = width, videoFormat.width)